@@ -0,0 +1,350 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * End-to-end latency benchmark for KmsKeyring, against LatencyKmsClient rather than real KMS.
+ *
+ * Each scenario builds a CMM over KMS keyrings whose simulated regions have the given latency
+ * distributions, throttling and error rates, then has worker threads encrypt and decrypt small
+ * messages through it for a while. Results are written to stdout as JSON lines, one object per
+ * (operation, scenario) pair, with latency percentiles and the number of KMS calls made, so that
+ * changes such as hedging, fan-out or prefetching can be compared without calling KMS.
+ *
+ * Usage: kms_keyring_bench [--quick] [--min-time-ms N] [--threads N]
+ */
+
+#include <aws/core/Aws.h>
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/cpp/kms_keyring.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/multi_keyring.h>
+#include <aws/cryptosdk/session.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "latency_kms_client.h"
+
+using Aws::Cryptosdk::Testing::LatencyClientSupplier;
+using Aws::Cryptosdk::Testing::LatencyProfile;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+static const char *CLASS_TAG = "KmsKeyringBench";
+
+static const char *const KEY_US_WEST_2 = "arn:aws:kms:us-west-2:111122223333:key/00000000-0000-0000-0000-000000000001";
+static const char *const KEY_EU_WEST_1 = "arn:aws:kms:eu-west-1:111122223333:key/00000000-0000-0000-0000-000000000002";
+static const char *const KEY_AP_SOUTHEAST_2 =
+    "arn:aws:kms:ap-southeast-2:111122223333:key/00000000-0000-0000-0000-000000000003";
+
+static const size_t MESSAGE_SIZE = 1024;
+
+/* A healthy region, one with a long tail, and one which throttles */
+static const LatencyProfile STEADY    = { microseconds(5000), microseconds(15000), 0, 0 };
+static const LatencyProfile LONG_TAIL = { microseconds(5000), microseconds(150000), 0, 0 };
+static const LatencyProfile THROTTLED = { microseconds(5000), microseconds(15000), 0.05, 0.01 };
+static const LatencyProfile FAR_AWAY  = { microseconds(60000), microseconds(120000), 0, 0 };
+
+enum class Topology {
+    /* One KmsKeyring with one key */
+    SINGLE,
+    /* One KmsKeyring with keys in three regions */
+    MULTI_REGION,
+    /* A multi-keyring of KmsKeyrings, one per region */
+    MULTI_KEYRING,
+    /* A caching CMM over a single-key KmsKeyring */
+    CACHING_CMM
+};
+
+struct Scenario {
+    const char *name;
+    Topology topology;
+    LatencyProfile profile;
+    /* Applies the keyring options under test */
+    void (*configure)(Aws::Cryptosdk::KmsKeyring::Builder &builder);
+};
+
+static void NoOptions(Aws::Cryptosdk::KmsKeyring::Builder &) {}
+
+static void Hedged(Aws::Cryptosdk::KmsKeyring::Builder &builder) {
+    builder.WithHedging(0.9, 0.1);
+}
+
+static void FanOut(Aws::Cryptosdk::KmsKeyring::Builder &builder) {
+    builder.WithDecryptConcurrency(3);
+}
+
+static void Prefetched(Aws::Cryptosdk::KmsKeyring::Builder &builder) {
+    builder.WithDataKeyPrefetch(4, milliseconds(60000));
+}
+
+static void Retried(Aws::Cryptosdk::KmsKeyring::Builder &builder) {
+    builder.WithRetryBudget(0.2);
+}
+
+static const Scenario scenarios[] = {
+    { "single", Topology::SINGLE, STEADY, NoOptions },
+    { "single_long_tail", Topology::SINGLE, LONG_TAIL, NoOptions },
+    { "single_long_tail_hedged", Topology::SINGLE, LONG_TAIL, Hedged },
+    { "single_long_tail_prefetch", Topology::SINGLE, LONG_TAIL, Prefetched },
+    { "single_throttled", Topology::SINGLE, THROTTLED, NoOptions },
+    { "single_throttled_retry", Topology::SINGLE, THROTTLED, Retried },
+    { "multi_region", Topology::MULTI_REGION, STEADY, NoOptions },
+    { "multi_region_fan_out", Topology::MULTI_REGION, STEADY, FanOut },
+    { "multi_keyring", Topology::MULTI_KEYRING, STEADY, NoOptions },
+    { "caching_cmm_long_tail", Topology::CACHING_CMM, LONG_TAIL, NoOptions },
+};
+
+struct BenchConfig {
+    milliseconds min_time;
+    size_t threads;
+};
+
+/* Latencies of the messages which succeeded, and the number which failed */
+struct OpResult {
+    std::vector<uint64_t> latencies_us;
+    uint64_t failures = 0;
+};
+
+static aws_cryptosdk_keyring *BuildKeyring(
+    const Scenario &scenario,
+    const std::shared_ptr<LatencyClientSupplier> &supplier,
+    const Aws::String &generator,
+    const Aws::Vector<Aws::String> &additional = {}) {
+    Aws::Cryptosdk::KmsKeyring::Builder builder;
+    builder.WithClientSupplier(supplier);
+    scenario.configure(builder);
+    return builder.Build(generator, additional);
+}
+
+static aws_cryptosdk_cmm *BuildCmm(
+    aws_allocator *alloc, const Scenario &scenario, const std::shared_ptr<LatencyClientSupplier> &supplier) {
+    aws_cryptosdk_keyring *kr = nullptr;
+    aws_cryptosdk_cmm *cmm    = nullptr;
+
+    switch (scenario.topology) {
+        case Topology::SINGLE:
+        case Topology::CACHING_CMM: kr = BuildKeyring(scenario, supplier, KEY_US_WEST_2); break;
+        case Topology::MULTI_REGION:
+            kr = BuildKeyring(scenario, supplier, KEY_US_WEST_2, { KEY_EU_WEST_1, KEY_AP_SOUTHEAST_2 });
+            break;
+        case Topology::MULTI_KEYRING: {
+            aws_cryptosdk_keyring *generator = BuildKeyring(scenario, supplier, KEY_US_WEST_2);
+            aws_cryptosdk_keyring *child     = BuildKeyring(scenario, supplier, KEY_EU_WEST_1);
+            if (generator && child) {
+                kr = aws_cryptosdk_multi_keyring_new(alloc, generator);
+                if (kr && aws_cryptosdk_multi_keyring_add_child(kr, child)) {
+                    aws_cryptosdk_keyring_release(kr);
+                    kr = nullptr;
+                }
+            }
+            if (generator) aws_cryptosdk_keyring_release(generator);
+            if (child) aws_cryptosdk_keyring_release(child);
+            break;
+        }
+    }
+    if (!kr) return nullptr;
+
+    if (scenario.topology == Topology::CACHING_CMM) {
+        aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+        if (cache) {
+            cmm = aws_cryptosdk_caching_cmm_new_from_keyring(alloc, cache, kr, NULL, 60, AWS_TIMESTAMP_SECS);
+            aws_cryptosdk_materials_cache_release(cache);
+        }
+    } else {
+        cmm = aws_cryptosdk_default_cmm_new(alloc, kr);
+    }
+    aws_cryptosdk_keyring_release(kr);
+
+    return cmm;
+}
+
+/* Runs one whole message through session, returning its latency, or -1 if it failed */
+static int64_t RunMessage(
+    aws_cryptosdk_session *session,
+    aws_cryptosdk_mode mode,
+    uint8_t *out,
+    size_t out_cap,
+    size_t *out_len,
+    const uint8_t *in,
+    size_t in_len) {
+    size_t in_read;
+    auto start = std::chrono::steady_clock::now();
+
+    if (aws_cryptosdk_session_reset(session, mode)) return -1;
+    if (mode == AWS_CRYPTOSDK_ENCRYPT && aws_cryptosdk_session_set_message_size(session, in_len)) return -1;
+    if (aws_cryptosdk_session_process(session, out, out_cap, out_len, in, in_len, &in_read)) return -1;
+    if (!aws_cryptosdk_session_is_done(session) || in_read != in_len) return -1;
+
+    return std::chrono::duration_cast<microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void Worker(
+    aws_allocator *alloc,
+    aws_cryptosdk_cmm *cmm,
+    std::chrono::steady_clock::time_point deadline,
+    OpResult *encrypt,
+    OpResult *decrypt) {
+    std::vector<uint8_t> pt(MESSAGE_SIZE), ct(MESSAGE_SIZE + 4096), pt_out(MESSAGE_SIZE);
+    size_t ct_len, pt_len;
+
+    for (size_t i = 0; i < MESSAGE_SIZE; i++) pt[i] = (uint8_t)(i * 31 + 7);
+
+    aws_cryptosdk_session *session = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    if (!session) {
+        encrypt->failures++;
+        return;
+    }
+
+    while (std::chrono::steady_clock::now() < deadline) {
+        int64_t elapsed =
+            RunMessage(session, AWS_CRYPTOSDK_ENCRYPT, ct.data(), ct.size(), &ct_len, pt.data(), pt.size());
+        if (elapsed < 0) {
+            encrypt->failures++;
+            continue;
+        }
+        encrypt->latencies_us.push_back(elapsed);
+
+        elapsed = RunMessage(session, AWS_CRYPTOSDK_DECRYPT, pt_out.data(), pt_out.size(), &pt_len, ct.data(), ct_len);
+        if (elapsed < 0 || pt_len != MESSAGE_SIZE || memcmp(pt.data(), pt_out.data(), MESSAGE_SIZE)) {
+            decrypt->failures++;
+            continue;
+        }
+        decrypt->latencies_us.push_back(elapsed);
+    }
+
+    aws_cryptosdk_session_destroy(session);
+}
+
+static uint64_t Percentile(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t idx = (size_t)(p * (double)(sorted.size() - 1));
+    return sorted[idx];
+}
+
+static void Report(
+    const char *op,
+    const Scenario &scenario,
+    const BenchConfig &config,
+    std::vector<uint64_t> &latencies,
+    uint64_t failures,
+    uint64_t kms_calls) {
+    uint64_t total = 0;
+    std::sort(latencies.begin(), latencies.end());
+    for (uint64_t latency : latencies) total += latency;
+
+    printf(
+        "{\"op\":\"%s\",\"scenario\":\"%s\",\"threads\":%zu,\"messages\":%zu,\"failures\":%llu,"
+        "\"kms_calls\":%llu,\"latency_us_mean\":%llu,\"latency_us_p50\":%llu,\"latency_us_p99\":%llu,"
+        "\"latency_us_max\":%llu}\n",
+        op,
+        scenario.name,
+        config.threads,
+        latencies.size(),
+        (unsigned long long)failures,
+        (unsigned long long)kms_calls,
+        (unsigned long long)(latencies.empty() ? 0 : total / latencies.size()),
+        (unsigned long long)Percentile(latencies, 0.5),
+        (unsigned long long)Percentile(latencies, 0.99),
+        (unsigned long long)(latencies.empty() ? 0 : latencies.back()));
+    fflush(stdout);
+}
+
+static int BenchScenario(aws_allocator *alloc, const BenchConfig &config, const Scenario &scenario) {
+    // The far regions only hold extra EDKs, so on decrypt they matter only if tried first or in parallel
+    Aws::Map<Aws::String, LatencyProfile> region_profiles;
+    region_profiles["eu-west-1"]      = FAR_AWAY;
+    region_profiles["ap-southeast-2"] = FAR_AWAY;
+    auto supplier = Aws::MakeShared<LatencyClientSupplier>(CLASS_TAG, scenario.profile, region_profiles);
+
+    aws_cryptosdk_cmm *cmm = BuildCmm(alloc, scenario, supplier);
+    if (!cmm) {
+        fprintf(stderr, "Benchmark failed: scenario=%s: %s\n", scenario.name, aws_error_str(aws_last_error()));
+        return -1;
+    }
+
+    std::vector<OpResult> encrypts(config.threads), decrypts(config.threads);
+    std::vector<std::thread> threads;
+    auto deadline = std::chrono::steady_clock::now() + config.min_time;
+    for (size_t i = 0; i < config.threads; i++) {
+        threads.emplace_back(Worker, alloc, cmm, deadline, &encrypts[i], &decrypts[i]);
+    }
+    for (auto &thread : threads) thread.join();
+    aws_cryptosdk_cmm_release(cmm);
+
+    OpResult encrypt, decrypt;
+    for (size_t i = 0; i < config.threads; i++) {
+        encrypt.latencies_us.insert(
+            encrypt.latencies_us.end(), encrypts[i].latencies_us.begin(), encrypts[i].latencies_us.end());
+        decrypt.latencies_us.insert(
+            decrypt.latencies_us.end(), decrypts[i].latencies_us.begin(), decrypts[i].latencies_us.end());
+        encrypt.failures += encrypts[i].failures;
+        decrypt.failures += decrypts[i].failures;
+    }
+
+    uint64_t kms_calls = 0;
+    for (const char *region : { "us-west-2", "eu-west-1", "ap-southeast-2" }) {
+        auto client = supplier->ClientFor(region);
+        if (client) kms_calls += client->Calls();
+    }
+
+    // KMS calls are not told apart by operation, so both lines carry the scenario's total
+    Report("encrypt", scenario, config, encrypt.latencies_us, encrypt.failures, kms_calls);
+    Report("decrypt", scenario, config, decrypt.latencies_us, decrypt.failures, kms_calls);
+
+    return encrypt.latencies_us.empty() || decrypt.latencies_us.empty() ? -1 : 0;
+}
+
+static void Usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--quick] [--min-time-ms N] [--threads N]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    BenchConfig config = { milliseconds(2000), 4 };
+    int failures       = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) {
+            config.min_time = milliseconds(200);
+        } else if (!strcmp(argv[i], "--min-time-ms") && i + 1 < argc) {
+            config.min_time = milliseconds(strtoull(argv[++i], NULL, 10));
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            config.threads = strtoul(argv[++i], NULL, 10);
+        } else {
+            Usage(argv[0]);
+        }
+    }
+    if (!config.threads) Usage(argv[0]);
+
+    Aws::SDKOptions options;
+    Aws::InitAPI(options);
+    aws_cryptosdk_load_error_strings();
+
+    for (const Scenario &scenario : scenarios) {
+        if (BenchScenario(aws_default_allocator(), config, scenario)) failures++;
+    }
+
+    Aws::ShutdownAPI(options);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_ENCRYPTION_SDK_ASYNC_SESSION_H
+#define AWS_ENCRYPTION_SDK_ASYNC_SESSION_H
+
+#include <aws/cryptosdk/cpp/exports.h>
+
+#include <aws/cryptosdk/session.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#    define AWS_CRYPTOSDK_CPP_COROUTINES 1
+#    include <coroutine>
+#endif
+
+namespace Aws {
+namespace Cryptosdk {
+
+/**
+ * @defgroup async_session Asynchronous sessions (C++)
+ *
+ * Drives a session through a whole message without blocking a thread while the CMM waits on
+ * remote services, so that many messages can be in flight on a few threads. While materials are
+ * outstanding, no thread is held by the session (see @ref aws_cryptosdk_session_set_async_callback);
+ * whether the keyring itself holds one depends on the keyring, e.g. the KMS keyring runs its KMS
+ * calls on the executor given to KmsKeyring::Builder::WithAsyncExecutor.
+ *
+ * @{
+ */
+
+/**
+ * Encrypts or decrypts one message at a time with a session, from a buffer in memory to a vector.
+ * The session must be configured and ready for a new message; reset it to reuse this for another.
+ *
+ * Work resumes on the executor once the materials arrive, and the completion runs there too, or
+ * on the calling thread if the CMM and keyrings answer at once. Neither the session, nor the
+ * input and output of a message, are owned; they and this object must outlive the completion.
+ *
+ * With a C++20 compiler, the Encrypt and Decrypt overloads without a completion return an
+ * awaitable, so that a coroutine can write int error_code = co_await session.Encrypt(...).
+ */
+class AWS_CRYPTOSDK_CPP_API AsyncSession {
+   public:
+    /** Runs a task, now or later and on any thread, as long as it runs exactly once */
+    typedef std::function<void(std::function<void()>)> Executor;
+    /** Receives AWS_ERROR_SUCCESS, or the error code the message failed with */
+    typedef std::function<void(int error_code)> Completion;
+
+    AsyncSession(struct aws_cryptosdk_session *session, Executor executor);
+
+    AsyncSession(const AsyncSession &) = delete;
+    AsyncSession &operator=(const AsyncSession &) = delete;
+
+    /**
+     * Encrypts plaintext_len bytes at plaintext into a message, which replaces the contents of
+     * ciphertext. The session must be in encrypt mode; its message size is set to plaintext_len.
+     */
+    void Encrypt(
+        const uint8_t *plaintext, size_t plaintext_len, std::vector<uint8_t> *ciphertext, Completion done);
+
+    /**
+     * Decrypts the message of ciphertext_len bytes at ciphertext, replacing the contents of
+     * plaintext with what it holds. The session must be in decrypt mode. Fails with
+     * AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if the message is truncated; on any failure, whatever was
+     * decrypted before it must be discarded. Bytes after the end of the message are ignored.
+     */
+    void Decrypt(
+        const uint8_t *ciphertext, size_t ciphertext_len, std::vector<uint8_t> *plaintext, Completion done);
+
+#ifdef AWS_CRYPTOSDK_CPP_COROUTINES
+    /**
+     * Awaitable for a message, which suspends the awaiting coroutine until it completes and
+     * yields its error code. The coroutine is resumed where the completion would run. This is
+     * defined here rather than in the library, which is built as C++11.
+     */
+    class Awaiter {
+       public:
+        bool await_ready() const noexcept {
+            return false;
+        }
+        bool await_suspend(std::coroutine_handle<> handle) {
+            this->handle = handle;
+            session.Start(encrypt, input, input_len, output, [this](int error_code) {
+                this->error_code = error_code;
+                if (settled.exchange(true)) this->handle.resume();
+            });
+            // If the message completed already, the coroutine carries on without suspending
+            return !settled.exchange(true);
+        }
+        int await_resume() const noexcept {
+            return error_code;
+        }
+
+       private:
+        friend class AsyncSession;
+        Awaiter(
+            AsyncSession &session, bool encrypt, const uint8_t *input, size_t input_len, std::vector<uint8_t> *output)
+            : session(session), encrypt(encrypt), input(input), input_len(input_len), output(output) {}
+
+        AsyncSession &session;
+        bool encrypt;
+        const uint8_t *input;
+        size_t input_len;
+        std::vector<uint8_t> *output;
+        std::coroutine_handle<> handle;
+        int error_code = AWS_ERROR_SUCCESS;
+        /* Set by whichever of await_suspend and the completion finishes first; the other resumes */
+        std::atomic<bool> settled{ false };
+    };
+
+    Awaiter Encrypt(const uint8_t *plaintext, size_t plaintext_len, std::vector<uint8_t> *ciphertext) {
+        return Awaiter(*this, true, plaintext, plaintext_len, ciphertext);
+    }
+    Awaiter Decrypt(const uint8_t *ciphertext, size_t ciphertext_len, std::vector<uint8_t> *plaintext) {
+        return Awaiter(*this, false, ciphertext, ciphertext_len, plaintext);
+    }
+#endif
+
+   private:
+    static void OnReady(struct aws_cryptosdk_session *session, void *user_data);
+    void Start(bool encrypt, const uint8_t *input, size_t input_len, std::vector<uint8_t> *output, Completion done);
+    void Run();
+    void Finish(int error_code);
+
+    struct aws_cryptosdk_session *session;
+    Executor executor;
+
+    /* The message in progress */
+    bool encrypting;
+    const uint8_t *input;
+    size_t input_len, consumed;
+    std::vector<uint8_t> *output;
+    size_t produced;
+    Completion done;
+
+    /*
+     * running is set while a thread is in Run. Materials which arrive meanwhile set ready rather
+     * than scheduling another Run, and the running one picks them up.
+     */
+    std::mutex mutex;
+    bool running;
+    bool ready;
+};
+
+/** @} */  // doxygen group async_session
+
+}  // namespace Cryptosdk
+}  // namespace Aws
+
+#endif  // AWS_ENCRYPTION_SDK_ASYNC_SESSION_H
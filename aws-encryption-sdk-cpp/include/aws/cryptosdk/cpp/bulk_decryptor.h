@@ -0,0 +1,123 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_ENCRYPTION_SDK_BULK_DECRYPTOR_H
+#define AWS_ENCRYPTION_SDK_BULK_DECRYPTOR_H
+
+#include <aws/cryptosdk/cpp/exports.h>
+
+#include <aws/cryptosdk/materials.h>
+#include <aws/cryptosdk/session.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Aws {
+namespace Cryptosdk {
+
+/**
+ * @defgroup bulk_decryptor Bulk decryption (C++)
+ *
+ * Decrypts a stream of many independent messages as a pipeline, for batch jobs over large
+ * numbers of stored objects. Rather than taking each message from start to finish on one
+ * thread, the work is split into stages with pools of their own: reading the header and
+ * unwrapping its data key, which mostly waits on remote services and so runs with high
+ * concurrency, and decrypting the body, which is CPU-bound and runs about one thread per core.
+ * Keys for the messages coming up are unwrapped while earlier bodies are being decrypted.
+ *
+ * @{
+ */
+
+/**
+ * Runs batches of decryptions through a CMM. Each message gets a session of its own, taken
+ * from a pool which is kept between batches. The CMM is not owned; the sessions hold references
+ * to it.
+ */
+class AWS_CRYPTOSDK_CPP_API BulkDecryptor {
+   public:
+    /**
+     * Replaces the contents of *ciphertext with the next message, and returns true, or returns
+     * false once there are no more. Called on the thread running Decrypt, in turn with
+     * the rest of the work, so it should not block for long.
+     */
+    typedef std::function<bool(std::vector<uint8_t> *ciphertext)> Source;
+
+    /**
+     * Receives the outcome of message job (counting from 0, in the order the source gave them):
+     * AWS_ERROR_SUCCESS with its plaintext, which the sink may move from, or the error code it
+     * failed with and an empty plaintext. Messages are delivered one at a time on an output
+     * thread of their own, in the order they finish. Returns AWS_OP_SUCCESS, or AWS_OP_ERR
+     * having raised an error, which stops the batch.
+     */
+    typedef std::function<int(uint64_t job, int error_code, std::vector<uint8_t> *plaintext)> Sink;
+
+    /**
+     * Configures a new session before its first message, for example to limit the number of
+     * EDKs it accepts. Settings must be ones that are preserved across resets. Returns
+     * AWS_OP_SUCCESS, or AWS_OP_ERR having raised an error, which stops the batch.
+     */
+    typedef std::function<int(struct aws_cryptosdk_session *session)> SessionSetup;
+
+    /**
+     * Up to unwrap_threads messages have their headers read and data keys unwrapped at once,
+     * and up to decrypt_threads bodies are decrypted at once; zero decrypt threads means one
+     * per hardware thread. At most max_in_flight messages (at least enough to keep both pools
+     * busy) are held between the source and the sink, which bounds how far ahead keys are
+     * unwrapped and how much memory a batch uses.
+     */
+    BulkDecryptor(
+        struct aws_cryptosdk_cmm *cmm, unsigned unwrap_threads, unsigned decrypt_threads, size_t max_in_flight);
+
+    ~BulkDecryptor();
+
+    BulkDecryptor(const BulkDecryptor &) = delete;
+    BulkDecryptor &operator=(const BulkDecryptor &) = delete;
+
+    /** Sets a function to configure each session this creates; call it before the first batch. */
+    void SetSessionSetup(const SessionSetup &setup);
+
+    /**
+     * Decrypts every message the source gives, passing the outcome of each to sink, and returns
+     * once all of them have been delivered or the batch has been stopped. A message that fails
+     * to decrypt does not stop the batch, and is delivered with its error code. Returns
+     * AWS_OP_SUCCESS, or AWS_OP_ERR with the error that stopped the batch (raised by the sink,
+     * or in creating or configuring a session) set as the calling thread's last error.
+     */
+    int Decrypt(const Source &source, const Sink &sink);
+
+   private:
+    struct Job;
+    class JobQueue;
+
+    struct aws_cryptosdk_session *AcquireSession();
+    void ReleaseSession(struct aws_cryptosdk_session *session);
+    static void UnwrapKey(Job *job);
+    static void DecryptBody(Job *job);
+
+    struct aws_cryptosdk_cmm *cmm;
+    unsigned unwrap_threads;
+    unsigned decrypt_threads;
+    size_t max_in_flight;
+    SessionSetup setup;
+    /* Sessions ready for a new message; guarded by the batch's lock while one is running */
+    std::vector<struct aws_cryptosdk_session *> idle_sessions;
+};
+
+/** @} */  // doxygen group bulk_decryptor
+
+}  // namespace Cryptosdk
+}  // namespace Aws
+
+#endif  // AWS_ENCRYPTION_SDK_BULK_DECRYPTOR_H
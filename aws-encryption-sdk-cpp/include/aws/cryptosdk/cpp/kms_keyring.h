@@ -18,19 +18,27 @@
 #include <aws/cryptosdk/cpp/exports.h>
 
 #include <aws/core/Aws.h>
+#include <aws/core/auth/AWSCredentialsProvider.h>
 #include <aws/core/utils/Outcome.h>
 #include <aws/core/utils/memory/stl/AWSMap.h>
 #include <aws/core/utils/memory/stl/AWSString.h>
 #include <aws/core/utils/memory/stl/AWSVector.h>
+#include <aws/core/utils/threading/Executor.h>
 #include <aws/cryptosdk/materials.h>
 #include <aws/kms/KMSClient.h>
+#include <chrono>
 #include <functional>
 #include <mutex>
 
 namespace Aws {
 namespace Cryptosdk {
+namespace Private {
+struct DiscoveryFilter;
+}  // namespace Private
+
 namespace KmsKeyring {
 class ClientSupplier;
+class MetricsSink;
 
 /**
  * @defgroup kms_keyring KMS keyring (AWS SDK for C++)
@@ -94,6 +102,131 @@ class AWS_CRYPTOSDK_CPP_API Builder {
      */
     Builder &WithKmsClient(const std::shared_ptr<KMS::KMSClient> &kms_client);
 
+    /**
+     * On decryption, KmsKeyring normally tries the EDKs it can use one at a time, and only moves on
+     * to the next one after a call to KMS has failed, which with an unreachable region can take
+     * as long as the request timeout. With a concurrency greater than one, it instead makes Decrypt
+     * calls for up to that many EDKs at once, using the first one to succeed. Calls still in flight
+     * at that point are left to complete in the background, and their results are discarded.
+     *
+     * This trades extra KMS requests for lower latency, and is mainly of use in discovery mode or
+     * with keys in several regions. Defaults to one; zero is treated as one.
+     */
+    Builder &WithDecryptConcurrency(size_t decrypt_concurrency);
+
+    /**
+     * On decryption, KmsKeyring tries the EDKs in this region first, and then those in the other
+     * regions in order of the latency and error rate it has seen from them so far, rather than in
+     * the order they appear in the message. Regions it has not called yet are tried before those
+     * it has, in message order. Usually the region the application runs in.
+     */
+    Builder &WithLocalRegion(const Aws::String &local_region);
+
+    /**
+     * On encryption, KmsKeyring normally calls GenerateDataKey under the generator key given to
+     * Build, and Encrypt under the others. With local_generator set, it instead generates under
+     * the first key in the local region (see WithLocalRegion), or failing that the first in the
+     * same geographic area, such as "eu" for eu-west-1, and wraps the data key under all the
+     * others, the configured generator included. A fleet sharing one keyring configuration across
+     * regions then saves a cross-region round trip per encryption. Messages still get an EDK under
+     * every key, though the EDK of the key generated under comes first. If no key is in the local
+     * area, the configured generator is used as usual.
+     *
+     * GenerateDataKey permission is then needed on the key chosen. Build fails with
+     * AWS_ERROR_INVALID_ARGUMENT if this is set without a local region. Defaults to false.
+     */
+    Builder &WithLocalGenerator(bool local_generator = true);
+
+    /**
+     * With prewarm_clients set, Build creates the KMS client for every region its keys are in
+     * straight away, rather than when each region is first called, so that the cost is paid while
+     * the application starts up (e.g. in the initialization phase of a serverless function) and
+     * not by its first requests. This applies to the default client supplier and to any
+     * CachingClientSupplier given to WithClientSupplier or used for hedging; a single-key keyring
+     * always creates its client in Build. Defaults to false.
+     */
+    Builder &WithPrewarmedClients(bool prewarm_clients = true);
+
+    /**
+     * Makes KmsKeyring generate data keys ahead of time. For each encryption context it has
+     * recently generated a data key for, it keeps up to depth more in a queue, replenished by
+     * background GenerateDataKey calls, so that encryption takes a ready key instead of waiting for
+     * KMS. Each key is still used for one message only, and keys are discarded unused once they
+     * have been queued for longer than ttl. The first encryption with a context, and any which find
+     * its queue empty, call KMS as usual.
+     *
+     * Data keys are held in memory until they are used or expire, and KMS sees up to depth more
+     * GenerateDataKey calls than messages. A depth of zero, the default, disables prefetching.
+     */
+    Builder &WithDataKeyPrefetch(size_t depth, std::chrono::milliseconds ttl);
+
+    /**
+     * Makes KmsKeyring hedge its Decrypt and GenerateDataKey calls: if KMS has not answered a call
+     * by the given percentile (between zero and one, exclusive) of the latencies recently seen from
+     * its region, the same call is made again, and whichever answers first successfully is used.
+     * Hedged calls are limited to the fraction budget (at most one) of all calls, so that a slow
+     * region does not get twice the load. The second call uses a client from
+     * hedge_client_supplier, which may for example be configured with another endpoint, or from
+     * the keyring's usual client supplier if that is null.
+     *
+     * No call is hedged until a region has enough latency samples. Decrypt calls made concurrently
+     * (see WithDecryptConcurrency) are not hedged. Build fails with AWS_ERROR_INVALID_ARGUMENT if
+     * the percentile or budget is out of range. A budget of zero, the default, disables hedging.
+     */
+    Builder &WithHedging(
+        double percentile, double budget, const std::shared_ptr<ClientSupplier> &hedge_client_supplier = nullptr);
+
+    /**
+     * Limits the KMS calls KmsKeyring makes to each region to calls_per_second, with bursts of up to
+     * burst calls at once. A call over the limit waits its turn for up to max_wait, and otherwise
+     * fails at once without reaching KMS, so that an overloaded keyring sheds load rather than
+     * adding to KMS throttling. Prefetches (see WithDataKeyPrefetch) and hedges (see WithHedging)
+     * are only made when they need not wait. A rate of zero, the default, disables the limit.
+     */
+    Builder &WithRateLimit(double calls_per_second, size_t burst, std::chrono::milliseconds max_wait);
+
+    /**
+     * Makes KmsKeyring retry KMS calls which fail with a retryable error, such as throttling, as
+     * long as retries make up no more than the fraction ratio (at most one) of its calls. Retries
+     * wait their turn under the rate limit (see WithRateLimit) like any other call. A ratio of
+     * zero, the default, disables retries.
+     *
+     * With a retry budget, the KMS clients the keyring creates itself make no retries of their
+     * own, so that every retry counts against the budget and the rate limit. A client or client
+     * supplier given to the builder keeps its own retry strategy, whose retries multiply the
+     * keyring's and bypass the rate limit; give such clients no retries, for example with
+     * CachingClientSupplier::Create(false) or a ClientConfiguration whose retryStrategy allows
+     * none. The same goes for a rate limit without a retry budget.
+     */
+    Builder &WithRetryBudget(double ratio);
+
+    /**
+     * Limits a discovery keyring (see BuildDiscovery) to KMS keys in the given partition, such as
+     * "aws", owned by one of the given account IDs and, unless regions is empty, in one of the
+     * given regions. EDKs under other keys are skipped without calling KMS or the client supplier,
+     * rather than costing a round trip each to fail. Build fails with AWS_ERROR_INVALID_ARGUMENT if
+     * a discovery filter is set, as a keyring with key IDs only uses those keys anyway.
+     */
+    Builder &WithDiscoveryFilter(
+        const Aws::String &partition,
+        const Aws::Vector<Aws::String> &account_ids,
+        const Aws::Vector<Aws::String> &regions = {});
+
+    /**
+     * Reports every call KmsKeyring makes to GenerateDataKey, Encrypt or Decrypt to metrics_sink,
+     * with its region, key ID, latency, outcome and size. See MetricsSink.
+     */
+    Builder &WithMetricsSink(const std::shared_ptr<MetricsSink> &metrics_sink);
+
+    /**
+     * Lets KmsKeyring be called asynchronously (see @ref aws_cryptosdk_keyring_on_encrypt_async),
+     * as sessions do once given an asynchronous callback, e.g. by AsyncSession. Each such call
+     * runs on executor, as the KMS client's own asynchronous calls run on its executor, so that the
+     * thread driving the session is free while KMS answers. Calls the executor refuses fail with
+     * AWS_CRYPTOSDK_ERR_BAD_STATE. Without an executor, the default, such calls block the caller.
+     */
+    Builder &WithAsyncExecutor(const std::shared_ptr<Aws::Utils::Threading::Executor> &executor);
+
     /**
      * Creates a new KmsKeyring object or returns NULL if parameters are invalid.
      *
@@ -148,6 +281,22 @@ class AWS_CRYPTOSDK_CPP_API Builder {
     std::shared_ptr<KMS::KMSClient> kms_client;
     Aws::Vector<Aws::String> grant_tokens;
     std::shared_ptr<ClientSupplier> client_supplier;
+    size_t decrypt_concurrency = 1;
+    Aws::String local_region;
+    bool local_generator  = false;
+    bool prewarm_clients  = false;
+    size_t prefetch_depth = 0;
+    std::chrono::milliseconds prefetch_ttl{ 0 };
+    double hedge_percentile = 0;
+    double hedge_budget     = 0;
+    std::shared_ptr<ClientSupplier> hedge_client_supplier;
+    double rate_limit = 0;
+    size_t rate_burst = 1;
+    std::chrono::milliseconds rate_max_wait{ 0 };
+    double retry_budget = 0;
+    std::shared_ptr<const Private::DiscoveryFilter> discovery_filter;
+    std::shared_ptr<MetricsSink> metrics_sink;
+    std::shared_ptr<Aws::Utils::Threading::Executor> async_executor;
 };
 
 /**
@@ -173,8 +322,10 @@ class AWS_CRYPTOSDK_CPP_API CachingClientSupplier : public ClientSupplier {
    public:
     /**
      * Helper function which creates a new CachingClientSupplier and returns a shared pointer to it.
+     * If client_retries is false, the clients it creates make no retries of their own, as suits a
+     * keyring with a retry budget (see Builder::WithRetryBudget).
      */
-    static std::shared_ptr<CachingClientSupplier> Create();
+    static std::shared_ptr<CachingClientSupplier> Create(bool client_retries = true);
 
     /**
      * If a client is already cached for this region, returns that one and provides a no-op callable.
@@ -183,12 +334,35 @@ class AWS_CRYPTOSDK_CPP_API CachingClientSupplier : public ClientSupplier {
      */
     std::shared_ptr<KMS::KMSClient> GetClient(const Aws::String &region, std::function<void()> &report_success);
 
+    /**
+     * Creates and caches a KMS client for each of these regions ahead of time, so that the first
+     * requests to them do not have to wait for one to be created, and concurrent first requests do
+     * not each create their own. Unlike clients created on demand, these are cached whether or not
+     * they are ever used successfully. Regions which already have a client are left alone.
+     */
+    void Prewarm(const Aws::Vector<Aws::String> &regions);
+
    protected:
+    /**
+     * Replaces cache_snapshot with a copy of cache. Must be called with cache_mutex held whenever
+     * cache changes.
+     */
+    void PublishCache();
+
     mutable std::mutex cache_mutex;
     /**
      * Region -> KMS Client.
      */
     Aws::Map<Aws::String, std::shared_ptr<Aws::KMS::KMSClient>> cache;
+    /**
+     * Read-only copy of cache, which GetClient looks regions up in without taking cache_mutex.
+     * Only ever accessed through std::atomic_load and std::atomic_store, and replaced as a whole.
+     */
+    std::shared_ptr<const Aws::Map<Aws::String, std::shared_ptr<Aws::KMS::KMSClient>>> cache_snapshot;
+    /**
+     * Whether the clients created retry failed calls themselves.
+     */
+    bool client_retries = true;
 };
 
 /**
@@ -213,6 +387,100 @@ class AWS_CRYPTOSDK_CPP_API SingleClientSupplier : public ClientSupplier {
     std::shared_ptr<KMS::KMSClient> kms_client;
 };
 
+/**
+ * Shares KMS clients among the keyrings of many tenants, each of which calls KMS with credentials
+ * of its own, such as a role assumed on its behalf. Clients are cached by region and credentials
+ * identity, so every keyring of one tenant, including keyrings created per request, reuses the
+ * same clients and the connections they hold open, while no tenant is ever given a client signing
+ * with another's credentials.
+ *
+ * The cache holds at most max_clients clients, dropping the least recently used beyond that;
+ * keyrings still using a dropped client keep it until they are done with it. If refresh_interval
+ * is nonzero, a background thread asks the credentials provider of every cached client for its
+ * credentials at that interval, so that providers which refresh expiring credentials when asked
+ * (as the STS assume-role provider does) do so off the request path. The interval should be well
+ * below the lifetime of the credentials.
+ */
+class AWS_CRYPTOSDK_CPP_API TenantClientCache {
+   public:
+    /**
+     * Helper function which creates a new TenantClientCache and returns a shared pointer to it.
+     */
+    static std::shared_ptr<TenantClientCache> Create(
+        size_t max_clients = 256, std::chrono::milliseconds refresh_interval = std::chrono::milliseconds(0));
+
+    TenantClientCache(size_t max_clients, std::chrono::milliseconds refresh_interval);
+
+    /** Stops the refresh thread. Suppliers from ForTenant keep working, with their own clients. */
+    ~TenantClientCache();
+
+    TenantClientCache(const TenantClientCache &) = delete;
+    TenantClientCache &operator=(const TenantClientCache &) = delete;
+
+    /**
+     * Returns a supplier, to give to KmsKeyring::Builder::WithClientSupplier, of clients which
+     * call KMS with these credentials. identity must name the credentials uniquely, for example
+     * by the tenant ID and role ARN: a client cached under it is returned whichever provider is
+     * passed, and keeps the provider of the supplier that first created it.
+     *
+     * The supplier creates and caches a client for a region the first time it is asked for one,
+     * without waiting for it to be used successfully, and never returns nullptr.
+     */
+    std::shared_ptr<ClientSupplier> ForTenant(
+        const Aws::String &identity, const std::shared_ptr<Aws::Auth::AWSCredentialsProvider> &credentials);
+
+    /** Returns the number of clients currently cached. */
+    size_t Size() const;
+
+   private:
+    struct State;
+    class TenantSupplier;
+    class RefreshThread;
+
+    std::shared_ptr<State> state;
+    std::unique_ptr<RefreshThread> refresh_thread;
+};
+
+enum class KmsOperation { GENERATE_DATA_KEY, ENCRYPT, DECRYPT };
+
+/**
+ * Broad class of a KMS call's failure, for telling apart overload, misconfigured permissions and
+ * connectivity problems without parsing error names.
+ */
+enum class KmsErrorClass { NONE, THROTTLED, ACCESS_DENIED, NETWORK, OTHER };
+
+/**
+ * What a KmsKeyring reports about each call it makes to KMS.
+ */
+struct KmsCallMetrics {
+    KmsOperation operation;
+    Aws::String region;
+    /* The key the call was made for, which on decryption is the key ARN from the EDK */
+    Aws::String key_id;
+    std::chrono::microseconds latency;
+    KmsErrorClass error_class;
+    /* Sizes of the key material sent to and received from KMS */
+    size_t bytes_sent;
+    size_t bytes_received;
+};
+
+/**
+ * Receives metrics about the KMS calls made by the keyrings it is given to (see
+ * KmsKeyring::Builder::WithMetricsSink), to be counted, bucketed into latency histograms per
+ * region or key ID, or passed on to a monitoring system. OnKmsCall is called once each call has
+ * completed, which may be on one of the KMS client's threads and concurrently with other calls,
+ * so implementations must be thread-safe, and should be quick.
+ *
+ * Retries are reported as calls of their own, while a hedged call is reported once, with the
+ * outcome used and the time until it arrived. Calls made to prefetch data keys (see
+ * KmsKeyring::Builder::WithDataKeyPrefetch) and calls refused by the rate limit are not reported.
+ */
+class AWS_CRYPTOSDK_CPP_API MetricsSink {
+   public:
+    virtual ~MetricsSink(){};
+    virtual void OnKmsCall(const KmsCallMetrics &metrics) = 0;
+};
+
 /** @} */  // doxygen group kms_keyring
 
 }  // namespace KmsKeyring
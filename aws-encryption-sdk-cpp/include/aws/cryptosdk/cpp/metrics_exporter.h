@@ -0,0 +1,169 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_ENCRYPTION_SDK_METRICS_EXPORTER_H
+#define AWS_ENCRYPTION_SDK_METRICS_EXPORTER_H
+
+#include <aws/cryptosdk/cpp/exports.h>
+
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/cpp/kms_keyring.h>
+#include <aws/cryptosdk/session.h>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Aws {
+namespace Cryptosdk {
+
+/**
+ * @defgroup metrics_exporter Metrics export (C++)
+ *
+ * Gathers the SDK's instrumentation (session stage timings, materials cache counters and the
+ * outcomes of KMS calls) into metrics following the OpenTelemetry data model, and hands them to
+ * an exporter at a fixed interval. Counters are cumulative sums, latencies are histograms with
+ * explicit bucket bounds, and each point carries its attributes as key/value pairs, so an
+ * exporter forwarding them to an OpenTelemetry SDK, or to OTLP directly, only has to copy them
+ * across. The SDK itself has no dependency on OpenTelemetry.
+ *
+ * Metrics are named under "aws.encryption_sdk.":
+ *
+ *   session.messages          counter    {message}  mode, outcome ("ok" or "error")
+ *   session.bytes             counter    By         mode, direction ("in" or "out")
+ *   session.frames            counter    {frame}    mode
+ *   session.stage.duration    histogram  us         mode, stage ("cmm", "hkdf", "gcm", "signature", "header")
+ *   cache.lookups             counter    {lookup}   cache, result ("encrypt_hit", "decrypt_hit", "miss")
+ *   cache.evictions           counter    {entry}    cache, reason ("capacity", "ttl", "quota", "invalidated")
+ *   cache.entries             gauge      {entry}    cache
+ *   cache.size                gauge      By         cache
+ *   kms.calls                 counter    {call}     operation, outcome ("ok", "throttled", "access_denied",
+ *                                                   "network", "other")
+ *   kms.call.duration         histogram  us         operation
+ *
+ * @{
+ */
+
+/** The kind of a metric point, as in the OpenTelemetry data model */
+enum class MetricKind {
+    /** A monotonic sum, cumulative since the collector was created */
+    COUNTER,
+    /** A current value */
+    GAUGE,
+    /** A cumulative histogram with explicit bucket bounds */
+    HISTOGRAM
+};
+
+/** One point of one metric, for one set of attributes */
+struct MetricPoint {
+    std::string name;
+    /** In UCUM form, as OpenTelemetry uses: "us", "By", or an annotation such as "{message}" */
+    std::string unit;
+    MetricKind kind;
+    std::vector<std::pair<std::string, std::string>> attributes;
+    /** The value of a counter or gauge */
+    uint64_t value;
+    /**
+     * For histograms: the upper bounds of the buckets, inclusive, and the count in each bucket,
+     * which has one more entry than bounds for the values above the last bound
+     */
+    std::vector<uint64_t> bounds;
+    std::vector<uint64_t> bucket_counts;
+    uint64_t count;
+    uint64_t sum;
+    /** When cumulation started (the collector's creation), and when the point was taken */
+    std::chrono::system_clock::time_point start_time;
+    std::chrono::system_clock::time_point time;
+};
+
+/**
+ * Receives each batch of points taken by a MetricsCollector. Export is called on the collector's
+ * export thread, one batch at a time.
+ */
+class AWS_CRYPTOSDK_CPP_API MetricsExporter {
+   public:
+    virtual ~MetricsExporter(){};
+    virtual void Export(const std::vector<MetricPoint> &points) = 0;
+};
+
+/**
+ * Aggregates metrics from any number of threads, and exports them periodically once started.
+ *
+ * Recording never takes a lock: each recording thread adds to relaxed atomic counters in a
+ * shard of its own (up to 64 threads; beyond that, threads share shards), and shards are only
+ * summed when points are collected. Recording a message therefore costs a few uncontended
+ * atomic additions, and exporting does not stall the threads being measured.
+ */
+class AWS_CRYPTOSDK_CPP_API MetricsCollector {
+   public:
+    MetricsCollector();
+
+    /** Stops exporting, as Stop does, and releases the caches being watched. */
+    ~MetricsCollector();
+
+    MetricsCollector(const MetricsCollector &) = delete;
+    MetricsCollector &operator=(const MetricsCollector &) = delete;
+
+    /**
+     * Records the message a session has just finished, or failed on: its outcome and the
+     * counters from @ref aws_cryptosdk_session_get_stats. Call this before the session is reset.
+     * Stages which took no time (such as signing, for unsigned suites) are not recorded in the
+     * stage histograms.
+     */
+    void RecordMessage(enum aws_cryptosdk_mode mode, const struct aws_cryptosdk_session *session, bool succeeded);
+
+    /**
+     * Returns a sink which records the KMS calls of the keyrings it is given to, with
+     * KmsKeyring::Builder::WithMetricsSink. The sink may outlive the collector; calls reported
+     * after the collector is gone are dropped.
+     */
+    std::shared_ptr<KmsKeyring::MetricsSink> GetKmsMetricsSink();
+
+    /**
+     * Exports the counters of a materials cache, read with @ref
+     * aws_cryptosdk_materials_cache_get_stats at each collection, with the attribute cache=name.
+     * The collector holds a reference to the cache until it is destroyed. Returns AWS_OP_SUCCESS,
+     * or AWS_OP_ERR if the cache does not report statistics.
+     */
+    int AddCache(const std::string &name, struct aws_cryptosdk_materials_cache *cache);
+
+    /** Returns the current value of every metric. May be called from any thread. */
+    std::vector<MetricPoint> Collect() const;
+
+    /**
+     * Starts a thread which passes the collected points to exporter every interval. If already
+     * started, the previous exporter is stopped first.
+     */
+    void Start(const std::shared_ptr<MetricsExporter> &exporter, std::chrono::milliseconds interval);
+
+    /** Stops the export thread, after a final export so that nothing recorded is lost. */
+    void Stop();
+
+   private:
+    struct State;
+    class KmsSink;
+    class ExportThread;
+
+    std::shared_ptr<State> state;
+    std::unique_ptr<ExportThread> export_thread;
+};
+
+/** @} */  // doxygen group metrics_exporter
+
+}  // namespace Cryptosdk
+}  // namespace Aws
+
+#endif  // AWS_ENCRYPTION_SDK_METRICS_EXPORTER_H
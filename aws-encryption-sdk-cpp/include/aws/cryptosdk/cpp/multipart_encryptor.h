@@ -0,0 +1,90 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_ENCRYPTION_SDK_MULTIPART_ENCRYPTOR_H
+#define AWS_ENCRYPTION_SDK_MULTIPART_ENCRYPTOR_H
+
+#include <aws/cryptosdk/cpp/exports.h>
+
+#include <aws/cryptosdk/session.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace Aws {
+namespace Cryptosdk {
+
+/**
+ * @defgroup multipart_encryptor Multipart encryption (C++)
+ *
+ * Encrypts a large message as a series of parts on several threads, so that each part can be
+ * handed to an uploader (for example, as the parts of an S3 multipart upload) as soon as it is
+ * ready, rather than encrypting the whole message on one thread before the upload can begin.
+ * Concatenating the parts in order gives exactly the message a session would have produced.
+ *
+ * The SDK has no dependency on an S3 client; the caller uploads each part from the sink.
+ *
+ * @{
+ */
+
+/**
+ * Encrypts one message at a time with a session, as parts of (about) a fixed size. Each part
+ * but the last is a whole number of frames; the first part also holds the header. Parts are
+ * encrypted with @ref aws_cryptosdk_session_encrypt_frames_at, so the session's algorithm
+ * suite must not sign messages and the message must be framed.
+ *
+ * The session must be configured and ready for a new message in encrypt mode, and is not
+ * owned. After Encrypt returns, the session must be reset before it is used again.
+ */
+class AWS_CRYPTOSDK_CPP_API MultipartEncryptor {
+   public:
+    /**
+     * Receives part part_number (counting from 1) of the message, which is only valid for the
+     * duration of the call. Parts are delivered on the worker threads, possibly concurrently
+     * and in any order. Returns AWS_OP_SUCCESS, or AWS_OP_ERR having raised an error, which
+     * stops any further parts from being encrypted.
+     */
+    typedef std::function<int(int part_number, const uint8_t *data, size_t len)> PartSink;
+
+    /**
+     * Parts will hold as many whole frames as fit in part_size bytes of ciphertext (and at
+     * least one). Up to num_threads parts are encrypted at once; zero means one per hardware
+     * thread.
+     */
+    MultipartEncryptor(struct aws_cryptosdk_session *session, size_t part_size, unsigned num_threads);
+
+    MultipartEncryptor(const MultipartEncryptor &) = delete;
+    MultipartEncryptor &operator=(const MultipartEncryptor &) = delete;
+
+    /**
+     * Encrypts the plaintext_len bytes at plaintext, passing each part of the message to sink,
+     * and returns once every part has been delivered or an error has stopped the work. Returns
+     * AWS_OP_SUCCESS, or AWS_OP_ERR with the first error raised (by the session or the sink)
+     * set as the calling thread's last error. On failure, parts already delivered must be
+     * discarded.
+     */
+    int Encrypt(const uint8_t *plaintext, size_t plaintext_len, const PartSink &sink);
+
+   private:
+    struct aws_cryptosdk_session *session;
+    size_t part_size;
+    unsigned num_threads;
+};
+
+/** @} */  // doxygen group multipart_encryptor
+
+}  // namespace Cryptosdk
+}  // namespace Aws
+
+#endif  // AWS_ENCRYPTION_SDK_MULTIPART_ENCRYPTOR_H
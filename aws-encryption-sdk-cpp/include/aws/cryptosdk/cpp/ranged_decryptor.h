@@ -0,0 +1,114 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_ENCRYPTION_SDK_RANGED_DECRYPTOR_H
+#define AWS_ENCRYPTION_SDK_RANGED_DECRYPTOR_H
+
+#include <aws/cryptosdk/cpp/exports.h>
+
+#include <aws/cryptosdk/session.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Aws {
+namespace Cryptosdk {
+
+/**
+ * @defgroup ranged_decryptor Ranged decryption (C++)
+ *
+ * Decrypts a large stored message by reading it as a series of byte ranges on several threads
+ * (for example, as ranged GETs of an S3 object), so that fetching and decrypting are spread
+ * over the threads rather than done in sequence by one session. This is the counterpart of
+ * @ref multipart_encryptor.
+ *
+ * The SDK has no dependency on an S3 client; the caller fetches each range in the fetcher.
+ *
+ * @{
+ */
+
+/**
+ * Decrypts one message at a time with a session, reading it as ranges of (about) a fixed size.
+ * The header is read first; each range after it begins on a frame and is decrypted with
+ * @ref aws_cryptosdk_session_decrypt_frames_at, so random access must be available for the
+ * message (see @ref aws_cryptosdk_session_get_frame_range): it must be framed, and use an
+ * algorithm suite without a trailing signature unless a frame index is given with
+ * UseFrameIndex. The trailing signature, if any, is not read.
+ *
+ * The session must be configured and ready for a new message in decrypt mode, and is not
+ * owned. After Decrypt returns, the session must be reset before it is used again.
+ */
+class AWS_CRYPTOSDK_CPP_API RangedDecryptor {
+   public:
+    /**
+     * Replaces the contents of *data with the len bytes of the message at offset. Called on the
+     * worker threads, possibly concurrently. Returns AWS_OP_SUCCESS, or AWS_OP_ERR having
+     * raised an error, which stops any further ranges from being decrypted.
+     */
+    typedef std::function<int(uint64_t offset, size_t len, std::vector<uint8_t> *data)> RangeFetcher;
+
+    /**
+     * Receives the len bytes of plaintext at offset in the message's plaintext, which are only
+     * valid for the duration of the call. Returns AWS_OP_SUCCESS, or AWS_OP_ERR having raised
+     * an error, which stops any further ranges from being decrypted.
+     */
+    typedef std::function<int(uint64_t offset, const uint8_t *data, size_t len)> PlaintextSink;
+
+    /**
+     * Ranges will hold as many whole frames as fit in range_size bytes (and at least one). Up
+     * to num_threads ranges are fetched and decrypted at once; zero means one per hardware
+     * thread. If in_order is set, plaintext is given to the sink one range at a time, in order,
+     * as for writing to a stream; otherwise ranges are delivered concurrently and in any order,
+     * as for writing to a file at their offsets.
+     */
+    RangedDecryptor(struct aws_cryptosdk_session *session, size_t range_size, unsigned num_threads, bool in_order);
+
+    RangedDecryptor(const RangedDecryptor &) = delete;
+    RangedDecryptor &operator=(const RangedDecryptor &) = delete;
+
+    /**
+     * Has the next message checked against its frame index, as with
+     * @ref aws_cryptosdk_session_use_frame_index, which is given to the session once the header
+     * has been read. The index is not copied, and must stay valid until Decrypt returns.
+     */
+    void UseFrameIndex(const uint8_t *index, size_t len);
+
+    /**
+     * Decrypts the message of message_len bytes read through fetch, passing its plaintext to
+     * sink, and returns once all of it has been delivered or an error has stopped the work.
+     * Returns AWS_OP_SUCCESS, or AWS_OP_ERR with the first error raised (by the session, fetch
+     * or sink) set as the calling thread's last error. Fails with
+     * AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if the message is truncated; on any failure, plaintext
+     * already delivered must be discarded.
+     */
+    int Decrypt(uint64_t message_len, const RangeFetcher &fetch, const PlaintextSink &sink);
+
+   private:
+    int ReadHeader(uint64_t message_len, const RangeFetcher &fetch, uint64_t *header_len);
+
+    struct aws_cryptosdk_session *session;
+    size_t range_size;
+    unsigned num_threads;
+    bool in_order;
+    const uint8_t *frame_index;
+    size_t frame_index_len;
+};
+
+/** @} */  // doxygen group ranged_decryptor
+
+}  // namespace Cryptosdk
+}  // namespace Aws
+
+#endif  // AWS_ENCRYPTION_SDK_RANGED_DECRYPTOR_H
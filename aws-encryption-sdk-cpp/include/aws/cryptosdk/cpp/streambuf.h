@@ -0,0 +1,148 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_ENCRYPTION_SDK_STREAMBUF_H
+#define AWS_ENCRYPTION_SDK_STREAMBUF_H
+
+#include <aws/cryptosdk/cpp/exports.h>
+
+#include <aws/cryptosdk/session.h>
+#include <cstdint>
+#include <streambuf>
+#include <vector>
+
+namespace Aws {
+namespace Cryptosdk {
+
+/**
+ * @defgroup streambuf Stream buffers (C++)
+ *
+ * Adapters which run a session over standard C++ streams, so that a message can be encrypted
+ * by writing to a std::ostream and decrypted by reading from a std::istream.
+ *
+ * The session's own buffers are the stream buffer's put or get area, and writes or reads of at
+ * least a whole buffer bypass it altogether, so the session encrypts straight from, or decrypts
+ * straight into, the caller's memory. Buffers work best as a multiple of the frame size (4096
+ * bytes unless set with @ref aws_cryptosdk_session_set_frame_size), so that each pass hands the
+ * session whole frames.
+ *
+ * Neither class owns the session or the underlying stream buffer, both of which must outlive
+ * it. On failure, the stream operation fails (setting badbit on the stream) and the session's
+ * error is left in aws_last_error().
+ *
+ * @{
+ */
+
+/**
+ * Output stream buffer which encrypts everything written to it as a single message, writing the
+ * ciphertext to sink. The session must be in encrypt mode, configured, and not yet used for the
+ * current message.
+ */
+class AWS_CRYPTOSDK_CPP_API EncryptingStreambuf : public std::streambuf {
+   public:
+    EncryptingStreambuf(struct aws_cryptosdk_session *session, std::streambuf *sink, size_t buffer_size = 65536);
+
+    /**
+     * Wipes the buffered plaintext. Does not finish the message; a message that was not
+     * finished is incomplete and will not decrypt.
+     */
+    ~EncryptingStreambuf() override;
+
+    EncryptingStreambuf(const EncryptingStreambuf &) = delete;
+    EncryptingStreambuf &operator=(const EncryptingStreambuf &) = delete;
+
+    /**
+     * Declares the exact plaintext size up front, in place of calling
+     * @ref aws_cryptosdk_session_set_message_size on the session directly, so that the final
+     * frame can be written as soon as the last byte arrives. Returns AWS_OP_SUCCESS, or raises
+     * the session's error.
+     */
+    int SetMessageSize(uint64_t message_size);
+
+    /**
+     * Encrypts any buffered plaintext, ends the message (setting its size to the number of bytes
+     * written, unless SetMessageSize was called), and writes the rest of the ciphertext to the
+     * sink, which is then synced. Returns AWS_OP_SUCCESS or raises an error; nothing more may be
+     * written afterwards.
+     */
+    int Finish();
+
+   protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+    /** Encrypts the whole frames buffered so far and syncs the sink; a partial frame stays buffered */
+    int sync() override;
+
+   private:
+    int Encrypt(const uint8_t *in, size_t in_len, size_t *in_read);
+    int Drain();
+
+    struct aws_cryptosdk_session *session;
+    std::streambuf *sink;
+    std::vector<uint8_t> plaintext;
+    std::vector<uint8_t> ciphertext;
+    /* Plaintext bytes taken by the session so far */
+    uint64_t consumed;
+    bool size_set;
+    /* Set once the message is finished or has failed, after which writes are refused */
+    bool closed;
+};
+
+/**
+ * Input stream buffer which reads a single message from source and yields its plaintext. The
+ * session must be in decrypt mode, configured, and not yet used for the current message.
+ *
+ * As with @ref aws_cryptosdk_session_process, plaintext is released as each frame is
+ * authenticated, before any trailing signature has been checked. The stream reaches end of
+ * file once the whole message has been read; call IsDone to tell that apart from a failure
+ * (such as a source which ends before the message does), after which anything read should be
+ * discarded. The source is read ahead in blocks, so any data following the message in it is
+ * consumed as well.
+ */
+class AWS_CRYPTOSDK_CPP_API DecryptingStreambuf : public std::streambuf {
+   public:
+    DecryptingStreambuf(struct aws_cryptosdk_session *session, std::streambuf *source, size_t buffer_size = 65536);
+
+    /** Wipes the buffered plaintext */
+    ~DecryptingStreambuf() override;
+
+    DecryptingStreambuf(const DecryptingStreambuf &) = delete;
+    DecryptingStreambuf &operator=(const DecryptingStreambuf &) = delete;
+
+    /** True once the whole message, including any trailing signature, has been verified */
+    bool IsDone() const;
+
+   protected:
+    int_type underflow() override;
+    std::streamsize xsgetn(char *s, std::streamsize n) override;
+
+   private:
+    int Decrypt(uint8_t *out, size_t out_len, size_t *out_written);
+    int Refill(size_t in_needed);
+
+    struct aws_cryptosdk_session *session;
+    std::streambuf *source;
+    std::vector<uint8_t> plaintext;
+    std::vector<uint8_t> ciphertext;
+    /* Unconsumed ciphertext lies in ciphertext[ct_start, ct_end) */
+    size_t ct_start, ct_end;
+    bool failed;
+};
+
+/** @} */  // doxygen group streambuf
+
+}  // namespace Cryptosdk
+}  // namespace Aws
+
+#endif  // AWS_ENCRYPTION_SDK_STREAMBUF_H
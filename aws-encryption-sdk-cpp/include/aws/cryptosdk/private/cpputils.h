@@ -53,6 +53,14 @@ Aws::String aws_string_from_c_aws_string(const struct aws_string *c_aws_string);
 AWS_CRYPTOSDK_CPP_API
 Aws::Map<Aws::String, Aws::String> aws_map_from_c_aws_hash_table(const struct aws_hash_table *hash_table);
 
+/**
+ * Returns true if map holds exactly the keys and values of an aws_hash_table that has aws_string as key and
+ * value, as if it had been made from it by aws_map_from_c_aws_hash_table. Does not allocate memory.
+ */
+AWS_CRYPTOSDK_CPP_API
+bool aws_map_eq_c_aws_hash_table(
+    const Aws::Map<Aws::String, Aws::String> &map, const struct aws_hash_table *hash_table);
+
 /**
  * Copies source buffer into dest and sets the correct len and capacity.
  * A new memory zone is allocated for dest->buffer. When dest is no longer needed it will have to be cleaned-up using
@@ -64,6 +72,17 @@ AWS_CRYPTOSDK_CPP_API
 int aws_byte_buf_dup_from_aws_utils(
     struct aws_allocator *allocator, struct aws_byte_buf *dest, const Aws::Utils::ByteBuffer &src);
 
+/**
+ * Hands the contents of src over to dest without copying them, leaving src empty; for buffers such as KMS results
+ * which the caller has no further use for. Only a small record of the ByteBuffer is allocated, with allocator.
+ * dest->allocator is private to dest: aws_byte_buf_clean_up(dest) or aws_byte_buf_clean_up_secure(dest) wipes and
+ * frees the data, but dest must not be resized or reallocated. An empty src leaves dest zeroed.
+ * Returns AWS_OP_SUCCESS in case of success or AWS_OP_ERR when memory can't be allocated, leaving src unchanged.
+ */
+AWS_CRYPTOSDK_CPP_API
+int aws_byte_buf_adopt_from_aws_utils(
+    struct aws_allocator *allocator, struct aws_byte_buf *dest, Aws::Utils::ByteBuffer &&src);
+
 /**
  * Appends a new key to the encrypted_data_keys.
  * Note: a new memory zone will be allocated for the inserted values in encrypted_data_keys
@@ -83,6 +102,20 @@ int append_key_dup_to_edks(
     const Aws::String *data_key_id,
     const aws_byte_buf *key_provider);
 
+/**
+ * Appends a new key to the encrypted_data_keys, as append_key_dup_to_edks does, but takes over encrypted_data_key
+ * rather than copying it (see aws_byte_buf_adopt_from_aws_utils). data_key_id and key_provider are copied into a
+ * single allocation. encrypted_data_key is left empty, unless this fails before it is taken.
+ * @return AWS_OP_SUCCESS in case of success
+ */
+AWS_CRYPTOSDK_CPP_API
+int append_key_to_edks(
+    struct aws_allocator *allocator,
+    struct aws_array_list *encrypted_data_keys,
+    Aws::Utils::ByteBuffer &&encrypted_data_key,
+    const Aws::String &data_key_id,
+    const aws_byte_buf *key_provider);
+
 /**
  * Extracts region from a KMS Key ARN
  * E.g. From a key like:
@@ -93,6 +126,15 @@ int append_key_dup_to_edks(
 AWS_CRYPTOSDK_CPP_API
 Aws::String parse_region_from_kms_key_arn(const Aws::String &key_id);
 
+/**
+ * Splits a KMS Key ARN of the form arn:[partition]:kms:[region]:[account]:[resource] into its
+ * partition, region and account ID. Returns false, leaving the outputs unspecified, if key_id is
+ * not such an ARN or any of those parts is empty.
+ */
+AWS_CRYPTOSDK_CPP_API
+bool parse_kms_key_arn(
+    const Aws::String &key_id, Aws::String &partition, Aws::String &region, Aws::String &account_id);
+
 }  // namespace Private
 }  // namespace Cryptosdk
 }  // namespace Aws
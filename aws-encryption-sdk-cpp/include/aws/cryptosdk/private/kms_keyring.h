@@ -16,11 +16,177 @@
 #define AWS_ENCRYPTION_SDK_PRIVATE_KMS_KEYRING_H
 
 #include <aws/cryptosdk/cpp/kms_keyring.h>
+#include <aws/kms/model/DecryptResult.h>
+#include <aws/kms/model/GenerateDataKeyRequest.h>
+#include <aws/kms/model/GenerateDataKeyResult.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 
 namespace Aws {
 namespace Cryptosdk {
 namespace Private {
 
+/**
+ * Moving averages of the latency and error rate of the KMS calls a keyring has made to each region,
+ * which it uses to decide which EDKs to try first. Shared with the handlers of calls which may
+ * finish after the keyring is gone.
+ */
+class AWS_CRYPTOSDK_CPP_API RegionLatencyTracker {
+   public:
+    void Record(const Aws::String &region, double latency_ms, bool success);
+
+    /**
+     * Returns the expected time spent on calls to the region for each one that succeeds, or zero
+     * for a region without any calls yet, so that regions are tried at least once.
+     */
+    double ExpectedLatencyMs(const Aws::String &region) const;
+
+    /**
+     * Returns the latency below which the given fraction of recent calls to the region completed,
+     * rounded up to a histogram bucket, or a negative value while there are too few samples.
+     */
+    double LatencyPercentileMs(const Aws::String &region, double percentile) const;
+
+    enum { LATENCY_BUCKETS = 48 };
+
+   private:
+    struct Stats {
+        double latency_ms;
+        double error_rate;
+        uint32_t samples;
+        uint32_t histogram[LATENCY_BUCKETS];
+    };
+    mutable std::mutex mutex;
+    Aws::Map<Aws::String, Stats> stats;
+};
+
+/**
+ * Queues of data keys generated ahead of time by background GenerateDataKey calls, one queue for
+ * each encryption context and data key length in recent use. Every key is handed out at most once,
+ * and not at all once it is older than the TTL. Shared with the handlers of calls which may finish
+ * after the keyring is gone.
+ */
+class AWS_CRYPTOSDK_CPP_API DataKeyPrefetcher {
+   public:
+    DataKeyPrefetcher(size_t depth, std::chrono::milliseconds ttl);
+
+    /**
+     * Removes the oldest key still within the TTL from the queue for this context and length,
+     * returning false if there is none.
+     */
+    bool Take(
+        const Aws::Map<Aws::String, Aws::String> &enc_ctx,
+        int num_bytes,
+        Aws::KMS::Model::GenerateDataKeyResult &result);
+
+    /**
+     * Starts enough background calls with this request to bring its queue, and the calls already
+     * in flight for it, up to the depth.
+     */
+    static void Refill(
+        const std::shared_ptr<DataKeyPrefetcher> &self,
+        const std::shared_ptr<KMS::KMSClient> &kms_client,
+        const Aws::KMS::Model::GenerateDataKeyRequest &request);
+
+   private:
+    struct Queue {
+        Aws::Map<Aws::String, Aws::String> enc_ctx;
+        int num_bytes;
+        std::deque<std::pair<std::chrono::steady_clock::time_point, Aws::KMS::Model::GenerateDataKeyResult>> keys;
+        size_t in_flight;
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+    /* Must be called with mutex held */
+    std::shared_ptr<Queue> FindQueue(const Aws::Map<Aws::String, Aws::String> &enc_ctx, int num_bytes);
+
+    const size_t depth;
+    const std::chrono::milliseconds ttl;
+    std::mutex mutex;
+    Aws::Vector<std::shared_ptr<Queue>> queues;
+};
+
+/**
+ * Limits extra calls, such as hedges or retries, to a fraction of the calls they could be made
+ * for: each such call credits the budget with that fraction of an extra call, and each extra
+ * call spends a whole one.
+ */
+class AWS_CRYPTOSDK_CPP_API RequestBudget {
+   public:
+    explicit RequestBudget(double ratio);
+    void Credit();
+    /* Returns whether an extra call may be made, spending the budget for it if so */
+    bool Spend();
+
+   private:
+    std::mutex mutex;
+    const double ratio;
+    double tokens;
+};
+
+/**
+ * Limits the rate of KMS calls to each region with a token bucket. A call that finds the bucket
+ * empty reserves the next token and waits for it, unless that would take longer than max_wait, in
+ * which case it is refused; waiting callers are thus served in order and no faster than the rate.
+ */
+class AWS_CRYPTOSDK_CPP_API KmsRateLimiter {
+   public:
+    KmsRateLimiter(double calls_per_second, size_t burst, std::chrono::milliseconds max_wait);
+
+    /* Returns whether a call to region may be made, waiting for a token first if wait is set */
+    bool Acquire(const Aws::String &region, bool wait);
+
+   private:
+    struct Bucket {
+        /* Negative while callers are waiting for tokens they have reserved */
+        double tokens;
+        std::chrono::steady_clock::time_point refilled;
+    };
+
+    const double calls_per_second;
+    const double burst;
+    const std::chrono::milliseconds max_wait;
+    std::mutex mutex;
+    Aws::Map<Aws::String, Bucket> buckets;
+};
+
+/**
+ * Coalesces identical Decrypt calls made at the same time, so that only the first is sent to KMS
+ * and the others wait for and share its outcome. An outcome is forgotten as soon as the call that
+ * produced it completes; later calls with the same key are sent to KMS again.
+ */
+class AWS_CRYPTOSDK_CPP_API DecryptCoalescer {
+   public:
+    /* Returns the outcome of call, or of a call with the same key which is already in flight */
+    Aws::KMS::Model::DecryptOutcome Decrypt(
+        const Aws::String &key, const std::function<Aws::KMS::Model::DecryptOutcome()> &call);
+
+   private:
+    struct InFlight {
+        InFlight() : done(false) {}
+
+        bool done;
+        Aws::KMS::Model::DecryptOutcome outcome;
+        std::condition_variable completed;
+    };
+
+    std::mutex mutex;
+    Aws::Map<Aws::String, std::shared_ptr<InFlight>> in_flight;
+};
+
+/**
+ * The KMS keys a discovery keyring may try to decrypt with: those in the partition, owned by one
+ * of the accounts and, unless regions is empty, in one of the regions.
+ */
+struct DiscoveryFilter {
+    Aws::String partition;
+    Aws::Vector<Aws::String> account_ids;
+    Aws::Vector<Aws::String> regions;
+
+    bool Allows(const Aws::String &key_arn) const;
+};
+
 class AWS_CRYPTOSDK_CPP_API KmsKeyringImpl : public aws_cryptosdk_keyring {
     /* This entire class is a private implementation anyway, as users only handle
      * pointers to instances as (struct aws_cryptosdk_keyring *) types.
@@ -41,22 +207,87 @@ class AWS_CRYPTOSDK_CPP_API KmsKeyringImpl : public aws_cryptosdk_keyring {
      * @param key_ids List of KMS customer master keys (CMK)
      * @param grant_tokens A list of grant tokens.
      * @param supplier Object that supplies the KMSClient instances to use for each region.
+     * @param decrypt_concurrency Number of EDKs for which Decrypt calls may be in flight at once.
+     * @param local_region Region whose EDKs are tried first on decryption, if any.
+     * @param prefetch_depth Number of data keys to generate ahead of time per context, or zero.
+     * @param prefetch_ttl Age after which data keys generated ahead of time are discarded.
+     * @param hedge_percentile Latency percentile of a region after which a call to it is hedged.
+     * @param hedge_budget Largest fraction of calls which may be hedged, or zero to disable hedging.
+     * @param hedge_client_supplier Supplier of the clients for hedged calls, or null to use supplier.
+     * @param rate_limit Most KMS calls per second to each region, or zero for no limit.
+     * @param rate_burst Most KMS calls to a region which may be made at once within the limit.
+     * @param rate_max_wait Longest time a call waits for the limit before it is refused.
+     * @param retry_budget Largest fraction of calls which may be retried after throttling, or zero.
+     * @param discovery_filter Keys a discovery keyring is limited to, or null for no limit.
+     * @param metrics_sink Receiver of metrics about each KMS call, or null.
+     * @param async_executor Executor for asynchronous keyring calls, or null to make them synchronously.
      */
     KmsKeyringImpl(
         const Aws::Vector<Aws::String> &key_ids,
         const Aws::Vector<Aws::String> &grant_tokens,
-        std::shared_ptr<Aws::Cryptosdk::KmsKeyring::ClientSupplier> supplier);
+        std::shared_ptr<Aws::Cryptosdk::KmsKeyring::ClientSupplier> supplier,
+        size_t decrypt_concurrency             = 1,
+        const Aws::String &local_region        = "",
+        size_t prefetch_depth                  = 0,
+        std::chrono::milliseconds prefetch_ttl = std::chrono::milliseconds(0),
+        double hedge_percentile                = 0,
+        double hedge_budget                    = 0,
+        std::shared_ptr<Aws::Cryptosdk::KmsKeyring::ClientSupplier> hedge_client_supplier = nullptr,
+        double rate_limit                       = 0,
+        size_t rate_burst                       = 1,
+        std::chrono::milliseconds rate_max_wait = std::chrono::milliseconds(0),
+        double retry_budget                     = 0,
+        std::shared_ptr<const DiscoveryFilter> discovery_filter = nullptr,
+        std::shared_ptr<Aws::Cryptosdk::KmsKeyring::MetricsSink> metrics_sink = nullptr,
+        std::shared_ptr<Aws::Utils::Threading::Executor> async_executor       = nullptr);
 
     /**
      * Returns the KMS Client for a specific key ID
      */
     std::shared_ptr<KMS::KMSClient> GetKmsClient(const Aws::String &key_id) const;
 
+    /**
+     * Returns enc_ctx converted for use in KMS requests. The last conversion is kept, and handed
+     * out again for as long as messages have the same context, so that the usual case of a steady
+     * context costs a comparison rather than a copy of every key and value.
+     */
+    std::shared_ptr<const Aws::Map<Aws::String, Aws::String>> ConvertEncryptionContext(
+        const struct aws_hash_table *enc_ctx);
+
     const aws_byte_buf key_provider;
     std::shared_ptr<Aws::Cryptosdk::KmsKeyring::ClientSupplier> kms_client_supplier;
 
     Aws::Vector<Aws::String> grant_tokens;
     Aws::Vector<Aws::String> key_ids;
+    size_t decrypt_concurrency;
+    Aws::String local_region;
+    std::shared_ptr<RegionLatencyTracker> region_latencies;
+
+    std::mutex enc_ctx_mutex;
+    std::shared_ptr<const Aws::Map<Aws::String, Aws::String>> last_enc_ctx;
+
+    /* Null unless data keys are generated ahead of time */
+    std::shared_ptr<DataKeyPrefetcher> data_key_prefetcher;
+
+    double hedge_percentile;
+    /* Null unless calls are hedged */
+    std::shared_ptr<RequestBudget> hedge_budget;
+    std::shared_ptr<Aws::Cryptosdk::KmsKeyring::ClientSupplier> hedge_client_supplier;
+
+    /* Null unless KMS calls are rate limited or retried, respectively */
+    std::shared_ptr<KmsRateLimiter> rate_limiter;
+    std::shared_ptr<RequestBudget> retry_budget;
+
+    std::shared_ptr<DecryptCoalescer> decrypt_coalescer;
+
+    /* Null unless this is a discovery keyring limited to some accounts */
+    std::shared_ptr<const DiscoveryFilter> discovery_filter;
+
+    /* Null unless KMS calls are reported */
+    std::shared_ptr<Aws::Cryptosdk::KmsKeyring::MetricsSink> metrics_sink;
+
+    /* Null unless keyring calls may be made asynchronously */
+    std::shared_ptr<Aws::Utils::Threading::Executor> async_executor;
 };
 
 }  // namespace Private
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/cryptosdk/cpp/async_session.h>
+
+#include <aws/cryptosdk/error.h>
+#include <utility>
+
+namespace Aws {
+namespace Cryptosdk {
+
+AsyncSession::AsyncSession(struct aws_cryptosdk_session *session, Executor executor)
+    : session(session),
+      executor(std::move(executor)),
+      encrypting(false),
+      input(nullptr),
+      input_len(0),
+      consumed(0),
+      output(nullptr),
+      produced(0),
+      running(false),
+      ready(false) {}
+
+void AsyncSession::Encrypt(
+    const uint8_t *plaintext, size_t plaintext_len, std::vector<uint8_t> *ciphertext, Completion done) {
+    Start(true, plaintext, plaintext_len, ciphertext, std::move(done));
+}
+
+void AsyncSession::Decrypt(
+    const uint8_t *ciphertext, size_t ciphertext_len, std::vector<uint8_t> *plaintext, Completion done) {
+    Start(false, ciphertext, ciphertext_len, plaintext, std::move(done));
+}
+
+void AsyncSession::Start(
+    bool encrypt, const uint8_t *input, size_t input_len, std::vector<uint8_t> *output, Completion done) {
+    if (aws_cryptosdk_session_set_async_callback(session, OnReady, this) ||
+        (encrypt && aws_cryptosdk_session_set_message_size(session, input_len))) {
+        done(aws_last_error());
+        return;
+    }
+
+    this->encrypting = encrypt;
+    this->input      = input;
+    this->input_len  = input_len;
+    this->consumed   = 0;
+    this->output     = output;
+    this->produced   = 0;
+    this->done       = std::move(done);
+    output->clear();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = true;
+        ready   = false;
+    }
+    Run();
+}
+
+void AsyncSession::OnReady(struct aws_cryptosdk_session *, void *user_data) {
+    auto self = static_cast<AsyncSession *>(user_data);
+
+    {
+        std::lock_guard<std::mutex> lock(self->mutex);
+        if (self->running) {
+            self->ready = true;
+            return;
+        }
+        self->running = true;
+    }
+    self->executor([self] { self->Run(); });
+}
+
+/* Processes until the message is done or fails, or the session waits on its materials */
+void AsyncSession::Run() {
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t out_needed, in_needed;
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+        if (output->size() - produced < out_needed) output->resize(produced + out_needed);
+
+        size_t written, read;
+        if (aws_cryptosdk_session_process(
+                session,
+                output->data() + produced,
+                output->size() - produced,
+                &written,
+                input + consumed,
+                input_len - consumed,
+                &read)) {
+            Finish(aws_last_error());
+            return;
+        }
+        produced += written;
+        consumed += read;
+
+        if (aws_cryptosdk_session_is_pending(session)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!ready) {
+                // OnReady schedules the next Run
+                running = false;
+                return;
+            }
+            ready = false;
+            continue;
+        }
+
+        if (!written && !read && !aws_cryptosdk_session_is_done(session)) {
+            // With all the room it asked for and no progress, the session needs input we do not have
+            aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+            if (out_needed > output->size() - produced) continue;
+
+            int error_code = encrypting ? AWS_CRYPTOSDK_ERR_BAD_STATE : AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT;
+            aws_raise_error(error_code);
+            Finish(error_code);
+            return;
+        }
+    }
+
+    Finish(AWS_ERROR_SUCCESS);
+}
+
+void AsyncSession::Finish(int error_code) {
+    Completion done = std::move(this->done);
+    output->resize(produced);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+        ready   = false;
+    }
+    // The completion may destroy this object, so nothing here is touched after it
+    done(error_code);
+}
+
+}  // namespace Cryptosdk
+}  // namespace Aws
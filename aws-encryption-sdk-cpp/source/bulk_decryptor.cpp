@@ -0,0 +1,258 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/cryptosdk/cpp/bulk_decryptor.h>
+
+#include <aws/cryptosdk/error.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Aws {
+namespace Cryptosdk {
+
+struct BulkDecryptor::Job {
+    uint64_t id;
+    struct aws_cryptosdk_session *session;
+    std::vector<uint8_t> ciphertext, plaintext;
+    size_t consumed;
+    int error_code;
+};
+
+/* Hands jobs from one stage to the next; Pop returns false once the queue is closed and empty */
+class BulkDecryptor::JobQueue {
+   public:
+    JobQueue() : closed(false) {}
+
+    void Push(Job *job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job);
+        not_empty.notify_one();
+    }
+
+    bool Pop(Job **job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return closed || !jobs.empty(); });
+        if (jobs.empty()) return false;
+        *job = jobs.front();
+        jobs.pop_front();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+    }
+
+   private:
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::deque<Job *> jobs;
+    bool closed;
+};
+
+BulkDecryptor::BulkDecryptor(
+    struct aws_cryptosdk_cmm *cmm, unsigned unwrap_threads, unsigned decrypt_threads, size_t max_in_flight)
+    : cmm(cmm), unwrap_threads(std::max(1u, unwrap_threads)), decrypt_threads(decrypt_threads) {
+    if (!this->decrypt_threads) this->decrypt_threads = std::max(1u, std::thread::hardware_concurrency());
+    this->max_in_flight = std::max<size_t>(max_in_flight, this->unwrap_threads + this->decrypt_threads);
+}
+
+BulkDecryptor::~BulkDecryptor() {
+    for (auto session : idle_sessions) aws_cryptosdk_session_destroy(session);
+}
+
+void BulkDecryptor::SetSessionSetup(const SessionSetup &setup) {
+    this->setup = setup;
+}
+
+struct aws_cryptosdk_session *BulkDecryptor::AcquireSession() {
+    if (!idle_sessions.empty()) {
+        struct aws_cryptosdk_session *session = idle_sessions.back();
+        idle_sessions.pop_back();
+        return session;
+    }
+
+    struct aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_cmm(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, cmm);
+    if (session && setup && setup(session)) {
+        aws_cryptosdk_session_destroy(session);
+        return nullptr;
+    }
+    return session;
+}
+
+void BulkDecryptor::ReleaseSession(struct aws_cryptosdk_session *session) {
+    if (aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT)) {
+        aws_cryptosdk_session_destroy(session);
+        return;
+    }
+    idle_sessions.push_back(session);
+}
+
+/*
+ * Reads the header, which has the session unwrap the data key, but offers no room for
+ * plaintext, so that the body is left for the decrypt stage.
+ */
+void BulkDecryptor::UnwrapKey(Job *job) {
+    uint8_t unused;
+    size_t written;
+
+    if (aws_cryptosdk_session_process(
+            job->session, &unused, 0, &written, job->ciphertext.data(), job->ciphertext.size(), &job->consumed)) {
+        job->error_code = aws_last_error();
+    } else if (!job->consumed) {
+        // Nothing is consumed until the whole header is there, and the whole message is
+        job->error_code = AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT;
+    }
+}
+
+void BulkDecryptor::DecryptBody(Job *job) {
+    struct aws_cryptosdk_session *session = job->session;
+    size_t produced                       = 0;
+
+    job->plaintext.reserve(job->ciphertext.size());
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t out_needed, in_needed, written, read;
+
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+        if (job->plaintext.size() - produced < out_needed) job->plaintext.resize(produced + out_needed);
+
+        if (aws_cryptosdk_session_process(
+                session,
+                job->plaintext.data() + produced,
+                job->plaintext.size() - produced,
+                &written,
+                job->ciphertext.data() + job->consumed,
+                job->ciphertext.size() - job->consumed,
+                &read)) {
+            job->error_code = aws_last_error();
+            break;
+        }
+        produced += written;
+        job->consumed += read;
+
+        if (!written && !read && !aws_cryptosdk_session_is_done(session)) {
+            // With all the room it asked for and no progress, the message must be truncated
+            aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+            if (out_needed > job->plaintext.size() - produced) continue;
+            job->error_code = AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT;
+            break;
+        }
+    }
+
+    job->plaintext.resize(job->error_code == AWS_ERROR_SUCCESS ? produced : 0);
+}
+
+int BulkDecryptor::Decrypt(const Source &source, const Sink &sink) {
+    JobQueue unwrap_queue, decrypt_queue, output_queue;
+    std::vector<std::thread> unwrappers, decrypters;
+    std::atomic<int> stop_error(AWS_ERROR_SUCCESS);
+    std::mutex mutex;
+    std::condition_variable slot_freed;
+    size_t in_flight = 0;
+
+    auto stopped = [&] { return stop_error.load() != AWS_ERROR_SUCCESS; };
+    auto stop    = [&](int error_code) {
+        int expected = AWS_ERROR_SUCCESS;
+        stop_error.compare_exchange_strong(expected, error_code);
+        std::lock_guard<std::mutex> lock(mutex);
+        slot_freed.notify_all();
+    };
+
+    // Runs a stage on its pool, passing each job it takes from in along to out
+    auto start_stage = [](std::vector<std::thread> *threads,
+                          unsigned num_threads,
+                          JobQueue *in,
+                          JobQueue *out,
+                          const std::function<void(Job *)> &stage) {
+        for (unsigned i = 0; i < num_threads; i++) {
+            threads->emplace_back([=] {
+                Job *job;
+                while (in->Pop(&job)) {
+                    stage(job);
+                    out->Push(job);
+                }
+            });
+        }
+    };
+    auto join_stage = [](std::vector<std::thread> *threads, JobQueue *in) {
+        in->Close();
+        for (auto &thread : *threads) thread.join();
+    };
+
+    // Once the batch is stopped, jobs still pass through every stage, but without any work done
+    start_stage(&unwrappers, unwrap_threads, &unwrap_queue, &decrypt_queue, [&](Job *job) {
+        if (!stopped()) UnwrapKey(job);
+    });
+    start_stage(&decrypters, decrypt_threads, &decrypt_queue, &output_queue, [&](Job *job) {
+        if (!stopped() && job->error_code == AWS_ERROR_SUCCESS) DecryptBody(job);
+        std::vector<uint8_t>().swap(job->ciphertext);
+    });
+    std::thread output([&] {
+        Job *job;
+        while (output_queue.Pop(&job)) {
+            std::unique_ptr<Job> owned(job);
+            if (!stopped() && sink(job->id, job->error_code, &job->plaintext)) stop(aws_last_error());
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ReleaseSession(job->session);
+            in_flight--;
+            slot_freed.notify_all();
+        }
+    });
+
+    for (uint64_t id = 0;; id++) {
+        std::unique_ptr<Job> job(new Job());
+        job->id         = id;
+        job->consumed   = 0;
+        job->error_code = AWS_ERROR_SUCCESS;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            slot_freed.wait(lock, [&] { return in_flight < max_in_flight || stopped(); });
+            if (stopped()) break;
+            job->session = AcquireSession();
+            if (job->session) in_flight++;
+        }
+        if (!job->session) {
+            stop(aws_last_error());
+            break;
+        }
+
+        if (!source(&job->ciphertext)) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ReleaseSession(job->session);
+            in_flight--;
+            break;
+        }
+        unwrap_queue.Push(job.release());
+    }
+
+    join_stage(&unwrappers, &unwrap_queue);
+    join_stage(&decrypters, &decrypt_queue);
+    output_queue.Close();
+    output.join();
+
+    if (stopped()) return aws_raise_error(stop_error.load());
+    return AWS_OP_SUCCESS;
+}
+
+}  // namespace Cryptosdk
+}  // namespace Aws
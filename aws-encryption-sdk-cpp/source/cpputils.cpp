@@ -18,6 +18,10 @@
 #include <aws/common/hash_table.h>
 #include <aws/cryptosdk/error.h>
 #include <aws/cryptosdk/materials.h>
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <utility>
 
 namespace Aws {
 namespace Cryptosdk {
@@ -41,6 +45,56 @@ int aws_byte_buf_dup_from_aws_utils(
     return aws_byte_buf_init_copy(dest, allocator, &data_key_bb);
 }
 
+namespace {
+/**
+ * A ByteBuffer handed over to an aws_byte_buf. The embedded allocator is the aws_byte_buf's, and can only release
+ * the buffer, which destroys this record along with it.
+ */
+struct AdoptedByteBuffer {
+    struct aws_allocator release_only;
+    struct aws_allocator *allocator;
+    Aws::Utils::ByteBuffer buffer;
+
+    AdoptedByteBuffer(struct aws_allocator *allocator, Aws::Utils::ByteBuffer &&buffer)
+        : allocator(allocator), buffer(std::move(buffer)) {}
+};
+}  // namespace
+
+static void *adopted_byte_buffer_acquire(struct aws_allocator *, size_t) {
+    return NULL;
+}
+
+static void adopted_byte_buffer_release(struct aws_allocator *release_only, void *) {
+    auto adopted                    = static_cast<AdoptedByteBuffer *>(release_only->impl);
+    struct aws_allocator *allocator = adopted->allocator;
+    aws_secure_zero(adopted->buffer.GetUnderlyingData(), adopted->buffer.GetLength());
+    adopted->~AdoptedByteBuffer();
+    aws_mem_release(allocator, adopted);
+}
+
+int aws_byte_buf_adopt_from_aws_utils(
+    struct aws_allocator *allocator, struct aws_byte_buf *dest, Aws::Utils::ByteBuffer &&src) {
+    if (!src.GetLength()) {
+        AWS_ZERO_STRUCT(*dest);
+        return AWS_OP_SUCCESS;
+    }
+
+    void *mem = aws_mem_acquire(allocator, sizeof(AdoptedByteBuffer));
+    if (!mem) return AWS_OP_ERR;
+    auto adopted = new (mem) AdoptedByteBuffer(allocator, std::move(src));
+
+    AWS_ZERO_STRUCT(adopted->release_only);
+    adopted->release_only.mem_acquire = adopted_byte_buffer_acquire;
+    adopted->release_only.mem_release = adopted_byte_buffer_release;
+    adopted->release_only.impl        = adopted;
+
+    dest->buffer    = adopted->buffer.GetUnderlyingData();
+    dest->len       = adopted->buffer.GetLength();
+    dest->capacity  = adopted->buffer.GetLength();
+    dest->allocator = &adopted->release_only;
+    return AWS_OP_SUCCESS;
+}
+
 Aws::Map<Aws::String, Aws::String> aws_map_from_c_aws_hash_table(const struct aws_hash_table *hash_table) {
     Aws::Map<Aws::String, Aws::String> result;
 
@@ -58,6 +112,42 @@ Aws::Map<Aws::String, Aws::String> aws_map_from_c_aws_hash_table(const struct aw
     return result;
 }
 
+static bool aws_string_eq_c_aws_string(const Aws::String &str, const struct aws_string *c_aws_string) {
+    return str.size() == c_aws_string->len && !memcmp(str.data(), aws_string_bytes(c_aws_string), str.size());
+}
+
+/* Orders like Aws::String's operator<, which compares characters as unsigned */
+static bool map_key_less_than_c_aws_string(
+    const std::pair<const Aws::String, Aws::String> &entry, const struct aws_string *key) {
+    size_t common = std::min(entry.first.size(), key->len);
+    int cmp       = memcmp(entry.first.data(), aws_string_bytes(key), common);
+    return cmp < 0 || (cmp == 0 && entry.first.size() < key->len);
+}
+
+bool aws_map_eq_c_aws_hash_table(
+    const Aws::Map<Aws::String, Aws::String> &map, const struct aws_hash_table *hash_table) {
+    if (hash_table == NULL) {
+        return map.empty();
+    }
+    if (map.size() != aws_hash_table_get_entry_count(hash_table)) {
+        return false;
+    }
+
+    for (struct aws_hash_iter iter = aws_hash_iter_begin(hash_table); !aws_hash_iter_done(&iter);
+         aws_hash_iter_next(&iter)) {
+        const struct aws_string *key   = (struct aws_string *)iter.element.key;
+        const struct aws_string *value = (struct aws_string *)iter.element.value;
+
+        auto it = std::lower_bound(map.begin(), map.end(), key, map_key_less_than_c_aws_string);
+        if (it == map.end() || !aws_string_eq_c_aws_string(it->first, key) ||
+            !aws_string_eq_c_aws_string(it->second, value)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 int append_aws_byte_buf_key_dup_to_edks(
     struct aws_allocator *allocator,
     struct aws_array_list *encrypted_data_keys,
@@ -96,6 +186,30 @@ int append_key_dup_to_edks(
     return append_aws_byte_buf_key_dup_to_edks(
         allocator, encrypted_data_keys, &enc_data_key_byte, &data_key_id_byte, key_provider);
 }
+
+int append_key_to_edks(
+    struct aws_allocator *allocator,
+    struct aws_array_list *encrypted_data_keys,
+    Utils::ByteBuffer &&encrypted_data_key,
+    const Aws::String &data_key_id,
+    const struct aws_byte_buf *key_provider) {
+    struct aws_cryptosdk_edk edk;
+
+    // The ciphertext takes no part of the packed allocation, so it is free to be adopted in its place
+    if (aws_cryptosdk_edk_init_packed(allocator, &edk, key_provider->len, data_key_id.length(), 0)) {
+        return AWS_OP_ERR;
+    }
+    aws_byte_buf_write_from_whole_buffer(&edk.provider_id, *key_provider);
+    aws_byte_buf_write(&edk.provider_info, (const uint8_t *)data_key_id.data(), data_key_id.length());
+
+    if (aws_byte_buf_adopt_from_aws_utils(allocator, &edk.ciphertext, std::move(encrypted_data_key)) ||
+        aws_array_list_push_back(encrypted_data_keys, &edk)) {
+        aws_cryptosdk_edk_clean_up(&edk);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
 /**
  * Compares an aws_byte_buf (byte_buf_b) with a sequence of characters (char_buf_a)
  * @param char_buf_a Sequence of characters
@@ -150,6 +264,28 @@ Aws::String parse_region_from_kms_key_arn(const Aws::String &key_id) {
     return Aws::String(key_id.data() + idx_start, idx_end - idx_start);
 }
 
+bool parse_kms_key_arn(
+    const Aws::String &key_id, Aws::String &partition, Aws::String &region, Aws::String &account_id) {
+    Aws::String *fields[] = { NULL, &partition, NULL, &region, &account_id };
+    size_t idx_start      = 0;
+
+    for (size_t field = 0; field < sizeof(fields) / sizeof(fields[0]); field++) {
+        size_t idx_end = key_id.find(':', idx_start);
+        if (idx_end == std::string::npos || idx_start == idx_end) {
+            return false;
+        }
+        Aws::String value(key_id.data() + idx_start, idx_end - idx_start);
+        if (fields[field]) {
+            *fields[field] = value;
+        } else if (value != (field == 0 ? "arn" : "kms")) {
+            return false;
+        }
+        idx_start = idx_end + 1;
+    }
+    // The resource must follow the account ID
+    return idx_start < key_id.size();
+}
+
 }  // namespace Private
 }  // namespace Cryptosdk
 }  // namespace Aws
@@ -14,25 +14,40 @@
  */
 #include <aws/cryptosdk/private/kms_keyring.h>
 
+#include <aws/core/client/AWSError.h>
+#include <aws/core/client/CoreErrors.h>
+#include <aws/core/client/DefaultRetryStrategy.h>
 #include <aws/core/utils/Outcome.h>
 #include <aws/core/utils/logging/LogMacros.h>
 #include <aws/core/utils/memory/MemorySystemInterface.h>
 #include <aws/core/utils/memory/stl/AWSAllocator.h>
+#include <aws/core/utils/memory/stl/AWSList.h>
 #include <aws/cryptosdk/list_utils.h>
 #include <aws/cryptosdk/private/cpputils.h>
+#include <aws/cryptosdk/private/probes.h>
 #include <aws/cryptosdk/private/user_agent.h>
+#include <aws/kms/KMSErrors.h>
 #include <aws/kms/model/DecryptRequest.h>
 #include <aws/kms/model/DecryptResult.h>
 #include <aws/kms/model/EncryptRequest.h>
 #include <aws/kms/model/EncryptResult.h>
 #include <aws/kms/model/GenerateDataKeyRequest.h>
 #include <aws/kms/model/GenerateDataKeyResult.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iterator>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 namespace Aws {
 namespace Cryptosdk {
 
-using Private::append_key_dup_to_edks;
-using Private::aws_byte_buf_dup_from_aws_utils;
+using Private::append_key_to_edks;
+using Private::aws_byte_buf_adopt_from_aws_utils;
+using Private::aws_map_eq_c_aws_hash_table;
 using Private::aws_map_from_c_aws_hash_table;
 using Private::aws_utils_byte_buffer_from_c_aws_byte_buf;
 
@@ -44,6 +59,439 @@ static void DestroyKeyring(struct aws_cryptosdk_keyring *keyring) {
     Aws::Delete(keyring_data_ptr);
 }
 
+/* Any EDK with the KMS provider ID may be one of ours; the key ARN in its provider info is checked on decrypt */
+static int GetEdkFilter(
+    const struct aws_cryptosdk_keyring *keyring,
+    struct aws_byte_cursor *provider_id,
+    struct aws_byte_cursor *provider_info_prefix) {
+    auto self             = static_cast<const Aws::Cryptosdk::Private::KmsKeyringImpl *>(keyring);
+    *provider_id          = aws_byte_cursor_from_buf(&self->key_provider);
+    *provider_info_prefix = aws_byte_cursor_from_array(NULL, 0);
+    return AWS_OP_SUCCESS;
+}
+
+/**
+ * An EDK which OnDecrypt may ask KMS to decrypt, with everything needed to make the call
+ */
+struct DecryptCandidate {
+    Aws::String key_arn;
+    Aws::String region;
+    /* Expected latency of a call to the region, as of when the candidate was found */
+    double expected_ms;
+    Aws::KMS::Model::DecryptRequest request;
+};
+
+/**
+ * State shared by RaceDecrypts and the handlers of the calls it makes, which may complete after it
+ * has returned. Guarded by mutex.
+ */
+struct DecryptRace {
+    DecryptRace() : pending(0), won(false), winner(0) {}
+
+    std::mutex mutex;
+    std::condition_variable settled;
+    size_t pending;
+    bool won;
+    size_t winner;
+    std::function<void()> report_success;
+    Aws::KMS::Model::DecryptResult result;
+    Aws::StringStream errors;
+};
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static size_t ResultBytes(const Aws::KMS::Model::GenerateDataKeyResult &result) {
+    return result.GetPlaintext().GetLength() + result.GetCiphertextBlob().GetLength();
+}
+
+static size_t ResultBytes(const Aws::KMS::Model::EncryptResult &result) {
+    return result.GetCiphertextBlob().GetLength();
+}
+
+static size_t ResultBytes(const Aws::KMS::Model::DecryptResult &result) {
+    return result.GetPlaintext().GetLength();
+}
+
+template <typename Outcome>
+static KmsKeyring::KmsErrorClass ClassifyKmsError(const Outcome &outcome) {
+    using KmsKeyring::KmsErrorClass;
+    if (outcome.IsSuccess()) return KmsErrorClass::NONE;
+
+    switch (outcome.GetError().GetErrorType()) {
+        case KMS::KMSErrors::THROTTLING:
+        case KMS::KMSErrors::SLOW_DOWN:
+        case KMS::KMSErrors::LIMIT_EXCEEDED: return KmsErrorClass::THROTTLED;
+        case KMS::KMSErrors::ACCESS_DENIED: return KmsErrorClass::ACCESS_DENIED;
+        case KMS::KMSErrors::NETWORK_CONNECTION:
+        case KMS::KMSErrors::REQUEST_TIMEOUT: return KmsErrorClass::NETWORK;
+        default: return KmsErrorClass::OTHER;
+    }
+}
+
+/**
+ * Fires the kms_call_start probe, and returns the time the call starts at for ReportKmsCall.
+ */
+static std::chrono::steady_clock::time_point StartKmsCall(KmsKeyring::KmsOperation operation) {
+    AWS_CRYPTOSDK_PROBE1(kms_call_start, (int)operation);
+    return std::chrono::steady_clock::now();
+}
+
+/** Fires the kms_call_end probe for a call made between start and completed */
+static void EndKmsCall(
+    KmsKeyring::KmsOperation operation,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point completed,
+    bool success) {
+    auto latency_us = std::chrono::duration_cast<std::chrono::microseconds>(completed - start).count();
+    AWS_CRYPTOSDK_PROBE3(kms_call_end, (int)operation, (long long)latency_us, (int)success);
+}
+
+/**
+ * Reports a KMS call made between start and completed, with outcome, to the kms_call_end probe
+ * and to sink if there is one.
+ */
+template <typename Outcome>
+static void ReportKmsCall(
+    const std::shared_ptr<KmsKeyring::MetricsSink> &sink,
+    KmsKeyring::KmsOperation operation,
+    const Aws::String &region,
+    const Aws::String &key_id,
+    std::chrono::steady_clock::time_point start,
+    const Outcome &outcome,
+    size_t bytes_sent,
+    std::chrono::steady_clock::time_point completed = std::chrono::steady_clock::now()) {
+    EndKmsCall(operation, start, completed, outcome.IsSuccess());
+    if (!sink) return;
+
+    auto latency = completed - start;
+    KmsKeyring::KmsCallMetrics metrics;
+    metrics.operation      = operation;
+    metrics.region         = region;
+    metrics.key_id         = key_id;
+    metrics.latency        = std::chrono::duration_cast<std::chrono::microseconds>(latency);
+    metrics.error_class    = ClassifyKmsError(outcome);
+    metrics.bytes_sent     = bytes_sent;
+    metrics.bytes_received = outcome.IsSuccess() ? ResultBytes(outcome.GetResult()) : 0;
+    sink->OnKmsCall(metrics);
+}
+
+/**
+ * Returns the outcome of a KMS call refused by the keyring's rate limiter. It is not retryable,
+ * since retrying would only add to the overload that the limiter protects KMS from.
+ */
+template <typename Outcome>
+static Outcome RateLimitedOutcome() {
+    return Outcome(Aws::Client::AWSError<Aws::Client::CoreErrors>(
+        Aws::Client::CoreErrors::THROTTLING, "ClientRateLimitExceeded", "KMS call refused by the rate limit", false));
+}
+
+/**
+ * Makes a KMS call to region with call, subject to the keyring's rate limit. A call which fails
+ * with a retryable error, such as throttling, is made again for as long as the retry budget
+ * allows, so that retries stay a small fraction of all calls however overloaded KMS is.
+ */
+template <typename Outcome>
+static Outcome LimitedCall(
+    const Aws::Cryptosdk::Private::KmsKeyringImpl *self, const Aws::String &region, std::function<Outcome()> call) {
+    if (self->retry_budget) self->retry_budget->Credit();
+    while (true) {
+        if (self->rate_limiter && !self->rate_limiter->Acquire(region, true)) {
+            AWS_LOGSTREAM_WARN(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "KMS rate limit exceeded for region " << region);
+            return RateLimitedOutcome<Outcome>();
+        }
+        Outcome outcome = call();
+        if (outcome.IsSuccess() || !outcome.GetError().ShouldRetry() || !self->retry_budget ||
+            !self->retry_budget->Spend()) {
+            return outcome;
+        }
+    }
+}
+
+/**
+ * State shared by HedgedCall and the handlers of its calls, which may complete after it has
+ * returned. Guarded by mutex.
+ */
+template <typename Outcome>
+struct HedgeState {
+    HedgeState() : pending(0), answered(false) {}
+
+    std::mutex mutex;
+    std::condition_variable settled;
+    size_t pending;
+    bool answered;
+    Outcome outcome;
+};
+
+/**
+ * Makes a call with launch, which starts it asynchronously on the client it is given and passes
+ * its outcome to the function it is given. If the call has not completed by the keyring's hedging
+ * percentile of the region's latency, and the hedging budget allows, makes the same call again on
+ * a client from the hedge client supplier. Returns the first successful outcome, or the last
+ * failed one if neither succeeds.
+ */
+template <typename Outcome, typename Launch>
+static Outcome HedgedCall(
+    const Aws::Cryptosdk::Private::KmsKeyringImpl *self,
+    const Aws::String &region,
+    const std::shared_ptr<KMS::KMSClient> &kms_client,
+    Launch launch) {
+    auto state   = Aws::MakeShared<HedgeState<Outcome>>(AWS_CRYPTO_SDK_KMS_CLASS_TAG);
+    auto on_done = [state](const Outcome &outcome) {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->pending--;
+        // Keep the latest outcome, so that whichever call is last to finish has one to answer with
+        if (!state->answered) {
+            state->outcome  = outcome;
+            state->answered = outcome.IsSuccess() || !state->pending;
+        }
+        state->settled.notify_all();
+    };
+    auto answered = [&state] { return state->answered; };
+
+    self->hedge_budget->Credit();
+    double deadline_ms = self->region_latencies->LatencyPercentileMs(region, self->hedge_percentile);
+
+    state->pending = 1;
+    launch(kms_client, on_done);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (deadline_ms >= 0 &&
+        !state->settled.wait_for(lock, std::chrono::duration<double, std::milli>(deadline_ms), answered) &&
+        self->hedge_budget->Spend() && (!self->rate_limiter || self->rate_limiter->Acquire(region, false))) {
+        state->pending++;
+        // Some executors run calls inline, so the handlers must be able to take the lock
+        lock.unlock();
+        std::function<void()> report_success;
+        auto &supplier    = self->hedge_client_supplier ? self->hedge_client_supplier : self->kms_client_supplier;
+        auto hedge_client = supplier->GetClient(region, report_success);
+        if (hedge_client) {
+            launch(hedge_client, [on_done, report_success](const Outcome &outcome) {
+                if (outcome.IsSuccess() && report_success) report_success();
+                on_done(outcome);
+            });
+            lock.lock();
+        } else {
+            lock.lock();
+            // The original call may have failed meanwhile, leaving its outcome as the answer
+            if (!--state->pending) state->answered = true;
+        }
+    }
+    state->settled.wait(lock, answered);
+    return state->outcome;
+}
+
+static void AppendKeyField(Aws::String &key, const char *data, size_t len) {
+    // Length-prefixed, so that no two different requests can have the same key
+    key.append((const char *)&len, sizeof(len));
+    key.append(data, len);
+}
+
+/**
+ * Returns a key identifying everything in the candidate's request that KMS decrypts with, which
+ * identical concurrent requests are coalesced on.
+ */
+static Aws::String DecryptRequestKey(const DecryptCandidate &candidate) {
+    const auto &request = candidate.request;
+    const auto &blob    = request.GetCiphertextBlob();
+    Aws::String key;
+
+    AppendKeyField(key, candidate.key_arn.data(), candidate.key_arn.size());
+    AppendKeyField(key, (const char *)blob.GetUnderlyingData(), blob.GetLength());
+    for (const auto &grant_token : request.GetGrantTokens()) {
+        AppendKeyField(key, grant_token.data(), grant_token.size());
+    }
+    // The grant tokens are variable in number, so mark where they end
+    key.push_back('\0');
+    for (const auto &entry : request.GetEncryptionContext()) {
+        AppendKeyField(key, entry.first.data(), entry.first.size());
+        AppendKeyField(key, entry.second.data(), entry.second.size());
+    }
+    return key;
+}
+
+/**
+ * Makes a Decrypt call for the candidate, returning whether it succeeded, in which case the result
+ * is at result. Returns false without making a call if the client supplier does not serve the
+ * candidate's region.
+ */
+static bool DecryptCandidateEdk(
+    const Aws::Cryptosdk::Private::KmsKeyringImpl *self,
+    const DecryptCandidate &candidate,
+    Aws::StringStream &error_buf,
+    Aws::KMS::Model::DecryptResult &result) {
+    std::function<void()> report_success;
+    auto kms_client = self->kms_client_supplier->GetClient(candidate.region, report_success);
+    if (!kms_client) {
+        // Client supplier does not serve this region. Skip.
+        return false;
+    }
+
+    auto decrypt = [&] {
+        auto start = StartKmsCall(KmsKeyring::KmsOperation::DECRYPT);
+        Aws::KMS::Model::DecryptOutcome outcome;
+        if (self->hedge_budget) {
+            outcome = HedgedCall<Aws::KMS::Model::DecryptOutcome>(
+                self,
+                candidate.region,
+                kms_client,
+                [&candidate](
+                    const std::shared_ptr<KMS::KMSClient> &client,
+                    std::function<void(const Aws::KMS::Model::DecryptOutcome &)> done) {
+                    client->DecryptAsync(
+                        candidate.request,
+                        [client, done](
+                            const KMS::KMSClient *,
+                            const Aws::KMS::Model::DecryptRequest &,
+                            const Aws::KMS::Model::DecryptOutcome &outcome,
+                            const std::shared_ptr<const Aws::Client::AsyncCallerContext> &) { done(outcome); });
+                });
+        } else {
+            outcome = kms_client->Decrypt(candidate.request);
+        }
+        self->region_latencies->Record(candidate.region, MillisecondsSince(start), outcome.IsSuccess());
+        ReportKmsCall(
+            self->metrics_sink,
+            KmsKeyring::KmsOperation::DECRYPT,
+            candidate.region,
+            candidate.key_arn,
+            start,
+            outcome,
+            candidate.request.GetCiphertextBlob().GetLength());
+        return outcome;
+    };
+    auto outcome = self->decrypt_coalescer->Decrypt(DecryptRequestKey(candidate), [&] {
+        return LimitedCall<Aws::KMS::Model::DecryptOutcome>(self, candidate.region, decrypt);
+    });
+    if (!outcome.IsSuccess()) {
+        // Failing on this call is normal behavior in "discovery" mode, but not in standard mode.
+        if (self->key_ids.size()) {
+            error_buf << "Error: " << outcome.GetError().GetExceptionName()
+                      << " Message:" << outcome.GetError().GetMessage() << " ";
+        }
+        return false;
+    }
+    report_success();
+
+    result = outcome.GetResultWithOwnership();
+    return result.GetKeyId() == candidate.key_arn;
+}
+
+/**
+ * Makes Decrypt calls for up to decrypt_concurrency candidates at a time, in order, and returns as
+ * soon as any of them succeeds, with its index at winner and its result at result. Calls still in
+ * flight by then are left to complete in the background, and their outcomes are ignored. Returns
+ * false if every call fails.
+ */
+static bool RaceDecrypts(
+    const Aws::Cryptosdk::Private::KmsKeyringImpl *self,
+    const Aws::Vector<DecryptCandidate> &candidates,
+    Aws::StringStream &error_buf,
+    size_t &winner,
+    Aws::KMS::Model::DecryptResult &result) {
+    auto race          = Aws::MakeShared<DecryptRace>(AWS_CRYPTO_SDK_KMS_CLASS_TAG);
+    auto latencies     = self->region_latencies;
+    bool report_errors = self->key_ids.size() != 0;
+    size_t next        = 0;
+
+    std::unique_lock<std::mutex> lock(race->mutex);
+    while (!race->won && (next < candidates.size() || race->pending)) {
+        if (next == candidates.size() || race->pending >= self->decrypt_concurrency) {
+            race->settled.wait(lock);
+            continue;
+        }
+
+        size_t index                      = next++;
+        const DecryptCandidate &candidate = candidates[index];
+        race->pending++;
+
+        // Some executors run the call inline, so its handler must be able to take the lock
+        lock.unlock();
+        std::function<void()> report_success;
+        // The handler holds on to the client, which must outlive the call even if we return first
+        auto kms_client = self->kms_client_supplier->GetClient(candidate.region, report_success);
+        if (!kms_client) {
+            // Client supplier does not serve this region. Skip.
+            lock.lock();
+            race->pending--;
+            continue;
+        }
+        if (self->rate_limiter && !self->rate_limiter->Acquire(candidate.region, true)) {
+            lock.lock();
+            race->pending--;
+            if (report_errors) race->errors << "Error: KMS rate limit exceeded for region " << candidate.region << " ";
+            continue;
+        }
+        Aws::String key_arn = candidate.key_arn;
+        Aws::String region  = candidate.region;
+        auto start          = StartKmsCall(KmsKeyring::KmsOperation::DECRYPT);
+        auto metrics_sink   = self->metrics_sink;
+
+        kms_client->DecryptAsync(
+            candidate.request,
+            [race, latencies, metrics_sink, index, kms_client, report_success, key_arn, region, start, report_errors](
+                const KMS::KMSClient *,
+                const Aws::KMS::Model::DecryptRequest &request,
+                const Aws::KMS::Model::DecryptOutcome &outcome,
+                const std::shared_ptr<const Aws::Client::AsyncCallerContext> &) {
+                latencies->Record(region, MillisecondsSince(start), outcome.IsSuccess());
+                ReportKmsCall(
+                    metrics_sink,
+                    KmsKeyring::KmsOperation::DECRYPT,
+                    region,
+                    key_arn,
+                    start,
+                    outcome,
+                    request.GetCiphertextBlob().GetLength());
+
+                std::unique_lock<std::mutex> handler_lock(race->mutex);
+                race->pending--;
+                if (outcome.IsSuccess() && outcome.GetResult().GetKeyId() == key_arn) {
+                    if (!race->won) {
+                        race->won            = true;
+                        race->winner         = index;
+                        race->report_success = report_success;
+                        race->result         = outcome.GetResult();
+                    }
+                } else if (!outcome.IsSuccess() && report_errors) {
+                    race->errors << "Error: " << outcome.GetError().GetExceptionName()
+                                 << " Message:" << outcome.GetError().GetMessage() << " ";
+                }
+                race->settled.notify_all();
+            });
+        lock.lock();
+    }
+
+    error_buf << race->errors.str();
+    if (!race->won) return false;
+
+    race->report_success();
+    winner = race->winner;
+    result = std::move(race->result);
+    return true;
+}
+
+static int UseDecryptedDataKey(
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const Aws::String &key_arn,
+    Aws::KMS::Model::DecryptResult &result) {
+    // The result is ours alone, and only has a const accessor, so its plaintext is taken rather than copied
+    int ret = aws_byte_buf_adopt_from_aws_utils(
+        request_alloc, unencrypted_data_key, std::move(const_cast<Aws::Utils::CryptoBuffer &>(result.GetPlaintext())));
+    if (ret == AWS_OP_SUCCESS) {
+        aws_cryptosdk_keyring_trace_add_record_c_str(
+            request_alloc,
+            keyring_trace,
+            KEY_PROVIDER_STR,
+            key_arn.c_str(),
+            AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX);
+    }
+    return ret;
+}
+
 static int OnDecrypt(
     struct aws_cryptosdk_keyring *keyring,
     struct aws_allocator *request_alloc,
@@ -60,7 +508,8 @@ static int OnDecrypt(
     }
 
     Aws::StringStream error_buf;
-    const auto enc_ctx_cpp = aws_map_from_c_aws_hash_table(enc_ctx);
+    const auto enc_ctx_cpp = self->ConvertEncryptionContext(enc_ctx);
+    Aws::Vector<DecryptCandidate> candidates;
 
     size_t num_elems = aws_array_list_length(edks);
     for (unsigned int idx = 0; idx < num_elems; idx++) {
@@ -88,6 +537,10 @@ static int OnDecrypt(
             // This keyring does not have access to the CMK used to encrypt this data key. Skip.
             continue;
         }
+        if (self->discovery_filter && !self->discovery_filter->Allows(key_arn)) {
+            // The CMK is outside the accounts this keyring may use, so the call would fail. Skip.
+            continue;
+        }
         Aws::String kms_region = Private::parse_region_from_kms_key_arn(key_arn);
         if (kms_region.empty()) {
             error_buf << "Error: Malformed ciphertext. Provider ID field of KMS EDK is invalid KMS CMK ARN: " << key_arn
@@ -95,42 +548,38 @@ static int OnDecrypt(
             continue;
         }
 
-        std::function<void()> report_success;
-        auto kms_client = self->kms_client_supplier->GetClient(kms_region, report_success);
-        if (!kms_client) {
-            // Client supplier does not serve this region. Skip.
-            continue;
-        }
-
         Aws::KMS::Model::DecryptRequest kms_request;
         kms_request.WithGrantTokens(self->grant_tokens)
             .WithCiphertextBlob(aws_utils_byte_buffer_from_c_aws_byte_buf(&edk->ciphertext))
-            .WithEncryptionContext(enc_ctx_cpp);
+            .WithEncryptionContext(*enc_ctx_cpp);
 
-        Aws::KMS::Model::DecryptOutcome outcome = kms_client->Decrypt(kms_request);
-        if (!outcome.IsSuccess()) {
-            // Failing on this call is normal behavior in "discovery" mode, but not in standard mode.
-            if (self->key_ids.size()) {
-                error_buf << "Error: " << outcome.GetError().GetExceptionName()
-                          << " Message:" << outcome.GetError().GetMessage() << " ";
-            }
-            continue;
+        double expected_ms = self->region_latencies->ExpectedLatencyMs(kms_region);
+        candidates.push_back({ key_arn, kms_region, expected_ms, kms_request });
+    }
+
+    /* Try the local region first, then the others from the fastest and most reliable so far. The
+     * sort is stable, so EDKs in regions with the same estimate stay in header order.
+     */
+    const Aws::String &local_region = self->local_region;
+    std::stable_sort(
+        candidates.begin(), candidates.end(), [&local_region](const DecryptCandidate &a, const DecryptCandidate &b) {
+            bool a_local = a.region == local_region, b_local = b.region == local_region;
+            return a_local != b_local ? a_local : a.expected_ms < b.expected_ms;
+        });
+
+    Aws::KMS::Model::DecryptResult result;
+    if (self->decrypt_concurrency > 1) {
+        size_t winner;
+        if (RaceDecrypts(self, candidates, error_buf, winner, result)) {
+            return UseDecryptedDataKey(
+                request_alloc, unencrypted_data_key, keyring_trace, candidates[winner].key_arn, result);
         }
-        report_success();
-
-        const Aws::String &outcome_key_id = outcome.GetResult().GetKeyId();
-        if (outcome_key_id == key_arn) {
-            int ret = aws_byte_buf_dup_from_aws_utils(
-                request_alloc, unencrypted_data_key, outcome.GetResult().GetPlaintext());
-            if (ret == AWS_OP_SUCCESS) {
-                aws_cryptosdk_keyring_trace_add_record_c_str(
-                    request_alloc,
-                    keyring_trace,
-                    KEY_PROVIDER_STR,
-                    key_arn.c_str(),
-                    AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX);
+    } else {
+        for (auto &candidate : candidates) {
+            if (DecryptCandidateEdk(self, candidate, error_buf, result)) {
+                return UseDecryptedDataKey(
+                    request_alloc, unencrypted_data_key, keyring_trace, candidate.key_arn, result);
             }
-            return ret;
         }
     }
 
@@ -191,7 +640,7 @@ static int OnEncrypt(
     rv = my_keyring_trace.Create(request_alloc);
     if (rv) return rv;
 
-    const auto enc_ctx_cpp = aws_map_from_c_aws_hash_table(enc_ctx);
+    const auto enc_ctx_cpp = self->ConvertEncryptionContext(enc_ctx);
 
     bool generated_new_data_key = false;
     if (!unencrypted_data_key->buffer) {
@@ -218,23 +667,72 @@ static int OnEncrypt(
         kms_request.WithKeyId(key_id)
             .WithGrantTokens(self->grant_tokens)
             .WithNumberOfBytes((int)alg_prop->data_key_len)
-            .WithEncryptionContext(enc_ctx_cpp);
+            .WithEncryptionContext(*enc_ctx_cpp);
 
-        Aws::KMS::Model::GenerateDataKeyOutcome outcome = kms_client->GenerateDataKey(kms_request);
-        if (!outcome.IsSuccess()) {
-            AWS_LOGSTREAM_ERROR(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "Invalid encryption materials algorithm properties");
-            return aws_raise_error(AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+        Aws::KMS::Model::GenerateDataKeyResult generated;
+        auto &prefetcher = self->data_key_prefetcher;
+        if (!prefetcher || !prefetcher->Take(*enc_ctx_cpp, kms_request.GetNumberOfBytes(), generated)) {
+            auto outcome = LimitedCall<Aws::KMS::Model::GenerateDataKeyOutcome>(self, kms_region, [&] {
+                auto start = StartKmsCall(KmsKeyring::KmsOperation::GENERATE_DATA_KEY);
+                Aws::KMS::Model::GenerateDataKeyOutcome outcome;
+                if (self->hedge_budget) {
+                    outcome = HedgedCall<Aws::KMS::Model::GenerateDataKeyOutcome>(
+                        self,
+                        kms_region,
+                        kms_client,
+                        [&kms_request](
+                            const std::shared_ptr<KMS::KMSClient> &client,
+                            std::function<void(const Aws::KMS::Model::GenerateDataKeyOutcome &)> done) {
+                            client->GenerateDataKeyAsync(
+                                kms_request,
+                                [client, done](
+                                    const KMS::KMSClient *,
+                                    const Aws::KMS::Model::GenerateDataKeyRequest &,
+                                    const Aws::KMS::Model::GenerateDataKeyOutcome &outcome,
+                                    const std::shared_ptr<const Aws::Client::AsyncCallerContext> &) {
+                                    done(outcome);
+                                });
+                        });
+                } else {
+                    outcome = kms_client->GenerateDataKey(kms_request);
+                }
+                self->region_latencies->Record(kms_region, MillisecondsSince(start), outcome.IsSuccess());
+                ReportKmsCall(
+                    self->metrics_sink,
+                    KmsKeyring::KmsOperation::GENERATE_DATA_KEY,
+                    kms_region,
+                    key_id,
+                    start,
+                    outcome,
+                    0);
+                return outcome;
+            });
+            if (!outcome.IsSuccess()) {
+                AWS_LOGSTREAM_ERROR(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "Invalid encryption materials algorithm properties");
+                return aws_raise_error(AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+            }
+            report_success();
+            generated = outcome.GetResultWithOwnership();
         }
-        report_success();
-        rv = append_key_dup_to_edks(
+        // Prefetches are only made with spare capacity under the rate limit
+        if (prefetcher && (!self->rate_limiter || self->rate_limiter->Acquire(kms_region, false))) {
+            // Replace the key just used, or start filling the queue for a new context
+            Private::DataKeyPrefetcher::Refill(prefetcher, kms_client, kms_request);
+        }
+
+        // Nothing else needs the result, so its buffers are handed over rather than copied
+        rv = append_key_to_edks(
             request_alloc,
             &my_edks.list,
-            &outcome.GetResult().GetCiphertextBlob(),
-            &outcome.GetResult().GetKeyId(),
+            std::move(const_cast<Aws::Utils::ByteBuffer &>(generated.GetCiphertextBlob())),
+            generated.GetKeyId(),
             &self->key_provider);
         if (rv != AWS_OP_SUCCESS) return rv;
 
-        rv = aws_byte_buf_dup_from_aws_utils(request_alloc, unencrypted_data_key, outcome.GetResult().GetPlaintext());
+        rv = aws_byte_buf_adopt_from_aws_utils(
+            request_alloc,
+            unencrypted_data_key,
+            std::move(const_cast<Aws::Utils::CryptoBuffer &>(generated.GetPlaintext())));
         if (rv != AWS_OP_SUCCESS) return rv;
         generated_new_data_key = true;
         aws_cryptosdk_keyring_trace_add_record_c_str(
@@ -246,32 +744,93 @@ static int OnEncrypt(
                 AWS_CRYPTOSDK_WRAPPING_KEY_SIGNED_ENC_CTX);
     }
 
-    const auto unencrypted_data_key_cpp = aws_utils_byte_buffer_from_c_aws_byte_buf(unencrypted_data_key);
+    /* The remaining wraps are issued all at once, so that wrapping under keys in several regions
+     * takes about as long as the slowest region rather than the sum of them all. Their outcomes are
+     * then handled in key ID order, which keeps the order of the EDKs deterministic.
+     */
+    struct PendingWrap {
+        Aws::String key_id;
+        std::shared_ptr<KMS::KMSClient> kms_client;
+        std::function<void()> report_success;
+        Aws::String region;
+        Aws::KMS::Model::EncryptRequest request;
+        std::chrono::steady_clock::time_point start, completed;
+        Aws::KMS::Model::EncryptOutcomeCallable outcome;
+    };
+    Aws::Vector<PendingWrap> wraps;
 
     size_t num_key_ids = self->key_ids.size();
+    wraps.reserve(num_key_ids);
     for (size_t key_id_idx = generated_new_data_key ? 1 : 0; key_id_idx < num_key_ids; ++key_id_idx) {
-        Aws::String key_id = self->key_ids[key_id_idx];
+        PendingWrap wrap;
+        wrap.key_id = self->key_ids[key_id_idx];
 
         // Already checked on keyring build that this will succeed.
-        Aws::String kms_region = Private::parse_region_from_kms_key_arn(key_id);
+        Aws::String kms_region = Private::parse_region_from_kms_key_arn(wrap.key_id);
 
-        std::function<void()> report_success;
-        auto kms_client = self->kms_client_supplier->GetClient(kms_region, report_success);
-        if (!kms_client) {
+        wrap.kms_client = self->kms_client_supplier->GetClient(kms_region, wrap.report_success);
+        if (!wrap.kms_client) {
             /* Client supplier is allowed to return NULL if, for example, user wants to exclude particular
              * regions. But if we are here it means that user configured keyring with a KMS key that was
              * incompatible with the client supplier in use.
              */
             rv = aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
-            goto out;
+            break;
         }
-        Aws::KMS::Model::EncryptRequest kms_request;
-        kms_request.WithKeyId(key_id)
+        if (self->rate_limiter && !self->rate_limiter->Acquire(kms_region, true)) {
+            AWS_LOGSTREAM_ERROR(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "KMS rate limit exceeded for region " << kms_region);
+            rv = aws_raise_error(AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+            break;
+        }
+        wrap.request.WithKeyId(wrap.key_id)
             .WithGrantTokens(self->grant_tokens)
-            .WithPlaintext(unencrypted_data_key_cpp)
-            .WithEncryptionContext(enc_ctx_cpp);
+            .WithPlaintext(Aws::Utils::CryptoBuffer(unencrypted_data_key->buffer, unencrypted_data_key->len))
+            .WithEncryptionContext(*enc_ctx_cpp);
+
+        if (self->retry_budget) self->retry_budget->Credit();
+        wrap.region  = kms_region;
+        wrap.start   = StartKmsCall(KmsKeyring::KmsOperation::ENCRYPT);
+        wrap.outcome = wrap.kms_client->EncryptCallable(wrap.request);
+        wraps.push_back(std::move(wrap));
+    }
 
-        Aws::KMS::Model::EncryptOutcome outcome = kms_client->Encrypt(kms_request);
+    // Each call uses its client until it completes, so all of them must finish before we return
+    for (auto &wrap : wraps) {
+        wrap.outcome.wait();
+        wrap.completed = std::chrono::steady_clock::now();
+    }
+    if (rv != AWS_OP_SUCCESS) goto out;
+
+    for (auto &wrap : wraps) {
+        Aws::KMS::Model::EncryptOutcome outcome = wrap.outcome.get();
+        size_t bytes_sent                       = wrap.request.GetPlaintext().GetLength();
+        /* The latency is taken when the call is waited for, so a call which completes before one
+         * launched ahead of it is reported as taking as long as that one.
+         */
+        ReportKmsCall(
+            self->metrics_sink,
+            KmsKeyring::KmsOperation::ENCRYPT,
+            wrap.region,
+            wrap.key_id,
+            wrap.start,
+            outcome,
+            bytes_sent,
+            wrap.completed);
+        // Retries are made one at a time, as they should be rare
+        while (!outcome.IsSuccess() && outcome.GetError().ShouldRetry() && self->retry_budget &&
+               self->retry_budget->Spend()) {
+            if (self->rate_limiter && !self->rate_limiter->Acquire(wrap.region, true)) break;
+            auto start = StartKmsCall(KmsKeyring::KmsOperation::ENCRYPT);
+            outcome    = wrap.kms_client->Encrypt(wrap.request);
+            ReportKmsCall(
+                self->metrics_sink,
+                KmsKeyring::KmsOperation::ENCRYPT,
+                wrap.region,
+                wrap.key_id,
+                start,
+                outcome,
+                bytes_sent);
+        }
         if (!outcome.IsSuccess()) {
             AWS_LOGSTREAM_ERROR(
                 AWS_CRYPTO_SDK_KMS_CLASS_TAG,
@@ -280,12 +839,14 @@ static int OnEncrypt(
             rv = aws_raise_error(AWS_CRYPTOSDK_ERR_KMS_FAILURE);
             goto out;
         }
-        report_success();
-        rv = append_key_dup_to_edks(
+        wrap.report_success();
+        Aws::KMS::Model::EncryptResult wrapped = outcome.GetResultWithOwnership();
+        // As with the generated key, the ciphertext is handed over rather than copied
+        rv = append_key_to_edks(
             request_alloc,
             &my_edks.list,
-            &outcome.GetResult().GetCiphertextBlob(),
-            &outcome.GetResult().GetKeyId(),
+            std::move(const_cast<Aws::Utils::ByteBuffer &>(wrapped.GetCiphertextBlob())),
+            wrapped.GetKeyId(),
             &self->key_provider);
         if (rv != AWS_OP_SUCCESS) {
             goto out;
@@ -294,7 +855,7 @@ static int OnEncrypt(
             request_alloc,
             &my_keyring_trace.list,
             KEY_PROVIDER_STR,
-            key_id.c_str(),
+            wrap.key_id.c_str(),
             AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_SIGNED_ENC_CTX);
     }
     rv = aws_cryptosdk_transfer_list(edk_list, &my_edks.list);
@@ -308,33 +869,422 @@ out:
     return rv;
 }
 
+/**
+ * Runs a keyring call on the keyring's executor, and passes its outcome to callback there. The
+ * error code is taken on the executor thread, where the call raised it.
+ */
+static int RunOnAsyncExecutor(
+    Aws::Cryptosdk::Private::KmsKeyringImpl *self,
+    const std::function<int()> &call,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    bool submitted = self->async_executor->Submit([call, callback, user_data] {
+        int error_code = call() ? aws_last_error() : AWS_ERROR_SUCCESS;
+        callback(error_code, user_data);
+    });
+    if (!submitted) {
+        AWS_LOGSTREAM_ERROR(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "Asynchronous keyring call refused by executor");
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+    return AWS_OP_SUCCESS;
+}
+
+static int OnEncryptAsync(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edk_list,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    auto self = static_cast<Aws::Cryptosdk::Private::KmsKeyringImpl *>(keyring);
+    return RunOnAsyncExecutor(
+        self,
+        [=] { return OnEncrypt(keyring, request_alloc, unencrypted_data_key, keyring_trace, edk_list, enc_ctx, alg); },
+        callback,
+        user_data);
+}
+
+static int OnDecryptAsync(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    auto self = static_cast<Aws::Cryptosdk::Private::KmsKeyringImpl *>(keyring);
+    return RunOnAsyncExecutor(
+        self,
+        [=] { return OnDecrypt(keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg); },
+        callback,
+        user_data);
+}
+
+/* Weight of each new observation in the moving averages, and the highest error rate we assume, so
+ * that a region which has only ever failed still gets a finite estimate and is eventually retried
+ */
+static const double REGION_EWMA_WEIGHT    = 0.2;
+static const double REGION_MAX_ERROR_RATE = 0.95;
+
+/* Each histogram bucket covers latencies up to this factor above the previous one, from 1 ms up.
+ * Once a region has this many samples, its counts are halved, so that the histogram follows the
+ * region's recent behavior; percentiles are not reported until it has the minimum.
+ */
+static const double LATENCY_BUCKET_GROWTH  = 1.25;
+static const uint32_t LATENCY_MAX_SAMPLES  = 1000;
+static const uint32_t LATENCY_MIN_SAMPLES  = 20;
+
+static size_t LatencyBucket(double latency_ms) {
+    if (latency_ms <= 1.0) return 0;
+    double bucket = std::ceil(std::log(latency_ms) / std::log(LATENCY_BUCKET_GROWTH));
+    return std::min((size_t)bucket, (size_t)Aws::Cryptosdk::Private::RegionLatencyTracker::LATENCY_BUCKETS - 1);
+}
+
+void Aws::Cryptosdk::Private::RegionLatencyTracker::Record(const Aws::String &region, double latency_ms, bool success) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = stats.find(region);
+    if (it == stats.end()) {
+        Stats &fresh     = stats[region];
+        fresh.latency_ms = latency_ms;
+        fresh.error_rate = success ? 0.0 : 1.0;
+        fresh.samples    = 0;
+        std::fill(fresh.histogram, fresh.histogram + LATENCY_BUCKETS, 0);
+        it = stats.find(region);
+    } else {
+        it->second.latency_ms += REGION_EWMA_WEIGHT * (latency_ms - it->second.latency_ms);
+        it->second.error_rate += REGION_EWMA_WEIGHT * ((success ? 0.0 : 1.0) - it->second.error_rate);
+    }
+
+    Stats &region_stats = it->second;
+    region_stats.histogram[LatencyBucket(latency_ms)]++;
+    if (++region_stats.samples >= LATENCY_MAX_SAMPLES) {
+        region_stats.samples = 0;
+        for (auto &count : region_stats.histogram) {
+            count /= 2;
+            region_stats.samples += count;
+        }
+    }
+}
+
+double Aws::Cryptosdk::Private::RegionLatencyTracker::LatencyPercentileMs(
+    const Aws::String &region, double percentile) const {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = stats.find(region);
+    if (it == stats.end() || it->second.samples < LATENCY_MIN_SAMPLES) {
+        return -1.0;
+    }
+
+    uint32_t target = (uint32_t)std::ceil(percentile * it->second.samples), seen = 0;
+    for (size_t bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += it->second.histogram[bucket];
+        if (seen >= target) return std::pow(LATENCY_BUCKET_GROWTH, (double)bucket);
+    }
+    return std::pow(LATENCY_BUCKET_GROWTH, (double)(LATENCY_BUCKETS - 1));
+}
+
+/* Most extra calls that can be saved up while requests go well, so that a burst after a quiet
+ * spell cannot double the load on a region that starts to slow down or throttle
+ */
+static const double BUDGET_MAX_TOKENS = 10.0;
+
+Aws::Cryptosdk::Private::RequestBudget::RequestBudget(double ratio) : ratio(ratio), tokens(0.0) {}
+
+void Aws::Cryptosdk::Private::RequestBudget::Credit() {
+    std::unique_lock<std::mutex> lock(mutex);
+    tokens = std::min(tokens + ratio, BUDGET_MAX_TOKENS);
+}
+
+bool Aws::Cryptosdk::Private::RequestBudget::Spend() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (tokens < 1.0) return false;
+    tokens -= 1.0;
+    return true;
+}
+
+bool Aws::Cryptosdk::Private::DiscoveryFilter::Allows(const Aws::String &key_arn) const {
+    Aws::String key_partition, key_region, key_account_id;
+    if (!parse_kms_key_arn(key_arn, key_partition, key_region, key_account_id)) return false;
+
+    return key_partition == partition &&
+           std::find(account_ids.begin(), account_ids.end(), key_account_id) != account_ids.end() &&
+           (regions.empty() || std::find(regions.begin(), regions.end(), key_region) != regions.end());
+}
+
+Aws::KMS::Model::DecryptOutcome Aws::Cryptosdk::Private::DecryptCoalescer::Decrypt(
+    const Aws::String &key, const std::function<Aws::KMS::Model::DecryptOutcome()> &call) {
+    std::shared_ptr<InFlight> call_state;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto it = in_flight.find(key);
+        if (it != in_flight.end()) {
+            auto leader = it->second;
+            leader->completed.wait(lock, [&leader] { return leader->done; });
+            return leader->outcome;
+        }
+        call_state     = Aws::MakeShared<InFlight>(AWS_CRYPTO_SDK_KMS_CLASS_TAG);
+        in_flight[key] = call_state;
+    }
+
+    auto outcome = call();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    in_flight.erase(key);
+    call_state->outcome = outcome;
+    call_state->done    = true;
+    call_state->completed.notify_all();
+    return outcome;
+}
+
+Aws::Cryptosdk::Private::KmsRateLimiter::KmsRateLimiter(
+    double calls_per_second, size_t burst, std::chrono::milliseconds max_wait)
+    : calls_per_second(calls_per_second), burst((double)burst), max_wait(max_wait) {}
+
+bool Aws::Cryptosdk::Private::KmsRateLimiter::Acquire(const Aws::String &region, bool wait) {
+    std::chrono::duration<double> delay;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto now = std::chrono::steady_clock::now();
+        auto it  = buckets.find(region);
+        if (it == buckets.end()) {
+            it = buckets.insert(std::make_pair(region, Bucket{ burst, now })).first;
+        }
+
+        Bucket &bucket  = it->second;
+        double elapsed  = std::chrono::duration<double>(now - bucket.refilled).count();
+        bucket.tokens   = std::min(bucket.tokens + elapsed * calls_per_second, burst);
+        bucket.refilled = now;
+
+        if (bucket.tokens >= 1.0) {
+            bucket.tokens -= 1.0;
+            return true;
+        }
+        delay = std::chrono::duration<double>((1.0 - bucket.tokens) / calls_per_second);
+        if (!wait || delay > max_wait) return false;
+        // Reserve the token, so that later callers queue up behind this one
+        bucket.tokens -= 1.0;
+    }
+    std::this_thread::sleep_for(delay);
+    return true;
+}
+
+double Aws::Cryptosdk::Private::RegionLatencyTracker::ExpectedLatencyMs(const Aws::String &region) const {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = stats.find(region);
+    if (it == stats.end()) {
+        return 0.0;
+    }
+    // Each failure costs a call, so this is the expected time spent per call that succeeds
+    return it->second.latency_ms / (1.0 - std::min(it->second.error_rate, REGION_MAX_ERROR_RATE));
+}
+
+/* Most contexts the prefetcher keeps queues for; the least recently used queue goes first */
+static const size_t PREFETCH_MAX_CONTEXTS = 8;
+
+Aws::Cryptosdk::Private::DataKeyPrefetcher::DataKeyPrefetcher(size_t depth, std::chrono::milliseconds ttl)
+    : depth(depth), ttl(ttl) {}
+
+std::shared_ptr<Aws::Cryptosdk::Private::DataKeyPrefetcher::Queue> Aws::Cryptosdk::Private::DataKeyPrefetcher::
+    FindQueue(const Aws::Map<Aws::String, Aws::String> &enc_ctx, int num_bytes) {
+    for (auto &queue : queues) {
+        if (queue->num_bytes == num_bytes && queue->enc_ctx == enc_ctx) {
+            queue->last_used = std::chrono::steady_clock::now();
+            return queue;
+        }
+    }
+    return nullptr;
+}
+
+bool Aws::Cryptosdk::Private::DataKeyPrefetcher::Take(
+    const Aws::Map<Aws::String, Aws::String> &enc_ctx,
+    int num_bytes,
+    Aws::KMS::Model::GenerateDataKeyResult &result) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto queue = FindQueue(enc_ctx, num_bytes);
+    if (!queue) return false;
+
+    auto now = std::chrono::steady_clock::now();
+    while (!queue->keys.empty() && now - queue->keys.front().first >= ttl) {
+        queue->keys.pop_front();
+    }
+    if (queue->keys.empty()) return false;
+
+    result = std::move(queue->keys.front().second);
+    queue->keys.pop_front();
+    return true;
+}
+
+void Aws::Cryptosdk::Private::DataKeyPrefetcher::Refill(
+    const std::shared_ptr<DataKeyPrefetcher> &self,
+    const std::shared_ptr<KMS::KMSClient> &kms_client,
+    const Aws::KMS::Model::GenerateDataKeyRequest &request) {
+    size_t wanted;
+    std::shared_ptr<Queue> queue;
+    {
+        std::unique_lock<std::mutex> lock(self->mutex);
+        queue = self->FindQueue(request.GetEncryptionContext(), request.GetNumberOfBytes());
+        if (!queue) {
+            if (self->queues.size() == PREFETCH_MAX_CONTEXTS) {
+                auto lru = std::min_element(
+                    self->queues.begin(),
+                    self->queues.end(),
+                    [](const std::shared_ptr<Queue> &a, const std::shared_ptr<Queue> &b) {
+                        return a->last_used < b->last_used;
+                    });
+                self->queues.erase(lru);
+            }
+            queue            = Aws::MakeShared<Queue>(AWS_CRYPTO_SDK_KMS_CLASS_TAG);
+            queue->enc_ctx   = request.GetEncryptionContext();
+            queue->num_bytes = request.GetNumberOfBytes();
+            queue->in_flight = 0;
+            queue->last_used = std::chrono::steady_clock::now();
+            self->queues.push_back(queue);
+        }
+
+        size_t have = queue->keys.size() + queue->in_flight;
+        wanted      = have < self->depth ? self->depth - have : 0;
+        queue->in_flight += wanted;
+    }
+
+    // Some executors run calls inline, so the handlers must be able to take the lock
+    for (size_t i = 0; i < wanted; i++) {
+        // Prefetches show up in the probes, but not in the metrics sink, which sees only calls made for a request
+        auto start = StartKmsCall(KmsKeyring::KmsOperation::GENERATE_DATA_KEY);
+        kms_client->GenerateDataKeyAsync(
+            request,
+            [self, queue, kms_client, start](
+                const KMS::KMSClient *,
+                const Aws::KMS::Model::GenerateDataKeyRequest &,
+                const Aws::KMS::Model::GenerateDataKeyOutcome &outcome,
+                const std::shared_ptr<const Aws::Client::AsyncCallerContext> &) {
+                EndKmsCall(
+                    KmsKeyring::KmsOperation::GENERATE_DATA_KEY,
+                    start,
+                    std::chrono::steady_clock::now(),
+                    outcome.IsSuccess());
+                std::unique_lock<std::mutex> lock(self->mutex);
+                queue->in_flight--;
+                // A failed prefetch is not retried until the next encryption with this context
+                if (outcome.IsSuccess()) {
+                    queue->keys.push_back(std::make_pair(std::chrono::steady_clock::now(), outcome.GetResult()));
+                }
+            });
+    }
+}
+
 Aws::Cryptosdk::Private::KmsKeyringImpl::~KmsKeyringImpl() {}
 
+std::shared_ptr<const Aws::Map<Aws::String, Aws::String>> Aws::Cryptosdk::Private::KmsKeyringImpl::
+    ConvertEncryptionContext(const struct aws_hash_table *enc_ctx) {
+    {
+        std::unique_lock<std::mutex> lock(enc_ctx_mutex);
+        if (last_enc_ctx && aws_map_eq_c_aws_hash_table(*last_enc_ctx, enc_ctx)) {
+            return last_enc_ctx;
+        }
+    }
+
+    std::shared_ptr<const Aws::Map<Aws::String, Aws::String>> converted =
+        Aws::MakeShared<Aws::Map<Aws::String, Aws::String>>(
+            AWS_CRYPTO_SDK_KMS_CLASS_TAG, aws_map_from_c_aws_hash_table(enc_ctx));
+
+    std::unique_lock<std::mutex> lock(enc_ctx_mutex);
+    last_enc_ctx = converted;
+    return converted;
+}
+
 Aws::Cryptosdk::Private::KmsKeyringImpl::KmsKeyringImpl(
     const Aws::Vector<Aws::String> &key_ids,
     const Aws::Vector<Aws::String> &grant_tokens,
-    std::shared_ptr<Aws::Cryptosdk::KmsKeyring::ClientSupplier> client_supplier)
+    std::shared_ptr<Aws::Cryptosdk::KmsKeyring::ClientSupplier> client_supplier,
+    size_t decrypt_concurrency,
+    const Aws::String &local_region,
+    size_t prefetch_depth,
+    std::chrono::milliseconds prefetch_ttl,
+    double hedge_percentile,
+    double hedge_budget,
+    std::shared_ptr<Aws::Cryptosdk::KmsKeyring::ClientSupplier> hedge_client_supplier,
+    double rate_limit,
+    size_t rate_burst,
+    std::chrono::milliseconds rate_max_wait,
+    double retry_budget,
+    std::shared_ptr<const DiscoveryFilter> discovery_filter,
+    std::shared_ptr<Aws::Cryptosdk::KmsKeyring::MetricsSink> metrics_sink,
+    std::shared_ptr<Aws::Utils::Threading::Executor> async_executor)
     : key_provider(aws_byte_buf_from_c_str(KEY_PROVIDER_STR)),
       kms_client_supplier(client_supplier),
       grant_tokens(grant_tokens),
-      key_ids(key_ids) {
-    static const aws_cryptosdk_keyring_vt kms_keyring_vt = {
-        sizeof(struct aws_cryptosdk_keyring_vt), KEY_PROVIDER_STR, &DestroyKeyring, &OnEncrypt, &OnDecrypt
-    };
+      key_ids(key_ids),
+      decrypt_concurrency(decrypt_concurrency),
+      local_region(local_region),
+      region_latencies(Aws::MakeShared<RegionLatencyTracker>(AWS_CRYPTO_SDK_KMS_CLASS_TAG)),
+      decrypt_coalescer(Aws::MakeShared<DecryptCoalescer>(AWS_CRYPTO_SDK_KMS_CLASS_TAG)),
+      discovery_filter(discovery_filter),
+      metrics_sink(metrics_sink),
+      async_executor(async_executor),
+      hedge_percentile(hedge_percentile),
+      hedge_client_supplier(hedge_client_supplier) {
+    if (hedge_budget > 0) {
+        this->hedge_budget = Aws::MakeShared<RequestBudget>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, hedge_budget);
+    }
+    if (rate_limit > 0) {
+        rate_limiter =
+            Aws::MakeShared<KmsRateLimiter>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, rate_limit, rate_burst, rate_max_wait);
+    }
+    if (retry_budget > 0) {
+        this->retry_budget = Aws::MakeShared<RequestBudget>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, retry_budget);
+    }
+    if (prefetch_depth) {
+        data_key_prefetcher =
+            Aws::MakeShared<DataKeyPrefetcher>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, prefetch_depth, prefetch_ttl);
+    }
+
+    static const aws_cryptosdk_keyring_vt kms_keyring_vt       = { sizeof(struct aws_cryptosdk_keyring_vt),
+                                                                   KEY_PROVIDER_STR,
+                                                                   &DestroyKeyring,
+                                                                   &OnEncrypt,
+                                                                   &OnDecrypt,
+                                                                   NULL,
+                                                                   NULL,
+                                                                   &GetEdkFilter };
+    static const aws_cryptosdk_keyring_vt kms_keyring_async_vt = { sizeof(struct aws_cryptosdk_keyring_vt),
+                                                                   KEY_PROVIDER_STR,
+                                                                   &DestroyKeyring,
+                                                                   &OnEncrypt,
+                                                                   &OnDecrypt,
+                                                                   &OnEncryptAsync,
+                                                                   &OnDecryptAsync,
+                                                                   &GetEdkFilter };
 
-    aws_cryptosdk_keyring_base_init(this, &kms_keyring_vt);
+    aws_cryptosdk_keyring_base_init(this, async_executor ? &kms_keyring_async_vt : &kms_keyring_vt);
 }
 
-static std::shared_ptr<KMS::KMSClient> CreateDefaultKmsClient(const Aws::String &region) {
+/*
+ * Returns the configuration of the clients we create. Without client retries, the keyring's own retries (see
+ * LimitedCall) are the only ones, and stay within its retry budget and rate limit.
+ */
+static Aws::Client::ClientConfiguration KmsClientConfiguration(const Aws::String &region, bool client_retries = true) {
     Aws::Client::ClientConfiguration client_configuration;
     client_configuration.region = region;
+    if (!client_retries) {
+        client_configuration.retryStrategy =
+            Aws::MakeShared<Aws::Client::DefaultRetryStrategy>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, 0);
+    }
     client_configuration.userAgent += " " AWS_CRYPTOSDK_PRIVATE_VERSION_UA "/kms-keyring-cpp";
 #ifdef VALGRIND_TESTS
     // When running under valgrind, the default timeouts are too slow
     client_configuration.requestTimeoutMs = 10000;
     client_configuration.connectTimeoutMs = 10000;
 #endif
-    return Aws::MakeShared<Aws::KMS::KMSClient>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, client_configuration);
+    return client_configuration;
+}
+
+static std::shared_ptr<KMS::KMSClient> CreateDefaultKmsClient(const Aws::String &region, bool client_retries = true) {
+    return Aws::MakeShared<Aws::KMS::KMSClient>(
+        AWS_CRYPTO_SDK_KMS_CLASS_TAG, KmsClientConfiguration(region, client_retries));
 }
 
 std::shared_ptr<KmsKeyring::SingleClientSupplier> KmsKeyring::SingleClientSupplier::Create(
@@ -348,12 +1298,22 @@ std::shared_ptr<KMS::KMSClient> KmsKeyring::SingleClientSupplier::GetClient(
     return this->kms_client;
 }
 
-std::shared_ptr<KmsKeyring::CachingClientSupplier> KmsKeyring::CachingClientSupplier::Create() {
-    return Aws::MakeShared<KmsKeyring::CachingClientSupplier>(AWS_CRYPTO_SDK_KMS_CLASS_TAG);
+std::shared_ptr<KmsKeyring::CachingClientSupplier> KmsKeyring::CachingClientSupplier::Create(bool client_retries) {
+    auto supplier            = Aws::MakeShared<KmsKeyring::CachingClientSupplier>(AWS_CRYPTO_SDK_KMS_CLASS_TAG);
+    supplier->client_retries = client_retries;
+    return supplier;
 }
 
 std::shared_ptr<KMS::KMSClient> KmsKeyring::CachingClientSupplier::GetClient(
     const Aws::String &region, std::function<void()> &report_success) {
+    auto snapshot = std::atomic_load(&cache_snapshot);
+    if (snapshot) {
+        auto it = snapshot->find(region);
+        if (it != snapshot->end()) {
+            report_success = [] {};  // no-op lambda
+            return it->second;
+        }
+    }
     {
         std::unique_lock<std::mutex> lock(cache_mutex);
         if (cache.find(region) != cache.end()) {
@@ -361,32 +1321,267 @@ std::shared_ptr<KMS::KMSClient> KmsKeyring::CachingClientSupplier::GetClient(
             return cache.at(region);
         }
     }
-    auto client    = CreateDefaultKmsClient(region);
+    auto client    = CreateDefaultKmsClient(region, client_retries);
     report_success = [this, region, client] {
         std::unique_lock<std::mutex> lock(this->cache_mutex);
         this->cache[region] = client;
+        this->PublishCache();
     };
     return client;
 }
 
+void KmsKeyring::CachingClientSupplier::Prewarm(const Aws::Vector<Aws::String> &regions) {
+    for (auto &region : regions) {
+        {
+            std::unique_lock<std::mutex> lock(cache_mutex);
+            if (cache.find(region) != cache.end()) continue;
+        }
+        // Creating a client can be slow, so it is done without holding the lock
+        auto client = CreateDefaultKmsClient(region, client_retries);
+
+        std::unique_lock<std::mutex> lock(cache_mutex);
+        if (cache.find(region) == cache.end()) {
+            cache[region] = client;
+            PublishCache();
+        }
+    }
+}
+
+void KmsKeyring::CachingClientSupplier::PublishCache() {
+    std::shared_ptr<const Aws::Map<Aws::String, std::shared_ptr<Aws::KMS::KMSClient>>> snapshot =
+        Aws::MakeShared<Aws::Map<Aws::String, std::shared_ptr<Aws::KMS::KMSClient>>>(
+            AWS_CRYPTO_SDK_KMS_CLASS_TAG, cache);
+    std::atomic_store(&cache_snapshot, snapshot);
+}
+
+struct KmsKeyring::TenantClientCache::State {
+    /* (region, credentials identity) */
+    typedef std::pair<Aws::String, Aws::String> Key;
+
+    struct Entry {
+        Key key;
+        std::shared_ptr<KMS::KMSClient> client;
+        std::shared_ptr<Aws::Auth::AWSCredentialsProvider> credentials;
+    };
+
+    explicit State(size_t max_clients) : max_clients(max_clients) {}
+
+    std::shared_ptr<KMS::KMSClient> GetClient(
+        const Aws::String &region,
+        const Aws::String &identity,
+        const std::shared_ptr<Aws::Auth::AWSCredentialsProvider> &credentials) {
+        Key key(region, identity);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto client = Lookup(key);
+            if (client) return client;
+        }
+        // Creating a client can be slow, so it is done without holding the lock
+        auto client = Aws::MakeShared<Aws::KMS::KMSClient>(
+            AWS_CRYPTO_SDK_KMS_CLASS_TAG, credentials, KmsClientConfiguration(region));
+
+        // Evicted clients are released after the lock, as destroying a client waits for its threads
+        Aws::List<Entry> evicted;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto cached = Lookup(key);
+        if (cached) return cached;
+
+        lru.push_front(Entry{ key, client, credentials });
+        index[key] = lru.begin();
+        while (lru.size() > max_clients) {
+            index.erase(lru.back().key);
+            evicted.splice(evicted.begin(), lru, std::prev(lru.end()));
+        }
+        return client;
+    }
+
+    /* Returns the cached client for key, marked as the most recently used, or nullptr. Call with mutex held. */
+    std::shared_ptr<KMS::KMSClient> Lookup(const Key &key) {
+        auto it = index.find(key);
+        if (it == index.end()) return nullptr;
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->client;
+    }
+
+    /* Asks each distinct credentials provider of the cached clients for its credentials */
+    void RefreshCredentials() {
+        Aws::Vector<std::shared_ptr<Aws::Auth::AWSCredentialsProvider>> providers;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto &entry : lru) {
+                if (std::find(providers.begin(), providers.end(), entry.credentials) == providers.end()) {
+                    providers.push_back(entry.credentials);
+                }
+            }
+        }
+        for (auto &provider : providers) {
+            provider->GetAWSCredentials();
+        }
+    }
+
+    const size_t max_clients;
+    mutable std::mutex mutex;
+    /* Most recently used first */
+    Aws::List<Entry> lru;
+    Aws::Map<Key, Aws::List<Entry>::iterator> index;
+};
+
+class KmsKeyring::TenantClientCache::TenantSupplier : public KmsKeyring::ClientSupplier {
+   public:
+    TenantSupplier(
+        const std::shared_ptr<State> &state,
+        const Aws::String &identity,
+        const std::shared_ptr<Aws::Auth::AWSCredentialsProvider> &credentials)
+        : state(state), identity(identity), credentials(credentials) {}
+
+    std::shared_ptr<KMS::KMSClient> GetClient(const Aws::String &region, std::function<void()> &report_success) {
+        report_success = [] {};  // no-op lambda
+        return state->GetClient(region, identity, credentials);
+    }
+
+   private:
+    std::shared_ptr<State> state;
+    Aws::String identity;
+    std::shared_ptr<Aws::Auth::AWSCredentialsProvider> credentials;
+};
+
+class KmsKeyring::TenantClientCache::RefreshThread {
+   public:
+    RefreshThread(const std::shared_ptr<State> &state, std::chrono::milliseconds interval) : stopping(false) {
+        thread = std::thread([this, state, interval] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping) {
+                if (stop_requested.wait_for(lock, interval, [this] { return stopping; })) break;
+                lock.unlock();
+                state->RefreshCredentials();
+                lock.lock();
+            }
+        });
+    }
+
+    ~RefreshThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            stop_requested.notify_all();
+        }
+        thread.join();
+    }
+
+   private:
+    std::mutex mutex;
+    std::condition_variable stop_requested;
+    bool stopping;
+    std::thread thread;
+};
+
+std::shared_ptr<KmsKeyring::TenantClientCache> KmsKeyring::TenantClientCache::Create(
+    size_t max_clients, std::chrono::milliseconds refresh_interval) {
+    return Aws::MakeShared<KmsKeyring::TenantClientCache>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, max_clients, refresh_interval);
+}
+
+KmsKeyring::TenantClientCache::TenantClientCache(size_t max_clients, std::chrono::milliseconds refresh_interval)
+    : state(Aws::MakeShared<State>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, max_clients)) {
+    if (refresh_interval.count() > 0) {
+        refresh_thread.reset(new RefreshThread(state, refresh_interval));
+    }
+}
+
+KmsKeyring::TenantClientCache::~TenantClientCache() {}
+
+std::shared_ptr<KmsKeyring::ClientSupplier> KmsKeyring::TenantClientCache::ForTenant(
+    const Aws::String &identity, const std::shared_ptr<Aws::Auth::AWSCredentialsProvider> &credentials) {
+    return Aws::MakeShared<TenantSupplier>(AWS_CRYPTO_SDK_KMS_CLASS_TAG, state, identity, credentials);
+}
+
+size_t KmsKeyring::TenantClientCache::Size() const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->lru.size();
+}
+
+/* Clients we create make no retries of their own if the keyring has a retry budget */
 static std::shared_ptr<KmsKeyring::ClientSupplier> BuildClientSupplier(
     const Aws::Vector<Aws::String> &key_ids,
     const std::shared_ptr<Aws::KMS::KMSClient> kms_client,
-    std::shared_ptr<KmsKeyring::ClientSupplier> client_supplier) {
+    std::shared_ptr<KmsKeyring::ClientSupplier> client_supplier,
+    bool client_retries) {
     if (kms_client) {
         return KmsKeyring::SingleClientSupplier::Create(kms_client);
     }
 
     if (key_ids.size() == 1) {
         Aws::String region = Private::parse_region_from_kms_key_arn(key_ids.front());
-        return KmsKeyring::SingleClientSupplier::Create(CreateDefaultKmsClient(region));
+        return KmsKeyring::SingleClientSupplier::Create(CreateDefaultKmsClient(region, client_retries));
+    }
+
+    return client_supplier ? client_supplier : KmsKeyring::CachingClientSupplier::Create(client_retries);
+}
+
+/* Has supplier create its clients for the regions of key_ids now, if it is one which caches them */
+static void PrewarmClients(
+    const std::shared_ptr<KmsKeyring::ClientSupplier> &supplier, const Aws::Vector<Aws::String> &key_ids) {
+    auto caching = std::dynamic_pointer_cast<KmsKeyring::CachingClientSupplier>(supplier);
+    if (!caching) return;
+
+    Aws::Vector<Aws::String> regions;
+    for (auto &key : key_ids) {
+        Aws::String region = Private::parse_region_from_kms_key_arn(key);
+        if (std::find(regions.begin(), regions.end(), region) == regions.end()) {
+            regions.push_back(region);
+        }
+    }
+    caching->Prewarm(regions);
+}
+
+static bool ValidHedging(double percentile, double budget) {
+    if (budget == 0) return true;
+    if (budget > 0 && budget <= 1 && percentile > 0 && percentile < 1) return true;
+
+    AWS_LOGSTREAM_ERROR(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "Invalid hedging percentile or budget");
+    return false;
+}
+
+static bool ValidRateLimits(double rate_limit, size_t rate_burst, double retry_budget) {
+    if (rate_limit >= 0 && (rate_limit == 0 || rate_burst >= 1) && retry_budget >= 0 && retry_budget <= 1) {
+        return true;
     }
 
-    return client_supplier ? client_supplier : KmsKeyring::CachingClientSupplier::Create();
+    AWS_LOGSTREAM_ERROR(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "Invalid rate limit or retry budget");
+    return false;
+}
+
+/* Returns the geographic area of a region, such as "eu" for eu-west-1 */
+static Aws::String RegionArea(const Aws::String &region) {
+    return region.substr(0, region.find('-'));
+}
+
+/*
+ * Returns the position in key_ids of the key to generate data keys under when running in
+ * local_region: the first key in that region, or else the first in the same geographic area, or
+ * else the configured generator.
+ */
+static size_t LocalGeneratorIndex(const Aws::Vector<Aws::String> &key_ids, const Aws::String &local_region) {
+    size_t area_match = key_ids.size();
+
+    for (size_t key_id_idx = 0; key_id_idx < key_ids.size(); ++key_id_idx) {
+        Aws::String region = Private::parse_region_from_kms_key_arn(key_ids[key_id_idx]);
+        if (region == local_region) return key_id_idx;
+        if (area_match == key_ids.size() && RegionArea(region) == RegionArea(local_region)) area_match = key_id_idx;
+    }
+    return area_match < key_ids.size() ? area_match : 0;
 }
 
 aws_cryptosdk_keyring *KmsKeyring::Builder::Build(
     const Aws::String &generator_key_id, const Aws::Vector<Aws::String> &additional_key_ids) const {
+    if (!ValidHedging(hedge_percentile, hedge_budget) || !ValidRateLimits(rate_limit, rate_burst, retry_budget)) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+    if (discovery_filter) {
+        AWS_LOGSTREAM_ERROR(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "Discovery filter set on a keyring with key IDs");
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
     if (Private::parse_region_from_kms_key_arn(generator_key_id).empty()) {
         AWS_LOGSTREAM_ERROR(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "Unable to parse key ARN");
         aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
@@ -403,20 +1598,69 @@ aws_cryptosdk_keyring *KmsKeyring::Builder::Build(
         my_key_ids.push_back(key);
     }
 
+    if (local_generator) {
+        if (local_region.empty()) {
+            AWS_LOGSTREAM_ERROR(AWS_CRYPTO_SDK_KMS_CLASS_TAG, "Local generator requested without a local region");
+            aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+            return NULL;
+        }
+        // The keyring generates under its first key and wraps under the rest, so the local key goes first
+        size_t generator_idx = LocalGeneratorIndex(my_key_ids, local_region);
+        std::rotate(my_key_ids.begin(), my_key_ids.begin() + generator_idx, my_key_ids.begin() + generator_idx + 1);
+    }
+
+    auto supplier = BuildClientSupplier(my_key_ids, kms_client, client_supplier, retry_budget == 0);
+    if (prewarm_clients) {
+        PrewarmClients(supplier, my_key_ids);
+        PrewarmClients(hedge_client_supplier, my_key_ids);
+    }
+
     return Aws::New<Private::KmsKeyringImpl>(
         AWS_CRYPTO_SDK_KMS_CLASS_TAG,
         my_key_ids,
         grant_tokens,
-        BuildClientSupplier(my_key_ids, kms_client, client_supplier));
+        supplier,
+        decrypt_concurrency,
+        local_region,
+        prefetch_depth,
+        prefetch_ttl,
+        hedge_percentile,
+        hedge_budget,
+        hedge_client_supplier,
+        rate_limit,
+        rate_burst,
+        rate_max_wait,
+        retry_budget,
+        nullptr,
+        metrics_sink,
+        async_executor);
 }
 
 aws_cryptosdk_keyring *KmsKeyring::Builder::BuildDiscovery() const {
+    if (!ValidHedging(hedge_percentile, hedge_budget) || !ValidRateLimits(rate_limit, rate_burst, retry_budget)) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
     Aws::Vector<Aws::String> empty_key_ids_list;
     return Aws::New<Private::KmsKeyringImpl>(
         AWS_CRYPTO_SDK_KMS_CLASS_TAG,
         empty_key_ids_list,
         grant_tokens,
-        BuildClientSupplier(empty_key_ids_list, kms_client, client_supplier));
+        BuildClientSupplier(empty_key_ids_list, kms_client, client_supplier, retry_budget == 0),
+        decrypt_concurrency,
+        local_region,
+        prefetch_depth,
+        prefetch_ttl,
+        hedge_percentile,
+        hedge_budget,
+        hedge_client_supplier,
+        rate_limit,
+        rate_burst,
+        rate_max_wait,
+        retry_budget,
+        discovery_filter,
+        metrics_sink,
+        async_executor);
 }
 
 KmsKeyring::Builder &KmsKeyring::Builder::WithGrantTokens(const Aws::Vector<Aws::String> &grant_tokens) {
@@ -435,6 +1679,76 @@ KmsKeyring::Builder &KmsKeyring::Builder::WithClientSupplier(
     return *this;
 }
 
+KmsKeyring::Builder &KmsKeyring::Builder::WithDecryptConcurrency(size_t decrypt_concurrency) {
+    this->decrypt_concurrency = decrypt_concurrency ? decrypt_concurrency : 1;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithLocalRegion(const Aws::String &local_region) {
+    this->local_region = local_region;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithLocalGenerator(bool local_generator) {
+    this->local_generator = local_generator;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithPrewarmedClients(bool prewarm_clients) {
+    this->prewarm_clients = prewarm_clients;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithDataKeyPrefetch(size_t depth, std::chrono::milliseconds ttl) {
+    this->prefetch_depth = depth;
+    this->prefetch_ttl   = ttl;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithHedging(
+    double percentile, double budget, const std::shared_ptr<ClientSupplier> &hedge_client_supplier) {
+    this->hedge_percentile      = percentile;
+    this->hedge_budget          = budget;
+    this->hedge_client_supplier = hedge_client_supplier;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithRateLimit(
+    double calls_per_second, size_t burst, std::chrono::milliseconds max_wait) {
+    this->rate_limit    = calls_per_second;
+    this->rate_burst    = burst;
+    this->rate_max_wait = max_wait;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithDiscoveryFilter(
+    const Aws::String &partition,
+    const Aws::Vector<Aws::String> &account_ids,
+    const Aws::Vector<Aws::String> &regions) {
+    auto filter         = Aws::MakeShared<Private::DiscoveryFilter>(AWS_CRYPTO_SDK_KMS_CLASS_TAG);
+    filter->partition   = partition;
+    filter->account_ids = account_ids;
+    filter->regions     = regions;
+    discovery_filter    = filter;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithMetricsSink(const std::shared_ptr<MetricsSink> &metrics_sink) {
+    this->metrics_sink = metrics_sink;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithAsyncExecutor(
+    const std::shared_ptr<Aws::Utils::Threading::Executor> &executor) {
+    this->async_executor = executor;
+    return *this;
+}
+
+KmsKeyring::Builder &KmsKeyring::Builder::WithRetryBudget(double ratio) {
+    this->retry_budget = ratio;
+    return *this;
+}
+
 KmsKeyring::Builder &KmsKeyring::Builder::WithKmsClient(const std::shared_ptr<KMS::KMSClient> &kms_client) {
     this->kms_client = kms_client;
     return *this;
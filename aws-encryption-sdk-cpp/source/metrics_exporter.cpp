@@ -0,0 +1,356 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/cryptosdk/cpp/metrics_exporter.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+namespace Aws {
+namespace Cryptosdk {
+
+namespace {
+
+const char *const PREFIX = "aws.encryption_sdk.";
+
+const int NUM_SHARDS     = 64;
+const int NUM_MODES      = 2;
+const int NUM_STAGES     = 5;
+const int NUM_KMS_OPS    = 3;
+const int NUM_KMS_ERRORS = 5;
+const char *const MODE_NAMES[NUM_MODES]           = { "encrypt", "decrypt" };
+const char *const STAGE_NAMES[NUM_STAGES]         = { "cmm", "hkdf", "gcm", "signature", "header" };
+const char *const KMS_OP_NAMES[NUM_KMS_OPS]       = { "generate_data_key", "encrypt", "decrypt" };
+const char *const KMS_ERROR_NAMES[NUM_KMS_ERRORS] = { "ok", "throttled", "access_denied", "network", "other" };
+
+/* Bucket bounds in microseconds, from 10us to 10s */
+const uint64_t LATENCY_BOUNDS[] = { 10,    25,    50,     100,    250,    500,     1000,    2500,   5000,
+                                    10000, 25000, 50000,  100000, 250000, 500000,  1000000, 2500000, 5000000,
+                                    10000000 };
+const int NUM_BUCKETS = sizeof(LATENCY_BOUNDS) / sizeof(LATENCY_BOUNDS[0]) + 1;
+
+/* A shard is written by one thread unless there are more threads than shards, so additions are uncontended */
+inline void Add(std::atomic<uint64_t> &counter, uint64_t value) {
+    counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+inline uint64_t Read(const std::atomic<uint64_t> &counter) {
+    return counter.load(std::memory_order_relaxed);
+}
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[NUM_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+
+    void Record(uint64_t value) {
+        int bucket = 0;
+        while (bucket < NUM_BUCKETS - 1 && value > LATENCY_BOUNDS[bucket]) bucket++;
+        Add(buckets[bucket], 1);
+        Add(count, 1);
+        Add(sum, value);
+    }
+};
+
+struct Shard {
+    std::atomic<uint64_t> messages[NUM_MODES][2];
+    std::atomic<uint64_t> bytes[NUM_MODES][2];
+    std::atomic<uint64_t> frames[NUM_MODES];
+    Histogram stages[NUM_MODES][NUM_STAGES];
+    std::atomic<uint64_t> kms_calls[NUM_KMS_OPS][NUM_KMS_ERRORS];
+    Histogram kms_latency[NUM_KMS_OPS];
+    /* Keeps the counters of neighbouring shards off each other's cache lines */
+    char padding[64];
+};
+
+/* The shard of the calling thread; threads are given shards in turn, the same for every collector */
+int ThreadShard() {
+    static std::atomic<unsigned> next_shard(0);
+    thread_local int shard = (int)(next_shard.fetch_add(1, std::memory_order_relaxed) % NUM_SHARDS);
+    return shard;
+}
+
+}  // namespace
+
+struct MetricsCollector::State {
+    State() : start_time(std::chrono::system_clock::now()) {
+        for (auto &shard : shards) {
+            // Value-initialized, so that every counter starts at zero
+            shard.reset(new Shard());
+        }
+    }
+
+    ~State() {
+        for (auto &cache : caches) aws_cryptosdk_materials_cache_release(cache.second);
+    }
+
+    Shard &LocalShard() {
+        return *shards[ThreadShard()];
+    }
+
+    std::chrono::system_clock::time_point start_time;
+    std::unique_ptr<Shard> shards[NUM_SHARDS];
+
+    /* Guards caches, which are only added to and read at collection */
+    mutable std::mutex caches_mutex;
+    std::vector<std::pair<std::string, struct aws_cryptosdk_materials_cache *>> caches;
+};
+
+class MetricsCollector::KmsSink : public KmsKeyring::MetricsSink {
+   public:
+    explicit KmsSink(const std::shared_ptr<State> &state) : state(state) {}
+
+    void OnKmsCall(const KmsKeyring::KmsCallMetrics &metrics) override {
+        std::shared_ptr<State> locked = state.lock();
+        if (!locked) return;
+
+        int op = (int)metrics.operation, error_class = (int)metrics.error_class;
+        if (op < 0 || op >= NUM_KMS_OPS || error_class < 0 || error_class >= NUM_KMS_ERRORS) return;
+
+        Shard &shard = locked->LocalShard();
+        Add(shard.kms_calls[op][error_class], 1);
+        shard.kms_latency[op].Record(metrics.latency.count());
+    }
+
+   private:
+    std::weak_ptr<State> state;
+};
+
+class MetricsCollector::ExportThread {
+   public:
+    ExportThread(
+        const MetricsCollector *collector,
+        const std::shared_ptr<MetricsExporter> &exporter,
+        std::chrono::milliseconds interval)
+        : exporter(exporter), stopping(false) {
+        thread = std::thread([this, collector, interval] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping) {
+                if (stop_requested.wait_for(lock, interval, [this] { return stopping; })) break;
+                lock.unlock();
+                this->exporter->Export(collector->Collect());
+                lock.lock();
+            }
+            lock.unlock();
+            this->exporter->Export(collector->Collect());
+        });
+    }
+
+    ~ExportThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            stop_requested.notify_all();
+        }
+        thread.join();
+    }
+
+   private:
+    std::shared_ptr<MetricsExporter> exporter;
+    std::mutex mutex;
+    std::condition_variable stop_requested;
+    bool stopping;
+    std::thread thread;
+};
+
+MetricsCollector::MetricsCollector() : state(std::make_shared<State>()) {}
+
+MetricsCollector::~MetricsCollector() {
+    Stop();
+}
+
+void MetricsCollector::RecordMessage(
+    enum aws_cryptosdk_mode mode, const struct aws_cryptosdk_session *session, bool succeeded) {
+    struct aws_cryptosdk_session_stats stats;
+    int m = mode == AWS_CRYPTOSDK_ENCRYPT ? 0 : 1;
+
+    aws_cryptosdk_session_get_stats(session, &stats);
+    const uint64_t stage_ns[NUM_STAGES] = {
+        stats.cmm_ns, stats.hkdf_ns, stats.gcm_ns, stats.signature_ns, stats.header_ns
+    };
+
+    Shard &shard = state->LocalShard();
+    Add(shard.messages[m][succeeded ? 0 : 1], 1);
+    Add(shard.bytes[m][0], stats.bytes_in);
+    Add(shard.bytes[m][1], stats.bytes_out);
+    Add(shard.frames[m], stats.frames);
+    for (int stage = 0; stage < NUM_STAGES; stage++) {
+        if (stage_ns[stage]) shard.stages[m][stage].Record(stage_ns[stage] / 1000);
+    }
+}
+
+std::shared_ptr<KmsKeyring::MetricsSink> MetricsCollector::GetKmsMetricsSink() {
+    return std::make_shared<KmsSink>(state);
+}
+
+int MetricsCollector::AddCache(const std::string &name, struct aws_cryptosdk_materials_cache *cache) {
+    struct aws_cryptosdk_materials_cache_stats stats;
+    if (aws_cryptosdk_materials_cache_get_stats(cache, &stats)) return AWS_OP_ERR;
+
+    std::lock_guard<std::mutex> lock(state->caches_mutex);
+    state->caches.emplace_back(name, aws_cryptosdk_materials_cache_retain(cache));
+    return AWS_OP_SUCCESS;
+}
+
+std::vector<MetricPoint> MetricsCollector::Collect() const {
+    std::vector<MetricPoint> points;
+    auto now = std::chrono::system_clock::now();
+
+    auto scalar = [&](MetricKind kind,
+                      const char *name,
+                      const char *unit,
+                      std::vector<std::pair<std::string, std::string>> attributes,
+                      uint64_t value) {
+        MetricPoint point;
+        point.name       = std::string(PREFIX) + name;
+        point.unit       = unit;
+        point.kind       = kind;
+        point.attributes = std::move(attributes);
+        point.value      = value;
+        point.count      = 0;
+        point.sum        = 0;
+        point.start_time = state->start_time;
+        point.time       = now;
+        points.push_back(std::move(point));
+    };
+    // Sums the histograms picked by get from every shard into one point
+    auto histogram = [&](const char *name,
+                         std::vector<std::pair<std::string, std::string>> attributes,
+                         const std::function<const Histogram &(const Shard &)> &get) {
+        MetricPoint point;
+        point.name       = std::string(PREFIX) + name;
+        point.unit       = "us";
+        point.kind       = MetricKind::HISTOGRAM;
+        point.attributes = std::move(attributes);
+        point.value      = 0;
+        point.bounds.assign(std::begin(LATENCY_BOUNDS), std::end(LATENCY_BOUNDS));
+        point.bucket_counts.assign(NUM_BUCKETS, 0);
+        point.count      = 0;
+        point.sum        = 0;
+        point.start_time = state->start_time;
+        point.time       = now;
+        for (const auto &shard : state->shards) {
+            const Histogram &h = get(*shard);
+            for (int i = 0; i < NUM_BUCKETS; i++) point.bucket_counts[i] += Read(h.buckets[i]);
+            point.count += Read(h.count);
+            point.sum += Read(h.sum);
+        }
+        points.push_back(std::move(point));
+    };
+    auto total = [&](const std::function<const std::atomic<uint64_t> &(const Shard &)> &get) {
+        uint64_t sum = 0;
+        for (const auto &shard : state->shards) sum += Read(get(*shard));
+        return sum;
+    };
+
+    for (int m = 0; m < NUM_MODES; m++) {
+        const char *mode = MODE_NAMES[m];
+        for (int outcome = 0; outcome < 2; outcome++) {
+            scalar(
+                MetricKind::COUNTER,
+                "session.messages",
+                "{message}",
+                { { "mode", mode }, { "outcome", outcome ? "error" : "ok" } },
+                total([=](const Shard &s) -> const std::atomic<uint64_t> & { return s.messages[m][outcome]; }));
+        }
+        for (int dir = 0; dir < 2; dir++) {
+            scalar(
+                MetricKind::COUNTER,
+                "session.bytes",
+                "By",
+                { { "mode", mode }, { "direction", dir ? "out" : "in" } },
+                total([=](const Shard &s) -> const std::atomic<uint64_t> & { return s.bytes[m][dir]; }));
+        }
+        scalar(
+            MetricKind::COUNTER,
+            "session.frames",
+            "{frame}",
+            { { "mode", mode } },
+            total([=](const Shard &s) -> const std::atomic<uint64_t> & { return s.frames[m]; }));
+        for (int stage = 0; stage < NUM_STAGES; stage++) {
+            histogram(
+                "session.stage.duration",
+                { { "mode", mode }, { "stage", STAGE_NAMES[stage] } },
+                [=](const Shard &s) -> const Histogram & { return s.stages[m][stage]; });
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state->caches_mutex);
+        for (const auto &cache : state->caches) {
+            struct aws_cryptosdk_materials_cache_stats stats;
+            if (aws_cryptosdk_materials_cache_get_stats(cache.second, &stats)) continue;
+
+            const std::string &name = cache.first;
+            const std::pair<const char *, uint64_t> lookups[] = {
+                { "encrypt_hit", stats.encrypt_hits }, { "decrypt_hit", stats.decrypt_hits }, { "miss", stats.misses }
+            };
+            const std::pair<const char *, uint64_t> evictions[] = { { "capacity", stats.capacity_evictions },
+                                                                    { "ttl", stats.ttl_evictions },
+                                                                    { "quota", stats.quota_evictions },
+                                                                    { "invalidated", stats.invalidations } };
+            for (const auto &lookup : lookups) {
+                scalar(
+                    MetricKind::COUNTER,
+                    "cache.lookups",
+                    "{lookup}",
+                    { { "cache", name }, { "result", lookup.first } },
+                    lookup.second);
+            }
+            for (const auto &eviction : evictions) {
+                scalar(
+                    MetricKind::COUNTER,
+                    "cache.evictions",
+                    "{entry}",
+                    { { "cache", name }, { "reason", eviction.first } },
+                    eviction.second);
+            }
+            scalar(MetricKind::GAUGE, "cache.entries", "{entry}", { { "cache", name } }, stats.entries);
+            scalar(MetricKind::GAUGE, "cache.size", "By", { { "cache", name } }, stats.bytes);
+        }
+    }
+
+    for (int op = 0; op < NUM_KMS_OPS; op++) {
+        for (int error_class = 0; error_class < NUM_KMS_ERRORS; error_class++) {
+            scalar(
+                MetricKind::COUNTER,
+                "kms.calls",
+                "{call}",
+                { { "operation", KMS_OP_NAMES[op] }, { "outcome", KMS_ERROR_NAMES[error_class] } },
+                total([=](const Shard &s) -> const std::atomic<uint64_t> & { return s.kms_calls[op][error_class]; }));
+        }
+        histogram("kms.call.duration", { { "operation", KMS_OP_NAMES[op] } }, [=](const Shard &s) -> const Histogram & {
+            return s.kms_latency[op];
+        });
+    }
+
+    return points;
+}
+
+void MetricsCollector::Start(const std::shared_ptr<MetricsExporter> &exporter, std::chrono::milliseconds interval) {
+    Stop();
+    export_thread.reset(new ExportThread(this, exporter, interval));
+}
+
+void MetricsCollector::Stop() {
+    // The export thread's destructor makes the final export
+    export_thread.reset();
+}
+
+}  // namespace Cryptosdk
+}  // namespace Aws
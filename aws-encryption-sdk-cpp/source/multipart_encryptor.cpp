@@ -0,0 +1,103 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/cryptosdk/cpp/multipart_encryptor.h>
+
+#include <aws/cryptosdk/error.h>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace Aws {
+namespace Cryptosdk {
+
+MultipartEncryptor::MultipartEncryptor(struct aws_cryptosdk_session *session, size_t part_size, unsigned num_threads)
+    : session(session), part_size(part_size), num_threads(num_threads) {
+    if (!this->num_threads) this->num_threads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+int MultipartEncryptor::Encrypt(const uint8_t *plaintext, size_t plaintext_len, const PartSink &sink) {
+    uint8_t unused;
+    size_t written, consumed, header_len, frame_len, final_frame_max_len, frame_plaintext_len;
+
+    if (aws_cryptosdk_session_set_message_size(session, plaintext_len)) return AWS_OP_ERR;
+
+    // Generate the header without room to write it, to learn its size, then collect it
+    if (aws_cryptosdk_session_process(session, &unused, 0, &written, plaintext, 0, &consumed)) return AWS_OP_ERR;
+    aws_cryptosdk_session_estimate_buf(session, &header_len, nullptr);
+
+    std::vector<uint8_t> header(header_len);
+    if (aws_cryptosdk_session_process(session, header.data(), header.size(), &written, plaintext, 0, &consumed)) {
+        return AWS_OP_ERR;
+    }
+    // Still waiting on the CMM, or the header did not come out whole
+    if (written != header_len) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+
+    if (aws_cryptosdk_session_get_frame_sizes(session, &frame_len, &final_frame_max_len, &frame_plaintext_len)) {
+        return AWS_OP_ERR;
+    }
+
+    size_t frames_per_part = std::max<size_t>(1, part_size / frame_len);
+    size_t part_plaintext  = frames_per_part * frame_plaintext_len;
+    size_t part_capacity   = header_len + frames_per_part * frame_len + final_frame_max_len;
+    uint64_t num_parts     = std::max<uint64_t>(1, plaintext_len / part_plaintext + !!(plaintext_len % part_plaintext));
+    unsigned workers       = (unsigned)std::min<uint64_t>(num_threads, num_parts);
+    if (num_parts > INT_MAX) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+
+    std::atomic<uint64_t> next_part(0);
+    std::atomic<int> first_error(AWS_ERROR_SUCCESS);
+
+    auto work = [&]() {
+        std::vector<uint8_t> buf(part_capacity);
+
+        for (;;) {
+            uint64_t part = next_part++;
+            if (part >= num_parts || first_error.load() != AWS_ERROR_SUCCESS) return;
+
+            size_t offset = (size_t)part * part_plaintext;
+            size_t len    = std::min(part_plaintext, plaintext_len - offset);
+            size_t prefix = part ? 0 : header_len;
+            size_t part_written;
+
+            if (prefix) memcpy(buf.data(), header.data(), prefix);
+            if (aws_cryptosdk_session_encrypt_frames_at(
+                    session,
+                    part * frames_per_part + 1,
+                    buf.data() + prefix,
+                    buf.size() - prefix,
+                    &part_written,
+                    plaintext + offset,
+                    len) ||
+                sink((int)part + 1, buf.data(), prefix + part_written)) {
+                int expected = AWS_ERROR_SUCCESS;
+                first_error.compare_exchange_strong(expected, aws_last_error());
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < workers; i++) threads.emplace_back(work);
+    work();
+    for (auto &thread : threads) thread.join();
+
+    if (first_error.load() != AWS_ERROR_SUCCESS) return aws_raise_error(first_error.load());
+    return AWS_OP_SUCCESS;
+}
+
+}  // namespace Cryptosdk
+}  // namespace Aws
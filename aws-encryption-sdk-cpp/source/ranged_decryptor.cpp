@@ -0,0 +1,188 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/cryptosdk/cpp/ranged_decryptor.h>
+
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/error.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace Aws {
+namespace Cryptosdk {
+
+/* Enough for the header of a message with a few EDKs; longer headers are fetched again whole */
+static const size_t HEADER_READ_SIZE = 4096;
+
+RangedDecryptor::RangedDecryptor(
+    struct aws_cryptosdk_session *session, size_t range_size, unsigned num_threads, bool in_order)
+    : session(session),
+      range_size(range_size),
+      num_threads(num_threads),
+      in_order(in_order),
+      frame_index(nullptr),
+      frame_index_len(0) {
+    if (!this->num_threads) this->num_threads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+void RangedDecryptor::UseFrameIndex(const uint8_t *index, size_t len) {
+    frame_index     = index;
+    frame_index_len = len;
+}
+
+int RangedDecryptor::ReadHeader(uint64_t message_len, const RangeFetcher &fetch, uint64_t *header_len) {
+    std::vector<uint8_t> data;
+    size_t want = (size_t)std::min<uint64_t>(message_len, HEADER_READ_SIZE);
+
+    for (;;) {
+        uint8_t unused;
+        size_t written, consumed, needed, max_len;
+
+        if (fetch(0, want, &data)) return AWS_OP_ERR;
+        if (data.size() != want) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+
+        // Nothing is consumed until the whole header is there
+        if (aws_cryptosdk_session_process(session, &unused, 0, &written, data.data(), data.size(), &consumed)) {
+            return AWS_OP_ERR;
+        }
+        if (consumed) {
+            if (frame_index && aws_cryptosdk_session_use_frame_index(session, frame_index, frame_index_len)) {
+                return AWS_OP_ERR;
+            }
+            // The first frame follows the header
+            return aws_cryptosdk_session_get_frame_range(session, 1, header_len, &max_len);
+        }
+        if (want == message_len) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+
+        aws_cryptosdk_session_estimate_buf(session, nullptr, &needed);
+        want = (size_t)std::min<uint64_t>(message_len, std::max(needed, want * 2));
+    }
+}
+
+int RangedDecryptor::Decrypt(uint64_t message_len, const RangeFetcher &fetch, const PlaintextSink &sink) {
+    enum aws_cryptosdk_alg_id alg_id;
+    uint64_t header_len;
+    size_t frame_len, final_frame_max_len, frame_plaintext_len;
+
+    if (ReadHeader(message_len, fetch, &header_len) || aws_cryptosdk_session_get_alg_id(session, &alg_id) ||
+        aws_cryptosdk_session_get_frame_sizes(session, &frame_len, &final_frame_max_len, &frame_plaintext_len)) {
+        return AWS_OP_ERR;
+    }
+
+    /*
+     * Every range but the last is a whole number of frames. A tail too short to hold the start
+     * of the final frame can only be the end of it (and the trailer), so it joins the range
+     * before it.
+     */
+    size_t signature_len    = aws_cryptosdk_alg_props(alg_id)->signature_len;
+    size_t max_spill        = final_frame_max_len - frame_len + (signature_len ? signature_len + 2 : 0);
+    uint64_t body_len       = message_len - header_len;
+    size_t frames_per_range = std::max<size_t>(1, range_size / frame_len);
+    uint64_t chunk_len      = (uint64_t)frames_per_range * frame_len;
+    uint64_t num_ranges     = body_len / chunk_len;
+    if (!num_ranges || body_len % chunk_len > max_spill) num_ranges++;
+    if (body_len - (num_ranges - 1) * chunk_len > SIZE_MAX / 2) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    unsigned workers = (unsigned)std::min<uint64_t>(num_threads, num_ranges);
+    std::atomic<uint64_t> next_range(0);
+    std::atomic<int> first_error(AWS_ERROR_SUCCESS);
+    std::mutex mutex;
+    std::condition_variable delivered;
+    uint64_t next_delivery = 0;
+
+    auto fail = [&](int error_code) {
+        int expected = AWS_ERROR_SUCCESS;
+        first_error.compare_exchange_strong(expected, error_code);
+        std::lock_guard<std::mutex> lock(mutex);
+        delivered.notify_all();
+    };
+
+    auto work = [&]() {
+        std::vector<uint8_t> ciphertext, plaintext;
+
+        for (;;) {
+            uint64_t range = next_range++;
+            if (range >= num_ranges || first_error.load() != AWS_ERROR_SUCCESS) return;
+
+            bool last       = range == num_ranges - 1;
+            uint64_t offset = header_len + range * chunk_len;
+            size_t len      = (size_t)(last ? message_len - offset : chunk_len);
+            size_t written, consumed;
+            bool final_frame;
+
+            if (fetch(offset, len, &ciphertext)) {
+                fail(aws_last_error());
+                return;
+            }
+            if (ciphertext.size() != len) {
+                fail(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+                return;
+            }
+
+            plaintext.resize((len / frame_len + 1) * frame_plaintext_len);
+            if (aws_cryptosdk_session_decrypt_frames_at(
+                    session,
+                    range * frames_per_range + 1,
+                    plaintext.data(),
+                    plaintext.size(),
+                    &written,
+                    ciphertext.data(),
+                    ciphertext.size(),
+                    &consumed,
+                    &final_frame)) {
+                fail(aws_last_error());
+                return;
+            }
+            // Only the last range ends the message, and it must; the others are all frames
+            if (last ? !final_frame : (final_frame || consumed != len)) {
+                fail(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+                return;
+            }
+
+            if (in_order) {
+                std::unique_lock<std::mutex> lock(mutex);
+                delivered.wait(
+                    lock, [&] { return next_delivery == range || first_error.load() != AWS_ERROR_SUCCESS; });
+                if (first_error.load() != AWS_ERROR_SUCCESS) return;
+            }
+
+            if (sink(range * frames_per_range * frame_plaintext_len, plaintext.data(), written)) {
+                fail(aws_last_error());
+                return;
+            }
+
+            if (in_order) {
+                std::lock_guard<std::mutex> lock(mutex);
+                next_delivery++;
+                delivered.notify_all();
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < workers; i++) threads.emplace_back(work);
+    work();
+    for (auto &thread : threads) thread.join();
+
+    if (first_error.load() != AWS_ERROR_SUCCESS) return aws_raise_error(first_error.load());
+    return AWS_OP_SUCCESS;
+}
+
+}  // namespace Cryptosdk
+}  // namespace Aws
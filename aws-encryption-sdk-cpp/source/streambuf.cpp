@@ -0,0 +1,312 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/cryptosdk/cpp/streambuf.h>
+
+#include <aws/common/common.h>
+#include <aws/cryptosdk/error.h>
+#include <algorithm>
+#include <cstring>
+
+namespace Aws {
+namespace Cryptosdk {
+
+EncryptingStreambuf::EncryptingStreambuf(
+    struct aws_cryptosdk_session *session, std::streambuf *sink, size_t buffer_size)
+    : session(session),
+      sink(sink),
+      plaintext(std::max<size_t>(buffer_size, 1)),
+      ciphertext(std::max<size_t>(buffer_size, 1)),
+      consumed(0),
+      size_set(false),
+      closed(false) {
+    char *base = reinterpret_cast<char *>(plaintext.data());
+    setp(base, base + plaintext.size());
+}
+
+EncryptingStreambuf::~EncryptingStreambuf() {
+    aws_secure_zero(plaintext.data(), plaintext.size());
+}
+
+int EncryptingStreambuf::SetMessageSize(uint64_t message_size) {
+    if (aws_cryptosdk_session_set_message_size(session, message_size)) return AWS_OP_ERR;
+    size_set = true;
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Runs as much of in through the session as it will take, handing the ciphertext to the sink.
+ * Returns successfully once the session needs more input than is left.
+ */
+int EncryptingStreambuf::Encrypt(const uint8_t *in, size_t in_len, size_t *in_read) {
+    *in_read = 0;
+
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t written, read;
+
+        if (aws_cryptosdk_session_process(
+                session, ciphertext.data(), ciphertext.size(), &written, in + *in_read, in_len - *in_read, &read)) {
+            return AWS_OP_ERR;
+        }
+        if (written &&
+            sink->sputn(reinterpret_cast<const char *>(ciphertext.data()), written) != (std::streamsize)written) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_IO);
+        }
+        *in_read += read;
+        consumed += read;
+        if (written || read) continue;
+
+        // No progress: the next step either needs more room than we have, or more input
+        size_t out_needed, in_needed;
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+        if (out_needed <= ciphertext.size()) break;
+        ciphertext.resize(out_needed);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Encrypts the put area, keeping whatever the session did not take (at most a partial frame) */
+int EncryptingStreambuf::Drain() {
+    uint8_t *base  = plaintext.data();
+    size_t pending = pptr() - pbase();
+    size_t read;
+
+    if (Encrypt(base, pending, &read)) return AWS_OP_ERR;
+
+    pending -= read;
+    memmove(base, base + read, pending);
+    aws_secure_zero(base + pending, read);
+    if (pending == plaintext.size()) {
+        // The session wants more than a whole buffer for its next frame; move to a larger one
+        std::vector<uint8_t> larger(plaintext.size() * 2);
+        memcpy(larger.data(), base, pending);
+        aws_secure_zero(base, pending);
+        plaintext.swap(larger);
+        base = plaintext.data();
+    }
+
+    setp(reinterpret_cast<char *>(base), reinterpret_cast<char *>(base) + plaintext.size());
+    pbump((int)pending);
+    return AWS_OP_SUCCESS;
+}
+
+EncryptingStreambuf::int_type EncryptingStreambuf::overflow(int_type ch) {
+    if (closed) return traits_type::eof();
+    if (Drain()) {
+        closed = true;
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+std::streamsize EncryptingStreambuf::xsputn(const char *s, std::streamsize n) {
+    std::streamsize done = 0;
+
+    if (closed) return 0;
+    while (done < n) {
+        size_t left = n - done;
+
+        // With nothing buffered, whole buffers' worth of input go straight to the session
+        if (pptr() == pbase() && left >= plaintext.size()) {
+            size_t read;
+            if (Encrypt(reinterpret_cast<const uint8_t *>(s + done), left, &read)) {
+                closed = true;
+                break;
+            }
+            done += read;
+            if (read) continue;
+        }
+
+        size_t chunk = std::min<size_t>(epptr() - pptr(), left);
+        memcpy(pptr(), s + done, chunk);
+        pbump((int)chunk);
+        done += chunk;
+        if (pptr() == epptr() && Drain()) {
+            closed = true;
+            break;
+        }
+    }
+
+    return done;
+}
+
+int EncryptingStreambuf::sync() {
+    if (closed || Drain()) return -1;
+    return sink->pubsync();
+}
+
+int EncryptingStreambuf::Finish() {
+    if (closed) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    closed = true;
+
+    if (Drain()) return AWS_OP_ERR;
+
+    size_t pending = pptr() - pbase();
+    size_t read;
+
+    if (!size_set && aws_cryptosdk_session_set_message_size(session, consumed + pending)) return AWS_OP_ERR;
+    if (Encrypt(plaintext.data(), pending, &read)) return AWS_OP_ERR;
+    aws_secure_zero(plaintext.data(), plaintext.size());
+    setp(nullptr, nullptr);
+
+    if (!aws_cryptosdk_session_is_done(session)) {
+        // Fewer bytes were written than SetMessageSize promised
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+    if (sink->pubsync()) return aws_raise_error(AWS_CRYPTOSDK_ERR_IO);
+
+    return AWS_OP_SUCCESS;
+}
+
+DecryptingStreambuf::DecryptingStreambuf(
+    struct aws_cryptosdk_session *session, std::streambuf *source, size_t buffer_size)
+    : session(session),
+      source(source),
+      plaintext(std::max<size_t>(buffer_size, 1)),
+      ciphertext(std::max<size_t>(buffer_size, 1)),
+      ct_start(0),
+      ct_end(0),
+      failed(false) {
+    char *base = reinterpret_cast<char *>(plaintext.data());
+    setg(base, base, base);
+}
+
+DecryptingStreambuf::~DecryptingStreambuf() {
+    aws_secure_zero(plaintext.data(), plaintext.size());
+}
+
+bool DecryptingStreambuf::IsDone() const {
+    return aws_cryptosdk_session_is_done(session);
+}
+
+/* Reads more ciphertext from the source, making room for at least in_needed unconsumed bytes */
+int DecryptingStreambuf::Refill(size_t in_needed) {
+    size_t pending = ct_end - ct_start;
+
+    memmove(ciphertext.data(), ciphertext.data() + ct_start, pending);
+    ct_start = 0;
+    ct_end   = pending;
+
+    if (ciphertext.size() < std::max(in_needed, pending + 1)) {
+        ciphertext.resize(std::max({ in_needed, pending + 1, ciphertext.size() * 2 }));
+    }
+
+    std::streamsize got =
+        source->sgetn(reinterpret_cast<char *>(ciphertext.data()) + ct_end, ciphertext.size() - ct_end);
+    if (got <= 0) {
+        // The source ended before the message did
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    }
+    ct_end += got;
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Decrypts the next output the session has into out. Returns successfully with nothing written
+ * once the message is done, or if that output would not fit in out_len bytes.
+ */
+int DecryptingStreambuf::Decrypt(uint8_t *out, size_t out_len, size_t *out_written) {
+    *out_written = 0;
+
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t written, read;
+
+        if (aws_cryptosdk_session_process(
+                session, out, out_len, &written, ciphertext.data() + ct_start, ct_end - ct_start, &read)) {
+            return AWS_OP_ERR;
+        }
+        ct_start += read;
+        if (written) {
+            *out_written = written;
+            break;
+        }
+        if (read) continue;
+
+        size_t out_needed, in_needed;
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+        if (out_needed > out_len) break;
+        if (Refill(in_needed)) return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+DecryptingStreambuf::int_type DecryptingStreambuf::underflow() {
+    if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+
+    while (!failed && !IsDone()) {
+        size_t written;
+
+        if (Decrypt(plaintext.data(), plaintext.size(), &written)) {
+            failed = true;
+            break;
+        }
+        if (written) {
+            char *base = reinterpret_cast<char *>(plaintext.data());
+            setg(base, base, base + written);
+            return traits_type::to_int_type(*gptr());
+        }
+        if (IsDone()) break;
+
+        // The next frame is larger than the get area; the old contents have all been read
+        size_t out_needed, in_needed;
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+        aws_secure_zero(plaintext.data(), plaintext.size());
+        plaintext.resize(std::max(out_needed, plaintext.size() + 1));
+        setg(nullptr, nullptr, nullptr);
+    }
+
+    return traits_type::eof();
+}
+
+std::streamsize DecryptingStreambuf::xsgetn(char *s, std::streamsize n) {
+    std::streamsize done = 0;
+
+    while (done < n) {
+        size_t left  = n - done;
+        size_t avail = egptr() - gptr();
+
+        if (avail) {
+            size_t chunk = std::min(avail, left);
+            memcpy(s + done, gptr(), chunk);
+            gbump((int)chunk);
+            done += chunk;
+            continue;
+        }
+
+        // With nothing buffered, frames are decrypted straight into the caller's memory
+        if (left >= plaintext.size() && !failed) {
+            size_t written;
+            if (Decrypt(reinterpret_cast<uint8_t *>(s + done), left, &written)) {
+                failed = true;
+                break;
+            }
+            done += written;
+            if (written) continue;
+        }
+
+        if (traits_type::eq_int_type(underflow(), traits_type::eof())) break;
+    }
+
+    return done;
+}
+
+}  // namespace Cryptosdk
+}  // namespace Aws
@@ -41,7 +41,9 @@ class TESTLIB_CPP_API Edks {
 };
 
 /**
- * Assets that an edk structure has the expected values for expected_ct, expected_key_id, expected_provider_id
+ * Assets that an edk structure has the expected values for expected_ct, expected_key_id, expected_provider_id,
+ * and that its provider ID was allocated with allocator. The ciphertext may have been adopted from a KMS result
+ * (see aws_byte_buf_adopt_from_aws_utils), so it only has to be owned.
  */
 static inline int t_assert_edk_contains_expected_values(
     const struct aws_cryptosdk_edk *edk,
@@ -52,7 +54,8 @@ static inline int t_assert_edk_contains_expected_values(
     TEST_ASSERT(string(expected_ct) == string((char *)edk->ciphertext.buffer, edk->ciphertext.len));
     TEST_ASSERT(string(expected_key_id) == string((char *)edk->provider_info.buffer, edk->provider_info.len));
     TEST_ASSERT(string(expected_provider_id) == string((char *)edk->provider_id.buffer, edk->provider_id.len));
-    TEST_ASSERT_ADDR_EQ(allocator, edk->ciphertext.allocator);
+    TEST_ASSERT_ADDR_EQ(allocator, edk->provider_id.allocator);
+    TEST_ASSERT_ADDR_NOT_NULL(edk->ciphertext.allocator);
     return 0;
 }
 
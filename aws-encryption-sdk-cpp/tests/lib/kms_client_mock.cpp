@@ -14,6 +14,7 @@
  */
 
 #include "kms_client_mock.h"
+#include <algorithm>
 #include <stdexcept>
 
 namespace Aws {
@@ -21,7 +22,7 @@ namespace Cryptosdk {
 namespace Testing {
 using std::logic_error;
 
-KmsClientMock::KmsClientMock() : Aws::KMS::KMSClient(), expect_generate_dk(false) {}
+KmsClientMock::KmsClientMock() : Aws::KMS::KMSClient() {}
 
 KmsClientMock::~KmsClientMock() {
     // there shouldn't be any other expecting calls
@@ -32,18 +33,17 @@ KmsClientMock::~KmsClientMock() {
 }
 
 Model::EncryptOutcome KmsClientMock::Encrypt(const Model::EncryptRequest &request) const {
-    if (expected_encrypt_values.size() == 0) {
-        throw logic_error("Unexpected call to encrypt");
+    std::unique_lock<std::mutex> lock(encrypt_mutex);
+    auto eev_it = std::find_if(
+        expected_encrypt_values.begin(), expected_encrypt_values.end(), [&request](const ExpectedEncryptValues &eev) {
+            return eev.expected_enc_request.GetKeyId() == request.GetKeyId();
+        });
+    if (eev_it == expected_encrypt_values.end()) {
+        throw logic_error(std::string("Unexpected call to encrypt with key: ") + request.GetKeyId().c_str());
     }
 
-    ExpectedEncryptValues eev = expected_encrypt_values.front();
-    expected_encrypt_values.pop_front();
-
-    if (request.GetKeyId() != eev.expected_enc_request.GetKeyId()) {
-        throw logic_error(
-            std::string("Got :") + request.GetKeyId().c_str() +
-            " expecting: " + eev.expected_enc_request.GetKeyId().c_str());
-    }
+    ExpectedEncryptValues eev = *eev_it;
+    expected_encrypt_values.erase(eev_it);
 
     if (request.GetPlaintext() != eev.expected_enc_request.GetPlaintext()) {
         throw logic_error(
@@ -64,11 +64,13 @@ Model::EncryptOutcome KmsClientMock::Encrypt(const Model::EncryptRequest &reques
 }
 void KmsClientMock::ExpectEncryptAccumulator(
     const Model::EncryptRequest &request, Model::EncryptOutcome encrypt_return) {
+    std::unique_lock<std::mutex> lock(encrypt_mutex);
     ExpectedEncryptValues eev = { request, encrypt_return };
     this->expected_encrypt_values.push_back(eev);
 }
 
 Model::DecryptOutcome KmsClientMock::Decrypt(const Model::DecryptRequest &request) const {
+    std::unique_lock<std::mutex> lock(decrypt_mutex);
     if (expected_decrypt_values.size() == 0) {
         throw std::exception();
     }
@@ -92,20 +94,24 @@ Model::DecryptOutcome KmsClientMock::Decrypt(const Model::DecryptRequest &reques
 
 void KmsClientMock::ExpectDecryptAccumulator(
     const Model::DecryptRequest &request, Model::DecryptOutcome decrypt_return) {
+    std::unique_lock<std::mutex> lock(decrypt_mutex);
     ExpectedDecryptValues edv = { request, decrypt_return };
     this->expected_decrypt_values.push_back(edv);
 }
 
 Model::GenerateDataKeyOutcome KmsClientMock::GenerateDataKey(const Model::GenerateDataKeyRequest &request) const {
-    if (!expect_generate_dk) {
+    std::unique_lock<std::mutex> lock(generate_dk_mutex);
+    if (expected_generate_dk_values.size() == 0) {
         throw std::exception();
     }
+    ExpectedGenerateDataKeyValues egv = expected_generate_dk_values.front();
+    expected_generate_dk_values.pop_front();
 
-    if (request.GetKeyId() != expected_generate_dk_request.GetKeyId()) {
+    if (request.GetKeyId() != egv.expected_generate_dk_request.GetKeyId()) {
         throw std::exception();
     }
 
-    if (request.GetNumberOfBytes() != expected_generate_dk_request.GetNumberOfBytes()) {
+    if (request.GetNumberOfBytes() != egv.expected_generate_dk_request.GetNumberOfBytes()) {
         throw std::exception();
     }
 
@@ -113,23 +119,47 @@ Model::GenerateDataKeyOutcome KmsClientMock::GenerateDataKey(const Model::Genera
         throw logic_error("Got other grant tokens than expected");
     }
 
-    if (request.GetEncryptionContext() != expected_generate_dk_request.GetEncryptionContext()) {
+    if (request.GetEncryptionContext() != egv.expected_generate_dk_request.GetEncryptionContext()) {
         throw logic_error("Got other encryption context than expected");
     }
 
-    expect_generate_dk = false;
-    return generate_dk_return;
+    return egv.generate_dk_return;
 }
 
 void KmsClientMock::ExpectGenerateDataKey(
     const Model::GenerateDataKeyRequest &request, Model::GenerateDataKeyOutcome generate_dk_return) {
-    expect_generate_dk           = true;
-    expected_generate_dk_request = request;
-    this->generate_dk_return     = generate_dk_return;
+    std::unique_lock<std::mutex> lock(generate_dk_mutex);
+    ExpectedGenerateDataKeyValues egv = { request, generate_dk_return };
+    this->expected_generate_dk_values.push_back(egv);
+}
+
+void KmsClientMock::GenerateDataKeyAsync(
+    const Model::GenerateDataKeyRequest &request,
+    const Aws::KMS::GenerateDataKeyResponseReceivedHandler &handler,
+    const std::shared_ptr<const Aws::Client::AsyncCallerContext> &context) const {
+    std::unique_lock<std::mutex> lock(generate_dk_mutex);
+    PendingGenerateDataKey pending = { request, handler, context };
+    pending_generate_dk.push_back(pending);
+}
+
+size_t KmsClientMock::RunPendingGenerateDataKeys() {
+    std::deque<PendingGenerateDataKey> pending;
+    {
+        std::unique_lock<std::mutex> lock(generate_dk_mutex);
+        pending.swap(pending_generate_dk);
+    }
+
+    // The handlers may make more calls, which are left for the next run
+    for (auto &call : pending) {
+        call.handler(this, call.request, GenerateDataKey(call.request), call.context);
+    }
+    return pending.size();
 }
 
 bool KmsClientMock::ExpectingOtherCalls() {
-    return (expected_decrypt_values.size() != 0) || (expected_encrypt_values.size() != 0) || expect_generate_dk;
+    std::unique_lock<std::mutex> lock(generate_dk_mutex);
+    return (expected_decrypt_values.size() != 0) || (expected_encrypt_values.size() != 0) ||
+           (expected_generate_dk_values.size() != 0) || (pending_generate_dk.size() != 0);
 }
 
 void KmsClientMock::ExpectGrantTokens(const Aws::Vector<Aws::String> &grant_tokens) {
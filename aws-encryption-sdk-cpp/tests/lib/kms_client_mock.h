@@ -25,6 +25,7 @@
 #include <aws/kms/model/GenerateDataKeyRequest.h>
 #include <aws/kms/model/GenerateDataKeyResult.h>
 #include <deque>
+#include <mutex>
 
 #include "exports.h"
 
@@ -49,9 +50,18 @@ class TESTLIB_CPP_API KmsClientMock : public Aws::KMS::KMSClient {
     void ExpectDecryptAccumulator(const Model::DecryptRequest &request, Model::DecryptOutcome decrypt_return);
 
     Model::GenerateDataKeyOutcome GenerateDataKey(const Model::GenerateDataKeyRequest &request) const;
+    /* Expectations are queued, and met by GenerateDataKey calls in the order they were made */
     void ExpectGenerateDataKey(
         const Model::GenerateDataKeyRequest &request, Model::GenerateDataKeyOutcome generate_dk_return);
 
+    /* Holds on to the call until RunPendingGenerateDataKeys makes it, rather than making it on another thread */
+    void GenerateDataKeyAsync(
+        const Model::GenerateDataKeyRequest &request,
+        const Aws::KMS::GenerateDataKeyResponseReceivedHandler &handler,
+        const std::shared_ptr<const Aws::Client::AsyncCallerContext> &context = nullptr) const;
+    /* Makes the calls held by GenerateDataKeyAsync on the calling thread, and returns how many there were */
+    size_t RunPendingGenerateDataKeys();
+
     void ExpectGrantTokens(const Aws::Vector<Aws::String> &grant_tokens);
 
     bool ExpectingOtherCalls();
@@ -61,17 +71,30 @@ class TESTLIB_CPP_API KmsClientMock : public Aws::KMS::KMSClient {
         Model::EncryptRequest expected_enc_request;
         Model::EncryptOutcome encrypt_return;
     };
+    /* The keyring issues its Encrypt calls concurrently, so these are matched by key ID, not order */
     mutable std::deque<ExpectedEncryptValues> expected_encrypt_values;
+    mutable std::mutex encrypt_mutex;
 
     struct ExpectedDecryptValues {
         Model::DecryptRequest expected_dec_request;
         Model::DecryptOutcome return_decrypt;
     };
     mutable std::deque<ExpectedDecryptValues> expected_decrypt_values;
+    mutable std::mutex decrypt_mutex;
+
+    struct ExpectedGenerateDataKeyValues {
+        Model::GenerateDataKeyRequest expected_generate_dk_request;
+        Model::GenerateDataKeyOutcome generate_dk_return;
+    };
+    mutable std::deque<ExpectedGenerateDataKeyValues> expected_generate_dk_values;
 
-    mutable bool expect_generate_dk;
-    Model::GenerateDataKeyRequest expected_generate_dk_request;
-    Model::GenerateDataKeyOutcome generate_dk_return;
+    struct PendingGenerateDataKey {
+        Model::GenerateDataKeyRequest request;
+        Aws::KMS::GenerateDataKeyResponseReceivedHandler handler;
+        std::shared_ptr<const Aws::Client::AsyncCallerContext> context;
+    };
+    mutable std::deque<PendingGenerateDataKey> pending_generate_dk;
+    mutable std::mutex generate_dk_mutex;
 
     Aws::Vector<Aws::String> grant_tokens;
 };
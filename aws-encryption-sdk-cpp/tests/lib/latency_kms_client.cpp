@@ -0,0 +1,170 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "latency_kms_client.h"
+
+#include <aws/core/client/AWSError.h>
+#include <aws/core/client/CoreErrors.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace Aws {
+namespace Cryptosdk {
+namespace Testing {
+
+namespace Model = Aws::KMS::Model;
+
+static const char *LATENCY_KMS_CLIENT_TAG = "LatencyKmsClient";
+
+/* z-score of the 99th percentile of the standard normal distribution */
+static const double Z_P99 = 2.3263478740;
+
+/* Ciphertext blobs are the key ID, a zero byte, then the plaintext */
+static Aws::Utils::ByteBuffer MakeBlob(const Aws::String &key_id, const Aws::Utils::ByteBuffer &plaintext) {
+    Aws::Utils::ByteBuffer blob(key_id.size() + 1 + plaintext.GetLength());
+    memcpy(blob.GetUnderlyingData(), key_id.data(), key_id.size());
+    blob[key_id.size()] = 0;
+    if (plaintext.GetLength()) {
+        memcpy(blob.GetUnderlyingData() + key_id.size() + 1, plaintext.GetUnderlyingData(), plaintext.GetLength());
+    }
+    return blob;
+}
+
+static bool ParseBlob(const Aws::Utils::ByteBuffer &blob, Aws::String &key_id, Aws::Utils::CryptoBuffer &plaintext) {
+    const unsigned char *data = blob.GetUnderlyingData();
+    const void *sep           = data ? memchr(data, 0, blob.GetLength()) : nullptr;
+    if (!sep) return false;
+
+    size_t key_len = static_cast<const unsigned char *>(sep) - data;
+    key_id         = Aws::String(reinterpret_cast<const char *>(data), key_len);
+    plaintext      = Aws::Utils::CryptoBuffer(data + key_len + 1, blob.GetLength() - key_len - 1);
+    return true;
+}
+
+LatencyKmsClient::LatencyKmsClient(const LatencyProfile &profile, uint64_t seed)
+    : Aws::KMS::KMSClient(), profile(profile), rng(seed), calls(0), throttled(0), errors(0) {
+    double median = std::max<double>(1, static_cast<double>(profile.median.count()));
+    double p99    = std::max<double>(median, static_cast<double>(profile.p99.count()));
+    mu            = std::log(median);
+    sigma         = std::log(p99 / median) / Z_P99;
+}
+
+LatencyKmsClient::Fault LatencyKmsClient::Delay() const {
+    double latency_us, fault_draw;
+    {
+        std::lock_guard<std::mutex> lock(rng_mutex);
+        latency_us = sigma > 0 ? std::lognormal_distribution<double>(mu, sigma)(rng) : std::exp(mu);
+        fault_draw = std::uniform_real_distribution<double>(0, 1)(rng);
+    }
+    calls++;
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64_t>(latency_us)));
+
+    if (fault_draw < profile.throttle_rate) {
+        throttled++;
+        return Fault::THROTTLED;
+    }
+    if (fault_draw < profile.throttle_rate + profile.error_rate) {
+        errors++;
+        return Fault::OTHER;
+    }
+    return Fault::NONE;
+}
+
+template <typename Outcome>
+Outcome LatencyKmsClient::FaultOutcome(Fault fault) {
+    if (fault == Fault::THROTTLED) {
+        return Outcome(Aws::Client::AWSError<Aws::Client::CoreErrors>(
+            Aws::Client::CoreErrors::THROTTLING, "ThrottlingException", "Rate exceeded", true));
+    }
+    return Outcome(Aws::Client::AWSError<Aws::Client::CoreErrors>(
+        Aws::Client::CoreErrors::INTERNAL_FAILURE, "KMSInternalException", "Injected failure", false));
+}
+
+Model::EncryptOutcome LatencyKmsClient::Encrypt(const Model::EncryptRequest &request) const {
+    Fault fault = Delay();
+    if (fault != Fault::NONE) return FaultOutcome<Model::EncryptOutcome>(fault);
+
+    Model::EncryptResult result;
+    result.SetKeyId(request.GetKeyId());
+    result.SetCiphertextBlob(MakeBlob(request.GetKeyId(), request.GetPlaintext()));
+    return Model::EncryptOutcome(result);
+}
+
+Model::DecryptOutcome LatencyKmsClient::Decrypt(const Model::DecryptRequest &request) const {
+    Fault fault = Delay();
+    if (fault != Fault::NONE) return FaultOutcome<Model::DecryptOutcome>(fault);
+
+    Aws::String key_id;
+    Aws::Utils::CryptoBuffer plaintext;
+    if (!ParseBlob(request.GetCiphertextBlob(), key_id, plaintext)) {
+        return Model::DecryptOutcome(Aws::Client::AWSError<Aws::Client::CoreErrors>(
+            Aws::Client::CoreErrors::VALIDATION, "InvalidCiphertextException", "Not a ciphertext blob", false));
+    }
+
+    Model::DecryptResult result;
+    result.SetKeyId(key_id);
+    result.SetPlaintext(plaintext);
+    return Model::DecryptOutcome(result);
+}
+
+Model::GenerateDataKeyOutcome LatencyKmsClient::GenerateDataKey(const Model::GenerateDataKeyRequest &request) const {
+    Fault fault = Delay();
+    if (fault != Fault::NONE) return FaultOutcome<Model::GenerateDataKeyOutcome>(fault);
+
+    Aws::Utils::CryptoBuffer data_key(static_cast<size_t>(request.GetNumberOfBytes()));
+    {
+        std::lock_guard<std::mutex> lock(rng_mutex);
+        for (size_t i = 0; i < data_key.GetLength(); i++) data_key[i] = static_cast<unsigned char>(rng());
+    }
+
+    Model::GenerateDataKeyResult result;
+    result.SetKeyId(request.GetKeyId());
+    result.SetCiphertextBlob(MakeBlob(request.GetKeyId(), data_key));
+    result.SetPlaintext(data_key);
+    return Model::GenerateDataKeyOutcome(result);
+}
+
+LatencyClientSupplier::LatencyClientSupplier(
+    const LatencyProfile &default_profile, const Aws::Map<Aws::String, LatencyProfile> &region_profiles)
+    : default_profile(default_profile), region_profiles(region_profiles) {}
+
+std::shared_ptr<Aws::KMS::KMSClient> LatencyClientSupplier::GetClient(
+    const Aws::String &region, std::function<void()> &report_success) {
+    report_success = [] {};
+
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    auto &client = clients[region];
+    if (!client) {
+        auto it = region_profiles.find(region);
+        // Each region gets its own seed, so that regions with the same profile are not in lockstep
+        client = Aws::MakeShared<LatencyKmsClient>(
+            LATENCY_KMS_CLIENT_TAG,
+            it == region_profiles.end() ? default_profile : it->second,
+            static_cast<uint64_t>(std::hash<std::string>()(std::string(region.c_str()))));
+    }
+    return client;
+}
+
+std::shared_ptr<LatencyKmsClient> LatencyClientSupplier::ClientFor(const Aws::String &region) const {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    auto it = clients.find(region);
+    return it == clients.end() ? nullptr : it->second;
+}
+
+}  // namespace Testing
+}  // namespace Cryptosdk
+}  // namespace Aws
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_ENCRYPTION_SDK_LATENCY_KMS_CLIENT_H
+#define AWS_ENCRYPTION_SDK_LATENCY_KMS_CLIENT_H
+
+#include <aws/cryptosdk/cpp/kms_keyring.h>
+#include <aws/kms/KMSClient.h>
+#include <aws/kms/model/DecryptRequest.h>
+#include <aws/kms/model/DecryptResult.h>
+#include <aws/kms/model/EncryptRequest.h>
+#include <aws/kms/model/EncryptResult.h>
+#include <aws/kms/model/GenerateDataKeyRequest.h>
+#include <aws/kms/model/GenerateDataKeyResult.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+
+#include "exports.h"
+
+namespace Aws {
+namespace Cryptosdk {
+namespace Testing {
+
+/**
+ * How a simulated KMS region answers: latencies are lognormal with the given median and 99th
+ * percentile, and each call is throttled with probability throttle_rate, and otherwise fails with
+ * probability error_rate. Failed calls take as long as successful ones.
+ */
+struct LatencyProfile {
+    std::chrono::microseconds median;
+    std::chrono::microseconds p99;
+    double throttle_rate;
+    double error_rate;
+};
+
+/**
+ * A stand-in for KMS which answers any number of calls, for benchmarks. Unlike KmsClientMock, it
+ * has no expectations: it sleeps for a latency drawn from its profile, then "encrypts" by
+ * prefixing the plaintext with the key ID, so that anything it encrypted it can also decrypt, and
+ * GenerateDataKey returns random data keys. Nothing it returns is secret.
+ */
+class TESTLIB_CPP_API LatencyKmsClient : public Aws::KMS::KMSClient {
+   public:
+    explicit LatencyKmsClient(const LatencyProfile &profile, uint64_t seed = 1);
+
+    Aws::KMS::Model::EncryptOutcome Encrypt(const Aws::KMS::Model::EncryptRequest &request) const;
+    Aws::KMS::Model::DecryptOutcome Decrypt(const Aws::KMS::Model::DecryptRequest &request) const;
+    Aws::KMS::Model::GenerateDataKeyOutcome GenerateDataKey(
+        const Aws::KMS::Model::GenerateDataKeyRequest &request) const;
+
+    /** Number of calls made so far, and how many of them were throttled or failed otherwise */
+    uint64_t Calls() const {
+        return calls.load();
+    }
+    uint64_t Throttled() const {
+        return throttled.load();
+    }
+    uint64_t Errors() const {
+        return errors.load();
+    }
+
+   private:
+    enum class Fault { NONE, THROTTLED, OTHER };
+
+    /** Sleeps for one call's latency, and returns the fault the call is to fail with, if any */
+    Fault Delay() const;
+
+    template <typename Outcome>
+    static Outcome FaultOutcome(Fault fault);
+
+    LatencyProfile profile;
+    double mu, sigma;
+
+    mutable std::mutex rng_mutex;
+    mutable std::mt19937_64 rng;
+
+    mutable std::atomic<uint64_t> calls, throttled, errors;
+};
+
+/**
+ * Supplies a LatencyKmsClient per region, with the profile given for that region or the default
+ * profile otherwise. Clients are created on first use and kept, so their counts add up over a run.
+ */
+class TESTLIB_CPP_API LatencyClientSupplier : public Aws::Cryptosdk::KmsKeyring::ClientSupplier {
+   public:
+    LatencyClientSupplier(
+        const LatencyProfile &default_profile, const Aws::Map<Aws::String, LatencyProfile> &region_profiles = {});
+
+    std::shared_ptr<Aws::KMS::KMSClient> GetClient(const Aws::String &region, std::function<void()> &report_success);
+
+    /** Returns the client for region, or nullptr if none has been created yet */
+    std::shared_ptr<LatencyKmsClient> ClientFor(const Aws::String &region) const;
+
+   private:
+    LatencyProfile default_profile;
+    Aws::Map<Aws::String, LatencyProfile> region_profiles;
+
+    mutable std::mutex clients_mutex;
+    Aws::Map<Aws::String, std::shared_ptr<LatencyKmsClient>> clients;
+};
+
+}  // namespace Testing
+}  // namespace Cryptosdk
+}  // namespace Aws
+
+#endif  // AWS_ENCRYPTION_SDK_LATENCY_KMS_CLIENT_H
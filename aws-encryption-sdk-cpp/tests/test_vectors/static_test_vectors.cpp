@@ -26,11 +26,15 @@
 #include <aws/cryptosdk/raw_rsa_keyring.h>
 #include <aws/cryptosdk/session.h>
 
+#include <cstring>
+#include <string>
+
 #include <json-c/json.h>
 #include <json-c/json_object.h>
 
 #include "testing.h"
 #include "testutil.h"
+#include "vector_perf.h"
 
 #define MANIFEST_VERSION 1
 #define KEYS_MANIFEST_VERSION 3
@@ -46,6 +50,9 @@ enum test_type {
 };
 
 int passed, failed, encrypt_only, not_yet_supported, test_type_passed[3];
+/* Set by --perf: vectors which decrypt correctly are also timed (see vector_perf.h) */
+static bool perf_mode;
+static struct vector_perf_options perf_options = { 100ull * 1000 * 1000, 0.25, NULL };
 
 static int cmp_jsonstr_with_cstr(json_object *jso, const char *str) {
     const char *tmp_str = json_object_get_string(jso);
@@ -123,6 +130,7 @@ static bool get_padding_mode(
 
 static int process_test_scenarios(
     struct aws_allocator *alloc,
+    const char *test_name,
     std::string pt_filename,
     std::string ct_filename,
     json_object *master_keys_obj,
@@ -376,6 +384,12 @@ static int process_test_scenarios(
             passed++;
         }
 
+        // Timing a KMS vector would time KMS itself, and cost a call per decrypt
+        if (perf_mode && test_type_idx != AWS_CRYPTOSDK_KMS) {
+            std::string perf_name = std::string(test_name) + "#" + std::to_string(j);
+            if (vector_perf_run(&perf_options, perf_name.c_str(), cmm, ciphertext, ct_len, pt_len)) failed++;
+        }
+
     next_test_scenario:
         if (key_namespace) aws_string_destroy(key_namespace);
         if (key_name) aws_string_destroy(key_name);
@@ -443,7 +457,7 @@ static int test_vector_runner(const char *path) {
         ct_filename.replace(ct_filename.find(find_str), find_str.length(), path);
 
         TEST_ASSERT(json_object_object_get_ex(val, "master-keys", &master_keys_obj));
-        TEST_ASSERT_SUCCESS(process_test_scenarios(alloc, pt_filename, ct_filename, master_keys_obj, keys_obj));
+        TEST_ASSERT_SUCCESS(process_test_scenarios(alloc, key, pt_filename, ct_filename, master_keys_obj, keys_obj));
     }
     printf("Decryption successfully completed for %d test cases and failed for %d.\n", passed, failed);
     printf(
@@ -457,14 +471,37 @@ static int test_vector_runner(const char *path) {
 }
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Wrong number of arguments\nUsage: ./static_test_vectors /path/to/manifest/files\n");
+    const char *baseline_path = NULL;
+    int i;
+
+    for (i = 1; i < argc - 1; i++) {
+        if (!strcmp(argv[i], "--perf")) {
+            perf_mode = true;
+        } else if (!strcmp(argv[i], "--baseline") && i + 2 < argc) {
+            baseline_path = argv[++i];
+        } else if (!strcmp(argv[i], "--min-time-ms") && i + 2 < argc) {
+            perf_options.min_time_ns = strtoull(argv[++i], NULL, 10) * 1000 * 1000;
+        } else if (!strcmp(argv[i], "--tolerance") && i + 2 < argc) {
+            perf_options.tolerance = strtod(argv[++i], NULL);
+        } else {
+            break;
+        }
+    }
+    if (i != argc - 1 || (baseline_path && !perf_mode)) {
+        fprintf(
+            stderr,
+            "Wrong arguments\nUsage: ./static_test_vectors [--perf [--baseline FILE] [--min-time-ms N] "
+            "[--tolerance FRACTION]] /path/to/manifest/files\n");
         return EXIT_FAILURE;
     }
     aws_cryptosdk_load_error_strings();
+    if (baseline_path && !(perf_options.baseline = vector_perf_baseline_load(aws_default_allocator(), baseline_path))) {
+        return EXIT_FAILURE;
+    }
     SDKOptions options;
     Aws::InitAPI(options);
-    int rv = test_vector_runner(argv[1]);
+    int rv = test_vector_runner(argv[i]);
     Aws::ShutdownAPI(options);
+    vector_perf_baseline_destroy(perf_options.baseline);
     return rv;
 }
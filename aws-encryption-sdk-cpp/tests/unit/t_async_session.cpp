@@ -0,0 +1,325 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/cpp/async_session.h>
+#include <aws/cryptosdk/error.h>
+#include <deque>
+#include <string>
+
+#include "testing.h"
+#include "testutil.h"
+#include "zero_keyring.h"
+
+using namespace Aws::Cryptosdk;
+
+/*
+ * A keyring which forwards to a zero keyring. Its asynchronous calls are left outstanding
+ * until the test completes them with CompleteDeferredCall.
+ */
+static struct aws_cryptosdk_keyring *zero_kr;
+static std::function<void()> deferred_call;
+
+static void DeferredDestroy(struct aws_cryptosdk_keyring *) {}
+
+static int DeferredOnEncrypt(
+    struct aws_cryptosdk_keyring *,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return aws_cryptosdk_keyring_on_encrypt(
+        zero_kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+}
+
+static int DeferredOnDecrypt(
+    struct aws_cryptosdk_keyring *,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return aws_cryptosdk_keyring_on_decrypt(
+        zero_kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+}
+
+static int DeferredOnEncryptAsync(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    deferred_call = [=] {
+        int rv = DeferredOnEncrypt(kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+        callback(rv ? aws_last_error() : AWS_ERROR_SUCCESS, user_data);
+    };
+    return AWS_OP_SUCCESS;
+}
+
+static int DeferredOnDecryptAsync(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    deferred_call = [=] {
+        int rv = DeferredOnDecrypt(kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+        callback(rv ? aws_last_error() : AWS_ERROR_SUCCESS, user_data);
+    };
+    return AWS_OP_SUCCESS;
+}
+
+static const aws_cryptosdk_keyring_vt deferred_keyring_vt = { sizeof(struct aws_cryptosdk_keyring_vt),
+                                                              "deferred keyring",
+                                                              DeferredDestroy,
+                                                              DeferredOnEncrypt,
+                                                              DeferredOnDecrypt,
+                                                              DeferredOnEncryptAsync,
+                                                              DeferredOnDecryptAsync };
+
+static struct aws_cryptosdk_keyring deferred_kr;
+
+static bool CompleteDeferredCall() {
+    std::function<void()> call = std::move(deferred_call);
+    deferred_call              = nullptr;
+    if (!call) return false;
+    call();
+    return true;
+}
+
+/* An executor whose tasks wait until the test runs them */
+struct QueuedExecutor {
+    std::deque<std::function<void()>> tasks;
+
+    AsyncSession::Executor Get() {
+        return [this](std::function<void()> task) { tasks.push_back(std::move(task)); };
+    }
+
+    size_t RunAll() {
+        size_t ran = 0;
+        while (!tasks.empty()) {
+            std::function<void()> task = std::move(tasks.front());
+            tasks.pop_front();
+            task();
+            ran++;
+        }
+        return ran;
+    }
+};
+
+static const std::string plaintext = "Asynchronous sessions multiplex messages on a few threads";
+
+static const uint8_t *Bytes(const std::string &str) {
+    return reinterpret_cast<const uint8_t *>(str.data());
+}
+
+int asyncSession_deferredMaterials_completeOnExecutor() {
+    struct aws_cryptosdk_session *enc_session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, &deferred_kr);
+    struct aws_cryptosdk_session *dec_session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, &deferred_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(enc_session);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_session);
+
+    QueuedExecutor executor;
+    AsyncSession encryptor(enc_session, executor.Get());
+    AsyncSession decryptor(dec_session, executor.Get());
+    std::vector<uint8_t> ciphertext, decrypted;
+    int enc_result = -1, dec_result = -1;
+
+    encryptor.Encrypt(Bytes(plaintext), plaintext.size(), &ciphertext, [&](int error_code) {
+        enc_result = error_code;
+    });
+    // Nothing is held while the keyring is outstanding, and nothing is scheduled until it answers
+    TEST_ASSERT_INT_EQ(-1, enc_result);
+    TEST_ASSERT(aws_cryptosdk_session_is_pending(enc_session));
+    TEST_ASSERT_INT_EQ(0, executor.tasks.size());
+
+    TEST_ASSERT(CompleteDeferredCall());
+    TEST_ASSERT_INT_EQ(-1, enc_result);
+    TEST_ASSERT_INT_EQ(1, executor.RunAll());
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, enc_result);
+    TEST_ASSERT(aws_cryptosdk_session_is_done(enc_session));
+    uint64_t message_size;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_total_output_size(enc_session, &message_size));
+    TEST_ASSERT_INT_EQ(message_size, ciphertext.size());
+
+    decryptor.Decrypt(ciphertext.data(), ciphertext.size(), &decrypted, [&](int error_code) {
+        dec_result = error_code;
+    });
+    TEST_ASSERT_INT_EQ(-1, dec_result);
+    TEST_ASSERT(CompleteDeferredCall());
+    TEST_ASSERT_INT_EQ(1, executor.RunAll());
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, dec_result);
+    TEST_ASSERT(std::string(decrypted.begin(), decrypted.end()) == plaintext);
+
+    aws_cryptosdk_session_destroy(enc_session);
+    aws_cryptosdk_session_destroy(dec_session);
+    return 0;
+}
+
+int asyncSession_synchronousKeyring_completesInline() {
+    struct aws_cryptosdk_session *enc_session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, zero_kr);
+    struct aws_cryptosdk_session *dec_session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, zero_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(enc_session);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_session);
+
+    QueuedExecutor executor;
+    AsyncSession encryptor(enc_session, executor.Get());
+    AsyncSession decryptor(dec_session, executor.Get());
+    std::vector<uint8_t> ciphertext, decrypted;
+    int result = -1;
+
+    // Reusing the session for a second message only takes a reset
+    for (int i = 0; i < 2; i++) {
+        encryptor.Encrypt(Bytes(plaintext), plaintext.size(), &ciphertext, [&](int error_code) {
+            result = error_code;
+        });
+        TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, result);
+
+        result = -1;
+        decryptor.Decrypt(ciphertext.data(), ciphertext.size(), &decrypted, [&](int error_code) {
+            result = error_code;
+        });
+        TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, result);
+        TEST_ASSERT(std::string(decrypted.begin(), decrypted.end()) == plaintext);
+        TEST_ASSERT_INT_EQ(0, executor.tasks.size());
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(enc_session, AWS_CRYPTOSDK_ENCRYPT));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(dec_session, AWS_CRYPTOSDK_DECRYPT));
+    }
+
+    aws_cryptosdk_session_destroy(enc_session);
+    aws_cryptosdk_session_destroy(dec_session);
+    return 0;
+}
+
+int asyncSession_truncatedCiphertext_failsWithBadCiphertext() {
+    struct aws_cryptosdk_session *enc_session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, zero_kr);
+    struct aws_cryptosdk_session *dec_session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, zero_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(enc_session);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_session);
+
+    QueuedExecutor executor;
+    AsyncSession encryptor(enc_session, executor.Get());
+    AsyncSession decryptor(dec_session, executor.Get());
+    std::vector<uint8_t> ciphertext, decrypted;
+    int result = -1;
+
+    encryptor.Encrypt(Bytes(plaintext), plaintext.size(), &ciphertext, [&](int error_code) { result = error_code; });
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, result);
+
+    decryptor.Decrypt(ciphertext.data(), ciphertext.size() - 1, &decrypted, [&](int error_code) {
+        result = error_code;
+    });
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, result);
+    TEST_ASSERT(!aws_cryptosdk_session_is_done(dec_session));
+
+    // A session which has already been used for this message is refused
+    encryptor.Encrypt(Bytes(plaintext), plaintext.size(), &ciphertext, [&](int error_code) { result = error_code; });
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_BAD_STATE, result);
+
+    aws_cryptosdk_session_destroy(enc_session);
+    aws_cryptosdk_session_destroy(dec_session);
+    return 0;
+}
+
+#ifdef AWS_CRYPTOSDK_CPP_COROUTINES
+/* A coroutine which starts at once and is never awaited */
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() {
+            abort();
+        }
+    };
+};
+
+static DetachedTask RoundTrip(
+    AsyncSession &encryptor,
+    AsyncSession &decryptor,
+    std::vector<uint8_t> &ciphertext,
+    std::vector<uint8_t> &decrypted,
+    int &result) {
+    int error_code = co_await encryptor.Encrypt(Bytes(plaintext), plaintext.size(), &ciphertext);
+    if (!error_code) error_code = co_await decryptor.Decrypt(ciphertext.data(), ciphertext.size(), &decrypted);
+    result = error_code;
+}
+
+int asyncSession_coroutine_resumesOnExecutor() {
+    struct aws_cryptosdk_session *enc_session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, &deferred_kr);
+    struct aws_cryptosdk_session *dec_session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, zero_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(enc_session);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_session);
+
+    QueuedExecutor executor;
+    AsyncSession encryptor(enc_session, executor.Get());
+    AsyncSession decryptor(dec_session, executor.Get());
+    std::vector<uint8_t> ciphertext, decrypted;
+    int result = -1;
+
+    RoundTrip(encryptor, decryptor, ciphertext, decrypted, result);
+    // Suspended on encryption; decryption then completes without suspending at all
+    TEST_ASSERT_INT_EQ(-1, result);
+    TEST_ASSERT(CompleteDeferredCall());
+    TEST_ASSERT_INT_EQ(1, executor.RunAll());
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, result);
+    TEST_ASSERT(std::string(decrypted.begin(), decrypted.end()) == plaintext);
+
+    aws_cryptosdk_session_destroy(enc_session);
+    aws_cryptosdk_session_destroy(dec_session);
+    return 0;
+}
+#endif
+
+int main() {
+    aws_cryptosdk_load_error_strings();
+    zero_kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    aws_cryptosdk_keyring_base_init(&deferred_kr, &deferred_keyring_vt);
+
+    RUN_TEST(asyncSession_deferredMaterials_completeOnExecutor());
+    RUN_TEST(asyncSession_synchronousKeyring_completesInline());
+    RUN_TEST(asyncSession_truncatedCiphertext_failsWithBadCiphertext());
+#ifdef AWS_CRYPTOSDK_CPP_COROUTINES
+    RUN_TEST(asyncSession_coroutine_resumesOnExecutor());
+#endif
+
+    aws_cryptosdk_keyring_release(zero_kr);
+}
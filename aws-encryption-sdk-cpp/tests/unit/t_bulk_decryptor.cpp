@@ -0,0 +1,159 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/cpp/bulk_decryptor.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <mutex>
+#include <vector>
+
+#include "testing.h"
+#include "testutil.h"
+#include "zero_keyring.h"
+
+using namespace Aws::Cryptosdk;
+
+static struct aws_cryptosdk_keyring *zero_kr;
+static struct aws_cryptosdk_cmm *cmm;
+
+/* Encrypts message i of a batch, of a length that varies from one to the next */
+static int EncryptMessage(size_t i, std::vector<uint8_t> *plaintext, std::vector<uint8_t> *ciphertext) {
+    struct aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_cmm(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 1024));
+
+    plaintext->resize(i * 777);
+    for (size_t j = 0; j < plaintext->size(); j++) (*plaintext)[j] = (uint8_t)(i + j);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, plaintext->size()));
+
+    size_t written, consumed;
+    ciphertext->resize(plaintext->size() + 4096);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+        session, ciphertext->data(), ciphertext->size(), &written, plaintext->data(), plaintext->size(), &consumed));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    ciphertext->resize(written);
+
+    aws_cryptosdk_session_destroy(session);
+    return 0;
+}
+
+int bulkDecryptor_batch_decryptsEachMessage() {
+    const size_t num_messages = 50;
+    std::vector<std::vector<uint8_t>> plaintexts(num_messages), ciphertexts(num_messages);
+    for (size_t i = 0; i < num_messages; i++) {
+        TEST_ASSERT_SUCCESS(EncryptMessage(i, &plaintexts[i], &ciphertexts[i]));
+    }
+    // A truncated message and a corrupted one fail on their own
+    ciphertexts[7].resize(ciphertexts[7].size() - 1);
+    ciphertexts[11].back() ^= 1;
+
+    BulkDecryptor decryptor(cmm, 8, 2, 0);
+    int sessions_set_up = 0;
+    decryptor.SetSessionSetup([&](struct aws_cryptosdk_session *session) {
+        sessions_set_up++;
+        return aws_cryptosdk_session_set_max_encrypted_data_keys(session, 1);
+    });
+
+    for (int batch = 0; batch < 2; batch++) {
+        size_t next = 0;
+        std::mutex mutex;
+        std::vector<int> delivered(num_messages, 0);
+        BulkDecryptor::Source source = [&](std::vector<uint8_t> *ciphertext) {
+            if (next == num_messages) return false;
+            *ciphertext = ciphertexts[next++];
+            return true;
+        };
+        BulkDecryptor::Sink sink = [&](uint64_t job, int error_code, std::vector<uint8_t> *plaintext) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (job >= num_messages || delivered[job]++) return aws_raise_error(AWS_ERROR_INVALID_INDEX);
+            if (job == 7 || job == 11) {
+                if (error_code != AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT || !plaintext->empty()) {
+                    return aws_raise_error(AWS_ERROR_UNKNOWN);
+                }
+            } else if (error_code != AWS_ERROR_SUCCESS || *plaintext != plaintexts[job]) {
+                return aws_raise_error(AWS_ERROR_UNKNOWN);
+            }
+            return AWS_OP_SUCCESS;
+        };
+
+        TEST_ASSERT_SUCCESS(decryptor.Decrypt(source, sink));
+        for (size_t i = 0; i < num_messages; i++) TEST_ASSERT_INT_EQ(1, delivered[i]);
+    }
+    // Sessions are kept from one batch to the next, and no more are made than can be in flight
+    TEST_ASSERT(sessions_set_up > 0 && sessions_set_up <= 10);
+
+    return 0;
+}
+
+int bulkDecryptor_emptyBatch_succeeds() {
+    BulkDecryptor decryptor(cmm, 1, 1, 1);
+    TEST_ASSERT_SUCCESS(decryptor.Decrypt(
+        [](std::vector<uint8_t> *) { return false; },
+        [](uint64_t, int, std::vector<uint8_t> *) { return aws_raise_error(AWS_ERROR_UNKNOWN); }));
+    return 0;
+}
+
+int bulkDecryptor_sinkError_stopsBatch() {
+    std::vector<uint8_t> plaintext, ciphertext;
+    TEST_ASSERT_SUCCESS(EncryptMessage(3, &plaintext, &ciphertext));
+
+    size_t given  = 0;
+    int delivered = 0;
+    BulkDecryptor decryptor(cmm, 4, 2, 8);
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_OOM,
+        decryptor.Decrypt(
+            [&](std::vector<uint8_t> *data) {
+                // An endless source, which only the sink's error stops
+                *data = ciphertext;
+                given++;
+                return true;
+            },
+            [&](uint64_t, int, std::vector<uint8_t> *) {
+                if (++delivered == 5) return aws_raise_error(AWS_ERROR_OOM);
+                return AWS_OP_SUCCESS;
+            }));
+    TEST_ASSERT_INT_EQ(5, delivered);
+    TEST_ASSERT(given >= 5);
+
+    return 0;
+}
+
+int bulkDecryptor_setupError_stopsBatch() {
+    BulkDecryptor decryptor(cmm, 1, 1, 1);
+    decryptor.SetSessionSetup(
+        [](struct aws_cryptosdk_session *) { return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION); });
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_UNSUPPORTED_OPERATION,
+        decryptor.Decrypt(
+            [](std::vector<uint8_t> *) { return true; },
+            [](uint64_t, int, std::vector<uint8_t> *) { return AWS_OP_SUCCESS; }));
+    return 0;
+}
+
+int main() {
+    aws_cryptosdk_load_error_strings();
+    zero_kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    cmm     = aws_cryptosdk_default_cmm_new(aws_default_allocator(), zero_kr);
+
+    RUN_TEST(bulkDecryptor_batch_decryptsEachMessage());
+    RUN_TEST(bulkDecryptor_emptyBatch_succeeds());
+    RUN_TEST(bulkDecryptor_sinkError_stopsBatch());
+    RUN_TEST(bulkDecryptor_setupError_stopsBatch());
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(zero_kr);
+}
@@ -76,6 +76,37 @@ int awsByteBufDupFromAwsUtils_validInputs_returnNewAwsByteBuf() {
     return 0;
 }
 
+int awsByteBufAdoptFromAwsUtils_validInputs_takesBufferWithoutCopying() {
+    struct aws_allocator *allocator = aws_default_allocator();
+    Aws::Utils::ByteBuffer src((uint8_t *)TEST_STRING, strlen(TEST_STRING));
+    const uint8_t *src_data = src.GetUnderlyingData();
+    struct aws_byte_buf dest;
+    struct aws_byte_buf dest_expected = aws_byte_buf_from_c_str(TEST_STRING);
+
+    TEST_ASSERT_SUCCESS(aws_byte_buf_adopt_from_aws_utils(allocator, &dest, std::move(src)));
+    TEST_ASSERT_ADDR_EQ(src_data, dest.buffer);
+    TEST_ASSERT(aws_byte_buf_eq(&dest, &dest_expected) == true);
+    TEST_ASSERT_INT_EQ(0, src.GetLength());
+    aws_byte_buf_clean_up_secure(&dest);
+    TEST_ASSERT_ADDR_NULL(dest.allocator);
+
+    // An empty buffer has nothing to hand over
+    Aws::Utils::ByteBuffer empty;
+    TEST_ASSERT_SUCCESS(aws_byte_buf_adopt_from_aws_utils(allocator, &dest, std::move(empty)));
+    TEST_ASSERT_ADDR_NULL(dest.buffer);
+    TEST_ASSERT_ADDR_NULL(dest.allocator);
+    return 0;
+}
+
+int awsByteBufAdoptFromAwsUtils_allocatorThatDoesNotAllocateMemory_leavesSourceUnchanged() {
+    Aws::Utils::ByteBuffer src((uint8_t *)TEST_STRING, strlen(TEST_STRING));
+    struct aws_byte_buf dest;
+
+    TEST_ASSERT_ERROR(AWS_ERROR_OOM, aws_byte_buf_adopt_from_aws_utils(t_aws_bad_allocator(), &dest, std::move(src)));
+    TEST_ASSERT(Aws::String((const char *)src.GetUnderlyingData(), src.GetLength()) == TEST_STRING);
+    return 0;
+}
+
 int awsMapFromCAwsHashHable_hashMap_returnAwsMap() {
     const char *key1_c_chr   = "key1";
     const char *key2_c_chr   = "key2";
@@ -111,6 +142,38 @@ int awsMapFromCAwsHashHable_hashMap_returnAwsMap() {
     return 0;
 }
 
+int awsMapEqCAwsHashTable_sameAndDifferentContents_returnsMatch() {
+    struct aws_hash_table hash_table;
+    struct aws_allocator *allocator = aws_default_allocator();
+    struct aws_hash_element *p_elem;
+    int was_created;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(allocator, &hash_table));
+    TEST_ASSERT(aws_map_eq_c_aws_hash_table({}, &hash_table));
+    TEST_ASSERT(aws_map_eq_c_aws_hash_table({}, NULL));
+
+    const char *pairs[][2] = { { "b", "value2" }, { "a", "value1" }, { "ab", "value3" } };
+    for (auto &pair : pairs) {
+        const struct aws_string *key   = aws_string_new_from_c_str(allocator, pair[0]);
+        const struct aws_string *value = aws_string_new_from_c_str(allocator, pair[1]);
+        TEST_ASSERT_SUCCESS(aws_hash_table_create(&hash_table, (void *)key, &p_elem, &was_created));
+        p_elem->value = (void *)value;
+    }
+
+    Aws::Map<Aws::String, Aws::String> aws_map = aws_map_from_c_aws_hash_table(&hash_table);
+    TEST_ASSERT(aws_map_eq_c_aws_hash_table(aws_map, &hash_table));
+
+    aws_map["ab"] = "other value";
+    TEST_ASSERT(!aws_map_eq_c_aws_hash_table(aws_map, &hash_table));
+    aws_map.erase("ab");
+    TEST_ASSERT(!aws_map_eq_c_aws_hash_table(aws_map, &hash_table));
+    aws_map["abc"] = "value3";
+    TEST_ASSERT(!aws_map_eq_c_aws_hash_table(aws_map, &hash_table));
+
+    aws_cryptosdk_enc_ctx_clean_up(&hash_table);
+    return 0;
+}
+
 /**
  * Structure that initializes data for the tests
  */
@@ -182,6 +245,48 @@ int appendKeyToEdks_multipleElementsAppended_elementsAreAppended() {
     return 0;
 }
 
+int appendKeyToEdks_adoptedCiphertext_elementIsAppendedWithoutCopy() {
+    EdksTestData ed;
+    Aws::Utils::ByteBuffer enc(ed.enc);
+    const uint8_t *enc_data = enc.GetUnderlyingData();
+    struct aws_byte_buf key_provider = aws_byte_buf_from_c_str(ed.key_provider);
+
+    TEST_ASSERT_SUCCESS(append_key_to_edks(
+        ed.allocator, &ed.edks.encrypted_data_keys, std::move(enc), Aws::String(ed.data_key_id), &key_provider));
+    TEST_ASSERT_SUCCESS(t_assert_edks_with_single_element_contains_expected_values(
+        &ed.edks.encrypted_data_keys, ed.enc_data, ed.data_key_id, ed.key_provider, ed.allocator));
+    TEST_ASSERT_INT_EQ(0, enc.GetLength());
+
+    struct aws_cryptosdk_edk *edk;
+    TEST_ASSERT_INT_EQ(0, aws_array_list_get_at_ptr(&ed.edks.encrypted_data_keys, (void **)&edk, 0));
+    TEST_ASSERT_ADDR_EQ(enc_data, edk->ciphertext.buffer);
+
+    // Adopted and copied EDKs compare alike
+    Edks copied(ed.allocator);
+    TEST_ASSERT_SUCCESS(t_append_c_str_key_to_edks(
+        ed.allocator, &copied.encrypted_data_keys, &ed.enc, ed.data_key_id, ed.key_provider));
+    TEST_ASSERT_SUCCESS(t_assert_edks_equals(&ed.edks.encrypted_data_keys, &copied.encrypted_data_keys));
+    return 0;
+}
+
+int appendKeyToEdks_adoptedCiphertextWithAllocatorThatDoesNotAllocateMemory_returnsOomError() {
+    EdksTestData ed;
+    Aws::Utils::ByteBuffer enc(ed.enc);
+    struct aws_byte_buf key_provider = aws_byte_buf_from_c_str(ed.key_provider);
+
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_OOM,
+        append_key_to_edks(
+            t_aws_bad_allocator(),
+            &ed.edks.encrypted_data_keys,
+            std::move(enc),
+            Aws::String(ed.data_key_id),
+            &key_provider));
+    TEST_ASSERT_INT_EQ(0, aws_array_list_length(&ed.edks.encrypted_data_keys));
+    TEST_ASSERT_INT_EQ(ed.enc.GetLength(), enc.GetLength());
+    return 0;
+}
+
 int parseRegionFromKmsKeyArn_validKeyArn_returnsRegion() {
     Aws::String key_arn1 = "arn:aws:kms:us-west-1:658956600833:key/b3537ef1-d8dc-4780-9f5a-55776cbb2f7f";
     Aws::String key_arn2 = "arn:xxx:kms:us-west-2:658956600833:key/b3537ef1-d8dc-4780-9f5a-55776cbb2f7f";
@@ -230,15 +335,41 @@ int parseRegionFromKmsKeyArn_invalidKeyArn_returnsEmpty() {
     return 0;
 }
 
+int parseKmsKeyArn_validAndInvalidArns_returnsParts() {
+    Aws::String partition, region, account_id;
+
+    TEST_ASSERT(parse_kms_key_arn(
+        "arn:aws-cn:kms:cn-north-1:658956600833:key/b3537ef1-d8dc-4780-9f5a-55776cbb2f7f",
+        partition,
+        region,
+        account_id));
+    TEST_ASSERT(partition == "aws-cn");
+    TEST_ASSERT(region == "cn-north-1");
+    TEST_ASSERT(account_id == "658956600833");
+
+    TEST_ASSERT(!parse_kms_key_arn("arn:aws:kms:us-west-2::key/1", partition, region, account_id));
+    TEST_ASSERT(!parse_kms_key_arn("arn:aws:kms2:us-west-2:658956600833:key/1", partition, region, account_id));
+    TEST_ASSERT(!parse_kms_key_arn("arn:aws:kms:us-west-2:658956600833:", partition, region, account_id));
+    TEST_ASSERT(!parse_kms_key_arn("arn:aws:kms:us-west-2:658956600833", partition, region, account_id));
+    TEST_ASSERT(!parse_kms_key_arn("alias/foobar", partition, region, account_id));
+    return 0;
+}
+
 int main() {
     RUN_TEST(awsStringFromCAwsByteBuf_validInputs_returnAwsString());
+    RUN_TEST(parseKmsKeyArn_validAndInvalidArns_returnsParts());
     RUN_TEST(awsUtilsByteBufferFromCAwsByteBuf_validInputs_returnAwsUtils());
     RUN_TEST(appendKeyToEdks_appendSingleElement_elementIsAppended());
     RUN_TEST(appendKeyToEdks_allocatorThatDoesNotAllocateMemory_returnsOomError());
     RUN_TEST(appendKeyToEdks_multipleElementsAppended_elementsAreAppended());
+    RUN_TEST(appendKeyToEdks_adoptedCiphertext_elementIsAppendedWithoutCopy());
+    RUN_TEST(appendKeyToEdks_adoptedCiphertextWithAllocatorThatDoesNotAllocateMemory_returnsOomError());
     RUN_TEST(awsStringFromCAwsString_validInputs_returnAwsString());
     RUN_TEST(awsMapFromCAwsHashHable_hashMap_returnAwsMap());
+    RUN_TEST(awsMapEqCAwsHashTable_sameAndDifferentContents_returnsMatch());
     RUN_TEST(awsByteBufDupFromAwsUtils_validInputs_returnNewAwsByteBuf());
+    RUN_TEST(awsByteBufAdoptFromAwsUtils_validInputs_takesBufferWithoutCopying());
+    RUN_TEST(awsByteBufAdoptFromAwsUtils_allocatorThatDoesNotAllocateMemory_leavesSourceUnchanged());
     RUN_TEST(parseRegionFromKmsKeyArn_validKeyArn_returnsRegion());
     RUN_TEST(parseRegionFromKmsKeyArn_invalidKeyArn_returnsEmpty());
 }
@@ -16,11 +16,17 @@
 #include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/private/cpputils.h>
 #include <aws/cryptosdk/private/kms_keyring.h>
+#include <aws/kms/KMSErrors.h>
 
 #include "edks_utils.h"
 #include "kms_client_mock.h"
 #include "testutil.h"
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
 using namespace Aws::Cryptosdk;
 using namespace Aws::Cryptosdk::Private;
 using namespace Aws::Cryptosdk::Testing;
@@ -387,6 +393,9 @@ int encrypt_multipleKeysOneFails_returnFail() {
 
     ev.kms_client_mock->ExpectEncryptAccumulator(ev.GetRequest(fake_arns[0], ev.pt_bb), ev.GetResult(fake_arns[0], ct));
     ev.kms_client_mock->ExpectEncryptAccumulator(ev.GetRequest(fake_arns[1], ev.pt_bb), error_return);
+    // the wraps are issued concurrently, so the third key is still called after the second fails
+    ev.kms_client_mock->ExpectEncryptAccumulator(
+        ev.GetRequest(fake_arns[2], ev.pt_bb), ev.GetResult(fake_arns[2], ev.ct_bb));
 
     TEST_ASSERT_ERROR(
         AWS_CRYPTOSDK_ERR_KMS_FAILURE,
@@ -422,6 +431,9 @@ int encrypt_multipleKeysOneFails_initialEdksAreNotAffected() {
         ev.GetRequest(fake_arns[0], ev.pt_bb), ev.GetResult(fake_arns[0], ev.ct_bb));
     // second request will fail
     ev.kms_client_mock->ExpectEncryptAccumulator(ev.GetRequest(fake_arns[1], ev.pt_bb), error_return);
+    // the wraps are issued concurrently, so the third key is still called after the second fails
+    ev.kms_client_mock->ExpectEncryptAccumulator(
+        ev.GetRequest(fake_arns[2], ev.pt_bb), ev.GetResult(fake_arns[2], ev.ct_bb));
 
     TEST_ASSERT_ERROR(
         AWS_CRYPTOSDK_ERR_KMS_FAILURE,
@@ -626,6 +638,79 @@ int generateDataKey_validInputs_returnSuccess() {
     return 0;
 }
 
+/* An executor which holds on to its tasks until the test runs them, or refuses them all */
+class QueuedExecutor : public Aws::Utils::Threading::Executor {
+   public:
+    bool refuse = false;
+    Aws::Vector<std::function<void()>> tasks;
+
+   protected:
+    bool SubmitToThread(std::function<void()> &&task) override {
+        if (refuse) return false;
+        tasks.push_back(std::move(task));
+        return true;
+    }
+};
+
+static void RecordKeyringResult(int error_code, void *user_data) {
+    *static_cast<int *>(user_data) = error_code;
+}
+
+int generateDataKey_withAsyncExecutor_completesOnExecutor() {
+    GenerateDataKeyValues gv;
+    auto executor = Aws::MakeShared<QueuedExecutor>(CLASS_TAG);
+    Aws::Cryptosdk::KmsKeyring::Builder builder;
+    struct aws_cryptosdk_keyring *kms_keyring =
+        builder.WithKmsClient(gv.kms_client_mock).WithAsyncExecutor(executor).Build(gv.key_id);
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    Model::GenerateDataKeyOutcome return_generate(gv.generate_result);
+    gv.kms_client_mock->ExpectGenerateDataKey(gv.GetRequest(), return_generate);
+
+    int result = -1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt_async(
+        kms_keyring,
+        gv.allocator,
+        &gv.unencrypted_data_key,
+        &gv.keyring_trace,
+        &gv.edks,
+        &gv.encryption_context,
+        gv.alg,
+        RecordKeyringResult,
+        &result));
+    // KMS is only called once the executor runs the call
+    TEST_ASSERT_INT_EQ(-1, result);
+    TEST_ASSERT(gv.kms_client_mock->ExpectingOtherCalls());
+    TEST_ASSERT_INT_EQ(1, executor->tasks.size());
+
+    executor->tasks[0]();
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, result);
+    TEST_ASSERT_SUCCESS(t_encrypt_with_single_key_success(gv, true));
+    TEST_ASSERT(aws_byte_buf_eq(&gv.unencrypted_data_key, &gv.pt_aws_byte));
+    TEST_ASSERT(!gv.kms_client_mock->ExpectingOtherCalls());
+
+    // A refused call fails at once, without calling back
+    struct aws_byte_buf data_key = { 0 };
+    executor->refuse            = true;
+    result                      = -1;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE,
+        aws_cryptosdk_keyring_on_encrypt_async(
+            kms_keyring,
+            gv.allocator,
+            &data_key,
+            &gv.keyring_trace,
+            &gv.edks,
+            &gv.encryption_context,
+            gv.alg,
+            RecordKeyringResult,
+            &result));
+    TEST_ASSERT_INT_EQ(-1, result);
+
+    aws_cryptosdk_keyring_release(kms_keyring);
+    return 0;
+}
+
 int generateDataKey_validInputsWithGrantTokensAndEncContext_returnSuccess() {
     Aws::Vector<Aws::String> grant_tokens = { "gt1", "gt2" };
     GenerateDataKeyValues gv(grant_tokens);
@@ -697,6 +782,653 @@ int testBuilder_emptyKey_invalid() {
     return 0;
 }
 
+int testBuilder_localGenerator_generatesInLocalArea() {
+    const char *us_key_id   = "arn:aws:kms:us-fake-1:999999999999:key/1";
+    const char *eu_key_id   = "arn:aws:kms:eu-fake-1:999999999999:key/2";
+    const char *ap_key_id   = "arn:aws:kms:ap-fake-1:999999999999:key/3";
+    const char *eu_2_key_id = "arn:aws:kms:eu-fake-2:999999999999:key/4";
+    struct {
+        const char *local_region;
+        Aws::Vector<Aws::String> expected_key_ids;
+    } cases[] = {
+        // The key in the local region is moved to the front; the others keep their order
+        { "eu-fake-2", { eu_2_key_id, us_key_id, eu_key_id, ap_key_id } },
+        // Failing that, the first key in the same area
+        { "eu-fake-3", { eu_key_id, us_key_id, ap_key_id, eu_2_key_id } },
+        // Failing that, the configured generator
+        { "sa-fake-1", { us_key_id, eu_key_id, ap_key_id, eu_2_key_id } },
+    };
+
+    for (auto &test_case : cases) {
+        KmsKeyring::Builder builder;
+        struct aws_cryptosdk_keyring *kms_keyring = builder.WithLocalRegion(test_case.local_region)
+                                                        .WithLocalGenerator()
+                                                        .Build(us_key_id, { eu_key_id, ap_key_id, eu_2_key_id });
+        TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+        TEST_ASSERT(
+            static_cast<Aws::Cryptosdk::Private::KmsKeyringImpl *>(kms_keyring)->key_ids == test_case.expected_key_ids);
+        aws_cryptosdk_keyring_release(kms_keyring);
+    }
+
+    KmsKeyring::Builder no_region;
+    TEST_ASSERT_ADDR_NULL(no_region.WithLocalGenerator().Build(us_key_id, { eu_key_id }));
+    return 0;
+}
+
+int decrypt_concurrentWithMultipleEdks_returnSuccess() {
+    DecryptValues dv;
+    Aws::Cryptosdk::KmsKeyring::Builder builder;
+    struct aws_cryptosdk_keyring *kms_keyring =
+        builder.WithKmsClient(dv.kms_client_mock).WithDecryptConcurrency(4).Build(dv.key_id);
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    // Both usable EDKs are tried at once; whichever call comes second gets the successful outcome
+    build_multiple_edks(dv);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        kms_keyring,
+        dv.allocator,
+        &dv.unencrypted_data_key,
+        &dv.keyring_trace,
+        &dv.edks.encrypted_data_keys,
+        &dv.encryption_context,
+        dv.alg));
+    TEST_ASSERT_SUCCESS(t_decrypt_success(dv));
+    TEST_ASSERT(!dv.kms_client_mock->ExpectingOtherCalls());
+
+    aws_cryptosdk_keyring_release(kms_keyring);
+    return 0;
+}
+
+int decrypt_localRegionFirst_returnSuccess() {
+    const char *remote_key_id = "arn:aws:kms:us-fake-1:999999999999:key/1";
+    const char *local_key_id  = "arn:aws:kms:eu-fake-1:999999999999:key/2";
+    DecryptValues dv;
+    Aws::Cryptosdk::KmsKeyring::Builder builder;
+    struct aws_cryptosdk_keyring *kms_keyring =
+        builder.WithKmsClient(dv.kms_client_mock).WithLocalRegion("eu-fake-1").Build(remote_key_id, { local_key_id });
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    // The remote EDK comes first in the message, but only the local one should be tried
+    auto remote_ct_bb = t_aws_utils_bb_from_char("remote_ct");
+    TEST_ASSERT_SUCCESS(t_append_c_str_key_to_edks(
+        dv.allocator, &dv.edks.encrypted_data_keys, &remote_ct_bb, remote_key_id, dv.provider_id));
+    TEST_ASSERT_SUCCESS(t_append_c_str_key_to_edks(
+        dv.allocator, &dv.edks.encrypted_data_keys, &dv.ct_bb, local_key_id, dv.provider_id));
+    dv.kms_client_mock->ExpectDecryptAccumulator(
+        dv.GetRequest(dv.ct_bb), Model::DecryptOutcome(MakeDecryptResult(local_key_id, dv.pt)));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        kms_keyring,
+        dv.allocator,
+        &dv.unencrypted_data_key,
+        &dv.keyring_trace,
+        &dv.edks.encrypted_data_keys,
+        &dv.encryption_context,
+        dv.alg));
+    TEST_ASSERT(aws_byte_buf_eq(&dv.unencrypted_data_key, &dv.pt_aws_byte));
+    TEST_ASSERT_SUCCESS(assert_keyring_trace_record(
+        &dv.keyring_trace,
+        0,
+        "aws-kms",
+        local_key_id,
+        AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX));
+    TEST_ASSERT(!dv.kms_client_mock->ExpectingOtherCalls());
+
+    aws_cryptosdk_keyring_release(kms_keyring);
+    return 0;
+}
+
+int decrypt_discoveryFilter_skipsOtherAccounts() {
+    const char *other_key_id   = "arn:aws:kms:us-fake-1:111111111111:key/1";
+    const char *allowed_key_id = "arn:aws:kms:us-fake-1:999999999999:key/2";
+    DecryptValues dv;
+    Aws::Cryptosdk::KmsKeyring::Builder builder;
+    struct aws_cryptosdk_keyring *kms_keyring =
+        builder.WithKmsClient(dv.kms_client_mock).WithDiscoveryFilter("aws", { "999999999999" }).BuildDiscovery();
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    // Only the EDK under the allowed account's key should reach KMS
+    auto other_ct_bb = t_aws_utils_bb_from_char("other_ct");
+    TEST_ASSERT_SUCCESS(t_append_c_str_key_to_edks(
+        dv.allocator, &dv.edks.encrypted_data_keys, &other_ct_bb, other_key_id, dv.provider_id));
+    TEST_ASSERT_SUCCESS(t_append_c_str_key_to_edks(
+        dv.allocator, &dv.edks.encrypted_data_keys, &dv.ct_bb, allowed_key_id, dv.provider_id));
+    dv.kms_client_mock->ExpectDecryptAccumulator(
+        dv.GetRequest(dv.ct_bb), Model::DecryptOutcome(MakeDecryptResult(allowed_key_id, dv.pt)));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        kms_keyring,
+        dv.allocator,
+        &dv.unencrypted_data_key,
+        &dv.keyring_trace,
+        &dv.edks.encrypted_data_keys,
+        &dv.encryption_context,
+        dv.alg));
+    TEST_ASSERT(aws_byte_buf_eq(&dv.unencrypted_data_key, &dv.pt_aws_byte));
+    TEST_ASSERT(!dv.kms_client_mock->ExpectingOtherCalls());
+    aws_cryptosdk_keyring_release(kms_keyring);
+
+    // A filter only applies to discovery keyrings
+    TEST_ASSERT_ADDR_NULL(builder.Build(allowed_key_id));
+    return 0;
+}
+
+struct RecordingMetricsSink : public KmsKeyring::MetricsSink {
+    void OnKmsCall(const KmsKeyring::KmsCallMetrics &metrics) {
+        std::unique_lock<std::mutex> lock(mutex);
+        calls.push_back(metrics);
+    }
+
+    std::mutex mutex;
+    Aws::Vector<KmsKeyring::KmsCallMetrics> calls;
+};
+
+int encrypt_withMetricsSink_reportsCall() {
+    EncryptTestValues ev;
+    auto sink = Aws::MakeShared<RecordingMetricsSink>(CLASS_TAG);
+    Aws::Cryptosdk::KmsKeyring::Builder builder;
+    struct aws_cryptosdk_keyring *kms_keyring =
+        builder.WithKmsClient(ev.kms_client_mock).WithMetricsSink(sink).Build(ev.key_id);
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    ev.kms_client_mock->ExpectEncryptAccumulator(ev.GetRequest(), ev.GetResult());
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+        kms_keyring,
+        ev.allocator,
+        &ev.unencrypted_data_key,
+        &ev.keyring_trace,
+        &ev.edks,
+        &ev.encryption_context,
+        ev.alg));
+    TEST_ASSERT(!ev.kms_client_mock->ExpectingOtherCalls());
+
+    TEST_ASSERT_INT_EQ(sink->calls.size(), 1);
+    const auto &metrics = sink->calls[0];
+    TEST_ASSERT(metrics.operation == KmsKeyring::KmsOperation::ENCRYPT);
+    TEST_ASSERT(metrics.region == parse_region_from_kms_key_arn(ev.key_id));
+    TEST_ASSERT(metrics.key_id == ev.key_id);
+    TEST_ASSERT(metrics.error_class == KmsKeyring::KmsErrorClass::NONE);
+    TEST_ASSERT_INT_EQ(metrics.bytes_sent, ev.pt_bb.GetLength());
+    TEST_ASSERT_INT_EQ(metrics.bytes_received, ev.ct_bb.GetLength());
+
+    aws_cryptosdk_keyring_release(kms_keyring);
+    return 0;
+}
+
+int cachingClientSupplier_prewarm_returnsCachedClient() {
+    auto supplier = Aws::Cryptosdk::KmsKeyring::CachingClientSupplier::Create();
+    std::function<void()> report_success;
+
+    supplier->Prewarm({ "us-fake-1", "eu-fake-1" });
+
+    auto client = supplier->GetClient("us-fake-1", report_success);
+    TEST_ASSERT(client != nullptr);
+    TEST_ASSERT(client == supplier->GetClient("us-fake-1", report_success));
+    TEST_ASSERT(client != supplier->GetClient("eu-fake-1", report_success));
+
+    // Prewarming again keeps the clients already cached
+    supplier->Prewarm({ "us-fake-1" });
+    TEST_ASSERT(client == supplier->GetClient("us-fake-1", report_success));
+    return 0;
+}
+
+int tenantClientCache_sharesClientsPerTenant_evictsLeastRecentlyUsed() {
+    auto cache = Aws::Cryptosdk::KmsKeyring::TenantClientCache::Create(2);
+    auto credentials_a = Aws::MakeShared<Aws::Auth::SimpleAWSCredentialsProvider>(CLASS_TAG, "akid-a", "secret-a");
+    auto credentials_b = Aws::MakeShared<Aws::Auth::SimpleAWSCredentialsProvider>(CLASS_TAG, "akid-b", "secret-b");
+    std::function<void()> report_success;
+
+    auto client_a = cache->ForTenant("tenant-a", credentials_a)->GetClient("us-fake-1", report_success);
+    TEST_ASSERT(client_a != nullptr);
+    // Another supplier for the same tenant shares its client
+    TEST_ASSERT(client_a == cache->ForTenant("tenant-a", credentials_a)->GetClient("us-fake-1", report_success));
+
+    auto client_b = cache->ForTenant("tenant-b", credentials_b)->GetClient("us-fake-1", report_success);
+    TEST_ASSERT(client_b != client_a);
+    TEST_ASSERT_INT_EQ(cache->Size(), 2);
+
+    // Using tenant-a's client makes tenant-b's the least recently used, so it is dropped first
+    cache->ForTenant("tenant-a", credentials_a)->GetClient("us-fake-1", report_success);
+    auto client_a_eu = cache->ForTenant("tenant-a", credentials_a)->GetClient("eu-fake-1", report_success);
+    TEST_ASSERT(client_a_eu != client_a);
+    TEST_ASSERT_INT_EQ(cache->Size(), 2);
+    TEST_ASSERT(client_a == cache->ForTenant("tenant-a", credentials_a)->GetClient("us-fake-1", report_success));
+    TEST_ASSERT(client_b != cache->ForTenant("tenant-b", credentials_b)->GetClient("us-fake-1", report_success));
+    return 0;
+}
+
+class CountingCredentialsProvider : public Aws::Auth::AWSCredentialsProvider {
+   public:
+    CountingCredentialsProvider() : calls(0) {}
+    Aws::Auth::AWSCredentials GetAWSCredentials() {
+        calls++;
+        return Aws::Auth::AWSCredentials("akid", "secret");
+    }
+    std::atomic<int> calls;
+};
+
+int tenantClientCache_refreshInterval_refreshesCachedCredentials() {
+    auto cache = Aws::Cryptosdk::KmsKeyring::TenantClientCache::Create(16, std::chrono::milliseconds(10));
+    auto credentials = Aws::MakeShared<CountingCredentialsProvider>(CLASS_TAG);
+    std::function<void()> report_success;
+
+    cache->ForTenant("tenant", credentials)->GetClient("us-fake-1", report_success);
+    cache->ForTenant("tenant", credentials)->GetClient("eu-fake-1", report_success);
+    for (int i = 0; i < 500 && credentials->calls < 2; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    TEST_ASSERT(credentials->calls >= 2);
+
+    // Once the cache is gone, nothing refreshes the credentials
+    cache.reset();
+    int calls = credentials->calls;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    TEST_ASSERT_INT_EQ(credentials->calls, calls);
+    return 0;
+}
+
+int decryptCoalescer_concurrentIdenticalCalls_makeOneCall() {
+    DecryptCoalescer coalescer;
+    std::atomic<int> calls(0);
+    auto slow_call = [&calls] {
+        calls++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        return Aws::KMS::Model::DecryptOutcome(Aws::KMS::Model::DecryptResult().WithKeyId("key"));
+    };
+
+    bool leader_success = false;
+    std::thread leader([&] { leader_success = coalescer.Decrypt("blob", slow_call).IsSuccess(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto outcome = coalescer.Decrypt("blob", slow_call);
+    leader.join();
+    TEST_ASSERT(leader_success);
+    TEST_ASSERT(outcome.IsSuccess());
+    TEST_ASSERT(outcome.GetResult().GetKeyId() == "key");
+    TEST_ASSERT_INT_EQ(calls.load(), 1);
+
+    // Outcomes are not kept once the call completes
+    TEST_ASSERT(coalescer.Decrypt("blob", slow_call).IsSuccess());
+    TEST_ASSERT_INT_EQ(calls.load(), 2);
+    return 0;
+}
+
+int regionLatencyTracker_percentile_roundsUpToBucket() {
+    RegionLatencyTracker tracker;
+
+    // Too few samples to go on
+    for (int i = 0; i < 19; i++) tracker.Record("us-fake-1", 1.0, true);
+    TEST_ASSERT(tracker.LatencyPercentileMs("us-fake-1", 0.5) < 0);
+    TEST_ASSERT(tracker.LatencyPercentileMs("eu-fake-1", 0.5) < 0);
+
+    // Half the calls take 1ms, in the first bucket, and half 100ms, rounded up to 1.25^21 ms
+    tracker.Record("us-fake-1", 1.0, true);
+    for (int i = 0; i < 20; i++) tracker.Record("us-fake-1", 100.0, true);
+    TEST_ASSERT(tracker.LatencyPercentileMs("us-fake-1", 0.5) == 1.0);
+    TEST_ASSERT(tracker.LatencyPercentileMs("us-fake-1", 0.51) == std::pow(1.25, 21));
+    TEST_ASSERT(tracker.LatencyPercentileMs("us-fake-1", 0.99) == std::pow(1.25, 21));
+    TEST_ASSERT(tracker.LatencyPercentileMs("us-fake-1", 0.99) >= 100.0);
+    return 0;
+}
+
+/* Answers GenerateDataKey with outcome after a delay, counting the calls it gets and completes */
+class DelayedKmsClient : public Aws::KMS::KMSClient {
+   public:
+    DelayedKmsClient(std::chrono::milliseconds delay, const Model::GenerateDataKeyOutcome &outcome)
+        : delay(delay), outcome(outcome), calls(0), completed(0) {}
+
+    Model::GenerateDataKeyOutcome GenerateDataKey(const Model::GenerateDataKeyRequest &) const {
+        calls++;
+        std::this_thread::sleep_for(delay);
+        completed++;
+        return outcome;
+    }
+
+    /* Waits for expected calls to be made and completed, as they may outlive the keyring calls making them */
+    void Drain(int expected) const {
+        while (calls < expected || completed < calls) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    const std::chrono::milliseconds delay;
+    const Model::GenerateDataKeyOutcome outcome;
+    mutable std::atomic<int> calls, completed;
+};
+
+/* Supplies client, which may be null, after a delay, and counts the successes reported for it */
+class CountingClientSupplier : public KmsKeyring::ClientSupplier {
+   public:
+    CountingClientSupplier(
+        const std::shared_ptr<Aws::KMS::KMSClient> &client,
+        std::chrono::milliseconds delay = std::chrono::milliseconds(0))
+        : client(client), delay(delay), requests(0), successes(0) {}
+
+    std::shared_ptr<Aws::KMS::KMSClient> GetClient(const Aws::String &, std::function<void()> &report_success) {
+        requests++;
+        std::this_thread::sleep_for(delay);
+        report_success = [this] { successes++; };
+        return client;
+    }
+
+    const std::shared_ptr<Aws::KMS::KMSClient> client;
+    const std::chrono::milliseconds delay;
+    std::atomic<int> requests, successes;
+};
+
+/* Builds a keyring hedging calls to client after the median latency, which is made out to be 2ms */
+static struct aws_cryptosdk_keyring *BuildHedgedKeyring(
+    const std::shared_ptr<Aws::KMS::KMSClient> &client,
+    const std::shared_ptr<KmsKeyring::ClientSupplier> &hedge_client_supplier,
+    double budget) {
+    KmsKeyring::Builder builder;
+    auto keyring =
+        builder.WithKmsClient(client).WithHedging(0.5, budget, hedge_client_supplier).Build(TestValues::key_id);
+    if (!keyring) return NULL;
+
+    auto region_latencies = static_cast<KmsKeyringImpl *>(keyring)->region_latencies;
+    for (int i = 0; i < 20; i++) region_latencies->Record("us-west-2", 2.0, true);
+    return keyring;
+}
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int generateDataKey_hedging_hedgesSlowCallsWithinBudget() {
+    GenerateDataKeyValues gv;
+    Model::GenerateDataKeyOutcome success(gv.generate_result);
+    auto slow           = Aws::MakeShared<DelayedKmsClient>(CLASS_TAG, std::chrono::milliseconds(300), success);
+    auto fast           = Aws::MakeShared<DelayedKmsClient>(CLASS_TAG, std::chrono::milliseconds(0), success);
+    auto hedge_supplier = Aws::MakeShared<CountingClientSupplier>(CLASS_TAG, fast);
+    struct aws_cryptosdk_keyring *kms_keyring = BuildHedgedKeyring(slow, hedge_supplier, 0.5);
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    // With half a hedge earned per call, every other call is hedged, and answered by the hedge
+    for (int i = 1; i <= 4; i++) {
+        struct aws_byte_buf data_key = { 0 };
+        auto start                   = std::chrono::steady_clock::now();
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+            kms_keyring, gv.allocator, &data_key, &gv.keyring_trace, &gv.edks, &gv.encryption_context, gv.alg));
+        aws_byte_buf_clean_up(&data_key);
+
+        bool hedged = i % 2 == 0;
+        TEST_ASSERT_INT_EQ(fast->calls.load(), i / 2);
+        TEST_ASSERT_INT_EQ(hedge_supplier->successes.load(), i / 2);
+        TEST_ASSERT(hedged ? MillisecondsSince(start) < 200 : MillisecondsSince(start) >= 300);
+    }
+    slow->Drain(4);
+    TEST_ASSERT_INT_EQ(slow->calls.load(), 4);
+
+    aws_cryptosdk_keyring_release(kms_keyring);
+    return 0;
+}
+
+int generateDataKey_hedging_failsWhenNoHedgeClient() {
+    GenerateDataKeyValues gv;
+    Model::GenerateDataKeyOutcome failure;
+    auto failing = Aws::MakeShared<DelayedKmsClient>(CLASS_TAG, std::chrono::milliseconds(20), failure);
+    // The original call fails while the supplier is still deciding that there is no hedge client
+    auto hedge_supplier =
+        Aws::MakeShared<CountingClientSupplier>(CLASS_TAG, nullptr, std::chrono::milliseconds(100));
+    struct aws_cryptosdk_keyring *kms_keyring = BuildHedgedKeyring(failing, hedge_supplier, 1.0);
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_KMS_FAILURE,
+        aws_cryptosdk_keyring_on_encrypt(
+            kms_keyring,
+            gv.allocator,
+            &gv.unencrypted_data_key,
+            &gv.keyring_trace,
+            &gv.edks,
+            &gv.encryption_context,
+            gv.alg));
+    TEST_ASSERT_INT_EQ(hedge_supplier->requests.load(), 1);
+    failing->Drain(1);
+    TEST_ASSERT_INT_EQ(failing->calls.load(), 1);
+
+    aws_cryptosdk_keyring_release(kms_keyring);
+    return 0;
+}
+
+int requestBudget_limitsExtraCallsToRatio() {
+    RequestBudget budget(0.5);
+
+    TEST_ASSERT(!budget.Spend());
+    budget.Credit();
+    TEST_ASSERT(!budget.Spend());
+    budget.Credit();
+    TEST_ASSERT(budget.Spend());
+    TEST_ASSERT(!budget.Spend());
+
+    // Only so much can be saved up during a quiet spell
+    for (int i = 0; i < 100; i++) budget.Credit();
+    for (int i = 0; i < 10; i++) TEST_ASSERT(budget.Spend());
+    TEST_ASSERT(!budget.Spend());
+    return 0;
+}
+
+int kmsRateLimiter_queuesUpToMaxWait() {
+    KmsRateLimiter limiter(10, 2, std::chrono::milliseconds(150));
+
+    // The burst goes through at once, after which a call may wait for the next token, 100ms away
+    TEST_ASSERT(limiter.Acquire("us-fake-1", false));
+    TEST_ASSERT(limiter.Acquire("us-fake-1", false));
+    TEST_ASSERT(!limiter.Acquire("us-fake-1", false));
+    auto start = std::chrono::steady_clock::now();
+    TEST_ASSERT(limiter.Acquire("us-fake-1", true));
+    TEST_ASSERT(MillisecondsSince(start) >= 80);
+
+    // Each region has a bucket of its own
+    TEST_ASSERT(limiter.Acquire("eu-fake-1", false));
+
+    // A caller queued behind one already waiting would wait longer than max_wait, so it is refused
+    TEST_ASSERT(limiter.Acquire("eu-fake-1", false));
+    bool waited = false;
+    std::thread waiter([&] { waited = limiter.Acquire("eu-fake-1", true); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    TEST_ASSERT(!limiter.Acquire("eu-fake-1", true));
+    waiter.join();
+    TEST_ASSERT(waited);
+    return 0;
+}
+
+int generateDataKey_retryBudget_retriesThrottlingWithinBudget() {
+    GenerateDataKeyValues gv;
+    Model::GenerateDataKeyOutcome throttled(
+        Aws::Client::AWSError<Aws::KMS::KMSErrors>(Aws::KMS::KMSErrors::THROTTLING, "ThrottlingException", "", true));
+    auto kms_client = Aws::MakeShared<DelayedKmsClient>(CLASS_TAG, std::chrono::milliseconds(0), throttled);
+    KmsKeyring::Builder builder;
+    struct aws_cryptosdk_keyring *kms_keyring = builder.WithKmsClient(kms_client).WithRetryBudget(0.5).Build(gv.key_id);
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    // The first call earns half a retry, so is not retried; the second earns the other half
+    for (int expected_calls : { 1, 3 }) {
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_KMS_FAILURE,
+            aws_cryptosdk_keyring_on_encrypt(
+                kms_keyring,
+                gv.allocator,
+                &gv.unencrypted_data_key,
+                &gv.keyring_trace,
+                &gv.edks,
+                &gv.encryption_context,
+                gv.alg));
+        TEST_ASSERT_INT_EQ(kms_client->calls.load(), expected_calls);
+    }
+
+    aws_cryptosdk_keyring_release(kms_keyring);
+    return 0;
+}
+
+int generateDataKey_rateLimit_refusesCallsOverLimit() {
+    GenerateDataKeyValues gv;
+    Model::GenerateDataKeyOutcome success(gv.generate_result);
+    auto kms_client = Aws::MakeShared<DelayedKmsClient>(CLASS_TAG, std::chrono::milliseconds(0), success);
+    KmsKeyring::Builder builder;
+    struct aws_cryptosdk_keyring *kms_keyring =
+        builder.WithKmsClient(kms_client).WithRateLimit(1, 1, std::chrono::milliseconds(0)).Build(gv.key_id);
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    struct aws_byte_buf data_key = { 0 };
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+        kms_keyring, gv.allocator, &data_key, &gv.keyring_trace, &gv.edks, &gv.encryption_context, gv.alg));
+    aws_byte_buf_clean_up(&data_key);
+
+    // The next token is a second away, longer than the call may wait, so KMS is not called at all
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_KMS_FAILURE,
+        aws_cryptosdk_keyring_on_encrypt(
+            kms_keyring, gv.allocator, &data_key, &gv.keyring_trace, &gv.edks, &gv.encryption_context, gv.alg));
+    TEST_ASSERT_INT_EQ(kms_client->calls.load(), 1);
+
+    aws_cryptosdk_keyring_release(kms_keyring);
+    return 0;
+}
+
+/* Returns a GenerateDataKey outcome whose data key is the 16 characters of plaintext */
+static Model::GenerateDataKeyOutcome MakeGenerateDataKeyOutcome(const char *plaintext) {
+    Model::GenerateDataKeyResult result;
+    result.SetPlaintext(t_aws_utils_bb_from_char(plaintext));
+    result.SetCiphertextBlob(t_aws_utils_bb_from_char("expected_ct"));
+    result.SetKeyId(TestValues::key_id);
+    return Model::GenerateDataKeyOutcome(result);
+}
+
+/* Expects a GenerateDataKey call under gv's encryption context, answered with plaintext as the data key */
+static void ExpectDataKey(GenerateDataKeyValues &gv, const char *plaintext) {
+    gv.kms_client_mock->ExpectGenerateDataKey(gv.GetRequest(), MakeGenerateDataKeyOutcome(plaintext));
+}
+
+/* Replaces gv's encryption context with a single entry */
+static void SetContext(GenerateDataKeyValues &gv, const Aws::String &value) {
+    aws_cryptosdk_enc_ctx_clear(&gv.encryption_context);
+    gv.SetEncryptionContext({ { "context", value } });
+}
+
+/* Generates a data key with kms_keyring under gv's encryption context, checking that it is expected */
+static int EncryptExpectingDataKey(
+    GenerateDataKeyValues &gv, struct aws_cryptosdk_keyring *kms_keyring, const char *expected) {
+    struct aws_byte_buf data_key     = { 0 };
+    struct aws_byte_buf expected_key = aws_byte_buf_from_c_str(expected);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+        kms_keyring, gv.allocator, &data_key, &gv.keyring_trace, &gv.edks, &gv.encryption_context, gv.alg));
+    bool matched = aws_byte_buf_eq(&data_key, &expected_key);
+    aws_byte_buf_clean_up(&data_key);
+    TEST_ASSERT(matched);
+    return 0;
+}
+
+static struct aws_cryptosdk_keyring *BuildPrefetchingKeyring(
+    GenerateDataKeyValues &gv, size_t depth, std::chrono::milliseconds ttl) {
+    KmsKeyring::Builder builder;
+    return builder.WithKmsClient(gv.kms_client_mock).WithDataKeyPrefetch(depth, ttl).Build(gv.key_id);
+}
+
+int dataKeyPrefetch_handsOutEachKeyOnce() {
+    GenerateDataKeyValues gv;
+    struct aws_cryptosdk_keyring *kms_keyring = BuildPrefetchingKeyring(gv, 2, std::chrono::minutes(1));
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    // The first encryption with a context calls KMS, then starts filling its queue
+    ExpectDataKey(gv, "generated key 01");
+    TEST_ASSERT_SUCCESS(EncryptExpectingDataKey(gv, kms_keyring, "generated key 01"));
+    ExpectDataKey(gv, "prefetched key 1");
+    ExpectDataKey(gv, "prefetched key 2");
+    TEST_ASSERT_INT_EQ(gv.kms_client_mock->RunPendingGenerateDataKeys(), 2);
+
+    // Later ones take the queued keys in order, each replacing the one it took
+    TEST_ASSERT_SUCCESS(EncryptExpectingDataKey(gv, kms_keyring, "prefetched key 1"));
+    TEST_ASSERT_SUCCESS(EncryptExpectingDataKey(gv, kms_keyring, "prefetched key 2"));
+    ExpectDataKey(gv, "prefetched key 3");
+    ExpectDataKey(gv, "prefetched key 4");
+    TEST_ASSERT_INT_EQ(gv.kms_client_mock->RunPendingGenerateDataKeys(), 2);
+    TEST_ASSERT_SUCCESS(EncryptExpectingDataKey(gv, kms_keyring, "prefetched key 3"));
+
+    ExpectDataKey(gv, "prefetched key 5");
+    TEST_ASSERT_INT_EQ(gv.kms_client_mock->RunPendingGenerateDataKeys(), 1);
+    TEST_ASSERT(!gv.kms_client_mock->ExpectingOtherCalls());
+
+    aws_cryptosdk_keyring_release(kms_keyring);
+    return 0;
+}
+
+int dataKeyPrefetch_discardsKeysPastTtl() {
+    GenerateDataKeyValues gv;
+    struct aws_cryptosdk_keyring *kms_keyring = BuildPrefetchingKeyring(gv, 1, std::chrono::milliseconds(50));
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    ExpectDataKey(gv, "generated key 01");
+    TEST_ASSERT_SUCCESS(EncryptExpectingDataKey(gv, kms_keyring, "generated key 01"));
+    ExpectDataKey(gv, "prefetched key 1");
+    TEST_ASSERT_INT_EQ(gv.kms_client_mock->RunPendingGenerateDataKeys(), 1);
+
+    // The queued key has expired, so KMS is called again
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ExpectDataKey(gv, "generated key 02");
+    TEST_ASSERT_SUCCESS(EncryptExpectingDataKey(gv, kms_keyring, "generated key 02"));
+
+    // A key fetched since is still fresh
+    ExpectDataKey(gv, "prefetched key 2");
+    TEST_ASSERT_INT_EQ(gv.kms_client_mock->RunPendingGenerateDataKeys(), 1);
+    TEST_ASSERT_SUCCESS(EncryptExpectingDataKey(gv, kms_keyring, "prefetched key 2"));
+
+    ExpectDataKey(gv, "prefetched key 3");
+    TEST_ASSERT_INT_EQ(gv.kms_client_mock->RunPendingGenerateDataKeys(), 1);
+    TEST_ASSERT(!gv.kms_client_mock->ExpectingOtherCalls());
+
+    aws_cryptosdk_keyring_release(kms_keyring);
+    return 0;
+}
+
+int dataKeyPrefetch_evictsLeastRecentlyUsedContext() {
+    GenerateDataKeyValues gv;
+    struct aws_cryptosdk_keyring *kms_keyring = BuildPrefetchingKeyring(gv, 1, std::chrono::minutes(1));
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    // Queues are kept for 8 contexts, so the ninth displaces the first
+    for (int i = 0; i < 9; i++) {
+        char generated[] = "generated key 0?", prefetched[] = "prefetched key ?";
+        generated[15] = prefetched[15] = (char)('0' + i);
+
+        SetContext(gv, Aws::String(1, (char)('0' + i)));
+        ExpectDataKey(gv, generated);
+        TEST_ASSERT_SUCCESS(EncryptExpectingDataKey(gv, kms_keyring, generated));
+        ExpectDataKey(gv, prefetched);
+        TEST_ASSERT_INT_EQ(gv.kms_client_mock->RunPendingGenerateDataKeys(), 1);
+    }
+
+    SetContext(gv, "1");
+    TEST_ASSERT_SUCCESS(EncryptExpectingDataKey(gv, kms_keyring, "prefetched key 1"));
+    ExpectDataKey(gv, "prefetched key 9");
+    TEST_ASSERT_INT_EQ(gv.kms_client_mock->RunPendingGenerateDataKeys(), 1);
+
+    SetContext(gv, "0");
+    ExpectDataKey(gv, "generated key 99");
+    TEST_ASSERT_SUCCESS(EncryptExpectingDataKey(gv, kms_keyring, "generated key 99"));
+    ExpectDataKey(gv, "prefetched key 0");
+    TEST_ASSERT_INT_EQ(gv.kms_client_mock->RunPendingGenerateDataKeys(), 1);
+    TEST_ASSERT(!gv.kms_client_mock->ExpectingOtherCalls());
+
+    aws_cryptosdk_keyring_release(kms_keyring);
+    return 0;
+}
+
+int dataKeyPrefetch_completesAfterKeyringDestroyed() {
+    GenerateDataKeyValues gv;
+    struct aws_cryptosdk_keyring *kms_keyring = BuildPrefetchingKeyring(gv, 1, std::chrono::minutes(1));
+    TEST_ASSERT_ADDR_NOT_NULL(kms_keyring);
+
+    ExpectDataKey(gv, "generated key 01");
+    TEST_ASSERT_SUCCESS(EncryptExpectingDataKey(gv, kms_keyring, "generated key 01"));
+    aws_cryptosdk_keyring_release(kms_keyring);
+
+    // The prefetch still in flight completes into a queue nothing can take from any more
+    ExpectDataKey(gv, "prefetched key 1");
+    TEST_ASSERT_INT_EQ(gv.kms_client_mock->RunPendingGenerateDataKeys(), 1);
+    TEST_ASSERT(!gv.kms_client_mock->ExpectingOtherCalls());
+    return 0;
+}
+
 int t_assert_encrypt_with_default_values(aws_cryptosdk_keyring *kms_keyring, EncryptTestValues &ev) {
     TEST_ASSERT(kms_keyring != NULL);
     TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
@@ -729,12 +1461,33 @@ int main() {
     RUN_TEST(decrypt_noKeys_returnSuccess());
     RUN_TEST(decrypt_validInputsWithMultipleEdks_returnSuccess());
     RUN_TEST(decrypt_validInputsWithMultipleEdksWithGrantTokensAndEncContext_returnSuccess());
+    RUN_TEST(decrypt_concurrentWithMultipleEdks_returnSuccess());
+    RUN_TEST(decrypt_localRegionFirst_returnSuccess());
+    RUN_TEST(decrypt_discoveryFilter_skipsOtherAccounts());
+    RUN_TEST(encrypt_withMetricsSink_reportsCall());
     RUN_TEST(generateDataKey_validInputs_returnSuccess());
     RUN_TEST(generateDataKey_validInputsWithGrantTokensAndEncContext_returnSuccess());
     RUN_TEST(generateDataKey_kmsFails_returnFailure());
+    RUN_TEST(generateDataKey_withAsyncExecutor_completesOnExecutor());
     RUN_TEST(testBuilder_keyWithRegion_valid());
     RUN_TEST(testBuilder_keyWithoutRegion_invalid());
     RUN_TEST(testBuilder_emptyKey_invalid());
+    RUN_TEST(testBuilder_localGenerator_generatesInLocalArea());
+    RUN_TEST(cachingClientSupplier_prewarm_returnsCachedClient());
+    RUN_TEST(tenantClientCache_sharesClientsPerTenant_evictsLeastRecentlyUsed());
+    RUN_TEST(tenantClientCache_refreshInterval_refreshesCachedCredentials());
+    RUN_TEST(decryptCoalescer_concurrentIdenticalCalls_makeOneCall());
+    RUN_TEST(regionLatencyTracker_percentile_roundsUpToBucket());
+    RUN_TEST(generateDataKey_hedging_hedgesSlowCallsWithinBudget());
+    RUN_TEST(generateDataKey_hedging_failsWhenNoHedgeClient());
+    RUN_TEST(requestBudget_limitsExtraCallsToRatio());
+    RUN_TEST(kmsRateLimiter_queuesUpToMaxWait());
+    RUN_TEST(generateDataKey_retryBudget_retriesThrottlingWithinBudget());
+    RUN_TEST(generateDataKey_rateLimit_refusesCallsOverLimit());
+    RUN_TEST(dataKeyPrefetch_handsOutEachKeyOnce());
+    RUN_TEST(dataKeyPrefetch_discardsKeysPastTtl());
+    RUN_TEST(dataKeyPrefetch_evictsLeastRecentlyUsedContext());
+    RUN_TEST(dataKeyPrefetch_completesAfterKeyringDestroyed());
 
     Aws::ShutdownAPI(*options);
     Aws::Delete(options);
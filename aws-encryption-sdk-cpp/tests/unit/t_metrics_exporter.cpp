@@ -0,0 +1,232 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/cpp/metrics_exporter.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "testing.h"
+#include "testutil.h"
+#include "zero_keyring.h"
+
+using namespace Aws::Cryptosdk;
+
+static struct aws_cryptosdk_keyring *zero_kr;
+
+/* Finds the point of the named metric with the given attributes, or returns NULL */
+static const MetricPoint *FindPoint(
+    const std::vector<MetricPoint> &points,
+    const char *name,
+    const std::vector<std::pair<std::string, std::string>> &attributes) {
+    for (const MetricPoint &point : points) {
+        if (point.name == std::string("aws.encryption_sdk.") + name && point.attributes == attributes) return &point;
+    }
+    return nullptr;
+}
+
+/* Encrypts then decrypts a message through cmm, recording both in collector */
+static int RoundTrip(MetricsCollector *collector, struct aws_cryptosdk_cmm *cmm, size_t size) {
+    std::vector<uint8_t> plaintext(size, 0x42), ciphertext(size + 4096), decrypted(size);
+    size_t ct_len, pt_len, consumed;
+
+    struct aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_cmm(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, size));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+        session, ciphertext.data(), ciphertext.size(), &ct_len, plaintext.data(), size, &consumed));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    collector->RecordMessage(AWS_CRYPTOSDK_ENCRYPT, session, true);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+        session, decrypted.data(), decrypted.size(), &pt_len, ciphertext.data(), ct_len, &consumed));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT(decrypted == plaintext);
+    collector->RecordMessage(AWS_CRYPTOSDK_DECRYPT, session, true);
+
+    aws_cryptosdk_session_destroy(session);
+    return 0;
+}
+
+int metricsCollector_messages_sumAcrossThreads() {
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(aws_default_allocator(), zero_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+
+    MetricsCollector collector;
+    std::vector<std::thread> threads;
+    std::vector<int> results(8);
+    for (size_t i = 0; i < results.size(); i++) {
+        threads.emplace_back([&, i] {
+            for (int j = 0; j < 10 && !results[i]; j++) results[i] = RoundTrip(&collector, cmm, 1000);
+        });
+    }
+    for (auto &thread : threads) thread.join();
+    for (int result : results) TEST_ASSERT_INT_EQ(0, result);
+
+    std::vector<MetricPoint> points = collector.Collect();
+    const MetricPoint *point = FindPoint(points, "session.messages", { { "mode", "encrypt" }, { "outcome", "ok" } });
+    TEST_ASSERT_ADDR_NOT_NULL(point);
+    TEST_ASSERT(point->kind == MetricKind::COUNTER);
+    TEST_ASSERT_INT_EQ(80, point->value);
+
+    point = FindPoint(points, "session.messages", { { "mode", "decrypt" }, { "outcome", "error" } });
+    TEST_ASSERT_ADDR_NOT_NULL(point);
+    TEST_ASSERT_INT_EQ(0, point->value);
+
+    point = FindPoint(points, "session.bytes", { { "mode", "decrypt" }, { "direction", "out" } });
+    TEST_ASSERT_ADDR_NOT_NULL(point);
+    TEST_ASSERT_INT_EQ(80 * 1000, point->value);
+
+    // Every message spends some time in its body, so each lands in a bucket of the histogram
+    point = FindPoint(points, "session.stage.duration", { { "mode", "encrypt" }, { "stage", "gcm" } });
+    TEST_ASSERT_ADDR_NOT_NULL(point);
+    TEST_ASSERT(point->kind == MetricKind::HISTOGRAM);
+    TEST_ASSERT_INT_EQ(point->bounds.size() + 1, point->bucket_counts.size());
+    uint64_t in_buckets = 0;
+    for (uint64_t count : point->bucket_counts) in_buckets += count;
+    TEST_ASSERT_INT_EQ(point->count, in_buckets);
+    TEST_ASSERT(point->count > 0 && point->count <= 80);
+
+    aws_cryptosdk_cmm_release(cmm);
+    return 0;
+}
+
+int metricsCollector_kmsSink_countsByOutcome() {
+    std::shared_ptr<KmsKeyring::MetricsSink> sink;
+    {
+        MetricsCollector collector;
+        sink = collector.GetKmsMetricsSink();
+
+        KmsKeyring::KmsCallMetrics metrics;
+        metrics.operation      = KmsKeyring::KmsOperation::DECRYPT;
+        metrics.latency        = std::chrono::microseconds(30);
+        metrics.error_class    = KmsKeyring::KmsErrorClass::NONE;
+        metrics.bytes_sent     = 0;
+        metrics.bytes_received = 0;
+        sink->OnKmsCall(metrics);
+        sink->OnKmsCall(metrics);
+        metrics.latency     = std::chrono::microseconds(20000000);
+        metrics.error_class = KmsKeyring::KmsErrorClass::THROTTLED;
+        sink->OnKmsCall(metrics);
+
+        std::vector<MetricPoint> points = collector.Collect();
+        const MetricPoint *point = FindPoint(points, "kms.calls", { { "operation", "decrypt" }, { "outcome", "ok" } });
+        TEST_ASSERT_ADDR_NOT_NULL(point);
+        TEST_ASSERT_INT_EQ(2, point->value);
+        point = FindPoint(points, "kms.calls", { { "operation", "decrypt" }, { "outcome", "throttled" } });
+        TEST_ASSERT_ADDR_NOT_NULL(point);
+        TEST_ASSERT_INT_EQ(1, point->value);
+
+        point = FindPoint(points, "kms.call.duration", { { "operation", "decrypt" } });
+        TEST_ASSERT_ADDR_NOT_NULL(point);
+        TEST_ASSERT_INT_EQ(3, point->count);
+        TEST_ASSERT_INT_EQ(20000060, point->sum);
+        // 30us falls in the (25, 50] bucket, and 20s above the last bound
+        TEST_ASSERT_INT_EQ(2, point->bucket_counts[2]);
+        TEST_ASSERT_INT_EQ(1, point->bucket_counts.back());
+    }
+
+    // Calls reported once the collector is gone are dropped
+    KmsKeyring::KmsCallMetrics metrics = {};
+    sink->OnKmsCall(metrics);
+    return 0;
+}
+
+int metricsCollector_cache_exportsItsCounters() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    struct aws_cryptosdk_cmm *cmm =
+        aws_cryptosdk_caching_cmm_new_from_keyring(alloc, cache, zero_kr, NULL, 60, AWS_TIMESTAMP_SECS);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+
+    MetricsCollector collector;
+    TEST_ASSERT_SUCCESS(collector.AddCache("local", cache));
+    aws_cryptosdk_materials_cache_release(cache);
+    for (int i = 0; i < 5; i++) TEST_ASSERT_SUCCESS(RoundTrip(&collector, cmm, 100));
+
+    std::vector<MetricPoint> points = collector.Collect();
+    const MetricPoint *hits = FindPoint(points, "cache.lookups", { { "cache", "local" }, { "result", "encrypt_hit" } });
+    const MetricPoint *misses = FindPoint(points, "cache.lookups", { { "cache", "local" }, { "result", "miss" } });
+    TEST_ASSERT_ADDR_NOT_NULL(hits);
+    TEST_ASSERT_ADDR_NOT_NULL(misses);
+    // The first encryption misses, and later ones reuse its materials
+    TEST_ASSERT(hits->value >= 1 && misses->value >= 1);
+
+    const MetricPoint *entries = FindPoint(points, "cache.entries", { { "cache", "local" } });
+    TEST_ASSERT_ADDR_NOT_NULL(entries);
+    TEST_ASSERT(entries->kind == MetricKind::GAUGE);
+    TEST_ASSERT(entries->value >= 1);
+
+    aws_cryptosdk_cmm_release(cmm);
+    return 0;
+}
+
+class RecordingExporter : public MetricsExporter {
+   public:
+    void Export(const std::vector<MetricPoint> &points) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        batches.push_back(points);
+    }
+
+    std::mutex mutex;
+    std::vector<std::vector<MetricPoint>> batches;
+};
+
+int metricsCollector_stop_exportsFinalPoints() {
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(aws_default_allocator(), zero_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    auto exporter = std::make_shared<RecordingExporter>();
+
+    MetricsCollector collector;
+    collector.Start(exporter, std::chrono::milliseconds(5));
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    TEST_ASSERT_SUCCESS(RoundTrip(&collector, cmm, 10));
+    collector.Stop();
+
+    size_t batches;
+    {
+        std::lock_guard<std::mutex> lock(exporter->mutex);
+        batches = exporter->batches.size();
+        TEST_ASSERT(batches >= 2);
+        const MetricPoint *point = FindPoint(
+            exporter->batches.back(), "session.messages", { { "mode", "encrypt" }, { "outcome", "ok" } });
+        TEST_ASSERT_ADDR_NOT_NULL(point);
+        TEST_ASSERT_INT_EQ(1, point->value);
+    }
+
+    // Once stopped, nothing more is exported
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    TEST_ASSERT_INT_EQ(batches, exporter->batches.size());
+
+    aws_cryptosdk_cmm_release(cmm);
+    return 0;
+}
+
+int main() {
+    aws_cryptosdk_load_error_strings();
+    zero_kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+
+    RUN_TEST(metricsCollector_messages_sumAcrossThreads());
+    RUN_TEST(metricsCollector_kmsSink_countsByOutcome());
+    RUN_TEST(metricsCollector_cache_exportsItsCounters());
+    RUN_TEST(metricsCollector_stop_exportsFinalPoints());
+
+    aws_cryptosdk_keyring_release(zero_kr);
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/cpp/multipart_encryptor.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "testing.h"
+#include "testutil.h"
+#include "zero_keyring.h"
+
+using namespace Aws::Cryptosdk;
+
+static struct aws_cryptosdk_keyring *zero_kr;
+
+static struct aws_cryptosdk_session *NewEncryptSession(enum aws_cryptosdk_alg_id alg_id) {
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(aws_default_allocator(), zero_kr);
+    if (!cmm) return nullptr;
+
+    struct aws_cryptosdk_session *session = nullptr;
+    if (!aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id)) {
+        session = aws_cryptosdk_session_new_from_cmm(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, cmm);
+    }
+    aws_cryptosdk_cmm_release(cmm);
+    return session;
+}
+
+/* Encrypts a message of len bytes in parts, checking that the joined parts decrypt to it */
+static int RoundTrip(size_t len, size_t part_size, unsigned num_threads, size_t expected_parts) {
+    struct aws_cryptosdk_session *enc_session = NewEncryptSession(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256);
+    struct aws_cryptosdk_session *dec_session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, zero_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(enc_session);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(enc_session, 4096));
+
+    std::vector<uint8_t> plaintext(len);
+    for (size_t i = 0; i < len; i++) plaintext[i] = (uint8_t)(i * 31 + 7);
+
+    std::mutex mutex;
+    std::map<int, std::vector<uint8_t>> parts;
+    MultipartEncryptor::PartSink sink = [&](int part_number, const uint8_t *data, size_t data_len) {
+        std::lock_guard<std::mutex> lock(mutex);
+        parts[part_number].assign(data, data + data_len);
+        return AWS_OP_SUCCESS;
+    };
+    MultipartEncryptor encryptor(enc_session, part_size, num_threads);
+    TEST_ASSERT_SUCCESS(encryptor.Encrypt(plaintext.data(), plaintext.size(), sink));
+
+    // Parts are numbered from one, and the middle ones fit in part_size, or hold a single frame
+    TEST_ASSERT_INT_EQ(parts.size(), expected_parts);
+    std::vector<uint8_t> ciphertext;
+    int part_number = 1;
+    for (auto &part : parts) {
+        TEST_ASSERT_INT_EQ(part.first, part_number++);
+        if (part.first > 1 && part.first < (int)expected_parts) {
+            TEST_ASSERT(part.second.size() <= std::max<size_t>(part_size, 4128));
+        }
+        ciphertext.insert(ciphertext.end(), part.second.begin(), part.second.end());
+    }
+
+    uint64_t message_size;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_total_output_size(enc_session, &message_size));
+    TEST_ASSERT_INT_EQ(message_size, ciphertext.size());
+
+    std::vector<uint8_t> decrypted(len);
+    size_t out_len, in_read;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+        dec_session, decrypted.data(), decrypted.size(), &out_len, ciphertext.data(), ciphertext.size(), &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(dec_session));
+    TEST_ASSERT_INT_EQ(out_len, len);
+    TEST_ASSERT(decrypted == plaintext);
+
+    aws_cryptosdk_session_destroy(enc_session);
+    aws_cryptosdk_session_destroy(dec_session);
+    return 0;
+}
+
+int multipartEncryptor_parts_joinToMessage() {
+    // 4128 bytes of ciphertext per frame, so 15 frames to a part
+    if (RoundTrip(1000000, 64 * 1024, 4, 17)) return 1;
+    // A part holds at least one frame, and a message ending on a part still gets its final frame
+    if (RoundTrip(8 * 4096, 1, 3, 8)) return 1;
+    if (RoundTrip(0, 64 * 1024, 0, 1)) return 1;
+    return 0;
+}
+
+int multipartEncryptor_sinkError_stopsEncryption() {
+    struct aws_cryptosdk_session *session = NewEncryptSession(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 4096));
+
+    std::vector<uint8_t> plaintext(1000000);
+    std::mutex mutex;
+    int delivered = 0;
+    MultipartEncryptor encryptor(session, 64 * 1024, 1);
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_OOM, encryptor.Encrypt(plaintext.data(), plaintext.size(), [&](int, const uint8_t *, size_t) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (++delivered == 3) return aws_raise_error(AWS_ERROR_OOM);
+            return AWS_OP_SUCCESS;
+        }));
+    TEST_ASSERT_INT_EQ(delivered, 3);
+
+    aws_cryptosdk_session_destroy(session);
+    return 0;
+}
+
+int multipartEncryptor_signedSuite_fails() {
+    struct aws_cryptosdk_session *session = NewEncryptSession(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+
+    uint8_t plaintext[100] = { 0 };
+    MultipartEncryptor encryptor(session, 64 * 1024, 2);
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_UNSUPPORTED_OPERATION,
+        encryptor.Encrypt(plaintext, sizeof(plaintext), [](int, const uint8_t *, size_t) { return AWS_OP_SUCCESS; }));
+
+    aws_cryptosdk_session_destroy(session);
+    return 0;
+}
+
+int main() {
+    aws_cryptosdk_load_error_strings();
+    zero_kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+
+    RUN_TEST(multipartEncryptor_parts_joinToMessage());
+    RUN_TEST(multipartEncryptor_sinkError_stopsEncryption());
+    RUN_TEST(multipartEncryptor_signedSuite_fails());
+
+    aws_cryptosdk_keyring_release(zero_kr);
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/cpp/ranged_decryptor.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include "testing.h"
+#include "testutil.h"
+#include "zero_keyring.h"
+
+using namespace Aws::Cryptosdk;
+
+static struct aws_cryptosdk_keyring *zero_kr;
+
+/* Encrypts plaintext with the given suite in 4096-byte frames, also collecting its frame index */
+static int EncryptMessage(
+    enum aws_cryptosdk_alg_id alg_id,
+    const std::vector<uint8_t> &plaintext,
+    std::vector<uint8_t> *ciphertext,
+    std::vector<uint8_t> *frame_index) {
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(aws_default_allocator(), zero_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+    struct aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_cmm(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+
+    struct aws_byte_buf index;
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&index, aws_default_allocator(), 1));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_index(session, &index));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 4096));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, plaintext.size()));
+
+    size_t written, consumed;
+    ciphertext->resize(plaintext.size() + 65536);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+        session, ciphertext->data(), ciphertext->size(), &written, plaintext.data(), plaintext.size(), &consumed));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    ciphertext->resize(written);
+    frame_index->assign(index.buffer, index.buffer + index.len);
+
+    aws_byte_buf_clean_up(&index);
+    aws_cryptosdk_session_destroy(session);
+    aws_cryptosdk_cmm_release(cmm);
+    return 0;
+}
+
+/* Decrypts ciphertext in ranges, checking that the plaintext delivered matches */
+static int DecryptRanges(
+    const std::vector<uint8_t> &ciphertext,
+    const std::vector<uint8_t> &plaintext,
+    const std::vector<uint8_t> *frame_index,
+    size_t range_size,
+    unsigned num_threads,
+    bool in_order,
+    int *error_code) {
+    struct aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, zero_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+
+    std::vector<uint8_t> decrypted(plaintext.size());
+    std::atomic<uint64_t> next_offset(0);
+    std::atomic<bool> out_of_order(false);
+
+    RangedDecryptor::RangeFetcher fetch = [&](uint64_t offset, size_t len, std::vector<uint8_t> *data) {
+        if (offset + len > ciphertext.size()) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        data->assign(ciphertext.begin() + offset, ciphertext.begin() + offset + len);
+        return AWS_OP_SUCCESS;
+    };
+    RangedDecryptor::PlaintextSink sink = [&](uint64_t offset, const uint8_t *data, size_t len) {
+        if (offset + len > decrypted.size()) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        if (next_offset.exchange(offset + len) != offset) out_of_order = true;
+        if (len) memcpy(decrypted.data() + offset, data, len);
+        return AWS_OP_SUCCESS;
+    };
+
+    RangedDecryptor decryptor(session, range_size, num_threads, in_order);
+    if (frame_index) decryptor.UseFrameIndex(frame_index->data(), frame_index->size());
+    *error_code = decryptor.Decrypt(ciphertext.size(), fetch, sink) ? aws_last_error() : AWS_ERROR_SUCCESS;
+
+    if (*error_code == AWS_ERROR_SUCCESS) {
+        TEST_ASSERT(decrypted == plaintext);
+        if (in_order) TEST_ASSERT(!out_of_order);
+    }
+
+    aws_cryptosdk_session_destroy(session);
+    return 0;
+}
+
+int rangedDecryptor_ranges_decryptMessage() {
+    std::vector<uint8_t> plaintext(1000000), ciphertext, index;
+    for (size_t i = 0; i < plaintext.size(); i++) plaintext[i] = (uint8_t)(i * 31 + 7);
+    TEST_ASSERT_SUCCESS(EncryptMessage(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, plaintext, &ciphertext, &index));
+
+    int error_code;
+    TEST_ASSERT_SUCCESS(DecryptRanges(ciphertext, plaintext, nullptr, 64 * 1024, 4, false, &error_code));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, error_code);
+    TEST_ASSERT_SUCCESS(DecryptRanges(ciphertext, plaintext, nullptr, 64 * 1024, 4, true, &error_code));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, error_code);
+    // Ranges of a single frame, and a single range for the whole message
+    TEST_ASSERT_SUCCESS(DecryptRanges(ciphertext, plaintext, nullptr, 1, 3, true, &error_code));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, error_code);
+    TEST_ASSERT_SUCCESS(DecryptRanges(ciphertext, plaintext, nullptr, SIZE_MAX / 2, 0, false, &error_code));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, error_code);
+
+    // Empty messages are a header and an empty final frame
+    std::vector<uint8_t> empty;
+    TEST_ASSERT_SUCCESS(EncryptMessage(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, empty, &ciphertext, &index));
+    TEST_ASSERT_SUCCESS(DecryptRanges(ciphertext, empty, nullptr, 64 * 1024, 2, false, &error_code));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, error_code);
+    return 0;
+}
+
+int rangedDecryptor_truncatedMessage_failsWithBadCiphertext() {
+    std::vector<uint8_t> plaintext(100000), ciphertext, index;
+    TEST_ASSERT_SUCCESS(EncryptMessage(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, plaintext, &ciphertext, &index));
+
+    // Cut at the end of a regular frame, so that every range is well formed but the final frame is missing
+    size_t frame_len = 4096 + 32;
+    size_t body      = ciphertext.size() - (plaintext.size() / 4096) * frame_len - (plaintext.size() % 4096 + 40);
+    ciphertext.resize(body + 10 * frame_len);
+
+    int error_code;
+    TEST_ASSERT_SUCCESS(DecryptRanges(ciphertext, plaintext, nullptr, 16 * 1024, 2, true, &error_code));
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, error_code);
+    return 0;
+}
+
+int rangedDecryptor_signedSuite_needsFrameIndex() {
+    std::vector<uint8_t> plaintext(100000), ciphertext, index;
+    for (size_t i = 0; i < plaintext.size(); i++) plaintext[i] = (uint8_t)i;
+    TEST_ASSERT_SUCCESS(
+        EncryptMessage(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, plaintext, &ciphertext, &index));
+
+    int error_code;
+    TEST_ASSERT_SUCCESS(DecryptRanges(ciphertext, plaintext, nullptr, 16 * 1024, 2, false, &error_code));
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_BAD_STATE, error_code);
+    TEST_ASSERT_SUCCESS(DecryptRanges(ciphertext, plaintext, &index, 16 * 1024, 2, false, &error_code));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_SUCCESS, error_code);
+    return 0;
+}
+
+int main() {
+    aws_cryptosdk_load_error_strings();
+    zero_kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+
+    RUN_TEST(rangedDecryptor_ranges_decryptMessage());
+    RUN_TEST(rangedDecryptor_truncatedMessage_failsWithBadCiphertext());
+    RUN_TEST(rangedDecryptor_signedSuite_needsFrameIndex());
+
+    aws_cryptosdk_keyring_release(zero_kr);
+}
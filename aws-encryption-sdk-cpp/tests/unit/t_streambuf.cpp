@@ -0,0 +1,181 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/cpp/streambuf.h>
+#include <aws/cryptosdk/error.h>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+#include "testing.h"
+#include "testutil.h"
+#include "zero_keyring.h"
+
+using namespace Aws::Cryptosdk;
+
+static struct aws_cryptosdk_session *new_session(aws_cryptosdk_mode mode) {
+    struct aws_cryptosdk_keyring *kr      = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), mode, kr);
+    aws_cryptosdk_keyring_release(kr);
+    return session;
+}
+
+static std::string make_plaintext(size_t len) {
+    std::string pt(len, '\0');
+    for (size_t i = 0; i < len; i++) pt[i] = (char)(i * 7 + (i >> 8));
+    return pt;
+}
+
+/* Encrypts pt by writing it in writes of write_size bytes, through a put area of buffer_size */
+static int encrypt_stream(std::string &ct, const std::string &pt, size_t write_size, size_t buffer_size) {
+    struct aws_cryptosdk_session *session = new_session(AWS_CRYPTOSDK_ENCRYPT);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+
+    std::stringbuf sink;
+    {
+        EncryptingStreambuf encryptor(session, &sink, buffer_size);
+        std::ostream out(&encryptor);
+
+        for (size_t i = 0; i < pt.size(); i += write_size) {
+            out.write(pt.data() + i, std::min(write_size, pt.size() - i));
+        }
+        TEST_ASSERT(out.good());
+        TEST_ASSERT_SUCCESS(encryptor.Finish());
+    }
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    aws_cryptosdk_session_destroy(session);
+
+    ct = sink.str();
+    return 0;
+}
+
+/* Decrypts ct through a get area of buffer_size, in reads of read_size bytes */
+static int decrypt_stream(std::string &pt, bool &done, const std::string &ct, size_t read_size, size_t buffer_size) {
+    struct aws_cryptosdk_session *session = new_session(AWS_CRYPTOSDK_DECRYPT);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+
+    std::stringbuf source(ct);
+    DecryptingStreambuf decryptor(session, &source, buffer_size);
+    std::istream in(&decryptor);
+    std::string chunk(read_size, '\0');
+
+    pt.clear();
+    while (in.read(&chunk[0], read_size) || in.gcount()) {
+        pt.append(chunk.data(), in.gcount());
+    }
+    done = decryptor.IsDone();
+
+    aws_cryptosdk_session_destroy(session);
+    return 0;
+}
+
+int streambuf_roundTrip_variousChunkSizes_matchesPlaintext() {
+    const std::string pt = make_plaintext(100000);
+    // Byte-at-a-time, a partial frame, whole buffers which bypass the put and get areas, and more
+    const size_t chunk_sizes[] = { 1, 1000, 4096, 65536, 100000 };
+
+    for (size_t write_size : chunk_sizes) {
+        std::string ct, decrypted;
+        bool done;
+
+        TEST_ASSERT_SUCCESS(encrypt_stream(ct, pt, write_size, 16384));
+        for (size_t read_size : chunk_sizes) {
+            TEST_ASSERT_SUCCESS(decrypt_stream(decrypted, done, ct, read_size, 8192));
+            TEST_ASSERT(done);
+            TEST_ASSERT(decrypted == pt);
+        }
+    }
+
+    return 0;
+}
+
+int streambuf_smallBuffers_growToFitFrames() {
+    const std::string pt = make_plaintext(20000);
+    std::string ct, decrypted;
+    bool done;
+
+    // Buffers smaller than a frame are grown as the session asks for more
+    TEST_ASSERT_SUCCESS(encrypt_stream(ct, pt, 333, 100));
+    TEST_ASSERT_SUCCESS(decrypt_stream(decrypted, done, ct, 777, 100));
+    TEST_ASSERT(done);
+    TEST_ASSERT(decrypted == pt);
+
+    return 0;
+}
+
+int streambuf_emptyMessage_roundTrips() {
+    std::string ct, decrypted;
+    bool done;
+
+    TEST_ASSERT_SUCCESS(encrypt_stream(ct, std::string(), 1, 4096));
+    TEST_ASSERT(!ct.empty());
+    TEST_ASSERT_SUCCESS(decrypt_stream(decrypted, done, ct, 100, 4096));
+    TEST_ASSERT(done);
+    TEST_ASSERT(decrypted.empty());
+
+    return 0;
+}
+
+int streambuf_truncatedCiphertext_failsWithoutFinishing() {
+    const std::string pt = make_plaintext(10000);
+    std::string ct, decrypted;
+    bool done;
+
+    TEST_ASSERT_SUCCESS(encrypt_stream(ct, pt, 10000, 4096));
+    ct.resize(ct.size() - 1);
+
+    aws_reset_error();
+    TEST_ASSERT_SUCCESS(decrypt_stream(decrypted, done, ct, 4096, 4096));
+    TEST_ASSERT(!done);
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+
+    return 0;
+}
+
+int streambuf_messageSizeSetUpFront_mustMatchWrites() {
+    const std::string pt = make_plaintext(5000);
+    struct aws_cryptosdk_session *session = new_session(AWS_CRYPTOSDK_ENCRYPT);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+
+    std::stringbuf sink;
+    {
+        EncryptingStreambuf encryptor(session, &sink, 4096);
+        TEST_ASSERT_SUCCESS(encryptor.SetMessageSize(pt.size() + 1));
+
+        std::ostream out(&encryptor);
+        out.write(pt.data(), pt.size());
+        TEST_ASSERT(out.good());
+        TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, encryptor.Finish());
+
+        // Nothing more is accepted once the message is closed
+        out.write(pt.data(), 1);
+        TEST_ASSERT(!out.good());
+    }
+    TEST_ASSERT(!aws_cryptosdk_session_is_done(session));
+    aws_cryptosdk_session_destroy(session);
+
+    return 0;
+}
+
+int main() {
+    aws_cryptosdk_load_error_strings();
+
+    RUN_TEST(streambuf_roundTrip_variousChunkSizes_matchesPlaintext());
+    RUN_TEST(streambuf_smallBuffers_growToFitFrames());
+    RUN_TEST(streambuf_emptyMessage_roundTrips());
+    RUN_TEST(streambuf_truncatedCiphertext_failsWithoutFinishing());
+    RUN_TEST(streambuf_messageSizeSetUpFront_mustMatchWrites());
+}
@@ -0,0 +1,446 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Load generator for the Encryption SDK against real KMS keys, for capacity planning and for
+ * checking how an application's keyring stack behaves under throttling before raising traffic.
+ *
+ * Worker threads encrypt and decrypt messages through a CMM built as the examples build theirs:
+ * a KmsKeyring over the given keys, or (with --multi-keyring) a multi-keyring of one KmsKeyring
+ * per key, optionally behind a caching CMM. Each operation is a decryption with the probability
+ * given by --decrypt-ratio, of one of the thread's recent ciphertexts, and otherwise an encryption
+ * of a message whose size is drawn from --sizes. With --rate, operations are paced to that total
+ * rate, whether or not earlier ones have finished late; otherwise each thread runs flat out.
+ *
+ * Results are written to stdout as JSON lines when the run ends: one per operation, with
+ * throughput and latency percentiles, then one for the KMS calls the keyrings made, counted by
+ * operation and by class of error, so that throttling shows up as such.
+ *
+ * Usage: aws-encryption-sdk-loadgen --key ARN [--key ARN ...] [--multi-keyring] [--threads N]
+ *            [--duration-s N] [--rate N] [--sizes BYTES[:WEIGHT],...] [--decrypt-ratio R]
+ *            [--frame-size N] [--cache N] [--cache-ttl-s N] [--cache-limit-messages N]
+ *
+ * Credentials and retries are those of the AWS SDK for C++'s defaults. Every call is a real KMS
+ * call, billed and counted against the account's request quotas.
+ */
+
+#include <aws/core/Aws.h>
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/cpp/kms_keyring.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/multi_keyring.h>
+#include <aws/cryptosdk/session.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+
+static const char *CLASS_TAG = "LoadGenerator";
+
+/* How many of its recent ciphertexts each thread keeps to decrypt */
+static const size_t CIPHERTEXT_POOL = 16;
+
+struct SizeChoice {
+    size_t bytes;
+    double weight;
+};
+
+struct LoadConfig {
+    Aws::Vector<Aws::String> keys;
+    bool multi_keyring            = false;
+    size_t threads                = 8;
+    uint64_t duration_s           = 60;
+    double rate                   = 0;
+    double decrypt_ratio          = 0.5;
+    size_t frame_size             = 0;
+    size_t cache_capacity         = 0;
+    uint64_t cache_ttl_s          = 300;
+    uint64_t cache_limit_messages = 0;
+    std::vector<SizeChoice> sizes;
+};
+
+/* Latencies of the operations which succeeded, the number which failed, and the bytes processed */
+struct OpResult {
+    std::vector<uint64_t> latencies_us;
+    uint64_t failures = 0;
+    uint64_t bytes    = 0;
+};
+
+/* Counts the KMS calls made by the keyrings, by operation and outcome */
+class KmsCallCounter : public Aws::Cryptosdk::KmsKeyring::MetricsSink {
+   public:
+    void OnKmsCall(const Aws::Cryptosdk::KmsKeyring::KmsCallMetrics &metrics) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        calls[(int)metrics.operation]++;
+        errors[(int)metrics.error_class]++;
+        latencies_us.push_back(metrics.latency.count());
+    }
+
+    std::mutex mutex;
+    /* Indexed by KmsOperation and KmsErrorClass */
+    uint64_t calls[3]  = { 0 };
+    uint64_t errors[5] = { 0 };
+    std::vector<uint64_t> latencies_us;
+};
+
+static aws_cryptosdk_keyring *BuildKeyring(
+    const LoadConfig &config,
+    const std::shared_ptr<KmsCallCounter> &counter,
+    const std::shared_ptr<Aws::Cryptosdk::KmsKeyring::ClientSupplier> &supplier) {
+    Aws::Cryptosdk::KmsKeyring::Builder builder;
+    builder.WithClientSupplier(supplier).WithMetricsSink(counter);
+
+    if (!config.multi_keyring) {
+        Aws::Vector<Aws::String> additional(config.keys.begin() + 1, config.keys.end());
+        return builder.Build(config.keys[0], additional);
+    }
+
+    aws_cryptosdk_keyring *multi = nullptr;
+    for (const Aws::String &key : config.keys) {
+        aws_cryptosdk_keyring *kr = builder.Build(key);
+        if (!kr) break;
+
+        if (!multi) {
+            multi = aws_cryptosdk_multi_keyring_new(aws_default_allocator(), kr);
+            aws_cryptosdk_keyring_release(kr);
+            if (!multi) return nullptr;
+            continue;
+        }
+
+        int rv = aws_cryptosdk_multi_keyring_add_child(multi, kr);
+        aws_cryptosdk_keyring_release(kr);
+        if (rv) {
+            aws_cryptosdk_keyring_release(multi);
+            return nullptr;
+        }
+    }
+    return multi;
+}
+
+static aws_cryptosdk_cmm *BuildCmm(const LoadConfig &config, const std::shared_ptr<KmsCallCounter> &counter) {
+    aws_allocator *alloc = aws_default_allocator();
+    // One client per region, shared by all the keyrings, as a long-running application would have
+    aws_cryptosdk_keyring *kr =
+        BuildKeyring(config, counter, Aws::Cryptosdk::KmsKeyring::CachingClientSupplier::Create());
+    aws_cryptosdk_cmm *cmm = nullptr;
+    if (!kr) return nullptr;
+
+    if (config.cache_capacity) {
+        aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, config.cache_capacity);
+        if (cache) {
+            cmm = aws_cryptosdk_caching_cmm_new_from_keyring(
+                alloc, cache, kr, NULL, config.cache_ttl_s, AWS_TIMESTAMP_SECS);
+            aws_cryptosdk_materials_cache_release(cache);
+        }
+        if (cmm && config.cache_limit_messages &&
+            aws_cryptosdk_caching_cmm_set_limit_messages(cmm, config.cache_limit_messages)) {
+            aws_cryptosdk_cmm_release(cmm);
+            cmm = nullptr;
+        }
+    } else {
+        cmm = aws_cryptosdk_default_cmm_new(alloc, kr);
+    }
+    aws_cryptosdk_keyring_release(kr);
+
+    return cmm;
+}
+
+/* Runs one whole message through session, returning its latency, or -1 if it failed */
+static int64_t RunMessage(
+    aws_cryptosdk_session *session,
+    aws_cryptosdk_mode mode,
+    size_t frame_size,
+    std::vector<uint8_t> *out,
+    const std::vector<uint8_t> &in) {
+    size_t out_len = 0, in_read = 0;
+    auto start     = steady_clock::now();
+
+    if (aws_cryptosdk_session_reset(session, mode)) return -1;
+    if (mode == AWS_CRYPTOSDK_ENCRYPT) {
+        if (aws_cryptosdk_session_set_message_size(session, in.size())) return -1;
+        if (frame_size && aws_cryptosdk_session_set_frame_size(session, frame_size)) return -1;
+    }
+
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t out_needed, in_needed, written, read;
+
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+        if (out->size() - out_len < out_needed) out->resize(out_len + out_needed);
+        if (aws_cryptosdk_session_process(
+                session,
+                out->data() + out_len,
+                out->size() - out_len,
+                &written,
+                in.data() + in_read,
+                in.size() - in_read,
+                &read)) {
+            return -1;
+        }
+        out_len += written;
+        in_read += read;
+        if (!written && !read && !aws_cryptosdk_session_is_done(session)) {
+            aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+            if (out_needed <= out->size() - out_len) return -1;
+        }
+    }
+    out->resize(out_len);
+
+    return std::chrono::duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+static void Worker(
+    const LoadConfig &config,
+    aws_cryptosdk_cmm *cmm,
+    size_t index,
+    steady_clock::time_point deadline,
+    OpResult *encrypt,
+    OpResult *decrypt) {
+    std::mt19937_64 rng(index * 0x9E3779B97F4A7C15ull + 1);
+    std::uniform_real_distribution<double> coin(0, 1);
+    std::vector<double> weights;
+    for (const SizeChoice &size : config.sizes) weights.push_back(size.weight);
+    std::discrete_distribution<size_t> pick_size(weights.begin(), weights.end());
+
+    std::vector<std::vector<uint8_t>> ciphertexts;
+    std::vector<uint8_t> plaintext, output;
+    size_t next_slot = 0;
+
+    aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_cmm(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, cmm);
+    if (!session) {
+        encrypt->failures++;
+        return;
+    }
+
+    // Operations are spaced so that all threads together keep to the rate, each starting at a different offset
+    auto interval = config.rate > 0 ? microseconds((int64_t)(1e6 * config.threads / config.rate)) : microseconds(0);
+    auto next     = steady_clock::now() + interval * index / config.threads;
+
+    while (true) {
+        if (interval.count()) {
+            if (next >= deadline) break;
+            std::this_thread::sleep_until(next);
+            next += interval;
+        } else if (steady_clock::now() >= deadline) {
+            break;
+        }
+
+        if (!ciphertexts.empty() && coin(rng) < config.decrypt_ratio) {
+            const std::vector<uint8_t> &ciphertext = ciphertexts[rng() % ciphertexts.size()];
+            int64_t elapsed = RunMessage(session, AWS_CRYPTOSDK_DECRYPT, 0, &output, ciphertext);
+            if (elapsed < 0) {
+                decrypt->failures++;
+                continue;
+            }
+            decrypt->latencies_us.push_back(elapsed);
+            decrypt->bytes += output.size();
+            continue;
+        }
+
+        plaintext.resize(config.sizes[pick_size(rng)].bytes);
+        for (size_t i = 0; i < plaintext.size(); i++) plaintext[i] = (uint8_t)(i * 31 + 7);
+        int64_t elapsed = RunMessage(session, AWS_CRYPTOSDK_ENCRYPT, config.frame_size, &output, plaintext);
+        if (elapsed < 0) {
+            encrypt->failures++;
+            continue;
+        }
+        encrypt->latencies_us.push_back(elapsed);
+        encrypt->bytes += plaintext.size();
+
+        if (ciphertexts.size() < CIPHERTEXT_POOL) {
+            ciphertexts.push_back(output);
+        } else {
+            ciphertexts[next_slot].swap(output);
+            next_slot = (next_slot + 1) % CIPHERTEXT_POOL;
+        }
+    }
+
+    aws_cryptosdk_session_destroy(session);
+}
+
+static uint64_t Percentile(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty()) return 0;
+    size_t idx = (size_t)(p * (double)(sorted.size() - 1));
+    return sorted[idx];
+}
+
+static void ReportOp(const char *op, const LoadConfig &config, double seconds, OpResult &result) {
+    std::vector<uint64_t> &latencies = result.latencies_us;
+    std::sort(latencies.begin(), latencies.end());
+
+    printf(
+        "{\"op\":\"%s\",\"threads\":%zu,\"duration_s\":%.1f,\"messages\":%zu,\"failures\":%llu,"
+        "\"messages_per_s\":%.1f,\"mb_per_s\":%.3f,\"latency_us_p50\":%llu,\"latency_us_p90\":%llu,"
+        "\"latency_us_p99\":%llu,\"latency_us_p999\":%llu,\"latency_us_max\":%llu}\n",
+        op,
+        config.threads,
+        seconds,
+        latencies.size(),
+        (unsigned long long)result.failures,
+        (double)latencies.size() / seconds,
+        (double)result.bytes / seconds / (1024 * 1024),
+        (unsigned long long)Percentile(latencies, 0.5),
+        (unsigned long long)Percentile(latencies, 0.9),
+        (unsigned long long)Percentile(latencies, 0.99),
+        (unsigned long long)Percentile(latencies, 0.999),
+        (unsigned long long)(latencies.empty() ? 0 : latencies.back()));
+}
+
+static void ReportKms(double seconds, KmsCallCounter &counter) {
+    std::lock_guard<std::mutex> lock(counter.mutex);
+    std::vector<uint64_t> &latencies = counter.latencies_us;
+    std::sort(latencies.begin(), latencies.end());
+
+    printf(
+        "{\"op\":\"kms\",\"calls\":%zu,\"calls_per_s\":%.1f,\"generate_data_key\":%llu,\"encrypt\":%llu,"
+        "\"decrypt\":%llu,\"throttled\":%llu,\"access_denied\":%llu,\"network_errors\":%llu,"
+        "\"other_errors\":%llu,\"latency_us_p50\":%llu,\"latency_us_p99\":%llu,\"latency_us_max\":%llu}\n",
+        latencies.size(),
+        (double)latencies.size() / seconds,
+        (unsigned long long)counter.calls[(int)Aws::Cryptosdk::KmsKeyring::KmsOperation::GENERATE_DATA_KEY],
+        (unsigned long long)counter.calls[(int)Aws::Cryptosdk::KmsKeyring::KmsOperation::ENCRYPT],
+        (unsigned long long)counter.calls[(int)Aws::Cryptosdk::KmsKeyring::KmsOperation::DECRYPT],
+        (unsigned long long)counter.errors[(int)Aws::Cryptosdk::KmsKeyring::KmsErrorClass::THROTTLED],
+        (unsigned long long)counter.errors[(int)Aws::Cryptosdk::KmsKeyring::KmsErrorClass::ACCESS_DENIED],
+        (unsigned long long)counter.errors[(int)Aws::Cryptosdk::KmsKeyring::KmsErrorClass::NETWORK],
+        (unsigned long long)counter.errors[(int)Aws::Cryptosdk::KmsKeyring::KmsErrorClass::OTHER],
+        (unsigned long long)Percentile(latencies, 0.5),
+        (unsigned long long)Percentile(latencies, 0.99),
+        (unsigned long long)(latencies.empty() ? 0 : latencies.back()));
+}
+
+static void Usage(const char *prog) {
+    fprintf(
+        stderr,
+        "Usage: %s --key ARN [--key ARN ...] [--multi-keyring] [--threads N] [--duration-s N] [--rate N]\n"
+        "       [--sizes BYTES[:WEIGHT],...] [--decrypt-ratio R] [--frame-size N] [--cache N] [--cache-ttl-s N]\n"
+        "       [--cache-limit-messages N]\n",
+        prog);
+    exit(1);
+}
+
+static void ParseSizes(const char *prog, const char *arg, std::vector<SizeChoice> *sizes) {
+    sizes->clear();
+    while (*arg) {
+        char *end;
+        SizeChoice choice = { strtoull(arg, &end, 10), 1 };
+
+        if (end == arg) Usage(prog);
+        if (*end == ':') {
+            arg           = end + 1;
+            choice.weight = strtod(arg, &end);
+            if (end == arg || choice.weight < 0) Usage(prog);
+        }
+        if (*end && *end != ',') Usage(prog);
+        sizes->push_back(choice);
+        arg = *end ? end + 1 : end;
+    }
+    if (sizes->empty()) Usage(prog);
+}
+
+int main(int argc, char **argv) {
+    LoadConfig config;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--multi-keyring")) {
+            config.multi_keyring = true;
+            continue;
+        }
+        if (i + 1 == argc) Usage(argv[0]);
+
+        const char *arg = argv[++i];
+        if (!strcmp(argv[i - 1], "--key")) {
+            config.keys.push_back(arg);
+        } else if (!strcmp(argv[i - 1], "--threads")) {
+            config.threads = strtoul(arg, NULL, 10);
+        } else if (!strcmp(argv[i - 1], "--duration-s")) {
+            config.duration_s = strtoull(arg, NULL, 10);
+        } else if (!strcmp(argv[i - 1], "--rate")) {
+            config.rate = strtod(arg, NULL);
+        } else if (!strcmp(argv[i - 1], "--sizes")) {
+            ParseSizes(argv[0], arg, &config.sizes);
+        } else if (!strcmp(argv[i - 1], "--decrypt-ratio")) {
+            config.decrypt_ratio = strtod(arg, NULL);
+        } else if (!strcmp(argv[i - 1], "--frame-size")) {
+            config.frame_size = strtoul(arg, NULL, 10);
+        } else if (!strcmp(argv[i - 1], "--cache")) {
+            config.cache_capacity = strtoul(arg, NULL, 10);
+        } else if (!strcmp(argv[i - 1], "--cache-ttl-s")) {
+            config.cache_ttl_s = strtoull(arg, NULL, 10);
+        } else if (!strcmp(argv[i - 1], "--cache-limit-messages")) {
+            config.cache_limit_messages = strtoull(arg, NULL, 10);
+        } else {
+            Usage(argv[0]);
+        }
+    }
+    if (config.keys.empty() || !config.threads || !config.duration_s) Usage(argv[0]);
+    if (config.decrypt_ratio < 0 || config.decrypt_ratio > 1 || config.rate < 0) Usage(argv[0]);
+    if (config.sizes.empty()) config.sizes.push_back({ 4096, 1 });
+
+    Aws::SDKOptions options;
+    Aws::InitAPI(options);
+    aws_cryptosdk_load_error_strings();
+    int rv = 1;
+
+    {
+        auto counter           = Aws::MakeShared<KmsCallCounter>(CLASS_TAG);
+        aws_cryptosdk_cmm *cmm = BuildCmm(config, counter);
+        if (!cmm) {
+            fprintf(stderr, "Cannot build the keyring stack: %s\n", aws_error_str(aws_last_error()));
+        } else {
+            std::vector<OpResult> encrypts(config.threads), decrypts(config.threads);
+            std::vector<std::thread> threads;
+            auto start    = steady_clock::now();
+            auto deadline = start + std::chrono::seconds(config.duration_s);
+            for (size_t i = 0; i < config.threads; i++) {
+                threads.emplace_back(Worker, std::cref(config), cmm, i, deadline, &encrypts[i], &decrypts[i]);
+            }
+            for (auto &thread : threads) thread.join();
+            double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+            aws_cryptosdk_cmm_release(cmm);
+
+            OpResult encrypt, decrypt;
+            for (size_t i = 0; i < config.threads; i++) {
+                encrypt.latencies_us.insert(
+                    encrypt.latencies_us.end(), encrypts[i].latencies_us.begin(), encrypts[i].latencies_us.end());
+                decrypt.latencies_us.insert(
+                    decrypt.latencies_us.end(), decrypts[i].latencies_us.begin(), decrypts[i].latencies_us.end());
+                encrypt.failures += encrypts[i].failures;
+                decrypt.failures += decrypts[i].failures;
+                encrypt.bytes += encrypts[i].bytes;
+                decrypt.bytes += decrypts[i].bytes;
+            }
+
+            ReportOp("encrypt", config, seconds, encrypt);
+            ReportOp("decrypt", config, seconds, decrypt);
+            ReportKms(seconds, *counter);
+            fflush(stdout);
+            rv = encrypt.latencies_us.empty() ? 1 : 0;
+        }
+    }
+
+    Aws::ShutdownAPI(options);
+    return rv;
+}
@@ -0,0 +1,455 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cache trace replay simulator, for sizing local caches and caching CMM usage limits.
+ *
+ * A trace is recorded from a caching CMM in production with
+ * aws_cryptosdk_caching_cmm_set_request_recorder, one request per line:
+ *
+ *     <E|D> <timestamp in ns> <cache ID hash as 16 hex digits> <bytes>
+ *
+ * which a recorder can write with
+ *
+ *     fprintf(f, "%c %llu %016llx %llu\n", record->is_encrypt ? 'E' : 'D',
+ *             (unsigned long long)record->timestamp, (unsigned long long)record->cache_id_hash,
+ *             (unsigned long long)record->bytes);
+ *
+ * Each configuration of the sweep (every combination of the values given to the options) replays
+ * the whole trace through a caching CMM on a new local cache, with a simulated clock following the
+ * trace's timestamps. Each distinct cache ID hash becomes a distinct encryption context, so that
+ * requests share cache entries exactly as the recorded ones did. On a miss, the caching CMM calls
+ * an upstream CMM which counts its calls; these stand for calls to the key provider (e.g. KMS).
+ * Results are written to stdout as JSON lines, one object per configuration, in the same way as
+ * the other benchmarks.
+ *
+ * Without a trace, --synthetic N generates one of N requests over an hour, with a skewed choice of
+ * cache IDs, which serves as a smoke test.
+ *
+ * Usage: cache_replay (--trace FILE | --synthetic N) [--capacity N,...] [--ttl-s N,...]
+ *                     [--limit-messages N,...] [--limit-bytes N,...] [--byte-limit N,...]
+ *                     [--eviction lru|clock,...]
+ * Limits of zero are no limit.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aws/common/clock.h>
+#include <aws/common/string.h>
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/edk.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/materials.h>
+
+#include "zero_keyring.h"
+
+/* Exported by the test build of the library, for simulated time */
+void caching_cmm_set_clock(struct aws_cryptosdk_cmm *generic_cmm, int (*clock_get_ticks)(uint64_t *now));
+void aws_cryptosdk_local_cache_set_clock(
+    struct aws_cryptosdk_materials_cache *generic_cache, int (*clock_get_ticks)(uint64_t *timestamp));
+
+#define MAX_SWEEP_VALUES 16
+/* Replayed messages are encrypted with an unsigned suite, so that misses do not generate signing keys */
+#define REPLAY_ALG ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256
+
+AWS_STATIC_STRING_FROM_LITERAL(replay_key, "replay-id");
+AWS_STATIC_STRING_FROM_LITERAL(null_field, "null");
+
+struct sweep {
+    uint64_t values[MAX_SWEEP_VALUES];
+    size_t count;
+};
+
+struct replay_config {
+    size_t capacity;
+    uint64_t ttl_s, limit_messages, limit_bytes, byte_limit;
+    enum aws_cryptosdk_local_cache_eviction eviction;
+};
+
+struct trace {
+    struct aws_cryptosdk_caching_cmm_request_record *records;
+    size_t count, allocated;
+};
+
+/* Forwards requests to the default CMM, counting them */
+struct counting_cmm {
+    struct aws_cryptosdk_cmm base;
+    struct aws_cryptosdk_cmm *upstream;
+    uint64_t calls;
+};
+
+static uint64_t sim_now;
+
+static int sim_clock_get_ticks(uint64_t *now) {
+    *now = sim_now;
+    return AWS_OP_SUCCESS;
+}
+
+static void counting_cmm_destroy(struct aws_cryptosdk_cmm *cmm) {
+    (void)cmm;
+}
+
+static int counting_cmm_generate_enc_materials(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_enc_materials **output,
+    struct aws_cryptosdk_enc_request *request) {
+    struct counting_cmm *self = (struct counting_cmm *)cmm;
+
+    self->calls++;
+    return aws_cryptosdk_cmm_generate_enc_materials(self->upstream, output, request);
+}
+
+static int counting_cmm_decrypt_materials(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request) {
+    struct counting_cmm *self = (struct counting_cmm *)cmm;
+
+    self->calls++;
+    return aws_cryptosdk_cmm_decrypt_materials(self->upstream, output, request);
+}
+
+static const struct aws_cryptosdk_cmm_vt counting_cmm_vt = { .vt_size = sizeof(struct aws_cryptosdk_cmm_vt),
+                                                             .name    = "counting cmm",
+                                                             .destroy = counting_cmm_destroy,
+                                                             .generate_enc_materials =
+                                                                 counting_cmm_generate_enc_materials,
+                                                             .decrypt_materials = counting_cmm_decrypt_materials };
+
+static int trace_append(struct trace *trace, const struct aws_cryptosdk_caching_cmm_request_record *record) {
+    if (trace->count == trace->allocated) {
+        size_t allocated = trace->allocated ? trace->allocated * 2 : 1024;
+        void *records    = realloc(trace->records, allocated * sizeof(*trace->records));
+        if (!records) return aws_raise_error(AWS_ERROR_OOM);
+        trace->records   = records;
+        trace->allocated = allocated;
+    }
+
+    trace->records[trace->count++] = *record;
+    return AWS_OP_SUCCESS;
+}
+
+static int load_trace(struct trace *trace, const char *path) {
+    FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    char line[256];
+    int rv = AWS_OP_SUCCESS;
+
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    while (!rv && fgets(line, sizeof(line), f)) {
+        struct aws_cryptosdk_caching_cmm_request_record record = { 0 };
+        unsigned long long timestamp, hash, bytes;
+        char mode;
+
+        if (line[0] == '\n' || line[0] == '#') continue;
+        if (sscanf(line, " %c %llu %llx %llu", &mode, &timestamp, &hash, &bytes) != 4 ||
+            (mode != 'E' && mode != 'D')) {
+            fprintf(stderr, "Malformed trace line: %s", line);
+            rv = aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+            break;
+        }
+
+        record.timestamp     = timestamp;
+        record.cache_id_hash = hash;
+        record.bytes         = bytes;
+        record.is_encrypt    = mode == 'E';
+        rv                   = trace_append(trace, &record);
+    }
+
+    if (f != stdin) fclose(f);
+    return rv;
+}
+
+/* xorshift64, as in the local cache benchmark */
+static uint64_t next_random(uint64_t *rng) {
+    uint64_t x = *rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *rng = x;
+}
+
+/*
+ * N requests spread over an hour, nine in ten of them encryptions. Cache IDs are drawn below a
+ * power of two which is itself drawn uniformly up to 2^14, so a few low IDs take most of the
+ * requests, as with real workloads.
+ */
+static int synthetic_trace(struct trace *trace, size_t num_requests) {
+    uint64_t rng  = 0x9E3779B97F4A7C15ull;
+    uint64_t span = 3600ull * AWS_TIMESTAMP_NANOS;
+
+    for (size_t i = 0; i < num_requests; i++) {
+        struct aws_cryptosdk_caching_cmm_request_record record = { 0 };
+        unsigned bits = (unsigned)(next_random(&rng) % 15);
+
+        record.timestamp     = span / num_requests * i;
+        record.cache_id_hash = next_random(&rng) & ((1ull << bits) - 1);
+        record.is_encrypt    = next_random(&rng) % 10 != 0;
+        record.bytes         = record.is_encrypt ? 4096 : 0;
+        if (trace_append(trace, &record)) return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Sets the encryption context that stands for the recorded cache ID hash */
+static int set_replay_enc_ctx(struct aws_hash_table *enc_ctx, uint64_t cache_id_hash) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016" PRIx64, cache_id_hash);
+
+    struct aws_string *value = aws_string_new_from_c_str(aws_default_allocator(), hex);
+    if (!value) return AWS_OP_ERR;
+
+    aws_hash_table_clear(enc_ctx);
+    if (aws_hash_table_put(enc_ctx, replay_key, value, NULL)) {
+        aws_string_destroy(value);
+        return AWS_OP_ERR;
+    }
+    return AWS_OP_SUCCESS;
+}
+
+static int replay_request(
+    struct aws_cryptosdk_cmm *caching_cmm,
+    const struct aws_cryptosdk_caching_cmm_request_record *record,
+    struct aws_hash_table *enc_ctx) {
+    struct aws_allocator *alloc = aws_default_allocator();
+
+    if (set_replay_enc_ctx(enc_ctx, record->cache_id_hash)) return AWS_OP_ERR;
+
+    if (record->is_encrypt) {
+        struct aws_cryptosdk_enc_materials *materials = NULL;
+        struct aws_cryptosdk_enc_request request      = {
+            .alloc = alloc, .enc_ctx = enc_ctx, .requested_alg = REPLAY_ALG, .plaintext_size = record->bytes
+        };
+
+        if (aws_cryptosdk_cmm_generate_enc_materials(caching_cmm, &materials, &request)) return AWS_OP_ERR;
+        aws_cryptosdk_enc_materials_destroy(materials);
+        return AWS_OP_SUCCESS;
+    }
+
+    struct aws_cryptosdk_dec_materials *materials = NULL;
+    struct aws_cryptosdk_dec_request request;
+    struct aws_cryptosdk_edk edk;
+    int rv = AWS_OP_ERR;
+
+    AWS_ZERO_STRUCT(request);
+    AWS_ZERO_STRUCT(edk);
+    request.alloc   = alloc;
+    request.enc_ctx = enc_ctx;
+    request.alg     = REPLAY_ALG;
+    // The EDK of the zero keyring, which the upstream CMM always decrypts
+    edk.provider_id   = aws_byte_buf_from_array(aws_string_bytes(null_field), null_field->len);
+    edk.provider_info = edk.provider_id;
+    edk.ciphertext    = edk.provider_id;
+
+    if (aws_cryptosdk_edk_list_init(alloc, &request.encrypted_data_keys)) return AWS_OP_ERR;
+    if (!aws_array_list_push_back(&request.encrypted_data_keys, &edk) &&
+        !aws_cryptosdk_cmm_decrypt_materials(caching_cmm, &materials, &request)) {
+        aws_cryptosdk_dec_materials_destroy(materials);
+        rv = AWS_OP_SUCCESS;
+    }
+
+    aws_array_list_clean_up(&request.encrypted_data_keys);
+    return rv;
+}
+
+static int run_config(const struct trace *trace, const struct replay_config *config, struct aws_cryptosdk_cmm *dflt) {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct counting_cmm upstream                = { .upstream = dflt, .calls = 0 };
+    struct aws_cryptosdk_materials_cache *cache = NULL;
+    struct aws_cryptosdk_cmm *caching_cmm       = NULL;
+    struct aws_hash_table enc_ctx;
+    int rv = AWS_OP_ERR;
+
+    if (aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx)) return AWS_OP_ERR;
+    aws_cryptosdk_cmm_base_init(&upstream.base, &counting_cmm_vt);
+    sim_now = trace->count ? trace->records[0].timestamp : 0;
+
+    if (!(cache = aws_cryptosdk_materials_cache_local_new(alloc, config->capacity)) ||
+        aws_cryptosdk_materials_cache_local_set_eviction(cache, config->eviction) ||
+        (config->byte_limit && aws_cryptosdk_materials_cache_local_set_byte_limit(cache, config->byte_limit))) {
+        goto out;
+    }
+    aws_cryptosdk_local_cache_set_clock(cache, sim_clock_get_ticks);
+
+    if (!(caching_cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+              alloc, cache, &upstream.base, NULL, config->ttl_s, AWS_TIMESTAMP_SECS)) ||
+        (config->limit_messages && aws_cryptosdk_caching_cmm_set_limit_messages(caching_cmm, config->limit_messages)) ||
+        (config->limit_bytes && aws_cryptosdk_caching_cmm_set_limit_bytes(caching_cmm, config->limit_bytes))) {
+        goto out;
+    }
+    caching_cmm_set_clock(caching_cmm, sim_clock_get_ticks);
+
+    for (size_t i = 0; i < trace->count; i++) {
+        // Timestamps from several threads may be slightly out of order; time never goes backwards here
+        if (trace->records[i].timestamp > sim_now) sim_now = trace->records[i].timestamp;
+        if (replay_request(caching_cmm, &trace->records[i], &enc_ctx)) goto out;
+    }
+
+    uint64_t span_ns = trace->count ? sim_now - trace->records[0].timestamp : 0;
+    double seconds   = (double)(span_ns ? span_ns : 1) / (double)AWS_TIMESTAMP_NANOS;
+    uint64_t hits    = trace->count - (upstream.calls < trace->count ? upstream.calls : trace->count);
+
+    printf(
+        "{\"capacity\":%zu,\"ttl_s\":%" PRIu64 ",\"limit_messages\":%" PRIu64 ",\"limit_bytes\":%" PRIu64
+        ",\"byte_limit\":%" PRIu64 ",\"eviction\":\"%s\",\"requests\":%zu,\"hits\":%" PRIu64
+        ",\"hit_ratio\":%.4f,\"upstream_calls\":%" PRIu64 ",\"trace_s\":%.1f,\"upstream_calls_per_s\":%.3f}\n",
+        config->capacity,
+        config->ttl_s,
+        config->limit_messages,
+        config->limit_bytes,
+        config->byte_limit,
+        config->eviction == AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_CLOCK ? "clock" : "lru",
+        trace->count,
+        hits,
+        trace->count ? (double)hits / (double)trace->count : 0.0,
+        upstream.calls,
+        seconds,
+        (double)upstream.calls / seconds);
+    fflush(stdout);
+    rv = AWS_OP_SUCCESS;
+
+out:
+    if (rv) fprintf(stderr, "Replay failed at capacity %zu: %s\n", config->capacity, aws_error_str(aws_last_error()));
+    if (caching_cmm) aws_cryptosdk_cmm_release(caching_cmm);
+    if (cache) aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    return rv;
+}
+
+static void usage(const char *prog) {
+    fprintf(
+        stderr,
+        "Usage: %s (--trace FILE | --synthetic N) [--capacity N,...] [--ttl-s N,...] [--limit-messages N,...]\n"
+        "       [--limit-bytes N,...] [--byte-limit N,...] [--eviction lru|clock,...]\n",
+        prog);
+    exit(1);
+}
+
+static void parse_sweep(const char *prog, struct sweep *sweep, const char *arg) {
+    char *end;
+
+    sweep->count = 0;
+    do {
+        if (sweep->count == MAX_SWEEP_VALUES) usage(prog);
+        sweep->values[sweep->count++] = strtoull(arg, &end, 10);
+        if (end == arg || (*end && *end != ',')) usage(prog);
+        arg = end + 1;
+    } while (*end);
+}
+
+static void parse_evictions(const char *prog, struct sweep *sweep, const char *arg) {
+    sweep->count = 0;
+    while (*arg) {
+        size_t len = strcspn(arg, ",");
+
+        if (sweep->count == MAX_SWEEP_VALUES) usage(prog);
+        if (len == 3 && !strncmp(arg, "lru", len)) {
+            sweep->values[sweep->count++] = AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU;
+        } else if (len == 5 && !strncmp(arg, "clock", len)) {
+            sweep->values[sweep->count++] = AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_CLOCK;
+        } else {
+            usage(prog);
+        }
+        arg += len + (arg[len] == ',');
+    }
+    if (!sweep->count) usage(prog);
+}
+
+int main(int argc, char **argv) {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct sweep capacities = { { 1000 }, 1 }, ttls = { { 300 }, 1 }, limit_messages = { { 0 }, 1 },
+                 limit_bytes = { { 0 }, 1 }, byte_limits = { { 0 }, 1 },
+                 evictions = { { AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU }, 1 };
+    struct trace trace = { 0 };
+    const char *trace_path = NULL;
+    size_t synthetic       = 0;
+    int failures           = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 == argc) usage(argv[0]);
+
+        if (!strcmp(argv[i], "--trace")) {
+            trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "--synthetic")) {
+            synthetic = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--capacity")) {
+            parse_sweep(argv[0], &capacities, argv[++i]);
+        } else if (!strcmp(argv[i], "--ttl-s")) {
+            parse_sweep(argv[0], &ttls, argv[++i]);
+        } else if (!strcmp(argv[i], "--limit-messages")) {
+            parse_sweep(argv[0], &limit_messages, argv[++i]);
+        } else if (!strcmp(argv[i], "--limit-bytes")) {
+            parse_sweep(argv[0], &limit_bytes, argv[++i]);
+        } else if (!strcmp(argv[i], "--byte-limit")) {
+            parse_sweep(argv[0], &byte_limits, argv[++i]);
+        } else if (!strcmp(argv[i], "--eviction")) {
+            parse_evictions(argv[0], &evictions, argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (!trace_path == !synthetic) usage(argv[0]);
+
+    aws_cryptosdk_load_error_strings();
+    if (trace_path ? load_trace(&trace, trace_path) : synthetic_trace(&trace, synthetic)) {
+        fprintf(stderr, "Cannot load trace: %s\n", aws_error_str(aws_last_error()));
+        free(trace.records);
+        return 1;
+    }
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *dflt   = kr ? aws_cryptosdk_default_cmm_new(alloc, kr) : NULL;
+    if (!dflt) {
+        fprintf(stderr, "Cannot create the upstream CMM: %s\n", aws_error_str(aws_last_error()));
+        return 1;
+    }
+
+    for (size_t c = 0; c < capacities.count; c++) {
+        for (size_t t = 0; t < ttls.count; t++) {
+            for (size_t m = 0; m < limit_messages.count; m++) {
+                for (size_t b = 0; b < limit_bytes.count; b++) {
+                    for (size_t l = 0; l < byte_limits.count; l++) {
+                        for (size_t e = 0; e < evictions.count; e++) {
+                            struct replay_config config = {
+                                .capacity       = (size_t)capacities.values[c],
+                                .ttl_s          = ttls.values[t],
+                                .limit_messages = limit_messages.values[m],
+                                .limit_bytes    = limit_bytes.values[b],
+                                .byte_limit     = byte_limits.values[l],
+                                .eviction       = (enum aws_cryptosdk_local_cache_eviction)evictions.values[e],
+                            };
+                            if (run_config(&trace, &config, dflt)) failures++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    aws_cryptosdk_cmm_release(dflt);
+    aws_cryptosdk_keyring_release(kr);
+    free(trace.records);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cold start latency of the first message a process encrypts and decrypts.
+ *
+ * The SDK sets up its ciphers, digests, curve groups and random generator the first time they
+ * are needed, once per process, so a cold start can only be measured once per run. Each run
+ * times, in a process which has not used the SDK yet: the optional call to
+ * aws_cryptosdk_prepare, creating a keyring, CMM and session, the first encryption and
+ * decryption, and then one more of each for comparison. The results are written to stdout as
+ * a single JSON line. `make bench_cold_start` runs it once without and once with --prepare.
+ *
+ * Usage: cold_start_bench [--prepare] [--message-size N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aws/common/clock.h>
+#include <aws/common/string.h>
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/raw_aes_keyring.h>
+#include <aws/cryptosdk/session.h>
+
+AWS_STATIC_STRING_FROM_LITERAL(bench_key_namespace, "bench");
+AWS_STATIC_STRING_FROM_LITERAL(bench_key_name, "bench key");
+
+static const uint8_t bench_wrapping_key[32] = { 0 };
+
+/* A signing suite, so that the first message also pays for the curve group and key generation */
+static const enum aws_cryptosdk_alg_id bench_alg = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384;
+
+static uint64_t now_ns() {
+    uint64_t ticks = 0;
+    aws_high_res_clock_get_ticks(&ticks);
+    return ticks;
+}
+
+/* Runs one whole message through the session, returning the elapsed nanoseconds, or 0 on failure */
+static uint64_t run_message(
+    struct aws_cryptosdk_session *session,
+    enum aws_cryptosdk_mode mode,
+    uint8_t *out,
+    size_t out_cap,
+    size_t *out_len,
+    const uint8_t *in,
+    size_t in_len) {
+    size_t in_read;
+    uint64_t start = now_ns();
+
+    if (aws_cryptosdk_session_reset(session, mode)) return 0;
+    if (mode == AWS_CRYPTOSDK_ENCRYPT && aws_cryptosdk_session_set_message_size(session, in_len)) return 0;
+    if (aws_cryptosdk_session_process(session, out, out_cap, out_len, in, in_len, &in_read)) return 0;
+
+    uint64_t elapsed = now_ns() - start;
+
+    if (!aws_cryptosdk_session_is_done(session) || in_read != in_len) return 0;
+
+    return elapsed ? elapsed : 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--prepare] [--message-size N]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    struct aws_allocator *alloc           = aws_default_allocator();
+    bool prepare                          = false;
+    size_t message_size                   = 1024;
+    int rv                                = 1;
+    struct aws_cryptosdk_keyring *kr      = NULL;
+    struct aws_cryptosdk_cmm *cmm         = NULL;
+    struct aws_cryptosdk_session *session = NULL;
+    uint64_t prepare_ns                   = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--prepare")) {
+            prepare = true;
+        } else if (!strcmp(argv[i], "--message-size") && i + 1 < argc) {
+            message_size = strtoul(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    // Generous bound on header, frame and trailer overhead
+    size_t ct_cap = message_size + 8192;
+    size_t ct_len = 0, pt_len = 0;
+    uint8_t *pt   = malloc(message_size);
+    uint8_t *ct   = malloc(ct_cap);
+    uint8_t *pt2  = malloc(message_size);
+
+    if (!pt || !ct || !pt2) goto out;
+    for (size_t i = 0; i < message_size; i++) pt[i] = (uint8_t)(i * 31 + 7);
+
+    if (prepare) {
+        uint64_t prepare_start = now_ns();
+        if (aws_cryptosdk_prepare()) goto out;
+        prepare_ns = now_ns() - prepare_start;
+    } else {
+        aws_cryptosdk_load_error_strings();
+    }
+
+    uint64_t setup_start = now_ns();
+    if (!(kr = aws_cryptosdk_raw_aes_keyring_new(
+              alloc, bench_key_namespace, bench_key_name, bench_wrapping_key, AWS_CRYPTOSDK_AES256))) {
+        goto out;
+    }
+    if (!(cmm = aws_cryptosdk_default_cmm_new(alloc, kr))) goto out;
+    if (aws_cryptosdk_default_cmm_set_alg_id(cmm, bench_alg)) goto out;
+    if (!(session = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm))) goto out;
+    uint64_t setup_ns = now_ns() - setup_start;
+
+    uint64_t first_encrypt_ns = run_message(session, AWS_CRYPTOSDK_ENCRYPT, ct, ct_cap, &ct_len, pt, message_size);
+    uint64_t first_decrypt_ns = run_message(session, AWS_CRYPTOSDK_DECRYPT, pt2, message_size, &pt_len, ct, ct_len);
+    if (!first_encrypt_ns || !first_decrypt_ns) goto out;
+    if (pt_len != message_size || memcmp(pt, pt2, message_size)) goto out;
+
+    uint64_t warm_encrypt_ns = run_message(session, AWS_CRYPTOSDK_ENCRYPT, ct, ct_cap, &ct_len, pt, message_size);
+    uint64_t warm_decrypt_ns = run_message(session, AWS_CRYPTOSDK_DECRYPT, pt2, message_size, &pt_len, ct, ct_len);
+    if (!warm_encrypt_ns || !warm_decrypt_ns) goto out;
+
+    printf(
+        "{\"op\":\"cold_start\",\"prepared\":%s,\"message_size\":%zu,\"prepare_ns\":%llu,\"setup_ns\":%llu,"
+        "\"first_encrypt_ns\":%llu,\"first_decrypt_ns\":%llu,\"warm_encrypt_ns\":%llu,\"warm_decrypt_ns\":%llu}\n",
+        prepare ? "true" : "false",
+        message_size,
+        (unsigned long long)prepare_ns,
+        (unsigned long long)setup_ns,
+        (unsigned long long)first_encrypt_ns,
+        (unsigned long long)first_decrypt_ns,
+        (unsigned long long)warm_encrypt_ns,
+        (unsigned long long)warm_decrypt_ns);
+    fflush(stdout);
+
+    rv = 0;
+
+out:
+    if (rv) {
+        fprintf(stderr, "Benchmark failed: %s\n", aws_error_str(aws_last_error()));
+    }
+
+    if (session) aws_cryptosdk_session_destroy(session);
+    if (cmm) aws_cryptosdk_cmm_release(cmm);
+    if (kr) aws_cryptosdk_keyring_release(kr);
+    free(pt);
+    free(ct);
+    free(pt2);
+
+    return rv;
+}
@@ -0,0 +1,424 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contention benchmark for the local materials cache.
+ *
+ * Threads run the caching CMM's encrypt-side pattern against one cache: find_entry, then
+ * get_enc_materials on a hit or put_entry_for_encrypt on a miss, then release_entry. Keys are
+ * drawn uniformly from a key space sized so that the LRU hit ratio is about the one asked for,
+ * and with TTL churn some inserted entries are given a short TTL, so that they expire and are
+ * looked up and replaced again. The sweep covers cache engines (LRU, CLOCK and a sharded LRU),
+ * thread counts, capacities, hit ratios and churn rates.
+ *
+ * Every call is timed on its own, so latencies include the cost of reading the clock. They are
+ * kept in histograms with eight buckets per power of two, so percentiles are accurate to about
+ * 12%. Results are written to stdout as JSON lines, one object per (operation, configuration),
+ * in the same way as session_bench.
+ *
+ * Usage: local_cache_bench [--quick] [--min-time-ms N] [--threads N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aws/common/atomics.h>
+#include <aws/common/clock.h>
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/materials.h>
+
+#include "cache_test_lib.h"
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Distinct materials put into the cache; keys share them round robin, as the cache copies them */
+#define MATERIALS_POOL_SIZE 64
+/* The most threads a case may run */
+#define MAX_THREADS 64
+/* Lifetime of entries given a TTL by churn */
+#define CHURN_TTL_NS (1000ull * 1000)
+
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+enum bench_op { OP_FIND_ENTRY, OP_GET_ENC_MATERIALS, OP_PUT_ENTRY_FOR_ENCRYPT, OP_RELEASE_ENTRY, OP_COUNT };
+
+static const char *const op_names[OP_COUNT] = {
+    [OP_FIND_ENTRY]            = "find_entry",
+    [OP_GET_ENC_MATERIALS]     = "get_enc_materials",
+    [OP_PUT_ENTRY_FOR_ENCRYPT] = "put_entry_for_encrypt",
+    [OP_RELEASE_ENTRY]         = "release_entry",
+};
+
+struct engine {
+    const char *name;
+    enum aws_cryptosdk_local_cache_eviction eviction;
+    size_t shards;
+};
+
+static const struct engine engines[] = {
+    { "lru", AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU, 1 },
+    { "clock", AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_CLOCK, 1 },
+    { "sharded_lru", AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU, 8 },
+};
+
+static const size_t thread_counts[] = { 1, 2, 4, 8, 16 };
+static const size_t capacities[]    = { 100, 10000 };
+static const double hit_ratios[]    = { 0.5, 0.9, 0.99 };
+static const double ttl_churns[]    = { 0, 0.01 };
+
+struct bench_config {
+    uint64_t min_time_ns;
+    /* If nonzero, the only thread count to run */
+    size_t threads;
+    bool quick;
+};
+
+struct bench_case {
+    const struct engine *engine;
+    size_t threads, capacity;
+    double hit_ratio, ttl_churn;
+};
+
+struct histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+};
+
+/* Per-thread state; threads only ever write their own, so nothing here is shared */
+struct worker {
+    struct aws_cryptosdk_materials_cache *cache;
+    struct aws_cryptosdk_enc_materials **pool;
+    const struct bench_case *bench_case;
+    uint32_t key_space;
+    uint64_t rng;
+    uint64_t hits, misses;
+    bool failed;
+    struct histogram hist[OP_COUNT];
+};
+
+static struct aws_atomic_var stop_flag;
+
+static uint64_t now_ns() {
+    uint64_t ticks = 0;
+    aws_high_res_clock_get_ticks(&ticks);
+    return ticks;
+}
+
+/* xorshift64; the access pattern only needs to look random, and must not contend between threads */
+static uint64_t next_random(struct worker *worker) {
+    uint64_t x = worker->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return worker->rng = x;
+}
+
+static size_t hist_bucket(uint64_t ns) {
+    size_t shift = 0;
+
+    if (ns < (1u << HIST_SUB_BITS)) return (size_t)ns;
+    while ((ns >> shift) >= (2u << HIST_SUB_BITS)) shift++;
+
+    return ((shift + 1) << HIST_SUB_BITS) + (size_t)((ns >> shift) - (1u << HIST_SUB_BITS));
+}
+
+/* The smallest value falling in bucket */
+static uint64_t hist_bucket_floor(size_t bucket) {
+    if (bucket < (1u << HIST_SUB_BITS)) return bucket;
+
+    size_t shift = (bucket >> HIST_SUB_BITS) - 1;
+    return ((uint64_t)(bucket & ((1u << HIST_SUB_BITS) - 1)) + (1u << HIST_SUB_BITS)) << shift;
+}
+
+static void hist_record(struct histogram *hist, uint64_t start, uint64_t end) {
+    hist->counts[hist_bucket(end > start ? end - start : 0)]++;
+    hist->total++;
+}
+
+static uint64_t hist_percentile(const struct histogram *hist, double percentile) {
+    uint64_t rank = (uint64_t)((double)hist->total * percentile);
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen > rank) return hist_bucket_floor(i);
+    }
+
+    return 0;
+}
+
+/* One lookup, as the caching CMM makes it for an encrypt request */
+static void one_iteration(struct worker *worker, struct aws_hash_table *enc_ctx) {
+    struct aws_cryptosdk_materials_cache *cache = worker->cache;
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    struct aws_cryptosdk_enc_materials *materials;
+    uint32_t key = (uint32_t)(next_random(worker) % worker->key_space);
+    bool is_encrypt;
+    char buf[32];
+
+    struct aws_byte_buf cache_id = aws_byte_buf_from_array((uint8_t *)buf, sizeof(buf));
+    cache_id.len                 = (size_t)snprintf(buf, sizeof(buf), "bench entry %u", (unsigned)key);
+
+    uint64_t start = now_ns();
+    int rv         = aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id);
+    hist_record(&worker->hist[OP_FIND_ENTRY], start, now_ns());
+    if (rv) {
+        worker->failed = true;
+        return;
+    }
+
+    if (entry) {
+        worker->hits++;
+        start = now_ns();
+        rv    = aws_cryptosdk_materials_cache_get_enc_materials(
+            cache, aws_default_allocator(), &materials, enc_ctx, entry);
+        hist_record(&worker->hist[OP_GET_ENC_MATERIALS], start, now_ns());
+        // A concurrent invalidation or expiry may make this fail, which is not an error here
+        if (!rv) aws_cryptosdk_enc_materials_destroy(materials);
+        aws_hash_table_clear(enc_ctx);
+    } else {
+        struct aws_cryptosdk_cache_usage_stats initial_usage = { 0 };
+
+        worker->misses++;
+        start = now_ns();
+        aws_cryptosdk_materials_cache_put_entry_for_encrypt(
+            cache, &entry, worker->pool[key % MATERIALS_POOL_SIZE], initial_usage, enc_ctx, &cache_id);
+        hist_record(&worker->hist[OP_PUT_ENTRY_FOR_ENCRYPT], start, now_ns());
+
+        double churn = worker->bench_case->ttl_churn;
+        if (entry && churn > 0 && (double)(next_random(worker) >> 11) < churn * (double)(1ull << 53)) {
+            uint64_t now = 0;
+            aws_sys_clock_get_ticks(&now);
+            aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, now + CHURN_TTL_NS);
+        }
+    }
+
+    if (entry) {
+        start = now_ns();
+        aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+        hist_record(&worker->hist[OP_RELEASE_ENTRY], start, now_ns());
+    }
+}
+
+static void worker_fn(void *arg) {
+    struct worker *worker = arg;
+    struct aws_hash_table enc_ctx;
+
+    if (aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx)) {
+        worker->failed = true;
+        return;
+    }
+
+    while (!worker->failed && !aws_atomic_load_int_explicit(&stop_flag, aws_memory_order_relaxed)) {
+        one_iteration(worker, &enc_ctx);
+    }
+
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+}
+
+static struct aws_cryptosdk_materials_cache *new_cache(const struct bench_case *bench_case) {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    const struct engine *engine                 = bench_case->engine;
+    struct aws_cryptosdk_materials_cache *cache = NULL;
+
+    if (engine->shards > 1) {
+        cache = aws_cryptosdk_materials_cache_local_new_sharded(alloc, bench_case->capacity, engine->shards);
+    } else {
+        cache = aws_cryptosdk_materials_cache_local_new(alloc, bench_case->capacity);
+    }
+    if (cache && aws_cryptosdk_materials_cache_local_set_eviction(cache, engine->eviction)) {
+        aws_cryptosdk_materials_cache_release(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+static void report(const struct bench_case *bench_case, const struct worker *workers, uint64_t elapsed_ns) {
+    uint64_t hits = 0, misses = 0;
+
+    for (size_t t = 0; t < bench_case->threads; t++) {
+        hits += workers[t].hits;
+        misses += workers[t].misses;
+    }
+
+    for (int op = 0; op < OP_COUNT; op++) {
+        static struct histogram merged;
+
+        memset(&merged, 0, sizeof(merged));
+        for (size_t t = 0; t < bench_case->threads; t++) {
+            for (size_t i = 0; i < HIST_BUCKETS; i++) merged.counts[i] += workers[t].hist[op].counts[i];
+            merged.total += workers[t].hist[op].total;
+        }
+        if (!merged.total) continue;
+
+        printf(
+            "{\"op\":\"%s\",\"engine\":\"%s\",\"threads\":%zu,\"capacity\":%zu,\"hit_ratio\":%.2f,"
+            "\"ttl_churn\":%.3f,\"measured_hit_ratio\":%.3f,\"ops\":%llu,\"ops_per_s\":%.0f,"
+            "\"latency_ns_p50\":%llu,\"latency_ns_p99\":%llu}\n",
+            op_names[op],
+            bench_case->engine->name,
+            bench_case->threads,
+            bench_case->capacity,
+            bench_case->hit_ratio,
+            bench_case->ttl_churn,
+            (double)hits / (double)(hits + misses),
+            (unsigned long long)merged.total,
+            (double)merged.total * 1e9 / (double)elapsed_ns,
+            (unsigned long long)hist_percentile(&merged, 0.50),
+            (unsigned long long)hist_percentile(&merged, 0.99));
+    }
+    fflush(stdout);
+}
+
+static int run_case(
+    const struct bench_config *config,
+    const struct bench_case *bench_case,
+    struct aws_cryptosdk_enc_materials **pool) {
+    struct aws_thread threads[MAX_THREADS];
+    struct aws_cryptosdk_materials_cache *cache = NULL;
+    struct worker *workers                      = NULL;
+    size_t launched                             = 0;
+    int rv                                      = -1;
+
+    if (!bench_case->threads || bench_case->threads > MAX_THREADS) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        goto out;
+    }
+    if (!(cache = new_cache(bench_case))) goto out;
+    if (!(workers = calloc(bench_case->threads, sizeof(*workers)))) goto out;
+
+    for (size_t t = 0; t < bench_case->threads; t++) {
+        workers[t].cache      = cache;
+        workers[t].pool       = pool;
+        workers[t].bench_case = bench_case;
+        // Under LRU with uniformly drawn keys, the hit ratio is about capacity / key space
+        workers[t].key_space = (uint32_t)((double)bench_case->capacity / bench_case->hit_ratio);
+        workers[t].rng       = 0x9E3779B97F4A7C15ull * (t + 1);
+    }
+
+    aws_atomic_store_int(&stop_flag, 0);
+    uint64_t start = now_ns();
+    for (; launched < bench_case->threads; launched++) {
+        if (aws_thread_init(&threads[launched], aws_default_allocator())) break;
+        if (aws_thread_launch(&threads[launched], worker_fn, &workers[launched], aws_default_thread_options())) {
+            aws_thread_clean_up(&threads[launched]);
+            break;
+        }
+    }
+
+    if (launched == bench_case->threads) aws_thread_current_sleep(config->min_time_ns);
+    aws_atomic_store_int(&stop_flag, 1);
+    for (size_t t = 0; t < launched; t++) {
+        aws_thread_join(&threads[t]);
+        aws_thread_clean_up(&threads[t]);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    if (launched != bench_case->threads) goto out;
+    for (size_t t = 0; t < bench_case->threads; t++) {
+        if (workers[t].failed) goto out;
+    }
+
+    report(bench_case, workers, elapsed ? elapsed : 1);
+    rv = 0;
+
+out:
+    if (rv) {
+        fprintf(
+            stderr,
+            "Benchmark failed: engine=%s threads=%zu capacity=%zu hit_ratio=%.2f ttl_churn=%.3f: %s\n",
+            bench_case->engine->name,
+            bench_case->threads,
+            bench_case->capacity,
+            bench_case->hit_ratio,
+            bench_case->ttl_churn,
+            aws_error_str(aws_last_error()));
+    }
+
+    free(workers);
+    if (cache) aws_cryptosdk_materials_cache_release(cache);
+    return rv;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--quick] [--min-time-ms N] [--threads N]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    struct aws_allocator *alloc                                   = aws_default_allocator();
+    struct bench_config config                                    = { .min_time_ns = 200ull * 1000 * 1000 };
+    struct aws_cryptosdk_enc_materials *pool[MATERIALS_POOL_SIZE] = { NULL };
+    int failures                                                  = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) {
+            config.quick       = true;
+            config.min_time_ns = 10ull * 1000 * 1000;
+        } else if (!strcmp(argv[i], "--min-time-ms") && i + 1 < argc) {
+            config.min_time_ns = strtoull(argv[++i], NULL, 10) * 1000 * 1000;
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            config.threads = strtoul(argv[++i], NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    aws_cryptosdk_load_error_strings();
+    aws_atomic_init_int(&stop_flag, 0);
+
+    for (int i = 0; i < MATERIALS_POOL_SIZE; i++) {
+        gen_enc_materials(alloc, &pool[i], i, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 1);
+    }
+
+    for (size_t e = 0; e < ARRAY_LEN(engines); e++) {
+        for (size_t t = 0; t < ARRAY_LEN(thread_counts); t++) {
+            size_t threads = config.threads ? config.threads : thread_counts[t];
+            // The quick sweep keeps to one and four threads, small caches and a 90% hit ratio
+            if (config.threads && t) break;
+            if (config.quick && !config.threads && threads != 1 && threads != 4) continue;
+
+            for (size_t c = 0; c < ARRAY_LEN(capacities); c++) {
+                if (config.quick && c) continue;
+
+                for (size_t h = 0; h < ARRAY_LEN(hit_ratios); h++) {
+                    if (config.quick && hit_ratios[h] != 0.9) continue;
+
+                    for (size_t r = 0; r < ARRAY_LEN(ttl_churns); r++) {
+                        struct bench_case bench_case = { .engine    = &engines[e],
+                                                         .threads   = threads,
+                                                         .capacity  = capacities[c],
+                                                         .hit_ratio = hit_ratios[h],
+                                                         .ttl_churn = ttl_churns[r] };
+
+                        if (run_case(&config, &bench_case, pool)) failures++;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < MATERIALS_POOL_SIZE; i++) {
+        aws_cryptosdk_enc_materials_destroy(pool[i]);
+    }
+
+    return failures ? 1 : 0;
+}
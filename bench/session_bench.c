@@ -0,0 +1,325 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Throughput and latency benchmark for aws_cryptosdk_session_process.
+ *
+ * Sweeps keyrings, algorithm suites, frame sizes and message sizes, encrypting and then
+ * decrypting whole messages with a single process call each. Results are written to
+ * stdout as JSON lines, one object per (operation, configuration) pair, so that they
+ * can be collected and compared between builds.
+ *
+ * With --alloc-stats, everything allocates through an instrumented allocator, and each line
+ * also reports the allocations one message makes once the session has warmed up, in total and
+ * by the part of the SDK making them.
+ *
+ * Usage: session_bench [--quick] [--min-time-ms N] [--threads N] [--alloc-stats]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aws/common/clock.h>
+#include <aws/common/string.h>
+#include <aws/cryptosdk/alloc_stats.h>
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/raw_aes_keyring.h>
+#include <aws/cryptosdk/session.h>
+
+#include "zero_keyring.h"
+
+AWS_STATIC_STRING_FROM_LITERAL(bench_key_namespace, "bench");
+AWS_STATIC_STRING_FROM_LITERAL(bench_key_name, "bench key");
+
+static const uint8_t bench_wrapping_key[32] = { 0 };
+
+static const char *const keyring_names[] = { "zero", "raw_aes" };
+
+static const enum aws_cryptosdk_alg_id algorithms[] = {
+    ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256,
+    ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384,
+};
+
+static const size_t frame_sizes[]   = { 1024, 4096, 16384, 65536, 262144, 1048576 };
+static const size_t message_sizes[] = { 1024, 65536, 1048576, 16777216 };
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+struct bench_config {
+    uint64_t min_time_ns;
+    size_t worker_threads;
+    bool quick;
+    /* With --alloc-stats, the instrumented allocator everything is created with; otherwise NULL */
+    struct aws_allocator *instrumented;
+};
+
+struct bench_result {
+    uint64_t messages;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    /* Allocations made by one warm message, when config->instrumented is set */
+    struct aws_cryptosdk_alloc_stats allocs;
+};
+
+static struct aws_cryptosdk_keyring *new_keyring(struct aws_allocator *alloc, const char *name) {
+    if (!strcmp(name, "zero")) {
+        return aws_cryptosdk_zero_keyring_new(alloc);
+    }
+
+    return aws_cryptosdk_raw_aes_keyring_new(
+        alloc, bench_key_namespace, bench_key_name, bench_wrapping_key, AWS_CRYPTOSDK_AES256);
+}
+
+static uint64_t now_ns() {
+    uint64_t ticks = 0;
+    aws_high_res_clock_get_ticks(&ticks);
+    return ticks;
+}
+
+/*
+ * Runs one message through the session from a freshly reset state, returning the elapsed time
+ * in nanoseconds (or 0 on failure) and the number of bytes written in *out_len.
+ */
+static uint64_t run_message(
+    struct aws_cryptosdk_session *session,
+    enum aws_cryptosdk_mode mode,
+    const struct bench_config *config,
+    size_t frame_size,
+    uint8_t *out,
+    size_t out_cap,
+    size_t *out_len,
+    const uint8_t *in,
+    size_t in_len) {
+    size_t in_read;
+    uint64_t start = now_ns();
+
+    if (aws_cryptosdk_session_reset(session, mode)) return 0;
+    if (aws_cryptosdk_session_set_worker_threads(session, config->worker_threads)) return 0;
+    if (mode == AWS_CRYPTOSDK_ENCRYPT) {
+        if (aws_cryptosdk_session_set_frame_size(session, (uint32_t)frame_size)) return 0;
+        if (aws_cryptosdk_session_set_message_size(session, in_len)) return 0;
+    }
+
+    if (aws_cryptosdk_session_process(session, out, out_cap, out_len, in, in_len, &in_read)) return 0;
+
+    uint64_t elapsed = now_ns() - start;
+
+    if (!aws_cryptosdk_session_is_done(session) || in_read != in_len) return 0;
+
+    return elapsed ? elapsed : 1;
+}
+
+static int run_op(
+    struct aws_cryptosdk_session *session,
+    enum aws_cryptosdk_mode mode,
+    const struct bench_config *config,
+    size_t frame_size,
+    uint8_t *out,
+    size_t out_cap,
+    size_t *out_len,
+    const uint8_t *in,
+    size_t in_len,
+    struct bench_result *result) {
+    memset(result, 0, sizeof(*result));
+    result->min_ns = UINT64_MAX;
+
+    // Warm up (and check that the configuration works at all)
+    if (!run_message(session, mode, config, frame_size, out, out_cap, out_len, in, in_len)) return -1;
+
+    // Count the allocations of one more message, untimed, as the instrumented allocator takes a lock on each
+    if (config->instrumented) {
+        if (aws_cryptosdk_instrumented_allocator_reset(config->instrumented)) return -1;
+        if (!run_message(session, mode, config, frame_size, out, out_cap, out_len, in, in_len)) return -1;
+        if (aws_cryptosdk_instrumented_allocator_get_stats(config->instrumented, &result->allocs)) return -1;
+    }
+
+    while (result->total_ns < config->min_time_ns || result->messages < 3) {
+        uint64_t elapsed = run_message(session, mode, config, frame_size, out, out_cap, out_len, in, in_len);
+        if (!elapsed) return -1;
+
+        result->messages++;
+        result->total_ns += elapsed;
+        if (elapsed < result->min_ns) result->min_ns = elapsed;
+    }
+
+    return 0;
+}
+
+static void report(
+    const char *op,
+    const char *keyring,
+    enum aws_cryptosdk_alg_id alg_id,
+    const struct bench_config *config,
+    size_t frame_size,
+    size_t message_size,
+    const struct bench_result *result) {
+    const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg_id);
+    double seconds                                   = (double)result->total_ns / 1e9;
+    double mb_per_s = (double)message_size * (double)result->messages / (1024.0 * 1024.0) / seconds;
+
+    printf(
+        "{\"op\":\"%s\",\"keyring\":\"%s\",\"alg\":\"%s\",\"signed\":%s,\"threads\":%zu,"
+        "\"frame_size\":%zu,\"message_size\":%zu,\"messages\":%llu,\"mb_per_s\":%.2f,"
+        "\"latency_ns_mean\":%llu,\"latency_ns_min\":%llu",
+        op,
+        keyring,
+        props->alg_name,
+        props->signature_len ? "true" : "false",
+        config->worker_threads,
+        frame_size,
+        message_size,
+        (unsigned long long)result->messages,
+        mb_per_s,
+        (unsigned long long)(result->total_ns / result->messages),
+        (unsigned long long)result->min_ns);
+
+    if (config->instrumented) {
+        // peak_live_bytes includes what the session, CMM and keyring hold between messages
+        printf(
+            ",\"allocs_per_message\":%llu,\"bytes_per_message\":%llu,\"peak_live_bytes\":%llu,\"allocs_by_tag\":{",
+            (unsigned long long)result->allocs.total.allocs,
+            (unsigned long long)result->allocs.total.bytes,
+            (unsigned long long)result->allocs.total.peak_live_bytes);
+        for (int tag = 0; tag < AWS_CRYPTOSDK_ALLOC_TAG_COUNT; tag++) {
+            printf(
+                "%s\"%s\":%llu",
+                tag ? "," : "",
+                aws_cryptosdk_alloc_tag_name(tag),
+                (unsigned long long)result->allocs.by_tag[tag].allocs);
+        }
+        printf("}");
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+static int bench_case(
+    struct aws_allocator *alloc,
+    const struct bench_config *config,
+    const char *keyring_name,
+    enum aws_cryptosdk_alg_id alg_id,
+    size_t frame_size,
+    size_t message_size) {
+    int rv                                = -1;
+    struct aws_cryptosdk_keyring *kr      = NULL;
+    struct aws_cryptosdk_cmm *cmm         = NULL;
+    struct aws_cryptosdk_session *session = NULL;
+    struct bench_result result;
+
+    // Generous bound on header, per-frame and trailer overhead
+    size_t ct_cap = message_size + (message_size / frame_size + 2) * 64 + 4096;
+    size_t ct_len = 0, pt_len = 0;
+    uint8_t *pt   = malloc(message_size);
+    uint8_t *ct   = malloc(ct_cap);
+    uint8_t *pt2  = malloc(message_size);
+
+    if (!pt || !ct || !pt2) goto out;
+    for (size_t i = 0; i < message_size; i++) pt[i] = (uint8_t)(i * 31 + 7);
+
+    if (!(kr = new_keyring(alloc, keyring_name))) goto out;
+    if (!(cmm = aws_cryptosdk_default_cmm_new(alloc, kr))) goto out;
+    if (aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id)) goto out;
+    if (!(session = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm))) goto out;
+
+    if (run_op(session, AWS_CRYPTOSDK_ENCRYPT, config, frame_size, ct, ct_cap, &ct_len, pt, message_size, &result)) {
+        goto out;
+    }
+    report("encrypt", keyring_name, alg_id, config, frame_size, message_size, &result);
+
+    if (run_op(session, AWS_CRYPTOSDK_DECRYPT, config, frame_size, pt2, message_size, &pt_len, ct, ct_len, &result)) {
+        goto out;
+    }
+    if (pt_len != message_size || memcmp(pt, pt2, message_size)) goto out;
+    report("decrypt", keyring_name, alg_id, config, frame_size, message_size, &result);
+
+    rv = 0;
+
+out:
+    if (rv) {
+        fprintf(
+            stderr,
+            "Benchmark failed: keyring=%s alg=0x%04x frame_size=%zu message_size=%zu: %s\n",
+            keyring_name,
+            (unsigned)alg_id,
+            frame_size,
+            message_size,
+            aws_error_str(aws_last_error()));
+    }
+
+    if (session) aws_cryptosdk_session_destroy(session);
+    if (cmm) aws_cryptosdk_cmm_release(cmm);
+    if (kr) aws_cryptosdk_keyring_release(kr);
+    free(pt);
+    free(ct);
+    free(pt2);
+
+    return rv;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--quick] [--min-time-ms N] [--threads N] [--alloc-stats]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct bench_config config  = { .min_time_ns = 200ull * 1000 * 1000, .worker_threads = 1, .quick = false };
+    int failures                = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) {
+            config.quick       = true;
+            config.min_time_ns = 10ull * 1000 * 1000;
+        } else if (!strcmp(argv[i], "--min-time-ms") && i + 1 < argc) {
+            config.min_time_ns = strtoull(argv[++i], NULL, 10) * 1000 * 1000;
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            config.worker_threads = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--alloc-stats")) {
+            if (!config.instrumented && !(config.instrumented = aws_cryptosdk_instrumented_allocator_new(alloc))) {
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    aws_cryptosdk_load_error_strings();
+    if (config.instrumented) alloc = config.instrumented;
+
+    for (size_t k = 0; k < ARRAY_LEN(keyring_names); k++) {
+        for (size_t a = 0; a < ARRAY_LEN(algorithms); a++) {
+            for (size_t m = 0; m < ARRAY_LEN(message_sizes); m++) {
+                // The quick sweep skips the largest messages, which dominate run time
+                if (config.quick && message_sizes[m] > 1048576) continue;
+
+                for (size_t f = 0; f < ARRAY_LEN(frame_sizes); f++) {
+                    // Frames larger than the message behave the same as frame == message
+                    if (frame_sizes[f] > message_sizes[m]) continue;
+
+                    if (bench_case(alloc, &config, keyring_names[k], algorithms[a], frame_sizes[f], message_sizes[m])) {
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+
+    aws_cryptosdk_instrumented_allocator_destroy(config.instrumented);
+
+    return failures ? 1 : 0;
+}
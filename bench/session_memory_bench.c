@@ -0,0 +1,413 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Peak memory profile of streaming encryption and decryption.
+ *
+ * Streams synthetic messages of up to several gigabytes through an encrypt session and straight
+ * into a decrypt session, a chunk at a time, so that neither the plaintext nor the ciphertext is
+ * ever held in full. Each session allocates through an instrumented allocator of its own, and
+ * the peak live bytes of each are reported as JSON lines, one per (operation, configuration).
+ * Configurations cover tiny and huge frames, one and many EDKs, and empty and large encryption
+ * contexts.
+ *
+ * Each configuration is run with a small message and then a large one. Streaming memory should
+ * depend on the frame size, header and encryption context only, so the run fails if either
+ * session's peak for the large message exceeds that for the small one by more than a sixteenth
+ * plus PEAK_SLACK; that catches buffering which grows with the message.
+ *
+ * The encrypt session pulls its plaintext from an input source and pushes its ciphertext to an
+ * output sink; the decrypt session takes the ciphertext from the caller's buffer and pushes the
+ * plaintext, which is checked, to an output sink. The ciphertext in flight is held in memory
+ * that is not counted.
+ *
+ * Usage: session_memory_bench [--quick] [--max-message-mb N]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <aws/common/clock.h>
+#include <aws/common/string.h>
+#include <aws/cryptosdk/alloc_stats.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/multi_keyring.h>
+#include <aws/cryptosdk/raw_aes_keyring.h>
+#include <aws/cryptosdk/session.h>
+
+AWS_STATIC_STRING_FROM_LITERAL(bench_key_namespace, "bench");
+
+static const uint8_t bench_wrapping_key[32] = { 0 };
+
+static const size_t frame_sizes[]     = { 128, 4194304 };
+static const size_t edk_counts[]      = { 1, 256 };
+static const size_t enc_ctx_entries[] = { 0, 32 };
+
+/* Size of each encryption context value; 32 of them come to about half the limit on the context */
+#define ENC_CTX_VALUE_LEN 1000
+/* Plaintext the encrypt session may pull before the decrypt session catches up */
+#define STREAM_CHUNK (1024 * 1024)
+/* How much more the large message may peak at than the small one: 1/16 of the small one's peak, plus this */
+#define PEAK_SLACK 4096
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+struct stream {
+    uint64_t message_size;
+    /* Plaintext pulled by the encrypt session, and checked on the way out of the decrypt session */
+    uint64_t pt_pulled;
+    uint64_t pt_checked;
+    /* Plaintext the encrypt session may still pull before the decrypt session runs again */
+    size_t budget;
+    /* Ciphertext written by the encrypt session and not yet taken by the decrypt session */
+    uint8_t *ct;
+    size_t ct_len, ct_cap;
+    bool mismatch;
+};
+
+struct profile {
+    uint64_t elapsed_ns;
+    struct aws_cryptosdk_alloc_stats enc_stats;
+    struct aws_cryptosdk_alloc_stats dec_stats;
+};
+
+static uint64_t now_ns() {
+    uint64_t ticks = 0;
+    aws_high_res_clock_get_ticks(&ticks);
+    return ticks;
+}
+
+static uint8_t pattern_at(uint64_t offset) {
+    return (uint8_t)(offset * 31 + 7);
+}
+
+static int pull_plaintext(
+    struct aws_cryptosdk_session *session, uint8_t *buf, size_t len, size_t *out_bytes_read, void *user_data) {
+    struct stream *stream = user_data;
+    uint64_t left         = stream->message_size - stream->pt_pulled;
+    (void)session;
+
+    if (len > stream->budget) len = stream->budget;
+    if (len > left) len = (size_t)left;
+    for (size_t i = 0; i < len; i++) buf[i] = pattern_at(stream->pt_pulled + i);
+
+    stream->pt_pulled += len;
+    stream->budget -= len;
+    *out_bytes_read = len;
+    return AWS_OP_SUCCESS;
+}
+
+static int push_ciphertext(
+    struct aws_cryptosdk_session *session, const struct aws_byte_cursor *segments, size_t count, void *user_data) {
+    struct stream *stream = user_data;
+    (void)session;
+
+    for (size_t i = 0; i < count; i++) {
+        if (stream->ct_len + segments[i].len > stream->ct_cap) {
+            size_t cap  = (stream->ct_len + segments[i].len) * 2;
+            uint8_t *ct = realloc(stream->ct, cap);
+            if (!ct) return aws_raise_error(AWS_ERROR_OOM);
+            stream->ct     = ct;
+            stream->ct_cap = cap;
+        }
+        memcpy(stream->ct + stream->ct_len, segments[i].ptr, segments[i].len);
+        stream->ct_len += segments[i].len;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int check_plaintext(
+    struct aws_cryptosdk_session *session, const struct aws_byte_cursor *segments, size_t count, void *user_data) {
+    struct stream *stream = user_data;
+    (void)session;
+
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < segments[i].len; j++) {
+            if (segments[i].ptr[j] != pattern_at(stream->pt_checked + j)) {
+                stream->mismatch = true;
+                return aws_raise_error(AWS_ERROR_UNKNOWN);
+            }
+        }
+        stream->pt_checked += segments[i].len;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static struct aws_cryptosdk_keyring *new_keyring(struct aws_allocator *alloc, size_t num_edks) {
+    struct aws_cryptosdk_keyring *multi = NULL;
+
+    // A multi-keyring of raw AES keyrings writes one EDK per keyring, and decrypts with the generator
+    for (size_t i = 0; i < num_edks; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "bench key %zu", i);
+        struct aws_string *key_name = aws_string_new_from_c_str(alloc, name);
+        if (!key_name) goto err;
+        struct aws_cryptosdk_keyring *kr = aws_cryptosdk_raw_aes_keyring_new(
+            alloc, bench_key_namespace, key_name, bench_wrapping_key, AWS_CRYPTOSDK_AES256);
+        aws_string_destroy(key_name);
+        if (!kr) goto err;
+
+        if (!multi) {
+            multi = aws_cryptosdk_multi_keyring_new(alloc, kr);
+        } else if (aws_cryptosdk_multi_keyring_add_child(multi, kr)) {
+            aws_cryptosdk_keyring_release(kr);
+            goto err;
+        }
+        aws_cryptosdk_keyring_release(kr);
+        if (!multi) goto err;
+    }
+
+    return multi;
+
+err:
+    aws_cryptosdk_keyring_release(multi);
+    return NULL;
+}
+
+static int fill_enc_ctx(struct aws_allocator *alloc, struct aws_cryptosdk_session *session, size_t entries) {
+    struct aws_hash_table *enc_ctx = aws_cryptosdk_session_get_enc_ctx_ptr_mut(session);
+    char value[ENC_CTX_VALUE_LEN + 1];
+
+    memset(value, 'v', ENC_CTX_VALUE_LEN);
+    value[ENC_CTX_VALUE_LEN] = 0;
+    for (size_t i = 0; i < entries; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "bench-%02zu", i);
+        struct aws_string *k = aws_string_new_from_c_str(alloc, key);
+        struct aws_string *v = aws_string_new_from_c_str(alloc, value);
+        if (!k || !v || aws_hash_table_put(enc_ctx, k, v, NULL)) {
+            aws_string_destroy(k);
+            aws_string_destroy(v);
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Streams one message of message_size bytes from a new encrypt session into a new decrypt
+ * session, recording the peak memory of each.
+ */
+static int run_stream(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_allocator *enc_alloc,
+    struct aws_allocator *dec_alloc,
+    size_t frame_size,
+    size_t enc_ctx_len,
+    uint64_t message_size,
+    struct profile *profile) {
+    int rv                            = AWS_OP_ERR;
+    struct stream stream              = { .message_size = message_size };
+    struct aws_cryptosdk_session *enc = NULL;
+    struct aws_cryptosdk_session *dec = NULL;
+    size_t written, read;
+
+    if (aws_cryptosdk_instrumented_allocator_reset(enc_alloc) ||
+        aws_cryptosdk_instrumented_allocator_reset(dec_alloc)) {
+        return AWS_OP_ERR;
+    }
+
+    uint64_t start = now_ns();
+    if (!(enc = aws_cryptosdk_session_new_from_cmm(enc_alloc, AWS_CRYPTOSDK_ENCRYPT, cmm))) goto out;
+    if (!(dec = aws_cryptosdk_session_new_from_cmm(dec_alloc, AWS_CRYPTOSDK_DECRYPT, cmm))) goto out;
+    if (aws_cryptosdk_session_set_frame_size(enc, (uint32_t)frame_size) ||
+        aws_cryptosdk_session_set_message_size(enc, message_size) ||
+        fill_enc_ctx(enc_alloc, enc, enc_ctx_len) ||
+        aws_cryptosdk_session_set_input_source(enc, pull_plaintext, &stream) ||
+        aws_cryptosdk_session_set_output_sink(enc, push_ciphertext, &stream) ||
+        aws_cryptosdk_session_set_output_sink(dec, check_plaintext, &stream)) {
+        goto out;
+    }
+
+    while (!aws_cryptosdk_session_is_done(dec)) {
+        bool progress = false;
+
+        if (!aws_cryptosdk_session_is_done(enc)) {
+            stream.budget = STREAM_CHUNK;
+            if (aws_cryptosdk_session_process(enc, NULL, 0, &written, NULL, 0, &read)) goto out;
+            // A huge frame may take several chunks of plaintext before any ciphertext comes out
+            progress = written > 0 || stream.budget < STREAM_CHUNK;
+        }
+
+        if (aws_cryptosdk_session_process(dec, NULL, 0, &written, stream.ct, stream.ct_len, &read)) goto out;
+        memmove(stream.ct, stream.ct + read, stream.ct_len - read);
+        stream.ct_len -= read;
+
+        if (!progress && !read && !aws_cryptosdk_session_is_done(dec)) {
+            aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+            goto out;
+        }
+    }
+
+    if (stream.pt_checked != message_size || stream.ct_len) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        goto out;
+    }
+    profile->elapsed_ns = now_ns() - start;
+    rv                  = AWS_OP_SUCCESS;
+
+out:
+    if (stream.mismatch) fprintf(stderr, "Decrypted plaintext does not match\n");
+    if (enc) aws_cryptosdk_session_destroy(enc);
+    if (dec) aws_cryptosdk_session_destroy(dec);
+    free(stream.ct);
+
+    if (!rv && (aws_cryptosdk_instrumented_allocator_get_stats(enc_alloc, &profile->enc_stats) ||
+                aws_cryptosdk_instrumented_allocator_get_stats(dec_alloc, &profile->dec_stats))) {
+        rv = AWS_OP_ERR;
+    }
+    return rv;
+}
+
+static void report(
+    const char *op,
+    size_t frame_size,
+    size_t num_edks,
+    size_t enc_ctx_len,
+    uint64_t message_size,
+    const struct profile *profile,
+    const struct aws_cryptosdk_alloc_stats *stats) {
+    double seconds = (double)profile->elapsed_ns / 1e9;
+
+    printf(
+        "{\"op\":\"%s\",\"frame_size\":%zu,\"edks\":%zu,\"enc_ctx_entries\":%zu,\"message_size\":%llu,"
+        "\"mb_per_s\":%.2f,\"allocs\":%llu,\"peak_live_bytes\":%llu}\n",
+        op,
+        frame_size,
+        num_edks,
+        enc_ctx_len,
+        (unsigned long long)message_size,
+        (double)message_size / (1024.0 * 1024.0) / seconds,
+        (unsigned long long)stats->total.allocs,
+        (unsigned long long)stats->total.peak_live_bytes);
+    fflush(stdout);
+}
+
+static bool peak_grew(const struct aws_cryptosdk_alloc_stats *small, const struct aws_cryptosdk_alloc_stats *large) {
+    uint64_t small_peak = small->total.peak_live_bytes;
+
+    return large->total.peak_live_bytes > small_peak + small_peak / 16 + PEAK_SLACK;
+}
+
+static int profile_case(
+    struct aws_allocator *alloc,
+    size_t frame_size,
+    size_t num_edks,
+    size_t enc_ctx_len,
+    uint64_t small_size,
+    uint64_t large_size) {
+    int rv                           = -1;
+    bool failed_check                = false;
+    struct aws_allocator *enc_alloc  = aws_cryptosdk_instrumented_allocator_new(alloc);
+    struct aws_allocator *dec_alloc  = aws_cryptosdk_instrumented_allocator_new(alloc);
+    struct aws_cryptosdk_keyring *kr = NULL;
+    struct aws_cryptosdk_cmm *cmm    = NULL;
+    struct profile small, large;
+
+    if (!enc_alloc || !dec_alloc) goto out;
+    if (!(kr = new_keyring(alloc, num_edks))) goto out;
+    if (!(cmm = aws_cryptosdk_default_cmm_new(alloc, kr))) goto out;
+
+    if (run_stream(cmm, enc_alloc, dec_alloc, frame_size, enc_ctx_len, small_size, &small)) goto out;
+    report("encrypt", frame_size, num_edks, enc_ctx_len, small_size, &small, &small.enc_stats);
+    report("decrypt", frame_size, num_edks, enc_ctx_len, small_size, &small, &small.dec_stats);
+
+    if (run_stream(cmm, enc_alloc, dec_alloc, frame_size, enc_ctx_len, large_size, &large)) goto out;
+    report("encrypt", frame_size, num_edks, enc_ctx_len, large_size, &large, &large.enc_stats);
+    report("decrypt", frame_size, num_edks, enc_ctx_len, large_size, &large, &large.dec_stats);
+
+    rv = 0;
+    if (peak_grew(&small.enc_stats, &large.enc_stats) || peak_grew(&small.dec_stats, &large.dec_stats)) {
+        rv           = -1;
+        failed_check = true;
+        fprintf(
+            stderr,
+            "Peak memory grew with the message: frame_size=%zu edks=%zu enc_ctx_entries=%zu: "
+            "encrypt %llu -> %llu bytes, decrypt %llu -> %llu bytes\n",
+            frame_size,
+            num_edks,
+            enc_ctx_len,
+            (unsigned long long)small.enc_stats.total.peak_live_bytes,
+            (unsigned long long)large.enc_stats.total.peak_live_bytes,
+            (unsigned long long)small.dec_stats.total.peak_live_bytes,
+            (unsigned long long)large.dec_stats.total.peak_live_bytes);
+    }
+
+out:
+    if (rv && !failed_check) {
+        fprintf(
+            stderr,
+            "Profile failed: frame_size=%zu edks=%zu enc_ctx_entries=%zu: %s\n",
+            frame_size,
+            num_edks,
+            enc_ctx_len,
+            aws_error_str(aws_last_error()));
+    }
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    aws_cryptosdk_instrumented_allocator_destroy(enc_alloc);
+    aws_cryptosdk_instrumented_allocator_destroy(dec_alloc);
+
+    return rv;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--quick] [--max-message-mb N]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    struct aws_allocator *alloc = aws_default_allocator();
+    uint64_t max_message_size   = 4096ull * 1024 * 1024;
+    bool quick                  = false;
+    int failures                = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) {
+            quick = true;
+        } else if (!strcmp(argv[i], "--max-message-mb") && i + 1 < argc) {
+            max_message_size = strtoull(argv[++i], NULL, 10) * 1024 * 1024;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    aws_cryptosdk_load_error_strings();
+
+    for (size_t f = 0; f < ARRAY_LEN(frame_sizes); f++) {
+        // The small message has several frames, so that both messages have full frames and a final one
+        uint64_t small_size = (uint64_t)frame_sizes[f] * 4 + frame_sizes[f] / 2;
+        if (small_size < 1024 * 1024) small_size = 1024 * 1024;
+        // The quick run, which is also the ctest, only needs the large message to be clearly larger
+        uint64_t large_size = quick ? small_size * 8 : max_message_size;
+        if (large_size <= small_size) large_size = small_size * 2;
+
+        for (size_t e = 0; e < ARRAY_LEN(edk_counts); e++) {
+            for (size_t c = 0; c < ARRAY_LEN(enc_ctx_entries); c++) {
+                if (profile_case(alloc, frame_sizes[f], edk_counts[e], enc_ctx_entries[c], small_size, large_size)) {
+                    failures++;
+                }
+            }
+        }
+    }
+
+    return failures ? 1 : 0;
+}
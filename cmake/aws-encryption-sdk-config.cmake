@@ -12,5 +12,18 @@
 # implied. See the License for the specific language governing permissions and
 # limitations under the License.
 
+include(CMakeFindDependencyMacro)
+
 find_package(aws-c-common CONFIG REQUIRED)
+
+# The library links these publicly when it was built with them (see USE_AWS_C_IO and USE_AWS_C_HTTP)
+set(AWS_CRYPTOSDK_BUILT_WITH_AWS_C_IO "@HAVE_AWS_C_IO@")
+if(AWS_CRYPTOSDK_BUILT_WITH_AWS_C_IO)
+    find_dependency(aws-c-io)
+endif()
+set(AWS_CRYPTOSDK_BUILT_WITH_AWS_C_HTTP "@HAVE_AWS_C_HTTP@")
+if(AWS_CRYPTOSDK_BUILT_WITH_AWS_C_HTTP)
+    find_dependency(aws-c-http)
+    find_dependency(aws-c-auth)
+endif()
 include(${CMAKE_CURRENT_LIST_DIR}/@AWS_INSTALL_TARGET@-targets.cmake)
@@ -17,10 +17,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <thread>
+
 #include <aws/core/Aws.h>
 
 #include <aws/cryptosdk/cpp/kms_keyring.h>
 #include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/pipeline.h>
 #include <aws/cryptosdk/session.h>
 
 /* Encrypts or decrypts a file in a streaming way. This is suitable
@@ -58,83 +61,49 @@ static int process_file(
     /* Since the session now holds a reference to the keyring, we can release the local reference. */
     aws_cryptosdk_keyring_release(kms_keyring);
 
-    /* Allocate buffers for input and output.  Note that the initial size is not critical, as we will resize
-     * and reallocate if more space is needed to make progress.
+    /* The pipeline keeps the session's output in a ring of buffers, so that one thread can feed it
+     * the input while another writes out the result; the ring's size bounds the memory used.
      */
-    const size_t INITIAL_CAPACITY = 16 * 1024;
-
-    uint8_t *input_buffer = (uint8_t *)malloc(INITIAL_CAPACITY);
-    size_t input_capacity = INITIAL_CAPACITY;
-    size_t input_len      = 0;
-
-    uint8_t *output_buffer = (uint8_t *)malloc(INITIAL_CAPACITY);
-    size_t output_capacity = INITIAL_CAPACITY;
+    struct aws_cryptosdk_pipeline *pipeline = aws_cryptosdk_pipeline_new(allocator, session, 4);
+    if (!pipeline) abort();
 
-    /* These variables keep a running total of the number of bytes of input consumed and output produced,
-     * while the similarly named variables without "total_" measure the bytes consumed and produced in
-     * a single iteration of the loop.
-     */
+    /* These variables keep a running total of the number of bytes of input consumed and output produced. */
     size_t total_input_consumed  = 0;
     size_t total_output_produced = 0;
 
-    int aws_status;
-    while (!aws_cryptosdk_session_is_done(session)) {
-        if (!feof(input_fp) && (input_len < input_capacity)) {
-            size_t num_read = fread(&input_buffer[input_len], 1, input_capacity - input_len, input_fp);
-            if (ferror(input_fp)) abort();
-            input_len += num_read;
-        }
+    /* The output is written out on a thread of its own, for as long as there is any. */
+    int output_status = 0;
+    std::thread writer([&]() {
+        uint8_t output_buffer[16 * 1024];
+        size_t output_produced;
 
-        /* During encryption, once we know exactly how much plaintext is to be consumed, we call the
-         * set_message_size() function with the exact input size so that the session can be finished.
-         */
-        if ((mode == AWS_CRYPTOSDK_ENCRYPT) && feof(input_fp)) {
-            aws_status = aws_cryptosdk_session_set_message_size(session, total_input_consumed + input_len);
-            if (aws_status) break;
-        }
-
-        size_t output_produced, input_consumed;
-        aws_status = aws_cryptosdk_session_process(
-            session, output_buffer, output_capacity, &output_produced, input_buffer, input_len, &input_consumed);
-        if (aws_status) break;
-        total_input_consumed += input_consumed;
-
-        if ((input_consumed > 0) && (input_consumed < input_len)) {
-            /* If not all input was consumed, move what's left over to the beginning of the buffer. */
-            memmove(input_buffer, &input_buffer[input_consumed], input_len - input_consumed);
-        }
-        input_len -= input_consumed;
-
-        if (output_produced > 0) {
+        while (!(output_status = aws_cryptosdk_pipeline_read(
+                     pipeline, output_buffer, sizeof(output_buffer), &output_produced)) &&
+               output_produced) {
             size_t num_written = fwrite(output_buffer, 1, output_produced, output_fp);
-            if (ferror(output_fp)) abort();
-
-            if (num_written != output_produced) abort();
+            if (ferror(output_fp) || num_written != output_produced) abort();
             total_output_produced += num_written;
         }
+    });
 
-        /* Determine how much buffer space we need to make progress, and resize buffers if necessary. */
-        size_t input_needed, output_needed;
-        aws_cryptosdk_session_estimate_buf(session, &output_needed, &input_needed);
+    /* Input is passed on in pieces of whatever size is convenient; the pipeline buffers what the session
+     * cannot take yet, and holds us back while the writer catches up.
+     */
+    uint8_t input_buffer[16 * 1024];
+    int aws_status = AWS_OP_SUCCESS;
+    while (!aws_status && !feof(input_fp)) {
+        size_t num_read = fread(input_buffer, 1, sizeof(input_buffer), input_fp);
+        if (ferror(input_fp)) abort();
+        aws_status = aws_cryptosdk_pipeline_write(pipeline, input_buffer, num_read);
+        total_input_consumed += num_read;
+    }
 
-        if (!input_consumed && !output_produced && input_capacity >= input_needed && output_capacity >= output_needed) {
-            /* This should be impossible. */
-            fprintf(
-                stderr, "Unexpected error: Encryption SDK made no progress.  Please contact the development team.\n");
-            abort();
-        }
+    /* During encryption, the end of the input fixes the size of the message. */
+    if (!aws_status) aws_status = aws_cryptosdk_pipeline_finish(pipeline);
 
-        if (output_capacity < output_needed) {
-            output_buffer = (uint8_t *)realloc(output_buffer, output_needed);
-            if (!output_buffer) abort();
-            output_capacity = output_needed;
-        }
-        if (input_capacity < input_needed) {
-            input_buffer = (uint8_t *)realloc(input_buffer, input_needed);
-            if (!input_buffer) abort();
-            input_capacity = input_needed;
-        }
-    }
+    writer.join();
+    if (!aws_status) aws_status = output_status;
+    aws_cryptosdk_pipeline_destroy(pipeline);
 
     if (aws_status) {
         fprintf(
@@ -153,8 +122,6 @@ static int process_file(
             output_filename);
     }
 
-    free(input_buffer);
-    free(output_buffer);
     fclose(input_fp);
     fclose(output_fp);
 
@@ -0,0 +1,111 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_ALLOC_STATS_H
+#define AWS_CRYPTOSDK_ALLOC_STATS_H
+
+#include <aws/common/common.h>
+#include <aws/cryptosdk/exports.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The parts of the SDK which allocations made through an instrumented allocator are attributed
+ * to. An allocation is attributed to the innermost part that made it: for example, the strings of
+ * an encryption context parsed from a message header count towards AWS_CRYPTOSDK_ALLOC_ENC_CTX,
+ * and the rest of the header towards AWS_CRYPTOSDK_ALLOC_HEADER. Everything else, such as the
+ * session's own buffers and allocations made by the caller, counts towards AWS_CRYPTOSDK_ALLOC_OTHER.
+ */
+enum aws_cryptosdk_alloc_tag {
+    AWS_CRYPTOSDK_ALLOC_OTHER = 0,
+    /** Message headers, and the EDK lists in them */
+    AWS_CRYPTOSDK_ALLOC_HEADER,
+    /** Encryption contexts, including serialized and frozen ones */
+    AWS_CRYPTOSDK_ALLOC_ENC_CTX,
+    /** The local materials cache and its entries */
+    AWS_CRYPTOSDK_ALLOC_CACHE,
+    /** Keyring calls, including the EDKs and trace entries they produce */
+    AWS_CRYPTOSDK_ALLOC_KEYRING,
+    /** Keys, digests and signing contexts */
+    AWS_CRYPTOSDK_ALLOC_CIPHER,
+    AWS_CRYPTOSDK_ALLOC_TAG_COUNT
+};
+
+struct aws_cryptosdk_alloc_counts {
+    /** Acquisitions, counting each reallocation as one */
+    uint64_t allocs;
+    /** Bytes acquired; a reallocation counts only the bytes it grows by */
+    uint64_t bytes;
+    /** Bytes acquired and not yet released, and the most there were at once */
+    uint64_t live_bytes;
+    uint64_t peak_live_bytes;
+};
+
+struct aws_cryptosdk_alloc_stats {
+    struct aws_cryptosdk_alloc_counts total;
+    struct aws_cryptosdk_alloc_counts by_tag[AWS_CRYPTOSDK_ALLOC_TAG_COUNT];
+};
+
+/**
+ * Creates an allocator which passes every request on to upstream, counting allocations, bytes
+ * and peak live bytes in total and by the part of the SDK making them (see
+ * aws_cryptosdk_alloc_tag). Pass it to sessions, CMMs, keyrings or caches, and read the counts
+ * with @ref aws_cryptosdk_instrumented_allocator_get_stats, for instance to find the allocations
+ * made per message once a session has warmed up.
+ *
+ * Each allocation carries a small prefix recording its size and tag, and counts are kept under a
+ * lock, so this is meant for tests and measurements rather than production use. The allocator is
+ * thread-safe. Memory must be released through the same instrumented allocator it came from.
+ *
+ * @return The new allocator, or NULL on failure (in which case, an AWS error code is set)
+ */
+AWS_CRYPTOSDK_API
+struct aws_allocator *aws_cryptosdk_instrumented_allocator_new(struct aws_allocator *upstream);
+
+/**
+ * Destroys an instrumented allocator. Memory not yet released through it must not be released
+ * afterwards; @ref aws_cryptosdk_instrumented_allocator_get_stats tells whether there is any.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_instrumented_allocator_destroy(struct aws_allocator *alloc);
+
+/**
+ * Copies the counts of an instrumented allocator to *stats. Fails with AWS_ERROR_INVALID_ARGUMENT
+ * if alloc was not created by @ref aws_cryptosdk_instrumented_allocator_new.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_instrumented_allocator_get_stats(
+    struct aws_allocator *alloc, struct aws_cryptosdk_alloc_stats *stats);
+
+/**
+ * Zeroes the allocation and byte counts of an instrumented allocator, so that the next reading
+ * covers only what happens in between. Live bytes are kept, and peak live bytes restart from them.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_instrumented_allocator_reset(struct aws_allocator *alloc);
+
+/**
+ * Returns a short name for tag, such as "header", or NULL if it is out of range.
+ */
+AWS_CRYPTOSDK_API
+const char *aws_cryptosdk_alloc_tag_name(enum aws_cryptosdk_alloc_tag tag);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_ALLOC_STATS_H
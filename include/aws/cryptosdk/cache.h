@@ -69,6 +69,57 @@ struct aws_cryptosdk_materials_cache {
 };
 #endif
 
+/**
+ * Counters describing the use of a materials cache, as returned by @ref
+ * aws_cryptosdk_materials_cache_get_stats. Counts of events are totals since the cache was
+ * created; entries, zombies and bytes are current values. A cache leaves any counter it does not
+ * track at zero.
+ */
+struct aws_cryptosdk_materials_cache_stats {
+    /** Lookups which found encryption or decryption materials, respectively */
+    uint64_t encrypt_hits, decrypt_hits;
+    /** Lookups which found no entry, or only an expired one */
+    uint64_t misses;
+    /** Entries inserted with encryption or decryption materials, respectively */
+    uint64_t encrypt_puts, decrypt_puts;
+    /** Entries evicted to keep the cache within its capacity */
+    uint64_t capacity_evictions;
+    /** Entries removed once their TTL passed */
+    uint64_t ttl_evictions;
+    /**
+     * Entries invalidated by their users; the caching CMM does this when an entry reaches its
+     * usage limits, or is found to have expired
+     */
+    uint64_t invalidations;
+    /** Entries replaced by a newer entry with the same cache ID */
+    uint64_t replacements;
+    /**
+     * Entries removed by @ref aws_cryptosdk_materials_cache_clear or
+     * @ref aws_cryptosdk_materials_cache_invalidate_partition
+     */
+    uint64_t cleared;
+    /** Entries currently in the cache */
+    uint64_t entries;
+    /** Entries removed from the cache but not yet freed, as their users still hold them */
+    uint64_t zombies;
+    /** Approximate memory used by the entries currently in the cache, in bytes */
+    uint64_t bytes;
+    /** Total time threads have spent waiting for the cache's locks, in nanoseconds */
+    uint64_t lock_wait_ns;
+    /** Entries evicted to keep their partition within its quota */
+    uint64_t quota_evictions;
+    /**
+     * For a remote materials cache, lookups which missed its local cache and then found, or did
+     * not find, usable materials in the remote store
+     */
+    uint64_t remote_hits, remote_misses;
+    /**
+     * Removals of entries the local cache did not deliver to its removal callback, as too many
+     * were waiting; see @ref aws_cryptosdk_materials_cache_local_set_removal_callback
+     */
+    uint64_t removals_dropped;
+};
+
 #ifndef AWS_CRYPTOSDK_DOXYGEN
 /**
  * NOTE: The extension API for defining new materials cache is currently considered unstable and
@@ -283,6 +334,54 @@ struct aws_cryptosdk_materials_cache_vt {
      * may be used by referenced entries until released.
      */
     void (*clear)(struct aws_cryptosdk_materials_cache *cache);
+
+    /**
+     * Fills in *stats, which the caller has zeroed, with the counters this cache tracks. Counters
+     * may be read one at a time, so under concurrent use they are not a consistent snapshot.
+     */
+    int (*get_stats)(
+        const struct aws_cryptosdk_materials_cache *cache, struct aws_cryptosdk_materials_cache_stats *stats);
+
+    /**
+     * Gives back usage which was added to this entry's usage stats by update_usage_stats, but
+     * never actually used; *usage_stats is subtracted from the entry's usage stats, and must not
+     * exceed what was added. Caches may ignore this for entries which have been invalidated.
+     */
+    int (*return_usage_stats)(
+        struct aws_cryptosdk_materials_cache *cache,
+        struct aws_cryptosdk_materials_cache_entry *entry,
+        const struct aws_cryptosdk_cache_usage_stats *usage_stats);
+
+    /**
+     * Advises the cache that the selected entry belongs to the given partition, which the caching
+     * CMM identifies by its partition ID. Caches may use this to keep partitions from crowding
+     * each other out. The partition ID need not remain valid once this returns.
+     */
+    void (*entry_partition_hint)(
+        struct aws_cryptosdk_materials_cache *cache,
+        struct aws_cryptosdk_materials_cache_entry *entry,
+        const struct aws_byte_buf *partition_id);
+
+    /**
+     * Invalidates every entry hinted to belong to the given partition, leaving all other entries
+     * in place. This method is threadsafe, with the same caveats as clear.
+     */
+    int (*invalidate_partition)(struct aws_cryptosdk_materials_cache *cache, const struct aws_byte_buf *partition_id);
+
+    /**
+     * Looks up count cache IDs at once, with the same results as calling find_entry for each:
+     * entries[i] receives a handle for cache_ids[i], or NULL if it was not found, and if
+     * is_encrypt is non-NULL, is_encrypt[i] is set as by find_entry. Caches implement this to
+     * share work, such as taking a lock, between the lookups.
+     *
+     * On failure, no handles are returned, and every entries[i] is NULL.
+     */
+    int (*find_entries)(
+        struct aws_cryptosdk_materials_cache *cache,
+        struct aws_cryptosdk_materials_cache_entry **entries,
+        bool *is_encrypt,
+        const struct aws_byte_buf *cache_ids,
+        size_t count);
 };
 
 AWS_CRYPTOSDK_STATIC_INLINE
@@ -305,6 +404,50 @@ int aws_cryptosdk_materials_cache_find_entry(
     return AWS_OP_SUCCESS;
 }
 
+AWS_CRYPTOSDK_STATIC_INLINE
+void aws_cryptosdk_materials_cache_entry_release(
+    struct aws_cryptosdk_materials_cache *cache, struct aws_cryptosdk_materials_cache_entry *entry, bool invalidate);
+
+/**
+ * Looks up count cache IDs, in one call to the cache if it supports batched lookups, or else
+ * one at a time.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE
+int aws_cryptosdk_materials_cache_find_entries(
+    struct aws_cryptosdk_materials_cache *cache,
+    struct aws_cryptosdk_materials_cache_entry **entries,
+    bool *is_encrypt,
+    const struct aws_byte_buf *cache_ids,
+    size_t count) {
+    int (*find_entries)(
+        struct aws_cryptosdk_materials_cache * cache,
+        struct aws_cryptosdk_materials_cache_entry * *entries,
+        bool *is_encrypt,
+        const struct aws_byte_buf *cache_ids,
+        size_t count) = AWS_CRYPTOSDK_PRIVATE_VT_GET_NULL(cache->vt, find_entries);
+
+    if (find_entries) {
+        return find_entries(cache, entries, is_encrypt, cache_ids, count);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        entries[i] = NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (aws_cryptosdk_materials_cache_find_entry(
+                cache, &entries[i], is_encrypt ? &is_encrypt[i] : NULL, &cache_ids[i])) {
+            while (i--) {
+                if (entries[i]) aws_cryptosdk_materials_cache_entry_release(cache, entries[i], false);
+                entries[i] = NULL;
+            }
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
 AWS_CRYPTOSDK_STATIC_INLINE
 int aws_cryptosdk_materials_cache_update_usage_stats(
     struct aws_cryptosdk_materials_cache *cache,
@@ -447,16 +590,314 @@ void aws_cryptosdk_materials_cache_entry_ttl_hint(
     }
 }
 
+AWS_CRYPTOSDK_STATIC_INLINE
+void aws_cryptosdk_materials_cache_entry_partition_hint(
+    struct aws_cryptosdk_materials_cache *cache,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    const struct aws_byte_buf *partition_id) {
+    void (*entry_partition_hint)(
+        struct aws_cryptosdk_materials_cache * cache,
+        struct aws_cryptosdk_materials_cache_entry * entry,
+        const struct aws_byte_buf *partition_id) = AWS_CRYPTOSDK_PRIVATE_VT_GET_NULL(cache->vt, entry_partition_hint);
+
+    if (entry_partition_hint) {
+        entry_partition_hint(cache, entry, partition_id);
+    }
+}
+
 #endif  // AWS_CRYPTOSDK_DOXYGEN (unstable APIs excluded from docs)
 
 /**
  * Creates a new instance of the built-in local materials cache. This cache is thread safe, and uses a simple
- * LRU policy (with capacity shared between encrypt and decrypt) to evict entries.
+ * LRU policy (with capacity shared between encrypt and decrypt) to evict entries. Cache hits only take a
+ * shared lock, and their effect on the LRU order is applied later, so under heavy concurrent use the order
+ * is approximate.
  */
 AWS_CRYPTOSDK_API
 struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new(
     struct aws_allocator *alloc, size_t capacity);
 
+/**
+ * Creates a new instance of the built-in local materials cache, split into num_shards independently
+ * locked shards so that threads using different entries rarely contend for a lock. Each entry is
+ * placed in a shard chosen by its cache ID, and the capacity is divided evenly between the shards,
+ * each of which runs its own LRU eviction; so entries may be evicted while the cache as a whole
+ * holds fewer than capacity entries, if their cache IDs are unevenly spread.
+ *
+ * num_shards is reduced if needed to leave each shard a capacity of at least two entries. With a
+ * single shard, this is equivalent to @ref aws_cryptosdk_materials_cache_local_new.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new_sharded(
+    struct aws_allocator *alloc, size_t capacity, size_t num_shards);
+
+/**
+ * Eviction policies for the local materials cache.
+ */
+enum aws_cryptosdk_local_cache_eviction {
+    /** Evicts the least recently used entry. This is the default. */
+    AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU,
+    /**
+     * Approximates LRU with the CLOCK (second chance) algorithm: a cache hit only sets a reference
+     * bit on the entry, and entries whose bit is set are passed over once when choosing an entry to
+     * evict. Hits then do not write to any memory shared with other entries, which reduces
+     * contention between threads using the same entries.
+     */
+    AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_CLOCK
+};
+
+/**
+ * Sets the eviction policy of a local materials cache, created with @ref
+ * aws_cryptosdk_materials_cache_local_new or @ref aws_cryptosdk_materials_cache_local_new_sharded.
+ * The policy may be changed at any time, and applies to hits and evictions from then on.
+ * Raises AWS_ERROR_INVALID_ARGUMENT for other caches or unknown policies.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_set_eviction(
+    struct aws_cryptosdk_materials_cache *cache, enum aws_cryptosdk_local_cache_eviction eviction);
+
+/**
+ * Limits the memory held by the entries of a local materials cache to roughly byte_limit bytes,
+ * in addition to its capacity in entries. Each entry is accounted at the size of the memory
+ * holding it, its materials, encryption context, encrypted data keys and keyring trace, so entries
+ * with many or large (e.g. RSA) encrypted data keys take up more of the limit. Entries are evicted
+ * as for the capacity, and an entry larger than the limit is not cached at all. In a sharded cache,
+ * each shard gets an equal share of the limit.
+ *
+ * Lowering the limit evicts entries immediately. A limit of zero, the default, removes the limit.
+ * Raises AWS_ERROR_INVALID_ARGUMENT for other caches.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_set_byte_limit(struct aws_cryptosdk_materials_cache *cache, size_t byte_limit);
+
+/**
+ * Limits the number of entries each partition may hold in a local materials cache to roughly
+ * quota, so that several caching CMMs with different partition IDs can share the cache without
+ * one of them evicting the entries of all the others. The entries of each partition are kept in
+ * an LRU list of their own, and once a partition exceeds its quota, its own least recently used
+ * entries are evicted, whatever the state of the rest of the cache. The capacity and byte limit
+ * still apply to the cache as a whole. In a sharded cache, each shard gets an equal share of the
+ * quota.
+ *
+ * Entries are assigned to partitions by the caching CMM that inserts them; entries inserted
+ * otherwise belong to no partition, and are subject only to the overall limits.
+ *
+ * Lowering the quota evicts entries immediately. A quota of zero, the default, removes it.
+ * Raises AWS_ERROR_INVALID_ARGUMENT for other caches.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_set_partition_quota(struct aws_cryptosdk_materials_cache *cache, size_t quota);
+
+/**
+ * Changes the capacity of a local materials cache, dividing it between the shards as the
+ * constructor does. Lowering the capacity evicts entries immediately; raising it regrows the
+ * cache's tables, and raises an error leaving some shards at their old capacity if that fails.
+ * Raises AWS_ERROR_INVALID_ARGUMENT for other caches.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_set_capacity(struct aws_cryptosdk_materials_cache *cache, size_t capacity);
+
+/**
+ * Returns the current capacity of a local materials cache, or 0 for other caches.
+ */
+AWS_CRYPTOSDK_API
+size_t aws_cryptosdk_materials_cache_local_get_capacity(const struct aws_cryptosdk_materials_cache *cache);
+
+/**
+ * Turns on automatic tuning of the capacity of a local materials cache, within min_capacity and
+ * max_capacity entries, or off if max_capacity is zero. The cache then remembers the cache IDs of
+ * entries it recently evicted to make room, and counts misses on them as ghost hits: hits a larger
+ * cache would have had. Each tuning pass grows the capacity by a quarter while ghost hits make up a
+ * significant share of lookups, and shrinks it by a quarter when there were none and less than half
+ * the capacity is in use. If byte_ceiling is nonzero, the capacity is also kept low enough that that
+ * many entries of the current average size fit in byte_ceiling bytes; unlike the byte limit, this
+ * does not evict entries itself, except by lowering the capacity.
+ *
+ * Passes run as part of maintenance (see @ref aws_cryptosdk_materials_cache_local_start_maintenance),
+ * or whenever @ref aws_cryptosdk_materials_cache_local_tune_capacity is called. Raises
+ * AWS_ERROR_INVALID_ARGUMENT for other caches, or if min_capacity exceeds max_capacity.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_set_auto_capacity(
+    struct aws_cryptosdk_materials_cache *cache, size_t min_capacity, size_t max_capacity, size_t byte_ceiling);
+
+/**
+ * Runs one capacity tuning pass over a local materials cache, for applications which do not run
+ * maintenance. Does nothing unless automatic tuning is on, or if too few lookups have been made
+ * since the last pass to judge by. Raises AWS_ERROR_INVALID_ARGUMENT for other caches.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_tune_capacity(struct aws_cryptosdk_materials_cache *cache);
+
+/**
+ * Why an entry left a local materials cache.
+ */
+enum aws_cryptosdk_local_cache_removal_reason {
+    /** Evicted to keep the cache within its capacity or byte limit */
+    AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_CAPACITY,
+    /** Removed once its TTL passed */
+    AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_EXPIRED,
+    /** Evicted to keep its partition within its quota */
+    AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_QUOTA,
+    /**
+     * Invalidated by its user; the caching CMM does this when an entry reaches its usage limits,
+     * or is found to have expired
+     */
+    AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_INVALIDATED,
+    /** Replaced by a newer entry with the same cache ID */
+    AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_REPLACED,
+    /**
+     * Removed by @ref aws_cryptosdk_materials_cache_clear or
+     * @ref aws_cryptosdk_materials_cache_invalidate_partition
+     */
+    AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_CLEARED
+};
+
+/**
+ * An entry which left a local materials cache. The cursors are only valid during the callback.
+ */
+struct aws_cryptosdk_local_cache_removal {
+    enum aws_cryptosdk_local_cache_removal_reason reason;
+    /** Whether the entry held encryption materials, rather than decryption materials */
+    bool is_encrypt;
+    struct aws_byte_cursor cache_id;
+    /** The partition ID the entry was inserted with, or an empty cursor if none */
+    struct aws_byte_cursor partition_id;
+};
+
+/**
+ * Invoked for each entry removed from a local materials cache; see
+ * @ref aws_cryptosdk_materials_cache_local_set_removal_callback.
+ */
+typedef void(aws_cryptosdk_local_cache_removal_fn)(
+    const struct aws_cryptosdk_local_cache_removal *removal, void *user_data);
+
+/**
+ * Registers a callback to be told of every entry which leaves a local materials cache, and why,
+ * for metrics, refreshing entries ahead of their expiry, or demoting them to another cache.
+ * Passing NULL for on_removal stops this. Without a callback, removals cost no more than before.
+ *
+ * Removals are not delivered as they happen, which would hold up the thread removing the entry:
+ * each shard queues them, and they are delivered on each maintenance pass (see @ref
+ * aws_cryptosdk_materials_cache_local_start_maintenance), or whenever @ref
+ * aws_cryptosdk_materials_cache_local_deliver_removals is called. The callback is never called
+ * with any of the cache's locks held, so it may use the cache; but it must not call this function
+ * or aws_cryptosdk_materials_cache_local_deliver_removals. Removals still queued when the cache is
+ * destroyed are never delivered, and a shard with too many undelivered removals drops further
+ * ones, counting them in removals_dropped.
+ *
+ * Raises AWS_ERROR_INVALID_ARGUMENT for other caches.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_set_removal_callback(
+    struct aws_cryptosdk_materials_cache *cache, aws_cryptosdk_local_cache_removal_fn *on_removal, void *user_data);
+
+/**
+ * Delivers the removals queued in a local materials cache to its removal callback, on the calling
+ * thread, for applications which do not run maintenance. Raises AWS_ERROR_INVALID_ARGUMENT for
+ * other caches.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_deliver_removals(struct aws_cryptosdk_materials_cache *cache);
+
+/**
+ * Makes a local materials cache read the time for its TTL checks from a coarse clock, which a
+ * background thread shared by the whole process updates every precision units, instead of asking
+ * the system clock on every lookup and insertion. Entries may then be treated as live for up to
+ * one precision after they expire. A precision of zero, the default, returns to the system clock.
+ *
+ * This should be called before the cache is shared with other threads. Raises
+ * AWS_ERROR_INVALID_ARGUMENT for other caches or invalid units.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_set_clock_precision(
+    struct aws_cryptosdk_materials_cache *cache, uint64_t precision, enum aws_timestamp_unit units);
+
+/**
+ * Starts a background thread which maintains a local materials cache every interval nanoseconds:
+ * it removes expired entries, applies the LRU effect of recent cache hits, evicts entries beyond
+ * the capacity, tunes the capacity if that is turned on, and delivers removals to the removal
+ * callback, if any. Threads using the cache then no longer remove expired entries themselves, so
+ * a burst of expiries does not delay their requests; expired entries are still never returned.
+ * Insertions into a full cache still evict the one entry needed to make room.
+ *
+ * The thread is stopped when the cache is destroyed. Raises AWS_ERROR_INVALID_ARGUMENT for other
+ * caches or a zero interval, and AWS_CRYPTOSDK_ERR_BAD_STATE if maintenance is already running.
+ * This function must not be called concurrently with itself on the same cache.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_materials_cache_local_start_maintenance(
+    struct aws_cryptosdk_materials_cache *cache, uint64_t interval);
+
+/**
+ * Creates a materials cache held in shared memory, which is shared with every process forked from
+ * the creating process after this call; so a pre-forking server's workers can reuse each other's
+ * data keys. The cache holds up to capacity entries, each stored in a fixed slot of slot_size bytes
+ * (at least 512), which must be large enough for the entry's serialized materials, including its
+ * encryption context and encrypted data keys; larger entries are not cached. An entry's cache ID
+ * may only be stored in one of a few slots, so entries may be evicted before the cache is full.
+ *
+ * Each process destroys its own reference to the cache; the shared memory is released once every
+ * process has done so or exited. A process which dies while using the cache does not leave it
+ * locked on Linux, where the lock is robust. On Windows, raises AWS_ERROR_UNSUPPORTED_OPERATION.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_shm_new(
+    struct aws_allocator *alloc, size_t capacity, size_t slot_size);
+
+/**
+ * The connection to a shared key-value store, such as Redis or memcached, used by a remote
+ * materials cache. The SDK does not speak the store's protocol itself: the application provides
+ * these callbacks using the client library of its choice. Keys are printable ASCII of at most
+ * 142 bytes, so they are valid memcached keys; values are opaque bytes. The callbacks may be
+ * called from several threads at once.
+ */
+struct aws_cryptosdk_remote_cache_store {
+    /** Passed to each of the callbacks */
+    void *ctx;
+    /**
+     * Fetches the value stored under key into *value, which the callback initializes with alloc
+     * (as for Redis GET or memcached get). If no value is stored, leaves *value zeroed and succeeds.
+     */
+    int (*get)(void *ctx, struct aws_allocator *alloc, struct aws_byte_cursor key, struct aws_byte_buf *value);
+    /**
+     * Stores value under key, to expire after ttl_secs seconds (as for Redis SET with EX, or
+     * memcached set).
+     */
+    int (*set)(void *ctx, struct aws_byte_cursor key, struct aws_byte_cursor value, uint64_t ttl_secs);
+    /** If not NULL, called once the cache is destroyed, to release ctx */
+    void (*destroy)(void *ctx);
+};
+
+/**
+ * Creates a two-tier materials cache, which holds its entries in local (such as a cache from
+ * @ref aws_cryptosdk_materials_cache_local_new), and also shares decryption materials with other
+ * hosts through store. Decryption materials put in the cache are written to the store as well,
+ * and a lookup which misses the local cache is tried in the store, whose materials are then
+ * added to the local cache; so a data key decrypted by one host of a fleet need not be decrypted
+ * by the others.
+ *
+ * Values are sealed with AES-GCM under wrapping_key, which must be 16, 24 or 32 bytes long and
+ * shared by every host using the store, so the store never sees a plaintext data key; values
+ * that do not open under the key are treated as misses. Entries expire from the store after
+ * ttl_secs seconds, which must not be zero and should be no longer than the TTL of the caching
+ * CMMs using the cache, as materials fetched from the store start a new TTL in the local cache.
+ * Entries are only ever removed from the store by expiry: invalidating, clearing or partition
+ * invalidation only apply to the local cache.
+ *
+ * Encryption materials are only held in the local cache, as their usage limits are counted per
+ * cache. The cache holds a reference to local; on success, it also takes ownership of store's
+ * ctx, which it releases with store's destroy callback. Failures of the store are treated as
+ * misses, and counted in the remote_misses of @ref aws_cryptosdk_materials_cache_get_stats.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_remote_new(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_materials_cache *local,
+    const struct aws_cryptosdk_remote_cache_store *store,
+    struct aws_byte_cursor wrapping_key,
+    uint64_t ttl_secs);
+
 /**
  * Returns an estimate of the number of entries in the cache. If a size estimate is not available,
  * returns SIZE_MAX.
@@ -473,6 +914,48 @@ size_t aws_cryptosdk_materials_cache_entry_count(const struct aws_cryptosdk_mate
     return entry_count(cache);
 }
 
+/**
+ * Fills in *stats with the counters kept by the cache; see @ref aws_cryptosdk_materials_cache_stats.
+ * Raises AWS_ERROR_UNSUPPORTED_OPERATION, leaving every counter zero, if the cache keeps none.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE
+int aws_cryptosdk_materials_cache_get_stats(
+    const struct aws_cryptosdk_materials_cache *cache, struct aws_cryptosdk_materials_cache_stats *stats) {
+    int (*get_stats)(
+        const struct aws_cryptosdk_materials_cache *cache, struct aws_cryptosdk_materials_cache_stats *stats) =
+        AWS_CRYPTOSDK_PRIVATE_VT_GET_NULL(cache->vt, get_stats);
+    struct aws_cryptosdk_materials_cache_stats zero = { 0 };
+
+    *stats = zero;
+    if (!get_stats) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    return get_stats(cache, stats);
+}
+
+/**
+ * Gives back usage previously added to the entry with @ref aws_cryptosdk_materials_cache_update_usage_stats
+ * which was never used. Raises AWS_ERROR_UNSUPPORTED_OPERATION if the cache does not support this.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE
+int aws_cryptosdk_materials_cache_return_usage_stats(
+    struct aws_cryptosdk_materials_cache *cache,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    const struct aws_cryptosdk_cache_usage_stats *usage_stats) {
+    int (*return_usage_stats)(
+        struct aws_cryptosdk_materials_cache * cache,
+        struct aws_cryptosdk_materials_cache_entry * entry,
+        const struct aws_cryptosdk_cache_usage_stats *usage_stats) =
+        AWS_CRYPTOSDK_PRIVATE_VT_GET_NULL(cache->vt, return_usage_stats);
+
+    if (!return_usage_stats) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    return return_usage_stats(cache, entry, usage_stats);
+}
+
 /**
  * Attempts to clear all entries in the cache. This method is threadsafe, though any entries
  * being inserted in parallel with the clear operation may not end up being cleared.
@@ -486,6 +969,25 @@ void aws_cryptosdk_materials_cache_clear(struct aws_cryptosdk_materials_cache *c
     }
 }
 
+/**
+ * Invalidates the entries of one partition, as identified by the caching CMMs using it (see @ref
+ * aws_cryptosdk_caching_cmm_invalidate_partition), without disturbing the entries of any other
+ * partition. This is cheaper than clearing the whole cache when one tenant's data keys must be
+ * rotated. Raises AWS_ERROR_UNSUPPORTED_OPERATION if the cache does not track partitions.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE
+int aws_cryptosdk_materials_cache_invalidate_partition(
+    struct aws_cryptosdk_materials_cache *cache, const struct aws_byte_buf *partition_id) {
+    int (*invalidate_partition)(struct aws_cryptosdk_materials_cache * cache, const struct aws_byte_buf *partition_id) =
+        AWS_CRYPTOSDK_PRIVATE_VT_GET_NULL(cache->vt, invalidate_partition);
+
+    if (!invalidate_partition) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    return invalidate_partition(cache, partition_id);
+}
+
 /**
  * Increments the reference count on the materials cache
  */
@@ -577,6 +1079,17 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_keyring(
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_caching_cmm_set_ttl(struct aws_cryptosdk_cmm *cmm, uint64_t ttl, enum aws_timestamp_unit ttl_units);
 
+/**
+ * Enables TTL jitter: each cache entry expires early by a random amount of up to jitter_percent
+ * percent of the TTL, fixed when the entry is created. Entries created together, such as those of
+ * a warm-up burst, then expire, and are fetched again from the upstream CMM, spread out over time
+ * rather than all at once. The TTL remains the longest that any data key is used for.
+ *
+ * jitter_percent must be below 100; zero disables jitter, which is the default.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_ttl_jitter(struct aws_cryptosdk_cmm *cmm, uint32_t jitter_percent);
+
 /**
  * Configures the maximum number of bytes that may be encrypted by a single data key.
  * This value has a maximum of 2^63 - 1 (i.e., INT64_MAX, *not* UINT64_MAX)
@@ -591,6 +1104,219 @@ int aws_cryptosdk_caching_cmm_set_limit_bytes(struct aws_cryptosdk_cmm *cmm, uin
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_caching_cmm_set_limit_messages(struct aws_cryptosdk_cmm *cmm, uint64_t limit_messages);
 
+/**
+ * Enables refresh-ahead of encryption materials: once a cached data key has used refresh_percent
+ * percent of its TTL, message limit or byte limit, a background thread requests new materials
+ * from the upstream CMM and replaces the entry with them, so that requests keep hitting the cache
+ * instead of waiting on the upstream CMM when the old entry expires. The old data key remains
+ * usable until then. The thread is started on first use, and stops when the CMM is destroyed.
+ *
+ * refresh_percent must be below 100; zero disables refresh-ahead, which is the default.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_refresh_ahead(struct aws_cryptosdk_cmm *cmm, uint32_t refresh_percent);
+
+/**
+ * Enables leasing of usage budgets: rather than adding the usage of every message to the shared
+ * usage stats of the cache entry it uses, each thread leases the budget for lease_messages
+ * messages (and as many bytes as that many messages of the current size) from the entry at a
+ * time, and counts its messages against the lease. When a thread moves to another entry, the
+ * unused part of its lease is given back. Leases never exceed the configured limits, so those
+ * stay exact, though an entry may be exhausted while another thread still holds part of its
+ * budget. This takes contended atomic operations off the cache hit path, which helps when many
+ * threads encrypt with the same data key.
+ *
+ * lease_messages may not exceed AWS_CRYPTOSDK_CACHE_MAX_LIMIT_MESSAGES; values below 2 disable
+ * leasing, which is the default.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_usage_lease(struct aws_cryptosdk_cmm *cmm, uint64_t lease_messages);
+
+/**
+ * Enables negative caching of decryption requests: when the upstream CMM fails a request with
+ * AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT, requests for the same EDKs, algorithm and encryption context
+ * fail with that error for the given time, without calling the upstream CMM. This keeps replays
+ * of a message no keyring can decrypt from reaching the key provider each time. Only the most
+ * recent few such requests are remembered, and other upstream failures are never cached.
+ *
+ * A ttl of zero disables negative caching, which is the default, and forgets any remembered
+ * requests.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_negative_ttl(
+    struct aws_cryptosdk_cmm *cmm, uint64_t ttl, enum aws_timestamp_unit ttl_units);
+
+/**
+ * Enables write-through caching of decryption materials: whenever the caching CMM gets new
+ * encryption materials from the upstream CMM, it also caches the decryption materials for
+ * messages encrypted with them, as if such a message had already been decrypted once. Reading
+ * back data shortly after writing it then hits the cache, instead of asking the upstream CMM
+ * (and so, typically, a key provider) to decrypt a data key that was generated moments before.
+ *
+ * The decryption entries are subject to the same TTL as any other. Their keyring trace records
+ * the first wrapping key that encrypted the data key as having decrypted it. Disabled by default.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_write_through(struct aws_cryptosdk_cmm *cmm, bool enabled);
+
+/**
+ * Warms the materials cache up for decrypting messages with the given headers, such as a
+ * manifest of the headers of recently written messages, so that the first decryption of each
+ * after a deployment does not wait on the upstream CMM. Each of headers holds a serialized
+ * message header (anything following it is ignored); the decryption materials for its EDKs,
+ * algorithm suite and encryption context are looked up as a decryption of the message would,
+ * and fetched from the upstream CMM on a miss. Headers sharing a data key are only fetched once.
+ *
+ * The headers are spread over num_threads threads, the calling thread included, and this
+ * function returns once all have been processed. Headers which cannot be parsed, use an
+ * algorithm suite that is never cached, or whose materials the upstream CMM fails to return,
+ * are skipped; if num_warmed is not NULL, it receives the number of headers whose materials were
+ * found or fetched.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_prewarm_decrypt(
+    struct aws_cryptosdk_cmm *cmm,
+    const struct aws_byte_cursor *headers,
+    size_t num_headers,
+    size_t num_threads,
+    size_t *num_warmed);
+
+/**
+ * Gets the decryption materials for count decrypt requests at once, as count calls to
+ * @ref aws_cryptosdk_cmm_decrypt_materials would, but sharing work between them: the cache IDs
+ * are all computed in one pass, and looked up in one call to the materials cache (see
+ * aws_cryptosdk_materials_cache_find_entries), so that the local cache takes each shard's lock
+ * once for the whole batch. Misses are then fetched from the upstream CMM in order, so requests
+ * sharing a data key need only one upstream call between them. Requests for algorithm suites that
+ * are never cached go straight to the upstream CMM.
+ *
+ * outputs[i] receives the materials for requests[i], or NULL if that request failed, in which
+ * case errors[i] (if errors is not NULL) receives its error code; errors[i] is zero for requests
+ * which succeeded. The caller owns, and must destroy, every non-NULL output, whether or not this
+ * function succeeds. Returns AWS_OP_ERR, with the error of the first request that failed, if any
+ * request failed.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_decrypt_materials_batch(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_dec_materials **outputs,
+    struct aws_cryptosdk_dec_request *requests,
+    int *errors,
+    size_t count);
+
+/**
+ * The largest number of data keys that may be kept live for each distinct encryption request;
+ * see @ref aws_cryptosdk_caching_cmm_set_key_pool.
+ */
+#define AWS_CRYPTOSDK_CACHE_MAX_KEY_POOL 256
+
+/**
+ * How the caching CMM chooses among the data keys of a key pool.
+ */
+enum aws_cryptosdk_key_pool_selection {
+    /** Each request uses the next key of the pool in turn. This is the default. */
+    AWS_CRYPTOSDK_KEY_POOL_ROUND_ROBIN,
+    /**
+     * Each thread always uses the same key of the pool, chosen by a hash of its thread ID, so
+     * that threads encrypting in parallel mostly touch different cache entries.
+     */
+    AWS_CRYPTOSDK_KEY_POOL_THREAD_AFFINITY
+};
+
+/**
+ * Keeps up to pool_size data keys live for each distinct encryption request (that is, each
+ * partition and encryption context) instead of one, and spreads requests over them as chosen by
+ * selection. Each key of the pool is cached under its own cache ID and has its own usage limits
+ * and TTL, so usage is no longer counted on one entry shared by every thread.
+ *
+ * When a key of the pool is first created, it is charged a proportional share of the message
+ * limit up front (none for the first key, 1/pool_size of the limit for the second, and so on), so
+ * that the keys of a pool reach the message limit, and fetch new materials from the upstream CMM,
+ * one at a time rather than all at once. Keys of a pool are otherwise not invalidated on exactly
+ * reaching the message limit, but on the request after, so that their successors are not charged
+ * this share again.
+ *
+ * pool_size must be between 1 and AWS_CRYPTOSDK_CACHE_MAX_KEY_POOL; 1, the default, disables
+ * pooling.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_key_pool(
+    struct aws_cryptosdk_cmm *cmm, uint32_t pool_size, enum aws_cryptosdk_key_pool_selection selection);
+
+/**
+ * Invalidates every entry of this CMM's partition in its materials cache, so that its next
+ * requests fetch new materials from the upstream CMM, while other partitions sharing the cache
+ * keep theirs. Entries still in use by sessions stay usable for those sessions. Raises
+ * AWS_ERROR_UNSUPPORTED_OPERATION if the cache does not track partitions.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_invalidate_partition(struct aws_cryptosdk_cmm *cmm);
+
+/**
+ * Makes the caching CMM check the TTL of cache entries against a coarse clock, which a background
+ * thread shared by the whole process updates every precision units, instead of asking the system
+ * clock on every request. Entries may then be used for up to one precision past their TTL. A
+ * precision of zero, the default, returns to the system clock. The clock of the materials cache
+ * is set separately; see @ref aws_cryptosdk_materials_cache_local_set_clock_precision.
+ *
+ * This should be called before the CMM is shared with other threads.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_clock_precision(
+    struct aws_cryptosdk_cmm *cmm, uint64_t precision, enum aws_timestamp_unit units);
+
+/**
+ * One request to a caching CMM, as passed to a request recorder (see @ref
+ * aws_cryptosdk_caching_cmm_set_request_recorder). Records hold nothing that identifies the
+ * caller's data: requests are told apart only by a hash of their cache ID, which is itself a
+ * SHA-512 digest of the partition ID, algorithm suite and encryption context (and, for decryption,
+ * the EDKs), so a trace of them can be kept and shared to size caches and usage limits offline.
+ */
+struct aws_cryptosdk_caching_cmm_request_record {
+    /** When the request was made, in nanoseconds of the CMM's clock */
+    uint64_t timestamp;
+    /** The first eight bytes of the request's cache ID, read as a big-endian integer */
+    uint64_t cache_id_hash;
+    /** For encryption, the plaintext size given in the request (its upper bound); 0 for decryption */
+    uint64_t bytes;
+    bool is_encrypt;
+};
+
+typedef void(aws_cryptosdk_caching_cmm_request_recorder_fn)(
+    const struct aws_cryptosdk_caching_cmm_request_record *record, void *user_data);
+
+/**
+ * Calls recorder with each request made of the caching CMM which it looks up in its materials
+ * cache, before the lookup, on the thread making the request. Requests which bypass the cache
+ * (those for uncachable algorithm suites, or larger than the byte limit) and refresh-ahead requests
+ * made by the CMM itself are not recorded. The recorder must be thread safe if the CMM is used by
+ * several threads, and should be quick, as requests wait for it. Passing NULL stops recording.
+ *
+ * The cache_replay tool in the bench directory replays such traces against local caches of other
+ * capacities, TTLs, usage limits and eviction policies.
+ *
+ * This should be called before the CMM is shared with other threads.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_request_recorder(
+    struct aws_cryptosdk_cmm *cmm, aws_cryptosdk_caching_cmm_request_recorder_fn *recorder, void *user_data);
+
+/**
+ * Has the caching CMM hash the EDKs of decryption requests with provider (see struct
+ * aws_cryptosdk_digest_provider_vt), which is handed up to AWS_CRYPTOSDK_DIGEST_MAX_OPS EDKs at a
+ * time, to compute cache IDs. Every EDK of a request, or of all the requests of a call to @ref
+ * aws_cryptosdk_caching_cmm_decrypt_materials_batch, is hashed before any cache ID is derived,
+ * so that a multi-buffer implementation can hash multi-region messages' EDKs together. Cache IDs
+ * are the same whichever provider computes them. Passing NULL restores the default: the digest
+ * kernel selected for the process, if any (see @ref aws_cryptosdk_select_kernels), or else
+ * hashing each EDK in turn.
+ *
+ * This should be called before the CMM is shared with other threads.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_caching_cmm_set_digest_provider(
+    struct aws_cryptosdk_cmm *cmm, const struct aws_cryptosdk_digest_provider_vt *provider);
+
 AWS_EXTERN_C_END
 
 /** @} */  // doxygen group caching
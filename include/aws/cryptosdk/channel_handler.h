@@ -0,0 +1,101 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_CHANNEL_HANDLER_H
+#define AWS_CRYPTOSDK_CHANNEL_HANDLER_H
+
+#include <aws/cryptosdk/exports.h>
+#include <aws/cryptosdk/session.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct aws_channel_handler;
+
+/**
+ * @ingroup session
+ * Settings for @ref aws_cryptosdk_channel_handler_new. Zero-initialize the struct, then set
+ * the session for at least one direction.
+ */
+struct aws_cryptosdk_channel_handler_options {
+    /**
+     * Processes the data read from the channel, on its way from the socket to the application,
+     * or NULL to pass it through unchanged. Usually a decrypt session.
+     */
+    struct aws_cryptosdk_session *read_session;
+    /**
+     * Processes the data written to the channel, on its way from the application to the
+     * socket, or NULL to pass it through unchanged. Usually an encrypt session.
+     */
+    struct aws_cryptosdk_session *write_session;
+    /**
+     * Most unprocessed input the handler holds in the read direction, which is its initial read
+     * window, or 0 for the default of 64 KiB. The window grows past this if a frame is larger.
+     */
+    size_t initial_window_size;
+};
+
+/**
+ * @ingroup session
+ * Creates an aws-c-io channel handler which runs a session over the data flowing through its
+ * slot, in each direction that has one, in the way the TLS handler encrypts and decrypts. Put
+ * it between the socket (or TLS) handler and the application's handler, and the application
+ * reads and writes plaintext while ciphertext goes over the wire.
+ *
+ * Each incoming message is handed to the session as it is; the session's output is written
+ * straight into messages from the channel's pool, and nothing is copied in between, except for
+ * the occasional frame that spans two messages or does not fit in one. Incoming messages are
+ * held until the session has consumed them, and in the read direction, the session only runs
+ * while the downstream handler's read window has room for its output, and the handler only
+ * opens its own window as it consumes input, so that backpressure reaches the socket.
+ *
+ * Each session processes exactly one message, and must be ready for it; settings such as the
+ * message size may be applied beforehand. An encrypt session which does not know its message
+ * size ends the message when its direction of the channel shuts down cleanly. A message cut
+ * short by a clean shutdown, or followed by more data, shuts the channel down with
+ * AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT when decrypting, or with AWS_CRYPTOSDK_ERR_BAD_STATE or
+ * AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED respectively when encrypting; so does any error raised by a
+ * session. As with @ref aws_cryptosdk_session_process, decrypted plaintext is passed on before
+ * a trailing signature has been checked.
+ *
+ * The sessions remain the caller's, and must outlive the handler. To use asynchronous
+ * materials requests, set an async callback on a session before creating the handler, and
+ * call @ref aws_cryptosdk_channel_handler_resume from it.
+ *
+ * On success, the caller owns the handler until it is set on a channel slot; the channel then
+ * destroys it along with the slot. Raises AWS_ERROR_INVALID_ARGUMENT if neither session is
+ * set, and AWS_ERROR_UNSUPPORTED_OPERATION if the library was built without aws-c-io.
+ *
+ * @return The new handler, or NULL on failure (in which case, an AWS error code is set)
+ */
+AWS_CRYPTOSDK_API
+struct aws_channel_handler *aws_cryptosdk_channel_handler_new(
+    struct aws_allocator *alloc, const struct aws_cryptosdk_channel_handler_options *options);
+
+/**
+ * @ingroup session
+ * Schedules the handler to run its sessions again on the channel's thread, after an
+ * asynchronous materials request completes. This may be called from any thread, while the
+ * handler is on a channel that has not been destroyed.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_channel_handler_resume(struct aws_channel_handler *handler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_CHANNEL_HANDLER_H
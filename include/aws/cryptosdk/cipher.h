@@ -107,6 +107,333 @@ const struct aws_cryptosdk_alg_properties *aws_cryptosdk_alg_props(enum aws_cryp
 AWS_CRYPTOSDK_API
 bool aws_cryptosdk_alg_properties_is_valid(const struct aws_cryptosdk_alg_properties *const alg_props);
 
+/**
+ * One of several independent AES-GCM operations handed to a provider's seal_many or open_many.
+ * Each has its own key context, IV and AAD; the provider sets error for each.
+ */
+struct aws_cryptosdk_gcm_op {
+    void *key_ctx;
+    uint8_t *out;
+    const uint8_t *in;
+    size_t len;
+    const uint8_t *iv;
+    const uint8_t *aad;
+    size_t aad_len;
+    /** Written when sealing, checked when opening */
+    uint8_t *tag;
+    /** Set by the provider to AWS_ERROR_SUCCESS, or to the error code the operation failed with */
+    int error;
+};
+
+/** The most operations passed to a single seal_many or open_many call */
+#define AWS_CRYPTOSDK_GCM_MAX_OPS 8
+
+/**
+ * A pluggable AES-GCM implementation, used to encrypt and decrypt message body frames, and
+ * to compute and check the header authentication tag (as a seal or open of zero bytes, with
+ * the header as AAD) under the same keyed context. All algorithm suites currently supported
+ * use a 12-byte IV and a 16-byte tag with content keys of 16, 24 or 32 bytes; providers need
+ * not support anything else.
+ *
+ * Most applications should use the built-in provider (see
+ * @ref aws_cryptosdk_gcm_provider_openssl), which is used when no other provider is
+ * configured. A provider object must remain valid for as long as any session uses it.
+ */
+struct aws_cryptosdk_gcm_provider_vt {
+    /**
+     * Always set to sizeof(struct aws_cryptosdk_gcm_provider_vt).
+     */
+    size_t vt_size;
+    /**
+     * Identifier for debugging purposes.
+     */
+    const char *name;
+    /**
+     * Creates a context keyed for encryption (enc = true) or decryption with the given key.
+     * The key schedule should be set up here, as the context is reused for every frame of
+     * a message. Returns NULL and raises an error on failure.
+     */
+    void *(*key_new)(const uint8_t *key, size_t key_len, bool enc);
+    /**
+     * Destroys a context returned by key_new, zeroing any key material.
+     */
+    void (*key_destroy)(void *key_ctx);
+    /**
+     * Encrypts len bytes from in to out, authenticating aad, and writes the tag. The
+     * buffers may be identical (in-place operation) but will not otherwise overlap.
+     * Returns AWS_OP_SUCCESS, or raises an error.
+     */
+    int (*seal)(
+        void *key_ctx,
+        uint8_t *out,
+        const uint8_t *in,
+        size_t len,
+        const uint8_t *iv,
+        const uint8_t *aad,
+        size_t aad_len,
+        uint8_t *tag);
+    /**
+     * Decrypts len bytes from in to out, authenticating aad against tag. The buffers may
+     * be identical but will not otherwise overlap. Raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT
+     * if the tag does not verify; the contents of out are then unspecified.
+     */
+    int (*open)(
+        void *key_ctx,
+        uint8_t *out,
+        const uint8_t *in,
+        size_t len,
+        const uint8_t *iv,
+        const uint8_t *aad,
+        size_t aad_len,
+        const uint8_t *tag);
+    /**
+     * Optional, and may be NULL (as may open_many), or absent from providers declared with an
+     * older definition of this structure, whose vt_size ends before it. Seals between two and
+     * AWS_CRYPTOSDK_GCM_MAX_OPS independent operations, as seal does each, so that a
+     * multi-buffer implementation can interleave them through the AES and GHASH pipelines,
+     * which a single short frame leaves mostly idle. Success or failure is reported through
+     * each operation's error field.
+     *
+     * When a provider has both seal_many and open_many, sessions hand it all the frames that
+     * fit in the buffers passed to @ref aws_cryptosdk_session_process, a few at a time, even
+     * with a single thread.
+     */
+    void (*seal_many)(struct aws_cryptosdk_gcm_op *ops, size_t count);
+    /**
+     * Optional; the counterpart of seal_many for open. An operation whose tag does not verify
+     * fails with AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT without affecting the others.
+     */
+    void (*open_many)(struct aws_cryptosdk_gcm_op *ops, size_t count);
+};
+
+/**
+ * Returns true if the provider implements seal_many and open_many.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_gcm_provider_has_many(const struct aws_cryptosdk_gcm_provider_vt *provider);
+
+/**
+ * Returns the built-in AES-GCM provider, which is backed by OpenSSL's EVP interface.
+ * OpenSSL selects the fastest available implementation for the CPU at runtime
+ * (e.g. AES-NI with carry-less multiply, VAES, or the ARMv8 Crypto Extensions).
+ */
+AWS_CRYPTOSDK_API
+const struct aws_cryptosdk_gcm_provider_vt *aws_cryptosdk_gcm_provider_openssl(void);
+
+/** One of several independent messages handed to a digest provider's sha512_many */
+struct aws_cryptosdk_digest_op {
+    const uint8_t *in;
+    size_t len;
+    /** Receives the 64-byte digest */
+    uint8_t *digest;
+};
+
+/** The most messages passed to a single sha512_many call */
+#define AWS_CRYPTOSDK_DIGEST_MAX_OPS 8
+
+/**
+ * A pluggable SHA-512 implementation for hashing many short messages at once, which the caching
+ * CMM uses to hash the EDKs of decryption requests when computing their cache IDs (see
+ * @ref aws_cryptosdk_caching_cmm_set_digest_provider). A provider object must remain valid for
+ * as long as any CMM uses it.
+ */
+struct aws_cryptosdk_digest_provider_vt {
+    /**
+     * Always set to sizeof(struct aws_cryptosdk_digest_provider_vt).
+     */
+    size_t vt_size;
+    /**
+     * Identifier for debugging purposes.
+     */
+    const char *name;
+    /**
+     * Computes the SHA-512 digests of between one and AWS_CRYPTOSDK_DIGEST_MAX_OPS independent
+     * messages, so that a multi-buffer implementation can run them through the lanes of its
+     * vector registers together (e.g. four with AVX2, eight with AVX-512). Returns
+     * AWS_OP_SUCCESS, or raises an error, in which case no digest may be used.
+     */
+    int (*sha512_many)(const struct aws_cryptosdk_digest_op *ops, size_t count);
+};
+
+/**
+ * Returns the built-in digest provider, which hashes each message in turn with OpenSSL's EVP
+ * interface, reusing pooled digest contexts. It serves as a reference for other providers.
+ */
+AWS_CRYPTOSDK_API
+const struct aws_cryptosdk_digest_provider_vt *aws_cryptosdk_digest_provider_openssl(void);
+
+/**
+ * @defgroup kernels Kernel selection
+ *
+ * Beyond the providers a caller sets on a session or caching CMM, further AES-GCM and SHA-512
+ * implementations ("kernels") can be registered for the whole process, each with the CPU
+ * features it needs. @ref aws_cryptosdk_select_kernels then picks, among those the CPU
+ * supports, which one sessions and caching CMMs use when they have not been given a provider
+ * of their own; optionally, it benchmarks each candidate first and picks the fastest, for
+ * each class of frame size. The built-in providers are always candidates, and remain in use
+ * until a selection is made.
+ *
+ * @{
+ */
+
+/** CPU features a kernel may need, as reported by @ref aws_cryptosdk_cpu_features */
+enum aws_cryptosdk_cpu_feature {
+    AWS_CRYPTOSDK_CPU_AESNI      = 1 << 0,
+    AWS_CRYPTOSDK_CPU_PCLMULQDQ  = 1 << 1,
+    AWS_CRYPTOSDK_CPU_AVX        = 1 << 2,
+    AWS_CRYPTOSDK_CPU_AVX2       = 1 << 3,
+    AWS_CRYPTOSDK_CPU_AVX512F    = 1 << 4,
+    AWS_CRYPTOSDK_CPU_VAES       = 1 << 5,
+    AWS_CRYPTOSDK_CPU_VPCLMULQDQ = 1 << 6,
+    AWS_CRYPTOSDK_CPU_SHA_NI     = 1 << 7,
+    AWS_CRYPTOSDK_CPU_ARM_AES    = 1 << 8,
+    AWS_CRYPTOSDK_CPU_ARM_PMULL  = 1 << 9,
+    AWS_CRYPTOSDK_CPU_ARM_SHA512 = 1 << 10
+};
+
+/**
+ * Returns the aws_cryptosdk_cpu_feature bits of the features this CPU has and the operating
+ * system has enabled. Features which cannot be detected on this platform are reported absent.
+ */
+AWS_CRYPTOSDK_API
+uint32_t aws_cryptosdk_cpu_features(void);
+
+/** The classes of frame size for which AES-GCM kernels are selected separately */
+enum aws_cryptosdk_frame_class {
+    /** Frames of up to 1 KiB */
+    AWS_CRYPTOSDK_FRAME_CLASS_SMALL,
+    /** Frames of up to 64 KiB, including the default frame size */
+    AWS_CRYPTOSDK_FRAME_CLASS_MEDIUM,
+    /** Larger frames, and unframed bodies */
+    AWS_CRYPTOSDK_FRAME_CLASS_LARGE,
+    AWS_CRYPTOSDK_FRAME_CLASS_COUNT
+};
+
+/** Returns the class of a frame size; zero, for unframed bodies, is a large frame */
+AWS_CRYPTOSDK_API
+enum aws_cryptosdk_frame_class aws_cryptosdk_frame_class_of(uint64_t frame_size);
+
+/** The most kernels of each kind which may be registered, besides the built-in providers */
+#define AWS_CRYPTOSDK_MAX_KERNELS 8
+
+/**
+ * Registers an AES-GCM kernel which needs the given aws_cryptosdk_cpu_feature bits. It only
+ * comes into use once @ref aws_cryptosdk_select_kernels picks it. The provider must remain
+ * valid for the life of the process. Registering a provider twice has no effect.
+ *
+ * Raises AWS_ERROR_INVALID_ARGUMENT if the provider's vtable is incomplete (as
+ * @ref aws_cryptosdk_session_set_gcm_provider does), or AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED once
+ * AWS_CRYPTOSDK_MAX_KERNELS have been registered.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_register_gcm_kernel(const struct aws_cryptosdk_gcm_provider_vt *provider, uint32_t cpu_features);
+
+/** As @ref aws_cryptosdk_register_gcm_kernel, for a multi-buffer SHA-512 kernel */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_register_digest_kernel(
+    const struct aws_cryptosdk_digest_provider_vt *provider, uint32_t cpu_features);
+
+/**
+ * Selects the kernels in use from those registered whose CPU features are all present.
+ *
+ * Without benchmarking, the kernel registered last is preferred, for every frame class. With
+ * benchmarking, each candidate first encrypts and decrypts a few hundred kilobytes of frames
+ * of a size typical of each class, in batches if it has seal_many and open_many, as sessions
+ * would use it, and the fastest in each class is picked; digest kernels likewise hash batches
+ * of EDK-sized messages. This takes a few milliseconds per candidate. Each candidate's output
+ * is also checked against the built-in provider's, and one which disagrees is never selected.
+ *
+ * Sessions and caching CMMs pick up the selection when they next key a message or hash a
+ * request; it may be made again at any time, e.g. after registering more kernels. Returns
+ * AWS_OP_SUCCESS, or raises an error if the benchmark itself could not run, in which case the
+ * previous selection stands.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_select_kernels(bool benchmark);
+
+/**
+ * Returns the AES-GCM kernel selected for frames of the given size (see
+ * @ref aws_cryptosdk_frame_class_of): the built-in provider, until a selection is made.
+ */
+AWS_CRYPTOSDK_API
+const struct aws_cryptosdk_gcm_provider_vt *aws_cryptosdk_gcm_kernel_for_frame_size(uint64_t frame_size);
+
+/** Returns the selected SHA-512 kernel, or NULL while the built-in digest is in use */
+AWS_CRYPTOSDK_API
+const struct aws_cryptosdk_digest_provider_vt *aws_cryptosdk_digest_kernel(void);
+
+/** The kernels in use, as reported by @ref aws_cryptosdk_get_active_kernels */
+struct aws_cryptosdk_active_kernels {
+    /** As returned by @ref aws_cryptosdk_cpu_features */
+    uint32_t cpu_features;
+    /** True if the selection in effect was made by benchmarking */
+    bool benchmarked;
+    /** The name of the AES-GCM kernel in use for each aws_cryptosdk_frame_class */
+    const char *gcm[AWS_CRYPTOSDK_FRAME_CLASS_COUNT];
+    /** When benchmarked, its throughput, encrypting and decrypting, in bytes per second; else 0 */
+    uint64_t gcm_bytes_per_sec[AWS_CRYPTOSDK_FRAME_CLASS_COUNT];
+    /** The name of the SHA-512 kernel in use */
+    const char *digest;
+    /** When benchmarked, its throughput in messages per second; else 0 */
+    uint64_t digest_ops_per_sec;
+};
+
+/** Reports which kernels are in use, and why */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_get_active_kernels(struct aws_cryptosdk_active_kernels *kernels);
+
+/**
+ * Goes back to the built-in providers, and forgets every kernel registered so far, e.g. before
+ * the code providing them is unloaded. Sessions and caching CMMs already using a kernel keep
+ * it until they next key a message or hash a request.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_reset_kernels(void);
+
+/** @} */  // doxygen group kernels
+
+/**
+ * Enables or disables buffered random generation for the whole process; it is disabled by
+ * default. When enabled, each thread fetches random bytes from OpenSSL a block at a time and
+ * serves message IDs, IVs and data keys from that block, which avoids contention on OpenSSL's
+ * random generator lock when many threads encrypt at once. Unused bytes are kept in per-thread
+ * memory until they are handed out, and are discarded in the child after a fork.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_set_buffered_random(bool enabled);
+
+/* OpenSSL 3's OSSL_LIB_CTX */
+struct ossl_lib_ctx_st;
+
+/**
+ * Has the SDK fetch its ciphers and digests from the given OpenSSL 3 library context, rather
+ * than the default one (NULL), e.g. to use providers loaded only there. Each algorithm is
+ * fetched once, the first time it is needed, and the handle is kept for the life of the process,
+ * which spares every operation a provider lookup under OpenSSL's process-wide lock. The library
+ * context must therefore outlive all use of the SDK. Keys and random bytes still come from the
+ * default library context.
+ *
+ * This must be called before the SDK first uses a cipher or digest, and not concurrently with
+ * it; once one has been fetched, this raises AWS_CRYPTOSDK_ERR_BAD_STATE. With OpenSSL
+ * versions before 3.0, this raises AWS_ERROR_UNSUPPORTED_OPERATION.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_set_openssl_lib_ctx(struct ossl_lib_ctx_st *lib_ctx);
+
+/**
+ * Does ahead of time the one-off setup the SDK otherwise does the first time each piece is
+ * needed: loads the error strings, fetches every cipher and digest (see
+ * aws_cryptosdk_set_openssl_lib_ctx, which must therefore be called first if at all), builds
+ * the elliptic curve groups used for signing, and seeds OpenSSL's random generator. Calling this
+ * during process startup, e.g. in the initialization phase of a serverless function, keeps that
+ * cost out of the first message. It is safe to call more than once, and from several threads.
+ *
+ * Returns AWS_OP_SUCCESS, or raises AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN if some algorithm is
+ * unavailable; the rest is still prepared, and messages which do not need the missing one work.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_prepare(void);
+
 /**
  * An opaque structure representing an ongoing sign or verify operation
  */
@@ -138,6 +465,42 @@ AWS_CRYPTOSDK_API
 int aws_cryptosdk_sig_get_pubkey(
     const struct aws_cryptosdk_sig_ctx *ctx, struct aws_allocator *alloc, struct aws_string **pub_key_buf);
 
+/**
+ * A parsed signing or verification key, taken from a signature context so that further
+ * contexts can be started with the same key without serializing and parsing it again.
+ * Starting a context from it only sets up a new digest; the key itself is shared, by
+ * reference, with every context started from it, which may outlive it.
+ */
+struct aws_cryptosdk_sig_key;
+
+/**
+ * Obtains the key of a signing context, which may be in either sign or verify mode. Contexts
+ * started from the key are in the same mode as ctx.
+ *
+ * This method is intended to be used with caching mechanisms local to the process; those
+ * which store keys elsewhere should serialize them with aws_cryptosdk_sig_get_privkey or
+ * aws_cryptosdk_sig_get_pubkey.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_sig_get_key(
+    const struct aws_cryptosdk_sig_ctx *ctx, struct aws_allocator *alloc, struct aws_cryptosdk_sig_key **key);
+
+/**
+ * Destroys a key obtained with aws_cryptosdk_sig_get_key. Contexts started from the key are
+ * unaffected. If key is null, this operation is a no-op.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_sig_key_destroy(struct aws_cryptosdk_sig_key *key);
+
+/**
+ * Initializes a new signature context, in the mode of the context the key was obtained from,
+ * as aws_cryptosdk_sig_sign_start or aws_cryptosdk_sig_verify_start would from the serialized
+ * key. The key may be used to start contexts on any number of threads at once.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_sig_start_from_key(
+    struct aws_cryptosdk_sig_ctx **ctx, struct aws_allocator *alloc, const struct aws_cryptosdk_sig_key *key);
+
 /**
  * Generates a new signature keypair, initializes a signing context, and serializes the public key.
  * If a non-signing algorithm is used, this function returns successfully, sets *ctx to NULL,
@@ -156,6 +519,56 @@ int aws_cryptosdk_sig_sign_start_keygen(
     struct aws_string **pub_key_buf,
     const struct aws_cryptosdk_alg_properties *props);
 
+/**
+ * A pool of pre-generated signing keys for one curve, refilled by a background thread.
+ * Generating an ECDSA keypair is by far the most expensive part of starting an encryption
+ * with a signing algorithm suite; drawing keys from a pool moves that work off the
+ * encrypting thread. Each key is kept with its public key already serialized, as it goes in
+ * the encryption context.
+ */
+struct aws_cryptosdk_sig_key_pool;
+
+/**
+ * Creates a signing key pool for the curve used by the given (signing) algorithm suite,
+ * and starts a thread which generates keys until depth keys are available, topping the pool
+ * back up as keys are taken. Raises AWS_ERROR_INVALID_ARGUMENT if the algorithm suite does
+ * not sign or depth is zero.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_sig_key_pool *aws_cryptosdk_sig_key_pool_new(
+    struct aws_allocator *alloc, const struct aws_cryptosdk_alg_properties *props, size_t depth);
+
+/**
+ * Stops the refill thread and destroys the pool, along with any keys still in it.
+ * The pool must not be in use by any other thread.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_sig_key_pool_destroy(struct aws_cryptosdk_sig_key_pool *pool);
+
+/**
+ * Returns the number of keys currently available in the pool.
+ */
+AWS_CRYPTOSDK_API
+size_t aws_cryptosdk_sig_key_pool_available(struct aws_cryptosdk_sig_key_pool *pool);
+
+/**
+ * Behaves as aws_cryptosdk_sig_sign_start_keygen, but takes the keypair from the pool if
+ * one is available. If pool is NULL, is empty, or was created for a different curve, a
+ * new keypair is generated on the calling thread instead. The pool may be shared between
+ * threads.
+ *
+ * A key from the pool comes with its public key already serialized, and if alloc is the
+ * allocator the pool was created with, that string is returned at *pub_key_buf without being
+ * copied or encoded again.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_sig_sign_start_pooled(
+    struct aws_cryptosdk_sig_ctx **ctx,
+    struct aws_allocator *alloc,
+    struct aws_string **pub_key_buf,
+    const struct aws_cryptosdk_alg_properties *props,
+    struct aws_cryptosdk_sig_key_pool *pool);
+
 /**
  * Initializes a new signature context based on a private key serialized using
  * aws_cryptosdk_sig_get_privkey.
@@ -68,6 +68,20 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_default_cmm_new(struct aws_allocator *al
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_default_cmm_set_alg_id(struct aws_cryptosdk_cmm *cmm, enum aws_cryptosdk_alg_id alg_id);
 
+/**
+ * @ingroup cmm_kr_highlevel
+ * Keeps up to depth pre-generated signing keys for the currently selected algorithm suite,
+ * refilled by a background thread, so that encrypting with a signing suite does not pay
+ * for key generation on the calling thread. If the pool runs dry, or a different curve is
+ * needed, keys are generated inline as usual. A depth of zero stops the thread and discards
+ * the pool.
+ *
+ * Must not be called concurrently with use of the CMM. Raises AWS_ERROR_INVALID_ARGUMENT
+ * if depth is nonzero and the selected algorithm suite does not sign.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_default_cmm_set_sig_key_pool_depth(struct aws_cryptosdk_cmm *cmm, size_t depth);
+
 #ifdef __cplusplus
 }
 #endif
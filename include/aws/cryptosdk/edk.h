@@ -40,6 +40,13 @@ struct aws_cryptosdk_edk {
     struct aws_byte_buf provider_id;
     struct aws_byte_buf provider_info;
     struct aws_byte_buf ciphertext;
+    /**
+     * Optionally, the EDK as it appears in a message header: each field in turn, preceded by its
+     * length as a 16-bit big-endian integer. When set, the three fields above are views into it,
+     * and it is written to headers, cached and hashed as it is rather than reassembled from the
+     * fields. See @ref aws_cryptosdk_edk_init_record. Zeroed for EDKs without a record.
+     */
+    struct aws_byte_buf record;
 };
 
 #ifdef __cplusplus
@@ -74,6 +81,67 @@ bool aws_cryptosdk_edk_list_elements_are_valid(const struct aws_array_list *edk_
 AWS_CRYPTOSDK_API
 void aws_cryptosdk_edk_clean_up(struct aws_cryptosdk_edk *edk);
 
+/**
+ * Initializes edk with empty buffers of the given capacities, all carved out of a single
+ * allocation (or none, if every capacity is zero), which the caller then fills in.
+ * aws_cryptosdk_edk_clean_up frees the whole allocation; the individual buffers of such an
+ * EDK must not be cleaned up, resized or replaced on their own.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_edk_init_packed(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_edk *edk,
+    size_t provider_id_len,
+    size_t provider_info_len,
+    size_t ciphertext_len);
+
+/**
+ * Initializes edk as a record (see struct aws_cryptosdk_edk): a single allocation, owned by
+ * edk->record, already holding the length of each field, with empty buffers of exactly those
+ * capacities in between for the caller to fill in. Once every field is full, the record is
+ * the EDK's serialized form. As for packed EDKs, the individual buffers must not be cleaned up,
+ * resized or replaced on their own; if they are, the record is simply no longer used.
+ *
+ * Raises AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED if a field is longer than a header allows.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_edk_init_record(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_edk *edk,
+    size_t provider_id_len,
+    size_t provider_info_len,
+    size_t ciphertext_len);
+
+/**
+ * Sets edk to views of the serialized EDK at the start of *cursor, including its record, and
+ * advances the cursor past it. Nothing is copied, so the bytes must outlive the EDK. Raises
+ * AWS_ERROR_SHORT_BUFFER if the cursor does not hold a whole EDK.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_edk_init_view(struct aws_cryptosdk_edk *edk, struct aws_byte_cursor *cursor);
+
+/**
+ * Returns the length of the EDK in serialized form.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE size_t aws_cryptosdk_edk_record_size(const struct aws_cryptosdk_edk *edk) {
+    return 6 + edk->provider_id.len + edk->provider_info.len + edk->ciphertext.len;
+}
+
+/**
+ * Returns true if edk->record is set and still holds the EDK's fields, so that it can stand in
+ * for them.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_edk_has_record(const struct aws_cryptosdk_edk *edk);
+
+/**
+ * Appends the EDK in serialized form to out, copying its record if it has one. Raises
+ * AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED if a field is too long to serialize, or AWS_ERROR_SHORT_BUFFER
+ * if out does not have room, in which case out is unchanged.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_edk_write_record(struct aws_byte_buf *out, const struct aws_cryptosdk_edk *edk);
+
 /**
  * Allocates an empty list of EDKs.
  */
@@ -94,7 +162,8 @@ AWS_CRYPTOSDK_API
 void aws_cryptosdk_edk_list_clear(struct aws_array_list *edk_list);
 
 /**
- * Copies the EDK data in src to dest.
+ * Copies the EDK data in src to dest: as a record (see @ref aws_cryptosdk_edk_init_record) if src
+ * has one, and otherwise as a packed EDK (see @ref aws_cryptosdk_edk_init_packed).
  */
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_edk_init_clone(
@@ -109,6 +178,20 @@ AWS_CRYPTOSDK_STATIC_INLINE bool aws_cryptosdk_edk_eq(
            aws_byte_buf_eq(&a->provider_id, &b->provider_id);
 }
 
+/**
+ * Returns true if the EDK has the given provider ID and its provider info starts with the given
+ * prefix, as described by get_edk_filter in struct aws_cryptosdk_keyring_vt.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE bool aws_cryptosdk_edk_matches_filter(
+    const struct aws_cryptosdk_edk *edk,
+    const struct aws_byte_cursor *provider_id,
+    const struct aws_byte_cursor *provider_info_prefix) {
+    return aws_byte_cursor_eq_byte_buf(provider_id, &edk->provider_id) &&
+           edk->provider_info.len >= provider_info_prefix->len &&
+           (!provider_info_prefix->len ||
+            !memcmp(edk->provider_info.buffer, provider_info_prefix->ptr, provider_info_prefix->len));
+}
+
 #ifdef __cplusplus
 }
 #endif
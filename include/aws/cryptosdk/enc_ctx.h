@@ -17,6 +17,7 @@
 
 #include <aws/cryptosdk/exports.h>
 
+#include <aws/common/byte_buf.h>
 #include <aws/common/hash_table.h>
 
 #ifdef __cplusplus
@@ -47,6 +48,14 @@ extern "C" {
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_enc_ctx_init(struct aws_allocator *alloc, struct aws_hash_table *enc_ctx);
 
+/**
+ * As aws_cryptosdk_enc_ctx_init, but sizes the table to hold capacity pairs without being
+ * rehashed, for callers which know how many pairs they are about to add.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_enc_ctx_init_with_capacity(
+    struct aws_allocator *alloc, struct aws_hash_table *enc_ctx, size_t capacity);
+
 /**
  * Clear the elements of an encryption context without deallocating the hash table.
  * This is equivalent to aws_hash_table_clear, but provided as an alias for clarity.
@@ -87,6 +96,136 @@ AWS_CRYPTOSDK_API
 int aws_cryptosdk_enc_ctx_clone(
     struct aws_allocator *alloc, struct aws_hash_table *dest, const struct aws_hash_table *src);
 
+/**
+ * An immutable snapshot of an encryption context, holding its canonical (sorted) serialization
+ * and the SHA-512 digest of that serialization.
+ *
+ * Encrypting a message normally serializes its encryption context several times. An application
+ * which encrypts many messages under the same context can freeze it once and pass the frozen
+ * context to @ref aws_cryptosdk_session_set_frozen_enc_ctx, so that the session and the CMMs
+ * it calls use the stored serialization wherever the context still matches it.
+ *
+ * Frozen contexts are never modified after creation, and may be shared freely between threads.
+ */
+struct aws_cryptosdk_frozen_enc_ctx;
+
+/**
+ * Creates a frozen copy of enc_ctx. Returns NULL on failure.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_frozen_enc_ctx *aws_cryptosdk_enc_ctx_freeze(
+    struct aws_allocator *alloc, const struct aws_hash_table *enc_ctx);
+
+/**
+ * Destroys a frozen encryption context. Passing NULL is a no-op.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_frozen_enc_ctx_destroy(struct aws_cryptosdk_frozen_enc_ctx *frozen);
+
+/**
+ * Returns the frozen context as an encryption context hash table, which must not be modified.
+ */
+AWS_CRYPTOSDK_API
+const struct aws_hash_table *aws_cryptosdk_frozen_enc_ctx_table(const struct aws_cryptosdk_frozen_enc_ctx *frozen);
+
+/**
+ * Returns the canonical serialization of the frozen context, as it appears in the message header.
+ * This is empty for an empty context.
+ */
+AWS_CRYPTOSDK_API
+struct aws_byte_cursor aws_cryptosdk_frozen_enc_ctx_serialized(const struct aws_cryptosdk_frozen_enc_ctx *frozen);
+
+/**
+ * Returns the SHA-512 digest of the canonical serialization of the frozen context.
+ */
+AWS_CRYPTOSDK_API
+struct aws_byte_cursor aws_cryptosdk_frozen_enc_ctx_digest(const struct aws_cryptosdk_frozen_enc_ctx *frozen);
+
+/**
+ * Returns true if enc_ctx holds exactly the same keys and values as the frozen context. This
+ * makes one hash table lookup per key, and neither allocates nor sorts.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_frozen_enc_ctx_matches(
+    const struct aws_cryptosdk_frozen_enc_ctx *frozen, const struct aws_hash_table *enc_ctx);
+
+/**
+ * A compact, read-only encryption context: one allocation holding the serialized context,
+ * preceded by an index of offset/length pairs sorted by key, so that keys can be looked up by
+ * binary search. Building one costs a single allocation however many pairs the context has,
+ * which makes it cheaper than a hash table of aws_strings for reading small contexts, such as
+ * those of decrypted messages (see @ref aws_cryptosdk_session_get_enc_ctx_flat).
+ *
+ * The fields are internal; use the functions below.
+ */
+struct aws_cryptosdk_flat_enc_ctx {
+    struct aws_allocator *alloc;
+    uint8_t *buffer;
+    size_t count;
+    size_t serialized_len;
+};
+
+/**
+ * Initializes flat from an encryption context hash table.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_flat_enc_ctx_init(
+    struct aws_allocator *alloc, struct aws_cryptosdk_flat_enc_ctx *flat, const struct aws_hash_table *enc_ctx);
+
+/**
+ * Initializes flat from exactly the bytes of a serialized encryption context, as found in a
+ * message header. Raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if they are malformed or hold a key
+ * twice. The serialization is kept as given, even if its pairs are not in canonical order.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_flat_enc_ctx_init_from_serialized(
+    struct aws_allocator *alloc, struct aws_cryptosdk_flat_enc_ctx *flat, struct aws_byte_cursor serialized);
+
+/**
+ * Frees the memory held by flat. Calling this on a zeroed or already cleaned up
+ * flat context is a no-op.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_flat_enc_ctx_clean_up(struct aws_cryptosdk_flat_enc_ctx *flat);
+
+/**
+ * Returns the number of key-value pairs in flat.
+ */
+AWS_CRYPTOSDK_API
+size_t aws_cryptosdk_flat_enc_ctx_count(const struct aws_cryptosdk_flat_enc_ctx *flat);
+
+/**
+ * Sets *key and *value to the idx-th pair of flat in key order. idx must be less than
+ * aws_cryptosdk_flat_enc_ctx_count(flat).
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_flat_enc_ctx_get_at(
+    const struct aws_cryptosdk_flat_enc_ctx *flat,
+    size_t idx,
+    struct aws_byte_cursor *key,
+    struct aws_byte_cursor *value);
+
+/**
+ * Looks up key in flat. If it is present, sets *value and returns true.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_flat_enc_ctx_get(
+    const struct aws_cryptosdk_flat_enc_ctx *flat, struct aws_byte_cursor key, struct aws_byte_cursor *value);
+
+/**
+ * Returns the serialized encryption context held by flat.
+ */
+AWS_CRYPTOSDK_API
+struct aws_byte_cursor aws_cryptosdk_flat_enc_ctx_serialized(const struct aws_cryptosdk_flat_enc_ctx *flat);
+
+/**
+ * Replaces the contents of the initialized encryption context enc_ctx with copies of the pairs
+ * in flat, for use with APIs that take a hash table. On failure, enc_ctx is left empty.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_flat_enc_ctx_to_table(
+    struct aws_allocator *alloc, struct aws_hash_table *enc_ctx, const struct aws_cryptosdk_flat_enc_ctx *flat);
+
 /** @} */  // doxygen group enc_ctx
 
 #ifdef __cplusplus
@@ -49,6 +49,10 @@ enum aws_cryptosdk_err {
     AWS_CRYPTOSDK_ERR_RESERVED_NAME,
     /** An unsupported format version was encountered on decrypt */
     AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT,
+    /** A file could not be opened, mapped, read or written; errno has the details */
+    AWS_CRYPTOSDK_ERR_IO,
+    /** A PKCS#11 module or token returned an error, or could not be loaded */
+    AWS_CRYPTOSDK_ERR_PKCS11_FAILURE,
     AWS_CRYPTOSDK_ERR_END_RANGE = 0x2400
 };
 
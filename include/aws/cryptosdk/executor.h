@@ -0,0 +1,46 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_EXECUTOR_H
+#define AWS_CRYPTOSDK_EXECUTOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup cmm_kr_highlevel
+ * @{
+ */
+
+/**
+ * A task for an executor to run: fn(arg) must be called exactly once, on any thread.
+ */
+typedef void(aws_cryptosdk_task_fn)(void *arg);
+
+/**
+ * A caller-supplied executor, such as a thread pool, which schedules task(task_arg) to run on
+ * one of its threads. executor_data is the pointer given along with the executor. Returns
+ * AWS_OP_SUCCESS if the task has been accepted, or AWS_OP_ERR if not, in which case the task is
+ * run on the calling thread instead.
+ */
+typedef int(aws_cryptosdk_executor_fn)(aws_cryptosdk_task_fn *task, void *task_arg, void *executor_data);
+
+/** @} */  // doxygen group cmm_kr_highlevel
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_EXECUTOR_H
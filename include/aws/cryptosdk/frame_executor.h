@@ -0,0 +1,79 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_FRAME_EXECUTOR_H
+#define AWS_CRYPTOSDK_FRAME_EXECUTOR_H
+
+#include <aws/cryptosdk/exports.h>
+#include <aws/cryptosdk/session.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @ingroup session
+ * A fixed set of threads shared by any number of sessions to encrypt and decrypt frames, in
+ * place of the threads each session would otherwise keep for itself (see
+ * @ref aws_cryptosdk_session_set_worker_threads). With thousands of sessions active at once,
+ * one executor sized to the host's cores keeps the number of threads fixed however many
+ * sessions there are.
+ *
+ * A session splits each batch of frames into the same contiguous runs it would give its own
+ * worker threads, keeps the first for the calling thread and queues the rest on the executor,
+ * whose threads take runs from all sessions in the order they were queued. Once done with its
+ * own run, the calling thread takes back those of its runs that no executor thread has started,
+ * so a busy executor slows a session down to single-threaded speed but never stalls it. As a
+ * session queues at most one batch at a time, a large message cannot crowd small ones out.
+ *
+ * Output is released, and the trailing signature updated, in frame order, exactly as with a
+ * session's own threads. All functions but @ref aws_cryptosdk_frame_executor_destroy may be
+ * called concurrently.
+ */
+struct aws_cryptosdk_frame_executor;
+
+/**
+ * Creates an executor with num_threads threads, which must be at least one.
+ *
+ * @return The new executor, or NULL on failure (in which case, an AWS error code is set)
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_frame_executor *aws_cryptosdk_frame_executor_new(struct aws_allocator *alloc, size_t num_threads);
+
+/**
+ * Stops the executor's threads and destroys it. Sessions using the executor must have been
+ * destroyed, or given another executor, beforehand.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_frame_executor_destroy(struct aws_cryptosdk_frame_executor *executor);
+
+/**
+ * Has the session run the frames of each batch on executor instead of on threads of its
+ * own. The number of runs each batch is split into is still that set with
+ * @ref aws_cryptosdk_session_set_worker_threads, which must be more than one for the executor
+ * to be used at all. The session borrows the executor, which must outlive it; passing NULL
+ * restores the default. This setting is preserved across @ref aws_cryptosdk_session_reset, and
+ * raises AWS_CRYPTOSDK_ERR_BAD_STATE if the session has been used since it was created or last
+ * reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_frame_executor(
+    struct aws_cryptosdk_session *session, struct aws_cryptosdk_frame_executor *executor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_FRAME_EXECUTOR_H
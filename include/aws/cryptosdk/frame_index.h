@@ -0,0 +1,85 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_FRAME_INDEX_H
+#define AWS_CRYPTOSDK_FRAME_INDEX_H
+
+#include <aws/common/byte_buf.h>
+
+#include <aws/cryptosdk/exports.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup frame_index Frame indexes
+ *
+ * A frame index is a side-car file, produced alongside a message by an encrypt session
+ * (see @ref aws_cryptosdk_session_set_frame_index), which records where each frame of the
+ * message lies and the authentication tag it carries. With it, a reader knows the exact byte
+ * range of every frame up front, so that several ranges can be fetched and decrypted in
+ * parallel, possibly by several sessions on several hosts.
+ *
+ * The index is not itself authenticated. When it is obtained from a trusted source, a decrypt
+ * session can check each frame against the tag recorded for it (see
+ * @ref aws_cryptosdk_session_use_frame_index), which ties the frame to the encryptor's output
+ * even for algorithm suites with a trailing signature; otherwise, only the signature over the
+ * complete message provides that assurance.
+ *
+ * All integers are big-endian. The index starts with a fixed-size prefix:
+ *
+ *   version (1 byte, AWS_CRYPTOSDK_FRAME_INDEX_VERSION), algorithm ID (2 bytes),
+ *   message ID (16 bytes), frame length (4 bytes, zero if unframed), header length (8 bytes)
+ *
+ * which is followed by one record per frame, in sequence number order:
+ *
+ *   sequence number (4 bytes), offset from the start of the message (8 bytes),
+ *   frame length including framing (4 bytes), authentication tag (16 bytes)
+ *
+ * @{
+ */
+
+#define AWS_CRYPTOSDK_FRAME_INDEX_VERSION 0x01
+
+/** Size of the fixed prefix of a frame index */
+#define AWS_CRYPTOSDK_FRAME_INDEX_PREFIX_LEN (1 + 2 + 16 + 4 + 8)
+
+/** Size of each per-frame record of a frame index */
+#define AWS_CRYPTOSDK_FRAME_INDEX_RECORD_LEN (4 + 8 + 4 + 16)
+
+/**
+ * Returns via *num_frames the number of frames recorded in the index. Raises
+ * AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if the index is malformed.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_frame_index_get_frame_count(struct aws_byte_cursor index, uint64_t *num_frames);
+
+/**
+ * Looks up frame seqno (counting from 1) in the index, returning via *offset its position
+ * relative to the start of the message and via *len its exact length, ready for a ranged
+ * read. Raises AWS_ERROR_INVALID_ARGUMENT if the index has no such frame, and
+ * AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if it is malformed.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_frame_index_lookup(struct aws_byte_cursor index, uint64_t seqno, uint64_t *offset, size_t *len);
+
+/** @} */  // doxygen group frame_index
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_FRAME_INDEX_H
@@ -0,0 +1,119 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_FRAME_SCAN_H
+#define AWS_CRYPTOSDK_FRAME_SCAN_H
+
+#include <aws/common/byte_buf.h>
+#include <aws/cryptosdk/exports.h>
+#include <aws/cryptosdk/header.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @ingroup session
+ * The extent of one frame of a message body, as found by a frame scanner.
+ */
+struct aws_cryptosdk_frame_span {
+    /** Position of the frame relative to the start of the message */
+    uint64_t offset;
+    /** Length of the serialized frame, framing included */
+    size_t len;
+    /** Length of the plaintext the frame decrypts to */
+    size_t plaintext_len;
+    /** Sequence number of the frame; 1 for the body of an unframed message */
+    uint32_t seqno;
+    /** Set for the final frame of a framed message, and for the body of an unframed one */
+    bool final;
+};
+
+/**
+ * @ingroup session
+ * Finds the frames of a message body by reading only their framing (sequence numbers, final
+ * frame markers and length fields) without authenticating or decrypting anything, and without
+ * allocating memory. The spans found can be handed, in any order and to any number of workers,
+ * to @ref aws_cryptosdk_session_decrypt_frame_at, or recorded as an index of the message.
+ *
+ * The body may be presented in chunks of any size. A frame is reported as soon as its framing
+ * has been read, so its span may run past the end of the chunk it starts in; the rest of the
+ * frame is skipped as later chunks arrive. As with the header view, nothing is authenticated:
+ * a span only says where a frame would lie if the message is genuine.
+ *
+ * The fields of this structure are private; it is initialized by
+ * @ref aws_cryptosdk_frame_scanner_init and may be copied freely.
+ */
+struct aws_cryptosdk_frame_scanner {
+    uint64_t offset;
+    uint64_t skip;
+    uint32_t frame_len;
+    uint32_t next_seqno;
+    uint8_t iv_len;
+    uint8_t tag_len;
+    uint8_t staged_len;
+    bool in_final;
+    bool done;
+    /* Framing of a frame that straddles chunks; large enough for a final frame's */
+    uint8_t staged[32];
+};
+
+/**
+ * Readies a scanner for the body of the message whose header is described by view; the body
+ * is taken to start right after the header. Raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if the
+ * view's algorithm suite is unknown.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_frame_scanner_init(
+    struct aws_cryptosdk_frame_scanner *scanner, const struct aws_cryptosdk_hdr_view *view);
+
+/**
+ * Scans the next chunk of the message body, in a single pass, writing the span of each frame
+ * found to spans, up to max_spans of them, and setting *num_spans to the number written. The
+ * cursor is advanced past the bytes accounted for: all of it, unless spans fills up (the rest
+ * then awaits the next call) or the final frame ends within it (what follows is the trailer,
+ * if any, which the scanner does not read).
+ *
+ * Raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if a frame is out of sequence or its length fields
+ * are out of range, and AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED if a frame is too large to describe
+ * on this platform; the scanner must not be used further. *num_spans still counts the spans of
+ * the frames found before the bad one.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_frame_scanner_scan(
+    struct aws_cryptosdk_frame_scanner *scanner,
+    struct aws_byte_cursor *input,
+    struct aws_cryptosdk_frame_span *spans,
+    size_t max_spans,
+    size_t *num_spans);
+
+/**
+ * Returns true once the final frame has been found and skipped to its end.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_frame_scanner_is_done(const struct aws_cryptosdk_frame_scanner *scanner);
+
+/**
+ * Returns the position, relative to the start of the message, of the next byte the scanner
+ * expects; once the scanner is done, that of the trailer, if the message has one.
+ */
+AWS_CRYPTOSDK_API
+uint64_t aws_cryptosdk_frame_scanner_offset(const struct aws_cryptosdk_frame_scanner *scanner);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_FRAME_SCAN_H
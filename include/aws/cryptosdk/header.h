@@ -16,6 +16,14 @@
 #ifndef AWS_CRYPTOSDK_HEADER_H
 #define AWS_CRYPTOSDK_HEADER_H
 
+#include <aws/common/byte_buf.h>
+
+#include <aws/cryptosdk/exports.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * @ingroup session
  * Known algorithm suite names.
@@ -35,4 +43,88 @@ enum aws_cryptosdk_alg_id {
     ALG_AES128_GCM_IV12_TAG16_NO_KDF                 = 0x0014
 };
 
+/**
+ * @ingroup session
+ * A read-only view of a serialized message header, for callers which only need to inspect
+ * it (for example, to route a message by its algorithm, message ID, key providers or
+ * encryption context) without decrypting the message. The view refers to the caller's bytes,
+ * which must outlive it, and is built without allocating any memory. Encrypted data keys and
+ * encryption context pairs are read on demand through the iterators below.
+ *
+ * The header's structure is checked when the view is built, but it is not authenticated, and
+ * duplicate encryption context keys are not detected; a message which is later decrypted may
+ * still be rejected for either reason.
+ */
+struct aws_cryptosdk_hdr_view {
+    /** The complete header, from the version byte through the header authentication tag */
+    struct aws_byte_cursor header;
+    enum aws_cryptosdk_alg_id alg_id;
+    /** The 16-byte message ID */
+    struct aws_byte_cursor message_id;
+    /** Number of encryption context pairs, and their serialized form */
+    uint16_t enc_ctx_count;
+    struct aws_byte_cursor enc_ctx;
+    /** Number of encrypted data keys, and their serialized form */
+    uint16_t edk_count;
+    struct aws_byte_cursor edks;
+    /** Frame length, or zero for an unframed message */
+    uint32_t frame_len;
+    struct aws_byte_cursor iv;
+    struct aws_byte_cursor auth_tag;
+};
+
+/** Position within the encrypted data keys of a header view */
+struct aws_cryptosdk_hdr_edk_iter {
+    struct aws_byte_cursor cur;
+    uint16_t remaining;
+};
+
+/** Position within the encryption context of a header view */
+struct aws_cryptosdk_hdr_enc_ctx_iter {
+    struct aws_byte_cursor cur;
+    uint16_t remaining;
+};
+
+/**
+ * Builds a view of the header at the start of input. Trailing bytes after the header are
+ * ignored. Raises AWS_ERROR_SHORT_BUFFER if input holds only part of a header, and
+ * AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if the header is malformed.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_hdr_view_init(struct aws_cryptosdk_hdr_view *view, struct aws_byte_cursor input);
+
+/** Starts iterating over the encrypted data keys of view, in header order */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_hdr_view_edk_iter_init(
+    const struct aws_cryptosdk_hdr_view *view, struct aws_cryptosdk_hdr_edk_iter *iter);
+
+/**
+ * Points provider_id, provider_info and ciphertext (any of which may be NULL) at the fields
+ * of the next encrypted data key. Returns false, with the outputs untouched, once there are
+ * no more.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_hdr_edk_iter_next(
+    struct aws_cryptosdk_hdr_edk_iter *iter,
+    struct aws_byte_cursor *provider_id,
+    struct aws_byte_cursor *provider_info,
+    struct aws_byte_cursor *ciphertext);
+
+/** Starts iterating over the encryption context of view, in serialized (sorted) order */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_hdr_view_enc_ctx_iter_init(
+    const struct aws_cryptosdk_hdr_view *view, struct aws_cryptosdk_hdr_enc_ctx_iter *iter);
+
+/**
+ * Points key and value (either of which may be NULL) at the next encryption context pair.
+ * Returns false, with the outputs untouched, once there are no more.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_hdr_enc_ctx_iter_next(
+    struct aws_cryptosdk_hdr_enc_ctx_iter *iter, struct aws_byte_cursor *key, struct aws_byte_cursor *value);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif  // AWS_CRYPTOSDK_HEADER_H
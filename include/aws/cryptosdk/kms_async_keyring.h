@@ -0,0 +1,105 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_KMS_ASYNC_KEYRING_H
+#define AWS_CRYPTOSDK_KMS_ASYNC_KEYRING_H
+
+#include <aws/cryptosdk/exports.h>
+#include <aws/cryptosdk/materials.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct aws_client_bootstrap;
+struct aws_credentials_provider;
+struct aws_tls_ctx;
+
+/**
+ * @defgroup kms_async_keyring KMS keyring (aws-c-http)
+ *
+ * A pure-C KMS keyring, which needs neither C++ nor the AWS SDK for C++; see @ref kms_keyring.
+ * @{
+ */
+
+/**
+ * Settings for @ref aws_cryptosdk_kms_async_keyring_new. Zero-initialize the struct, then set
+ * at least the bootstrap and credentials provider.
+ */
+struct aws_cryptosdk_kms_async_keyring_options {
+    /** Event loops, host resolver and sockets for the connections to KMS. Required. */
+    struct aws_client_bootstrap *bootstrap;
+    /** Source of the credentials with which each request is signed. Required. */
+    struct aws_credentials_provider *credentials_provider;
+    /** TLS settings for the connections to KMS, or NULL for the default client settings */
+    struct aws_tls_ctx *tls_ctx;
+    /** Region of the key IDs which are not ARNs, such as aliases; may be empty if they all are */
+    struct aws_byte_cursor default_region;
+    /** Host to connect to in every region instead of kms.REGION.amazonaws.com; may be empty */
+    struct aws_byte_cursor endpoint;
+    /** Port to connect to, or 0 for 443 */
+    uint16_t port;
+    /** Most connections kept open to each region, or 0 for the default of 32 */
+    size_t max_connections_per_region;
+    /** Retries of a throttled or failed call, or 0 for the default of 3 */
+    size_t max_retries;
+};
+
+/**
+ * A KMS keyring which calls KMS directly over HTTP with aws-c-http, on the event loops of
+ * options->bootstrap, rather than through the AWS SDK for C++. It implements on_encrypt_async
+ * and on_decrypt_async without blocking any thread: each call is a chain of callbacks on the
+ * event loops, so that a few threads can keep any number of KMS calls in flight, as many as the
+ * connection pool of each region allows at once and the rest queued for a connection.
+ *
+ * The keyring behaves as the C++ KMS keyring does. The first of key_ids generates the data key
+ * and the others each encrypt it again, all at once; their EDKs are added in key ID order. On
+ * decrypt, the keyring tries the EDKs written by KMS under one of key_ids, in header order, until
+ * one decrypts. With no key_ids, the keyring is in discovery mode: it encrypts nothing, and tries
+ * every KMS EDK. Key IDs which are not ARNs are sent to options->default_region.
+ *
+ * Each request is signed with SigV4 using credentials from options->credentials_provider.
+ * Throttled calls, server errors and failed connections are retried with exponential backoff,
+ * up to options->max_retries times. Calls which still fail raise AWS_CRYPTOSDK_ERR_KMS_FAILURE
+ * on encrypt, and let decrypt go on to the next EDK.
+ *
+ * The synchronous on_encrypt and on_decrypt block the calling thread until the asynchronous
+ * call completes, so they must not be called from one of the keyring's event loop threads.
+ * The caller must have initialized aws-c-auth with aws_auth_library_init, and keeps ownership of
+ * the bootstrap, which must outlive the keyring; the keyring takes its own references to the
+ * credentials provider and the TLS context.
+ *
+ * Fails with AWS_ERROR_INVALID_ARGUMENT if a required option is missing, or if a key ID is not an
+ * ARN and there is no default region, and with AWS_ERROR_UNSUPPORTED_OPERATION if the library was
+ * built without aws-c-http and aws-c-auth.
+ *
+ * On failure returns NULL and sets an internal AWS error code.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_keyring *aws_cryptosdk_kms_async_keyring_new(
+    struct aws_allocator *alloc,
+    const struct aws_cryptosdk_kms_async_keyring_options *options,
+    const struct aws_string *const *key_ids,
+    size_t num_key_ids,
+    const struct aws_string *const *grant_tokens,
+    size_t num_grant_tokens);
+
+/** @} */  // doxygen group kms_async_keyring
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_KMS_ASYNC_KEYRING_H
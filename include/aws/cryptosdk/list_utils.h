@@ -27,6 +27,10 @@ extern "C" {
  * does not clean it up. This makes shallow copies of all pointers in the source list, so
  * for example byte buffers and strings are not duplicated. Their ownership is just
  * transferred from the source list to the destination.
+ *
+ * If destination is a keyring trace whose collection was disabled by the session (see
+ * @ref aws_cryptosdk_session_set_keyring_trace), nothing is transferred and source keeps its
+ * records, which are freed when source is cleaned up.
  */
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_transfer_list(struct aws_array_list *dest, struct aws_array_list *src);
@@ -18,6 +18,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include <aws/common/array_list.h>
@@ -28,6 +29,7 @@
 
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/edk.h>
+#include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/error.h>
 #include <aws/cryptosdk/exports.h>
 #include <aws/cryptosdk/header.h>
@@ -124,6 +126,36 @@ struct aws_cryptosdk_enc_request {
      * this will be UINT64_MAX.
      */
     uint64_t plaintext_size;
+    /**
+     * Optional frozen copy of the encryption context (see @ref aws_cryptosdk_enc_ctx_freeze),
+     * or NULL. CMMs may use its stored serialization and digest in place of serializing enc_ctx,
+     * but only after checking with @ref aws_cryptosdk_frozen_enc_ctx_matches that enc_ctx has not
+     * been modified since.
+     */
+    const struct aws_cryptosdk_frozen_enc_ctx *frozen_enc_ctx;
+    /**
+     * True if the caller will not read the keyring trace of the returned materials (see
+     * @ref aws_cryptosdk_session_set_keyring_trace). CMMs may then return an empty trace, and
+     * the default CMM has keyrings skip recording one. A CMM which keeps materials for other
+     * requests must clear this before passing the request on.
+     */
+    bool skip_keyring_trace;
+    /**
+     * Optional empty materials left over from an earlier request, or NULL. A CMM may take them
+     * with @ref aws_cryptosdk_enc_materials_new_from_spare instead of allocating new materials,
+     * but only before its generate_enc_materials call returns; the caller keeps them otherwise.
+     */
+    struct aws_cryptosdk_enc_materials *spare_materials;
+};
+
+/**
+ * Immutable, refcounted storage that materials may borrow from instead of owning copies of their
+ * contents. A snapshot is allocated as a single block beginning with this struct, and is freed
+ * with alloc once the last reference is released.
+ */
+struct aws_cryptosdk_materials_snapshot {
+    struct aws_atomic_var refcount;
+    struct aws_allocator *alloc;
 };
 
 /**
@@ -139,6 +171,19 @@ struct aws_cryptosdk_enc_materials {
     /** Trailing signature context, or NULL if no trailing signature is needed for this algorithm */
     struct aws_cryptosdk_sig_ctx *signctx;
     enum aws_cryptosdk_alg_id alg;
+    /**
+     * Optional pre-serialized encryption context and EDK sections of the message header, i.e. the
+     * bytes from the AAD length through the last EDK, exactly as they would be serialized from the
+     * request's encryption context and encrypted_data_keys. Left empty by most CMMs, in which case
+     * the session serializes these sections itself.
+     */
+    struct aws_byte_buf header_template;
+    /**
+     * Optional reference to storage that some of the encrypted_data_keys borrow from; such EDKs
+     * have byte buffers with a NULL allocator, and must not be modified. Released when the
+     * materials are destroyed, so anyone who moves borrowed EDKs elsewhere must take it too.
+     */
+    struct aws_cryptosdk_materials_snapshot *snapshot;
 };
 
 /**
@@ -146,9 +191,53 @@ struct aws_cryptosdk_enc_materials {
  */
 struct aws_cryptosdk_dec_request {
     struct aws_allocator *alloc;
+    /**
+     * The message's encryption context. If enc_ctx_deferred is set, this is still empty; see
+     * @ref aws_cryptosdk_dec_request_materialize_enc_ctx.
+     */
     const struct aws_hash_table *enc_ctx;
+    /**
+     * List of struct aws_cryptosdk_edk objects. When built by the session this is a read-only view
+     * of the parsed header's EDKs: neither the list nor the EDKs in it may be modified or cleaned
+     * up, and CMMs or keyrings that need to keep an EDK past the request must copy it with
+     * aws_cryptosdk_edk_init_clone.
+     */
     struct aws_array_list encrypted_data_keys;
     enum aws_cryptosdk_alg_id alg;
+    /**
+     * Message ID of the ciphertext being decrypted, or NULL if not known. CMMs may use this to
+     * supply a precomputed content key in the returned materials.
+     */
+    const uint8_t *message_id;
+    /**
+     * The canonical serialization of enc_ctx, exactly as found in the message header, or
+     * zeroed if not known. It stays valid for as long as enc_ctx does. The session only sets it
+     * when the header's pairs are in canonical order.
+     */
+    struct aws_byte_cursor serialized_enc_ctx;
+    /**
+     * True if the caller will not read the keyring trace of the returned materials, as for
+     * aws_cryptosdk_enc_request.
+     */
+    bool skip_keyring_trace;
+    /**
+     * True if the caller will not verify the trailing signature, as when only the header is
+     * authenticated; CMMs may then leave the signature context of the materials NULL. A CMM
+     * which keeps materials for other requests must clear this before passing the request on.
+     */
+    bool skip_signature;
+    /**
+     * Optional empty materials left over from an earlier request, as for aws_cryptosdk_enc_request;
+     * see @ref aws_cryptosdk_dec_materials_new_from_spare.
+     */
+    struct aws_cryptosdk_dec_materials *spare_materials;
+    /**
+     * If true, enc_ctx has not been deserialized from serialized_enc_ctx (which is then always
+     * set) yet. The session only defers the context for CMMs whose vtable sets
+     * decrypt_takes_deferred_enc_ctx; when the request is passed on to any other CMM, the
+     * context is filled in first.
+     */
+    bool enc_ctx_deferred;
 };
 
 /**
@@ -162,6 +251,61 @@ struct aws_cryptosdk_dec_materials {
     /** Trailing signature context, or NULL if no trailing signature is needed for this algorithm */
     struct aws_cryptosdk_sig_ctx *signctx;
     enum aws_cryptosdk_alg_id alg;
+    /**
+     * Optional content key, already derived from unencrypted_data_key for the request's message ID.
+     * Left empty by most CMMs, in which case the session derives the content key itself.
+     */
+    struct aws_byte_buf content_key;
+};
+
+/**
+ * Completion callback for asynchronous encryption materials requests. On success, error_code is
+ * AWS_ERROR_SUCCESS and ownership of materials passes to the callback; on failure, materials is NULL.
+ */
+typedef void(aws_cryptosdk_enc_materials_fn)(
+    struct aws_cryptosdk_enc_materials *materials, int error_code, void *user_data);
+
+/**
+ * Completion callback for asynchronous decryption materials requests. On success, error_code is
+ * AWS_ERROR_SUCCESS and ownership of materials passes to the callback; on failure, materials is NULL.
+ */
+typedef void(aws_cryptosdk_dec_materials_fn)(
+    struct aws_cryptosdk_dec_materials *materials, int error_code, void *user_data);
+
+/**
+ * Completion callback for asynchronous keyring calls. error_code is AWS_ERROR_SUCCESS if the call
+ * succeeded, in which case its outputs have been filled in just as for the synchronous call.
+ */
+typedef void(aws_cryptosdk_keyring_fn)(int error_code, void *user_data);
+
+/**
+ * One message of a batched On Encrypt call; see @ref aws_cryptosdk_keyring_on_encrypt_batch.
+ * The inputs and outputs are those of @ref aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx,
+ * and error_code receives AWS_ERROR_SUCCESS or the error this message failed with.
+ */
+struct aws_cryptosdk_keyring_encrypt_item {
+    struct aws_byte_buf *unencrypted_data_key;
+    struct aws_array_list *keyring_trace;
+    struct aws_array_list *edks;
+    const struct aws_hash_table *enc_ctx;
+    /* May be NULL */
+    const struct aws_byte_cursor *serialized_enc_ctx;
+    enum aws_cryptosdk_alg_id alg;
+    int error_code;
+};
+
+/**
+ * One message of a batched On Decrypt call; see @ref aws_cryptosdk_keyring_on_decrypt_batch.
+ */
+struct aws_cryptosdk_keyring_decrypt_item {
+    struct aws_byte_buf *unencrypted_data_key;
+    struct aws_array_list *keyring_trace;
+    const struct aws_array_list *edks;
+    const struct aws_hash_table *enc_ctx;
+    /* May be NULL */
+    const struct aws_byte_cursor *serialized_enc_ctx;
+    enum aws_cryptosdk_alg_id alg;
+    int error_code;
 };
 
 #ifndef AWS_CRYPTOSDK_DOXYGEN /* do not document internal macros */
@@ -323,6 +467,46 @@ struct aws_cryptosdk_cmm_vt {
         struct aws_cryptosdk_cmm *cmm,
         struct aws_cryptosdk_dec_materials **output,
         struct aws_cryptosdk_dec_request *request);
+
+    /**
+     * VIRTUAL FUNCTION: optional. Asynchronous variant of generate_enc_materials.
+     *
+     * Returns AWS_OP_SUCCESS once the request has been accepted; callback is then invoked exactly
+     * once, possibly on another thread and possibly before this function returns. The request, and
+     * everything it refers to, remains valid until the callback is invoked. If AWS_OP_ERR is returned,
+     * the callback is not invoked. CMMs that leave this NULL are called through generate_enc_materials.
+     */
+    int (*generate_enc_materials_async)(
+        struct aws_cryptosdk_cmm *cmm,
+        struct aws_cryptosdk_enc_request *request,
+        aws_cryptosdk_enc_materials_fn *callback,
+        void *user_data);
+    /**
+     * VIRTUAL FUNCTION: optional. Asynchronous variant of decrypt_materials, with the same
+     * contract as generate_enc_materials_async.
+     */
+    int (*decrypt_materials_async)(
+        struct aws_cryptosdk_cmm *cmm,
+        struct aws_cryptosdk_dec_request *request,
+        aws_cryptosdk_dec_materials_fn *callback,
+        void *user_data);
+
+    /**
+     * Optional. Set if decrypt_materials (and decrypt_materials_async) can be handed requests
+     * whose encryption context is deferred, calling
+     * @ref aws_cryptosdk_dec_request_materialize_enc_ctx before reading enc_ctx (or passing the
+     * request to @ref aws_cryptosdk_cmm_decrypt_materials, which does so as needed). This saves
+     * building the context for messages whose materials can be found from its serialization.
+     */
+    bool decrypt_takes_deferred_enc_ctx;
+
+    /**
+     * VIRTUAL FUNCTION: optional. Returns false if decrypt_materials is certain to fail for a
+     * message with these EDKs, because none of them is one the CMM's keyrings can decrypt, so
+     * that the session can reject the message without building a request. Must not raise an
+     * error, and must be safe to call concurrently. CMMs that leave this NULL are always called.
+     */
+    bool (*may_decrypt)(const struct aws_cryptosdk_cmm *cmm, const struct aws_array_list *edks);
 };
 
 /**
@@ -404,6 +588,32 @@ AWS_CRYPTOSDK_STATIC_INLINE int aws_cryptosdk_cmm_generate_enc_materials(
     return ret;
 }
 
+/**
+ * Fills in the request's encryption context from its serialization, if enc_ctx_deferred is set,
+ * and clears enc_ctx_deferred. The entries are allocated with the request's allocator. Does
+ * nothing if the context is not deferred.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_dec_request_materialize_enc_ctx(struct aws_cryptosdk_dec_request *request);
+
+/**
+ * Internal function: True if the CMM has declared that it takes requests with deferred
+ * encryption contexts.
+ */
+AWS_CRYPTOSDK_STATIC_INLINE bool aws_cryptosdk_private_cmm_takes_deferred_enc_ctx(const struct aws_cryptosdk_cmm *cmm) {
+    size_t end = offsetof(struct aws_cryptosdk_cmm_vt, decrypt_takes_deferred_enc_ctx) + sizeof(bool);
+
+    return cmm->vtable->vt_size >= end && cmm->vtable->decrypt_takes_deferred_enc_ctx;
+}
+
+/**
+ * Returns false if the CMM has declared that it cannot decrypt a message with these EDKs (a list
+ * of struct aws_cryptosdk_edk); see may_decrypt in struct aws_cryptosdk_cmm_vt. Returns true if
+ * the CMM does not say.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_cmm_may_decrypt(const struct aws_cryptosdk_cmm *cmm, const struct aws_array_list *edks);
+
 /**
  * Receives decryption request from user and attempts to get decryption materials.
  *
@@ -417,10 +627,39 @@ AWS_CRYPTOSDK_STATIC_INLINE int aws_cryptosdk_cmm_decrypt_materials(
     struct aws_cryptosdk_cmm *cmm,
     struct aws_cryptosdk_dec_materials **output,
     struct aws_cryptosdk_dec_request *request) {
+    if (request && request->enc_ctx_deferred && !aws_cryptosdk_private_cmm_takes_deferred_enc_ctx(cmm) &&
+        aws_cryptosdk_dec_request_materialize_enc_ctx(request)) {
+        *output = NULL;
+        return AWS_OP_ERR;
+    }
     AWS_CRYPTOSDK_PRIVATE_VF_CALL(decrypt_materials, cmm, output, request);
     return ret;
 }
 
+/**
+ * Asynchronously generates encryption materials, invoking callback exactly once with the result
+ * unless AWS_OP_ERR is returned. If the CMM has no asynchronous implementation, the synchronous
+ * one is called and the callback is invoked before this function returns.
+ *
+ * The request, and everything it refers to, must remain valid until the callback is invoked.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_cmm_generate_enc_materials_async(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_enc_request *request,
+    aws_cryptosdk_enc_materials_fn *callback,
+    void *user_data);
+
+/**
+ * Asynchronously obtains decryption materials; see @ref aws_cryptosdk_cmm_generate_enc_materials_async.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_cmm_decrypt_materials_async(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_dec_request *request,
+    aws_cryptosdk_dec_materials_fn *callback,
+    void *user_data);
+
 struct aws_cryptosdk_keyring_vt {
     /**
      * Always set to sizeof(struct aws_cryptosdk_keyring_vt).
@@ -470,6 +709,116 @@ struct aws_cryptosdk_keyring_vt {
         const struct aws_array_list *edks,
         const struct aws_hash_table *enc_ctx,
         enum aws_cryptosdk_alg_id alg);
+
+    /**
+     * VIRTUAL FUNCTION: optional. Asynchronous variant of on_encrypt, for keyrings that wait on
+     * remote services. The same requirements as on_encrypt apply to the outputs, which must
+     * not be touched after the callback is invoked.
+     *
+     * Returns AWS_OP_SUCCESS once the call has been accepted; callback is then invoked exactly
+     * once, possibly on another thread and possibly before this function returns. All arguments
+     * remain valid until the callback is invoked. If AWS_OP_ERR is returned, the callback is not
+     * invoked. Keyrings that leave this NULL are called through on_encrypt.
+     */
+    int (*on_encrypt_async)(
+        struct aws_cryptosdk_keyring *keyring,
+        struct aws_allocator *request_alloc,
+        struct aws_byte_buf *unencrypted_data_key,
+        struct aws_array_list *keyring_trace,
+        struct aws_array_list *edks,
+        const struct aws_hash_table *enc_ctx,
+        enum aws_cryptosdk_alg_id alg,
+        aws_cryptosdk_keyring_fn *callback,
+        void *user_data);
+
+    /**
+     * VIRTUAL FUNCTION: optional. Asynchronous variant of on_decrypt, with the same contract
+     * as on_encrypt_async.
+     */
+    int (*on_decrypt_async)(
+        struct aws_cryptosdk_keyring *keyring,
+        struct aws_allocator *request_alloc,
+        struct aws_byte_buf *unencrypted_data_key,
+        struct aws_array_list *keyring_trace,
+        const struct aws_array_list *edks,
+        const struct aws_hash_table *enc_ctx,
+        enum aws_cryptosdk_alg_id alg,
+        aws_cryptosdk_keyring_fn *callback,
+        void *user_data);
+
+    /**
+     * VIRTUAL FUNCTION: optional. Describes the only EDKs this keyring can decrypt, so that a
+     * multi-keyring can hand it just those, and skip calling it for messages that have none:
+     * sets provider_id to their provider ID, and provider_info_prefix to bytes their provider
+     * info always starts with, which may be empty. The cursors must stay valid for the life of
+     * the keyring. Keyrings which may decrypt EDKs with more than one provider ID leave this NULL.
+     */
+    int (*get_edk_filter)(
+        const struct aws_cryptosdk_keyring *keyring,
+        struct aws_byte_cursor *provider_id,
+        struct aws_byte_cursor *provider_info_prefix);
+
+    /**
+     * VIRTUAL FUNCTION: optional. Variant of on_encrypt which is also given the canonical
+     * serialization of enc_ctx, as written by the session to the message header, for keyrings
+     * that authenticate the encryption context and would otherwise serialize it themselves.
+     * serialized_enc_ctx is never NULL here. Keyrings that leave this NULL are called through
+     * on_encrypt.
+     */
+    int (*on_encrypt_with_serialized_ctx)(
+        struct aws_cryptosdk_keyring *keyring,
+        struct aws_allocator *request_alloc,
+        struct aws_byte_buf *unencrypted_data_key,
+        struct aws_array_list *keyring_trace,
+        struct aws_array_list *edks,
+        const struct aws_hash_table *enc_ctx,
+        const struct aws_byte_cursor *serialized_enc_ctx,
+        enum aws_cryptosdk_alg_id alg);
+
+    /**
+     * VIRTUAL FUNCTION: optional. Variant of on_decrypt which is also given the canonical
+     * serialization of enc_ctx, as for on_encrypt_with_serialized_ctx.
+     */
+    int (*on_decrypt_with_serialized_ctx)(
+        struct aws_cryptosdk_keyring *keyring,
+        struct aws_allocator *request_alloc,
+        struct aws_byte_buf *unencrypted_data_key,
+        struct aws_array_list *keyring_trace,
+        const struct aws_array_list *edks,
+        const struct aws_hash_table *enc_ctx,
+        const struct aws_byte_cursor *serialized_enc_ctx,
+        enum aws_cryptosdk_alg_id alg);
+
+    /**
+     * VIRTUAL FUNCTION: optional. Returns false if on_decrypt cannot decrypt any of these EDKs,
+     * for keyrings which know that without a description as simple as get_edk_filter's, such as
+     * multi-keyrings. Must not raise an error. Keyrings that leave this NULL are judged by
+     * get_edk_filter, or assumed to decrypt anything if they leave that NULL too.
+     */
+    bool (*may_decrypt)(const struct aws_cryptosdk_keyring *keyring, const struct aws_array_list *edks);
+
+    /**
+     * VIRTUAL FUNCTION: optional. On Encrypt for many messages at once, for keyrings that can
+     * share a round trip or pipeline work between them. Each item is handled as by
+     * on_encrypt_with_serialized_ctx, and must have its error_code set. Returns AWS_OP_ERR only
+     * if no item was attempted, in which case every item fails with the error raised. Keyrings
+     * that leave this NULL are called once per item.
+     */
+    int (*on_encrypt_batch)(
+        struct aws_cryptosdk_keyring *keyring,
+        struct aws_allocator *request_alloc,
+        struct aws_cryptosdk_keyring_encrypt_item *items,
+        size_t num_items);
+
+    /**
+     * VIRTUAL FUNCTION: optional. On Decrypt for many messages at once, with the same contract
+     * as on_encrypt_batch. An item whose data key is not decrypted is not a failure.
+     */
+    int (*on_decrypt_batch)(
+        struct aws_cryptosdk_keyring *keyring,
+        struct aws_allocator *request_alloc,
+        struct aws_cryptosdk_keyring_decrypt_item *items,
+        size_t num_items);
 };
 
 /**
@@ -550,6 +899,120 @@ int aws_cryptosdk_keyring_on_decrypt(
     const struct aws_hash_table *enc_ctx,
     enum aws_cryptosdk_alg_id alg);
 
+/**
+ * As @ref aws_cryptosdk_keyring_on_encrypt, also handing the keyring serialized_enc_ctx, the
+ * canonical serialization of enc_ctx, if it can use it. serialized_enc_ctx may be NULL if no
+ * serialization is at hand, in which case this is the same as @ref aws_cryptosdk_keyring_on_encrypt.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg);
+
+/**
+ * As @ref aws_cryptosdk_keyring_on_decrypt, also handing the keyring serialized_enc_ctx; see
+ * @ref aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_keyring_on_decrypt_with_serialized_ctx(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg);
+
+/**
+ * Describes the EDKs the keyring can decrypt; see get_edk_filter in struct aws_cryptosdk_keyring_vt.
+ * Fails with AWS_ERROR_UNIMPLEMENTED if the keyring does not describe them, in which case it may
+ * decrypt any EDK.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_keyring_get_edk_filter(
+    const struct aws_cryptosdk_keyring *keyring,
+    struct aws_byte_cursor *provider_id,
+    struct aws_byte_cursor *provider_info_prefix);
+
+/**
+ * Returns false if the keyring is known to be unable to decrypt any of the EDKs (a list of
+ * struct aws_cryptosdk_edk), from its may_decrypt or get_edk_filter; otherwise returns true.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_keyring_may_decrypt(const struct aws_cryptosdk_keyring *keyring, const struct aws_array_list *edks);
+
+/**
+ * Asynchronous variant of @ref aws_cryptosdk_keyring_on_encrypt. Unless AWS_OP_ERR is returned,
+ * callback is invoked exactly once, after the same postconditions have been checked. If the
+ * keyring has no asynchronous implementation, the synchronous one is called and the callback is
+ * invoked before this function returns.
+ *
+ * All arguments must remain valid until the callback is invoked.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_keyring_on_encrypt_async(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data);
+
+/**
+ * Asynchronous variant of @ref aws_cryptosdk_keyring_on_decrypt; see
+ * @ref aws_cryptosdk_keyring_on_encrypt_async.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_keyring_on_decrypt_async(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data);
+
+/**
+ * Calls On Encrypt for num_items messages at once: in one call to the keyring if it implements
+ * on_encrypt_batch, or else once per item through
+ * @ref aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx. The postconditions of that function
+ * are checked for each item, and each item's error_code is set.
+ *
+ * Returns AWS_OP_SUCCESS if every item succeeded; otherwise raises the error of the first item
+ * that failed and returns AWS_OP_ERR. If any item does not meet the preconditions of On Encrypt,
+ * the keyring is not called and every item fails.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_keyring_on_encrypt_batch(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_cryptosdk_keyring_encrypt_item *items,
+    size_t num_items);
+
+/**
+ * Calls On Decrypt for num_items messages at once; see @ref aws_cryptosdk_keyring_on_encrypt_batch.
+ * As for @ref aws_cryptosdk_keyring_on_decrypt, an item whose data key was not decrypted has its
+ * unencrypted_data_key buffer left NULL and does not fail.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_keyring_on_decrypt_batch(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_cryptosdk_keyring_decrypt_item *items,
+    size_t num_items);
+
 /**
  * Allocates a new encryption materials object, including allocating memory to the list
  * of EDKs. The list of EDKs will be empty and no memory will be allocated to any byte
@@ -570,6 +1033,38 @@ struct aws_cryptosdk_enc_materials *aws_cryptosdk_enc_materials_new(
 AWS_CRYPTOSDK_API
 void aws_cryptosdk_enc_materials_destroy(struct aws_cryptosdk_enc_materials *enc_mat);
 
+/**
+ * Returns *spare, setting *spare to NULL, if it is non-NULL and was allocated from alloc; the
+ * returned materials are then empty, exactly as if newly allocated, but keep the list storage of
+ * their earlier use. Otherwise this behaves like aws_cryptosdk_enc_materials_new.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_enc_materials *aws_cryptosdk_enc_materials_new_from_spare(
+    struct aws_cryptosdk_enc_materials **spare, struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg);
+
+/**
+ * Releases everything held by enc_mat, wiping its data key, and keeps the emptied object as *spare
+ * for aws_cryptosdk_enc_materials_new_from_spare. If *spare is already occupied, enc_mat is
+ * destroyed instead. An empty spare is freed with aws_cryptosdk_enc_materials_destroy.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_enc_materials_recycle(
+    struct aws_cryptosdk_enc_materials **spare, struct aws_cryptosdk_enc_materials *enc_mat);
+
+/**
+ * Takes an additional reference to the snapshot, and returns it. NULL is passed through.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_materials_snapshot *aws_cryptosdk_materials_snapshot_retain(
+    struct aws_cryptosdk_materials_snapshot *snapshot);
+
+/**
+ * Releases a reference to the snapshot, freeing it when the last reference is released.
+ * NULL is a no-op.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_materials_snapshot_release(struct aws_cryptosdk_materials_snapshot *snapshot);
+
 /**
  * Allocates a new decryption materials object. Note that no memory will be allocated to
  * the byte buffer for  the unencrypted data key. That will only be allocated when an EDK
@@ -589,6 +1084,21 @@ struct aws_cryptosdk_dec_materials *aws_cryptosdk_dec_materials_new(
 AWS_CRYPTOSDK_API
 void aws_cryptosdk_dec_materials_destroy(struct aws_cryptosdk_dec_materials *dec_mat);
 
+/**
+ * Decryption counterpart of @ref aws_cryptosdk_enc_materials_new_from_spare.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_dec_materials *aws_cryptosdk_dec_materials_new_from_spare(
+    struct aws_cryptosdk_dec_materials **spare, struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg);
+
+/**
+ * Decryption counterpart of @ref aws_cryptosdk_enc_materials_recycle; the data key and any
+ * content key are wiped.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_dec_materials_recycle(
+    struct aws_cryptosdk_dec_materials **spare, struct aws_cryptosdk_dec_materials *dec_mat);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,6 +15,7 @@
 #ifndef AWS_CRYPTOSDK_MULTI_KEYRING_H
 #define AWS_CRYPTOSDK_MULTI_KEYRING_H
 
+#include <aws/cryptosdk/executor.h>
 #include <aws/cryptosdk/exports.h>
 #include <aws/cryptosdk/materials.h>
 
@@ -74,6 +75,91 @@ AWS_CRYPTOSDK_API
 struct aws_cryptosdk_keyring *aws_cryptosdk_multi_keyring_new(
     struct aws_allocator *alloc, struct aws_cryptosdk_keyring *generator);
 
+/**
+ * Makes the multi-keyring's On Encrypt call its child keyrings concurrently rather than one
+ * after another, by handing all but the first to executor; the calling thread runs the first
+ * one itself and then waits for the rest. With one child keyring per region, this makes the
+ * latency of On Encrypt that of the slowest child rather than the sum of them all. Each child
+ * appends to an EDK list and keyring trace of its own, which are merged in child order once all
+ * have completed, so the output is the same as for sequential calls.
+ *
+ * In this mode every child is called even if one fails, and the error raised is that of the
+ * first failing child in order. The child keyrings and the request allocator passed to On
+ * Encrypt must be safe to use from several threads at once. The generator is not affected, nor
+ * is On Decrypt unless @ref aws_cryptosdk_multi_keyring_set_parallel_decrypt enables it too.
+ * Passing a NULL executor restores sequential calls, which are the default.
+ *
+ * As with @ref aws_cryptosdk_multi_keyring_add_child, this must not be called while the
+ * multi-keyring is in use.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_multi_keyring_set_executor(
+    struct aws_cryptosdk_keyring *multi, aws_cryptosdk_executor_fn *executor, void *executor_data);
+
+/**
+ * Makes the multi-keyring's On Decrypt, when it has an executor (see @ref
+ * aws_cryptosdk_multi_keyring_set_executor), hand all the keyrings which may decrypt the message,
+ * generator included, to the executor at once, and return as soon as the first of them decrypts
+ * the data key, rather than trying them one after another. With, say, a KMS keyring and a fallback
+ * raw keyring, the latency of On Decrypt is then that of the fastest keyring able to decrypt the
+ * message, even while another waits on a degraded region.
+ *
+ * Keyrings still running when On Decrypt returns finish in the background; any data key they
+ * decrypt is wiped, and the multi-keyring is kept alive until they are done. Since they may
+ * outlive the request, the keyrings are called with copies of the EDKs and encryption context, and
+ * with the multi-keyring's own allocator rather than the request allocator, and must be safe to
+ * use from several threads at once. The keyring trace holds only the records of the keyring whose
+ * data key was taken. The decrypt order, and the success rates of the adaptive orders, do not
+ * apply. If no keyring decrypts the data key, On Decrypt fails with the first error any keyring
+ * raised, if there was one, as in sequential mode.
+ *
+ * Parallel decryption is off by default. As with @ref aws_cryptosdk_multi_keyring_add_child, this
+ * must not be called while the multi-keyring is in use.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_multi_keyring_set_parallel_decrypt(struct aws_cryptosdk_keyring *multi, bool enabled);
+
+/**
+ * The order in which the multi-keyring's On Decrypt tries its keyrings.
+ */
+enum aws_cryptosdk_multi_keyring_decrypt_order {
+    /** The generator, then the children in the order they were added. This is the default. */
+    AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_IN_ORDER,
+    /**
+     * The generator, then the children by their recent success at decrypting EDKs with the
+     * provider IDs found in the message, most successful first.
+     */
+    AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_ADAPTIVE,
+    /** As AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_ADAPTIVE, but ranks the generator along with the children. */
+    AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_ADAPTIVE_ALL
+};
+
+/**
+ * Sets the order in which the multi-keyring's On Decrypt tries its keyrings. In the adaptive
+ * orders, the multi-keyring keeps a rolling success rate for each pair of keyring and provider ID,
+ * updated by every keyring it calls, and tries first the keyrings most likely to decrypt the
+ * message. This helps when most messages are decrypted by a keyring far down the list.
+ *
+ * The order only depends on the outcomes of earlier calls, and ties are broken by the order in
+ * which the keyrings were added, so that keyrings which have never succeeded keep their places.
+ * Rates are kept for up to AWS_CRYPTOSDK_MULTI_KEYRING_MAX_TRACKED_PROVIDERS provider IDs; EDKs
+ * with other provider IDs do not affect the order. As every keyring decrypts the same data key,
+ * only the order of the keyring trace changes. Raises AWS_ERROR_INVALID_ARGUMENT for unknown
+ * orders.
+ *
+ * As with @ref aws_cryptosdk_multi_keyring_add_child, this must not be called while the
+ * multi-keyring is in use.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_multi_keyring_set_decrypt_order(
+    struct aws_cryptosdk_keyring *multi, enum aws_cryptosdk_multi_keyring_decrypt_order order);
+
+/**
+ * The number of provider IDs for which an adaptive multi-keyring keeps success rates; see @ref
+ * aws_cryptosdk_multi_keyring_set_decrypt_order.
+ */
+#define AWS_CRYPTOSDK_MULTI_KEYRING_MAX_TRACKED_PROVIDERS 64
+
 /**
  * Adds a new child keyring to this multi-keyring. Child keyrings are only used
  * to encrypt or decrypt a data key, not to generate new data keys. Do not add
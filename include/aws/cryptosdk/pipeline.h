@@ -0,0 +1,90 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_PIPELINE_H
+#define AWS_CRYPTOSDK_PIPELINE_H
+
+#include <aws/cryptosdk/exports.h>
+#include <aws/cryptosdk/session.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @ingroup session
+ * Streams a message through a session with a fixed amount of memory, without the caller
+ * managing buffers: a producer writes the input in pieces of any size, and a consumer reads
+ * the output as the session produces it, frame by frame.
+ *
+ * Output is kept in a ring of buffers, each sized by the session's own estimates the first
+ * time it is used, so that once the message body is reached nothing is reallocated. When the
+ * ring is full, writes block until the consumer reads, which holds the producer to the pace of
+ * the consumer; reads block until there is output, the message is complete, or it has failed.
+ *
+ * One thread may write while another reads. Writes must not be made concurrently with each
+ * other, nor reads with each other. Since writes wait for reads, a thread that does both must
+ * not let the ring fill; in that case @ref aws_cryptosdk_session_process is the better fit.
+ */
+struct aws_cryptosdk_pipeline;
+
+/**
+ * Creates a pipeline over session, which must be ready for a new message, with num_buffers
+ * output buffers. The session remains the caller's, and must not be used otherwise until the
+ * pipeline is destroyed. Settings such as the message size may be applied to it beforehand.
+ *
+ * @return The new pipeline, or NULL on failure (in which case, an AWS error code is set)
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_pipeline *aws_cryptosdk_pipeline_new(
+    struct aws_allocator *alloc, struct aws_cryptosdk_session *session, size_t num_buffers);
+
+/**
+ * Destroys the pipeline, discarding any output not yet read. The session is not destroyed.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_pipeline_destroy(struct aws_cryptosdk_pipeline *pipeline);
+
+/**
+ * Passes len bytes of input to the session, blocking while the ring is full. All of the input
+ * is taken unless the message fails, in which case its error is raised here and by all later
+ * calls.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_pipeline_write(struct aws_cryptosdk_pipeline *pipeline, const uint8_t *data, size_t len);
+
+/**
+ * Marks the end of the input, blocking until the session has processed all of it. When
+ * encrypting a message whose size was not set on the session, it is set to the number of
+ * bytes written. Fails if the input ends before the message is complete, or goes on beyond it.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_pipeline_finish(struct aws_cryptosdk_pipeline *pipeline);
+
+/**
+ * Copies up to len bytes of output to outp, blocking until there is some; len must not be zero.
+ * Sets *out_bytes_read to the number of bytes copied, which is zero only once all output of a
+ * complete message has been read. If the message fails, its error is raised and unread output
+ * is discarded.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_pipeline_read(
+    struct aws_cryptosdk_pipeline *pipeline, uint8_t *outp, size_t len, size_t *out_bytes_read);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_PIPELINE_H
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_PKCS11_KEYRING_H
+#define AWS_CRYPTOSDK_PKCS11_KEYRING_H
+
+#include <aws/cryptosdk/exports.h>
+#include <aws/cryptosdk/materials.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @ingroup raw_keyring
+ * A keyring which encrypts and decrypts data keys with an AES key held in a PKCS#11 token, such
+ * as a hardware security module, so that the wrapping key never leaves the token.
+ *
+ * The keyring loads the PKCS#11 module at module_path and initializes it for use by multiple
+ * threads, unless it has already been initialized in this process, and finds the secret AES key
+ * whose CKA_LABEL is key_name in the token in slot_id. Data keys are encrypted with CKM_AES_GCM
+ * using the encryption context as AAD, and EDKs are written in the same format as the raw AES
+ * keyring's: a raw AES keyring with the same namespace and name, and the same key bytes, can
+ * decrypt them, and the other way around.
+ *
+ * Opening and logging in to a token session is expensive, so the keyring keeps a pool of up to
+ * max_sessions sessions, which are opened as calls need them and reused by later calls on any
+ * thread; calls which find every session busy wait for one to be returned. pin logs each new
+ * session in as the normal user; pass an empty pin for tokens which need no login. A session
+ * which the token reports to be closed or invalid is dropped from the pool, and the next call
+ * which needs one opens a replacement.
+ *
+ * The keyring may be used by any number of threads at once. It is cheaper to share one keyring
+ * than to create one per thread; in particular, when one keyring initializes the module, it
+ * finalizes it when destroyed, so other keyrings using the same module must not outlive it.
+ *
+ * Fails with AWS_CRYPTOSDK_ERR_RESERVED_NAME for the namespace "aws-kms", with
+ * AWS_ERROR_INVALID_ARGUMENT if max_sessions is zero or the token does not hold exactly one AES
+ * key labeled key_name, with AWS_CRYPTOSDK_ERR_PKCS11_FAILURE if the module cannot be loaded or
+ * the token returns an error, and with AWS_ERROR_UNSUPPORTED_OPERATION if the library was built
+ * without PKCS#11 support.
+ *
+ * On failure returns NULL and sets an internal AWS error code.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_keyring *aws_cryptosdk_pkcs11_keyring_new(
+    struct aws_allocator *alloc,
+    const char *module_path,
+    unsigned long slot_id,
+    struct aws_byte_cursor pin,
+    const struct aws_string *key_namespace,
+    const struct aws_string *key_name,
+    size_t max_sessions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_PKCS11_KEYRING_H
@@ -0,0 +1,28 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_ALLOC_STATS_H
+#define AWS_CRYPTOSDK_PRIVATE_ALLOC_STATS_H
+
+#include <aws/cryptosdk/alloc_stats.h>
+
+/*
+ * An instrumented allocator has one view per tag, all sharing its counts; memory acquired through
+ * any of them may be released through any other. Parts of the SDK pass the allocators they are
+ * given through this on the way in, so that what they allocate is attributed to them. Any other
+ * allocator is returned unchanged, at the cost of a single comparison.
+ */
+struct aws_allocator *aws_cryptosdk_priv_alloc_tagged(struct aws_allocator *alloc, enum aws_cryptosdk_alloc_tag tag);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_ALLOC_STATS_H
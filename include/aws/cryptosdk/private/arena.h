@@ -0,0 +1,42 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_ARENA_H
+#define AWS_CRYPTOSDK_PRIVATE_ARENA_H
+
+#include <aws/common/common.h>
+
+/*
+ * A bump allocator for objects which all die together, such as those belonging to a single
+ * message. Allocations are carved from blocks obtained from a parent allocator; releasing an
+ * allocation does nothing, and the memory is only reclaimed by aws_cryptosdk_arena_reset, which
+ * wipes everything handed out and keeps the blocks for reuse. Arenas are not thread-safe.
+ */
+struct aws_cryptosdk_arena;
+
+struct aws_cryptosdk_arena *aws_cryptosdk_arena_new(struct aws_allocator *parent);
+
+/* Returns the allocator which hands out memory from the arena; valid until the arena is destroyed */
+struct aws_allocator *aws_cryptosdk_arena_allocator(struct aws_cryptosdk_arena *arena);
+
+/*
+ * Securely zeroes and reclaims all memory allocated from the arena. Nothing allocated from the
+ * arena may be used afterwards.
+ */
+void aws_cryptosdk_arena_reset(struct aws_cryptosdk_arena *arena);
+
+/* Resets the arena and returns its blocks to the parent allocator */
+void aws_cryptosdk_arena_destroy(struct aws_cryptosdk_arena *arena);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_ARENA_H
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_PRIVATE_CACHE_SERIALIZE_H
+#define AWS_CRYPTOSDK_PRIVATE_CACHE_SERIALIZE_H
+
+#include <aws/cryptosdk/materials.h>
+
+/*
+ * Serialization of cached materials, for caches which hold entries outside of the process heap.
+ * The format is internal to the SDK, and may change from one release to the next.
+ */
+
+/**
+ * Appends encryption materials and their encryption context to out, whose capacity is not grown;
+ * raises AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED if they do not fit.
+ */
+int aws_cryptosdk_priv_serialize_enc_materials(
+    struct aws_allocator *alloc,
+    struct aws_byte_buf *out,
+    const struct aws_cryptosdk_enc_materials *materials,
+    const struct aws_hash_table *enc_ctx);
+
+/**
+ * Appends decryption materials to out, whose capacity is not grown; raises
+ * AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED if they do not fit.
+ */
+int aws_cryptosdk_priv_serialize_dec_materials(
+    struct aws_allocator *alloc, struct aws_byte_buf *out, const struct aws_cryptosdk_dec_materials *materials);
+
+/**
+ * Reads back materials written by aws_cryptosdk_priv_serialize_enc_materials into new materials,
+ * and deserializes their encryption context into enc_ctx. Raises
+ * AWS_CRYPTOSDK_ERR_BAD_STATE if cur is malformed.
+ */
+int aws_cryptosdk_priv_deserialize_enc_materials(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_enc_materials **materials,
+    struct aws_hash_table *enc_ctx,
+    struct aws_byte_cursor cur);
+
+/**
+ * Reads back materials written by aws_cryptosdk_priv_serialize_dec_materials into new materials.
+ * Raises AWS_CRYPTOSDK_ERR_BAD_STATE if cur is malformed.
+ */
+int aws_cryptosdk_priv_deserialize_dec_materials(
+    struct aws_allocator *alloc, struct aws_cryptosdk_dec_materials **materials, struct aws_byte_cursor cur);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_CACHE_SERIALIZE_H
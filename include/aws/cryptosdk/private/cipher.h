@@ -17,6 +17,7 @@
 #define AWS_CRYPTOSDK_PRIVATE_CIPHER_H
 
 #include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/private/hkdf.h>
 #include <openssl/evp.h>
 
 /*
@@ -28,6 +29,27 @@ struct aws_cryptosdk_alg_impl {
     const char *curve_name;
 };
 
+/*
+ * Handles for the ciphers and digests the SDK uses. On OpenSSL 3 they are fetched from the
+ * library context set by aws_cryptosdk_set_openssl_lib_ctx the first time they are needed,
+ * and cached; NULL is returned if the algorithm is unavailable there.
+ */
+const EVP_CIPHER *aws_cryptosdk_priv_evp_aes_128_gcm(void);
+const EVP_CIPHER *aws_cryptosdk_priv_evp_aes_192_gcm(void);
+const EVP_CIPHER *aws_cryptosdk_priv_evp_aes_256_gcm(void);
+const EVP_CIPHER *aws_cryptosdk_priv_evp_aes_128_ecb(void);
+const EVP_CIPHER *aws_cryptosdk_priv_evp_aes_192_ecb(void);
+const EVP_CIPHER *aws_cryptosdk_priv_evp_aes_256_ecb(void);
+const EVP_MD *aws_cryptosdk_priv_evp_sha256(void);
+const EVP_MD *aws_cryptosdk_priv_evp_sha384(void);
+const EVP_MD *aws_cryptosdk_priv_evp_sha512(void);
+
+/*
+ * Builds the cached group of every curve the signing suites use, which otherwise happens the
+ * first time each curve is used. Returns false if any of them could not be built.
+ */
+bool aws_cryptosdk_priv_prepare_ec_groups(void);
+
 /**
  * Internal cryptographic helpers.
  * This header is not installed and is not a stable API.
@@ -65,6 +87,19 @@ int aws_cryptosdk_md_finish(struct aws_cryptosdk_md_context *md_context, void *o
 
 void aws_cryptosdk_md_abort(struct aws_cryptosdk_md_context *md_context);
 
+/**
+ * Like aws_cryptosdk_md_finish, but rather than destroying the context, leaves it ready to hash a
+ * new message with the same algorithm. If this fails, the context must be aborted.
+ */
+int aws_cryptosdk_md_finish_reset(struct aws_cryptosdk_md_context *md_context, void *output_buf, size_t *length);
+
+/**
+ * Replaces the state of dest with a copy of that of src, which must use the same algorithm, so
+ * that dest continues from the data hashed into src so far. src is not modified, so several
+ * threads may copy from the same context at once.
+ */
+int aws_cryptosdk_md_copy(struct aws_cryptosdk_md_context *dest, const struct aws_cryptosdk_md_context *src);
+
 /**
  * Derive the decryption key from the data key.
  * Depending on the algorithm ID, this either does a HKDF,
@@ -76,6 +111,51 @@ int aws_cryptosdk_derive_key(
     const struct data_key *data_key,
     const uint8_t *message_id);
 
+/**
+ * Performs the extract half of the key derivation for data_key, so that the content keys of
+ * any number of messages sharing the data key can then be derived with
+ * aws_cryptosdk_derive_key_from_hkdf. Raises AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT for
+ * algorithms without a KDF, whose content key is the data key itself.
+ */
+int aws_cryptosdk_data_key_hkdf_init(
+    const struct aws_cryptosdk_alg_properties *alg_props,
+    struct aws_cryptosdk_hkdf_key *hkdf_key,
+    const struct data_key *data_key);
+
+/**
+ * Derives the content key for message_id from a data key prepared by
+ * aws_cryptosdk_data_key_hkdf_init, for the same algorithm. The result is the same as
+ * aws_cryptosdk_derive_key.
+ */
+int aws_cryptosdk_derive_key_from_hkdf(
+    const struct aws_cryptosdk_alg_properties *alg_props,
+    struct content_key *content_key,
+    const struct aws_cryptosdk_hkdf_key *hkdf_key,
+    const uint8_t *message_id);
+
+/**
+ * Derives the content keys of count messages sharing data_key, one for each of message_ids,
+ * as count calls to aws_cryptosdk_derive_key would. The HKDF extract is done once for all of
+ * them, and the expansions are batched. On failure, all of content_keys are zeroed.
+ */
+int aws_cryptosdk_derive_keys(
+    const struct aws_cryptosdk_alg_properties *alg_props,
+    struct content_key *content_keys,
+    const struct data_key *data_key,
+    const uint8_t *const *message_ids,
+    size_t count);
+
+/**
+ * As aws_cryptosdk_derive_keys, for a data key already prepared by
+ * aws_cryptosdk_data_key_hkdf_init.
+ */
+int aws_cryptosdk_derive_keys_from_hkdf(
+    const struct aws_cryptosdk_alg_properties *alg_props,
+    struct content_key *content_keys,
+    const struct aws_cryptosdk_hkdf_key *hkdf_key,
+    const uint8_t *const *message_ids,
+    size_t count);
+
 /**
  * Verifies the header authentication tag.
  * Returns AWS_OP_SUCCESS if the tag is valid, raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT
@@ -98,10 +178,101 @@ int aws_cryptosdk_sign_header(
 
 enum aws_cryptosdk_frame_type { FRAME_TYPE_SINGLE, FRAME_TYPE_FRAME, FRAME_TYPE_FINAL };
 
-// TODO: Initialize the cipher once and reuse it
+/* Large enough for the message ID, the longest AAD string, the sequence number and the body length */
+#define MAX_FRAME_AAD_LEN 64
+
+/**
+ * A body cipher context, keyed once with a content key and then reused for every frame
+ * of a message. Only the IV is reset between frames.
+ */
+struct aws_cryptosdk_body_codec;
+
+struct aws_cryptosdk_cipher_ctx {
+    const struct aws_cryptosdk_gcm_provider_vt *provider;
+    /*
+     * Frame body routines for the provider, chosen when the context is initialized so that
+     * frames do not re-select them; those of the built-in provider call OpenSSL directly.
+     */
+    const struct aws_cryptosdk_body_codec *codec;
+    /* Provider-specific keyed context, or NULL if not initialized */
+    void *key_ctx;
+    const struct aws_cryptosdk_alg_properties *props;
+    bool enc;
+    /*
+     * The AAD of the last frame processed. Its constant prefix (the message ID and frame type
+     * string) is kept for the following frames of the same type, so that only the sequence
+     * number and length are rewritten per frame. aad_prefix_len is zero if there is none.
+     */
+    uint8_t aad[MAX_FRAME_AAD_LEN];
+    size_t aad_prefix_len;
+    int aad_frame_type;
+    /* GHASH key (the encryption of the zero block), set by aws_cryptosdk_cipher_ctx_enable_verify_only */
+    uint8_t hash_key[16];
+    bool has_hash_key;
+};
+
+/**
+ * Returns true if a GCM provider's vtable has every required member. Providers built against
+ * older headers end before the optional members.
+ */
+bool aws_cryptosdk_priv_gcm_provider_is_complete(const struct aws_cryptosdk_gcm_provider_vt *provider);
+
+/**
+ * Returns true if a digest provider's vtable has every required member.
+ */
+bool aws_cryptosdk_priv_digest_provider_is_complete(const struct aws_cryptosdk_digest_provider_vt *provider);
+
+/**
+ * Initializes a body cipher context for encryption (enc = true) or decryption (enc = false)
+ * with the given content key, using the given GCM provider (or the built-in provider, if
+ * NULL). On failure, raises an error and leaves the context in a state where
+ * aws_cryptosdk_cipher_ctx_clean_up is a no-op.
+ */
+int aws_cryptosdk_cipher_ctx_init(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const struct aws_cryptosdk_gcm_provider_vt *provider,
+    const struct aws_cryptosdk_alg_properties *props,
+    const struct content_key *key,
+    bool enc);
+
+/**
+ * Prepares a body cipher context keyed for decryption with key to check frames with
+ * aws_cryptosdk_verify_body_and_digest. Raises AWS_ERROR_UNSUPPORTED_OPERATION unless the
+ * context uses the built-in GCM provider.
+ */
+int aws_cryptosdk_cipher_ctx_enable_verify_only(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx, const struct content_key *key);
+
+/**
+ * Releases the resources held by a body cipher context. Idempotent; safe to call on a
+ * zero-initialized context.
+ */
+void aws_cryptosdk_cipher_ctx_clean_up(struct aws_cryptosdk_cipher_ctx *cipher_ctx);
+
+/**
+ * As aws_cryptosdk_sign_header, but using a previously keyed encryption context, so that the
+ * header tag and the frames of a message share one key schedule.
+ */
+int aws_cryptosdk_sign_header_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const struct aws_byte_buf *authtag,
+    const struct aws_byte_buf *header);
+
+/**
+ * As aws_cryptosdk_verify_header, but using a previously keyed context. A context keyed for
+ * encryption recomputes the tag and compares it in constant time.
+ */
+int aws_cryptosdk_verify_header_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const struct aws_byte_buf *authtag,
+    const struct aws_byte_buf *header);
+
 /**
  * Decrypts either the body of the message (for non-framed messages) or a single frame of the message.
  * Returns AWS_OP_SUCCESS if successful.
+ *
+ * This sets up a new cipher context for each call; when decrypting many frames under the same
+ * content key, prefer aws_cryptosdk_decrypt_body_with_ctx.
  */
 int aws_cryptosdk_decrypt_body(
     const struct aws_cryptosdk_alg_properties *alg_props,
@@ -129,6 +300,121 @@ int aws_cryptosdk_encrypt_body(
     uint8_t *tag, /* out */
     int body_frame_type);
 
+/**
+ * As aws_cryptosdk_decrypt_body, but using a previously keyed decryption context.
+ */
+int aws_cryptosdk_decrypt_body_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    struct aws_byte_buf *out,
+    const struct aws_byte_cursor *in,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    const uint8_t *iv,
+    const uint8_t *tag,
+    int body_frame_type);
+
+/**
+ * As aws_cryptosdk_encrypt_body, but using a previously keyed encryption context.
+ */
+int aws_cryptosdk_encrypt_body_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    struct aws_byte_buf *out,
+    const struct aws_byte_cursor *in,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    uint8_t *iv,  /* out */
+    uint8_t *tag, /* out */
+    int body_frame_type);
+
+/**
+ * A frame body for aws_cryptosdk_encrypt_bodies_with_ctx and aws_cryptosdk_decrypt_bodies_with_ctx,
+ * with the arguments aws_cryptosdk_encrypt_body_with_ctx (or its decrypt counterpart) would take.
+ */
+struct aws_cryptosdk_body_op {
+    struct aws_byte_buf *out;
+    const struct aws_byte_cursor *in;
+    uint32_t seqno;
+    uint8_t *iv;
+    uint8_t *tag;
+    int body_frame_type;
+    /* Set to the error code the frame failed with, or AWS_ERROR_SUCCESS */
+    int error;
+};
+
+/**
+ * Encrypts count frame bodies of the same message, each as aws_cryptosdk_encrypt_body_with_ctx
+ * would, passing them to the provider's seal_many several at a time if it has one. Returns
+ * AWS_OP_ERR, with the first failing frame's error raised, if any frame fails; the outputs of
+ * failing frames are zeroed.
+ */
+int aws_cryptosdk_encrypt_bodies_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const uint8_t *message_id,
+    struct aws_cryptosdk_body_op *ops,
+    size_t count);
+
+/**
+ * Decryption counterpart of aws_cryptosdk_encrypt_bodies_with_ctx, using open_many.
+ */
+int aws_cryptosdk_decrypt_bodies_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const uint8_t *message_id,
+    struct aws_cryptosdk_body_op *ops,
+    size_t count);
+
+/**
+ * As aws_cryptosdk_encrypt_body_with_ctx, but also feeds the serialized frame containing
+ * the output to signctx (if not NULL): the frame's header once the IV is written, then its
+ * body, then its tag. With the built-in GCM provider, the body is digested a cache-sized
+ * chunk at a time as the ciphertext is produced, rather than in a second pass over the frame.
+ */
+int aws_cryptosdk_encrypt_body_and_digest(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    struct aws_byte_buf *out,
+    const struct aws_byte_cursor *in,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    uint8_t *iv,  /* out */
+    uint8_t *tag, /* out */
+    int body_frame_type,
+    struct aws_cryptosdk_sig_ctx *signctx,
+    struct aws_byte_cursor frame);
+
+/**
+ * As aws_cryptosdk_decrypt_body_with_ctx, but also feeds the serialized frame containing the
+ * input to signctx (if not NULL). With the built-in GCM provider, the body is digested a
+ * cache-sized chunk at a time, just ahead of its decryption.
+ */
+int aws_cryptosdk_decrypt_body_and_digest(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    struct aws_byte_buf *out,
+    const struct aws_byte_cursor *in,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    const uint8_t *iv,
+    const uint8_t *tag,
+    int body_frame_type,
+    struct aws_cryptosdk_sig_ctx *signctx,
+    struct aws_byte_cursor frame);
+
+/**
+ * Authenticates a frame (or the body of a non-framed message) without decrypting it, feeding the
+ * serialized frame to signctx (if not NULL) as aws_cryptosdk_decrypt_body_and_digest does. Only
+ * the GHASH half of GCM is computed over the ciphertext; the tag is compared as OpenSSL would
+ * when decrypting. Raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if the frame does not authenticate.
+ * The context must have been prepared with aws_cryptosdk_cipher_ctx_enable_verify_only.
+ */
+int aws_cryptosdk_verify_body_and_digest(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const struct aws_byte_cursor *in,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    const uint8_t *iv,
+    const uint8_t *tag,
+    int body_frame_type,
+    struct aws_cryptosdk_sig_ctx *signctx,
+    struct aws_byte_cursor frame);
+
 int aws_cryptosdk_genrandom(uint8_t *buf, size_t len);
 
 // TODO: Footer
@@ -182,6 +468,48 @@ int aws_cryptosdk_aes_gcm_decrypt(
     const struct aws_byte_cursor aad,
     const struct aws_string *key);
 
+/**
+ * An AES-GCM wrapping key whose key schedule is expanded once, when it is created, rather than on
+ * every call as with @ref aws_cryptosdk_aes_gcm_encrypt and @ref aws_cryptosdk_aes_gcm_decrypt.
+ * It holds keyed OpenSSL contexts for encryption and decryption, which each call copies or takes
+ * from a small pool and re-IVs. It may be used from several threads at once.
+ */
+struct aws_cryptosdk_aes_gcm_key;
+
+/**
+ * Creates a wrapping key from the bytes of key, which must be 16, 24 or 32 bytes long; otherwise
+ * raises AWS_ERROR_INVALID_BUFFER_SIZE. The key bytes are not referenced after this returns.
+ */
+struct aws_cryptosdk_aes_gcm_key *aws_cryptosdk_aes_gcm_key_new(
+    struct aws_allocator *alloc, const struct aws_byte_cursor key);
+
+/**
+ * Destroys the wrapping key, zeroing its key material. Does nothing if key is NULL.
+ */
+void aws_cryptosdk_aes_gcm_key_destroy(struct aws_cryptosdk_aes_gcm_key *key);
+
+/**
+ * As @ref aws_cryptosdk_aes_gcm_encrypt, with a wrapping key from @ref aws_cryptosdk_aes_gcm_key_new.
+ */
+int aws_cryptosdk_aes_gcm_key_encrypt(
+    struct aws_cryptosdk_aes_gcm_key *key,
+    struct aws_byte_buf *cipher,
+    struct aws_byte_buf *tag,
+    const struct aws_byte_cursor plain,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad);
+
+/**
+ * As @ref aws_cryptosdk_aes_gcm_decrypt, with a wrapping key from @ref aws_cryptosdk_aes_gcm_key_new.
+ */
+int aws_cryptosdk_aes_gcm_key_decrypt(
+    struct aws_cryptosdk_aes_gcm_key *key,
+    struct aws_byte_buf *plain,
+    const struct aws_byte_cursor cipher,
+    const struct aws_byte_cursor tag,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad);
+
 /**
  * Does RSA decryption of an encrypted data key to an unecrypted data key.
  * RSA with PKCS1, OAEP_SHA1_MGF1 and OAEP_SHA256_MGF1 padding modes is supported.
@@ -233,4 +561,45 @@ int aws_cryptosdk_rsa_encrypt(
     const struct aws_string *rsa_public_key_pem,
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode);
 
+/**
+ * An RSA key parsed once from PEM, for use by many calls to @ref aws_cryptosdk_rsa_key_encrypt
+ * or @ref aws_cryptosdk_rsa_key_decrypt without parsing it again. OpenSSL caches the key's
+ * blinding and Montgomery values on it after first use. It may be used from several threads at once.
+ */
+struct aws_cryptosdk_rsa_key;
+
+/**
+ * Parses an RSA public or private key in PEM format. The PEM bytes are not referenced after this
+ * returns. Raises AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN if the key cannot be parsed.
+ */
+struct aws_cryptosdk_rsa_key *aws_cryptosdk_rsa_public_key_new(
+    struct aws_allocator *alloc, struct aws_byte_cursor rsa_public_key_pem);
+struct aws_cryptosdk_rsa_key *aws_cryptosdk_rsa_private_key_new(
+    struct aws_allocator *alloc, struct aws_byte_cursor rsa_private_key_pem);
+
+/**
+ * Destroys the key, zeroing its key material. Does nothing if key is NULL.
+ */
+void aws_cryptosdk_rsa_key_destroy(struct aws_cryptosdk_rsa_key *key);
+
+/**
+ * As @ref aws_cryptosdk_rsa_encrypt, with a key from @ref aws_cryptosdk_rsa_public_key_new.
+ */
+int aws_cryptosdk_rsa_key_encrypt(
+    struct aws_byte_buf *cipher,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor plain,
+    const struct aws_cryptosdk_rsa_key *rsa_public_key,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode);
+
+/**
+ * As @ref aws_cryptosdk_rsa_decrypt, with a key from @ref aws_cryptosdk_rsa_private_key_new.
+ */
+int aws_cryptosdk_rsa_key_decrypt(
+    struct aws_byte_buf *plain,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor cipher,
+    const struct aws_cryptosdk_rsa_key *rsa_private_key,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode);
+
 #endif  // AWS_CRYPTOSDK_PRIVATE_CIPHER_H
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_COARSE_CLOCK_H
+#define AWS_CRYPTOSDK_PRIVATE_COARSE_CLOCK_H
+
+#include <stdint.h>
+
+/*
+ * A process-wide clock which trades precision for the cost of reading it: a ticker thread samples
+ * aws_sys_clock_get_ticks every so often, and readers only load the latest sample, which may be
+ * up to one tick old. The ticker runs while the clock has any holders, ticking as often as the
+ * finest precision any of them asked for since it started.
+ */
+
+/*
+ * Adds a holder asking for a sample at least every precision_ns nanoseconds, starting the ticker
+ * if there were none. The clock is readable as soon as this returns.
+ */
+int aws_cryptosdk_priv_coarse_clock_acquire(uint64_t precision_ns);
+
+/* Removes a holder, stopping the ticker once there are none left */
+void aws_cryptosdk_priv_coarse_clock_release(void);
+
+/*
+ * Reads the latest sample; has the signature of aws_sys_clock_get_ticks, so that it can stand in
+ * for it. Must only be called while the clock has holders.
+ */
+int aws_cryptosdk_priv_coarse_clock_get_ticks(uint64_t *now);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_COARSE_CLOCK_H
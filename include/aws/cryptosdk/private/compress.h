@@ -0,0 +1,64 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_PRIVATE_COMPRESS_H
+#define AWS_CRYPTOSDK_PRIVATE_COMPRESS_H
+
+#include <aws/common/string.h>
+#include <aws/cryptosdk/session.h>
+
+/* The streaming state of one compressor or decompressor */
+struct aws_cryptosdk_codec;
+
+/**
+ * Returns the encryption context key recording how the plaintext of a message was compressed.
+ */
+const struct aws_string *aws_cryptosdk_priv_compression_key(void);
+
+/**
+ * Returns the encryption context value naming the given compression, or NULL for none.
+ */
+const struct aws_string *aws_cryptosdk_priv_compression_name(enum aws_cryptosdk_compression compression);
+
+/**
+ * Looks up the compression with the given name. Raises AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT
+ * if it is unknown, or was not built in.
+ */
+int aws_cryptosdk_priv_compression_from_name(
+    const struct aws_string *name, enum aws_cryptosdk_compression *compression);
+
+/**
+ * Creates a compressor, or a decompressor if compress is false, for one stream.
+ */
+struct aws_cryptosdk_codec *aws_cryptosdk_priv_codec_new(
+    struct aws_allocator *alloc, enum aws_cryptosdk_compression compression, bool compress);
+
+void aws_cryptosdk_priv_codec_destroy(struct aws_cryptosdk_codec *codec);
+
+/**
+ * Runs the codec over as much of *input as fits in the unused capacity of output, advancing
+ * *input past what was consumed and output->len over what was produced. When compressing,
+ * finish indicates that *input holds the end of the stream. Sets *done once the end of the
+ * stream has been written, or read when decompressing; a decompressor then takes no more
+ * input. Raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if the compressed data is malformed.
+ */
+int aws_cryptosdk_priv_codec_run(
+    struct aws_cryptosdk_codec *codec,
+    struct aws_byte_cursor *input,
+    struct aws_byte_buf *output,
+    bool finish,
+    bool *done);
+
+#endif
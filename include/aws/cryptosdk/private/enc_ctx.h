@@ -33,10 +33,27 @@ int aws_cryptosdk_enc_ctx_size(size_t *size, const struct aws_hash_table *enc_ct
 int aws_cryptosdk_enc_ctx_serialize(
     struct aws_allocator *alloc, struct aws_byte_buf *output, const struct aws_hash_table *enc_ctx);
 
+struct aws_cryptosdk_md_context;
+
+/**
+ * Hashes the serialization of an encryption context into md_context, in the same order that
+ * aws_cryptosdk_enc_ctx_serialize would write it, but without building the serialized buffer.
+ * The passed allocator is used for temporary working memory only.
+ */
+int aws_cryptosdk_enc_ctx_digest_update(
+    struct aws_allocator *alloc, struct aws_cryptosdk_md_context *md_context, const struct aws_hash_table *enc_ctx);
+
 /**
  * Deserializes an encryption context from the given cursor, which will be advanced accordingly.
  */
 int aws_cryptosdk_enc_ctx_deserialize(
     struct aws_allocator *alloc, struct aws_hash_table *enc_ctx, struct aws_byte_cursor *cursor);
 
+/**
+ * Returns true if serialized is a well-formed serialized encryption context whose keys are in
+ * strictly increasing order, so that it is the same as aws_cryptosdk_enc_ctx_serialize would
+ * write for the context it holds. Neither allocates nor sorts.
+ */
+bool aws_cryptosdk_enc_ctx_is_canonical(struct aws_byte_cursor serialized);
+
 #endif  // AWS_CRYPTOSDK_PRIVATE_ENC_CTX_H
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_PRIVATE_FRAME_EXECUTOR_H
+#define AWS_CRYPTOSDK_PRIVATE_FRAME_EXECUTOR_H
+
+#include <aws/common/linked_list.h>
+#include <aws/cryptosdk/frame_executor.h>
+
+struct aws_cryptosdk_frame_task_group;
+
+/*
+ * One run of frames handed to an executor; fn is called exactly once, on some thread.
+ * on_executor_thread is false when the thread which called aws_cryptosdk_priv_frame_executor_run
+ * runs the task itself: that thread belongs to the application, which fn must leave where it is.
+ */
+struct aws_cryptosdk_frame_task {
+    struct aws_linked_list_node node;
+    void (*fn)(void *arg, bool on_executor_thread);
+    void *arg;
+    /* Guarded by the executor's mutex */
+    struct aws_cryptosdk_frame_task_group *group;
+    bool started;
+};
+
+/**
+ * Runs every one of tasks: all but the first are queued on the executor, the first is run on
+ * the calling thread, which then runs any of the queued ones no executor thread has started,
+ * and waits for the others. Returns once all have finished.
+ */
+void aws_cryptosdk_priv_frame_executor_run(
+    struct aws_cryptosdk_frame_executor *executor, struct aws_cryptosdk_frame_task *tasks, size_t num_tasks);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_FRAME_EXECUTOR_H
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_PRIVATE_FRAME_INDEX_H
+#define AWS_CRYPTOSDK_PRIVATE_FRAME_INDEX_H
+
+#include <aws/cryptosdk/frame_index.h>
+#include <aws/cryptosdk/private/header.h>
+
+/**
+ * Appends the index prefix describing the message with the given (serialized) header to
+ * index, which must be able to grow (that is, have an allocator).
+ */
+int aws_cryptosdk_priv_frame_index_write_prefix(
+    struct aws_byte_buf *index, const struct aws_cryptosdk_hdr *hdr, size_t header_len);
+
+/**
+ * Appends the record for one frame, whose 16-byte authentication tag is at tag, to index.
+ */
+int aws_cryptosdk_priv_frame_index_append(
+    struct aws_byte_buf *index, uint32_t seqno, uint64_t offset, size_t len, const uint8_t *tag);
+
+/**
+ * Checks that index is well formed and describes the message with the given header. Raises
+ * AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if not.
+ */
+int aws_cryptosdk_priv_frame_index_check(
+    struct aws_byte_cursor index, const struct aws_cryptosdk_hdr *hdr, size_t header_len);
+
+/**
+ * Looks up the record of frame seqno, as aws_cryptosdk_frame_index_lookup, additionally
+ * returning via *tag a pointer to the frame's authentication tag within the index.
+ */
+int aws_cryptosdk_priv_frame_index_get_record(
+    struct aws_byte_cursor index, uint64_t seqno, uint64_t *offset, size_t *len, const uint8_t **tag);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_FRAME_INDEX_H
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_FRAME_POOL_H
+#define AWS_CRYPTOSDK_PRIVATE_FRAME_POOL_H
+
+#include <aws/common/common.h>
+
+/*
+ * A process-wide allocator for large, frame-sized buffers, which sessions and pipelines would
+ * otherwise allocate and free for every message. Requests from AWS_CRYPTOSDK_FRAME_POOL_MIN
+ * bytes up to AWS_CRYPTOSDK_FRAME_POOL_MAX bytes are rounded up to a size class of a power of two
+ * (from 64 KiB) plus a page of slack, so that a buffer for a frame of that size fits its class
+ * along with the frame's sequence number, IV and tag. Buffers are carved from slabs aligned to
+ * 2 MiB and backed by huge pages where possible: explicit ones if the system has any reserved,
+ * otherwise transparent ones on Linux. Released buffers are recycled for any later request of
+ * the same class; slabs are never unmapped, so the pool holds on to its peak usage.
+ *
+ * Other requests, and all requests on platforms without mmap, fall back to the default
+ * allocator. Released buffers are not wiped; as with any allocator, callers holding secrets
+ * clean them up securely. The allocator is thread-safe.
+ */
+#define AWS_CRYPTOSDK_FRAME_POOL_MIN (16 * 1024)
+#define AWS_CRYPTOSDK_FRAME_POOL_MAX (16 * 1024 * 1024)
+
+struct aws_allocator *aws_cryptosdk_frame_buffer_allocator(void);
+
+/* Returns true if ptr lies in a slab of the pool, rather than coming from the fallback */
+bool aws_cryptosdk_frame_pool_owns(const void *ptr);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_FRAME_POOL_H
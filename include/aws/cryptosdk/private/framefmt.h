@@ -20,6 +20,7 @@
 #include <aws/common/common.h>
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/utils.h>
 
 struct aws_cryptosdk_frame {
     /* The type of frame in question */
@@ -103,6 +104,19 @@ int aws_cryptosdk_serialize_frame(
     struct aws_byte_buf *ciphertext_buf,
     const struct aws_cryptosdk_alg_properties *alg_props);
 
+/**
+ * As aws_cryptosdk_serialize_frame, but if ciphertext_buf is too small, returns
+ * AWS_CRYPTOSDK_NEED_MORE without raising an error, with *ciphertext_size set to the exact
+ * space needed. Other failures return AWS_OP_ERR and raise an error as usual.
+ */
+int aws_cryptosdk_try_serialize_frame(
+    struct aws_cryptosdk_frame *frame, /* in/out */
+    size_t *ciphertext_size,           /* out */
+    /* in */
+    size_t plaintext_size,
+    struct aws_byte_buf *ciphertext_buf,
+    const struct aws_cryptosdk_alg_properties *alg_props);
+
 /**
  * Attempts to parse a frame into its constituents.
  *
@@ -141,4 +155,20 @@ int aws_cryptosdk_deserialize_frame(
     const struct aws_cryptosdk_alg_properties *alg_props,
     uint64_t max_frame_size);
 
+/**
+ * As aws_cryptosdk_deserialize_frame, but if the frame is incomplete, returns
+ * AWS_CRYPTOSDK_NEED_MORE without raising an error, with *ciphertext_size and *plaintext_size
+ * set to the bounds described above. Malformed frames return AWS_OP_ERR and raise an error as
+ * usual.
+ */
+int aws_cryptosdk_try_deserialize_frame(
+    /* out */
+    struct aws_cryptosdk_frame *frame,
+    size_t *ciphertext_size,
+    size_t *plaintext_size,
+    /* in */
+    struct aws_byte_cursor *ciphertext_buf,
+    const struct aws_cryptosdk_alg_properties *alg_props,
+    uint64_t max_frame_size);
+
 #endif
@@ -20,11 +20,20 @@
 #include <aws/common/hash_table.h>
 #include "aws/cryptosdk/header.h"
 #include "aws/cryptosdk/materials.h"  // struct aws_cryptosdk_edk
+#include "aws/cryptosdk/private/utils.h"
 
 #define MESSAGE_ID_LEN 16
 struct aws_cryptosdk_hdr {
     struct aws_allocator *alloc;
 
+    // Allocator for parsed EDKs and encryption context entries, which are freed whenever the
+    // header is cleared. Set to alloc by aws_cryptosdk_hdr_init; preserved by aws_cryptosdk_hdr_clear.
+    struct aws_allocator *field_alloc;
+
+    // If set, parsed EDKs refer directly to the input bytes instead of owning copies. The
+    // input must then outlive the EDK list. Preserved by aws_cryptosdk_hdr_clear.
+    bool borrow_edks;
+
     uint16_t alg_id;
 
     uint32_t frame_len;
@@ -37,9 +46,41 @@ struct aws_cryptosdk_hdr {
     struct aws_hash_table enc_ctx;
     struct aws_array_list edk_list;
 
+    // If non-empty, the canonical serialization of enc_ctx, which aws_cryptosdk_hdr_write copies
+    // instead of serializing enc_ctx. The bytes are not owned by the header; zeroed by hdr_clear.
+    struct aws_byte_cursor serialized_enc_ctx;
+
+    // Offset and length of the serialized encryption context within the bytes the header was
+    // parsed from; set by the parse and zeroed by hdr_clear
+    size_t parsed_enc_ctx_offset, parsed_enc_ctx_len;
+
+    // If set, a parsed encryption context in canonical order is only checked, not deserialized
+    // into enc_ctx, and enc_ctx_deferred is set instead; see aws_cryptosdk_hdr_materialize_enc_ctx.
+    // A header with a deferred context cannot be written until it is materialized. Preserved by
+    // aws_cryptosdk_hdr_clear.
+    bool defer_enc_ctx;
+    // Set while enc_ctx is empty pending aws_cryptosdk_hdr_materialize_enc_ctx; zeroed by hdr_clear
+    bool enc_ctx_deferred;
+
+    // If nonzero, the most EDKs and serialized encryption context bytes the parse accepts. Larger
+    // counts raise AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED as soon as they are read, before the context or
+    // any EDK is deserialized. Preserved by aws_cryptosdk_hdr_clear.
+    size_t max_edks, max_enc_ctx_len;
+
     // number of bytes of header except for IV and auth tag,
     // i.e., exactly the bytes that get authenticated
     size_t auth_len;
+
+    // Progress of an in-flight aws_cryptosdk_hdr_parse_incremental; zeroed by hdr_clear
+    struct {
+        int stage;
+        // number of header bytes consumed by the completed parse stages
+        size_t offset;
+        // header bytes required to make progress, as of the last short-buffer return
+        size_t needed;
+        uint16_t aad_len;
+        uint16_t edk_count;
+    } parse;
 };
 
 enum aws_cryptosdk_hdr_version {
@@ -71,6 +112,13 @@ int aws_cryptosdk_hdr_init(struct aws_cryptosdk_hdr *hdr, struct aws_allocator *
  */
 void aws_cryptosdk_hdr_clean_up(struct aws_cryptosdk_hdr *hdr);
 
+/**
+ * Frees the EDKs and encryption context of a parsed header, along with the EDK list's storage,
+ * keeping what is needed to process the message body: the algorithm ID, message ID, frame
+ * length, IV and tag. The header can still be cleared and reused afterwards.
+ */
+void aws_cryptosdk_hdr_trim(struct aws_cryptosdk_hdr *hdr);
+
 /**
  * Resets the header to the same state as it would have after hdr_init
  */
@@ -85,6 +133,36 @@ void aws_cryptosdk_hdr_clear(struct aws_cryptosdk_hdr *hdr);
  */
 int aws_cryptosdk_hdr_parse(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *cursor);
 
+/**
+ * If the header's encryption context was deferred by the parse, deserializes it into enc_ctx from
+ * header_bytes, the bytes the header was parsed from (which must still hold them). Does nothing
+ * otherwise.
+ */
+int aws_cryptosdk_hdr_materialize_enc_ctx(struct aws_cryptosdk_hdr *hdr, const uint8_t *header_bytes);
+
+/**
+ * Resumable variant of aws_cryptosdk_hdr_parse. The cursor must point at the start of the
+ * header, and on each call must present at least the bytes presented on the previous call;
+ * fields which were completely parsed by an earlier call are not parsed again.
+ *
+ * If the header is incomplete, raises AWS_ERROR_SHORT_BUFFER and, if needed is non-NULL, sets
+ * *needed to the number of header bytes required to make further progress. Once the EDK count
+ * and lengths have been read this is the exact size of the header. On success, advances *cursor
+ * past the end of the header.
+ *
+ * Parse progress is kept in hdr; call aws_cryptosdk_hdr_clear to start over with a new header.
+ * On errors other than AWS_ERROR_SHORT_BUFFER the header must be cleared before it is reused.
+ */
+int aws_cryptosdk_hdr_parse_incremental(
+    struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *cursor, size_t *needed);
+
+/**
+ * As aws_cryptosdk_hdr_parse_incremental, but if the header is incomplete, returns
+ * AWS_CRYPTOSDK_NEED_MORE without raising an error.
+ */
+int aws_cryptosdk_hdr_try_parse_incremental(
+    struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *cursor, size_t *needed);
+
 /**
  * Reads information from already parsed hdr object and determines how many bytes are
  * needed to serialize.
@@ -108,6 +186,42 @@ int aws_cryptosdk_hdr_size(const struct aws_cryptosdk_hdr *hdr);
  */
 int aws_cryptosdk_hdr_write(const struct aws_cryptosdk_hdr *hdr, size_t *bytes_written, uint8_t *outbuf, size_t outlen);
 
+/**
+ * Returns the number of bytes needed to serialize the encryption context and EDK sections of a
+ * header (from the AAD length through the last EDK), or zero on overflow.
+ */
+size_t aws_cryptosdk_hdr_fields_size(const struct aws_hash_table *enc_ctx, const struct aws_array_list *edk_list);
+
+/**
+ * Appends the encryption context and EDK sections of a header to output, which must be
+ * preallocated. Raises AWS_ERROR_SHORT_BUFFER if output is too small.
+ */
+int aws_cryptosdk_hdr_write_fields(
+    struct aws_byte_buf *output, const struct aws_hash_table *enc_ctx, const struct aws_array_list *edk_list);
+
+/**
+ * Returns the size of hdr when its encryption context and EDK sections are replaced by
+ * fields_len bytes written by aws_cryptosdk_hdr_write_fields, or zero on overflow.
+ */
+size_t aws_cryptosdk_hdr_size_with_fields(const struct aws_cryptosdk_hdr *hdr, size_t fields_len);
+
+/**
+ * As aws_cryptosdk_hdr_write, but copies the encryption context and EDK sections from fields
+ * rather than serializing hdr->enc_ctx and hdr->edk_list.
+ */
+int aws_cryptosdk_hdr_write_with_fields(
+    const struct aws_cryptosdk_hdr *hdr,
+    struct aws_byte_cursor fields,
+    size_t *bytes_written,
+    uint8_t *outbuf,
+    size_t outlen);
+
+/**
+ * Returns true if the sections in fields, as written by aws_cryptosdk_hdr_write_fields, hold
+ * exactly the EDKs in edk_list, in order. The encryption context section is not compared.
+ */
+bool aws_cryptosdk_hdr_fields_match_edks(struct aws_byte_cursor fields, const struct aws_array_list *edk_list);
+
 /**
  * Returns number of bytes in auth tag for known algorithms, -1 for unknown algorithms.
  */
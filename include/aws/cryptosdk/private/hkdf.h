@@ -17,6 +17,7 @@
 #define AWS_CRYPTOSDK_PRIVATE_HKDF_H
 
 #include <aws/common/byte_buf.h>
+#include <openssl/sha.h>
 
 enum aws_cryptosdk_sha_version {
     AWS_CRYPTOSDK_NOSHA,
@@ -24,6 +25,56 @@ enum aws_cryptosdk_sha_version {
     AWS_CRYPTOSDK_SHA384,
 };
 
+union aws_cryptosdk_sha_ctx {
+    SHA256_CTX sha256;
+    /* SHA-384 runs on the SHA-512 state */
+    SHA512_CTX sha512;
+};
+
+/*
+ * The result of an HKDF extract step: an HMAC keyed with the pseudorandom key, whose inner and
+ * outer hashes have already absorbed their padded key blocks. Expanding from it only hashes the
+ * info and output blocks, so a key kept across messages that share an input key saves both the
+ * extract and the HMAC key setup of each derivation. The struct may be copied freely, and holds
+ * secret material: release it with aws_cryptosdk_hkdf_key_clean_up.
+ */
+struct aws_cryptosdk_hkdf_key {
+    enum aws_cryptosdk_sha_version which_sha;
+    union aws_cryptosdk_sha_ctx inner, outer;
+};
+
+/*
+ * Performs the HKDF extract step of RFC-5869 on salt and ikm. An empty salt stands for HashLen
+ * zero bytes. Raises AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT for an unknown which_sha.
+ */
+int aws_cryptosdk_hkdf_key_init(
+    struct aws_cryptosdk_hkdf_key *hkdf_key,
+    enum aws_cryptosdk_sha_version which_sha,
+    const struct aws_byte_buf *salt,
+    const struct aws_byte_buf *ikm);
+
+/*
+ * Performs the HKDF expand step, filling all okm->len bytes of okm, which must be between 1 and
+ * 255*HashLen. hkdf_key is not modified, so it may be shared by concurrent callers.
+ */
+int aws_cryptosdk_hkdf_key_expand(
+    const struct aws_cryptosdk_hkdf_key *hkdf_key, struct aws_byte_buf *okm, const struct aws_byte_buf *info);
+
+/*
+ * Performs the HKDF expand step for count outputs at once, filling okms[i] as
+ * aws_cryptosdk_hkdf_key_expand would from infos[i]. Outputs of at most HashLen bytes, such as
+ * content keys, are computed side by side from the one keyed state. If any okm has an invalid
+ * length, all of okms are zeroed and nothing is derived; if deriving any of them fails, all of
+ * okms are zeroed and the error is left raised.
+ */
+int aws_cryptosdk_hkdf_key_expand_many(
+    const struct aws_cryptosdk_hkdf_key *hkdf_key,
+    struct aws_byte_buf *okms,
+    const struct aws_byte_buf *infos,
+    size_t count);
+
+void aws_cryptosdk_hkdf_key_clean_up(struct aws_cryptosdk_hkdf_key *hkdf_key);
+
 /*
  * This function performs the HKDF extract then expand steps as described in
  * RFC-5869. The length of the okm (output keying material) is required to be
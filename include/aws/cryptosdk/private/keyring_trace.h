@@ -30,6 +30,30 @@ int aws_cryptosdk_keyring_trace_record_init_clone(
     struct aws_cryptosdk_keyring_trace_record *dest,
     const struct aws_cryptosdk_keyring_trace_record *src);
 
+/**
+ * Initializes trace as a disabled keyring trace: it owns no memory, adding records to it
+ * succeeds without recording anything, and lists transferred or copied into it are left
+ * untouched. Used when the caller has said it will not read the trace.
+ */
+void aws_cryptosdk_keyring_trace_init_disabled(struct aws_array_list *trace);
+
+/**
+ * Frees the records and storage of an initialized trace and makes it a disabled trace.
+ */
+void aws_cryptosdk_keyring_trace_disable(struct aws_array_list *trace);
+
+/**
+ * Returns true if trace was set up by aws_cryptosdk_keyring_trace_init_disabled.
+ */
+bool aws_cryptosdk_keyring_trace_is_disabled(const struct aws_array_list *trace);
+
+/**
+ * Initializes a scratch trace whose records will be transferred into parent, disabling it
+ * if parent is disabled so that nothing is recorded only to be thrown away.
+ */
+int aws_cryptosdk_keyring_trace_init_like(
+    struct aws_allocator *alloc, struct aws_array_list *trace, const struct aws_array_list *parent);
+
 /**
  * Return true if both traces have identical strings and flags, false otherwise.
  */
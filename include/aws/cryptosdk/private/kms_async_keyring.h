@@ -0,0 +1,91 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_PRIVATE_KMS_ASYNC_KEYRING_H
+#define AWS_CRYPTOSDK_PRIVATE_KMS_ASYNC_KEYRING_H
+
+#include <aws/cryptosdk/kms_async_keyring.h>
+
+/*
+ * The KMS JSON protocol as the keyring speaks it, which does not depend on aws-c-http, so that
+ * it is built and tested everywhere.
+ */
+
+enum aws_cryptosdk_kms_op {
+    AWS_CRYPTOSDK_KMS_GENERATE_DATA_KEY,
+    AWS_CRYPTOSDK_KMS_ENCRYPT,
+    AWS_CRYPTOSDK_KMS_DECRYPT,
+};
+
+/* Returns the X-Amz-Target header value for op */
+const char *aws_cryptosdk_kms_target(enum aws_cryptosdk_kms_op op);
+
+/*
+ * Sets *region to the region field of key_id, if it is a KMS key or alias ARN. Returns false,
+ * leaving *region untouched, for any other key ID.
+ */
+bool aws_cryptosdk_kms_region_of_arn(struct aws_byte_cursor *region, struct aws_byte_cursor key_id);
+
+struct aws_cryptosdk_kms_request {
+    enum aws_cryptosdk_kms_op op;
+    /* Required except for DECRYPT, where it is sent only if not empty */
+    struct aws_byte_cursor key_id;
+    /* The plaintext for ENCRYPT, and the ciphertext for DECRYPT */
+    struct aws_byte_cursor blob;
+    /* For GENERATE_DATA_KEY */
+    size_t number_of_bytes;
+    /* May be NULL */
+    const struct aws_hash_table *enc_ctx;
+    const struct aws_string *const *grant_tokens;
+    size_t num_grant_tokens;
+};
+
+/*
+ * Writes the JSON body of request to body, which must be initialized. A plaintext is written
+ * last, after the buffer has grown to hold it, so that no copy of it is left behind by a
+ * reallocation; the caller must clean up body with aws_byte_buf_clean_up_secure.
+ */
+int aws_cryptosdk_kms_request_body(struct aws_byte_buf *body, const struct aws_cryptosdk_kms_request *request);
+
+struct aws_cryptosdk_kms_response {
+    /* The ARN of the KMS key which served the request */
+    struct aws_byte_buf key_id;
+    /* The decoded CiphertextBlob of GENERATE_DATA_KEY and ENCRYPT */
+    struct aws_byte_buf ciphertext;
+    /* The decoded Plaintext of GENERATE_DATA_KEY and DECRYPT, allocated from the secure key allocator */
+    struct aws_byte_buf plaintext;
+};
+
+/*
+ * Parses the body of a successful response to an op request into response, which is
+ * initialized here. Raises AWS_CRYPTOSDK_ERR_KMS_FAILURE if a field op returns is missing or
+ * malformed; response is then left clean.
+ */
+int aws_cryptosdk_kms_response_parse(
+    struct aws_cryptosdk_kms_response *response,
+    struct aws_allocator *alloc,
+    enum aws_cryptosdk_kms_op op,
+    struct aws_byte_cursor body);
+
+void aws_cryptosdk_kms_response_clean_up(struct aws_cryptosdk_kms_response *response);
+
+/*
+ * Returns true if a KMS error response is worth retrying: any 5xx status, a 429, or an error
+ * whose __type is a throttling or internal exception. *throttled is set if the service asked
+ * the caller to slow down.
+ */
+bool aws_cryptosdk_kms_error_is_retryable(int status, struct aws_byte_cursor body, bool *throttled);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_KMS_ASYNC_KEYRING_H
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_PRIVATE_PKCS11_KEYRING_H
+#define AWS_CRYPTOSDK_PRIVATE_PKCS11_KEYRING_H
+
+#include <aws/cryptosdk/pkcs11_keyring.h>
+
+/**
+ * As @ref aws_cryptosdk_pkcs11_keyring_new, with the function list (a CK_FUNCTION_LIST_PTR) of a
+ * module which the caller has already loaded and initialized, and which must stay so for the life
+ * of the keyring. For testing against mock tokens.
+ */
+struct aws_cryptosdk_keyring *aws_cryptosdk_pkcs11_keyring_new_from_functions(
+    struct aws_allocator *alloc,
+    void *functions,
+    unsigned long slot_id,
+    struct aws_byte_cursor pin,
+    const struct aws_string *key_namespace,
+    const struct aws_string *key_name,
+    size_t max_sessions);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_PKCS11_KEYRING_H
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_PRIVATE_PROBES_H
+#define AWS_CRYPTOSDK_PRIVATE_PROBES_H
+
+#include <aws/cryptosdk/private/config.h>
+
+/*
+ * Static tracepoints (USDT probes) in the provider aws_cryptosdk, for tools such as bpftrace and
+ * perf. Where sys/sdt.h is available at build time, each probe compiles to a single nop plus a
+ * note in the ELF file, and costs nothing until a tracer attaches to it; otherwise the macros
+ * expand to nothing, and their arguments are not evaluated.
+ *
+ * Paired probes are named <event>_start and <event>_end, and pass the same first argument so
+ * that a tracer can match them up. The probes are:
+ *
+ *   frame_encrypt_start(seqno, len)               frame_encrypt_end(seqno, len, error)
+ *   frame_decrypt_start(seqno, len)               frame_decrypt_end(seqno, len, error)
+ *   frames_encrypt_start(count)                   frames_encrypt_end(count, error)
+ *   frames_decrypt_start(count)                   frames_decrypt_end(count, error)
+ *   header_parse_start(hdr)                       header_parse_end(hdr, header_len, error)
+ *   header_write_start(hdr)                       header_write_end(hdr, header_len, error)
+ *   cmm_generate_start(session)                   cmm_generate_end(session, error)
+ *   cmm_decrypt_start(session)                    cmm_decrypt_end(session, error)
+ *   cache_hit(shard, is_encrypt)  cache_miss(shard)  cache_evict(shard, reason)
+ *   cache_resize(cache, capacity)
+ *   kms_call_start(operation)                     kms_call_end(operation, latency_us, success)
+ *
+ * error is an AWS error code, or 0 on success. The frames_* probes cover batches of frames
+ * processed together by a GCM provider that handles several at once; the frames in a batch do
+ * not fire frame_* probes of their own. cache_evict's reason is 0 for capacity, 1 for expiry and
+ * 2 for a partition quota. cache_resize fires when capacity tuning resizes a local cache.
+ * kms_call_* take a KmsKeyring::KmsOperation.
+ */
+
+#ifdef AWS_CRYPTOSDK_P_HAVE_SDT
+#    include <sys/sdt.h>
+#    define AWS_CRYPTOSDK_PROBE1(name, a) DTRACE_PROBE1(aws_cryptosdk, name, a)
+#    define AWS_CRYPTOSDK_PROBE2(name, a, b) DTRACE_PROBE2(aws_cryptosdk, name, a, b)
+#    define AWS_CRYPTOSDK_PROBE3(name, a, b, c) DTRACE_PROBE3(aws_cryptosdk, name, a, b, c)
+#else
+/* sizeof keeps the arguments type-checked, and variables used only by probes used, without evaluating them */
+#    define AWS_CRYPTOSDK_PROBE1(name, a) ((void)sizeof(a))
+#    define AWS_CRYPTOSDK_PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#    define AWS_CRYPTOSDK_PROBE3(name, a, b, c) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#endif
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_PROBES_H
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_SECURE_POOL_H
+#define AWS_CRYPTOSDK_PRIVATE_SECURE_POOL_H
+
+#include <aws/common/common.h>
+
+/*
+ * A process-wide allocator for small, short-lived key material: data keys, content keys and
+ * RSA plaintext blocks. Requests of up to AWS_CRYPTOSDK_SECURE_POOL_MAX_SLOT bytes are served
+ * from fixed-size slots in slabs which are locked into memory (where the platform allows it),
+ * excluded from core dumps on Linux, and bounded by inaccessible guard pages. Released slots
+ * are zeroed and recycled, so once the pool is warm, allocation makes no system calls.
+ *
+ * Larger requests, and all requests on platforms without mmap, fall back to the default
+ * allocator; that memory is still zeroed when released. The allocator is thread-safe.
+ */
+#define AWS_CRYPTOSDK_SECURE_POOL_MAX_SLOT 512
+
+struct aws_allocator *aws_cryptosdk_secure_key_allocator(void);
+
+/* Returns true if ptr lies in a slot of the pool, rather than coming from the fallback */
+bool aws_cryptosdk_secure_pool_owns(const void *ptr);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_SECURE_POOL_H
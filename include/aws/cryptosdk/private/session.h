@@ -16,12 +16,31 @@
 #ifndef AWS_CRYPTOSDK_PRIVATE_SESSION_H
 #define AWS_CRYPTOSDK_PRIVATE_SESSION_H
 
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
+#include <aws/cryptosdk/private/arena.h>
 #include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/framefmt.h>
 #include <aws/cryptosdk/private/header.h>
 #include <aws/cryptosdk/session.h>
 
 #define DEFAULT_FRAME_SIZE (256 * 1024)
 
+/* Bounds on the frame sizes chosen by adaptive frame sizing; both are powers of two */
+#define MIN_ADAPTIVE_FRAME_SIZE 4096
+#define MAX_ADAPTIVE_FRAME_SIZE (1024 * 1024)
+/* Largest message of known size that adaptive frame sizing writes unframed */
+#define MAX_ADAPTIVE_UNFRAMED_SIZE 512
+
+/* Smallest block size accepted for block-aligned frames */
+#define MIN_FRAME_BLOCK_SIZE 512
+
+/* Upper bound on the number of worker threads a session may be configured with */
+#define MAX_WORKER_THREADS 64
+
+/* Maximum number of frames handed to the worker threads in a single batch */
+#define MAX_FRAME_JOBS 32
+
 enum session_state {
     /*** Common states ***/
 
@@ -53,6 +72,8 @@ struct aws_cryptosdk_session {
     enum session_state state;
 
     struct aws_cryptosdk_cmm *cmm;
+    /* Set when the session holds no reference on cmm, whose owner keeps it alive instead */
+    bool cmm_borrowed;
 
     /* Encrypt mode configuration */
     uint64_t precise_size; /* Exact size of message */
@@ -60,12 +81,47 @@ struct aws_cryptosdk_session {
     uint64_t data_so_far;  /* Bytes processed thus far */
     bool precise_size_known;
 
-    /* The actual header, if parsed */
+    /* The actual header, if parsed. The allocation is kept across resets (securely zeroed). */
     uint8_t *header_copy;
     size_t header_size;
+    size_t header_copy_capacity;
+
+    /* The parsed header's bytes when decrypting: header_copy, or the caller's input if borrowed */
+    const uint8_t *header_bytes;
+
+    /* Refer to the caller's header bytes instead of copying them; preserved across resets */
+    bool borrow_header;
+
+    /*
+     * Set when borrowed header bytes stay valid for the life of the session, so that the
+     * encryption context can stay deferred past the call that parsed the header
+     */
+    bool borrowed_header_outlives_session;
+
+    /* Allocates objects belonging to the current message, or NULL if disabled; preserved across resets */
+    struct aws_cryptosdk_arena *arena;
     struct aws_cryptosdk_hdr header;
+    /* Storage that the header's EDKs borrow from, if the CMM returned them borrowed; see materials.h */
+    struct aws_cryptosdk_materials_snapshot *edk_snapshot;
     uint64_t frame_size; /* Frame size, zero for unframed */
 
+    /* Choose frame_size for each message when encrypting; preserved across resets */
+    bool adaptive_frame_size;
+    /* Serialized size of each whole frame when encrypting, or zero; preserved across resets */
+    uint32_t frame_block_size;
+
+    /* Output buffer size of the current process call, which adaptive frame sizing fits frames to */
+    size_t output_capacity;
+
+    /* Caller's frozen copy of the encryption context when encrypting, or NULL; cleared on reset */
+    const struct aws_cryptosdk_frozen_enc_ctx *frozen_enc_ctx;
+
+    /* Caller's buffer receiving the frame index when encrypting, or NULL; cleared on reset */
+    struct aws_byte_buf *frame_index_out;
+
+    /* Caller's (borrowed) frame index when decrypting, empty if none; cleared on reset */
+    struct aws_byte_cursor frame_index;
+
     /* List of (struct aws_cryptosdk_keyring_trace_record)s */
     struct aws_array_list keyring_trace;
 
@@ -79,25 +135,259 @@ struct aws_cryptosdk_session {
 
     const struct aws_cryptosdk_alg_properties *alg_props;
 
-    /* Decrypted, derived (if applicable) content key */
-    struct content_key content_key;
+    /* Decrypted, derived (if applicable) content key, in a slot of the secure key pool */
+    struct content_key *content_key;
+
+    /* Body cipher context keyed with content_key, reused across frames */
+    struct aws_cryptosdk_cipher_ctx body_cipher;
+
+    /* Number of threads used to encrypt or decrypt the body; preserved across resets */
+    size_t worker_threads;
+
+    /* Cipher contexts for worker threads beyond the calling thread (worker_threads - 1 entries) */
+    struct aws_cryptosdk_cipher_ctx *worker_ciphers;
+
+    /* The session's own worker_threads - 1 threads, started by aws_cryptosdk_session_set_worker_threads
+     * and kept until the session is destroyed, or NULL for a single thread; preserved across resets */
+    struct aws_cryptosdk_frame_executor *worker_executor;
+
+    /* Shared threads to run worker shares on in place of worker_executor, or NULL; borrowed, and
+     * preserved across resets */
+    struct aws_cryptosdk_frame_executor *frame_executor;
+
+    /* AES-GCM implementation for body frames, or NULL for the built-in one; preserved across resets */
+    const struct aws_cryptosdk_gcm_provider_vt *gcm_provider;
 
     /* In-progress trailing signature context (if applicable) */
     struct aws_cryptosdk_sig_ctx *signctx;
 
+    /* Digest body frames for the signature on a helper thread; preserved across resets */
+    bool pipelined_signature;
+
+    /* Leave the trailing signature for aws_cryptosdk_session_verify_deferred_signatures; preserved across resets */
+    bool defer_signature;
+
+    /* Have CMMs and keyrings leave the keyring trace empty; preserved across resets */
+    bool skip_keyring_trace;
+
+    /* Stop decrypting once the header is authenticated; preserved across resets */
+    bool header_only;
+
+    /* Authenticate the body without producing plaintext; preserved across resets */
+    bool verify_only;
+
+    /* If nonzero, the most EDKs offered to the CMM when decrypting; preserved across resets */
+    size_t max_unwrap_attempts;
+
+    /* Free what decrypting the body does not need once it is reached; preserved across resets */
+    bool compact;
+    /* Set once that has been done for the current message; cleared on reset */
+    bool compacted;
+
+    /* Signature read from the trailer but not yet verified against signctx, or NULL; cleared on reset */
+    struct aws_string *deferred_signature;
+
     /* Set to true after successful call to CMM to indicate availability
      * of keyring trace and--in the case of decryption--the encryption context.
      */
     bool cmm_success;
+
+    /* Set for the duration of a process call whose output buffer overlaps its input */
+    bool in_place;
+
+    /* Set for the duration of a process call whose input is processv's temporary staging buffer */
+    bool input_staged;
+
+    /* Asynchronous materials requests, or NULL for synchronous ones; preserved across resets */
+    aws_cryptosdk_session_ready_fn *on_ready;
+    void *on_ready_user_data;
+
+    /*
+     * Set while a request is outstanding or its result has yet to be picked up. Requests live
+     * here so that they remain valid until the CMM completes them.
+     */
+    bool async_requested;
+    struct aws_cryptosdk_enc_request enc_request;
+    struct aws_cryptosdk_dec_request dec_request;
+
+    /* Guards the completion state below, which is written by the CMM's callback */
+    struct aws_mutex async_mutex;
+    struct aws_condition_variable async_done;
+    bool async_complete;
+    int async_error;
+    struct aws_cryptosdk_enc_materials *async_enc_materials;
+    struct aws_cryptosdk_dec_materials *async_dec_materials;
+
+    /*
+     * Emptied materials from the last message, lent to the CMM through each request so that it
+     * can reuse them; preserved across resets. Only materials allocated from the session's own
+     * allocator are kept, as arena allocations do not outlive the message.
+     */
+    struct aws_cryptosdk_enc_materials *spare_enc_materials;
+    struct aws_cryptosdk_dec_materials *spare_dec_materials;
+
+    /* Counters for the current message; cleared on reset. stats.frames is derived on demand. */
+    struct aws_cryptosdk_session_stats stats;
+
+    /* When time in the current state started being counted, or zero outside of session calls */
+    uint64_t state_since;
+
+    /* State transition tracing, or NULL if disabled; preserved across resets */
+    aws_cryptosdk_session_trace_fn *on_trace;
+    void *on_trace_user_data;
+
+    /* Receives all output in place of the caller's buffer, or NULL; preserved across resets */
+    aws_cryptosdk_session_sink_fn *sink;
+    void *sink_user_data;
+    /* The sink's output buffer, which keeps its allocation across messages */
+    struct aws_byte_buf sink_buf;
+
+    /* Receives each decrypted frame in place of the caller's buffer, or NULL; preserved across resets */
+    aws_cryptosdk_session_plaintext_fn *plaintext_sink;
+    void *plaintext_sink_user_data;
+    /* Plaintext of the current message passed to the plaintext sink; cleared on reset */
+    uint64_t plaintext_sunk;
+
+    /* Supplies all input in place of the caller's buffer, or NULL; preserved across resets */
+    aws_cryptosdk_session_source_fn *source;
+    void *source_user_data;
+    /* Input pulled from the source and not yet consumed; keeps its allocation across messages */
+    struct aws_byte_buf source_buf;
+
+    /* Compression of the plaintext to encrypt; preserved across resets */
+    enum aws_cryptosdk_compression compression;
+    /* The current message's compressor or decompressor, or NULL; cleared on reset */
+    struct aws_cryptosdk_codec *codec;
+    /* Set once a decrypt session has looked for the message's compression */
+    bool codec_checked;
+    /* Set once the codec has written, or read, the end of its stream */
+    bool codec_done;
+    /* Plaintext size set for a compressed message being encrypted, and the plaintext taken so far */
+    uint64_t codec_plain_size;
+    bool codec_plain_size_known;
+    uint64_t codec_plain_in;
+    /* Compressed bytes produced when encrypting */
+    uint64_t codec_out;
+    /* Compressed plaintext between the codec and the body; keeps its allocation across messages */
+    struct aws_byte_buf codec_buf;
+};
+
+/*
+ * A single frame's worth of body cipher work. For encryption, input is the plaintext and output
+ * is frame.ciphertext; for decryption, input is frame.ciphertext and output is a slice of the
+ * plaintext buffer. The IV and tag are taken from (or written to) frame.iv and frame.authtag.
+ */
+struct aws_cryptosdk_frame_job {
+    struct aws_cryptosdk_frame frame;
+    struct aws_byte_cursor input;
+    struct aws_byte_buf output;
+    /*
+     * For in-place decryption, the frame is decrypted where it lies (output aliases input) and
+     * the plaintext is moved here, in frame order, once the whole batch has authenticated.
+     * NULL otherwise.
+     */
+    uint8_t *in_place_dest;
+    /* The whole serialized frame (header, body and tag), for digesting along with the body */
+    struct aws_byte_cursor serialized;
+    /* Error code raised while processing this frame, or AWS_ERROR_SUCCESS */
+    int error;
 };
 
 /* Common session routines */
 
 void aws_cryptosdk_priv_session_change_state(struct aws_cryptosdk_session *session, enum session_state new_state);
+
+/*
+ * Derives the session's content key from data_key and the message ID, counting the time taken
+ * as HKDF rather than as part of the current state.
+ */
+int aws_cryptosdk_priv_session_derive_key(struct aws_cryptosdk_session *session, const struct data_key *data_key);
+
+/*
+ * Returns the allocator for objects which live no longer than the current message: the session's
+ * arena if enabled, and otherwise the session's allocator. Asynchronous materials requests, which
+ * the CMM may complete on another thread, always get the session's allocator.
+ */
+struct aws_allocator *aws_cryptosdk_priv_message_alloc(const struct aws_cryptosdk_session *session);
+
+/*
+ * Returns the allocator for the session's frame-sized buffers, and for those of pipelines running
+ * it: the frame buffer pool if enabled, and otherwise the session's allocator.
+ */
+struct aws_allocator *aws_cryptosdk_priv_buffer_alloc(const struct aws_cryptosdk_session *session);
+
+/* Completion callbacks for asynchronous materials requests; user_data is the session */
+void aws_cryptosdk_priv_enc_materials_ready(
+    struct aws_cryptosdk_enc_materials *materials, int error_code, void *user_data);
+void aws_cryptosdk_priv_dec_materials_ready(
+    struct aws_cryptosdk_dec_materials *materials, int error_code, void *user_data);
+
+/*
+ * Checks on the outstanding asynchronous request. Sets *ready to false if it has not completed.
+ * Otherwise clears the request, leaving its materials (if any) in async_enc_materials or
+ * async_dec_materials, and raises its error (if any).
+ */
+int aws_cryptosdk_priv_session_poll_async(struct aws_cryptosdk_session *session, bool *ready);
 int aws_cryptosdk_priv_fail_session(struct aws_cryptosdk_session *session, int error_code);
 
+/**
+ * Makes session->header_copy large enough for session->header_size bytes, reusing the
+ * buffer kept from a previous message when it is big enough.
+ */
+int aws_cryptosdk_priv_reserve_header_copy(struct aws_cryptosdk_session *session);
+
+/**
+ * Returns the size of a serialized frame of the given type carrying plaintext_size bytes.
+ */
+size_t aws_cryptosdk_priv_frame_ciphertext_size(
+    const struct aws_cryptosdk_alg_properties *props, enum aws_cryptosdk_frame_type type, size_t plaintext_size);
+
+/**
+ * Returns the GCM provider for the session's body: its own, if one was set, else the kernel
+ * selected for its frame size (see aws_cryptosdk_select_kernels). Verify-only sessions need
+ * the built-in provider, which NULL stands for.
+ */
+const struct aws_cryptosdk_gcm_provider_vt *aws_cryptosdk_priv_session_gcm_provider(
+    const struct aws_cryptosdk_session *session);
+
+/**
+ * Returns how many frames an encrypting session gathers into jobs for each call to
+ * aws_cryptosdk_priv_run_frame_jobs: many when they can be spread over worker threads or
+ * handed to the GCM provider's seal_many or open_many, otherwise one at a time, which lets a
+ * single frame be digested as it is encrypted. Decryption always gathers up to MAX_FRAME_JOBS
+ * frames, and digests them as they are decrypted where this returns 1.
+ */
+size_t aws_cryptosdk_priv_frame_batch_limit(const struct aws_cryptosdk_session *session);
+
+/**
+ * Runs the body cipher over each of the given frame jobs, spreading them over the session's
+ * worker threads when more than one is configured. The direction (encrypt or decrypt) follows
+ * the session's body cipher context. On success, any in-place plaintext is then moved to
+ * its final destination. On failure, raises the error of the first failed frame (in frame
+ * order); the outputs of all jobs are then unspecified and must be discarded.
+ *
+ * If signctx is not NULL, the jobs are instead run in order on the calling thread, and each
+ * frame's serialized bytes are fed to signctx, the body as it is encrypted or decrypted.
+ *
+ * Jobs of verify-only sessions are authenticated without being decrypted; their outputs are
+ * left untouched.
+ */
+int aws_cryptosdk_priv_run_frame_jobs(
+    struct aws_cryptosdk_session *session,
+    struct aws_cryptosdk_frame_job *jobs,
+    size_t num_jobs,
+    struct aws_cryptosdk_sig_ctx *signctx);
+
 /* Decrypt path */
 int aws_cryptosdk_priv_unwrap_keys(struct aws_cryptosdk_session *AWS_RESTRICT session);
+
+/**
+ * Obtains the data key for the session's parsed header from the CMM, synchronously and just as
+ * a decrypt session would, then derives the content key, keys the body cipher context for
+ * encryption and checks the header against it. session->alg_props must already be set. Used
+ * to resume encrypting a message from a checkpoint.
+ */
+int aws_cryptosdk_priv_recover_content_key(struct aws_cryptosdk_session *session);
 int aws_cryptosdk_priv_try_parse_header(
     struct aws_cryptosdk_session *AWS_RESTRICT session, struct aws_byte_cursor *AWS_RESTRICT input);
 int aws_cryptosdk_priv_try_decrypt_body(
@@ -107,6 +397,28 @@ int aws_cryptosdk_priv_try_decrypt_body(
 int aws_cryptosdk_priv_check_trailer(
     struct aws_cryptosdk_session *AWS_RESTRICT session, struct aws_byte_cursor *AWS_RESTRICT pinput);
 
+/**
+ * Returns how much input the next step needs when buffered bytes of it are already at hand,
+ * never counting past the end of the message: unlike the input estimate, which assumes a
+ * regular frame until it has seen enough of the next frame to tell.
+ */
+size_t aws_cryptosdk_priv_decrypt_input_needed(const struct aws_cryptosdk_session *session, size_t buffered);
+
+/**
+ * Returns true if the parsed header's encryption context marks the message as compressed.
+ * Only the streaming decrypt decompresses; other decrypt paths must refuse such messages.
+ */
+bool aws_cryptosdk_priv_is_compressed(const struct aws_cryptosdk_session *session);
+
+/**
+ * Computes the total plaintext size of the message body at the start of body, which must
+ * hold the complete body. Only valid in ST_DECRYPT_BODY, before any frames are decrypted.
+ * Raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if the body is malformed or incomplete, and
+ * AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT if the message is compressed.
+ */
+int aws_cryptosdk_priv_decrypt_output_size(
+    const struct aws_cryptosdk_session *session, struct aws_byte_cursor body, uint64_t *size);
+
 /* Encrypt path */
 void aws_cryptosdk_priv_encrypt_compute_body_estimate(struct aws_cryptosdk_session *session);
 
@@ -119,4 +431,11 @@ int aws_cryptosdk_priv_try_encrypt_body(
 int aws_cryptosdk_priv_write_trailer(
     struct aws_cryptosdk_session *AWS_RESTRICT session, struct aws_byte_buf *AWS_RESTRICT poutput);
 
+/**
+ * Computes the exact size of the complete ciphertext message: header, body and trailer.
+ * Requires the precise message size to be known and the materials to have been generated
+ * (i.e. the session has passed ST_GEN_KEY).
+ */
+int aws_cryptosdk_priv_encrypt_output_size(const struct aws_cryptosdk_session *session, uint64_t *size);
+
 #endif
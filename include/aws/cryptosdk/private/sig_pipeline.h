@@ -0,0 +1,73 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef AWS_CRYPTOSDK_PRIVATE_SIG_PIPELINE_H
+#define AWS_CRYPTOSDK_PRIVATE_SIG_PIPELINE_H
+
+#include <aws/common/atomics.h>
+#include <aws/common/byte_buf.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/cipher.h>
+
+/*
+ * Feeds spans of a message into a signature context on a helper thread, so that the digest of
+ * one batch of frames overlaps the encryption or decryption of the next. The calling thread is
+ * the only producer and the helper the only consumer of a fixed ring of spans; the ring's
+ * indices are atomics, and either side only takes the mutex to sleep or to wake the other.
+ *
+ * The spans must stay valid and unmodified until they have been consumed, which
+ * aws_cryptosdk_priv_sig_pipeline_wait and aws_cryptosdk_priv_sig_pipeline_finish guarantee.
+ * If the helper thread cannot be started, spans are digested on the calling thread as they are
+ * pushed.
+ */
+#define AWS_CRYPTOSDK_SIG_PIPELINE_SLOTS 64
+
+struct aws_cryptosdk_sig_pipeline {
+    struct aws_cryptosdk_sig_ctx *signctx;
+    struct aws_byte_cursor spans[AWS_CRYPTOSDK_SIG_PIPELINE_SLOTS];
+    /* Counts of spans pushed and consumed; each is only written by one side */
+    struct aws_atomic_var head, tail;
+    /* Set by a side about to sleep, so that the other knows to wake it */
+    struct aws_atomic_var consumer_waiting, producer_waiting;
+    /* First error raised by the digest, or AWS_ERROR_SUCCESS; once set, later spans are skipped */
+    struct aws_atomic_var error;
+    struct aws_atomic_var done;
+    struct aws_mutex mutex;
+    struct aws_condition_variable cond;
+    struct aws_thread thread;
+    bool launched;
+};
+
+/* Starts digesting into signctx, which must not be used by anyone else until the pipeline finishes */
+void aws_cryptosdk_priv_sig_pipeline_start(
+    struct aws_cryptosdk_sig_pipeline *pipeline, struct aws_allocator *alloc, struct aws_cryptosdk_sig_ctx *signctx);
+
+/* Queues span to be digested after all spans pushed before it, waiting if the ring is full */
+void aws_cryptosdk_priv_sig_pipeline_push(struct aws_cryptosdk_sig_pipeline *pipeline, struct aws_byte_cursor span);
+
+/*
+ * Waits until every span pushed so far has been digested, after which their memory may be
+ * reused. Raises the digest's error, if any.
+ */
+int aws_cryptosdk_priv_sig_pipeline_wait(struct aws_cryptosdk_sig_pipeline *pipeline);
+
+/*
+ * Waits for the outstanding spans and stops the helper thread, returning the signature context
+ * to the caller. Raises the digest's error, if any.
+ */
+int aws_cryptosdk_priv_sig_pipeline_finish(struct aws_cryptosdk_sig_pipeline *pipeline);
+
+#endif  // AWS_CRYPTOSDK_PRIVATE_SIG_PIPELINE_H
@@ -16,9 +16,19 @@
 #define AWS_CRYPTOSDK_PRIVATE_UTILS_H
 
 #include <aws/common/array_list.h>
+#include <aws/common/byte_buf.h>
 #include <aws/common/hash_table.h>
 #include <aws/common/string.h>
 
+/**
+ * Returned by the non-raising serializers and parsers (such as aws_cryptosdk_try_serialize_frame)
+ * when a buffer is too short, alongside AWS_OP_SUCCESS and AWS_OP_ERR. No error is raised; the
+ * size needed is reported through the function's output arguments instead. Running short of
+ * buffer is routine while streaming, so this keeps it off the error path, whose thread-local
+ * write and error handler are reserved for real errors.
+ */
+#define AWS_CRYPTOSDK_NEED_MORE 1
+
 /**
  * Allocates array list and places all hash elements from map into it.
  * No guarantees are made about the order of elements.
@@ -44,4 +54,27 @@ int aws_cryptosdk_compare_hash_elems_by_key_string(const void *elem_a, const voi
  * aws_string_destroy is a no-op for static strings.
  */
 struct aws_string *aws_cryptosdk_string_dup(struct aws_allocator *alloc, const struct aws_string *str);
+
+/**
+ * Returns a reference-counted copy of str, for strings such as wrapping key names that are
+ * recorded over and over. aws_cryptosdk_string_dup of the result takes another reference
+ * instead of copying, and aws_string_destroy drops one; the memory, which comes from alloc,
+ * is freed with the last reference. A static or already interned str is returned as is
+ * (with a new reference in the latter case). Interned strings must not be destroyed with
+ * aws_string_destroy_secure, as other holders still read them.
+ */
+struct aws_string *aws_cryptosdk_string_intern(struct aws_allocator *alloc, const struct aws_string *str);
+
+/**
+ * Prepares buf to hold capacity bytes, leaving it empty. If buf already owns an allocation
+ * from alloc that is large enough, it is securely zeroed and reused; otherwise any existing
+ * allocation is released and a new one is made, as with aws_byte_buf_init. A reused buffer's
+ * capacity may exceed the one asked for, so callers must fill it to the length they need.
+ */
+int aws_cryptosdk_byte_buf_reinit(struct aws_byte_buf *buf, struct aws_allocator *alloc, size_t capacity);
+
+/**
+ * Returns a hash of the calling thread's ID, for spreading threads over a fixed set of slots.
+ */
+uint64_t aws_cryptosdk_current_thread_hash(void);
 #endif  // AWS_CRYPTOSDK_PRIVATE_UTILS_H
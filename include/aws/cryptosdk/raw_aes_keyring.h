@@ -61,6 +61,47 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_aes_keyring_new(
     const uint8_t *key_bytes,
     enum aws_cryptosdk_aes_key_len key_len);
 
+/**
+ * A keyring which holds any number of raw AES wrapping keys, each with its own namespace and
+ * name, and which behaves towards each EDK as the raw AES keyring with that namespace and name
+ * would. The keys are indexed by namespace and name, so on decrypt the right key for an EDK is
+ * found with a single lookup, however many keys are held; this is much cheaper than a multi-keyring
+ * of one raw AES keyring per key when there are many keys, e.g. one per tenant.
+ *
+ * The keyring starts out empty. Add keys with aws_cryptosdk_raw_aes_key_store_keyring_add_key,
+ * and choose the one new data keys are encrypted under with
+ * aws_cryptosdk_raw_aes_key_store_keyring_set_encrypt_key; until then, encryption fails with
+ * AWS_CRYPTOSDK_ERR_BAD_STATE. Keys must all be added before the keyring is used, and in
+ * particular before it is shared between threads.
+ *
+ * On failure returns NULL and sets an internal AWS error code.
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_keyring *aws_cryptosdk_raw_aes_key_store_keyring_new(struct aws_allocator *alloc);
+
+/**
+ * Adds a wrapping key to a keyring made by aws_cryptosdk_raw_aes_key_store_keyring_new. The
+ * namespace, name and key bytes are copied, as for aws_cryptosdk_raw_aes_keyring_new.
+ *
+ * Fails with AWS_CRYPTOSDK_ERR_RESERVED_NAME for the namespace "aws-kms", and with
+ * AWS_ERROR_INVALID_ARGUMENT if the keyring already holds a key of this namespace and name.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_raw_aes_key_store_keyring_add_key(
+    struct aws_cryptosdk_keyring *kr,
+    const struct aws_string *key_namespace,
+    const struct aws_string *key_name,
+    const uint8_t *key_bytes,
+    enum aws_cryptosdk_aes_key_len key_len);
+
+/**
+ * Selects the previously added key that data keys are encrypted under. Fails with
+ * AWS_ERROR_INVALID_ARGUMENT if the keyring holds no key of this namespace and name.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_raw_aes_key_store_keyring_set_encrypt_key(
+    struct aws_cryptosdk_keyring *kr, const struct aws_string *key_namespace, const struct aws_string *key_name);
+
 /** @} */  // doxygen group raw_keyring
 
 #ifdef __cplusplus
@@ -16,6 +16,7 @@
 #define AWS_CRYPTOSDK_RAW_RSA_KEYRING_H
 
 #include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/executor.h>
 #include <aws/cryptosdk/materials.h>
 
 #ifdef __cplusplus
@@ -33,10 +34,11 @@ extern "C" {
  * to NULL. Encryption is possible only when a public key is provided, and
  * decryption is possible only when a private key is provided.
  *
- * Key namespace, name, RSA private key and RSA public key provided by the caller
- * are copied into the state of the keyring, so those arrays do not need to be
- * maintained while using the keyring. For maximum security, the caller should
- * zero out the array of 'rsa_private_key_pem' after creating this object.
+ * Key namespace and name are copied into the state of the keyring, and the RSA
+ * keys are parsed when the keyring is created, so none of those arrays need to
+ * be maintained while using the keyring. For maximum security, the caller should
+ * zero out the array of 'rsa_private_key_pem' after creating this object. Creation
+ * fails with AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN if a key cannot be parsed.
  *
  * Set your own namespace and name for the wrapping (RSA) key you use, for
  * bookkeeping purposes. A raw RSA keyring which attempts to decrypt data
@@ -59,6 +61,45 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_rsa_keyring_new(
     const char *rsa_public_key_pem,
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode);
 
+/**
+ * One message's worth of work for @ref aws_cryptosdk_raw_rsa_keyring_decrypt_batch. The caller
+ * fills in edks, alg and keyring_trace, and leaves unencrypted_data_key unallocated.
+ */
+struct aws_cryptosdk_raw_rsa_batch_item {
+    /** The message's EDKs, as passed to On Decrypt */
+    const struct aws_array_list *edks;
+    enum aws_cryptosdk_alg_id alg;
+    /** Receives the trace record of a successful unwrap; each item must have a list of its own */
+    struct aws_array_list *keyring_trace;
+    /** Set to the data key, or left unallocated if none of the EDKs could be unwrapped */
+    struct aws_byte_buf unencrypted_data_key;
+    /** Set to AWS_ERROR_SUCCESS, or to the error raised while unwrapping this item's EDKs */
+    int error;
+};
+
+/**
+ * Unwraps the data keys of many messages with a raw RSA keyring, doing for each item what On
+ * Decrypt would. With an executor, the items are spread over num_workers tasks handed to it plus
+ * the calling thread, each taking the next unprocessed item until none are left, so throughput
+ * grows with the number of cores; with a NULL executor, the items are processed in order on the
+ * calling thread. Returns once all items are done.
+ *
+ * The outcome of each item is reported in the item, and a failed item does not stop the others.
+ * request_alloc must be safe to use from several threads at once when there is an executor.
+ *
+ * Fails with AWS_CRYPTOSDK_ERR_BAD_STATE, without processing any item, if the keyring has no
+ * private key.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_raw_rsa_keyring_decrypt_batch(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_cryptosdk_raw_rsa_batch_item *items,
+    size_t num_items,
+    aws_cryptosdk_executor_fn *executor,
+    void *executor_data,
+    size_t num_workers);
+
 #ifdef __cplusplus
 }
 #endif
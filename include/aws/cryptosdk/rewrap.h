@@ -0,0 +1,110 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_REWRAP_H
+#define AWS_CRYPTOSDK_REWRAP_H
+
+#include <aws/cryptosdk/exports.h>
+#include <aws/cryptosdk/materials.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @ingroup session
+ * Re-keys messages under new wrapping keys without decrypting their bodies, as when rotating
+ * wrapping keys. The data key of each message is obtained from a CMM, just as a decrypt session
+ * would, and encrypted anew by a keyring. The header is rewritten with the new EDKs in place of
+ * the old ones and authenticated afresh, and the frames that follow are copied through byte for
+ * byte: the content key, and so every frame's AAD and tag, depend only on the data key and the
+ * message ID, which are unchanged.
+ *
+ * The original header is authenticated before it is rewritten, but the body is not read beyond
+ * its frame structure, so a damaged frame is only caught when the rewrapped message is
+ * decrypted. Only algorithm suites without a trailing signature can be rewrapped, since the
+ * signature covers the header and can only be made again with the private key of the writer.
+ */
+struct aws_cryptosdk_rewrap;
+
+/**
+ * Creates a rewrapper which unwraps data keys with cmm and wraps them with keyring, holding a
+ * reference on each.
+ *
+ * @return The new rewrapper, or NULL on failure (in which case, an AWS error code is set)
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_rewrap *aws_cryptosdk_rewrap_new(
+    struct aws_allocator *alloc, struct aws_cryptosdk_cmm *cmm, struct aws_cryptosdk_keyring *keyring);
+
+/**
+ * Destroys the rewrapper, releasing its references on the CMM and keyring.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_rewrap_destroy(struct aws_cryptosdk_rewrap *rewrap);
+
+/**
+ * Makes the rewrapper ready for a new message, discarding any progress (or error) on the last
+ * one. Buffers allocated for earlier headers are kept.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_rewrap_reset(struct aws_cryptosdk_rewrap *rewrap);
+
+/**
+ * Streams the message through the rewrapper, in the manner of
+ * @ref aws_cryptosdk_session_process: reads up to inlen bytes of the original message from inp,
+ * and writes up to outlen bytes of the rewrapped message to outp, setting *in_bytes_read and
+ * *out_bytes_written to the amounts consumed and produced. The header is taken in pieces of any
+ * size and written out in pieces to fit the output; frames are copied whole, so each needs to be
+ * presented in full, along with as much output space. Use @ref aws_cryptosdk_rewrap_estimate_buf
+ * to learn how much is needed when a call makes no progress.
+ *
+ * Raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if the header does not authenticate or the frames are
+ * malformed, AWS_ERROR_UNSUPPORTED_OPERATION for a signed algorithm suite, and
+ * AWS_CRYPTOSDK_ERR_BAD_STATE if the keyring made no EDK. Errors from the CMM and keyring are
+ * passed on. After an error, *out_bytes_written is zero, the output written by earlier calls must
+ * be discarded, and the error is raised again until the rewrapper is reset. The input and output
+ * buffers must not overlap.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_rewrap_message(
+    struct aws_cryptosdk_rewrap *rewrap,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen,
+    size_t *in_bytes_read);
+
+/**
+ * Returns true once the whole message has been read and the rewrapped message written.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_rewrap_is_done(const struct aws_cryptosdk_rewrap *rewrap);
+
+/**
+ * Estimates the buffer sizes the next call to @ref aws_cryptosdk_rewrap_message needs in order
+ * to make progress: the input still needed to complete the header or the next frame, and the
+ * output needed to write the rest of the header or that frame.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_rewrap_estimate_buf(
+    const struct aws_cryptosdk_rewrap *rewrap, size_t *outlen_needed, size_t *inlen_needed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_REWRAP_H
@@ -16,6 +16,7 @@
 #ifndef AWS_CRYPTOSDK_SESSION_H
 #define AWS_CRYPTOSDK_SESSION_H
 
+#include <aws/cryptosdk/executor.h>
 #include <aws/cryptosdk/materials.h>
 
 /**
@@ -88,6 +89,23 @@ AWS_CRYPTOSDK_API
 struct aws_cryptosdk_session *aws_cryptosdk_session_new_from_cmm(
     struct aws_allocator *allocator, enum aws_cryptosdk_mode mode, struct aws_cryptosdk_cmm *cmm);
 
+/**
+ * Creates a new encryption or decryption session which uses cmm without taking a reference on
+ * it, just as @ref aws_cryptosdk_session_new_from_cmm does otherwise. The caller must keep cmm
+ * alive, through a reference of its own, until the session is destroyed.
+ *
+ * Retaining and releasing a CMM are atomic operations on a counter which every thread using the
+ * CMM shares; when many threads each create and destroy a session per message, that counter's
+ * cache line bounces between cores. A session pool or worker thread which already holds a
+ * reference for as long as its sessions live can use this instead, so that sessions do not
+ * touch the CMM's reference count at all.
+ *
+ * @return The new session, or NULL on failure (in which case, an AWS error code is set)
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_session *aws_cryptosdk_session_new_borrowing_cmm(
+    struct aws_allocator *allocator, enum aws_cryptosdk_mode mode, struct aws_cryptosdk_cmm *cmm);
+
 /** Destroys a previously allocated session */
 AWS_CRYPTOSDK_API
 void aws_cryptosdk_session_destroy(struct aws_cryptosdk_session *session);
@@ -103,6 +121,368 @@ void aws_cryptosdk_session_destroy(struct aws_cryptosdk_session *session);
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_session_reset(struct aws_cryptosdk_session *session, enum aws_cryptosdk_mode mode);
 
+/**
+ * Sets the number of threads used to encrypt or decrypt the message body. When more than
+ * one thread is configured, all complete frames that fit within the buffers passed to
+ * @ref aws_cryptosdk_session_process are processed concurrently, with the calling thread
+ * doing its share of the work. The output, and any trailing signature, are identical to
+ * those produced by a single-threaded session.
+ *
+ * Each thread takes a contiguous run of those frames. Where built with libnuma (see USE_LIBNUMA)
+ * on a host with several NUMA nodes, each worker thread runs its frames on the node holding
+ * their input. The calling thread is never moved, even when it runs frames a worker thread has
+ * not yet got to.
+ *
+ * The num_threads - 1 worker threads are started by this call and kept, idle between batches,
+ * until the session is destroyed or this is called again, so that no threads are started per
+ * batch of frames. The default is one thread (no worker threads are started). This setting is
+ * preserved across @ref aws_cryptosdk_session_reset. Sessions can instead share a fixed set of
+ * threads; see @ref aws_cryptosdk_session_set_frame_executor.
+ *
+ * This function will fail if @ref aws_cryptosdk_session_process has been called since
+ * the session was created or last reset, or if num_threads is zero or unreasonably large.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_worker_threads(struct aws_cryptosdk_session *session, size_t num_threads);
+
+/**
+ * Enables or disables computing the trailing signature's digest on a helper thread. For
+ * algorithm suites with a trailing signature, each batch of frames is then hashed while the
+ * next one is encrypted or decrypted, rather than afterwards; for decryption into a separate
+ * output buffer, a batch is hashed while it is decrypted. The helper thread lives for the
+ * duration of each @ref aws_cryptosdk_session_process call, which does not return until the
+ * digest has caught up with its input and output. The signature is unaffected.
+ *
+ * This is disabled by default and makes no difference to unsigned algorithm suites. The
+ * setting is preserved across @ref aws_cryptosdk_session_reset. This function will fail if
+ * @ref aws_cryptosdk_session_process has been called since the session was created or last
+ * reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_pipelined_signature(struct aws_cryptosdk_session *session, bool enable);
+
+/**
+ * Has a decrypt session leave the trailing signature unchecked, so that the signatures of many
+ * messages can be verified together with @ref aws_cryptosdk_session_verify_deferred_signatures.
+ * Once the session has read the signature it is done, as @ref aws_cryptosdk_session_is_done
+ * reports, but the message is not authenticated: the plaintext it produced, which is never
+ * authenticated until the signature has been checked, must not be trusted until then.
+ *
+ * This is disabled by default and makes no difference to unsigned algorithm suites or to
+ * encryption. The setting is preserved across @ref aws_cryptosdk_session_reset, which discards
+ * any signature still awaiting verification. This function will fail if
+ * @ref aws_cryptosdk_session_process has been called since the session was created or last
+ * reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_deferred_signature(struct aws_cryptosdk_session *session, bool enable);
+
+/**
+ * Verifies the deferred signatures (see @ref aws_cryptosdk_session_set_deferred_signature) of
+ * num_sessions done sessions. With an executor, the sessions are spread over num_workers tasks
+ * handed to it plus the calling thread, each taking the next unverified session until none are
+ * left; with a NULL executor, they are verified in order on the calling thread. Returns once all
+ * sessions are done.
+ *
+ * The outcome for sessions[i] is stored in results[i]: AWS_ERROR_SUCCESS if its signature is
+ * valid, or if it has none awaiting verification; AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, and the
+ * session enters the error state, if the signature is invalid; or AWS_CRYPTOSDK_ERR_BAD_STATE,
+ * without affecting the session, if it is not done. A failed session does not stop the others.
+ *
+ * Each session must appear at most once, and none may be used elsewhere during the call. Any
+ * trace callbacks of failing sessions may be invoked on the executor's threads.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_verify_deferred_signatures(
+    struct aws_cryptosdk_session **sessions,
+    int *results,
+    size_t num_sessions,
+    aws_cryptosdk_executor_fn *executor,
+    void *executor_data,
+    size_t num_workers);
+
+/**
+ * Sets the AES-GCM implementation used to encrypt or decrypt the message body. Passing
+ * NULL, the default, uses the kernel selected for the message's frame size (see
+ * @ref aws_cryptosdk_select_kernels), which is the built-in OpenSSL-backed provider unless
+ * another has been selected. The message header is always authenticated with the built-in
+ * implementation.
+ *
+ * This setting is preserved across @ref aws_cryptosdk_session_reset. This function will
+ * fail if @ref aws_cryptosdk_session_process has been called since the session was
+ * created or last reset, or if the provider's vtable is incomplete.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_gcm_provider(
+    struct aws_cryptosdk_session *session, const struct aws_cryptosdk_gcm_provider_vt *provider);
+
+/**
+ * Lets a decrypt session parse the message header in place. Rather than copying the header,
+ * and the encrypted data keys within it, out of the input buffer, the session refers to the
+ * caller's bytes, saving several allocations per message. This suits inputs which are mapped
+ * or held in memory in full.
+ *
+ * When enabled, the input buffer passed to @ref aws_cryptosdk_session_process that completes
+ * the header must stay valid and unmodified until the session is reset or destroyed. A header
+ * which is split across several process calls is only borrowed from the call that completes
+ * it, and parsing restarts from the beginning of the header on each call until then. Headers
+ * which @ref aws_cryptosdk_session_processv has to reassemble from several segments are
+ * always copied.
+ *
+ * The default is to copy the header. This setting is preserved across
+ * @ref aws_cryptosdk_session_reset and has no effect when encrypting. This function will fail
+ * if @ref aws_cryptosdk_session_process has been called since the session was created or last
+ * reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_borrow_header(struct aws_cryptosdk_session *session, bool borrow);
+
+/**
+ * Has the session allocate the objects belonging to each message from an arena of its own,
+ * rather than individually from its allocator. This covers the parsed header's encrypted data
+ * keys and encryption context, the keyring trace, and what the CMM and keyrings allocate for
+ * the materials request. The arena's memory is securely wiped and reclaimed all at once by
+ * @ref aws_cryptosdk_session_reset and kept for the next message, so a session reused for
+ * many messages soon stops calling its allocator for them at all.
+ *
+ * Objects obtained from the session, such as the encryption context and keyring trace, are
+ * already only valid until the session is reset, so their lifetime is unchanged. The CMM and
+ * keyrings must not keep anything they allocate for a request beyond the request itself (the
+ * CMMs and keyrings in this library do not). Requests made asynchronously, see
+ * @ref aws_cryptosdk_session_set_async_callback, use the session's allocator regardless.
+ *
+ * The default is disabled. This setting is preserved across @ref aws_cryptosdk_session_reset.
+ * This function will fail if @ref aws_cryptosdk_session_process has been called since the
+ * session was created or last reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_message_arena(struct aws_cryptosdk_session *session, bool enable);
+
+/**
+ * Has the session take its frame-sized buffers, and those of any pipeline running it (see
+ * @ref aws_cryptosdk_pipeline_new and @ref aws_cryptosdk_session_process_fd), from a pool shared
+ * by the whole process rather than from its allocator. The pool sorts buffers into size classes
+ * of powers of two from 64 KiB, each with room for a frame's overhead, backs them with huge pages
+ * where the system allows, and recycles them across sessions, which cuts allocator traffic and
+ * TLB misses when streaming large messages. Memory returned to the pool stays with the process.
+ *
+ * The buffers the session holds are released when this setting changes. The default is disabled.
+ * This setting is preserved across @ref aws_cryptosdk_session_reset, and a pipeline picks it up
+ * when created. This function will fail if @ref aws_cryptosdk_session_process has been called
+ * since the session was created or last reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_frame_buffer_pool(struct aws_cryptosdk_session *session, bool enable);
+
+/**
+ * Has an encrypt session append a frame index (see @ref frame_index) for the message to index
+ * as it is encrypted. The index is complete once the session is done; until then, it holds
+ * the records of the frames written so far. index must have an allocator, so that it can grow,
+ * and must stay valid until the session is done, reset or destroyed. Passing NULL stops
+ * generating an index.
+ *
+ * This setting applies to the current message only, and is cleared by
+ * @ref aws_cryptosdk_session_reset. This function will fail for decrypt sessions and if
+ * @ref aws_cryptosdk_session_process has been called since the session was created or last reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_frame_index(struct aws_cryptosdk_session *session, struct aws_byte_buf *index);
+
+/**
+ * Appends to checkpoint a record of how far an encrypt session has got through its message, from
+ * which @ref aws_cryptosdk_session_resume_from_checkpoint can carry on encrypting should this
+ * session be lost: for instance, after each part of a multipart upload, so that a failure costs
+ * only the part in progress rather than the whole message. checkpoint must have an allocator, so
+ * that it can grow. The session is unaffected.
+ *
+ * A checkpoint is taken between frames: it covers all of the output the session has produced,
+ * and all of the plaintext it has consumed. It holds the message header and the session's
+ * position in the body, authenticated under the content key; it holds no key material, which
+ * is instead recovered through the CMM on resuming, so it may be stored alongside the message.
+ *
+ * Raises AWS_CRYPTOSDK_ERR_BAD_STATE unless the session is encrypting the body of a framed,
+ * uncompressed message, and AWS_ERROR_UNSUPPORTED_OPERATION for algorithm suites with a trailing
+ * signature, whose state in the middle of a message cannot be saved.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_export_checkpoint(
+    const struct aws_cryptosdk_session *session, struct aws_byte_buf *checkpoint);
+
+/**
+ * Has an encrypt session carry on with the message from a checkpoint made by
+ * @ref aws_cryptosdk_session_export_checkpoint. The session's CMM is asked for the data key of
+ * the checkpoint's header, as when decrypting, and so must be able to decrypt the message's
+ * EDKs. The session then continues with the next frame: the caller should discard any output
+ * produced after the checkpoint was taken, and pass plaintext starting from the position it
+ * records. The message size may still be set, if the checkpoint was taken before it was known.
+ *
+ * The session must be freshly created or reset, with no frame index or compression set.
+ * Otherwise, raises AWS_CRYPTOSDK_ERR_BAD_STATE and the session remains usable. Once the
+ * checkpoint has been read, failures put the session in an error state: a checkpoint which is
+ * malformed or fails to authenticate raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, and errors from
+ * the CMM are passed on.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_resume_from_checkpoint(
+    struct aws_cryptosdk_session *session, const uint8_t *checkpoint, size_t len);
+
+/**
+ * Receives output from a session with an output sink (see @ref aws_cryptosdk_session_set_output_sink).
+ * The bytes are given as count segments, in order, and remain valid only for the duration of
+ * the call. Return AWS_OP_SUCCESS once they have been taken, or raise an error to fail the
+ * session with it. This runs on the thread calling @ref aws_cryptosdk_session_process, and
+ * must not call into the session itself.
+ */
+typedef int(aws_cryptosdk_session_sink_fn)(
+    struct aws_cryptosdk_session *session, const struct aws_byte_cursor *segments, size_t count, void *user_data);
+
+/**
+ * Has the session pass its output to sink as soon as it is produced, instead of writing it to
+ * the caller's buffer: the message header, frames and trailer are written into a buffer owned
+ * by the session, which grows to what each step needs and is reused from then on, and handed
+ * to the sink. Calls to @ref aws_cryptosdk_session_process then take input only, and must pass
+ * zero for outlen; *out_bytes_written reports the bytes passed to the sink. A call returns
+ * once the session needs more input or the message is done, so there is no need to consult
+ * @ref aws_cryptosdk_session_estimate_buf for output space.
+ *
+ * When decrypting, the session's buffer is zeroed once the sink has returned. Passing NULL
+ * for sink restores the default behavior. This setting is preserved across resets; raises
+ * AWS_CRYPTOSDK_ERR_BAD_STATE if the session has a plaintext sink (see
+ * @ref aws_cryptosdk_session_set_plaintext_sink), or if called after the first call to process
+ * since the session was created or last reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_output_sink(
+    struct aws_cryptosdk_session *session, aws_cryptosdk_session_sink_fn *sink, void *user_data);
+
+/**
+ * Receives plaintext from a decrypt session with a plaintext sink (see
+ * @ref aws_cryptosdk_session_set_plaintext_sink), in order. Each call carries one frame, given
+ * with its sequence number (1 for an unframed body); for compressed messages, the plaintext is
+ * instead passed on as it is decompressed, with a sequence number of 0. The bytes remain valid
+ * only for the duration of the call. Return AWS_OP_SUCCESS once they have been taken, or raise
+ * an error to fail the session with it. This runs on the thread calling
+ * @ref aws_cryptosdk_session_process, and must not call into the session itself.
+ */
+typedef int(aws_cryptosdk_session_plaintext_fn)(
+    struct aws_cryptosdk_session *session,
+    struct aws_byte_cursor plaintext,
+    uint32_t sequence_number,
+    void *user_data);
+
+/**
+ * Has a decrypt session pass each frame's plaintext to sink as soon as that frame has
+ * authenticated, straight from the buffer it was decrypted into, which is owned by the session.
+ * Calls to @ref aws_cryptosdk_session_process then take input only, as with
+ * @ref aws_cryptosdk_session_set_output_sink: outlen must be zero, and *out_bytes_written
+ * reports the bytes passed to the sink. Unlike an output sink, which is handed everything a
+ * batch of frames produces at once, a plaintext sink receives each frame of the batch in turn,
+ * without waiting for the rest of the input to be decrypted.
+ *
+ * For messages with a signed algorithm suite, as when decrypting into the caller's buffer,
+ * frames are passed on before the signature at the end of the message has been verified; only
+ * once the session is done is the whole message known to be authentic. Each frame is zeroed
+ * once the sink has returned.
+ *
+ * Passing NULL for sink restores the default behavior. This setting is preserved across resets,
+ * and has no effect on messages encrypted after a reset to encrypt mode; raises
+ * AWS_CRYPTOSDK_ERR_BAD_STATE for encrypt sessions, for sessions with an output sink, or if called
+ * after the first call to process since the session was created or last reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_plaintext_sink(
+    struct aws_cryptosdk_session *session, aws_cryptosdk_session_plaintext_fn *sink, void *user_data);
+
+/**
+ * Supplies input to a session with an input source (see @ref aws_cryptosdk_session_set_input_source).
+ * Copy up to len bytes of the message into buf, and set *out_bytes_read to the number copied;
+ * zero means that no more input is available for now. Raise an error to fail the session with
+ * it. This runs on the thread calling @ref aws_cryptosdk_session_process, and must not call
+ * into the session itself.
+ */
+typedef int(aws_cryptosdk_session_source_fn)(
+    struct aws_cryptosdk_session *session, uint8_t *buf, size_t len, size_t *out_bytes_read, void *user_data);
+
+/**
+ * Has the session pull its input from source instead of taking it from the caller's buffer.
+ * The session asks for exactly as much as its next step needs, such as the rest of the
+ * message header, one frame with its tag, or the trailer, and reads it into a buffer of its
+ * own; a reader can fill that buffer directly, and nothing past the end of the message is
+ * ever asked for. Calls to @ref aws_cryptosdk_session_process must then pass zero for inlen,
+ * and report zero bytes read; they return once the source has no more input for now, output
+ * space runs out, or the message is done. This combines with
+ * @ref aws_cryptosdk_session_set_output_sink.
+ *
+ * When encrypting, the message size must still be set as usual. Passing NULL for source
+ * restores the default behavior. This setting is preserved across resets, which discard any
+ * input pulled but not used; raises AWS_CRYPTOSDK_ERR_BAD_STATE if called after the first call
+ * to process since the session was created or last reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_input_source(
+    struct aws_cryptosdk_session *session, aws_cryptosdk_session_source_fn *source, void *user_data);
+
+/**
+ * Invoked when a pending session (see @ref aws_cryptosdk_session_is_pending) has received its
+ * materials and @ref aws_cryptosdk_session_process should be called again. This may run on any
+ * thread, including the one calling aws_cryptosdk_session_process, and must not call into the
+ * session itself; schedule the next process call instead.
+ */
+typedef void(aws_cryptosdk_session_ready_fn)(struct aws_cryptosdk_session *session, void *user_data);
+
+/**
+ * Switches the session to asynchronous materials requests. Instead of blocking in the CMM,
+ * @ref aws_cryptosdk_session_process hands the CMM a request through its asynchronous entry
+ * point and returns without making further progress while the request is outstanding; see
+ * @ref aws_cryptosdk_session_is_pending. When the materials arrive, on_ready is invoked.
+ * CMMs and keyrings without an asynchronous implementation complete within the first call.
+ *
+ * Passing NULL for on_ready restores the default, synchronous behavior. This setting is
+ * preserved across resets. Resetting or destroying a pending session waits for the outstanding
+ * request to complete.
+ *
+ * Raises AWS_CRYPTOSDK_ERR_BAD_STATE if called after the first call to process since the
+ * session was created or last reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_async_callback(
+    struct aws_cryptosdk_session *session, aws_cryptosdk_session_ready_fn *on_ready, void *user_data);
+
+/**
+ * Describes a session moving from one stage of a message to the next. The stages are named
+ * "config", "error", "done", "read_header", "unwrap_key", "decrypt_body", "check_trailer",
+ * "gen_key", "write_header", "encrypt_body" and "write_trailer"; the strings are static.
+ */
+struct aws_cryptosdk_session_trace_event {
+    /** When the transition happened, in nanoseconds from aws_high_res_clock_get_ticks */
+    uint64_t timestamp_ns;
+    const char *old_state;
+    const char *new_state;
+    /** The 16-byte message ID, or NULL if it has not been generated or parsed yet */
+    const uint8_t *message_id;
+};
+
+/**
+ * Invoked on the thread driving the session each time it changes state. This must not call
+ * any function which modifies the session.
+ */
+typedef void(aws_cryptosdk_session_trace_fn)(
+    const struct aws_cryptosdk_session *session,
+    const struct aws_cryptosdk_session_trace_event *event,
+    void *user_data);
+
+/**
+ * Registers a callback to be told of every state transition the session makes, including the
+ * return to "config" on @ref aws_cryptosdk_session_reset, so that the latency of each stage
+ * of a message can be traced. Passing NULL for on_trace stops tracing. Without a callback,
+ * state transitions cost no more than before.
+ *
+ * This may be called at any time, and the setting is preserved across resets.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_session_set_trace_callback(
+    struct aws_cryptosdk_session *session, aws_cryptosdk_session_trace_fn *on_trace, void *user_data);
+
 /**
  * Sets the frame size to use for encryption. If zero is specified, the message
  * will be processed in an unframed mode. If this function is not called, a
@@ -114,6 +494,96 @@ int aws_cryptosdk_session_reset(struct aws_cryptosdk_session *session, enum aws_
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_session_set_frame_size(struct aws_cryptosdk_session *session, uint32_t frame_size);
 
+/**
+ * Has an encrypt session choose the frame size of each message itself, when the message
+ * header is generated. A message of at most 512 bytes whose precise size is known (see
+ * @ref aws_cryptosdk_session_set_message_size) is written unframed, as a single block, unless it
+ * is compressed or a frame index is being built. A message whose size (see also
+ * @ref aws_cryptosdk_session_set_message_bound) is otherwise known to be small is written as a
+ * single final frame. Otherwise, frames are as large as possible, up to 1 MiB, while each
+ * worker thread (see @ref aws_cryptosdk_session_set_worker_threads) can still fill one within
+ * the output buffer of the process call that generates the header, and the message still
+ * spans at least one frame per worker thread.
+ *
+ * This setting is preserved across @ref aws_cryptosdk_session_reset, and is turned off again
+ * by @ref aws_cryptosdk_session_set_frame_size or by passing false, which restores the
+ * default frame size. This function will fail if invoked in decrypt mode, or if
+ * @ref aws_cryptosdk_session_process has been called.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_adaptive_frame_size(struct aws_cryptosdk_session *session, bool enable);
+
+/**
+ * Has an encrypt session size its frames so that every serialized frame but the final one
+ * (sequence number, IV, body and tag) occupies exactly block_size bytes, for example 4096 to
+ * match a device block or 1048576 for large bulk transfers. The frame size is worked out from
+ * the algorithm suite once the header is generated. Since frames follow the header, frame n
+ * then begins at the length of the header plus (n - 1) * block_size: a reader which stores or
+ * addresses the body relative to its start fetches each frame as exactly one block, and an
+ * unaligned header costs at most one extra block per read. The final frame, which also states
+ * its length, may be up to four bytes longer.
+ *
+ * block_size must be a power of two of at least 512; otherwise, raises
+ * AWS_ERROR_INVALID_ARGUMENT. Passing zero turns the mode off again and restores the default
+ * frame size, as does @ref aws_cryptosdk_session_set_frame_size or
+ * @ref aws_cryptosdk_session_set_adaptive_frame_size. This setting is preserved across
+ * @ref aws_cryptosdk_session_reset. This function will fail if invoked in decrypt mode, or if
+ * @ref aws_cryptosdk_session_process has been called.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_block_aligned_frames(struct aws_cryptosdk_session *session, uint32_t block_size);
+
+/**
+ * Ways of compressing the plaintext of a message before it is encrypted.
+ */
+enum aws_cryptosdk_compression {
+    AWS_CRYPTOSDK_COMPRESSION_NONE = 0,
+    /** Zstandard; needs libzstd when the SDK is built */
+    AWS_CRYPTOSDK_COMPRESSION_ZSTD,
+    /** zlib's deflate format; needs zlib when the SDK is built */
+    AWS_CRYPTOSDK_COMPRESSION_ZLIB
+};
+
+/**
+ * Returns true if this build of the SDK can compress and decompress with the given compression.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_compression_available(enum aws_cryptosdk_compression compression);
+
+/**
+ * Has an encrypt session compress the plaintext of each message as it streams in, before it
+ * is encrypted. The compression is recorded under the reserved "aws-crypto-compression" key
+ * of the encryption context, and sessions decrypting the message decompress it transparently,
+ * streaming in bounded memory much as without compression. Messages are not readable by SDKs
+ * which predate this setting, which see the compressed plaintext.
+ *
+ * The message size set with @ref aws_cryptosdk_session_set_message_size remains that of the
+ * plaintext, and marks the end of the input as usual; but the size of the body, and so of
+ * the output, is only known once all of it has been compressed. A message bound applies to
+ * the compressed data, which is what is encrypted under the data key. Compressed messages
+ * must be framed.
+ *
+ * Compressed messages cannot be processed in place (see @ref aws_cryptosdk_session_process):
+ * an encrypt session with compression set raises AWS_ERROR_INVALID_ARGUMENT, without otherwise
+ * failing, when given overlapping buffers. A decrypt session given overlapping buffers stops
+ * once it has read the header of a compressed message, and raises the same error if called
+ * again with them; it can carry on with separate buffers.
+ *
+ * Compression leaks information about the plaintext through the length of the ciphertext,
+ * which encryption does not hide. Where an attacker can influence part of the plaintext and
+ * observe the size of the resulting messages, as in the CRIME and BREACH attacks on TLS and
+ * HTTP, they can recover secrets in the rest of it a byte at a time, by watching for guesses
+ * that compress better. Do not compress messages that mix secrets with data an attacker
+ * controls.
+ *
+ * This setting is preserved across resets. Raises AWS_CRYPTOSDK_ERR_BAD_STATE in decrypt mode
+ * or if process has been called since the session was created or last reset, and
+ * AWS_ERROR_UNSUPPORTED_OPERATION if the compression is not available in this build.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_compression(
+    struct aws_cryptosdk_session *session, enum aws_cryptosdk_compression compression);
+
 /**
  * Sets the precise size of the message to encrypt. This function must be
  * called exactly once during an encrypt operation. You do not need to call it
@@ -161,9 +631,20 @@ int aws_cryptosdk_session_set_message_bound(struct aws_cryptosdk_session *sessio
  *   2. Producing some data in the output buffer
  *   3. Entering an error state, and raising the error in question.
  *
- * The data referenced by the input and output cursors must not overlap.
+ * The data referenced by the input and output cursors must either not overlap,
+ * or must be arranged for in-place operation: the output buffer starts at or
+ * before the input data within the same allocation. When encrypting in place,
+ * the input plaintext must be preceded by enough headroom to hold the expansion
+ * of everything produced from it (the message header plus per-frame overhead);
+ * if there is not enough headroom, the session stops making progress rather than
+ * overwrite unconsumed plaintext. When decrypting in place, no headroom is needed.
+ * Overlapping buffers arranged any other way, or used for a compressed message
+ * (see @ref aws_cryptosdk_session_set_compression), are rejected with
+ * AWS_ERROR_INVALID_ARGUMENT.
+ *
  * If this method raises an error, the contents of the output buffer will
- * be zeroed. The buffer referenced by the input buffer will never be modified.
+ * be zeroed. Except for in-place operation, the buffer referenced by the input
+ * buffer will never be modified.
  *
  * If there is insufficient output space and/or insufficient input
  * data, this method may not make any progress. The @ref aws_cryptosdk_session_estimate_buf
@@ -188,6 +669,32 @@ int aws_cryptosdk_session_process(
     size_t inlen,
     size_t *in_bytes_read);
 
+/**
+ * Scatter/gather variant of @ref aws_cryptosdk_session_process. Input is taken from the
+ * inv segments in order, and output is appended to each of the outv buffers in turn,
+ * from its current len up to its capacity; the len of each output buffer is updated to
+ * reflect the data written to it.
+ *
+ * Data which lies within a single segment is processed in place. Frames (or message
+ * headers and trailers) which straddle a segment boundary are staged through a temporary
+ * buffer no larger than the session's size estimate for that step, so callers need not
+ * coalesce buffer chains themselves.
+ *
+ * Upon return, *out_bytes_written and *in_bytes_read report the total number of bytes
+ * produced and consumed across all segments. If this method raises an error, all output
+ * written by this call is zeroed, the output buffer lengths are left unchanged, and both
+ * counts are reported as zero.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_processv(
+    struct aws_cryptosdk_session *session,
+    struct aws_byte_buf *outv,
+    size_t outcnt,
+    size_t *out_bytes_written,
+    const struct aws_byte_cursor *inv,
+    size_t incnt,
+    size_t *in_bytes_read);
+
 /**
  * Returns true if the session has finished processing the entire message.
  *
@@ -198,6 +705,14 @@ int aws_cryptosdk_session_process(
 AWS_CRYPTOSDK_API
 bool aws_cryptosdk_session_is_done(const struct aws_cryptosdk_session *session);
 
+/**
+ * Returns true if the session is waiting on an asynchronous materials request (see @ref
+ * aws_cryptosdk_session_set_async_callback). This remains true from the process call that
+ * issued the request until the process call that picks up its result.
+ */
+AWS_CRYPTOSDK_API
+bool aws_cryptosdk_session_is_pending(const struct aws_cryptosdk_session *session);
+
 /**
  * Returns the algorithm ID in use for this message via *alg_id.
  * Raises AWS_CRYPTOSDK_ERR_BAD_STATE if the algorithm ID has not yet
@@ -208,6 +723,172 @@ bool aws_cryptosdk_session_is_done(const struct aws_cryptosdk_session *session);
 AWS_CRYPTOSDK_API
 int aws_cryptosdk_session_get_alg_id(const struct aws_cryptosdk_session *session, enum aws_cryptosdk_alg_id *alg_id);
 
+/**
+ * Returns via *size the exact size of the complete ciphertext message (header, body and
+ * trailer) that this encrypt session will produce. The message size must have been set
+ * with @ref aws_cryptosdk_session_set_message_size.
+ *
+ * If the encryption materials have not yet been generated, this function obtains them from
+ * the CMM, just as the first call to @ref aws_cryptosdk_session_process would; the session's
+ * configuration is then fixed, and a CMM failure puts the session in an error state. This
+ * allows output buffers to be allocated once, up front.
+ *
+ * Raises AWS_CRYPTOSDK_ERR_BAD_STATE for decrypt sessions, if the message size is not yet
+ * known, or while an asynchronous materials request is pending; in these cases the session
+ * remains usable.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_get_total_output_size(struct aws_cryptosdk_session *session, uint64_t *size);
+
+/**
+ * Locates a frame of the message being decrypted, for random access to its body. On return,
+ * *offset is the position of frame seqno (counting from 1) relative to the start of the message,
+ * and *max_len is the most ciphertext the frame can occupy. Every frame but the final one is
+ * somewhat shorter than *max_len, so a caller fetching a range of the message may simply fetch
+ * *max_len bytes, or up to the end of the message if that comes first.
+ *
+ * Random access is only available for framed messages using algorithm suites without a
+ * trailing signature (which can only be checked over the whole message) unless a frame index
+ * is in use (see @ref aws_cryptosdk_session_use_frame_index), once the header has
+ * been processed: that is, once @ref aws_cryptosdk_session_process has consumed the header and
+ * the session is ready to decrypt the body. Otherwise, raises AWS_CRYPTOSDK_ERR_BAD_STATE.
+ * Compressed messages (see @ref aws_cryptosdk_session_set_compression) can only be decompressed
+ * from the start, so random access to them raises AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT.
+ * Frames past the end of the message cannot be detected here. With a frame index, *max_len is
+ * the frame's exact length, and frames past the end raise AWS_ERROR_INVALID_ARGUMENT.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_get_frame_range(
+    const struct aws_cryptosdk_session *session, uint64_t seqno, uint64_t *offset, size_t *max_len);
+
+/**
+ * Reports the layout of the body of the message being decrypted, so that a reader can fetch
+ * ciphertext in exactly frame-sized reads (for example, aligned reads of a file opened with
+ * O_DIRECT) from the first frame on, rather than learning sizes from short reads. On return,
+ * *frame_len is the exact ciphertext length of every frame but the final one, each of which
+ * decrypts to *frame_plaintext_len bytes; *final_frame_max_len bounds the final frame, which
+ * holds at most *frame_plaintext_len bytes of plaintext.
+ *
+ * A call to @ref aws_cryptosdk_session_process given n whole frames of input thus never
+ * produces more than n * *frame_plaintext_len bytes, and will decrypt all of them when given
+ * that much output space.
+ *
+ * Available for framed messages once the header has been processed (or, when encrypting, once
+ * it has been generated), whatever the algorithm suite. Otherwise (including for unframed
+ * messages, whose single frame states its own length), raises AWS_CRYPTOSDK_ERR_BAD_STATE and
+ * the session remains usable.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_get_frame_sizes(
+    const struct aws_cryptosdk_session *session,
+    size_t *frame_len,
+    size_t *final_frame_max_len,
+    size_t *frame_plaintext_len);
+
+/**
+ * Decrypts and authenticates the single frame seqno, whose ciphertext begins at inp; see
+ * @ref aws_cryptosdk_session_get_frame_range for where to find it and for when random access is
+ * available. Frames may be decrypted in any order, and the session's position in the message is
+ * unaffected, so this may be freely mixed with calls to @ref aws_cryptosdk_session_process.
+ * Random access calls must not, however, be made concurrently on the same session.
+ *
+ * On success, *out_bytes_written is set to the length of the frame's plaintext, which is
+ * written to outp. If inp does not hold the whole frame, or outp is too small to hold its
+ * plaintext, raises AWS_ERROR_SHORT_BUFFER. If the frame does not carry sequence number seqno or
+ * fails to authenticate, raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT and zeroes outp. None of these
+ * errors affect the state of the session.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_decrypt_frame_at(
+    struct aws_cryptosdk_session *session,
+    uint64_t seqno,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen);
+
+/**
+ * Decrypts and authenticates consecutive frames, beginning with frame first_seqno at inp, as
+ * @ref aws_cryptosdk_session_decrypt_frame_at would decrypt each one; random access must be
+ * available as described there. This lets the ranges of a large message - for example, ranged
+ * reads of a stored object - be decrypted by several threads at once: unlike the other calls on
+ * a session, calls to this function may be made concurrently with one another.
+ *
+ * Decryption stops after the final frame, when the input is used up, or at the first frame
+ * which the input does not hold whole or whose plaintext does not fit in outp; *in_bytes_read
+ * and *out_bytes_written are set to the ciphertext consumed and plaintext written, and
+ * *final_frame to whether the final frame of the message was among them. A message is only
+ * complete once its final frame has been seen: ciphertext which ends on any other frame has
+ * been truncated. Any input after the final frame is left unread.
+ *
+ * If not even the first frame can be decrypted for lack of input or output space, raises
+ * AWS_ERROR_SHORT_BUFFER. If a frame is out of sequence or fails to authenticate, raises
+ * AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT and zeroes outp. None of these errors affect the state of
+ * the session.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_decrypt_frames_at(
+    const struct aws_cryptosdk_session *session,
+    uint64_t first_seqno,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen,
+    size_t *in_bytes_read,
+    bool *final_frame);
+
+/**
+ * Encrypts the frames of the message being encrypted which hold the plaintext at inp, starting
+ * with frame first_seqno, writing them to outp in the same form @ref aws_cryptosdk_session_process
+ * would. This lets a large message be encrypted as independent ranges - for example, the parts
+ * of a multipart upload - by several threads at once: unlike the other calls on a session,
+ * calls to this function may be made concurrently with one another. The session's position in
+ * the message is unaffected.
+ *
+ * The message size must have been set with @ref aws_cryptosdk_session_set_message_size, and the
+ * header must have been generated: that is, @ref aws_cryptosdk_session_process has been called
+ * (with or without room for the header) and the session has not yet started on the body. The
+ * header itself is still obtained from @ref aws_cryptosdk_session_process. Frame sizes are given
+ * by @ref aws_cryptosdk_session_get_frame_sizes. Otherwise, or if the message is unframed or a
+ * frame index is being produced, raises AWS_CRYPTOSDK_ERR_BAD_STATE. Algorithm suites with a
+ * trailing signature, which must cover every frame in order, raise AWS_ERROR_UNSUPPORTED_OPERATION.
+ *
+ * The plaintext must begin at the start of frame first_seqno and hold a whole number of frames,
+ * unless it runs to the end of the message, in which case the final frame is written as well;
+ * otherwise, raises AWS_ERROR_INVALID_ARGUMENT. If outp is too small for the frames, raises
+ * AWS_ERROR_SHORT_BUFFER without writing anything. On success, *out_bytes_written is set to the
+ * length of the ciphertext written.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_encrypt_frames_at(
+    const struct aws_cryptosdk_session *session,
+    uint64_t first_seqno,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen);
+
+/**
+ * Gives a decrypt session the frame index (see @ref frame_index) produced when the message was
+ * encrypted. @ref aws_cryptosdk_session_get_frame_range then returns the exact range of each
+ * frame, and @ref aws_cryptosdk_session_decrypt_frame_at rejects any frame whose authentication
+ * tag differs from the one recorded for it. Because this ties every frame to the encryptor's
+ * output, random access becomes available for signed algorithm suites as well; the index must
+ * therefore come from a source as trusted as the signature would be.
+ *
+ * The index is not copied: it must stay valid and unmodified until the session is reset or
+ * destroyed. It may be given once the header has been processed, as for random access. Raises
+ * AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT if the index is malformed or describes another message.
+ *
+ * A session decrypts one frame at a time; to decrypt frames in parallel, use one session per
+ * worker (each processing the same header and index).
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_use_frame_index(struct aws_cryptosdk_session *session, const uint8_t *index, size_t len);
+
 /**
  * Estimates the amount of buffer space needed to make forward progress.
  * Supplying the amount of data indicated here to @ref aws_cryptosdk_session_process
@@ -224,6 +905,41 @@ void aws_cryptosdk_session_estimate_buf(
     size_t *AWS_RESTRICT outbuf_needed,
     size_t *AWS_RESTRICT inbuf_needed);
 
+/**
+ * Counters describing the work a session has done on the current message. Times are in
+ * nanoseconds, and only cover time spent within the session's own calls; time spent waiting
+ * for an asynchronous materials request to complete is not counted.
+ */
+struct aws_cryptosdk_session_stats {
+    /** Bytes consumed from, and written to, the caller's buffers */
+    uint64_t bytes_in, bytes_out;
+    /** Body frames encrypted or decrypted (an unframed body counts as one) */
+    uint64_t frames;
+    /** Time spent obtaining and checking the materials, excluding key derivation */
+    uint64_t cmm_ns;
+    /** Time spent deriving the content key */
+    uint64_t hkdf_ns;
+    /** Time spent encrypting or decrypting the body, including feeding it to any signature digest */
+    uint64_t gcm_ns;
+    /** Time spent signing or verifying the trailing signature */
+    uint64_t signature_ns;
+    /** Time spent writing or parsing the header */
+    uint64_t header_ns;
+    /** Calls to @ref aws_cryptosdk_session_process which made no progress for lack of buffer space or input */
+    uint64_t stalled_calls;
+};
+
+/**
+ * Fills in stats with the counters for the message the session is processing, or has most
+ * recently finished. The counters start from zero on @ref aws_cryptosdk_session_reset.
+ *
+ * Times are taken as the session moves from one stage of the message to the next, so
+ * collecting them adds a few clock reads per process call rather than per frame.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_session_get_stats(
+    const struct aws_cryptosdk_session *session, struct aws_cryptosdk_session_stats *stats);
+
 /**
  * Returns a read-only pointer to the encryption context held by the session.
  * This will return NULL if it is called too early in the decryption process,
@@ -234,6 +950,15 @@ void aws_cryptosdk_session_estimate_buf(
  * read-only access to the encryption context, but for setting the encryption
  * context, use aws_cryptosdk_get_enc_ctx_ptr_mut instead.
  *
+ * When decrypting, the hash table is only built from the header the first
+ * time it is asked for, so this may also return NULL if that runs out of
+ * memory (in which case, an AWS error code is set). Building it modifies the
+ * session, so despite taking a const session, this function (and @ref
+ * aws_cryptosdk_session_get_enc_ctx_flat, which calls it) is not safe to call
+ * from several threads at once on the same decrypt session; call it once
+ * before sharing the session between readers, after which the pointer it
+ * returns may be read from any thread.
+ *
  * The hash table pointed to by this pointer lives until the session is
  * reset or destroyed. If you want a copy of the encryption context that will
  * outlive the session, you should duplicate it with
@@ -265,6 +990,159 @@ const struct aws_hash_table *aws_cryptosdk_session_get_enc_ctx_ptr(const struct
 AWS_CRYPTOSDK_API
 struct aws_hash_table *aws_cryptosdk_session_get_enc_ctx_ptr_mut(struct aws_cryptosdk_session *session);
 
+/**
+ * Initializes *flat with a copy of the encryption context held by the session, in the flat
+ * representation described in enc_ctx.h; see @ref aws_cryptosdk_session_get_enc_ctx_ptr for
+ * when it is available. Once the header has been written or read, the copy is indexed straight
+ * from the header's serialized encryption context rather than from the hash table.
+ *
+ * The caller owns *flat, which outlives the session, and must release it with
+ * @ref aws_cryptosdk_flat_enc_ctx_clean_up. Raises AWS_CRYPTOSDK_ERR_BAD_STATE if called too
+ * early in decryption.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_get_enc_ctx_flat(
+    const struct aws_cryptosdk_session *session,
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_flat_enc_ctx *flat);
+
+/**
+ * Sets the encryption context of the message to a copy of the frozen context, and lets the
+ * session, and the CMMs it calls, use the frozen context's stored serialization and digest
+ * rather than serializing the encryption context again. CMMs which add to the encryption
+ * context, such as the default CMM with a signing algorithm suite, still cause the header's
+ * copy to be serialized afresh.
+ *
+ * The frozen context must remain valid until the session is reset or destroyed; the setting
+ * is cleared by @ref aws_cryptosdk_session_reset. This function will fail if invoked in
+ * decrypt mode, or if @ref aws_cryptosdk_session_process has been called.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_frozen_enc_ctx(
+    struct aws_cryptosdk_session *session, const struct aws_cryptosdk_frozen_enc_ctx *frozen);
+
+/**
+ * Enables or disables collection of the keyring trace (see
+ * @ref aws_cryptosdk_session_get_keyring_trace_ptr). Callers that never read the trace can
+ * disable it, so that keyrings skip recording the wrapping keys they used; the session's
+ * trace is then always empty. CMMs see this as the skip_keyring_trace field of their
+ * requests.
+ *
+ * The trace is collected by default. This setting is preserved across
+ * @ref aws_cryptosdk_session_reset. This function will fail if
+ * @ref aws_cryptosdk_session_process has been called since the session was created or last
+ * reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_keyring_trace(struct aws_cryptosdk_session *session, bool enable);
+
+/**
+ * Has a decrypt session stop once the message header has been authenticated: the header is
+ * parsed, the data key is obtained from the CMM, and the header's authentication tag is
+ * checked, after which the session is done. The body cipher context is keyed, as it is what
+ * checks the header's tag, but no signature verification context is set up, and only the
+ * header bytes are consumed, so messages can be scanned for their
+ * encryption context (see @ref aws_cryptosdk_session_get_enc_ctx_ptr) and EDKs (see
+ * @ref aws_cryptosdk_session_get_edks_ptr) by reading their headers alone. CMMs see this as the
+ * skip_signature field of their requests.
+ *
+ * Note that the body, which is never read, is not authenticated, and that for algorithm suites
+ * with a trailing signature, the header is authenticated only by the data key and not by the
+ * signature.
+ *
+ * The default is disabled. This setting is preserved across @ref aws_cryptosdk_session_reset,
+ * but only applies to decryption. This function will fail for encrypt sessions, and if
+ * @ref aws_cryptosdk_session_process has been called since the session was created or last
+ * reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_header_only(struct aws_cryptosdk_session *session, bool enable);
+
+/**
+ * Has a decrypt session authenticate the message without decrypting it: the header, the tag of
+ * every frame and the trailing signature (if any) are all checked as usual, but no plaintext is
+ * produced, so @ref aws_cryptosdk_session_process needs no output buffer (outlen may be zero)
+ * and always reports zero bytes written. This is meant for integrity scans of stored messages.
+ *
+ * Frame tags are checked by running only the GHASH half of AES-GCM over the ciphertext, which
+ * skips the AES-CTR pass that would produce the plaintext. A compressed message is not
+ * decompressed. Verify-only sessions require the built-in GCM provider; with another provider set by
+ * @ref aws_cryptosdk_session_set_gcm_provider, processing fails with
+ * AWS_ERROR_UNSUPPORTED_OPERATION once the data key has been obtained.
+ *
+ * @ref aws_cryptosdk_session_set_header_only takes precedence over this setting. The default is
+ * disabled. This setting is preserved across @ref aws_cryptosdk_session_reset, but only applies
+ * to decryption. This function will fail for encrypt sessions, and if
+ * @ref aws_cryptosdk_session_process has been called since the session was created or last
+ * reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_verify_only(struct aws_cryptosdk_session *session, bool enable);
+
+/**
+ * Limits the number of encrypted data keys a decrypt session accepts in a message header. The
+ * EDK count is checked as soon as it has been read, before the encryption context or any EDK is
+ * deserialized, and a message with more EDKs fails with AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED. This
+ * bounds the memory and work spent on headers from untrusted sources, which may carry up to
+ * 65535 EDKs. Zero, the default, means no limit.
+ *
+ * This setting is preserved across @ref aws_cryptosdk_session_reset. This function will fail for
+ * encrypt sessions, and if @ref aws_cryptosdk_session_process has been called since the session
+ * was created or last reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_max_encrypted_data_keys(struct aws_cryptosdk_session *session, size_t max_edks);
+
+/**
+ * Limits the size in bytes of the serialized encryption context a decrypt session accepts in a
+ * message header. The size is checked as soon as it has been read, before anything else is
+ * parsed, and a message with a larger context fails with AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED. Zero,
+ * the default, means no limit.
+ *
+ * This setting is preserved across @ref aws_cryptosdk_session_reset. This function will fail for
+ * encrypt sessions, and if @ref aws_cryptosdk_session_process has been called since the session
+ * was created or last reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_max_enc_ctx_size(struct aws_cryptosdk_session *session, size_t max_size);
+
+/**
+ * Limits the data key unwraps a decrypt session can cause. Only the first max_attempts EDKs of
+ * the message are offered to the CMM, so a keyring makes at most that many attempts (for KMS
+ * keyrings, calls to KMS) however many EDKs the message carries; a message whose only usable
+ * EDKs come later fails with AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT. Unlike
+ * @ref aws_cryptosdk_session_set_max_encrypted_data_keys, messages with more EDKs are not
+ * rejected. Zero, the default, means no limit.
+ *
+ * This setting is preserved across @ref aws_cryptosdk_session_reset. This function will fail for
+ * encrypt sessions, and if @ref aws_cryptosdk_session_process has been called since the session
+ * was created or last reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_max_unwrap_attempts(struct aws_cryptosdk_session *session, size_t max_attempts);
+
+/**
+ * Has a decrypt session free what it no longer needs once it starts on the message body, for
+ * applications which keep many streams open at once. The copy of the header, the encryption
+ * context, the EDKs, the keyring trace and the emptied materials kept for the next message are
+ * all released, leaving little beyond the content key, cipher and signature state and counters
+ * for as long as the stream stays open.
+ *
+ * From then until the session is reset, @ref aws_cryptosdk_session_get_enc_ctx_ptr,
+ * @ref aws_cryptosdk_session_get_edks_ptr and @ref aws_cryptosdk_session_get_keyring_trace_ptr
+ * return NULL, and @ref aws_cryptosdk_session_get_enc_ctx_flat raises
+ * AWS_CRYPTOSDK_ERR_BAD_STATE. Anything wanted from them must be read before plaintext is
+ * first asked for, e.g. after calling @ref aws_cryptosdk_session_process with no output space;
+ * verify-only sessions, which need no output space, release it as soon as they reach the body.
+ * The next message allocates afresh what a session normally keeps.
+ *
+ * The default is disabled. This setting is preserved across @ref aws_cryptosdk_session_reset.
+ * This function will fail for encrypt sessions, and if @ref aws_cryptosdk_session_process has
+ * been called since the session was created or last reset.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_set_compact(struct aws_cryptosdk_session *session, bool enable);
+
 /**
  * Returns a read-only pointer to the keyring trace held by the session.
  * This will return NULL if called too early in the encryption or
@@ -286,6 +1164,200 @@ struct aws_hash_table *aws_cryptosdk_session_get_enc_ctx_ptr_mut(struct aws_cryp
 AWS_CRYPTOSDK_API
 const struct aws_array_list *aws_cryptosdk_session_get_keyring_trace_ptr(const struct aws_cryptosdk_session *session);
 
+/**
+ * Returns a read-only pointer to the list of EDKs (of type struct aws_cryptosdk_edk) in the
+ * header of the message, or NULL if called before the CMM has been asked for the materials.
+ * The list lives until the session is reset or destroyed; copy any EDKs needed beyond that
+ * with aws_cryptosdk_edk_init_clone.
+ */
+AWS_CRYPTOSDK_API
+const struct aws_array_list *aws_cryptosdk_session_get_edks_ptr(const struct aws_cryptosdk_session *session);
+
+/**
+ * Encrypts a complete plaintext held in memory in a single call, using the given CMM and the
+ * default frame size. This avoids the buffer size negotiation of aws_cryptosdk_session_process
+ * and is intended for small messages.
+ *
+ * Once the encryption materials have been generated, the exact size of the ciphertext is
+ * computed. If outlen is smaller than that, nothing is written, *out_bytes_written is set to
+ * the size required, and AWS_ERROR_SHORT_BUFFER is raised; note that the CMM will have been
+ * called regardless. On success, *out_bytes_written is set to the size of the ciphertext.
+ *
+ * enc_ctx may be NULL; otherwise it is copied into the message's encryption context.
+ * The input and output buffers must not overlap.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_encrypt_buffer(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    const struct aws_hash_table *enc_ctx,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen);
+
+/**
+ * Decrypts a complete ciphertext message held in memory in a single call. The input must
+ * contain exactly one message; trailing data is rejected with AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT.
+ *
+ * After the header has been verified, the exact size of the plaintext is computed from the
+ * frame structure. If outlen is smaller than that, nothing is written, *out_bytes_written is
+ * set to the size required, and AWS_ERROR_SHORT_BUFFER is raised. On any other failure, the
+ * output buffer is zeroed. The size of a compressed message's plaintext is not recorded, so
+ * such messages raise AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT; decrypt them with a session.
+ *
+ * If enc_ctx_out is non-NULL, it must be an initialized encryption context; on success, it
+ * receives a copy of the message's encryption context.
+ * The input and output buffers must not overlap.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_decrypt_buffer(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_hash_table *enc_ctx_out,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen);
+
+/**
+ * Encrypts each of count plaintexts held in memory into its own message, all under the same
+ * encryption context, which is suited to large numbers of small records. Each message is in the
+ * standard format, with its own message ID, content key and signature, and can be decrypted on
+ * its own.
+ *
+ * The messages share one data key: the CMM is called through a caching CMM private to this
+ * call, so that it is asked for materials once, and again only for every
+ * AWS_CRYPTOSDK_CACHE_MAX_LIMIT_MESSAGES messages. Algorithm suites which the caching CMM does
+ * not cache (those without key derivation) still call the CMM for each message. The header
+ * fields common to all messages are serialized once, and each thread reuses one session for
+ * all the messages it encrypts.
+ *
+ * The messages are encrypted by num_threads threads, the calling thread among them; zero is
+ * treated as one. enc_ctx may be NULL. outputs must point to count byte buffers, which need not
+ * be initialized; on success, outputs[i] is allocated from alloc and holds the message for
+ * inputs[i], and the caller must clean it up. On failure, none of outputs is left allocated.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_encrypt_batch(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    const struct aws_hash_table *enc_ctx,
+    struct aws_byte_buf *outputs,
+    const struct aws_byte_cursor *inputs,
+    size_t count,
+    size_t num_threads);
+
+/**
+ * Encrypts the file at in_path into a new message at out_path, using the given CMM and the
+ * default frame size. The input is memory-mapped, and the output file is preallocated to the
+ * exact size of the ciphertext and mapped as well, so that the whole body is encrypted in a
+ * single pass with no intermediate copies. Any existing file at out_path is replaced.
+ *
+ * enc_ctx may be NULL; otherwise it is copied into the message's encryption context. If the
+ * input or output cannot be opened, mapped or written, raises AWS_CRYPTOSDK_ERR_IO and leaves
+ * errno set by the failing call. On any failure the output file is left empty.
+ *
+ * in_path and out_path must not refer to the same file.
+ *
+ * On Windows, neither file is mapped: both are opened for overlapped I/O on an I/O completion
+ * port, and several 1 MiB reads and writes are kept in flight while the calling thread runs
+ * the session, so that disk and CPU work concurrently. The output is still sized up front.
+ * Errors are reported the same way, except that GetLastError(), rather than errno, is left set.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_encrypt_file(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    const struct aws_hash_table *enc_ctx,
+    const char *out_path,
+    const char *in_path);
+
+/**
+ * Decrypts the message in the file at in_path, which must contain exactly one message, into a
+ * new file at out_path. As with @ref aws_cryptosdk_encrypt_file, both files are memory-mapped
+ * (on Windows, streamed with overlapped I/O) and the plaintext is written in a single pass once
+ * the header has been verified.
+ *
+ * Plaintext is written to out_path before a trailing signature, if any, has been checked. On
+ * any failure, including a bad signature or trailing data after the message, the output file is
+ * truncated so that no unauthenticated plaintext remains in it.
+ *
+ * If enc_ctx_out is non-NULL, it must be an initialized encryption context; on success, it
+ * receives a copy of the message's encryption context. Errors are otherwise reported as for
+ * @ref aws_cryptosdk_encrypt_file. Except on Windows, the output is sized from the frames up
+ * front, so compressed messages raise AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_decrypt_file(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_hash_table *enc_ctx_out,
+    const char *out_path,
+    const char *in_path);
+
+/**
+ * Encrypts a file as @ref aws_cryptosdk_encrypt_file does, but bypassing the page cache, for
+ * bulk jobs whose data will not be read again soon. Both files are opened with O_DIRECT (or, on
+ * macOS, F_NOCACHE) and streamed through block-aligned buffers, 1 MiB at a time; the last,
+ * partial block of output is padded for the write and then truncated away. File systems which
+ * refuse direct I/O are read and written through the cache instead.
+ *
+ * If block_size is nonzero, frames are sized as by
+ * @ref aws_cryptosdk_session_set_block_aligned_frames, so that each whole frame of ciphertext
+ * is exactly block_size bytes long; otherwise, the default frame size is used. Errors are
+ * reported as for @ref aws_cryptosdk_encrypt_file, and on any failure the output file is left
+ * empty. Only available on POSIX systems; elsewhere, raises AWS_ERROR_UNIMPLEMENTED.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_encrypt_file_direct(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    const struct aws_hash_table *enc_ctx,
+    const char *out_path,
+    const char *in_path,
+    uint32_t block_size);
+
+/**
+ * Decrypts a file as @ref aws_cryptosdk_decrypt_file does, but with direct I/O as described
+ * for @ref aws_cryptosdk_encrypt_file_direct. Only available on POSIX systems; elsewhere,
+ * raises AWS_ERROR_UNIMPLEMENTED.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_decrypt_file_direct(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_hash_table *enc_ctx_out,
+    const char *out_path,
+    const char *in_path);
+
+/**
+ * Runs the session over a whole stream, reading the input from in_fd until end of file and
+ * writing the output to out_fd, which may be files, pipes or sockets. Reads and writes are
+ * done on two helper threads, overlapping with the session's work on the calling thread (and
+ * on its worker threads, if configured): up to read_ahead chunks of 1 MiB are read ahead of the
+ * session, and up to read_ahead chunks of output are queued for writing behind it.
+ *
+ * The session must have been configured and not yet used for the current message. When
+ * encrypting, the message size is set from the length of the input if it has not been set
+ * already. The input must hold exactly one message: if it ends early, raises
+ * AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT when decrypting or AWS_CRYPTOSDK_ERR_BAD_STATE when
+ * encrypting; if data follows the message, raises AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT or
+ * AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED respectively. An error reading or writing raises
+ * AWS_CRYPTOSDK_ERR_IO, leaving errno set by the failing call.
+ *
+ * As with @ref aws_cryptosdk_session_process, plaintext is written as each frame is
+ * authenticated, before a trailing signature has been checked; on failure, the caller should
+ * discard anything written to out_fd. If the call fails while the reader is blocked on in_fd,
+ * it returns once that read completes. Neither descriptor is closed.
+ *
+ * Only available on POSIX systems; elsewhere, raises AWS_ERROR_UNIMPLEMENTED.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_session_process_fd(struct aws_cryptosdk_session *session, int out_fd, int in_fd, size_t read_ahead);
+
 #ifdef __cplusplus
 }
 #endif
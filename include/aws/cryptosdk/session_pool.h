@@ -0,0 +1,96 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_SESSION_POOL_H
+#define AWS_CRYPTOSDK_SESSION_POOL_H
+
+#include <aws/cryptosdk/exports.h>
+#include <aws/cryptosdk/session.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @ingroup session
+ * A pool of idle sessions of one mode over one CMM, which threads take sessions from and give
+ * them back to, so that serving a message does not construct and destroy a session. Returned
+ * sessions are reset with @ref aws_cryptosdk_session_reset, which keeps their allocations for
+ * the next message.
+ *
+ * Idle sessions are kept on several freelists, each with its own lock; a thread uses the one
+ * its ID hashes to, so that threads rarely contend, and a thread that finds its freelist empty
+ * takes a session from another before creating one. All functions except
+ * @ref aws_cryptosdk_session_pool_destroy may be called concurrently.
+ *
+ * The settings that @ref aws_cryptosdk_session_reset preserves, such as the frame size and the
+ * number of worker threads, go with a session from one user to the next. Apply them in the
+ * configure function given to @ref aws_cryptosdk_session_pool_new, which runs once for each
+ * session the pool creates, rather than changing them on sessions taken from the pool.
+ */
+struct aws_cryptosdk_session_pool;
+
+/**
+ * Called on each session the pool creates, before it is first handed out. Returning
+ * AWS_OP_ERR (with an error raised) destroys the session and fails the acquire.
+ */
+typedef int(aws_cryptosdk_session_pool_configure_fn)(struct aws_cryptosdk_session *session, void *user_data);
+
+/**
+ * Creates a pool of sessions in the given mode, using cmm, on which it holds a reference.
+ * Up to max_idle_per_list sessions are kept on each of the pool's freelists; sessions returned
+ * to a full freelist are destroyed. configure may be NULL.
+ *
+ * @return The new pool, or NULL on failure (in which case, an AWS error code is set)
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_session_pool *aws_cryptosdk_session_pool_new(
+    struct aws_allocator *alloc,
+    enum aws_cryptosdk_mode mode,
+    struct aws_cryptosdk_cmm *cmm,
+    size_t max_idle_per_list,
+    aws_cryptosdk_session_pool_configure_fn *configure,
+    void *configure_user_data);
+
+/**
+ * Destroys the pool and its idle sessions. Sessions taken from the pool must all have been
+ * returned, or destroyed with @ref aws_cryptosdk_session_destroy, beforehand.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_session_pool_destroy(struct aws_cryptosdk_session_pool *pool);
+
+/**
+ * Takes a session from the pool, ready for a new message in the pool's mode, creating one if
+ * none is idle.
+ *
+ * @return The session, or NULL on failure (in which case, an AWS error code is set)
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_session *aws_cryptosdk_session_pool_acquire(struct aws_cryptosdk_session_pool *pool);
+
+/**
+ * Resets session and gives it back to the pool it was taken from, whether or not its message
+ * completed. Any pending materials request is abandoned by the reset. Does nothing if session
+ * is NULL.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_session_pool_release(
+    struct aws_cryptosdk_session_pool *pool, struct aws_cryptosdk_session *session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_SESSION_POOL_H
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_TIMING_H
+#define AWS_CRYPTOSDK_TIMING_H
+
+#include <aws/cryptosdk/exports.h>
+#include <aws/cryptosdk/materials.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @addtogroup cmm_kr_highlevel
+ * @{
+ */
+
+/**
+ * The calls a timing keyring or timing CMM measures. Asynchronous calls, and the variants of
+ * On Encrypt and On Decrypt which are given the serialized encryption context, count towards
+ * the same operation, from the call until the callback or return.
+ */
+enum aws_cryptosdk_timed_op {
+    AWS_CRYPTOSDK_TIMED_ON_ENCRYPT = 0,
+    AWS_CRYPTOSDK_TIMED_ON_DECRYPT,
+    AWS_CRYPTOSDK_TIMED_GENERATE_ENC_MATERIALS,
+    AWS_CRYPTOSDK_TIMED_DECRYPT_MATERIALS,
+    AWS_CRYPTOSDK_TIMED_OP_COUNT
+};
+
+/**
+ * The number of buckets in a latency histogram. Bucket 0 counts calls taking less than 2
+ * nanoseconds, bucket i calls taking from 2^i up to 2^(i+1) nanoseconds, and the last bucket
+ * every call taking 2^(AWS_CRYPTOSDK_TIMING_BUCKETS - 1) nanoseconds (about nine minutes) or more.
+ */
+#define AWS_CRYPTOSDK_TIMING_BUCKETS 40
+
+struct aws_cryptosdk_timing_histogram {
+    /** Calls completed, and how many of them failed */
+    uint64_t calls;
+    uint64_t errors;
+    /** The sum and maximum of their latencies, in nanoseconds */
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[AWS_CRYPTOSDK_TIMING_BUCKETS];
+};
+
+/**
+ * Latency histograms, one per aws_cryptosdk_timed_op, which timing keyrings and CMMs report to.
+ * Give each layer of a keyring or CMM stack a sink of its own to see how much of the time each
+ * one takes, or share one between layers of the same kind to see them together.
+ *
+ * Recording a call takes a few relaxed atomic additions and no locks, so a sink may be shared by
+ * any number of threads. Readings are not atomic as a whole: one taken while calls complete may
+ * count a call in some fields and not yet in others.
+ */
+struct aws_cryptosdk_timing_sink;
+
+/**
+ * Creates a sink with empty histograms.
+ *
+ * @return The new sink, or NULL on failure (in which case, an AWS error code is set)
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_timing_sink *aws_cryptosdk_timing_sink_new(struct aws_allocator *alloc);
+
+/**
+ * Destroys a sink. Keyrings and CMMs reporting to it must have been destroyed beforehand.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_timing_sink_destroy(struct aws_cryptosdk_timing_sink *sink);
+
+/**
+ * Records one call to op which took latency_ns nanoseconds, and failed if error_code is not
+ * AWS_ERROR_SUCCESS. Timing keyrings and CMMs call this themselves; it is public so that
+ * other layers, such as application code around a session, can report to the same sink.
+ * Calls with an op out of range are ignored.
+ */
+AWS_CRYPTOSDK_API
+void aws_cryptosdk_timing_sink_record(
+    struct aws_cryptosdk_timing_sink *sink, enum aws_cryptosdk_timed_op op, uint64_t latency_ns, int error_code);
+
+/**
+ * Copies the histogram of op to *histogram. Raises AWS_ERROR_INVALID_ARGUMENT if op is out of
+ * range. Histograms are never reset; subtract an earlier reading to cover an interval.
+ */
+AWS_CRYPTOSDK_API
+int aws_cryptosdk_timing_sink_get(
+    const struct aws_cryptosdk_timing_sink *sink,
+    enum aws_cryptosdk_timed_op op,
+    struct aws_cryptosdk_timing_histogram *histogram);
+
+/**
+ * Returns an upper bound, in nanoseconds, on the latency of the given percentile (from 0 to
+ * 100) of the calls in histogram: the top of the bucket that call falls in, capped at max_ns.
+ * Returns 0 for an empty histogram.
+ */
+AWS_CRYPTOSDK_API
+uint64_t aws_cryptosdk_timing_histogram_percentile(
+    const struct aws_cryptosdk_timing_histogram *histogram, double percentile);
+
+/**
+ * Creates a keyring which passes every call on to inner, on which it holds a reference, and
+ * records how long each On Encrypt and On Decrypt takes in sink. The keyring describes the EDKs
+ * it can decrypt as inner does, so it can stand in for inner anywhere, including as the
+ * generator or a child of a multi-keyring. sink must outlive the keyring.
+ *
+ * @return The new keyring, or NULL on failure (in which case, an AWS error code is set)
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_keyring *aws_cryptosdk_timing_keyring_new(
+    struct aws_allocator *alloc, struct aws_cryptosdk_keyring *inner, struct aws_cryptosdk_timing_sink *sink);
+
+/**
+ * Creates a CMM which passes every call on to inner, on which it holds a reference, and records
+ * how long each call for encryption or decryption materials takes in sink. sink must outlive
+ * the CMM.
+ *
+ * @return The new CMM, or NULL on failure (in which case, an AWS error code is set)
+ */
+AWS_CRYPTOSDK_API
+struct aws_cryptosdk_cmm *aws_cryptosdk_timing_cmm_new(
+    struct aws_allocator *alloc, struct aws_cryptosdk_cmm *inner, struct aws_cryptosdk_timing_sink *sink);
+
+/** @} */  // doxygen group cmm_kr_highlevel
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_TIMING_H
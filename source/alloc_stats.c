@@ -0,0 +1,200 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <aws/common/mutex.h>
+#include <aws/cryptosdk/private/alloc_stats.h>
+
+/*
+ * Every allocation is preceded by a prefix holding its size and tag, padded so that the memory
+ * handed out keeps the alignment the upstream allocator gave the block.
+ */
+#define PREFIX_SIZE 16
+
+struct instrumented_allocator {
+    /* views[tag] attributes allocations to tag; views[AWS_CRYPTOSDK_ALLOC_OTHER] is the one handed out */
+    struct aws_allocator views[AWS_CRYPTOSDK_ALLOC_TAG_COUNT];
+    struct aws_allocator *upstream;
+    struct aws_mutex mutex;
+    /* Guarded by mutex */
+    struct aws_cryptosdk_alloc_stats stats;
+};
+
+static const char *const tag_names[AWS_CRYPTOSDK_ALLOC_TAG_COUNT] = {
+    "other", "header", "enc_ctx", "cache", "keyring", "cipher",
+};
+
+static void *instrumented_acquire(struct aws_allocator *view, size_t size);
+
+static struct instrumented_allocator *instrumented_from(struct aws_allocator *alloc) {
+    return alloc && alloc->mem_acquire == instrumented_acquire ? alloc->impl : NULL;
+}
+
+static void count_acquired(struct aws_cryptosdk_alloc_counts *counts, size_t bytes) {
+    counts->allocs++;
+    counts->bytes += bytes;
+}
+
+static void count_live(struct aws_cryptosdk_alloc_counts *counts, size_t added, size_t removed) {
+    counts->live_bytes = counts->live_bytes + added - removed;
+    if (counts->live_bytes > counts->peak_live_bytes) counts->peak_live_bytes = counts->live_bytes;
+}
+
+static void read_prefix(const uint8_t *block, size_t *size, size_t *tag) {
+    memcpy(size, block, sizeof(*size));
+    memcpy(tag, block + sizeof(*size), sizeof(*tag));
+}
+
+static void *write_prefix(uint8_t *block, size_t size, size_t tag) {
+    memcpy(block, &size, sizeof(size));
+    memcpy(block + sizeof(size), &tag, sizeof(tag));
+    return block + PREFIX_SIZE;
+}
+
+static void *instrumented_acquire(struct aws_allocator *view, size_t size) {
+    struct instrumented_allocator *self = view->impl;
+    size_t tag                          = view - self->views;
+
+    if (size > SIZE_MAX - PREFIX_SIZE) return NULL;
+    uint8_t *block = aws_mem_acquire(self->upstream, size + PREFIX_SIZE);
+    if (!block) return NULL;
+
+    aws_mutex_lock(&self->mutex);
+    count_acquired(&self->stats.total, size);
+    count_acquired(&self->stats.by_tag[tag], size);
+    count_live(&self->stats.total, size, 0);
+    count_live(&self->stats.by_tag[tag], size, 0);
+    aws_mutex_unlock(&self->mutex);
+
+    return write_prefix(block, size, tag);
+}
+
+static void instrumented_release(struct aws_allocator *view, void *ptr) {
+    struct instrumented_allocator *self = view->impl;
+    uint8_t *block                      = (uint8_t *)ptr - PREFIX_SIZE;
+    size_t size, tag;
+
+    read_prefix(block, &size, &tag);
+
+    aws_mutex_lock(&self->mutex);
+    count_live(&self->stats.total, 0, size);
+    count_live(&self->stats.by_tag[tag], 0, size);
+    aws_mutex_unlock(&self->mutex);
+
+    aws_mem_release(self->upstream, block);
+}
+
+/* A reallocation is attributed to the part making it, as a new allocation would be */
+static void *instrumented_realloc(struct aws_allocator *view, void *oldptr, size_t oldsize, size_t newsize) {
+    struct instrumented_allocator *self = view->impl;
+    size_t tag                          = view - self->views;
+    size_t old_size, old_tag;
+
+    if (!oldptr) return instrumented_acquire(view, newsize);
+    if (newsize > SIZE_MAX - PREFIX_SIZE) return NULL;
+    (void)oldsize;
+
+    void *block = (uint8_t *)oldptr - PREFIX_SIZE;
+    read_prefix(block, &old_size, &old_tag);
+    if (aws_mem_realloc(self->upstream, &block, old_size + PREFIX_SIZE, newsize + PREFIX_SIZE)) return NULL;
+
+    size_t grown = newsize > old_size ? newsize - old_size : 0;
+    aws_mutex_lock(&self->mutex);
+    count_acquired(&self->stats.total, grown);
+    count_acquired(&self->stats.by_tag[tag], grown);
+    count_live(&self->stats.total, newsize, old_size);
+    count_live(&self->stats.by_tag[old_tag], 0, old_size);
+    count_live(&self->stats.by_tag[tag], newsize, 0);
+    aws_mutex_unlock(&self->mutex);
+
+    return write_prefix(block, newsize, tag);
+}
+
+static void *instrumented_calloc(struct aws_allocator *view, size_t num, size_t size) {
+    if (size && num > SIZE_MAX / size) return NULL;
+
+    void *ptr = instrumented_acquire(view, num * size);
+    if (ptr) memset(ptr, 0, num * size);
+
+    return ptr;
+}
+
+struct aws_allocator *aws_cryptosdk_instrumented_allocator_new(struct aws_allocator *upstream) {
+    struct instrumented_allocator *self = aws_mem_calloc(upstream, 1, sizeof(*self));
+    if (!self) return NULL;
+
+    if (aws_mutex_init(&self->mutex)) {
+        aws_mem_release(upstream, self);
+        return NULL;
+    }
+    for (size_t tag = 0; tag < AWS_CRYPTOSDK_ALLOC_TAG_COUNT; tag++) {
+        self->views[tag].mem_acquire = instrumented_acquire;
+        self->views[tag].mem_release = instrumented_release;
+        self->views[tag].mem_realloc = instrumented_realloc;
+        self->views[tag].mem_calloc  = instrumented_calloc;
+        self->views[tag].impl        = self;
+    }
+    self->upstream = upstream;
+
+    return &self->views[AWS_CRYPTOSDK_ALLOC_OTHER];
+}
+
+void aws_cryptosdk_instrumented_allocator_destroy(struct aws_allocator *alloc) {
+    struct instrumented_allocator *self = instrumented_from(alloc);
+    if (!self) return;
+
+    aws_mutex_clean_up(&self->mutex);
+    aws_mem_release(self->upstream, self);
+}
+
+int aws_cryptosdk_instrumented_allocator_get_stats(
+    struct aws_allocator *alloc, struct aws_cryptosdk_alloc_stats *stats) {
+    struct instrumented_allocator *self = instrumented_from(alloc);
+    if (!self) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+
+    aws_mutex_lock(&self->mutex);
+    *stats = self->stats;
+    aws_mutex_unlock(&self->mutex);
+
+    return AWS_OP_SUCCESS;
+}
+
+static void reset_counts(struct aws_cryptosdk_alloc_counts *counts) {
+    counts->allocs          = 0;
+    counts->bytes           = 0;
+    counts->peak_live_bytes = counts->live_bytes;
+}
+
+int aws_cryptosdk_instrumented_allocator_reset(struct aws_allocator *alloc) {
+    struct instrumented_allocator *self = instrumented_from(alloc);
+    if (!self) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+
+    aws_mutex_lock(&self->mutex);
+    reset_counts(&self->stats.total);
+    for (size_t tag = 0; tag < AWS_CRYPTOSDK_ALLOC_TAG_COUNT; tag++) reset_counts(&self->stats.by_tag[tag]);
+    aws_mutex_unlock(&self->mutex);
+
+    return AWS_OP_SUCCESS;
+}
+
+const char *aws_cryptosdk_alloc_tag_name(enum aws_cryptosdk_alloc_tag tag) {
+    return (unsigned)tag < AWS_CRYPTOSDK_ALLOC_TAG_COUNT ? tag_names[tag] : NULL;
+}
+
+struct aws_allocator *aws_cryptosdk_priv_alloc_tagged(struct aws_allocator *alloc, enum aws_cryptosdk_alloc_tag tag) {
+    struct instrumented_allocator *self = instrumented_from(alloc);
+    return self ? &self->views[tag] : alloc;
+}
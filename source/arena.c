@@ -0,0 +1,163 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/common/common.h>
+#include <aws/cryptosdk/private/arena.h>
+#include <string.h>
+
+/* Allocations are aligned (and blocks sized) to this many bytes */
+#define ARENA_ALIGN 16
+
+/* Enough for the header, EDKs, encryption context and trace of most messages */
+#define ARENA_BLOCK_SIZE 4096
+
+struct arena_block {
+    struct arena_block *next;
+    size_t capacity, used;
+    /* Padding keeps data aligned to ARENA_ALIGN on all platforms */
+    uint8_t pad[ARENA_ALIGN - (2 * sizeof(size_t) + sizeof(void *)) % ARENA_ALIGN];
+    uint8_t data[];
+};
+
+struct aws_cryptosdk_arena {
+    struct aws_allocator allocator;
+    struct aws_allocator *parent;
+    /* All blocks, in the order they were added; cur is the one being carved up */
+    struct arena_block *blocks, *cur;
+    /* The most recent allocation, which can be grown in place */
+    uint8_t *last;
+};
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static void *arena_acquire(struct aws_allocator *allocator, size_t size) {
+    struct aws_cryptosdk_arena *arena = allocator->impl;
+
+    if (size > SIZE_MAX - ARENA_BLOCK_SIZE - sizeof(struct arena_block)) return NULL;
+    size = align_up(size ? size : 1);
+
+    // Move on through the blocks kept from earlier messages, then add one if none has room
+    while (arena->cur && arena->cur->capacity - arena->cur->used < size) {
+        if (!arena->cur->next) {
+            size_t capacity           = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+            struct arena_block *block = aws_mem_acquire(arena->parent, sizeof(*block) + capacity);
+            if (!block) return NULL;
+
+            block->next      = NULL;
+            block->capacity  = capacity;
+            block->used      = 0;
+            arena->cur->next = block;
+        }
+        arena->cur = arena->cur->next;
+    }
+
+    uint8_t *ptr = arena->cur->data + arena->cur->used;
+    arena->cur->used += size;
+    arena->last = ptr;
+
+    return ptr;
+}
+
+static void arena_release(struct aws_allocator *allocator, void *ptr) {
+    // Memory is reclaimed when the arena is reset
+    (void)allocator;
+    (void)ptr;
+}
+
+static void *arena_realloc(struct aws_allocator *allocator, void *oldptr, size_t oldsize, size_t newsize) {
+    struct aws_cryptosdk_arena *arena = allocator->impl;
+    struct arena_block *cur           = arena->cur;
+
+    // The most recent allocation can usually grow where it is
+    if (oldptr && oldptr == arena->last && newsize <= SIZE_MAX - ARENA_ALIGN) {
+        size_t start = (uint8_t *)oldptr - cur->data;
+        if (align_up(newsize) <= cur->capacity - start) {
+            cur->used = start + align_up(newsize ? newsize : 1);
+            return oldptr;
+        }
+    }
+
+    void *newptr = arena_acquire(allocator, newsize);
+    if (newptr && oldptr) memcpy(newptr, oldptr, oldsize < newsize ? oldsize : newsize);
+
+    return newptr;
+}
+
+static void *arena_calloc(struct aws_allocator *allocator, size_t num, size_t size) {
+    if (size && num > SIZE_MAX / size) return NULL;
+
+    void *ptr = arena_acquire(allocator, num * size);
+    if (ptr) memset(ptr, 0, num * size);
+
+    return ptr;
+}
+
+struct aws_cryptosdk_arena *aws_cryptosdk_arena_new(struct aws_allocator *parent) {
+    struct aws_cryptosdk_arena *arena = aws_mem_acquire(parent, sizeof(*arena));
+    if (!arena) return NULL;
+
+    struct arena_block *block = aws_mem_acquire(parent, sizeof(*block) + ARENA_BLOCK_SIZE);
+    if (!block) {
+        aws_mem_release(parent, arena);
+        return NULL;
+    }
+    block->next     = NULL;
+    block->capacity = ARENA_BLOCK_SIZE;
+    block->used     = 0;
+
+    arena->allocator.mem_acquire = arena_acquire;
+    arena->allocator.mem_release = arena_release;
+    arena->allocator.mem_realloc = arena_realloc;
+    arena->allocator.mem_calloc  = arena_calloc;
+    arena->allocator.impl        = arena;
+    arena->parent                = parent;
+    arena->blocks                = block;
+    arena->cur                   = block;
+    arena->last                  = NULL;
+
+    return arena;
+}
+
+struct aws_allocator *aws_cryptosdk_arena_allocator(struct aws_cryptosdk_arena *arena) {
+    return &arena->allocator;
+}
+
+void aws_cryptosdk_arena_reset(struct aws_cryptosdk_arena *arena) {
+    // Blocks past cur have not been touched since the last reset
+    for (struct arena_block *block = arena->blocks; block; block = block->next) {
+        aws_secure_zero(block->data, block->used);
+        block->used = 0;
+        if (block == arena->cur) break;
+    }
+
+    arena->cur  = arena->blocks;
+    arena->last = NULL;
+}
+
+void aws_cryptosdk_arena_destroy(struct aws_cryptosdk_arena *arena) {
+    if (!arena) return;
+
+    aws_cryptosdk_arena_reset(arena);
+
+    struct arena_block *block = arena->blocks;
+    while (block) {
+        struct arena_block *next = block->next;
+        aws_mem_release(arena->parent, block);
+        block = next;
+    }
+
+    aws_mem_release(arena->parent, arena);
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/atomics.h>
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/session.h>
+
+struct batch {
+    struct aws_allocator *alloc;
+    struct aws_cryptosdk_cmm *cmm;
+    const struct aws_cryptosdk_frozen_enc_ctx *enc_ctx;
+    struct aws_byte_buf *outputs;
+    const struct aws_byte_cursor *inputs;
+    size_t count;
+    /* Index of the next message to be claimed by a thread */
+    struct aws_atomic_var next;
+    /* Error code of the first message to fail, or zero; threads stop once it is set */
+    struct aws_atomic_var error;
+};
+
+static void record_error(struct batch *batch) {
+    size_t expected = 0;
+    int error       = aws_last_error();
+
+    aws_atomic_compare_exchange_int(&batch->error, &expected, error ? error : AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+}
+
+static int encrypt_one(struct batch *batch, struct aws_cryptosdk_session *session, size_t i) {
+    /* An empty input must still point somewhere, or the session sees no plaintext at all */
+    static const uint8_t empty_input = 0;
+    const uint8_t *inp               = batch->inputs[i].ptr ? batch->inputs[i].ptr : &empty_input;
+    struct aws_byte_buf *output      = &batch->outputs[i];
+    size_t written, read;
+    uint64_t size;
+
+    if (batch->enc_ctx && aws_cryptosdk_session_set_frozen_enc_ctx(session, batch->enc_ctx)) return AWS_OP_ERR;
+    if (aws_cryptosdk_session_set_message_size(session, batch->inputs[i].len)) return AWS_OP_ERR;
+
+    // Generates the materials, fixing the size of the message
+    if (aws_cryptosdk_session_get_total_output_size(session, &size)) return AWS_OP_ERR;
+    if (size > SIZE_MAX) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    if (aws_byte_buf_init(output, batch->alloc, (size_t)size)) return AWS_OP_ERR;
+
+    if (aws_cryptosdk_session_process(
+            session, output->buffer, output->capacity, &written, inp, batch->inputs[i].len, &read)) {
+        return AWS_OP_ERR;
+    }
+    if (!aws_cryptosdk_session_is_done(session) || read != batch->inputs[i].len || written != output->capacity) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+    output->len = written;
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Encrypts messages until none are left or one fails, on the calling thread or a helper */
+static void batch_worker(void *arg) {
+    struct batch *batch = arg;
+    struct aws_cryptosdk_session *session;
+
+    if (!(session = aws_cryptosdk_session_new_borrowing_cmm(batch->alloc, AWS_CRYPTOSDK_ENCRYPT, batch->cmm)) ||
+        aws_cryptosdk_session_set_keyring_trace(session, false)) {
+        record_error(batch);
+        goto out;
+    }
+
+    while (!aws_atomic_load_int(&batch->error)) {
+        size_t i = aws_atomic_fetch_add(&batch->next, 1);
+        if (i >= batch->count) break;
+
+        if (encrypt_one(batch, session, i) || aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT)) {
+            record_error(batch);
+            break;
+        }
+    }
+
+out:
+    if (session) aws_cryptosdk_session_destroy(session);
+}
+
+static struct aws_cryptosdk_cmm *new_batch_cmm(
+    struct aws_allocator *alloc, struct aws_cryptosdk_cmm *upstream, size_t count) {
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 1);
+    if (!cache) return NULL;
+
+    // The materials live as long as the batch, and as many messages as it holds may use them
+    struct aws_cryptosdk_cmm *cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, upstream, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    aws_cryptosdk_materials_cache_release(cache);
+    if (!cmm) return NULL;
+
+    uint64_t limit = count < AWS_CRYPTOSDK_CACHE_MAX_LIMIT_MESSAGES ? count : AWS_CRYPTOSDK_CACHE_MAX_LIMIT_MESSAGES;
+    if (aws_cryptosdk_caching_cmm_set_limit_messages(cmm, limit)) {
+        aws_cryptosdk_cmm_release(cmm);
+        return NULL;
+    }
+
+    return cmm;
+}
+
+int aws_cryptosdk_encrypt_batch(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    const struct aws_hash_table *enc_ctx,
+    struct aws_byte_buf *outputs,
+    const struct aws_byte_cursor *inputs,
+    size_t count,
+    size_t num_threads) {
+    struct aws_cryptosdk_frozen_enc_ctx *frozen = NULL;
+    struct aws_thread *threads                  = NULL;
+    size_t helpers                              = 0;
+    struct batch batch                          = { 0 };
+    int rv                                      = AWS_OP_ERR;
+
+    for (size_t i = 0; i < count; i++) {
+        AWS_ZERO_STRUCT(outputs[i]);
+    }
+    if (!count) return AWS_OP_SUCCESS;
+
+    batch.alloc   = alloc;
+    batch.outputs = outputs;
+    batch.inputs  = inputs;
+    batch.count   = count;
+    aws_atomic_init_int(&batch.next, 0);
+    aws_atomic_init_int(&batch.error, 0);
+
+    if (enc_ctx && !(frozen = aws_cryptosdk_enc_ctx_freeze(alloc, enc_ctx))) goto out;
+    batch.enc_ctx = frozen;
+    if (!(batch.cmm = new_batch_cmm(alloc, cmm, count))) goto out;
+
+    if (num_threads > count) num_threads = count;
+    if (num_threads > 1) {
+        if (!(threads = aws_mem_calloc(alloc, num_threads - 1, sizeof(*threads)))) goto out;
+        // Threads which cannot be started leave their share of the messages to the others
+        for (; helpers < num_threads - 1; helpers++) {
+            if (aws_thread_init(&threads[helpers], alloc)) break;
+            if (aws_thread_launch(&threads[helpers], batch_worker, &batch, NULL)) {
+                aws_thread_clean_up(&threads[helpers]);
+                break;
+            }
+        }
+    }
+
+    batch_worker(&batch);
+    for (size_t i = 0; i < helpers; i++) {
+        aws_thread_join(&threads[i]);
+        aws_thread_clean_up(&threads[i]);
+    }
+
+    int error = (int)aws_atomic_load_int(&batch.error);
+    if (error) {
+        aws_raise_error(error);
+        goto out;
+    }
+    rv = AWS_OP_SUCCESS;
+
+out:
+    if (rv) {
+        for (size_t i = 0; i < count; i++) {
+            if (outputs[i].allocator) aws_byte_buf_clean_up_secure(&outputs[i]);
+        }
+    }
+    if (threads) aws_mem_release(alloc, threads);
+    aws_cryptosdk_cmm_release(batch.cmm);
+    aws_cryptosdk_frozen_enc_ctx_destroy(frozen);
+
+    return rv;
+}
@@ -0,0 +1,286 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/edk.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/keyring_trace.h>
+#include <aws/cryptosdk/private/cache_serialize.h>
+#include <aws/cryptosdk/private/enc_ctx.h>
+#include <aws/cryptosdk/private/secure_pool.h>
+
+static bool write_field(struct aws_byte_buf *buf, const uint8_t *ptr, size_t len) {
+    return len <= UINT16_MAX && aws_byte_buf_write_be16(buf, (uint16_t)len) && aws_byte_buf_write(buf, ptr, len);
+}
+
+static int read_field(struct aws_byte_cursor *cur, struct aws_byte_cursor *field) {
+    uint16_t len;
+
+    if (!aws_byte_cursor_read_be16(cur, &len) || cur->len < len) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    *field = aws_byte_cursor_advance(cur, len);
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Writes the fields common to encryption and decryption materials. All integers are big-endian,
+ * and each variable-length field is preceded by its 16-bit length:
+ *
+ *   alg (2), data key, trace record count (2)
+ *   for each trace record: flags (4), wrapping key namespace, wrapping key name
+ *   signing or verification key (empty if the algorithm does not sign)
+ *
+ * followed, for encryption materials, by:
+ *
+ *   serialized encryption context, EDK count (2)
+ *   for each EDK: provider ID, provider info, ciphertext
+ */
+static int serialize_common(
+    struct aws_byte_buf *out,
+    enum aws_cryptosdk_alg_id alg,
+    const struct aws_byte_buf *data_key,
+    const struct aws_array_list *trace,
+    const struct aws_string *key_materials) {
+    size_t num_records = aws_array_list_length(trace);
+
+    if (!aws_byte_buf_write_be16(out, (uint16_t)alg) || !write_field(out, data_key->buffer, data_key->len) ||
+        num_records > UINT16_MAX || !aws_byte_buf_write_be16(out, (uint16_t)num_records)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    for (size_t i = 0; i < num_records; i++) {
+        struct aws_cryptosdk_keyring_trace_record *record;
+
+        if (aws_array_list_get_at_ptr(trace, (void **)&record, i)) return AWS_OP_ERR;
+
+        if (!aws_byte_buf_write_be32(out, record->flags) ||
+            !write_field(
+                out, aws_string_bytes(record->wrapping_key_namespace), record->wrapping_key_namespace->len) ||
+            !write_field(out, aws_string_bytes(record->wrapping_key_name), record->wrapping_key_name->len)) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        }
+    }
+
+    if (!write_field(
+            out, key_materials ? aws_string_bytes(key_materials) : NULL, key_materials ? key_materials->len : 0)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_priv_serialize_enc_materials(
+    struct aws_allocator *alloc,
+    struct aws_byte_buf *out,
+    const struct aws_cryptosdk_enc_materials *materials,
+    const struct aws_hash_table *enc_ctx) {
+    struct aws_string *key_materials = NULL;
+    int rv                           = AWS_OP_ERR;
+    size_t enc_ctx_len;
+    size_t num_edks = aws_array_list_length(&materials->encrypted_data_keys);
+
+    if (materials->signctx && aws_cryptosdk_sig_get_privkey(materials->signctx, alloc, &key_materials)) {
+        return AWS_OP_ERR;
+    }
+
+    if (serialize_common(
+            out, materials->alg, &materials->unencrypted_data_key, &materials->keyring_trace, key_materials) ||
+        aws_cryptosdk_enc_ctx_size(&enc_ctx_len, enc_ctx)) {
+        goto out;
+    }
+
+    /* The serializer checks the buffer's whole capacity, so check the room left here */
+    if (out->capacity - out->len < enc_ctx_len + 4 || !aws_byte_buf_write_be16(out, (uint16_t)enc_ctx_len) ||
+        aws_cryptosdk_enc_ctx_serialize(alloc, out, enc_ctx)) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        goto out;
+    }
+
+    if (num_edks > UINT16_MAX || !aws_byte_buf_write_be16(out, (uint16_t)num_edks)) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        goto out;
+    }
+
+    for (size_t i = 0; i < num_edks; i++) {
+        struct aws_cryptosdk_edk *edk;
+
+        if (aws_array_list_get_at_ptr(&materials->encrypted_data_keys, (void **)&edk, i)) goto out;
+
+        if (aws_cryptosdk_edk_write_record(out, edk)) {
+            aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+            goto out;
+        }
+    }
+
+    rv = AWS_OP_SUCCESS;
+
+out:
+    aws_string_destroy_secure(key_materials);
+    return rv;
+}
+
+int aws_cryptosdk_priv_serialize_dec_materials(
+    struct aws_allocator *alloc, struct aws_byte_buf *out, const struct aws_cryptosdk_dec_materials *materials) {
+    struct aws_string *key_materials = NULL;
+
+    if (materials->signctx && aws_cryptosdk_sig_get_pubkey(materials->signctx, alloc, &key_materials)) {
+        return AWS_OP_ERR;
+    }
+
+    int rv = serialize_common(
+        out, materials->alg, &materials->unencrypted_data_key, &materials->keyring_trace, key_materials);
+
+    aws_string_destroy(key_materials);
+    return rv;
+}
+
+/*
+ * Reads the common fields written by serialize_common into a newly allocated materials object's
+ * data key and keyring trace, and returns its signing or verification key, if any, in *key_materials.
+ */
+static int deserialize_common(
+    struct aws_allocator *alloc,
+    struct aws_byte_cursor *cur,
+    struct aws_byte_buf *data_key,
+    struct aws_array_list *trace,
+    struct aws_string **key_materials) {
+    struct aws_byte_cursor field, namespace, name;
+    uint16_t num_records;
+    uint32_t flags;
+
+    *key_materials = NULL;
+
+    if (read_field(cur, &field) ||
+        aws_byte_buf_init_copy_from_cursor(data_key, aws_cryptosdk_secure_key_allocator(), field)) {
+        return AWS_OP_ERR;
+    }
+
+    if (!aws_byte_cursor_read_be16(cur, &num_records)) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+
+    for (uint16_t i = 0; i < num_records; i++) {
+        if (!aws_byte_cursor_read_be32(cur, &flags)) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+        if (read_field(cur, &namespace) || read_field(cur, &name)) return AWS_OP_ERR;
+
+        struct aws_byte_buf namespace_buf = aws_byte_buf_from_array(namespace.ptr, namespace.len);
+        struct aws_byte_buf name_buf      = aws_byte_buf_from_array(name.ptr, name.len);
+        if (aws_cryptosdk_keyring_trace_add_record_buf(alloc, trace, &namespace_buf, &name_buf, flags)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    if (read_field(cur, &field)) return AWS_OP_ERR;
+    if (field.len && !(*key_materials = aws_string_new_from_array(alloc, field.ptr, field.len))) return AWS_OP_ERR;
+
+    return AWS_OP_SUCCESS;
+}
+
+static int deserialize_edks(struct aws_allocator *alloc, struct aws_byte_cursor *cur, struct aws_array_list *edks) {
+    uint16_t num_edks;
+
+    if (!aws_byte_cursor_read_be16(cur, &num_edks)) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+
+    // EDKs are stored as records, so each is copied out in one piece and stays a record
+    for (uint16_t i = 0; i < num_edks; i++) {
+        struct aws_cryptosdk_edk view, edk;
+
+        if (aws_cryptosdk_edk_init_view(&view, cur)) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+
+        if (aws_cryptosdk_edk_init_clone(alloc, &edk, &view)) return AWS_OP_ERR;
+        if (aws_array_list_push_back(edks, &edk)) {
+            aws_cryptosdk_edk_clean_up(&edk);
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_priv_deserialize_enc_materials(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_enc_materials **materials_out,
+    struct aws_hash_table *enc_ctx,
+    struct aws_byte_cursor cur) {
+    struct aws_cryptosdk_enc_materials *materials = NULL;
+    struct aws_string *key_materials              = NULL;
+    struct aws_byte_cursor enc_ctx_field;
+    uint16_t alg;
+    *materials_out = NULL;
+
+    if (!aws_byte_cursor_read_be16(&cur, &alg)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (!(materials = aws_cryptosdk_enc_materials_new(alloc, (enum aws_cryptosdk_alg_id)alg))) {
+        return AWS_OP_ERR;
+    }
+
+    if (deserialize_common(alloc, &cur, &materials->unencrypted_data_key, &materials->keyring_trace, &key_materials) ||
+        read_field(&cur, &enc_ctx_field) || aws_cryptosdk_enc_ctx_deserialize(alloc, enc_ctx, &enc_ctx_field) ||
+        deserialize_edks(alloc, &cur, &materials->encrypted_data_keys)) {
+        goto out;
+    }
+
+    if (key_materials &&
+        aws_cryptosdk_sig_sign_start(
+            &materials->signctx, alloc, NULL, aws_cryptosdk_alg_props(materials->alg), key_materials)) {
+        goto out;
+    }
+
+    *materials_out = materials;
+    materials      = NULL;
+
+out:
+    aws_string_destroy_secure(key_materials);
+    aws_cryptosdk_enc_materials_destroy(materials);
+
+    return *materials_out ? AWS_OP_SUCCESS : AWS_OP_ERR;
+}
+
+int aws_cryptosdk_priv_deserialize_dec_materials(
+    struct aws_allocator *alloc, struct aws_cryptosdk_dec_materials **materials_out, struct aws_byte_cursor cur) {
+    struct aws_cryptosdk_dec_materials *materials = NULL;
+    struct aws_string *key_materials              = NULL;
+    uint16_t alg;
+    *materials_out = NULL;
+
+    if (!aws_byte_cursor_read_be16(&cur, &alg)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (!(materials = aws_cryptosdk_dec_materials_new(alloc, (enum aws_cryptosdk_alg_id)alg))) {
+        return AWS_OP_ERR;
+    }
+
+    if (deserialize_common(alloc, &cur, &materials->unencrypted_data_key, &materials->keyring_trace, &key_materials)) {
+        goto out;
+    }
+
+    if (key_materials &&
+        aws_cryptosdk_sig_verify_start(
+            &materials->signctx, alloc, key_materials, aws_cryptosdk_alg_props(materials->alg))) {
+        goto out;
+    }
+
+    *materials_out = materials;
+    materials      = NULL;
+
+out:
+    aws_string_destroy(key_materials);
+    aws_cryptosdk_dec_materials_destroy(materials);
+
+    return *materials_out ? AWS_OP_SUCCESS : AWS_OP_ERR;
+}
@@ -13,14 +13,136 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
+
 #include <aws/common/byte_buf.h>
+#include <aws/common/condition_variable.h>
 #include <aws/common/linked_list.h> /* AWS_CONTAINER_OF */
 #include <aws/common/math.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
 #include <aws/cryptosdk/cache.h>
 #include <aws/cryptosdk/default_cmm.h>
 #include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/coarse_clock.h>
 #include <aws/cryptosdk/private/enc_ctx.h>
+#include <aws/cryptosdk/private/header.h>
+#include <aws/cryptosdk/private/secure_pool.h>
+#include <aws/cryptosdk/private/utils.h>
+
+/*
+ * Number of recent (cache entry, message ID) pairs for which we remember the derived content key,
+ * so that repeatedly decrypting the same message skips the KDF.
+ */
+#define DERIVED_KEY_SLOTS 16
+
+struct derived_key_slot {
+    bool valid;
+    enum aws_cryptosdk_alg_id alg;
+    uint8_t cache_id[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t cache_id_len;
+    uint8_t message_id[MESSAGE_ID_LEN];
+    struct content_key content_key;
+};
+
+/*
+ * Number of recent cache entries for which we keep the data key's HKDF extract, so that each new
+ * message decrypted with cached materials only pays for the expand step; see hkdf.h.
+ */
+#define HKDF_KEY_SLOTS 16
+
+struct hkdf_key_slot {
+    bool valid;
+    enum aws_cryptosdk_alg_id alg;
+    uint8_t cache_id[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t cache_id_len;
+    struct aws_cryptosdk_hkdf_key hkdf_key;
+};
+
+/*
+ * Number of recent cache entries for which we remember the serialized encryption context and EDK
+ * sections of the message header, so that encrypting with cached materials skips re-serializing them.
+ */
+#define HEADER_TEMPLATE_SLOTS 16
+
+struct header_template_slot {
+    uint8_t cache_id[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t cache_id_len;
+    /* Output of aws_cryptosdk_hdr_write_fields; empty if the slot is unused */
+    struct aws_byte_buf fields;
+};
+
+/*
+ * Number of recent decrypt cache IDs which no keyring could decrypt, which we fail without asking
+ * the upstream CMM again until the negative TTL passes
+ */
+#define NEGATIVE_SLOTS 16
+
+struct negative_slot {
+    uint8_t cache_id[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    /* Zero if the slot is unused */
+    size_t cache_id_len;
+    uint64_t expiry;
+};
+
+/*
+ * Number of usage leases, each shared by the threads whose IDs hash to it. A lease is a part of
+ * an entry's message and byte budget which has already been added to the entry's usage stats, and
+ * which the threads using the lease then count down without touching the entry.
+ */
+#define LEASE_SLOTS 16
+
+struct lease_slot {
+    /* Set while a thread is using the lease; a thread which finds it set charges the entry directly */
+    struct aws_atomic_var busy;
+    /* Entry the budget was leased from, on which the lease holds a reference, or NULL */
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    /* The entry's usage stats at the end of the lease, and the part of the lease not yet used */
+    struct aws_cryptosdk_cache_usage_stats end, remaining;
+    /* Usage added to the entry beyond the CMM's limits when the lease was taken, which can never be used */
+    struct aws_cryptosdk_cache_usage_stats excess;
+};
+
+/*
+ * Number of idle SHA-512 contexts kept for deriving cache IDs, so that concurrent requests need
+ * not allocate one each
+ */
+#define MD_CONTEXT_SLOTS 8
+
+/*
+ * Number of encryption entries which may be queued for refresh-ahead at once; entries which cross
+ * the refresh threshold while the queue is full are left to expire as usual.
+ */
+#define REFRESH_SLOTS 8
+
+struct refresh_slot {
+    /* Set while the slot holds a queued or running refresh; enc_ctx is only initialized while set */
+    bool pending;
+    /* Set once the refresh thread has taken the slot, after which only that thread touches it */
+    bool running;
+    uint8_t cache_id[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t cache_id_len;
+    enum aws_cryptosdk_alg_id requested_alg;
+    uint64_t plaintext_size;
+    /* Copy of the caller's encryption context, before any upstream CMM modified it */
+    struct aws_hash_table enc_ctx;
+};
+
+/*
+ * Number of cache misses which may be in flight at once while other requests for the same cache ID
+ * wait for them; further misses call the upstream CMM independently.
+ */
+#define INFLIGHT_SLOTS 16
+
+struct inflight_slot {
+    /* Set while a request is fetching materials for cache_id from the upstream CMM */
+    bool active;
+    uint8_t cache_id[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t cache_id_len;
+    /* Incremented when each fetch finishes, so that a waiter can tell that the one it waited for has */
+    uint64_t completions;
+};
 
 struct caching_cmm {
     struct aws_cryptosdk_cmm base;
@@ -28,10 +150,74 @@ struct caching_cmm {
     struct aws_cryptosdk_cmm *upstream;
     struct aws_cryptosdk_materials_cache *materials_cache;
     struct aws_string *partition_id;
+    /* SHA-512 state after hashing partition_id, which begins every cache ID; only ever copied from */
+    struct aws_cryptosdk_md_context *partition_md;
 
     int (*clock_get_ticks)(uint64_t *now);
+    /* Set while clock_get_ticks is the coarse clock, which this CMM then holds */
+    bool coarse_clock;
 
     uint64_t limit_messages, limit_bytes, ttl_nanos;
+    /* Largest share of the TTL by which entries are expired early, or 0 if jitter is disabled */
+    uint32_t ttl_jitter_percent;
+    /* Random value mixed into each entry's jitter, so that it differs between processes */
+    uint64_t ttl_jitter_seed;
+
+    /*
+     * Protects derived_keys, hkdf_keys, header_templates, negatives and their next indices, which
+     * are shared by all sessions using this CMM
+     */
+    struct aws_mutex derived_key_mutex;
+    struct derived_key_slot derived_keys[DERIVED_KEY_SLOTS];
+    size_t next_derived_key;
+    struct hkdf_key_slot hkdf_keys[HKDF_KEY_SLOTS];
+    size_t next_hkdf_key;
+    struct header_template_slot header_templates[HEADER_TEMPLATE_SLOTS];
+    size_t next_header_template;
+    /* How long undecryptable requests are failed fast, or 0 if negative caching is disabled */
+    uint64_t negative_ttl_nanos;
+    struct negative_slot negatives[NEGATIVE_SLOTS];
+    size_t next_negative;
+
+    struct aws_mutex md_context_mutex;
+    struct aws_cryptosdk_md_context *md_contexts[MD_CONTEXT_SLOTS];
+    size_t md_context_count;
+
+    /* Percentage of each limit after which entries are refreshed ahead of expiry, or 0 if disabled */
+    uint32_t refresh_percent;
+    /* Protects refreshes and the refresh thread's state */
+    struct aws_mutex refresh_mutex;
+    /* Signalled when a refresh is queued, and on shutdown */
+    struct aws_condition_variable refresh_wakeup;
+    struct refresh_slot refreshes[REFRESH_SLOTS];
+    bool refresh_thread_started, refresh_shutdown;
+    struct aws_thread refresh_thread;
+
+    /* Protects inflight */
+    struct aws_mutex inflight_mutex;
+    /* Signalled whenever a fetch recorded in inflight finishes */
+    struct aws_condition_variable inflight_done;
+    struct inflight_slot inflight[INFLIGHT_SLOTS];
+
+    /* Number of messages leased from an entry at a time, or 0 if leasing is disabled */
+    uint64_t lease_messages;
+    struct lease_slot leases[LEASE_SLOTS];
+
+    /* Set if generating encryption materials also caches the materials to decrypt their messages */
+    bool write_through;
+
+    /* Number of data keys kept live per encryption request, and how requests are spread over them */
+    uint32_t key_pool_size;
+    enum aws_cryptosdk_key_pool_selection key_pool_selection;
+    /* Counts requests, for round-robin selection */
+    struct aws_atomic_var next_pool_key;
+
+    /* Called with each request looked up in the cache, if set */
+    aws_cryptosdk_caching_cmm_request_recorder_fn *recorder;
+    void *recorder_user_data;
+
+    /* Hashes the EDKs of decryption requests, or NULL to hash them one at a time with a digest context */
+    const struct aws_cryptosdk_digest_provider_vt *digest_provider;
 };
 
 static void destroy_caching_cmm(struct aws_cryptosdk_cmm *generic_cmm);
@@ -43,18 +229,66 @@ static int decrypt_materials(
     struct aws_cryptosdk_cmm *cmm,
     struct aws_cryptosdk_dec_materials **output,
     struct aws_cryptosdk_dec_request *request);
-static const struct aws_cryptosdk_cmm_vt caching_cmm_vt = { .vt_size                = sizeof(caching_cmm_vt),
-                                                            .name                   = "Caching CMM",
-                                                            .destroy                = destroy_caching_cmm,
-                                                            .generate_enc_materials = generate_enc_materials,
-                                                            .decrypt_materials      = decrypt_materials };
+static bool may_decrypt(const struct aws_cryptosdk_cmm *cmm, const struct aws_array_list *edks);
+// Cache IDs for decryption are digested from the serialized context, so a hit never builds it
+static const struct aws_cryptosdk_cmm_vt caching_cmm_vt = { .vt_size                        = sizeof(caching_cmm_vt),
+                                                            .name                           = "Caching CMM",
+                                                            .destroy                        = destroy_caching_cmm,
+                                                            .generate_enc_materials         = generate_enc_materials,
+                                                            .decrypt_materials              = decrypt_materials,
+                                                            .decrypt_takes_deferred_enc_ctx = true,
+                                                            .may_decrypt                    = may_decrypt };
+
+static void drop_lease(struct caching_cmm *cmm, struct lease_slot *slot);
+
+// Every cached entry came from the upstream CMM decrypting one of the same EDKs, so it decides
+static bool may_decrypt(const struct aws_cryptosdk_cmm *generic_cmm, const struct aws_array_list *edks) {
+    const struct caching_cmm *cmm = (const struct caching_cmm *)generic_cmm;
+    return aws_cryptosdk_cmm_may_decrypt(cmm->upstream, edks);
+}
 
 static void destroy_caching_cmm(struct aws_cryptosdk_cmm *generic_cmm) {
     struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
 
+    if (cmm->refresh_thread_started) {
+        aws_mutex_lock(&cmm->refresh_mutex);
+        cmm->refresh_shutdown = true;
+        aws_condition_variable_notify_all(&cmm->refresh_wakeup);
+        aws_mutex_unlock(&cmm->refresh_mutex);
+
+        aws_thread_join(&cmm->refresh_thread);
+        aws_thread_clean_up(&cmm->refresh_thread);
+    }
+    for (size_t i = 0; i < REFRESH_SLOTS; i++) {
+        if (cmm->refreshes[i].pending) {
+            aws_cryptosdk_enc_ctx_clean_up(&cmm->refreshes[i].enc_ctx);
+        }
+    }
+    aws_condition_variable_clean_up(&cmm->refresh_wakeup);
+    aws_mutex_clean_up(&cmm->refresh_mutex);
+    aws_condition_variable_clean_up(&cmm->inflight_done);
+    aws_mutex_clean_up(&cmm->inflight_mutex);
+    for (size_t i = 0; i < LEASE_SLOTS; i++) {
+        drop_lease(cmm, &cmm->leases[i]);
+    }
+
+    aws_secure_zero(cmm->derived_keys, sizeof(cmm->derived_keys));
+    aws_secure_zero(cmm->hkdf_keys, sizeof(cmm->hkdf_keys));
+    for (size_t i = 0; i < HEADER_TEMPLATE_SLOTS; i++) {
+        aws_byte_buf_clean_up(&cmm->header_templates[i].fields);
+    }
+    for (size_t i = 0; i < cmm->md_context_count; i++) {
+        aws_cryptosdk_md_abort(cmm->md_contexts[i]);
+    }
+    aws_mutex_clean_up(&cmm->md_context_mutex);
+    aws_mutex_clean_up(&cmm->derived_key_mutex);
+    aws_cryptosdk_md_abort(cmm->partition_md);
     aws_string_destroy(cmm->partition_id);
     aws_cryptosdk_materials_cache_release(cmm->materials_cache);
     aws_cryptosdk_cmm_release(cmm->upstream);
+    if (cmm->coarse_clock) {
+        aws_cryptosdk_priv_coarse_clock_release();
+    }
     aws_mem_release(cmm->alloc, cmm);
 }
 
@@ -98,6 +332,54 @@ struct aws_string *hash_or_generate_partition_id(
     }
 }
 
+/* Creates a SHA-512 context which has hashed the partition ID, to be copied at the start of each cache ID */
+AWS_CRYPTOSDK_TEST_STATIC
+int new_partition_md(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_md_context **partition_md,
+    const struct aws_string *partition_id) {
+    if (aws_cryptosdk_md_init(alloc, partition_md, AWS_CRYPTOSDK_MD_SHA512)) {
+        return AWS_OP_ERR;
+    }
+
+    if (aws_cryptosdk_md_update(*partition_md, aws_string_bytes(partition_id), partition_id->len)) {
+        aws_cryptosdk_md_abort(*partition_md);
+        *partition_md = NULL;
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Takes an idle SHA-512 context from the pool, or creates one if the pool is empty */
+static struct aws_cryptosdk_md_context *acquire_md_context(struct caching_cmm *cmm) {
+    struct aws_cryptosdk_md_context *md_context = NULL;
+
+    aws_mutex_lock(&cmm->md_context_mutex);
+    if (cmm->md_context_count) {
+        md_context = cmm->md_contexts[--cmm->md_context_count];
+    }
+    aws_mutex_unlock(&cmm->md_context_mutex);
+
+    if (!md_context && aws_cryptosdk_md_init(cmm->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512)) {
+        return NULL;
+    }
+
+    return md_context;
+}
+
+/* Returns a context, which must be ready to hash a new message, to the pool */
+static void release_md_context(struct caching_cmm *cmm, struct aws_cryptosdk_md_context *md_context) {
+    aws_mutex_lock(&cmm->md_context_mutex);
+    if (cmm->md_context_count < MD_CONTEXT_SLOTS) {
+        cmm->md_contexts[cmm->md_context_count++] = md_context;
+        md_context                                = NULL;
+    }
+    aws_mutex_unlock(&cmm->md_context_mutex);
+
+    aws_cryptosdk_md_abort(md_context);
+}
+
 AWS_CRYPTOSDK_TEST_STATIC
 void caching_cmm_set_clock(struct aws_cryptosdk_cmm *generic_cmm, int (*clock_get_ticks)(uint64_t *now)) {
     struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
@@ -133,6 +415,41 @@ int aws_cryptosdk_caching_cmm_set_limit_messages(struct aws_cryptosdk_cmm *gener
     return AWS_OP_SUCCESS;
 }
 
+static void run_refreshes(void *arg);
+
+int aws_cryptosdk_caching_cmm_set_refresh_ahead(struct aws_cryptosdk_cmm *generic_cmm, uint32_t refresh_percent) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    if (refresh_percent >= 100) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    if (refresh_percent) {
+        int rv = AWS_OP_SUCCESS;
+
+        if (aws_mutex_lock(&cmm->refresh_mutex)) return AWS_OP_ERR;
+        if (!cmm->refresh_thread_started) {
+            if (aws_thread_init(&cmm->refresh_thread, cmm->alloc)) {
+                rv = AWS_OP_ERR;
+            } else if (aws_thread_launch(&cmm->refresh_thread, run_refreshes, cmm, NULL)) {
+                aws_thread_clean_up(&cmm->refresh_thread);
+                rv = AWS_OP_ERR;
+            } else {
+                cmm->refresh_thread_started = true;
+            }
+        }
+        aws_mutex_unlock(&cmm->refresh_mutex);
+
+        if (rv) return rv;
+    }
+
+    cmm->refresh_percent = refresh_percent;
+    return AWS_OP_SUCCESS;
+}
+
 /* Returns zero if any of the arguments have invalid values
  * and returns UINT64_MAX if there would be an overflow.
  */
@@ -145,6 +462,27 @@ uint64_t convert_ttl_to_nanos(uint64_t ttl, enum aws_timestamp_unit ttl_units) {
     return aws_mul_u64_saturating(AWS_TIMESTAMP_NANOS / ttl_units, ttl);
 }
 
+int aws_cryptosdk_caching_cmm_set_clock_precision(
+    struct aws_cryptosdk_cmm *generic_cmm, uint64_t precision, enum aws_timestamp_unit units) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    // Zero is valid here, and selects the exact clock
+    uint64_t precision_nanos = convert_ttl_to_nanos(precision ? precision : 1, units);
+    if (!precision_nanos) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+
+    if (precision && aws_cryptosdk_priv_coarse_clock_acquire(precision_nanos)) return AWS_OP_ERR;
+    if (cmm->coarse_clock) {
+        aws_cryptosdk_priv_coarse_clock_release();
+    }
+
+    cmm->coarse_clock = precision != 0;
+    caching_cmm_set_clock(generic_cmm, precision ? aws_cryptosdk_priv_coarse_clock_get_ticks : aws_sys_clock_get_ticks);
+    return AWS_OP_SUCCESS;
+}
+
 int aws_cryptosdk_caching_cmm_set_ttl(
     struct aws_cryptosdk_cmm *generic_cmm, uint64_t ttl, enum aws_timestamp_unit ttl_units) {
     struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
@@ -159,6 +497,155 @@ int aws_cryptosdk_caching_cmm_set_ttl(
     return AWS_OP_SUCCESS;
 }
 
+int aws_cryptosdk_caching_cmm_set_ttl_jitter(struct aws_cryptosdk_cmm *generic_cmm, uint32_t jitter_percent) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    if (jitter_percent >= 100) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    if (jitter_percent && !cmm->ttl_jitter_seed) {
+        uint8_t seed[sizeof(cmm->ttl_jitter_seed)];
+
+        if (aws_cryptosdk_genrandom(seed, sizeof(seed))) return AWS_OP_ERR;
+        memcpy(&cmm->ttl_jitter_seed, seed, sizeof(seed));
+    }
+
+    cmm->ttl_jitter_percent = jitter_percent;
+    return AWS_OP_SUCCESS;
+}
+
+/* Waits for the lease to be idle, then takes it */
+static void lock_lease(struct lease_slot *slot) {
+    size_t idle = 0;
+
+    while (!aws_atomic_compare_exchange_int(&slot->busy, &idle, 1)) {
+        idle = 0;
+        aws_thread_current_sleep(1000);
+    }
+}
+
+static void unlock_lease(struct lease_slot *slot) {
+    aws_atomic_store_int(&slot->busy, 0);
+}
+
+int aws_cryptosdk_caching_cmm_set_usage_lease(struct aws_cryptosdk_cmm *generic_cmm, uint64_t lease_messages) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    if (lease_messages > AWS_CRYPTOSDK_CACHE_MAX_LIMIT_MESSAGES) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    cmm->lease_messages = lease_messages;
+
+    /* Give back what is left of the current leases, so that a smaller lease size applies at once */
+    for (size_t i = 0; i < LEASE_SLOTS; i++) {
+        lock_lease(&cmm->leases[i]);
+        drop_lease(cmm, &cmm->leases[i]);
+        unlock_lease(&cmm->leases[i]);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_caching_cmm_set_negative_ttl(
+    struct aws_cryptosdk_cmm *generic_cmm, uint64_t ttl, enum aws_timestamp_unit ttl_units) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    uint64_t ttl_nanos = 0;
+    if (ttl) {
+        ttl_nanos = convert_ttl_to_nanos(ttl, ttl_units);
+        if (!ttl_nanos) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    if (aws_mutex_lock(&cmm->derived_key_mutex)) return AWS_OP_ERR;
+    cmm->negative_ttl_nanos = ttl_nanos;
+    if (!ttl_nanos) {
+        memset(cmm->negatives, 0, sizeof(cmm->negatives));
+    }
+    aws_mutex_unlock(&cmm->derived_key_mutex);
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_caching_cmm_set_key_pool(
+    struct aws_cryptosdk_cmm *generic_cmm, uint32_t pool_size, enum aws_cryptosdk_key_pool_selection selection) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    if (pool_size < 1 || pool_size > AWS_CRYPTOSDK_CACHE_MAX_KEY_POOL ||
+        (selection != AWS_CRYPTOSDK_KEY_POOL_ROUND_ROBIN && selection != AWS_CRYPTOSDK_KEY_POOL_THREAD_AFFINITY)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    cmm->key_pool_size      = pool_size;
+    cmm->key_pool_selection = selection;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_caching_cmm_set_write_through(struct aws_cryptosdk_cmm *generic_cmm, bool enabled) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    cmm->write_through = enabled;
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_caching_cmm_set_request_recorder(
+    struct aws_cryptosdk_cmm *generic_cmm, aws_cryptosdk_caching_cmm_request_recorder_fn *recorder, void *user_data) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    cmm->recorder           = recorder;
+    cmm->recorder_user_data = recorder ? user_data : NULL;
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_caching_cmm_set_digest_provider(
+    struct aws_cryptosdk_cmm *generic_cmm, const struct aws_cryptosdk_digest_provider_vt *provider) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+    if (provider && !aws_cryptosdk_priv_digest_provider_is_complete(provider)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    cmm->digest_provider = provider;
+    return AWS_OP_SUCCESS;
+}
+
+static struct aws_byte_buf partition_id_buf(const struct caching_cmm *cmm) {
+    return aws_byte_buf_from_array(aws_string_bytes(cmm->partition_id), cmm->partition_id->len);
+}
+
+int aws_cryptosdk_caching_cmm_invalidate_partition(struct aws_cryptosdk_cmm *generic_cmm) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    struct aws_byte_buf partition_id = partition_id_buf(cmm);
+
+    return aws_cryptosdk_materials_cache_invalidate_partition(cmm->materials_cache, &partition_id);
+}
+
 struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_cmm(
     struct aws_allocator *alloc,
     struct aws_cryptosdk_materials_cache *materials_cache,
@@ -172,23 +659,80 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_cmm(
         return NULL;
     }
 
-    struct aws_string *partition_id_str = hash_or_generate_partition_id(alloc, partition_name);
+    struct aws_cryptosdk_md_context *partition_md = NULL;
+    struct aws_string *partition_id_str           = hash_or_generate_partition_id(alloc, partition_name);
 
     if (!partition_id_str) {
         return NULL;
     }
 
+    if (new_partition_md(alloc, &partition_md, partition_id_str)) {
+        goto err_partition_id;
+    }
+
     struct caching_cmm *cmm = aws_mem_acquire(alloc, sizeof(*cmm));
     if (!cmm) {
-        return NULL;
+        goto err_partition_md;
+    }
+
+    if (aws_mutex_init(&cmm->derived_key_mutex)) {
+        goto err_cmm;
+    }
+
+    if (aws_mutex_init(&cmm->md_context_mutex)) {
+        goto err_derived_key_mutex;
+    }
+
+    if (aws_mutex_init(&cmm->refresh_mutex)) {
+        goto err_md_context_mutex;
+    }
+
+    if (aws_condition_variable_init(&cmm->refresh_wakeup)) {
+        goto err_refresh_mutex;
+    }
+
+    if (aws_mutex_init(&cmm->inflight_mutex)) {
+        goto err_refresh_wakeup;
     }
 
+    if (aws_condition_variable_init(&cmm->inflight_done)) {
+        goto err_inflight_mutex;
+    }
+
+    cmm->md_context_count = 0;
+    memset(cmm->refreshes, 0, sizeof(cmm->refreshes));
+    cmm->refresh_percent        = 0;
+    cmm->ttl_jitter_percent     = 0;
+    cmm->ttl_jitter_seed        = 0;
+    cmm->refresh_thread_started = false;
+    cmm->refresh_shutdown       = false;
+    memset(cmm->inflight, 0, sizeof(cmm->inflight));
+    memset(cmm->derived_keys, 0, sizeof(cmm->derived_keys));
+    cmm->next_derived_key = 0;
+    memset(cmm->hkdf_keys, 0, sizeof(cmm->hkdf_keys));
+    cmm->next_hkdf_key = 0;
+    memset(cmm->header_templates, 0, sizeof(cmm->header_templates));
+    cmm->next_header_template = 0;
+    cmm->negative_ttl_nanos   = 0;
+    memset(cmm->negatives, 0, sizeof(cmm->negatives));
+    cmm->next_negative  = 0;
+    cmm->lease_messages = 0;
+    for (size_t i = 0; i < LEASE_SLOTS; i++) {
+        aws_atomic_init_int(&cmm->leases[i].busy, 0);
+        cmm->leases[i].entry = NULL;
+    }
+    cmm->write_through      = false;
+    cmm->key_pool_size      = 1;
+    cmm->key_pool_selection = AWS_CRYPTOSDK_KEY_POOL_ROUND_ROBIN;
+    aws_atomic_init_int(&cmm->next_pool_key, 0);
+
     aws_cryptosdk_cmm_base_init(&cmm->base, &caching_cmm_vt);
 
     cmm->alloc           = alloc;
     cmm->upstream        = aws_cryptosdk_cmm_retain(upstream);
     cmm->materials_cache = aws_cryptosdk_materials_cache_retain(materials_cache);
     cmm->partition_id    = partition_id_str;
+    cmm->partition_md    = partition_md;
 
     // We use the test helper here just to ensure we don't get unused static function warnings
     caching_cmm_set_clock(&cmm->base, aws_sys_clock_get_ticks);
@@ -198,6 +742,24 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_cmm(
     cmm->ttl_nanos      = ttl_nanos;
 
     return &cmm->base;
+
+err_inflight_mutex:
+    aws_mutex_clean_up(&cmm->inflight_mutex);
+err_refresh_wakeup:
+    aws_condition_variable_clean_up(&cmm->refresh_wakeup);
+err_refresh_mutex:
+    aws_mutex_clean_up(&cmm->refresh_mutex);
+err_md_context_mutex:
+    aws_mutex_clean_up(&cmm->md_context_mutex);
+err_derived_key_mutex:
+    aws_mutex_clean_up(&cmm->derived_key_mutex);
+err_cmm:
+    aws_mem_release(alloc, cmm);
+err_partition_md:
+    aws_cryptosdk_md_abort(partition_md);
+err_partition_id:
+    aws_string_destroy(partition_id_str);
+    return NULL;
 }
 
 struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_keyring(
@@ -216,6 +778,32 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_caching_cmm_new_from_keyring(
     return caching_cmm;
 }
 
+static uint64_t percent_of(uint64_t limit, uint32_t percent) {
+    return limit / 100 * percent + limit % 100 * percent / 100;
+}
+
+/*
+ * Returns the TTL of an entry created at creation_time: the configured TTL, less up to the
+ * jitter share of it. How much less is a hash of the entry and its creation time, so that it
+ * stays the same each time the entry is checked, but varies between entries created together.
+ * Jitter only ever shortens the TTL, which therefore remains an upper bound.
+ */
+static uint64_t entry_ttl(
+    const struct caching_cmm *cmm, const struct aws_cryptosdk_materials_cache_entry *entry, uint64_t creation_time) {
+    if (!cmm->ttl_jitter_percent || cmm->ttl_nanos == UINT64_MAX) return cmm->ttl_nanos;
+
+    uint64_t max_jitter = percent_of(cmm->ttl_nanos, cmm->ttl_jitter_percent);
+    uint64_t mixed      = creation_time ^ (uint64_t)(uintptr_t)entry ^ cmm->ttl_jitter_seed;
+
+    mixed ^= mixed >> 33;
+    mixed *= 0xFF51AFD7ED558CCDull;
+    mixed ^= mixed >> 33;
+    mixed *= 0xC4CEB9FE1A85EC53ull;
+    mixed ^= mixed >> 33;
+
+    return cmm->ttl_nanos - mixed % (max_jitter + 1);
+}
+
 /*
  * Checks the TTL on the entry given. Returns true if the TTL has not yet expired, or false if it has expired.
  * Additionally, sets the TTL hint on the entry if it has not expired.
@@ -227,7 +815,7 @@ static bool check_ttl(struct caching_cmm *cmm, struct aws_cryptosdk_materials_ca
     }
 
     uint64_t creation_time = aws_cryptosdk_materials_cache_entry_get_creation_time(cmm->materials_cache, entry);
-    uint64_t expiration    = creation_time + cmm->ttl_nanos;
+    uint64_t expiration    = creation_time + entry_ttl(cmm, entry, creation_time);
     uint64_t now;
 
     if (expiration < creation_time) {
@@ -247,9 +835,17 @@ static bool check_ttl(struct caching_cmm *cmm, struct aws_cryptosdk_materials_ca
     return true;
 }
 
+/*
+ * Derives the cache ID of an encryption request. partition_md has hashed the partition ID, and
+ * md_context must be ready to hash a new message; it is left that way on success, and must be
+ * aborted on failure.
+ */
 AWS_CRYPTOSDK_TEST_STATIC
 int hash_enc_request(
-    struct aws_string *partition_id, struct aws_byte_buf *out, const struct aws_cryptosdk_enc_request *req) {
+    const struct aws_cryptosdk_md_context *partition_md,
+    struct aws_cryptosdk_md_context *md_context,
+    struct aws_byte_buf *out,
+    const struct aws_cryptosdk_enc_request *req) {
     /*
      * Here, we hash the relevant aspects of the request structure to use as a cache identifier.
      * The hash is intended to match Java and Python, but since we've not yet committed to maintaining
@@ -260,66 +856,36 @@ int hash_enc_request(
      *   [request alg id, if set]
      *   [serialized encryption context]
      */
-    struct aws_byte_buf context_buf              = { 0 };
     uint8_t digestbuf[AWS_CRYPTOSDK_MD_MAX_SIZE] = { 0 };
+    size_t enc_ctx_digest_len;
 
     if (out->capacity < AWS_CRYPTOSDK_MD_MAX_SIZE) {
         return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
     }
 
-    struct aws_cryptosdk_md_context *md_context, *enc_ctx_md;
-    if (aws_cryptosdk_md_init(req->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512)) {
-        return AWS_OP_ERR;
-    }
+    if (req->frozen_enc_ctx && aws_cryptosdk_frozen_enc_ctx_matches(req->frozen_enc_ctx, req->enc_ctx)) {
+        // The frozen context already holds the digest of its serialization
+        struct aws_byte_cursor digest = aws_cryptosdk_frozen_enc_ctx_digest(req->frozen_enc_ctx);
 
-    if (aws_cryptosdk_md_init(req->alloc, &enc_ctx_md, AWS_CRYPTOSDK_MD_SHA512)) {
+        memcpy(digestbuf, digest.ptr, digest.len);
+        enc_ctx_digest_len = digest.len;
+    } else if (
+        aws_cryptosdk_enc_ctx_digest_update(req->alloc, md_context, req->enc_ctx) ||
+        aws_cryptosdk_md_finish_reset(md_context, digestbuf, &enc_ctx_digest_len)) {
         return AWS_OP_ERR;
     }
 
-    if (aws_cryptosdk_md_update(md_context, aws_string_bytes(partition_id), partition_id->len)) {
-        goto md_err;
-    }
-
     uint8_t requested_alg_present = req->requested_alg != 0;
-    if (aws_cryptosdk_md_update(md_context, &requested_alg_present, 1)) {
-        goto md_err;
-    }
-
-    if (requested_alg_present) {
-        uint16_t alg_id = aws_hton16(req->requested_alg);
-        if (aws_cryptosdk_md_update(md_context, &alg_id, sizeof(alg_id))) {
-            goto md_err;
-        }
-    }
-
-    size_t context_size;
-    if (aws_cryptosdk_enc_ctx_size(&context_size, req->enc_ctx) ||
-        aws_byte_buf_init(&context_buf, req->alloc, context_size) ||
-        aws_cryptosdk_enc_ctx_serialize(req->alloc, &context_buf, req->enc_ctx) ||
-        aws_cryptosdk_md_update(enc_ctx_md, context_buf.buffer, context_buf.len)) {
-        goto md_err;
-    }
-
-    size_t enc_ctx_digest_len;
-    if (aws_cryptosdk_md_finish(enc_ctx_md, digestbuf, &enc_ctx_digest_len)) {
-        enc_ctx_md = NULL;
-        goto md_err;
-    }
-    enc_ctx_md = NULL;
+    uint16_t alg_id               = aws_hton16(req->requested_alg);
 
-    if (aws_cryptosdk_md_update(md_context, digestbuf, enc_ctx_digest_len)) {
-        goto md_err;
+    if (aws_cryptosdk_md_copy(md_context, partition_md) ||
+        aws_cryptosdk_md_update(md_context, &requested_alg_present, 1) ||
+        (requested_alg_present && aws_cryptosdk_md_update(md_context, &alg_id, sizeof(alg_id))) ||
+        aws_cryptosdk_md_update(md_context, digestbuf, enc_ctx_digest_len)) {
+        return AWS_OP_ERR;
     }
 
-    aws_byte_buf_clean_up(&context_buf);
-    return aws_cryptosdk_md_finish(md_context, out->buffer, &out->len);
-
-md_err:
-    aws_byte_buf_clean_up(&context_buf);
-    aws_cryptosdk_md_abort(md_context);
-    aws_cryptosdk_md_abort(enc_ctx_md);
-
-    return AWS_OP_ERR;
+    return aws_cryptosdk_md_finish_reset(md_context, out->buffer, &out->len);
 }
 
 struct edk_hash_entry {
@@ -348,66 +914,140 @@ static int hash_edk_field(struct aws_cryptosdk_md_context *md_context, const str
     return AWS_OP_SUCCESS;
 }
 
+/* md_context must be ready to hash a new message, and is left that way on success */
 AWS_CRYPTOSDK_TEST_STATIC
 int hash_edk_for_decrypt(
-    struct aws_allocator *alloc, struct edk_hash_entry *entry, const struct aws_cryptosdk_edk *edk) {
-    struct aws_cryptosdk_md_context *md_context = NULL;
-    if (aws_cryptosdk_md_init(alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512)) {
-        return AWS_OP_ERR;
-    }
-
-    if (hash_edk_field(md_context, &edk->provider_id) || hash_edk_field(md_context, &edk->provider_info) ||
-        hash_edk_field(md_context, &edk->ciphertext)) {
-        aws_cryptosdk_md_abort(md_context);
+    struct aws_cryptosdk_md_context *md_context, struct edk_hash_entry *entry, const struct aws_cryptosdk_edk *edk) {
+    // The fields are hashed in their serialized form, which a record already is
+    if (aws_cryptosdk_edk_has_record(edk)) {
+        if (aws_cryptosdk_md_update(md_context, edk->record.buffer, edk->record.len)) return AWS_OP_ERR;
+    } else if (hash_edk_field(md_context, &edk->provider_id) || hash_edk_field(md_context, &edk->provider_info) ||
+               hash_edk_field(md_context, &edk->ciphertext)) {
         return AWS_OP_ERR;
     }
 
     memset(entry->hash_data, 0, sizeof(entry->hash_data));
 
     size_t ignored_length;
-    return aws_cryptosdk_md_finish(md_context, entry->hash_data, &ignored_length);
+    return aws_cryptosdk_md_finish_reset(md_context, entry->hash_data, &ignored_length);
 }
 
-AWS_CRYPTOSDK_TEST_STATIC
-int hash_dec_request(
-    const struct aws_string *partition_id, struct aws_byte_buf *out, const struct aws_cryptosdk_dec_request *req) {
-    static const struct edk_hash_entry zero_entry = { { 0 } };
-
-    int rv             = AWS_OP_ERR;
-    size_t md_length   = aws_cryptosdk_md_size(AWS_CRYPTOSDK_MD_SHA512);
-    uint16_t alg_id_be = aws_hton16(req->alg);
+/* Returns the EDKs of the k-th of the requests selected by which (or of requests[k], if which is NULL) */
+static const struct aws_array_list *selected_edks(
+    const struct aws_cryptosdk_dec_request *requests, const size_t *which, size_t k) {
+    return &requests[which ? which[k] : k].encrypted_data_keys;
+}
 
-    struct aws_byte_buf context_buf                       = { 0 };
-    uint8_t context_digest_arr[AWS_CRYPTOSDK_MD_MAX_SIZE] = { 0 };
-    struct aws_byte_buf context_digest_buf = aws_byte_buf_from_array(context_digest_arr, sizeof(context_digest_arr));
-    struct aws_cryptosdk_md_context *md_context = NULL;
-    struct aws_array_list edk_hash_list;
+/*
+ * Hashes the EDKs of count requests (see selected_edks) into entries, in order. With a digest
+ * provider, EDKs are handed to it AWS_CRYPTOSDK_DIGEST_MAX_OPS at a time, whichever requests they
+ * belong to, so that a multi-buffer implementation hashes them together; otherwise each is hashed
+ * in turn with md_context, which must be ready to hash a new message and is left that way.
+ */
+static int hash_edks_for_decrypt(
+    const struct aws_cryptosdk_digest_provider_vt *provider,
+    struct aws_cryptosdk_md_context *md_context,
+    struct aws_allocator *alloc,
+    const struct aws_cryptosdk_dec_request *requests,
+    const size_t *which,
+    size_t count,
+    struct edk_hash_entry *entries) {
+    struct aws_cryptosdk_digest_op ops[AWS_CRYPTOSDK_DIGEST_MAX_OPS];
+    struct aws_byte_buf scratch;
+    size_t scratch_size = 0, num_ops = 0, num_entries = 0;
+    int rv = AWS_OP_ERR;
+
+    AWS_ZERO_STRUCT(scratch);
+    for (size_t k = 0; k < count; k++) {
+        const struct aws_array_list *edks = selected_edks(requests, which, k);
+
+        for (size_t i = 0; i < aws_array_list_length(edks); i++) {
+            void *vp_edk = NULL;
+
+            if (aws_array_list_get_at_ptr(edks, &vp_edk, i)) goto out;
+            if (!provider) {
+                if (hash_edk_for_decrypt(md_context, &entries[num_entries++], vp_edk)) goto out;
+            } else if (!aws_cryptosdk_edk_has_record(vp_edk)) {
+                scratch_size += aws_cryptosdk_edk_record_size(vp_edk);
+            }
+        }
+    }
+    if (!provider) return AWS_OP_SUCCESS;
+
+    // EDKs without a record are serialized up front, so that each is a single contiguous message
+    if (scratch_size && aws_byte_buf_init(&scratch, alloc, scratch_size)) goto out;
+
+    for (size_t k = 0; k < count; k++) {
+        const struct aws_array_list *edks = selected_edks(requests, which, k);
+
+        for (size_t i = 0; i < aws_array_list_length(edks); i++) {
+            struct aws_cryptosdk_digest_op *op = &ops[num_ops++];
+            struct edk_hash_entry *entry       = &entries[num_entries++];
+            void *vp_edk                       = NULL;
+
+            if (aws_array_list_get_at_ptr(edks, &vp_edk, i)) goto out;
+            const struct aws_cryptosdk_edk *edk = vp_edk;
+
+            if (aws_cryptosdk_edk_has_record(edk)) {
+                op->in  = edk->record.buffer;
+                op->len = edk->record.len;
+            } else {
+                size_t start = scratch.len;
+
+                if (aws_cryptosdk_edk_write_record(&scratch, edk)) goto out;
+                op->in  = scratch.buffer + start;
+                op->len = scratch.len - start;
+            }
+            memset(entry->hash_data, 0, sizeof(entry->hash_data));
+            op->digest = entry->hash_data;
+
+            if (num_ops == AWS_CRYPTOSDK_DIGEST_MAX_OPS) {
+                if (provider->sha512_many(ops, num_ops)) goto out;
+                num_ops = 0;
+            }
+        }
+    }
+    if (num_ops && provider->sha512_many(ops, num_ops)) goto out;
+
+    rv = AWS_OP_SUCCESS;
+
+out:
+    aws_byte_buf_clean_up(&scratch);
+    return rv;
+}
+
+/*
+ * Derives the cache ID of a decryption request from the hashes of its EDKs, which are sorted in
+ * place, with the same contract as hash_enc_request
+ */
+static int dec_request_id_from_edk_hashes(
+    const struct aws_cryptosdk_md_context *partition_md,
+    struct aws_cryptosdk_md_context *md_context,
+    struct aws_byte_buf *out,
+    const struct aws_cryptosdk_dec_request *req,
+    struct edk_hash_entry *entries,
+    size_t n_edks) {
+    static const struct edk_hash_entry zero_entry = { { 0 } };
+
+    size_t md_length   = aws_cryptosdk_md_size(AWS_CRYPTOSDK_MD_SHA512);
+    uint16_t alg_id_be = aws_hton16(req->alg);
+
+    uint8_t context_digest_arr[AWS_CRYPTOSDK_MD_MAX_SIZE] = { 0 };
+    size_t context_digest_len;
 
     if (out->capacity < AWS_CRYPTOSDK_MD_MAX_SIZE) {
         return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
     }
 
-    if (aws_array_list_init_dynamic(
-            &edk_hash_list,
-            req->alloc,
-            aws_array_list_length(&req->encrypted_data_keys),
-            sizeof(struct edk_hash_entry))) {
+    // The canonical serialization is exactly what digesting the context would hash
+    if (req->serialized_enc_ctx.len) {
+        if (aws_cryptosdk_md_update(md_context, req->serialized_enc_ctx.ptr, req->serialized_enc_ctx.len)) {
+            return AWS_OP_ERR;
+        }
+    } else if (aws_cryptosdk_enc_ctx_digest_update(req->alloc, md_context, req->enc_ctx)) {
         return AWS_OP_ERR;
     }
-
-    size_t context_size;
-    if (aws_cryptosdk_md_init(req->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512) ||
-        aws_cryptosdk_enc_ctx_size(&context_size, req->enc_ctx) ||
-        aws_byte_buf_init(&context_buf, req->alloc, context_size) ||
-        aws_cryptosdk_enc_ctx_serialize(req->alloc, &context_buf, req->enc_ctx) ||
-        aws_cryptosdk_md_update(md_context, context_buf.buffer, context_buf.len)) {
-        goto err;
-    }
-
-    if (aws_cryptosdk_md_finish(md_context, context_digest_buf.buffer, &context_digest_buf.len)) {
-        md_context = NULL;
-        goto err;
-    }
+    if (aws_cryptosdk_md_finish_reset(md_context, context_digest_arr, &context_digest_len)) return AWS_OP_ERR;
 
     // The decryption request cache IDs are constructed out of a hash of:
     // [partition ID]
@@ -416,73 +1056,680 @@ int hash_dec_request(
     // [digestLength zero bytes]
     // [encryption context hash]
 
-    // Before we start hashing the top level stuff, let's hash the EDKs and sort them
     // Note that the EDK entries have no length field - if we introduce a larger hash
     // in the future, we just treat the smaller (?) SHA-512 as the top-order bits of
     // a larger field.
 
-    size_t n_edks = aws_array_list_length(&req->encrypted_data_keys);
+    if (n_edks) qsort(entries, n_edks, sizeof(*entries), edk_hash_entry_cmp);
+    if (aws_cryptosdk_md_copy(md_context, partition_md) ||
+        aws_cryptosdk_md_update(md_context, &alg_id_be, sizeof(alg_id_be))) {
+        return AWS_OP_ERR;
+    }
+
     for (size_t i = 0; i < n_edks; i++) {
-        struct edk_hash_entry entry;
-        const struct aws_cryptosdk_edk *edk = NULL;
-        void *vp_edk                        = NULL;
+        if (aws_cryptosdk_md_update(md_context, entries[i].hash_data, md_length)) return AWS_OP_ERR;
+    }
+
+    if (aws_cryptosdk_md_update(md_context, &zero_entry, sizeof(zero_entry)) ||
+        aws_cryptosdk_md_update(md_context, context_digest_arr, context_digest_len)) {
+        return AWS_OP_ERR;
+    }
+
+    return aws_cryptosdk_md_finish_reset(md_context, out->buffer, &out->len);
+}
+
+/* As hash_dec_request, hashing the EDKs with provider if it is not NULL */
+static int hash_dec_request_with_provider(
+    const struct aws_cryptosdk_digest_provider_vt *provider,
+    const struct aws_cryptosdk_md_context *partition_md,
+    struct aws_cryptosdk_md_context *md_context,
+    struct aws_byte_buf *out,
+    const struct aws_cryptosdk_dec_request *req) {
+    size_t n_edks                  = aws_array_list_length(&req->encrypted_data_keys);
+    struct edk_hash_entry *entries = NULL;
+    int rv                         = AWS_OP_ERR;
+
+    if (n_edks && !(entries = aws_mem_calloc(req->alloc, n_edks, sizeof(*entries)))) return AWS_OP_ERR;
+
+    if (!hash_edks_for_decrypt(provider, md_context, req->alloc, req, NULL, 1, entries)) {
+        rv = dec_request_id_from_edk_hashes(partition_md, md_context, out, req, entries, n_edks);
+    }
+
+    if (entries) aws_mem_release(req->alloc, entries);
+    return rv;
+}
+
+/* Derives the cache ID of a decryption request, with the same contract as hash_enc_request */
+AWS_CRYPTOSDK_TEST_STATIC
+int hash_dec_request(
+    const struct aws_cryptosdk_md_context *partition_md,
+    struct aws_cryptosdk_md_context *md_context,
+    struct aws_byte_buf *out,
+    const struct aws_cryptosdk_dec_request *req) {
+    return hash_dec_request_with_provider(NULL, partition_md, md_context, out, req);
+}
+
+static int cache_id_for_enc(
+    struct caching_cmm *cmm, struct aws_byte_buf *out, const struct aws_cryptosdk_enc_request *req) {
+    struct aws_cryptosdk_md_context *md_context = acquire_md_context(cmm);
+    if (!md_context) return AWS_OP_ERR;
+
+    if (hash_enc_request(cmm->partition_md, md_context, out, req)) {
+        aws_cryptosdk_md_abort(md_context);
+        return AWS_OP_ERR;
+    }
+
+    release_md_context(cmm, md_context);
+    return AWS_OP_SUCCESS;
+}
+
+/* The CMM's own digest provider, else the kernel selected for the process, or NULL for neither */
+static const struct aws_cryptosdk_digest_provider_vt *digest_provider_of(const struct caching_cmm *cmm) {
+    return cmm->digest_provider ? cmm->digest_provider : aws_cryptosdk_digest_kernel();
+}
+
+static int cache_id_for_dec(
+    struct caching_cmm *cmm, struct aws_byte_buf *out, const struct aws_cryptosdk_dec_request *req) {
+    struct aws_cryptosdk_md_context *md_context = acquire_md_context(cmm);
+    if (!md_context) return AWS_OP_ERR;
 
-        if (aws_array_list_get_at_ptr(&req->encrypted_data_keys, &vp_edk, i)) {
-            goto err;
+    if (hash_dec_request_with_provider(digest_provider_of(cmm), cmm->partition_md, md_context, out, req)) {
+        aws_cryptosdk_md_abort(md_context);
+        return AWS_OP_ERR;
+    }
+
+    release_md_context(cmm, md_context);
+    return AWS_OP_SUCCESS;
+}
+
+/* Passes a request to the recorder, if any, identified by the start of its cache ID */
+static void record_request(
+    struct caching_cmm *cmm, const struct aws_byte_buf *cache_id, bool is_encrypt, uint64_t bytes) {
+    struct aws_cryptosdk_caching_cmm_request_record record;
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_buf(cache_id);
+
+    if (!cmm->recorder) return;
+
+    AWS_ZERO_STRUCT(record);
+    if (cmm->clock_get_ticks(&record.timestamp)) record.timestamp = 0;
+    aws_byte_cursor_read_be64(&cursor, &record.cache_id_hash);
+    record.bytes      = bytes;
+    record.is_encrypt = is_encrypt;
+
+    cmm->recorder(&record, cmm->recorder_user_data);
+}
+
+static void set_ttl_on_miss(struct caching_cmm *cmm, struct aws_cryptosdk_materials_cache_entry *entry) {
+    if (entry && cmm->ttl_nanos != UINT64_MAX) {
+        uint64_t creation_time = aws_cryptosdk_materials_cache_entry_get_creation_time(cmm->materials_cache, entry);
+        uint64_t exp_time      = creation_time + entry_ttl(cmm, entry, creation_time);
+
+        if (exp_time > creation_time) {
+            aws_cryptosdk_materials_cache_entry_ttl_hint(cmm->materials_cache, entry, exp_time);
         }
+    }
+}
+
+/* Tells the cache which partition a new entry belongs to, so that it can enforce partition quotas */
+static void set_partition_on_miss(struct caching_cmm *cmm, struct aws_cryptosdk_materials_cache_entry *entry) {
+    if (entry) {
+        struct aws_byte_buf partition_id = partition_id_buf(cmm);
+
+        aws_cryptosdk_materials_cache_entry_partition_hint(cmm->materials_cache, entry, &partition_id);
+    }
+}
+
+/*
+ * Builds the decryption materials for the data key of newly generated encryption materials, as
+ * the upstream CMM would return them for a message encrypted with them, and puts them under the
+ * cache ID that decrypting such a message looks up. enc_ctx must be the request's encryption
+ * context as the upstream CMM left it, which is the message's. This is best effort: any failure
+ * only means that the first decryption goes upstream.
+ */
+static void write_through_dec_materials(
+    struct caching_cmm *cmm,
+    struct aws_allocator *alloc,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_cryptosdk_enc_materials *enc_materials) {
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_dec_materials *materials     = NULL;
+    struct aws_string *pub_key                        = NULL;
+    struct aws_cryptosdk_dec_request request          = { 0 };
+
+    uint8_t hash_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    struct aws_byte_buf hash_buf = aws_byte_buf_from_array(hash_arr, sizeof(hash_arr));
+
+    request.alloc               = alloc;
+    request.enc_ctx             = enc_ctx;
+    request.encrypted_data_keys = enc_materials->encrypted_data_keys;
+    request.alg                 = enc_materials->alg;
+
+    if (cache_id_for_dec(cmm, &hash_buf, &request)) goto out;
 
-        edk = vp_edk;
+    if (!(materials = aws_cryptosdk_dec_materials_new(alloc, enc_materials->alg))) goto out;
+    if (aws_byte_buf_init_copy(&materials->unencrypted_data_key, alloc, &enc_materials->unencrypted_data_key)) {
+        goto out;
+    }
+
+    // Record the first wrapping key that encrypted the data key as having decrypted it
+    for (size_t i = 0; i < aws_array_list_length(&enc_materials->keyring_trace); i++) {
+        struct aws_cryptosdk_keyring_trace_record *record = NULL;
 
-        if (hash_edk_for_decrypt(req->alloc, &entry, edk)) {
-            goto err;
+        if (aws_array_list_get_at_ptr(&enc_materials->keyring_trace, (void **)&record, i)) goto out;
+        if (!(record->flags & AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY)) continue;
+
+        uint32_t flags = AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY;
+        if (record->flags & AWS_CRYPTOSDK_WRAPPING_KEY_SIGNED_ENC_CTX) {
+            flags |= AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX;
+        }
+        if (aws_cryptosdk_keyring_trace_add_record(
+                alloc, &materials->keyring_trace, record->wrapping_key_namespace, record->wrapping_key_name, flags)) {
+            goto out;
         }
+        break;
+    }
+
+    if (enc_materials->signctx &&
+        (aws_cryptosdk_sig_get_pubkey(enc_materials->signctx, alloc, &pub_key) ||
+         aws_cryptosdk_sig_verify_start(
+             &materials->signctx, alloc, pub_key, aws_cryptosdk_alg_props(enc_materials->alg)))) {
+        goto out;
+    }
 
-        if (aws_array_list_push_back(&edk_hash_list, &entry)) {
-            goto err;
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cmm->materials_cache, &entry, materials, &hash_buf);
+
+    set_ttl_on_miss(cmm, entry);
+    set_partition_on_miss(cmm, entry);
+
+    if (entry) {
+        aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
+    }
+
+out:
+    aws_string_destroy(pub_key);
+    aws_cryptosdk_dec_materials_destroy(materials);
+    aws_reset_error();
+}
+
+static bool negative_slot_matches(const struct negative_slot *slot, const struct aws_byte_buf *cache_id) {
+    return slot->cache_id_len && slot->cache_id_len == cache_id->len &&
+           !memcmp(slot->cache_id, cache_id->buffer, cache_id->len);
+}
+
+/* True if a recent request with this cache ID could not be decrypted, and the negative TTL has not passed */
+static bool is_known_undecryptable(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id) {
+    bool found = false;
+    uint64_t now;
+
+    if (!cmm->negative_ttl_nanos || cmm->clock_get_ticks(&now) || aws_mutex_lock(&cmm->derived_key_mutex)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < NEGATIVE_SLOTS; i++) {
+        struct negative_slot *slot = &cmm->negatives[i];
+
+        if (negative_slot_matches(slot, cache_id)) {
+            if (now < slot->expiry) {
+                found = true;
+            } else {
+                slot->cache_id_len = 0;
+            }
+            break;
         }
     }
+    aws_mutex_unlock(&cmm->derived_key_mutex);
 
-    aws_array_list_sort(&edk_hash_list, edk_hash_entry_cmp);
-    if (aws_cryptosdk_md_init(req->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512) ||
-        aws_cryptosdk_md_update(md_context, aws_string_bytes(partition_id), partition_id->len) ||
-        aws_cryptosdk_md_update(md_context, &alg_id_be, sizeof(alg_id_be))) {
-        goto err;
+    return found;
+}
+
+/*
+ * Remembers that no keyring could decrypt a request with this cache ID. This is only an
+ * optimization; on any failure we simply don't remember it.
+ */
+static void save_undecryptable(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id) {
+    uint64_t now;
+
+    if (!cmm->negative_ttl_nanos || cache_id->len > AWS_CRYPTOSDK_MD_MAX_SIZE || cmm->clock_get_ticks(&now) ||
+        aws_mutex_lock(&cmm->derived_key_mutex)) {
+        return;
     }
 
-    for (size_t i = 0; i < n_edks; i++) {
-        void *vp_entry = NULL;
+    struct negative_slot *slot = NULL;
+    for (size_t i = 0; i < NEGATIVE_SLOTS && !slot; i++) {
+        if (negative_slot_matches(&cmm->negatives[i], cache_id)) {
+            slot = &cmm->negatives[i];
+        }
+    }
+    if (!slot) {
+        slot               = &cmm->negatives[cmm->next_negative];
+        cmm->next_negative = (cmm->next_negative + 1) % NEGATIVE_SLOTS;
+    }
 
-        if (aws_array_list_get_at_ptr(&edk_hash_list, &vp_entry, i) ||
-            aws_cryptosdk_md_update(md_context, ((struct edk_hash_entry *)vp_entry)->hash_data, md_length)) {
-            goto err;
+    memcpy(slot->cache_id, cache_id->buffer, cache_id->len);
+    slot->cache_id_len = cache_id->len;
+    slot->expiry       = now + cmm->negative_ttl_nanos < now ? UINT64_MAX : now + cmm->negative_ttl_nanos;
+    aws_mutex_unlock(&cmm->derived_key_mutex);
+}
+
+static bool header_template_slot_matches(const struct header_template_slot *slot, const struct aws_byte_buf *cache_id) {
+    return slot->fields.len && slot->cache_id_len == cache_id->len &&
+           !memcmp(slot->cache_id, cache_id->buffer, cache_id->len);
+}
+
+/*
+ * Remembers the header sections for materials just added to the cache, replacing any template saved
+ * for an earlier entry with the same cache ID. This is only an optimization; on any failure we
+ * simply don't save a template.
+ */
+static void save_header_template(
+    struct caching_cmm *cmm,
+    const struct aws_byte_buf *cache_id,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_cryptosdk_enc_materials *materials) {
+    struct aws_byte_buf fields;
+    size_t fields_len = aws_cryptosdk_hdr_fields_size(enc_ctx, &materials->encrypted_data_keys);
+
+    if (!fields_len || cache_id->len > AWS_CRYPTOSDK_MD_MAX_SIZE) return;
+    if (aws_byte_buf_init(&fields, cmm->alloc, fields_len)) return;
+    if (aws_cryptosdk_hdr_write_fields(&fields, enc_ctx, &materials->encrypted_data_keys)) goto out;
+
+    if (aws_mutex_lock(&cmm->derived_key_mutex)) goto out;
+    struct header_template_slot *slot = NULL;
+    for (size_t i = 0; i < HEADER_TEMPLATE_SLOTS; i++) {
+        if (header_template_slot_matches(&cmm->header_templates[i], cache_id)) {
+            slot = &cmm->header_templates[i];
+            break;
         }
     }
+    if (!slot) {
+        slot                      = &cmm->header_templates[cmm->next_header_template];
+        cmm->next_header_template = (cmm->next_header_template + 1) % HEADER_TEMPLATE_SLOTS;
+    }
 
-    if (aws_cryptosdk_md_update(md_context, &zero_entry, sizeof(zero_entry)) ||
-        aws_cryptosdk_md_update(md_context, context_digest_buf.buffer, context_digest_buf.len)) {
-        goto err;
+    // Swap the new template in, so that the old one is freed outside the lock
+    struct aws_byte_buf old_fields = slot->fields;
+    slot->fields                   = fields;
+    slot->cache_id_len             = cache_id->len;
+    memcpy(slot->cache_id, cache_id->buffer, cache_id->len);
+    fields = old_fields;
+    aws_mutex_unlock(&cmm->derived_key_mutex);
+
+out:
+    aws_byte_buf_clean_up(&fields);
+}
+
+/*
+ * Attaches the header template saved for cache_id to materials taken from the cache. Another CMM
+ * sharing the cache may have replaced the entry since we saved the template, so it is only used
+ * if it holds exactly the cached EDKs; the encryption context is already fixed by the cache ID
+ * together with the entry.
+ */
+static void attach_header_template(
+    struct caching_cmm *cmm, const struct aws_byte_buf *cache_id, struct aws_cryptosdk_enc_materials *materials) {
+    if (aws_mutex_lock(&cmm->derived_key_mutex)) return;
+    for (size_t i = 0; i < HEADER_TEMPLATE_SLOTS; i++) {
+        const struct header_template_slot *slot = &cmm->header_templates[i];
+
+        if (header_template_slot_matches(slot, cache_id)) {
+            if (aws_cryptosdk_hdr_fields_match_edks(
+                    aws_byte_cursor_from_buf(&slot->fields), &materials->encrypted_data_keys)) {
+                aws_byte_buf_init_copy(&materials->header_template, materials->alloc, &slot->fields);
+            }
+            break;
+        }
     }
+    aws_mutex_unlock(&cmm->derived_key_mutex);
+}
 
-    rv         = aws_cryptosdk_md_finish(md_context, out->buffer, &out->len);
-    md_context = NULL;
+struct inflight_wait {
+    const struct inflight_slot *slot;
+    uint64_t completions;
+};
 
-err:
-    aws_cryptosdk_md_abort(md_context);
-    aws_byte_buf_clean_up(&context_buf);
-    aws_array_list_clean_up(&edk_hash_list);
+static bool inflight_finished(void *arg) {
+    const struct inflight_wait *wait = arg;
 
-    return rv;
+    return wait->slot->completions != wait->completions;
 }
 
-static void set_ttl_on_miss(struct caching_cmm *cmm, struct aws_cryptosdk_materials_cache_entry *entry) {
-    if (entry && cmm->ttl_nanos != UINT64_MAX) {
-        uint64_t creation_time = aws_cryptosdk_materials_cache_entry_get_creation_time(cmm->materials_cache, entry);
-        uint64_t exp_time      = creation_time + cmm->ttl_nanos;
+/*
+ * Called on a cache miss for cache_id. If another request is already fetching materials for the
+ * same cache ID, waits for it to finish and returns true, so that the caller can look the entry up
+ * again instead of calling the upstream CMM itself. Otherwise returns false and sets *flight to a
+ * slot recording the caller's own fetch, to be passed to finish_inflight once the fetched materials
+ * are in the cache; *flight is NULL if all slots are busy.
+ */
+static bool join_inflight(struct caching_cmm *cmm, const struct aws_byte_buf *cache_id, struct inflight_slot **flight) {
+    struct inflight_wait wait = { NULL, 0 };
 
-        if (exp_time > creation_time) {
-            aws_cryptosdk_materials_cache_entry_ttl_hint(cmm->materials_cache, entry, exp_time);
+    *flight = NULL;
+    if (cache_id->len > AWS_CRYPTOSDK_MD_MAX_SIZE) return false;
+
+    if (aws_mutex_lock(&cmm->inflight_mutex)) return false;
+    for (size_t i = 0; i < INFLIGHT_SLOTS; i++) {
+        struct inflight_slot *slot = &cmm->inflight[i];
+
+        if (slot->active && slot->cache_id_len == cache_id->len &&
+            !memcmp(slot->cache_id, cache_id->buffer, cache_id->len)) {
+            wait.slot        = slot;
+            wait.completions = slot->completions;
+            break;
         }
+        if (!slot->active && !*flight) *flight = slot;
+    }
+
+    if (wait.slot) {
+        *flight = NULL;
+        aws_condition_variable_wait_pred(&cmm->inflight_done, &cmm->inflight_mutex, inflight_finished, &wait);
+    } else if (*flight) {
+        (*flight)->active       = true;
+        (*flight)->cache_id_len = cache_id->len;
+        memcpy((*flight)->cache_id, cache_id->buffer, cache_id->len);
+    }
+    aws_mutex_unlock(&cmm->inflight_mutex);
+
+    return wait.slot != NULL;
+}
+
+/* Wakes the requests waiting on a fetch started by join_inflight, whether or not it succeeded */
+static void finish_inflight(struct caching_cmm *cmm, struct inflight_slot *flight) {
+    if (!flight) return;
+
+    aws_mutex_lock(&cmm->inflight_mutex);
+    flight->active = false;
+    flight->completions++;
+    aws_condition_variable_notify_all(&cmm->inflight_done);
+    aws_mutex_unlock(&cmm->inflight_mutex);
+}
+
+/* Returns the given percentage of limit, without overflowing */
+/* Returns true if an entry with the given usage has used up the refresh-ahead share of any of its limits */
+static bool should_refresh(
+    struct caching_cmm *cmm,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    const struct aws_cryptosdk_cache_usage_stats *stats) {
+    uint32_t percent = cmm->refresh_percent;
+    uint64_t creation_time, now;
+
+    if (!percent) return false;
+
+    if (stats->messages_encrypted >= percent_of(cmm->limit_messages, percent) ||
+        stats->bytes_encrypted >= percent_of(cmm->limit_bytes, percent)) {
+        return true;
     }
+
+    if (cmm->ttl_nanos == UINT64_MAX || cmm->clock_get_ticks(&now)) return false;
+
+    creation_time = aws_cryptosdk_materials_cache_entry_get_creation_time(cmm->materials_cache, entry);
+    return now >= creation_time && now - creation_time >= percent_of(entry_ttl(cmm, entry, creation_time), percent);
+}
+
+static bool refresh_slot_matches(const struct refresh_slot *slot, const struct aws_byte_buf *cache_id) {
+    return slot->pending && slot->cache_id_len == cache_id->len &&
+           !memcmp(slot->cache_id, cache_id->buffer, cache_id->len);
+}
+
+/*
+ * Queues the replacement of the entry for cache_id with new materials for the same request, unless
+ * a replacement is already queued. This must be called before the request's encryption context
+ * is overwritten by the cached one. This is only an optimization; on any failure, or if the queue
+ * is full, the entry simply expires as usual.
+ */
+static void queue_refresh(
+    struct caching_cmm *cmm, const struct aws_byte_buf *cache_id, const struct aws_cryptosdk_enc_request *request) {
+    struct refresh_slot *slot = NULL;
+
+    if (cache_id->len > AWS_CRYPTOSDK_MD_MAX_SIZE) return;
+
+    if (aws_mutex_lock(&cmm->refresh_mutex)) return;
+    for (size_t i = 0; i < REFRESH_SLOTS; i++) {
+        if (refresh_slot_matches(&cmm->refreshes[i], cache_id)) goto out;
+        if (!slot && !cmm->refreshes[i].pending) slot = &cmm->refreshes[i];
+    }
+    if (!slot || !cmm->refresh_thread_started) goto out;
+
+    if (aws_cryptosdk_enc_ctx_init(cmm->alloc, &slot->enc_ctx)) goto out;
+    if (aws_cryptosdk_enc_ctx_clone(cmm->alloc, &slot->enc_ctx, request->enc_ctx)) {
+        aws_cryptosdk_enc_ctx_clean_up(&slot->enc_ctx);
+        goto out;
+    }
+
+    slot->pending        = true;
+    slot->running        = false;
+    slot->cache_id_len   = cache_id->len;
+    slot->requested_alg  = request->requested_alg;
+    slot->plaintext_size = request->plaintext_size;
+    memcpy(slot->cache_id, cache_id->buffer, cache_id->len);
+    aws_condition_variable_notify_all(&cmm->refresh_wakeup);
+
+out:
+    aws_mutex_unlock(&cmm->refresh_mutex);
+    aws_reset_error();
+}
+
+/* Generates new materials for a queued refresh, and puts them in the cache in place of the old entry */
+static void refresh_entry(struct caching_cmm *cmm, struct refresh_slot *slot) {
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_enc_materials *materials     = NULL;
+    struct aws_cryptosdk_cache_usage_stats no_usage   = { 0, 0 };
+    struct aws_byte_buf cache_id                      = aws_byte_buf_from_array(slot->cache_id, slot->cache_id_len);
+    struct aws_cryptosdk_enc_request request          = { 0 };
+
+    request.alloc          = cmm->alloc;
+    request.enc_ctx        = &slot->enc_ctx;
+    request.requested_alg  = slot->requested_alg;
+    request.plaintext_size = slot->plaintext_size;
+
+    if (aws_cryptosdk_cmm_generate_enc_materials(cmm->upstream, &materials, &request)) {
+        // The next request to find the entry expired will retry as a normal cache miss
+        aws_reset_error();
+        return;
+    }
+
+    if (can_cache_algorithm(materials->alg)) {
+        aws_cryptosdk_materials_cache_put_entry_for_encrypt(
+            cmm->materials_cache, &entry, materials, no_usage, &slot->enc_ctx, &cache_id);
+
+        set_ttl_on_miss(cmm, entry);
+        set_partition_on_miss(cmm, entry);
+
+        if (entry) {
+            save_header_template(cmm, &cache_id, &slot->enc_ctx, materials);
+            aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
+        }
+
+        if (cmm->write_through) {
+            write_through_dec_materials(cmm, cmm->alloc, &slot->enc_ctx, materials);
+        }
+    }
+
+    aws_cryptosdk_enc_materials_destroy(materials);
+}
+
+static bool refresh_needs_work(void *arg) {
+    struct caching_cmm *cmm = arg;
+
+    if (cmm->refresh_shutdown) return true;
+
+    for (size_t i = 0; i < REFRESH_SLOTS; i++) {
+        if (cmm->refreshes[i].pending && !cmm->refreshes[i].running) return true;
+    }
+
+    return false;
+}
+
+static void run_refreshes(void *arg) {
+    struct caching_cmm *cmm = arg;
+
+    aws_mutex_lock(&cmm->refresh_mutex);
+    while (true) {
+        aws_condition_variable_wait_pred(&cmm->refresh_wakeup, &cmm->refresh_mutex, refresh_needs_work, cmm);
+        if (cmm->refresh_shutdown) break;
+
+        struct refresh_slot *slot = NULL;
+        for (size_t i = 0; !slot && i < REFRESH_SLOTS; i++) {
+            if (cmm->refreshes[i].pending && !cmm->refreshes[i].running) slot = &cmm->refreshes[i];
+        }
+        slot->running = true;
+
+        /* Call upstream without holding the lock, so that hits queueing refreshes never wait on it */
+        aws_mutex_unlock(&cmm->refresh_mutex);
+        refresh_entry(cmm, slot);
+        aws_mutex_lock(&cmm->refresh_mutex);
+
+        aws_cryptosdk_enc_ctx_clean_up(&slot->enc_ctx);
+        slot->pending = slot->running = false;
+    }
+    aws_mutex_unlock(&cmm->refresh_mutex);
+}
+
+static struct lease_slot *lease_for_current_thread(struct caching_cmm *cmm) {
+    return &cmm->leases[aws_cryptosdk_current_thread_hash() % LEASE_SLOTS];
+}
+
+/* Gives the unused part of the lease back to its entry and releases the lease's reference. The lease must be locked. */
+static void drop_lease(struct caching_cmm *cmm, struct lease_slot *slot) {
+    if (!slot->entry) {
+        return;
+    }
+
+    struct aws_cryptosdk_cache_usage_stats unused = slot->remaining;
+    unused.messages_encrypted += slot->excess.messages_encrypted;
+    unused.bytes_encrypted += slot->excess.bytes_encrypted;
+
+    if (unused.messages_encrypted || unused.bytes_encrypted) {
+        /* Best effort; if the cache cannot take the remainder back, it just goes unused */
+        if (aws_cryptosdk_materials_cache_return_usage_stats(cmm->materials_cache, slot->entry, &unused)) {
+            aws_reset_error();
+        }
+    }
+
+    aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, slot->entry, false);
+    slot->entry = NULL;
+}
+
+/*
+ * Leases from entry enough budget for cmm->lease_messages messages of the size of this one, trimmed
+ * to the CMM's limits, taking over the caller's reference to entry. If not even this message fits
+ * within the limits, no lease is taken, and *stats is set to usage stats which exceed them.
+ */
+static int lease_budget(
+    struct caching_cmm *cmm,
+    struct lease_slot *slot,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    struct aws_cryptosdk_cache_usage_stats *stats,
+    bool *leased) {
+    struct aws_cryptosdk_cache_usage_stats lease, end, start;
+
+    lease.messages_encrypted = aws_min_u64(cmm->lease_messages, cmm->limit_messages);
+    lease.bytes_encrypted    = cmm->limit_bytes;
+    if (stats->bytes_encrypted <= cmm->limit_bytes / lease.messages_encrypted) {
+        lease.bytes_encrypted = stats->bytes_encrypted * lease.messages_encrypted;
+    }
+
+    end = lease;
+    if (aws_cryptosdk_materials_cache_update_usage_stats(cmm->materials_cache, entry, &end)) {
+        return AWS_OP_ERR;
+    }
+
+    start.messages_encrypted = end.messages_encrypted - lease.messages_encrypted;
+    start.bytes_encrypted    = end.bytes_encrypted - lease.bytes_encrypted;
+
+    /* Only the part of the lease within the limits can be used */
+    slot->excess.messages_encrypted = end.messages_encrypted - aws_min_u64(end.messages_encrypted, cmm->limit_messages);
+    slot->excess.bytes_encrypted    = end.bytes_encrypted - aws_min_u64(end.bytes_encrypted, cmm->limit_bytes);
+    end.messages_encrypted -= slot->excess.messages_encrypted;
+    end.bytes_encrypted -= slot->excess.bytes_encrypted;
+
+    if (start.messages_encrypted + stats->messages_encrypted > end.messages_encrypted ||
+        start.bytes_encrypted + stats->bytes_encrypted > end.bytes_encrypted) {
+        stats->messages_encrypted += start.messages_encrypted;
+        stats->bytes_encrypted += start.bytes_encrypted;
+        return AWS_OP_SUCCESS;
+    }
+
+    slot->entry                        = entry;
+    slot->end                          = end;
+    slot->remaining.messages_encrypted = end.messages_encrypted - start.messages_encrypted;
+    slot->remaining.bytes_encrypted    = end.bytes_encrypted - start.bytes_encrypted;
+    *leased                            = true;
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Charges *stats, the usage of one message, to entry, and sets *stats to the entry's resulting
+ * usage stats. With leasing enabled, the usage is instead counted against the calling thread's
+ * lease, which is renewed from the entry when it runs out or is for another entry. If this takes
+ * a new lease, the lease takes over the caller's reference to entry, and *leased is set.
+ */
+static int charge_usage(
+    struct caching_cmm *cmm,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    struct aws_cryptosdk_cache_usage_stats *stats,
+    bool *leased) {
+    struct lease_slot *slot = lease_for_current_thread(cmm);
+    size_t idle             = 0;
+    int rv                  = AWS_OP_SUCCESS;
+
+    *leased = false;
+
+    if (cmm->lease_messages < 2 || !aws_atomic_compare_exchange_int(&slot->busy, &idle, 1)) {
+        return aws_cryptosdk_materials_cache_update_usage_stats(cmm->materials_cache, entry, stats);
+    }
+
+    if (slot->entry != entry || slot->remaining.messages_encrypted < stats->messages_encrypted ||
+        slot->remaining.bytes_encrypted < stats->bytes_encrypted) {
+        drop_lease(cmm, slot);
+        rv = lease_budget(cmm, slot, entry, stats, leased);
+    }
+
+    if (!rv && slot->entry) {
+        slot->remaining.messages_encrypted -= stats->messages_encrypted;
+        slot->remaining.bytes_encrypted -= stats->bytes_encrypted;
+        stats->messages_encrypted = slot->end.messages_encrypted - slot->remaining.messages_encrypted;
+        stats->bytes_encrypted    = slot->end.bytes_encrypted - slot->remaining.bytes_encrypted;
+
+        /* The caller will invalidate the entry once it reaches the message limit, and we drop it too */
+        if (stats->messages_encrypted == cmm->limit_messages) {
+            if (*leased) {
+                /* Hand the caller's reference back, rather than releasing it out from under them */
+                slot->entry = NULL;
+                *leased     = false;
+            } else {
+                drop_lease(cmm, slot);
+            }
+        }
+    }
+
+    unlock_lease(slot);
+
+    return rv;
+}
+
+/* Chooses which key of the request's key pool to use, and makes cache_id the cache ID of that key */
+static uint32_t select_pool_key(struct caching_cmm *cmm, struct aws_byte_buf *cache_id) {
+    uint32_t pool_size = cmm->key_pool_size;
+    uint32_t key;
+
+    if (pool_size <= 1) {
+        return 0;
+    }
+
+    if (cmm->key_pool_selection == AWS_CRYPTOSDK_KEY_POOL_THREAD_AFFINITY) {
+        key = (uint32_t)(aws_cryptosdk_current_thread_hash() % pool_size);
+    } else {
+        key = (uint32_t)(aws_atomic_fetch_add(&cmm->next_pool_key, 1) % pool_size);
+    }
+
+    /*
+     * The first key keeps the plain cache ID. The others flip bits of its last byte, which keeps
+     * cache IDs the same length; they only collide with another request's if the two SHA-512
+     * digests differ in nothing but those bits.
+     */
+    cache_id->buffer[cache_id->len - 1] ^= (uint8_t)key;
+
+    return key;
 }
 
 static int generate_enc_materials(
@@ -491,9 +1738,11 @@ static int generate_enc_materials(
     struct aws_cryptosdk_enc_request *request) {
     struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
 
-    bool is_encrypt, should_invalidate = false;
+    bool is_encrypt, should_invalidate = false, waited = false, leased = false, found = false;
     struct aws_cryptosdk_materials_cache_entry *entry = NULL;
-    struct aws_cryptosdk_cache_usage_stats delta_usage;
+    struct inflight_slot *flight                      = NULL;
+    struct aws_cryptosdk_cache_usage_stats delta_usage, initial_usage;
+    uint32_t pool_key;
 
     delta_usage.bytes_encrypted    = request->plaintext_size;
     delta_usage.messages_encrypted = 1;
@@ -513,12 +1762,18 @@ static int generate_enc_materials(
 
     uint8_t hash_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
     struct aws_byte_buf hash_buf = aws_byte_buf_from_array(hash_arr, sizeof(hash_arr));
-    if (hash_enc_request(cmm->partition_id, &hash_buf, request)) {
+    if (cache_id_for_enc(cmm, &hash_buf, request)) {
         return AWS_OP_ERR;
     }
+    record_request(cmm, &hash_buf, true, request->plaintext_size);
+    pool_key = select_pool_key(cmm, &hash_buf);
 
-    if (aws_cryptosdk_materials_cache_find_entry(cmm->materials_cache, &entry, &is_encrypt, &hash_buf) || !entry ||
-        !is_encrypt) {
+lookup:
+    if (aws_cryptosdk_materials_cache_find_entry(cmm->materials_cache, &entry, &is_encrypt, &hash_buf) || !entry) {
+        goto cache_miss;
+    }
+    found = true;
+    if (!is_encrypt) {
         goto cache_miss;
     }
 
@@ -527,7 +1782,7 @@ static int generate_enc_materials(
     }
 
     struct aws_cryptosdk_cache_usage_stats stats = delta_usage;
-    if (aws_cryptosdk_materials_cache_update_usage_stats(cmm->materials_cache, entry, &stats)) {
+    if (charge_usage(cmm, entry, &stats, &leased)) {
         goto cache_miss;
     }
 
@@ -538,70 +1793,348 @@ static int generate_enc_materials(
     /* If the current message exactly hits the message limit, reuse the data key this time but
      * immediately invalidate it from the cache. If the current message exactly hits the byte
      * limit, we do not invalidate the data key, because we are allowed to reuse it for zero
-     * byte length messages.
+     * byte length messages. Keys of a pool are left for the next request to invalidate, which then
+     * knows that the key it replaces was used up rather than never created.
      */
-    if (stats.messages_encrypted == cmm->limit_messages) {
+    if (stats.messages_encrypted == cmm->limit_messages && cmm->key_pool_size <= 1) {
         should_invalidate = true;
     }
 
+    if (should_refresh(cmm, entry, &stats)) {
+        queue_refresh(cmm, &hash_buf, request);
+    }
+
     if (aws_cryptosdk_materials_cache_get_enc_materials(
             cmm->materials_cache, request->alloc, output, request->enc_ctx, entry)) {
         goto cache_miss;
     }
 
-    aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, should_invalidate);
+    attach_header_template(cmm, &hash_buf, *output);
+
+    if (!leased) {
+        aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, should_invalidate);
+    }
 
     return AWS_OP_SUCCESS;
 cache_miss:
     if (entry) {
         /*
          * If we found the entry but then did a cache miss, it must have been unusable for some reason,
-         * and we should invalidate.
+         * and we should invalidate. A reference taken over by a new lease is left to the lease.
          */
-        aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, true);
-        entry = NULL;
+        if (!leased) {
+            aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, true);
+        }
+        entry  = NULL;
+        leased = false;
     }
 
+    /* Only wait once, so that a request does not queue behind a series of failing fetches */
+    if (!waited && join_inflight(cmm, &hash_buf, &flight)) {
+        waited = true;
+        goto lookup;
+    }
+
+    // Later hits on the cached materials may read the trace, even if this caller will not
+    request->skip_keyring_trace = false;
     if (aws_cryptosdk_cmm_generate_enc_materials(cmm->upstream, output, request)) {
+        finish_inflight(cmm, flight);
         return AWS_OP_ERR;
     }
 
     if (can_cache_algorithm((*output)->alg)) {
+        /* Staggers the keys of a new pool, so that they do not all reach the message limit at once */
+        initial_usage = delta_usage;
+        if (!found && pool_key) {
+            initial_usage.messages_encrypted += pool_key * cmm->limit_messages / cmm->key_pool_size;
+        }
+
         aws_cryptosdk_materials_cache_put_entry_for_encrypt(
-            cmm->materials_cache, &entry, *output, delta_usage, request->enc_ctx, &hash_buf);
+            cmm->materials_cache, &entry, *output, initial_usage, request->enc_ctx, &hash_buf);
 
         set_ttl_on_miss(cmm, entry);
+        set_partition_on_miss(cmm, entry);
 
         if (entry) {
+            save_header_template(cmm, &hash_buf, request->enc_ctx, *output);
             aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
         }
+
+        if (cmm->write_through) {
+            write_through_dec_materials(cmm, request->alloc, request->enc_ctx, *output);
+        }
     }
 
+    finish_inflight(cmm, flight);
+
     return AWS_OP_SUCCESS;
 }
 
-static int decrypt_materials(
-    struct aws_cryptosdk_cmm *generic_cmm,
-    struct aws_cryptosdk_dec_materials **output,
-    struct aws_cryptosdk_dec_request *request) {
-    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+static bool derived_key_slot_matches(
+    const struct derived_key_slot *slot,
+    enum aws_cryptosdk_alg_id alg,
+    const struct aws_byte_buf *cache_id,
+    const uint8_t *message_id) {
+    return slot->valid && slot->alg == alg && slot->cache_id_len == cache_id->len &&
+           !memcmp(slot->cache_id, cache_id->buffer, cache_id->len) &&
+           !memcmp(slot->message_id, message_id, MESSAGE_ID_LEN);
+}
 
-    bool is_encrypt;
-    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+/* Returns true if a content key can be derived for request from materials, which were cached under cache_id */
+static bool can_attach_content_key(
+    const struct aws_byte_buf *cache_id,
+    const struct aws_cryptosdk_dec_request *request,
+    const struct aws_cryptosdk_dec_materials *materials) {
+    const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(materials->alg);
 
-    if (!can_cache_algorithm(request->alg)) {
-        /* The algorithm used for the ciphertext is not cachable, so bypass the cache entirely */
-        return aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, output, request);
+    return request->message_id && props && materials->unencrypted_data_key.len == props->data_key_len &&
+           cache_id->len <= AWS_CRYPTOSDK_MD_MAX_SIZE;
+}
+
+/* Copies the content key remembered for message_id under cache_id into content_key, if there is one */
+static bool find_derived_key(
+    struct caching_cmm *cmm,
+    enum aws_cryptosdk_alg_id alg,
+    const struct aws_byte_buf *cache_id,
+    const uint8_t *message_id,
+    struct content_key *content_key) {
+    bool found = false;
+
+    if (aws_mutex_lock(&cmm->derived_key_mutex)) return false;
+    for (size_t i = 0; i < DERIVED_KEY_SLOTS; i++) {
+        const struct derived_key_slot *slot = &cmm->derived_keys[i];
+
+        if (derived_key_slot_matches(slot, alg, cache_id, message_id)) {
+            *content_key = slot->content_key;
+            found        = true;
+            break;
+        }
     }
+    aws_mutex_unlock(&cmm->derived_key_mutex);
 
-    uint8_t hash_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
-    struct aws_byte_buf hash_buf = aws_byte_buf_from_array(hash_arr, sizeof(hash_arr));
+    return found;
+}
 
-    if (hash_dec_request(cmm->partition_id, &hash_buf, request)) {
-        return AWS_OP_ERR;
+static void remember_derived_key(
+    struct caching_cmm *cmm,
+    enum aws_cryptosdk_alg_id alg,
+    const struct aws_byte_buf *cache_id,
+    const uint8_t *message_id,
+    const struct content_key *content_key) {
+    if (aws_mutex_lock(&cmm->derived_key_mutex)) return;
+
+    struct derived_key_slot *slot = &cmm->derived_keys[cmm->next_derived_key];
+    cmm->next_derived_key         = (cmm->next_derived_key + 1) % DERIVED_KEY_SLOTS;
+
+    slot->valid        = true;
+    slot->alg          = alg;
+    slot->cache_id_len = cache_id->len;
+    memcpy(slot->cache_id, cache_id->buffer, cache_id->len);
+    memcpy(slot->message_id, message_id, MESSAGE_ID_LEN);
+    slot->content_key = *content_key;
+    aws_mutex_unlock(&cmm->derived_key_mutex);
+}
+
+/*
+ * Prepares the HKDF extract of the cached materials' data key in hkdf_key, reusing the one done for an
+ * earlier message decrypted with the same cache entry where possible.
+ */
+static int hkdf_key_for_entry(
+    struct caching_cmm *cmm,
+    const struct aws_byte_buf *cache_id,
+    const struct aws_cryptosdk_dec_materials *materials,
+    struct aws_cryptosdk_hkdf_key *hkdf_key) {
+    const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(materials->alg);
+    struct data_key data_key;
+    bool found = false;
+
+    if (!aws_mutex_lock(&cmm->derived_key_mutex)) {
+        for (size_t i = 0; i < HKDF_KEY_SLOTS; i++) {
+            const struct hkdf_key_slot *slot = &cmm->hkdf_keys[i];
+
+            if (slot->valid && slot->alg == materials->alg && slot->cache_id_len == cache_id->len &&
+                !memcmp(slot->cache_id, cache_id->buffer, cache_id->len)) {
+                *hkdf_key = slot->hkdf_key;
+                found     = true;
+                break;
+            }
+        }
+        aws_mutex_unlock(&cmm->derived_key_mutex);
+    }
+    if (found) return AWS_OP_SUCCESS;
+
+    memcpy(data_key.keybuf, materials->unencrypted_data_key.buffer, materials->unencrypted_data_key.len);
+    int rv = aws_cryptosdk_data_key_hkdf_init(props, hkdf_key, &data_key);
+    aws_secure_zero(&data_key, sizeof(data_key));
+    if (rv) return AWS_OP_ERR;
+
+    if (!aws_mutex_lock(&cmm->derived_key_mutex)) {
+        struct hkdf_key_slot *slot = &cmm->hkdf_keys[cmm->next_hkdf_key];
+        cmm->next_hkdf_key         = (cmm->next_hkdf_key + 1) % HKDF_KEY_SLOTS;
+
+        slot->valid        = true;
+        slot->alg          = materials->alg;
+        slot->cache_id_len = cache_id->len;
+        memcpy(slot->cache_id, cache_id->buffer, cache_id->len);
+        slot->hkdf_key = *hkdf_key;
+        aws_mutex_unlock(&cmm->derived_key_mutex);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Derives the content keys for count messages from the same cached materials. Without a KDF the content
+ * key is the data key itself.
+ */
+static int derive_content_keys(
+    struct caching_cmm *cmm,
+    const struct aws_byte_buf *cache_id,
+    const struct aws_cryptosdk_dec_materials *materials,
+    const uint8_t *const *message_ids,
+    struct content_key *content_keys,
+    size_t count) {
+    const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(materials->alg);
+    struct aws_cryptosdk_hkdf_key hkdf_key;
+    int rv;
+
+    if (!props->impl->md_ctor) {
+        struct data_key data_key;
+
+        memcpy(data_key.keybuf, materials->unencrypted_data_key.buffer, materials->unencrypted_data_key.len);
+        rv = aws_cryptosdk_derive_keys(props, content_keys, &data_key, message_ids, count);
+        aws_secure_zero(&data_key, sizeof(data_key));
+        return rv;
+    }
+
+    if (hkdf_key_for_entry(cmm, cache_id, materials, &hkdf_key)) return AWS_OP_ERR;
+    rv = aws_cryptosdk_derive_keys_from_hkdf(props, content_keys, &hkdf_key, message_ids, count);
+    aws_cryptosdk_hkdf_key_clean_up(&hkdf_key);
+    return rv;
+}
+
+static void set_content_key(struct aws_cryptosdk_dec_materials *materials, const struct content_key *content_key) {
+    const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(materials->alg);
+
+    if (!aws_byte_buf_init(
+            &materials->content_key, aws_cryptosdk_secure_key_allocator(), props->content_key_len)) {
+        aws_byte_buf_write(&materials->content_key, content_key->keybuf, props->content_key_len);
+    }
+}
+
+/*
+ * Attaches the content key for request->message_id to the materials, reusing the key derived for an
+ * earlier request against the same cache entry where possible. This is only an optimization; on any
+ * failure we leave the content key empty and the session derives it as usual.
+ */
+static void attach_content_key(
+    struct caching_cmm *cmm,
+    const struct aws_byte_buf *cache_id,
+    const struct aws_cryptosdk_dec_request *request,
+    struct aws_cryptosdk_dec_materials *materials) {
+    struct content_key content_key;
+
+    if (!can_attach_content_key(cache_id, request, materials)) return;
+
+    if (!find_derived_key(cmm, materials->alg, cache_id, request->message_id, &content_key)) {
+        if (derive_content_keys(cmm, cache_id, materials, &request->message_id, &content_key, 1)) goto out;
+        remember_derived_key(cmm, materials->alg, cache_id, request->message_id, &content_key);
+    }
+    set_content_key(materials, &content_key);
+
+out:
+    aws_secure_zero(&content_key, sizeof(content_key));
+}
+
+/* Most cache hits of a batch whose content keys are derived in one call */
+#define CONTENT_KEY_GROUP 16
+
+/*
+ * Attaches content keys to the materials of the cache hits of a batch, as attach_content_key does. Hits
+ * which share a cache entry have their keys derived together from the one HKDF extract, so that a batch
+ * of small messages under one data key does not set up the KDF for each message.
+ */
+static void attach_content_keys(
+    struct caching_cmm *cmm,
+    const struct aws_byte_buf *ids,
+    const size_t *id_request,
+    size_t num_ids,
+    const struct aws_cryptosdk_dec_request *requests,
+    struct aws_cryptosdk_dec_materials **outputs) {
+    struct content_key content_keys[CONTENT_KEY_GROUP];
+    const uint8_t *message_ids[CONTENT_KEY_GROUP];
+    size_t group[CONTENT_KEY_GROUP];
+    bool *done;
+
+    if (!(done = aws_mem_calloc(cmm->alloc, num_ids, sizeof(*done)))) {
+        aws_reset_error();
+        for (size_t k = 0; k < num_ids; k++) {
+            size_t i = id_request[k];
+            if (outputs[i]) attach_content_key(cmm, &ids[k], &requests[i], outputs[i]);
+        }
+        return;
+    }
+
+    for (size_t k = 0; k < num_ids; k++) {
+        size_t i = id_request[k];
+        size_t n = 0;
+
+        if (done[k] || !outputs[i]) continue;
+        if (!can_attach_content_key(&ids[k], &requests[i], outputs[i])) continue;
+
+        // Gather the hits on the same entry whose keys we have not derived before
+        for (size_t k2 = k; k2 < num_ids && n < CONTENT_KEY_GROUP; k2++) {
+            size_t i2                                     = id_request[k2];
+            struct aws_cryptosdk_dec_materials *materials = outputs[i2];
+
+            if (done[k2] || !materials || ids[k2].len != ids[k].len ||
+                memcmp(ids[k2].buffer, ids[k].buffer, ids[k].len) || materials->alg != outputs[i]->alg ||
+                !can_attach_content_key(&ids[k2], &requests[i2], materials)) {
+                continue;
+            }
+            done[k2] = true;
+
+            if (find_derived_key(cmm, materials->alg, &ids[k2], requests[i2].message_id, &content_keys[0])) {
+                set_content_key(materials, &content_keys[0]);
+                continue;
+            }
+            group[n]       = k2;
+            message_ids[n] = requests[i2].message_id;
+            n++;
+        }
+
+        if (n && !derive_content_keys(cmm, &ids[k], outputs[i], message_ids, content_keys, n)) {
+            for (size_t g = 0; g < n; g++) {
+                size_t i2 = id_request[group[g]];
+
+                remember_derived_key(cmm, outputs[i2]->alg, &ids[group[g]], message_ids[g], &content_keys[g]);
+                set_content_key(outputs[i2], &content_keys[g]);
+            }
+        }
+        // Hits beyond a full group start a group of their own when the outer loop reaches them
+        aws_reset_error();
+    }
+
+    aws_secure_zero(content_keys, sizeof(content_keys));
+    aws_mem_release(cmm->alloc, done);
+}
+
+/* Serves a decrypt request of a cachable algorithm, whose cache ID has been computed, from the cache or upstream */
+static int decrypt_materials_for_id(
+    struct caching_cmm *cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request,
+    const struct aws_byte_buf *cache_id) {
+    bool is_encrypt, waited = false;
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct inflight_slot *flight                      = NULL;
+
+lookup:
+    if (is_known_undecryptable(cmm, cache_id)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT);
     }
 
-    if (aws_cryptosdk_materials_cache_find_entry(cmm->materials_cache, &entry, &is_encrypt, &hash_buf) || !entry ||
+    if (aws_cryptosdk_materials_cache_find_entry(cmm->materials_cache, &entry, &is_encrypt, cache_id) || !entry ||
         is_encrypt) {
         /*
          * If we got an encrypt entry, we'll invalidate it, since we're about to replace it anyway.
@@ -619,6 +2152,7 @@ static int decrypt_materials(
     }
 
     aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
+    attach_content_key(cmm, cache_id, request, *output);
 
     return AWS_OP_SUCCESS;
 
@@ -629,19 +2163,320 @@ cache_miss:
          * and we should invalidate.
          */
         aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, true);
+        entry = NULL;
     }
 
+    if (!waited && join_inflight(cmm, cache_id, &flight)) {
+        waited = true;
+        goto lookup;
+    }
+
+    // Later hits on the cached materials may read the trace or check the signature, even if this caller will not
+    request->skip_keyring_trace = false;
+    request->skip_signature     = false;
     if (aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, output, request)) {
-        return AWS_OP_ERR;
+        int error = aws_last_error();
+
+        /* Only remember requests no keyring could decrypt, not transient failures of the upstream CMM */
+        if (error == AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT) {
+            save_undecryptable(cmm, cache_id);
+        }
+        finish_inflight(cmm, flight);
+        return aws_raise_error(error);
     }
 
-    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cmm->materials_cache, &entry, *output, &hash_buf);
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cmm->materials_cache, &entry, *output, cache_id);
 
     set_ttl_on_miss(cmm, entry);
+    set_partition_on_miss(cmm, entry);
 
     if (entry) {
         aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entry, false);
     }
 
+    finish_inflight(cmm, flight);
+    attach_content_key(cmm, cache_id, request, *output);
+
     return AWS_OP_SUCCESS;
 }
+
+static int decrypt_materials(
+    struct aws_cryptosdk_cmm *generic_cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+
+    if (!can_cache_algorithm(request->alg)) {
+        /* The algorithm used for the ciphertext is not cachable, so bypass the cache entirely */
+        return aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, output, request);
+    }
+
+    uint8_t hash_arr[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    struct aws_byte_buf hash_buf = aws_byte_buf_from_array(hash_arr, sizeof(hash_arr));
+
+    if (cache_id_for_dec(cmm, &hash_buf, request)) {
+        return AWS_OP_ERR;
+    }
+    record_request(cmm, &hash_buf, false, 0);
+
+    return decrypt_materials_for_id(cmm, output, request, &hash_buf);
+}
+
+/* Shared by the threads of one aws_cryptosdk_caching_cmm_prewarm_decrypt call */
+struct prewarm_job {
+    struct caching_cmm *cmm;
+    const struct aws_byte_cursor *headers;
+    size_t num_headers;
+    /* Index of the next header to take, and number of headers whose materials are now cached */
+    struct aws_atomic_var next, warmed;
+};
+
+/* Looks up the decryption materials for one serialized header, which fetches them upstream on a miss */
+static bool prewarm_header(struct caching_cmm *cmm, struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor header) {
+    struct aws_cryptosdk_dec_materials *materials = NULL;
+    struct aws_byte_cursor cursor                 = header;
+
+    if (aws_cryptosdk_hdr_parse(hdr, &cursor) || !can_cache_algorithm(hdr->alg_id)) return false;
+
+    // Misses fetch with the trace and signature enabled regardless, so nothing is lost by skipping them here
+    struct aws_cryptosdk_dec_request request = { .alloc               = cmm->alloc,
+                                                 .enc_ctx             = &hdr->enc_ctx,
+                                                 .encrypted_data_keys = hdr->edk_list,
+                                                 .alg                 = hdr->alg_id,
+                                                 .skip_keyring_trace  = true,
+                                                 .skip_signature      = true };
+
+    // As with sessions, the request borrows the header's EDK list, and cannot grow it
+    request.encrypted_data_keys.alloc = NULL;
+
+    struct aws_byte_cursor serialized =
+        aws_byte_cursor_from_array(header.ptr + hdr->parsed_enc_ctx_offset, hdr->parsed_enc_ctx_len);
+    if (serialized.len && aws_cryptosdk_enc_ctx_is_canonical(serialized)) request.serialized_enc_ctx = serialized;
+
+    bool ok = !decrypt_materials(&cmm->base, &materials, &request);
+
+    aws_cryptosdk_dec_materials_destroy(materials);
+    aws_array_list_clean_up(&request.encrypted_data_keys);
+
+    return ok;
+}
+
+static void run_prewarm(void *arg) {
+    struct prewarm_job *job = arg;
+    struct aws_cryptosdk_hdr hdr;
+
+    if (aws_cryptosdk_hdr_init(&hdr, job->cmm->alloc)) return;
+
+    for (;;) {
+        size_t i = aws_atomic_fetch_add(&job->next, 1);
+        if (i >= job->num_headers) break;
+
+        if (prewarm_header(job->cmm, &hdr, job->headers[i])) {
+            aws_atomic_fetch_add(&job->warmed, 1);
+        }
+    }
+
+    aws_cryptosdk_hdr_clean_up(&hdr);
+}
+
+int aws_cryptosdk_caching_cmm_prewarm_decrypt(
+    struct aws_cryptosdk_cmm *generic_cmm,
+    const struct aws_byte_cursor *headers,
+    size_t num_headers,
+    size_t num_threads,
+    size_t *num_warmed) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    if (num_headers && !headers) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_thread *threads = NULL;
+    size_t helpers             = 0;
+    struct prewarm_job job     = { .cmm = cmm, .headers = headers, .num_headers = num_headers };
+    aws_atomic_init_int(&job.next, 0);
+    aws_atomic_init_int(&job.warmed, 0);
+
+    if (num_threads > num_headers) num_threads = num_headers;
+    if (num_threads > 1 && (threads = aws_mem_calloc(cmm->alloc, num_threads - 1, sizeof(*threads)))) {
+        // Threads which cannot be started leave their share of the headers to the others
+        for (; helpers < num_threads - 1; helpers++) {
+            if (aws_thread_init(&threads[helpers], cmm->alloc)) break;
+            if (aws_thread_launch(&threads[helpers], run_prewarm, &job, NULL)) {
+                aws_thread_clean_up(&threads[helpers]);
+                break;
+            }
+        }
+    }
+
+    run_prewarm(&job);
+
+    for (size_t i = 0; i < helpers; i++) {
+        aws_thread_join(&threads[i]);
+        aws_thread_clean_up(&threads[i]);
+    }
+    if (threads) aws_mem_release(cmm->alloc, threads);
+
+    if (num_warmed) *num_warmed = aws_atomic_load_int(&job.warmed);
+    aws_reset_error();
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_caching_cmm_decrypt_materials_batch(
+    struct aws_cryptosdk_cmm *generic_cmm,
+    struct aws_cryptosdk_dec_materials **outputs,
+    struct aws_cryptosdk_dec_request *requests,
+    int *errors,
+    size_t count) {
+    struct caching_cmm *cmm = AWS_CONTAINER_OF(generic_cmm, struct caching_cmm, base);
+    if (generic_cmm->vtable != &caching_cmm_vt) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    if (count && (!outputs || !requests)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+    for (size_t i = 0; i < count; i++) {
+        outputs[i] = NULL;
+        if (errors) errors[i] = 0;
+    }
+    if (!count) return AWS_OP_SUCCESS;
+
+    struct aws_cryptosdk_md_context *md_context         = NULL;
+    struct aws_cryptosdk_materials_cache_entry **entries = NULL;
+    struct aws_byte_buf *ids                            = NULL;
+    uint8_t *id_storage                                 = NULL;
+    size_t *id_request                                  = NULL;
+    bool *is_encrypt                                    = NULL;
+    int *status                                         = NULL;
+    struct edk_hash_entry *edk_hashes                   = NULL;
+    size_t num_ids                                      = 0;
+    int first_error                                     = AWS_OP_SUCCESS;
+
+    const struct aws_cryptosdk_digest_provider_vt *digest_provider = digest_provider_of(cmm);
+
+    if (count > SIZE_MAX / AWS_CRYPTOSDK_MD_MAX_SIZE) {
+        first_error = AWS_ERROR_OOM;
+        goto out;
+    }
+    if (!(entries = aws_mem_calloc(cmm->alloc, count, sizeof(*entries))) ||
+        !(ids = aws_mem_calloc(cmm->alloc, count, sizeof(*ids))) ||
+        !(id_storage = aws_mem_acquire(cmm->alloc, count * AWS_CRYPTOSDK_MD_MAX_SIZE)) ||
+        !(id_request = aws_mem_calloc(cmm->alloc, count, sizeof(*id_request))) ||
+        !(is_encrypt = aws_mem_calloc(cmm->alloc, count, sizeof(*is_encrypt))) ||
+        !(status = aws_mem_calloc(cmm->alloc, count, sizeof(*status)))) {
+        first_error = aws_last_error();
+        goto out;
+    }
+
+    /*
+     * With a digest provider, the EDKs of all the cachable requests are hashed together first. If
+     * that fails, each request's EDKs are hashed again on their own below, so that one bad EDK
+     * only fails its own request.
+     */
+    if (digest_provider) {
+        size_t num_cachable = 0, total_edks = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            if (!can_cache_algorithm(requests[i].alg)) continue;
+            id_request[num_cachable++] = i;
+            total_edks += aws_array_list_length(&requests[i].encrypted_data_keys);
+        }
+        if (total_edks && (edk_hashes = aws_mem_calloc(cmm->alloc, total_edks, sizeof(*edk_hashes))) &&
+            hash_edks_for_decrypt(
+                digest_provider, NULL, cmm->alloc, requests, id_request, num_cachable, edk_hashes)) {
+            aws_mem_release(cmm->alloc, edk_hashes);
+            edk_hashes = NULL;
+        }
+        aws_reset_error();
+    }
+
+    // Compute the cache IDs in one pass with one hash context; uncachable requests are served upstream below
+    for (size_t i = 0, edk_offset = 0; i < count; i++) {
+        if (!can_cache_algorithm(requests[i].alg)) continue;
+
+        struct aws_byte_buf *id = &ids[num_ids];
+        *id = aws_byte_buf_from_array(id_storage + num_ids * AWS_CRYPTOSDK_MD_MAX_SIZE, AWS_CRYPTOSDK_MD_MAX_SIZE);
+        size_t n_edks = aws_array_list_length(&requests[i].encrypted_data_keys);
+        struct edk_hash_entry *hashes = edk_hashes ? edk_hashes + edk_offset : NULL;
+        edk_offset += n_edks;
+
+        if (!md_context && !(md_context = acquire_md_context(cmm))) {
+            status[i] = aws_last_error();
+            continue;
+        }
+        if (hashes ? dec_request_id_from_edk_hashes(cmm->partition_md, md_context, id, &requests[i], hashes, n_edks)
+                   : hash_dec_request_with_provider(
+                         digest_provider, cmm->partition_md, md_context, id, &requests[i])) {
+            status[i] = aws_last_error();
+            aws_cryptosdk_md_abort(md_context);
+            md_context = NULL;
+            continue;
+        }
+        record_request(cmm, id, false, 0);
+
+        id_request[num_ids++] = i;
+    }
+    if (md_context) release_md_context(cmm, md_context);
+    if (edk_hashes) aws_mem_release(cmm->alloc, edk_hashes);
+
+    // If the batched lookup fails, every request just takes the miss path, which looks it up again
+    if (aws_cryptosdk_materials_cache_find_entries(cmm->materials_cache, entries, is_encrypt, ids, num_ids)) {
+        aws_reset_error();
+    }
+
+    for (size_t k = 0; k < num_ids; k++) {
+        size_t i = id_request[k];
+
+        if (!entries[k]) continue;
+        if (!is_encrypt[k] && !is_known_undecryptable(cmm, &ids[k]) && check_ttl(cmm, entries[k]) &&
+            !aws_cryptosdk_materials_cache_get_dec_materials(
+                cmm->materials_cache, requests[i].alloc, &outputs[i], entries[k])) {
+            aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entries[k], false);
+        } else {
+            // As in decrypt_materials, an entry found but unusable is invalidated before the miss
+            aws_cryptosdk_materials_cache_entry_release(cmm->materials_cache, entries[k], true);
+        }
+        entries[k] = NULL;
+    }
+    attach_content_keys(cmm, ids, id_request, num_ids, requests, outputs);
+
+    /*
+     * Resolve the misses in order: the first request for each data key fetches it upstream and
+     * caches it, so that later requests in the batch for the same key hit that entry.
+     */
+    for (size_t k = 0; k < num_ids; k++) {
+        size_t i = id_request[k];
+
+        if (!outputs[i] && decrypt_materials_for_id(cmm, &outputs[i], &requests[i], &ids[k])) {
+            status[i] = aws_last_error();
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!status[i] && !outputs[i] && !can_cache_algorithm(requests[i].alg) &&
+            aws_cryptosdk_cmm_decrypt_materials(cmm->upstream, &outputs[i], &requests[i])) {
+            status[i] = aws_last_error();
+        }
+        if (errors) errors[i] = status[i];
+        if (status[i] && !first_error) first_error = status[i];
+    }
+
+out:
+    // If the batch could not be set up, no request was served
+    for (size_t i = 0; i < count && !status && errors; i++) {
+        errors[i] = first_error;
+    }
+    if (status) aws_mem_release(cmm->alloc, status);
+    if (is_encrypt) aws_mem_release(cmm->alloc, is_encrypt);
+    if (id_request) aws_mem_release(cmm->alloc, id_request);
+    if (id_storage) aws_mem_release(cmm->alloc, id_storage);
+    if (ids) aws_mem_release(cmm->alloc, ids);
+    if (entries) aws_mem_release(cmm->alloc, entries);
+
+    return first_error ? aws_raise_error(first_error) : AWS_OP_SUCCESS;
+}
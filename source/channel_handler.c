@@ -0,0 +1,481 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/channel_handler.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/config.h>
+
+#ifdef AWS_CRYPTOSDK_P_HAVE_AWS_C_IO
+#    include <aws/common/atomics.h>
+#    include <aws/common/linked_list.h>
+#    include <aws/cryptosdk/private/session.h>
+#    include <aws/io/channel.h>
+#    include <aws/io/io.h>
+
+#    define DEFAULT_WINDOW_SIZE (64 * 1024)
+
+/* The state of one direction of the channel */
+struct direction {
+    enum aws_channel_direction dir;
+    /* NULL if data passes through unchanged */
+    struct aws_cryptosdk_session *session;
+    /* Messages received and not yet wholly consumed, in order; the first offset bytes are consumed */
+    struct aws_linked_list pending;
+    size_t offset;
+    size_t pending_len;
+    uint64_t total_in;
+    /* Read window granted upstream and not yet filled by messages; read direction only */
+    size_t window;
+    /* Set once this direction has begun a clean shutdown, after which no more input comes */
+    bool input_done;
+    /* Set while that shutdown waits for the session to finish the message */
+    bool shutdown_pending;
+};
+
+struct crypto_handler {
+    struct aws_channel_handler handler;
+    struct direction read, write;
+    size_t initial_window_size;
+    /* Reused by every run: the input segments, and output too large for one message */
+    struct aws_array_list segments;
+    struct aws_byte_buf staging;
+    struct aws_channel_task resume_task;
+    struct aws_atomic_var resume_scheduled;
+};
+
+static void release_message(struct aws_channel *channel, struct aws_io_message *message, int error_code) {
+    if (message->on_completion) message->on_completion(channel, message, error_code, message->user_data);
+    aws_mem_release(message->allocator, message);
+}
+
+static void release_pending(struct crypto_handler *self, struct direction *d, int error_code) {
+    while (!aws_linked_list_empty(&d->pending)) {
+        struct aws_linked_list_node *node = aws_linked_list_pop_front(&d->pending);
+        release_message(
+            self->handler.slot ? self->handler.slot->channel : NULL,
+            AWS_CONTAINER_OF(node, struct aws_io_message, queueing_handle),
+            error_code);
+    }
+    d->offset      = 0;
+    d->pending_len = 0;
+}
+
+/* Releases the first len bytes of pending input, which the session has consumed */
+static void consume_input(struct crypto_handler *self, struct direction *d, size_t len) {
+    d->pending_len -= len;
+    while (!aws_linked_list_empty(&d->pending)) {
+        struct aws_io_message *message =
+            AWS_CONTAINER_OF(aws_linked_list_front(&d->pending), struct aws_io_message, queueing_handle);
+        size_t available = message->message_data.len - d->offset;
+
+        if (len < available) {
+            d->offset += len;
+            return;
+        }
+        len -= available;
+        d->offset = 0;
+        aws_linked_list_pop_front(&d->pending);
+        release_message(self->handler.slot->channel, message, AWS_ERROR_SUCCESS);
+    }
+}
+
+/* Points self->segments at the unconsumed part of each pending message */
+static int gather_input(struct crypto_handler *self, struct direction *d) {
+    size_t offset = d->offset;
+
+    aws_array_list_clear(&self->segments);
+    for (struct aws_linked_list_node *node = aws_linked_list_begin(&d->pending);
+         node != aws_linked_list_end(&d->pending);
+         node = aws_linked_list_next(node)) {
+        struct aws_io_message *message = AWS_CONTAINER_OF(node, struct aws_io_message, queueing_handle);
+        struct aws_byte_cursor segment = aws_byte_cursor_from_buf(&message->message_data);
+
+        aws_byte_cursor_advance(&segment, offset);
+        offset = 0;
+        if (aws_array_list_push_back(&self->segments, &segment)) return AWS_OP_ERR;
+    }
+    return AWS_OP_SUCCESS;
+}
+
+static int send_message(struct crypto_handler *self, struct direction *d, struct aws_io_message *message) {
+    if (aws_channel_slot_send_message(self->handler.slot, message, d->dir)) {
+        release_message(self->handler.slot->channel, message, aws_last_error());
+        return AWS_OP_ERR;
+    }
+    return AWS_OP_SUCCESS;
+}
+
+/* Copies data into as many messages from the pool as it takes, and sends them on */
+static int send_copies(struct crypto_handler *self, struct direction *d, struct aws_byte_cursor data) {
+    while (data.len) {
+        struct aws_io_message *message = aws_channel_acquire_message_from_pool(
+            self->handler.slot->channel, AWS_IO_MESSAGE_APPLICATION_DATA, data.len);
+        if (!message) return AWS_OP_ERR;
+
+        struct aws_byte_cursor chunk = aws_byte_cursor_advance(
+            &data, data.len < message->message_data.capacity ? data.len : message->message_data.capacity);
+        aws_byte_buf_write_from_whole_cursor(&message->message_data, chunk);
+        if (send_message(self, d, message)) return AWS_OP_ERR;
+    }
+    return AWS_OP_SUCCESS;
+}
+
+/* Sends on whole pending messages, as far as the downstream window allows */
+static int pass_through(struct crypto_handler *self, struct direction *d, size_t *consumed) {
+    while (!aws_linked_list_empty(&d->pending)) {
+        struct aws_io_message *message =
+            AWS_CONTAINER_OF(aws_linked_list_front(&d->pending), struct aws_io_message, queueing_handle);
+        size_t len = message->message_data.len;
+
+        if (d->dir == AWS_CHANNEL_DIR_READ && len > aws_channel_slot_downstream_read_window(self->handler.slot)) break;
+
+        aws_linked_list_pop_front(&d->pending);
+        d->pending_len -= len;
+        *consumed += len;
+        if (send_message(self, d, message)) return AWS_OP_ERR;
+    }
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Runs the session over the pending input for as long as it makes progress. Output goes
+ * straight into messages from the pool, unless the next step needs more room than the pool's
+ * messages have, in which case it is staged and split.
+ */
+static int run_session(struct crypto_handler *self, struct direction *d, size_t *consumed) {
+    struct aws_cryptosdk_session *session = d->session;
+    struct aws_channel_slot *slot         = self->handler.slot;
+
+    for (;;) {
+        size_t limit = d->dir == AWS_CHANNEL_DIR_READ ? aws_channel_slot_downstream_read_window(slot) : SIZE_MAX;
+        size_t out_needed, in_needed, out_bytes_written, in_bytes_read;
+        struct aws_io_message *message = NULL;
+        struct aws_byte_buf out;
+
+        if (aws_cryptosdk_session_is_done(session)) {
+            // Anything more than the message itself is an error
+            if (d->pending_len) {
+                return aws_raise_error(
+                    session->mode == AWS_CRYPTOSDK_DECRYPT ? AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT
+                                                           : AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+            }
+            return AWS_OP_SUCCESS;
+        }
+        if (d->input_done && session->mode == AWS_CRYPTOSDK_ENCRYPT && !session->precise_size_known &&
+            aws_cryptosdk_session_set_message_size(session, d->total_in)) {
+            return AWS_OP_ERR;
+        }
+
+        // The downstream handler takes up the rest when it opens its window
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+        if (!limit || out_needed > limit) return AWS_OP_SUCCESS;
+        if (gather_input(self, d)) return AWS_OP_ERR;
+
+        size_t hint = out_needed > d->pending_len ? out_needed : d->pending_len;
+        if (!(message = aws_channel_acquire_message_from_pool(
+                  slot->channel, AWS_IO_MESSAGE_APPLICATION_DATA, hint < limit ? hint : limit))) {
+            return AWS_OP_ERR;
+        }
+        if (message->message_data.capacity < out_needed) {
+            aws_mem_release(message->allocator, message);
+            message = NULL;
+            if (aws_byte_buf_reserve(&self->staging, out_needed)) return AWS_OP_ERR;
+            out = aws_byte_buf_from_empty_array(
+                self->staging.buffer, self->staging.capacity < limit ? self->staging.capacity : limit);
+        } else {
+            out = aws_byte_buf_from_empty_array(
+                message->message_data.buffer,
+                message->message_data.capacity < limit ? message->message_data.capacity : limit);
+        }
+
+        if (aws_cryptosdk_session_processv(
+                session,
+                &out,
+                1,
+                &out_bytes_written,
+                aws_array_list_length(&self->segments) ? self->segments.data : NULL,
+                aws_array_list_length(&self->segments),
+                &in_bytes_read)) {
+            if (message) aws_mem_release(message->allocator, message);
+            return AWS_OP_ERR;
+        }
+        consume_input(self, d, in_bytes_read);
+        *consumed += in_bytes_read;
+
+        if (!message) {
+            int rv = send_copies(self, d, aws_byte_cursor_from_buf(&out));
+            aws_secure_zero(out.buffer, out.len);
+            if (rv) return AWS_OP_ERR;
+        } else if (out_bytes_written) {
+            message->message_data.len = out_bytes_written;
+            if (send_message(self, d, message)) return AWS_OP_ERR;
+        } else {
+            aws_mem_release(message->allocator, message);
+        }
+
+        // Otherwise the session needs more input, or is waiting on its materials
+        if (!out_bytes_written && !in_bytes_read) return AWS_OP_SUCCESS;
+    }
+}
+
+/*
+ * Grants the upstream handler as much read window as input was consumed, and more if the
+ * session needs more input at once than the window would otherwise ever let in.
+ */
+static void open_window(struct crypto_handler *self, struct direction *d, size_t consumed) {
+    size_t increment = consumed;
+    size_t out_needed, in_needed;
+
+    if (d->session && !aws_cryptosdk_session_is_done(d->session)) {
+        size_t expected = d->pending_len + d->window + consumed;
+        aws_cryptosdk_session_estimate_buf(d->session, &out_needed, &in_needed);
+        if (in_needed > expected) increment += in_needed - expected;
+    }
+    if (increment) {
+        d->window += increment;
+        aws_channel_slot_increment_read_window(self->handler.slot, increment);
+    }
+}
+
+static int run_direction(struct crypto_handler *self, struct direction *d) {
+    size_t consumed = 0;
+    int rv          = d->session ? run_session(self, d, &consumed) : pass_through(self, d, &consumed);
+
+    if (d->dir == AWS_CHANNEL_DIR_READ) open_window(self, d, consumed);
+    return rv;
+}
+
+/* Returns true if the direction cannot finish yet, but will once its materials or window arrive */
+static bool is_stalled(struct crypto_handler *self, struct direction *d) {
+    size_t out_needed, in_needed;
+
+    if (!d->session) return !aws_linked_list_empty(&d->pending);
+    if (aws_cryptosdk_session_is_done(d->session)) return false;
+    if (aws_cryptosdk_session_is_pending(d->session)) return true;
+    if (d->dir != AWS_CHANNEL_DIR_READ) return false;
+
+    aws_cryptosdk_session_estimate_buf(d->session, &out_needed, &in_needed);
+    return out_needed > aws_channel_slot_downstream_read_window(self->handler.slot);
+}
+
+static int complete_shutdown(struct crypto_handler *self, struct direction *d, int error_code, bool free_scarce) {
+    release_pending(self, d, error_code ? error_code : AWS_CRYPTOSDK_ERR_BAD_STATE);
+    return aws_channel_slot_on_handler_shutdown_complete(self->handler.slot, d->dir, error_code, free_scarce);
+}
+
+/* Runs the direction again, and completes its shutdown if that was waiting on this run */
+static void continue_direction(struct crypto_handler *self, struct direction *d) {
+    int rv = run_direction(self, d);
+    int error_code;
+
+    if (!d->shutdown_pending) {
+        if (rv) aws_channel_shutdown(self->handler.slot->channel, aws_last_error());
+        return;
+    }
+    if (!rv && is_stalled(self, d)) return;
+
+    if (rv) {
+        error_code = aws_last_error();
+    } else if (d->session && !aws_cryptosdk_session_is_done(d->session)) {
+        // The input ended partway through the message
+        error_code = d->session->mode == AWS_CRYPTOSDK_DECRYPT ? AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT
+                                                               : AWS_CRYPTOSDK_ERR_BAD_STATE;
+    } else {
+        error_code = AWS_ERROR_SUCCESS;
+    }
+    d->shutdown_pending = false;
+    complete_shutdown(self, d, error_code, false);
+}
+
+static int receive(struct crypto_handler *self, struct direction *d, struct aws_io_message *message) {
+    size_t len = message->message_data.len;
+
+    // The message is ours from here on, whatever becomes of it
+    aws_linked_list_push_back(&d->pending, &message->queueing_handle);
+    d->pending_len += len;
+    d->total_in += len;
+    d->window -= len < d->window ? len : d->window;
+
+    continue_direction(self, d);
+    return AWS_OP_SUCCESS;
+}
+
+static int crypto_handler_process_read_message(
+    struct aws_channel_handler *handler, struct aws_channel_slot *slot, struct aws_io_message *message) {
+    struct crypto_handler *self = handler->impl;
+    (void)slot;
+
+    return receive(self, &self->read, message);
+}
+
+static int crypto_handler_process_write_message(
+    struct aws_channel_handler *handler, struct aws_channel_slot *slot, struct aws_io_message *message) {
+    struct crypto_handler *self = handler->impl;
+    (void)slot;
+
+    return receive(self, &self->write, message);
+}
+
+static int crypto_handler_increment_read_window(
+    struct aws_channel_handler *handler, struct aws_channel_slot *slot, size_t size) {
+    struct crypto_handler *self = handler->impl;
+    (void)slot;
+    (void)size;
+
+    // The upstream window follows what is consumed, not the downstream window
+    continue_direction(self, &self->read);
+    return AWS_OP_SUCCESS;
+}
+
+static int crypto_handler_shutdown(
+    struct aws_channel_handler *handler,
+    struct aws_channel_slot *slot,
+    enum aws_channel_direction dir,
+    int error_code,
+    bool free_scarce_resources_immediately) {
+    struct crypto_handler *self = handler->impl;
+    struct direction *d         = dir == AWS_CHANNEL_DIR_READ ? &self->read : &self->write;
+    (void)slot;
+
+    if (error_code || free_scarce_resources_immediately) {
+        return complete_shutdown(self, d, error_code, free_scarce_resources_immediately);
+    }
+
+    // A clean shutdown ends the input, which lets the session finish the message
+    d->input_done       = true;
+    d->shutdown_pending = true;
+    continue_direction(self, d);
+    return AWS_OP_SUCCESS;
+}
+
+static size_t crypto_handler_initial_window_size(struct aws_channel_handler *handler) {
+    struct crypto_handler *self = handler->impl;
+
+    return self->initial_window_size;
+}
+
+static size_t crypto_handler_message_overhead(struct aws_channel_handler *handler) {
+    (void)handler;
+
+    // Output is cut into messages of its own, so nothing is added to the messages passed in
+    return 0;
+}
+
+static void crypto_handler_reset_statistics(struct aws_channel_handler *handler) {
+    (void)handler;
+}
+
+static void crypto_handler_gather_statistics(struct aws_channel_handler *handler, struct aws_array_list *stats) {
+    (void)handler;
+    (void)stats;
+}
+
+static void crypto_handler_destroy(struct aws_channel_handler *handler) {
+    struct crypto_handler *self = handler->impl;
+
+    release_pending(self, &self->read, AWS_CRYPTOSDK_ERR_BAD_STATE);
+    release_pending(self, &self->write, AWS_CRYPTOSDK_ERR_BAD_STATE);
+    aws_array_list_clean_up(&self->segments);
+    aws_byte_buf_clean_up_secure(&self->staging);
+    aws_mem_release(handler->alloc, self);
+}
+
+static struct aws_channel_handler_vtable crypto_handler_vtable = {
+    .process_read_message  = crypto_handler_process_read_message,
+    .process_write_message = crypto_handler_process_write_message,
+    .increment_read_window = crypto_handler_increment_read_window,
+    .shutdown              = crypto_handler_shutdown,
+    .initial_window_size   = crypto_handler_initial_window_size,
+    .message_overhead      = crypto_handler_message_overhead,
+    .destroy               = crypto_handler_destroy,
+    .reset_statistics      = crypto_handler_reset_statistics,
+    .gather_statistics     = crypto_handler_gather_statistics
+};
+
+static void resume_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
+    struct crypto_handler *self = arg;
+    (void)task;
+
+    aws_atomic_store_int(&self->resume_scheduled, 0);
+    if (status != AWS_TASK_STATUS_RUN_READY) return;
+
+    continue_direction(self, &self->read);
+    continue_direction(self, &self->write);
+}
+
+void aws_cryptosdk_channel_handler_resume(struct aws_channel_handler *handler) {
+    struct crypto_handler *self = handler->impl;
+    size_t expected             = 0;
+
+    // A run which is already scheduled picks up whatever has completed by the time it starts
+    if (aws_atomic_compare_exchange_int(&self->resume_scheduled, &expected, 1)) {
+        aws_channel_schedule_task_now(self->handler.slot->channel, &self->resume_task);
+    }
+}
+
+static void direction_init(struct direction *d, enum aws_channel_direction dir, struct aws_cryptosdk_session *session) {
+    d->dir     = dir;
+    d->session = session;
+    aws_linked_list_init(&d->pending);
+}
+
+struct aws_channel_handler *aws_cryptosdk_channel_handler_new(
+    struct aws_allocator *alloc, const struct aws_cryptosdk_channel_handler_options *options) {
+    struct crypto_handler *self;
+
+    if (!options || (!options->read_session && !options->write_session)) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    if (!(self = aws_mem_calloc(alloc, 1, sizeof(*self)))) return NULL;
+    if (aws_array_list_init_dynamic(&self->segments, alloc, 4, sizeof(struct aws_byte_cursor))) {
+        aws_mem_release(alloc, self);
+        return NULL;
+    }
+    if (aws_byte_buf_init(&self->staging, alloc, 0)) {
+        aws_array_list_clean_up(&self->segments);
+        aws_mem_release(alloc, self);
+        return NULL;
+    }
+
+    self->handler.vtable      = &crypto_handler_vtable;
+    self->handler.alloc       = alloc;
+    self->handler.impl        = self;
+    self->initial_window_size = options->initial_window_size ? options->initial_window_size : DEFAULT_WINDOW_SIZE;
+    direction_init(&self->read, AWS_CHANNEL_DIR_READ, options->read_session);
+    direction_init(&self->write, AWS_CHANNEL_DIR_WRITE, options->write_session);
+    self->read.window = self->initial_window_size;
+    aws_channel_task_init(&self->resume_task, resume_task, self, "cryptosdk_channel_handler_resume");
+    aws_atomic_init_int(&self->resume_scheduled, 0);
+
+    return &self->handler;
+}
+
+#else  // AWS_CRYPTOSDK_P_HAVE_AWS_C_IO
+
+struct aws_channel_handler *aws_cryptosdk_channel_handler_new(
+    struct aws_allocator *alloc, const struct aws_cryptosdk_channel_handler_options *options) {
+    (void)alloc;
+    (void)options;
+    aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    return NULL;
+}
+
+void aws_cryptosdk_channel_handler_resume(struct aws_channel_handler *handler) {
+    (void)handler;
+}
+
+#endif  // AWS_CRYPTOSDK_P_HAVE_AWS_C_IO
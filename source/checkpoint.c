@@ -0,0 +1,178 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <openssl/crypto.h>  // CRYPTO_memcmp
+
+#include <aws/common/byte_buf.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/hkdf.h>
+#include <aws/cryptosdk/private/session.h>
+#include <aws/cryptosdk/session.h>
+
+/*
+ * A checkpoint is laid out as follows, with integers in big-endian order:
+ *
+ *   u8  version
+ *   u32 header length, followed by the serialized message header
+ *   u32 sequence number of the next frame
+ *   u64 plaintext bytes encrypted so far
+ *   u64 message size bound
+ *   u8  whether the message size is known
+ *   u64 message size, or zero
+ *   MAC over all of the above
+ *
+ * The MAC is HKDF-SHA256 output, with the content key as input keying material and the fields
+ * as info, so only holders of the data key can produce or check it. No key material is stored.
+ */
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_MAC_LEN 32
+#define CHECKPOINT_FIELDS_LEN (1 + 4 + 4 + 8 + 8 + 1 + 8)
+
+static int checkpoint_mac(
+    const struct aws_cryptosdk_session *session, uint8_t *mac, const uint8_t *fields, size_t fields_len) {
+    static const uint8_t salt_bytes[] = "aws-crypto-checkpoint";
+    const struct content_key *key     = session->content_key;
+    struct aws_byte_buf okm           = aws_byte_buf_from_array(mac, CHECKPOINT_MAC_LEN);
+    struct aws_byte_buf salt          = aws_byte_buf_from_array(salt_bytes, sizeof(salt_bytes) - 1);
+    struct aws_byte_buf ikm           = aws_byte_buf_from_array(key->keybuf, session->alg_props->content_key_len);
+    struct aws_byte_buf info          = aws_byte_buf_from_array(fields, fields_len);
+
+    return aws_cryptosdk_hkdf(&okm, AWS_CRYPTOSDK_SHA256, &salt, &ikm, &info);
+}
+
+int aws_cryptosdk_session_export_checkpoint(
+    const struct aws_cryptosdk_session *session, struct aws_byte_buf *checkpoint) {
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT || session->state != ST_ENCRYPT_BODY || !session->frame_size ||
+        session->codec) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+    // The signature's digest state cannot be taken out of the signing context
+    if (session->signctx) return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    if (session->header_size > UINT32_MAX || session->frame_seqno > UINT32_MAX) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    size_t len = CHECKPOINT_FIELDS_LEN + session->header_size + CHECKPOINT_MAC_LEN;
+    if (aws_byte_buf_reserve_relative(checkpoint, len)) return AWS_OP_ERR;
+
+    // With the space reserved, these cannot fail
+    uint8_t *start = checkpoint->buffer + checkpoint->len;
+    aws_byte_buf_write_u8(checkpoint, CHECKPOINT_VERSION);
+    aws_byte_buf_write_be32(checkpoint, (uint32_t)session->header_size);
+    aws_byte_buf_write(checkpoint, session->header_copy, session->header_size);
+    aws_byte_buf_write_be32(checkpoint, (uint32_t)session->frame_seqno);
+    aws_byte_buf_write_be64(checkpoint, session->data_so_far);
+    aws_byte_buf_write_be64(checkpoint, session->size_bound);
+    aws_byte_buf_write_u8(checkpoint, session->precise_size_known);
+    aws_byte_buf_write_be64(checkpoint, session->precise_size_known ? session->precise_size : 0);
+
+    if (checkpoint_mac(session, checkpoint->buffer + checkpoint->len, start, len - CHECKPOINT_MAC_LEN)) {
+        aws_secure_zero(start, len - CHECKPOINT_MAC_LEN);
+        checkpoint->len -= len - CHECKPOINT_MAC_LEN;
+        return AWS_OP_ERR;
+    }
+    checkpoint->len += CHECKPOINT_MAC_LEN;
+
+    return AWS_OP_SUCCESS;
+}
+
+/* The fields of a checkpoint, as read and checked for consistency, but not yet authenticated */
+struct checkpoint {
+    struct aws_byte_cursor header;
+    uint32_t seqno;
+    uint64_t data_so_far, size_bound, precise_size;
+    uint8_t precise_size_known;
+    const uint8_t *mac;
+};
+
+static int read_checkpoint(struct checkpoint *cp, struct aws_byte_cursor cur) {
+    uint8_t version;
+    uint32_t header_len;
+
+    if (!aws_byte_cursor_read_u8(&cur, &version) || version != CHECKPOINT_VERSION) goto bad;
+    if (!aws_byte_cursor_read_be32(&cur, &header_len)) goto bad;
+    if (!(cp->header = aws_byte_cursor_advance(&cur, header_len)).ptr) goto bad;
+    if (!aws_byte_cursor_read_be32(&cur, &cp->seqno) || !aws_byte_cursor_read_be64(&cur, &cp->data_so_far) ||
+        !aws_byte_cursor_read_be64(&cur, &cp->size_bound) || !aws_byte_cursor_read_u8(&cur, &cp->precise_size_known) ||
+        !aws_byte_cursor_read_be64(&cur, &cp->precise_size)) {
+        goto bad;
+    }
+    if (cur.len != CHECKPOINT_MAC_LEN) goto bad;
+    cp->mac = cur.ptr;
+
+    if (!cp->seqno || cp->precise_size_known > 1) goto bad;
+    if (cp->precise_size_known && (cp->data_so_far > cp->precise_size || cp->precise_size > cp->size_bound)) goto bad;
+
+    return AWS_OP_SUCCESS;
+
+bad:
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+}
+
+int aws_cryptosdk_session_resume_from_checkpoint(
+    struct aws_cryptosdk_session *session, const uint8_t *checkpoint, size_t len) {
+    struct aws_byte_cursor cur = aws_byte_cursor_from_array(checkpoint, len);
+    struct checkpoint cp;
+    uint8_t mac[CHECKPOINT_MAC_LEN];
+
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT || session->state != ST_CONFIG || session->frame_index_out ||
+        session->compression) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+    if (read_checkpoint(&cp, cur)) return AWS_OP_ERR;
+
+    // From here on the session is committed to the checkpoint's message
+    session->header.borrow_edks   = false;
+    session->header.defer_enc_ctx = false;
+    session->header_size          = cp.header.len;
+    if (aws_cryptosdk_priv_reserve_header_copy(session)) goto fail;
+    memcpy(session->header_copy, cp.header.ptr, cp.header.len);
+    session->header_bytes = session->header_copy;
+
+    struct aws_byte_cursor header = aws_byte_cursor_from_array(session->header_copy, session->header_size);
+    if (aws_cryptosdk_hdr_parse(&session->header, &header) || header.len) goto bad;
+
+    session->alg_props = aws_cryptosdk_alg_props(session->header.alg_id);
+    if (!session->alg_props) goto bad;
+    if (session->alg_props->signature_len) {
+        aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+        goto fail;
+    }
+    // Every frame before the next one is a full frame, and the next one is still to come
+    if (!session->header.frame_len || (cp.seqno - 1) * (uint64_t)session->header.frame_len != cp.data_so_far) goto bad;
+
+    aws_cryptosdk_priv_session_change_state(session, ST_GEN_KEY);
+    if (aws_cryptosdk_priv_recover_content_key(session)) goto fail;
+    if (checkpoint_mac(session, mac, checkpoint, len - CHECKPOINT_MAC_LEN)) goto fail;
+    if (CRYPTO_memcmp(mac, cp.mac, CHECKPOINT_MAC_LEN)) goto bad;
+
+    session->frame_size         = session->header.frame_len;
+    session->frame_seqno        = cp.seqno;
+    session->data_so_far        = cp.data_so_far;
+    session->size_bound         = cp.size_bound;
+    session->precise_size       = cp.precise_size;
+    session->precise_size_known = cp.precise_size_known;
+    // The header went out before the checkpoint was taken
+    aws_cryptosdk_priv_session_change_state(session, ST_WRITE_HEADER);
+    aws_cryptosdk_priv_session_change_state(session, ST_ENCRYPT_BODY);
+    aws_cryptosdk_priv_encrypt_compute_body_estimate(session);
+
+    return AWS_OP_SUCCESS;
+
+bad:
+    aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+fail:
+    return aws_cryptosdk_priv_fail_session(session, aws_last_error());
+}
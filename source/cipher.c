@@ -14,27 +14,37 @@
  */
 
 #include <assert.h>
+#include <openssl/crypto.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
 #include <openssl/rand.h>
 #include <openssl/rsa.h>
 #include <stdbool.h>
+#include <stddef.h>
+#ifndef _WIN32
+#    include <pthread.h>
+#endif
 
+#include <aws/common/atomics.h>
 #include <aws/common/byte_order.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
 #include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/alloc_stats.h>
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/hkdf.h>
+#include <aws/cryptosdk/private/probes.h>
 
 #define MSG_ID_LEN 16
 
 const struct aws_cryptosdk_alg_properties *aws_cryptosdk_alg_props(enum aws_cryptosdk_alg_id alg_id) {
-#define EVP_NULL NULL
+#define aws_cryptosdk_priv_evp_NULL NULL
 #define STATIC_ALG_PROPS(alg_id_v, md, cipher, dk_len_v, iv_len_v, tag_len_v, signature_len_v, curve_name_v)   \
     case alg_id_v: {                                                                                           \
         static const struct aws_cryptosdk_alg_impl impl = {                                                    \
-            .md_ctor     = (EVP_##md),                                                                         \
-            .cipher_ctor = (EVP_##cipher),                                                                     \
+            .md_ctor     = (aws_cryptosdk_priv_evp_##md),                                                      \
+            .cipher_ctor = (aws_cryptosdk_priv_evp_##cipher),                                                  \
             .curve_name  = (curve_name_v),                                                                     \
         };                                                                                                     \
         static const struct aws_cryptosdk_alg_properties props = {                                             \
@@ -120,21 +130,102 @@ int aws_cryptosdk_derive_key(
     const struct data_key *data_key,
     const uint8_t *message_id) {
     aws_secure_zero(content_key->keybuf, sizeof(content_key->keybuf));
+    if (aws_cryptosdk_which_sha(props->alg_id) == AWS_CRYPTOSDK_NOSHA) {
+        memcpy(content_key->keybuf, data_key->keybuf, props->data_key_len);
+        return AWS_OP_SUCCESS;
+    }
+
+    struct aws_cryptosdk_hkdf_key hkdf_key;
+    if (aws_cryptosdk_data_key_hkdf_init(props, &hkdf_key, data_key)) return AWS_OP_ERR;
+    int rv = aws_cryptosdk_derive_key_from_hkdf(props, content_key, &hkdf_key, message_id);
+    aws_cryptosdk_hkdf_key_clean_up(&hkdf_key);
+
+    return rv;
+}
+
+int aws_cryptosdk_data_key_hkdf_init(
+    const struct aws_cryptosdk_alg_properties *props,
+    struct aws_cryptosdk_hkdf_key *hkdf_key,
+    const struct data_key *data_key) {
+    const struct aws_byte_buf mysalt = aws_byte_buf_from_c_str("");
+    const struct aws_byte_buf myikm  = aws_byte_buf_from_array(data_key->keybuf, props->data_key_len);
+
+    return aws_cryptosdk_hkdf_key_init(hkdf_key, aws_cryptosdk_which_sha(props->alg_id), &mysalt, &myikm);
+}
+
+int aws_cryptosdk_derive_key_from_hkdf(
+    const struct aws_cryptosdk_alg_properties *props,
+    struct content_key *content_key,
+    const struct aws_cryptosdk_hkdf_key *hkdf_key,
+    const uint8_t *message_id) {
+    aws_secure_zero(content_key->keybuf, sizeof(content_key->keybuf));
     uint8_t info[MSG_ID_LEN + 2];
     uint16_t alg_id = props->alg_id;
     info[0]         = alg_id >> 8;
     info[1]         = alg_id & 0xFF;
     memcpy(&info[2], message_id, sizeof(info) - 2);
-    enum aws_cryptosdk_sha_version which_sha = aws_cryptosdk_which_sha(props->alg_id);
-    if (which_sha == AWS_CRYPTOSDK_NOSHA) {
-        memcpy(content_key->keybuf, data_key->keybuf, props->data_key_len);
-        return AWS_OP_SUCCESS;
-    }
+
     struct aws_byte_buf myokm        = aws_byte_buf_from_array(content_key->keybuf, props->content_key_len);
-    const struct aws_byte_buf mysalt = aws_byte_buf_from_c_str("");
-    const struct aws_byte_buf myikm  = aws_byte_buf_from_array(data_key->keybuf, props->data_key_len);
     const struct aws_byte_buf myinfo = aws_byte_buf_from_array(info, MSG_ID_LEN + 2);
-    return aws_cryptosdk_hkdf(&myokm, which_sha, &mysalt, &myikm, &myinfo);
+    return aws_cryptosdk_hkdf_key_expand(hkdf_key, &myokm, &myinfo);
+}
+
+/* Number of content keys whose HKDF info is built on the stack for each call to expand them */
+#define DERIVE_KEYS_CHUNK 16
+
+int aws_cryptosdk_derive_keys_from_hkdf(
+    const struct aws_cryptosdk_alg_properties *props,
+    struct content_key *content_keys,
+    const struct aws_cryptosdk_hkdf_key *hkdf_key,
+    const uint8_t *const *message_ids,
+    size_t count) {
+    uint8_t info[DERIVE_KEYS_CHUNK][MSG_ID_LEN + 2];
+    struct aws_byte_buf okms[DERIVE_KEYS_CHUNK], infos[DERIVE_KEYS_CHUNK];
+    uint16_t alg_id = props->alg_id;
+    int rv          = AWS_OP_SUCCESS;
+
+    for (size_t base = 0; base < count && !rv; base += DERIVE_KEYS_CHUNK) {
+        size_t n = count - base < DERIVE_KEYS_CHUNK ? count - base : DERIVE_KEYS_CHUNK;
+
+        for (size_t i = 0; i < n; i++) {
+            struct content_key *content_key = &content_keys[base + i];
+
+            aws_secure_zero(content_key->keybuf, sizeof(content_key->keybuf));
+            info[i][0] = alg_id >> 8;
+            info[i][1] = alg_id & 0xFF;
+            memcpy(&info[i][2], message_ids[base + i], MSG_ID_LEN);
+            okms[i]  = aws_byte_buf_from_array(content_key->keybuf, props->content_key_len);
+            infos[i] = aws_byte_buf_from_array(info[i], MSG_ID_LEN + 2);
+        }
+        rv = aws_cryptosdk_hkdf_key_expand_many(hkdf_key, okms, infos, n);
+    }
+
+    if (rv) {
+        for (size_t i = 0; i < count; i++) aws_secure_zero(&content_keys[i], sizeof(content_keys[i]));
+    }
+    return rv;
+}
+
+int aws_cryptosdk_derive_keys(
+    const struct aws_cryptosdk_alg_properties *props,
+    struct content_key *content_keys,
+    const struct data_key *data_key,
+    const uint8_t *const *message_ids,
+    size_t count) {
+    if (aws_cryptosdk_which_sha(props->alg_id) == AWS_CRYPTOSDK_NOSHA) {
+        for (size_t i = 0; i < count; i++) {
+            aws_secure_zero(content_keys[i].keybuf, sizeof(content_keys[i].keybuf));
+            memcpy(content_keys[i].keybuf, data_key->keybuf, props->data_key_len);
+        }
+        return AWS_OP_SUCCESS;
+    }
+
+    struct aws_cryptosdk_hkdf_key hkdf_key;
+    if (aws_cryptosdk_data_key_hkdf_init(props, &hkdf_key, data_key)) return AWS_OP_ERR;
+    int rv = aws_cryptosdk_derive_keys_from_hkdf(props, content_keys, &hkdf_key, message_ids, count);
+    aws_cryptosdk_hkdf_key_clean_up(&hkdf_key);
+
+    return rv;
 }
 
 static EVP_CIPHER_CTX *evp_gcm_cipher_init(
@@ -275,180 +366,1223 @@ int aws_cryptosdk_verify_header(
 out:
     if (ctx) EVP_CIPHER_CTX_free(ctx);
 
-    if (result == AWS_ERROR_SUCCESS) {
-        return AWS_OP_SUCCESS;
-    } else {
-        return aws_raise_error(result);
+    if (result == AWS_ERROR_SUCCESS) {
+        return AWS_OP_SUCCESS;
+    } else {
+        return aws_raise_error(result);
+    }
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+/*
+ * On OpenSSL 3, EVP_aes_256_gcm() and the like return placeholders which are fetched from the
+ * providers on every use, under a process-wide lock. Instead, each algorithm is fetched once
+ * from the library context, the first time it is needed, and the handle is kept for the life
+ * of the process. Once anything has been fetched the library context can no longer change.
+ */
+static struct aws_atomic_var openssl_lib_ctx   = AWS_ATOMIC_VAR_PTRVAL(NULL);
+static struct aws_atomic_var lib_ctx_committed = AWS_ATOMIC_VAR_INTVAL(0);
+
+int aws_cryptosdk_set_openssl_lib_ctx(struct ossl_lib_ctx_st *lib_ctx) {
+    if (aws_atomic_load_int(&lib_ctx_committed)) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    aws_atomic_store_ptr(&openssl_lib_ctx, lib_ctx);
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Returns the handle cached in slot, fetching it if need be; NULL if the algorithm is unavailable */
+static void *fetch_cached(struct aws_atomic_var *slot, const char *name, bool is_md) {
+    void *handle = aws_atomic_load_ptr(slot);
+    if (handle) return handle;
+
+    aws_atomic_store_int(&lib_ctx_committed, 1);
+    OSSL_LIB_CTX *lib_ctx = aws_atomic_load_ptr(&openssl_lib_ctx);
+    if (is_md) {
+        handle = EVP_MD_fetch(lib_ctx, name, NULL);
+    } else {
+        handle = EVP_CIPHER_fetch(lib_ctx, name, NULL);
+    }
+    if (!handle) {
+        flush_openssl_errors();
+        return NULL;
+    }
+
+    void *expected = NULL;
+    if (!aws_atomic_compare_exchange_ptr(slot, &expected, handle)) {
+        // Another thread fetched it first; use theirs, so that every caller sees one handle
+        if (is_md) {
+            EVP_MD_free(handle);
+        } else {
+            EVP_CIPHER_free(handle);
+        }
+        handle = expected;
+    }
+
+    return handle;
+}
+
+#    define FETCHED_ALG(type, alg, name, is_md)                            \
+        const type *aws_cryptosdk_priv_evp_##alg(void) {                     \
+            static struct aws_atomic_var slot = AWS_ATOMIC_VAR_PTRVAL(NULL); \
+            return fetch_cached(&slot, name, is_md);                         \
+        }
+#else
+int aws_cryptosdk_set_openssl_lib_ctx(struct ossl_lib_ctx_st *lib_ctx) {
+    (void)lib_ctx;
+    return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+}
+
+/* Before OpenSSL 3, the built-in handles are static and need no lookup */
+#    define FETCHED_ALG(type, alg, name, is_md)        \
+        const type *aws_cryptosdk_priv_evp_##alg(void) { \
+            return EVP_##alg();                          \
+        }
+#endif
+
+FETCHED_ALG(EVP_CIPHER, aes_128_gcm, "AES-128-GCM", false)
+FETCHED_ALG(EVP_CIPHER, aes_192_gcm, "AES-192-GCM", false)
+FETCHED_ALG(EVP_CIPHER, aes_256_gcm, "AES-256-GCM", false)
+FETCHED_ALG(EVP_CIPHER, aes_128_ecb, "AES-128-ECB", false)
+FETCHED_ALG(EVP_CIPHER, aes_192_ecb, "AES-192-ECB", false)
+FETCHED_ALG(EVP_CIPHER, aes_256_ecb, "AES-256-ECB", false)
+FETCHED_ALG(EVP_MD, sha256, "SHA256", true)
+FETCHED_ALG(EVP_MD, sha384, "SHA384", true)
+FETCHED_ALG(EVP_MD, sha512, "SHA512", true)
+
+static const EVP_CIPHER *get_alg_from_key_size(size_t key_len) {
+    switch (key_len) {
+        case AWS_CRYPTOSDK_AES128: return aws_cryptosdk_priv_evp_aes_128_gcm();
+        case AWS_CRYPTOSDK_AES192: return aws_cryptosdk_priv_evp_aes_192_gcm();
+        case AWS_CRYPTOSDK_AES256: return aws_cryptosdk_priv_evp_aes_256_gcm();
+        default: return NULL;
+    }
+}
+
+// These implementations of AES-GCM encryption/decryption only support these tag/IV lengths
+static const size_t aes_gcm_tag_len = 16;
+static const size_t aes_gcm_iv_len  = 12;
+
+/* Bytes of body ciphertext between signature updates when stitching; comfortably cache-resident */
+#define STITCH_CHUNK_LEN 16384
+
+#define AAD_STRING(s) { (const uint8_t *)(s), sizeof(s) - 1 }
+
+/* Body AAD strings, indexed by frame type */
+static const struct {
+    const uint8_t *bytes;
+    size_t len;
+} frame_aad_strings[] = {
+    [FRAME_TYPE_SINGLE] = AAD_STRING("AWSKMSEncryptionClient Single Block"),
+    [FRAME_TYPE_FRAME]  = AAD_STRING("AWSKMSEncryptionClient Frame"),
+    [FRAME_TYPE_FINAL]  = AAD_STRING("AWSKMSEncryptionClient Final Frame"),
+};
+
+/*
+ * Serializes the body AAD for a frame into cipher_ctx->aad, reusing the message ID and frame
+ * type string left there by the previous frame when they match. Returns the AAD length, or
+ * zero if the frame type is invalid.
+ */
+static size_t build_frame_aad(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const uint8_t *message_id,
+    int body_frame_type,
+    uint32_t seqno,
+    uint64_t data_size) {
+    if (body_frame_type < FRAME_TYPE_SINGLE || body_frame_type > FRAME_TYPE_FINAL) {
+        return 0;
+    }
+
+    if (!cipher_ctx->aad_prefix_len || cipher_ctx->aad_frame_type != body_frame_type ||
+        memcmp(cipher_ctx->aad, message_id, MSG_ID_LEN)) {
+        size_t string_len = frame_aad_strings[body_frame_type].len;
+
+        memcpy(cipher_ctx->aad, message_id, MSG_ID_LEN);
+        memcpy(cipher_ctx->aad + MSG_ID_LEN, frame_aad_strings[body_frame_type].bytes, string_len);
+        cipher_ctx->aad_prefix_len = MSG_ID_LEN + string_len;
+        cipher_ctx->aad_frame_type = body_frame_type;
+    }
+
+    uint8_t *suffix   = cipher_ctx->aad + cipher_ctx->aad_prefix_len;
+    uint32_t seqno_be = aws_hton32(seqno);
+    uint64_t size_be  = aws_hton64(data_size);
+
+    memcpy(suffix, &seqno_be, sizeof(seqno_be));
+    memcpy(suffix + sizeof(seqno_be), &size_be, sizeof(size_be));
+
+    return cipher_ctx->aad_prefix_len + sizeof(seqno_be) + sizeof(size_be);
+}
+
+/*
+ * The built-in GCM provider, backed by OpenSSL EVP. The frame AAD is passed to OpenSSL in a
+ * single update call, to keep per-frame dispatch overhead down for small frames.
+ */
+static void *openssl_gcm_key_new(const uint8_t *key, size_t key_len, bool enc) {
+    const EVP_CIPHER *cipher = get_alg_from_key_size(key_len);
+    EVP_CIPHER_CTX *ctx      = NULL;
+
+    if (!cipher) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    /*
+     * We only set the key here; the IV is set once per frame when the context is used.
+     * This means the (relatively expensive) context allocation and key schedule setup
+     * happens once per message rather than once per frame.
+     */
+    if (!(ctx = EVP_CIPHER_CTX_new())) goto err;
+    if (!EVP_CipherInit_ex(ctx, cipher, NULL, NULL, NULL, (int)enc)) goto err;
+    if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, aes_gcm_iv_len, NULL)) goto err;
+    if (!EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, -1)) goto err;
+
+    return ctx;
+
+err:
+    if (ctx) {
+        EVP_CIPHER_CTX_free(ctx);
+    }
+    flush_openssl_errors();
+    aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    return NULL;
+}
+
+static void openssl_gcm_key_destroy(void *key_ctx) {
+    EVP_CIPHER_CTX_free(key_ctx);
+}
+
+/* Re-IVs the (already keyed) context, which also resets any GCM state from the previous frame */
+static bool openssl_gcm_start(EVP_CIPHER_CTX *ctx, const uint8_t *iv, const uint8_t *aad, size_t aad_len) {
+    int ignored;
+
+    return EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, -1) && aad_len <= INT_MAX &&
+           EVP_CipherUpdate(ctx, NULL, &ignored, aad, (int)aad_len);
+}
+
+static bool openssl_gcm_update(EVP_CIPHER_CTX *ctx, uint8_t *out, const uint8_t *in, size_t len) {
+    while (len) {
+        int in_len = len > INT_MAX ? INT_MAX : (int)len;
+        int out_len;
+
+        if (!EVP_CipherUpdate(ctx, out, &out_len, in, in_len)) return false;
+        if (out_len != in_len) {
+            /* None of the algorithms we support should break this invariant. abort() to limit the damage. */
+            abort();
+        }
+
+        out += in_len;
+        in += in_len;
+        len -= in_len;
+    }
+
+    return true;
+}
+
+static int openssl_gcm_seal_final(EVP_CIPHER_CTX *ctx, uint8_t *tag) {
+    int outlen;
+    uint8_t finalbuf;
+
+    if (!EVP_EncryptFinal_ex(ctx, &finalbuf, &outlen) ||
+        !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, aes_gcm_tag_len, (void *)tag)) {
+        flush_openssl_errors();
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    if (outlen != 0) {
+        abort();  // wrong output size - potentially smashed stack
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int openssl_gcm_seal(
+    void *key_ctx,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    uint8_t *tag) {
+    EVP_CIPHER_CTX *ctx = key_ctx;
+
+    if (!openssl_gcm_start(ctx, iv, aad, aad_len) || !openssl_gcm_update(ctx, out, in, len)) {
+        flush_openssl_errors();
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    return openssl_gcm_seal_final(ctx, tag);
+}
+
+static int openssl_gcm_open_final(EVP_CIPHER_CTX *ctx, const uint8_t *tag) {
+    if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, aes_gcm_tag_len, (void *)tag)) {
+        flush_openssl_errors();
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    /*
+     * Flush all error codes; if the GCM tag is invalid, openssl will fail without generating
+     * an error code, so any leftover error codes will get in the way of detection.
+     */
+    flush_openssl_errors();
+
+    int outlen;
+    uint8_t finalbuf;
+
+    if (!EVP_DecryptFinal_ex(ctx, &finalbuf, &outlen)) {
+        if (ERR_peek_last_error() == 0) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        }
+        flush_openssl_errors();
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    if (outlen != 0) {
+        abort();  // wrong output size - potentially smashed stack
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int openssl_gcm_open(
+    void *key_ctx,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    const uint8_t *tag) {
+    EVP_CIPHER_CTX *ctx = key_ctx;
+
+    if (!openssl_gcm_start(ctx, iv, aad, aad_len) || !openssl_gcm_update(ctx, out, in, len)) {
+        flush_openssl_errors();
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    return openssl_gcm_open_final(ctx, tag);
+}
+
+/*
+ * The stitched variants below feed each chunk of ciphertext to the signature right after it is
+ * produced (or right before it is consumed), while it is still in cache, so that large frames
+ * are read from memory once rather than twice.
+ */
+static int openssl_gcm_seal_and_digest(
+    EVP_CIPHER_CTX *ctx,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    uint8_t *tag,
+    struct aws_cryptosdk_sig_ctx *signctx) {
+    if (!openssl_gcm_start(ctx, iv, aad, aad_len)) goto err;
+
+    for (size_t offset = 0; offset < len; offset += STITCH_CHUNK_LEN) {
+        size_t chunk_len = len - offset < STITCH_CHUNK_LEN ? len - offset : STITCH_CHUNK_LEN;
+
+        if (!openssl_gcm_update(ctx, out + offset, in + offset, chunk_len)) goto err;
+        if (aws_cryptosdk_sig_update(signctx, aws_byte_cursor_from_array(out + offset, chunk_len))) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    return openssl_gcm_seal_final(ctx, tag);
+
+err:
+    flush_openssl_errors();
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+}
+
+static int openssl_gcm_open_and_digest(
+    EVP_CIPHER_CTX *ctx,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    const uint8_t *tag,
+    struct aws_cryptosdk_sig_ctx *signctx) {
+    if (!openssl_gcm_start(ctx, iv, aad, aad_len)) goto err;
+
+    for (size_t offset = 0; offset < len; offset += STITCH_CHUNK_LEN) {
+        size_t chunk_len = len - offset < STITCH_CHUNK_LEN ? len - offset : STITCH_CHUNK_LEN;
+
+        // The output may alias the input, so the ciphertext is hashed first
+        if (aws_cryptosdk_sig_update(signctx, aws_byte_cursor_from_array(in + offset, chunk_len))) {
+            return AWS_OP_ERR;
+        }
+        if (!openssl_gcm_update(ctx, out + offset, in + offset, chunk_len)) goto err;
+    }
+
+    return openssl_gcm_open_final(ctx, tag);
+
+err:
+    flush_openssl_errors();
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+}
+
+/*
+ * Verify-only frames are checked without running AES-CTR over them. The GCM tag of (A, C) is
+ * GHASH_H(A || pad || C || pad || L) XOR E_K(J0), where L holds the bit lengths of A and C. Passing
+ * A, its padding and C all to OpenSSL as AAD, with no plaintext, hashes the same blocks but for the
+ * final one, which becomes L'. GHASH multiplies that block by H alone, so the two tags differ by
+ * (L XOR L') * H; the expected tag is adjusted by that much, and OpenSSL compares it as usual.
+ */
+
+/* Sets z to x * y in the (bit-reflected) field of GHASH, in time independent of y */
+static void gf128_mul(uint8_t *z, const uint8_t *x, const uint8_t *y) {
+    uint8_t v[16], acc[16] = { 0 };
+
+    memcpy(v, y, sizeof(v));
+    for (int i = 0; i < 128; i++) {
+        uint8_t bit_mask   = (uint8_t)(0 - ((x[i / 8] >> (7 - i % 8)) & 1));
+        uint8_t carry_mask = (uint8_t)(0 - (v[15] & 1));
+
+        for (int j = 0; j < 16; j++) acc[j] ^= v[j] & bit_mask;
+        for (int j = 15; j > 0; j--) v[j] = (uint8_t)((v[j] >> 1) | (v[j - 1] << 7));
+        v[0] = (uint8_t)((v[0] >> 1) ^ (0xE1 & carry_mask));
+    }
+
+    memcpy(z, acc, sizeof(acc));
+    aws_secure_zero(v, sizeof(v));
+    aws_secure_zero(acc, sizeof(acc));
+}
+
+/* Writes the GHASH key for key, the encryption of the all-zero block, to hash_key */
+static int openssl_gcm_hash_key(uint8_t *hash_key, const uint8_t *key, size_t key_len) {
+    static const uint8_t zero_block[16] = { 0 };
+    const EVP_CIPHER *cipher;
+    int outlen = 0;
+
+    switch (key_len) {
+        case AWS_CRYPTOSDK_AES128: cipher = aws_cryptosdk_priv_evp_aes_128_ecb(); break;
+        case AWS_CRYPTOSDK_AES192: cipher = aws_cryptosdk_priv_evp_aes_192_ecb(); break;
+        case AWS_CRYPTOSDK_AES256: cipher = aws_cryptosdk_priv_evp_aes_256_ecb(); break;
+        default: return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    EVP_CIPHER_CTX *ctx = cipher ? EVP_CIPHER_CTX_new() : NULL;
+    bool ok = ctx && EVP_EncryptInit_ex(ctx, cipher, NULL, key, NULL) && EVP_CIPHER_CTX_set_padding(ctx, 0) &&
+              EVP_EncryptUpdate(ctx, hash_key, &outlen, zero_block, sizeof(zero_block)) &&
+              outlen == sizeof(zero_block);
+
+    if (ctx) EVP_CIPHER_CTX_free(ctx);
+    if (!ok) {
+        aws_secure_zero(hash_key, sizeof(zero_block));
+        flush_openssl_errors();
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int openssl_gcm_verify_and_digest(
+    EVP_CIPHER_CTX *ctx,
+    const uint8_t *hash_key,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    const uint8_t *tag,
+    struct aws_cryptosdk_sig_ctx *signctx) {
+    static const uint8_t zero_pad[16] = { 0 };
+    size_t pad_len = (sizeof(zero_pad) - aad_len % sizeof(zero_pad)) % sizeof(zero_pad);
+    uint64_t lengths_be[2], hashed_be[2];
+    uint8_t delta[16], adjusted_tag[16];
+    int ignored;
+
+    lengths_be[0] = aws_hton64((uint64_t)aad_len * 8);
+    lengths_be[1] = aws_hton64((uint64_t)len * 8);
+    hashed_be[0]  = aws_hton64(((uint64_t)aad_len + pad_len + len) * 8);
+    hashed_be[1]  = 0;
+    memcpy(delta, lengths_be, sizeof(lengths_be));
+    for (size_t i = 0; i < sizeof(delta); i++) delta[i] ^= ((const uint8_t *)hashed_be)[i];
+
+    gf128_mul(adjusted_tag, delta, hash_key);
+    for (size_t i = 0; i < sizeof(adjusted_tag); i++) adjusted_tag[i] ^= tag[i];
+
+    if (!openssl_gcm_start(ctx, iv, aad, aad_len) ||
+        (pad_len && !EVP_CipherUpdate(ctx, NULL, &ignored, zero_pad, (int)pad_len))) {
+        goto err;
+    }
+
+    for (size_t offset = 0; offset < len; offset += STITCH_CHUNK_LEN) {
+        size_t chunk_len = len - offset < STITCH_CHUNK_LEN ? len - offset : STITCH_CHUNK_LEN;
+
+        if (signctx && aws_cryptosdk_sig_update(signctx, aws_byte_cursor_from_array(in + offset, chunk_len))) {
+            aws_secure_zero(adjusted_tag, sizeof(adjusted_tag));
+            return AWS_OP_ERR;
+        }
+        if (!EVP_CipherUpdate(ctx, NULL, &ignored, in + offset, (int)chunk_len)) goto err;
+    }
+
+    int rv = openssl_gcm_open_final(ctx, adjusted_tag);
+    aws_secure_zero(adjusted_tag, sizeof(adjusted_tag));
+
+    return rv;
+
+err:
+    aws_secure_zero(adjusted_tag, sizeof(adjusted_tag));
+    flush_openssl_errors();
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+}
+
+const struct aws_cryptosdk_gcm_provider_vt *aws_cryptosdk_gcm_provider_openssl(void) {
+    static const struct aws_cryptosdk_gcm_provider_vt provider = {
+        .vt_size     = sizeof(struct aws_cryptosdk_gcm_provider_vt),
+        .name        = "OpenSSL EVP AES-GCM",
+        .key_new     = openssl_gcm_key_new,
+        .key_destroy = openssl_gcm_key_destroy,
+        .seal        = openssl_gcm_seal,
+        .open        = openssl_gcm_open,
+    };
+
+    return &provider;
+}
+
+bool aws_cryptosdk_gcm_provider_has_many(const struct aws_cryptosdk_gcm_provider_vt *provider) {
+    size_t needed = offsetof(struct aws_cryptosdk_gcm_provider_vt, open_many) + sizeof(provider->open_many);
+
+    return provider && provider->vt_size >= needed && provider->seal_many && provider->open_many;
+}
+
+bool aws_cryptosdk_priv_gcm_provider_is_complete(const struct aws_cryptosdk_gcm_provider_vt *provider) {
+    return provider && provider->vt_size >= offsetof(struct aws_cryptosdk_gcm_provider_vt, seal_many) &&
+           provider->vt_size <= sizeof(*provider) && provider->key_new && provider->key_destroy && provider->seal &&
+           provider->open;
+}
+
+static const struct aws_cryptosdk_body_codec *body_codec_for(const struct aws_cryptosdk_gcm_provider_vt *provider);
+
+int aws_cryptosdk_cipher_ctx_init(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const struct aws_cryptosdk_gcm_provider_vt *provider,
+    const struct aws_cryptosdk_alg_properties *props,
+    const struct content_key *key,
+    bool enc) {
+    if (!provider) {
+        provider = aws_cryptosdk_gcm_provider_openssl();
+    }
+
+    cipher_ctx->provider       = provider;
+    cipher_ctx->codec          = body_codec_for(provider);
+    cipher_ctx->props          = props;
+    cipher_ctx->enc            = enc;
+    cipher_ctx->aad_prefix_len = 0;
+    cipher_ctx->has_hash_key   = false;
+
+    if (props->iv_len != aes_gcm_iv_len || props->tag_len != aes_gcm_tag_len) {
+        cipher_ctx->key_ctx = NULL;
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    if (!(cipher_ctx->key_ctx = provider->key_new(key->keybuf, props->content_key_len, enc))) {
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_cipher_ctx_enable_verify_only(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx, const struct content_key *key) {
+    if (!cipher_ctx->key_ctx || cipher_ctx->enc) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    // Other providers' key contexts are opaque, so there is no way to feed them ciphertext as AAD
+    if (cipher_ctx->provider != aws_cryptosdk_gcm_provider_openssl()) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    if (openssl_gcm_hash_key(cipher_ctx->hash_key, key->keybuf, cipher_ctx->props->content_key_len)) {
+        return AWS_OP_ERR;
+    }
+    cipher_ctx->has_hash_key = true;
+
+    return AWS_OP_SUCCESS;
+}
+
+void aws_cryptosdk_cipher_ctx_clean_up(struct aws_cryptosdk_cipher_ctx *cipher_ctx) {
+    if (cipher_ctx->key_ctx) {
+        cipher_ctx->provider->key_destroy(cipher_ctx->key_ctx);
+    }
+
+    cipher_ctx->key_ctx        = NULL;
+    cipher_ctx->props          = NULL;
+    cipher_ctx->aad_prefix_len = 0;
+    cipher_ctx->has_hash_key   = false;
+    aws_secure_zero(cipher_ctx->hash_key, sizeof(cipher_ctx->hash_key));
+}
+
+int aws_cryptosdk_sign_header_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const struct aws_byte_buf *authtag,
+    const struct aws_byte_buf *header) {
+    const struct aws_cryptosdk_alg_properties *props = cipher_ctx->props;
+    uint8_t no_plaintext;
+
+    if (!cipher_ctx->key_ctx || !cipher_ctx->enc || authtag->len != props->iv_len + props->tag_len) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    uint8_t *iv  = authtag->buffer;
+    uint8_t *tag = authtag->buffer + props->iv_len;
+
+    // As in aws_cryptosdk_sign_header, the header IV is always all-zero
+    aws_secure_zero(iv, props->iv_len);
+
+    // The tag is that of an empty plaintext with the header as AAD
+    return cipher_ctx->provider->seal(
+        cipher_ctx->key_ctx, &no_plaintext, &no_plaintext, 0, iv, header->buffer, header->len, tag);
+}
+
+int aws_cryptosdk_verify_header_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const struct aws_byte_buf *authtag,
+    const struct aws_byte_buf *header) {
+    const struct aws_cryptosdk_alg_properties *props = cipher_ctx->props;
+    uint8_t no_plaintext;
+
+    if (!cipher_ctx->key_ctx) return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    if (authtag->len != props->iv_len + props->tag_len) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+
+    const uint8_t *iv  = authtag->buffer;
+    const uint8_t *tag = authtag->buffer + props->iv_len;
+
+    if (!cipher_ctx->enc) {
+        return cipher_ctx->provider->open(
+            cipher_ctx->key_ctx, &no_plaintext, &no_plaintext, 0, iv, header->buffer, header->len, tag);
+    }
+
+    // A context keyed for encryption recomputes the tag, and compares it in constant time; keyed
+    // contexts only ever have 16-byte tags
+    uint8_t expected[16];
+    if (cipher_ctx->provider->seal(
+            cipher_ctx->key_ctx, &no_plaintext, &no_plaintext, 0, iv, header->buffer, header->len, expected)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+    int differs = CRYPTO_memcmp(expected, tag, props->tag_len);
+    aws_secure_zero(expected, sizeof(expected));
+
+    return differs ? aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT) : AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_encrypt_body(
+    const struct aws_cryptosdk_alg_properties *props,
+    struct aws_byte_buf *outp,
+    const struct aws_byte_cursor *inp,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    uint8_t *iv,
+    const struct content_key *key,
+    uint8_t *tag,
+    int body_frame_type) {
+    struct aws_cryptosdk_cipher_ctx cipher_ctx;
+
+    if (aws_cryptosdk_cipher_ctx_init(&cipher_ctx, NULL, props, key, true)) {
+        aws_byte_buf_secure_zero(outp);
+        return AWS_OP_ERR;
+    }
+
+    int rv = aws_cryptosdk_encrypt_body_with_ctx(&cipher_ctx, outp, inp, message_id, seqno, iv, tag, body_frame_type);
+
+    aws_cryptosdk_cipher_ctx_clean_up(&cipher_ctx);
+
+    return rv;
+}
+
+int aws_cryptosdk_encrypt_body_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    struct aws_byte_buf *outp,
+    const struct aws_byte_cursor *inp,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    uint8_t *iv,
+    uint8_t *tag,
+    int body_frame_type) {
+    struct aws_byte_cursor no_frame = { 0 };
+
+    return aws_cryptosdk_encrypt_body_and_digest(
+        cipher_ctx, outp, inp, message_id, seqno, iv, tag, body_frame_type, NULL, no_frame);
+}
+
+/* Feeds the bytes from start up to end to signctx */
+static int digest_span(struct aws_cryptosdk_sig_ctx *signctx, const uint8_t *start, const uint8_t *end) {
+    return aws_cryptosdk_sig_update(signctx, aws_byte_cursor_from_array(start, end - start));
+}
+
+/*
+ * Frame body routines for the built-in provider, which call OpenSSL directly; with a signature
+ * to update, the ciphertext is digested chunk by chunk as it is produced or consumed.
+ */
+static int openssl_body_seal(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    uint8_t *tag,
+    struct aws_cryptosdk_sig_ctx *signctx) {
+    if (signctx) {
+        return openssl_gcm_seal_and_digest(cipher_ctx->key_ctx, out, in, len, iv, aad, aad_len, tag, signctx);
+    }
+
+    return openssl_gcm_seal(cipher_ctx->key_ctx, out, in, len, iv, aad, aad_len, tag);
+}
+
+static int openssl_body_open(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    const uint8_t *tag,
+    struct aws_cryptosdk_sig_ctx *signctx) {
+    if (signctx) {
+        return openssl_gcm_open_and_digest(cipher_ctx->key_ctx, out, in, len, iv, aad, aad_len, tag, signctx);
+    }
+
+    return openssl_gcm_open(cipher_ctx->key_ctx, out, in, len, iv, aad, aad_len, tag);
+}
+
+/* Frame body routines for other providers, which seal and open each frame whole */
+static int provider_body_seal(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    uint8_t *tag,
+    struct aws_cryptosdk_sig_ctx *signctx) {
+    if (cipher_ctx->provider->seal(cipher_ctx->key_ctx, out, in, len, iv, aad, aad_len, tag)) return AWS_OP_ERR;
+
+    // The ciphertext is hashed afterwards
+    return signctx ? aws_cryptosdk_sig_update(signctx, aws_byte_cursor_from_array(out, len)) : AWS_OP_SUCCESS;
+}
+
+static int provider_body_open(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    const uint8_t *tag,
+    struct aws_cryptosdk_sig_ctx *signctx) {
+    if (signctx && aws_cryptosdk_sig_update(signctx, aws_byte_cursor_from_array(in, len))) return AWS_OP_ERR;
+
+    return cipher_ctx->provider->open(cipher_ctx->key_ctx, out, in, len, iv, aad, aad_len, tag);
+}
+
+struct aws_cryptosdk_body_codec {
+    int (*seal)(
+        struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+        uint8_t *out,
+        const uint8_t *in,
+        size_t len,
+        const uint8_t *iv,
+        const uint8_t *aad,
+        size_t aad_len,
+        uint8_t *tag,
+        struct aws_cryptosdk_sig_ctx *signctx);
+    int (*open)(
+        struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+        uint8_t *out,
+        const uint8_t *in,
+        size_t len,
+        const uint8_t *iv,
+        const uint8_t *aad,
+        size_t aad_len,
+        const uint8_t *tag,
+        struct aws_cryptosdk_sig_ctx *signctx);
+};
+
+static const struct aws_cryptosdk_body_codec openssl_body_codec = { .seal = openssl_body_seal,
+                                                                    .open = openssl_body_open };
+static const struct aws_cryptosdk_body_codec provider_body_codec = { .seal = provider_body_seal,
+                                                                     .open = provider_body_open };
+
+static const struct aws_cryptosdk_body_codec *body_codec_for(const struct aws_cryptosdk_gcm_provider_vt *provider) {
+    return provider == aws_cryptosdk_gcm_provider_openssl() ? &openssl_body_codec : &provider_body_codec;
+}
+
+/* Writes the IV of frame seqno into iv */
+static int build_frame_iv(uint32_t seqno, uint8_t *iv) {
+    /*
+     * We use a deterministic IV generation algorithm; the frame sequence number
+     * is used for the IV. To avoid collisions with the header IV, seqno=0 is
+     * forbidden.
+     */
+    if (seqno == 0) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    uint64_t iv_seq = aws_hton64(seqno);
+
+    // Cipher contexts are only keyed for suites with 12-byte IVs, so the layout is fixed
+    memset(iv, 0, aes_gcm_iv_len - sizeof(iv_seq));
+    memcpy(iv + aes_gcm_iv_len - sizeof(iv_seq), &iv_seq, sizeof(iv_seq));
+
+    return AWS_OP_SUCCESS;
+}
+
+static int seal_frame(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    struct aws_byte_buf *outp,
+    const struct aws_byte_cursor *inp,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    uint8_t *iv,
+    uint8_t *tag,
+    int body_frame_type,
+    struct aws_cryptosdk_sig_ctx *signctx,
+    struct aws_byte_cursor frame) {
+    if (inp->len != outp->capacity) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
+
+    if (!cipher_ctx->key_ctx || !cipher_ctx->enc) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (build_frame_iv(seqno, iv)) {
+        return AWS_OP_ERR;
+    }
+
+    size_t aad_len     = build_frame_aad(cipher_ctx, message_id, body_frame_type, seqno, inp->len);
+    const uint8_t *aad = cipher_ctx->aad;
+
+    if (!aad_len) {
+        aws_byte_buf_secure_zero(outp);
+        return aws_raise_error(AWS_ERROR_UNKNOWN);
+    }
+
+    // The frame header, which holds the IV just written, is digested ahead of the body
+    if ((signctx && digest_span(signctx, frame.ptr, outp->buffer)) ||
+        cipher_ctx->codec->seal(cipher_ctx, outp->buffer, inp->ptr, inp->len, iv, aad, aad_len, tag, signctx) ||
+        (signctx && digest_span(signctx, outp->buffer + inp->len, frame.ptr + frame.len))) {
+        aws_byte_buf_secure_zero(outp);
+        return AWS_OP_ERR;
+    }
+
+    outp->len = inp->len;
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_encrypt_body_and_digest(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    struct aws_byte_buf *outp,
+    const struct aws_byte_cursor *inp,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    uint8_t *iv,
+    uint8_t *tag,
+    int body_frame_type,
+    struct aws_cryptosdk_sig_ctx *signctx,
+    struct aws_byte_cursor frame) {
+    AWS_CRYPTOSDK_PROBE2(frame_encrypt_start, seqno, inp->len);
+    int rv = seal_frame(cipher_ctx, outp, inp, message_id, seqno, iv, tag, body_frame_type, signctx, frame);
+    AWS_CRYPTOSDK_PROBE3(frame_encrypt_end, seqno, inp->len, rv ? aws_last_error() : 0);
+
+    return rv;
+}
+
+int aws_cryptosdk_decrypt_body(
+    const struct aws_cryptosdk_alg_properties *props,
+    struct aws_byte_buf *outp,
+    const struct aws_byte_cursor *inp,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    const uint8_t *iv,
+    const struct content_key *key,
+    const uint8_t *tag,
+    int body_frame_type) {
+    struct aws_cryptosdk_cipher_ctx cipher_ctx;
+
+    if (inp->len != outp->capacity - outp->len) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
+
+    if (aws_cryptosdk_cipher_ctx_init(&cipher_ctx, NULL, props, key, false)) {
+        aws_byte_buf_secure_zero(outp);
+        return AWS_OP_ERR;
+    }
+
+    int rv = aws_cryptosdk_decrypt_body_with_ctx(&cipher_ctx, outp, inp, message_id, seqno, iv, tag, body_frame_type);
+
+    aws_cryptosdk_cipher_ctx_clean_up(&cipher_ctx);
+
+    return rv;
+}
+
+int aws_cryptosdk_decrypt_body_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    struct aws_byte_buf *outp,
+    const struct aws_byte_cursor *inp,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    const uint8_t *iv,
+    const uint8_t *tag,
+    int body_frame_type) {
+    struct aws_byte_cursor no_frame = { 0 };
+
+    return aws_cryptosdk_decrypt_body_and_digest(
+        cipher_ctx, outp, inp, message_id, seqno, iv, tag, body_frame_type, NULL, no_frame);
+}
+
+static int open_frame(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    struct aws_byte_buf *outp,
+    const struct aws_byte_cursor *inp,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    const uint8_t *iv,
+    const uint8_t *tag,
+    int body_frame_type,
+    struct aws_cryptosdk_sig_ctx *signctx,
+    struct aws_byte_cursor frame) {
+    if (inp->len != outp->capacity - outp->len) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
+
+    if (!cipher_ctx->key_ctx || cipher_ctx->enc) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    size_t aad_len     = build_frame_aad(cipher_ctx, message_id, body_frame_type, seqno, inp->len);
+    const uint8_t *aad = cipher_ctx->aad;
+
+    if (!aad_len) {
+        aws_byte_buf_secure_zero(outp);
+        return aws_raise_error(AWS_ERROR_UNKNOWN);
+    }
+
+    uint8_t *out = outp->buffer + outp->len;
+
+    if ((signctx && digest_span(signctx, frame.ptr, inp->ptr)) ||
+        cipher_ctx->codec->open(cipher_ctx, out, inp->ptr, inp->len, iv, aad, aad_len, tag, signctx) ||
+        (signctx && digest_span(signctx, inp->ptr + inp->len, frame.ptr + frame.len))) {
+        aws_byte_buf_secure_zero(outp);
+        return AWS_OP_ERR;
+    }
+
+    outp->len += inp->len;
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_decrypt_body_and_digest(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    struct aws_byte_buf *outp,
+    const struct aws_byte_cursor *inp,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    const uint8_t *iv,
+    const uint8_t *tag,
+    int body_frame_type,
+    struct aws_cryptosdk_sig_ctx *signctx,
+    struct aws_byte_cursor frame) {
+    AWS_CRYPTOSDK_PROBE2(frame_decrypt_start, seqno, inp->len);
+    int rv = open_frame(cipher_ctx, outp, inp, message_id, seqno, iv, tag, body_frame_type, signctx, frame);
+    AWS_CRYPTOSDK_PROBE3(frame_decrypt_end, seqno, inp->len, rv ? aws_last_error() : 0);
+
+    return rv;
+}
+
+int aws_cryptosdk_verify_body_and_digest(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const struct aws_byte_cursor *inp,
+    const uint8_t *message_id,
+    uint32_t seqno,
+    const uint8_t *iv,
+    const uint8_t *tag,
+    int body_frame_type,
+    struct aws_cryptosdk_sig_ctx *signctx,
+    struct aws_byte_cursor frame) {
+    if (!cipher_ctx->key_ctx || cipher_ctx->enc || !cipher_ctx->has_hash_key) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    size_t aad_len = build_frame_aad(cipher_ctx, message_id, body_frame_type, seqno, inp->len);
+    if (!aad_len) {
+        return aws_raise_error(AWS_ERROR_UNKNOWN);
     }
-}
 
-static int update_frame_aad(
-    EVP_CIPHER_CTX *ctx, const uint8_t *message_id, int body_frame_type, uint32_t seqno, uint64_t data_size) {
-    const char *aad_string;
+    const uint8_t *aad      = cipher_ctx->aad;
+    const uint8_t *hash_key = cipher_ctx->hash_key;
 
-    switch (body_frame_type) {
-        case FRAME_TYPE_SINGLE: aad_string = "AWSKMSEncryptionClient Single Block"; break;
-        case FRAME_TYPE_FRAME: aad_string = "AWSKMSEncryptionClient Frame"; break;
-        case FRAME_TYPE_FINAL: aad_string = "AWSKMSEncryptionClient Final Frame"; break;
-        default: return aws_raise_error(AWS_ERROR_UNKNOWN);
+    AWS_CRYPTOSDK_PROBE2(frame_decrypt_start, seqno, inp->len);
+    int rv = AWS_OP_SUCCESS;
+    if ((signctx && digest_span(signctx, frame.ptr, inp->ptr)) ||
+        openssl_gcm_verify_and_digest(
+            cipher_ctx->key_ctx, hash_key, inp->ptr, inp->len, iv, aad, aad_len, tag, signctx) ||
+        (signctx && digest_span(signctx, inp->ptr + inp->len, frame.ptr + frame.len))) {
+        rv = AWS_OP_ERR;
     }
+    AWS_CRYPTOSDK_PROBE3(frame_decrypt_end, seqno, inp->len, rv ? aws_last_error() : 0);
 
-    int ignored;
+    return rv;
+}
 
-    if (!EVP_CipherUpdate(ctx, NULL, &ignored, message_id, MSG_ID_LEN)) return 0;
-    if (!EVP_CipherUpdate(ctx, NULL, &ignored, (const uint8_t *)aad_string, strlen(aad_string))) return 0;
+/*
+ * Checks the buffers of a frame for aws_cryptosdk_encrypt_bodies_with_ctx or its decrypt
+ * counterpart and fills in the provider operation for it, serializing its AAD into aad.
+ */
+static int prepare_body_op(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const uint8_t *message_id,
+    const struct aws_cryptosdk_body_op *op,
+    uint8_t *aad,
+    struct aws_cryptosdk_gcm_op *gcm_op) {
+    size_t avail = op->out->capacity - (cipher_ctx->enc ? 0 : op->out->len);
 
-    seqno = aws_hton32(seqno);
-    if (!EVP_CipherUpdate(ctx, NULL, &ignored, (const uint8_t *)&seqno, sizeof(seqno))) return 0;
+    if (op->in->len != avail) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
 
-    uint32_t size[2];
+    if (cipher_ctx->enc && build_frame_iv(op->seqno, op->iv)) {
+        return AWS_OP_ERR;
+    }
 
-    size[0] = aws_hton32(data_size >> 32);
-    size[1] = aws_hton32(data_size & 0xFFFFFFFFUL);
+    size_t aad_len = build_frame_aad(cipher_ctx, message_id, op->body_frame_type, op->seqno, op->in->len);
+    if (!aad_len) {
+        return aws_raise_error(AWS_ERROR_UNKNOWN);
+    }
+    memcpy(aad, cipher_ctx->aad, aad_len);
+
+    gcm_op->key_ctx = cipher_ctx->key_ctx;
+    gcm_op->out     = op->out->buffer + (cipher_ctx->enc ? 0 : op->out->len);
+    gcm_op->in      = op->in->ptr;
+    gcm_op->len     = op->in->len;
+    gcm_op->iv      = op->iv;
+    gcm_op->aad     = aad;
+    gcm_op->aad_len = aad_len;
+    gcm_op->tag     = op->tag;
+    gcm_op->error   = AWS_ERROR_SUCCESS;
 
-    return EVP_CipherUpdate(ctx, NULL, &ignored, (const uint8_t *)size, sizeof(size));
+    return AWS_OP_SUCCESS;
 }
 
-int aws_cryptosdk_encrypt_body(
-    const struct aws_cryptosdk_alg_properties *props,
-    struct aws_byte_buf *outp,
-    const struct aws_byte_cursor *inp,
-    const uint8_t *message_id,
-    uint32_t seqno,
-    uint8_t *iv,
-    const struct content_key *key,
-    uint8_t *tag,
-    int body_frame_type) {
-    if (inp->len != outp->capacity) {
-        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+/* Runs up to AWS_CRYPTOSDK_GCM_MAX_OPS prepared operations, leaving the outcome of each in its error */
+static void run_gcm_ops(struct aws_cryptosdk_cipher_ctx *cipher_ctx, struct aws_cryptosdk_gcm_op *ops, size_t count) {
+    const struct aws_cryptosdk_gcm_provider_vt *provider = cipher_ctx->provider;
+
+    if (count > 1) {
+        (cipher_ctx->enc ? provider->seal_many : provider->open_many)(ops, count);
+        return;
     }
 
-    /*
-     * We use a deterministic IV generation algorithm; the frame sequence number
-     * is used for the IV. To avoid collisions with the header IV, seqno=0 is
-     * forbidden.
-     */
-    if (seqno == 0) {
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    // The many entry points take at least two operations, so a lone frame goes through seal or open
+    struct aws_cryptosdk_gcm_op *op = &ops[0];
+    int rv;
+
+    if (cipher_ctx->enc) {
+        rv = provider->seal(op->key_ctx, op->out, op->in, op->len, op->iv, op->aad, op->aad_len, op->tag);
+    } else {
+        rv = provider->open(op->key_ctx, op->out, op->in, op->len, op->iv, op->aad, op->aad_len, op->tag);
     }
+    op->error = rv ? aws_last_error() : AWS_ERROR_SUCCESS;
+}
 
-    uint64_t iv_seq = aws_hton64(seqno);
+static int process_bodies(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const uint8_t *message_id,
+    struct aws_cryptosdk_body_op *ops,
+    size_t count,
+    bool enc) {
+    struct aws_cryptosdk_gcm_op gcm_ops[AWS_CRYPTOSDK_GCM_MAX_OPS];
+    uint8_t aads[AWS_CRYPTOSDK_GCM_MAX_OPS][MAX_FRAME_AAD_LEN];
+    struct aws_cryptosdk_body_op *pending[AWS_CRYPTOSDK_GCM_MAX_OPS];
+    int error = AWS_ERROR_SUCCESS;
 
-    /*
-     * Paranoid check to make sure we're not going to walk off the end of the IV
-     * buffer if someone in the future introduces an algorithm with a really small
-     * IV for some reason.
-     */
-    if (props->iv_len < sizeof(iv_seq)) {
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    if (!cipher_ctx->key_ctx || cipher_ctx->enc != enc) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
     }
 
-    aws_secure_zero(iv, props->iv_len);
+    for (size_t i = 0; i < count;) {
+        size_t n = 0;
+
+        for (; i < count && n < AWS_CRYPTOSDK_GCM_MAX_OPS; i++) {
+            if (prepare_body_op(cipher_ctx, message_id, &ops[i], aads[n], &gcm_ops[n])) {
+                ops[i].error = aws_last_error();
+                aws_byte_buf_secure_zero(ops[i].out);
+                if (!error) error = ops[i].error;
+                continue;
+            }
+            pending[n++] = &ops[i];
+        }
+        if (!n) continue;
 
-    uint8_t *iv_seq_p = iv + props->iv_len - sizeof(iv_seq);
-    memcpy(iv_seq_p, &iv_seq, sizeof(iv_seq));
+        run_gcm_ops(cipher_ctx, gcm_ops, n);
 
-    EVP_CIPHER_CTX *ctx = NULL;
+        for (size_t j = 0; j < n; j++) {
+            struct aws_cryptosdk_body_op *op = pending[j];
 
-    int result = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
+            op->error = gcm_ops[j].error;
+            if (op->error) {
+                aws_byte_buf_secure_zero(op->out);
+                if (!error) error = op->error;
+            } else {
+                op->out->len = enc ? op->in->len : op->out->len + op->in->len;
+            }
+        }
+    }
 
-    if (!(ctx = evp_gcm_cipher_init(props, key, iv, true))) goto out;
-    if (!update_frame_aad(ctx, message_id, body_frame_type, seqno, inp->len)) goto out;
+    aws_secure_zero(aads, sizeof(aads));
 
-    struct aws_byte_buf outbuf    = *outp;
-    struct aws_byte_cursor incurs = *inp;
+    return error ? aws_raise_error(error) : AWS_OP_SUCCESS;
+}
 
-    while (incurs.len) {
-        if (incurs.len != outbuf.capacity - outbuf.len) {
-            /*
-             * None of the algorithms we currently support should break this invariant.
-             * Bail out immediately with an unknown error.
-             */
-            goto out;
+/* Runs the frames one at a time, for providers without seal_many and open_many */
+static int process_bodies_serially(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const uint8_t *message_id,
+    struct aws_cryptosdk_body_op *ops,
+    size_t count,
+    bool enc) {
+    int error = AWS_ERROR_SUCCESS;
+
+    for (size_t i = 0; i < count; i++) {
+        struct aws_cryptosdk_body_op *op = &ops[i];
+        int rv;
+
+        if (enc) {
+            rv = aws_cryptosdk_encrypt_body_with_ctx(
+                cipher_ctx, op->out, op->in, message_id, op->seqno, op->iv, op->tag, op->body_frame_type);
+        } else {
+            rv = aws_cryptosdk_decrypt_body_with_ctx(
+                cipher_ctx, op->out, op->in, message_id, op->seqno, op->iv, op->tag, op->body_frame_type);
         }
 
-        int in_len = incurs.len > INT_MAX ? INT_MAX : incurs.len;
-        int ct_len;
+        op->error = rv ? aws_last_error() : AWS_ERROR_SUCCESS;
+        if (op->error && !error) error = op->error;
+    }
 
-        if (!EVP_EncryptUpdate(ctx, outbuf.buffer + outbuf.len, &ct_len, incurs.ptr, in_len)) goto out;
-        /*
-         * The next two advances should never fail ... but check the return values
-         * just in case.
-         */
-        if (!aws_byte_cursor_advance_nospec(&incurs, in_len).ptr) goto out;
-        outbuf.len += ct_len;
+    return error ? aws_raise_error(error) : AWS_OP_SUCCESS;
+}
 
-        if (outbuf.capacity < outbuf.len) {
-            /* Somehow we ran over the output buffer. abort() to limit the damage. */
-            abort();
-        }
+int aws_cryptosdk_encrypt_bodies_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const uint8_t *message_id,
+    struct aws_cryptosdk_body_op *ops,
+    size_t count) {
+    if (!aws_cryptosdk_gcm_provider_has_many(cipher_ctx->provider)) {
+        return process_bodies_serially(cipher_ctx, message_id, ops, count, true);
     }
 
-    result = evp_gcm_encrypt_final(props, ctx, tag);
+    AWS_CRYPTOSDK_PROBE1(frames_encrypt_start, count);
+    int rv = process_bodies(cipher_ctx, message_id, ops, count, true);
+    AWS_CRYPTOSDK_PROBE2(frames_encrypt_end, count, rv ? aws_last_error() : 0);
 
-out:
-    if (ctx) EVP_CIPHER_CTX_free(ctx);
+    return rv;
+}
 
-    if (result == AWS_ERROR_SUCCESS) {
-        *outp = outbuf;
-        return AWS_OP_SUCCESS;
-    } else {
-        aws_byte_buf_secure_zero(outp);
-        return aws_raise_error(result);
+int aws_cryptosdk_decrypt_bodies_with_ctx(
+    struct aws_cryptosdk_cipher_ctx *cipher_ctx,
+    const uint8_t *message_id,
+    struct aws_cryptosdk_body_op *ops,
+    size_t count) {
+    if (!aws_cryptosdk_gcm_provider_has_many(cipher_ctx->provider)) {
+        return process_bodies_serially(cipher_ctx, message_id, ops, count, false);
     }
+
+    AWS_CRYPTOSDK_PROBE1(frames_decrypt_start, count);
+    int rv = process_bodies(cipher_ctx, message_id, ops, count, false);
+    AWS_CRYPTOSDK_PROBE2(frames_decrypt_end, count, rv ? aws_last_error() : 0);
+
+    return rv;
 }
 
-int aws_cryptosdk_decrypt_body(
-    const struct aws_cryptosdk_alg_properties *props,
-    struct aws_byte_buf *outp,
-    const struct aws_byte_cursor *inp,
-    const uint8_t *message_id,
-    uint32_t seqno,
-    const uint8_t *iv,
-    const struct content_key *key,
-    const uint8_t *tag,
-    int body_frame_type) {
-    if (inp->len != outp->capacity - outp->len) {
-        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+/*
+ * When buffered random generation is enabled, each thread draws a block from OpenSSL's DRBG (which
+ * is seeded from the system) and serves small requests such as message IDs, IVs and data keys from
+ * it, so that RAND_bytes and its locks are hit once per block rather than once per request. Bytes
+ * are wiped as they are handed out. A forked child must not repeat its parent's output, so the
+ * buffers are tagged with a generation that is bumped in the child after every fork.
+ */
+#ifdef _MSC_VER
+#    define RANDOM_THREAD_LOCAL __declspec(thread)
+#else
+#    define RANDOM_THREAD_LOCAL __thread
+#endif
+
+#define RANDOM_BUFFER_SIZE 512
+#define RANDOM_BUFFERED_MAX 32
+
+struct random_buffer {
+    uint8_t bytes[RANDOM_BUFFER_SIZE];
+    /* The unused bytes are the last avail bytes of the block */
+    size_t avail;
+    size_t fork_generation;
+};
+
+static RANDOM_THREAD_LOCAL struct random_buffer random_buffer;
+static struct aws_atomic_var buffered_random   = AWS_ATOMIC_VAR_INTVAL(0);
+static struct aws_atomic_var fork_generation   = AWS_ATOMIC_VAR_INTVAL(0);
+static aws_thread_once fork_handler_registered = AWS_THREAD_ONCE_STATIC_INIT;
+
+#ifndef _WIN32
+static void bump_fork_generation(void) {
+    aws_atomic_fetch_add(&fork_generation, 1);
+}
+#endif
+
+static void register_fork_handler(void *arg) {
+    (void)arg;
+#ifndef _WIN32
+    if (pthread_atfork(NULL, NULL, bump_fork_generation)) {
+        // Without the handler a child could reuse its parent's bytes, so never buffer
+        aws_atomic_store_int(&fork_generation, SIZE_MAX);
     }
+#endif
+}
 
-    EVP_CIPHER_CTX *ctx           = NULL;
-    struct aws_byte_buf outcurs   = *outp;
-    struct aws_byte_cursor incurs = *inp;
-    int result                    = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
+void aws_cryptosdk_set_buffered_random(bool enabled) {
+    if (enabled) {
+        aws_thread_call_once(&fork_handler_registered, register_fork_handler, NULL);
+    }
+    aws_atomic_store_int(&buffered_random, enabled);
+}
 
-    if (!(ctx = evp_gcm_cipher_init(props, key, iv, false))) goto out;
+static int genrandom_buffered(uint8_t *buf, size_t len) {
+    struct random_buffer *rb = &random_buffer;
+    size_t generation        = aws_atomic_load_int(&fork_generation);
 
-    if (!update_frame_aad(ctx, message_id, body_frame_type, seqno, inp->len)) goto out;
+    if (generation == SIZE_MAX) {
+        return RAND_bytes(buf, len) == 1 ? AWS_OP_SUCCESS : AWS_OP_ERR;
+    }
 
-    while (incurs.len) {
-        int in_len = incurs.len > INT_MAX ? INT_MAX : incurs.len;
-        int pt_len;
+    if (rb->fork_generation != generation) {
+        aws_secure_zero(rb->bytes, sizeof(rb->bytes));
+        rb->avail           = 0;
+        rb->fork_generation = generation;
+    }
 
-        if (!EVP_DecryptUpdate(ctx, outcurs.buffer + outcurs.len, &pt_len, incurs.ptr, in_len)) goto out;
-        /*
-         * The next two advances should never fail ... but check the return values
-         * just in case.
-         */
-        if (!aws_byte_cursor_advance_nospec(&incurs, in_len).ptr) goto out;
-        outcurs.len += pt_len;
-        if (outcurs.len > outcurs.capacity) {
-            /* Somehow we ran over the output buffer. abort() to limit the damage. */
-            abort();
+    if (rb->avail < len) {
+        if (RAND_bytes(rb->bytes, sizeof(rb->bytes)) != 1) {
+            aws_secure_zero(rb->bytes, sizeof(rb->bytes));
+            rb->avail = 0;
+            return AWS_OP_ERR;
         }
+        rb->avail = sizeof(rb->bytes);
     }
 
-    result = evp_gcm_decrypt_final(props, ctx, tag);
-out:
-    if (ctx) EVP_CIPHER_CTX_free(ctx);
+    uint8_t *next = rb->bytes + sizeof(rb->bytes) - rb->avail;
+    memcpy(buf, next, len);
+    aws_secure_zero(next, len);
+    rb->avail -= len;
 
-    if (result == AWS_ERROR_SUCCESS) {
-        *outp = outcurs;
-        return AWS_OP_SUCCESS;
-    } else {
-        aws_byte_buf_secure_zero(outp);
-        return aws_raise_error(result);
-    }
+    return AWS_OP_SUCCESS;
 }
 
 int aws_cryptosdk_genrandom(uint8_t *buf, size_t len) {
@@ -457,7 +1591,13 @@ int aws_cryptosdk_genrandom(uint8_t *buf, size_t len) {
     if (len == 0) {
         return 0;
     }
-    int rc = RAND_bytes(buf, len);
+
+    int rc;
+    if (len <= RANDOM_BUFFERED_MAX && aws_atomic_load_int(&buffered_random)) {
+        rc = genrandom_buffered(buf, len) == AWS_OP_SUCCESS;
+    } else {
+        rc = RAND_bytes(buf, len);
+    }
 
     if (rc != 1) {
         aws_secure_zero(buf, len);
@@ -467,19 +1607,6 @@ int aws_cryptosdk_genrandom(uint8_t *buf, size_t len) {
     return AWS_OP_SUCCESS;
 }
 
-static const EVP_CIPHER *get_alg_from_key_size(size_t key_len) {
-    switch (key_len) {
-        case AWS_CRYPTOSDK_AES128: return EVP_aes_128_gcm();
-        case AWS_CRYPTOSDK_AES192: return EVP_aes_192_gcm();
-        case AWS_CRYPTOSDK_AES256: return EVP_aes_256_gcm();
-        default: return NULL;
-    }
-}
-
-// These implementations of AES-GCM encryption/decryption only support these tag/IV lengths
-static const size_t aes_gcm_tag_len = 16;
-static const size_t aes_gcm_iv_len  = 12;
-
 int aws_cryptosdk_aes_gcm_encrypt(
     struct aws_byte_buf *cipher,
     struct aws_byte_buf *tag,
@@ -572,6 +1699,166 @@ decrypt_err:
     return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
 }
 
+/* Idle keyed contexts kept by a wrapping key for each direction; more concurrent calls copy the template */
+#define AES_GCM_KEY_POOL_SLOTS 8
+
+struct aes_gcm_key_pool {
+    EVP_CIPHER_CTX *template_ctx;
+    EVP_CIPHER_CTX *idle[AES_GCM_KEY_POOL_SLOTS];
+    size_t num_idle;
+};
+
+struct aws_cryptosdk_aes_gcm_key {
+    struct aws_allocator *alloc;
+    struct aws_mutex mutex;  // guards the idle contexts of both pools
+    struct aes_gcm_key_pool enc, dec;
+};
+
+static void aes_gcm_key_pool_clean_up(struct aes_gcm_key_pool *pool) {
+    while (pool->num_idle) {
+        EVP_CIPHER_CTX_free(pool->idle[--pool->num_idle]);
+    }
+    if (pool->template_ctx) EVP_CIPHER_CTX_free(pool->template_ctx);
+    pool->template_ctx = NULL;
+}
+
+struct aws_cryptosdk_aes_gcm_key *aws_cryptosdk_aes_gcm_key_new(
+    struct aws_allocator *alloc, const struct aws_byte_cursor key) {
+    alloc = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_CIPHER);
+    if (!get_alg_from_key_size(key.len)) {
+        aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+        return NULL;
+    }
+
+    struct aws_cryptosdk_aes_gcm_key *gcm_key = aws_mem_calloc(alloc, 1, sizeof(*gcm_key));
+    if (!gcm_key) return NULL;
+    gcm_key->alloc = alloc;
+    if (aws_mutex_init(&gcm_key->mutex)) {
+        aws_mem_release(alloc, gcm_key);
+        return NULL;
+    }
+
+    if (!(gcm_key->enc.template_ctx = openssl_gcm_key_new(key.ptr, key.len, true)) ||
+        !(gcm_key->dec.template_ctx = openssl_gcm_key_new(key.ptr, key.len, false))) {
+        aws_cryptosdk_aes_gcm_key_destroy(gcm_key);
+        return NULL;
+    }
+    return gcm_key;
+}
+
+void aws_cryptosdk_aes_gcm_key_destroy(struct aws_cryptosdk_aes_gcm_key *key) {
+    if (!key) return;
+
+    // EVP_CIPHER_CTX_free zeroes the key schedule
+    aes_gcm_key_pool_clean_up(&key->enc);
+    aes_gcm_key_pool_clean_up(&key->dec);
+    aws_mutex_clean_up(&key->mutex);
+    aws_mem_release(key->alloc, key);
+}
+
+/* Returns a keyed context for the caller's exclusive use, taking an idle one if there is one */
+static EVP_CIPHER_CTX *aes_gcm_key_acquire(struct aws_cryptosdk_aes_gcm_key *key, struct aes_gcm_key_pool *pool) {
+    EVP_CIPHER_CTX *ctx = NULL;
+
+    aws_mutex_lock(&key->mutex);
+    if (pool->num_idle) ctx = pool->idle[--pool->num_idle];
+    aws_mutex_unlock(&key->mutex);
+    if (ctx) return ctx;
+
+    // Copying the template duplicates its key schedule, rather than expanding the key again
+    if (!(ctx = EVP_CIPHER_CTX_new()) || !EVP_CIPHER_CTX_copy(ctx, pool->template_ctx)) {
+        if (ctx) EVP_CIPHER_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/* Returns the context to the pool; contexts of failed calls are freed, as their state is unknown */
+static void aes_gcm_key_release(
+    struct aws_cryptosdk_aes_gcm_key *key, struct aes_gcm_key_pool *pool, EVP_CIPHER_CTX *ctx, bool reusable) {
+    if (reusable) {
+        aws_mutex_lock(&key->mutex);
+        if (pool->num_idle < AES_GCM_KEY_POOL_SLOTS) {
+            pool->idle[pool->num_idle++] = ctx;
+            ctx                          = NULL;
+        }
+        aws_mutex_unlock(&key->mutex);
+    }
+    if (ctx) EVP_CIPHER_CTX_free(ctx);
+}
+
+int aws_cryptosdk_aes_gcm_key_encrypt(
+    struct aws_cryptosdk_aes_gcm_key *key,
+    struct aws_byte_buf *cipher,
+    struct aws_byte_buf *tag,
+    const struct aws_byte_cursor plain,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad) {
+    if (iv.len != aes_gcm_iv_len || tag->capacity < aes_gcm_tag_len || cipher->capacity < plain.len)
+        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+
+    EVP_CIPHER_CTX *ctx = aes_gcm_key_acquire(key, &key->enc);
+    if (!ctx) goto openssl_err;
+
+    if (!openssl_gcm_start(ctx, iv.ptr, aad.ptr, aad.len) ||
+        !openssl_gcm_update(ctx, cipher->buffer, plain.ptr, plain.len)) {
+        aes_gcm_key_release(key, &key->enc, ctx, false);
+        goto openssl_err;
+    }
+    if (openssl_gcm_seal_final(ctx, tag->buffer)) {
+        aes_gcm_key_release(key, &key->enc, ctx, false);
+        aws_byte_buf_secure_zero(cipher);
+        aws_byte_buf_secure_zero(tag);
+        return AWS_OP_ERR;
+    }
+
+    aes_gcm_key_release(key, &key->enc, ctx, true);
+    tag->len    = aes_gcm_tag_len;
+    cipher->len = plain.len;
+    return AWS_OP_SUCCESS;
+
+openssl_err:
+    aws_byte_buf_secure_zero(cipher);
+    aws_byte_buf_secure_zero(tag);
+    flush_openssl_errors();
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+}
+
+int aws_cryptosdk_aes_gcm_key_decrypt(
+    struct aws_cryptosdk_aes_gcm_key *key,
+    struct aws_byte_buf *plain,
+    const struct aws_byte_cursor cipher,
+    const struct aws_byte_cursor tag,
+    const struct aws_byte_cursor iv,
+    const struct aws_byte_cursor aad) {
+    if (iv.len != aes_gcm_iv_len || tag.len != aes_gcm_tag_len || plain->capacity < cipher.len)
+        return aws_raise_error(AWS_ERROR_INVALID_BUFFER_SIZE);
+
+    EVP_CIPHER_CTX *ctx = aes_gcm_key_acquire(key, &key->dec);
+    if (!ctx) goto openssl_err;
+
+    if (!openssl_gcm_start(ctx, iv.ptr, aad.ptr, aad.len) ||
+        !openssl_gcm_update(ctx, plain->buffer, cipher.ptr, cipher.len)) {
+        aes_gcm_key_release(key, &key->dec, ctx, false);
+        goto openssl_err;
+    }
+    if (openssl_gcm_open_final(ctx, tag.ptr)) {
+        // A tag mismatch leaves the context in the same state as a success
+        aes_gcm_key_release(key, &key->dec, ctx, aws_last_error() == AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        aws_byte_buf_secure_zero(plain);  // sets plain->len to zero
+        return AWS_OP_ERR;
+    }
+
+    aes_gcm_key_release(key, &key->dec, ctx, true);
+    plain->len = cipher.len;
+    return AWS_OP_SUCCESS;
+
+openssl_err:
+    aws_byte_buf_secure_zero(plain);
+    flush_openssl_errors();
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+}
+
 static int get_openssl_rsa_padding_mode(enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
     switch (rsa_padding_mode) {
         case AWS_CRYPTOSDK_RSA_PKCS1: return RSA_PKCS1_PADDING;
@@ -581,33 +1868,89 @@ static int get_openssl_rsa_padding_mode(enum aws_cryptosdk_rsa_padding_mode rsa_
     }
 }
 
-int aws_cryptosdk_rsa_encrypt(
+struct aws_cryptosdk_rsa_key {
+    struct aws_allocator *alloc;
+    EVP_PKEY *pkey;
+};
+
+static EVP_PKEY *read_rsa_pem(struct aws_byte_cursor pem, bool is_private) {
+    BIO *bio = BIO_new_mem_buf(pem.ptr, pem.len);
+    if (!bio) return NULL;
+
+    EVP_PKEY *pkey = is_private ? PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL)
+                                : PEM_read_bio_PUBKEY(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+    return pkey;
+}
+
+static struct aws_cryptosdk_rsa_key *rsa_key_new(
+    struct aws_allocator *alloc, struct aws_byte_cursor pem, bool is_private) {
+    alloc                             = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_CIPHER);
+    struct aws_cryptosdk_rsa_key *key = aws_mem_calloc(alloc, 1, sizeof(*key));
+    if (!key) return NULL;
+    key->alloc = alloc;
+
+    if (!(key->pkey = read_rsa_pem(pem, is_private))) {
+        flush_openssl_errors();
+        aws_mem_release(alloc, key);
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        return NULL;
+    }
+    return key;
+}
+
+struct aws_cryptosdk_rsa_key *aws_cryptosdk_rsa_public_key_new(
+    struct aws_allocator *alloc, struct aws_byte_cursor rsa_public_key_pem) {
+    return rsa_key_new(alloc, rsa_public_key_pem, false);
+}
+
+struct aws_cryptosdk_rsa_key *aws_cryptosdk_rsa_private_key_new(
+    struct aws_allocator *alloc, struct aws_byte_cursor rsa_private_key_pem) {
+    return rsa_key_new(alloc, rsa_private_key_pem, true);
+}
+
+void aws_cryptosdk_rsa_key_destroy(struct aws_cryptosdk_rsa_key *key) {
+    if (!key) return;
+
+    // Frees the key's numbers along with its cached blinding and Montgomery state
+    EVP_PKEY_free(key->pkey);
+    aws_mem_release(key->alloc, key);
+}
+
+/* Sets up a context on pkey for the padding mode, with init being EVP_PKEY_encrypt_init or EVP_PKEY_decrypt_init */
+static EVP_PKEY_CTX *rsa_ctx_new(
+    EVP_PKEY *pkey, int (*init)(EVP_PKEY_CTX *), int padding, enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    if (!ctx) return NULL;
+    if (init(ctx) <= 0) goto err;
+    if (EVP_PKEY_CTX_set_rsa_padding(ctx, padding) <= 0) goto err;
+    if (rsa_padding_mode == AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1) {
+        const EVP_MD *sha256 = aws_cryptosdk_priv_evp_sha256();
+        if (!sha256 || EVP_PKEY_CTX_set_rsa_oaep_md(ctx, sha256) <= 0) goto err;
+        if (EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, sha256) <= 0) goto err;
+    }
+    return ctx;
+
+err:
+    EVP_PKEY_CTX_free(ctx);
+    return NULL;
+}
+
+static int rsa_encrypt_with_pkey(
     struct aws_byte_buf *cipher,
     struct aws_allocator *alloc,
     const struct aws_byte_cursor plain,
-    const struct aws_string *rsa_public_key_pem,
+    EVP_PKEY *pkey,
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
     if (cipher->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
     int padding = get_openssl_rsa_padding_mode(rsa_padding_mode);
     if (padding < 0) return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
-    BIO *bio          = NULL;
     EVP_PKEY_CTX *ctx = NULL;
-    EVP_PKEY *pkey    = NULL;
     bool error        = true;
     int err_code      = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
-    pkey              = EVP_PKEY_new();
     if (!pkey) goto cleanup;
-    bio = BIO_new_mem_buf(aws_string_bytes(rsa_public_key_pem), rsa_public_key_pem->len);
-    if (!bio) goto cleanup;
-    if (!PEM_read_bio_PUBKEY(bio, &pkey, NULL, NULL)) goto cleanup;
-    ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    ctx = rsa_ctx_new(pkey, EVP_PKEY_encrypt_init, padding, rsa_padding_mode);
     if (!ctx) goto cleanup;
-    if (EVP_PKEY_encrypt_init(ctx) <= 0) goto cleanup;
-    if (EVP_PKEY_CTX_set_rsa_padding(ctx, padding) <= 0) goto cleanup;
-    if (rsa_padding_mode == AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1) {
-        if (EVP_PKEY_CTX_set_rsa_oaep_md(ctx, EVP_sha256()) <= 0) goto cleanup;
-        if (EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, EVP_sha256()) <= 0) goto cleanup;
-    }
     size_t outlen;
     if (EVP_PKEY_encrypt(ctx, NULL, &outlen, plain.ptr, plain.len) <= 0) goto cleanup;
     if (aws_byte_buf_init(cipher, alloc, outlen)) goto cleanup;
@@ -618,8 +1961,6 @@ int aws_cryptosdk_rsa_encrypt(
 
 cleanup:
     EVP_PKEY_CTX_free(ctx);
-    EVP_PKEY_free(pkey);
-    BIO_free(bio);
     flush_openssl_errors();
     if (error) {
         aws_byte_buf_clean_up_secure(cipher);
@@ -629,33 +1970,21 @@ cleanup:
     }
 }
 
-int aws_cryptosdk_rsa_decrypt(
+static int rsa_decrypt_with_pkey(
     struct aws_byte_buf *plain,
     struct aws_allocator *alloc,
     const struct aws_byte_cursor cipher,
-    const struct aws_string *rsa_private_key_pem,
+    EVP_PKEY *pkey,
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
     if (plain->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
     int padding = get_openssl_rsa_padding_mode(rsa_padding_mode);
     if (padding < 0) return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
-    BIO *bio          = NULL;
     EVP_PKEY_CTX *ctx = NULL;
-    EVP_PKEY *pkey    = NULL;
     bool error        = true;
     int err_code      = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
-    pkey              = EVP_PKEY_new();
     if (!pkey) goto cleanup;
-    bio = BIO_new_mem_buf(aws_string_bytes(rsa_private_key_pem), rsa_private_key_pem->len);
-    if (!bio) goto cleanup;
-    if (!PEM_read_bio_PrivateKey(bio, &pkey, NULL, NULL)) goto cleanup;
-    ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    ctx = rsa_ctx_new(pkey, EVP_PKEY_decrypt_init, padding, rsa_padding_mode);
     if (!ctx) goto cleanup;
-    if (EVP_PKEY_decrypt_init(ctx) <= 0) goto cleanup;
-    if (EVP_PKEY_CTX_set_rsa_padding(ctx, padding) <= 0) goto cleanup;
-    if (rsa_padding_mode == AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1) {
-        if (EVP_PKEY_CTX_set_rsa_oaep_md(ctx, EVP_sha256()) <= 0) goto cleanup;
-        if (EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, EVP_sha256()) <= 0) goto cleanup;
-    }
     size_t outlen;
     if (EVP_PKEY_decrypt(ctx, NULL, &outlen, cipher.ptr, cipher.len) <= 0) goto cleanup;
     if (aws_byte_buf_init(plain, alloc, outlen)) goto cleanup;
@@ -668,8 +1997,6 @@ int aws_cryptosdk_rsa_decrypt(
 
 cleanup:
     EVP_PKEY_CTX_free(ctx);
-    EVP_PKEY_free(pkey);
-    BIO_free(bio);
     flush_openssl_errors();
     if (error) {
         aws_byte_buf_clean_up_secure(plain);
@@ -678,3 +2005,65 @@ cleanup:
         return AWS_OP_SUCCESS;
     }
 }
+
+int aws_cryptosdk_rsa_key_encrypt(
+    struct aws_byte_buf *cipher,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor plain,
+    const struct aws_cryptosdk_rsa_key *rsa_public_key,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
+    return rsa_encrypt_with_pkey(cipher, alloc, plain, rsa_public_key->pkey, rsa_padding_mode);
+}
+
+int aws_cryptosdk_rsa_key_decrypt(
+    struct aws_byte_buf *plain,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor cipher,
+    const struct aws_cryptosdk_rsa_key *rsa_private_key,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
+    return rsa_decrypt_with_pkey(plain, alloc, cipher, rsa_private_key->pkey, rsa_padding_mode);
+}
+
+int aws_cryptosdk_rsa_encrypt(
+    struct aws_byte_buf *cipher,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor plain,
+    const struct aws_string *rsa_public_key_pem,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
+    if (cipher->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    EVP_PKEY *pkey = read_rsa_pem(aws_byte_cursor_from_string(rsa_public_key_pem), false);
+    int ret        = rsa_encrypt_with_pkey(cipher, alloc, plain, pkey, rsa_padding_mode);
+    EVP_PKEY_free(pkey);
+    return ret;
+}
+
+int aws_cryptosdk_rsa_decrypt(
+    struct aws_byte_buf *plain,
+    struct aws_allocator *alloc,
+    const struct aws_byte_cursor cipher,
+    const struct aws_string *rsa_private_key_pem,
+    enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
+    if (plain->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    EVP_PKEY *pkey = read_rsa_pem(aws_byte_cursor_from_string(rsa_private_key_pem), true);
+    int ret        = rsa_decrypt_with_pkey(plain, alloc, cipher, pkey, rsa_padding_mode);
+    EVP_PKEY_free(pkey);
+    return ret;
+}
+
+int aws_cryptosdk_prepare(void) {
+    aws_cryptosdk_load_error_strings();
+
+    bool ok = aws_cryptosdk_priv_evp_aes_128_gcm() && aws_cryptosdk_priv_evp_aes_192_gcm() &&
+              aws_cryptosdk_priv_evp_aes_256_gcm() && aws_cryptosdk_priv_evp_aes_128_ecb() &&
+              aws_cryptosdk_priv_evp_aes_192_ecb() && aws_cryptosdk_priv_evp_aes_256_ecb() &&
+              aws_cryptosdk_priv_evp_sha256() && aws_cryptosdk_priv_evp_sha384() && aws_cryptosdk_priv_evp_sha512();
+
+    ok = aws_cryptosdk_priv_prepare_ec_groups() && ok;
+
+    // The first draw instantiates and seeds OpenSSL's random generators
+    uint8_t scratch[16];
+    ok = aws_cryptosdk_genrandom(scratch, sizeof(scratch)) == AWS_OP_SUCCESS && ok;
+    aws_secure_zero(scratch, sizeof(scratch));
+
+    return ok ? AWS_OP_SUCCESS : aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+}
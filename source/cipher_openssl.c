@@ -14,6 +14,7 @@
  */
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 #include <openssl/crypto.h>
@@ -24,13 +25,19 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 
+#include <aws/common/atomics.h>
+#include <aws/common/condition_variable.h>
 #include <aws/common/encoding.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
 
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/alloc_stats.h>
 #include <aws/cryptosdk/private/cipher.h>
 
 #include <ctype.h>
+#include <string.h>
 #include <stdio.h>
 
 /* This is large enough to hold an encoded public key for all currently supported curves */
@@ -68,6 +75,11 @@ static void ECDSA_SIG_set0(ECDSA_SIG *sig, BIGNUM *r, BIGNUM *s) {
     sig->s = s;
 }
 
+static int EVP_PKEY_up_ref(EVP_PKEY *pkey) {
+    CRYPTO_add(&pkey->references, 1, CRYPTO_LOCK_EVP_PKEY);
+    return 1;
+}
+
 #endif
 
 struct aws_cryptosdk_sig_ctx {
@@ -90,22 +102,79 @@ bool aws_cryptosdk_sig_ctx_is_valid(const struct aws_cryptosdk_sig_ctx *sig_ctx)
 
 struct aws_cryptosdk_md_context {
     struct aws_allocator *alloc;
+    const EVP_MD *evp_md;
     EVP_MD_CTX *evp_md_ctx;
 };
 
 bool aws_cryptosdk_md_context_is_valid(const struct aws_cryptosdk_md_context *md_context) {
-    return md_context && AWS_OBJECT_PTR_IS_READABLE(md_context->alloc) && md_context->evp_md_ctx;
+    return md_context && AWS_OBJECT_PTR_IS_READABLE(md_context->alloc) && md_context->evp_md &&
+           md_context->evp_md_ctx;
+}
+
+/*
+ * Digest contexts released by aws_cryptosdk_md_finish and aws_cryptosdk_md_abort are kept here, already
+ * initialized, so that hashing a short message does not allocate and free an EVP_MD_CTX every time. Each
+ * slot holds either NULL or a context owned by the pool, and is claimed and refilled with a compare and
+ * exchange, so no lock is needed. Only contexts from the default allocator are pooled, as a caller's
+ * allocator might not outlive the pool.
+ */
+#define MD_CONTEXT_POOL_SIZE 8
+
+static struct aws_atomic_var md_context_pool[MD_CONTEXT_POOL_SIZE];
+
+static struct aws_cryptosdk_md_context *md_context_pool_take(void) {
+    for (size_t i = 0; i < MD_CONTEXT_POOL_SIZE; i++) {
+        void *md_context = aws_atomic_load_ptr(&md_context_pool[i]);
+
+        if (md_context && aws_atomic_compare_exchange_ptr(&md_context_pool[i], &md_context, NULL)) {
+            return md_context;
+        }
+    }
+
+    return NULL;
+}
+
+static bool md_context_pool_give(struct aws_cryptosdk_md_context *md_context) {
+    for (size_t i = 0; i < MD_CONTEXT_POOL_SIZE; i++) {
+        void *empty = NULL;
+
+        if (aws_atomic_compare_exchange_ptr(&md_context_pool[i], &empty, md_context)) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 int aws_cryptosdk_md_init(
     struct aws_allocator *alloc, struct aws_cryptosdk_md_context **md_context, enum aws_cryptosdk_md_alg md_alg) {
+    alloc = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_CIPHER);
     const EVP_MD *evp_md_alg;
     *md_context = NULL;
 
     switch (md_alg) {
-        case AWS_CRYPTOSDK_MD_SHA512: evp_md_alg = EVP_sha512(); break;
+        case AWS_CRYPTOSDK_MD_SHA512: evp_md_alg = aws_cryptosdk_priv_evp_sha512(); break;
         default: return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
     }
+    if (!evp_md_alg) return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+
+    if (alloc == aws_default_allocator()) {
+        struct aws_cryptosdk_md_context *pooled = md_context_pool_take();
+
+        if (pooled &&
+            (pooled->evp_md == evp_md_alg || 1 == EVP_DigestInit_ex(pooled->evp_md_ctx, evp_md_alg, NULL))) {
+            pooled->evp_md = evp_md_alg;
+            *md_context    = pooled;
+
+            AWS_POSTCONDITION(aws_cryptosdk_md_context_is_valid(*md_context));
+            return AWS_OP_SUCCESS;
+        }
+
+        if (pooled) {
+            EVP_MD_CTX_destroy(pooled->evp_md_ctx);
+            aws_mem_release(pooled->alloc, pooled);
+        }
+    }
 
     EVP_MD_CTX *evp_md_ctx = EVP_MD_CTX_new();
     if (!evp_md_ctx) {
@@ -124,6 +193,7 @@ int aws_cryptosdk_md_init(
     }
 
     (*md_context)->alloc      = alloc;
+    (*md_context)->evp_md     = evp_md_alg;
     (*md_context)->evp_md_ctx = evp_md_ctx;
 
     AWS_POSTCONDITION(aws_cryptosdk_md_context_is_valid(*md_context));
@@ -184,26 +254,153 @@ void aws_cryptosdk_md_abort(struct aws_cryptosdk_md_context *md_context) {
         return;
     }
 
+    // Reinitialize before pooling, so that the next aws_cryptosdk_md_init need not
+    if (md_context->alloc == aws_default_allocator() &&
+        1 == EVP_DigestInit_ex(md_context->evp_md_ctx, md_context->evp_md, NULL) &&
+        md_context_pool_give(md_context)) {
+        return;
+    }
+
     EVP_MD_CTX_destroy(md_context->evp_md_ctx);
     aws_mem_release(md_context->alloc, md_context);
 }
 
-static EC_GROUP *group_for_props(const struct aws_cryptosdk_alg_properties *props) {
-    // TODO: Cache? Are EC_GROUPs threadsafe?
+int aws_cryptosdk_md_finish_reset(struct aws_cryptosdk_md_context *md_context, void *output_buf, size_t *length) {
+    AWS_PRECONDITION(aws_cryptosdk_md_context_is_valid(md_context));
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_READABLE(length));
+    AWS_PRECONDITION(AWS_MEM_IS_WRITABLE(output_buf, *length));
+
+    unsigned int size = 0;
+
+    if (!output_buf) {
+        abort();
+    }
+
+    if (1 != EVP_DigestFinal_ex(md_context->evp_md_ctx, output_buf, &size) ||
+        1 != EVP_DigestInit_ex(md_context->evp_md_ctx, md_context->evp_md, NULL)) {
+        *length = 0;
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    *length = size;
+
+    AWS_POSTCONDITION(aws_cryptosdk_md_context_is_valid(md_context));
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_md_copy(struct aws_cryptosdk_md_context *dest, const struct aws_cryptosdk_md_context *src) {
+    AWS_PRECONDITION(aws_cryptosdk_md_context_is_valid(dest));
+    AWS_PRECONDITION(aws_cryptosdk_md_context_is_valid(src));
+    AWS_PRECONDITION(dest->evp_md == src->evp_md);
+
+    if (1 != EVP_MD_CTX_copy_ex(dest->evp_md_ctx, src->evp_md_ctx)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    AWS_POSTCONDITION(aws_cryptosdk_md_context_is_valid(dest));
+    return AWS_OP_SUCCESS;
+}
+
+static int openssl_sha512_many(const struct aws_cryptosdk_digest_op *ops, size_t count) {
+    struct aws_cryptosdk_md_context *md_context = NULL;
+
+    // One pooled context serves every message, reset by each finish
+    if (aws_cryptosdk_md_init(aws_default_allocator(), &md_context, AWS_CRYPTOSDK_MD_SHA512)) return AWS_OP_ERR;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t length = AWS_CRYPTOSDK_MD_MAX_SIZE;
+
+        if (aws_cryptosdk_md_update(md_context, ops[i].in, ops[i].len) ||
+            aws_cryptosdk_md_finish_reset(md_context, ops[i].digest, &length)) {
+            aws_cryptosdk_md_abort(md_context);
+            return AWS_OP_ERR;
+        }
+    }
+
+    aws_cryptosdk_md_abort(md_context);
+    return AWS_OP_SUCCESS;
+}
+
+bool aws_cryptosdk_priv_digest_provider_is_complete(const struct aws_cryptosdk_digest_provider_vt *provider) {
+    size_t needed = offsetof(struct aws_cryptosdk_digest_provider_vt, sha512_many) + sizeof(provider->sha512_many);
+
+    return provider && provider->vt_size >= needed && provider->sha512_many;
+}
+
+const struct aws_cryptosdk_digest_provider_vt *aws_cryptosdk_digest_provider_openssl(void) {
+    static const struct aws_cryptosdk_digest_provider_vt provider = {
+        .vt_size     = sizeof(struct aws_cryptosdk_digest_provider_vt),
+        .name        = "OpenSSL EVP SHA-512",
+        .sha512_many = openssl_sha512_many,
+    };
 
-    int nid = OBJ_txt2nid(props->impl->curve_name);
+    return &provider;
+}
+
+/*
+ * Each curve's group is built once per process, along with its precomputed multiples of the generator, and is
+ * never modified afterwards. EC_KEY_set_group only reads the group it is given, and the copy it makes shares the
+ * precomputed tables, so the cached groups may be used from any number of threads at once.
+ */
+struct cached_group {
+    const char *curve_name;
+    aws_thread_once once;
+    EC_GROUP *group;
+};
+
+static struct cached_group cached_groups[] = {
+    { "prime256v1", AWS_THREAD_ONCE_STATIC_INIT, NULL },
+    { "secp384r1", AWS_THREAD_ONCE_STATIC_INIT, NULL },
+};
+
+static void build_cached_group(void *arg) {
+    struct cached_group *cached = arg;
+
+    int nid = OBJ_txt2nid(cached->curve_name);
     if (nid == NID_undef) {
-        fprintf(stderr, "Unknown curve %s\n", props->impl->curve_name);
-        // unknown curve
-        return NULL;
+        return;
     }
 
     EC_GROUP *group = EC_GROUP_new_by_curve_name(nid);
-    if (group) {
-        EC_GROUP_set_point_conversion_form(group, POINT_CONVERSION_COMPRESSED);
+    if (!group) {
+        return;
+    }
+
+    EC_GROUP_set_point_conversion_form(group, POINT_CONVERSION_COMPRESSED);
+    // The tables only speed up keygen and signing, so the group remains usable if they could not be built
+    if (!EC_GROUP_precompute_mult(group, NULL)) {
+        ERR_clear_error();
     }
 
-    return group;
+    cached->group = group;
+}
+
+static const EC_GROUP *group_for_props(const struct aws_cryptosdk_alg_properties *props) {
+    for (size_t i = 0; i < sizeof(cached_groups) / sizeof(cached_groups[0]); i++) {
+        struct cached_group *cached = &cached_groups[i];
+
+        if (!strcmp(cached->curve_name, props->impl->curve_name)) {
+            aws_thread_call_once(&cached->once, build_cached_group, cached);
+            return cached->group;
+        }
+    }
+
+    fprintf(stderr, "Unknown curve %s\n", props->impl->curve_name);
+    // unknown curve
+    return NULL;
+}
+
+bool aws_cryptosdk_priv_prepare_ec_groups(void) {
+    bool ok = true;
+
+    for (size_t i = 0; i < sizeof(cached_groups) / sizeof(cached_groups[0]); i++) {
+        struct cached_group *cached = &cached_groups[i];
+
+        aws_thread_call_once(&cached->once, build_cached_group, cached);
+        ok = ok && cached->group;
+    }
+
+    return ok;
 }
 
 /**
@@ -212,6 +409,7 @@ static EC_GROUP *group_for_props(const struct aws_cryptosdk_alg_properties *prop
  */
 static struct aws_cryptosdk_sig_ctx *sign_start(
     struct aws_allocator *alloc, EC_KEY *keypair, const struct aws_cryptosdk_alg_properties *props) {
+    alloc                             = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_CIPHER);
     struct aws_cryptosdk_sig_ctx *ctx = aws_mem_acquire(alloc, sizeof(*ctx));
 
     if (!ctx) {
@@ -431,6 +629,98 @@ err:
     return rv;
 }
 
+struct aws_cryptosdk_sig_key {
+    struct aws_allocator *alloc;
+    const struct aws_cryptosdk_alg_properties *props;
+    EC_KEY *keypair;
+    EVP_PKEY *pkey;
+    bool is_sign;
+};
+
+int aws_cryptosdk_sig_get_key(
+    const struct aws_cryptosdk_sig_ctx *ctx, struct aws_allocator *alloc, struct aws_cryptosdk_sig_key **pkey) {
+    AWS_PRECONDITION(aws_cryptosdk_sig_ctx_is_valid(ctx));
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_WRITABLE(pkey));
+    struct aws_cryptosdk_sig_key *key = aws_mem_acquire(alloc, sizeof(*key));
+
+    *pkey = NULL;
+    if (!key) {
+        return aws_raise_error(AWS_ERROR_OOM);
+    }
+
+    /*
+     * Contexts started from the key share it with this one, so settle the conversion form now;
+     * serializing the public key of any of them then never needs to change it.
+     */
+    EC_KEY_set_conv_form(ctx->keypair, POINT_CONVERSION_COMPRESSED);
+
+    *key = (struct aws_cryptosdk_sig_key){
+        .alloc = alloc, .props = ctx->props, .keypair = ctx->keypair, .pkey = ctx->pkey, .is_sign = ctx->is_sign
+    };
+    EC_KEY_up_ref(key->keypair);
+    EVP_PKEY_up_ref(key->pkey);
+
+    *pkey = key;
+
+    return AWS_OP_SUCCESS;
+}
+
+void aws_cryptosdk_sig_key_destroy(struct aws_cryptosdk_sig_key *key) {
+    if (!key) {
+        return;
+    }
+
+    EVP_PKEY_free(key->pkey);
+    EC_KEY_free(key->keypair);
+
+    aws_mem_release(key->alloc, key);
+}
+
+int aws_cryptosdk_sig_start_from_key(
+    struct aws_cryptosdk_sig_ctx **pctx, struct aws_allocator *alloc, const struct aws_cryptosdk_sig_key *key) {
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_WRITABLE(pctx));
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_READABLE(alloc));
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_READABLE(key));
+    const EVP_MD *md = key->props->impl->md_ctor();
+    int ok;
+
+    *pctx = NULL;
+    alloc = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_CIPHER);
+
+    struct aws_cryptosdk_sig_ctx *ctx = aws_mem_acquire(alloc, sizeof(*ctx));
+    if (!ctx) {
+        return aws_raise_error(AWS_ERROR_OOM);
+    }
+
+    *ctx = (struct aws_cryptosdk_sig_ctx){
+        .alloc = alloc, .props = key->props, .keypair = key->keypair, .pkey = key->pkey, .is_sign = key->is_sign
+    };
+    EC_KEY_up_ref(ctx->keypair);
+    EVP_PKEY_up_ref(ctx->pkey);
+
+    if (!(ctx->ctx = EVP_MD_CTX_new())) {
+        aws_cryptosdk_sig_abort(ctx);
+        return aws_raise_error(AWS_ERROR_OOM);
+    }
+
+    // As in sign_start and aws_cryptosdk_sig_verify_start respectively
+    if (ctx->is_sign) {
+        ok = EVP_DigestInit(ctx->ctx, md);
+    } else {
+        ok = EVP_DigestVerifyInit(ctx->ctx, NULL, md, NULL, ctx->pkey);
+    }
+
+    if (!ok) {
+        aws_cryptosdk_sig_abort(ctx);
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    *pctx = ctx;
+
+    AWS_POSTCONDITION(aws_cryptosdk_sig_ctx_is_valid(*pctx));
+    return AWS_OP_SUCCESS;
+}
+
 int aws_cryptosdk_sig_sign_start_keygen(
     struct aws_cryptosdk_sig_ctx **pctx,
     struct aws_allocator *alloc,
@@ -439,8 +729,8 @@ int aws_cryptosdk_sig_sign_start_keygen(
     AWS_PRECONDITION(AWS_OBJECT_PTR_IS_WRITABLE(pctx));
     AWS_PRECONDITION(AWS_OBJECT_PTR_IS_READABLE(alloc));
     AWS_PRECONDITION(AWS_OBJECT_PTR_IS_READABLE(props));
-    EC_GROUP *group = NULL;
-    EC_KEY *keypair = NULL;
+    const EC_GROUP *group = NULL;
+    EC_KEY *keypair       = NULL;
 
     *pctx = NULL;
     if (pub_key) {
@@ -484,7 +774,6 @@ int aws_cryptosdk_sig_sign_start_keygen(
     }
 
     EC_KEY_free(keypair);
-    EC_GROUP_free(group);
 
     AWS_POSTCONDITION(aws_cryptosdk_sig_ctx_is_valid(*pctx) && (*pctx)->is_sign);
     AWS_POSTCONDITION(!pub_key || aws_string_is_valid(*pub_key));
@@ -502,13 +791,232 @@ rethrow:
     }
 
     EC_KEY_free(keypair);
-    EC_GROUP_free(group);
 
     AWS_POSTCONDITION(!*pctx);
     AWS_POSTCONDITION(!pub_key || !*pub_key);
     return AWS_OP_ERR;
 }
 
+/* How long the refill thread waits before retrying after a failed key generation */
+#define KEY_POOL_RETRY_NANOS (100 * 1000 * 1000)
+
+struct key_pool_entry {
+    EC_KEY *keypair;
+    /* The compressed public key, base64-encoded as it goes in the encryption context */
+    struct aws_string *pub_key;
+};
+
+struct aws_cryptosdk_sig_key_pool {
+    struct aws_allocator *alloc;
+    const struct aws_cryptosdk_alg_properties *props;
+
+    /* Protects keys, count and shutdown */
+    struct aws_mutex mutex;
+    /* Signalled when a key is taken from the pool, and on shutdown */
+    struct aws_condition_variable wakeup;
+    struct key_pool_entry *keys;
+    size_t depth, count;
+    bool shutdown;
+
+    struct aws_thread refill_thread;
+};
+
+static EC_KEY *generate_keypair(const struct aws_cryptosdk_alg_properties *props) {
+    const EC_GROUP *group = group_for_props(props);
+    EC_KEY *keypair       = NULL;
+
+    if (!group) return NULL;
+
+    if (!(keypair = EC_KEY_new()) || !EC_KEY_set_group(keypair, group) || !EC_KEY_generate_key(keypair)) {
+        EC_KEY_free(keypair);
+        keypair = NULL;
+    } else {
+        EC_KEY_set_conv_form(keypair, POINT_CONVERSION_COMPRESSED);
+    }
+
+    return keypair;
+}
+
+static bool key_pool_needs_work(void *arg) {
+    struct aws_cryptosdk_sig_key_pool *pool = arg;
+
+    return pool->shutdown || pool->count < pool->depth;
+}
+
+static void key_pool_refill(void *arg) {
+    struct aws_cryptosdk_sig_key_pool *pool = arg;
+
+    aws_mutex_lock(&pool->mutex);
+    while (true) {
+        aws_condition_variable_wait_pred(&pool->wakeup, &pool->mutex, key_pool_needs_work, pool);
+        if (pool->shutdown) break;
+
+        /*
+         * Generate and serialize without holding the lock, so that encryptors taking keys never
+         * wait on either
+         */
+        aws_mutex_unlock(&pool->mutex);
+        struct aws_string *pub_key = NULL;
+        EC_KEY *keypair            = generate_keypair(pool->props);
+        if (keypair && serialize_pubkey(pool->alloc, keypair, &pub_key)) {
+            EC_KEY_free(keypair);
+            keypair = NULL;
+        }
+        aws_mutex_lock(&pool->mutex);
+
+        if (!keypair) {
+            /* Callers fall back to generating their own keys in the meantime */
+            aws_condition_variable_wait_for(&pool->wakeup, &pool->mutex, KEY_POOL_RETRY_NANOS);
+            continue;
+        }
+
+        /* Only this thread adds keys, so there is still room */
+        pool->keys[pool->count].keypair   = keypair;
+        pool->keys[pool->count++].pub_key = pub_key;
+    }
+    aws_mutex_unlock(&pool->mutex);
+}
+
+struct aws_cryptosdk_sig_key_pool *aws_cryptosdk_sig_key_pool_new(
+    struct aws_allocator *alloc, const struct aws_cryptosdk_alg_properties *props, size_t depth) {
+    alloc                                   = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_CIPHER);
+    struct aws_cryptosdk_sig_key_pool *pool = NULL;
+    bool mutex_init = false, cond_init = false, thread_init = false;
+
+    if (!props || !props->impl->curve_name || !depth || depth > SIZE_MAX / sizeof(struct key_pool_entry)) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    if (!(pool = aws_mem_acquire(alloc, sizeof(*pool)))) return NULL;
+    memset(pool, 0, sizeof(*pool));
+    pool->alloc = alloc;
+    pool->props = props;
+    pool->depth = depth;
+
+    if (!(pool->keys = aws_mem_acquire(alloc, depth * sizeof(struct key_pool_entry)))) goto err;
+    if (aws_mutex_init(&pool->mutex)) goto err;
+    mutex_init = true;
+    if (aws_condition_variable_init(&pool->wakeup)) goto err;
+    cond_init = true;
+    if (aws_thread_init(&pool->refill_thread, alloc)) goto err;
+    thread_init = true;
+    if (aws_thread_launch(&pool->refill_thread, key_pool_refill, pool, NULL)) goto err;
+
+    return pool;
+
+err:
+    if (thread_init) aws_thread_clean_up(&pool->refill_thread);
+    if (cond_init) aws_condition_variable_clean_up(&pool->wakeup);
+    if (mutex_init) aws_mutex_clean_up(&pool->mutex);
+    if (pool->keys) aws_mem_release(alloc, pool->keys);
+    aws_mem_release(alloc, pool);
+
+    return NULL;
+}
+
+void aws_cryptosdk_sig_key_pool_destroy(struct aws_cryptosdk_sig_key_pool *pool) {
+    if (!pool) return;
+
+    aws_mutex_lock(&pool->mutex);
+    pool->shutdown = true;
+    aws_condition_variable_notify_all(&pool->wakeup);
+    aws_mutex_unlock(&pool->mutex);
+
+    aws_thread_join(&pool->refill_thread);
+    aws_thread_clean_up(&pool->refill_thread);
+
+    /* EC_KEY_free clears the private key */
+    for (size_t i = 0; i < pool->count; i++) {
+        EC_KEY_free(pool->keys[i].keypair);
+        aws_string_destroy(pool->keys[i].pub_key);
+    }
+
+    aws_condition_variable_clean_up(&pool->wakeup);
+    aws_mutex_clean_up(&pool->mutex);
+    aws_mem_release(pool->alloc, pool->keys);
+    aws_mem_release(pool->alloc, pool);
+}
+
+size_t aws_cryptosdk_sig_key_pool_available(struct aws_cryptosdk_sig_key_pool *pool) {
+    size_t count;
+
+    aws_mutex_lock(&pool->mutex);
+    count = pool->count;
+    aws_mutex_unlock(&pool->mutex);
+
+    return count;
+}
+
+/* Takes an entry from the pool, or returns one with a NULL keypair if the pool is empty */
+static struct key_pool_entry key_pool_take(struct aws_cryptosdk_sig_key_pool *pool) {
+    struct key_pool_entry entry = { NULL, NULL };
+
+    if (aws_mutex_lock(&pool->mutex)) return entry;
+    if (pool->count) {
+        entry                   = pool->keys[--pool->count];
+        pool->keys[pool->count] = (struct key_pool_entry){ NULL, NULL };
+        aws_condition_variable_notify_one(&pool->wakeup);
+    }
+    aws_mutex_unlock(&pool->mutex);
+
+    return entry;
+}
+
+int aws_cryptosdk_sig_sign_start_pooled(
+    struct aws_cryptosdk_sig_ctx **pctx,
+    struct aws_allocator *alloc,
+    struct aws_string **pub_key,
+    const struct aws_cryptosdk_alg_properties *props,
+    struct aws_cryptosdk_sig_key_pool *pool) {
+    struct key_pool_entry entry = { NULL, NULL };
+
+    if (pool && props->impl->curve_name && !strcmp(pool->props->impl->curve_name, props->impl->curve_name)) {
+        entry = key_pool_take(pool);
+    }
+
+    if (!entry.keypair) {
+        return aws_cryptosdk_sig_sign_start_keygen(pctx, alloc, pub_key, props);
+    }
+
+    *pctx = NULL;
+    if (pub_key) {
+        *pub_key = NULL;
+    }
+
+    if (pub_key) {
+        /*
+         * The string the refill thread serialized is handed over as is, unless it came from
+         * another allocator, which might not outlive the caller's use of it
+         */
+        if (aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_CIPHER) == pool->alloc) {
+            *pub_key      = entry.pub_key;
+            entry.pub_key = NULL;
+        } else if (serialize_pubkey(alloc, entry.keypair, pub_key)) {
+            goto err;
+        }
+    }
+
+    if (!(*pctx = sign_start(alloc, entry.keypair, props))) {
+        goto err;
+    }
+
+    EC_KEY_free(entry.keypair);
+    aws_string_destroy(entry.pub_key);
+
+    return AWS_OP_SUCCESS;
+
+err:
+    if (pub_key) {
+        aws_string_destroy(*pub_key);
+        *pub_key = NULL;
+    }
+    EC_KEY_free(entry.keypair);
+    aws_string_destroy(entry.pub_key);
+
+    return AWS_OP_ERR;
+}
+
 // TODO: add preconditions that if the ctx/pkey/keypair exist, they are valid.
 void aws_cryptosdk_sig_abort(struct aws_cryptosdk_sig_ctx *ctx) {
     AWS_PRECONDITION(ctx == NULL || aws_allocator_is_valid(ctx->alloc));
@@ -558,7 +1066,7 @@ int aws_cryptosdk_sig_sign_start(
     }
 
     EC_KEY *keypair             = NULL;
-    EC_GROUP *group             = NULL;
+    const EC_GROUP *group       = NULL;
     ASN1_INTEGER *priv_key_asn1 = NULL;
     BIGNUM *priv_key_bn         = NULL;
 
@@ -595,10 +1103,8 @@ int aws_cryptosdk_sig_sign_start(
 
     if (!EC_KEY_set_group(keypair, group)) {
         aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
-        EC_GROUP_free(group);
         goto out;
     }
-    EC_GROUP_free(group);
     EC_KEY_set_conv_form(keypair, POINT_CONVERSION_COMPRESSED);
 
     field = aws_byte_cursor_advance(&cursor, pubkey_len);
@@ -666,24 +1172,97 @@ out:
     return *ctx ? AWS_OP_SUCCESS : AWS_OP_ERR;
 }
 
-static int load_pubkey(
-    EC_KEY **key, const struct aws_cryptosdk_alg_properties *props, const struct aws_string *pub_key_s) {
-    int result                              = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
-    EC_GROUP *group                         = NULL;
-    uint8_t b64_decode_arr[MAX_PUBKEY_SIZE] = { 0 };
-    struct aws_byte_buf b64_decode_buf      = aws_byte_buf_from_array(b64_decode_arr, sizeof(b64_decode_arr));
-    struct aws_byte_cursor pub_key          = aws_byte_cursor_from_string(pub_key_s);
+/*
+ * Decompressing a public key takes a modular square root, so the most recently used verification keys are kept,
+ * keyed by curve and compressed point. Messages signed with the same key, such as those produced from cached
+ * encryption materials, then share one EVP_PKEY. Cached keys are never modified, and EVP_PKEYs are reference
+ * counted, so an entry may be evicted while contexts still hold its key.
+ */
+#define PUBKEY_CACHE_SIZE 16
 
-    *key = NULL;
+struct pubkey_cache_entry {
+    const char *curve_name;
+    uint8_t point[MAX_PUBKEY_SIZE];
+    size_t point_len;
+    EVP_PKEY *pkey;
+    uint64_t last_used;
+};
 
-    if (aws_base64_decode(&pub_key, &b64_decode_buf)) {
-        /*
-         * This'll happen if e.g. the public key is too large (aws_base64_decode checks the output buffer capacity),
-         * or if it's just bad base64.
-         */
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+static struct {
+    /* Protects entries and clock */
+    struct aws_mutex mutex;
+    struct pubkey_cache_entry entries[PUBKEY_CACHE_SIZE];
+    uint64_t clock;
+} pubkey_cache = { .mutex = AWS_MUTEX_INIT };
+
+static bool pubkey_cache_entry_matches(
+    const struct pubkey_cache_entry *entry, const char *curve_name, const struct aws_byte_buf *point) {
+    return entry->pkey && !strcmp(entry->curve_name, curve_name) && entry->point_len == point->len &&
+           !memcmp(entry->point, point->buffer, point->len);
+}
+
+/* Returns a new reference on the cached key for point, or NULL if there is none */
+static EVP_PKEY *pubkey_cache_get(const char *curve_name, const struct aws_byte_buf *point) {
+    EVP_PKEY *pkey = NULL;
+
+    aws_mutex_lock(&pubkey_cache.mutex);
+    for (size_t i = 0; i < PUBKEY_CACHE_SIZE; i++) {
+        struct pubkey_cache_entry *entry = &pubkey_cache.entries[i];
+
+        if (pubkey_cache_entry_matches(entry, curve_name, point)) {
+            entry->last_used = ++pubkey_cache.clock;
+            pkey             = entry->pkey;
+            EVP_PKEY_up_ref(pkey);
+            break;
+        }
+    }
+    aws_mutex_unlock(&pubkey_cache.mutex);
+
+    return pkey;
+}
+
+/* Caches a reference on pkey, evicting the least recently used entry if the cache is full */
+static void pubkey_cache_put(const char *curve_name, const struct aws_byte_buf *point, EVP_PKEY *pkey) {
+    EVP_PKEY *evicted = NULL;
+
+    aws_mutex_lock(&pubkey_cache.mutex);
+    struct pubkey_cache_entry *victim = &pubkey_cache.entries[0];
+    for (size_t i = 0; i < PUBKEY_CACHE_SIZE; i++) {
+        struct pubkey_cache_entry *entry = &pubkey_cache.entries[i];
+
+        if (pubkey_cache_entry_matches(entry, curve_name, point)) {
+            // Another thread loaded the same key first
+            victim = NULL;
+            break;
+        }
+        if (!entry->pkey || (victim->pkey && entry->last_used < victim->last_used)) {
+            victim = entry;
+        }
     }
 
+    if (victim) {
+        evicted = victim->pkey;
+        EVP_PKEY_up_ref(pkey);
+
+        victim->curve_name = curve_name;
+        memcpy(victim->point, point->buffer, point->len);
+        victim->point_len = point->len;
+        victim->pkey      = pkey;
+        victim->last_used = ++pubkey_cache.clock;
+    }
+    aws_mutex_unlock(&pubkey_cache.mutex);
+
+    // Contexts may still hold the evicted key, in which case this only drops the cache's reference
+    EVP_PKEY_free(evicted);
+}
+
+static int decompress_pubkey(
+    EC_KEY **key, const struct aws_cryptosdk_alg_properties *props, const struct aws_byte_buf *point) {
+    int result            = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
+    const EC_GROUP *group = NULL;
+
+    *key = NULL;
+
     group = group_for_props(props);
     if (!group) {
         goto out;
@@ -701,22 +1280,74 @@ static int load_pubkey(
     }
     EC_KEY_set_conv_form(*key, POINT_CONVERSION_COMPRESSED);
 
-    const unsigned char *pBuf = b64_decode_buf.buffer;
+    const unsigned char *pBuf = point->buffer;
 
-    if (!o2i_ECPublicKey(key, &pBuf, b64_decode_buf.len)) {
+    if (!o2i_ECPublicKey(key, &pBuf, point->len)) {
         result = AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT;
         goto out;
     }
 
     result = AWS_OP_SUCCESS;
 out:
-    // The EC_KEY_set_group method copies the provided group.
-
-    EC_GROUP_free(group);
     if (result) {
         EC_KEY_free(*key);
         *key = NULL;
     }
+
+    return result ? aws_raise_error(result) : AWS_OP_SUCCESS;
+}
+
+/* Sets *key and *pkey to new references on the verification key encoded in pub_key_s */
+static int load_pubkey(
+    EC_KEY **key,
+    EVP_PKEY **pkey,
+    const struct aws_cryptosdk_alg_properties *props,
+    const struct aws_string *pub_key_s) {
+    int result                              = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
+    uint8_t b64_decode_arr[MAX_PUBKEY_SIZE] = { 0 };
+    struct aws_byte_buf b64_decode_buf      = aws_byte_buf_from_array(b64_decode_arr, sizeof(b64_decode_arr));
+    struct aws_byte_cursor pub_key          = aws_byte_cursor_from_string(pub_key_s);
+
+    *key  = NULL;
+    *pkey = NULL;
+
+    if (aws_base64_decode(&pub_key, &b64_decode_buf)) {
+        /*
+         * This'll happen if e.g. the public key is too large (aws_base64_decode checks the output buffer capacity),
+         * or if it's just bad base64.
+         */
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    }
+
+    if ((*pkey = pubkey_cache_get(props->impl->curve_name, &b64_decode_buf))) {
+        if (!(*key = EVP_PKEY_get1_EC_KEY(*pkey))) {
+            goto out;
+        }
+
+        result = AWS_OP_SUCCESS;
+        goto out;
+    }
+
+    if (decompress_pubkey(key, props, &b64_decode_buf)) {
+        result = aws_last_error();
+        goto out;
+    }
+
+    if (!(*pkey = EVP_PKEY_new()) || !EVP_PKEY_set1_EC_KEY(*pkey, *key)) {
+        result = AWS_ERROR_OOM;
+        goto out;
+    }
+
+    pubkey_cache_put(props->impl->curve_name, &b64_decode_buf, *pkey);
+
+    result = AWS_OP_SUCCESS;
+out:
+    if (result) {
+        EVP_PKEY_free(*pkey);
+        EC_KEY_free(*key);
+        *pkey = NULL;
+        *key  = NULL;
+    }
     aws_secure_zero(b64_decode_arr, sizeof(b64_decode_arr));
 
     return result ? aws_raise_error(result) : AWS_OP_SUCCESS;
@@ -733,6 +1364,7 @@ int aws_cryptosdk_sig_verify_start(
     AWS_PRECONDITION(props);
 
     *pctx = NULL;
+    alloc = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_CIPHER);
 
     if (!props->impl->curve_name) {
         AWS_POSTCONDITION(!*pctx);
@@ -750,18 +1382,10 @@ int aws_cryptosdk_sig_verify_start(
         .alloc = alloc, .props = props, .keypair = NULL, .pkey = NULL, .is_sign = false
     };
 
-    if (load_pubkey(&ctx->keypair, props, pub_key)) {
+    if (load_pubkey(&ctx->keypair, &ctx->pkey, props, pub_key)) {
         goto rethrow;
     }
 
-    if (!(ctx->pkey = EVP_PKEY_new())) {
-        goto oom;
-    }
-
-    if (!EVP_PKEY_set1_EC_KEY(ctx->pkey, ctx->keypair)) {
-        goto oom;
-    }
-
     if (!(ctx->ctx = EVP_MD_CTX_new())) {
         goto oom;
     }
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/common/atomics.h>
+#include <aws/common/clock.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/private/coarse_clock.h>
+
+/*
+ * Atomics only hold a size_t, so the sample is published in two halves under a sequence count,
+ * which is odd while the ticker is writing; readers retry until they see the same even count
+ * before and after reading both halves. There is only ever one writer: the ticker, or the first
+ * holder before it launches the ticker.
+ */
+static struct aws_atomic_var sample_seq = AWS_ATOMIC_VAR_INTVAL(0);
+static struct aws_atomic_var sample_hi  = AWS_ATOMIC_VAR_INTVAL(0);
+static struct aws_atomic_var sample_lo  = AWS_ATOMIC_VAR_INTVAL(0);
+
+/* Held for the whole of acquire and release, so that a new ticker never starts while the old one is joined */
+static struct aws_mutex lifecycle_mutex = AWS_MUTEX_INIT;
+static size_t holders;
+static struct aws_thread ticker;
+
+/* Protect the ticker's interval and stop flag, and let release cut its sleep short */
+static struct aws_mutex ticker_mutex             = AWS_MUTEX_INIT;
+static struct aws_condition_variable ticker_cond = AWS_CONDITION_VARIABLE_INIT;
+static uint64_t tick_ns;
+static bool stopping;
+
+static void publish(uint64_t now) {
+    size_t seq = aws_atomic_load_int(&sample_seq);
+
+    aws_atomic_store_int(&sample_seq, seq + 1);
+    aws_atomic_store_int(&sample_hi, (size_t)(now >> 32));
+    aws_atomic_store_int(&sample_lo, (size_t)(now & 0xFFFFFFFF));
+    aws_atomic_store_int(&sample_seq, seq + 2);
+}
+
+static void run_ticker(void *arg) {
+    (void)arg;
+
+    aws_mutex_lock(&ticker_mutex);
+    while (!stopping) {
+        uint64_t now;
+
+        aws_condition_variable_wait_for(&ticker_cond, &ticker_mutex, (int64_t)tick_ns);
+        // A failed sample leaves the last one in place; the next tick will try again
+        if (!stopping && !aws_sys_clock_get_ticks(&now)) {
+            publish(now);
+        }
+    }
+    aws_mutex_unlock(&ticker_mutex);
+}
+
+int aws_cryptosdk_priv_coarse_clock_acquire(uint64_t precision_ns) {
+    int rv = AWS_OP_SUCCESS;
+
+    if (!precision_ns || precision_ns > INT64_MAX) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+
+    aws_mutex_lock(&lifecycle_mutex);
+    if (!holders) {
+        uint64_t now;
+
+        if (aws_sys_clock_get_ticks(&now)) {
+            rv = AWS_OP_ERR;
+            goto out;
+        }
+        publish(now);
+        tick_ns  = precision_ns;
+        stopping = false;
+
+        if (aws_thread_init(&ticker, aws_default_allocator())) {
+            rv = AWS_OP_ERR;
+            goto out;
+        }
+        if (aws_thread_launch(&ticker, run_ticker, NULL, aws_default_thread_options())) {
+            aws_thread_clean_up(&ticker);
+            rv = AWS_OP_ERR;
+            goto out;
+        }
+    } else {
+        aws_mutex_lock(&ticker_mutex);
+        if (precision_ns < tick_ns) {
+            // Wake the ticker so that the finer interval applies from now on
+            tick_ns = precision_ns;
+            aws_condition_variable_notify_all(&ticker_cond);
+        }
+        aws_mutex_unlock(&ticker_mutex);
+    }
+    holders++;
+
+out:
+    aws_mutex_unlock(&lifecycle_mutex);
+    return rv;
+}
+
+void aws_cryptosdk_priv_coarse_clock_release(void) {
+    aws_mutex_lock(&lifecycle_mutex);
+    if (holders && !--holders) {
+        aws_mutex_lock(&ticker_mutex);
+        stopping = true;
+        aws_condition_variable_notify_all(&ticker_cond);
+        aws_mutex_unlock(&ticker_mutex);
+
+        aws_thread_join(&ticker);
+        aws_thread_clean_up(&ticker);
+    }
+    aws_mutex_unlock(&lifecycle_mutex);
+}
+
+int aws_cryptosdk_priv_coarse_clock_get_ticks(uint64_t *now) {
+    size_t seq, hi, lo;
+
+    do {
+        seq = aws_atomic_load_int(&sample_seq);
+        hi  = aws_atomic_load_int(&sample_hi);
+        lo  = aws_atomic_load_int(&sample_lo);
+    } while ((seq & 1) || seq != aws_atomic_load_int(&sample_seq));
+
+    *now = ((uint64_t)hi << 32) | (uint64_t)lo;
+    return AWS_OP_SUCCESS;
+}
@@ -0,0 +1,262 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits.h>
+
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/compress.h>
+#include <aws/cryptosdk/private/config.h>
+
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZSTD
+#    include <zstd.h>
+#endif
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZLIB
+#    include <zlib.h>
+#endif
+
+AWS_STATIC_STRING_FROM_LITERAL(COMPRESSION_KEY, "aws-crypto-compression");
+AWS_STATIC_STRING_FROM_LITERAL(ZSTD_NAME, "zstd");
+AWS_STATIC_STRING_FROM_LITERAL(ZLIB_NAME, "zlib");
+
+
+struct aws_cryptosdk_codec {
+    struct aws_allocator *alloc;
+    enum aws_cryptosdk_compression compression;
+    bool compress;
+    union {
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZSTD
+        ZSTD_CCtx *cctx;
+        ZSTD_DCtx *dctx;
+#endif
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZLIB
+        z_stream zs;
+#endif
+        char unused;
+    } u;
+};
+
+const struct aws_string *aws_cryptosdk_priv_compression_key(void) {
+    return COMPRESSION_KEY;
+}
+
+bool aws_cryptosdk_compression_available(enum aws_cryptosdk_compression compression) {
+    switch (compression) {
+        case AWS_CRYPTOSDK_COMPRESSION_NONE: return true;
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZSTD
+        case AWS_CRYPTOSDK_COMPRESSION_ZSTD: return true;
+#endif
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZLIB
+        case AWS_CRYPTOSDK_COMPRESSION_ZLIB: return true;
+#endif
+        default: return false;
+    }
+}
+
+const struct aws_string *aws_cryptosdk_priv_compression_name(enum aws_cryptosdk_compression compression) {
+    switch (compression) {
+        case AWS_CRYPTOSDK_COMPRESSION_ZSTD: return ZSTD_NAME;
+        case AWS_CRYPTOSDK_COMPRESSION_ZLIB: return ZLIB_NAME;
+        default: return NULL;
+    }
+}
+
+int aws_cryptosdk_priv_compression_from_name(
+    const struct aws_string *name, enum aws_cryptosdk_compression *compression) {
+    if (aws_string_eq(name, ZSTD_NAME)) {
+        *compression = AWS_CRYPTOSDK_COMPRESSION_ZSTD;
+    } else if (aws_string_eq(name, ZLIB_NAME)) {
+        *compression = AWS_CRYPTOSDK_COMPRESSION_ZLIB;
+    } else {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
+
+    if (!aws_cryptosdk_compression_available(*compression)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZLIB
+static voidpf zlib_alloc(voidpf opaque, uInt items, uInt size) {
+    return aws_mem_calloc(opaque, items, size);
+}
+
+static void zlib_free(voidpf opaque, voidpf address) {
+    aws_mem_release(opaque, address);
+}
+#endif
+
+struct aws_cryptosdk_codec *aws_cryptosdk_priv_codec_new(
+    struct aws_allocator *alloc, enum aws_cryptosdk_compression compression, bool compress) {
+    if (compression == AWS_CRYPTOSDK_COMPRESSION_NONE || !aws_cryptosdk_compression_available(compression)) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+        return NULL;
+    }
+
+    struct aws_cryptosdk_codec *codec = aws_mem_calloc(alloc, 1, sizeof(*codec));
+    if (!codec) return NULL;
+
+    codec->alloc       = alloc;
+    codec->compression = compression;
+    codec->compress    = compress;
+
+    bool ok = false;
+    switch (compression) {
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZSTD
+        case AWS_CRYPTOSDK_COMPRESSION_ZSTD:
+            if (compress) {
+                ok = (codec->u.cctx = ZSTD_createCCtx()) != NULL;
+            } else {
+                ok = (codec->u.dctx = ZSTD_createDCtx()) != NULL;
+            }
+            break;
+#endif
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZLIB
+        case AWS_CRYPTOSDK_COMPRESSION_ZLIB:
+            codec->u.zs.zalloc = zlib_alloc;
+            codec->u.zs.zfree  = zlib_free;
+            codec->u.zs.opaque = alloc;
+            ok = (compress ? deflateInit(&codec->u.zs, Z_DEFAULT_COMPRESSION) : inflateInit(&codec->u.zs)) == Z_OK;
+            break;
+#endif
+        default: break;
+    }
+
+    if (!ok) {
+        aws_mem_release(alloc, codec);
+        aws_raise_error(AWS_ERROR_OOM);
+        return NULL;
+    }
+
+    return codec;
+}
+
+void aws_cryptosdk_priv_codec_destroy(struct aws_cryptosdk_codec *codec) {
+    if (!codec) return;
+
+    switch (codec->compression) {
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZSTD
+        case AWS_CRYPTOSDK_COMPRESSION_ZSTD:
+            if (codec->compress) {
+                ZSTD_freeCCtx(codec->u.cctx);
+            } else {
+                ZSTD_freeDCtx(codec->u.dctx);
+            }
+            break;
+#endif
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZLIB
+        case AWS_CRYPTOSDK_COMPRESSION_ZLIB:
+            if (codec->compress) {
+                deflateEnd(&codec->u.zs);
+            } else {
+                inflateEnd(&codec->u.zs);
+            }
+            break;
+#endif
+        default: break;
+    }
+
+    aws_mem_release(codec->alloc, codec);
+}
+
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZSTD
+static int zstd_run(
+    struct aws_cryptosdk_codec *codec,
+    struct aws_byte_cursor *input,
+    struct aws_byte_buf *output,
+    bool finish,
+    bool *done) {
+    ZSTD_inBuffer in   = { input->ptr, input->len, 0 };
+    ZSTD_outBuffer out = { output->buffer + output->len, output->capacity - output->len, 0 };
+    size_t rv;
+
+    if (codec->compress) {
+        rv = ZSTD_compressStream2(codec->u.cctx, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(rv)) return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        // Nothing is left to flush once the end of the stream is written
+        *done = finish && !rv;
+    } else {
+        rv = ZSTD_decompressStream(codec->u.dctx, &out, &in);
+        if (ZSTD_isError(rv)) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        *done = !rv;
+    }
+
+    aws_byte_cursor_advance(input, in.pos);
+    output->len += out.pos;
+
+    return AWS_OP_SUCCESS;
+}
+#endif
+
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZLIB
+static int zlib_run(
+    struct aws_cryptosdk_codec *codec,
+    struct aws_byte_cursor *input,
+    struct aws_byte_buf *output,
+    bool finish,
+    bool *done) {
+    /* zlib refuses null buffers even when they are empty */
+    static uint8_t no_room;
+    z_stream *zs = &codec->u.zs;
+    int rv;
+
+    // zlib counts in uInt, so very large buffers are taken a piece at a time
+    uInt in_len  = input->len > UINT_MAX ? UINT_MAX : (uInt)input->len;
+    uInt out_len = output->capacity - output->len > UINT_MAX ? UINT_MAX : (uInt)(output->capacity - output->len);
+
+    zs->next_in   = input->ptr ? input->ptr : &no_room;
+    zs->avail_in  = in_len;
+    zs->next_out  = output->buffer ? output->buffer + output->len : &no_room;
+    zs->avail_out = out_len;
+
+    if (codec->compress) {
+        rv = deflate(zs, finish && in_len == input->len ? Z_FINISH : Z_NO_FLUSH);
+        if (rv != Z_OK && rv != Z_STREAM_END && rv != Z_BUF_ERROR) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        }
+    } else {
+        rv = inflate(zs, Z_NO_FLUSH);
+        if (rv != Z_OK && rv != Z_STREAM_END && rv != Z_BUF_ERROR) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        }
+    }
+    *done = rv == Z_STREAM_END;
+
+    aws_byte_cursor_advance(input, in_len - zs->avail_in);
+    output->len += out_len - zs->avail_out;
+
+    return AWS_OP_SUCCESS;
+}
+#endif
+
+int aws_cryptosdk_priv_codec_run(
+    struct aws_cryptosdk_codec *codec,
+    struct aws_byte_cursor *input,
+    struct aws_byte_buf *output,
+    bool finish,
+    bool *done) {
+    *done = false;
+
+    switch (codec->compression) {
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZSTD
+        case AWS_CRYPTOSDK_COMPRESSION_ZSTD: return zstd_run(codec, input, output, finish, done);
+#endif
+#ifdef AWS_CRYPTOSDK_P_HAVE_ZLIB
+        case AWS_CRYPTOSDK_COMPRESSION_ZLIB: return zlib_run(codec, input, output, finish, done);
+#endif
+        default: return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
+}
@@ -15,6 +15,7 @@
 #include <aws/common/string.h>
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
 
 #include <assert.h>
 
@@ -27,14 +28,17 @@ struct default_cmm {
     struct aws_allocator *alloc;
     struct aws_cryptosdk_keyring *kr;
     const struct aws_cryptosdk_alg_properties *alg_props;
+    /* Pre-generated signing keys, or NULL if keys are generated per message */
+    struct aws_cryptosdk_sig_key_pool *key_pool;
 };
 
-static int default_cmm_generate_enc_materials(
-    struct aws_cryptosdk_cmm *cmm,
-    struct aws_cryptosdk_enc_materials **output,
-    struct aws_cryptosdk_enc_request *request) {
+/*
+ * Creates the encryption materials and sets up the signing key, if any; everything but the call
+ * to the keyring, which must see the public key in the encryption context.
+ */
+static int prepare_enc_materials(
+    struct default_cmm *self, struct aws_cryptosdk_enc_materials **output, struct aws_cryptosdk_enc_request *request) {
     struct aws_cryptosdk_enc_materials *enc_mat      = NULL;
-    struct default_cmm *self                         = (struct default_cmm *)cmm;
     const struct aws_cryptosdk_alg_properties *props = self->alg_props;
     struct aws_hash_element *pElement                = NULL;
     *output                                          = NULL;
@@ -48,28 +52,58 @@ static int default_cmm_generate_enc_materials(
         request->requested_alg = props->alg_id;
     }
 
-    enc_mat = aws_cryptosdk_enc_materials_new(request->alloc, request->requested_alg);
+    enc_mat = aws_cryptosdk_enc_materials_new_from_spare(
+        &request->spare_materials, request->alloc, request->requested_alg);
     if (!enc_mat) goto err;
+    if (request->skip_keyring_trace) aws_cryptosdk_keyring_trace_disable(&enc_mat->keyring_trace);
 
     if (props->signature_len) {
         struct aws_string *pubkey = NULL;
-        if (aws_cryptosdk_sig_sign_start_keygen(&enc_mat->signctx, request->alloc, &pubkey, props)) {
+        if (aws_cryptosdk_sig_sign_start_pooled(&enc_mat->signctx, request->alloc, &pubkey, props, self->key_pool)) {
             goto err;
         }
 
+        // The context takes over the string, which a key from the pool had serialized in advance
         if (aws_hash_table_put(request->enc_ctx, EC_PUBLIC_KEY_FIELD, pubkey, NULL)) {
             aws_string_destroy(pubkey);
             goto err;
         }
     }
 
-    if (aws_cryptosdk_keyring_on_encrypt(
+    *output = enc_mat;
+    return AWS_OP_SUCCESS;
+
+err:
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    return AWS_OP_ERR;
+}
+
+static int default_cmm_generate_enc_materials(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_enc_materials **output,
+    struct aws_cryptosdk_enc_request *request) {
+    struct aws_cryptosdk_enc_materials *enc_mat = NULL;
+    struct default_cmm *self                    = (struct default_cmm *)cmm;
+    *output                                     = NULL;
+
+    if (prepare_enc_materials(self, &enc_mat, request)) return AWS_OP_ERR;
+
+    // The frozen serialization is the one the session writes to the header, if no CMM changed the context
+    struct aws_byte_cursor serialized;
+    const struct aws_byte_cursor *serialized_enc_ctx = NULL;
+    if (request->frozen_enc_ctx && aws_cryptosdk_frozen_enc_ctx_matches(request->frozen_enc_ctx, request->enc_ctx)) {
+        serialized         = aws_cryptosdk_frozen_enc_ctx_serialized(request->frozen_enc_ctx);
+        serialized_enc_ctx = &serialized;
+    }
+
+    if (aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx(
             self->kr,
             request->alloc,
             &enc_mat->unencrypted_data_key,
             &enc_mat->keyring_trace,
             &enc_mat->encrypted_data_keys,
             request->enc_ctx,
+            serialized_enc_ctx,
             request->requested_alg))
         goto err;
 
@@ -81,6 +115,29 @@ err:
     return AWS_OP_ERR;
 }
 
+/* Validates the keyring's output and sets up signature verification, if needed */
+static int finish_dec_materials(
+    struct aws_cryptosdk_dec_materials *dec_mat, struct aws_cryptosdk_dec_request *request) {
+    if (!dec_mat->unencrypted_data_key.buffer) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT);
+    }
+
+    const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(request->alg);
+    if (props->signature_len && !request->skip_signature) {
+        struct aws_hash_element *pElement = NULL;
+
+        if (aws_hash_table_find(request->enc_ctx, EC_PUBLIC_KEY_FIELD, &pElement) || !pElement || !pElement->key) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        }
+
+        if (aws_cryptosdk_sig_verify_start(&dec_mat->signctx, request->alloc, pElement->value, props)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
 static int default_cmm_decrypt_materials(
     struct aws_cryptosdk_cmm *cmm,
     struct aws_cryptosdk_dec_materials **output,
@@ -88,59 +145,178 @@ static int default_cmm_decrypt_materials(
     struct aws_cryptosdk_dec_materials *dec_mat;
     struct default_cmm *self = (struct default_cmm *)cmm;
 
-    dec_mat = aws_cryptosdk_dec_materials_new(request->alloc, request->alg);
+    dec_mat = aws_cryptosdk_dec_materials_new_from_spare(&request->spare_materials, request->alloc, request->alg);
     if (!dec_mat) goto err;
+    if (request->skip_keyring_trace) aws_cryptosdk_keyring_trace_disable(&dec_mat->keyring_trace);
 
-    if (aws_cryptosdk_keyring_on_decrypt(
+    if (aws_cryptosdk_keyring_on_decrypt_with_serialized_ctx(
             self->kr,
             request->alloc,
             &dec_mat->unencrypted_data_key,
             &dec_mat->keyring_trace,
             &request->encrypted_data_keys,
             request->enc_ctx,
+            request->serialized_enc_ctx.ptr ? &request->serialized_enc_ctx : NULL,
             request->alg))
         goto err;
 
-    if (!dec_mat->unencrypted_data_key.buffer) {
-        aws_raise_error(AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT);
-        goto err;
+    if (finish_dec_materials(dec_mat, request)) goto err;
+
+    *output = dec_mat;
+    return AWS_OP_SUCCESS;
+
+err:
+    *output = NULL;
+    aws_cryptosdk_dec_materials_destroy(dec_mat);
+    return AWS_OP_ERR;
+}
+
+/* An asynchronous request in flight to the keyring */
+struct default_cmm_async_call {
+    struct aws_allocator *alloc;
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    struct aws_cryptosdk_dec_materials *dec_mat;
+    struct aws_cryptosdk_dec_request *dec_request;
+    aws_cryptosdk_enc_materials_fn *enc_callback;
+    aws_cryptosdk_dec_materials_fn *dec_callback;
+    void *user_data;
+};
+
+static void default_cmm_enc_keyring_done(int error_code, void *user_data) {
+    struct default_cmm_async_call *call         = user_data;
+    struct aws_cryptosdk_enc_materials *enc_mat = call->enc_mat;
+    aws_cryptosdk_enc_materials_fn *callback    = call->enc_callback;
+    void *callback_data                         = call->user_data;
+
+    aws_mem_release(call->alloc, call);
+
+    if (error_code) {
+        aws_cryptosdk_enc_materials_destroy(enc_mat);
+        enc_mat = NULL;
     }
 
-    const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(request->alg);
-    if (props->signature_len) {
-        struct aws_hash_element *pElement = NULL;
+    callback(enc_mat, error_code, callback_data);
+}
 
-        if (aws_hash_table_find(request->enc_ctx, EC_PUBLIC_KEY_FIELD, &pElement) || !pElement || !pElement->key) {
-            aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
-            goto err;
-        }
+static int default_cmm_generate_enc_materials_async(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_enc_request *request,
+    aws_cryptosdk_enc_materials_fn *callback,
+    void *user_data) {
+    struct aws_cryptosdk_enc_materials *enc_mat = NULL;
+    struct default_cmm *self                    = (struct default_cmm *)cmm;
+    struct default_cmm_async_call *call         = NULL;
+
+    if (prepare_enc_materials(self, &enc_mat, request)) return AWS_OP_ERR;
+
+    if (!(call = aws_mem_calloc(request->alloc, 1, sizeof(*call)))) goto err;
+    call->alloc        = request->alloc;
+    call->enc_mat      = enc_mat;
+    call->enc_callback = callback;
+    call->user_data    = user_data;
+
+    if (aws_cryptosdk_keyring_on_encrypt_async(
+            self->kr,
+            request->alloc,
+            &enc_mat->unencrypted_data_key,
+            &enc_mat->keyring_trace,
+            &enc_mat->encrypted_data_keys,
+            request->enc_ctx,
+            request->requested_alg,
+            default_cmm_enc_keyring_done,
+            call))
+        goto err;
 
-        if (aws_cryptosdk_sig_verify_start(&dec_mat->signctx, request->alloc, pElement->value, props)) {
-            goto err;
-        }
+    return AWS_OP_SUCCESS;
+
+err:
+    if (call) aws_mem_release(request->alloc, call);
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    return AWS_OP_ERR;
+}
+
+static void default_cmm_dec_keyring_done(int error_code, void *user_data) {
+    struct default_cmm_async_call *call         = user_data;
+    struct aws_cryptosdk_dec_materials *dec_mat = call->dec_mat;
+    aws_cryptosdk_dec_materials_fn *callback    = call->dec_callback;
+    void *callback_data                         = call->user_data;
+
+    if (!error_code && finish_dec_materials(dec_mat, call->dec_request)) {
+        error_code = aws_last_error();
     }
 
-    *output = dec_mat;
+    aws_mem_release(call->alloc, call);
+
+    if (error_code) {
+        aws_cryptosdk_dec_materials_destroy(dec_mat);
+        dec_mat = NULL;
+    }
+
+    callback(dec_mat, error_code, callback_data);
+}
+
+static int default_cmm_decrypt_materials_async(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_dec_request *request,
+    aws_cryptosdk_dec_materials_fn *callback,
+    void *user_data) {
+    struct aws_cryptosdk_dec_materials *dec_mat = NULL;
+    struct default_cmm *self                    = (struct default_cmm *)cmm;
+    struct default_cmm_async_call *call         = NULL;
+
+    dec_mat = aws_cryptosdk_dec_materials_new_from_spare(&request->spare_materials, request->alloc, request->alg);
+    if (!dec_mat) goto err;
+    if (request->skip_keyring_trace) aws_cryptosdk_keyring_trace_disable(&dec_mat->keyring_trace);
+
+    if (!(call = aws_mem_calloc(request->alloc, 1, sizeof(*call)))) goto err;
+    call->alloc        = request->alloc;
+    call->dec_mat      = dec_mat;
+    call->dec_request  = request;
+    call->dec_callback = callback;
+    call->user_data    = user_data;
+
+    if (aws_cryptosdk_keyring_on_decrypt_async(
+            self->kr,
+            request->alloc,
+            &dec_mat->unencrypted_data_key,
+            &dec_mat->keyring_trace,
+            &request->encrypted_data_keys,
+            request->enc_ctx,
+            request->alg,
+            default_cmm_dec_keyring_done,
+            call))
+        goto err;
+
     return AWS_OP_SUCCESS;
 
 err:
-    *output = NULL;
+    if (call) aws_mem_release(request->alloc, call);
     aws_cryptosdk_dec_materials_destroy(dec_mat);
     return AWS_OP_ERR;
 }
 
+static bool default_cmm_may_decrypt(const struct aws_cryptosdk_cmm *cmm, const struct aws_array_list *edks) {
+    const struct default_cmm *self = (const struct default_cmm *)cmm;
+    return aws_cryptosdk_keyring_may_decrypt(self->kr, edks);
+}
+
 static void default_cmm_destroy(struct aws_cryptosdk_cmm *cmm) {
     struct default_cmm *self = (struct default_cmm *)cmm;
+    aws_cryptosdk_sig_key_pool_destroy(self->key_pool);
     aws_cryptosdk_keyring_release(self->kr);
     aws_mem_release(self->alloc, self);
 }
 
-static const struct aws_cryptosdk_cmm_vt default_cmm_vt = { .vt_size = sizeof(struct aws_cryptosdk_cmm_vt),
-                                                            .name    = "default cmm",
-                                                            .destroy = default_cmm_destroy,
-                                                            .generate_enc_materials =
-                                                                default_cmm_generate_enc_materials,
-                                                            .decrypt_materials = default_cmm_decrypt_materials };
+static const struct aws_cryptosdk_cmm_vt default_cmm_vt = {
+    .vt_size                      = sizeof(struct aws_cryptosdk_cmm_vt),
+    .name                         = "default cmm",
+    .destroy                      = default_cmm_destroy,
+    .generate_enc_materials       = default_cmm_generate_enc_materials,
+    .decrypt_materials            = default_cmm_decrypt_materials,
+    .generate_enc_materials_async = default_cmm_generate_enc_materials_async,
+    .decrypt_materials_async      = default_cmm_decrypt_materials_async,
+    .may_decrypt                  = default_cmm_may_decrypt
+};
 
 struct aws_cryptosdk_cmm *aws_cryptosdk_default_cmm_new(struct aws_allocator *alloc, struct aws_cryptosdk_keyring *kr) {
     struct default_cmm *cmm;
@@ -149,8 +325,9 @@ struct aws_cryptosdk_cmm *aws_cryptosdk_default_cmm_new(struct aws_allocator *al
 
     aws_cryptosdk_cmm_base_init(&cmm->base, &default_cmm_vt);
 
-    cmm->alloc = alloc;
-    cmm->kr    = aws_cryptosdk_keyring_retain(kr);
+    cmm->alloc    = alloc;
+    cmm->kr       = aws_cryptosdk_keyring_retain(kr);
+    cmm->key_pool = NULL;
 
     aws_cryptosdk_default_cmm_set_alg_id((struct aws_cryptosdk_cmm *)cmm, DEFAULT_ALG);
 
@@ -171,3 +348,25 @@ int aws_cryptosdk_default_cmm_set_alg_id(struct aws_cryptosdk_cmm *cmm, enum aws
 
     return AWS_OP_SUCCESS;
 }
+
+int aws_cryptosdk_default_cmm_set_sig_key_pool_depth(struct aws_cryptosdk_cmm *cmm, size_t depth) {
+    struct default_cmm *self                = (struct default_cmm *)cmm;
+    struct aws_cryptosdk_sig_key_pool *pool = NULL;
+
+    assert(self->base.vtable == &default_cmm_vt);
+
+    if (depth) {
+        if (!self->alg_props->signature_len) {
+            return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        }
+
+        if (!(pool = aws_cryptosdk_sig_key_pool_new(self->alloc, self->alg_props, depth))) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    aws_cryptosdk_sig_key_pool_destroy(self->key_pool);
+    self->key_pool = pool;
+
+    return AWS_OP_SUCCESS;
+}
@@ -12,7 +12,9 @@
  * implied. See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <aws/common/math.h>
 #include <aws/cryptosdk/edk.h>
+#include <aws/cryptosdk/error.h>
 
 int aws_cryptosdk_edk_list_init(struct aws_allocator *alloc, struct aws_array_list *edk_list) {
     const int initial_size = 4;  // arbitrary starting point, list will resize as necessary
@@ -25,6 +27,7 @@ void aws_cryptosdk_edk_clean_up(struct aws_cryptosdk_edk *edk) {
     if (edk->provider_id.allocator) aws_byte_buf_clean_up(&edk->provider_id);
     if (edk->provider_info.allocator) aws_byte_buf_clean_up(&edk->provider_info);
     if (edk->ciphertext.allocator) aws_byte_buf_clean_up(&edk->ciphertext);
+    if (edk->record.allocator) aws_byte_buf_clean_up(&edk->record);
     AWS_POSTCONDITION(aws_cryptosdk_edk_is_valid(edk));
 }
 
@@ -46,29 +49,178 @@ void aws_cryptosdk_edk_list_clean_up(struct aws_array_list *edk_list) {
     aws_array_list_clean_up(edk_list);
 }
 
+int aws_cryptosdk_edk_init_packed(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_edk *edk,
+    size_t provider_id_len,
+    size_t provider_info_len,
+    size_t ciphertext_len) {
+    AWS_PRECONDITION(aws_allocator_is_valid(alloc));
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_WRITABLE(edk));
+
+    struct aws_byte_buf *fields[] = { &edk->provider_id, &edk->provider_info, &edk->ciphertext };
+    size_t lens[]                 = { provider_id_len, provider_info_len, ciphertext_len };
+    size_t total;
+
+    AWS_ZERO_STRUCT(*edk);
+    if (aws_add_size_checked(provider_id_len, provider_info_len, &total) ||
+        aws_add_size_checked(total, ciphertext_len, &total)) {
+        return AWS_OP_ERR;
+    }
+    if (!total) {
+        return AWS_OP_SUCCESS;
+    }
+
+    uint8_t *block = aws_mem_acquire(alloc, total);
+    if (!block) {
+        return AWS_OP_ERR;
+    }
+
+    /* The first non-empty buffer starts the block and so owns it; the others only borrow */
+    bool owned = false;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (!lens[i]) continue;
+        *fields[i] = aws_byte_buf_from_empty_array(block, lens[i]);
+        if (!owned) {
+            fields[i]->allocator = alloc;
+            owned                = true;
+        }
+        block += lens[i];
+    }
+
+    AWS_POSTCONDITION(aws_cryptosdk_edk_is_valid(edk));
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_edk_init_record(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_edk *edk,
+    size_t provider_id_len,
+    size_t provider_info_len,
+    size_t ciphertext_len) {
+    AWS_PRECONDITION(aws_allocator_is_valid(alloc));
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_WRITABLE(edk));
+
+    struct aws_byte_buf *fields[] = { &edk->provider_id, &edk->provider_info, &edk->ciphertext };
+    size_t lens[]                 = { provider_id_len, provider_info_len, ciphertext_len };
+
+    AWS_ZERO_STRUCT(*edk);
+    if (provider_id_len > UINT16_MAX || provider_info_len > UINT16_MAX || ciphertext_len > UINT16_MAX) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+    if (aws_byte_buf_init(&edk->record, alloc, 6 + provider_id_len + provider_info_len + ciphertext_len)) {
+        return AWS_OP_ERR;
+    }
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        aws_byte_buf_write_be16(&edk->record, (uint16_t)lens[i]);
+        if (lens[i]) *fields[i] = aws_byte_buf_from_empty_array(edk->record.buffer + edk->record.len, lens[i]);
+        edk->record.len += lens[i];
+    }
+
+    AWS_POSTCONDITION(aws_cryptosdk_edk_is_valid(edk));
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_edk_init_view(struct aws_cryptosdk_edk *edk, struct aws_byte_cursor *cursor) {
+    struct aws_byte_buf *fields[] = { &edk->provider_id, &edk->provider_info, &edk->ciphertext };
+    struct aws_byte_cursor cur    = *cursor;
+
+    AWS_ZERO_STRUCT(*edk);
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        uint16_t field_len;
+
+        if (!aws_byte_cursor_read_be16(&cur, &field_len) || cur.len < field_len) {
+            AWS_ZERO_STRUCT(*edk);
+            return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+        }
+        if (field_len) *fields[i] = aws_byte_buf_from_array(cur.ptr, field_len);
+        aws_byte_cursor_advance(&cur, field_len);
+    }
+
+    edk->record = aws_byte_buf_from_array(cursor->ptr, cursor->len - cur.len);
+    *cursor     = cur;
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Checks that field is empty or lies in the record at *offset, just after its length */
+static bool field_in_record(const struct aws_cryptosdk_edk *edk, const struct aws_byte_buf *field, size_t *offset) {
+    bool in_record = !field->len || field->buffer == edk->record.buffer + *offset + 2;
+
+    *offset += 2 + field->len;
+    return in_record;
+}
+
+bool aws_cryptosdk_edk_has_record(const struct aws_cryptosdk_edk *edk) {
+    size_t offset = 0;
+
+    return edk->record.len && edk->record.len == aws_cryptosdk_edk_record_size(edk) &&
+           field_in_record(edk, &edk->provider_id, &offset) && field_in_record(edk, &edk->provider_info, &offset) &&
+           field_in_record(edk, &edk->ciphertext, &offset);
+}
+
+int aws_cryptosdk_edk_write_record(struct aws_byte_buf *out, const struct aws_cryptosdk_edk *edk) {
+    if (edk->provider_id.len > UINT16_MAX || edk->provider_info.len > UINT16_MAX ||
+        edk->ciphertext.len > UINT16_MAX) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+    if (out->capacity - out->len < aws_cryptosdk_edk_record_size(edk)) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
+
+    if (aws_cryptosdk_edk_has_record(edk)) {
+        aws_byte_buf_write_from_whole_buffer(out, edk->record);
+        return AWS_OP_SUCCESS;
+    }
+
+    aws_byte_buf_write_be16(out, (uint16_t)edk->provider_id.len);
+    aws_byte_buf_write_from_whole_buffer(out, edk->provider_id);
+    aws_byte_buf_write_be16(out, (uint16_t)edk->provider_info.len);
+    aws_byte_buf_write_from_whole_buffer(out, edk->provider_info);
+    aws_byte_buf_write_be16(out, (uint16_t)edk->ciphertext.len);
+    aws_byte_buf_write_from_whole_buffer(out, edk->ciphertext);
+
+    return AWS_OP_SUCCESS;
+}
+
 int aws_cryptosdk_edk_init_clone(
     struct aws_allocator *alloc, struct aws_cryptosdk_edk *dest, const struct aws_cryptosdk_edk *src) {
     AWS_PRECONDITION(aws_allocator_is_valid(alloc));
     AWS_PRECONDITION(AWS_OBJECT_PTR_IS_READABLE(dest));
     AWS_PRECONDITION(aws_cryptosdk_edk_is_valid(src));
 
-    AWS_ZERO_STRUCT(*dest);
+    // A record is copied whole, and stays one
+    if (aws_cryptosdk_edk_has_record(src)) {
+        if (aws_cryptosdk_edk_init_record(
+                alloc, dest, src->provider_id.len, src->provider_info.len, src->ciphertext.len)) {
+            AWS_ZERO_STRUCT(*dest);
+            return AWS_OP_ERR;
+        }
+        memcpy(dest->record.buffer, src->record.buffer, src->record.len);
+        dest->provider_id.len   = dest->provider_id.capacity;
+        dest->provider_info.len = dest->provider_info.capacity;
+        dest->ciphertext.len    = dest->ciphertext.capacity;
+        return AWS_OP_SUCCESS;
+    }
 
-    if (aws_byte_buf_init_copy(&dest->provider_id, alloc, &src->provider_id) ||
-        aws_byte_buf_init_copy(&dest->provider_info, alloc, &src->provider_info) ||
-        aws_byte_buf_init_copy(&dest->ciphertext, alloc, &src->ciphertext)) {
-        aws_cryptosdk_edk_clean_up(dest);
+    if (aws_cryptosdk_edk_init_packed(
+            alloc, dest, src->provider_id.len, src->provider_info.len, src->ciphertext.len)) {
         AWS_ZERO_STRUCT(*dest);
-
         return AWS_OP_ERR;
     }
 
+    aws_byte_buf_write_from_whole_buffer(&dest->provider_id, src->provider_id);
+    aws_byte_buf_write_from_whole_buffer(&dest->provider_info, src->provider_info);
+    aws_byte_buf_write_from_whole_buffer(&dest->ciphertext, src->ciphertext);
+
     return AWS_OP_SUCCESS;
 }
 
 bool aws_cryptosdk_edk_is_valid(const struct aws_cryptosdk_edk *const edk) {
     return AWS_OBJECT_PTR_IS_READABLE(edk) && aws_byte_buf_is_valid(&edk->provider_id) &&
-           aws_byte_buf_is_valid(&edk->provider_info) && aws_byte_buf_is_valid(&edk->ciphertext);
+           aws_byte_buf_is_valid(&edk->provider_info) && aws_byte_buf_is_valid(&edk->ciphertext) &&
+           aws_byte_buf_is_valid(&edk->record);
 }
 
 bool aws_cryptosdk_edk_list_elements_are_valid(const struct aws_array_list *edk_list) {
@@ -14,17 +14,18 @@
  */
 
 #include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/alloc_stats.h>
+#include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/enc_ctx.h>
 #include <aws/cryptosdk/private/utils.h>
 
 #include <aws/common/byte_buf.h>
 #include <aws/common/common.h>
 #include <aws/common/hash_table.h>
+#include <aws/common/private/hash_table_impl.h>
+#include <string.h>
 
-int aws_cryptosdk_enc_ctx_init(struct aws_allocator *alloc, struct aws_hash_table *enc_ctx) {
-    AWS_PRECONDITION(alloc);
-    AWS_PRECONDITION(enc_ctx);
-    size_t initial_size = 10;  // arbitrary starting point, will resize as necessary
+static int enc_ctx_init_sized(struct aws_allocator *alloc, struct aws_hash_table *enc_ctx, size_t initial_size) {
     if (aws_hash_table_init(
             enc_ctx,
             alloc,
@@ -36,9 +37,52 @@ int aws_cryptosdk_enc_ctx_init(struct aws_allocator *alloc, struct aws_hash_tabl
         return AWS_OP_ERR;
     }
 
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_enc_ctx_init(struct aws_allocator *alloc, struct aws_hash_table *enc_ctx) {
+    AWS_PRECONDITION(alloc);
+    AWS_PRECONDITION(enc_ctx);
+    size_t initial_size = 10;  // arbitrary starting point, will resize as necessary
+    if (enc_ctx_init_sized(alloc, enc_ctx, initial_size)) {
+        return AWS_OP_ERR;
+    }
+
     AWS_SUCCEED_WITH_POSTCONDITION(aws_hash_table_is_valid(enc_ctx));
 }
 
+int aws_cryptosdk_enc_ctx_init_with_capacity(
+    struct aws_allocator *alloc, struct aws_hash_table *enc_ctx, size_t capacity) {
+    AWS_PRECONDITION(alloc);
+    AWS_PRECONDITION(enc_ctx);
+    /*
+     * The table grows once its entries pass 95% of its (power of two) size; asking for a
+     * little over capacity / 0.95 slots keeps capacity entries below that
+     */
+    size_t initial_size = aws_add_size_saturating(capacity, capacity / 16 + 1);
+    if (enc_ctx_init_sized(alloc, enc_ctx, initial_size)) {
+        return AWS_OP_ERR;
+    }
+
+    AWS_SUCCEED_WITH_POSTCONDITION(aws_hash_table_is_valid(enc_ctx));
+}
+
+/*
+ * Makes room for count pairs in an empty encryption context, so that adding them does not
+ * rehash it. A table which is too small is replaced with a larger one from the same allocator.
+ */
+static int enc_ctx_reserve(struct aws_hash_table *enc_ctx, size_t count) {
+    struct aws_hash_table larger;
+
+    if (count <= enc_ctx->p_impl->max_load) return AWS_OP_SUCCESS;
+    if (aws_cryptosdk_enc_ctx_init_with_capacity(enc_ctx->p_impl->alloc, &larger, count)) return AWS_OP_ERR;
+
+    aws_hash_table_swap(enc_ctx, &larger);
+    aws_hash_table_clean_up(&larger);
+
+    return AWS_OP_SUCCESS;
+}
+
 int aws_cryptosdk_enc_ctx_size(size_t *size, const struct aws_hash_table *enc_ctx) {
     AWS_PRECONDITION(AWS_OBJECT_PTR_IS_WRITABLE(size));
     AWS_PRECONDITION(aws_hash_table_is_valid(enc_ctx));
@@ -82,6 +126,7 @@ int aws_cryptosdk_enc_ctx_serialize(
     AWS_PRECONDITION(aws_byte_buf_is_valid(output));
     AWS_PRECONDITION(aws_hash_table_is_valid(enc_ctx));
 
+    alloc            = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_ENC_CTX);
     size_t num_elems = aws_hash_table_get_entry_count(enc_ctx);
     if (num_elems > UINT16_MAX) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
 
@@ -125,12 +170,57 @@ WRITE_ERR:
     return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
 }
 
+static int digest_string_field(struct aws_cryptosdk_md_context *md_context, const struct aws_string *field) {
+    uint16_t field_len = aws_hton16((uint16_t)field->len);
+
+    if (aws_cryptosdk_md_update(md_context, &field_len, sizeof(field_len)) ||
+        aws_cryptosdk_md_update(md_context, aws_string_bytes(field), field->len)) {
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_enc_ctx_digest_update(
+    struct aws_allocator *alloc, struct aws_cryptosdk_md_context *md_context, const struct aws_hash_table *enc_ctx) {
+    AWS_PRECONDITION(AWS_OBJECT_PTR_IS_READABLE(alloc));
+    AWS_PRECONDITION(aws_cryptosdk_md_context_is_valid(md_context));
+    AWS_PRECONDITION(aws_hash_table_is_valid(enc_ctx));
+
+    size_t length;
+    if (aws_cryptosdk_enc_ctx_size(&length, enc_ctx)) return AWS_OP_ERR;
+    if (length == 0) return AWS_OP_SUCCESS;  // Empty encryption context
+
+    // The size check above also bounds the number of pairs and the length of each field
+    size_t num_elems      = aws_hash_table_get_entry_count(enc_ctx);
+    uint16_t num_elems_be = aws_hton16((uint16_t)num_elems);
+    if (aws_cryptosdk_md_update(md_context, &num_elems_be, sizeof(num_elems_be))) return AWS_OP_ERR;
+
+    struct aws_array_list elems;
+    if (aws_cryptosdk_hash_elems_array_init(alloc, &elems, enc_ctx)) return AWS_OP_ERR;
+    aws_array_list_sort(&elems, aws_cryptosdk_compare_hash_elems_by_key_string);
+
+    int rv = AWS_OP_SUCCESS;
+    for (size_t idx = 0; idx < num_elems && rv == AWS_OP_SUCCESS; ++idx) {
+        struct aws_hash_element *elem;
+        if (aws_array_list_get_at_ptr(&elems, (void **)&elem, idx) ||
+            digest_string_field(md_context, (const struct aws_string *)elem->key) ||
+            digest_string_field(md_context, (const struct aws_string *)elem->value)) {
+            rv = AWS_OP_ERR;
+        }
+    }
+
+    aws_array_list_clean_up(&elems);
+    return rv;
+}
+
 int aws_cryptosdk_enc_ctx_deserialize(
     struct aws_allocator *alloc, struct aws_hash_table *enc_ctx, struct aws_byte_cursor *cursor) {
     AWS_PRECONDITION(aws_allocator_is_valid(alloc));
     AWS_PRECONDITION(aws_hash_table_is_valid(enc_ctx));
     AWS_PRECONDITION(aws_byte_cursor_is_valid(cursor));
 
+    alloc = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_ENC_CTX);
     aws_cryptosdk_enc_ctx_clear(enc_ctx);
 
     if (cursor->len == 0) {
@@ -143,6 +233,9 @@ int aws_cryptosdk_enc_ctx_deserialize(
     uint16_t elem_count;
     if (!aws_byte_cursor_read_be16(cursor, &elem_count)) goto SHORT_BUF;
     if (!elem_count) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    // Each pair takes at least its two length fields, so a count the input cannot hold fails before reserving room
+    if (cursor->len < (size_t)elem_count * 4) goto SHORT_BUF;
+    if (enc_ctx_reserve(enc_ctx, elem_count)) goto RETHROW;
 
     for (uint16_t i = 0; i < elem_count; i++) {
         uint16_t len;
@@ -252,3 +345,344 @@ int aws_cryptosdk_enc_ctx_clone(
 
     return AWS_OP_SUCCESS;
 }
+
+struct aws_cryptosdk_frozen_enc_ctx {
+    struct aws_allocator *alloc;
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf serialized;
+    uint8_t digest[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t digest_len;
+};
+
+static int digest_serialized(struct aws_cryptosdk_frozen_enc_ctx *frozen) {
+    struct aws_cryptosdk_md_context *md_context;
+
+    if (aws_cryptosdk_md_init(frozen->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512)) return AWS_OP_ERR;
+
+    if (aws_cryptosdk_md_update(md_context, frozen->serialized.buffer, frozen->serialized.len)) {
+        aws_cryptosdk_md_abort(md_context);
+        return AWS_OP_ERR;
+    }
+
+    return aws_cryptosdk_md_finish(md_context, frozen->digest, &frozen->digest_len);
+}
+
+struct aws_cryptosdk_frozen_enc_ctx *aws_cryptosdk_enc_ctx_freeze(
+    struct aws_allocator *alloc, const struct aws_hash_table *enc_ctx) {
+    alloc                                       = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_ENC_CTX);
+    struct aws_cryptosdk_frozen_enc_ctx *frozen = aws_mem_calloc(alloc, 1, sizeof(*frozen));
+    size_t serialized_len;
+
+    if (!frozen) return NULL;
+    frozen->alloc = alloc;
+
+    if (aws_cryptosdk_enc_ctx_init(alloc, &frozen->enc_ctx)) {
+        aws_mem_release(alloc, frozen);
+        return NULL;
+    }
+
+    if (aws_cryptosdk_enc_ctx_clone(alloc, &frozen->enc_ctx, enc_ctx) ||
+        aws_cryptosdk_enc_ctx_size(&serialized_len, enc_ctx) ||
+        aws_byte_buf_init(&frozen->serialized, alloc, serialized_len) ||
+        aws_cryptosdk_enc_ctx_serialize(alloc, &frozen->serialized, &frozen->enc_ctx) || digest_serialized(frozen)) {
+        aws_cryptosdk_frozen_enc_ctx_destroy(frozen);
+        return NULL;
+    }
+
+    return frozen;
+}
+
+void aws_cryptosdk_frozen_enc_ctx_destroy(struct aws_cryptosdk_frozen_enc_ctx *frozen) {
+    if (!frozen) return;
+
+    aws_cryptosdk_enc_ctx_clean_up(&frozen->enc_ctx);
+    aws_byte_buf_clean_up(&frozen->serialized);
+    aws_mem_release(frozen->alloc, frozen);
+}
+
+const struct aws_hash_table *aws_cryptosdk_frozen_enc_ctx_table(const struct aws_cryptosdk_frozen_enc_ctx *frozen) {
+    return &frozen->enc_ctx;
+}
+
+struct aws_byte_cursor aws_cryptosdk_frozen_enc_ctx_serialized(const struct aws_cryptosdk_frozen_enc_ctx *frozen) {
+    return aws_byte_cursor_from_buf(&frozen->serialized);
+}
+
+struct aws_byte_cursor aws_cryptosdk_frozen_enc_ctx_digest(const struct aws_cryptosdk_frozen_enc_ctx *frozen) {
+    return aws_byte_cursor_from_array(frozen->digest, frozen->digest_len);
+}
+
+bool aws_cryptosdk_frozen_enc_ctx_matches(
+    const struct aws_cryptosdk_frozen_enc_ctx *frozen, const struct aws_hash_table *enc_ctx) {
+    if (aws_hash_table_get_entry_count(enc_ctx) != aws_hash_table_get_entry_count(&frozen->enc_ctx)) return false;
+
+    for (struct aws_hash_iter iter = aws_hash_iter_begin(&frozen->enc_ctx); !aws_hash_iter_done(&iter);
+         aws_hash_iter_next(&iter)) {
+        struct aws_hash_element *elem = NULL;
+
+        if (aws_hash_table_find(enc_ctx, iter.element.key, &elem) || !elem) return false;
+        if (!aws_string_eq(elem->value, iter.element.value)) return false;
+    }
+
+    return true;
+}
+
+/*
+ * Index entry of a flat encryption context. Offsets are relative to the start of the serialized
+ * context, which is at most UINT16_MAX bytes long.
+ */
+struct flat_entry {
+    uint16_t key_offset, key_len;
+    uint16_t value_offset, value_len;
+};
+
+static struct flat_entry *flat_entries(const struct aws_cryptosdk_flat_enc_ctx *flat) {
+    return (struct flat_entry *)flat->buffer;
+}
+
+static const uint8_t *flat_data(const struct aws_cryptosdk_flat_enc_ctx *flat) {
+    return flat->buffer + flat->count * sizeof(struct flat_entry);
+}
+
+static int compare_bytes(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len) {
+    // Same order as aws_string_compare, which the canonical serialization is sorted by
+    int r = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+    if (r) return r;
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+static int compare_entries(const uint8_t *data, const struct flat_entry *a, const struct flat_entry *b) {
+    return compare_bytes(data + a->key_offset, a->key_len, data + b->key_offset, b->key_len);
+}
+
+static void sift_down(const uint8_t *data, struct flat_entry *entries, size_t root, size_t count) {
+    while (2 * root + 1 < count) {
+        size_t child = 2 * root + 1;
+
+        if (child + 1 < count && compare_entries(data, &entries[child], &entries[child + 1]) < 0) child++;
+        if (compare_entries(data, &entries[root], &entries[child]) >= 0) return;
+
+        struct flat_entry tmp = entries[root];
+        entries[root]         = entries[child];
+        entries[child]        = tmp;
+        root                  = child;
+    }
+}
+
+/* Heapsort, as qsort has no way to pass the data pointer to the comparator */
+static void sort_entries(const uint8_t *data, struct flat_entry *entries, size_t count) {
+    for (size_t i = count / 2; i > 0; i--) {
+        sift_down(data, entries, i - 1, count);
+    }
+
+    for (size_t end = count; end > 1; end--) {
+        struct flat_entry tmp = entries[0];
+        entries[0]            = entries[end - 1];
+        entries[end - 1]      = tmp;
+        sift_down(data, entries, 0, end - 1);
+    }
+}
+
+/* Reads the pair count of a serialized context, checking that the pairs fill it exactly */
+static int count_serialized_pairs(struct aws_byte_cursor cur, size_t *count) {
+    uint16_t elem_count, len;
+
+    *count = 0;
+    if (cur.len == 0) return AWS_OP_SUCCESS;
+    if (cur.len > UINT16_MAX) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+
+    if (!aws_byte_cursor_read_be16(&cur, &elem_count) || !elem_count) goto bad;
+
+    for (uint16_t i = 0; i < 2 * elem_count; i++) {
+        if (!aws_byte_cursor_read_be16(&cur, &len) || !aws_byte_cursor_advance(&cur, len).ptr) goto bad;
+    }
+    if (cur.len) goto bad;
+
+    *count = elem_count;
+    return AWS_OP_SUCCESS;
+
+bad:
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+}
+
+/* Fills in and sorts the index of a flat context whose serialized data is already in place */
+static int index_flat(struct aws_cryptosdk_flat_enc_ctx *flat) {
+    struct flat_entry *entries = flat_entries(flat);
+    const uint8_t *data        = flat_data(flat);
+    size_t offset              = 2;
+
+    for (size_t i = 0; i < flat->count; i++) {
+        entries[i].key_len      = (uint16_t)(data[offset] << 8 | data[offset + 1]);
+        entries[i].key_offset   = (uint16_t)(offset + 2);
+        offset += 2 + entries[i].key_len;
+        entries[i].value_len    = (uint16_t)(data[offset] << 8 | data[offset + 1]);
+        entries[i].value_offset = (uint16_t)(offset + 2);
+        offset += 2 + entries[i].value_len;
+    }
+
+    sort_entries(data, entries, flat->count);
+
+    for (size_t i = 1; i < flat->count; i++) {
+        if (!compare_entries(data, &entries[i - 1], &entries[i])) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int alloc_flat(
+    struct aws_allocator *alloc, struct aws_cryptosdk_flat_enc_ctx *flat, size_t count, size_t serialized_len) {
+    AWS_ZERO_STRUCT(*flat);
+    alloc = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_ENC_CTX);
+
+    if (serialized_len == 0) return AWS_OP_SUCCESS;
+
+    flat->buffer = aws_mem_acquire(alloc, count * sizeof(struct flat_entry) + serialized_len);
+    if (!flat->buffer) return AWS_OP_ERR;
+
+    flat->alloc          = alloc;
+    flat->count          = count;
+    flat->serialized_len = serialized_len;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_flat_enc_ctx_init(
+    struct aws_allocator *alloc, struct aws_cryptosdk_flat_enc_ctx *flat, const struct aws_hash_table *enc_ctx) {
+    size_t serialized_len;
+
+    if (aws_cryptosdk_enc_ctx_size(&serialized_len, enc_ctx) ||
+        alloc_flat(alloc, flat, aws_hash_table_get_entry_count(enc_ctx), serialized_len)) {
+        return AWS_OP_ERR;
+    }
+
+    if (serialized_len) {
+        struct aws_byte_buf data = aws_byte_buf_from_empty_array(flat_data(flat), serialized_len);
+
+        if (aws_cryptosdk_enc_ctx_serialize(alloc, &data, enc_ctx) || index_flat(flat)) {
+            aws_cryptosdk_flat_enc_ctx_clean_up(flat);
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_flat_enc_ctx_init_from_serialized(
+    struct aws_allocator *alloc, struct aws_cryptosdk_flat_enc_ctx *flat, struct aws_byte_cursor serialized) {
+    size_t count;
+
+    if (count_serialized_pairs(serialized, &count) || alloc_flat(alloc, flat, count, serialized.len)) {
+        AWS_ZERO_STRUCT(*flat);
+        return AWS_OP_ERR;
+    }
+
+    if (serialized.len) {
+        memcpy((uint8_t *)flat_data(flat), serialized.ptr, serialized.len);
+
+        if (index_flat(flat)) {
+            aws_cryptosdk_flat_enc_ctx_clean_up(flat);
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+void aws_cryptosdk_flat_enc_ctx_clean_up(struct aws_cryptosdk_flat_enc_ctx *flat) {
+    if (flat->buffer) aws_mem_release(flat->alloc, flat->buffer);
+
+    AWS_ZERO_STRUCT(*flat);
+}
+
+size_t aws_cryptosdk_flat_enc_ctx_count(const struct aws_cryptosdk_flat_enc_ctx *flat) {
+    return flat->count;
+}
+
+void aws_cryptosdk_flat_enc_ctx_get_at(
+    const struct aws_cryptosdk_flat_enc_ctx *flat,
+    size_t idx,
+    struct aws_byte_cursor *key,
+    struct aws_byte_cursor *value) {
+    AWS_PRECONDITION(idx < flat->count);
+    const struct flat_entry *entry = &flat_entries(flat)[idx];
+    const uint8_t *data            = flat_data(flat);
+
+    *key   = aws_byte_cursor_from_array(data + entry->key_offset, entry->key_len);
+    *value = aws_byte_cursor_from_array(data + entry->value_offset, entry->value_len);
+}
+
+bool aws_cryptosdk_flat_enc_ctx_get(
+    const struct aws_cryptosdk_flat_enc_ctx *flat, struct aws_byte_cursor key, struct aws_byte_cursor *value) {
+    const struct flat_entry *entries = flat_entries(flat);
+    const uint8_t *data              = flat_data(flat);
+    size_t lo = 0, hi = flat->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int r      = compare_bytes(data + entries[mid].key_offset, entries[mid].key_len, key.ptr, key.len);
+
+        if (r == 0) {
+            *value = aws_byte_cursor_from_array(data + entries[mid].value_offset, entries[mid].value_len);
+            return true;
+        }
+        if (r < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return false;
+}
+
+struct aws_byte_cursor aws_cryptosdk_flat_enc_ctx_serialized(const struct aws_cryptosdk_flat_enc_ctx *flat) {
+    if (!flat->buffer) return aws_byte_cursor_from_array(NULL, 0);
+
+    return aws_byte_cursor_from_array(flat_data(flat), flat->serialized_len);
+}
+
+int aws_cryptosdk_flat_enc_ctx_to_table(
+    struct aws_allocator *alloc, struct aws_hash_table *enc_ctx, const struct aws_cryptosdk_flat_enc_ctx *flat) {
+    alloc = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_ENC_CTX);
+    aws_cryptosdk_enc_ctx_clear(enc_ctx);
+
+    for (size_t i = 0; i < flat->count; i++) {
+        struct aws_byte_cursor k_cursor, v_cursor;
+        aws_cryptosdk_flat_enc_ctx_get_at(flat, i, &k_cursor, &v_cursor);
+
+        struct aws_string *k = aws_string_new_from_array(alloc, k_cursor.ptr, k_cursor.len);
+        struct aws_string *v = aws_string_new_from_array(alloc, v_cursor.ptr, v_cursor.len);
+
+        if (!k || !v || aws_hash_table_put(enc_ctx, k, (void *)v, NULL)) {
+            aws_string_destroy(k);
+            aws_string_destroy(v);
+            aws_cryptosdk_enc_ctx_clear(enc_ctx);
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+bool aws_cryptosdk_enc_ctx_is_canonical(struct aws_byte_cursor serialized) {
+    struct aws_byte_cursor prev_key = { 0 };
+    uint16_t elem_count, len;
+
+    if (serialized.len == 0) return true;
+    if (!aws_byte_cursor_read_be16(&serialized, &elem_count) || !elem_count) return false;
+
+    for (uint16_t i = 0; i < elem_count; i++) {
+        if (!aws_byte_cursor_read_be16(&serialized, &len)) return false;
+        struct aws_byte_cursor key = aws_byte_cursor_advance(&serialized, len);
+        if (!key.ptr || !aws_byte_cursor_read_be16(&serialized, &len)) return false;
+        if (!aws_byte_cursor_advance(&serialized, len).ptr) return false;
+
+        if (i && compare_bytes(prev_key.ptr, prev_key.len, key.ptr, key.len) >= 0) return false;
+        prev_key = key;
+    }
+
+    return serialized.len == 0;
+}
@@ -23,7 +23,9 @@ static const struct aws_error_info error_info[] = {
     AWS_DEFINE_ERROR_INFO(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED, "Limit exceeded", "cryptosdk"),
     AWS_DEFINE_ERROR_INFO(AWS_CRYPTOSDK_ERR_RESERVED_NAME, "Contains name reserved for usage by AWS", "cryptosdk"),
     AWS_DEFINE_ERROR_INFO(
-        AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT, "Unsupported format version or bad ciphertext", "cryptosdk")
+        AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT, "Unsupported format version or bad ciphertext", "cryptosdk"),
+    AWS_DEFINE_ERROR_INFO(AWS_CRYPTOSDK_ERR_IO, "Unable to read or write a file", "cryptosdk"),
+    AWS_DEFINE_ERROR_INFO(AWS_CRYPTOSDK_ERR_PKCS11_FAILURE, "Unexpected failure from a PKCS#11 token", "cryptosdk")
 };
 
 static const struct aws_error_info_list error_info_list = { .error_list = error_info,
@@ -0,0 +1,1307 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+/* For O_DIRECT */
+#    define _GNU_SOURCE
+#endif
+
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/session.h>
+#include <aws/cryptosdk/session.h>
+
+#ifndef _WIN32
+
+#    include <errno.h>
+#    include <fcntl.h>
+#    include <stdint.h>
+#    include <stdlib.h>
+#    include <string.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+
+#    include <aws/common/condition_variable.h>
+#    include <aws/common/mutex.h>
+#    include <aws/common/thread.h>
+
+/* An open file and its mapping; ptr is NULL for empty files, which cannot be mapped */
+struct file_map {
+    int fd;
+    uint8_t *ptr;
+    size_t len;
+};
+
+#    define FILE_MAP_INIT \
+        { .fd = -1, .ptr = NULL, .len = 0 }
+
+static int raise_io_error(void) {
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_IO);
+}
+
+static void unmap_file(struct file_map *map) {
+    // Keep the errno of whatever failed before we got here
+    int saved_errno = errno;
+
+    if (map->ptr) munmap(map->ptr, map->len);
+    if (map->fd >= 0) close(map->fd);
+
+    map->fd  = -1;
+    map->ptr = NULL;
+    map->len = 0;
+    errno    = saved_errno;
+}
+
+static int map_input(struct file_map *map, const char *path) {
+    struct stat st;
+
+    if ((map->fd = open(path, O_RDONLY)) < 0) return raise_io_error();
+    if (fstat(map->fd, &st)) return raise_io_error();
+    if ((uint64_t)st.st_size > SIZE_MAX) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+
+    map->len = (size_t)st.st_size;
+    if (!map->len) return AWS_OP_SUCCESS;
+
+    void *ptr = mmap(NULL, map->len, PROT_READ, MAP_SHARED, map->fd, 0);
+    if (ptr == MAP_FAILED) return raise_io_error();
+    map->ptr = ptr;
+
+    // The message is read front to back exactly once; this is only a hint
+    posix_madvise(map->ptr, map->len, POSIX_MADV_SEQUENTIAL);
+
+    return AWS_OP_SUCCESS;
+}
+
+static int map_output(struct file_map *map, const char *path, uint64_t size) {
+    if (size > SIZE_MAX || (off_t)size < 0) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+
+    if ((map->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) return raise_io_error();
+
+    map->len = (size_t)size;
+    if (!map->len) return AWS_OP_SUCCESS;
+
+#    ifdef __linux__
+    // Allocate the blocks up front, so that running out of space fails here rather than
+    // raising SIGBUS when the mapping is written
+    int err = posix_fallocate(map->fd, 0, (off_t)size);
+    if (err) {
+        errno = err;
+        return raise_io_error();
+    }
+#    else
+    if (ftruncate(map->fd, (off_t)size)) return raise_io_error();
+#    endif
+
+    void *ptr = mmap(NULL, map->len, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+    if (ptr == MAP_FAILED) return raise_io_error();
+    map->ptr = ptr;
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Unmaps and closes the output, reporting any error writing it back */
+static int finish_output(struct file_map *map) {
+    int rv = AWS_OP_SUCCESS;
+
+    if (map->ptr && munmap(map->ptr, map->len)) rv = raise_io_error();
+    map->ptr = NULL;
+
+    if (close(map->fd) && !rv) rv = raise_io_error();
+    map->fd = -1;
+
+    return rv;
+}
+
+/* Empties the output after a failure, so that no partial (or unauthenticated) data remains */
+static void discard_output(struct file_map *map) {
+    if (map->ptr) {
+        aws_secure_zero(map->ptr, map->len);
+        munmap(map->ptr, map->len);
+        map->ptr = NULL;
+    }
+
+    if (map->fd >= 0 && ftruncate(map->fd, 0)) {
+        // Nothing more we can do; the zeroed contents are all that remain
+    }
+
+    unmap_file(map);
+}
+
+int aws_cryptosdk_encrypt_file(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    const struct aws_hash_table *enc_ctx,
+    const char *out_path,
+    const char *in_path) {
+    struct file_map input = FILE_MAP_INIT, output = FILE_MAP_INIT;
+    size_t out_bytes_written, in_bytes_read;
+    uint64_t size;
+    struct aws_cryptosdk_session *session = NULL;
+    int rv                                = AWS_OP_ERR;
+
+    if (map_input(&input, in_path)) goto out;
+
+    if (!(session = aws_cryptosdk_session_new_borrowing_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm))) goto out;
+    if (enc_ctx && aws_cryptosdk_enc_ctx_clone(alloc, &session->header.enc_ctx, enc_ctx)) goto out;
+    if (aws_cryptosdk_session_set_message_size(session, input.len)) goto out;
+
+    // Generates the materials, fixing the size of the message
+    if (aws_cryptosdk_session_get_total_output_size(session, &size)) goto out;
+    if (map_output(&output, out_path, size)) goto out;
+
+    // With the whole message in view, the session encrypts all frames in one call. An empty
+    // input must still point somewhere, or the session sees no plaintext at all.
+    static const uint8_t empty_input = 0;
+    const uint8_t *inp               = input.ptr ? input.ptr : &empty_input;
+    if (aws_cryptosdk_session_process(
+            session, output.ptr, output.len, &out_bytes_written, inp, input.len, &in_bytes_read)) {
+        goto out;
+    }
+
+    if (!aws_cryptosdk_session_is_done(session) || in_bytes_read != input.len || out_bytes_written != output.len) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        goto out;
+    }
+
+    rv = finish_output(&output);
+
+out:
+    if (rv) discard_output(&output);
+    unmap_file(&input);
+    if (session) aws_cryptosdk_session_destroy(session);
+
+    return rv;
+}
+
+int aws_cryptosdk_decrypt_file(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_hash_table *enc_ctx_out,
+    const char *out_path,
+    const char *in_path) {
+    struct file_map input = FILE_MAP_INIT, output = FILE_MAP_INIT;
+    size_t out_bytes_written, in_bytes_read;
+    uint64_t size;
+    struct aws_cryptosdk_session *session = NULL;
+    int rv                                = AWS_OP_ERR;
+
+    if (map_input(&input, in_path)) goto out;
+
+    if (!(session = aws_cryptosdk_session_new_borrowing_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, cmm))) goto out;
+
+    // The mapping outlives the session, so there is no need to copy the header out of it
+    session->borrow_header = true;
+
+    // Parsing the header also unwraps the data key and verifies the header
+    struct aws_byte_cursor body = aws_byte_cursor_from_array(input.ptr, input.len);
+    aws_cryptosdk_priv_session_change_state(session, ST_READ_HEADER);
+    if (aws_cryptosdk_priv_try_parse_header(session, &body)) goto out;
+    if (session->state != ST_DECRYPT_BODY) {
+        // Not even a complete header
+        aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        goto out;
+    }
+
+    if (aws_cryptosdk_priv_decrypt_output_size(session, body, &size)) goto out;
+    if (map_output(&output, out_path, size)) goto out;
+
+    if (aws_cryptosdk_session_process(
+            session, output.ptr, output.len, &out_bytes_written, body.ptr, body.len, &in_bytes_read)) {
+        goto out;
+    }
+
+    if (!aws_cryptosdk_session_is_done(session) || in_bytes_read != body.len || out_bytes_written != output.len) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        goto out;
+    }
+
+    if (enc_ctx_out && aws_cryptosdk_enc_ctx_clone(alloc, enc_ctx_out, &session->header.enc_ctx)) goto out;
+
+    rv = finish_output(&output);
+
+out:
+    if (rv) discard_output(&output);
+    unmap_file(&input);
+    if (session) aws_cryptosdk_session_destroy(session);
+
+    return rv;
+}
+
+/*
+ * The direct helpers bypass the page cache: both files are opened with O_DIRECT (or F_NOCACHE),
+ * so every read and write must use a buffer, length and file offset aligned to the device's
+ * logical block size. DIRECT_IO_ALIGN is a multiple of every common block size. Input is read
+ * in aligned chunks and copied into an ordinary buffer for the session; output is staged in an
+ * aligned buffer, written a whole number of blocks at a time, and the final partial block is
+ * padded and then cut off by truncating the file to the exact length of the output.
+ */
+#    define DIRECT_IO_ALIGN 4096
+#    define DIRECT_IO_CHUNK_SIZE (1024 * 1024)
+
+struct direct_io {
+    int in_fd, out_fd;
+    uint64_t in_size, in_offset;
+    /* Aligned buffer for reads, of DIRECT_IO_CHUNK_SIZE bytes */
+    uint8_t *read_buf;
+    /* Input the session has yet to consume */
+    struct aws_byte_buf acc;
+    /* Aligned staging buffer for output; out_offset is where it starts in the file */
+    uint8_t *write_buf;
+    size_t write_len, write_capacity;
+    uint64_t out_offset;
+};
+
+#    define DIRECT_IO_INIT \
+        { .in_fd = -1, .out_fd = -1 }
+
+static uint8_t *direct_buf_new(size_t size) {
+    void *ptr = NULL;
+
+    if (posix_memalign(&ptr, DIRECT_IO_ALIGN, size)) {
+        aws_raise_error(AWS_ERROR_OOM);
+        return NULL;
+    }
+
+    return ptr;
+}
+
+static void direct_buf_free(uint8_t *buf, size_t size) {
+    if (!buf) return;
+
+    aws_secure_zero(buf, size);
+    free(buf);
+}
+
+/* Opens a file for direct I/O, falling back to cached I/O on file systems which refuse it */
+static int open_direct(const char *path, int flags) {
+#    ifdef O_DIRECT
+    int fd = open(path, flags | O_DIRECT, 0666);
+    if (fd < 0 && errno == EINVAL) fd = open(path, flags, 0666);
+#    else
+    int fd = open(path, flags, 0666);
+#        ifdef F_NOCACHE
+    if (fd >= 0) fcntl(fd, F_NOCACHE, 1);
+#        endif
+#    endif
+
+    return fd;
+}
+
+static int direct_open(struct aws_allocator *alloc, struct direct_io *io, const char *out_path, const char *in_path) {
+    struct stat st;
+
+    if ((io->in_fd = open_direct(in_path, O_RDONLY)) < 0) return raise_io_error();
+    if (fstat(io->in_fd, &st)) return raise_io_error();
+    io->in_size = (uint64_t)st.st_size;
+
+    if ((io->out_fd = open_direct(out_path, O_WRONLY | O_CREAT | O_TRUNC)) < 0) return raise_io_error();
+
+    io->write_capacity = DIRECT_IO_CHUNK_SIZE;
+    if (!(io->read_buf = direct_buf_new(DIRECT_IO_CHUNK_SIZE))) return AWS_OP_ERR;
+    if (!(io->write_buf = direct_buf_new(io->write_capacity))) return AWS_OP_ERR;
+
+    return aws_byte_buf_init(&io->acc, alloc, DIRECT_IO_CHUNK_SIZE);
+}
+
+/* Makes room for at least needed more bytes of output in the staging buffer */
+static int direct_reserve_output(struct direct_io *io, size_t needed) {
+    if (io->write_capacity - io->write_len >= needed) return AWS_OP_SUCCESS;
+
+    size_t capacity = (io->write_len + needed + DIRECT_IO_ALIGN - 1) / DIRECT_IO_ALIGN * DIRECT_IO_ALIGN;
+    uint8_t *buf    = direct_buf_new(capacity);
+    if (!buf) return AWS_OP_ERR;
+
+    memcpy(buf, io->write_buf, io->write_len);
+    direct_buf_free(io->write_buf, io->write_capacity);
+    io->write_buf      = buf;
+    io->write_capacity = capacity;
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Writes out every whole block of staged output, or, at the end, everything, padded with zeros
+ * to a whole block; the padding is later cut off by direct_finish.
+ */
+static int direct_flush(struct direct_io *io, bool final) {
+    size_t len = io->write_len / DIRECT_IO_ALIGN * DIRECT_IO_ALIGN;
+
+    if (final && len < io->write_len) {
+        len += DIRECT_IO_ALIGN;
+        memset(io->write_buf + io->write_len, 0, len - io->write_len);
+    }
+
+    for (size_t done = 0; done < len;) {
+        ssize_t n = pwrite(io->out_fd, io->write_buf + done, len - done, (off_t)(io->out_offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return raise_io_error();
+        done += (size_t)n;
+    }
+
+    io->out_offset += len;
+    if (final) {
+        // Track the real end of the output, not the padding
+        io->out_offset -= len - io->write_len;
+        io->write_len = 0;
+    } else {
+        memmove(io->write_buf, io->write_buf + len, io->write_len - len);
+        io->write_len -= len;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Reads the next chunk of input onto the end of io->acc, setting *eof once the file is exhausted */
+static int direct_read(struct direct_io *io, bool *eof) {
+    size_t got = 0;
+
+    while (got < DIRECT_IO_CHUNK_SIZE) {
+        ssize_t n = pread(io->in_fd, io->read_buf + got, DIRECT_IO_CHUNK_SIZE - got, (off_t)(io->in_offset + got));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return raise_io_error();
+        if (n == 0) break;
+        got += (size_t)n;
+        // Only the end of the file leaves a read unaligned, and direct I/O cannot continue from there
+        if (got % DIRECT_IO_ALIGN) break;
+    }
+
+    io->in_offset += got;
+    *eof = got < DIRECT_IO_CHUNK_SIZE;
+
+    struct aws_byte_cursor chunk = aws_byte_cursor_from_array(io->read_buf, got);
+    return aws_byte_buf_append_dynamic(&io->acc, &chunk);
+}
+
+/* Runs the session over the whole input file, which must hold exactly one message */
+static int direct_run(struct aws_cryptosdk_session *session, struct direct_io *io) {
+    bool in_eof = false;
+
+    while (!in_eof) {
+        if (direct_read(io, &in_eof)) return AWS_OP_ERR;
+
+        for (;;) {
+            size_t out_bytes_written, in_bytes_read, out_needed, in_needed;
+
+            if (aws_cryptosdk_session_is_done(session)) {
+                // Anything more than the message itself is an error
+                if (io->acc.len) {
+                    return aws_raise_error(
+                        session->mode == AWS_CRYPTOSDK_DECRYPT ? AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT
+                                                               : AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+                }
+                break;
+            }
+
+            if (aws_cryptosdk_session_process(
+                    session,
+                    io->write_buf + io->write_len,
+                    io->write_capacity - io->write_len,
+                    &out_bytes_written,
+                    io->acc.buffer,
+                    io->acc.len,
+                    &in_bytes_read)) {
+                return AWS_OP_ERR;
+            }
+
+            memmove(io->acc.buffer, io->acc.buffer + in_bytes_read, io->acc.len - in_bytes_read);
+            io->acc.len -= in_bytes_read;
+            io->write_len += out_bytes_written;
+
+            if (io->write_len >= DIRECT_IO_ALIGN && direct_flush(io, false)) return AWS_OP_ERR;
+
+            if (!out_bytes_written && !in_bytes_read && !aws_cryptosdk_session_is_done(session)) {
+                // Either the staging buffer is too small for the next step, or we need more input
+                aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+                if (out_needed <= io->write_capacity - io->write_len) break;
+                if (direct_reserve_output(io, out_needed)) return AWS_OP_ERR;
+            }
+        }
+    }
+
+    if (!aws_cryptosdk_session_is_done(session)) {
+        // The input ended partway through the message
+        return aws_raise_error(
+            session->mode == AWS_CRYPTOSDK_DECRYPT ? AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT : AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    return direct_flush(io, true);
+}
+
+/*
+ * Cuts the output to its exact length and closes both files on success; on failure, empties the
+ * output, so that no partial (or unauthenticated) data remains. Frees the buffers either way.
+ */
+static int direct_finish(struct direct_io *io, int rv) {
+    int saved_errno = errno;
+
+    if (io->out_fd >= 0) {
+        if (!rv && ftruncate(io->out_fd, (off_t)io->out_offset)) rv = raise_io_error();
+        if (rv && ftruncate(io->out_fd, 0)) {
+            // Nothing more we can do
+        }
+        if (close(io->out_fd) && !rv) rv = raise_io_error();
+    }
+    if (io->in_fd >= 0) close(io->in_fd);
+
+    direct_buf_free(io->read_buf, DIRECT_IO_CHUNK_SIZE);
+    direct_buf_free(io->write_buf, io->write_capacity);
+    aws_byte_buf_clean_up_secure(&io->acc);
+
+    if (rv) errno = saved_errno;
+
+    return rv;
+}
+
+int aws_cryptosdk_encrypt_file_direct(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    const struct aws_hash_table *enc_ctx,
+    const char *out_path,
+    const char *in_path,
+    uint32_t block_size) {
+    struct direct_io io = DIRECT_IO_INIT;
+    uint64_t size;
+    struct aws_cryptosdk_session *session = NULL;
+    int rv                                = AWS_OP_ERR;
+
+    if (direct_open(alloc, &io, out_path, in_path)) goto out;
+
+    if (!(session = aws_cryptosdk_session_new_borrowing_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm))) goto out;
+    if (block_size && aws_cryptosdk_session_set_block_aligned_frames(session, block_size)) goto out;
+    if (enc_ctx && aws_cryptosdk_enc_ctx_clone(alloc, &session->header.enc_ctx, enc_ctx)) goto out;
+    if (aws_cryptosdk_session_set_message_size(session, io.in_size)) goto out;
+
+    // Generates the materials, fixing the size of the message
+    if (aws_cryptosdk_session_get_total_output_size(session, &size)) goto out;
+    if ((off_t)size < 0) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        goto out;
+    }
+
+#    ifdef __linux__
+    // Allocate the blocks up front, so that running out of space fails before any work is done
+    int err = size ? posix_fallocate(io.out_fd, 0, (off_t)size) : 0;
+    if (err) {
+        errno = err;
+        raise_io_error();
+        goto out;
+    }
+#    endif
+
+    if (direct_run(session, &io)) goto out;
+
+    if (io.out_offset != size) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        goto out;
+    }
+
+    rv = AWS_OP_SUCCESS;
+
+out:
+    rv = direct_finish(&io, rv);
+    if (session) aws_cryptosdk_session_destroy(session);
+
+    return rv;
+}
+
+int aws_cryptosdk_decrypt_file_direct(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_hash_table *enc_ctx_out,
+    const char *out_path,
+    const char *in_path) {
+    struct direct_io io                   = DIRECT_IO_INIT;
+    struct aws_cryptosdk_session *session = NULL;
+    int rv                                = AWS_OP_ERR;
+
+    if (direct_open(alloc, &io, out_path, in_path)) goto out;
+    if (!(session = aws_cryptosdk_session_new_borrowing_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, cmm))) goto out;
+    if (direct_run(session, &io)) goto out;
+
+    if (enc_ctx_out) {
+        const struct aws_hash_table *enc_ctx = aws_cryptosdk_session_get_enc_ctx_ptr(session);
+        if (!enc_ctx || aws_cryptosdk_enc_ctx_clone(alloc, enc_ctx_out, enc_ctx)) goto out;
+    }
+
+    rv = AWS_OP_SUCCESS;
+
+out:
+    rv = direct_finish(&io, rv);
+    if (session) aws_cryptosdk_session_destroy(session);
+
+    return rv;
+}
+
+/*
+ * The descriptor pipeline overlaps I/O with the session's work: a reader thread fills up to
+ * read_ahead input chunks ahead of the calling thread, which runs the session over them, and a
+ * writer thread drains up to read_ahead output chunks behind it. Each direction is a ring of
+ * buffers passed from one producer to one consumer; a slot belongs to the producer until it is
+ * published, and to the consumer until it is released.
+ */
+#    define PIPELINE_CHUNK_SIZE (1024 * 1024)
+
+struct pipe_ring {
+    struct aws_byte_buf *slots;
+    size_t depth, head, count;
+    /* Set by the producer once it will publish no more slots */
+    bool eof;
+    /* Set by either side to give up; the other side stops as soon as it notices */
+    bool abort;
+    /* Error raised by the I/O thread, with the errno of the failing call */
+    int error;
+    int io_errno;
+};
+
+struct fd_pipeline {
+    struct aws_mutex mutex;
+    struct aws_condition_variable changed;
+    struct pipe_ring in, out;
+    int in_fd, out_fd;
+};
+
+/* Waits for a free slot to fill; returns NULL if the consumer has given up. Call with the mutex held. */
+static struct aws_byte_buf *ring_producer_slot(struct fd_pipeline *p, struct pipe_ring *ring) {
+    while (ring->count == ring->depth && !ring->abort) aws_condition_variable_wait(&p->changed, &p->mutex);
+
+    return ring->abort ? NULL : &ring->slots[(ring->head + ring->count) % ring->depth];
+}
+
+/* Waits for a published slot; returns NULL at the end of the stream or on abort. Call with the mutex held. */
+static struct aws_byte_buf *ring_consumer_slot(struct fd_pipeline *p, struct pipe_ring *ring) {
+    while (!ring->count && !ring->eof && !ring->abort) aws_condition_variable_wait(&p->changed, &p->mutex);
+
+    return ring->count && !ring->abort ? &ring->slots[ring->head] : NULL;
+}
+
+static void ring_publish(struct fd_pipeline *p, struct pipe_ring *ring) {
+    ring->count++;
+    aws_condition_variable_notify_all(&p->changed);
+}
+
+static void ring_release(struct fd_pipeline *p, struct pipe_ring *ring) {
+    ring->slots[ring->head].len = 0;
+    ring->head                  = (ring->head + 1) % ring->depth;
+    ring->count--;
+    aws_condition_variable_notify_all(&p->changed);
+}
+
+static void pipeline_reader(void *arg) {
+    struct fd_pipeline *p = arg;
+
+    aws_mutex_lock(&p->mutex);
+    for (;;) {
+        struct aws_byte_buf *slot = ring_producer_slot(p, &p->in);
+        if (!slot) break;
+        aws_mutex_unlock(&p->mutex);
+
+        ssize_t n;
+        do {
+            n = read(p->in_fd, slot->buffer, slot->capacity);
+        } while (n < 0 && errno == EINTR);
+
+        aws_mutex_lock(&p->mutex);
+        if (n <= 0) {
+            if (n < 0) {
+                p->in.error    = AWS_CRYPTOSDK_ERR_IO;
+                p->in.io_errno = errno;
+            }
+            p->in.eof = true;
+            aws_condition_variable_notify_all(&p->changed);
+            break;
+        }
+
+        slot->len = (size_t)n;
+        ring_publish(p, &p->in);
+    }
+    aws_mutex_unlock(&p->mutex);
+}
+
+static void pipeline_writer(void *arg) {
+    struct fd_pipeline *p = arg;
+
+    aws_mutex_lock(&p->mutex);
+    for (;;) {
+        struct aws_byte_buf *slot = ring_consumer_slot(p, &p->out);
+        if (!slot) break;
+        aws_mutex_unlock(&p->mutex);
+
+        size_t written = 0;
+        while (written < slot->len) {
+            ssize_t n = write(p->out_fd, slot->buffer + written, slot->len - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            written += (size_t)n;
+        }
+
+        aws_mutex_lock(&p->mutex);
+        if (written < slot->len) {
+            p->out.error    = AWS_CRYPTOSDK_ERR_IO;
+            p->out.io_errno = errno;
+            p->out.abort    = true;
+            aws_condition_variable_notify_all(&p->changed);
+            break;
+        }
+
+        ring_release(p, &p->out);
+    }
+    aws_mutex_unlock(&p->mutex);
+}
+
+static int ring_init(
+    struct aws_allocator *alloc, struct aws_allocator *buf_alloc, struct pipe_ring *ring, size_t depth) {
+    if (!(ring->slots = aws_mem_acquire(alloc, depth * sizeof(*ring->slots)))) return aws_raise_error(AWS_ERROR_OOM);
+    memset(ring->slots, 0, depth * sizeof(*ring->slots));
+    ring->depth = depth;
+
+    for (size_t i = 0; i < depth; i++) {
+        if (aws_byte_buf_init(&ring->slots[i], buf_alloc, PIPELINE_CHUNK_SIZE)) return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static void ring_clean_up(struct aws_allocator *alloc, struct pipe_ring *ring) {
+    for (size_t i = 0; ring->slots && i < ring->depth; i++) {
+        // Slots may hold plaintext
+        aws_byte_buf_clean_up_secure(&ring->slots[i]);
+    }
+    if (ring->slots) aws_mem_release(alloc, ring->slots);
+}
+
+/*
+ * Runs the session over the input stream on the calling thread, until the message is complete
+ * and the input is exhausted. acc accumulates input the session has yet to consume.
+ */
+static int pipeline_run(struct aws_cryptosdk_session *session, struct fd_pipeline *p, struct aws_byte_buf *acc) {
+    uint64_t total_in = 0;
+    bool in_eof       = false;
+
+    for (;;) {
+        // Take the next chunk of input, waiting for the reader if it has not got there yet
+        aws_mutex_lock(&p->mutex);
+        struct aws_byte_buf *in_slot = ring_consumer_slot(p, &p->in);
+        if (!in_slot) in_eof = true;
+        aws_mutex_unlock(&p->mutex);
+
+        if (in_slot) {
+            struct aws_byte_cursor chunk = aws_byte_cursor_from_buf(in_slot);
+            int rv                       = aws_byte_buf_append_dynamic(acc, &chunk);
+            total_in += in_slot->len;
+
+            aws_mutex_lock(&p->mutex);
+            ring_release(p, &p->in);
+            aws_mutex_unlock(&p->mutex);
+
+            if (rv) return AWS_OP_ERR;
+        } else if (p->in.error) {
+            errno = p->in.io_errno;
+            return aws_raise_error(p->in.error);
+        }
+
+        if (aws_cryptosdk_session_is_done(session)) {
+            // Anything more than the message itself is an error
+            if (acc->len) {
+                return aws_raise_error(
+                    session->mode == AWS_CRYPTOSDK_DECRYPT ? AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT
+                                                           : AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+            }
+            if (in_eof) return AWS_OP_SUCCESS;
+            continue;
+        }
+
+        if (in_eof && session->mode == AWS_CRYPTOSDK_ENCRYPT && !session->precise_size_known &&
+            aws_cryptosdk_session_set_message_size(session, total_in)) {
+            return AWS_OP_ERR;
+        }
+
+        // Run the session over everything we have, handing each chunk of output to the writer
+        for (;;) {
+            size_t out_bytes_written, in_bytes_read, out_needed, in_needed;
+
+            aws_mutex_lock(&p->mutex);
+            struct aws_byte_buf *out_slot = ring_producer_slot(p, &p->out);
+            aws_mutex_unlock(&p->mutex);
+
+            if (!out_slot) {
+                errno = p->out.io_errno;
+                return aws_raise_error(p->out.error);
+            }
+
+            if (aws_cryptosdk_session_process(
+                    session,
+                    out_slot->buffer,
+                    out_slot->capacity,
+                    &out_bytes_written,
+                    acc->buffer,
+                    acc->len,
+                    &in_bytes_read)) {
+                return AWS_OP_ERR;
+            }
+
+            memmove(acc->buffer, acc->buffer + in_bytes_read, acc->len - in_bytes_read);
+            acc->len -= in_bytes_read;
+
+            if (out_bytes_written) {
+                out_slot->len = out_bytes_written;
+                aws_mutex_lock(&p->mutex);
+                ring_publish(p, &p->out);
+                aws_mutex_unlock(&p->mutex);
+            }
+
+            if (aws_cryptosdk_session_is_done(session)) break;
+
+            if (!out_bytes_written && !in_bytes_read) {
+                // Either the output slot is too small for the next step, or we need more input
+                aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+                if (out_needed <= out_slot->capacity) break;
+                if (aws_byte_buf_reserve(out_slot, out_needed)) return AWS_OP_ERR;
+            }
+        }
+
+        if (in_eof && !aws_cryptosdk_session_is_done(session)) {
+            // The input ended partway through the message
+            return aws_raise_error(
+                session->mode == AWS_CRYPTOSDK_DECRYPT ? AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT
+                                                       : AWS_CRYPTOSDK_ERR_BAD_STATE);
+        }
+    }
+}
+
+int aws_cryptosdk_session_process_fd(struct aws_cryptosdk_session *session, int out_fd, int in_fd, size_t read_ahead) {
+    struct aws_allocator *alloc     = session->alloc;
+    struct aws_allocator *buf_alloc = aws_cryptosdk_priv_buffer_alloc(session);
+    struct fd_pipeline p;
+    struct aws_byte_buf acc;
+    struct aws_thread reader, writer;
+    bool reader_running = false, writer_running = false;
+    int rv              = AWS_OP_ERR;
+
+    if (!read_ahead || read_ahead > SIZE_MAX / sizeof(struct aws_byte_buf)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    AWS_ZERO_STRUCT(p);
+    AWS_ZERO_STRUCT(acc);
+    p.in_fd  = in_fd;
+    p.out_fd = out_fd;
+
+    if (aws_mutex_init(&p.mutex)) return AWS_OP_ERR;
+    if (aws_condition_variable_init(&p.changed)) {
+        aws_mutex_clean_up(&p.mutex);
+        return AWS_OP_ERR;
+    }
+
+    if (ring_init(alloc, buf_alloc, &p.in, read_ahead) || ring_init(alloc, buf_alloc, &p.out, read_ahead)) goto out;
+    if (aws_byte_buf_init(&acc, buf_alloc, PIPELINE_CHUNK_SIZE)) goto out;
+
+    if (aws_thread_init(&reader, alloc)) goto out;
+    if (aws_thread_launch(&reader, pipeline_reader, &p, aws_default_thread_options())) {
+        aws_thread_clean_up(&reader);
+        goto out;
+    }
+    reader_running = true;
+
+    if (aws_thread_init(&writer, alloc)) goto out;
+    if (aws_thread_launch(&writer, pipeline_writer, &p, aws_default_thread_options())) {
+        aws_thread_clean_up(&writer);
+        goto out;
+    }
+    writer_running = true;
+
+    rv = pipeline_run(session, &p, &acc);
+
+out:
+    aws_mutex_lock(&p.mutex);
+    // On success, the reader is already done and the writer drains what is left
+    p.in.abort = true;
+    if (rv) {
+        p.out.abort = true;
+    } else {
+        p.out.eof = true;
+    }
+    aws_condition_variable_notify_all(&p.changed);
+    aws_mutex_unlock(&p.mutex);
+
+    if (reader_running) {
+        aws_thread_join(&reader);
+        aws_thread_clean_up(&reader);
+    }
+    if (writer_running) {
+        aws_thread_join(&writer);
+        aws_thread_clean_up(&writer);
+    }
+
+    // The writer may still fail on the final chunks
+    if (!rv && p.out.error) {
+        errno = p.out.io_errno;
+        rv    = aws_raise_error(p.out.error);
+    }
+
+    aws_byte_buf_clean_up_secure(&acc);
+    ring_clean_up(alloc, &p.in);
+    ring_clean_up(alloc, &p.out);
+    aws_condition_variable_clean_up(&p.changed);
+    aws_mutex_clean_up(&p.mutex);
+
+    return rv;
+}
+
+#else  // _WIN32
+
+#    include <string.h>
+
+#    include <windows.h>
+
+/*
+ * On Windows the file helpers stream instead of mapping: both files are opened for overlapped
+ * I/O on one completion port, and up to FILE_IO_DEPTH reads and FILE_IO_DEPTH writes are kept in
+ * flight while the calling thread runs the session, so that the disk and the cipher work at the
+ * same time. The chunk size is a multiple of every frame size up to 1 MiB, so reads start on
+ * frame boundaries when encrypting with such frames. Reads are issued and consumed in file order;
+ * writes each go to an explicit offset, so they may complete in any order.
+ */
+#    define FILE_IO_DEPTH 4
+#    define FILE_IO_CHUNK_SIZE (1024 * 1024)
+
+struct io_op {
+    OVERLAPPED ov;
+    struct aws_byte_buf buf;
+    /* Bytes a read must return; a file which shrinks under us is an error */
+    DWORD expected;
+    /* Set from issue until the completion has been dequeued */
+    bool pending;
+    bool is_write;
+};
+
+struct iocp_pipeline {
+    HANDLE in, out, port;
+    uint64_t in_size;
+    /* File offsets of the next read and write to issue */
+    uint64_t next_read, next_write;
+    struct io_op reads[FILE_IO_DEPTH];
+    struct io_op writes[FILE_IO_DEPTH];
+    /* Reads issued and consumed so far; read i uses reads[i % FILE_IO_DEPTH] */
+    size_t reads_issued, reads_consumed;
+    /* First Win32 error seen, which is left as the last error when the helper fails */
+    DWORD error;
+};
+
+static int io_failed(struct iocp_pipeline *p, DWORD error) {
+    if (!p->error) p->error = error ? error : ERROR_GEN_FAILURE;
+    SetLastError(p->error);
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_IO);
+}
+
+static void set_offset(OVERLAPPED *ov, uint64_t offset) {
+    memset(ov, 0, sizeof(*ov));
+    ov->Offset     = (DWORD)offset;
+    ov->OffsetHigh = (DWORD)(offset >> 32);
+}
+
+/* Moves the end of a file, which reserves its space up front when growing it */
+static bool set_file_size(HANDLE file, uint64_t size) {
+    FILE_END_OF_FILE_INFO info;
+    info.EndOfFile.QuadPart = (LONGLONG)size;
+
+    return SetFileInformationByHandle(file, FileEndOfFileInfo, &info, sizeof(info));
+}
+
+/* Dequeues one completion and records its outcome; returns false if the wait itself failed */
+static bool wait_for_io(struct iocp_pipeline *p) {
+    DWORD bytes    = 0;
+    ULONG_PTR key  = 0;
+    OVERLAPPED *ov = NULL;
+    BOOL ok        = GetQueuedCompletionStatus(p->port, &bytes, &key, &ov, INFINITE);
+
+    if (!ov) {
+        if (!p->error) p->error = GetLastError();
+        return false;
+    }
+
+    struct io_op *op = CONTAINING_RECORD(ov, struct io_op, ov);
+    op->pending      = false;
+    if (!ok) {
+        if (!p->error) p->error = GetLastError();
+    } else if (op->is_write ? bytes != op->buf.len : bytes != op->expected) {
+        if (!p->error) p->error = op->is_write ? ERROR_WRITE_FAULT : ERROR_HANDLE_EOF;
+    }
+
+    // A write's buffer is free again; a read's holds its data until it is consumed
+    if (op->is_write) op->buf.len = 0;
+    else op->buf.len = ok ? bytes : 0;
+
+    return true;
+}
+
+static int issue_read(struct iocp_pipeline *p) {
+    struct io_op *op   = &p->reads[p->reads_issued % FILE_IO_DEPTH];
+    uint64_t remaining = p->in_size - p->next_read;
+    DWORD len          = remaining < op->buf.capacity ? (DWORD)remaining : (DWORD)op->buf.capacity;
+
+    set_offset(&op->ov, p->next_read);
+    op->expected = len;
+    op->pending  = true;
+    if (!ReadFile(p->in, op->buf.buffer, len, NULL, &op->ov) && GetLastError() != ERROR_IO_PENDING) {
+        op->pending = false;
+        return io_failed(p, GetLastError());
+    }
+
+    p->next_read += len;
+    p->reads_issued++;
+
+    return AWS_OP_SUCCESS;
+}
+
+static int issue_write(struct iocp_pipeline *p, struct io_op *op) {
+    set_offset(&op->ov, p->next_write);
+    op->pending = true;
+    if (!WriteFile(p->out, op->buf.buffer, (DWORD)op->buf.len, NULL, &op->ov) && GetLastError() != ERROR_IO_PENDING) {
+        op->pending = false;
+        op->buf.len = 0;
+        return io_failed(p, GetLastError());
+    }
+
+    p->next_write += op->buf.len;
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Returns a write buffer with nothing in flight, waiting for one to complete if need be */
+static struct io_op *free_write_op(struct iocp_pipeline *p) {
+    for (;;) {
+        for (size_t i = 0; i < FILE_IO_DEPTH; i++) {
+            if (!p->writes[i].pending) return &p->writes[i];
+        }
+        if (!wait_for_io(p) || p->error) {
+            io_failed(p, p->error);
+            return NULL;
+        }
+    }
+}
+
+static size_t ops_pending(const struct iocp_pipeline *p) {
+    size_t pending = 0;
+
+    for (size_t i = 0; i < FILE_IO_DEPTH; i++) {
+        pending += p->reads[i].pending + p->writes[i].pending;
+    }
+
+    return pending;
+}
+
+/* Waits for everything in flight, cancelling it first if cancel is set */
+static void drain_io(struct iocp_pipeline *p, bool cancel) {
+    if (cancel) {
+        if (p->in != INVALID_HANDLE_VALUE) CancelIoEx(p->in, NULL);
+        if (p->out != INVALID_HANDLE_VALUE) CancelIoEx(p->out, NULL);
+    }
+
+    while (ops_pending(p)) {
+        if (!wait_for_io(p)) break;
+    }
+}
+
+static int iocp_open(struct iocp_pipeline *p, const char *out_path, const char *in_path) {
+    LARGE_INTEGER size;
+
+    p->in = CreateFileA(
+        in_path,
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        NULL,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN,
+        NULL);
+    if (p->in == INVALID_HANDLE_VALUE) return io_failed(p, GetLastError());
+    if (!GetFileSizeEx(p->in, &size)) return io_failed(p, GetLastError());
+    p->in_size = (uint64_t)size.QuadPart;
+
+    p->out = CreateFileA(
+        out_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
+    if (p->out == INVALID_HANDLE_VALUE) return io_failed(p, GetLastError());
+
+    if (!(p->port = CreateIoCompletionPort(p->in, NULL, 0, 1))) return io_failed(p, GetLastError());
+    if (!CreateIoCompletionPort(p->out, p->port, 0, 1)) return io_failed(p, GetLastError());
+
+    return AWS_OP_SUCCESS;
+}
+
+static int iocp_init(struct aws_allocator *alloc, struct iocp_pipeline *p) {
+    AWS_ZERO_STRUCT(*p);
+    p->in  = INVALID_HANDLE_VALUE;
+    p->out = INVALID_HANDLE_VALUE;
+
+    for (size_t i = 0; i < FILE_IO_DEPTH; i++) {
+        p->writes[i].is_write = true;
+        if (aws_byte_buf_init(&p->reads[i].buf, alloc, FILE_IO_CHUNK_SIZE)) return AWS_OP_ERR;
+        if (aws_byte_buf_init(&p->writes[i].buf, alloc, FILE_IO_CHUNK_SIZE)) return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Cancels and waits for anything still in flight, then closes both files and frees the buffers.
+ * If the output is to be discarded it is emptied first, so that no partial (or unauthenticated)
+ * data remains. Returns an error if the output could not be closed.
+ */
+static int iocp_clean_up(struct iocp_pipeline *p, bool discard) {
+    int rv = AWS_OP_SUCCESS;
+
+    drain_io(p, true);
+
+    if (p->out != INVALID_HANDLE_VALUE) {
+        if (discard) set_file_size(p->out, 0);
+        if (!CloseHandle(p->out) && !discard) rv = io_failed(p, GetLastError());
+    }
+    if (p->in != INVALID_HANDLE_VALUE) CloseHandle(p->in);
+    if (p->port) CloseHandle(p->port);
+
+    for (size_t i = 0; i < FILE_IO_DEPTH; i++) {
+        // A buffer the kernel might still write to is leaked rather than freed
+        if (!p->reads[i].pending) aws_byte_buf_clean_up_secure(&p->reads[i].buf);
+        if (!p->writes[i].pending) aws_byte_buf_clean_up_secure(&p->writes[i].buf);
+    }
+
+    if (p->error) SetLastError(p->error);
+
+    return rv;
+}
+
+/*
+ * Runs the session over the whole input file, writing its output from offset zero, until the
+ * message is complete and the input is exhausted; then waits for the last writes to land. acc
+ * accumulates input the session has yet to consume.
+ */
+static int iocp_run(struct aws_cryptosdk_session *session, struct iocp_pipeline *p, struct aws_byte_buf *acc) {
+    for (;;) {
+        // Keep every read slot busy, so that the disk works ahead while the session runs
+        while (p->next_read < p->in_size && p->reads_issued - p->reads_consumed < FILE_IO_DEPTH) {
+            if (issue_read(p)) return AWS_OP_ERR;
+        }
+
+        bool in_eof = p->reads_consumed == p->reads_issued;
+        if (!in_eof) {
+            struct io_op *op = &p->reads[p->reads_consumed % FILE_IO_DEPTH];
+            while (op->pending && wait_for_io(p)) {
+            }
+            if (op->pending || p->error) return io_failed(p, p->error);
+
+            struct aws_byte_cursor chunk = aws_byte_cursor_from_buf(&op->buf);
+            int rv                       = aws_byte_buf_append_dynamic(acc, &chunk);
+            op->buf.len                  = 0;
+            p->reads_consumed++;
+            if (rv) return AWS_OP_ERR;
+
+            // Put the slot straight back to work before the session takes its turn
+            if (p->next_read < p->in_size && issue_read(p)) return AWS_OP_ERR;
+        }
+
+        if (aws_cryptosdk_session_is_done(session)) {
+            // Anything more than the message itself is an error
+            if (acc->len || p->reads_consumed < p->reads_issued) {
+                return aws_raise_error(
+                    session->mode == AWS_CRYPTOSDK_DECRYPT ? AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT
+                                                           : AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+            }
+            break;
+        }
+
+        // Run the session over everything we have, writing each buffer of output as it fills
+        for (;;) {
+            size_t out_bytes_written, in_bytes_read, out_needed, in_needed;
+            struct io_op *out = free_write_op(p);
+            if (!out) return AWS_OP_ERR;
+
+            if (aws_cryptosdk_session_process(
+                    session,
+                    out->buf.buffer,
+                    out->buf.capacity,
+                    &out_bytes_written,
+                    acc->buffer,
+                    acc->len,
+                    &in_bytes_read)) {
+                return AWS_OP_ERR;
+            }
+
+            memmove(acc->buffer, acc->buffer + in_bytes_read, acc->len - in_bytes_read);
+            acc->len -= in_bytes_read;
+
+            if (out_bytes_written) {
+                out->buf.len = out_bytes_written;
+                if (issue_write(p, out)) return AWS_OP_ERR;
+            }
+
+            if (aws_cryptosdk_session_is_done(session)) break;
+
+            if (!out_bytes_written && !in_bytes_read) {
+                // Either the output buffer is too small for the next step, or we need more input
+                aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+                if (out_needed <= out->buf.capacity) break;
+                if (aws_byte_buf_reserve(&out->buf, out_needed)) return AWS_OP_ERR;
+            }
+        }
+
+        if (in_eof && !aws_cryptosdk_session_is_done(session)) {
+            // The input ended partway through the message
+            return aws_raise_error(
+                session->mode == AWS_CRYPTOSDK_DECRYPT ? AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT
+                                                       : AWS_CRYPTOSDK_ERR_BAD_STATE);
+        }
+    }
+
+    drain_io(p, false);
+    if (p->error) return io_failed(p, p->error);
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_encrypt_file(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    const struct aws_hash_table *enc_ctx,
+    const char *out_path,
+    const char *in_path) {
+    struct iocp_pipeline p;
+    struct aws_byte_buf acc;
+    uint64_t size;
+    struct aws_cryptosdk_session *session = NULL;
+    int rv                                = AWS_OP_ERR;
+
+    AWS_ZERO_STRUCT(acc);
+    if (iocp_init(alloc, &p)) goto out;
+    if (aws_byte_buf_init(&acc, alloc, FILE_IO_CHUNK_SIZE)) goto out;
+    if (iocp_open(&p, out_path, in_path)) goto out;
+
+    if (!(session = aws_cryptosdk_session_new_borrowing_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm))) goto out;
+    if (enc_ctx && aws_cryptosdk_enc_ctx_clone(alloc, &session->header.enc_ctx, enc_ctx)) goto out;
+    if (aws_cryptosdk_session_set_message_size(session, p.in_size)) goto out;
+
+    // Writes which extend a file complete synchronously, so the output is sized up front; this
+    // also makes running out of space fail here
+    if (aws_cryptosdk_session_get_total_output_size(session, &size)) goto out;
+    if (!set_file_size(p.out, size)) {
+        io_failed(&p, GetLastError());
+        goto out;
+    }
+
+    if (iocp_run(session, &p, &acc)) goto out;
+
+    if (p.next_write != size) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        goto out;
+    }
+
+    rv = AWS_OP_SUCCESS;
+
+out:
+    if (iocp_clean_up(&p, rv != AWS_OP_SUCCESS)) rv = AWS_OP_ERR;
+    aws_byte_buf_clean_up_secure(&acc);
+    if (session) aws_cryptosdk_session_destroy(session);
+
+    return rv;
+}
+
+int aws_cryptosdk_decrypt_file(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_hash_table *enc_ctx_out,
+    const char *out_path,
+    const char *in_path) {
+    struct iocp_pipeline p;
+    struct aws_byte_buf acc;
+    struct aws_cryptosdk_session *session = NULL;
+    int rv                                = AWS_OP_ERR;
+
+    AWS_ZERO_STRUCT(acc);
+    if (iocp_init(alloc, &p)) goto out;
+    if (aws_byte_buf_init(&acc, alloc, FILE_IO_CHUNK_SIZE)) goto out;
+    if (iocp_open(&p, out_path, in_path)) goto out;
+
+    if (!(session = aws_cryptosdk_session_new_borrowing_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, cmm))) goto out;
+
+    // The plaintext is never longer than the ciphertext, so the output is sized to that up front,
+    // keeping the writes asynchronous, and trimmed to what was written at the end
+    if (!set_file_size(p.out, p.in_size)) {
+        io_failed(&p, GetLastError());
+        goto out;
+    }
+
+    if (iocp_run(session, &p, &acc)) goto out;
+
+    if (!set_file_size(p.out, p.next_write)) {
+        io_failed(&p, GetLastError());
+        goto out;
+    }
+
+    if (enc_ctx_out) {
+        const struct aws_hash_table *enc_ctx = aws_cryptosdk_session_get_enc_ctx_ptr(session);
+        if (!enc_ctx || aws_cryptosdk_enc_ctx_clone(alloc, enc_ctx_out, enc_ctx)) goto out;
+    }
+
+    rv = AWS_OP_SUCCESS;
+
+out:
+    if (iocp_clean_up(&p, rv != AWS_OP_SUCCESS)) rv = AWS_OP_ERR;
+    aws_byte_buf_clean_up_secure(&acc);
+    if (session) aws_cryptosdk_session_destroy(session);
+
+    return rv;
+}
+
+int aws_cryptosdk_encrypt_file_direct(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    const struct aws_hash_table *enc_ctx,
+    const char *out_path,
+    const char *in_path,
+    uint32_t block_size) {
+    (void)alloc;
+    (void)cmm;
+    (void)enc_ctx;
+    (void)out_path;
+    (void)in_path;
+    (void)block_size;
+
+    return aws_raise_error(AWS_ERROR_UNIMPLEMENTED);
+}
+
+int aws_cryptosdk_decrypt_file_direct(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_hash_table *enc_ctx_out,
+    const char *out_path,
+    const char *in_path) {
+    (void)alloc;
+    (void)cmm;
+    (void)enc_ctx_out;
+    (void)out_path;
+    (void)in_path;
+
+    return aws_raise_error(AWS_ERROR_UNIMPLEMENTED);
+}
+
+int aws_cryptosdk_session_process_fd(struct aws_cryptosdk_session *session, int out_fd, int in_fd, size_t read_ahead) {
+    (void)session;
+    (void)out_fd;
+    (void)in_fd;
+    (void)read_ahead;
+
+    return aws_raise_error(AWS_ERROR_UNIMPLEMENTED);
+}
+
+#endif  // _WIN32
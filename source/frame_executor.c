@@ -0,0 +1,175 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/frame_executor.h>
+#include <aws/cryptosdk/private/session.h>
+
+/* The tasks queued by one call to aws_cryptosdk_priv_frame_executor_run */
+struct aws_cryptosdk_frame_task_group {
+    /* Tasks not yet finished; guarded by the executor's mutex */
+    size_t pending;
+};
+
+struct aws_cryptosdk_frame_executor {
+    struct aws_allocator *alloc;
+    struct aws_thread *threads;
+    size_t num_threads;
+
+    struct aws_mutex mutex;
+    /* Signalled when tasks are queued, and on shutdown */
+    struct aws_condition_variable work;
+    /* Signalled when a task finishes */
+    struct aws_condition_variable finished;
+    /* The fields below are guarded by mutex */
+    struct aws_linked_list queue;
+    bool shutdown;
+};
+
+/* Runs a task taken off the queue, with the mutex held on entry and on return */
+static void run_task(
+    struct aws_cryptosdk_frame_executor *executor, struct aws_cryptosdk_frame_task *task, bool on_executor_thread) {
+    struct aws_cryptosdk_frame_task_group *group = task->group;
+
+    task->started = true;
+    aws_mutex_unlock(&executor->mutex);
+    task->fn(task->arg, on_executor_thread);
+    aws_mutex_lock(&executor->mutex);
+
+    if (!--group->pending) aws_condition_variable_notify_all(&executor->finished);
+}
+
+static void run_executor_thread(void *arg) {
+    struct aws_cryptosdk_frame_executor *executor = arg;
+
+    aws_mutex_lock(&executor->mutex);
+    while (!executor->shutdown) {
+        if (aws_linked_list_empty(&executor->queue)) {
+            aws_condition_variable_wait(&executor->work, &executor->mutex);
+            continue;
+        }
+
+        struct aws_linked_list_node *node = aws_linked_list_pop_front(&executor->queue);
+        run_task(executor, AWS_CONTAINER_OF(node, struct aws_cryptosdk_frame_task, node), true);
+    }
+    aws_mutex_unlock(&executor->mutex);
+}
+
+struct aws_cryptosdk_frame_executor *aws_cryptosdk_frame_executor_new(struct aws_allocator *alloc, size_t num_threads) {
+    if (num_threads == 0 || num_threads > SIZE_MAX / sizeof(struct aws_thread)) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct aws_cryptosdk_frame_executor *executor = aws_mem_calloc(alloc, 1, sizeof(*executor));
+    if (!executor) return NULL;
+
+    if (!(executor->threads = aws_mem_calloc(alloc, num_threads, sizeof(*executor->threads)))) goto err_executor;
+    if (aws_mutex_init(&executor->mutex)) goto err_threads;
+    if (aws_condition_variable_init(&executor->work)) goto err_mutex;
+    if (aws_condition_variable_init(&executor->finished)) goto err_work;
+
+    executor->alloc = alloc;
+    aws_linked_list_init(&executor->queue);
+
+    for (; executor->num_threads < num_threads; executor->num_threads++) {
+        struct aws_thread *thread = &executor->threads[executor->num_threads];
+
+        if (aws_thread_init(thread, alloc)) goto err_launched;
+        if (aws_thread_launch(thread, run_executor_thread, executor, aws_default_thread_options())) {
+            aws_thread_clean_up(thread);
+            goto err_launched;
+        }
+    }
+
+    return executor;
+
+err_launched:
+    // The threads already started are stopped as on destroy, which cleans up everything else
+    aws_cryptosdk_frame_executor_destroy(executor);
+    return NULL;
+err_work:
+    aws_condition_variable_clean_up(&executor->work);
+err_mutex:
+    aws_mutex_clean_up(&executor->mutex);
+err_threads:
+    aws_mem_release(alloc, executor->threads);
+err_executor:
+    aws_mem_release(alloc, executor);
+    return NULL;
+}
+
+void aws_cryptosdk_frame_executor_destroy(struct aws_cryptosdk_frame_executor *executor) {
+    if (!executor) return;
+
+    aws_mutex_lock(&executor->mutex);
+    executor->shutdown = true;
+    aws_condition_variable_notify_all(&executor->work);
+    aws_mutex_unlock(&executor->mutex);
+
+    for (size_t i = 0; i < executor->num_threads; i++) {
+        aws_thread_join(&executor->threads[i]);
+        aws_thread_clean_up(&executor->threads[i]);
+    }
+
+    aws_condition_variable_clean_up(&executor->finished);
+    aws_condition_variable_clean_up(&executor->work);
+    aws_mutex_clean_up(&executor->mutex);
+    aws_mem_release(executor->alloc, executor->threads);
+    aws_mem_release(executor->alloc, executor);
+}
+
+void aws_cryptosdk_priv_frame_executor_run(
+    struct aws_cryptosdk_frame_executor *executor, struct aws_cryptosdk_frame_task *tasks, size_t num_tasks) {
+    struct aws_cryptosdk_frame_task_group group = { .pending = num_tasks - 1 };
+
+    aws_mutex_lock(&executor->mutex);
+    for (size_t i = 1; i < num_tasks; i++) {
+        tasks[i].group   = &group;
+        tasks[i].started = false;
+        aws_linked_list_push_back(&executor->queue, &tasks[i].node);
+    }
+    if (num_tasks > 1) aws_condition_variable_notify_all(&executor->work);
+    aws_mutex_unlock(&executor->mutex);
+
+    tasks[0].fn(tasks[0].arg, false);
+
+    // Take back whatever the executor's threads have not got to, rather than wait for them
+    aws_mutex_lock(&executor->mutex);
+    for (size_t i = 1; i < num_tasks; i++) {
+        if (!tasks[i].started) {
+            aws_linked_list_remove(&tasks[i].node);
+            run_task(executor, &tasks[i], false);
+        }
+    }
+    while (group.pending) {
+        aws_condition_variable_wait(&executor->finished, &executor->mutex);
+    }
+    aws_mutex_unlock(&executor->mutex);
+}
+
+int aws_cryptosdk_session_set_frame_executor(
+    struct aws_cryptosdk_session *session, struct aws_cryptosdk_frame_executor *executor) {
+    if (session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->frame_executor = executor;
+
+    return AWS_OP_SUCCESS;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/common/byte_buf.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/frame_index.h>
+#include <aws/cryptosdk/private/frame_index.h>
+#include <aws/cryptosdk/private/header.h>
+#include <string.h>  // memcmp
+
+#define FRAME_INDEX_TAG_LEN 16
+
+int aws_cryptosdk_priv_frame_index_write_prefix(
+    struct aws_byte_buf *index, const struct aws_cryptosdk_hdr *hdr, size_t header_len) {
+    if (aws_byte_buf_reserve_relative(index, AWS_CRYPTOSDK_FRAME_INDEX_PREFIX_LEN)) return AWS_OP_ERR;
+
+    // With the space reserved, these cannot fail
+    aws_byte_buf_write_u8(index, AWS_CRYPTOSDK_FRAME_INDEX_VERSION);
+    aws_byte_buf_write_be16(index, hdr->alg_id);
+    aws_byte_buf_write(index, hdr->message_id, MESSAGE_ID_LEN);
+    aws_byte_buf_write_be32(index, hdr->frame_len);
+    aws_byte_buf_write_be64(index, header_len);
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_priv_frame_index_append(
+    struct aws_byte_buf *index, uint32_t seqno, uint64_t offset, size_t len, const uint8_t *tag) {
+    if (len > UINT32_MAX) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    if (aws_byte_buf_reserve_relative(index, AWS_CRYPTOSDK_FRAME_INDEX_RECORD_LEN)) return AWS_OP_ERR;
+
+    aws_byte_buf_write_be32(index, seqno);
+    aws_byte_buf_write_be64(index, offset);
+    aws_byte_buf_write_be32(index, (uint32_t)len);
+    aws_byte_buf_write(index, tag, FRAME_INDEX_TAG_LEN);
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_priv_frame_index_check(
+    struct aws_byte_cursor index, const struct aws_cryptosdk_hdr *hdr, size_t header_len) {
+    uint8_t version;
+    uint16_t alg_id;
+    uint8_t message_id[MESSAGE_ID_LEN];
+    uint32_t frame_len;
+    uint64_t index_header_len, num_frames;
+
+    if (aws_cryptosdk_frame_index_get_frame_count(index, &num_frames)) return AWS_OP_ERR;
+
+    // The prefix is known to be present
+    aws_byte_cursor_read_u8(&index, &version);
+    aws_byte_cursor_read_be16(&index, &alg_id);
+    aws_byte_cursor_read(&index, message_id, sizeof(message_id));
+    aws_byte_cursor_read_be32(&index, &frame_len);
+    aws_byte_cursor_read_be64(&index, &index_header_len);
+
+    if (alg_id != hdr->alg_id || memcmp(message_id, hdr->message_id, MESSAGE_ID_LEN) ||
+        frame_len != hdr->frame_len || index_header_len != header_len) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_frame_index_get_frame_count(struct aws_byte_cursor index, uint64_t *num_frames) {
+    uint8_t version;
+
+    if (index.len < AWS_CRYPTOSDK_FRAME_INDEX_PREFIX_LEN || !aws_byte_cursor_read_u8(&index, &version) ||
+        version != AWS_CRYPTOSDK_FRAME_INDEX_VERSION) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    }
+
+    size_t records_len = index.len - (AWS_CRYPTOSDK_FRAME_INDEX_PREFIX_LEN - 1);
+    if (records_len % AWS_CRYPTOSDK_FRAME_INDEX_RECORD_LEN) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    }
+
+    *num_frames = records_len / AWS_CRYPTOSDK_FRAME_INDEX_RECORD_LEN;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_priv_frame_index_get_record(
+    struct aws_byte_cursor index, uint64_t seqno, uint64_t *offset, size_t *len, const uint8_t **tag) {
+    uint64_t num_frames;
+    uint32_t record_seqno, record_len;
+
+    if (aws_cryptosdk_frame_index_get_frame_count(index, &num_frames)) return AWS_OP_ERR;
+    if (seqno == 0 || seqno > num_frames) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+
+    // Records are fixed-size and in sequence number order
+    aws_byte_cursor_advance(
+        &index, AWS_CRYPTOSDK_FRAME_INDEX_PREFIX_LEN + (size_t)(seqno - 1) * AWS_CRYPTOSDK_FRAME_INDEX_RECORD_LEN);
+
+    aws_byte_cursor_read_be32(&index, &record_seqno);
+    aws_byte_cursor_read_be64(&index, offset);
+    aws_byte_cursor_read_be32(&index, &record_len);
+
+    if (record_seqno != seqno) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+
+    *len = record_len;
+    if (tag) *tag = index.ptr;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_frame_index_lookup(struct aws_byte_cursor index, uint64_t seqno, uint64_t *offset, size_t *len) {
+    return aws_cryptosdk_priv_frame_index_get_record(index, seqno, offset, len, NULL);
+}
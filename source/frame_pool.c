@@ -0,0 +1,225 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/common/mutex.h>
+#include <aws/cryptosdk/private/frame_pool.h>
+#include <string.h>
+
+#ifndef _WIN32
+#    include <sys/mman.h>
+#endif
+
+/* Class i holds buffers of (MIN_CLASS << i) + CLASS_SLACK bytes, up to AWS_CRYPTOSDK_FRAME_POOL_MAX */
+#define MIN_CLASS (64 * 1024)
+#define NUM_CLASSES 9
+#define CLASS_SLACK 4096
+
+/* Slabs are aligned to, and sized in, huge pages, and hold a few buffers of the smaller classes */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define MIN_SLAB_LEN (2 * HUGE_PAGE_SIZE)
+
+/* Fallback allocations are prefixed with their size, so that they can be resized */
+#define FALLBACK_HEADER_LEN 16
+
+struct slab {
+    struct slab *next;
+    uint8_t *buffers;
+    size_t len;
+    int cls;
+};
+
+static struct {
+    struct aws_mutex mutex;
+    /* Slabs are never unmapped, so this list only grows */
+    struct slab *slabs;
+    /* Free buffers of each class, linked through their first bytes */
+    void *free_lists[NUM_CLASSES];
+} pool = { AWS_MUTEX_INIT, NULL, { NULL } };
+
+static size_t class_size(int cls) {
+    return ((size_t)MIN_CLASS << cls) + CLASS_SLACK;
+}
+
+static int size_class(size_t size) {
+    if (size < AWS_CRYPTOSDK_FRAME_POOL_MIN) return -1;
+
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        if (size <= class_size(i)) return i;
+    }
+
+    return -1;
+}
+
+#ifndef _WIN32
+/* Maps len bytes aligned to a huge page, preferring memory backed by huge pages */
+static uint8_t *map_huge(size_t len) {
+#    ifdef MAP_HUGETLB
+    // Explicit huge pages only exist if the administrator reserved some, so this often fails
+    void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (map != MAP_FAILED) return map;
+#    endif
+
+    // Otherwise, map a little extra and trim it to alignment, so transparent huge pages can back it
+    uint8_t *raw = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+
+    uint8_t *aligned = (uint8_t *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (aligned > raw) munmap(raw, (size_t)(aligned - raw));
+    munmap(aligned + len, (size_t)(raw + HUGE_PAGE_SIZE - aligned));
+
+#    ifdef MADV_HUGEPAGE
+    // Only a hint; transparent huge pages may be disabled
+    (void)madvise(aligned, len, MADV_HUGEPAGE);
+#    endif
+
+    return aligned;
+}
+#endif
+
+/* Maps a slab for the class and puts its buffers on the free list. Call with the mutex held. */
+static void add_slab(int cls) {
+#ifndef _WIN32
+    size_t size = class_size(cls);
+    size_t len  = size > MIN_SLAB_LEN ? size : MIN_SLAB_LEN;
+    len         = (len + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    struct slab *slab = aws_mem_acquire(aws_default_allocator(), sizeof(*slab));
+    if (!slab) return;
+
+    if (!(slab->buffers = map_huge(len))) {
+        aws_mem_release(aws_default_allocator(), slab);
+        return;
+    }
+
+    slab->len  = len;
+    slab->cls  = cls;
+    slab->next = pool.slabs;
+    pool.slabs = slab;
+
+    for (size_t offset = len / size * size; offset >= size; offset -= size) {
+        void *buf = slab->buffers + offset - size;
+        memcpy(buf, &pool.free_lists[cls], sizeof(void *));
+        pool.free_lists[cls] = buf;
+    }
+#else
+    (void)cls;
+#endif
+}
+
+/* Call with the mutex held */
+static struct slab *find_slab(const void *ptr) {
+    for (struct slab *slab = pool.slabs; slab; slab = slab->next) {
+        if ((const uint8_t *)ptr >= slab->buffers && (const uint8_t *)ptr < slab->buffers + slab->len) return slab;
+    }
+
+    return NULL;
+}
+
+static void *fallback_acquire(size_t size) {
+    if (size > SIZE_MAX - FALLBACK_HEADER_LEN) return NULL;
+
+    uint8_t *mem = aws_mem_acquire(aws_default_allocator(), size + FALLBACK_HEADER_LEN);
+    if (!mem) return NULL;
+
+    memcpy(mem, &size, sizeof(size));
+
+    return mem + FALLBACK_HEADER_LEN;
+}
+
+static size_t fallback_size(const void *ptr) {
+    size_t size;
+    memcpy(&size, (const uint8_t *)ptr - FALLBACK_HEADER_LEN, sizeof(size));
+
+    return size;
+}
+
+static void *pool_acquire(struct aws_allocator *allocator, size_t size) {
+    (void)allocator;
+    int cls   = size_class(size);
+    void *buf = NULL;
+
+    if (cls < 0) return fallback_acquire(size);
+
+    aws_mutex_lock(&pool.mutex);
+    if (!pool.free_lists[cls]) add_slab(cls);
+    buf = pool.free_lists[cls];
+    if (buf) memcpy(&pool.free_lists[cls], buf, sizeof(void *));
+    aws_mutex_unlock(&pool.mutex);
+
+    return buf ? buf : fallback_acquire(size);
+}
+
+static void pool_release(struct aws_allocator *allocator, void *ptr) {
+    (void)allocator;
+
+    aws_mutex_lock(&pool.mutex);
+    struct slab *slab = find_slab(ptr);
+    if (slab) {
+        memcpy(ptr, &pool.free_lists[slab->cls], sizeof(void *));
+        pool.free_lists[slab->cls] = ptr;
+    }
+    aws_mutex_unlock(&pool.mutex);
+
+    if (!slab) aws_mem_release(aws_default_allocator(), (uint8_t *)ptr - FALLBACK_HEADER_LEN);
+}
+
+static void *pool_realloc(struct aws_allocator *allocator, void *oldptr, size_t oldsize, size_t newsize) {
+    if (!oldptr) return pool_acquire(allocator, newsize);
+
+    aws_mutex_lock(&pool.mutex);
+    struct slab *slab = find_slab(oldptr);
+    aws_mutex_unlock(&pool.mutex);
+
+    size_t capacity = slab ? class_size(slab->cls) : fallback_size(oldptr);
+    if (newsize <= capacity) return oldptr;
+
+    void *newptr = pool_acquire(allocator, newsize);
+    if (!newptr) return NULL;
+
+    // The old buffer may hold plaintext, and is about to be handed to someone else
+    memcpy(newptr, oldptr, oldsize);
+    aws_secure_zero(oldptr, oldsize);
+    pool_release(allocator, oldptr);
+
+    return newptr;
+}
+
+static void *pool_calloc(struct aws_allocator *allocator, size_t num, size_t size) {
+    if (size && num > SIZE_MAX / size) return NULL;
+
+    void *ptr = pool_acquire(allocator, num * size);
+    if (ptr) memset(ptr, 0, num * size);
+
+    return ptr;
+}
+
+static struct aws_allocator frame_buffer_allocator = {
+    .mem_acquire = pool_acquire,
+    .mem_release = pool_release,
+    .mem_realloc = pool_realloc,
+    .mem_calloc  = pool_calloc,
+    .impl        = NULL,
+};
+
+struct aws_allocator *aws_cryptosdk_frame_buffer_allocator(void) {
+    return &frame_buffer_allocator;
+}
+
+bool aws_cryptosdk_frame_pool_owns(const void *ptr) {
+    aws_mutex_lock(&pool.mutex);
+    struct slab *slab = find_slab(ptr);
+    aws_mutex_unlock(&pool.mutex);
+
+    return slab != NULL;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/frame_scan.h>
+#include <aws/cryptosdk/private/framefmt.h>
+
+#define LAST_FRAME_MARK 0xFFFFFFFFu
+
+int aws_cryptosdk_frame_scanner_init(
+    struct aws_cryptosdk_frame_scanner *scanner, const struct aws_cryptosdk_hdr_view *view) {
+    const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(view->alg_id);
+    if (!props) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+
+    AWS_ZERO_STRUCT(*scanner);
+    scanner->offset     = view->header.len;
+    scanner->frame_len  = view->frame_len;
+    scanner->next_seqno = 1;
+    scanner->iv_len     = (uint8_t)props->iv_len;
+    scanner->tag_len    = (uint8_t)props->tag_len;
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Returns how many bytes of framing the current frame has, as far as can be told from those
+ * staged so far: a framed frame starts with a sequence number, or with the final frame mark,
+ * which is followed by the sequence number, IV and content length.
+ */
+static size_t framing_len(const struct aws_cryptosdk_frame_scanner *scanner) {
+    if (!scanner->frame_len) return scanner->iv_len + sizeof(uint64_t);
+    if (scanner->staged_len < sizeof(uint32_t)) return sizeof(uint32_t);
+
+    struct aws_byte_cursor cur = aws_byte_cursor_from_array(scanner->staged, sizeof(uint32_t));
+    uint32_t seqno_mark;
+    aws_byte_cursor_read_be32(&cur, &seqno_mark);
+
+    if (seqno_mark != LAST_FRAME_MARK) return sizeof(uint32_t);
+    return 3 * sizeof(uint32_t) + scanner->iv_len;
+}
+
+/* Checks the staged framing of the current frame and describes the frame in *span */
+static int parse_framing(struct aws_cryptosdk_frame_scanner *scanner, struct aws_cryptosdk_frame_span *span) {
+    struct aws_byte_cursor cur = aws_byte_cursor_from_array(scanner->staged, scanner->staged_len);
+    uint64_t content_len;
+    uint32_t seqno = 1;
+    bool final     = true;
+
+    if (!scanner->frame_len) {
+        aws_byte_cursor_advance(&cur, scanner->iv_len);
+        aws_byte_cursor_read_be64(&cur, &content_len);
+        if (content_len >= MAX_UNFRAMED_PLAINTEXT_SIZE) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    } else {
+        aws_byte_cursor_read_be32(&cur, &seqno);
+        if (seqno == LAST_FRAME_MARK) {
+            uint32_t final_len;
+            aws_byte_cursor_read_be32(&cur, &seqno);
+            aws_byte_cursor_advance(&cur, scanner->iv_len);
+            aws_byte_cursor_read_be32(&cur, &final_len);
+            // As in aws_cryptosdk_deserialize_frame, the final frame may not outgrow the others
+            if (final_len > scanner->frame_len) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+            content_len = final_len;
+        } else {
+            content_len = scanner->frame_len;
+            final       = false;
+        }
+    }
+
+    if (seqno != scanner->next_seqno) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+
+    uint64_t rest = content_len + scanner->tag_len;
+    if (rest > SIZE_MAX - scanner->staged_len) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+
+    span->offset        = scanner->offset - scanner->staged_len;
+    span->len           = (size_t)(scanner->staged_len + rest);
+    span->plaintext_len = (size_t)content_len;
+    span->seqno         = seqno;
+    span->final         = final;
+
+    scanner->skip       = rest;
+    scanner->staged_len = 0;
+    scanner->in_final   = final;
+    scanner->next_seqno++;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_frame_scanner_scan(
+    struct aws_cryptosdk_frame_scanner *scanner,
+    struct aws_byte_cursor *input,
+    struct aws_cryptosdk_frame_span *spans,
+    size_t max_spans,
+    size_t *num_spans) {
+    *num_spans = 0;
+
+    while (!scanner->done) {
+        if (scanner->skip) {
+            size_t len = scanner->skip < input->len ? (size_t)scanner->skip : input->len;
+
+            aws_byte_cursor_advance(input, len);
+            scanner->offset += len;
+            scanner->skip -= len;
+
+            if (scanner->skip) break;
+            scanner->done = scanner->in_final;
+            continue;
+        }
+
+        if (*num_spans == max_spans) break;
+
+        // Stage the framing, which is read in two steps for a final frame
+        size_t needed = framing_len(scanner);
+        while (scanner->staged_len < needed && input->len) {
+            size_t len = needed - scanner->staged_len < input->len ? needed - scanner->staged_len : input->len;
+
+            memcpy(scanner->staged + scanner->staged_len, input->ptr, len);
+            aws_byte_cursor_advance(input, len);
+            scanner->staged_len += (uint8_t)len;
+            scanner->offset += len;
+            needed = framing_len(scanner);
+        }
+        if (scanner->staged_len < needed) break;
+
+        if (parse_framing(scanner, &spans[*num_spans])) return AWS_OP_ERR;
+        (*num_spans)++;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+bool aws_cryptosdk_frame_scanner_is_done(const struct aws_cryptosdk_frame_scanner *scanner) {
+    return scanner->done;
+}
+
+uint64_t aws_cryptosdk_frame_scanner_offset(const struct aws_cryptosdk_frame_scanner *scanner) {
+    return scanner->offset;
+}
@@ -51,8 +51,9 @@ struct aws_cryptosdk_framestate {
      * size needed even if we can't read/write the whole frame.
      *
      * Note that the serde functions don't /fail/ on short buffer. They just don't
-     * fully serialize or deserialize. The top level aws_cryptosdk_deserialize_frame and
-     * aws_cryptosdk_serialize_frame functions deal with translating to raised errors.
+     * fully serialize or deserialize. The top level functions translate this into
+     * AWS_CRYPTOSDK_NEED_MORE, or, in aws_cryptosdk_serialize_frame and
+     * aws_cryptosdk_deserialize_frame, into a raised AWS_ERROR_SHORT_BUFFER.
      */
     bool too_small;
 };
@@ -286,15 +287,15 @@ bool aws_cryptosdk_frame_has_valid_type(const struct aws_cryptosdk_frame *frame)
  * locations.
  *
  * This function also checks that there is sufficient space to perform the
- * write, and if there is not, returns false.
+ * write, and if there is not, returns AWS_CRYPTOSDK_NEED_MORE.
  *
  * On return, *ciphertext_size is always set to the amount of ciphertext
  * required to write the frame. If there was sufficient space in
  * ciphertext_buf, then *frame is initialized with cursors for the inner
  * components of the frame, *ciphertext_buf is advanced forward, and the
- * function returns true.
+ * function returns AWS_OP_SUCCESS.
  */
-int aws_cryptosdk_serialize_frame(
+int aws_cryptosdk_try_serialize_frame(
     /* out */
     struct aws_cryptosdk_frame *frame,
     size_t *ciphertext_size,
@@ -338,16 +339,12 @@ int aws_cryptosdk_serialize_frame(
         result = serde_framed(&state, frame);
     }
 
-    if (result == AWS_ERROR_SUCCESS && state.too_small) {
-        result = AWS_ERROR_SHORT_BUFFER;
-    }
-
     *ciphertext_size = state.ciphertext_size;
 
-    if (result != AWS_ERROR_SUCCESS) {
+    if (result != AWS_ERROR_SUCCESS || state.too_small) {
         // Clear any garbage we wrote
         aws_byte_buf_secure_zero(ciphertext_buf);
-        return aws_raise_error(result);
+        return result != AWS_ERROR_SUCCESS ? aws_raise_error(result) : AWS_CRYPTOSDK_NEED_MORE;
     } else {
         *ciphertext_buf = state.u.buffer;
         AWS_POSTCONDITION(aws_cryptosdk_frame_is_valid(frame));
@@ -362,14 +359,14 @@ int aws_cryptosdk_serialize_frame(
  *
  * If there was enough ciphertext to parse the frame, then *frame,
  * *ciphertext_size, and *plaintext_size are initialized with the components
- * and size of the frame accordingly, and the function returns true.
+ * and size of the frame accordingly, and the function returns AWS_OP_SUCCESS.
  *
- * If there was not enough ciphertext to parse the frame, then *frame is
- * zeroed, and *ciphertext_size and *plaintext_size contain a lower bound on
+ * If there was not enough ciphertext to parse the frame, the function returns
+ * AWS_CRYPTOSDK_NEED_MORE, *frame is zeroed, and *ciphertext_size and *plaintext_size contain a lower bound on
  * the size of the frame. This bound becomes precise if enough of the frame has
  * been provided to determine the frame size.
  */
-int aws_cryptosdk_deserialize_frame(
+int aws_cryptosdk_try_deserialize_frame(
     /* out */
     struct aws_cryptosdk_frame *frame,
     size_t *ciphertext_size,
@@ -401,10 +398,6 @@ int aws_cryptosdk_deserialize_frame(
         result = serde_nonframed(&state, frame);
     }
 
-    if (result == AWS_ERROR_SUCCESS && state.too_small) {
-        result = AWS_ERROR_SHORT_BUFFER;
-    }
-
     if (state.ciphertext_size > SIZE_MAX || state.plaintext_size > SIZE_MAX) {
         // The ciphertext or plaintext is too large to hold in memory on this platform.
         // This avoids issues with integer truncation resulting in the upper bits of
@@ -415,12 +408,12 @@ int aws_cryptosdk_deserialize_frame(
     *plaintext_size  = state.plaintext_size;
     *ciphertext_size = state.ciphertext_size;
 
-    if (result != AWS_ERROR_SUCCESS) {
+    if (result != AWS_ERROR_SUCCESS || state.too_small) {
         // Don't leak a partially-initialized structure
         aws_secure_zero(frame, sizeof(*frame));
         AWS_POSTCONDITION(aws_byte_cursor_is_valid(ciphertext_buf));
         AWS_POSTCONDITION(aws_cryptosdk_alg_properties_is_valid(alg_props));
-        return aws_raise_error(result);
+        return result != AWS_ERROR_SUCCESS ? aws_raise_error(result) : AWS_CRYPTOSDK_NEED_MORE;
     } else {
         *ciphertext_buf = state.u.cursor;
         AWS_POSTCONDITION(aws_cryptosdk_frame_is_valid(frame));
@@ -429,3 +422,31 @@ int aws_cryptosdk_deserialize_frame(
         return AWS_OP_SUCCESS;
     }
 }
+
+int aws_cryptosdk_serialize_frame(
+    /* out */
+    struct aws_cryptosdk_frame *frame,
+    size_t *ciphertext_size,
+    /* in */
+    size_t plaintext_size,
+    struct aws_byte_buf *ciphertext_buf,
+    const struct aws_cryptosdk_alg_properties *alg_props) {
+    int rv = aws_cryptosdk_try_serialize_frame(frame, ciphertext_size, plaintext_size, ciphertext_buf, alg_props);
+
+    return rv == AWS_CRYPTOSDK_NEED_MORE ? aws_raise_error(AWS_ERROR_SHORT_BUFFER) : rv;
+}
+
+int aws_cryptosdk_deserialize_frame(
+    /* out */
+    struct aws_cryptosdk_frame *frame,
+    size_t *ciphertext_size,
+    size_t *plaintext_size,
+    /* in */
+    struct aws_byte_cursor *ciphertext_buf,
+    const struct aws_cryptosdk_alg_properties *alg_props,
+    uint64_t max_frame_size) {
+    int rv = aws_cryptosdk_try_deserialize_frame(
+        frame, ciphertext_size, plaintext_size, ciphertext_buf, alg_props, max_frame_size);
+
+    return rv == AWS_CRYPTOSDK_NEED_MORE ? aws_raise_error(AWS_ERROR_SHORT_BUFFER) : rv;
+}
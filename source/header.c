@@ -18,9 +18,12 @@
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/edk.h>
 #include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/alloc_stats.h>
 #include <aws/cryptosdk/private/compiler.h>
 #include <aws/cryptosdk/private/enc_ctx.h>
 #include <aws/cryptosdk/private/header.h>
+#include <aws/cryptosdk/private/probes.h>
+#include <aws/cryptosdk/private/utils.h>
 #include <string.h>  // memcpy
 
 static int aws_cryptosdk_algorithm_is_known(uint16_t alg_id) {
@@ -67,7 +70,8 @@ static int is_known_type(uint8_t content_type) {
 int aws_cryptosdk_hdr_init(struct aws_cryptosdk_hdr *hdr, struct aws_allocator *alloc) {
     aws_secure_zero(hdr, sizeof(*hdr));
 
-    if (aws_cryptosdk_enc_ctx_init(alloc, &hdr->enc_ctx)) {
+    struct aws_allocator *enc_ctx_alloc = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_ENC_CTX);
+    if (aws_cryptosdk_enc_ctx_init(enc_ctx_alloc, &hdr->enc_ctx)) {
         return AWS_OP_ERR;
     }
 
@@ -76,18 +80,29 @@ int aws_cryptosdk_hdr_init(struct aws_cryptosdk_hdr *hdr, struct aws_allocator *
         return AWS_OP_ERR;
     }
 
-    hdr->alloc = alloc;
+    alloc            = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_HEADER);
+    hdr->alloc       = alloc;
+    hdr->field_alloc = alloc;
 
     return AWS_OP_SUCCESS;
 }
 
+/* Empties a header field, keeping its allocation (if we own it) for reuse */
+static void clear_field(struct aws_byte_buf *buf) {
+    if (buf->allocator) {
+        aws_byte_buf_secure_zero(buf);
+    } else {
+        AWS_ZERO_STRUCT(*buf);
+    }
+}
+
 void aws_cryptosdk_hdr_clear(struct aws_cryptosdk_hdr *hdr) {
-    /* hdr->alloc is preserved */
+    /* hdr->alloc, hdr->field_alloc, hdr->borrow_edks, hdr->defer_enc_ctx and the parse limits are preserved */
     hdr->alg_id    = 0;
     hdr->frame_len = 0;
 
-    aws_byte_buf_clean_up(&hdr->iv);
-    aws_byte_buf_clean_up(&hdr->auth_tag);
+    clear_field(&hdr->iv);
+    clear_field(&hdr->auth_tag);
 
     memset(&hdr->message_id, 0, sizeof(hdr->message_id));
 
@@ -95,6 +110,12 @@ void aws_cryptosdk_hdr_clear(struct aws_cryptosdk_hdr *hdr) {
     aws_cryptosdk_enc_ctx_clear(&hdr->enc_ctx);
 
     hdr->auth_len = 0;
+    AWS_ZERO_STRUCT(hdr->serialized_enc_ctx);
+    hdr->parsed_enc_ctx_offset = 0;
+    hdr->parsed_enc_ctx_len    = 0;
+    hdr->enc_ctx_deferred      = false;
+
+    AWS_ZERO_STRUCT(hdr->parse);
 }
 
 void aws_cryptosdk_hdr_clean_up(struct aws_cryptosdk_hdr *hdr) {
@@ -111,129 +132,306 @@ void aws_cryptosdk_hdr_clean_up(struct aws_cryptosdk_hdr *hdr) {
     aws_secure_zero(hdr, sizeof(*hdr));
 }
 
-static inline int parse_edk(
-    struct aws_allocator *allocator, struct aws_cryptosdk_edk *edk, struct aws_byte_cursor *cur) {
-    uint16_t field_len;
-
-    memset(edk, 0, sizeof(*edk));
+void aws_cryptosdk_hdr_trim(struct aws_cryptosdk_hdr *hdr) {
+    aws_cryptosdk_edk_list_clear(&hdr->edk_list);
+    aws_array_list_shrink_to_fit(&hdr->edk_list);
+    aws_cryptosdk_enc_ctx_clear(&hdr->enc_ctx);
 
-    if (!aws_byte_cursor_read_be16(cur, &field_len)) goto SHORT_BUF;
-    if (aws_byte_buf_init(&edk->provider_id, allocator, field_len)) goto MEM_ERR;
-    if (!aws_byte_cursor_read_and_fill_buffer(cur, &edk->provider_id)) goto SHORT_BUF;
+    AWS_ZERO_STRUCT(hdr->serialized_enc_ctx);
+    hdr->parsed_enc_ctx_offset = 0;
+    hdr->parsed_enc_ctx_len    = 0;
+    hdr->enc_ctx_deferred      = false;
+}
 
-    if (!aws_byte_cursor_read_be16(cur, &field_len)) goto SHORT_BUF;
-    if (aws_byte_buf_init(&edk->provider_info, allocator, field_len)) goto MEM_ERR;
-    if (!aws_byte_cursor_read_and_fill_buffer(cur, &edk->provider_info)) goto SHORT_BUF;
+/*
+ * Reads an EDK, along with its record. If allocator is NULL it is left pointing into the
+ * cursor's buffer; otherwise the record is copied into an allocation of its own.
+ */
+static inline int parse_edk(
+    struct aws_allocator *allocator, struct aws_cryptosdk_edk *edk, struct aws_byte_cursor *cur) {
+    struct aws_cryptosdk_edk view;
 
-    if (!aws_byte_cursor_read_be16(cur, &field_len)) goto SHORT_BUF;
-    if (aws_byte_buf_init(&edk->ciphertext, allocator, field_len)) goto MEM_ERR;
-    if (!aws_byte_cursor_read_and_fill_buffer(cur, &edk->ciphertext)) goto SHORT_BUF;
+    if (aws_cryptosdk_edk_init_view(&view, cur)) {
+        AWS_ZERO_STRUCT(*edk);
+        return AWS_OP_ERR;
+    }
 
-    return AWS_OP_SUCCESS;
+    if (!allocator) {
+        *edk = view;
+        return AWS_OP_SUCCESS;
+    }
 
-SHORT_BUF:
-    aws_cryptosdk_edk_clean_up(edk);
-    return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
-MEM_ERR:
-    aws_cryptosdk_edk_clean_up(edk);
-    // The _init function should have already raised an AWS_ERROR_OOM
-    return AWS_OP_ERR;
+    return aws_cryptosdk_edk_init_clone(allocator, edk, &view);
 }
 
-int aws_cryptosdk_hdr_parse(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *pcursor) {
-    struct aws_byte_cursor cur = *pcursor;
+enum hdr_parse_stage { HDR_PARSE_PREFIX = 0, HDR_PARSE_AAD, HDR_PARSE_EDKS, HDR_PARSE_TAIL, HDR_PARSE_DONE };
 
-    aws_cryptosdk_hdr_clear(hdr);
+// Version, type, algorithm ID, message ID and AAD length
+#define HDR_PREFIX_LEN (1 + 1 + 2 + MESSAGE_ID_LEN + 2)
+// Content type, reserved field, IV length and frame length
+#define HDR_TAIL_FIXED_LEN (1 + 4 + 1 + 4)
+
+/*
+ * Each parse stage below reads from *cur, which begins at hdr->parse.offset within the header.
+ * On success the cursor is advanced past the bytes consumed and the stage has been committed
+ * to hdr. If there is not enough data, *need is set to the number of bytes (counted from the
+ * start of *cur) that the stage requires, and AWS_CRYPTOSDK_NEED_MORE is returned.
+ */
+static int parse_prefix(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *cur, size_t *need) {
+    *need = HDR_PREFIX_LEN;
 
     uint8_t bytefield;
-    if (!aws_byte_cursor_read_u8(&cur, &bytefield)) goto SHORT_BUF;
+    if (!aws_byte_cursor_read_u8(cur, &bytefield)) goto SHORT_BUF;
     if (aws_cryptosdk_unlikely(bytefield != AWS_CRYPTOSDK_HEADER_VERSION_1_0)) goto PARSE_ERR;
 
-    if (!aws_byte_cursor_read_u8(&cur, &bytefield)) goto SHORT_BUF;
+    if (!aws_byte_cursor_read_u8(cur, &bytefield)) goto SHORT_BUF;
     if (aws_cryptosdk_unlikely(bytefield != AWS_CRYPTOSDK_HEADER_TYPE_CUSTOMER_AED)) goto PARSE_ERR;
 
     uint16_t alg_id;
-    if (!aws_byte_cursor_read_be16(&cur, &alg_id)) goto SHORT_BUF;
+    if (!aws_byte_cursor_read_be16(cur, &alg_id)) goto SHORT_BUF;
     if (aws_cryptosdk_unlikely(!aws_cryptosdk_algorithm_is_known(alg_id))) goto PARSE_ERR;
-    hdr->alg_id = alg_id;
 
-    if (!aws_byte_cursor_read(&cur, hdr->message_id, MESSAGE_ID_LEN)) goto SHORT_BUF;
+    if (!aws_byte_cursor_read(cur, hdr->message_id, MESSAGE_ID_LEN)) goto SHORT_BUF;
+    if (!aws_byte_cursor_read_be16(cur, &hdr->parse.aad_len)) goto SHORT_BUF;
+    if (hdr->max_enc_ctx_len && hdr->parse.aad_len > hdr->max_enc_ctx_len) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
 
-    uint16_t aad_len;
-    if (!aws_byte_cursor_read_be16(&cur, &aad_len)) goto SHORT_BUF;
+    hdr->alg_id      = alg_id;
+    hdr->parse.stage = HDR_PARSE_AAD;
+    return AWS_OP_SUCCESS;
 
-    if (aad_len) {
-        struct aws_byte_cursor aad = aws_byte_cursor_advance_nospec(&cur, aad_len);
+SHORT_BUF:
+    return AWS_CRYPTOSDK_NEED_MORE;
+PARSE_ERR:
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+}
+
+int aws_cryptosdk_hdr_materialize_enc_ctx(struct aws_cryptosdk_hdr *hdr, const uint8_t *header_bytes) {
+    if (!hdr->enc_ctx_deferred) return AWS_OP_SUCCESS;
+
+    struct aws_byte_cursor aad =
+        aws_byte_cursor_from_array(header_bytes + hdr->parsed_enc_ctx_offset, hdr->parsed_enc_ctx_len);
+    if (aws_cryptosdk_enc_ctx_deserialize(hdr->field_alloc, &hdr->enc_ctx, &aad)) return AWS_OP_ERR;
 
-        // Note that, even if this fails with SHORT_BUF, we report a parse error, since we know we
-        // have enough data (according to the aad length field).
-        if (aws_cryptosdk_enc_ctx_deserialize(hdr->alloc, &hdr->enc_ctx, &aad)) goto PARSE_ERR;
-        if (aad.len) {
-            // trailing garbage after the aad block
-            goto PARSE_ERR;
+    hdr->enc_ctx_deferred = false;
+    return AWS_OP_SUCCESS;
+}
+
+static int parse_aad(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *cur, size_t *need) {
+    // The AAD block is followed by the EDK count
+    *need = (size_t)hdr->parse.aad_len + 2;
+    if (cur->len < *need) return AWS_CRYPTOSDK_NEED_MORE;
+
+    if (hdr->max_edks) {
+        // Peek at the EDK count, so that too many are refused before the context is deserialized
+        struct aws_byte_cursor count = *cur;
+        uint16_t edk_count           = 0;
+        aws_byte_cursor_advance(&count, hdr->parse.aad_len);
+        aws_byte_cursor_read_be16(&count, &edk_count);
+        if (edk_count > hdr->max_edks) return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    hdr->parsed_enc_ctx_offset = hdr->parse.offset;
+    hdr->parsed_enc_ctx_len    = hdr->parse.aad_len;
+    if (hdr->parse.aad_len) {
+        struct aws_byte_cursor aad = aws_byte_cursor_advance_nospec(cur, hdr->parse.aad_len);
+
+        // A canonical context, which spans the whole block, only fails to deserialize for lack
+        // of memory, so that can wait until the context is wanted
+        if (hdr->defer_enc_ctx && aws_cryptosdk_enc_ctx_is_canonical(aad)) {
+            aws_cryptosdk_enc_ctx_clear(&hdr->enc_ctx);
+            hdr->enc_ctx_deferred = true;
+        } else {
+            // Even if this fails with SHORT_BUF, we report a parse error, since we know we have
+            // enough data (according to the aad length field).
+            if (aws_cryptosdk_enc_ctx_deserialize(hdr->field_alloc, &hdr->enc_ctx, &aad)) goto PARSE_ERR;
+            if (aad.len) {
+                // trailing garbage after the aad block
+                goto PARSE_ERR;
+            }
         }
     }
 
-    uint16_t edk_count;
-    if (!aws_byte_cursor_read_be16(&cur, &edk_count)) goto SHORT_BUF;
-    if (!edk_count) goto PARSE_ERR;
+    if (!aws_byte_cursor_read_be16(cur, &hdr->parse.edk_count)) goto PARSE_ERR;
+    if (!hdr->parse.edk_count) goto PARSE_ERR;
 
-    for (uint16_t i = 0; i < edk_count; ++i) {
-        struct aws_cryptosdk_edk edk;
+    /*
+     * Make room for every EDK now, so that the list is not reallocated as they are parsed; but
+     * only once the input holds enough bytes for that many (six each, at the least), so that a
+     * forged count cannot make us allocate far more than we were sent
+     */
+    if (cur->len / 6 >= hdr->parse.edk_count &&
+        aws_array_list_ensure_capacity(&hdr->edk_list, hdr->parse.edk_count - 1)) {
+        return AWS_OP_ERR;
+    }
 
-        if (parse_edk(hdr->alloc, &edk, &cur)) {
-            goto RETHROW;
-        }
+    hdr->parse.stage = HDR_PARSE_EDKS;
+    return AWS_OP_SUCCESS;
 
-        aws_array_list_push_back(&hdr->edk_list, &edk);
+PARSE_ERR:
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+}
+
+/*
+ * Returns the number of bytes needed to parse the EDK at the start of cur, as far as it can
+ * be determined from the length fields available so far.
+ */
+static size_t edk_bytes_needed(struct aws_byte_cursor cur) {
+    size_t needed = 0;
+
+    // provider ID, provider info and ciphertext, each with a two byte length prefix
+    for (int field = 0; field < 3; field++) {
+        uint16_t field_len;
+
+        needed += 2;
+        if (!aws_byte_cursor_read_be16(&cur, &field_len)) break;
+
+        needed += field_len;
+        if (cur.len < field_len) break;
+        aws_byte_cursor_advance(&cur, field_len);
+    }
+
+    return needed;
+}
+
+static int parse_next_edk(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *cur, size_t *need) {
+    if (aws_array_list_length(&hdr->edk_list) == hdr->parse.edk_count) {
+        hdr->parse.stage = HDR_PARSE_TAIL;
+        return AWS_OP_SUCCESS;
     }
 
+    *need = edk_bytes_needed(*cur);
+    if (cur->len < *need) return AWS_CRYPTOSDK_NEED_MORE;
+
+    struct aws_cryptosdk_edk edk;
+    if (parse_edk(hdr->borrow_edks ? NULL : hdr->field_alloc, &edk, cur)) return AWS_OP_ERR;
+
+    if (aws_array_list_push_back(&hdr->edk_list, &edk)) {
+        aws_cryptosdk_edk_clean_up(&edk);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int parse_tail(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *cur, size_t *need) {
+    size_t iv_len  = aws_cryptosdk_algorithm_ivlen(hdr->alg_id);
+    size_t tag_len = aws_cryptosdk_algorithm_taglen(hdr->alg_id);
+
+    *need = HDR_TAIL_FIXED_LEN + iv_len + tag_len;
+
     uint8_t content_type;
-    if (!aws_byte_cursor_read_u8(&cur, &content_type)) goto SHORT_BUF;
+    if (!aws_byte_cursor_read_u8(cur, &content_type)) goto SHORT_BUF;
 
     if (aws_cryptosdk_unlikely(!is_known_type(content_type))) goto PARSE_ERR;
 
     uint32_t reserved;  // must be zero
-    if (!aws_byte_cursor_read_be32(&cur, &reserved)) goto SHORT_BUF;
+    if (!aws_byte_cursor_read_be32(cur, &reserved)) goto SHORT_BUF;
     if (reserved) goto PARSE_ERR;
 
-    uint8_t iv_len;
-    if (!aws_byte_cursor_read_u8(&cur, &iv_len)) goto SHORT_BUF;
+    uint8_t iv_len_field;
+    if (!aws_byte_cursor_read_u8(cur, &iv_len_field)) goto SHORT_BUF;
 
-    if (iv_len != aws_cryptosdk_algorithm_ivlen(alg_id)) goto PARSE_ERR;
+    if (iv_len_field != iv_len) goto PARSE_ERR;
 
     uint32_t frame_len;
-    if (!aws_byte_cursor_read_be32(&cur, &frame_len)) goto SHORT_BUF;
+    if (!aws_byte_cursor_read_be32(cur, &frame_len)) goto SHORT_BUF;
 
     if ((content_type == AWS_CRYPTOSDK_HEADER_CTYPE_NONFRAMED && frame_len != 0) ||
         (content_type == AWS_CRYPTOSDK_HEADER_CTYPE_FRAMED && frame_len == 0))
         goto PARSE_ERR;
-    hdr->frame_len = frame_len;
 
-    // cur.ptr now points to end of portion of header that is authenticated
-    hdr->auth_len = cur.ptr - pcursor->ptr;
+    if (cur->len < iv_len + tag_len) goto SHORT_BUF;
 
-    if (aws_byte_buf_init(&hdr->iv, hdr->alloc, iv_len)) goto MEM_ERR;
-    if (!aws_byte_cursor_read_and_fill_buffer(&cur, &hdr->iv)) goto SHORT_BUF;
+    if (aws_cryptosdk_byte_buf_reinit(&hdr->iv, hdr->alloc, iv_len)) return AWS_OP_ERR;
+    if (aws_cryptosdk_byte_buf_reinit(&hdr->auth_tag, hdr->alloc, tag_len)) return AWS_OP_ERR;
 
-    size_t tag_len = aws_cryptosdk_algorithm_taglen(alg_id);
-    if (aws_byte_buf_init(&hdr->auth_tag, hdr->alloc, tag_len)) goto MEM_ERR;
-    if (!aws_byte_cursor_read_and_fill_buffer(&cur, &hdr->auth_tag)) goto SHORT_BUF;
+    // Reused buffers may be larger than needed, so they are filled by length rather than capacity
+    aws_byte_cursor_read(cur, hdr->iv.buffer, iv_len);
+    hdr->iv.len = iv_len;
+    aws_byte_cursor_read(cur, hdr->auth_tag.buffer, tag_len);
+    hdr->auth_tag.len = tag_len;
 
-    *pcursor = cur;
+    hdr->frame_len = frame_len;
+    // Everything up to the IV is authenticated
+    hdr->auth_len    = hdr->parse.offset + HDR_TAIL_FIXED_LEN;
+    hdr->parse.stage = HDR_PARSE_DONE;
 
     return AWS_OP_SUCCESS;
 
 SHORT_BUF:
-    aws_cryptosdk_hdr_clear(hdr);
-    return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    return AWS_CRYPTOSDK_NEED_MORE;
 PARSE_ERR:
-    aws_cryptosdk_hdr_clear(hdr);
     return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
-MEM_ERR:
-RETHROW:
+}
+
+int aws_cryptosdk_hdr_try_parse_incremental(
+    struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *pcursor, size_t *needed) {
+    struct aws_byte_cursor cur = *pcursor;
+
+    // A header arriving in pieces fires this on each call until the prefix parses; tracers should keep the last
+    if (!hdr->parse.offset && hdr->parse.stage != HDR_PARSE_DONE) AWS_CRYPTOSDK_PROBE1(header_parse_start, hdr);
+
+    // Skip over the parts of the header we have already parsed
+    if (cur.len < hdr->parse.offset) {
+        if (needed) *needed = hdr->parse.needed;
+        return AWS_CRYPTOSDK_NEED_MORE;
+    }
+    aws_byte_cursor_advance(&cur, hdr->parse.offset);
+
+    while (hdr->parse.stage != HDR_PARSE_DONE) {
+        struct aws_byte_cursor step = cur;
+        size_t need                 = 0;
+        int rv;
+
+        switch (hdr->parse.stage) {
+            case HDR_PARSE_PREFIX: rv = parse_prefix(hdr, &step, &need); break;
+            case HDR_PARSE_AAD: rv = parse_aad(hdr, &step, &need); break;
+            case HDR_PARSE_EDKS: rv = parse_next_edk(hdr, &step, &need); break;
+            case HDR_PARSE_TAIL: rv = parse_tail(hdr, &step, &need); break;
+            default: return aws_raise_error(AWS_ERROR_UNKNOWN);
+        }
+
+        if (rv == AWS_CRYPTOSDK_NEED_MORE) {
+            // A stage may see fewer length fields than it did on an earlier call with more
+            // data; never report less than we have already learned we need
+            need = aws_add_size_saturating(hdr->parse.offset, need);
+            if (need > hdr->parse.needed) hdr->parse.needed = need;
+            if (needed) *needed = hdr->parse.needed;
+            return AWS_CRYPTOSDK_NEED_MORE;
+        }
+        if (rv) {
+            AWS_CRYPTOSDK_PROBE3(header_parse_end, hdr, hdr->parse.offset, aws_last_error());
+            return AWS_OP_ERR;
+        }
+
+        hdr->parse.offset += step.ptr - cur.ptr;
+        cur = step;
+        if (hdr->parse.stage == HDR_PARSE_DONE) AWS_CRYPTOSDK_PROBE3(header_parse_end, hdr, hdr->parse.offset, 0);
+    }
+
+    *pcursor = cur;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_hdr_parse_incremental(
+    struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *pcursor, size_t *needed) {
+    int rv = aws_cryptosdk_hdr_try_parse_incremental(hdr, pcursor, needed);
+
+    return rv == AWS_CRYPTOSDK_NEED_MORE ? aws_raise_error(AWS_ERROR_SHORT_BUFFER) : rv;
+}
+
+int aws_cryptosdk_hdr_parse(struct aws_cryptosdk_hdr *hdr, struct aws_byte_cursor *pcursor) {
     aws_cryptosdk_hdr_clear(hdr);
-    return AWS_OP_ERR;  // Error code will already have been raised in aws_mem_acquire
+
+    if (aws_cryptosdk_hdr_parse_incremental(hdr, pcursor, NULL)) {
+        aws_cryptosdk_hdr_clear(hdr);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
 }
 
 /*
@@ -256,16 +454,14 @@ static size_t saturating_add(size_t a, size_t b) {
     return c;
 }
 
-int aws_cryptosdk_hdr_size(const struct aws_cryptosdk_hdr *hdr) {
-    if (!memcmp(hdr, &zero.hdr, sizeof(struct aws_cryptosdk_hdr))) return 0;
-
+size_t aws_cryptosdk_hdr_fields_size(const struct aws_hash_table *enc_ctx, const struct aws_array_list *edk_list) {
     size_t idx;
-    size_t edk_count = aws_array_list_length(&hdr->edk_list);
-    // 18 is the total size of the non-variable-size fields in the header
-    size_t bytes = 18 + MESSAGE_ID_LEN + hdr->iv.len + hdr->auth_tag.len;
+    size_t edk_count = aws_array_list_length(edk_list);
+    // 2 bytes each for the AAD length and the EDK count
+    size_t bytes = 4;
     size_t aad_len;
 
-    if (aws_cryptosdk_enc_ctx_size(&aad_len, &hdr->enc_ctx)) {
+    if (aws_cryptosdk_enc_ctx_size(&aad_len, enc_ctx)) {
         return 0;
     }
     bytes += aad_len;
@@ -274,7 +470,7 @@ int aws_cryptosdk_hdr_size(const struct aws_cryptosdk_hdr *hdr) {
         void *vp_edk = NULL;
         struct aws_cryptosdk_edk *edk;
 
-        aws_array_list_get_at_ptr(&hdr->edk_list, &vp_edk, idx);
+        aws_array_list_get_at_ptr(edk_list, &vp_edk, idx);
         assert(vp_edk);
 
         edk = vp_edk;
@@ -287,81 +483,340 @@ int aws_cryptosdk_hdr_size(const struct aws_cryptosdk_hdr *hdr) {
 
     return bytes == SIZE_MAX ? 0 : bytes;
 }
+
+size_t aws_cryptosdk_hdr_size_with_fields(const struct aws_cryptosdk_hdr *hdr, size_t fields_len) {
+    // 14 is the total size of the non-variable-size fields outside of the AAD and EDK sections
+    size_t bytes = saturating_add(14 + MESSAGE_ID_LEN + hdr->iv.len + hdr->auth_tag.len, fields_len);
+
+    return bytes == SIZE_MAX ? 0 : bytes;
+}
+
+int aws_cryptosdk_hdr_size(const struct aws_cryptosdk_hdr *hdr) {
+    if (!memcmp(hdr, &zero.hdr, sizeof(struct aws_cryptosdk_hdr))) return 0;
+
+    size_t fields_len = aws_cryptosdk_hdr_fields_size(&hdr->enc_ctx, &hdr->edk_list);
+    if (!fields_len) return 0;
+
+    // A deferred context is still empty, but its serialization was parsed
+    if (hdr->enc_ctx_deferred) fields_len = saturating_add(fields_len, hdr->parsed_enc_ctx_len);
+
+    return aws_cryptosdk_hdr_size_with_fields(hdr, fields_len);
+}
 static void init_aws_byte_buf_raw(struct aws_byte_buf *buf) {
     buf->allocator = NULL;
     buf->buffer    = NULL;
     buf->len       = 0;
     buf->capacity  = 0;
 }
-int aws_cryptosdk_hdr_write(
-    const struct aws_cryptosdk_hdr *hdr, size_t *bytes_written, uint8_t *outbuf, size_t outlen) {
-    struct aws_byte_buf output = aws_byte_buf_from_array(outbuf, outlen);
-    output.len                 = 0;
 
-    if (!aws_byte_buf_write_u8(&output, AWS_CRYPTOSDK_HEADER_VERSION_1_0)) goto WRITE_ERR;
-    if (!aws_byte_buf_write_u8(&output, AWS_CRYPTOSDK_HEADER_TYPE_CUSTOMER_AED)) goto WRITE_ERR;
-    if (!aws_byte_buf_write_be16(&output, hdr->alg_id)) goto WRITE_ERR;
-    if (!aws_byte_buf_write(&output, hdr->message_id, MESSAGE_ID_LEN)) goto WRITE_ERR;
+static bool write_prefix(const struct aws_cryptosdk_hdr *hdr, struct aws_byte_buf *output) {
+    return aws_byte_buf_write_u8(output, AWS_CRYPTOSDK_HEADER_VERSION_1_0) &&
+           aws_byte_buf_write_u8(output, AWS_CRYPTOSDK_HEADER_TYPE_CUSTOMER_AED) &&
+           aws_byte_buf_write_be16(output, hdr->alg_id) && aws_byte_buf_write(output, hdr->message_id, MESSAGE_ID_LEN);
+}
+
+static bool write_tail(const struct aws_cryptosdk_hdr *hdr, struct aws_byte_buf *output) {
+    if (!aws_byte_buf_write_u8(
+            output, hdr->frame_len ? AWS_CRYPTOSDK_HEADER_CTYPE_FRAMED : AWS_CRYPTOSDK_HEADER_CTYPE_NONFRAMED))
+        return false;
+
+    if (!aws_byte_buf_write(output, zero.bytes, 4)) return false;
 
+    if (!aws_byte_buf_write_u8(output, (uint8_t)hdr->iv.len)) return false;
+    if (!aws_byte_buf_write_be32(output, hdr->frame_len)) return false;
+
+    if (!aws_byte_buf_write_from_whole_cursor(output, aws_byte_cursor_from_array(hdr->iv.buffer, hdr->iv.len)))
+        return false;
+    if (!aws_byte_buf_write_from_whole_cursor(
+            output, aws_byte_cursor_from_array(hdr->auth_tag.buffer, hdr->auth_tag.len)))
+        return false;
+
+    return true;
+}
+
+static int write_fields(
+    struct aws_byte_buf *output,
+    const struct aws_hash_table *enc_ctx,
+    struct aws_byte_cursor serialized_enc_ctx,
+    const struct aws_array_list *edk_list) {
     // TODO - unify everything on byte_bufs when the aws-c-common refactor lands
     // See: https://github.com/awslabs/aws-c-common/pull/130
     struct aws_byte_buf aad_length_field;
     init_aws_byte_buf_raw(&aad_length_field);
 
-    if (!aws_byte_buf_advance(&output, &aad_length_field, 2)) goto WRITE_ERR;
+    if (!aws_byte_buf_advance(output, &aad_length_field, 2)) goto WRITE_ERR;
 
-    size_t old_len = output.len;
-    if (aws_cryptosdk_enc_ctx_serialize(aws_default_allocator(), &output, &hdr->enc_ctx)) goto WRITE_ERR;
+    size_t old_len = output->len;
+    if (serialized_enc_ctx.len) {
+        if (!aws_byte_buf_write_from_whole_cursor(output, serialized_enc_ctx)) goto WRITE_ERR;
+    } else if (aws_cryptosdk_enc_ctx_serialize(aws_default_allocator(), output, enc_ctx)) {
+        goto WRITE_ERR;
+    }
 
-    if (!aws_byte_buf_write_be16(&aad_length_field, (uint16_t)(output.len - old_len))) goto WRITE_ERR;
+    if (!aws_byte_buf_write_be16(&aad_length_field, (uint16_t)(output->len - old_len))) goto WRITE_ERR;
 
-    size_t edk_count = aws_array_list_length(&hdr->edk_list);
-    if (!aws_byte_buf_write_be16(&output, (uint16_t)edk_count)) goto WRITE_ERR;
+    size_t edk_count = aws_array_list_length(edk_list);
+    if (!aws_byte_buf_write_be16(output, (uint16_t)edk_count)) goto WRITE_ERR;
 
     for (size_t idx = 0; idx < edk_count; ++idx) {
         void *vp_edk = NULL;
 
-        aws_array_list_get_at_ptr(&hdr->edk_list, &vp_edk, idx);
+        aws_array_list_get_at_ptr(edk_list, &vp_edk, idx);
         assert(vp_edk);
 
         const struct aws_cryptosdk_edk *edk = vp_edk;
 
-        if (!aws_byte_buf_write_be16(&output, (uint16_t)edk->provider_id.len)) goto WRITE_ERR;
-        if (!aws_byte_buf_write_from_whole_cursor(
-                &output, aws_byte_cursor_from_array(edk->provider_id.buffer, edk->provider_id.len)))
-            goto WRITE_ERR;
+        // Keyrings and the header parser produce records, which are written as they are
+        if (aws_cryptosdk_edk_write_record(output, edk)) return AWS_OP_ERR;
+    }
 
-        if (!aws_byte_buf_write_be16(&output, (uint16_t)edk->provider_info.len)) goto WRITE_ERR;
-        if (!aws_byte_buf_write_from_whole_cursor(
-                &output, aws_byte_cursor_from_array(edk->provider_info.buffer, edk->provider_info.len)))
-            goto WRITE_ERR;
+    return AWS_OP_SUCCESS;
 
-        if (!aws_byte_buf_write_be16(&output, (uint16_t)edk->ciphertext.len)) goto WRITE_ERR;
-        if (!aws_byte_buf_write_from_whole_cursor(
-                &output, aws_byte_cursor_from_array(edk->ciphertext.buffer, edk->ciphertext.len)))
-            goto WRITE_ERR;
+WRITE_ERR:
+    return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+}
+
+int aws_cryptosdk_hdr_write_fields(
+    struct aws_byte_buf *output, const struct aws_hash_table *enc_ctx, const struct aws_array_list *edk_list) {
+    struct aws_byte_cursor no_serialized_enc_ctx = { 0 };
+
+    return write_fields(output, enc_ctx, no_serialized_enc_ctx, edk_list);
+}
+
+int aws_cryptosdk_hdr_write(
+    const struct aws_cryptosdk_hdr *hdr, size_t *bytes_written, uint8_t *outbuf, size_t outlen) {
+    struct aws_byte_buf output = aws_byte_buf_from_array(outbuf, outlen);
+    output.len                 = 0;
+
+    // The header no longer knows where the deferred context's bytes are
+    if (hdr->enc_ctx_deferred && !hdr->serialized_enc_ctx.len) {
+        *bytes_written = 0;
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
     }
 
-    if (!aws_byte_buf_write_u8(
-            &output, hdr->frame_len ? AWS_CRYPTOSDK_HEADER_CTYPE_FRAMED : AWS_CRYPTOSDK_HEADER_CTYPE_NONFRAMED))
-        goto WRITE_ERR;
+    AWS_CRYPTOSDK_PROBE1(header_write_start, hdr);
+    if (!write_prefix(hdr, &output)) goto WRITE_ERR;
+    if (write_fields(&output, &hdr->enc_ctx, hdr->serialized_enc_ctx, &hdr->edk_list)) goto WRITE_ERR;
+    if (!write_tail(hdr, &output)) goto WRITE_ERR;
 
-    if (!aws_byte_buf_write(&output, zero.bytes, 4)) goto WRITE_ERR;
+    *bytes_written = output.len;
+    AWS_CRYPTOSDK_PROBE3(header_write_end, hdr, output.len, 0);
+    return AWS_OP_SUCCESS;
 
-    if (!aws_byte_buf_write_u8(&output, (uint8_t)hdr->iv.len)) goto WRITE_ERR;
-    if (!aws_byte_buf_write_be32(&output, hdr->frame_len)) goto WRITE_ERR;
+WRITE_ERR:
+    aws_secure_zero(outbuf, outlen);
+    *bytes_written = 0;
+    AWS_CRYPTOSDK_PROBE3(header_write_end, hdr, 0, AWS_ERROR_SHORT_BUFFER);
+    return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+}
 
-    if (!aws_byte_buf_write_from_whole_cursor(&output, aws_byte_cursor_from_array(hdr->iv.buffer, hdr->iv.len)))
-        goto WRITE_ERR;
-    if (!aws_byte_buf_write_from_whole_cursor(
-            &output, aws_byte_cursor_from_array(hdr->auth_tag.buffer, hdr->auth_tag.len)))
-        goto WRITE_ERR;
+int aws_cryptosdk_hdr_write_with_fields(
+    const struct aws_cryptosdk_hdr *hdr,
+    struct aws_byte_cursor fields,
+    size_t *bytes_written,
+    uint8_t *outbuf,
+    size_t outlen) {
+    struct aws_byte_buf output = aws_byte_buf_from_array(outbuf, outlen);
+    output.len                 = 0;
+
+    AWS_CRYPTOSDK_PROBE1(header_write_start, hdr);
+    if (!write_prefix(hdr, &output)) goto WRITE_ERR;
+    if (!aws_byte_buf_write_from_whole_cursor(&output, fields)) goto WRITE_ERR;
+    if (!write_tail(hdr, &output)) goto WRITE_ERR;
 
     *bytes_written = output.len;
+    AWS_CRYPTOSDK_PROBE3(header_write_end, hdr, output.len, 0);
     return AWS_OP_SUCCESS;
 
 WRITE_ERR:
     aws_secure_zero(outbuf, outlen);
     *bytes_written = 0;
+    AWS_CRYPTOSDK_PROBE3(header_write_end, hdr, 0, AWS_ERROR_SHORT_BUFFER);
     return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
 }
+
+/* Reads a field with a two byte length prefix into *field, which still refers to cur's buffer */
+static bool read_field(struct aws_byte_cursor *cur, struct aws_byte_cursor *field) {
+    uint16_t field_len;
+
+    if (!aws_byte_cursor_read_be16(cur, &field_len)) return false;
+
+    *field = aws_byte_cursor_advance_nospec(cur, field_len);
+
+    return field->ptr != NULL;
+}
+
+/* Checks the serialized encryption context in aad, setting *count and *pairs */
+static int view_enc_ctx(struct aws_byte_cursor aad, uint16_t *count, struct aws_byte_cursor *pairs) {
+    struct aws_byte_cursor field;
+
+    *count = 0;
+    *pairs = aws_byte_cursor_from_array(aad.ptr, 0);
+    if (!aad.len) return AWS_OP_SUCCESS;
+
+    if (!aws_byte_cursor_read_be16(&aad, count) || !*count) goto PARSE_ERR;
+
+    *pairs = aad;
+    for (uint16_t i = 0; i < *count; i++) {
+        if (!read_field(&aad, &field) || !read_field(&aad, &field)) goto PARSE_ERR;
+    }
+
+    // trailing garbage after the aad block
+    if (aad.len) goto PARSE_ERR;
+
+    return AWS_OP_SUCCESS;
+
+PARSE_ERR:
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+}
+
+int aws_cryptosdk_hdr_view_init(struct aws_cryptosdk_hdr_view *view, struct aws_byte_cursor input) {
+    struct aws_byte_cursor cur = input, field;
+
+    AWS_ZERO_STRUCT(*view);
+
+    uint8_t bytefield;
+    if (!aws_byte_cursor_read_u8(&cur, &bytefield)) goto SHORT_BUF;
+    if (aws_cryptosdk_unlikely(bytefield != AWS_CRYPTOSDK_HEADER_VERSION_1_0)) goto PARSE_ERR;
+
+    if (!aws_byte_cursor_read_u8(&cur, &bytefield)) goto SHORT_BUF;
+    if (aws_cryptosdk_unlikely(bytefield != AWS_CRYPTOSDK_HEADER_TYPE_CUSTOMER_AED)) goto PARSE_ERR;
+
+    uint16_t alg_id;
+    if (!aws_byte_cursor_read_be16(&cur, &alg_id)) goto SHORT_BUF;
+    if (aws_cryptosdk_unlikely(!aws_cryptosdk_algorithm_is_known(alg_id))) goto PARSE_ERR;
+
+    struct aws_byte_cursor message_id = aws_byte_cursor_advance_nospec(&cur, MESSAGE_ID_LEN);
+    if (!message_id.ptr) goto SHORT_BUF;
+
+    struct aws_byte_cursor aad;
+    if (!read_field(&cur, &aad)) goto SHORT_BUF;
+    if (view_enc_ctx(aad, &view->enc_ctx_count, &view->enc_ctx)) goto ERR;
+
+    uint16_t edk_count;
+    if (!aws_byte_cursor_read_be16(&cur, &edk_count)) goto SHORT_BUF;
+    if (!edk_count) goto PARSE_ERR;
+
+    const uint8_t *edks = cur.ptr;
+    for (uint16_t i = 0; i < edk_count; i++) {
+        // provider ID, provider info and ciphertext
+        if (!read_field(&cur, &field) || !read_field(&cur, &field) || !read_field(&cur, &field)) goto SHORT_BUF;
+    }
+
+    uint8_t content_type;
+    if (!aws_byte_cursor_read_u8(&cur, &content_type)) goto SHORT_BUF;
+    if (aws_cryptosdk_unlikely(!is_known_type(content_type))) goto PARSE_ERR;
+
+    uint32_t reserved;  // must be zero
+    if (!aws_byte_cursor_read_be32(&cur, &reserved)) goto SHORT_BUF;
+    if (reserved) goto PARSE_ERR;
+
+    size_t iv_len  = aws_cryptosdk_algorithm_ivlen(alg_id);
+    size_t tag_len = aws_cryptosdk_algorithm_taglen(alg_id);
+
+    if (!aws_byte_cursor_read_u8(&cur, &bytefield)) goto SHORT_BUF;
+    if (bytefield != iv_len) goto PARSE_ERR;
+
+    uint32_t frame_len;
+    if (!aws_byte_cursor_read_be32(&cur, &frame_len)) goto SHORT_BUF;
+
+    if ((content_type == AWS_CRYPTOSDK_HEADER_CTYPE_NONFRAMED && frame_len != 0) ||
+        (content_type == AWS_CRYPTOSDK_HEADER_CTYPE_FRAMED && frame_len == 0))
+        goto PARSE_ERR;
+
+    struct aws_byte_cursor iv       = aws_byte_cursor_advance_nospec(&cur, iv_len);
+    struct aws_byte_cursor auth_tag = aws_byte_cursor_advance_nospec(&cur, tag_len);
+    if (!iv.ptr || !auth_tag.ptr) goto SHORT_BUF;
+
+    view->header     = aws_byte_cursor_from_array(input.ptr, cur.ptr - input.ptr);
+    view->alg_id     = (enum aws_cryptosdk_alg_id)alg_id;
+    view->message_id = message_id;
+    view->edk_count  = edk_count;
+    view->edks       = aws_byte_cursor_from_array(edks, iv.ptr - HDR_TAIL_FIXED_LEN - edks);
+    view->frame_len  = frame_len;
+    view->iv         = iv;
+    view->auth_tag   = auth_tag;
+
+    return AWS_OP_SUCCESS;
+
+SHORT_BUF:
+    aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    goto ERR;
+PARSE_ERR:
+    aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+ERR:
+    AWS_ZERO_STRUCT(*view);
+    return AWS_OP_ERR;
+}
+
+void aws_cryptosdk_hdr_view_edk_iter_init(
+    const struct aws_cryptosdk_hdr_view *view, struct aws_cryptosdk_hdr_edk_iter *iter) {
+    iter->cur       = view->edks;
+    iter->remaining = view->edk_count;
+}
+
+bool aws_cryptosdk_hdr_edk_iter_next(
+    struct aws_cryptosdk_hdr_edk_iter *iter,
+    struct aws_byte_cursor *provider_id,
+    struct aws_byte_cursor *provider_info,
+    struct aws_byte_cursor *ciphertext) {
+    struct aws_byte_cursor fields[3];
+
+    // The view has already checked that every field is present
+    if (!iter->remaining || !read_field(&iter->cur, &fields[0]) || !read_field(&iter->cur, &fields[1]) ||
+        !read_field(&iter->cur, &fields[2])) {
+        return false;
+    }
+
+    iter->remaining--;
+    if (provider_id) *provider_id = fields[0];
+    if (provider_info) *provider_info = fields[1];
+    if (ciphertext) *ciphertext = fields[2];
+
+    return true;
+}
+
+void aws_cryptosdk_hdr_view_enc_ctx_iter_init(
+    const struct aws_cryptosdk_hdr_view *view, struct aws_cryptosdk_hdr_enc_ctx_iter *iter) {
+    iter->cur       = view->enc_ctx;
+    iter->remaining = view->enc_ctx_count;
+}
+
+bool aws_cryptosdk_hdr_enc_ctx_iter_next(
+    struct aws_cryptosdk_hdr_enc_ctx_iter *iter, struct aws_byte_cursor *key, struct aws_byte_cursor *value) {
+    struct aws_byte_cursor k, v;
+
+    if (!iter->remaining || !read_field(&iter->cur, &k) || !read_field(&iter->cur, &v)) {
+        return false;
+    }
+
+    iter->remaining--;
+    if (key) *key = k;
+    if (value) *value = v;
+
+    return true;
+}
+
+bool aws_cryptosdk_hdr_fields_match_edks(struct aws_byte_cursor fields, const struct aws_array_list *edk_list) {
+    struct aws_byte_cursor aad, field;
+    uint16_t edk_count;
+
+    if (!read_field(&fields, &aad)) return false;
+    if (!aws_byte_cursor_read_be16(&fields, &edk_count)) return false;
+    if (edk_count != aws_array_list_length(edk_list)) return false;
+
+    for (size_t idx = 0; idx < edk_count; ++idx) {
+        void *vp_edk = NULL;
+
+        aws_array_list_get_at_ptr(edk_list, &vp_edk, idx);
+        assert(vp_edk);
+
+        const struct aws_cryptosdk_edk *edk = vp_edk;
+
+        if (!read_field(&fields, &field) || !aws_byte_cursor_eq_byte_buf(&field, &edk->provider_id)) return false;
+        if (!read_field(&fields, &field) || !aws_byte_cursor_eq_byte_buf(&field, &edk->provider_info)) return false;
+        if (!read_field(&fields, &field) || !aws_byte_cursor_eq_byte_buf(&field, &edk->ciphertext)) return false;
+    }
+
+    return fields.len == 0;
+}
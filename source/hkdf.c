@@ -12,137 +12,239 @@
  * express or implied. See the License for the specific language governing
  * permissions and limitations under the License.
  */
-#include <assert.h>
+#include <string.h>
+
 #include <aws/common/byte_buf.h>
 #include <aws/cryptosdk/error.h>
 #include <aws/cryptosdk/private/hkdf.h>
-#include <openssl/evp.h>
-#include <openssl/hmac.h>
-#include <openssl/opensslv.h>
-
-static const EVP_MD *aws_cryptosdk_get_evp_md(enum aws_cryptosdk_sha_version which_sha) {
-    switch (which_sha) {
-        case AWS_CRYPTOSDK_SHA256: return EVP_sha256();
-        case AWS_CRYPTOSDK_SHA384: return EVP_sha384();
-        default: return NULL;
+
+/*
+ * HMAC is computed directly over the SHA-2 compression functions rather than through the EVP
+ * layer, so that a keyed state is a plain struct which can be copied to start each HMAC.
+ */
+
+#define SHA256_BLOCK_LEN 64
+#define SHA384_BLOCK_LEN 128
+#define MAX_BLOCK_LEN SHA384_BLOCK_LEN
+
+static size_t hash_len(enum aws_cryptosdk_sha_version which_sha) {
+    return which_sha == AWS_CRYPTOSDK_SHA256 ? SHA256_DIGEST_LENGTH : SHA384_DIGEST_LENGTH;
+}
+
+static size_t block_len(enum aws_cryptosdk_sha_version which_sha) {
+    return which_sha == AWS_CRYPTOSDK_SHA256 ? SHA256_BLOCK_LEN : SHA384_BLOCK_LEN;
+}
+
+static void sha_init(enum aws_cryptosdk_sha_version which_sha, union aws_cryptosdk_sha_ctx *ctx) {
+    if (which_sha == AWS_CRYPTOSDK_SHA256) {
+        SHA256_Init(&ctx->sha256);
+    } else {
+        SHA384_Init(&ctx->sha512);
+    }
+}
+
+static void sha_update(
+    enum aws_cryptosdk_sha_version which_sha, union aws_cryptosdk_sha_ctx *ctx, const uint8_t *data, size_t len) {
+    if (which_sha == AWS_CRYPTOSDK_SHA256) {
+        SHA256_Update(&ctx->sha256, data, len);
+    } else {
+        SHA384_Update(&ctx->sha512, data, len);
+    }
+}
+
+static void sha_final(enum aws_cryptosdk_sha_version which_sha, union aws_cryptosdk_sha_ctx *ctx, uint8_t *digest) {
+    if (which_sha == AWS_CRYPTOSDK_SHA256) {
+        SHA256_Final(digest, &ctx->sha256);
+    } else {
+        SHA384_Final(digest, &ctx->sha512);
+    }
+}
+
+/* Absorbs the padded HMAC key into the inner and outer hash states of hkdf_key */
+static void hmac_set_key(struct aws_cryptosdk_hkdf_key *hkdf_key, const uint8_t *key, size_t key_len) {
+    enum aws_cryptosdk_sha_version which_sha = hkdf_key->which_sha;
+    size_t block                             = block_len(which_sha);
+    uint8_t pad[MAX_BLOCK_LEN]               = { 0 };
+
+    if (key_len > block) {
+        // Keys longer than a block are hashed first
+        sha_init(which_sha, &hkdf_key->inner);
+        sha_update(which_sha, &hkdf_key->inner, key, key_len);
+        sha_final(which_sha, &hkdf_key->inner, pad);
+    } else if (key_len) {
+        memcpy(pad, key, key_len);
     }
+
+    for (size_t i = 0; i < block; i++) pad[i] ^= 0x36;
+    sha_init(which_sha, &hkdf_key->inner);
+    sha_update(which_sha, &hkdf_key->inner, pad, block);
+
+    // Flips each byte from key ^ 0x36 to key ^ 0x5c
+    for (size_t i = 0; i < block; i++) pad[i] ^= 0x36 ^ 0x5c;
+    sha_init(which_sha, &hkdf_key->outer);
+    sha_update(which_sha, &hkdf_key->outer, pad, block);
+
+    aws_secure_zero(pad, sizeof(pad));
 }
 
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
+/* Completes an HMAC started from copies of hkdf_key's states, writing hash_len bytes to mac */
+static void hmac_finish(
+    const struct aws_cryptosdk_hkdf_key *hkdf_key,
+    union aws_cryptosdk_sha_ctx *inner,
+    union aws_cryptosdk_sha_ctx *outer,
+    uint8_t *mac) {
+    enum aws_cryptosdk_sha_version which_sha = hkdf_key->which_sha;
+    uint8_t inner_digest[SHA384_DIGEST_LENGTH];
+
+    sha_final(which_sha, inner, inner_digest);
+    sha_update(which_sha, outer, inner_digest, hash_len(which_sha));
+    sha_final(which_sha, outer, mac);
 
-static int aws_cryptosdk_hkdf_extract(
-    /* prk must be a buffer of EVP_MAX_MD_SIZE bytes */
-    uint8_t *prk,
-    unsigned int *prk_len,
+    aws_secure_zero(inner_digest, sizeof(inner_digest));
+}
+
+int aws_cryptosdk_hkdf_key_init(
+    struct aws_cryptosdk_hkdf_key *hkdf_key,
     enum aws_cryptosdk_sha_version which_sha,
     const struct aws_byte_buf *salt,
     const struct aws_byte_buf *ikm) {
-    const EVP_MD *evp_md = aws_cryptosdk_get_evp_md(which_sha);
-    if (!evp_md) return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    AWS_ZERO_STRUCT(*hkdf_key);
+    if (which_sha != AWS_CRYPTOSDK_SHA256 && which_sha != AWS_CRYPTOSDK_SHA384) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
+    hkdf_key->which_sha = which_sha;
 
-    static const uint8_t zeroes[EVP_MAX_MD_SIZE] = { 0 };
-    const uint8_t *mysalt                        = NULL;
-    size_t mysalt_len                            = 0;
+    // An absent salt is a string of HashLen zeroes, which pads to the same HMAC key as an empty one
+    hmac_set_key(hkdf_key, salt->buffer, salt->len);
+
+    uint8_t prk[SHA384_DIGEST_LENGTH];
+    sha_update(which_sha, &hkdf_key->inner, ikm->buffer, ikm->len);
+    hmac_finish(hkdf_key, &hkdf_key->inner, &hkdf_key->outer, prk);
+
+    hmac_set_key(hkdf_key, prk, hash_len(which_sha));
+    aws_secure_zero(prk, sizeof(prk));
 
-    if (salt->len) {
-        mysalt     = (uint8_t *)salt->buffer;
-        mysalt_len = salt->len;
-    } else {
-        mysalt     = zeroes;
-        mysalt_len = EVP_MD_size(evp_md);
-    }
-    if (!HMAC(evp_md, mysalt, mysalt_len, ikm->buffer, ikm->len, prk, prk_len) || *prk_len == 0) {
-        aws_secure_zero(prk, EVP_MAX_MD_SIZE);
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
-    }
     return AWS_OP_SUCCESS;
 }
 
-static int aws_cryptosdk_hkdf_expand(
-    struct aws_byte_buf *okm,
-    enum aws_cryptosdk_sha_version which_sha,
-    const uint8_t *prk,
-    unsigned int prk_len,
-    const struct aws_byte_buf *info) {
-    const EVP_MD *evp_md = aws_cryptosdk_get_evp_md(which_sha);
-    if (!evp_md) return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
-    HMAC_CTX ctx;
-    uint8_t t[EVP_MAX_MD_SIZE];
-    size_t n           = 0;
-    unsigned int t_len = 0;
-    size_t bytes_to_write;
-    size_t bytes_remaining = okm->len;
-    size_t hash_len        = EVP_MD_size(evp_md);
-    HMAC_CTX_init(&ctx);
-    if (!prk || !okm->len || !prk_len) goto err;
-    n = (okm->len + hash_len - 1) / hash_len;
-    if (n > 255) goto err;
-    for (uint32_t idx = 1; idx <= n; idx++) {
-        uint8_t idx_byte = idx;
-        if (!HMAC_Init_ex(&ctx, prk, prk_len, evp_md, NULL)) goto err;
-        if (idx != 1) {
-            if (!HMAC_Update(&ctx, t, hash_len)) goto err;
-        }
-        if (!HMAC_Update(&ctx, info->buffer, info->len)) goto err;
-        if (!HMAC_Update(&ctx, &idx_byte, 1)) goto err;
-        if (!HMAC_Final(&ctx, t, &t_len)) goto err;
-
-        assert(t_len == hash_len);
-        bytes_to_write = bytes_remaining < hash_len ? bytes_remaining : hash_len;
-        memcpy(okm->buffer + (idx - 1) * hash_len, t, bytes_to_write);
-        bytes_remaining -= bytes_to_write;
+int aws_cryptosdk_hkdf_key_expand(
+    const struct aws_cryptosdk_hkdf_key *hkdf_key, struct aws_byte_buf *okm, const struct aws_byte_buf *info) {
+    enum aws_cryptosdk_sha_version which_sha = hkdf_key->which_sha;
+    size_t hlen                              = hash_len(which_sha);
+    uint8_t t[SHA384_DIGEST_LENGTH];
+
+    if (!okm->len || (okm->len + hlen - 1) / hlen > 255) {
+        aws_byte_buf_secure_zero(okm);
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    }
+
+    for (size_t offset = 0, idx = 1; offset < okm->len; offset += hlen, idx++) {
+        union aws_cryptosdk_sha_ctx inner = hkdf_key->inner;
+        union aws_cryptosdk_sha_ctx outer = hkdf_key->outer;
+        uint8_t idx_byte                  = (uint8_t)idx;
+
+        // T(idx) = HMAC(PRK, T(idx - 1) | info | idx), where T(0) is empty
+        if (idx != 1) sha_update(which_sha, &inner, t, hlen);
+        sha_update(which_sha, &inner, info->buffer, info->len);
+        sha_update(which_sha, &inner, &idx_byte, 1);
+        hmac_finish(hkdf_key, &inner, &outer, t);
+
+        size_t bytes_to_write = okm->len - offset < hlen ? okm->len - offset : hlen;
+        memcpy(okm->buffer + offset, t, bytes_to_write);
+
+        aws_secure_zero(&inner, sizeof(inner));
+        aws_secure_zero(&outer, sizeof(outer));
     }
-    assert(bytes_remaining == 0);
+
     aws_secure_zero(t, sizeof(t));
-    HMAC_CTX_cleanup(&ctx);
     return AWS_OP_SUCCESS;
+}
 
-err:
-    HMAC_CTX_cleanup(&ctx);
-    aws_byte_buf_secure_zero(okm);
+/*
+ * Number of outputs expanded side by side. Each stage of the HMAC is run for every lane before
+ * the next stage starts, so the compressions of independent outputs follow each other with the
+ * keyed states and message blocks still in cache.
+ */
+#define EXPAND_LANES 8
+
+/* Expands the outputs of okms at lane_index, each of which fits in a single hash block */
+static void expand_single_blocks(
+    const struct aws_cryptosdk_hkdf_key *hkdf_key,
+    struct aws_byte_buf *okms,
+    const struct aws_byte_buf *infos,
+    const size_t *lane_index,
+    size_t lanes) {
+    enum aws_cryptosdk_sha_version which_sha = hkdf_key->which_sha;
+    size_t hlen                              = hash_len(which_sha);
+    static const uint8_t idx_byte            = 1;
+    union aws_cryptosdk_sha_ctx ctx[EXPAND_LANES];
+    uint8_t t[EXPAND_LANES][SHA384_DIGEST_LENGTH];
+
+    // T(1) = HMAC(PRK, info | 0x01)
+    for (size_t l = 0; l < lanes; l++) {
+        const struct aws_byte_buf *info = &infos[lane_index[l]];
+
+        ctx[l] = hkdf_key->inner;
+        sha_update(which_sha, &ctx[l], info->buffer, info->len);
+        sha_update(which_sha, &ctx[l], &idx_byte, 1);
+        sha_final(which_sha, &ctx[l], t[l]);
+    }
+    for (size_t l = 0; l < lanes; l++) {
+        ctx[l] = hkdf_key->outer;
+        sha_update(which_sha, &ctx[l], t[l], hlen);
+        sha_final(which_sha, &ctx[l], t[l]);
+    }
+    for (size_t l = 0; l < lanes; l++) {
+        struct aws_byte_buf *okm = &okms[lane_index[l]];
+        memcpy(okm->buffer, t[l], okm->len);
+    }
+
+    aws_secure_zero(ctx, sizeof(ctx));
     aws_secure_zero(t, sizeof(t));
-    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
 }
-#else
-#    include <openssl/kdf.h>
 
-static int aws_cryptosdk_openssl_hkdf_version(
-    struct aws_byte_buf *okm,
-    enum aws_cryptosdk_sha_version which_sha,
-    const struct aws_byte_buf *salt,
-    const struct aws_byte_buf *ikm,
-    const struct aws_byte_buf *info) {
-    const EVP_MD *evp_md = aws_cryptosdk_get_evp_md(which_sha);
-    if (!evp_md) return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
-    EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
-    if (!pctx) return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
-    static const uint8_t zeroes[EVP_MAX_MD_SIZE] = { 0 };
-    const uint8_t *mysalt                        = NULL;
-    size_t mysalt_len                            = 0;
-    if (salt->len) {
-        mysalt     = (uint8_t *)salt->buffer;
-        mysalt_len = salt->len;
-    } else {
-        mysalt     = zeroes;
-        mysalt_len = EVP_MD_size(evp_md);
+int aws_cryptosdk_hkdf_key_expand_many(
+    const struct aws_cryptosdk_hkdf_key *hkdf_key,
+    struct aws_byte_buf *okms,
+    const struct aws_byte_buf *infos,
+    size_t count) {
+    size_t hlen = hash_len(hkdf_key->which_sha);
+    size_t lane_index[EXPAND_LANES];
+    size_t lanes = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!okms[i].len || (okms[i].len + hlen - 1) / hlen > 255) {
+            aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+            goto fail;
+        }
     }
 
-    if (EVP_PKEY_derive_init(pctx) <= 0) goto err;
-    if (EVP_PKEY_CTX_set_hkdf_md(pctx, evp_md) <= 0) goto err;
-    if (EVP_PKEY_CTX_set1_hkdf_salt(pctx, mysalt, mysalt_len) <= 0) goto err;
-    if (EVP_PKEY_CTX_set1_hkdf_key(pctx, ikm->buffer, ikm->len) <= 0) goto err;
-    if (EVP_PKEY_CTX_add1_hkdf_info(pctx, info->buffer, info->len) <= 0) goto err;
-    if (EVP_PKEY_derive(pctx, okm->buffer, &okm->len) <= 0) goto err;
+    for (size_t i = 0; i < count; i++) {
+        if (okms[i].len > hlen) {
+            // Longer outputs chain their blocks, so they cannot share lanes
+            if (aws_cryptosdk_hkdf_key_expand(hkdf_key, &okms[i], &infos[i])) goto fail;
+            continue;
+        }
+
+        lane_index[lanes++] = i;
+        if (lanes == EXPAND_LANES) {
+            expand_single_blocks(hkdf_key, okms, infos, lane_index, lanes);
+            lanes = 0;
+        }
+    }
+    if (lanes) expand_single_blocks(hkdf_key, okms, infos, lane_index, lanes);
 
-    EVP_PKEY_CTX_free(pctx);
     return AWS_OP_SUCCESS;
 
-err:
-    EVP_PKEY_CTX_free(pctx);
-    aws_byte_buf_secure_zero(okm);
-    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+fail:
+    // No output is usable unless all of them are
+    for (size_t j = 0; j < count; j++) aws_byte_buf_secure_zero(&okms[j]);
+    return AWS_OP_ERR;
+}
+
+void aws_cryptosdk_hkdf_key_clean_up(struct aws_cryptosdk_hkdf_key *hkdf_key) {
+    aws_secure_zero(hkdf_key, sizeof(*hkdf_key));
 }
-#endif  // OPENSSL_VERSION_NUMBER
 
 int aws_cryptosdk_hkdf(
     struct aws_byte_buf *okm,
@@ -150,17 +252,11 @@ int aws_cryptosdk_hkdf(
     const struct aws_byte_buf *salt,
     const struct aws_byte_buf *ikm,
     const struct aws_byte_buf *info) {
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
-    uint8_t prk[EVP_MAX_MD_SIZE];
-    unsigned int prk_len = 0;
-    if (aws_cryptosdk_hkdf_extract(prk, &prk_len, which_sha, salt, ikm)) goto err;
-    if (aws_cryptosdk_hkdf_expand(okm, which_sha, prk, prk_len, info)) goto err;
-    aws_secure_zero(prk, sizeof(prk));
-    return AWS_OP_SUCCESS;
-err:
-    aws_secure_zero(prk, sizeof(prk));
-    return AWS_OP_ERR;
-#else
-    return aws_cryptosdk_openssl_hkdf_version(okm, which_sha, salt, ikm, info);
-#endif  // OPENSSL_VERSION_NUMBER
+    struct aws_cryptosdk_hkdf_key hkdf_key;
+
+    if (aws_cryptosdk_hkdf_key_init(&hkdf_key, which_sha, salt, ikm)) return AWS_OP_ERR;
+    int rv = aws_cryptosdk_hkdf_key_expand(&hkdf_key, okm, info);
+    aws_cryptosdk_hkdf_key_clean_up(&hkdf_key);
+
+    return rv;
 }
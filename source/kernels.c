@@ -0,0 +1,434 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <aws/common/atomics.h>
+#include <aws/common/clock.h>
+#include <aws/common/mutex.h>
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/cipher.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#    include <cpuid.h>
+#    define HAVE_X86_CPUID
+#elif defined(__aarch64__) && defined(__linux__)
+#    include <asm/hwcap.h>
+#    include <sys/auxv.h>
+#    define HAVE_ARM_HWCAP
+#endif
+
+/* Set in cpu_features alongside the feature bits once they have been detected */
+#define CPU_FEATURES_DETECTED (1u << 31)
+
+static struct aws_atomic_var cpu_features = AWS_ATOMIC_VAR_INTVAL(0);
+
+static uint32_t detect_cpu_features(void) {
+    uint32_t features = 0;
+#if defined(HAVE_X86_CPUID)
+    unsigned int eax, ebx, ecx, edx;
+    bool ymm = false, zmm = false;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    if (ecx & (1u << 25)) features |= AWS_CRYPTOSDK_CPU_AESNI;
+    if (ecx & (1u << 1)) features |= AWS_CRYPTOSDK_CPU_PCLMULQDQ;
+
+    // Vector registers are only usable if the OS saves them (OSXSAVE, then XCR0)
+    if ((ecx & (1u << 27)) && (ecx & (1u << 28))) {
+        uint32_t xcr0, xcr0_high;
+        __asm__ volatile("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+        ymm = (xcr0 & 0x6) == 0x6;
+        zmm = ymm && (xcr0 & 0xe0) == 0xe0;
+        if (ymm) features |= AWS_CRYPTOSDK_CPU_AVX;
+    }
+
+    if (__get_cpuid_max(0, NULL) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        if (ymm && (ebx & (1u << 5))) features |= AWS_CRYPTOSDK_CPU_AVX2;
+        if (zmm && (ebx & (1u << 16))) features |= AWS_CRYPTOSDK_CPU_AVX512F;
+        if (ebx & (1u << 29)) features |= AWS_CRYPTOSDK_CPU_SHA_NI;
+        if (ymm && (ecx & (1u << 9))) features |= AWS_CRYPTOSDK_CPU_VAES;
+        if (ymm && (ecx & (1u << 10))) features |= AWS_CRYPTOSDK_CPU_VPCLMULQDQ;
+    }
+#elif defined(HAVE_ARM_HWCAP)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+
+    if (hwcap & HWCAP_AES) features |= AWS_CRYPTOSDK_CPU_ARM_AES;
+    if (hwcap & HWCAP_PMULL) features |= AWS_CRYPTOSDK_CPU_ARM_PMULL;
+#    ifdef HWCAP_SHA512
+    if (hwcap & HWCAP_SHA512) features |= AWS_CRYPTOSDK_CPU_ARM_SHA512;
+#    endif
+#endif
+
+    return features;
+}
+
+uint32_t aws_cryptosdk_cpu_features(void) {
+    size_t features = aws_atomic_load_int(&cpu_features);
+
+    // Detection is idempotent, so threads racing here all store the same value
+    if (!(features & CPU_FEATURES_DETECTED)) {
+        features = detect_cpu_features() | CPU_FEATURES_DETECTED;
+        aws_atomic_store_int(&cpu_features, features);
+    }
+
+    return (uint32_t)features & ~CPU_FEATURES_DETECTED;
+}
+
+enum aws_cryptosdk_frame_class aws_cryptosdk_frame_class_of(uint64_t frame_size) {
+    if (frame_size && frame_size <= 1024) return AWS_CRYPTOSDK_FRAME_CLASS_SMALL;
+    if (frame_size && frame_size <= 64 * 1024) return AWS_CRYPTOSDK_FRAME_CLASS_MEDIUM;
+    return AWS_CRYPTOSDK_FRAME_CLASS_LARGE;
+}
+
+struct gcm_kernel {
+    const struct aws_cryptosdk_gcm_provider_vt *provider;
+    uint32_t cpu_features;
+};
+
+struct digest_kernel {
+    const struct aws_cryptosdk_digest_provider_vt *provider;
+    uint32_t cpu_features;
+};
+
+/* Registration and selection are serialized by kernels_mutex, which also guards active */
+static struct aws_mutex kernels_mutex = AWS_MUTEX_INIT;
+static struct gcm_kernel gcm_kernels[AWS_CRYPTOSDK_MAX_KERNELS];
+static size_t num_gcm_kernels;
+static struct digest_kernel digest_kernels[AWS_CRYPTOSDK_MAX_KERNELS];
+static size_t num_digest_kernels;
+static struct aws_cryptosdk_active_kernels active;
+static bool selected;
+
+/*
+ * The selection in effect, read by sessions and caching CMMs without the lock. NULL stands for
+ * the built-in provider, which keeps the default path free of any indirection.
+ */
+static struct aws_atomic_var selected_gcm[AWS_CRYPTOSDK_FRAME_CLASS_COUNT];
+static struct aws_atomic_var selected_digest;
+
+int aws_cryptosdk_register_gcm_kernel(const struct aws_cryptosdk_gcm_provider_vt *provider, uint32_t cpu_features) {
+    int rv = AWS_OP_SUCCESS;
+
+    if (!aws_cryptosdk_priv_gcm_provider_is_complete(provider)) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+
+    aws_mutex_lock(&kernels_mutex);
+    size_t i = 0;
+    while (i < num_gcm_kernels && gcm_kernels[i].provider != provider) i++;
+    if (i == AWS_CRYPTOSDK_MAX_KERNELS) {
+        rv = aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    } else if (i == num_gcm_kernels) {
+        gcm_kernels[num_gcm_kernels++] = (struct gcm_kernel){ .provider = provider, .cpu_features = cpu_features };
+    }
+    aws_mutex_unlock(&kernels_mutex);
+
+    return rv;
+}
+
+int aws_cryptosdk_register_digest_kernel(
+    const struct aws_cryptosdk_digest_provider_vt *provider, uint32_t cpu_features) {
+    int rv = AWS_OP_SUCCESS;
+
+    if (!aws_cryptosdk_priv_digest_provider_is_complete(provider)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    aws_mutex_lock(&kernels_mutex);
+    size_t i = 0;
+    while (i < num_digest_kernels && digest_kernels[i].provider != provider) i++;
+    if (i == AWS_CRYPTOSDK_MAX_KERNELS) {
+        rv = aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    } else if (i == num_digest_kernels) {
+        digest_kernels[num_digest_kernels++] =
+            (struct digest_kernel){ .provider = provider, .cpu_features = cpu_features };
+    }
+    aws_mutex_unlock(&kernels_mutex);
+
+    return rv;
+}
+
+/* The frame size each class is benchmarked with, and the bytes each way per measurement */
+static const size_t bench_frame_sizes[AWS_CRYPTOSDK_FRAME_CLASS_COUNT] = { 512, 16 * 1024, 256 * 1024 };
+#define BENCH_BYTES (512 * 1024)
+#define BENCH_ROUNDS 3
+/* A typical frame AAD (message ID, body string, sequence number and length), and KMS EDK */
+#define BENCH_AAD_LEN 54
+#define BENCH_EDK_LEN 300
+
+static uint64_t now_ns(void) {
+    uint64_t now = 0;
+    aws_high_res_clock_get_ticks(&now);
+    return now;
+}
+
+/*
+ * Seals (enc) or opens count frames of len bytes each with provider, in one batch if it has
+ * seal_many and open_many. Each frame i goes from in + i * len to out + i * len, with tags[i].
+ */
+static int gcm_run(
+    const struct aws_cryptosdk_gcm_provider_vt *provider,
+    void *key_ctx,
+    bool enc,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    size_t count,
+    const uint8_t *aad,
+    uint8_t (*tags)[16]) {
+    uint8_t ivs[AWS_CRYPTOSDK_GCM_MAX_OPS][12] = { { 0 } };
+    struct aws_cryptosdk_gcm_op ops[AWS_CRYPTOSDK_GCM_MAX_OPS];
+
+    for (size_t i = 0; i < count; i++) ivs[i][11] = (uint8_t)(i + 1);
+
+    if (count == 1 || !aws_cryptosdk_gcm_provider_has_many(provider)) {
+        for (size_t i = 0; i < count; i++) {
+            uint8_t *frame_out      = out + i * len;
+            const uint8_t *frame_in = in + i * len;
+            int rv = enc ? provider->seal(key_ctx, frame_out, frame_in, len, ivs[i], aad, BENCH_AAD_LEN, tags[i])
+                         : provider->open(key_ctx, frame_out, frame_in, len, ivs[i], aad, BENCH_AAD_LEN, tags[i]);
+            if (rv) return AWS_OP_ERR;
+        }
+        return AWS_OP_SUCCESS;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        ops[i] = (struct aws_cryptosdk_gcm_op){ .key_ctx = key_ctx,
+                                                .out     = out + i * len,
+                                                .in      = in + i * len,
+                                                .len     = len,
+                                                .iv      = ivs[i],
+                                                .aad     = aad,
+                                                .aad_len = BENCH_AAD_LEN,
+                                                .tag     = tags[i] };
+    }
+    (enc ? provider->seal_many : provider->open_many)(ops, count);
+    for (size_t i = 0; i < count; i++) {
+        if (ops[i].error) return aws_raise_error(ops[i].error);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Checks that provider seals frames as the built-in provider does and opens them again, then
+ * measures its throughput on frames of the given size, sealing and opening as many as it would
+ * be handed at once by a session. Raises AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN if its output is wrong.
+ */
+static int bench_gcm(
+    const struct aws_cryptosdk_gcm_provider_vt *provider, size_t frame_size, uint64_t *bytes_per_sec) {
+    const struct aws_cryptosdk_gcm_provider_vt *reference = aws_cryptosdk_gcm_provider_openssl();
+    struct aws_allocator *alloc                          = aws_default_allocator();
+    size_t batch     = aws_cryptosdk_gcm_provider_has_many(provider) ? AWS_CRYPTOSDK_GCM_MAX_OPS : 1;
+    size_t bytes     = batch * frame_size;
+    uint8_t key[32], aad[BENCH_AAD_LEN];
+    uint8_t tags[AWS_CRYPTOSDK_GCM_MAX_OPS][16], ref_tags[AWS_CRYPTOSDK_GCM_MAX_OPS][16];
+    void *key_ctx = NULL, *enc_ctx = NULL, *dec_ctx = NULL;
+    uint64_t best_ns = UINT64_MAX;
+    int rv           = AWS_OP_ERR;
+
+    uint8_t *plain  = aws_mem_acquire(alloc, bytes);
+    uint8_t *sealed = aws_mem_acquire(alloc, bytes);
+    uint8_t *check  = aws_mem_acquire(alloc, bytes);
+    if (!plain || !sealed || !check) goto out;
+
+    if (aws_cryptosdk_genrandom(key, sizeof(key)) || aws_cryptosdk_genrandom(aad, sizeof(aad)) ||
+        aws_cryptosdk_genrandom(plain, bytes)) {
+        goto out;
+    }
+    if (!(key_ctx = reference->key_new(key, sizeof(key), true)) ||
+        !(enc_ctx = provider->key_new(key, sizeof(key), true)) ||
+        !(dec_ctx = provider->key_new(key, sizeof(key), false))) {
+        goto out;
+    }
+
+    // Known answer: the reference's ciphertext and tags, which the candidate must reproduce and open
+    if (gcm_run(reference, key_ctx, true, check, plain, frame_size, batch, aad, ref_tags) ||
+        gcm_run(provider, enc_ctx, true, sealed, plain, frame_size, batch, aad, tags)) {
+        goto out;
+    }
+    if (memcmp(check, sealed, bytes) || memcmp(ref_tags, tags, batch * sizeof(tags[0])) ||
+        gcm_run(provider, dec_ctx, false, check, sealed, frame_size, batch, aad, tags) ||
+        memcmp(check, plain, bytes)) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        goto out;
+    }
+
+    size_t iterations = BENCH_BYTES / bytes ? BENCH_BYTES / bytes : 1;
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < iterations; i++) {
+            if (gcm_run(provider, enc_ctx, true, sealed, plain, frame_size, batch, aad, tags) ||
+                gcm_run(provider, dec_ctx, false, check, sealed, frame_size, batch, aad, tags)) {
+                goto out;
+            }
+        }
+        uint64_t elapsed = now_ns() - start;
+        if (elapsed < best_ns) best_ns = elapsed;
+    }
+    *bytes_per_sec = (uint64_t)((double)(2 * iterations * bytes) * 1e9 / (double)(best_ns ? best_ns : 1));
+    rv             = AWS_OP_SUCCESS;
+
+out:
+    if (key_ctx) reference->key_destroy(key_ctx);
+    if (enc_ctx) provider->key_destroy(enc_ctx);
+    if (dec_ctx) provider->key_destroy(dec_ctx);
+    aws_secure_zero(key, sizeof(key));
+    if (plain) aws_mem_release(alloc, plain);
+    if (sealed) aws_mem_release(alloc, sealed);
+    if (check) aws_mem_release(alloc, check);
+
+    return rv;
+}
+
+/* As bench_gcm, for a digest provider hashing batches of EDK-sized messages */
+static int bench_digest(const struct aws_cryptosdk_digest_provider_vt *provider, uint64_t *ops_per_sec) {
+    const struct aws_cryptosdk_digest_provider_vt *reference = aws_cryptosdk_digest_provider_openssl();
+    uint8_t messages[AWS_CRYPTOSDK_DIGEST_MAX_OPS][BENCH_EDK_LEN];
+    uint8_t digests[AWS_CRYPTOSDK_DIGEST_MAX_OPS][64], ref_digests[AWS_CRYPTOSDK_DIGEST_MAX_OPS][64];
+    struct aws_cryptosdk_digest_op ops[AWS_CRYPTOSDK_DIGEST_MAX_OPS], ref_ops[AWS_CRYPTOSDK_DIGEST_MAX_OPS];
+    uint64_t best_ns = UINT64_MAX;
+
+    if (aws_cryptosdk_genrandom(&messages[0][0], sizeof(messages))) return AWS_OP_ERR;
+    for (size_t i = 0; i < AWS_CRYPTOSDK_DIGEST_MAX_OPS; i++) {
+        // Lengths vary, as EDKs' do
+        size_t len = BENCH_EDK_LEN - 4 * i;
+        ops[i]     = (struct aws_cryptosdk_digest_op){ .in = messages[i], .len = len, .digest = digests[i] };
+        ref_ops[i] = (struct aws_cryptosdk_digest_op){ .in = messages[i], .len = len, .digest = ref_digests[i] };
+    }
+
+    if (reference->sha512_many(ref_ops, AWS_CRYPTOSDK_DIGEST_MAX_OPS) ||
+        provider->sha512_many(ops, AWS_CRYPTOSDK_DIGEST_MAX_OPS)) {
+        return AWS_OP_ERR;
+    }
+    if (memcmp(digests, ref_digests, sizeof(digests))) return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+
+    size_t iterations = BENCH_BYTES / sizeof(messages);
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < iterations; i++) {
+            if (provider->sha512_many(ops, AWS_CRYPTOSDK_DIGEST_MAX_OPS)) return AWS_OP_ERR;
+        }
+        uint64_t elapsed = now_ns() - start;
+        if (elapsed < best_ns) best_ns = elapsed;
+    }
+    *ops_per_sec =
+        (uint64_t)((double)(iterations * AWS_CRYPTOSDK_DIGEST_MAX_OPS) * 1e9 / (double)(best_ns ? best_ns : 1));
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_select_kernels(bool benchmark) {
+    const struct aws_cryptosdk_gcm_provider_vt *builtin_gcm = aws_cryptosdk_gcm_provider_openssl();
+    uint32_t features                                       = aws_cryptosdk_cpu_features();
+    struct aws_cryptosdk_active_kernels result              = { .cpu_features = features, .benchmarked = benchmark };
+    const struct aws_cryptosdk_gcm_provider_vt *gcm[AWS_CRYPTOSDK_FRAME_CLASS_COUNT];
+    const struct aws_cryptosdk_digest_provider_vt *digest = NULL;
+    int rv                                                = AWS_OP_ERR;
+
+    aws_mutex_lock(&kernels_mutex);
+
+    for (int c = 0; c < AWS_CRYPTOSDK_FRAME_CLASS_COUNT; c++) {
+        gcm[c] = builtin_gcm;
+        if (benchmark && bench_gcm(builtin_gcm, bench_frame_sizes[c], &result.gcm_bytes_per_sec[c])) goto out;
+
+        for (size_t i = 0; i < num_gcm_kernels; i++) {
+            uint64_t bytes_per_sec = 0;
+
+            if ((gcm_kernels[i].cpu_features & features) != gcm_kernels[i].cpu_features) continue;
+            if (!benchmark) {
+                gcm[c] = gcm_kernels[i].provider;
+                continue;
+            }
+            // A candidate that fails, or gets the wrong answer, is passed over
+            if (bench_gcm(gcm_kernels[i].provider, bench_frame_sizes[c], &bytes_per_sec)) {
+                aws_reset_error();
+                continue;
+            }
+            if (bytes_per_sec > result.gcm_bytes_per_sec[c]) {
+                gcm[c]                      = gcm_kernels[i].provider;
+                result.gcm_bytes_per_sec[c] = bytes_per_sec;
+            }
+        }
+        result.gcm[c] = gcm[c]->name;
+    }
+
+    if (benchmark && bench_digest(aws_cryptosdk_digest_provider_openssl(), &result.digest_ops_per_sec)) goto out;
+    for (size_t i = 0; i < num_digest_kernels; i++) {
+        uint64_t ops_per_sec = 0;
+
+        if ((digest_kernels[i].cpu_features & features) != digest_kernels[i].cpu_features) continue;
+        if (!benchmark) {
+            digest = digest_kernels[i].provider;
+            continue;
+        }
+        if (bench_digest(digest_kernels[i].provider, &ops_per_sec)) {
+            aws_reset_error();
+            continue;
+        }
+        if (ops_per_sec > result.digest_ops_per_sec) {
+            digest                    = digest_kernels[i].provider;
+            result.digest_ops_per_sec = ops_per_sec;
+        }
+    }
+    result.digest = digest ? digest->name : aws_cryptosdk_digest_provider_openssl()->name;
+
+    for (int c = 0; c < AWS_CRYPTOSDK_FRAME_CLASS_COUNT; c++) {
+        aws_atomic_store_ptr(&selected_gcm[c], gcm[c] == builtin_gcm ? NULL : (void *)gcm[c]);
+    }
+    aws_atomic_store_ptr(&selected_digest, (void *)digest);
+    active   = result;
+    selected = true;
+    rv       = AWS_OP_SUCCESS;
+
+out:
+    aws_mutex_unlock(&kernels_mutex);
+    return rv;
+}
+
+const struct aws_cryptosdk_gcm_provider_vt *aws_cryptosdk_gcm_kernel_for_frame_size(uint64_t frame_size) {
+    const struct aws_cryptosdk_gcm_provider_vt *provider =
+        aws_atomic_load_ptr(&selected_gcm[aws_cryptosdk_frame_class_of(frame_size)]);
+
+    return provider ? provider : aws_cryptosdk_gcm_provider_openssl();
+}
+
+const struct aws_cryptosdk_digest_provider_vt *aws_cryptosdk_digest_kernel(void) {
+    return aws_atomic_load_ptr(&selected_digest);
+}
+
+void aws_cryptosdk_get_active_kernels(struct aws_cryptosdk_active_kernels *kernels) {
+    aws_mutex_lock(&kernels_mutex);
+    if (selected) {
+        *kernels = active;
+    } else {
+        AWS_ZERO_STRUCT(*kernels);
+        kernels->cpu_features = aws_cryptosdk_cpu_features();
+        kernels->digest       = aws_cryptosdk_digest_provider_openssl()->name;
+        for (int c = 0; c < AWS_CRYPTOSDK_FRAME_CLASS_COUNT; c++) {
+            kernels->gcm[c] = aws_cryptosdk_gcm_provider_openssl()->name;
+        }
+    }
+    aws_mutex_unlock(&kernels_mutex);
+}
+
+void aws_cryptosdk_reset_kernels(void) {
+    aws_mutex_lock(&kernels_mutex);
+    for (int c = 0; c < AWS_CRYPTOSDK_FRAME_CLASS_COUNT; c++) aws_atomic_store_ptr(&selected_gcm[c], NULL);
+    aws_atomic_store_ptr(&selected_digest, NULL);
+    num_gcm_kernels = num_digest_kernels = 0;
+    selected                             = false;
+    aws_mutex_unlock(&kernels_mutex);
+}
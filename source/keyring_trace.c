@@ -120,6 +120,7 @@ int aws_cryptosdk_keyring_trace_add_record(
     AWS_FATAL_PRECONDITION(wk_name != NULL);
     AWS_FATAL_PRECONDITION(aws_cryptosdk_keyring_trace_is_valid(trace));
     AWS_FATAL_PRECONDITION(trace->item_size == sizeof(struct aws_cryptosdk_keyring_trace_record));
+    if (aws_cryptosdk_keyring_trace_is_disabled(trace)) return AWS_OP_SUCCESS;
     struct aws_cryptosdk_keyring_trace_record record;
     int ret = record_init_from_strings(alloc, &record, wk_namespace, wk_name, flags);
     if (ret) return ret;
@@ -138,6 +139,7 @@ int aws_cryptosdk_keyring_trace_add_record_c_str(
     AWS_FATAL_PRECONDITION(wk_name != NULL);
     AWS_FATAL_PRECONDITION(aws_cryptosdk_keyring_trace_is_valid(trace));
     AWS_FATAL_PRECONDITION(trace->item_size == sizeof(struct aws_cryptosdk_keyring_trace_record));
+    if (aws_cryptosdk_keyring_trace_is_disabled(trace)) return AWS_OP_SUCCESS;
     struct aws_cryptosdk_keyring_trace_record record;
     int ret = record_init_from_c_strs(alloc, &record, wk_namespace, wk_name, flags);
     if (ret) return ret;
@@ -159,6 +161,7 @@ int aws_cryptosdk_keyring_trace_add_record_buf(
     AWS_FATAL_PRECONDITION(aws_byte_buf_is_valid(wk_name));
     AWS_FATAL_PRECONDITION(aws_cryptosdk_keyring_trace_is_valid(trace));
     AWS_FATAL_PRECONDITION(trace->item_size == sizeof(struct aws_cryptosdk_keyring_trace_record));
+    if (aws_cryptosdk_keyring_trace_is_disabled(trace)) return AWS_OP_SUCCESS;
     struct aws_cryptosdk_keyring_trace_record record;
     int ret = record_init_from_bufs(alloc, &record, wk_namespace, wk_name, flags);
     if (ret) return ret;
@@ -167,10 +170,10 @@ int aws_cryptosdk_keyring_trace_add_record_buf(
 }
 
 int aws_cryptosdk_keyring_trace_init(struct aws_allocator *alloc, struct aws_array_list *trace) {
-    // arbitrary starting point, list will resize as necessary
+    // nothing is allocated until the first record is added, as many traces stay empty or unread
     AWS_FATAL_PRECONDITION(trace != NULL);
     aws_allocator_is_valid(alloc);
-    const int initial_size = 10;
+    const int initial_size = 0;
     int r_val =
         aws_array_list_init_dynamic(trace, alloc, initial_size, sizeof(struct aws_cryptosdk_keyring_trace_record));
     if (r_val == AWS_OP_SUCCESS) {
@@ -182,6 +185,30 @@ int aws_cryptosdk_keyring_trace_init(struct aws_allocator *alloc, struct aws_arr
     return r_val;
 }
 
+void aws_cryptosdk_keyring_trace_init_disabled(struct aws_array_list *trace) {
+    AWS_FATAL_PRECONDITION(trace != NULL);
+    AWS_ZERO_STRUCT(*trace);
+    trace->item_size = sizeof(struct aws_cryptosdk_keyring_trace_record);
+}
+
+void aws_cryptosdk_keyring_trace_disable(struct aws_array_list *trace) {
+    aws_cryptosdk_keyring_trace_clean_up(trace);
+    aws_cryptosdk_keyring_trace_init_disabled(trace);
+}
+
+bool aws_cryptosdk_keyring_trace_is_disabled(const struct aws_array_list *trace) {
+    return !trace->alloc && !trace->data && trace->item_size == sizeof(struct aws_cryptosdk_keyring_trace_record);
+}
+
+int aws_cryptosdk_keyring_trace_init_like(
+    struct aws_allocator *alloc, struct aws_array_list *trace, const struct aws_array_list *parent) {
+    if (aws_cryptosdk_keyring_trace_is_disabled(parent)) {
+        aws_cryptosdk_keyring_trace_init_disabled(trace);
+        return AWS_OP_SUCCESS;
+    }
+    return aws_cryptosdk_keyring_trace_init(alloc, trace);
+}
+
 int aws_cryptosdk_keyring_trace_record_init_clone(
     struct aws_allocator *alloc,
     struct aws_cryptosdk_keyring_trace_record *dest,
@@ -0,0 +1,1356 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <aws/common/encoding.h>
+#include <aws/common/hash_table.h>
+#include <aws/common/string.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/config.h>
+#include <aws/cryptosdk/private/kms_async_keyring.h>
+#include <aws/cryptosdk/private/secure_pool.h>
+
+static const char *const kms_targets[] = {
+    [AWS_CRYPTOSDK_KMS_GENERATE_DATA_KEY] = "TrentService.GenerateDataKey",
+    [AWS_CRYPTOSDK_KMS_ENCRYPT]           = "TrentService.Encrypt",
+    [AWS_CRYPTOSDK_KMS_DECRYPT]           = "TrentService.Decrypt",
+};
+
+const char *aws_cryptosdk_kms_target(enum aws_cryptosdk_kms_op op) {
+    return kms_targets[op];
+}
+
+bool aws_cryptosdk_kms_region_of_arn(struct aws_byte_cursor *region, struct aws_byte_cursor key_id) {
+    // arn:PARTITION:kms:REGION:ACCOUNT:key/ID, or alias/NAME in place of the key
+    struct aws_byte_cursor fields[6];
+    struct aws_byte_cursor field = { 0 };
+    size_t num_fields            = 0;
+
+    while (num_fields < 6 && aws_byte_cursor_next_split(&key_id, ':', &field)) {
+        fields[num_fields++] = field;
+    }
+    if (num_fields < 6 || !aws_byte_cursor_eq_c_str(&fields[0], "arn") ||
+        !aws_byte_cursor_eq_c_str(&fields[2], "kms") || !fields[3].len || !fields[5].len) {
+        return false;
+    }
+
+    *region = fields[3];
+    return true;
+}
+
+static int append_cursor(struct aws_byte_buf *buf, struct aws_byte_cursor cursor) {
+    if (aws_byte_buf_reserve_relative(buf, cursor.len)) return AWS_OP_ERR;
+    aws_byte_buf_write_from_whole_cursor(buf, cursor);
+    return AWS_OP_SUCCESS;
+}
+
+static int append_c_str(struct aws_byte_buf *buf, const char *str) {
+    return append_cursor(buf, aws_byte_cursor_from_c_str(str));
+}
+
+/* Appends str as a quoted JSON string */
+static int append_json_string(struct aws_byte_buf *buf, struct aws_byte_cursor str) {
+    static const char hex[] = "0123456789abcdef";
+
+    // Each byte takes six at most, as \u00XX
+    if (str.len > (SIZE_MAX - 2) / 6) return aws_raise_error(AWS_ERROR_OVERFLOW_DETECTED);
+    if (aws_byte_buf_reserve_relative(buf, str.len * 6 + 2)) return AWS_OP_ERR;
+
+    buf->buffer[buf->len++] = '"';
+    for (size_t i = 0; i < str.len; i++) {
+        uint8_t c = str.ptr[i];
+
+        if (c == '"' || c == '\\') {
+            buf->buffer[buf->len++] = '\\';
+            buf->buffer[buf->len++] = c;
+        } else if (c < 0x20) {
+            memcpy(buf->buffer + buf->len, "\\u00", 4);
+            buf->buffer[buf->len + 4] = hex[c >> 4];
+            buf->buffer[buf->len + 5] = hex[c & 0xf];
+            buf->len += 6;
+        } else {
+            buf->buffer[buf->len++] = c;
+        }
+    }
+    buf->buffer[buf->len++] = '"';
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Appends the separator and quoted name which start a field of a JSON object */
+static int append_field_name(struct aws_byte_buf *buf, bool *first, const char *name) {
+    if (!*first && append_c_str(buf, ",")) return AWS_OP_ERR;
+    *first = false;
+    if (append_json_string(buf, aws_byte_cursor_from_c_str(name))) return AWS_OP_ERR;
+    return append_c_str(buf, ":");
+}
+
+/*
+ * Appends the field name with data as its base64 value, then closes the object. Room for all of
+ * it is reserved first, so that the buffer does not move once data is in it.
+ */
+static int append_last_blob_field(
+    struct aws_byte_buf *buf, bool *first, const char *name, struct aws_byte_cursor data) {
+    struct aws_allocator *alloc = buf->allocator;
+    struct aws_byte_buf encoded = { 0 };
+    size_t encoded_len;
+    int rv = AWS_OP_ERR;
+
+    if (aws_base64_compute_encoded_len(data.len, &encoded_len)) return AWS_OP_ERR;
+    if (aws_byte_buf_reserve_relative(buf, strlen(name) + encoded_len + 7)) return AWS_OP_ERR;
+    if (aws_byte_buf_init(&encoded, alloc, encoded_len)) return AWS_OP_ERR;
+    if (aws_base64_encode(&data, &encoded)) goto out;
+
+    // base64_encode adds a NUL terminator; strip it off
+    if (encoded.len && encoded.buffer[encoded.len - 1] == 0) {
+        encoded.len--;
+    }
+    if (append_field_name(buf, first, name) || append_c_str(buf, "\"") ||
+        append_cursor(buf, aws_byte_cursor_from_buf(&encoded)) || append_c_str(buf, "\"}")) {
+        goto out;
+    }
+    rv = AWS_OP_SUCCESS;
+
+out:
+    aws_byte_buf_clean_up_secure(&encoded);
+    return rv;
+}
+
+int aws_cryptosdk_kms_request_body(struct aws_byte_buf *body, const struct aws_cryptosdk_kms_request *request) {
+    bool first = true;
+
+    if (append_c_str(body, "{")) return AWS_OP_ERR;
+
+    if (request->op != AWS_CRYPTOSDK_KMS_DECRYPT || request->key_id.len) {
+        if (append_field_name(body, &first, "KeyId") || append_json_string(body, request->key_id)) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    if (request->op == AWS_CRYPTOSDK_KMS_GENERATE_DATA_KEY) {
+        char number[24];
+        snprintf(number, sizeof(number), "%zu", request->number_of_bytes);
+        if (append_field_name(body, &first, "NumberOfBytes") || append_c_str(body, number)) return AWS_OP_ERR;
+    }
+
+    if (request->enc_ctx && aws_hash_table_get_entry_count(request->enc_ctx)) {
+        bool first_entry = true;
+
+        if (append_field_name(body, &first, "EncryptionContext") || append_c_str(body, "{")) return AWS_OP_ERR;
+        for (struct aws_hash_iter iter = aws_hash_iter_begin(request->enc_ctx); !aws_hash_iter_done(&iter);
+             aws_hash_iter_next(&iter)) {
+            const struct aws_string *key   = iter.element.key;
+            const struct aws_string *value = iter.element.value;
+
+            if ((!first_entry && append_c_str(body, ",")) ||
+                append_json_string(body, aws_byte_cursor_from_string(key)) || append_c_str(body, ":") ||
+                append_json_string(body, aws_byte_cursor_from_string(value))) {
+                return AWS_OP_ERR;
+            }
+            first_entry = false;
+        }
+        if (append_c_str(body, "}")) return AWS_OP_ERR;
+    }
+
+    if (request->num_grant_tokens) {
+        if (append_field_name(body, &first, "GrantTokens") || append_c_str(body, "[")) return AWS_OP_ERR;
+        for (size_t i = 0; i < request->num_grant_tokens; i++) {
+            if ((i && append_c_str(body, ",")) ||
+                append_json_string(body, aws_byte_cursor_from_string(request->grant_tokens[i]))) {
+                return AWS_OP_ERR;
+            }
+        }
+        if (append_c_str(body, "]")) return AWS_OP_ERR;
+    }
+
+    switch (request->op) {
+        case AWS_CRYPTOSDK_KMS_ENCRYPT: return append_last_blob_field(body, &first, "Plaintext", request->blob);
+        case AWS_CRYPTOSDK_KMS_DECRYPT: return append_last_blob_field(body, &first, "CiphertextBlob", request->blob);
+        default: return append_c_str(body, "}");
+    }
+}
+
+static void skip_json_space(struct aws_byte_cursor *json) {
+    while (json->len && (*json->ptr == ' ' || *json->ptr == '\t' || *json->ptr == '\r' || *json->ptr == '\n')) {
+        aws_byte_cursor_advance(json, 1);
+    }
+}
+
+/* Advances past the JSON string at the start of *json, setting *raw to its contents, still escaped */
+static bool read_json_string(struct aws_byte_cursor *json, struct aws_byte_cursor *raw) {
+    if (!json->len || *json->ptr != '"') return false;
+
+    for (size_t i = 1; i < json->len; i++) {
+        if (json->ptr[i] == '\\') {
+            i++;
+        } else if (json->ptr[i] == '"') {
+            *raw = aws_byte_cursor_from_array(json->ptr + 1, i - 1);
+            aws_byte_cursor_advance(json, i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Advances past the JSON value of any type at the start of *json */
+static bool skip_json_value(struct aws_byte_cursor *json) {
+    struct aws_byte_cursor raw;
+    size_t depth = 0;
+
+    skip_json_space(json);
+    if (!json->len) return false;
+    if (*json->ptr == '"') return read_json_string(json, &raw);
+
+    if (*json->ptr != '{' && *json->ptr != '[') {
+        // A number, true, false or null runs up to whatever ends the value
+        size_t len = 0;
+        while (len < json->len && !strchr(",}] \t\r\n", json->ptr[len])) len++;
+        aws_byte_cursor_advance(json, len);
+        return len > 0;
+    }
+
+    do {
+        if (!json->len) return false;
+        if (*json->ptr == '"') {
+            if (!read_json_string(json, &raw)) return false;
+            continue;
+        }
+        if (*json->ptr == '{' || *json->ptr == '[') depth++;
+        if (*json->ptr == '}' || *json->ptr == ']') depth--;
+        aws_byte_cursor_advance(json, 1);
+    } while (depth);
+
+    return true;
+}
+
+/* Finds the string value of the field name of the JSON object json, still escaped */
+static bool find_json_string(struct aws_byte_cursor json, const char *name, struct aws_byte_cursor *value) {
+    struct aws_byte_cursor key;
+
+    skip_json_space(&json);
+    if (!json.len || *json.ptr != '{') return false;
+    aws_byte_cursor_advance(&json, 1);
+
+    for (;;) {
+        skip_json_space(&json);
+        if (!read_json_string(&json, &key)) return false;
+        skip_json_space(&json);
+        if (!json.len || *json.ptr != ':') return false;
+        aws_byte_cursor_advance(&json, 1);
+        skip_json_space(&json);
+
+        if (aws_byte_cursor_eq_c_str(&key, name)) return read_json_string(&json, value);
+        if (!skip_json_value(&json)) return false;
+
+        skip_json_space(&json);
+        if (!json.len || *json.ptr != ',') return false;
+        aws_byte_cursor_advance(&json, 1);
+    }
+}
+
+/*
+ * Initializes out with the unescaped contents of a JSON string. Escapes of characters outside
+ * ASCII are not needed for any field we read, and are rejected.
+ */
+static int unescape_json_string(struct aws_allocator *alloc, struct aws_byte_buf *out, struct aws_byte_cursor raw) {
+    if (aws_byte_buf_init(out, alloc, raw.len)) return AWS_OP_ERR;
+
+    for (size_t i = 0; i < raw.len; i++) {
+        uint8_t c = raw.ptr[i];
+
+        if (c == '\\') {
+            if (++i == raw.len) goto err;
+            switch (raw.ptr[i]) {
+                case '"':
+                case '\\':
+                case '/': c = raw.ptr[i]; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'u': {
+                    unsigned int code = 0;
+                    if (raw.len - i < 5) goto err;
+                    for (size_t j = 1; j <= 4; j++) {
+                        uint8_t h = raw.ptr[i + j];
+                        code <<= 4;
+                        if (h >= '0' && h <= '9') {
+                            code |= h - '0';
+                        } else if ((h | 0x20) >= 'a' && (h | 0x20) <= 'f') {
+                            code |= (h | 0x20) - 'a' + 10;
+                        } else {
+                            goto err;
+                        }
+                    }
+                    if (code >= 0x80) goto err;
+                    c = (uint8_t)code;
+                    i += 4;
+                    break;
+                }
+                default: goto err;
+            }
+        }
+        out->buffer[out->len++] = c;
+    }
+    return AWS_OP_SUCCESS;
+
+err:
+    aws_byte_buf_clean_up_secure(out);
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+}
+
+/* Initializes out, from out_alloc, with the decoded contents of a base64 JSON string */
+static int decode_base64_string(
+    struct aws_allocator *alloc,
+    struct aws_allocator *out_alloc,
+    struct aws_byte_buf *out,
+    struct aws_byte_cursor raw) {
+    struct aws_byte_buf unescaped;
+    struct aws_byte_cursor encoded;
+    size_t decoded_len;
+    int rv = AWS_OP_ERR;
+
+    if (unescape_json_string(alloc, &unescaped, raw)) return AWS_OP_ERR;
+    encoded = aws_byte_cursor_from_buf(&unescaped);
+
+    if (!aws_base64_compute_decoded_len(&encoded, &decoded_len) && decoded_len &&
+        !aws_byte_buf_init(out, out_alloc, decoded_len)) {
+        if (!aws_base64_decode(&encoded, out)) {
+            rv = AWS_OP_SUCCESS;
+        } else {
+            aws_byte_buf_clean_up_secure(out);
+        }
+    }
+
+    aws_byte_buf_clean_up_secure(&unescaped);
+    return rv;
+}
+
+int aws_cryptosdk_kms_response_parse(
+    struct aws_cryptosdk_kms_response *response,
+    struct aws_allocator *alloc,
+    enum aws_cryptosdk_kms_op op,
+    struct aws_byte_cursor body) {
+    struct aws_byte_cursor raw;
+
+    AWS_ZERO_STRUCT(*response);
+
+    if (!find_json_string(body, "KeyId", &raw) || unescape_json_string(alloc, &response->key_id, raw)) goto err;
+    if (op != AWS_CRYPTOSDK_KMS_DECRYPT &&
+        (!find_json_string(body, "CiphertextBlob", &raw) ||
+         decode_base64_string(alloc, alloc, &response->ciphertext, raw))) {
+        goto err;
+    }
+    if (op != AWS_CRYPTOSDK_KMS_ENCRYPT &&
+        (!find_json_string(body, "Plaintext", &raw) ||
+         decode_base64_string(alloc, aws_cryptosdk_secure_key_allocator(), &response->plaintext, raw))) {
+        goto err;
+    }
+    return AWS_OP_SUCCESS;
+
+err:
+    aws_cryptosdk_kms_response_clean_up(response);
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+}
+
+void aws_cryptosdk_kms_response_clean_up(struct aws_cryptosdk_kms_response *response) {
+    aws_byte_buf_clean_up(&response->key_id);
+    aws_byte_buf_clean_up(&response->ciphertext);
+    aws_byte_buf_clean_up_secure(&response->plaintext);
+}
+
+bool aws_cryptosdk_kms_error_is_retryable(int status, struct aws_byte_cursor body, bool *throttled) {
+    struct aws_byte_cursor type;
+    bool internal = false;
+
+    *throttled = status == 429;
+    if (find_json_string(body, "__type", &type)) {
+        // The type may be qualified by the service's namespace, as in com.amazonaws.kms#ThrottlingException
+        struct aws_byte_cursor part = { 0 }, name = type;
+        while (aws_byte_cursor_next_split(&type, '#', &part)) name = part;
+
+        if (aws_byte_cursor_eq_c_str(&name, "ThrottlingException")) *throttled = true;
+        internal = aws_byte_cursor_eq_c_str(&name, "KMSInternalException");
+    }
+
+    return *throttled || internal || status >= 500;
+}
+
+#ifdef AWS_CRYPTOSDK_P_HAVE_AWS_C_HTTP
+#    include <aws/auth/credentials.h>
+#    include <aws/auth/signable.h>
+#    include <aws/auth/signing.h>
+#    include <aws/auth/signing_config.h>
+#    include <aws/auth/signing_result.h>
+#    include <aws/common/atomics.h>
+#    include <aws/common/condition_variable.h>
+#    include <aws/common/date_time.h>
+#    include <aws/common/mutex.h>
+#    include <aws/cryptosdk/cipher.h>
+#    include <aws/cryptosdk/keyring_trace.h>
+#    include <aws/cryptosdk/list_utils.h>
+#    include <aws/http/connection.h>
+#    include <aws/http/connection_manager.h>
+#    include <aws/http/request_response.h>
+#    include <aws/io/channel_bootstrap.h>
+#    include <aws/io/retry_strategy.h>
+#    include <aws/io/socket.h>
+#    include <aws/io/stream.h>
+#    include <aws/io/tls_channel_handler.h>
+
+#    define DEFAULT_MAX_CONNECTIONS 32
+#    define DEFAULT_MAX_RETRIES 3
+#    define CONNECT_TIMEOUT_MS 3000
+/* Room for a response before its buffer first has to grow, which is enough for any data key call */
+#    define RESPONSE_INITIAL_SIZE 4096
+
+AWS_STATIC_STRING_FROM_LITERAL(kms_provider_id, "aws-kms");
+
+/* The connections to KMS in one region */
+struct region_endpoint {
+    struct aws_string *region;
+    struct aws_string *host;
+    struct aws_http_connection_manager *manager;
+};
+
+struct kms_async_keyring {
+    struct aws_cryptosdk_keyring base;
+    struct aws_allocator *alloc;
+    struct aws_client_bootstrap *bootstrap;
+    struct aws_credentials_provider *credentials_provider;
+    struct aws_tls_ctx *tls_ctx;
+    struct aws_retry_strategy *retry_strategy;
+    /* Either may be NULL */
+    struct aws_string *default_region;
+    struct aws_string *endpoint;
+    uint16_t port;
+    size_t max_connections;
+    struct aws_string **key_ids;
+    size_t num_key_ids;
+    struct aws_string **grant_tokens;
+    size_t num_grant_tokens;
+
+    /* Guards endpoints, which are set up as calls first need each region */
+    struct aws_mutex mutex;
+    struct aws_array_list endpoints;
+};
+
+/* Copies the endpoint for region to *endpoint, setting it up on first use; its strings live as long as the keyring */
+static int endpoint_for_region(
+    struct kms_async_keyring *self, struct aws_byte_cursor region, struct region_endpoint *endpoint) {
+    struct region_endpoint new_endpoint = { 0 };
+    struct aws_byte_buf host            = { 0 };
+    struct aws_tls_connection_options tls_options;
+    bool have_tls_options = false;
+    int rv                = AWS_OP_ERR;
+
+    aws_mutex_lock(&self->mutex);
+    for (size_t i = 0; i < aws_array_list_length(&self->endpoints); i++) {
+        aws_array_list_get_at(&self->endpoints, endpoint, i);
+        if (aws_string_eq_byte_cursor(endpoint->region, &region)) {
+            aws_mutex_unlock(&self->mutex);
+            return AWS_OP_SUCCESS;
+        }
+    }
+
+    if (self->endpoint) {
+        new_endpoint.host = aws_string_new_from_string(self->alloc, self->endpoint);
+    } else if (!aws_byte_buf_init(&host, self->alloc, region.len + 32) && !append_c_str(&host, "kms.") &&
+               !append_cursor(&host, region) && !append_c_str(&host, ".amazonaws.com")) {
+        new_endpoint.host = aws_string_new_from_buf(self->alloc, &host);
+    }
+    if (!(new_endpoint.region = aws_string_new_from_cursor(self->alloc, &region)) || !new_endpoint.host) goto out;
+
+    struct aws_byte_cursor host_name    = aws_byte_cursor_from_string(new_endpoint.host);
+    struct aws_socket_options socket    = { .type               = AWS_SOCKET_STREAM,
+                                         .domain             = AWS_SOCKET_IPV4,
+                                         .connect_timeout_ms = CONNECT_TIMEOUT_MS };
+    aws_tls_connection_options_init_from_ctx(&tls_options, self->tls_ctx);
+    have_tls_options = true;
+    if (aws_tls_connection_options_set_server_name(&tls_options, self->alloc, &host_name)) goto out;
+
+    // The manager copies what it needs of the options
+    struct aws_http_connection_manager_options options = { .bootstrap              = self->bootstrap,
+                                                            .initial_window_size    = SIZE_MAX,
+                                                            .socket_options         = &socket,
+                                                            .tls_connection_options = &tls_options,
+                                                            .host                   = host_name,
+                                                            .port                   = self->port,
+                                                            .max_connections        = self->max_connections };
+    if (!(new_endpoint.manager = aws_http_connection_manager_new(self->alloc, &options))) goto out;
+    if (aws_array_list_push_back(&self->endpoints, &new_endpoint)) goto out;
+
+    *endpoint = new_endpoint;
+    AWS_ZERO_STRUCT(new_endpoint);
+    rv = AWS_OP_SUCCESS;
+
+out:
+    aws_mutex_unlock(&self->mutex);
+    if (new_endpoint.manager) aws_http_connection_manager_release(new_endpoint.manager);
+    if (have_tls_options) aws_tls_connection_options_clean_up(&tls_options);
+    aws_string_destroy(new_endpoint.region);
+    aws_string_destroy(new_endpoint.host);
+    aws_byte_buf_clean_up(&host);
+    return rv;
+}
+
+struct kms_call;
+
+/* Invoked exactly once when a started call completes; the callee then destroys the call */
+typedef void(kms_call_fn)(struct kms_call *call, int error_code);
+
+/*
+ * One KMS operation, from taking a retry token through signing, sending and retrying the request
+ * to parsing the response. Each step is started by the callback of the one before.
+ */
+struct kms_call {
+    struct kms_async_keyring *self;
+    enum aws_cryptosdk_kms_op op;
+    struct region_endpoint endpoint;
+    struct aws_byte_buf body;
+    struct aws_retry_token *retry_token;
+
+    /* The state of the current attempt */
+    struct aws_http_message *message;
+    struct aws_input_stream *body_stream;
+    struct aws_signable *signable;
+    struct aws_http_connection *connection;
+    struct aws_byte_buf response_body;
+    int status;
+
+    /* Set when the call succeeds */
+    struct aws_cryptosdk_kms_response response;
+    kms_call_fn *on_done;
+    void *user_data;
+    /* Which of the caller's calls this is */
+    size_t index;
+};
+
+static void send_attempt(struct kms_call *call);
+
+static void clean_up_attempt(struct kms_call *call) {
+    if (call->signable) aws_signable_destroy(call->signable);
+    if (call->message) aws_http_message_release(call->message);
+    if (call->body_stream) aws_input_stream_release(call->body_stream);
+    call->signable    = NULL;
+    call->message     = NULL;
+    call->body_stream = NULL;
+}
+
+static void finish_call(struct kms_call *call, int error_code) {
+    clean_up_attempt(call);
+    call->on_done(call, error_code);
+}
+
+static void kms_call_destroy(struct kms_call *call) {
+    struct aws_allocator *alloc = call->self->alloc;
+
+    clean_up_attempt(call);
+    if (call->retry_token) aws_retry_token_release(call->retry_token);
+    aws_byte_buf_clean_up_secure(&call->body);
+    aws_byte_buf_clean_up_secure(&call->response_body);
+    aws_cryptosdk_kms_response_clean_up(&call->response);
+    aws_mem_release(alloc, call);
+}
+
+static void on_retry_ready(struct aws_retry_token *token, int error_code, void *user_data) {
+    struct kms_call *call = user_data;
+    (void)token;
+
+    if (error_code) {
+        finish_call(call, error_code);
+    } else {
+        send_attempt(call);
+    }
+}
+
+/* Schedules another attempt after a backoff, or fails the call once its retries are spent */
+static void retry_or_finish(struct kms_call *call, enum aws_retry_error_type error_type, int error_code) {
+    clean_up_attempt(call);
+    if (aws_retry_strategy_schedule_retry(call->retry_token, error_type, on_retry_ready, call)) {
+        finish_call(call, error_code);
+    }
+}
+
+static int on_response_body(struct aws_http_stream *stream, const struct aws_byte_cursor *data, void *user_data) {
+    struct kms_call *call = user_data;
+    (void)stream;
+
+    return append_cursor(&call->response_body, *data);
+}
+
+static void on_stream_complete(struct aws_http_stream *stream, int error_code, void *user_data) {
+    struct kms_call *call = user_data;
+    bool throttled;
+
+    if (!error_code && aws_http_stream_get_incoming_response_status(stream, &call->status)) {
+        error_code = aws_last_error();
+    }
+    aws_http_stream_release(stream);
+    aws_http_connection_manager_release_connection(call->endpoint.manager, call->connection);
+    call->connection = NULL;
+
+    if (error_code) {
+        retry_or_finish(call, AWS_RETRY_ERROR_TYPE_TRANSIENT, error_code);
+        return;
+    }
+
+    struct aws_byte_cursor body = aws_byte_cursor_from_buf(&call->response_body);
+    if (call->status == 200) {
+        aws_retry_token_record_success(call->retry_token);
+        error_code = aws_cryptosdk_kms_response_parse(&call->response, call->self->alloc, call->op, body)
+                         ? aws_last_error()
+                         : AWS_ERROR_SUCCESS;
+        finish_call(call, error_code);
+    } else if (aws_cryptosdk_kms_error_is_retryable(call->status, body, &throttled)) {
+        retry_or_finish(
+            call,
+            throttled ? AWS_RETRY_ERROR_TYPE_THROTTLING : AWS_RETRY_ERROR_TYPE_SERVER_ERROR,
+            AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+    } else {
+        finish_call(call, AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+    }
+}
+
+static void on_connection(struct aws_http_connection *connection, int error_code, void *user_data) {
+    struct kms_call *call = user_data;
+
+    if (error_code) {
+        retry_or_finish(call, AWS_RETRY_ERROR_TYPE_TRANSIENT, error_code);
+        return;
+    }
+    call->connection = connection;
+
+    struct aws_http_make_request_options options = { .self_size        = sizeof(options),
+                                                     .request          = call->message,
+                                                     .user_data        = call,
+                                                     .on_response_body = on_response_body,
+                                                     .on_complete      = on_stream_complete };
+    struct aws_http_stream *stream               = aws_http_connection_make_request(connection, &options);
+    if (!stream || aws_http_stream_activate(stream)) {
+        error_code = aws_last_error();
+        if (stream) aws_http_stream_release(stream);
+        aws_http_connection_manager_release_connection(call->endpoint.manager, connection);
+        call->connection = NULL;
+        retry_or_finish(call, AWS_RETRY_ERROR_TYPE_TRANSIENT, error_code);
+    }
+}
+
+static void on_signed(struct aws_signing_result *result, int error_code, void *user_data) {
+    struct kms_call *call = user_data;
+
+    if (!error_code && aws_apply_signing_result_to_http_request(call->message, call->self->alloc, result)) {
+        error_code = aws_last_error();
+    }
+    if (error_code) {
+        finish_call(call, error_code);
+        return;
+    }
+
+    aws_signable_destroy(call->signable);
+    call->signable = NULL;
+    aws_http_connection_manager_acquire_connection(call->endpoint.manager, on_connection, call);
+}
+
+static int add_header(struct aws_http_message *message, const char *name, struct aws_byte_cursor value) {
+    struct aws_http_header header = { .name = aws_byte_cursor_from_c_str(name), .value = value };
+    return aws_http_message_add_header(message, header);
+}
+
+/* Builds and signs a new request for the call; each attempt is signed afresh, as signatures expire */
+static void send_attempt(struct kms_call *call) {
+    struct kms_async_keyring *self = call->self;
+    struct aws_byte_cursor body    = aws_byte_cursor_from_buf(&call->body);
+    char content_length[24];
+    struct aws_signing_config_aws config;
+
+    call->response_body.len = 0;
+    call->status            = 0;
+    snprintf(content_length, sizeof(content_length), "%zu", body.len);
+
+    if (!(call->message = aws_http_message_new_request(self->alloc)) ||
+        aws_http_message_set_request_method(call->message, aws_http_method_post) ||
+        aws_http_message_set_request_path(call->message, aws_byte_cursor_from_c_str("/")) ||
+        add_header(call->message, "Host", aws_byte_cursor_from_string(call->endpoint.host)) ||
+        add_header(call->message, "Content-Type", aws_byte_cursor_from_c_str("application/x-amz-json-1.1")) ||
+        add_header(call->message, "X-Amz-Target", aws_byte_cursor_from_c_str(aws_cryptosdk_kms_target(call->op))) ||
+        add_header(call->message, "Content-Length", aws_byte_cursor_from_c_str(content_length)) ||
+        !(call->body_stream = aws_input_stream_new_from_cursor(self->alloc, &body))) {
+        finish_call(call, aws_last_error());
+        return;
+    }
+    aws_http_message_set_body_stream(call->message, call->body_stream);
+
+    AWS_ZERO_STRUCT(config);
+    config.config_type                     = AWS_SIGNING_CONFIG_AWS;
+    config.algorithm                       = AWS_SIGNING_ALGORITHM_V4;
+    config.signature_type                  = AWS_ST_HTTP_REQUEST_HEADERS;
+    config.region                          = aws_byte_cursor_from_string(call->endpoint.region);
+    config.service                         = aws_byte_cursor_from_c_str("kms");
+    config.credentials_provider            = self->credentials_provider;
+    config.flags.use_double_uri_encode     = true;
+    config.flags.should_normalize_uri_path = true;
+    aws_date_time_init_now(&config.date);
+
+    if (!(call->signable = aws_signable_new_http_request(self->alloc, call->message)) ||
+        aws_sign_request_aws(
+            self->alloc, call->signable, (struct aws_signing_config_base *)&config, on_signed, call)) {
+        finish_call(call, aws_last_error());
+    }
+}
+
+static void on_retry_token(
+    struct aws_retry_strategy *strategy, int error_code, struct aws_retry_token *token, void *user_data) {
+    struct kms_call *call = user_data;
+    (void)strategy;
+
+    if (error_code) {
+        finish_call(call, error_code);
+        return;
+    }
+    call->retry_token = token;
+    send_attempt(call);
+}
+
+/*
+ * Starts a KMS call in region. If this fails, on_done is never invoked; otherwise it is invoked
+ * exactly once, possibly before this returns, and must destroy the call.
+ */
+static int kms_call_start(
+    struct kms_async_keyring *self,
+    const struct aws_cryptosdk_kms_request *request,
+    struct aws_byte_cursor region,
+    kms_call_fn *on_done,
+    void *user_data,
+    size_t index) {
+    struct kms_call *call = aws_mem_calloc(self->alloc, 1, sizeof(*call));
+    if (!call) return AWS_OP_ERR;
+
+    call->self      = self;
+    call->op        = request->op;
+    call->on_done   = on_done;
+    call->user_data = user_data;
+    call->index     = index;
+
+    if (endpoint_for_region(self, region, &call->endpoint) ||
+        aws_byte_buf_init(&call->body, self->alloc, RESPONSE_INITIAL_SIZE) ||
+        aws_cryptosdk_kms_request_body(&call->body, request) ||
+        aws_byte_buf_init(&call->response_body, self->alloc, RESPONSE_INITIAL_SIZE)) {
+        goto err;
+    }
+
+    // Retries are budgeted per region, so that a region in trouble does not starve the others
+    struct aws_byte_cursor partition = aws_byte_cursor_from_string(call->endpoint.region);
+    if (aws_retry_strategy_acquire_retry_token(self->retry_strategy, &partition, on_retry_token, call, 0)) goto err;
+
+    return AWS_OP_SUCCESS;
+
+err:
+    kms_call_destroy(call);
+    return AWS_OP_ERR;
+}
+
+/* Sets *region to where key_id lives: the region of its ARN, or the keyring's default */
+static bool region_of_key(
+    const struct kms_async_keyring *self, struct aws_byte_cursor key_id, struct aws_byte_cursor *region) {
+    if (aws_cryptosdk_kms_region_of_arn(region, key_id)) return true;
+    if (!self->default_region) return false;
+
+    *region = aws_byte_cursor_from_string(self->default_region);
+    return true;
+}
+
+/* Returns a request of the fields every call from this keyring sets */
+static struct aws_cryptosdk_kms_request new_request(
+    const struct kms_async_keyring *self,
+    enum aws_cryptosdk_kms_op op,
+    struct aws_byte_cursor key_id,
+    const struct aws_hash_table *enc_ctx) {
+    struct aws_cryptosdk_kms_request request = { .op = op, .key_id = key_id, .enc_ctx = enc_ctx };
+
+    request.grant_tokens     = (const struct aws_string *const *)self->grant_tokens;
+    request.num_grant_tokens = self->num_grant_tokens;
+    return request;
+}
+
+/* The state of one on_encrypt_async call */
+struct encrypt_op {
+    struct kms_async_keyring *self;
+    struct aws_allocator *request_alloc;
+    struct aws_byte_buf *unencrypted_data_key;
+    struct aws_array_list *keyring_trace;
+    struct aws_array_list *edks;
+    const struct aws_hash_table *enc_ctx;
+    enum aws_cryptosdk_alg_id alg;
+    aws_cryptosdk_keyring_fn *callback;
+    void *user_data;
+    bool generated;
+    /* The completed call for each key ID, in key ID order */
+    struct kms_call **calls;
+    /* Calls still in flight, plus one while they are being started */
+    struct aws_atomic_var pending;
+    /* The error of the first call to fail, or zero */
+    struct aws_atomic_var error;
+};
+
+static void record_encrypt_error(struct encrypt_op *op, int error_code) {
+    size_t expected = 0;
+    aws_atomic_compare_exchange_int(&op->error, &expected, error_code ? error_code : AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+}
+
+/* Adds the EDK and trace record of a completed call to the lists */
+static int add_wrapped_key(
+    struct encrypt_op *op,
+    struct aws_array_list *edks,
+    struct aws_array_list *trace,
+    const struct kms_call *call,
+    const struct aws_string *key_id,
+    uint32_t flags) {
+    const struct aws_cryptosdk_kms_response *response = &call->response;
+    struct aws_cryptosdk_edk edk;
+
+    if (aws_cryptosdk_edk_init_record(
+            op->request_alloc, &edk, kms_provider_id->len, response->key_id.len, response->ciphertext.len)) {
+        return AWS_OP_ERR;
+    }
+    // The buffers were sized for exactly these fields, so the writes cannot fail
+    aws_byte_buf_write_from_whole_string(&edk.provider_id, kms_provider_id);
+    aws_byte_buf_write_from_whole_buffer(&edk.provider_info, response->key_id);
+    aws_byte_buf_write_from_whole_buffer(&edk.ciphertext, response->ciphertext);
+
+    if (aws_array_list_push_back(edks, &edk)) {
+        aws_cryptosdk_edk_clean_up(&edk);
+        return AWS_OP_ERR;
+    }
+    return aws_cryptosdk_keyring_trace_add_record(op->request_alloc, trace, kms_provider_id, key_id, flags);
+}
+
+static void finish_encrypt(struct encrypt_op *op) {
+    struct kms_async_keyring *self = op->self;
+    int error_code                 = (int)aws_atomic_load_int(&op->error);
+    struct aws_array_list my_edks, my_trace;
+    bool have_lists = false;
+
+    if (!error_code) {
+        if (aws_cryptosdk_edk_list_init(op->request_alloc, &my_edks)) {
+            error_code = aws_last_error();
+        } else if (aws_cryptosdk_keyring_trace_init(op->request_alloc, &my_trace)) {
+            error_code = aws_last_error();
+            aws_cryptosdk_edk_list_clean_up(&my_edks);
+        } else {
+            have_lists = true;
+        }
+    }
+
+    // EDKs are added in key ID order, whatever order the calls completed in
+    for (size_t i = 0; i < self->num_key_ids && !error_code; i++) {
+        uint32_t flags = AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_SIGNED_ENC_CTX;
+        if (!i && op->generated) flags |= AWS_CRYPTOSDK_WRAPPING_KEY_GENERATED_DATA_KEY;
+
+        if (add_wrapped_key(op, &my_edks, &my_trace, op->calls[i], self->key_ids[i], flags)) {
+            error_code = aws_last_error();
+        }
+    }
+    if (!error_code && !aws_cryptosdk_transfer_list(op->edks, &my_edks)) {
+        aws_cryptosdk_transfer_list(op->keyring_trace, &my_trace);
+    } else if (!error_code) {
+        error_code = aws_last_error();
+    }
+
+    if (have_lists) {
+        aws_cryptosdk_edk_list_clean_up(&my_edks);
+        aws_cryptosdk_keyring_trace_clean_up(&my_trace);
+    }
+    if (error_code && op->generated) {
+        aws_byte_buf_clean_up_secure(op->unencrypted_data_key);
+    }
+    for (size_t i = 0; i < self->num_key_ids; i++) {
+        if (op->calls[i]) kms_call_destroy(op->calls[i]);
+    }
+
+    aws_cryptosdk_keyring_fn *callback = op->callback;
+    void *user_data                    = op->user_data;
+    aws_mem_release(self->alloc, op->calls);
+    aws_mem_release(self->alloc, op);
+    callback(error_code, user_data);
+}
+
+static void release_pending(struct encrypt_op *op) {
+    if (aws_atomic_fetch_sub(&op->pending, 1) == 1) finish_encrypt(op);
+}
+
+static void on_wrapped(struct kms_call *call, int error_code) {
+    struct encrypt_op *op = call->user_data;
+
+    // Each call has its own slot, so completions on different event loops do not race
+    op->calls[call->index] = call;
+    if (error_code) record_encrypt_error(op, error_code);
+    release_pending(op);
+}
+
+/* Encrypts the data key under each key ID from the first, all at once */
+static void start_wraps(struct encrypt_op *op, size_t first) {
+    struct kms_async_keyring *self = op->self;
+
+    aws_atomic_store_int(&op->pending, 1);
+    for (size_t i = first; i < self->num_key_ids; i++) {
+        struct aws_cryptosdk_kms_request request =
+            new_request(self, AWS_CRYPTOSDK_KMS_ENCRYPT, aws_byte_cursor_from_string(self->key_ids[i]), op->enc_ctx);
+        struct aws_byte_cursor region;
+
+        request.blob = aws_byte_cursor_from_buf(op->unencrypted_data_key);
+
+        // Key IDs are checked when the keyring is created, so every one has a region
+        region_of_key(self, request.key_id, &region);
+        aws_atomic_fetch_add(&op->pending, 1);
+        if (kms_call_start(self, &request, region, on_wrapped, op, i)) {
+            record_encrypt_error(op, aws_last_error());
+            aws_atomic_fetch_sub(&op->pending, 1);
+            break;
+        }
+    }
+    release_pending(op);
+}
+
+static void on_generated(struct kms_call *call, int error_code) {
+    struct encrypt_op *op = call->user_data;
+    size_t data_key_len   = aws_cryptosdk_alg_props(op->alg)->data_key_len;
+
+    op->calls[0] = call;
+    if (!error_code && call->response.plaintext.len != data_key_len) error_code = AWS_CRYPTOSDK_ERR_KMS_FAILURE;
+    if (error_code) {
+        record_encrypt_error(op, error_code);
+        finish_encrypt(op);
+        return;
+    }
+
+    // The data key was allocated from the secure key allocator, so it is handed over as it is
+    *op->unencrypted_data_key = call->response.plaintext;
+    AWS_ZERO_STRUCT(call->response.plaintext);
+    op->generated = true;
+    start_wraps(op, 1);
+}
+
+static int kms_async_keyring_on_encrypt_async(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    struct kms_async_keyring *self = (struct kms_async_keyring *)kr;
+
+    // In discovery mode there is nothing to encrypt with
+    if (!self->num_key_ids) {
+        callback(AWS_ERROR_SUCCESS, user_data);
+        return AWS_OP_SUCCESS;
+    }
+
+    struct encrypt_op *op = aws_mem_calloc(self->alloc, 1, sizeof(*op));
+    if (!op) return AWS_OP_ERR;
+    if (!(op->calls = aws_mem_calloc(self->alloc, self->num_key_ids, sizeof(*op->calls)))) {
+        aws_mem_release(self->alloc, op);
+        return AWS_OP_ERR;
+    }
+    op->self                 = self;
+    op->request_alloc        = request_alloc;
+    op->unencrypted_data_key = unencrypted_data_key;
+    op->keyring_trace        = keyring_trace;
+    op->edks                 = edks;
+    op->enc_ctx              = enc_ctx;
+    op->alg                  = alg;
+    op->callback             = callback;
+    op->user_data            = user_data;
+    aws_atomic_init_int(&op->pending, 0);
+    aws_atomic_init_int(&op->error, 0);
+
+    if (unencrypted_data_key->buffer) {
+        start_wraps(op, 0);
+        return AWS_OP_SUCCESS;
+    }
+
+    struct aws_cryptosdk_kms_request request = new_request(
+        self, AWS_CRYPTOSDK_KMS_GENERATE_DATA_KEY, aws_byte_cursor_from_string(self->key_ids[0]), enc_ctx);
+    struct aws_byte_cursor region;
+
+    request.number_of_bytes = aws_cryptosdk_alg_props(alg)->data_key_len;
+    region_of_key(self, request.key_id, &region);
+    if (kms_call_start(self, &request, region, on_generated, op, 0)) {
+        aws_mem_release(self->alloc, op->calls);
+        aws_mem_release(self->alloc, op);
+        return AWS_OP_ERR;
+    }
+    return AWS_OP_SUCCESS;
+}
+
+/* The state of one on_decrypt_async call, which tries one EDK at a time */
+struct decrypt_op {
+    struct kms_async_keyring *self;
+    struct aws_allocator *request_alloc;
+    struct aws_byte_buf *unencrypted_data_key;
+    struct aws_array_list *keyring_trace;
+    const struct aws_array_list *edks;
+    const struct aws_hash_table *enc_ctx;
+    size_t data_key_len;
+    aws_cryptosdk_keyring_fn *callback;
+    void *user_data;
+    /* The EDK being decrypted, and the index of the next one to try */
+    const struct aws_cryptosdk_edk *edk;
+    size_t next_edk;
+};
+
+static void finish_decrypt(struct decrypt_op *op, int error_code) {
+    aws_cryptosdk_keyring_fn *callback = op->callback;
+    void *user_data                    = op->user_data;
+
+    aws_mem_release(op->self->alloc, op);
+    callback(error_code, user_data);
+}
+
+static bool may_use_key(const struct kms_async_keyring *self, const struct aws_byte_buf *key_arn) {
+    // In discovery mode every KMS key may be tried; otherwise only the configured ARNs
+    if (!self->num_key_ids) return true;
+    for (size_t i = 0; i < self->num_key_ids; i++) {
+        if (aws_string_eq_byte_buf(self->key_ids[i], key_arn)) return true;
+    }
+    return false;
+}
+
+static void on_decrypted(struct kms_call *call, int error_code);
+
+/* Starts decrypting the next EDK this keyring may decrypt, or completes the call if none is left */
+static void try_next_edk(struct decrypt_op *op) {
+    struct kms_async_keyring *self = op->self;
+    size_t num_edks                = aws_array_list_length(op->edks);
+
+    while (op->next_edk < num_edks) {
+        const struct aws_cryptosdk_edk *edk;
+        struct aws_byte_cursor region;
+
+        if (aws_array_list_get_at_ptr(op->edks, (void **)&edk, op->next_edk++)) continue;
+        if (!aws_string_eq_byte_buf(kms_provider_id, &edk->provider_id) || !may_use_key(self, &edk->provider_info)) {
+            continue;
+        }
+        struct aws_byte_cursor key_arn = aws_byte_cursor_from_buf(&edk->provider_info);
+        if (!aws_cryptosdk_kms_region_of_arn(&region, key_arn)) continue;
+
+        struct aws_cryptosdk_kms_request request = new_request(self, AWS_CRYPTOSDK_KMS_DECRYPT, key_arn, op->enc_ctx);
+        request.blob                             = aws_byte_cursor_from_buf(&edk->ciphertext);
+        op->edk                                  = edk;
+        if (!kms_call_start(self, &request, region, on_decrypted, op, 0)) return;
+
+        // An EDK which cannot be tried is skipped, as one which fails to decrypt would be
+        aws_reset_error();
+    }
+
+    // Not decrypting any EDK is not an error
+    finish_decrypt(op, AWS_ERROR_SUCCESS);
+}
+
+static void on_decrypted(struct kms_call *call, int error_code) {
+    struct decrypt_op *op                       = call->user_data;
+    struct aws_cryptosdk_kms_response *response = &call->response;
+    int rv;
+
+    // KMS must have used the key named in the EDK, and returned a key of the right size
+    if (error_code || !aws_byte_buf_eq(&response->key_id, &op->edk->provider_info) ||
+        response->plaintext.len != op->data_key_len) {
+        kms_call_destroy(call);
+        try_next_edk(op);
+        return;
+    }
+
+    rv = aws_cryptosdk_keyring_trace_add_record_buf(
+        op->request_alloc,
+        op->keyring_trace,
+        &op->edk->provider_id,
+        &op->edk->provider_info,
+        AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX);
+    if (!rv) {
+        *op->unencrypted_data_key = response->plaintext;
+        AWS_ZERO_STRUCT(response->plaintext);
+    }
+
+    kms_call_destroy(call);
+    finish_decrypt(op, rv ? aws_last_error() : AWS_ERROR_SUCCESS);
+}
+
+static int kms_async_keyring_on_decrypt_async(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    struct kms_async_keyring *self = (struct kms_async_keyring *)kr;
+    struct decrypt_op *op          = aws_mem_calloc(self->alloc, 1, sizeof(*op));
+    if (!op) return AWS_OP_ERR;
+
+    op->self                 = self;
+    op->request_alloc        = request_alloc;
+    op->unencrypted_data_key = unencrypted_data_key;
+    op->keyring_trace        = keyring_trace;
+    op->edks                 = edks;
+    op->enc_ctx              = enc_ctx;
+    op->data_key_len         = aws_cryptosdk_alg_props(alg)->data_key_len;
+    op->callback             = callback;
+    op->user_data            = user_data;
+
+    try_next_edk(op);
+    return AWS_OP_SUCCESS;
+}
+
+/* Lets the synchronous entry points wait for the asynchronous ones */
+struct waiter {
+    struct aws_mutex mutex;
+    struct aws_condition_variable done_signal;
+    bool done;
+    int error_code;
+};
+
+static void on_waited(int error_code, void *user_data) {
+    struct waiter *waiter = user_data;
+
+    aws_mutex_lock(&waiter->mutex);
+    waiter->done       = true;
+    waiter->error_code = error_code;
+    aws_condition_variable_notify_all(&waiter->done_signal);
+    aws_mutex_unlock(&waiter->mutex);
+}
+
+static bool is_done(void *user_data) {
+    return ((struct waiter *)user_data)->done;
+}
+
+static int wait_for(struct waiter *waiter, int start_rv) {
+    if (!start_rv) {
+        aws_mutex_lock(&waiter->mutex);
+        aws_condition_variable_wait_pred(&waiter->done_signal, &waiter->mutex, is_done, waiter);
+        aws_mutex_unlock(&waiter->mutex);
+    }
+    aws_condition_variable_clean_up(&waiter->done_signal);
+    aws_mutex_clean_up(&waiter->mutex);
+
+    if (start_rv) return AWS_OP_ERR;
+    return waiter->error_code ? aws_raise_error(waiter->error_code) : AWS_OP_SUCCESS;
+}
+
+static int kms_async_keyring_on_encrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct waiter waiter = { .mutex = AWS_MUTEX_INIT, .done_signal = AWS_CONDITION_VARIABLE_INIT };
+
+    return wait_for(
+        &waiter,
+        kms_async_keyring_on_encrypt_async(
+            kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg, on_waited, &waiter));
+}
+
+static int kms_async_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct waiter waiter = { .mutex = AWS_MUTEX_INIT, .done_signal = AWS_CONDITION_VARIABLE_INIT };
+
+    return wait_for(
+        &waiter,
+        kms_async_keyring_on_decrypt_async(
+            kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg, on_waited, &waiter));
+}
+
+static int kms_async_keyring_get_edk_filter(
+    const struct aws_cryptosdk_keyring *kr,
+    struct aws_byte_cursor *provider_id,
+    struct aws_byte_cursor *provider_info_prefix) {
+    (void)kr;
+
+    *provider_id          = aws_byte_cursor_from_string(kms_provider_id);
+    *provider_info_prefix = aws_byte_cursor_from_c_str("");
+    return AWS_OP_SUCCESS;
+}
+
+static void destroy_strings(struct aws_allocator *alloc, struct aws_string **strings, size_t count) {
+    if (!strings) return;
+    for (size_t i = 0; i < count; i++) aws_string_destroy(strings[i]);
+    aws_mem_release(alloc, strings);
+}
+
+static void kms_async_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
+    struct kms_async_keyring *self = (struct kms_async_keyring *)kr;
+
+    // No calls are in progress, so each manager shuts down its idle connections on release
+    for (size_t i = 0; i < aws_array_list_length(&self->endpoints); i++) {
+        struct region_endpoint endpoint;
+        aws_array_list_get_at(&self->endpoints, &endpoint, i);
+        aws_http_connection_manager_release(endpoint.manager);
+        aws_string_destroy(endpoint.region);
+        aws_string_destroy(endpoint.host);
+    }
+    aws_array_list_clean_up(&self->endpoints);
+    aws_mutex_clean_up(&self->mutex);
+
+    if (self->retry_strategy) aws_retry_strategy_release(self->retry_strategy);
+    if (self->tls_ctx) aws_tls_ctx_release(self->tls_ctx);
+    if (self->credentials_provider) aws_credentials_provider_release(self->credentials_provider);
+    aws_string_destroy(self->default_region);
+    aws_string_destroy(self->endpoint);
+    destroy_strings(self->alloc, self->key_ids, self->num_key_ids);
+    destroy_strings(self->alloc, self->grant_tokens, self->num_grant_tokens);
+    aws_mem_release(self->alloc, self);
+}
+
+static const struct aws_cryptosdk_keyring_vt kms_async_keyring_vt = {
+    .vt_size          = sizeof(struct aws_cryptosdk_keyring_vt),
+    .name             = "KMS keyring (aws-c-http)",
+    .destroy          = kms_async_keyring_destroy,
+    .on_encrypt       = kms_async_keyring_on_encrypt,
+    .on_decrypt       = kms_async_keyring_on_decrypt,
+    .on_encrypt_async = kms_async_keyring_on_encrypt_async,
+    .on_decrypt_async = kms_async_keyring_on_decrypt_async,
+    .get_edk_filter   = kms_async_keyring_get_edk_filter
+};
+
+static struct aws_string **copy_strings(
+    struct aws_allocator *alloc, const struct aws_string *const *strings, size_t count) {
+    struct aws_string **copies;
+
+    if (!count) return NULL;
+    if (!(copies = aws_mem_calloc(alloc, count, sizeof(*copies)))) return NULL;
+    for (size_t i = 0; i < count; i++) {
+        if (!(copies[i] = aws_string_new_from_string(alloc, strings[i]))) {
+            destroy_strings(alloc, copies, i);
+            return NULL;
+        }
+    }
+    return copies;
+}
+
+struct aws_cryptosdk_keyring *aws_cryptosdk_kms_async_keyring_new(
+    struct aws_allocator *alloc,
+    const struct aws_cryptosdk_kms_async_keyring_options *options,
+    const struct aws_string *const *key_ids,
+    size_t num_key_ids,
+    const struct aws_string *const *grant_tokens,
+    size_t num_grant_tokens) {
+    struct kms_async_keyring *self;
+
+    if (!options || !options->bootstrap || !options->credentials_provider) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+    // A key ID which is neither an ARN nor in the default region could never be called
+    for (size_t i = 0; i < num_key_ids; i++) {
+        struct aws_byte_cursor region;
+        if (!aws_cryptosdk_kms_region_of_arn(&region, aws_byte_cursor_from_string(key_ids[i])) &&
+            !options->default_region.len) {
+            aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+            return NULL;
+        }
+    }
+
+    if (!(self = aws_mem_calloc(alloc, 1, sizeof(*self)))) return NULL;
+    aws_cryptosdk_keyring_base_init(&self->base, &kms_async_keyring_vt);
+    self->alloc           = alloc;
+    self->bootstrap       = options->bootstrap;
+    self->port            = options->port ? options->port : 443;
+    self->max_connections = options->max_connections_per_region ? options->max_connections_per_region
+                                                                : DEFAULT_MAX_CONNECTIONS;
+    self->num_key_ids      = num_key_ids;
+    self->num_grant_tokens = num_grant_tokens;
+    if (aws_mutex_init(&self->mutex)) {
+        aws_mem_release(alloc, self);
+        return NULL;
+    }
+    if (aws_array_list_init_dynamic(&self->endpoints, alloc, 4, sizeof(struct region_endpoint))) {
+        aws_mutex_clean_up(&self->mutex);
+        aws_mem_release(alloc, self);
+        return NULL;
+    }
+    self->credentials_provider = aws_credentials_provider_acquire(options->credentials_provider);
+
+    if (options->tls_ctx) {
+        self->tls_ctx = aws_tls_ctx_acquire(options->tls_ctx);
+    } else {
+        struct aws_tls_ctx_options tls_options;
+        aws_tls_ctx_options_init_default_client(&tls_options, alloc);
+        self->tls_ctx = aws_tls_client_ctx_new(alloc, &tls_options);
+        aws_tls_ctx_options_clean_up(&tls_options);
+        if (!self->tls_ctx) goto err;
+    }
+
+    struct aws_standard_retry_options retry_options = {
+        .backoff_retry_options = { .el_group    = options->bootstrap->event_loop_group,
+                                   .max_retries = options->max_retries ? options->max_retries : DEFAULT_MAX_RETRIES }
+    };
+    if (!(self->retry_strategy = aws_retry_strategy_new_standard(alloc, &retry_options))) goto err;
+
+    if ((options->default_region.len &&
+         !(self->default_region = aws_string_new_from_cursor(alloc, &options->default_region))) ||
+        (options->endpoint.len && !(self->endpoint = aws_string_new_from_cursor(alloc, &options->endpoint)))) {
+        goto err;
+    }
+    if ((num_key_ids && !(self->key_ids = copy_strings(alloc, key_ids, num_key_ids))) ||
+        (num_grant_tokens && !(self->grant_tokens = copy_strings(alloc, grant_tokens, num_grant_tokens)))) {
+        goto err;
+    }
+
+    return &self->base;
+
+err:
+    // Lists which were not copied are empty, so that destroy does not look at them
+    if (!self->key_ids) self->num_key_ids = 0;
+    if (!self->grant_tokens) self->num_grant_tokens = 0;
+    kms_async_keyring_destroy(&self->base);
+    return NULL;
+}
+
+#else  // AWS_CRYPTOSDK_P_HAVE_AWS_C_HTTP
+
+struct aws_cryptosdk_keyring *aws_cryptosdk_kms_async_keyring_new(
+    struct aws_allocator *alloc,
+    const struct aws_cryptosdk_kms_async_keyring_options *options,
+    const struct aws_string *const *key_ids,
+    size_t num_key_ids,
+    const struct aws_string *const *grant_tokens,
+    size_t num_grant_tokens) {
+    (void)alloc;
+    (void)options;
+    (void)key_ids;
+    (void)num_key_ids;
+    (void)grant_tokens;
+    (void)num_grant_tokens;
+    aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    return NULL;
+}
+
+#endif  // AWS_CRYPTOSDK_P_HAVE_AWS_C_HTTP
@@ -15,6 +15,9 @@
 #include <aws/cryptosdk/private/keyring_trace.h>
 
 int aws_cryptosdk_transfer_list(struct aws_array_list *dest, struct aws_array_list *src) {
+    /* Records transferred into a disabled keyring trace stay in src, to be freed with it */
+    if (aws_cryptosdk_keyring_trace_is_disabled(dest)) return AWS_OP_SUCCESS;
+
     size_t src_len = aws_array_list_length(src);
     for (size_t src_idx = 0; src_idx < src_len; ++src_idx) {
         void *item_ptr;
@@ -104,6 +107,7 @@ int aws_cryptosdk_edk_list_copy_all(
 
 int aws_cryptosdk_keyring_trace_copy_all(
     struct aws_allocator *alloc, struct aws_array_list *dest, const struct aws_array_list *src) {
+    if (aws_cryptosdk_keyring_trace_is_disabled(dest)) return AWS_OP_SUCCESS;
     return list_copy_all(
         alloc,
         dest,
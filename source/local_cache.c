@@ -17,17 +17,102 @@
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/list_utils.h>
+#include <aws/cryptosdk/private/alloc_stats.h>
 #include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/coarse_clock.h>
 #include <aws/cryptosdk/private/enc_ctx.h>
+#include <aws/cryptosdk/private/probes.h>
+#include <aws/cryptosdk/private/secure_pool.h>
 
 #include <aws/common/array_list.h>
+#include <aws/common/clock.h>
+#include <aws/common/condition_variable.h>
 #include <aws/common/linked_list.h>
+#include <aws/common/math.h>
 #include <aws/common/mutex.h>
-#include <aws/common/priority_queue.h>
+#include <aws/common/rw_lock.h>
+#include <aws/common/thread.h>
 
 #define CACHE_ID_MD_ALG AWS_CRYPTOSDK_MD_SHA512
-#define TTL_EXPIRATION_BATCH_SIZE 8
+/*
+ * TTLs are tracked in a hashed timer wheel of TTL_WHEEL_SLOTS slots, each covering
+ * TTL_WHEEL_TICK_NS of clock time; a full turn of the wheel is about half a minute. Entries
+ * expiring more than a turn ahead share slots with nearer ones, and are passed over until
+ * their turn comes round.
+ */
+#define TTL_WHEEL_SLOTS 256
+#define TTL_WHEEL_TICK_NS ((uint64_t)1 << 27)
+#define HIT_BUFFER_SLOTS 64
 #define NO_EXPIRY UINT64_MAX
+/* Assumed size of a CPU cache line, for keeping fields written by different threads apart */
+#define CACHE_LINE_SIZE 64
+/* Number of cache IDs whose shards find_entries locks together */
+#define FIND_BATCH 64
+/*
+ * Rough memory held by a parsed signing key (its EC_KEY, EVP_PKEY and their points and bignums),
+ * whose OpenSSL objects cannot be measured; shared with contexts started from it, it is counted once
+ */
+#define SIG_KEY_FOOTPRINT 1024
+/*
+ * The capacity tuner only judges a pass with at least TUNE_MIN_LOOKUPS lookups since the last one
+ * it judged, and grows the cache while at least one in TUNE_GROW_SHARE of those were ghost hits
+ */
+#define TUNE_MIN_LOOKUPS 64
+#define TUNE_GROW_SHARE 32
+/* Removals each shard queues for the removal callback before dropping further ones */
+#define REMOVAL_QUEUE_LIMIT 1024
+/*
+ * Entries are carved from slabs of ENTRY_SLAB_SLOTS slots, each of which also holds the first
+ * ENTRY_ARENA_BYTES of the entry's arena; allocations from an arena are aligned to ARENA_ALIGN
+ */
+#define ENTRY_SLAB_SLOTS 16
+#define ENTRY_ARENA_BYTES 1024
+#define ARENA_ALIGN 16
+
+/*
+ * The entries of one shard which belong to one partition, as hinted by the caching CMM; see
+ * aws_cryptosdk_materials_cache_local_set_partition_quota. A partition is freed along with its
+ * last entry.
+ */
+struct cache_partition {
+    /* The partition ID, which also serves as the partition's key in the shard's table */
+    struct aws_byte_buf id;
+
+    /* Root of a circular LRU list of the partition's entries, in the same order as lru_head */
+    struct aws_linked_list_node lru_head;
+
+    size_t count;
+};
+
+/*
+ * Open-addressing table of the entries of a shard, probed linearly. Each slot keeps the entry's
+ * fingerprint next to the entry pointer, so probing reads consecutive slots of one array and only
+ * compares the full cache ID of an entry whose fingerprint matches. The table only changes size
+ * along with the shard's capacity: it has at least twice as many slots as the shard can hold entries
+ * (counting the one an insertion adds before trimming), so a probe always ends at an empty slot.
+ * Removal shifts later entries of the probe sequence back into the hole, so no tombstones are
+ * needed.
+ */
+/*
+ * A removal queued for the removal callback. The cache ID and partition ID that removal points to
+ * are held, one after the other, in storage.
+ */
+struct removal_event {
+    struct aws_cryptosdk_local_cache_removal removal;
+    struct aws_byte_buf storage;
+};
+
+struct entry_slot {
+    uint64_t fingerprint;
+    struct local_cache_entry *entry;
+};
+
+struct entry_table {
+    struct entry_slot *slots;
+    /* The number of slots, a power of two, minus one */
+    size_t mask;
+    size_t count;
+};
 
 /*
  * An entry in the local cache. This is what the aws_cryptosdk_materials_cache_entry pointers actually
@@ -35,20 +120,56 @@
  */
 struct local_cache_entry {
     /*
+     * Fields written by every hit, from any number of threads at once. They have a cache line to
+     * themselves, so that these writes do not keep evicting the read-mostly fields below from the
+     * caches of other threads looking the entry up. Entries are allocated aligned to a cache line;
+     * see new_entry.
+     *
      * The local_cache_entry is kept allocated until refcount hits zero.
      * To keep it alive while it's referenced in the cache hash table, we consider
      * the hashtable itself to have a reference, and so refcount >= 1 when zombie == false.
      */
     struct aws_atomic_var refcount;
+    struct aws_atomic_var usage_messages, usage_bytes;
+    uint8_t hot_pad[CACHE_LINE_SIZE - (3 * sizeof(struct aws_atomic_var)) % CACHE_LINE_SIZE];
+
+    /*
+     * Fields only written under the shard's write lock, as the entry moves between lists, which
+     * readers never touch; they get the next cache line.
+     *
+     * ttl_node links the entry into the timer wheel slot for its expiry time.
+     * Note: If expiry_time = NO_EXPIRY, then this entry is not part of the timer wheel.
+     *
+     * For LRU purposes, we also include an intrusive circular doubly-linked-list, and the same
+     * again within the entry's partition, if any.
+     */
+    struct aws_linked_list_node ttl_node;
+    struct aws_linked_list_node lru_node;
+    struct cache_partition *partition;
+    struct aws_linked_list_node partition_node;
+    uint8_t locked_pad[CACHE_LINE_SIZE - (3 * sizeof(struct aws_linked_list_node) + sizeof(void *)) % CACHE_LINE_SIZE];
 
-    /* The owning cache */
+    /* The rest is set up on insertion, and from then on mostly read */
+
+    /* The owning cache, and the shard of it which holds this entry */
     struct aws_cryptosdk_local_cache *owner;
+    struct local_cache_shard *shard;
+
+    /*
+     * Allocator for the entry's own copies of its cache ID, materials and encryption context,
+     * which hands out memory from the rest of the entry's slot and then from overflow chunks;
+     * everything it hands out is freed at once along with the entry. See arena_acquire.
+     */
+    struct aws_allocator arena;
+    uint8_t *arena_next, *arena_end;
+    struct arena_chunk *chunks;
+    size_t chunk_bytes;
 
     /*
-     * The cache ID for this entry. Owned by the entry itself, and freed when the entry
-     * becomes a zombie.
+     * The cache ID for this entry. Owned by the entry itself, and freed along with the entry.
      */
     struct aws_byte_buf cache_id;
+    uint64_t fingerprint;
 
     /*
      * expiry_time is NO_EXPIRY if no TTL has been configured
@@ -62,22 +183,19 @@ struct local_cache_entry {
     struct aws_hash_table enc_ctx;
 
     /*
-     * we extract the public or private key out of the enc/dec materials and store it
-     * separately, in order to initialize the signing context later on
+     * we extract the parsed private or public key out of the enc/dec materials and keep it
+     * separately, so that each hit only needs a fresh digest to initialize its signing context
      */
-    struct aws_string *key_materials;
+    struct aws_cryptosdk_sig_key *sig_key;
 
-    struct aws_atomic_var usage_messages, usage_bytes;
+    /* Memory held by the entry, as estimated by entry_footprint when it was inserted */
+    size_t footprint;
 
     /*
-     * Cache entries are organized into a binary heap sorted by (expiration timestamp, thisptr)
-     *
-     * Note: If expiry_time = NO_EXPIRY, then this entry is not part of the heap.
+     * Set by hits under the CLOCK eviction policy, and cleared when the entry is given a second
+     * chance. Hits only write it when it is clear, so it stays read-mostly.
      */
-    struct aws_priority_queue_node heap_node;
-
-    /* For LRU purposes, we also include an intrusive circular doubly-linked-list */
-    struct aws_linked_list_node lru_node;
+    struct aws_atomic_var referenced;
 
     /*
      * After an entry is invalidated, it's possible that one or more references to it
@@ -85,31 +203,34 @@ struct local_cache_entry {
      * flag.
      *
      * When the zombie flag is set:
-     *   * The entry is not in the TTL heap (expiry_time = NO_EXPIRY)
+     *   * The entry is not in the timer wheel (expiry_time = NO_EXPIRY)
      *   * lru_node is not in the LRU list
+     *   * The entry is not in any partition (partition = NULL)
      */
     bool zombie;
 };
 
-struct aws_cryptosdk_local_cache {
-    struct aws_cryptosdk_materials_cache base;
-
+/*
+ * The cache is split into shards, each of which is an independent LRU cache with its own lock and
+ * its own share of the capacity. An entry always lives in the shard selected by its cache ID, so
+ * threads working on different cache IDs rarely contend for the same lock.
+ */
+struct local_cache_shard {
     /*
-     * This mutex protects most cache operations.
-     * In particular, manipulating entries, ttl_heap, or the LRU list requires that
-     * this mutex be held.
+     * This lock protects most operations on the shard.
+     * In particular, manipulating entries, ttl_wheel, or the LRU list requires that
+     * it be held for writing. Cache hits only hold it for reading; see find_entry.
      */
-    struct aws_mutex mutex;
-
-    struct aws_allocator *allocator;
+    struct aws_rw_lock lock;
 
     size_t capacity;
 
-    /* aws_string (hash of request) -> local_cache_entry */
-    struct aws_hash_table entries;
+    /* Cache ID (hash of request) -> local_cache_entry */
+    struct entry_table entries;
 
-    /* Priority queue used to track TTL hints */
-    struct aws_priority_queue ttl_heap;
+    /* Timer wheel used to track TTL hints, and the tick up to which it has been processed */
+    struct aws_linked_list ttl_wheel[TTL_WHEEL_SLOTS];
+    uint64_t ttl_wheel_tick;
 
     /*
      * the root of a _circular_ doubly linked list. lru_head->next is the MOST recently used;
@@ -118,9 +239,106 @@ struct aws_cryptosdk_local_cache {
     struct aws_linked_list_node lru_head;
 
     /*
-     * Time source - overridable in tests
+     * Entries found by readers, in the order they were found, to be moved to the head of the
+     * LRU list by the next writer. Each slot holds a reference to its entry. Readers claim
+     * slots by incrementing hit_count; once all slots are claimed, further hits go unrecorded
+     * until the buffer is applied, so the LRU order is only approximate under heavy load.
+     */
+    struct local_cache_entry *hits[HIT_BUFFER_SLOTS];
+    struct aws_atomic_var hit_count;
+
+    /* Sum of the footprints of the entries in the table, and this shard's share of the byte limit (0 if none) */
+    size_t bytes, byte_limit;
+
+    /* aws_byte_buf (partition ID) -> cache_partition, and this shard's share of the partition quota (0 if none) */
+    struct aws_hash_table partitions;
+    size_t partition_quota;
+
+    /*
+     * While the capacity is tuned automatically, the fingerprints of entries recently evicted to
+     * make room, each kept in the one slot its low-order bits select (NULL otherwise); a miss on
+     * one of these is a ghost hit, which a larger shard would have served. Only written under the
+     * write lock, and read by lookups under the read lock.
+     */
+    uint64_t *ghosts;
+    size_t ghost_mask;
+    struct aws_atomic_var ghost_hits;
+
+    /*
+     * Removals not yet delivered to the removal callback, as struct removal_event, and those
+     * dropped as the queue was full; see deliver_removals
+     */
+    struct aws_array_list removals;
+    uint64_t removals_dropped;
+
+    /*
+     * Counters for aws_cryptosdk_materials_cache_get_stats. Lookups are counted by readers, so
+     * their counters are atomic; the rest are only updated under the write lock.
+     */
+    struct aws_atomic_var encrypt_hits, decrypt_hits, misses;
+    uint64_t encrypt_puts, decrypt_puts;
+    uint64_t capacity_evictions, ttl_evictions, invalidations, replacements, cleared, quota_evictions;
+};
+
+struct aws_cryptosdk_local_cache {
+    struct aws_cryptosdk_materials_cache base;
+
+    struct aws_allocator *allocator;
+
+    struct local_cache_shard *shards;
+    size_t num_shards;
+
+    /* An enum aws_cryptosdk_local_cache_eviction */
+    struct aws_atomic_var eviction;
+
+    /*
+     * Set once a maintenance thread has been started, after which request threads leave TTL
+     * processing to it. The mutex only protects maintenance_stop; the thread sleeps on the
+     * condition variable between passes.
+     */
+    struct aws_atomic_var maintained;
+    struct aws_mutex maintenance_mutex;
+    struct aws_condition_variable maintenance_cond;
+    struct aws_thread maintenance_thread;
+    uint64_t maintenance_interval;
+    bool maintenance_stop;
+
+    /*
+     * Bounds for automatic tuning of the capacity (tune_max is 0 if it is off), and the lookup and
+     * ghost hit counts as of the last pass judged by tune_capacity; all guarded by tuning_mutex
+     */
+    struct aws_mutex tuning_mutex;
+    size_t tune_min, tune_max, tune_byte_ceiling;
+    uint64_t tune_lookups, tune_ghost_hits;
+
+    /*
+     * The removal callback (NULL if none), and the list each shard's queued removals are swapped
+     * into for delivery; guarded by removal_mutex. removals_wanted is set while there is a callback,
+     * as shards only queue removals then.
+     */
+    struct aws_mutex removal_mutex;
+    aws_cryptosdk_local_cache_removal_fn *on_removal;
+    void *removal_user_data;
+    struct aws_array_list delivering;
+    struct aws_atomic_var removals_wanted;
+
+    /* Invalidated entries not yet freed, and total time spent waiting for shard locks */
+    struct aws_atomic_var zombies, lock_wait_ns;
+
+    /*
+     * Slabs of entry slots, and the slots in them not holding an entry; guarded by pool_mutex,
+     * as the last reference to an entry may be released on any thread
+     */
+    struct aws_mutex pool_mutex;
+    struct entry_slab *slabs;
+    struct free_slot *free_slots;
+
+    /*
+     * Time source - overridable in tests; coarse_clock is set while it is the coarse clock, which
+     * the cache then holds
      */
     int (*clock_get_ticks)(uint64_t *timestamp);
+    bool coarse_clock;
 };
 
 /********** General helpers **********/
@@ -128,28 +346,30 @@ struct aws_cryptosdk_local_cache {
 /* Hash and compare functions that operate on struct aws_byte_buf * */
 AWS_CRYPTOSDK_TEST_STATIC uint64_t hash_cache_id(const void *vp_buf);
 static bool eq_cache_id(const void *vp_a, const void *vp_b);
-/* Heap comparator that acts on struct local_cache_entry * */
-static inline int ttl_heap_cmp(const void *vpa, const void *vpb);
 
 /*
- * Note: locked_* functions must be invoked while holding a lock on the cache mutex.
- * It follows that these locked_* functions must not reacquire the mutex, as aws-c-common
- * mutexes are not reentrant.
+ * Note: locked_* functions must be invoked while holding the lock of the shard they are given
+ * for writing. It follows that these locked_* functions must not reacquire the lock, as
+ * aws-c-common locks are not reentrant.
  */
 static void locked_invalidate_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry, bool skip_hash);
+    struct local_cache_shard *shard,
+    struct local_cache_entry *entry,
+    bool skip_hash,
+    enum aws_cryptosdk_local_cache_removal_reason reason);
 static inline void locked_lru_move_to_head(struct aws_linked_list_node *head, struct aws_linked_list_node *entry);
-static int locked_process_ttls(struct aws_cryptosdk_local_cache *cache);
-static bool locked_find_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry **entry, const struct aws_byte_buf *cache_id);
-static int locked_insert_entry(struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry);
-static void locked_release_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry, bool invalidate);
+static int locked_process_ttls(struct aws_cryptosdk_local_cache *cache, struct local_cache_shard *shard);
+static void locked_apply_hits(struct local_cache_shard *shard);
+static int locked_insert_entry(
+    struct aws_cryptosdk_local_cache *cache, struct local_cache_shard *shard, struct local_cache_entry *entry);
+static void locked_trim(
+    struct aws_cryptosdk_local_cache *cache, struct local_cache_shard *shard, struct local_cache_entry *protect);
+static void locked_release_entry(struct local_cache_shard *shard, struct local_cache_entry *entry, bool invalidate);
+static void locked_leave_partition(struct local_cache_shard *shard, struct local_cache_entry *entry);
 
 static struct local_cache_entry *new_entry(
     struct aws_cryptosdk_local_cache *cache, const struct aws_byte_buf *cache_id);
 static void destroy_cache_entry(struct local_cache_entry *entry);
-static void destroy_cache_entry_vp(void *vp_entry);
 static int copy_enc_materials(
     struct aws_allocator *alloc, struct aws_cryptosdk_enc_materials *out, const struct aws_cryptosdk_enc_materials *in);
 
@@ -174,6 +394,21 @@ AWS_CRYPTOSDK_TEST_STATIC uint64_t hash_cache_id(const void *vp_buf) {
     return hash_code;
 }
 
+/*
+ * Selects the shard for a cache ID. The hash of the ID is mixed first, as the hash tables
+ * within each shard use its low-order bits, and cache IDs from CMMs which don't pre-hash
+ * may only vary in a few of its bits.
+ */
+static struct local_cache_shard *shard_for_id(
+    const struct aws_cryptosdk_local_cache *cache, const struct aws_byte_buf *cache_id) {
+    uint64_t mixed = hash_cache_id(cache_id);
+
+    mixed ^= mixed >> 32;
+    mixed *= 0x9E3779B97F4A7C15ull;
+
+    return &cache->shards[(mixed >> 32) % cache->num_shards];
+}
+
 static bool eq_cache_id(const void *vp_a, const void *vp_b) {
     const struct aws_byte_buf *a = vp_a;
     const struct aws_byte_buf *b = vp_b;
@@ -181,29 +416,224 @@ static bool eq_cache_id(const void *vp_a, const void *vp_b) {
     return aws_byte_buf_eq(a, b);
 }
 
-static inline int ttl_heap_cmp(const void *vpa, const void *vpb) {
-    const struct local_cache_entry *const *pa = vpa;
-    const struct local_cache_entry *const *pb = vpb;
+static uint64_t fingerprint_cache_id(const struct aws_byte_buf *cache_id) {
+    uint64_t fingerprint = hash_cache_id(cache_id);
 
-    const struct local_cache_entry *a = *pa;
-    const struct local_cache_entry *b = *pb;
+    /* The MurmurHash3 finalizer, so that the low-order bits used as the table index depend on all the others */
+    fingerprint ^= fingerprint >> 33;
+    fingerprint *= 0xFF51AFD7ED558CCDull;
+    fingerprint ^= fingerprint >> 33;
+    fingerprint *= 0xC4CEB9FE1A85EC53ull;
+    fingerprint ^= fingerprint >> 33;
 
-    if (a == b) {
-        return 0;
-    } else if (a->expiry_time < b->expiry_time) {
-        return -1;
-    } else if (a->expiry_time > b->expiry_time) {
-        return 1;
-    } else if (a < b) {
-        return -1;
-    } else {
-        return 1;
+    return fingerprint;
+}
+
+/* Computes the number of slots a table needs to hold capacity entries, plus one being inserted */
+static int entry_table_slots(size_t capacity, size_t *slots) {
+    *slots = 8;
+
+    while (*slots / 2 < capacity + 1) {
+        if (*slots > SIZE_MAX / 2 / sizeof(struct entry_slot)) {
+            return aws_raise_error(AWS_ERROR_OOM);
+        }
+        *slots *= 2;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int entry_table_init(struct entry_table *table, struct aws_allocator *alloc, size_t capacity) {
+    size_t slots;
+
+    if (entry_table_slots(capacity, &slots)) {
+        return AWS_OP_ERR;
+    }
+
+    if (!(table->slots = aws_mem_calloc(alloc, slots, sizeof(*table->slots)))) {
+        return AWS_OP_ERR;
+    }
+
+    table->mask  = slots - 1;
+    table->count = 0;
+
+    return AWS_OP_SUCCESS;
+}
+
+static struct local_cache_entry *entry_table_find(
+    const struct entry_table *table, const struct aws_byte_buf *cache_id, uint64_t fingerprint) {
+    for (size_t i = fingerprint & table->mask;; i = (i + 1) & table->mask) {
+        const struct entry_slot *slot = &table->slots[i];
+
+        if (!slot->entry) {
+            return NULL;
+        }
+
+        if (slot->fingerprint == fingerprint && aws_byte_buf_eq(&slot->entry->cache_id, cache_id)) {
+            return slot->entry;
+        }
+    }
+}
+
+/* Adds entry to the table, returning the entry with the same cache ID which it replaces, if any */
+static struct local_cache_entry *entry_table_put(struct entry_table *table, struct local_cache_entry *entry) {
+    for (size_t i = entry->fingerprint & table->mask;; i = (i + 1) & table->mask) {
+        struct entry_slot *slot = &table->slots[i];
+
+        if (!slot->entry) {
+            slot->fingerprint = entry->fingerprint;
+            slot->entry       = entry;
+            table->count++;
+            assert(table->count <= table->mask / 2 + 1);
+
+            return NULL;
+        }
+
+        if (slot->fingerprint == entry->fingerprint && aws_byte_buf_eq(&slot->entry->cache_id, &entry->cache_id)) {
+            struct local_cache_entry *old = slot->entry;
+            slot->entry                   = entry;
+
+            return old;
+        }
+    }
+}
+
+/* Moves the entries of the table into a new slot array sized for capacity, which they must fit */
+static int entry_table_resize(struct entry_table *table, struct aws_allocator *alloc, size_t capacity) {
+    struct entry_table resized;
+    size_t slots;
+
+    assert(table->count <= capacity + 1);
+    if (entry_table_slots(capacity, &slots)) {
+        return AWS_OP_ERR;
+    }
+    if (slots == table->mask + 1) {
+        return AWS_OP_SUCCESS;
+    }
+    if (entry_table_init(&resized, alloc, capacity)) {
+        return AWS_OP_ERR;
+    }
+
+    for (size_t i = 0; i <= table->mask; i++) {
+        if (table->slots[i].entry) {
+            entry_table_put(&resized, table->slots[i].entry);
+        }
+    }
+
+    aws_mem_release(alloc, table->slots);
+    *table = resized;
+
+    return AWS_OP_SUCCESS;
+}
+
+static void entry_table_remove(struct entry_table *table, const struct local_cache_entry *entry) {
+    size_t hole = entry->fingerprint & table->mask;
+
+    while (table->slots[hole].entry != entry) {
+        assert(table->slots[hole].entry);
+        hole = (hole + 1) & table->mask;
+    }
+
+    /*
+     * Later entries of the same run move back into the hole, unless that would put them before
+     * the slot they hash to, which they could then no longer be found from
+     */
+    for (size_t i = (hole + 1) & table->mask; table->slots[i].entry; i = (i + 1) & table->mask) {
+        size_t home = table->slots[i].fingerprint & table->mask;
+
+        if (((i - home) & table->mask) >= ((i - hole) & table->mask)) {
+            table->slots[hole] = table->slots[i];
+            hole               = i;
+        }
+    }
+
+    table->slots[hole].entry       = NULL;
+    table->slots[hole].fingerprint = 0;
+    table->count--;
+}
+
+/* Takes a shard lock which could not be taken at once, adding the time spent waiting to the cache's total */
+static int wait_for_lock(
+    struct aws_cryptosdk_local_cache *cache, struct aws_rw_lock *lock, int (*take_lock)(struct aws_rw_lock *lock)) {
+    uint64_t start, end;
+    bool timed = !aws_high_res_clock_get_ticks(&start);
+
+    if (take_lock(lock)) {
+        return AWS_OP_ERR;
+    }
+
+    if (timed && !aws_high_res_clock_get_ticks(&end) && end > start) {
+        aws_atomic_fetch_add_explicit(&cache->lock_wait_ns, (size_t)(end - start), aws_memory_order_relaxed);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Locks a shard for writing or reading. The clock is only read if the lock is contended. */
+static int shard_wlock(struct aws_cryptosdk_local_cache *cache, struct local_cache_shard *shard) {
+    if (!aws_rw_lock_try_wlock(&shard->lock)) {
+        return AWS_OP_SUCCESS;
+    }
+
+    aws_reset_error();
+    return wait_for_lock(cache, &shard->lock, aws_rw_lock_wlock);
+}
+
+static int shard_rlock(struct aws_cryptosdk_local_cache *cache, struct local_cache_shard *shard) {
+    if (!aws_rw_lock_try_rlock(&shard->lock)) {
+        return AWS_OP_SUCCESS;
+    }
+
+    aws_reset_error();
+    return wait_for_lock(cache, &shard->lock, aws_rw_lock_rlock);
+}
+
+/*
+ * Queues the removal of entry for the removal callback. The entry's IDs are copied, as the entry
+ * and its partition may be freed before the removal is delivered. This is best effort: if the
+ * queue is full or the copy cannot be made, the removal is only counted as dropped.
+ */
+static void locked_queue_removal(
+    struct local_cache_shard *shard,
+    const struct local_cache_entry *entry,
+    enum aws_cryptosdk_local_cache_removal_reason reason) {
+    struct aws_byte_cursor partition_id =
+        entry->partition ? aws_byte_cursor_from_buf(&entry->partition->id) : aws_byte_cursor_from_array(NULL, 0);
+    struct removal_event event;
+
+    if (aws_array_list_length(&shard->removals) >= REMOVAL_QUEUE_LIMIT) {
+        shard->removals_dropped++;
+        return;
+    }
+
+    if (aws_byte_buf_init(&event.storage, entry->owner->allocator, entry->cache_id.len + partition_id.len)) {
+        goto err;
+    }
+    aws_byte_buf_write(&event.storage, entry->cache_id.buffer, entry->cache_id.len);
+    aws_byte_buf_write_from_whole_cursor(&event.storage, partition_id);
+
+    uint8_t *ids = event.storage.buffer;
+
+    event.removal.reason       = reason;
+    event.removal.is_encrypt   = entry->enc_materials != NULL;
+    event.removal.cache_id     = aws_byte_cursor_from_array(ids, entry->cache_id.len);
+    event.removal.partition_id = aws_byte_cursor_from_array(ids + entry->cache_id.len, partition_id.len);
+
+    if (aws_array_list_push_back(&shard->removals, &event)) {
+        aws_byte_buf_clean_up(&event.storage);
+        goto err;
     }
+
+    return;
+
+err:
+    shard->removals_dropped++;
+    aws_reset_error();
 }
 
 /**
  * Remove (invalidate) an entry from the cache, if it is not already invalidated.
- * The cache mutex must be held.
+ * The lock of the entry's shard must be held for writing.
  *
  * This may result in entry being deallocated, if the cache's reference is the only one remaining.
  * This function is idempotent, provided that the entry was not actually deallocated.
@@ -211,43 +641,46 @@ static inline int ttl_heap_cmp(const void *vpa, const void *vpb) {
  * This is distinct from locked_clean_entry in that it also removes the references from the
  * hash table and LRU.
  *
- * If skip_hash is true, this function will not actually remove the entry from the hashtable;
- * this is useful when the hashtable is being iterated, or otherwise when the entry will be
- * cleared by some other means.
+ * If skip_hash is true, this function will not actually remove the entry from the hash table;
+ * this is useful when the entry has already been replaced there by another. reason is passed on
+ * to the removal callback, if there is one.
  *
  * Note that the entry may be destroyed upon return, and the cache_id certainly will be
- * freed upon return. As such, if skip_hash is true, the caller must arrange to remove
- * the hash table's reference to the key without performing a lookup.
+ * freed upon return.
  */
 static void locked_invalidate_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry, bool skip_hash) {
-    assert(entry->owner == cache);
+    struct local_cache_shard *shard,
+    struct local_cache_entry *entry,
+    bool skip_hash,
+    enum aws_cryptosdk_local_cache_removal_reason reason) {
+    assert(entry->shard == shard);
 
     if (entry->zombie) {
         return;
     }
 
+    if (aws_atomic_load_int(&entry->owner->removals_wanted)) {
+        locked_queue_removal(shard, entry, reason);
+    }
+
     if (entry->expiry_time != NO_EXPIRY) {
-        void *ignored;
-        aws_priority_queue_remove(&cache->ttl_heap, &ignored, &entry->heap_node);
+        aws_linked_list_remove(&entry->ttl_node);
     }
 
     if (!skip_hash) {
-        struct aws_hash_element element;
-        /*
-         * Note: Because we accept the old value into element, destroy_cache_entry_vp
-         * is not called.
-         */
-        aws_hash_table_remove(&cache->entries, &entry->cache_id, &element, NULL);
-        assert(element.value == entry);
+        entry_table_remove(&shard->entries, entry);
     }
 
     aws_linked_list_remove(&entry->lru_node);
     entry->lru_node.next = entry->lru_node.prev = &entry->lru_node;
     entry->zombie                               = true;
+    locked_leave_partition(shard, entry);
+
+    shard->bytes -= entry->footprint;
+    aws_atomic_fetch_add_explicit(&entry->owner->zombies, 1, aws_memory_order_relaxed);
 
     /* Release the reference count owned by the cache itself */
-    locked_release_entry(entry->owner, entry, false);
+    locked_release_entry(shard, entry, false);
 }
 
 static inline void locked_lru_move_to_head(struct aws_linked_list_node *head, struct aws_linked_list_node *entry) {
@@ -255,77 +688,216 @@ static inline void locked_lru_move_to_head(struct aws_linked_list_node *head, st
     aws_linked_list_insert_after(head, entry);
 }
 
-static int locked_process_ttls(struct aws_cryptosdk_local_cache *cache) {
-    size_t max_items_to_expire = TTL_EXPIRATION_BATCH_SIZE;
+/* Links entry, which must not already be in the wheel, into the slot for its expiry time */
+static void locked_schedule_ttl(struct local_cache_shard *shard, struct local_cache_entry *entry) {
+    uint64_t tick = entry->expiry_time / TTL_WHEEL_TICK_NS;
 
-    void *vp_item;
-    struct local_cache_entry *entry;
+    /* Entries which are already due go in the next slot to be processed */
+    if (tick < shard->ttl_wheel_tick) {
+        tick = shard->ttl_wheel_tick;
+    }
+
+    aws_linked_list_push_back(&shard->ttl_wheel[tick % TTL_WHEEL_SLOTS], &entry->ttl_node);
+}
+
+/* Invalidates the expired entries of one slot of the wheel */
+static void locked_expire_slot(struct local_cache_shard *shard, struct aws_linked_list *slot, uint64_t now) {
+    struct aws_linked_list_node *node = aws_linked_list_begin(slot);
+
+    while (node != aws_linked_list_end(slot)) {
+        struct local_cache_entry *entry = AWS_CONTAINER_OF(node, struct local_cache_entry, ttl_node);
+        node                            = aws_linked_list_next(node);
+
+        if (entry->expiry_time <= now) {
+            shard->ttl_evictions++;
+            AWS_CRYPTOSDK_PROBE2(cache_evict, shard, 1);
+            locked_invalidate_entry(shard, entry, false, AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_EXPIRED);
+        }
+    }
+}
+
+/*
+ * Expires every entry due by now, visiting each slot the clock has passed since the last call;
+ * if the clock has moved on by a whole turn of the wheel or more, every slot once. The slot
+ * holding the current time is visited again on the next call, as its later entries are not yet
+ * due.
+ */
+static int locked_process_ttls(struct aws_cryptosdk_local_cache *cache, struct local_cache_shard *shard) {
     uint64_t now;
 
     if (cache->clock_get_ticks(&now)) {
         return AWS_OP_ERR;
     }
 
-    while (max_items_to_expire-- && aws_priority_queue_size(&cache->ttl_heap) &&
-           !aws_priority_queue_top(&cache->ttl_heap, &vp_item) &&
-           (entry = *(struct local_cache_entry **)vp_item)->expiry_time <= now) {
-        locked_invalidate_entry(cache, entry, false);
+    uint64_t now_tick = now / TTL_WHEEL_TICK_NS;
+    uint64_t tick     = shard->ttl_wheel_tick;
+
+    if (now_tick < tick) {
+        /* The clock went backwards; the current slot may still hold due entries */
+        tick = now_tick;
+    } else if (now_tick - tick >= TTL_WHEEL_SLOTS) {
+        tick = now_tick - (TTL_WHEEL_SLOTS - 1);
+    }
+
+    for (; tick <= now_tick; tick++) {
+        locked_expire_slot(shard, &shard->ttl_wheel[tick % TTL_WHEEL_SLOTS], now);
+    }
+
+    if (now_tick > shard->ttl_wheel_tick) {
+        shard->ttl_wheel_tick = now_tick;
     }
 
     return AWS_OP_SUCCESS;
 }
 
-static bool locked_find_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry **entry, const struct aws_byte_buf *cache_id) {
-    struct aws_hash_element *element;
-
-    locked_process_ttls(cache);
+/*
+ * Moves the entries recorded by readers to the head of the LRU list, in the order they were
+ * found, and releases the buffer's references to them.
+ */
+static void locked_apply_hits(struct local_cache_shard *shard) {
+    size_t count = aws_atomic_load_int(&shard->hit_count);
 
-    if (aws_hash_table_find(&cache->entries, cache_id, &element) || !element) {
-        return false;
+    if (count > HIT_BUFFER_SLOTS) {
+        count = HIT_BUFFER_SLOTS;
     }
 
-    *entry = element->value;
+    for (size_t i = 0; i < count; i++) {
+        struct local_cache_entry *entry = shard->hits[i];
 
-    locked_lru_move_to_head(&cache->lru_head, &(*entry)->lru_node);
+        /* Entries invalidated since they were found are no longer in the LRU list */
+        if (!entry->zombie) {
+            locked_lru_move_to_head(&shard->lru_head, &entry->lru_node);
+            if (entry->partition) {
+                locked_lru_move_to_head(&entry->partition->lru_head, &entry->partition_node);
+            }
+        }
+
+        shard->hits[i] = NULL;
+        locked_release_entry(shard, entry, false);
+    }
 
-    return true;
+    aws_atomic_store_int(&shard->hit_count, 0);
 }
 
-static int locked_insert_entry(struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry) {
-    int was_created = 0;
-    struct aws_hash_element *element;
+static int locked_insert_entry(
+    struct aws_cryptosdk_local_cache *cache, struct local_cache_shard *shard, struct local_cache_entry *entry) {
+    /* An entry which would not fit even in an empty shard is not cached at all */
+    if (shard->byte_limit && entry->footprint > shard->byte_limit) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    locked_apply_hits(shard);
+    if (!aws_atomic_load_int(&cache->maintained)) {
+        locked_process_ttls(cache, shard);
+    }
 
-    locked_process_ttls(cache);
+    struct local_cache_entry *old = entry_table_put(&shard->entries, entry);
 
-    if (aws_hash_table_create(&cache->entries, &entry->cache_id, &element, &was_created)) {
-        return AWS_OP_ERR;
+    if (old) {
+        /* skip_hash = true as the new entry has already taken the old one's place in the table */
+        shard->replacements++;
+        locked_invalidate_entry(shard, old, true, AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_REPLACED);
+    }
+
+    if (entry->enc_materials) {
+        shard->encrypt_puts++;
+    } else {
+        shard->decrypt_puts++;
     }
 
-    if (!was_created) {
-        /* Invalidate the old entry first. skip_hash = true as we'll remove it by replacing the hash value directly */
-        locked_invalidate_entry(cache, element->value, true);
+    aws_linked_list_insert_after(&shard->lru_head, &entry->lru_node);
+    shard->bytes += entry->footprint;
+
+    locked_trim(cache, shard, entry);
+
+    return AWS_OP_SUCCESS;
+}
+
+static bool locked_over_capacity(const struct local_cache_shard *shard) {
+    return shard->entries.count > shard->capacity ||
+           (shard->byte_limit && shard->bytes > shard->byte_limit);
+}
+
+/*
+ * Evicts entries until the shard is within its capacity and byte limit, never evicting protect
+ * (which may be NULL, and must fit within the byte limit by itself)
+ */
+static void locked_trim(
+    struct aws_cryptosdk_local_cache *cache, struct local_cache_shard *shard, struct local_cache_entry *protect) {
+    bool clock = aws_atomic_load_int(&cache->eviction) == AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_CLOCK;
+
+    while (locked_over_capacity(shard)) {
+        assert(shard->lru_head.prev != &shard->lru_head);
+        struct local_cache_entry *victim = AWS_CONTAINER_OF(shard->lru_head.prev, struct local_cache_entry, lru_node);
+
+        /*
+         * Under CLOCK, referenced entries get a second chance at the head of the list. A new
+         * entry always does, as it may come round again once every other entry has had one.
+         */
+        if (clock && (victim == protect || aws_atomic_load_int(&victim->referenced))) {
+            aws_atomic_store_int(&victim->referenced, 0);
+            locked_lru_move_to_head(&shard->lru_head, &victim->lru_node);
+            continue;
+        }
+
+        assert(victim != protect);
+        if (shard->ghosts) {
+            shard->ghosts[victim->fingerprint & shard->ghost_mask] = victim->fingerprint;
+        }
+        shard->capacity_evictions++;
+        AWS_CRYPTOSDK_PROBE2(cache_evict, shard, 0);
+        locked_invalidate_entry(shard, victim, false, AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_CAPACITY);
     }
+}
 
-    /* Update the key pointer in case we're overwriting an existing entry */
-    element->key   = &entry->cache_id;
-    element->value = entry;
+/* Removes entry from its partition's LRU list, if it is in one, freeing the partition once it is empty */
+static void locked_leave_partition(struct local_cache_shard *shard, struct local_cache_entry *entry) {
+    struct cache_partition *partition = entry->partition;
 
-    aws_linked_list_insert_after(&cache->lru_head, &entry->lru_node);
+    if (!partition) {
+        return;
+    }
 
-    while (aws_hash_table_get_entry_count(&cache->entries) > cache->capacity) {
-        assert(cache->lru_head.prev != &cache->lru_head);
-        assert(cache->lru_head.prev != &entry->lru_node);
+    aws_linked_list_remove(&entry->partition_node);
+    entry->partition = NULL;
 
-        locked_invalidate_entry(
-            cache, AWS_CONTAINER_OF(cache->lru_head.prev, struct local_cache_entry, lru_node), false);
+    if (--partition->count == 0) {
+        /* This frees the partition, through destroy_partition_vp */
+        aws_hash_table_remove(&shard->partitions, &partition->id, NULL, NULL);
     }
+}
 
-    return AWS_OP_SUCCESS;
+/*
+ * Evicts the partition's least recently used entries until it is within the shard's share of the
+ * quota, never evicting protect (which may be NULL). This never frees the partition itself, as
+ * the quota is at least one entry.
+ */
+static void locked_trim_partition(
+    struct aws_cryptosdk_local_cache *cache,
+    struct local_cache_shard *shard,
+    struct cache_partition *partition,
+    struct local_cache_entry *protect) {
+    bool clock = aws_atomic_load_int(&cache->eviction) == AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_CLOCK;
+
+    while (shard->partition_quota && partition->count > shard->partition_quota) {
+        struct local_cache_entry *victim =
+            AWS_CONTAINER_OF(partition->lru_head.prev, struct local_cache_entry, partition_node);
+
+        /* As in locked_trim, referenced entries and the new entry get a second chance under CLOCK */
+        if (clock && (victim == protect || aws_atomic_load_int(&victim->referenced))) {
+            aws_atomic_store_int(&victim->referenced, 0);
+            locked_lru_move_to_head(&partition->lru_head, &victim->partition_node);
+            continue;
+        }
+
+        assert(victim != protect);
+        shard->quota_evictions++;
+        AWS_CRYPTOSDK_PROBE2(cache_evict, shard, 2);
+        locked_invalidate_entry(shard, victim, false, AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_QUOTA);
+    }
 }
 
-static void locked_release_entry(
-    struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry, bool invalidate) {
+static void locked_release_entry(struct local_cache_shard *shard, struct local_cache_entry *entry, bool invalidate) {
     /*
      * We must use release memory order here, to guard against a race condition. Consider the following
      * program order:
@@ -370,38 +942,207 @@ static void locked_release_entry(
          * This will recurse back into locked_release_entry to remove the cache's reference
          * (and potentially free the entry)
          */
-        locked_invalidate_entry(cache, entry, false);
+        shard->invalidations++;
+        locked_invalidate_entry(shard, entry, false, AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_INVALIDATED);
     }
 }
 
-static struct local_cache_entry *new_entry(
-    struct aws_cryptosdk_local_cache *cache, const struct aws_byte_buf *cache_id) {
-    uint64_t now;
+/*
+ * Entry slots are ENTRY_SLOT_SIZE bytes: the entry, rounded up to a whole number of cache lines,
+ * then the start of its arena. A slab is a header followed, from the next cache line boundary,
+ * by ENTRY_SLAB_SLOTS slots. Slabs are only freed along with the cache; a slot not holding an
+ * entry is linked into the cache's free list through its first bytes.
+ */
+#define ENTRY_SIZE ((sizeof(struct local_cache_entry) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE)
+#define ENTRY_SLOT_SIZE (ENTRY_SIZE + ENTRY_ARENA_BYTES)
 
-    if (cache->clock_get_ticks(&now)) {
-        return NULL;
-    }
+struct entry_slab {
+    struct entry_slab *next;
+};
 
-    struct local_cache_entry *entry = aws_mem_acquire(cache->allocator, sizeof(*entry));
+struct free_slot {
+    struct free_slot *next;
+};
 
-    if (!entry) {
-        return NULL;
+/* An overflow chunk of an arena; the memory handed out follows the header, from ARENA_HEADER_SIZE */
+struct arena_chunk {
+    struct arena_chunk *next;
+};
+
+#define ARENA_HEADER_SIZE ((sizeof(struct arena_chunk) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+/* Takes a free slot for an entry, carving up a new slab if there is none */
+static struct local_cache_entry *acquire_entry_slot(struct aws_cryptosdk_local_cache *cache) {
+    aws_mutex_lock(&cache->pool_mutex);
+
+    if (!cache->free_slots) {
+        /* Allocators only promise alignment for basic types, so align the slots to a cache line ourselves */
+        struct entry_slab *slab = aws_mem_acquire(
+            cache->allocator, sizeof(*slab) + CACHE_LINE_SIZE - 1 + ENTRY_SLAB_SLOTS * ENTRY_SLOT_SIZE);
+
+        if (slab) {
+            uint8_t *slots = (uint8_t *)(slab + 1);
+            slots += (CACHE_LINE_SIZE - (uintptr_t)slots % CACHE_LINE_SIZE) % CACHE_LINE_SIZE;
+
+            slab->next   = cache->slabs;
+            cache->slabs = slab;
+
+            /* Link the slots in reverse, so that they are handed out in address order */
+            for (size_t i = ENTRY_SLAB_SLOTS; i-- > 0;) {
+                struct free_slot *slot = (struct free_slot *)(slots + i * ENTRY_SLOT_SIZE);
+                slot->next             = cache->free_slots;
+                cache->free_slots      = slot;
+            }
+        }
     }
 
-    memset(entry, 0, sizeof(*entry));
+    struct free_slot *slot = cache->free_slots;
+    if (slot) {
+        cache->free_slots = slot->next;
+    }
 
-    if (aws_byte_buf_init_copy(&entry->cache_id, cache->allocator, cache_id)) {
-        aws_mem_release(cache->allocator, entry);
+    aws_mutex_unlock(&cache->pool_mutex);
+
+    return (struct local_cache_entry *)slot;
+}
+
+static void release_entry_slot(struct aws_cryptosdk_local_cache *cache, struct local_cache_entry *entry) {
+    struct free_slot *slot = (struct free_slot *)entry;
+
+    aws_mutex_lock(&cache->pool_mutex);
+    slot->next        = cache->free_slots;
+    cache->free_slots = slot;
+    aws_mutex_unlock(&cache->pool_mutex);
+}
+
+/*
+ * An entry's arena hands out memory by bumping a pointer, first through the rest of the entry's
+ * slot and then through overflow chunks from the cache's allocator, each at least double the size
+ * of the last. Nothing is freed until the entry is destroyed. Arenas are only used while their entry
+ * is being set up, under its shard's write lock, so they need no locking of their own.
+ */
+static void *arena_acquire(struct aws_allocator *arena, size_t size) {
+    struct local_cache_entry *entry = arena->impl;
+
+    if (size > SIZE_MAX - ARENA_ALIGN) {
+        return NULL;
+    }
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+    if (size > (size_t)(entry->arena_end - entry->arena_next)) {
+        size_t chunk_size = entry->chunk_bytes ? entry->chunk_bytes * 2 : ENTRY_ARENA_BYTES;
+
+        if (chunk_size < size) {
+            chunk_size = size;
+        }
+        if (chunk_size > SIZE_MAX - ARENA_HEADER_SIZE) {
+            return NULL;
+        }
+
+        struct arena_chunk *chunk = aws_mem_acquire(entry->owner->allocator, ARENA_HEADER_SIZE + chunk_size);
+        if (!chunk) {
+            return NULL;
+        }
+
+        chunk->next   = entry->chunks;
+        entry->chunks = chunk;
+        entry->chunk_bytes += chunk_size;
+
+        entry->arena_next = (uint8_t *)chunk + ARENA_HEADER_SIZE;
+        entry->arena_end  = entry->arena_next + chunk_size;
+    }
+
+    void *ptr = entry->arena_next;
+    entry->arena_next += size;
+
+    return ptr;
+}
+
+static void arena_release(struct aws_allocator *arena, void *ptr) {
+    /* Freed along with the entry */
+    (void)arena;
+    (void)ptr;
+}
+
+static void *arena_realloc(struct aws_allocator *arena, void *oldptr, size_t oldsize, size_t newsize) {
+    struct local_cache_entry *entry = arena->impl;
+    size_t old_end                  = (oldsize + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+    if (!oldptr) {
+        return arena_acquire(arena, newsize);
+    }
+    if (newsize <= old_end) {
+        return oldptr;
+    }
+
+    /* The latest allocation grows in place, if there is room, as an array being appended to would */
+    if ((uint8_t *)oldptr + old_end == entry->arena_next && newsize <= SIZE_MAX - ARENA_ALIGN) {
+        size_t new_end = (newsize + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+        if (new_end - old_end <= (size_t)(entry->arena_end - entry->arena_next)) {
+            entry->arena_next += new_end - old_end;
+            return oldptr;
+        }
+    }
+
+    void *newptr = arena_acquire(arena, newsize);
+    if (newptr) {
+        memcpy(newptr, oldptr, oldsize);
+    }
+
+    return newptr;
+}
+
+static void *arena_calloc(struct aws_allocator *arena, size_t num, size_t size) {
+    if (size && num > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void *ptr = arena_acquire(arena, num * size);
+    if (ptr) {
+        memset(ptr, 0, num * size);
+    }
+
+    return ptr;
+}
+
+static struct local_cache_entry *new_entry(
+    struct aws_cryptosdk_local_cache *cache, const struct aws_byte_buf *cache_id) {
+    uint64_t now;
+
+    if (cache->clock_get_ticks(&now)) {
+        return NULL;
+    }
+
+    struct local_cache_entry *entry = acquire_entry_slot(cache);
+    if (!entry) {
+        return NULL;
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->owner             = cache;
+    entry->arena.mem_acquire = arena_acquire;
+    entry->arena.mem_release = arena_release;
+    entry->arena.mem_realloc = arena_realloc;
+    entry->arena.mem_calloc  = arena_calloc;
+    entry->arena.impl        = entry;
+    entry->arena_next        = (uint8_t *)entry + ENTRY_SIZE;
+    entry->arena_end         = entry->arena_next + ENTRY_ARENA_BYTES;
+
+    if (aws_byte_buf_init_copy(&entry->cache_id, &entry->arena, cache_id)) {
+        release_entry_slot(cache, entry);
         return NULL;
     }
 
     aws_atomic_init_int(&entry->refcount, 1);
-    entry->owner = cache;
+    entry->shard       = shard_for_id(cache, cache_id);
+    entry->fingerprint = fingerprint_cache_id(cache_id);
 
     entry->creation_time = now;
     entry->expiry_time   = NO_EXPIRY;
 
     entry->lru_node.next = entry->lru_node.prev = &entry->lru_node;
+    aws_atomic_init_int(&entry->referenced, 0);
 
     return entry;
 }
@@ -411,40 +1152,166 @@ static struct local_cache_entry *new_entry(
  * frees all memory associated with the entry.
  */
 static void destroy_cache_entry(struct local_cache_entry *entry) {
+    if (entry->zombie) {
+        aws_atomic_fetch_sub_explicit(&entry->owner->zombies, 1, aws_memory_order_relaxed);
+    }
+
     aws_cryptosdk_enc_materials_destroy(entry->enc_materials);
     aws_cryptosdk_dec_materials_destroy(entry->dec_materials);
 
     entry->enc_materials = NULL;
     entry->dec_materials = NULL;
 
-    aws_string_destroy_secure(entry->key_materials);
+    aws_cryptosdk_sig_key_destroy(entry->sig_key);
     aws_cryptosdk_enc_ctx_clean_up(&entry->enc_ctx);
 
     aws_byte_buf_clean_up(&entry->cache_id);
 
-    aws_mem_release(entry->owner->allocator, entry);
+    while (entry->chunks) {
+        struct arena_chunk *chunk = entry->chunks;
+        entry->chunks             = chunk->next;
+        aws_mem_release(entry->owner->allocator, chunk);
+    }
+
+    release_entry_slot(entry->owner, entry);
 }
 
-static void destroy_cache_entry_vp(void *vp_entry) {
+/* Frees the table along with every entry still in it */
+static void entry_table_clean_up(struct entry_table *table, struct aws_allocator *alloc) {
+    if (!table->slots) {
+        return;
+    }
+
     /*
-     * We enter this function already holding the cache mutex; because aws-common mutexes are non-reentrant,
-     * and because we're actively manipulating the hash table, we can't safely re-use the release_entry invalidation
-     * logic.
-     *
-     * Instead, we'll just set expiry_time to NO_EXPIRY (the priority queue has already been destroyed) and free
-     * the entry immediately.
+     * We can't safely re-use the release_entry invalidation logic here, as the shard is being torn
+     * down; instead, we'll just free the entries immediately, as the rest of the shard, timer wheel
+     * included, goes along with them.
      */
-    struct local_cache_entry *entry = vp_entry;
+    for (size_t i = 0; i <= table->mask; i++) {
+        if (table->slots[i].entry) {
+            destroy_cache_entry(table->slots[i].entry);
+        }
+    }
+
+    aws_mem_release(alloc, table->slots);
+    table->slots = NULL;
+}
+
+static void destroy_partition_vp(void *vp_partition) {
+    struct cache_partition *partition = vp_partition;
+    struct aws_allocator *alloc       = partition->id.allocator;
+
+    aws_byte_buf_clean_up(&partition->id);
+    aws_mem_release(alloc, partition);
+}
+
+static size_t edks_footprint(const struct aws_array_list *edks) {
+    size_t bytes = edks->current_size;
+
+    for (size_t i = 0; i < aws_array_list_length(edks); i++) {
+        struct aws_cryptosdk_edk *edk;
+        if (!aws_array_list_get_at_ptr(edks, (void **)&edk, i)) {
+            bytes += edk->provider_id.capacity + edk->provider_info.capacity + edk->ciphertext.capacity;
+        }
+    }
 
-    destroy_cache_entry(entry);
+    return bytes;
 }
 
+/*
+ * Estimates the memory held by a fully constructed entry: its slot and the overflow chunks of its
+ * arena, which hold its materials, keyring trace and encryption context, and the data key, EDKs
+ * and signing key held outside them. Allocator overheads are not counted.
+ */
+static size_t entry_footprint(const struct local_cache_entry *entry) {
+    size_t bytes = ENTRY_SLOT_SIZE + entry->chunk_bytes;
+
+    if (entry->sig_key) bytes += SIG_KEY_FOOTPRINT;
+
+    if (entry->enc_materials) {
+        bytes += entry->enc_materials->unencrypted_data_key.capacity +
+                 edks_footprint(&entry->enc_materials->encrypted_data_keys);
+    }
+
+    if (entry->dec_materials) {
+        bytes += entry->dec_materials->unencrypted_data_key.capacity;
+    }
+
+    return bytes;
+}
+
+/*
+ * The EDKs of an encrypt-mode entry live in a single snapshot allocation: an array of EDKs whose
+ * byte buffers are borrowed views into the records which follow it. Materials returned on a hit
+ * borrow the same views and hold a reference to the snapshot, so that a hit makes no per-EDK
+ * allocations, and the EDKs stay valid even if the entry is evicted while a session uses them.
+ * As the views include the records, the header writer copies each EDK out in one piece.
+ */
+struct edk_snapshot {
+    struct aws_cryptosdk_materials_snapshot base;
+    size_t num_edks;
+    struct aws_cryptosdk_edk edks[];
+};
+
+static struct edk_snapshot *snapshot_edks(struct aws_allocator *alloc, const struct aws_array_list *edks) {
+    size_t num_edks = aws_array_list_length(edks);
+    size_t size     = sizeof(struct edk_snapshot) + num_edks * sizeof(struct aws_cryptosdk_edk);
+    struct aws_cryptosdk_edk *edk;
+
+    for (size_t i = 0; i < num_edks; i++) {
+        if (aws_array_list_get_at_ptr(edks, (void **)&edk, i)) {
+            return NULL;
+        }
+        size += aws_cryptosdk_edk_record_size(edk);
+    }
+
+    struct edk_snapshot *snapshot = aws_mem_acquire(alloc, size);
+    if (!snapshot) {
+        return NULL;
+    }
+
+    aws_atomic_init_int(&snapshot->base.refcount, 1);
+    snapshot->base.alloc = alloc;
+    snapshot->num_edks   = num_edks;
+
+    size_t header_size          = sizeof(struct edk_snapshot) + num_edks * sizeof(struct aws_cryptosdk_edk);
+    struct aws_byte_buf records = aws_byte_buf_from_empty_array(&snapshot->edks[num_edks], size - header_size);
+    for (size_t i = 0; i < num_edks; i++) {
+        aws_array_list_get_at_ptr(edks, (void **)&edk, i);
+        if (aws_cryptosdk_edk_write_record(&records, edk)) {
+            aws_mem_release(alloc, snapshot);
+            return NULL;
+        }
+    }
+
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_buf(&records);
+    for (size_t i = 0; i < num_edks; i++) {
+        aws_cryptosdk_edk_init_view(&snapshot->edks[i], &cursor);
+    }
+
+    return snapshot;
+}
+
+/* Appends the snapshot's EDKs to out's (empty) list, and gives out a reference to the snapshot */
+static int share_edks(struct aws_cryptosdk_enc_materials *out, struct edk_snapshot *snapshot) {
+    out->snapshot = aws_cryptosdk_materials_snapshot_retain(&snapshot->base);
+
+    for (size_t i = 0; i < snapshot->num_edks; i++) {
+        if (aws_array_list_push_back(&out->encrypted_data_keys, &snapshot->edks[i])) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Copies everything but the EDKs, which are shared separately */
 static int copy_enc_materials(
     struct aws_allocator *alloc,
     struct aws_cryptosdk_enc_materials *out,
     const struct aws_cryptosdk_enc_materials *in) {
-    if (aws_byte_buf_init_copy(&out->unencrypted_data_key, alloc, &in->unencrypted_data_key) ||
-        aws_cryptosdk_edk_list_copy_all(alloc, &out->encrypted_data_keys, &in->encrypted_data_keys) ||
+    if (aws_byte_buf_init_copy(
+            &out->unencrypted_data_key, aws_cryptosdk_secure_key_allocator(), &in->unencrypted_data_key) ||
         aws_cryptosdk_keyring_trace_copy_all(alloc, &out->keyring_trace, &in->keyring_trace)) {
         return AWS_OP_ERR;
     }
@@ -460,7 +1327,8 @@ static int copy_dec_materials(
     struct aws_allocator *alloc,
     struct aws_cryptosdk_dec_materials *out,
     const struct aws_cryptosdk_dec_materials *in) {
-    if (aws_byte_buf_init_copy(&out->unencrypted_data_key, alloc, &in->unencrypted_data_key) ||
+    if (aws_byte_buf_init_copy(
+            &out->unencrypted_data_key, aws_cryptosdk_secure_key_allocator(), &in->unencrypted_data_key) ||
         aws_cryptosdk_keyring_trace_copy_all(alloc, &out->keyring_trace, &in->keyring_trace)) {
         return AWS_OP_ERR;
     }
@@ -474,65 +1342,458 @@ static int copy_dec_materials(
 
 /********** Local cache vtable methods **********/
 
+/* Frees the IDs held by a list of removal events, leaving the list empty */
+static void free_removals(struct aws_array_list *removals) {
+    for (size_t i = 0; i < aws_array_list_length(removals); i++) {
+        struct removal_event *event;
+
+        if (!aws_array_list_get_at_ptr(removals, (void **)&event, i)) {
+            aws_byte_buf_clean_up(&event->storage);
+        }
+    }
+
+    aws_array_list_clear(removals);
+}
+
+static void clean_up_shards(struct aws_cryptosdk_local_cache *cache, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        /*
+         * The timer wheel is intrusive, so there is nothing to free; entry_table_clean_up frees
+         * all entries in the shard, and destroy_partition_vp all partitions.
+         */
+        entry_table_clean_up(&shard->entries, cache->allocator);
+        if (shard->ghosts) {
+            aws_mem_release(cache->allocator, shard->ghosts);
+        }
+        free_removals(&shard->removals);
+        aws_array_list_clean_up(&shard->removals);
+        aws_hash_table_clean_up(&shard->partitions);
+        aws_rw_lock_clean_up(&shard->lock);
+    }
+}
+
+/* Sizes the shard's ghost table to remember about half its capacity in evicted entries, clearing it if resized */
+static int locked_size_ghosts(struct aws_allocator *alloc, struct local_cache_shard *shard) {
+    size_t slots = 8;
+
+    while (slots < shard->capacity / 2 && slots <= SIZE_MAX / 2 / sizeof(*shard->ghosts)) {
+        slots *= 2;
+    }
+    if (shard->ghosts && slots == shard->ghost_mask + 1) {
+        return AWS_OP_SUCCESS;
+    }
+
+    uint64_t *ghosts = aws_mem_calloc(alloc, slots, sizeof(*ghosts));
+    if (!ghosts) {
+        return AWS_OP_ERR;
+    }
+
+    if (shard->ghosts) {
+        aws_mem_release(alloc, shard->ghosts);
+    }
+    shard->ghosts     = ghosts;
+    shard->ghost_mask = slots - 1;
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Changes the capacity of a shard, evicting entries beyond a lower capacity and regrowing the entry
+ * table for a higher one. If the table cannot be regrown, the capacity is left as it was.
+ */
+static int locked_set_capacity(
+    struct aws_cryptosdk_local_cache *cache, struct local_cache_shard *shard, size_t capacity) {
+    if (capacity > shard->capacity) {
+        if (entry_table_resize(&shard->entries, cache->allocator, capacity)) {
+            return AWS_OP_ERR;
+        }
+        shard->capacity = capacity;
+    } else {
+        shard->capacity = capacity;
+        locked_apply_hits(shard);
+        locked_trim(cache, shard, NULL);
+
+        /* A shrunken shard works as well in its old table, so failing to shrink that is no error */
+        if (entry_table_resize(&shard->entries, cache->allocator, capacity)) {
+            aws_reset_error();
+        }
+    }
+
+    /* Likewise, ghosts only inform tuning, which can make do with the old ones */
+    if (shard->ghosts && locked_size_ghosts(cache->allocator, shard)) {
+        aws_reset_error();
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Divides capacity between the shards as the constructor does, leaving each at least two entries */
+static int resize_cache(struct aws_cryptosdk_local_cache *cache, size_t capacity) {
+    if (capacity < 2 * cache->num_shards) {
+        capacity = 2 * cache->num_shards;
+    }
+
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (shard_wlock(cache, shard)) {
+            return AWS_OP_ERR;
+        }
+
+        int rv = locked_set_capacity(cache, shard, capacity / cache->num_shards + (i < capacity % cache->num_shards));
+
+        if (aws_rw_lock_wunlock(&shard->lock)) {
+            abort();
+        }
+        if (rv) {
+            return AWS_OP_ERR;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * One pass of the capacity tuner. Ghost hits are lookups a larger cache would have served: while
+ * they make up a significant share of the lookups since the last pass, the capacity grows by a
+ * quarter. When a pass sees none, and less than half the capacity is in use, it shrinks by a
+ * quarter. Either way it stays within the configured bounds, and within the byte ceiling at the
+ * average footprint of the entries now held.
+ */
+static int tune_capacity(struct aws_cryptosdk_local_cache *cache) {
+    uint64_t lookups = 0, ghost_hits = 0;
+    size_t capacity  = 0, entries = 0, bytes = 0;
+    int rv           = AWS_OP_SUCCESS;
+
+    aws_mutex_lock(&cache->tuning_mutex);
+    if (!cache->tune_max) {
+        goto out;
+    }
+
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (shard_rlock(cache, shard)) {
+            rv = AWS_OP_ERR;
+            goto out;
+        }
+
+        lookups += aws_atomic_load_int(&shard->encrypt_hits) + aws_atomic_load_int(&shard->decrypt_hits) +
+                   aws_atomic_load_int(&shard->misses);
+        ghost_hits += aws_atomic_load_int(&shard->ghost_hits);
+        capacity += shard->capacity;
+        entries += shard->entries.count;
+        bytes += shard->bytes;
+
+        if (aws_rw_lock_runlock(&shard->lock)) {
+            abort();
+        }
+    }
+
+    /* With too few lookups to judge by, they carry over to the next pass */
+    if (lookups - cache->tune_lookups < TUNE_MIN_LOOKUPS) {
+        goto out;
+    }
+
+    uint64_t recent_lookups = lookups - cache->tune_lookups;
+    uint64_t recent_ghosts  = ghost_hits - cache->tune_ghost_hits;
+    size_t target           = capacity;
+
+    cache->tune_lookups    = lookups;
+    cache->tune_ghost_hits = ghost_hits;
+
+    if (recent_ghosts * TUNE_GROW_SHARE >= recent_lookups) {
+        target = capacity + capacity / 4 > capacity ? capacity + capacity / 4 : SIZE_MAX;
+    } else if (!recent_ghosts && entries < capacity / 2) {
+        target = capacity - capacity / 4;
+    }
+
+    if (cache->tune_byte_ceiling && entries) {
+        size_t average = bytes / entries ? bytes / entries : 1;
+
+        if (target > cache->tune_byte_ceiling / average) {
+            target = cache->tune_byte_ceiling / average;
+        }
+    }
+    if (target > cache->tune_max) {
+        target = cache->tune_max;
+    }
+    if (target < cache->tune_min) {
+        target = cache->tune_min;
+    }
+
+    if (target != capacity) {
+        AWS_CRYPTOSDK_PROBE2(cache_resize, cache, target);
+        rv = resize_cache(cache, target);
+    }
+
+out:
+    aws_mutex_unlock(&cache->tuning_mutex);
+    return rv;
+}
+
+/*
+ * Delivers the removals each shard has queued to the removal callback, or discards them if there
+ * is none. Each shard's queue is swapped out under its lock, and the callback is only called once
+ * the lock is released, so it may use the cache, and takes no time from threads looking entries up.
+ */
+static int deliver_removals(struct aws_cryptosdk_local_cache *cache) {
+    int rv = AWS_OP_SUCCESS;
+
+    aws_mutex_lock(&cache->removal_mutex);
+
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (shard_wlock(cache, shard)) {
+            rv = AWS_OP_ERR;
+            break;
+        }
+
+        aws_array_list_swap_contents(&shard->removals, &cache->delivering);
+
+        if (aws_rw_lock_wunlock(&shard->lock)) {
+            abort();
+        }
+
+        for (size_t j = 0; cache->on_removal && j < aws_array_list_length(&cache->delivering); j++) {
+            struct removal_event *event;
+
+            if (!aws_array_list_get_at_ptr(&cache->delivering, (void **)&event, j)) {
+                cache->on_removal(&event->removal, cache->removal_user_data);
+            }
+        }
+        free_removals(&cache->delivering);
+    }
+
+    aws_mutex_unlock(&cache->removal_mutex);
+
+    return rv;
+}
+
+/* One pass of the maintenance thread over every shard */
+static void maintain_cache(struct aws_cryptosdk_local_cache *cache) {
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (shard_wlock(cache, shard)) {
+            continue;
+        }
+
+        locked_apply_hits(shard);
+        locked_process_ttls(cache, shard);
+        locked_trim(cache, shard, NULL);
+
+        if (aws_rw_lock_wunlock(&shard->lock)) {
+            abort();
+        }
+    }
+
+    /* Tuning and delivery are best effort; the next pass tries again */
+    if (tune_capacity(cache)) {
+        aws_reset_error();
+    }
+    if (aws_atomic_load_int(&cache->removals_wanted) && deliver_removals(cache)) {
+        aws_reset_error();
+    }
+}
+
+static void run_maintenance(void *arg) {
+    struct aws_cryptosdk_local_cache *cache = arg;
+
+    aws_mutex_lock(&cache->maintenance_mutex);
+    while (!cache->maintenance_stop) {
+        /* Timeouts and spurious wakeups alike just bring the next pass forward */
+        aws_condition_variable_wait_for(
+            &cache->maintenance_cond, &cache->maintenance_mutex, (int64_t)cache->maintenance_interval);
+        if (cache->maintenance_stop) break;
+
+        aws_mutex_unlock(&cache->maintenance_mutex);
+        maintain_cache(cache);
+        aws_mutex_lock(&cache->maintenance_mutex);
+    }
+    aws_mutex_unlock(&cache->maintenance_mutex);
+}
+
+static void stop_maintenance(struct aws_cryptosdk_local_cache *cache) {
+    aws_mutex_lock(&cache->maintenance_mutex);
+    cache->maintenance_stop = true;
+    aws_condition_variable_notify_all(&cache->maintenance_cond);
+    aws_mutex_unlock(&cache->maintenance_mutex);
+
+    aws_thread_join(&cache->maintenance_thread);
+    aws_thread_clean_up(&cache->maintenance_thread);
+    aws_condition_variable_clean_up(&cache->maintenance_cond);
+    aws_mutex_clean_up(&cache->maintenance_mutex);
+}
+
+/* Frees every slab of entry slots, along with the pool's mutex, once no entries are left */
+static void free_slabs(struct aws_cryptosdk_local_cache *cache) {
+    while (cache->slabs) {
+        struct entry_slab *slab = cache->slabs;
+        cache->slabs            = slab->next;
+        aws_mem_release(cache->allocator, slab);
+    }
+
+    cache->free_slots = NULL;
+    aws_mutex_clean_up(&cache->pool_mutex);
+}
+
 static void destroy_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
     struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
 
-    /* No need to take a lock - we're the only thread with a reference now */
+    if (aws_atomic_load_int(&cache->maintained)) {
+        stop_maintenance(cache);
+    }
 
-    /*
-     * Destroy the pqueue first - when we destroy the hash table, destroy_cache_entry_vp will
-     * free all entries in the cache, and so we want to make sure the pqueue references to
-     * local_cache_entry->heap_node are no longer usable first.
-     */
-    aws_priority_queue_clean_up(&cache->ttl_heap);
-    aws_hash_table_clean_up(&cache->entries);
-    aws_mutex_clean_up(&cache->mutex);
+    /* No need to take a lock - we're the only thread with a reference now */
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        /* The hit buffers' references must go before the hash tables free the entries outright */
+        locked_apply_hits(&cache->shards[i]);
+    }
+    clean_up_shards(cache, cache->num_shards);
+    free_slabs(cache);
+    aws_array_list_clean_up(&cache->delivering);
+    aws_mutex_clean_up(&cache->removal_mutex);
+    aws_mutex_clean_up(&cache->tuning_mutex);
 
+    if (cache->coarse_clock) {
+        aws_cryptosdk_priv_coarse_clock_release();
+    }
+    aws_mem_release(cache->allocator, cache->shards);
     aws_mem_release(cache->allocator, cache);
 }
 
 static size_t entry_count(const struct aws_cryptosdk_materials_cache *generic_cache) {
-    // Removing const so we can lock the cache mutex
+    // Removing const so we can lock the shards
     struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+    size_t entry_count                      = 0;
 
-    if (aws_mutex_lock(&cache->mutex)) {
-        return SIZE_MAX;
-    }
+    /* Shards are counted one at a time, so this is only a snapshot if nothing else uses the cache */
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
 
-    size_t entry_count = aws_hash_table_get_entry_count(&cache->entries);
+        if (shard_rlock(cache, shard)) {
+            return SIZE_MAX;
+        }
 
-    if (aws_mutex_unlock(&cache->mutex)) {
-        abort();
+        entry_count += shard->entries.count;
+
+        if (aws_rw_lock_runlock(&shard->lock)) {
+            abort();
+        }
     }
 
     return entry_count;
 }
 
+/*
+ * Looks up a cache ID with its shard's read lock held. Lookups only read the shard, so hits on
+ * any number of threads proceed in parallel. Rather than moving the entry to the head of the LRU
+ * list, we record the hit in the shard's buffer for the next writer to apply, or under CLOCK just
+ * set the entry's reference bit; *hit_slot receives the buffer slot taken, if any. Expired entries
+ * are treated as missing, and are removed by the next writer to process the shard's TTLs.
+ */
+static struct local_cache_entry *locked_find(
+    struct aws_cryptosdk_local_cache *cache,
+    struct local_cache_shard *shard,
+    const struct aws_byte_buf *cache_id,
+    uint64_t fingerprint,
+    uint64_t now,
+    size_t *hit_slot) {
+    struct local_cache_entry *local_entry = entry_table_find(&shard->entries, cache_id, fingerprint);
+
+    *hit_slot = 0;
+    if (!local_entry) {
+        if (shard->ghosts && shard->ghosts[fingerprint & shard->ghost_mask] == fingerprint) {
+            aws_atomic_fetch_add_explicit(&shard->ghost_hits, 1, aws_memory_order_relaxed);
+        }
+        return NULL;
+    }
+    if (local_entry->expiry_time <= now) {
+        return NULL;
+    }
+
+    /* The table's reference keeps the entry alive while we hold the lock */
+    aws_atomic_fetch_add_explicit(&local_entry->refcount, 1, aws_memory_order_relaxed);
+
+    if (aws_atomic_load_int(&cache->eviction) == AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_CLOCK) {
+        /* Only write the bit if needed, so that hot entries' cache lines stay shared */
+        if (!aws_atomic_load_int(&local_entry->referenced)) {
+            aws_atomic_store_int(&local_entry->referenced, 1);
+        }
+    } else if ((*hit_slot = aws_atomic_fetch_add(&shard->hit_count, 1)) < HIT_BUFFER_SLOTS) {
+        aws_atomic_fetch_add_explicit(&local_entry->refcount, 1, aws_memory_order_relaxed);
+        shard->hits[*hit_slot] = local_entry;
+    }
+
+    return local_entry;
+}
+
+/* Counts a lookup made by locked_find, once the shard's lock is released */
+static void finish_find(struct local_cache_shard *shard, const struct local_cache_entry *local_entry, size_t hit_slot) {
+    if (!local_entry) {
+        AWS_CRYPTOSDK_PROBE1(cache_miss, shard);
+        aws_atomic_fetch_add_explicit(&shard->misses, 1, aws_memory_order_relaxed);
+    } else if (local_entry->enc_materials) {
+        AWS_CRYPTOSDK_PROBE2(cache_hit, shard, 1);
+        aws_atomic_fetch_add_explicit(&shard->encrypt_hits, 1, aws_memory_order_relaxed);
+    } else {
+        AWS_CRYPTOSDK_PROBE2(cache_hit, shard, 0);
+        aws_atomic_fetch_add_explicit(&shard->decrypt_hits, 1, aws_memory_order_relaxed);
+    }
+
+    /* The thread that fills the buffer applies it, unless a writer is already busy */
+    if (hit_slot == HIT_BUFFER_SLOTS - 1) {
+        if (!aws_rw_lock_try_wlock(&shard->lock)) {
+            locked_apply_hits(shard);
+
+            if (aws_rw_lock_wunlock(&shard->lock)) {
+                abort();
+            }
+        } else {
+            aws_reset_error();
+        }
+    }
+}
+
 static int find_entry(
     struct aws_cryptosdk_materials_cache *generic_cache,
     struct aws_cryptosdk_materials_cache_entry **entry,
     bool *is_encrypt,
     const struct aws_byte_buf *cache_id) {
     struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+    struct local_cache_shard *shard         = shard_for_id(cache, cache_id);
+    uint64_t fingerprint                    = fingerprint_cache_id(cache_id);
+    size_t hit_slot                         = 0;
+    uint64_t now                            = 0;
 
     *entry = NULL;
 
-    if (aws_mutex_lock(&cache->mutex)) {
+    /* If the clock is broken, entries just don't expire here */
+    if (cache->clock_get_ticks(&now)) {
+        now = 0;
+    }
+
+    if (shard_rlock(cache, shard)) {
         return AWS_OP_ERR;
     }
 
-    struct local_cache_entry *local_entry;
-    if (locked_find_entry(cache, &local_entry, cache_id)) {
-        aws_atomic_fetch_add_explicit(&local_entry->refcount, 1, aws_memory_order_relaxed);
+    struct local_cache_entry *local_entry = locked_find(cache, shard, cache_id, fingerprint, now, &hit_slot);
+
+    if (aws_rw_lock_runlock(&shard->lock)) {
+        abort();
+    }
+
+    if (local_entry) {
         *entry = (struct aws_cryptosdk_materials_cache_entry *)local_entry;
         if (is_encrypt) {
             *is_encrypt = (local_entry->enc_materials != NULL);
         }
     }
-
-    if (aws_mutex_unlock(&cache->mutex)) {
-        abort();
-    }
+    finish_find(shard, local_entry, hit_slot);
 
     return AWS_OP_SUCCESS;
 }
@@ -556,6 +1817,23 @@ static int update_usage_stats(
     return AWS_OP_SUCCESS;
 }
 
+static int return_usage_stats(
+    struct aws_cryptosdk_materials_cache *cache,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    const struct aws_cryptosdk_cache_usage_stats *usage_stats) {
+    (void)cache;
+    struct local_cache_entry *local_entry = (struct local_cache_entry *)entry;
+
+    if (local_entry->zombie || !local_entry->enc_materials) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    aws_atomic_fetch_sub(&local_entry->usage_bytes, usage_stats->bytes_encrypted);
+    aws_atomic_fetch_sub(&local_entry->usage_messages, usage_stats->messages_encrypted);
+
+    return AWS_OP_SUCCESS;
+}
+
 static int get_enc_materials(
     struct aws_cryptosdk_materials_cache *cache,
     struct aws_allocator *allocator,
@@ -575,7 +1853,8 @@ static int get_enc_materials(
         return AWS_OP_ERR;
     }
 
-    if (copy_enc_materials(allocator, materials, local_entry->enc_materials)) {
+    if (copy_enc_materials(allocator, materials, local_entry->enc_materials) ||
+        share_edks(materials, (struct edk_snapshot *)local_entry->enc_materials->snapshot)) {
         goto out;
     }
 
@@ -583,12 +1862,8 @@ static int get_enc_materials(
         goto out;
     }
 
-    if (local_entry->key_materials && aws_cryptosdk_sig_sign_start(
-                                          &materials->signctx,
-                                          allocator,
-                                          NULL,
-                                          aws_cryptosdk_alg_props(materials->alg),
-                                          local_entry->key_materials)) {
+    if (local_entry->sig_key &&
+        aws_cryptosdk_sig_start_from_key(&materials->signctx, allocator, local_entry->sig_key)) {
         goto out;
     }
 
@@ -621,9 +1896,8 @@ static int get_dec_materials(
         goto out;
     }
 
-    if (local_entry->key_materials &&
-        aws_cryptosdk_sig_verify_start(
-            &materials->signctx, allocator, local_entry->key_materials, aws_cryptosdk_alg_props(materials->alg))) {
+    if (local_entry->sig_key &&
+        aws_cryptosdk_sig_start_from_key(&materials->signctx, allocator, local_entry->sig_key)) {
         goto out;
     }
 
@@ -643,9 +1917,10 @@ static void put_entry_for_encrypt(
     const struct aws_hash_table *enc_ctx,
     const struct aws_byte_buf *cache_id) {
     struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+    struct local_cache_shard *shard         = shard_for_id(cache, cache_id);
     *ret_entry                              = NULL;
 
-    if (aws_mutex_lock(&cache->mutex)) {
+    if (shard_wlock(cache, shard)) {
         return;
     }
 
@@ -657,29 +1932,42 @@ static void put_entry_for_encrypt(
     aws_atomic_init_int(&entry->usage_bytes, initial_usage.bytes_encrypted);
     aws_atomic_init_int(&entry->usage_messages, initial_usage.messages_encrypted);
 
-    if (!(entry->enc_materials = aws_cryptosdk_enc_materials_new(cache->allocator, materials->alg))) {
+    if (!(entry->enc_materials = aws_cryptosdk_enc_materials_new(&entry->arena, materials->alg))) {
+        goto out;
+    }
+
+    if (copy_enc_materials(&entry->arena, entry->enc_materials, materials)) {
+        goto out;
+    }
+
+    struct edk_snapshot *snapshot = snapshot_edks(cache->allocator, &materials->encrypted_data_keys);
+    if (!snapshot) {
         goto out;
     }
 
-    if (copy_enc_materials(cache->allocator, entry->enc_materials, materials)) {
+    /* From here on the entry holds the only reference */
+    int shared = share_edks(entry->enc_materials, snapshot);
+    aws_cryptosdk_materials_snapshot_release(&snapshot->base);
+    if (shared) {
         goto out;
     }
 
-    if (aws_cryptosdk_enc_ctx_init(cache->allocator, &entry->enc_ctx)) {
+    if (aws_cryptosdk_enc_ctx_init(&entry->arena, &entry->enc_ctx)) {
         goto out;
     }
 
-    if (aws_cryptosdk_enc_ctx_clone(cache->allocator, &entry->enc_ctx, enc_ctx)) {
+    if (aws_cryptosdk_enc_ctx_clone(&entry->arena, &entry->enc_ctx, enc_ctx)) {
         goto out;
     }
 
     if (materials->signctx) {
-        if (aws_cryptosdk_sig_get_privkey(materials->signctx, cache->allocator, &entry->key_materials)) {
+        if (aws_cryptosdk_sig_get_key(materials->signctx, cache->allocator, &entry->sig_key)) {
             goto out;
         }
     }
 
-    if (!locked_insert_entry(cache, entry)) {
+    entry->footprint = entry_footprint(entry);
+    if (!locked_insert_entry(cache, shard, entry)) {
         /* Prevent the entry from being freed - and prepare to return it */
         *ret_entry = (struct aws_cryptosdk_materials_cache_entry *)entry;
         aws_atomic_fetch_add_explicit(&entry->refcount, 1, aws_memory_order_acq_rel);
@@ -694,7 +1982,7 @@ out:
         destroy_cache_entry(entry);
     }
 
-    if (aws_mutex_unlock(&cache->mutex)) {
+    if (aws_rw_lock_wunlock(&shard->lock)) {
         abort();
     }
 }
@@ -705,9 +1993,10 @@ static void put_entry_for_decrypt(
     const struct aws_cryptosdk_dec_materials *materials,
     const struct aws_byte_buf *cache_id) {
     struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+    struct local_cache_shard *shard         = shard_for_id(cache, cache_id);
     *ret_entry                              = NULL;
 
-    if (aws_mutex_lock(&cache->mutex)) {
+    if (shard_wlock(cache, shard)) {
         return;
     }
 
@@ -719,21 +2008,22 @@ static void put_entry_for_decrypt(
     aws_atomic_init_int(&entry->usage_bytes, 0);
     aws_atomic_init_int(&entry->usage_messages, 0);
 
-    if (!(entry->dec_materials = aws_cryptosdk_dec_materials_new(cache->allocator, materials->alg))) {
+    if (!(entry->dec_materials = aws_cryptosdk_dec_materials_new(&entry->arena, materials->alg))) {
         goto out;
     }
 
-    if (copy_dec_materials(cache->allocator, entry->dec_materials, materials)) {
+    if (copy_dec_materials(&entry->arena, entry->dec_materials, materials)) {
         goto out;
     }
 
     if (materials->signctx) {
-        if (aws_cryptosdk_sig_get_pubkey(materials->signctx, cache->allocator, &entry->key_materials)) {
+        if (aws_cryptosdk_sig_get_key(materials->signctx, cache->allocator, &entry->sig_key)) {
             goto out;
         }
     }
 
-    if (!locked_insert_entry(cache, entry)) {
+    entry->footprint = entry_footprint(entry);
+    if (!locked_insert_entry(cache, shard, entry)) {
         /* Prevent the entry from being freed - and prepare to return it */
         *ret_entry = (struct aws_cryptosdk_materials_cache_entry *)entry;
         aws_atomic_fetch_add_explicit(&entry->refcount, 1, aws_memory_order_acq_rel);
@@ -748,7 +2038,7 @@ out:
         destroy_cache_entry(entry);
     }
 
-    if (aws_mutex_unlock(&cache->mutex)) {
+    if (aws_rw_lock_wunlock(&shard->lock)) {
         abort();
     }
 }
@@ -770,6 +2060,7 @@ static void set_expiration_hint(
     uint64_t expiry_time) {
     struct local_cache_entry *entry         = (struct local_cache_entry *)generic_entry;
     struct aws_cryptosdk_local_cache *cache = entry->owner;
+    struct local_cache_shard *shard         = entry->shard;
     assert(&cache->base == generic_cache);
     (void)generic_cache;
 
@@ -781,7 +2072,7 @@ static void set_expiration_hint(
         return;
     }
 
-    if (aws_mutex_lock(&cache->mutex)) {
+    if (shard_wlock(cache, shard)) {
         return;
     }
 
@@ -793,28 +2084,77 @@ static void set_expiration_hint(
     }
 
     if (entry->expiry_time < NO_EXPIRY) {
-        void *ignored;
-        /* Remove from the heap before we muck with the heap order */
-        int rv = aws_priority_queue_remove(&cache->ttl_heap, &ignored, &entry->heap_node);
-        assert(!rv);
-        /* Suppress unused rv warnings when NDEBUG is set */
-        (void)rv;
+        aws_linked_list_remove(&entry->ttl_node);
     }
 
     entry->expiry_time = expiry_time;
-    void *vp_entry     = entry;
-    if (aws_priority_queue_push_ref(&cache->ttl_heap, &vp_entry, &entry->heap_node)) {
-        /* Heap insertion failed - should be impossible, but deal with it anyway */
-        entry->expiry_time = NO_EXPIRY;
-    }
+    locked_schedule_ttl(shard, entry);
 
 out:
-    if (aws_mutex_unlock(&cache->mutex)) {
+    if (aws_rw_lock_wunlock(&shard->lock)) {
         /* Failed to release a lock - no recovery is possible */
         abort();
     }
 }
 
+static void set_partition_hint(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    const struct aws_byte_buf *partition_id) {
+    struct local_cache_entry *entry         = (struct local_cache_entry *)generic_entry;
+    struct aws_cryptosdk_local_cache *cache = entry->owner;
+    struct local_cache_shard *shard         = entry->shard;
+    struct aws_hash_element *element        = NULL;
+    struct cache_partition *partition;
+    assert(&cache->base == generic_cache);
+    (void)generic_cache;
+
+    if (shard_wlock(cache, shard)) {
+        return;
+    }
+
+    /* Entries only ever join one partition */
+    if (entry->zombie || entry->partition) {
+        goto out;
+    }
+
+    if (aws_hash_table_find(&shard->partitions, partition_id, &element)) {
+        goto out;
+    }
+
+    if (element) {
+        partition = element->value;
+    } else {
+        if (!(partition = aws_mem_acquire(cache->allocator, sizeof(*partition)))) {
+            goto out;
+        }
+
+        if (aws_byte_buf_init_copy(&partition->id, cache->allocator, partition_id)) {
+            aws_mem_release(cache->allocator, partition);
+            goto out;
+        }
+
+        partition->lru_head.next = partition->lru_head.prev = &partition->lru_head;
+        partition->count                                    = 0;
+
+        if (aws_hash_table_put(&shard->partitions, &partition->id, partition, NULL)) {
+            destroy_partition_vp(partition);
+            goto out;
+        }
+    }
+
+    entry->partition = partition;
+    aws_linked_list_insert_after(&partition->lru_head, &entry->partition_node);
+    partition->count++;
+
+    locked_trim_partition(cache, shard, partition, entry);
+
+out:
+    if (aws_rw_lock_wunlock(&shard->lock)) {
+        abort();
+    }
+}
+
 static void release_entry(
     struct aws_cryptosdk_materials_cache *generic_cache,
     struct aws_cryptosdk_materials_cache_entry *generic_entry,
@@ -829,18 +2169,21 @@ static void release_entry(
     assert(entry->owner == cache);
 
     if (invalidate && !entry->zombie) {
-        if (aws_mutex_lock(&cache->mutex)) {
+        /* The entry may be freed before we unlock */
+        struct local_cache_shard *shard = entry->shard;
+
+        if (shard_wlock(cache, shard)) {
             /*
-             * If we failed to lock the mutex, we'll end up leaking the entry.
+             * If we failed to take the lock, we'll end up leaking the entry.
              * There's no meaningful recovery we can do, so just let it happen.
              */
             return;
         }
 
         /* This call will re-check the entry->zombie flag */
-        locked_release_entry(cache, entry, invalidate);
+        locked_release_entry(shard, entry, invalidate);
 
-        if (aws_mutex_unlock(&cache->mutex)) {
+        if (aws_rw_lock_wunlock(&shard->lock)) {
             abort();
         }
 
@@ -868,27 +2211,178 @@ static void release_entry(
 static void clear_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
     struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
 
-    if (aws_mutex_lock(&cache->mutex)) {
-        return;
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (shard_wlock(cache, shard)) {
+            return;
+        }
+
+        locked_apply_hits(shard);
+
+        /* Every entry in the table is also in the LRU list, which invalidation unlinks it from */
+        while (shard->lru_head.next != &shard->lru_head) {
+            struct local_cache_entry *entry =
+                AWS_CONTAINER_OF(shard->lru_head.next, struct local_cache_entry, lru_node);
+
+            shard->cleared++;
+            locked_invalidate_entry(shard, entry, false, AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_CLEARED);
+        }
+
+        if (aws_rw_lock_wunlock(&shard->lock)) {
+            abort();
+        }
     }
+}
 
-    for (struct aws_hash_iter iter = aws_hash_iter_begin(&cache->entries); !aws_hash_iter_done(&iter);
-         aws_hash_iter_next(&iter)) {
-        struct local_cache_entry *entry = iter.element.value;
+static int invalidate_partition(
+    struct aws_cryptosdk_materials_cache *generic_cache, const struct aws_byte_buf *partition_id) {
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
 
-        /*
-         * Don't delete from the entries table from within invalidate,
-         * as this would interfere with our iterator. Instead delete via the
-         * iterator.
-         */
-        locked_invalidate_entry(cache, entry, true);
+    /* A partition's entries may be in any shard, but each shard indexes its own by partition */
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard  = &cache->shards[i];
+        struct aws_hash_element *element = NULL;
+
+        if (shard_wlock(cache, shard)) {
+            return AWS_OP_ERR;
+        }
+
+        locked_apply_hits(shard);
 
-        aws_hash_iter_delete(&iter, false);
+        if (!aws_hash_table_find(&shard->partitions, partition_id, &element) && element) {
+            struct cache_partition *partition = element->value;
+
+            /* The partition is freed along with its last entry, so count down rather than walk the list */
+            for (size_t remaining = partition->count; remaining; remaining--) {
+                struct local_cache_entry *entry =
+                    AWS_CONTAINER_OF(partition->lru_head.next, struct local_cache_entry, partition_node);
+
+                shard->cleared++;
+                locked_invalidate_entry(shard, entry, false, AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_CLEARED);
+            }
+        }
+
+        if (aws_rw_lock_wunlock(&shard->lock)) {
+            abort();
+        }
     }
 
-    if (aws_mutex_unlock(&cache->mutex)) {
-        abort();
+    return AWS_OP_SUCCESS;
+}
+
+static int get_stats(
+    const struct aws_cryptosdk_materials_cache *generic_cache, struct aws_cryptosdk_materials_cache_stats *stats) {
+    // Removing const so we can lock the shards
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (shard_rlock(cache, shard)) {
+            return AWS_OP_ERR;
+        }
+
+        stats->encrypt_hits += aws_atomic_load_int(&shard->encrypt_hits);
+        stats->decrypt_hits += aws_atomic_load_int(&shard->decrypt_hits);
+        stats->misses += aws_atomic_load_int(&shard->misses);
+        stats->encrypt_puts += shard->encrypt_puts;
+        stats->decrypt_puts += shard->decrypt_puts;
+        stats->capacity_evictions += shard->capacity_evictions;
+        stats->ttl_evictions += shard->ttl_evictions;
+        stats->invalidations += shard->invalidations;
+        stats->replacements += shard->replacements;
+        stats->cleared += shard->cleared;
+        stats->quota_evictions += shard->quota_evictions;
+        stats->removals_dropped += shard->removals_dropped;
+        stats->entries += shard->entries.count;
+        stats->bytes += shard->bytes;
+
+        if (aws_rw_lock_runlock(&shard->lock)) {
+            abort();
+        }
+    }
+
+    stats->zombies      = aws_atomic_load_int(&cache->zombies);
+    stats->lock_wait_ns = aws_atomic_load_int(&cache->lock_wait_ns);
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Looks cache IDs up FIND_BATCH at a time: the shards and fingerprints of a batch are computed in
+ * one pass, and then each shard the batch touches is read-locked once for all of its lookups.
+ */
+static int find_entries(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **entries,
+    bool *is_encrypt,
+    const struct aws_byte_buf *cache_ids,
+    size_t count) {
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+    struct local_cache_shard *shards[FIND_BATCH];
+    uint64_t fingerprints[FIND_BATCH];
+    size_t hit_slots[FIND_BATCH];
+    uint64_t now = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        entries[i] = NULL;
+    }
+
+    /* If the clock is broken, entries just don't expire here */
+    if (cache->clock_get_ticks(&now)) {
+        now = 0;
     }
+
+    for (size_t base = 0; base < count; base += FIND_BATCH) {
+        size_t n = count - base < FIND_BATCH ? count - base : FIND_BATCH;
+
+        for (size_t i = 0; i < n; i++) {
+            shards[i]       = shard_for_id(cache, &cache_ids[base + i]);
+            fingerprints[i] = fingerprint_cache_id(&cache_ids[base + i]);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            struct local_cache_shard *shard = shards[i];
+
+            /* Each shard is handled at its first lookup in the batch, and then marked done */
+            if (!shard) continue;
+            if (shard_rlock(cache, shard)) goto err;
+
+            for (size_t j = i; j < n; j++) {
+                if (shards[j] != shard) continue;
+                entries[base + j] = (struct aws_cryptosdk_materials_cache_entry *)locked_find(
+                    cache, shard, &cache_ids[base + j], fingerprints[j], now, &hit_slots[j]);
+            }
+
+            if (aws_rw_lock_runlock(&shard->lock)) {
+                abort();
+            }
+
+            for (size_t j = i; j < n; j++) {
+                if (shards[j] != shard) continue;
+
+                struct local_cache_entry *local_entry = (struct local_cache_entry *)entries[base + j];
+                if (local_entry && is_encrypt) {
+                    is_encrypt[base + j] = (local_entry->enc_materials != NULL);
+                }
+                finish_find(shard, local_entry, hit_slots[j]);
+                shards[j] = NULL;
+            }
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+
+err:
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i]) {
+            release_entry(generic_cache, entries[i], false);
+            entries[i] = NULL;
+        }
+    }
+
+    return AWS_OP_ERR;
 }
 
 static const struct aws_cryptosdk_materials_cache_vt local_cache_vt = { .vt_size            = sizeof(local_cache_vt),
@@ -904,7 +2398,13 @@ static const struct aws_cryptosdk_materials_cache_vt local_cache_vt = { .vt_size
                                                                         .entry_release         = release_entry,
                                                                         .entry_get_creation_time = get_creation_time,
                                                                         .entry_ttl_hint          = set_expiration_hint,
-                                                                        .clear                   = clear_cache };
+                                                                        .clear                   = clear_cache,
+                                                                        .get_stats               = get_stats,
+                                                                        .return_usage_stats      = return_usage_stats,
+                                                                        .entry_partition_hint    = set_partition_hint,
+                                                                        .invalidate_partition    = invalidate_partition,
+                                                                        .find_entries            = find_entries
+};
 
 AWS_CRYPTOSDK_TEST_STATIC
 void aws_cryptosdk_local_cache_set_clock(
@@ -915,8 +2415,279 @@ void aws_cryptosdk_local_cache_set_clock(
     cache->clock_get_ticks = clock_get_ticks;
 }
 
+int aws_cryptosdk_materials_cache_local_set_clock_precision(
+    struct aws_cryptosdk_materials_cache *generic_cache, uint64_t precision, enum aws_timestamp_unit units) {
+    if (generic_cache->vt != &local_cache_vt || (units != AWS_TIMESTAMP_SECS && units != AWS_TIMESTAMP_MILLIS &&
+                                                 units != AWS_TIMESTAMP_MICROS && units != AWS_TIMESTAMP_NANOS)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    /* Take the new hold before dropping the old one, so that the ticker keeps running in between */
+    if (precision &&
+        aws_cryptosdk_priv_coarse_clock_acquire(aws_mul_u64_saturating(AWS_TIMESTAMP_NANOS / units, precision))) {
+        return AWS_OP_ERR;
+    }
+    if (cache->coarse_clock) {
+        aws_cryptosdk_priv_coarse_clock_release();
+    }
+
+    cache->coarse_clock = precision != 0;
+    aws_cryptosdk_local_cache_set_clock(
+        generic_cache, precision ? aws_cryptosdk_priv_coarse_clock_get_ticks : aws_sys_clock_get_ticks);
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_materials_cache_local_set_eviction(
+    struct aws_cryptosdk_materials_cache *generic_cache, enum aws_cryptosdk_local_cache_eviction eviction) {
+    if (generic_cache->vt != &local_cache_vt ||
+        (eviction != AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU && eviction != AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_CLOCK)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+    aws_atomic_store_int(&cache->eviction, eviction);
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_materials_cache_local_set_byte_limit(
+    struct aws_cryptosdk_materials_cache *generic_cache, size_t byte_limit) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (shard_wlock(cache, shard)) {
+            return AWS_OP_ERR;
+        }
+
+        /* As with the capacity, the remainder goes to the first shards */
+        shard->byte_limit = byte_limit / cache->num_shards + (i < byte_limit % cache->num_shards);
+        if (byte_limit && !shard->byte_limit) {
+            shard->byte_limit = 1;
+        }
+
+        locked_apply_hits(shard);
+        locked_trim(cache, shard, NULL);
+
+        if (aws_rw_lock_wunlock(&shard->lock)) {
+            abort();
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_materials_cache_local_set_partition_quota(
+    struct aws_cryptosdk_materials_cache *generic_cache, size_t quota) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (shard_wlock(cache, shard)) {
+            return AWS_OP_ERR;
+        }
+
+        /* As with the byte limit, the remainder goes to the first shards, and every shard gets some */
+        shard->partition_quota = quota / cache->num_shards + (i < quota % cache->num_shards);
+        if (quota && !shard->partition_quota) {
+            shard->partition_quota = 1;
+        }
+
+        locked_apply_hits(shard);
+
+        /* Trimming keeps every partition non-empty, so the table is not modified while we iterate */
+        for (struct aws_hash_iter iter = aws_hash_iter_begin(&shard->partitions); !aws_hash_iter_done(&iter);
+             aws_hash_iter_next(&iter)) {
+            locked_trim_partition(cache, shard, iter.element.value, NULL);
+        }
+
+        if (aws_rw_lock_wunlock(&shard->lock)) {
+            abort();
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_materials_cache_local_set_capacity(
+    struct aws_cryptosdk_materials_cache *generic_cache, size_t capacity) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    return resize_cache((struct aws_cryptosdk_local_cache *)generic_cache, capacity);
+}
+
+size_t aws_cryptosdk_materials_cache_local_get_capacity(const struct aws_cryptosdk_materials_cache *generic_cache) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return 0;
+    }
+
+    // Removing const so we can lock the shards
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+    size_t capacity                         = 0;
+
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (shard_rlock(cache, shard)) {
+            return SIZE_MAX;
+        }
+
+        capacity += shard->capacity;
+
+        if (aws_rw_lock_runlock(&shard->lock)) {
+            abort();
+        }
+    }
+
+    return capacity;
+}
+
+int aws_cryptosdk_materials_cache_local_set_auto_capacity(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    size_t min_capacity,
+    size_t max_capacity,
+    size_t byte_ceiling) {
+    if (generic_cache->vt != &local_cache_vt || min_capacity > max_capacity) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    uint64_t lookups = 0, ghost_hits = 0;
+    int rv           = AWS_OP_SUCCESS;
+
+    aws_mutex_lock(&cache->tuning_mutex);
+
+    for (size_t i = 0; i < cache->num_shards; i++) {
+        struct local_cache_shard *shard = &cache->shards[i];
+
+        if (shard_wlock(cache, shard)) {
+            rv = AWS_OP_ERR;
+            break;
+        }
+
+        if (!max_capacity && shard->ghosts) {
+            aws_mem_release(cache->allocator, shard->ghosts);
+            shard->ghosts = NULL;
+        } else if (max_capacity && locked_size_ghosts(cache->allocator, shard)) {
+            rv = AWS_OP_ERR;
+        }
+
+        lookups += aws_atomic_load_int(&shard->encrypt_hits) + aws_atomic_load_int(&shard->decrypt_hits) +
+                   aws_atomic_load_int(&shard->misses);
+        ghost_hits += aws_atomic_load_int(&shard->ghost_hits);
+
+        if (aws_rw_lock_wunlock(&shard->lock)) {
+            abort();
+        }
+        if (rv) {
+            break;
+        }
+    }
+
+    /* The first pass only judges the lookups from here on */
+    if (!rv) {
+        cache->tune_min          = min_capacity;
+        cache->tune_max          = max_capacity;
+        cache->tune_byte_ceiling = byte_ceiling;
+        cache->tune_lookups      = lookups;
+        cache->tune_ghost_hits   = ghost_hits;
+    }
+
+    aws_mutex_unlock(&cache->tuning_mutex);
+
+    return rv;
+}
+
+int aws_cryptosdk_materials_cache_local_tune_capacity(struct aws_cryptosdk_materials_cache *generic_cache) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    return tune_capacity((struct aws_cryptosdk_local_cache *)generic_cache);
+}
+
+int aws_cryptosdk_materials_cache_local_set_removal_callback(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    aws_cryptosdk_local_cache_removal_fn *on_removal,
+    void *user_data) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    aws_mutex_lock(&cache->removal_mutex);
+    cache->on_removal        = on_removal;
+    cache->removal_user_data = user_data;
+    aws_atomic_store_int(&cache->removals_wanted, on_removal != NULL);
+    aws_mutex_unlock(&cache->removal_mutex);
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_materials_cache_local_deliver_removals(struct aws_cryptosdk_materials_cache *generic_cache) {
+    if (generic_cache->vt != &local_cache_vt) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    return deliver_removals((struct aws_cryptosdk_local_cache *)generic_cache);
+}
+
+int aws_cryptosdk_materials_cache_local_start_maintenance(
+    struct aws_cryptosdk_materials_cache *generic_cache, uint64_t interval) {
+    if (generic_cache->vt != &local_cache_vt || interval == 0 || interval > INT64_MAX) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct aws_cryptosdk_local_cache *cache = (struct aws_cryptosdk_local_cache *)generic_cache;
+
+    if (aws_atomic_load_int(&cache->maintained)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    cache->maintenance_interval = interval;
+    cache->maintenance_stop     = false;
+
+    if (aws_mutex_init(&cache->maintenance_mutex)) goto err;
+    if (aws_condition_variable_init(&cache->maintenance_cond)) goto err_mutex;
+    if (aws_thread_init(&cache->maintenance_thread, cache->allocator)) goto err_cond;
+    if (aws_thread_launch(&cache->maintenance_thread, run_maintenance, cache, aws_default_thread_options())) {
+        aws_thread_clean_up(&cache->maintenance_thread);
+        goto err_cond;
+    }
+
+    aws_atomic_store_int(&cache->maintained, 1);
+    return AWS_OP_SUCCESS;
+
+err_cond:
+    aws_condition_variable_clean_up(&cache->maintenance_cond);
+err_mutex:
+    aws_mutex_clean_up(&cache->maintenance_mutex);
+err:
+    return AWS_OP_ERR;
+}
+
 struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new(
     struct aws_allocator *alloc, size_t capacity) {
+    return aws_cryptosdk_materials_cache_local_new_sharded(alloc, capacity, 1);
+}
+
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new_sharded(
+    struct aws_allocator *alloc, size_t capacity, size_t num_shards) {
     /* Suppress unused static method warnings */
     (void)aws_cryptosdk_local_cache_set_clock;
 
@@ -925,6 +2696,15 @@ struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new(
         capacity = 2;
     }
 
+    /* Every shard needs the minimum capacity too */
+    if (num_shards > capacity / 2) {
+        num_shards = capacity / 2;
+    }
+    if (num_shards == 0) {
+        num_shards = 1;
+    }
+
+    alloc                                   = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_CACHE);
     struct aws_cryptosdk_local_cache *cache = aws_mem_acquire(alloc, sizeof(*cache));
 
     if (!cache) {
@@ -934,31 +2714,86 @@ struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_local_new(
     memset(cache, 0, sizeof(*cache));
 
     aws_cryptosdk_materials_cache_base_init(&cache->base, &local_cache_vt);
-    cache->allocator     = alloc;
-    cache->lru_head.next = cache->lru_head.prev = &cache->lru_head;
-    cache->capacity                             = capacity;
-    cache->clock_get_ticks                      = aws_sys_clock_get_ticks;
+    cache->allocator       = alloc;
+    cache->num_shards      = num_shards;
+    cache->clock_get_ticks = aws_sys_clock_get_ticks;
+    aws_atomic_init_int(&cache->eviction, AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU);
+    aws_atomic_init_int(&cache->maintained, 0);
+    aws_atomic_init_int(&cache->zombies, 0);
+    aws_atomic_init_int(&cache->lock_wait_ns, 0);
+
+    aws_atomic_init_int(&cache->removals_wanted, 0);
 
-    if (aws_mutex_init(&cache->mutex)) {
+    if (aws_mutex_init(&cache->tuning_mutex)) {
         goto err_mutex;
     }
+    if (aws_mutex_init(&cache->removal_mutex)) {
+        goto err_removal_mutex;
+    }
+    if (aws_array_list_init_dynamic(&cache->delivering, alloc, 0, sizeof(struct removal_event))) {
+        goto err_delivering;
+    }
+    if (aws_mutex_init(&cache->pool_mutex)) {
+        goto err_pool;
+    }
 
-    if (aws_hash_table_init(
-            &cache->entries, alloc, capacity, hash_cache_id, eq_cache_id, NULL, destroy_cache_entry_vp)) {
-        goto err_hash_table;
+    if (!(cache->shards = aws_mem_calloc(alloc, num_shards, sizeof(*cache->shards)))) {
+        goto err_shards;
     }
 
-    if (aws_priority_queue_init_dynamic(
-            &cache->ttl_heap, alloc, capacity, sizeof(struct local_cache_entry *), ttl_heap_cmp)) {
-        goto err_pq;
+    size_t initialized = 0;
+    for (; initialized < num_shards; initialized++) {
+        struct local_cache_shard *shard = &cache->shards[initialized];
+
+        /* The remainder of the capacity goes to the first shards */
+        shard->capacity      = capacity / num_shards + (initialized < capacity % num_shards);
+        shard->lru_head.next = shard->lru_head.prev = &shard->lru_head;
+
+        aws_atomic_init_int(&shard->hit_count, 0);
+        aws_atomic_init_int(&shard->encrypt_hits, 0);
+        aws_atomic_init_int(&shard->decrypt_hits, 0);
+        aws_atomic_init_int(&shard->misses, 0);
+        aws_atomic_init_int(&shard->ghost_hits, 0);
+        for (size_t slot = 0; slot < TTL_WHEEL_SLOTS; slot++) {
+            aws_linked_list_init(&shard->ttl_wheel[slot]);
+        }
+
+        if (aws_rw_lock_init(&shard->lock)) {
+            goto err_shard;
+        }
+
+        if (entry_table_init(&shard->entries, alloc, shard->capacity)) {
+            goto err_hash_table;
+        }
+
+        if (aws_hash_table_init(&shard->partitions, alloc, 4, hash_cache_id, eq_cache_id, NULL, destroy_partition_vp)) {
+            goto err_partitions;
+        }
+
+        if (aws_array_list_init_dynamic(&shard->removals, alloc, 0, sizeof(struct removal_event))) {
+            goto err_removals;
+        }
     }
 
     return &cache->base;
 
-err_pq:
-    aws_hash_table_clean_up(&cache->entries);
+err_removals:
+    aws_hash_table_clean_up(&cache->shards[initialized].partitions);
+err_partitions:
+    entry_table_clean_up(&cache->shards[initialized].entries, alloc);
 err_hash_table:
-    aws_mutex_clean_up(&cache->mutex);
+    aws_rw_lock_clean_up(&cache->shards[initialized].lock);
+err_shard:
+    clean_up_shards(cache, initialized);
+    aws_mem_release(alloc, cache->shards);
+err_shards:
+    free_slabs(cache);
+err_pool:
+    aws_array_list_clean_up(&cache->delivering);
+err_delivering:
+    aws_mutex_clean_up(&cache->removal_mutex);
+err_removal_mutex:
+    aws_mutex_clean_up(&cache->tuning_mutex);
 err_mutex:
     aws_mem_release(alloc, cache);
 err_alloc:
@@ -14,6 +14,9 @@
  */
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/materials.h>
+#include <aws/cryptosdk/private/alloc_stats.h>
+#include <aws/cryptosdk/private/enc_ctx.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
 
 struct aws_cryptosdk_enc_materials *aws_cryptosdk_enc_materials_new(
     struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg) {
@@ -24,7 +27,9 @@ struct aws_cryptosdk_enc_materials *aws_cryptosdk_enc_materials_new(
     enc_mat->alloc = alloc;
     enc_mat->alg   = alg;
     memset(&enc_mat->unencrypted_data_key, 0, sizeof(struct aws_byte_buf));
-    enc_mat->signctx = NULL;
+    memset(&enc_mat->header_template, 0, sizeof(struct aws_byte_buf));
+    enc_mat->signctx  = NULL;
+    enc_mat->snapshot = NULL;
 
     if (aws_cryptosdk_edk_list_init(alloc, &enc_mat->encrypted_data_keys)) {
         aws_mem_release(alloc, enc_mat);
@@ -44,12 +49,67 @@ void aws_cryptosdk_enc_materials_destroy(struct aws_cryptosdk_enc_materials *enc
     if (enc_mat) {
         aws_cryptosdk_sig_abort(enc_mat->signctx);
         aws_byte_buf_clean_up_secure(&enc_mat->unencrypted_data_key);
+        aws_byte_buf_clean_up(&enc_mat->header_template);
         aws_cryptosdk_edk_list_clean_up(&enc_mat->encrypted_data_keys);
         aws_cryptosdk_keyring_trace_clean_up(&enc_mat->keyring_trace);
+        aws_cryptosdk_materials_snapshot_release(enc_mat->snapshot);
         aws_mem_release(enc_mat->alloc, enc_mat);
     }
 }
 
+struct aws_cryptosdk_enc_materials *aws_cryptosdk_enc_materials_new_from_spare(
+    struct aws_cryptosdk_enc_materials **spare, struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg) {
+    struct aws_cryptosdk_enc_materials *enc_mat = *spare;
+
+    if (!enc_mat || enc_mat->alloc != alloc) return aws_cryptosdk_enc_materials_new(alloc, alg);
+
+    *spare       = NULL;
+    enc_mat->alg = alg;
+    return enc_mat;
+}
+
+void aws_cryptosdk_enc_materials_recycle(
+    struct aws_cryptosdk_enc_materials **spare, struct aws_cryptosdk_enc_materials *enc_mat) {
+    if (!enc_mat) return;
+    if (*spare) {
+        aws_cryptosdk_enc_materials_destroy(enc_mat);
+        return;
+    }
+
+    aws_cryptosdk_sig_abort(enc_mat->signctx);
+    enc_mat->signctx = NULL;
+    aws_byte_buf_clean_up_secure(&enc_mat->unencrypted_data_key);
+    aws_byte_buf_clean_up(&enc_mat->header_template);
+    // The EDKs may borrow from the snapshot, so they have to go first
+    aws_cryptosdk_edk_list_clear(&enc_mat->encrypted_data_keys);
+    aws_cryptosdk_materials_snapshot_release(enc_mat->snapshot);
+    enc_mat->snapshot = NULL;
+
+    if (aws_cryptosdk_keyring_trace_is_disabled(&enc_mat->keyring_trace)) {
+        // Nothing is allocated by an empty trace, so this cannot fail
+        aws_cryptosdk_keyring_trace_init(enc_mat->alloc, &enc_mat->keyring_trace);
+    } else {
+        aws_cryptosdk_keyring_trace_clear(&enc_mat->keyring_trace);
+    }
+
+    *spare = enc_mat;
+}
+
+struct aws_cryptosdk_materials_snapshot *aws_cryptosdk_materials_snapshot_retain(
+    struct aws_cryptosdk_materials_snapshot *snapshot) {
+    if (snapshot) {
+        aws_atomic_fetch_add_explicit(&snapshot->refcount, 1, aws_memory_order_relaxed);
+    }
+
+    return snapshot;
+}
+
+void aws_cryptosdk_materials_snapshot_release(struct aws_cryptosdk_materials_snapshot *snapshot) {
+    if (snapshot && aws_atomic_fetch_sub_explicit(&snapshot->refcount, 1, aws_memory_order_acq_rel) == 1) {
+        aws_mem_release(snapshot->alloc, snapshot);
+    }
+}
+
 // TODO: initialization for trailing signature key, if necessary
 struct aws_cryptosdk_dec_materials *aws_cryptosdk_dec_materials_new(
     struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg) {
@@ -63,6 +123,10 @@ struct aws_cryptosdk_dec_materials *aws_cryptosdk_dec_materials_new(
     dec_mat->unencrypted_data_key.allocator = NULL;
     dec_mat->alg                            = alg;
     dec_mat->signctx                        = NULL;
+    dec_mat->content_key.buffer             = NULL;
+    dec_mat->content_key.len                = 0;
+    dec_mat->content_key.capacity           = 0;
+    dec_mat->content_key.allocator          = NULL;
     if (aws_cryptosdk_keyring_trace_init(alloc, &dec_mat->keyring_trace)) {
         aws_mem_release(alloc, dec_mat);
         return NULL;
@@ -75,34 +139,68 @@ void aws_cryptosdk_dec_materials_destroy(struct aws_cryptosdk_dec_materials *dec
     if (dec_mat) {
         aws_cryptosdk_sig_abort(dec_mat->signctx);
         aws_byte_buf_clean_up_secure(&dec_mat->unencrypted_data_key);
+        aws_byte_buf_clean_up_secure(&dec_mat->content_key);
         aws_cryptosdk_keyring_trace_clean_up(&dec_mat->keyring_trace);
         aws_mem_release(dec_mat->alloc, dec_mat);
     }
 }
 
-int aws_cryptosdk_keyring_on_encrypt(
-    struct aws_cryptosdk_keyring *keyring,
-    struct aws_allocator *request_alloc,
-    struct aws_byte_buf *unencrypted_data_key,
-    struct aws_array_list *keyring_trace,
-    struct aws_array_list *edks,
-    const struct aws_hash_table *enc_ctx,
-    enum aws_cryptosdk_alg_id alg) {
-    /* Shallow copy of byte buffer: does NOT duplicate key bytes */
-    const struct aws_byte_buf precall_data_key_buf = *unencrypted_data_key;
+struct aws_cryptosdk_dec_materials *aws_cryptosdk_dec_materials_new_from_spare(
+    struct aws_cryptosdk_dec_materials **spare, struct aws_allocator *alloc, enum aws_cryptosdk_alg_id alg) {
+    struct aws_cryptosdk_dec_materials *dec_mat = *spare;
 
-    /* Precondition: If a data key has not already been generated, there must be no EDKs.
-     * Generating a new one and then pushing new EDKs on the list would cause the list of
-     * EDKs to be inconsistent. (i.e., they would decrypt to different data keys.)
-     */
-    if (!precall_data_key_buf.buffer && aws_array_list_length(edks))
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    if (!dec_mat || dec_mat->alloc != alloc) return aws_cryptosdk_dec_materials_new(alloc, alg);
 
-    AWS_CRYPTOSDK_PRIVATE_VF_CALL(
-        on_encrypt, keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+    *spare       = NULL;
+    dec_mat->alg = alg;
+    return dec_mat;
+}
+
+void aws_cryptosdk_dec_materials_recycle(
+    struct aws_cryptosdk_dec_materials **spare, struct aws_cryptosdk_dec_materials *dec_mat) {
+    if (!dec_mat) return;
+    if (*spare) {
+        aws_cryptosdk_dec_materials_destroy(dec_mat);
+        return;
+    }
+
+    aws_cryptosdk_sig_abort(dec_mat->signctx);
+    dec_mat->signctx = NULL;
+    aws_byte_buf_clean_up_secure(&dec_mat->unencrypted_data_key);
+    aws_byte_buf_clean_up_secure(&dec_mat->content_key);
+
+    if (aws_cryptosdk_keyring_trace_is_disabled(&dec_mat->keyring_trace)) {
+        aws_cryptosdk_keyring_trace_init(dec_mat->alloc, &dec_mat->keyring_trace);
+    } else {
+        aws_cryptosdk_keyring_trace_clear(&dec_mat->keyring_trace);
+    }
 
+    *spare = dec_mat;
+}
+
+/* True if the vtable is large enough to contain fn_name and the function is implemented */
+#define VT_IMPLEMENTS(vtable, fn_name)                                                                                 \
+    ((size_t)((const uint8_t *)&(vtable)->fn_name - (const uint8_t *)(vtable)) + sizeof((vtable)->fn_name) <=         \
+         (vtable)->vt_size &&                                                                                          \
+     (vtable)->fn_name)
+
+/* Precondition: If a data key has not already been generated, there must be no EDKs.
+ * Generating a new one and then pushing new EDKs on the list would cause the list of
+ * EDKs to be inconsistent. (i.e., they would decrypt to different data keys.)
+ */
+static int check_on_encrypt_preconditions(
+    const struct aws_byte_buf *unencrypted_data_key, const struct aws_array_list *edks) {
+    if (!unencrypted_data_key->buffer && aws_array_list_length(edks))
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    return AWS_OP_SUCCESS;
+}
+
+static int check_on_encrypt_postconditions(
+    const struct aws_byte_buf *precall_data_key_buf,
+    const struct aws_byte_buf *unencrypted_data_key,
+    enum aws_cryptosdk_alg_id alg) {
     /* Postcondition: If this keyring generated data key, it must be the right length. */
-    if (!precall_data_key_buf.buffer && unencrypted_data_key->buffer) {
+    if (!precall_data_key_buf->buffer && unencrypted_data_key->buffer) {
         const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
         if (unencrypted_data_key->len != props->data_key_len) {
             return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
@@ -114,10 +212,44 @@ int aws_cryptosdk_keyring_on_encrypt(
      * bytes themselves. Verifying the key bytes were unchanged would require making an extra
      * copy of the key bytes, a case of the cure being worse than the disease.
      */
-    if (precall_data_key_buf.buffer) {
-        if (memcmp(&precall_data_key_buf, unencrypted_data_key, sizeof(precall_data_key_buf)))
+    if (precall_data_key_buf->buffer) {
+        if (memcmp(precall_data_key_buf, unencrypted_data_key, sizeof(*precall_data_key_buf)))
             return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
     }
+    return AWS_OP_SUCCESS;
+}
+
+static int check_on_decrypt_postconditions(
+    const struct aws_byte_buf *unencrypted_data_key, enum aws_cryptosdk_alg_id alg) {
+    /* Postcondition: if data key was decrypted, its length must agree with algorithm
+     * specification. If this is not the case, it either means ciphertext was tampered
+     * with or the keyring implementation is not setting the length properly.
+     */
+    if (unencrypted_data_key->buffer) {
+        const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
+        if (unencrypted_data_key->len != props->data_key_len) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    }
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_keyring_on_encrypt(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    request_alloc = aws_cryptosdk_priv_alloc_tagged(request_alloc, AWS_CRYPTOSDK_ALLOC_KEYRING);
+    /* Shallow copy of byte buffer: does NOT duplicate key bytes */
+    const struct aws_byte_buf precall_data_key_buf = *unencrypted_data_key;
+
+    if (check_on_encrypt_preconditions(unencrypted_data_key, edks)) return AWS_OP_ERR;
+
+    AWS_CRYPTOSDK_PRIVATE_VF_CALL(
+        on_encrypt, keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+
+    if (check_on_encrypt_postconditions(&precall_data_key_buf, unencrypted_data_key, alg)) return AWS_OP_ERR;
     return ret;
 }
 
@@ -129,18 +261,407 @@ int aws_cryptosdk_keyring_on_decrypt(
     const struct aws_array_list *edks,
     const struct aws_hash_table *enc_ctx,
     enum aws_cryptosdk_alg_id alg) {
+    request_alloc = aws_cryptosdk_priv_alloc_tagged(request_alloc, AWS_CRYPTOSDK_ALLOC_KEYRING);
     /* Precondition: data key buffer must be unset. */
     if (unencrypted_data_key->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
     AWS_CRYPTOSDK_PRIVATE_VF_CALL(
         on_decrypt, keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
 
-    /* Postcondition: if data key was decrypted, its length must agree with algorithm
-     * specification. If this is not the case, it either means ciphertext was tampered
-     * with or the keyring implementation is not setting the length properly.
-     */
-    if (unencrypted_data_key->buffer) {
-        const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
-        if (unencrypted_data_key->len != props->data_key_len) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    if (check_on_decrypt_postconditions(unencrypted_data_key, alg)) return AWS_OP_ERR;
+    return ret;
+}
+
+int aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    request_alloc = aws_cryptosdk_priv_alloc_tagged(request_alloc, AWS_CRYPTOSDK_ALLOC_KEYRING);
+    if (!serialized_enc_ctx || !VT_IMPLEMENTS(keyring->vtable, on_encrypt_with_serialized_ctx)) {
+        return aws_cryptosdk_keyring_on_encrypt(
+            keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+    }
+
+    /* Shallow copy of byte buffer: does NOT duplicate key bytes */
+    const struct aws_byte_buf precall_data_key_buf = *unencrypted_data_key;
+
+    if (check_on_encrypt_preconditions(unencrypted_data_key, edks)) return AWS_OP_ERR;
+
+    int ret = keyring->vtable->on_encrypt_with_serialized_ctx(
+        keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, serialized_enc_ctx, alg);
+
+    if (check_on_encrypt_postconditions(&precall_data_key_buf, unencrypted_data_key, alg)) return AWS_OP_ERR;
+    return ret;
+}
+
+int aws_cryptosdk_keyring_on_decrypt_with_serialized_ctx(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    request_alloc = aws_cryptosdk_priv_alloc_tagged(request_alloc, AWS_CRYPTOSDK_ALLOC_KEYRING);
+    if (!serialized_enc_ctx || !VT_IMPLEMENTS(keyring->vtable, on_decrypt_with_serialized_ctx)) {
+        return aws_cryptosdk_keyring_on_decrypt(
+            keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
     }
+
+    /* Precondition: data key buffer must be unset. */
+    if (unencrypted_data_key->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+
+    int ret = keyring->vtable->on_decrypt_with_serialized_ctx(
+        keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, serialized_enc_ctx, alg);
+
+    if (check_on_decrypt_postconditions(unencrypted_data_key, alg)) return AWS_OP_ERR;
+    return ret;
+}
+
+int aws_cryptosdk_keyring_get_edk_filter(
+    const struct aws_cryptosdk_keyring *keyring,
+    struct aws_byte_cursor *provider_id,
+    struct aws_byte_cursor *provider_info_prefix) {
+    AWS_CRYPTOSDK_PRIVATE_VF_CALL(get_edk_filter, keyring, provider_id, provider_info_prefix);
     return ret;
 }
+
+bool aws_cryptosdk_keyring_may_decrypt(const struct aws_cryptosdk_keyring *keyring, const struct aws_array_list *edks) {
+    if (VT_IMPLEMENTS(keyring->vtable, may_decrypt)) return keyring->vtable->may_decrypt(keyring, edks);
+
+    struct aws_byte_cursor provider_id, provider_info_prefix;
+    if (!VT_IMPLEMENTS(keyring->vtable, get_edk_filter) ||
+        keyring->vtable->get_edk_filter(keyring, &provider_id, &provider_info_prefix)) {
+        aws_reset_error();
+        return true;
+    }
+
+    size_t num_edks = aws_array_list_length(edks);
+    for (size_t edk_idx = 0; edk_idx < num_edks; edk_idx++) {
+        const struct aws_cryptosdk_edk *edk;
+        if (!aws_array_list_get_at_ptr(edks, (void **)&edk, edk_idx) &&
+            aws_cryptosdk_edk_matches_filter(edk, &provider_id, &provider_info_prefix)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* State carried across an asynchronous keyring call, so that its postconditions can be checked */
+struct keyring_async_call {
+    struct aws_allocator *alloc;
+    struct aws_byte_buf precall_data_key_buf;
+    struct aws_byte_buf *unencrypted_data_key;
+    enum aws_cryptosdk_alg_id alg;
+    bool encrypt;
+    aws_cryptosdk_keyring_fn *callback;
+    void *user_data;
+};
+
+static void keyring_async_done(int error_code, void *user_data) {
+    struct keyring_async_call *call    = user_data;
+    aws_cryptosdk_keyring_fn *callback = call->callback;
+    void *callback_data                = call->user_data;
+
+    if (!error_code) {
+        int rv = call->encrypt ? check_on_encrypt_postconditions(
+                                     &call->precall_data_key_buf, call->unencrypted_data_key, call->alg)
+                               : check_on_decrypt_postconditions(call->unencrypted_data_key, call->alg);
+        if (rv) error_code = aws_last_error();
+    }
+
+    aws_mem_release(call->alloc, call);
+    callback(error_code, callback_data);
+}
+
+static struct keyring_async_call *keyring_async_call_new(
+    struct aws_allocator *alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    enum aws_cryptosdk_alg_id alg,
+    bool encrypt,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    struct keyring_async_call *call = aws_mem_acquire(alloc, sizeof(*call));
+    if (!call) return NULL;
+
+    call->alloc                = alloc;
+    call->precall_data_key_buf = *unencrypted_data_key;
+    call->unencrypted_data_key = unencrypted_data_key;
+    call->alg                  = alg;
+    call->encrypt              = encrypt;
+    call->callback             = callback;
+    call->user_data            = user_data;
+
+    return call;
+}
+
+int aws_cryptosdk_keyring_on_encrypt_async(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    request_alloc = aws_cryptosdk_priv_alloc_tagged(request_alloc, AWS_CRYPTOSDK_ALLOC_KEYRING);
+    if (!VT_IMPLEMENTS(keyring->vtable, on_encrypt_async)) {
+        int rv = aws_cryptosdk_keyring_on_encrypt(
+            keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+        callback(rv ? aws_last_error() : AWS_ERROR_SUCCESS, user_data);
+        return AWS_OP_SUCCESS;
+    }
+
+    if (check_on_encrypt_preconditions(unencrypted_data_key, edks)) return AWS_OP_ERR;
+
+    struct keyring_async_call *call =
+        keyring_async_call_new(request_alloc, unencrypted_data_key, alg, true, callback, user_data);
+    if (!call) return AWS_OP_ERR;
+
+    if (keyring->vtable->on_encrypt_async(
+            keyring,
+            request_alloc,
+            unencrypted_data_key,
+            keyring_trace,
+            edks,
+            enc_ctx,
+            alg,
+            keyring_async_done,
+            call)) {
+        aws_mem_release(request_alloc, call);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_keyring_on_decrypt_async(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    request_alloc = aws_cryptosdk_priv_alloc_tagged(request_alloc, AWS_CRYPTOSDK_ALLOC_KEYRING);
+    if (!VT_IMPLEMENTS(keyring->vtable, on_decrypt_async)) {
+        int rv = aws_cryptosdk_keyring_on_decrypt(
+            keyring, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+        callback(rv ? aws_last_error() : AWS_ERROR_SUCCESS, user_data);
+        return AWS_OP_SUCCESS;
+    }
+
+    /* Precondition: data key buffer must be unset. */
+    if (unencrypted_data_key->buffer) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+
+    struct keyring_async_call *call =
+        keyring_async_call_new(request_alloc, unencrypted_data_key, alg, false, callback, user_data);
+    if (!call) return AWS_OP_ERR;
+
+    if (keyring->vtable->on_decrypt_async(
+            keyring,
+            request_alloc,
+            unencrypted_data_key,
+            keyring_trace,
+            edks,
+            enc_ctx,
+            alg,
+            keyring_async_done,
+            call)) {
+        aws_mem_release(request_alloc, call);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* The error a failed call raised, or AWS_ERROR_UNKNOWN if it raised none, so it is not taken for success */
+static int failed_call_error(void) {
+    return aws_last_error() ? aws_last_error() : AWS_ERROR_UNKNOWN;
+}
+
+int aws_cryptosdk_keyring_on_encrypt_batch(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_cryptosdk_keyring_encrypt_item *items,
+    size_t num_items) {
+    request_alloc                = aws_cryptosdk_priv_alloc_tagged(request_alloc, AWS_CRYPTOSDK_ALLOC_KEYRING);
+    struct aws_byte_buf *precall = NULL;
+    int batch_error              = AWS_ERROR_SUCCESS;
+
+    for (size_t i = 0; i < num_items; i++) {
+        items[i].error_code = AWS_ERROR_SUCCESS;
+        if (!batch_error && check_on_encrypt_preconditions(items[i].unencrypted_data_key, items[i].edks)) {
+            batch_error = aws_last_error();
+        }
+    }
+    if (batch_error || !num_items) goto out;
+
+    if (!VT_IMPLEMENTS(keyring->vtable, on_encrypt_batch)) {
+        for (size_t i = 0; i < num_items; i++) {
+            struct aws_cryptosdk_keyring_encrypt_item *item = &items[i];
+            if (aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx(
+                    keyring,
+                    request_alloc,
+                    item->unencrypted_data_key,
+                    item->keyring_trace,
+                    item->edks,
+                    item->enc_ctx,
+                    item->serialized_enc_ctx,
+                    item->alg)) {
+                item->error_code = failed_call_error();
+            }
+        }
+        goto out;
+    }
+
+    /* Shallow copies of the byte buffers, to check the postconditions against */
+    if (!(precall = aws_mem_calloc(request_alloc, num_items, sizeof(*precall)))) {
+        batch_error = aws_last_error();
+        goto out;
+    }
+    for (size_t i = 0; i < num_items; i++) precall[i] = *items[i].unencrypted_data_key;
+
+    if (keyring->vtable->on_encrypt_batch(keyring, request_alloc, items, num_items)) {
+        batch_error = failed_call_error();
+        goto out;
+    }
+    for (size_t i = 0; i < num_items; i++) {
+        if (!items[i].error_code &&
+            check_on_encrypt_postconditions(&precall[i], items[i].unencrypted_data_key, items[i].alg)) {
+            items[i].error_code = aws_last_error();
+        }
+    }
+
+out:
+    if (precall) aws_mem_release(request_alloc, precall);
+    if (batch_error) {
+        for (size_t i = 0; i < num_items; i++) items[i].error_code = batch_error;
+        return aws_raise_error(batch_error);
+    }
+    for (size_t i = 0; i < num_items; i++) {
+        if (items[i].error_code) return aws_raise_error(items[i].error_code);
+    }
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_keyring_on_decrypt_batch(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct aws_cryptosdk_keyring_decrypt_item *items,
+    size_t num_items) {
+    request_alloc   = aws_cryptosdk_priv_alloc_tagged(request_alloc, AWS_CRYPTOSDK_ALLOC_KEYRING);
+    int batch_error = AWS_ERROR_SUCCESS;
+
+    for (size_t i = 0; i < num_items; i++) {
+        items[i].error_code = AWS_ERROR_SUCCESS;
+        /* Precondition: data key buffers must be unset. */
+        if (items[i].unencrypted_data_key->buffer) batch_error = AWS_CRYPTOSDK_ERR_BAD_STATE;
+    }
+    if (batch_error || !num_items) goto out;
+
+    if (!VT_IMPLEMENTS(keyring->vtable, on_decrypt_batch)) {
+        for (size_t i = 0; i < num_items; i++) {
+            struct aws_cryptosdk_keyring_decrypt_item *item = &items[i];
+            if (aws_cryptosdk_keyring_on_decrypt_with_serialized_ctx(
+                    keyring,
+                    request_alloc,
+                    item->unencrypted_data_key,
+                    item->keyring_trace,
+                    item->edks,
+                    item->enc_ctx,
+                    item->serialized_enc_ctx,
+                    item->alg)) {
+                item->error_code = failed_call_error();
+            }
+        }
+        goto out;
+    }
+
+    if (keyring->vtable->on_decrypt_batch(keyring, request_alloc, items, num_items)) {
+        batch_error = failed_call_error();
+        goto out;
+    }
+    for (size_t i = 0; i < num_items; i++) {
+        if (!items[i].error_code && check_on_decrypt_postconditions(items[i].unencrypted_data_key, items[i].alg)) {
+            items[i].error_code = aws_last_error();
+        }
+    }
+
+out:
+    if (batch_error) {
+        for (size_t i = 0; i < num_items; i++) items[i].error_code = batch_error;
+        return aws_raise_error(batch_error);
+    }
+    for (size_t i = 0; i < num_items; i++) {
+        if (items[i].error_code) return aws_raise_error(items[i].error_code);
+    }
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_cmm_generate_enc_materials_async(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_enc_request *request,
+    aws_cryptosdk_enc_materials_fn *callback,
+    void *user_data) {
+    if (VT_IMPLEMENTS(cmm->vtable, generate_enc_materials_async)) {
+        return cmm->vtable->generate_enc_materials_async(cmm, request, callback, user_data);
+    }
+
+    struct aws_cryptosdk_enc_materials *materials = NULL;
+    if (aws_cryptosdk_cmm_generate_enc_materials(cmm, &materials, request)) {
+        callback(NULL, aws_last_error(), user_data);
+    } else {
+        callback(materials, AWS_ERROR_SUCCESS, user_data);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_dec_request_materialize_enc_ctx(struct aws_cryptosdk_dec_request *request) {
+    if (!request->enc_ctx_deferred) return AWS_OP_SUCCESS;
+
+    // The table belongs to whoever built the request, and is left empty for this to fill in
+    struct aws_byte_cursor serialized = request->serialized_enc_ctx;
+    if (aws_cryptosdk_enc_ctx_deserialize(request->alloc, (struct aws_hash_table *)request->enc_ctx, &serialized)) {
+        return AWS_OP_ERR;
+    }
+
+    request->enc_ctx_deferred = false;
+    return AWS_OP_SUCCESS;
+}
+
+bool aws_cryptosdk_cmm_may_decrypt(const struct aws_cryptosdk_cmm *cmm, const struct aws_array_list *edks) {
+    return !VT_IMPLEMENTS(cmm->vtable, may_decrypt) || cmm->vtable->may_decrypt(cmm, edks);
+}
+
+int aws_cryptosdk_cmm_decrypt_materials_async(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_dec_request *request,
+    aws_cryptosdk_dec_materials_fn *callback,
+    void *user_data) {
+    if (VT_IMPLEMENTS(cmm->vtable, decrypt_materials_async)) {
+        if (request->enc_ctx_deferred && !aws_cryptosdk_private_cmm_takes_deferred_enc_ctx(cmm) &&
+            aws_cryptosdk_dec_request_materialize_enc_ctx(request)) {
+            return AWS_OP_ERR;
+        }
+        return cmm->vtable->decrypt_materials_async(cmm, request, callback, user_data);
+    }
+
+    struct aws_cryptosdk_dec_materials *materials = NULL;
+    if (aws_cryptosdk_cmm_decrypt_materials(cmm, &materials, request)) {
+        callback(NULL, aws_last_error(), user_data);
+    } else {
+        callback(materials, AWS_ERROR_SUCCESS, user_data);
+    }
+
+    return AWS_OP_SUCCESS;
+}
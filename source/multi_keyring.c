@@ -13,15 +13,120 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
+#include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/list_utils.h>
 #include <aws/cryptosdk/materials.h>
 #include <aws/cryptosdk/multi_keyring.h>
+#include <aws/cryptosdk/private/keyring_trace.h>
 
 struct multi_keyring {
     struct aws_cryptosdk_keyring base;
     struct aws_allocator *alloc;
     struct aws_cryptosdk_keyring *generator;
     struct aws_array_list children;  // list of (struct aws_cryptosdk_keyring *)
+    /* NULL unless children are called concurrently */
+    aws_cryptosdk_executor_fn *executor;
+    void *executor_data;
+    /* Whether On Decrypt also calls its keyrings concurrently, when there is an executor */
+    bool parallel_decrypt;
+    /*
+     * Index of the keyrings which describe the EDKs they can decrypt, from provider ID (struct
+     * aws_byte_cursor *) to (struct provider_group *). Keyrings are identified by position, with
+     * the generator at 0 and the children after it.
+     */
+    struct aws_hash_table provider_index;
+    struct aws_array_list indexed;  // list of (bool), by position: whether the keyring is in provider_index
+    enum aws_cryptosdk_multi_keyring_decrypt_order decrypt_order;
+    /* Recent On Decrypt outcomes, from provider ID (struct aws_byte_cursor *) to (struct provider_stats *) */
+    struct aws_hash_table decrypt_stats;
+    struct aws_mutex stats_mutex;  // guards decrypt_stats
+};
+
+struct indexed_keyring {
+    size_t position;
+    struct aws_byte_cursor provider_info_prefix;
+};
+
+struct provider_group {
+    struct aws_allocator *alloc;
+    struct aws_byte_cursor provider_id;
+    struct aws_array_list keyrings;  // list of (struct indexed_keyring)
+};
+
+/* Success rates are fixed point, from 0 to DECRYPT_SCORE_ONE */
+#define DECRYPT_SCORE_ONE 0x10000
+/* Each outcome moves a success rate 1/DECRYPT_SCORE_WEIGHT of the way towards 0 or DECRYPT_SCORE_ONE */
+#define DECRYPT_SCORE_WEIGHT 8
+
+struct provider_stats {
+    struct aws_allocator *alloc;
+    struct aws_byte_cursor provider_id;  // points just past this struct, in the same allocation
+    struct aws_array_list scores;        // list of (uint32_t), by position; missing scores are 0
+};
+
+/* One keyring to try in On Decrypt, with the EDKs to hand it */
+struct decrypt_attempt {
+    size_t position;
+    const struct aws_array_list *edks;
+    uint32_t score;
+};
+
+/* State shared by all child calls of one concurrent On Encrypt; pending is guarded by mutex */
+struct parallel_encrypt {
+    struct aws_mutex mutex;
+    struct aws_condition_variable cond;
+    size_t pending;
+    struct aws_allocator *request_alloc;
+    struct aws_byte_buf *unencrypted_data_key;
+    const struct aws_hash_table *enc_ctx;
+    const struct aws_byte_cursor *serialized_enc_ctx;
+    enum aws_cryptosdk_alg_id alg;
+};
+
+/*
+ * State shared by all keyring calls of one concurrent On Decrypt. As the caller returns once one
+ * of them decrypts the data key, the others may still be running, so the state holds copies of
+ * the inputs, is freed by whichever of the caller and the calls is last to be done with it, and
+ * keeps the multi-keyring alive until then.
+ */
+struct parallel_decrypt {
+    struct aws_allocator *alloc;
+    struct aws_cryptosdk_keyring *multi;
+    struct aws_mutex mutex;
+    struct aws_condition_variable cond;
+    struct child_decrypt *calls;
+    size_t num_calls;
+    struct aws_array_list edks;
+    struct aws_hash_table enc_ctx;
+    bool has_enc_ctx;
+    struct aws_byte_buf serialized_enc_ctx;
+    bool has_serialized_enc_ctx;
+    enum aws_cryptosdk_alg_id alg;
+    /* The fields below are guarded by mutex */
+    size_t refs;     // the caller, until it returns, and each call not yet finished
+    size_t pending;  // calls not yet finished
+    /* The first call to decrypt the data key, which the caller takes it from */
+    struct child_decrypt *winner;
+    /* AWS_ERROR_SUCCESS, or the first error a keyring raised */
+    int error;
+};
+
+struct child_decrypt {
+    struct parallel_decrypt *parallel;
+    struct aws_cryptosdk_keyring *keyring;
+    struct aws_byte_buf data_key;
+    struct aws_array_list trace;
+};
+
+struct child_encrypt {
+    struct parallel_encrypt *parallel;
+    struct aws_cryptosdk_keyring *child;
+    struct aws_array_list edks;
+    struct aws_array_list trace;
+    /* AWS_ERROR_SUCCESS, or the error the child raised */
+    int error;
 };
 
 static int call_on_encrypt_on_list(
@@ -31,40 +136,158 @@ static int call_on_encrypt_on_list(
     struct aws_array_list *keyring_trace,
     struct aws_array_list *edks,
     const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
     enum aws_cryptosdk_alg_id alg) {
     size_t num_keyrings = aws_array_list_length(keyrings);
     for (size_t list_idx = 0; list_idx < num_keyrings; ++list_idx) {
         struct aws_cryptosdk_keyring *child;
         if (aws_array_list_get_at(keyrings, (void *)&child, list_idx)) return AWS_OP_ERR;
-        if (aws_cryptosdk_keyring_on_encrypt(
-                child, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg))
+        if (aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx(
+                child, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, serialized_enc_ctx, alg))
             return AWS_OP_ERR;
     }
     return AWS_OP_SUCCESS;
 }
 
-static int multi_keyring_on_encrypt(
+static void run_child_encrypt(void *arg) {
+    struct child_encrypt *call        = arg;
+    struct parallel_encrypt *parallel = call->parallel;
+
+    call->error = AWS_ERROR_SUCCESS;
+    if (aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx(
+            call->child,
+            parallel->request_alloc,
+            parallel->unencrypted_data_key,
+            &call->trace,
+            &call->edks,
+            parallel->enc_ctx,
+            parallel->serialized_enc_ctx,
+            parallel->alg)) {
+        // Error codes are thread-local, so capture this one for the calling thread to re-raise
+        call->error = aws_last_error() ? aws_last_error() : AWS_ERROR_UNKNOWN;
+    }
+
+    aws_mutex_lock(&parallel->mutex);
+    parallel->pending--;
+    aws_condition_variable_notify_all(&parallel->cond);
+    aws_mutex_unlock(&parallel->mutex);
+}
+
+static bool parallel_encrypt_done(void *arg) {
+    struct parallel_encrypt *parallel = arg;
+
+    return !parallel->pending;
+}
+
+/*
+ * Calls On Encrypt on all children at once, each with lists of its own, and then appends their
+ * EDKs and trace records to edks and keyring_trace in child order.
+ */
+static int call_on_encrypt_on_list_parallel(
+    const struct multi_keyring *self,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    size_t num_children = aws_array_list_length(&self->children);
+    if (!num_children) return AWS_OP_SUCCESS;
+
+    struct parallel_encrypt parallel = { .mutex                = AWS_MUTEX_INIT,
+                                         .cond                 = AWS_CONDITION_VARIABLE_INIT,
+                                         .pending              = 0,
+                                         .request_alloc        = request_alloc,
+                                         .unencrypted_data_key = unencrypted_data_key,
+                                         .enc_ctx              = enc_ctx,
+                                         .serialized_enc_ctx   = serialized_enc_ctx,
+                                         .alg                  = alg };
+    struct child_encrypt *calls = aws_mem_calloc(request_alloc, num_children, sizeof(*calls));
+    if (!calls) return AWS_OP_ERR;
+
+    int ret          = AWS_OP_SUCCESS;
+    size_t num_ready = 0;
+    for (; num_ready < num_children; num_ready++) {
+        struct child_encrypt *call = &calls[num_ready];
+        call->parallel             = &parallel;
+        if (aws_array_list_get_at(&self->children, (void *)&call->child, num_ready) ||
+            aws_cryptosdk_edk_list_init(request_alloc, &call->edks)) {
+            ret = AWS_OP_ERR;
+            break;
+        }
+        if (aws_cryptosdk_keyring_trace_init_like(request_alloc, &call->trace, keyring_trace)) {
+            aws_cryptosdk_edk_list_clean_up(&call->edks);
+            ret = AWS_OP_ERR;
+            break;
+        }
+    }
+
+    if (ret == AWS_OP_SUCCESS) {
+        parallel.pending = num_children;
+        for (size_t idx = 1; idx < num_children; idx++) {
+            if (self->executor(run_child_encrypt, &calls[idx], self->executor_data)) {
+                aws_reset_error();
+                run_child_encrypt(&calls[idx]);
+            }
+        }
+        run_child_encrypt(&calls[0]);
+
+        aws_mutex_lock(&parallel.mutex);
+        aws_condition_variable_wait_pred(&parallel.cond, &parallel.mutex, parallel_encrypt_done, &parallel);
+        aws_mutex_unlock(&parallel.mutex);
+
+        for (size_t idx = 0; idx < num_children && ret == AWS_OP_SUCCESS; idx++) {
+            if (calls[idx].error != AWS_ERROR_SUCCESS) ret = aws_raise_error(calls[idx].error);
+        }
+        for (size_t idx = 0; idx < num_children && ret == AWS_OP_SUCCESS; idx++) {
+            if (aws_cryptosdk_transfer_list(edks, &calls[idx].edks) ||
+                aws_cryptosdk_transfer_list(keyring_trace, &calls[idx].trace)) {
+                ret = AWS_OP_ERR;
+            }
+        }
+    }
+
+    for (size_t idx = 0; idx < num_ready; idx++) {
+        aws_cryptosdk_edk_list_clean_up(&calls[idx].edks);
+        aws_cryptosdk_keyring_trace_clean_up(&calls[idx].trace);
+    }
+    aws_mem_release(request_alloc, calls);
+    aws_condition_variable_clean_up(&parallel.cond);
+    aws_mutex_clean_up(&parallel.mutex);
+    return ret;
+}
+
+static int multi_keyring_on_encrypt_with_serialized_ctx(
     struct aws_cryptosdk_keyring *multi,
     struct aws_allocator *request_alloc,
     struct aws_byte_buf *unencrypted_data_key,
     struct aws_array_list *keyring_trace,
     struct aws_array_list *edks,
     const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
     enum aws_cryptosdk_alg_id alg) {
     struct multi_keyring *self = (struct multi_keyring *)multi;
 
     struct aws_array_list my_edks;
     if (aws_cryptosdk_edk_list_init(request_alloc, &my_edks)) return AWS_OP_ERR;
     struct aws_array_list my_trace;
-    if (aws_cryptosdk_keyring_trace_init(request_alloc, &my_trace)) {
+    if (aws_cryptosdk_keyring_trace_init_like(request_alloc, &my_trace, keyring_trace)) {
         aws_cryptosdk_edk_list_clean_up(&my_edks);
         return AWS_OP_ERR;
     }
 
     int ret = AWS_OP_SUCCESS;
     if (self->generator &&
-        aws_cryptosdk_keyring_on_encrypt(
-            self->generator, request_alloc, unencrypted_data_key, &my_trace, &my_edks, enc_ctx, alg)) {
+        aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx(
+            self->generator,
+            request_alloc,
+            unencrypted_data_key,
+            &my_trace,
+            &my_edks,
+            enc_ctx,
+            serialized_enc_ctx,
+            alg)) {
         ret = AWS_OP_ERR;
         goto out;
     }
@@ -82,9 +305,20 @@ static int multi_keyring_on_encrypt(
         goto out;
     }
 
-    if (call_on_encrypt_on_list(
-            &self->children, request_alloc, unencrypted_data_key, &my_trace, &my_edks, enc_ctx, alg) ||
-        aws_cryptosdk_transfer_list(edks, &my_edks)) {
+    int children_ret =
+        self->executor
+            ? call_on_encrypt_on_list_parallel(
+                  self, request_alloc, unencrypted_data_key, &my_trace, &my_edks, enc_ctx, serialized_enc_ctx, alg)
+            : call_on_encrypt_on_list(
+                  &self->children,
+                  request_alloc,
+                  unencrypted_data_key,
+                  &my_trace,
+                  &my_edks,
+                  enc_ctx,
+                  serialized_enc_ctx,
+                  alg);
+    if (children_ret || aws_cryptosdk_transfer_list(edks, &my_edks)) {
         ret = AWS_OP_ERR;
         goto out;
     }
@@ -96,13 +330,511 @@ out:
     return ret;
 }
 
-static int multi_keyring_on_decrypt(
+static int multi_keyring_on_encrypt(
+    struct aws_cryptosdk_keyring *multi,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return multi_keyring_on_encrypt_with_serialized_ctx(
+        multi, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, NULL, alg);
+}
+
+/* One item of a batched On Encrypt, with the lists it collects EDKs and trace records in until all keyrings are done */
+struct batch_encrypt {
+    struct aws_cryptosdk_keyring_encrypt_item item;
+    struct aws_array_list my_edks;
+    struct aws_array_list my_trace;
+};
+
+/*
+ * Hands keyring one batch call for the items at calls which have not failed yet, and records
+ * the error of each item that fails in it. live and live_idx are scratch arrays of num_calls.
+ */
+static void call_on_encrypt_batch(
+    struct aws_cryptosdk_keyring *keyring,
+    struct aws_allocator *request_alloc,
+    struct batch_encrypt *calls,
+    size_t num_calls,
+    struct aws_cryptosdk_keyring_encrypt_item *live,
+    size_t *live_idx) {
+    size_t num_live = 0;
+
+    for (size_t i = 0; i < num_calls; i++) {
+        if (calls[i].item.error_code) continue;
+        live[num_live]       = calls[i].item;
+        live_idx[num_live++] = i;
+    }
+    if (!num_live) return;
+
+    // Failures are recorded per item, so the result says nothing the items do not
+    aws_cryptosdk_keyring_on_encrypt_batch(keyring, request_alloc, live, num_live);
+    for (size_t k = 0; k < num_live; k++) {
+        calls[live_idx[k]].item.error_code = live[k].error_code;
+    }
+}
+
+/*
+ * Batched On Encrypt: the generator, and then each child in turn, gets one batch call for all the
+ * items that are still going, so that each keyring can share its work across the messages.
+ * The executor is not used here; children which can overlap their work do so within the batch.
+ */
+static int multi_keyring_on_encrypt_batch(
+    struct aws_cryptosdk_keyring *multi,
+    struct aws_allocator *request_alloc,
+    struct aws_cryptosdk_keyring_encrypt_item *items,
+    size_t num_items) {
+    struct multi_keyring *self                      = (struct multi_keyring *)multi;
+    struct batch_encrypt *calls                     = aws_mem_calloc(request_alloc, num_items, sizeof(*calls));
+    struct aws_cryptosdk_keyring_encrypt_item *live = aws_mem_calloc(request_alloc, num_items, sizeof(*live));
+    size_t *live_idx                                = aws_mem_calloc(request_alloc, num_items, sizeof(*live_idx));
+    size_t num_ready                                = 0;
+    int ret                                         = AWS_OP_ERR;
+
+    if (!calls || !live || !live_idx) goto out;
+    for (; num_ready < num_items; num_ready++) {
+        struct batch_encrypt *call = &calls[num_ready];
+        if (aws_cryptosdk_edk_list_init(request_alloc, &call->my_edks)) goto out;
+        if (aws_cryptosdk_keyring_trace_init_like(request_alloc, &call->my_trace, items[num_ready].keyring_trace)) {
+            aws_cryptosdk_edk_list_clean_up(&call->my_edks);
+            goto out;
+        }
+        call->item               = items[num_ready];
+        call->item.edks          = &call->my_edks;
+        call->item.keyring_trace = &call->my_trace;
+        call->item.error_code    = AWS_ERROR_SUCCESS;
+    }
+
+    if (self->generator) call_on_encrypt_batch(self->generator, request_alloc, calls, num_items, live, live_idx);
+    for (size_t i = 0; i < num_items; i++) {
+        // As in On Encrypt, the generator must have made a data key if none was given
+        if (!calls[i].item.error_code && !calls[i].item.unencrypted_data_key->buffer) {
+            calls[i].item.error_code = AWS_CRYPTOSDK_ERR_BAD_STATE;
+        }
+    }
+
+    size_t num_children = aws_array_list_length(&self->children);
+    for (size_t list_idx = 0; list_idx < num_children; list_idx++) {
+        struct aws_cryptosdk_keyring *child;
+        if (aws_array_list_get_at(&self->children, (void *)&child, list_idx)) goto out;
+        call_on_encrypt_batch(child, request_alloc, calls, num_items, live, live_idx);
+    }
+
+    for (size_t i = 0; i < num_items; i++) {
+        items[i].error_code = calls[i].item.error_code;
+        if (items[i].error_code) continue;
+        if (aws_cryptosdk_transfer_list(items[i].edks, &calls[i].my_edks)) {
+            items[i].error_code = aws_last_error();
+            continue;
+        }
+        aws_cryptosdk_transfer_list(items[i].keyring_trace, &calls[i].my_trace);
+    }
+    ret = AWS_OP_SUCCESS;
+
+out:
+    for (size_t i = 0; i < num_ready; i++) {
+        aws_cryptosdk_edk_list_clean_up(&calls[i].my_edks);
+        aws_cryptosdk_keyring_trace_clean_up(&calls[i].my_trace);
+    }
+    if (live_idx) aws_mem_release(request_alloc, live_idx);
+    if (live) aws_mem_release(request_alloc, live);
+    if (calls) aws_mem_release(request_alloc, calls);
+    return ret;
+}
+
+static struct aws_cryptosdk_keyring *keyring_at(const struct multi_keyring *self, size_t position) {
+    struct aws_cryptosdk_keyring *keyring = NULL;
+
+    if (!position) return self->generator;
+    aws_array_list_get_at(&self->children, (void *)&keyring, position - 1);
+    return keyring;
+}
+
+static bool is_indexed(const struct multi_keyring *self, size_t position) {
+    bool indexed = false;
+
+    aws_array_list_get_at(&self->indexed, &indexed, position);
+    return indexed;
+}
+
+/*
+ * Sorts the EDKs out by the indexed keyrings that can decrypt them, into lists of shallow copies
+ * at routed, which has a list for each position. Lists of keyrings with no EDKs are left
+ * uninitialized, with a NULL allocator.
+ */
+static int route_edks(
+    const struct multi_keyring *self,
+    struct aws_allocator *request_alloc,
+    struct aws_array_list *routed,
+    const struct aws_array_list *edks) {
+    size_t num_edks = aws_array_list_length(edks);
+
+    for (size_t edk_idx = 0; edk_idx < num_edks; edk_idx++) {
+        const struct aws_cryptosdk_edk *edk;
+        if (aws_array_list_get_at_ptr(edks, (void **)&edk, edk_idx)) return AWS_OP_ERR;
+
+        struct aws_byte_cursor provider_id = aws_byte_cursor_from_buf(&edk->provider_id);
+        struct aws_hash_element *elem      = NULL;
+        aws_hash_table_find(&self->provider_index, &provider_id, &elem);
+        if (!elem) continue;
+
+        const struct provider_group *group = elem->value;
+        size_t num_keyrings                = aws_array_list_length(&group->keyrings);
+        for (size_t kr_idx = 0; kr_idx < num_keyrings; kr_idx++) {
+            const struct indexed_keyring *keyring;
+            if (aws_array_list_get_at_ptr(&group->keyrings, (void **)&keyring, kr_idx)) return AWS_OP_ERR;
+
+            if (!aws_cryptosdk_edk_matches_filter(edk, &group->provider_id, &keyring->provider_info_prefix)) continue;
+
+            struct aws_array_list *list = &routed[keyring->position];
+            if (!list->alloc && aws_array_list_init_dynamic(list, request_alloc, 2, sizeof(*edk))) return AWS_OP_ERR;
+            if (aws_array_list_push_back(list, edk)) return AWS_OP_ERR;
+        }
+    }
+    return AWS_OP_SUCCESS;
+}
+
+/* Returns whether an EDK before edk_idx has the same provider ID */
+static bool seen_provider_id(const struct aws_array_list *edks, size_t edk_idx, const struct aws_cryptosdk_edk *edk) {
+    for (size_t prev_idx = 0; prev_idx < edk_idx; prev_idx++) {
+        const struct aws_cryptosdk_edk *prev;
+        if (!aws_array_list_get_at_ptr(edks, (void **)&prev, prev_idx) &&
+            aws_byte_buf_eq(&prev->provider_id, &edk->provider_id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns the keyring's best success rate over the provider IDs of its EDKs. Call with stats_mutex held. */
+static uint32_t attempt_score(const struct multi_keyring *self, const struct decrypt_attempt *attempt) {
+    uint32_t best    = 0;
+    size_t num_edks = aws_array_list_length(attempt->edks);
+
+    for (size_t edk_idx = 0; edk_idx < num_edks; edk_idx++) {
+        const struct aws_cryptosdk_edk *edk;
+        if (aws_array_list_get_at_ptr(attempt->edks, (void **)&edk, edk_idx)) continue;
+
+        struct aws_byte_cursor provider_id = aws_byte_cursor_from_buf(&edk->provider_id);
+        struct aws_hash_element *elem      = NULL;
+        aws_hash_table_find(&self->decrypt_stats, &provider_id, &elem);
+        if (!elem) continue;
+
+        const struct provider_stats *stats = elem->value;
+        uint32_t score                     = 0;
+        aws_array_list_get_at(&stats->scores, &score, attempt->position);
+        if (score > best) best = score;
+    }
+    return best;
+}
+
+/*
+ * Scores the attempts and sorts them by score, highest first, leaving the generator first unless
+ * it is ranked too. The sort is stable, so that ties keep the order of the keyrings.
+ */
+static void order_attempts(struct multi_keyring *self, struct decrypt_attempt *attempts, size_t num_attempts) {
+    aws_mutex_lock(&self->stats_mutex);
+    for (size_t idx = 0; idx < num_attempts; idx++) {
+        attempts[idx].score = attempt_score(self, &attempts[idx]);
+    }
+    aws_mutex_unlock(&self->stats_mutex);
+
+    size_t first = 0;
+    if (self->decrypt_order == AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_ADAPTIVE && num_attempts &&
+        attempts[0].position == 0) {
+        first = 1;
+    }
+    for (size_t idx = first + 1; idx < num_attempts; idx++) {
+        struct decrypt_attempt attempt = attempts[idx];
+        size_t dest                    = idx;
+        for (; dest > first && attempts[dest - 1].score < attempt.score; dest--) {
+            attempts[dest] = attempts[dest - 1];
+        }
+        attempts[dest] = attempt;
+    }
+}
+
+static void destroy_provider_stats(void *value) {
+    struct provider_stats *stats = value;
+
+    aws_array_list_clean_up(&stats->scores);
+    aws_mem_release(stats->alloc, stats);
+}
+
+/* Returns the scores for provider_id, creating them if there is room. Call with stats_mutex held. */
+static struct aws_array_list *scores_for(struct multi_keyring *self, const struct aws_byte_buf *provider_id) {
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_buf(provider_id);
+    struct aws_hash_element *elem = NULL;
+
+    aws_hash_table_find(&self->decrypt_stats, &cursor, &elem);
+    if (elem) return &((struct provider_stats *)elem->value)->scores;
+    if (aws_hash_table_get_entry_count(&self->decrypt_stats) >= AWS_CRYPTOSDK_MULTI_KEYRING_MAX_TRACKED_PROVIDERS) {
+        return NULL;
+    }
+
+    struct provider_stats *stats = aws_mem_acquire(self->alloc, sizeof(*stats) + cursor.len);
+    if (!stats) return NULL;
+    stats->alloc       = self->alloc;
+    stats->provider_id = aws_byte_cursor_from_array(stats + 1, cursor.len);
+    if (cursor.len) memcpy(stats + 1, cursor.ptr, cursor.len);
+    if (aws_array_list_init_dynamic(&stats->scores, self->alloc, 4, sizeof(uint32_t))) {
+        aws_mem_release(self->alloc, stats);
+        return NULL;
+    }
+    if (aws_hash_table_put(&self->decrypt_stats, &stats->provider_id, stats, NULL)) {
+        destroy_provider_stats(stats);
+        return NULL;
+    }
+    return &stats->scores;
+}
+
+/* Moves the keyring's success rate for each provider ID of its EDKs towards its outcome */
+static void record_outcome(struct multi_keyring *self, const struct decrypt_attempt *attempt, bool decrypted) {
+    size_t num_edks = aws_array_list_length(attempt->edks);
+
+    for (size_t edk_idx = 0; edk_idx < num_edks; edk_idx++) {
+        const struct aws_cryptosdk_edk *edk;
+        if (aws_array_list_get_at_ptr(attempt->edks, (void **)&edk, edk_idx) ||
+            seen_provider_id(attempt->edks, edk_idx, edk)) {
+            continue;
+        }
+
+        struct aws_array_list *scores = scores_for(self, &edk->provider_id);
+        if (!scores) continue;
+
+        uint32_t zero = 0;
+        while (aws_array_list_length(scores) <= attempt->position) {
+            if (aws_array_list_push_back(scores, &zero)) break;
+        }
+
+        uint32_t *score;
+        if (aws_array_list_get_at_ptr(scores, (void **)&score, attempt->position)) continue;
+        if (decrypted) {
+            *score += (DECRYPT_SCORE_ONE - *score) / DECRYPT_SCORE_WEIGHT;
+        } else {
+            *score -= *score / DECRYPT_SCORE_WEIGHT;
+        }
+    }
+}
+
+static void parallel_decrypt_destroy(struct parallel_decrypt *parallel) {
+    struct aws_allocator *alloc         = parallel->alloc;
+    struct aws_cryptosdk_keyring *multi = parallel->multi;
+
+    for (size_t idx = 0; idx < parallel->num_calls; idx++) {
+        aws_byte_buf_clean_up_secure(&parallel->calls[idx].data_key);
+        aws_cryptosdk_keyring_trace_clean_up(&parallel->calls[idx].trace);
+    }
+    if (parallel->calls) aws_mem_release(alloc, parallel->calls);
+    aws_cryptosdk_edk_list_clean_up(&parallel->edks);
+    if (parallel->has_enc_ctx) aws_cryptosdk_enc_ctx_clean_up(&parallel->enc_ctx);
+    aws_byte_buf_clean_up(&parallel->serialized_enc_ctx);
+    aws_condition_variable_clean_up(&parallel->cond);
+    aws_mutex_clean_up(&parallel->mutex);
+    aws_mem_release(alloc, parallel);
+
+    // This may destroy the multi-keyring, whose allocator the state came from
+    aws_cryptosdk_keyring_release(multi);
+}
+
+static void run_child_decrypt(void *arg) {
+    struct child_decrypt *call        = arg;
+    struct parallel_decrypt *parallel = call->parallel;
+    struct aws_byte_cursor serialized = aws_byte_cursor_from_buf(&parallel->serialized_enc_ctx);
+    int error                         = AWS_ERROR_SUCCESS;
+
+    if (aws_cryptosdk_keyring_on_decrypt_with_serialized_ctx(
+            call->keyring,
+            parallel->alloc,
+            &call->data_key,
+            &call->trace,
+            &parallel->edks,
+            parallel->has_enc_ctx ? &parallel->enc_ctx : NULL,
+            parallel->has_serialized_enc_ctx ? &serialized : NULL,
+            parallel->alg)) {
+        // Error codes are thread-local, so capture this one for the calling thread to re-raise
+        error = aws_last_error() ? aws_last_error() : AWS_ERROR_UNKNOWN;
+    }
+
+    aws_mutex_lock(&parallel->mutex);
+    bool won = call->data_key.buffer && !parallel->winner;
+    if (won) parallel->winner = call;
+    if (error && !parallel->error) parallel->error = error;
+    parallel->pending--;
+    bool last = !--parallel->refs;
+    aws_condition_variable_notify_all(&parallel->cond);
+    aws_mutex_unlock(&parallel->mutex);
+
+    // Only the winner's data key is used; any other is wiped as soon as it is known to be unwanted
+    if (!won) aws_byte_buf_clean_up_secure(&call->data_key);
+    if (last) parallel_decrypt_destroy(parallel);
+}
+
+static bool parallel_decrypt_done(void *arg) {
+    struct parallel_decrypt *parallel = arg;
+
+    return parallel->winner || !parallel->pending;
+}
+
+/*
+ * Sets up the state for a concurrent On Decrypt of the keyrings at positions, with copies of the
+ * inputs, all allocated with the multi-keyring's allocator as the calls may outlive the request.
+ */
+static struct parallel_decrypt *parallel_decrypt_new(
+    struct multi_keyring *self,
+    const size_t *positions,
+    size_t num_calls,
+    const struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct parallel_decrypt *parallel = aws_mem_calloc(self->alloc, 1, sizeof(*parallel));
+    if (!parallel) return NULL;
+    if (aws_mutex_init(&parallel->mutex)) goto err_parallel;
+    if (aws_condition_variable_init(&parallel->cond)) goto err_mutex;
+
+    parallel->alloc = self->alloc;
+    parallel->multi = aws_cryptosdk_keyring_retain(&self->base);
+    parallel->alg   = alg;
+    parallel->refs  = 1;
+
+    // From here on, parallel_decrypt_destroy frees whatever has been set up
+    if (!(parallel->calls = aws_mem_calloc(self->alloc, num_calls, sizeof(*parallel->calls))) ||
+        aws_cryptosdk_edk_list_init(self->alloc, &parallel->edks) ||
+        aws_cryptosdk_edk_list_copy_all(self->alloc, &parallel->edks, edks)) {
+        goto err_destroy;
+    }
+    if (enc_ctx) {
+        if (aws_cryptosdk_enc_ctx_init(self->alloc, &parallel->enc_ctx)) goto err_destroy;
+        parallel->has_enc_ctx = true;
+        if (aws_cryptosdk_enc_ctx_clone(self->alloc, &parallel->enc_ctx, enc_ctx)) goto err_destroy;
+    }
+    if (serialized_enc_ctx) {
+        if (aws_byte_buf_init_copy_from_cursor(&parallel->serialized_enc_ctx, self->alloc, *serialized_enc_ctx)) {
+            goto err_destroy;
+        }
+        parallel->has_serialized_enc_ctx = true;
+    }
+    for (; parallel->num_calls < num_calls; parallel->num_calls++) {
+        struct child_decrypt *call = &parallel->calls[parallel->num_calls];
+        call->parallel             = parallel;
+        call->keyring              = keyring_at(self, positions[parallel->num_calls]);
+        if (aws_cryptosdk_keyring_trace_init_like(self->alloc, &call->trace, keyring_trace)) goto err_destroy;
+    }
+
+    return parallel;
+
+err_destroy:
+    parallel_decrypt_destroy(parallel);
+    return NULL;
+err_mutex:
+    aws_mutex_clean_up(&parallel->mutex);
+err_parallel:
+    aws_mem_release(self->alloc, parallel);
+    return NULL;
+}
+
+/*
+ * On Decrypt with all the keyrings that may decrypt the message called at once through the
+ * executor, taking the data key from whichever decrypts it first. Indexed keyrings are handed
+ * every EDK rather than just their own, which they skip anyway, so that the calls can share one
+ * copy of the list. Keyrings still running when this returns finish in the background, and their
+ * data keys are wiped. The order of the keyrings, and so their success rates, do not apply.
+ */
+static int parallel_on_decrypt(
+    struct multi_keyring *self,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    size_t num_positions = aws_array_list_length(&self->children) + 1;
+    size_t *positions    = aws_mem_calloc(request_alloc, num_positions, sizeof(*positions));
+    size_t num_calls     = 0;
+    if (!positions) return AWS_OP_ERR;
+
+    for (size_t position = 0; position < num_positions; ++position) {
+        const struct aws_cryptosdk_keyring *keyring = keyring_at(self, position);
+        if (keyring && (!is_indexed(self, position) || aws_cryptosdk_keyring_may_decrypt(keyring, edks))) {
+            positions[num_calls++] = position;
+        }
+    }
+
+    // With fewer than two keyrings to call there is nothing to race
+    if (num_calls < 2) {
+        int ret = AWS_OP_SUCCESS;
+        if (num_calls) {
+            ret = aws_cryptosdk_keyring_on_decrypt_with_serialized_ctx(
+                keyring_at(self, positions[0]),
+                request_alloc,
+                unencrypted_data_key,
+                keyring_trace,
+                edks,
+                enc_ctx,
+                serialized_enc_ctx,
+                alg);
+        }
+        aws_mem_release(request_alloc, positions);
+        return ret;
+    }
+
+    struct parallel_decrypt *parallel =
+        parallel_decrypt_new(self, positions, num_calls, keyring_trace, edks, enc_ctx, serialized_enc_ctx, alg);
+    aws_mem_release(request_alloc, positions);
+    if (!parallel) return AWS_OP_ERR;
+
+    aws_mutex_lock(&parallel->mutex);
+    parallel->refs += num_calls;
+    parallel->pending = num_calls;
+    aws_mutex_unlock(&parallel->mutex);
+
+    size_t num_started = 0;
+    for (; num_started < num_calls; num_started++) {
+        // Stop handing out calls once some keyring has decrypted the data key
+        aws_mutex_lock(&parallel->mutex);
+        bool decided = parallel->winner != NULL;
+        aws_mutex_unlock(&parallel->mutex);
+        if (decided) break;
+
+        if (self->executor(run_child_decrypt, &parallel->calls[num_started], self->executor_data)) {
+            aws_reset_error();
+            run_child_decrypt(&parallel->calls[num_started]);
+        }
+    }
+
+    int ret = AWS_OP_SUCCESS;
+    aws_mutex_lock(&parallel->mutex);
+    parallel->refs -= num_calls - num_started;
+    parallel->pending -= num_calls - num_started;
+    aws_condition_variable_wait_pred(&parallel->cond, &parallel->mutex, parallel_decrypt_done, parallel);
+    if (parallel->winner) {
+        // The winner's call has finished, so its data key and trace are the caller's to take
+        *unencrypted_data_key = parallel->winner->data_key;
+        memset(&parallel->winner->data_key, 0, sizeof(parallel->winner->data_key));
+        aws_cryptosdk_transfer_list(keyring_trace, &parallel->winner->trace);
+    } else if (parallel->error) {
+        ret = aws_raise_error(parallel->error);
+    }
+    bool last = !--parallel->refs;
+    aws_mutex_unlock(&parallel->mutex);
+
+    if (last) parallel_decrypt_destroy(parallel);
+    return ret;
+}
+
+static int multi_keyring_on_decrypt_with_serialized_ctx(
     struct aws_cryptosdk_keyring *multi,
     struct aws_allocator *request_alloc,
     struct aws_byte_buf *unencrypted_data_key,
     struct aws_array_list *keyring_trace,
     const struct aws_array_list *edks,
     const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
     enum aws_cryptosdk_alg_id alg) {
     /* If one of the contained keyrings succeeds at decrypting the data key, return success,
      * but if we fail to decrypt the data key, only return success if there were no
@@ -111,28 +843,265 @@ static int multi_keyring_on_decrypt(
     int ret_if_no_decrypt = AWS_OP_SUCCESS;
 
     struct multi_keyring *self = (struct multi_keyring *)multi;
+    size_t num_positions       = aws_array_list_length(&self->children) + 1;
 
-    if (self->generator) {
-        int decrypt_err = aws_cryptosdk_keyring_on_decrypt(
-            self->generator, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
-        if (unencrypted_data_key->buffer) return AWS_OP_SUCCESS;
-        if (decrypt_err) ret_if_no_decrypt = AWS_OP_ERR;
+    if (self->executor && self->parallel_decrypt) {
+        return parallel_on_decrypt(
+            self, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, serialized_enc_ctx, alg);
     }
 
-    size_t num_children = aws_array_list_length(&self->children);
-    for (size_t child_idx = 0; child_idx < num_children; ++child_idx) {
-        struct aws_cryptosdk_keyring *child;
-        if (aws_array_list_get_at(&self->children, (void *)&child, child_idx)) return AWS_OP_ERR;
+    /* Keyrings which describe their EDKs are only handed those, and not called at all unless
+     * the message has some; the others are handed every EDK.
+     */
+    struct aws_array_list *routed = NULL;
+    if (aws_hash_table_get_entry_count(&self->provider_index)) {
+        routed = aws_mem_calloc(request_alloc, num_positions, sizeof(*routed));
+        if (!routed) return AWS_OP_ERR;
+        if (route_edks(self, request_alloc, routed, edks)) {
+            ret_if_no_decrypt = AWS_OP_ERR;
+            goto out;
+        }
+    }
+
+    struct decrypt_attempt *attempts = aws_mem_calloc(request_alloc, num_positions, sizeof(*attempts));
+    if (!attempts) {
+        ret_if_no_decrypt = AWS_OP_ERR;
+        goto out;
+    }
+
+    size_t num_attempts = 0;
+    for (size_t position = 0; position < num_positions; ++position) {
+        if (!keyring_at(self, position)) continue;
+
+        struct decrypt_attempt *attempt = &attempts[num_attempts++];
+        attempt->position               = position;
+        attempt->edks                   = edks;
+        if (routed && is_indexed(self, position)) {
+            if (!routed[position].alloc) {
+                num_attempts--;
+                continue;
+            }
+            attempt->edks = &routed[position];
+        }
+    }
+
+    bool adaptive = self->decrypt_order != AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_IN_ORDER;
+    if (adaptive) order_attempts(self, attempts, num_attempts);
+
+    size_t num_tried = 0;
+    while (num_tried < num_attempts) {
+        const struct decrypt_attempt *attempt = &attempts[num_tried++];
 
         // if decrypt data key fails, keep trying with other keyrings
-        int decrypt_err = aws_cryptosdk_keyring_on_decrypt(
-            child, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
-        if (unencrypted_data_key->buffer) return AWS_OP_SUCCESS;
+        int decrypt_err = aws_cryptosdk_keyring_on_decrypt_with_serialized_ctx(
+            keyring_at(self, attempt->position),
+            request_alloc,
+            unencrypted_data_key,
+            keyring_trace,
+            attempt->edks,
+            enc_ctx,
+            serialized_enc_ctx,
+            alg);
+        if (unencrypted_data_key->buffer) {
+            ret_if_no_decrypt = AWS_OP_SUCCESS;
+            break;
+        }
         if (decrypt_err) ret_if_no_decrypt = AWS_OP_ERR;
     }
+
+    if (adaptive) {
+        // Keeping the rates may run out of memory, which must not replace the keyrings' error
+        int error = aws_last_error();
+        aws_mutex_lock(&self->stats_mutex);
+        for (size_t idx = 0; idx < num_tried; idx++) {
+            record_outcome(self, &attempts[idx], unencrypted_data_key->buffer && idx == num_tried - 1);
+        }
+        aws_mutex_unlock(&self->stats_mutex);
+        aws_raise_error(error);
+    }
+    aws_mem_release(request_alloc, attempts);
+
+out:
+    if (routed) {
+        for (size_t position = 0; position < num_positions; ++position) {
+            if (routed[position].alloc) aws_array_list_clean_up(&routed[position]);
+        }
+        aws_mem_release(request_alloc, routed);
+    }
     return ret_if_no_decrypt;
 }
 
+static int multi_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *multi,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return multi_keyring_on_decrypt_with_serialized_ctx(
+        multi, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, NULL, alg);
+}
+
+/*
+ * Batched On Decrypt. In order, each keyring gets one batch call for the items it has not been
+ * ruled out for, which still have no data key, so that the first keyring able to decrypt most
+ * of the messages is asked for all of them at once. Indexed keyrings are handed every EDK of
+ * the messages they may decrypt, rather than just their own, as keyrings skip EDKs they cannot
+ * decrypt anyway. Adaptive orders differ from message to message, and concurrent calls race
+ * each message separately, so neither is batched.
+ */
+static int multi_keyring_on_decrypt_batch(
+    struct aws_cryptosdk_keyring *multi,
+    struct aws_allocator *request_alloc,
+    struct aws_cryptosdk_keyring_decrypt_item *items,
+    size_t num_items) {
+    struct multi_keyring *self = (struct multi_keyring *)multi;
+
+    bool parallel = self->executor && self->parallel_decrypt;
+    if (self->decrypt_order != AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_IN_ORDER || parallel) {
+        for (size_t i = 0; i < num_items; i++) {
+            struct aws_cryptosdk_keyring_decrypt_item *item = &items[i];
+            item->error_code                                = AWS_ERROR_SUCCESS;
+            if (multi_keyring_on_decrypt_with_serialized_ctx(
+                    multi,
+                    request_alloc,
+                    item->unencrypted_data_key,
+                    item->keyring_trace,
+                    item->edks,
+                    item->enc_ctx,
+                    item->serialized_enc_ctx,
+                    item->alg)) {
+                item->error_code = aws_last_error() ? aws_last_error() : AWS_ERROR_UNKNOWN;
+            }
+        }
+        return AWS_OP_SUCCESS;
+    }
+
+    struct aws_cryptosdk_keyring_decrypt_item *live = aws_mem_calloc(request_alloc, num_items, sizeof(*live));
+    size_t *live_idx                                = aws_mem_calloc(request_alloc, num_items, sizeof(*live_idx));
+    if (!live || !live_idx) {
+        if (live) aws_mem_release(request_alloc, live);
+        return AWS_OP_ERR;
+    }
+
+    // As in On Decrypt, an item only fails if no keyring decrypts it and some keyring failed on it
+    for (size_t i = 0; i < num_items; i++) items[i].error_code = AWS_ERROR_SUCCESS;
+
+    size_t num_positions = aws_array_list_length(&self->children) + 1;
+    for (size_t position = 0; position < num_positions; ++position) {
+        struct aws_cryptosdk_keyring *keyring = keyring_at(self, position);
+        if (!keyring) continue;
+
+        size_t num_live = 0;
+        for (size_t i = 0; i < num_items; i++) {
+            if (items[i].unencrypted_data_key->buffer) continue;
+            if (is_indexed(self, position) && !aws_cryptosdk_keyring_may_decrypt(keyring, items[i].edks)) continue;
+            live[num_live]       = items[i];
+            live_idx[num_live++] = i;
+        }
+        if (!num_live) continue;
+
+        aws_cryptosdk_keyring_on_decrypt_batch(keyring, request_alloc, live, num_live);
+        for (size_t k = 0; k < num_live; k++) {
+            struct aws_cryptosdk_keyring_decrypt_item *item = &items[live_idx[k]];
+            if (live[k].error_code && !item->error_code) item->error_code = live[k].error_code;
+        }
+    }
+
+    for (size_t i = 0; i < num_items; i++) {
+        if (items[i].unencrypted_data_key->buffer) items[i].error_code = AWS_ERROR_SUCCESS;
+    }
+    aws_mem_release(request_alloc, live_idx);
+    aws_mem_release(request_alloc, live);
+    return AWS_OP_SUCCESS;
+}
+
+static bool multi_keyring_may_decrypt(const struct aws_cryptosdk_keyring *multi, const struct aws_array_list *edks) {
+    const struct multi_keyring *self = (const struct multi_keyring *)multi;
+    size_t num_positions             = aws_array_list_length(&self->children) + 1;
+
+    // Keyrings outside the index are asked themselves
+    for (size_t position = 0; position < num_positions; position++) {
+        const struct aws_cryptosdk_keyring *keyring = keyring_at(self, position);
+        if (keyring && !is_indexed(self, position) && aws_cryptosdk_keyring_may_decrypt(keyring, edks)) return true;
+    }
+
+    size_t num_edks = aws_array_list_length(edks);
+    for (size_t edk_idx = 0; edk_idx < num_edks; edk_idx++) {
+        const struct aws_cryptosdk_edk *edk;
+        if (aws_array_list_get_at_ptr(edks, (void **)&edk, edk_idx)) continue;
+
+        struct aws_byte_cursor provider_id = aws_byte_cursor_from_buf(&edk->provider_id);
+        struct aws_hash_element *elem      = NULL;
+        aws_hash_table_find(&self->provider_index, &provider_id, &elem);
+        if (!elem) continue;
+
+        const struct provider_group *group = elem->value;
+        size_t num_keyrings                = aws_array_list_length(&group->keyrings);
+        for (size_t kr_idx = 0; kr_idx < num_keyrings; kr_idx++) {
+            const struct indexed_keyring *keyring;
+            if (!aws_array_list_get_at_ptr(&group->keyrings, (void **)&keyring, kr_idx) &&
+                aws_cryptosdk_edk_matches_filter(edk, &group->provider_id, &keyring->provider_info_prefix)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool provider_id_eq(const void *a, const void *b) {
+    return aws_byte_cursor_eq(a, b);
+}
+
+static void destroy_provider_group(void *value) {
+    struct provider_group *group = value;
+
+    aws_array_list_clean_up(&group->keyrings);
+    aws_mem_release(group->alloc, group);
+}
+
+/*
+ * Adds the keyring at position to provider_index if it describes its EDKs, and records whether
+ * it did in indexed.
+ */
+static int index_keyring(struct multi_keyring *self, struct aws_cryptosdk_keyring *keyring, size_t position) {
+    struct indexed_keyring entry = { .position = position };
+    struct aws_byte_cursor provider_id;
+    bool indexed = keyring && !aws_cryptosdk_keyring_get_edk_filter(keyring, &provider_id, &entry.provider_info_prefix);
+
+    if (!indexed) {
+        aws_reset_error();
+        return aws_array_list_push_back(&self->indexed, &indexed);
+    }
+
+    struct aws_hash_element *elem = NULL;
+    aws_hash_table_find(&self->provider_index, &provider_id, &elem);
+    if (!elem) {
+        struct provider_group *group = aws_mem_acquire(self->alloc, sizeof(*group));
+        if (!group) return AWS_OP_ERR;
+        group->alloc       = self->alloc;
+        group->provider_id = provider_id;
+        if (aws_array_list_init_dynamic(&group->keyrings, self->alloc, 1, sizeof(struct indexed_keyring))) {
+            aws_mem_release(self->alloc, group);
+            return AWS_OP_ERR;
+        }
+        if (aws_hash_table_put(&self->provider_index, &group->provider_id, group, NULL)) {
+            destroy_provider_group(group);
+            return AWS_OP_ERR;
+        }
+        aws_hash_table_find(&self->provider_index, &provider_id, &elem);
+    }
+
+    struct provider_group *group = elem->value;
+    if (aws_array_list_push_back(&group->keyrings, &entry)) return AWS_OP_ERR;
+    if (aws_array_list_push_back(&self->indexed, &indexed)) {
+        aws_array_list_pop_back(&group->keyrings);
+        return AWS_OP_ERR;
+    }
+    return AWS_OP_SUCCESS;
+}
+
 static void multi_keyring_destroy(struct aws_cryptosdk_keyring *multi) {
     struct multi_keyring *self = (struct multi_keyring *)multi;
     size_t n_keys              = aws_array_list_length(&self->children);
@@ -147,36 +1116,122 @@ static void multi_keyring_destroy(struct aws_cryptosdk_keyring *multi) {
     aws_cryptosdk_keyring_release(self->generator);
 
     aws_array_list_clean_up(&self->children);
+    aws_array_list_clean_up(&self->indexed);
+    aws_hash_table_clean_up(&self->provider_index);
+    aws_hash_table_clean_up(&self->decrypt_stats);
+    aws_mutex_clean_up(&self->stats_mutex);
     aws_mem_release(self->alloc, self);
 }
 
-static const struct aws_cryptosdk_keyring_vt vt = { .vt_size    = sizeof(struct aws_cryptosdk_keyring_vt),
-                                                    .name       = "multi keyring",
-                                                    .destroy    = multi_keyring_destroy,
-                                                    .on_encrypt = multi_keyring_on_encrypt,
-                                                    .on_decrypt = multi_keyring_on_decrypt };
+static const struct aws_cryptosdk_keyring_vt vt = {
+    .vt_size                        = sizeof(struct aws_cryptosdk_keyring_vt),
+    .name                           = "multi keyring",
+    .destroy                        = multi_keyring_destroy,
+    .on_encrypt                     = multi_keyring_on_encrypt,
+    .on_decrypt                     = multi_keyring_on_decrypt,
+    .on_encrypt_with_serialized_ctx = multi_keyring_on_encrypt_with_serialized_ctx,
+    .on_decrypt_with_serialized_ctx = multi_keyring_on_decrypt_with_serialized_ctx,
+    .may_decrypt                    = multi_keyring_may_decrypt,
+    .on_encrypt_batch               = multi_keyring_on_encrypt_batch,
+    .on_decrypt_batch               = multi_keyring_on_decrypt_batch
+};
 
 struct aws_cryptosdk_keyring *aws_cryptosdk_multi_keyring_new(
     struct aws_allocator *alloc, struct aws_cryptosdk_keyring *generator) {
     struct multi_keyring *multi = aws_mem_acquire(alloc, sizeof(struct multi_keyring));
     if (!multi) return NULL;
     if (aws_array_list_init_dynamic(&multi->children, alloc, 4, sizeof(struct aws_cryptosdk_keyring *))) {
-        aws_mem_release(alloc, multi);
-        return NULL;
+        goto err_multi;
+    }
+    if (aws_array_list_init_dynamic(&multi->indexed, alloc, 5, sizeof(bool))) goto err_children;
+    if (aws_hash_table_init(
+            &multi->provider_index,
+            alloc,
+            4,
+            aws_hash_byte_cursor_ptr,
+            provider_id_eq,
+            NULL,
+            destroy_provider_group)) {
+        goto err_indexed;
+    }
+    if (aws_hash_table_init(
+            &multi->decrypt_stats,
+            alloc,
+            4,
+            aws_hash_byte_cursor_ptr,
+            provider_id_eq,
+            NULL,
+            destroy_provider_stats)) {
+        goto err_provider_index;
     }
+    if (aws_mutex_init(&multi->stats_mutex)) goto err_decrypt_stats;
 
     aws_cryptosdk_keyring_base_init(&multi->base, &vt);
 
+    multi->generator        = NULL;
+    multi->alloc            = alloc;
+    multi->executor         = NULL;
+    multi->executor_data    = NULL;
+    multi->decrypt_order    = AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_IN_ORDER;
+    multi->parallel_decrypt = false;
+    if (index_keyring(multi, generator, 0)) goto err_mutex;
+
     if (generator) aws_cryptosdk_keyring_retain(generator);
     multi->generator = generator;
-    multi->alloc     = alloc;
     return (struct aws_cryptosdk_keyring *)multi;
+
+err_mutex:
+    aws_mutex_clean_up(&multi->stats_mutex);
+err_decrypt_stats:
+    aws_hash_table_clean_up(&multi->decrypt_stats);
+err_provider_index:
+    aws_hash_table_clean_up(&multi->provider_index);
+err_indexed:
+    aws_array_list_clean_up(&multi->indexed);
+err_children:
+    aws_array_list_clean_up(&multi->children);
+err_multi:
+    aws_mem_release(alloc, multi);
+    return NULL;
+}
+
+void aws_cryptosdk_multi_keyring_set_executor(
+    struct aws_cryptosdk_keyring *multi, aws_cryptosdk_executor_fn *executor, void *executor_data) {
+    struct multi_keyring *self = (struct multi_keyring *)multi;
+
+    self->executor      = executor;
+    self->executor_data = executor_data;
+}
+
+void aws_cryptosdk_multi_keyring_set_parallel_decrypt(struct aws_cryptosdk_keyring *multi, bool enabled) {
+    struct multi_keyring *self = (struct multi_keyring *)multi;
+
+    self->parallel_decrypt = enabled;
+}
+
+int aws_cryptosdk_multi_keyring_set_decrypt_order(
+    struct aws_cryptosdk_keyring *multi, enum aws_cryptosdk_multi_keyring_decrypt_order order) {
+    struct multi_keyring *self = (struct multi_keyring *)multi;
+
+    if (order != AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_IN_ORDER &&
+        order != AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_ADAPTIVE &&
+        order != AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_ADAPTIVE_ALL) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    self->decrypt_order = order;
+    return AWS_OP_SUCCESS;
 }
 
 int aws_cryptosdk_multi_keyring_add_child(struct aws_cryptosdk_keyring *multi, struct aws_cryptosdk_keyring *child) {
     struct multi_keyring *self = (struct multi_keyring *)multi;
 
-    aws_cryptosdk_keyring_retain(child);
+    if (aws_array_list_push_back(&self->children, (void *)&child)) return AWS_OP_ERR;
+    if (index_keyring(self, child, aws_array_list_length(&self->children))) {
+        aws_array_list_pop_back(&self->children);
+        return AWS_OP_ERR;
+    }
 
-    return aws_array_list_push_back(&self->children, (void *)&child);
+    aws_cryptosdk_keyring_retain(child);
+    return AWS_OP_SUCCESS;
 }
@@ -0,0 +1,275 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/pipeline.h>
+#include <aws/cryptosdk/private/session.h>
+
+/*
+ * The session runs on the producer's thread. Output goes into a ring of buffers passed to the
+ * consumer; a buffer belongs to the producer until it is published, and to the consumer until
+ * it has been read in full and is released.
+ */
+struct aws_cryptosdk_pipeline {
+    struct aws_allocator *alloc;
+    struct aws_cryptosdk_session *session;
+    struct aws_byte_buf *slots;
+    size_t depth;
+    /* Input the session has yet to consume, and the total written; touched only by the producer */
+    struct aws_byte_buf acc;
+    uint64_t total_in;
+
+    struct aws_mutex mutex;
+    struct aws_condition_variable changed;
+    /* Bytes of the slot at head already read; touched only by the consumer */
+    size_t head_read;
+    /* The fields below are guarded by mutex */
+    size_t head, count;
+    /* Set once the message is complete and all of its output is published */
+    bool eof;
+    /* Error which ended the message, if any; the other side stops as soon as it notices */
+    int error;
+};
+
+struct aws_cryptosdk_pipeline *aws_cryptosdk_pipeline_new(
+    struct aws_allocator *alloc, struct aws_cryptosdk_session *session, size_t depth) {
+    if (!session || !depth || depth > SIZE_MAX / sizeof(struct aws_byte_buf)) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct aws_cryptosdk_pipeline *pipeline = aws_mem_calloc(alloc, 1, sizeof(*pipeline));
+    if (!pipeline) return NULL;
+
+    if (!(pipeline->slots = aws_mem_calloc(alloc, depth, sizeof(*pipeline->slots)))) goto err_pipeline;
+    if (aws_mutex_init(&pipeline->mutex)) goto err_slots;
+    if (aws_condition_variable_init(&pipeline->changed)) goto err_mutex;
+
+    // Buffers start out empty, and grow to what the session asks for the first time they are used
+    struct aws_allocator *buf_alloc = aws_cryptosdk_priv_buffer_alloc(session);
+    for (size_t i = 0; i < depth; i++) {
+        pipeline->slots[i].allocator = buf_alloc;
+    }
+    pipeline->acc.allocator = buf_alloc;
+    pipeline->alloc         = alloc;
+    pipeline->session       = session;
+    pipeline->depth         = depth;
+
+    return pipeline;
+
+err_mutex:
+    aws_mutex_clean_up(&pipeline->mutex);
+err_slots:
+    aws_mem_release(alloc, pipeline->slots);
+err_pipeline:
+    aws_mem_release(alloc, pipeline);
+    return NULL;
+}
+
+void aws_cryptosdk_pipeline_destroy(struct aws_cryptosdk_pipeline *pipeline) {
+    if (!pipeline) return;
+
+    for (size_t i = 0; i < pipeline->depth; i++) {
+        // Slots may hold plaintext
+        if (pipeline->slots[i].buffer) aws_byte_buf_clean_up_secure(&pipeline->slots[i]);
+    }
+    if (pipeline->acc.buffer) aws_byte_buf_clean_up_secure(&pipeline->acc);
+
+    aws_condition_variable_clean_up(&pipeline->changed);
+    aws_mutex_clean_up(&pipeline->mutex);
+    aws_mem_release(pipeline->alloc, pipeline->slots);
+    aws_mem_release(pipeline->alloc, pipeline);
+}
+
+/* Ends the message with the error last raised, and wakes the other side. Returns AWS_OP_ERR. */
+static int fail_pipeline(struct aws_cryptosdk_pipeline *pipeline) {
+    int error = aws_last_error();
+
+    aws_mutex_lock(&pipeline->mutex);
+    if (!pipeline->error) pipeline->error = error ? error : AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
+    error = pipeline->error;
+    aws_condition_variable_notify_all(&pipeline->changed);
+    aws_mutex_unlock(&pipeline->mutex);
+
+    return aws_raise_error(error);
+}
+
+/* Waits for a free slot; returns NULL if the message has failed. */
+static struct aws_byte_buf *producer_slot(struct aws_cryptosdk_pipeline *pipeline) {
+    struct aws_byte_buf *slot = NULL;
+
+    aws_mutex_lock(&pipeline->mutex);
+    while (pipeline->count == pipeline->depth && !pipeline->error) {
+        aws_condition_variable_wait(&pipeline->changed, &pipeline->mutex);
+    }
+    if (!pipeline->error) slot = &pipeline->slots[(pipeline->head + pipeline->count) % pipeline->depth];
+    aws_mutex_unlock(&pipeline->mutex);
+
+    return slot;
+}
+
+/* Runs the session over the input accumulated so far, until it needs more or the message is complete */
+static int pump(struct aws_cryptosdk_pipeline *pipeline) {
+    /* An empty input must still point somewhere, or the session sees no plaintext at all */
+    static const uint8_t empty_input = 0;
+    struct aws_cryptosdk_session *session = pipeline->session;
+    struct aws_byte_buf *acc              = &pipeline->acc;
+    bool stalled                          = false;
+
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t out_bytes_written, in_bytes_read, out_needed, in_needed;
+        struct aws_byte_buf *slot = producer_slot(pipeline);
+        if (!slot) return aws_raise_error(pipeline->error);
+
+        const uint8_t *inp = acc->buffer ? acc->buffer : &empty_input;
+        if (aws_cryptosdk_session_process(
+                session, slot->buffer, slot->capacity, &out_bytes_written, inp, acc->len, &in_bytes_read)) {
+            return AWS_OP_ERR;
+        }
+
+        if (in_bytes_read) {
+            memmove(acc->buffer, acc->buffer + in_bytes_read, acc->len - in_bytes_read);
+            acc->len -= in_bytes_read;
+        }
+
+        if (out_bytes_written) {
+            slot->len = out_bytes_written;
+            aws_mutex_lock(&pipeline->mutex);
+            pipeline->count++;
+            aws_condition_variable_notify_all(&pipeline->changed);
+            aws_mutex_unlock(&pipeline->mutex);
+        }
+
+        if (!out_bytes_written && !in_bytes_read) {
+            // Either the slot is too small for the next step, or we need more input
+            aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+            if (out_needed > slot->capacity) {
+                if (aws_byte_buf_reserve(slot, out_needed)) return AWS_OP_ERR;
+                continue;
+            }
+            // Progress may have been made only in the estimates, so try once more before asking for input
+            if (in_needed <= acc->len && !stalled) {
+                stalled = true;
+                continue;
+            }
+            // Make room for the input needed, so that later writes can provide it
+            return aws_byte_buf_reserve(acc, in_needed);
+        }
+        stalled = false;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_pipeline_write(struct aws_cryptosdk_pipeline *pipeline, const uint8_t *data, size_t len) {
+    struct aws_byte_buf *acc = &pipeline->acc;
+
+    aws_mutex_lock(&pipeline->mutex);
+    int error = pipeline->error;
+    aws_mutex_unlock(&pipeline->mutex);
+    if (error) return aws_raise_error(error);
+
+    pipeline->total_in += len;
+    while (len) {
+        if (acc->len == acc->capacity && aws_byte_buf_reserve(acc, acc->capacity ? acc->capacity * 2 : len)) {
+            return fail_pipeline(pipeline);
+        }
+
+        size_t n = acc->capacity - acc->len < len ? acc->capacity - acc->len : len;
+        memcpy(acc->buffer + acc->len, data, n);
+        acc->len += n;
+        data += n;
+        len -= n;
+
+        if (pump(pipeline)) return fail_pipeline(pipeline);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_pipeline_finish(struct aws_cryptosdk_pipeline *pipeline) {
+    struct aws_cryptosdk_session *session = pipeline->session;
+
+    aws_mutex_lock(&pipeline->mutex);
+    int error = pipeline->error;
+    aws_mutex_unlock(&pipeline->mutex);
+    if (error) return aws_raise_error(error);
+
+    if (session->mode == AWS_CRYPTOSDK_ENCRYPT && !session->precise_size_known &&
+        aws_cryptosdk_session_set_message_size(session, pipeline->total_in)) {
+        return fail_pipeline(pipeline);
+    }
+    if (pump(pipeline)) return fail_pipeline(pipeline);
+
+    // The input must hold the message exactly
+    if (!aws_cryptosdk_session_is_done(session) || pipeline->acc.len) {
+        bool short_input = !aws_cryptosdk_session_is_done(session);
+        if (session->mode == AWS_CRYPTOSDK_DECRYPT) {
+            aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        } else {
+            aws_raise_error(short_input ? AWS_CRYPTOSDK_ERR_BAD_STATE : AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        }
+        return fail_pipeline(pipeline);
+    }
+
+    aws_mutex_lock(&pipeline->mutex);
+    pipeline->eof = true;
+    aws_condition_variable_notify_all(&pipeline->changed);
+    aws_mutex_unlock(&pipeline->mutex);
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_pipeline_read(
+    struct aws_cryptosdk_pipeline *pipeline, uint8_t *outp, size_t len, size_t *out_bytes_read) {
+    struct aws_byte_buf *slot = NULL;
+    int error;
+
+    *out_bytes_read = 0;
+    if (!len) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+
+    aws_mutex_lock(&pipeline->mutex);
+    while (!pipeline->count && !pipeline->eof && !pipeline->error) {
+        aws_condition_variable_wait(&pipeline->changed, &pipeline->mutex);
+    }
+    error = pipeline->error;
+    if (!error && pipeline->count) slot = &pipeline->slots[pipeline->head];
+    aws_mutex_unlock(&pipeline->mutex);
+
+    if (error) return aws_raise_error(error);
+    if (!slot) return AWS_OP_SUCCESS;
+
+    // The slot at head is ours until it is released, so it can be copied from unlocked
+    size_t n = slot->len - pipeline->head_read < len ? slot->len - pipeline->head_read : len;
+    memcpy(outp, slot->buffer + pipeline->head_read, n);
+    pipeline->head_read += n;
+    *out_bytes_read = n;
+
+    if (pipeline->head_read == slot->len) {
+        aws_mutex_lock(&pipeline->mutex);
+        slot->len           = 0;
+        pipeline->head      = (pipeline->head + 1) % pipeline->depth;
+        pipeline->head_read = 0;
+        pipeline->count--;
+        aws_condition_variable_notify_all(&pipeline->changed);
+        aws_mutex_unlock(&pipeline->mutex);
+    }
+
+    return AWS_OP_SUCCESS;
+}
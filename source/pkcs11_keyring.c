@@ -0,0 +1,613 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/keyring_trace.h>
+#include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/config.h>
+#include <aws/cryptosdk/private/enc_ctx.h>
+#include <aws/cryptosdk/private/pkcs11_keyring.h>
+#include <aws/cryptosdk/private/raw_aes_keyring.h>
+#include <aws/cryptosdk/private/secure_pool.h>
+#include <aws/cryptosdk/private/utils.h>
+
+#ifdef AWS_CRYPTOSDK_P_HAVE_PKCS11
+#    include <dlfcn.h>
+#    include <p11-kit/pkcs11.h>
+
+/* The largest data key of any algorithm suite */
+#    define MAX_DATA_KEY_LEN 32
+
+struct pkcs11_keyring {
+    struct aws_cryptosdk_keyring base;
+    struct aws_allocator *alloc;
+    CK_FUNCTION_LIST_PTR p11;
+    /* The module's handle if this keyring loaded it, and whether it initialized it */
+    void *module;
+    bool finalize;
+    CK_SLOT_ID slot_id;
+    struct aws_byte_buf pin;
+    struct aws_string *key_namespace;
+    struct aws_string *key_name;
+    CK_OBJECT_HANDLE key;
+
+    /* Guards the session pool; calls wait on idle_available when every session is busy */
+    struct aws_mutex mutex;
+    struct aws_condition_variable idle_available;
+    size_t max_sessions;
+    size_t open_sessions;
+    size_t idle_count;
+    /* Logged-in sessions not in use, max_sessions of them at most */
+    CK_SESSION_HANDLE *idle;
+};
+
+static int raise_pkcs11_error(CK_RV rv) {
+    (void)rv;
+    return aws_raise_error(AWS_CRYPTOSDK_ERR_PKCS11_FAILURE);
+}
+
+/* Whether rv means that the session can no longer be used, and should not go back in the pool */
+static bool session_broken(CK_RV rv) {
+    switch (rv) {
+        case CKR_SESSION_HANDLE_INVALID:
+        case CKR_SESSION_CLOSED:
+        case CKR_USER_NOT_LOGGED_IN:
+        case CKR_DEVICE_ERROR:
+        case CKR_DEVICE_REMOVED:
+        case CKR_TOKEN_NOT_PRESENT: return true;
+        default: return false;
+    }
+}
+
+static int open_session(struct pkcs11_keyring *self, CK_SESSION_HANDLE *session) {
+    CK_RV rv = self->p11->C_OpenSession(self->slot_id, CKF_SERIAL_SESSION, NULL, NULL, session);
+    if (rv != CKR_OK) return raise_pkcs11_error(rv);
+
+    // Logins are shared by all of this process's sessions with the token, but lapse when they all close
+    if (self->pin.len) {
+        rv = self->p11->C_Login(*session, CKU_USER, self->pin.buffer, self->pin.len);
+        if (rv != CKR_OK && rv != CKR_USER_ALREADY_LOGGED_IN) {
+            self->p11->C_CloseSession(*session);
+            return raise_pkcs11_error(rv);
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Takes an idle session from the pool, opening one if there is room, or waiting for one */
+static int acquire_session(struct pkcs11_keyring *self, CK_SESSION_HANDLE *session) {
+    aws_mutex_lock(&self->mutex);
+    while (!self->idle_count && self->open_sessions == self->max_sessions) {
+        aws_condition_variable_wait(&self->idle_available, &self->mutex);
+    }
+    if (self->idle_count) {
+        *session = self->idle[--self->idle_count];
+        aws_mutex_unlock(&self->mutex);
+        return AWS_OP_SUCCESS;
+    }
+    self->open_sessions++;
+    aws_mutex_unlock(&self->mutex);
+
+    if (open_session(self, session)) {
+        aws_mutex_lock(&self->mutex);
+        self->open_sessions--;
+        aws_condition_variable_notify_one(&self->idle_available);
+        aws_mutex_unlock(&self->mutex);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Returns a session to the pool, or closes it if the last call on it showed it to be broken */
+static void release_session(struct pkcs11_keyring *self, CK_SESSION_HANDLE session, CK_RV last_rv) {
+    bool broken = session_broken(last_rv);
+    if (broken) {
+        self->p11->C_CloseSession(session);
+    }
+
+    aws_mutex_lock(&self->mutex);
+    if (broken) {
+        self->open_sessions--;
+    } else {
+        self->idle[self->idle_count++] = session;
+    }
+    aws_condition_variable_notify_one(&self->idle_available);
+    aws_mutex_unlock(&self->mutex);
+}
+
+static void gcm_params_init(
+    CK_GCM_PARAMS *params, CK_MECHANISM *mechanism, const uint8_t *iv, struct aws_byte_cursor aad) {
+    params->pIv       = (CK_BYTE_PTR)iv;
+    params->ulIvLen   = RAW_AES_KR_IV_LEN;
+    params->ulIvBits  = RAW_AES_KR_IV_LEN * 8;
+    params->pAAD      = aad.ptr;
+    params->ulAADLen  = aad.len;
+    params->ulTagBits = RAW_AES_KR_TAG_LEN * 8;
+
+    mechanism->mechanism      = CKM_AES_GCM;
+    mechanism->pParameter     = params;
+    mechanism->ulParameterLen = sizeof(*params);
+}
+
+/*
+ * Sets *aad to the serialized encryption context: serialized_enc_ctx if the caller has it, and
+ * otherwise a serialization into aad_buf. The caller cleans up aad_buf either way.
+ */
+static int get_aad(
+    struct aws_allocator *alloc,
+    struct aws_byte_buf *aad_buf,
+    struct aws_byte_cursor *aad,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx) {
+    size_t aad_len;
+
+    AWS_ZERO_STRUCT(*aad_buf);
+    if (serialized_enc_ctx) {
+        *aad = *serialized_enc_ctx;
+        return AWS_OP_SUCCESS;
+    }
+
+    if (aws_cryptosdk_enc_ctx_size(&aad_len, enc_ctx) || aws_byte_buf_init(aad_buf, alloc, aad_len) ||
+        aws_cryptosdk_enc_ctx_serialize(alloc, aad_buf, enc_ctx)) {
+        aws_byte_buf_clean_up(aad_buf);
+        return AWS_OP_ERR;
+    }
+    *aad = aws_byte_cursor_from_buf(aad_buf);
+    return AWS_OP_SUCCESS;
+}
+
+/* The provider info is laid out as the raw AES keyring's: key name, tag length in bits, IV length, IV */
+static size_t provider_info_len(const struct aws_string *key_name) {
+    return key_name->len + 8 + RAW_AES_KR_IV_LEN;
+}
+
+/* Returns the IV of an EDK made under the given key name, or NULL if it was made otherwise */
+static const uint8_t *parse_provider_info(const struct aws_string *key_name, const struct aws_byte_buf *provider_info) {
+    struct aws_byte_cursor cur = aws_byte_cursor_from_buf(provider_info);
+    uint32_t tag_bits, iv_len;
+
+    if (provider_info->len != provider_info_len(key_name)) return NULL;
+
+    struct aws_byte_cursor name = aws_byte_cursor_advance(&cur, key_name->len);
+    if (!aws_string_eq_byte_cursor(key_name, &name) || !aws_byte_cursor_read_be32(&cur, &tag_bits) ||
+        !aws_byte_cursor_read_be32(&cur, &iv_len) || tag_bits != RAW_AES_KR_TAG_LEN * 8 ||
+        iv_len != RAW_AES_KR_IV_LEN) {
+        return NULL;
+    }
+
+    return cur.ptr;
+}
+
+static int wrap_data_key(
+    struct pkcs11_keyring *self,
+    struct aws_allocator *request_alloc,
+    const struct aws_byte_buf *data_key,
+    struct aws_array_list *edks,
+    struct aws_byte_cursor aad) {
+    uint8_t iv[RAW_AES_KR_IV_LEN];
+    struct aws_cryptosdk_edk edk;
+    CK_SESSION_HANDLE session;
+    CK_GCM_PARAMS params;
+    CK_MECHANISM mechanism;
+
+    if (aws_cryptosdk_genrandom(iv, sizeof(iv))) return AWS_OP_ERR;
+    if (aws_cryptosdk_edk_init_record(
+            request_alloc,
+            &edk,
+            self->key_namespace->len,
+            provider_info_len(self->key_name),
+            data_key->len + RAW_AES_KR_TAG_LEN)) {
+        return AWS_OP_ERR;
+    }
+    if (acquire_session(self, &session)) goto err;
+
+    // The token writes the ciphertext followed by the tag, which is how the EDK holds them
+    CK_ULONG ciphertext_len = edk.ciphertext.capacity;
+    gcm_params_init(&params, &mechanism, iv, aad);
+    CK_RV rv = self->p11->C_EncryptInit(session, &mechanism, self->key);
+    if (rv == CKR_OK) {
+        rv = self->p11->C_Encrypt(
+            session, data_key->buffer, data_key->len, edk.ciphertext.buffer, &ciphertext_len);
+    }
+    release_session(self, session, rv);
+    if (rv != CKR_OK || ciphertext_len != edk.ciphertext.capacity) {
+        raise_pkcs11_error(rv);
+        goto err;
+    }
+    edk.ciphertext.len = edk.ciphertext.capacity;
+
+    // The buffers were sized for exactly these fields, so the writes cannot fail
+    aws_byte_buf_write_from_whole_string(&edk.provider_id, self->key_namespace);
+    aws_byte_buf_write_from_whole_string(&edk.provider_info, self->key_name);
+    aws_byte_buf_write_be32(&edk.provider_info, RAW_AES_KR_TAG_LEN * 8);
+    aws_byte_buf_write_be32(&edk.provider_info, RAW_AES_KR_IV_LEN);
+    aws_byte_buf_write(&edk.provider_info, iv, sizeof(iv));
+
+    if (aws_array_list_push_back(edks, &edk)) goto err;
+
+    return AWS_OP_SUCCESS;
+
+err:
+    aws_cryptosdk_edk_clean_up(&edk);
+    return AWS_OP_ERR;
+}
+
+static int pkcs11_keyring_on_encrypt_with_serialized_ctx(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct pkcs11_keyring *self = (struct pkcs11_keyring *)kr;
+    size_t data_key_len         = aws_cryptosdk_alg_props(alg)->data_key_len;
+    uint32_t flags              = 0;
+    struct aws_byte_buf aad_buf;
+    struct aws_byte_cursor aad;
+
+    if (get_aad(request_alloc, &aad_buf, &aad, enc_ctx, serialized_enc_ctx)) return AWS_OP_ERR;
+
+    if (!unencrypted_data_key->buffer) {
+        if (aws_byte_buf_init(unencrypted_data_key, aws_cryptosdk_secure_key_allocator(), data_key_len)) {
+            aws_byte_buf_clean_up(&aad_buf);
+            return AWS_OP_ERR;
+        }
+        if (aws_cryptosdk_genrandom(unencrypted_data_key->buffer, data_key_len)) {
+            aws_byte_buf_clean_up(unencrypted_data_key);
+            aws_byte_buf_clean_up(&aad_buf);
+            return AWS_OP_ERR;
+        }
+        unencrypted_data_key->len = data_key_len;
+        flags                     = AWS_CRYPTOSDK_WRAPPING_KEY_GENERATED_DATA_KEY;
+    }
+
+    int rv = wrap_data_key(self, request_alloc, unencrypted_data_key, edks, aad);
+    aws_byte_buf_clean_up(&aad_buf);
+    if (rv) {
+        if (flags) aws_byte_buf_clean_up(unencrypted_data_key);
+        return AWS_OP_ERR;
+    }
+
+    flags |= AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_SIGNED_ENC_CTX;
+    aws_cryptosdk_keyring_trace_add_record(request_alloc, keyring_trace, self->key_namespace, self->key_name, flags);
+    return AWS_OP_SUCCESS;
+}
+
+static int pkcs11_keyring_on_encrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return pkcs11_keyring_on_encrypt_with_serialized_ctx(
+        kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, NULL, alg);
+}
+
+static int pkcs11_keyring_on_decrypt_with_serialized_ctx(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct pkcs11_keyring *self = (struct pkcs11_keyring *)kr;
+    size_t data_key_len         = aws_cryptosdk_alg_props(alg)->data_key_len;
+    size_t num_edks             = aws_array_list_length(edks);
+    bool have_session           = false;
+    int ret                     = AWS_OP_SUCCESS;
+    CK_SESSION_HANDLE session;
+    CK_RV rv = CKR_OK;
+    struct aws_byte_buf aad_buf;
+    struct aws_byte_cursor aad;
+    // Tokens may want room for the whole ciphertext, tag included, before working out the plaintext length
+    uint8_t plaintext[MAX_DATA_KEY_LEN + RAW_AES_KR_TAG_LEN];
+
+    if (get_aad(request_alloc, &aad_buf, &aad, enc_ctx, serialized_enc_ctx)) return AWS_OP_ERR;
+
+    for (size_t i = 0; i < num_edks && rv == CKR_OK; i++) {
+        const struct aws_cryptosdk_edk *edk;
+        if (aws_array_list_get_at_ptr(edks, (void **)&edk, i)) {
+            ret = AWS_OP_ERR;
+            break;
+        }
+        if (!aws_string_eq_byte_buf(self->key_namespace, &edk->provider_id) ||
+            edk->ciphertext.len != data_key_len + RAW_AES_KR_TAG_LEN) {
+            continue;
+        }
+        const uint8_t *iv = parse_provider_info(self->key_name, &edk->provider_info);
+        if (!iv) continue;
+
+        // One session serves every EDK tried, so that a message costs at most one trip to the pool
+        if (!have_session) {
+            if (acquire_session(self, &session)) {
+                ret = AWS_OP_ERR;
+                break;
+            }
+            have_session = true;
+        }
+
+        CK_GCM_PARAMS params;
+        CK_MECHANISM mechanism;
+        CK_ULONG plaintext_len = sizeof(plaintext);
+        gcm_params_init(&params, &mechanism, iv, aad);
+        rv = self->p11->C_DecryptInit(session, &mechanism, self->key);
+        if (rv == CKR_OK) {
+            rv = self->p11->C_Decrypt(session, edk->ciphertext.buffer, edk->ciphertext.len, plaintext, &plaintext_len);
+        }
+
+        if (rv == CKR_OK && plaintext_len == data_key_len) {
+            if (aws_byte_buf_init_copy_from_cursor(
+                    unencrypted_data_key,
+                    aws_cryptosdk_secure_key_allocator(),
+                    aws_byte_cursor_from_array(plaintext, data_key_len))) {
+                ret = AWS_OP_ERR;
+                break;
+            }
+            aws_cryptosdk_keyring_trace_add_record(
+                request_alloc,
+                keyring_trace,
+                self->key_namespace,
+                self->key_name,
+                AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX);
+            break;
+        }
+
+        // An EDK which fails to authenticate is not an error, as another EDK may work
+        if (rv == CKR_ENCRYPTED_DATA_INVALID || rv == CKR_ENCRYPTED_DATA_LEN_RANGE || rv == CKR_OK) {
+            rv = CKR_OK;
+            continue;
+        }
+        ret = raise_pkcs11_error(rv);
+    }
+
+    aws_secure_zero(plaintext, sizeof(plaintext));
+    if (have_session) release_session(self, session, rv);
+    aws_byte_buf_clean_up(&aad_buf);
+    return ret;
+}
+
+static int pkcs11_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return pkcs11_keyring_on_decrypt_with_serialized_ctx(
+        kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, NULL, alg);
+}
+
+static int pkcs11_keyring_get_edk_filter(
+    const struct aws_cryptosdk_keyring *kr,
+    struct aws_byte_cursor *provider_id,
+    struct aws_byte_cursor *provider_info_prefix) {
+    const struct pkcs11_keyring *self = (const struct pkcs11_keyring *)kr;
+
+    *provider_id          = aws_byte_cursor_from_string(self->key_namespace);
+    *provider_info_prefix = aws_byte_cursor_from_string(self->key_name);
+    return AWS_OP_SUCCESS;
+}
+
+static void pkcs11_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
+    struct pkcs11_keyring *self = (struct pkcs11_keyring *)kr;
+
+    // No calls are in progress, so every open session is idle
+    while (self->idle_count) {
+        self->p11->C_CloseSession(self->idle[--self->idle_count]);
+    }
+    if (self->finalize) {
+        self->p11->C_Finalize(NULL);
+    }
+    if (self->module) {
+        dlclose(self->module);
+    }
+
+    aws_condition_variable_clean_up(&self->idle_available);
+    aws_mutex_clean_up(&self->mutex);
+    aws_mem_release(self->alloc, self->idle);
+    aws_byte_buf_clean_up_secure(&self->pin);
+    aws_string_destroy(self->key_name);
+    aws_string_destroy(self->key_namespace);
+    aws_mem_release(self->alloc, self);
+}
+
+static const struct aws_cryptosdk_keyring_vt pkcs11_keyring_vt = {
+    .vt_size                        = sizeof(struct aws_cryptosdk_keyring_vt),
+    .name                           = "PKCS#11 keyring",
+    .destroy                        = pkcs11_keyring_destroy,
+    .on_encrypt                     = pkcs11_keyring_on_encrypt,
+    .on_decrypt                     = pkcs11_keyring_on_decrypt,
+    .get_edk_filter                 = pkcs11_keyring_get_edk_filter,
+    .on_encrypt_with_serialized_ctx = pkcs11_keyring_on_encrypt_with_serialized_ctx,
+    .on_decrypt_with_serialized_ctx = pkcs11_keyring_on_decrypt_with_serialized_ctx
+};
+
+/* Finds the one AES key labeled with the key name; object handles are valid in all of our sessions */
+static int find_key(struct pkcs11_keyring *self, CK_SESSION_HANDLE session) {
+    CK_OBJECT_CLASS key_class = CKO_SECRET_KEY;
+    CK_KEY_TYPE key_type      = CKK_AES;
+    CK_ATTRIBUTE template[]   = { { CKA_CLASS, &key_class, sizeof(key_class) },
+                                { CKA_KEY_TYPE, &key_type, sizeof(key_type) },
+                                { CKA_LABEL, (void *)aws_string_bytes(self->key_name), self->key_name->len } };
+    CK_OBJECT_HANDLE found[2];
+    CK_ULONG count = 0;
+
+    CK_RV rv = self->p11->C_FindObjectsInit(session, template, sizeof(template) / sizeof(template[0]));
+    if (rv == CKR_OK) {
+        rv          = self->p11->C_FindObjects(session, found, 2, &count);
+        CK_RV final = self->p11->C_FindObjectsFinal(session);
+        if (rv == CKR_OK) rv = final;
+    }
+    if (rv != CKR_OK) return raise_pkcs11_error(rv);
+    if (count != 1) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+
+    self->key = found[0];
+    return AWS_OP_SUCCESS;
+}
+
+struct aws_cryptosdk_keyring *aws_cryptosdk_pkcs11_keyring_new_from_functions(
+    struct aws_allocator *alloc,
+    void *functions,
+    unsigned long slot_id,
+    struct aws_byte_cursor pin,
+    const struct aws_string *key_namespace,
+    const struct aws_string *key_name,
+    size_t max_sessions) {
+    AWS_STATIC_STRING_FROM_LITERAL(disallowed, "aws-kms");
+    if (aws_string_eq(disallowed, key_namespace)) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_RESERVED_NAME);
+        return NULL;
+    }
+    if (!max_sessions || max_sessions > SIZE_MAX / sizeof(CK_SESSION_HANDLE)) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct pkcs11_keyring *self = aws_mem_calloc(alloc, 1, sizeof(*self));
+    if (!self) return NULL;
+
+    aws_cryptosdk_keyring_base_init(&self->base, &pkcs11_keyring_vt);
+    self->alloc        = alloc;
+    self->p11          = functions;
+    self->slot_id      = slot_id;
+    self->max_sessions = max_sessions;
+
+    if (aws_mutex_init(&self->mutex)) goto err_mutex;
+    if (aws_condition_variable_init(&self->idle_available)) goto err_cond;
+    if (!(self->idle = aws_mem_calloc(alloc, max_sessions, sizeof(*self->idle)))) goto err;
+    if (pin.len && aws_byte_buf_init_copy_from_cursor(&self->pin, alloc, pin)) goto err;
+    if (!(self->key_namespace = aws_cryptosdk_string_intern(alloc, key_namespace))) goto err;
+    if (!(self->key_name = aws_cryptosdk_string_intern(alloc, key_name))) goto err;
+
+    // The session used to find the key becomes the first in the pool
+    CK_SESSION_HANDLE session;
+    if (acquire_session(self, &session)) goto err;
+    int rv = find_key(self, session);
+    release_session(self, session, CKR_OK);
+    if (rv) goto err;
+
+    return &self->base;
+
+err:
+    while (self->idle_count) {
+        self->p11->C_CloseSession(self->idle[--self->idle_count]);
+    }
+    aws_string_destroy(self->key_name);
+    aws_string_destroy(self->key_namespace);
+    aws_byte_buf_clean_up_secure(&self->pin);
+    if (self->idle) aws_mem_release(alloc, self->idle);
+    aws_condition_variable_clean_up(&self->idle_available);
+err_cond:
+    aws_mutex_clean_up(&self->mutex);
+err_mutex:
+    aws_mem_release(alloc, self);
+    return NULL;
+}
+
+struct aws_cryptosdk_keyring *aws_cryptosdk_pkcs11_keyring_new(
+    struct aws_allocator *alloc,
+    const char *module_path,
+    unsigned long slot_id,
+    struct aws_byte_cursor pin,
+    const struct aws_string *key_namespace,
+    const struct aws_string *key_name,
+    size_t max_sessions) {
+    CK_FUNCTION_LIST_PTR functions;
+    CK_C_INITIALIZE_ARGS init_args = { .flags = CKF_OS_LOCKING_OK };
+
+    void *module = dlopen(module_path, RTLD_NOW | RTLD_LOCAL);
+    if (!module) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_PKCS11_FAILURE);
+        return NULL;
+    }
+
+    // Assigned through an object pointer, as ISO C has no conversion from void * to a function pointer
+    CK_C_GetFunctionList get_function_list;
+    *(void **)&get_function_list = dlsym(module, "C_GetFunctionList");
+    if (!get_function_list || get_function_list(&functions) != CKR_OK) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_PKCS11_FAILURE);
+        dlclose(module);
+        return NULL;
+    }
+
+    // Another user of the module in this process may have initialized it already
+    CK_RV rv = functions->C_Initialize(&init_args);
+    if (rv != CKR_OK && rv != CKR_CRYPTOKI_ALREADY_INITIALIZED) {
+        raise_pkcs11_error(rv);
+        dlclose(module);
+        return NULL;
+    }
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_pkcs11_keyring_new_from_functions(
+        alloc, functions, slot_id, pin, key_namespace, key_name, max_sessions);
+    if (!kr) {
+        if (rv == CKR_OK) functions->C_Finalize(NULL);
+        dlclose(module);
+        return NULL;
+    }
+
+    struct pkcs11_keyring *self = (struct pkcs11_keyring *)kr;
+    self->module                = module;
+    self->finalize              = rv == CKR_OK;
+
+    return kr;
+}
+
+#else  // AWS_CRYPTOSDK_P_HAVE_PKCS11
+
+struct aws_cryptosdk_keyring *aws_cryptosdk_pkcs11_keyring_new_from_functions(
+    struct aws_allocator *alloc,
+    void *functions,
+    unsigned long slot_id,
+    struct aws_byte_cursor pin,
+    const struct aws_string *key_namespace,
+    const struct aws_string *key_name,
+    size_t max_sessions) {
+    (void)alloc;
+    (void)functions;
+    (void)slot_id;
+    (void)pin;
+    (void)key_namespace;
+    (void)key_name;
+    (void)max_sessions;
+    aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    return NULL;
+}
+
+struct aws_cryptosdk_keyring *aws_cryptosdk_pkcs11_keyring_new(
+    struct aws_allocator *alloc,
+    const char *module_path,
+    unsigned long slot_id,
+    struct aws_byte_cursor pin,
+    const struct aws_string *key_namespace,
+    const struct aws_string *key_name,
+    size_t max_sessions) {
+    (void)module_path;
+    return aws_cryptosdk_pkcs11_keyring_new_from_functions(
+        alloc, NULL, slot_id, pin, key_namespace, key_name, max_sessions);
+}
+
+#endif  // AWS_CRYPTOSDK_P_HAVE_PKCS11
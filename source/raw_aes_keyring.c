@@ -16,6 +16,7 @@
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/enc_ctx.h>
 #include <aws/cryptosdk/private/raw_aes_keyring.h>
+#include <aws/cryptosdk/private/secure_pool.h>
 #include <aws/cryptosdk/private/utils.h>
 
 struct raw_aes_keyring {
@@ -23,7 +24,7 @@ struct raw_aes_keyring {
     struct aws_allocator *alloc;
     struct aws_string *key_namespace;
     struct aws_string *key_name;
-    struct aws_string *raw_key;
+    struct aws_cryptosdk_aes_gcm_key *wrapping_key;
 };
 
 static int serialize_aad_init(
@@ -42,15 +43,43 @@ static int serialize_aad_init(
     return AWS_OP_SUCCESS;
 }
 
+/*
+ * Sets *aad to the serialized encryption context: serialized_enc_ctx if the caller has it, and
+ * otherwise a serialization into aad_buf. The caller cleans up aad_buf either way.
+ */
+static int get_aad(
+    struct aws_allocator *alloc,
+    struct aws_byte_buf *aad_buf,
+    struct aws_byte_cursor *aad,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx) {
+    if (serialized_enc_ctx) {
+        AWS_ZERO_STRUCT(*aad_buf);
+        *aad = *serialized_enc_ctx;
+        return AWS_OP_SUCCESS;
+    }
+
+    if (serialize_aad_init(alloc, aad_buf, enc_ctx)) return AWS_OP_ERR;
+    *aad = aws_byte_cursor_from_buf(aad_buf);
+    return AWS_OP_SUCCESS;
+}
+
+static size_t provider_info_len(const struct aws_string *key_name) {
+    return key_name->len + RAW_AES_KR_IV_LEN + 8;  // 4 for tag len, 4 for iv len
+}
+
+static bool write_provider_info(struct aws_byte_buf *output, const struct aws_string *key_name, const uint8_t *iv) {
+    return aws_byte_buf_write_from_whole_string(output, key_name) &&
+           aws_byte_buf_write_be32(output, RAW_AES_KR_TAG_LEN * 8) &&
+           aws_byte_buf_write_be32(output, RAW_AES_KR_IV_LEN) && aws_byte_buf_write(output, iv, RAW_AES_KR_IV_LEN);
+}
+
 int aws_cryptosdk_serialize_provider_info_init(
     struct aws_allocator *alloc, struct aws_byte_buf *output, const struct aws_string *key_name, const uint8_t *iv) {
-    size_t serialized_len = key_name->len + RAW_AES_KR_IV_LEN + 8;  // 4 for tag len, 4 for iv len
-    if (aws_byte_buf_init(output, alloc, serialized_len)) {
+    if (aws_byte_buf_init(output, alloc, provider_info_len(key_name))) {
         return AWS_OP_ERR;
     }
-    if (!aws_byte_buf_write_from_whole_string(output, key_name) ||
-        !aws_byte_buf_write_be32(output, RAW_AES_KR_TAG_LEN * 8) ||
-        !aws_byte_buf_write_be32(output, RAW_AES_KR_IV_LEN) || !aws_byte_buf_write(output, iv, RAW_AES_KR_IV_LEN)) {
+    if (!write_provider_info(output, key_name, iv)) {
         // We should never get here, because buffer was allocated locally to be long enough.
         aws_byte_buf_clean_up(output);
         return aws_raise_error(AWS_ERROR_UNKNOWN);
@@ -58,18 +87,17 @@ int aws_cryptosdk_serialize_provider_info_init(
     return AWS_OP_SUCCESS;
 }
 
-bool aws_cryptosdk_parse_provider_info(
-    struct aws_cryptosdk_keyring *kr, struct aws_byte_buf *iv, const struct aws_byte_buf *provider_info) {
-    struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
-    size_t mkid_len              = self->key_name->len;
-    size_t serialized_len        = mkid_len + RAW_AES_KR_IV_LEN + 8;
+static bool parse_provider_info(
+    const struct aws_string *key_name, struct aws_byte_buf *iv, const struct aws_byte_buf *provider_info) {
+    size_t mkid_len       = key_name->len;
+    size_t serialized_len = mkid_len + RAW_AES_KR_IV_LEN + 8;
     if (serialized_len != provider_info->len) return false;
 
     struct aws_byte_cursor cur = aws_byte_cursor_from_buf(provider_info);
 
     struct aws_byte_cursor mkid = aws_byte_cursor_advance_nospec(&cur, mkid_len);
     if (!mkid.ptr) goto READ_ERR;
-    if (!aws_string_eq_byte_cursor(self->key_name, &mkid)) return false;
+    if (!aws_string_eq_byte_cursor(key_name, &mkid)) return false;
 
     uint32_t tag_len, iv_len;
     if (!aws_byte_cursor_read_be32(&cur, &tag_len)) goto READ_ERR;
@@ -87,48 +115,56 @@ READ_ERR:
     return false;
 }
 
-int aws_cryptosdk_raw_aes_keyring_encrypt_data_key_with_iv(
-    struct aws_cryptosdk_keyring *kr,
+bool aws_cryptosdk_parse_provider_info(
+    struct aws_cryptosdk_keyring *kr, struct aws_byte_buf *iv, const struct aws_byte_buf *provider_info) {
+    struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
+    return parse_provider_info(self->key_name, iv, provider_info);
+}
+
+static int encrypt_data_key_with_iv(
+    const struct aws_string *key_namespace,
+    const struct aws_string *key_name,
+    struct aws_cryptosdk_aes_gcm_key *wrapping_key,
     struct aws_allocator *request_alloc,
     const struct aws_byte_buf *unencrypted_data_key,
     struct aws_array_list *edks,
     const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
     enum aws_cryptosdk_alg_id alg,
     const uint8_t *iv) {
-    struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
-
     const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
     size_t data_key_len                              = props->data_key_len;
 
     struct aws_byte_buf aad;
-    if (serialize_aad_init(request_alloc, &aad, enc_ctx)) {
+    struct aws_byte_cursor aad_cursor;
+    if (get_aad(request_alloc, &aad, &aad_cursor, enc_ctx, serialized_enc_ctx)) {
         return AWS_OP_ERR;
     }
 
-    struct aws_cryptosdk_edk edk = { { 0 } };
+    struct aws_cryptosdk_edk edk;
     /* Encrypted data key bytes same length as unencrypted data key in GCM.
      * enc_data_key field also includes tag afterward.
      */
-    if (aws_byte_buf_init(&edk.ciphertext, request_alloc, data_key_len + RAW_AES_KR_TAG_LEN)) {
+    if (aws_cryptosdk_edk_init_record(
+            request_alloc, &edk, key_namespace->len, provider_info_len(key_name), data_key_len + RAW_AES_KR_TAG_LEN)) {
         aws_byte_buf_clean_up(&aad);
         return AWS_OP_ERR;
     }
     struct aws_byte_buf edk_bytes = aws_byte_buf_from_array(edk.ciphertext.buffer, data_key_len);
     struct aws_byte_buf tag       = aws_byte_buf_from_array(edk.ciphertext.buffer + data_key_len, RAW_AES_KR_TAG_LEN);
-    if (aws_cryptosdk_aes_gcm_encrypt(
+    if (aws_cryptosdk_aes_gcm_key_encrypt(
+            wrapping_key,
             &edk_bytes,
             &tag,
             aws_byte_cursor_from_buf(unencrypted_data_key),
             aws_byte_cursor_from_array(iv, RAW_AES_KR_IV_LEN),
-            aws_byte_cursor_from_buf(&aad),
-            self->raw_key))
+            aad_cursor))
         goto err;
     edk.ciphertext.len = edk.ciphertext.capacity;
 
-    if (aws_cryptosdk_serialize_provider_info_init(request_alloc, &edk.provider_info, self->key_name, iv)) goto err;
-
-    if (aws_byte_buf_init(&edk.provider_id, request_alloc, self->key_namespace->len)) goto err;
-    if (!aws_byte_buf_write_from_whole_string(&edk.provider_id, self->key_namespace)) goto err;
+    // The buffers were sized for exactly these fields, so the writes cannot fail
+    write_provider_info(&edk.provider_info, key_name, iv);
+    aws_byte_buf_write_from_whole_string(&edk.provider_id, key_namespace);
 
     if (aws_array_list_push_back(edks, &edk)) goto err;
 
@@ -141,13 +177,43 @@ err:
     return AWS_OP_ERR;
 }
 
-static int raw_aes_keyring_on_encrypt(
+int aws_cryptosdk_raw_aes_keyring_encrypt_data_key_with_iv(
     struct aws_cryptosdk_keyring *kr,
     struct aws_allocator *request_alloc,
+    const struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    const uint8_t *iv) {
+    struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
+
+    return encrypt_data_key_with_iv(
+        self->key_namespace,
+        self->key_name,
+        self->wrapping_key,
+        request_alloc,
+        unencrypted_data_key,
+        edks,
+        enc_ctx,
+        NULL,
+        alg,
+        iv);
+}
+
+/*
+ * Generates the data key if there is none yet, and wraps it under the given key, recording what
+ * was done in the trace.
+ */
+static int encrypt_with_key(
+    const struct aws_string *key_namespace,
+    const struct aws_string *key_name,
+    struct aws_cryptosdk_aes_gcm_key *wrapping_key,
+    struct aws_allocator *request_alloc,
     struct aws_byte_buf *unencrypted_data_key,
     struct aws_array_list *keyring_trace,
     struct aws_array_list *edks,
     const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
     enum aws_cryptosdk_alg_id alg) {
     const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
     size_t data_key_len                              = props->data_key_len;
@@ -157,7 +223,9 @@ static int raw_aes_keyring_on_encrypt(
 
     uint32_t flags = 0;
     if (!unencrypted_data_key->buffer) {
-        if (aws_byte_buf_init(unencrypted_data_key, request_alloc, data_key_len)) return AWS_OP_ERR;
+        if (aws_byte_buf_init(unencrypted_data_key, aws_cryptosdk_secure_key_allocator(), data_key_len)) {
+            return AWS_OP_ERR;
+        }
 
         if (aws_cryptosdk_genrandom(unencrypted_data_key->buffer, data_key_len)) {
             aws_byte_buf_clean_up(unencrypted_data_key);
@@ -167,33 +235,115 @@ static int raw_aes_keyring_on_encrypt(
         unencrypted_data_key->len = unencrypted_data_key->capacity;
     }
 
-    int ret = aws_cryptosdk_raw_aes_keyring_encrypt_data_key_with_iv(
-        kr, request_alloc, unencrypted_data_key, edks, enc_ctx, alg, iv);
+    int ret = encrypt_data_key_with_iv(
+        key_namespace,
+        key_name,
+        wrapping_key,
+        request_alloc,
+        unencrypted_data_key,
+        edks,
+        enc_ctx,
+        serialized_enc_ctx,
+        alg,
+        iv);
     if (ret && flags) {
         aws_byte_buf_clean_up(unencrypted_data_key);
     }
     if (!ret) {
-        struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
-
         flags |= AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_SIGNED_ENC_CTX;
-        aws_cryptosdk_keyring_trace_add_record(
-            request_alloc, keyring_trace, self->key_namespace, self->key_name, flags);
+        aws_cryptosdk_keyring_trace_add_record(request_alloc, keyring_trace, key_namespace, key_name, flags);
     }
     return ret;
 }
 
-static int raw_aes_keyring_on_decrypt(
+static int raw_aes_keyring_on_encrypt_with_serialized_ctx(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
+
+    return encrypt_with_key(
+        self->key_namespace,
+        self->key_name,
+        self->wrapping_key,
+        request_alloc,
+        unencrypted_data_key,
+        keyring_trace,
+        edks,
+        enc_ctx,
+        serialized_enc_ctx,
+        alg);
+}
+
+static int raw_aes_keyring_on_encrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return raw_aes_keyring_on_encrypt_with_serialized_ctx(
+        kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, NULL, alg);
+}
+
+/*
+ * Attempts to unwrap edk, which must already be known to come from a key of this name, into
+ * unencrypted_data_key. Returns true on success; failures are not errors, as another EDK may work.
+ */
+static bool decrypt_edk(
+    const struct aws_string *key_name,
+    struct aws_cryptosdk_aes_gcm_key *wrapping_key,
+    struct aws_byte_buf *unencrypted_data_key,
+    const struct aws_cryptosdk_edk *edk,
+    size_t data_key_len,
+    struct aws_byte_cursor aad) {
+    struct aws_byte_buf iv;
+    if (!parse_provider_info(key_name, &iv, &edk->provider_info)) return false;
+
+    const struct aws_byte_buf *edk_bytes = &edk->ciphertext;
+
+    /* Using GCM, so encrypted and unencrypted data key have same length, i.e. data_key_len.
+     * edk_bytes->buffer holds encrypted data key followed by GCM tag.
+     */
+    if (data_key_len + RAW_AES_KR_TAG_LEN != edk_bytes->len) return false;
+
+    if (aws_cryptosdk_aes_gcm_key_decrypt(
+            wrapping_key,
+            unencrypted_data_key,
+            aws_byte_cursor_from_array(edk_bytes->buffer, data_key_len),
+            aws_byte_cursor_from_array(edk_bytes->buffer + data_key_len, RAW_AES_KR_TAG_LEN),
+            aws_byte_cursor_from_buf(&iv),
+            aad)) {
+        /* We are here either because of a ciphertext/tag mismatch (e.g., wrong encryption
+         * context) or because of an OpenSSL error. In either case, nothing better to do
+         * than just moving on to next EDK, so clear the error code.
+         */
+        aws_reset_error();
+        return false;
+    }
+    return true;
+}
+
+static int raw_aes_keyring_on_decrypt_with_serialized_ctx(
     struct aws_cryptosdk_keyring *kr,
     struct aws_allocator *request_alloc,
     struct aws_byte_buf *unencrypted_data_key,
     struct aws_array_list *keyring_trace,
     const struct aws_array_list *edks,
     const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
     enum aws_cryptosdk_alg_id alg) {
     struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
 
     struct aws_byte_buf aad;
-    if (serialize_aad_init(request_alloc, &aad, enc_ctx)) {
+    struct aws_byte_cursor aad_cursor;
+    if (get_aad(request_alloc, &aad, &aad_cursor, enc_ctx, serialized_enc_ctx)) {
         return AWS_OP_ERR;
     }
 
@@ -202,7 +352,7 @@ static int raw_aes_keyring_on_decrypt(
     const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
     size_t data_key_len                              = props->data_key_len;
 
-    if (aws_byte_buf_init(unencrypted_data_key, request_alloc, props->data_key_len)) {
+    if (aws_byte_buf_init(unencrypted_data_key, aws_cryptosdk_secure_key_allocator(), props->data_key_len)) {
         aws_byte_buf_clean_up(&aad);
         return AWS_OP_ERR;
     }
@@ -217,29 +367,7 @@ static int raw_aes_keyring_on_decrypt(
 
         if (!aws_string_eq_byte_buf(self->key_namespace, &edk->provider_id)) continue;
 
-        struct aws_byte_buf iv;
-        if (!aws_cryptosdk_parse_provider_info(kr, &iv, &edk->provider_info)) continue;
-
-        const struct aws_byte_buf *edk_bytes = &edk->ciphertext;
-
-        /* Using GCM, so encrypted and unencrypted data key have same length, i.e. data_key_len.
-         * edk_bytes->buffer holds encrypted data key followed by GCM tag.
-         */
-        if (data_key_len + RAW_AES_KR_TAG_LEN != edk_bytes->len) continue;
-
-        if (aws_cryptosdk_aes_gcm_decrypt(
-                unencrypted_data_key,
-                aws_byte_cursor_from_array(edk_bytes->buffer, data_key_len),
-                aws_byte_cursor_from_array(edk_bytes->buffer + data_key_len, RAW_AES_KR_TAG_LEN),
-                aws_byte_cursor_from_buf(&iv),
-                aws_byte_cursor_from_buf(&aad),
-                self->raw_key)) {
-            /* We are here either because of a ciphertext/tag mismatch (e.g., wrong encryption
-             * context) or because of an OpenSSL error. In either case, nothing better to do
-             * than just moving on to next EDK, so clear the error code.
-             */
-            aws_reset_error();
-        } else {
+        if (decrypt_edk(self->key_name, self->wrapping_key, unencrypted_data_key, edk, data_key_len, aad_cursor)) {
             aws_cryptosdk_keyring_trace_add_record(
                 request_alloc,
                 keyring_trace,
@@ -257,19 +385,48 @@ success:
     return AWS_OP_SUCCESS;
 }
 
+static int raw_aes_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return raw_aes_keyring_on_decrypt_with_serialized_ctx(
+        kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, NULL, alg);
+}
+
 static void raw_aes_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
     struct raw_aes_keyring *self = (struct raw_aes_keyring *)kr;
     aws_string_destroy(self->key_name);
     aws_string_destroy(self->key_namespace);
-    aws_string_destroy_secure(self->raw_key);
+    aws_cryptosdk_aes_gcm_key_destroy(self->wrapping_key);
     aws_mem_release(self->alloc, self);
 }
 
-static const struct aws_cryptosdk_keyring_vt raw_aes_keyring_vt = { .vt_size = sizeof(struct aws_cryptosdk_keyring_vt),
-                                                                    .name    = "raw AES keyring",
-                                                                    .destroy = raw_aes_keyring_destroy,
-                                                                    .on_encrypt = raw_aes_keyring_on_encrypt,
-                                                                    .on_decrypt = raw_aes_keyring_on_decrypt };
+static int raw_aes_keyring_get_edk_filter(
+    const struct aws_cryptosdk_keyring *kr,
+    struct aws_byte_cursor *provider_id,
+    struct aws_byte_cursor *provider_info_prefix) {
+    const struct raw_aes_keyring *self = (const struct raw_aes_keyring *)kr;
+
+    // Provider info is the key name, followed by the tag and IV lengths and the IV
+    *provider_id          = aws_byte_cursor_from_string(self->key_namespace);
+    *provider_info_prefix = aws_byte_cursor_from_string(self->key_name);
+    return AWS_OP_SUCCESS;
+}
+
+static const struct aws_cryptosdk_keyring_vt raw_aes_keyring_vt = {
+    .vt_size                        = sizeof(struct aws_cryptosdk_keyring_vt),
+    .name                           = "raw AES keyring",
+    .destroy                        = raw_aes_keyring_destroy,
+    .on_encrypt                     = raw_aes_keyring_on_encrypt,
+    .on_decrypt                     = raw_aes_keyring_on_decrypt,
+    .get_edk_filter                 = raw_aes_keyring_get_edk_filter,
+    .on_encrypt_with_serialized_ctx = raw_aes_keyring_on_encrypt_with_serialized_ctx,
+    .on_decrypt_with_serialized_ctx = raw_aes_keyring_on_decrypt_with_serialized_ctx
+};
 
 struct aws_cryptosdk_keyring *aws_cryptosdk_raw_aes_keyring_new(
     struct aws_allocator *alloc,
@@ -289,14 +446,14 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_aes_keyring_new(
 
     aws_cryptosdk_keyring_base_init(&kr->base, &raw_aes_keyring_vt);
 
-    kr->key_name = aws_cryptosdk_string_dup(alloc, key_name);
+    kr->key_name = aws_cryptosdk_string_intern(alloc, key_name);
     if (!kr->key_name) goto oom_err;
 
-    kr->key_namespace = aws_cryptosdk_string_dup(alloc, key_namespace);
+    kr->key_namespace = aws_cryptosdk_string_intern(alloc, key_namespace);
     if (!kr->key_namespace) goto oom_err;
 
-    kr->raw_key = aws_string_new_from_array(alloc, raw_key_bytes, key_len);
-    if (!kr->raw_key) goto oom_err;
+    kr->wrapping_key = aws_cryptosdk_aes_gcm_key_new(alloc, aws_byte_cursor_from_array(raw_key_bytes, key_len));
+    if (!kr->wrapping_key) goto oom_err;
 
     kr->alloc = alloc;
     return (struct aws_cryptosdk_keyring *)kr;
@@ -307,3 +464,258 @@ oom_err:
     aws_mem_release(alloc, kr);
     return NULL;
 }
+
+/*
+ * Identifies a wrapping key in the key store keyring's index; the cursors point into the owning
+ * raw_aes_store_key's strings, or into an EDK when looking one up.
+ */
+struct raw_aes_key_id {
+    struct aws_byte_cursor key_namespace;
+    struct aws_byte_cursor key_name;
+};
+
+struct raw_aes_store_key {
+    struct raw_aes_key_id id;
+    struct aws_allocator *alloc;
+    struct aws_string *key_namespace;
+    struct aws_string *key_name;
+    struct aws_cryptosdk_aes_gcm_key *wrapping_key;
+};
+
+struct raw_aes_key_store_keyring {
+    struct aws_cryptosdk_keyring base;
+    struct aws_allocator *alloc;
+    struct aws_hash_table keys;  // map of (struct raw_aes_key_id *) to (struct raw_aes_store_key *)
+    const struct raw_aes_store_key *encrypt_key;
+};
+
+static uint64_t hash_key_id(const void *item) {
+    const struct raw_aes_key_id *id = item;
+
+    return aws_hash_byte_cursor_ptr(&id->key_namespace) * 31 + aws_hash_byte_cursor_ptr(&id->key_name);
+}
+
+static bool key_id_eq(const void *a, const void *b) {
+    const struct raw_aes_key_id *id_a = a;
+    const struct raw_aes_key_id *id_b = b;
+
+    return aws_byte_cursor_eq(&id_a->key_namespace, &id_b->key_namespace) &&
+           aws_byte_cursor_eq(&id_a->key_name, &id_b->key_name);
+}
+
+static void destroy_store_key(void *value) {
+    struct raw_aes_store_key *key = value;
+
+    aws_string_destroy(key->key_name);
+    aws_string_destroy(key->key_namespace);
+    aws_cryptosdk_aes_gcm_key_destroy(key->wrapping_key);
+    aws_mem_release(key->alloc, key);
+}
+
+static const struct raw_aes_store_key *find_store_key(
+    const struct raw_aes_key_store_keyring *self,
+    struct aws_byte_cursor key_namespace,
+    struct aws_byte_cursor key_name) {
+    struct raw_aes_key_id id = { .key_namespace = key_namespace, .key_name = key_name };
+    struct aws_hash_element *elem;
+
+    aws_hash_table_find(&self->keys, &id, &elem);
+    return elem ? elem->value : NULL;
+}
+
+static int raw_aes_key_store_keyring_on_encrypt_with_serialized_ctx(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct raw_aes_key_store_keyring *self = (struct raw_aes_key_store_keyring *)kr;
+    const struct raw_aes_store_key *key    = self->encrypt_key;
+
+    if (!key) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+
+    return encrypt_with_key(
+        key->key_namespace,
+        key->key_name,
+        key->wrapping_key,
+        request_alloc,
+        unencrypted_data_key,
+        keyring_trace,
+        edks,
+        enc_ctx,
+        serialized_enc_ctx,
+        alg);
+}
+
+static int raw_aes_key_store_keyring_on_encrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return raw_aes_key_store_keyring_on_encrypt_with_serialized_ctx(
+        kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, NULL, alg);
+}
+
+static int raw_aes_key_store_keyring_on_decrypt_with_serialized_ctx(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct raw_aes_key_store_keyring *self = (struct raw_aes_key_store_keyring *)kr;
+
+    struct aws_byte_buf aad;
+    struct aws_byte_cursor aad_cursor;
+    if (get_aad(request_alloc, &aad, &aad_cursor, enc_ctx, serialized_enc_ctx)) {
+        return AWS_OP_ERR;
+    }
+
+    size_t num_edks     = aws_array_list_length(edks);
+    size_t data_key_len = aws_cryptosdk_alg_props(alg)->data_key_len;
+
+    if (aws_byte_buf_init(unencrypted_data_key, aws_cryptosdk_secure_key_allocator(), data_key_len)) {
+        aws_byte_buf_clean_up(&aad);
+        return AWS_OP_ERR;
+    }
+
+    for (size_t edk_idx = 0; edk_idx < num_edks; ++edk_idx) {
+        const struct aws_cryptosdk_edk *edk;
+        if (aws_array_list_get_at_ptr(edks, (void **)&edk, edk_idx)) {
+            aws_byte_buf_clean_up(unencrypted_data_key);
+            aws_byte_buf_clean_up(&aad);
+            return AWS_OP_ERR;
+        }
+        if (!edk->provider_id.len || !edk->ciphertext.len) continue;
+
+        // The key name is whatever precedes the tag length, IV length and IV in the provider info
+        if (edk->provider_info.len <= RAW_AES_KR_IV_LEN + 8) continue;
+        const struct raw_aes_store_key *key = find_store_key(
+            self,
+            aws_byte_cursor_from_buf(&edk->provider_id),
+            aws_byte_cursor_from_array(edk->provider_info.buffer, edk->provider_info.len - RAW_AES_KR_IV_LEN - 8));
+        if (!key) continue;
+
+        if (decrypt_edk(key->key_name, key->wrapping_key, unencrypted_data_key, edk, data_key_len, aad_cursor)) {
+            aws_cryptosdk_keyring_trace_add_record(
+                request_alloc,
+                keyring_trace,
+                key->key_namespace,
+                key->key_name,
+                AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX);
+            aws_byte_buf_clean_up(&aad);
+            return AWS_OP_SUCCESS;
+        }
+    }
+
+    // None of the EDKs worked, clean up unencrypted data key buffer and return success per materials.h
+    aws_byte_buf_clean_up(unencrypted_data_key);
+    aws_byte_buf_clean_up(&aad);
+    return AWS_OP_SUCCESS;
+}
+
+static int raw_aes_key_store_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    return raw_aes_key_store_keyring_on_decrypt_with_serialized_ctx(
+        kr, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, NULL, alg);
+}
+
+static void raw_aes_key_store_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
+    struct raw_aes_key_store_keyring *self = (struct raw_aes_key_store_keyring *)kr;
+
+    aws_hash_table_clean_up(&self->keys);
+    aws_mem_release(self->alloc, self);
+}
+
+static const struct aws_cryptosdk_keyring_vt raw_aes_key_store_keyring_vt = {
+    .vt_size                        = sizeof(struct aws_cryptosdk_keyring_vt),
+    .name                           = "raw AES key store keyring",
+    .destroy                        = raw_aes_key_store_keyring_destroy,
+    .on_encrypt                     = raw_aes_key_store_keyring_on_encrypt,
+    .on_decrypt                     = raw_aes_key_store_keyring_on_decrypt,
+    .on_encrypt_with_serialized_ctx = raw_aes_key_store_keyring_on_encrypt_with_serialized_ctx,
+    .on_decrypt_with_serialized_ctx = raw_aes_key_store_keyring_on_decrypt_with_serialized_ctx
+};
+
+struct aws_cryptosdk_keyring *aws_cryptosdk_raw_aes_key_store_keyring_new(struct aws_allocator *alloc) {
+    struct raw_aes_key_store_keyring *kr = aws_mem_acquire(alloc, sizeof(struct raw_aes_key_store_keyring));
+    if (!kr) return NULL;
+    memset(kr, 0, sizeof(struct raw_aes_key_store_keyring));
+
+    if (aws_hash_table_init(&kr->keys, alloc, 16, hash_key_id, key_id_eq, NULL, destroy_store_key)) {
+        aws_mem_release(alloc, kr);
+        return NULL;
+    }
+
+    aws_cryptosdk_keyring_base_init(&kr->base, &raw_aes_key_store_keyring_vt);
+    kr->alloc = alloc;
+    return (struct aws_cryptosdk_keyring *)kr;
+}
+
+int aws_cryptosdk_raw_aes_key_store_keyring_add_key(
+    struct aws_cryptosdk_keyring *kr,
+    const struct aws_string *key_namespace,
+    const struct aws_string *key_name,
+    const uint8_t *key_bytes,
+    enum aws_cryptosdk_aes_key_len key_len) {
+    struct raw_aes_key_store_keyring *self = (struct raw_aes_key_store_keyring *)kr;
+    AWS_STATIC_STRING_FROM_LITERAL(disallowed, "aws-kms");
+
+    if (aws_string_eq(disallowed, key_namespace)) return aws_raise_error(AWS_CRYPTOSDK_ERR_RESERVED_NAME);
+    if (find_store_key(self, aws_byte_cursor_from_string(key_namespace), aws_byte_cursor_from_string(key_name))) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    struct raw_aes_store_key *key = aws_mem_acquire(self->alloc, sizeof(struct raw_aes_store_key));
+    if (!key) return AWS_OP_ERR;
+    memset(key, 0, sizeof(struct raw_aes_store_key));
+    key->alloc = self->alloc;
+
+    key->key_namespace = aws_cryptosdk_string_intern(self->alloc, key_namespace);
+    if (!key->key_namespace) goto err;
+
+    key->key_name = aws_cryptosdk_string_intern(self->alloc, key_name);
+    if (!key->key_name) goto err;
+
+    key->wrapping_key = aws_cryptosdk_aes_gcm_key_new(self->alloc, aws_byte_cursor_from_array(key_bytes, key_len));
+    if (!key->wrapping_key) goto err;
+
+    key->id.key_namespace = aws_byte_cursor_from_string(key->key_namespace);
+    key->id.key_name      = aws_byte_cursor_from_string(key->key_name);
+    if (aws_hash_table_put(&self->keys, &key->id, key, NULL)) goto err;
+
+    return AWS_OP_SUCCESS;
+
+err:
+    aws_string_destroy(key->key_name);
+    aws_string_destroy(key->key_namespace);
+    aws_cryptosdk_aes_gcm_key_destroy(key->wrapping_key);
+    aws_mem_release(self->alloc, key);
+    return AWS_OP_ERR;
+}
+
+int aws_cryptosdk_raw_aes_key_store_keyring_set_encrypt_key(
+    struct aws_cryptosdk_keyring *kr, const struct aws_string *key_namespace, const struct aws_string *key_name) {
+    struct raw_aes_key_store_keyring *self = (struct raw_aes_key_store_keyring *)kr;
+    const struct raw_aes_store_key *key =
+        find_store_key(self, aws_byte_cursor_from_string(key_namespace), aws_byte_cursor_from_string(key_name));
+
+    if (!key) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+
+    self->encrypt_key = key;
+    return AWS_OP_SUCCESS;
+}
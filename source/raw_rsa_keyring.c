@@ -14,10 +14,13 @@
  */
 #include <aws/cryptosdk/materials.h>
 #include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/secure_pool.h>
 #include <aws/cryptosdk/private/utils.h>
 #include <aws/cryptosdk/raw_rsa_keyring.h>
 
 #include <aws/common/byte_buf.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
 #include <aws/common/string.h>
 
 struct raw_rsa_keyring {
@@ -25,8 +28,8 @@ struct raw_rsa_keyring {
     struct aws_allocator *alloc;
     struct aws_string *key_namespace;
     struct aws_string *key_name;
-    struct aws_string *rsa_private_key_pem;
-    struct aws_string *rsa_public_key_pem;
+    struct aws_cryptosdk_rsa_key *rsa_private_key;
+    struct aws_cryptosdk_rsa_key *rsa_public_key;
     enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode;
 };
 
@@ -37,24 +40,23 @@ static int encrypt_data_key(
     struct aws_array_list *edks) {
     struct raw_rsa_keyring *self = (struct raw_rsa_keyring *)kr;
 
-    struct aws_cryptosdk_edk edk = { { 0 } };
+    struct aws_cryptosdk_edk edk;
 
-    if (aws_cryptosdk_rsa_encrypt(
+    // The RSA ciphertext is allocated separately, as its length is only known once encrypted
+    if (aws_cryptosdk_edk_init_packed(request_alloc, &edk, self->key_namespace->len, self->key_name->len, 0)) {
+        return AWS_OP_ERR;
+    }
+    aws_byte_buf_write_from_whole_string(&edk.provider_id, self->key_namespace);
+    aws_byte_buf_write_from_whole_string(&edk.provider_info, self->key_name);
+
+    if (aws_cryptosdk_rsa_key_encrypt(
             &edk.ciphertext,
             request_alloc,
             aws_byte_cursor_from_buf(unencrypted_data_key),
-            self->rsa_public_key_pem,
+            self->rsa_public_key,
             self->rsa_padding_mode))
         goto err;
 
-    if (aws_byte_buf_init(&edk.provider_id, request_alloc, self->key_namespace->len)) goto err;
-
-    if (aws_byte_buf_init(&edk.provider_info, request_alloc, self->key_name->len)) goto err;
-
-    if (!aws_byte_buf_write_from_whole_string(&edk.provider_id, self->key_namespace)) goto err;
-
-    if (!aws_byte_buf_write_from_whole_string(&edk.provider_info, self->key_name)) goto err;
-
     if (aws_array_list_push_back(edks, &edk)) goto err;
 
     return AWS_OP_SUCCESS;
@@ -74,14 +76,16 @@ static int raw_rsa_keyring_on_encrypt(
     enum aws_cryptosdk_alg_id alg) {
     (void)enc_ctx;
     struct raw_rsa_keyring *self = (struct raw_rsa_keyring *)kr;
-    if (!self->rsa_public_key_pem) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    if (!self->rsa_public_key) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
 
     uint32_t flags = 0;
     if (!unencrypted_data_key->buffer) {
         const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(alg);
         size_t data_key_len                              = props->data_key_len;
 
-        if (aws_byte_buf_init(unencrypted_data_key, request_alloc, data_key_len)) return AWS_OP_ERR;
+        if (aws_byte_buf_init(unencrypted_data_key, aws_cryptosdk_secure_key_allocator(), data_key_len)) {
+            return AWS_OP_ERR;
+        }
 
         if (aws_cryptosdk_genrandom(unencrypted_data_key->buffer, data_key_len)) {
             aws_byte_buf_clean_up(unencrypted_data_key);
@@ -113,7 +117,7 @@ static int raw_rsa_keyring_on_decrypt(
     (void)enc_ctx;
     (void)alg;
     struct raw_rsa_keyring *self = (struct raw_rsa_keyring *)kr;
-    if (!self->rsa_private_key_pem) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    if (!self->rsa_private_key) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
 
     size_t num_edks = aws_array_list_length(edks);
 
@@ -127,11 +131,11 @@ static int raw_rsa_keyring_on_decrypt(
         if (!aws_string_eq_byte_buf(self->key_namespace, &edk->provider_id)) continue;
         if (!aws_string_eq_byte_buf(self->key_name, &edk->provider_info)) continue;
 
-        if (aws_cryptosdk_rsa_decrypt(
+        if (aws_cryptosdk_rsa_key_decrypt(
                 unencrypted_data_key,
-                request_alloc,
+                aws_cryptosdk_secure_key_allocator(),
                 aws_byte_cursor_from_array(edk->ciphertext.buffer, edk->ciphertext.len),
-                self->rsa_private_key_pem,
+                self->rsa_private_key,
                 self->rsa_padding_mode)) {
             /* We are here either because of a ciphertext mismatch
              * or because of an OpenSSL error. In either case, nothing
@@ -156,16 +160,28 @@ static void raw_rsa_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
     struct raw_rsa_keyring *self = (struct raw_rsa_keyring *)kr;
     aws_string_destroy(self->key_name);
     aws_string_destroy(self->key_namespace);
-    aws_string_destroy_secure(self->rsa_private_key_pem);
-    aws_string_destroy_secure(self->rsa_public_key_pem);
+    aws_cryptosdk_rsa_key_destroy(self->rsa_private_key);
+    aws_cryptosdk_rsa_key_destroy(self->rsa_public_key);
     aws_mem_release(self->alloc, self);
 }
 
+static int raw_rsa_keyring_get_edk_filter(
+    const struct aws_cryptosdk_keyring *kr,
+    struct aws_byte_cursor *provider_id,
+    struct aws_byte_cursor *provider_info_prefix) {
+    const struct raw_rsa_keyring *self = (const struct raw_rsa_keyring *)kr;
+
+    *provider_id          = aws_byte_cursor_from_string(self->key_namespace);
+    *provider_info_prefix = aws_byte_cursor_from_string(self->key_name);
+    return AWS_OP_SUCCESS;
+}
+
 static const struct aws_cryptosdk_keyring_vt raw_rsa_keyring_vt = { .vt_size = sizeof(struct aws_cryptosdk_keyring_vt),
                                                                     .name    = "raw RSA keyring",
                                                                     .destroy = raw_rsa_keyring_destroy,
                                                                     .on_encrypt = raw_rsa_keyring_on_encrypt,
-                                                                    .on_decrypt = raw_rsa_keyring_on_decrypt };
+                                                                    .on_decrypt = raw_rsa_keyring_on_decrypt,
+                                                                    .get_edk_filter = raw_rsa_keyring_get_edk_filter };
 
 struct aws_cryptosdk_keyring *aws_cryptosdk_raw_rsa_keyring_new(
     struct aws_allocator *alloc,
@@ -184,10 +200,10 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_rsa_keyring_new(
     if (!kr) return NULL;
     memset(kr, 0, sizeof(struct raw_rsa_keyring));
 
-    kr->key_name = aws_cryptosdk_string_dup(alloc, key_name);
+    kr->key_name = aws_cryptosdk_string_intern(alloc, key_name);
     if (!kr->key_name) goto err;
 
-    kr->key_namespace = aws_cryptosdk_string_dup(alloc, key_namespace);
+    kr->key_namespace = aws_cryptosdk_string_intern(alloc, key_namespace);
     if (!kr->key_namespace) goto err;
 
     if (!rsa_private_key_pem && !rsa_public_key_pem) {
@@ -195,14 +211,16 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_rsa_keyring_new(
         goto err;
     }
 
+    // Parse the keys once here, rather than on every encrypt and decrypt
     if (rsa_public_key_pem) {
-        kr->rsa_public_key_pem = aws_string_new_from_c_str(alloc, rsa_public_key_pem);
-        if (!kr->rsa_public_key_pem) goto err;
+        kr->rsa_public_key = aws_cryptosdk_rsa_public_key_new(alloc, aws_byte_cursor_from_c_str(rsa_public_key_pem));
+        if (!kr->rsa_public_key) goto err;
     }
 
     if (rsa_private_key_pem) {
-        kr->rsa_private_key_pem = aws_string_new_from_c_str(alloc, rsa_private_key_pem);
-        if (!kr->rsa_private_key_pem) goto err;
+        kr->rsa_private_key =
+            aws_cryptosdk_rsa_private_key_new(alloc, aws_byte_cursor_from_c_str(rsa_private_key_pem));
+        if (!kr->rsa_private_key) goto err;
     }
 
     kr->rsa_padding_mode = rsa_padding_mode;
@@ -215,6 +233,102 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_raw_rsa_keyring_new(
 err:
     aws_string_destroy(kr->key_name);
     aws_string_destroy(kr->key_namespace);
+    aws_cryptosdk_rsa_key_destroy(kr->rsa_public_key);
     aws_mem_release(alloc, kr);
     return NULL;
 }
+
+/* State shared by the workers of one batch decrypt; next_item and pending are guarded by mutex */
+struct batch_decrypt {
+    struct aws_mutex mutex;
+    struct aws_condition_variable cond;
+    size_t next_item;
+    size_t pending;
+    struct aws_cryptosdk_keyring *kr;
+    struct aws_allocator *request_alloc;
+    struct aws_cryptosdk_raw_rsa_batch_item *items;
+    size_t num_items;
+};
+
+static void decrypt_batch_item(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_cryptosdk_raw_rsa_batch_item *item) {
+    item->error = AWS_ERROR_SUCCESS;
+    if (aws_cryptosdk_keyring_on_decrypt(
+            kr, request_alloc, &item->unencrypted_data_key, item->keyring_trace, item->edks, NULL, item->alg)) {
+        // Error codes are thread-local, so keep this one with the item
+        item->error = aws_last_error() ? aws_last_error() : AWS_ERROR_UNKNOWN;
+        aws_reset_error();
+    }
+}
+
+static void run_batch_worker(void *arg) {
+    struct batch_decrypt *batch = arg;
+
+    while (true) {
+        aws_mutex_lock(&batch->mutex);
+        size_t idx = batch->next_item;
+        if (idx < batch->num_items) batch->next_item++;
+        aws_mutex_unlock(&batch->mutex);
+
+        if (idx >= batch->num_items) break;
+        decrypt_batch_item(batch->kr, batch->request_alloc, &batch->items[idx]);
+    }
+
+    aws_mutex_lock(&batch->mutex);
+    batch->pending--;
+    aws_condition_variable_notify_all(&batch->cond);
+    aws_mutex_unlock(&batch->mutex);
+}
+
+static bool batch_decrypt_done(void *arg) {
+    struct batch_decrypt *batch = arg;
+
+    return !batch->pending;
+}
+
+int aws_cryptosdk_raw_rsa_keyring_decrypt_batch(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_cryptosdk_raw_rsa_batch_item *items,
+    size_t num_items,
+    aws_cryptosdk_executor_fn *executor,
+    void *executor_data,
+    size_t num_workers) {
+    struct raw_rsa_keyring *self = (struct raw_rsa_keyring *)kr;
+    if (!self->rsa_private_key) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+
+    if (!executor || !num_workers || num_items < 2) {
+        for (size_t idx = 0; idx < num_items; idx++) decrypt_batch_item(kr, request_alloc, &items[idx]);
+        return AWS_OP_SUCCESS;
+    }
+
+    // The calling thread is one of the workers, and more workers than items would find nothing to do
+    size_t num_tasks = num_workers < num_items ? num_workers + 1 : num_items;
+
+    struct batch_decrypt batch = { .mutex         = AWS_MUTEX_INIT,
+                                   .cond          = AWS_CONDITION_VARIABLE_INIT,
+                                   .next_item     = 0,
+                                   .pending       = num_tasks,
+                                   .kr            = kr,
+                                   .request_alloc = request_alloc,
+                                   .items         = items,
+                                   .num_items     = num_items };
+
+    for (size_t worker = 1; worker < num_tasks; worker++) {
+        if (executor(run_batch_worker, &batch, executor_data)) {
+            aws_reset_error();
+            run_batch_worker(&batch);
+        }
+    }
+    run_batch_worker(&batch);
+
+    aws_mutex_lock(&batch.mutex);
+    aws_condition_variable_wait_pred(&batch.cond, &batch.mutex, batch_decrypt_done, &batch);
+    aws_mutex_unlock(&batch.mutex);
+
+    aws_condition_variable_clean_up(&batch.cond);
+    aws_mutex_clean_up(&batch.mutex);
+    return AWS_OP_SUCCESS;
+}
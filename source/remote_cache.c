@@ -0,0 +1,402 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/private/cache_serialize.h>
+#include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/secure_pool.h>
+
+#include <aws/common/atomics.h>
+
+/*
+ * A value in the remote store is the serialized decryption materials, sealed with AES-GCM under
+ * the wrapping key:
+ *
+ *   version (1), IV (12), tag (16), ciphertext
+ *
+ * The store key is authenticated as AAD, so that the store cannot answer one lookup with the
+ * materials of another cache ID.
+ */
+#define SEALED_VERSION 1
+#define SEALED_IV_LEN 12
+#define SEALED_TAG_LEN 16
+#define SEALED_OVERHEAD (1 + SEALED_IV_LEN + SEALED_TAG_LEN)
+/* Decryption materials hold little more than the data key, trace and verification key */
+#define MAX_PAYLOAD_LEN 16384
+
+static const char key_prefix[] = "aws-cryptosdk:";
+/* The prefix, without its NUL, and the cache ID in hex */
+#define MAX_KEY_LEN (sizeof(key_prefix) - 1 + 2 * AWS_CRYPTOSDK_MD_MAX_SIZE)
+
+struct remote_cache {
+    struct aws_cryptosdk_materials_cache base;
+    struct aws_allocator *alloc;
+    struct aws_cryptosdk_materials_cache *local;
+    struct aws_cryptosdk_remote_cache_store store;
+    struct aws_cryptosdk_aes_gcm_key *wrapping_key;
+    uint64_t ttl_secs;
+
+    struct aws_atomic_var remote_hits, remote_misses;
+};
+
+/* Writes the store key for cache_id, which must be at most AWS_CRYPTOSDK_MD_MAX_SIZE bytes, to key */
+static void store_key(struct aws_byte_buf *key, const struct aws_byte_buf *cache_id) {
+    static const char hex[] = "0123456789abcdef";
+
+    aws_byte_buf_write(key, (const uint8_t *)key_prefix, sizeof(key_prefix) - 1);
+    for (size_t i = 0; i < cache_id->len; i++) {
+        aws_byte_buf_write_u8(key, (uint8_t)hex[cache_id->buffer[i] >> 4]);
+        aws_byte_buf_write_u8(key, (uint8_t)hex[cache_id->buffer[i] & 0xf]);
+    }
+}
+
+static int seal(
+    struct remote_cache *cache,
+    struct aws_byte_buf *sealed,
+    const struct aws_byte_buf *key,
+    const struct aws_byte_buf *payload) {
+    if (aws_byte_buf_init(sealed, cache->alloc, SEALED_OVERHEAD + payload->len)) return AWS_OP_ERR;
+
+    uint8_t *iv                = sealed->buffer + 1;
+    struct aws_byte_buf tag    = aws_byte_buf_from_empty_array(iv + SEALED_IV_LEN, SEALED_TAG_LEN);
+    struct aws_byte_buf cipher = aws_byte_buf_from_empty_array(sealed->buffer + SEALED_OVERHEAD, payload->len);
+
+    sealed->buffer[0] = SEALED_VERSION;
+    if (aws_cryptosdk_genrandom(iv, SEALED_IV_LEN) ||
+        aws_cryptosdk_aes_gcm_key_encrypt(
+            cache->wrapping_key,
+            &cipher,
+            &tag,
+            aws_byte_cursor_from_buf(payload),
+            aws_byte_cursor_from_array(iv, SEALED_IV_LEN),
+            aws_byte_cursor_from_buf(key))) {
+        aws_byte_buf_clean_up(sealed);
+        return AWS_OP_ERR;
+    }
+
+    sealed->len = SEALED_OVERHEAD + payload->len;
+    return AWS_OP_SUCCESS;
+}
+
+/* Opens a value sealed under the same store key into payload, which is taken from the secure key allocator */
+static int unseal(
+    struct remote_cache *cache,
+    struct aws_byte_buf *payload,
+    const struct aws_byte_buf *key,
+    struct aws_byte_cursor sealed) {
+    uint8_t version;
+
+    if (sealed.len < SEALED_OVERHEAD || !aws_byte_cursor_read_u8(&sealed, &version) || version != SEALED_VERSION) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    }
+
+    struct aws_byte_cursor iv  = aws_byte_cursor_advance(&sealed, SEALED_IV_LEN);
+    struct aws_byte_cursor tag = aws_byte_cursor_advance(&sealed, SEALED_TAG_LEN);
+
+    if (aws_byte_buf_init(payload, aws_cryptosdk_secure_key_allocator(), sealed.len)) return AWS_OP_ERR;
+
+    if (aws_cryptosdk_aes_gcm_key_decrypt(
+            cache->wrapping_key, payload, sealed, tag, iv, aws_byte_cursor_from_buf(key))) {
+        aws_byte_buf_clean_up_secure(payload);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Looks a cache ID which missed the local cache up in the remote store, and on a hit inserts the
+ * materials found into the local cache, returning a handle to the new local entry. Failures of
+ * the store, and values which do not open under our wrapping key, are treated as misses.
+ */
+static void fetch_remote(
+    struct remote_cache *cache,
+    struct aws_cryptosdk_materials_cache_entry **entry,
+    const struct aws_byte_buf *cache_id) {
+    uint8_t key_arr[MAX_KEY_LEN];
+    struct aws_byte_buf key                       = aws_byte_buf_from_empty_array(key_arr, sizeof(key_arr));
+    struct aws_byte_buf sealed                    = { 0 };
+    struct aws_byte_buf payload                   = { 0 };
+    struct aws_cryptosdk_dec_materials *materials = NULL;
+
+    if (cache_id->len > AWS_CRYPTOSDK_MD_MAX_SIZE) goto out;
+
+    store_key(&key, cache_id);
+    if (cache->store.get(cache->store.ctx, cache->alloc, aws_byte_cursor_from_buf(&key), &sealed) ||
+        !sealed.buffer) {
+        goto out;
+    }
+
+    if (unseal(cache, &payload, &key, aws_byte_cursor_from_buf(&sealed)) ||
+        aws_cryptosdk_priv_deserialize_dec_materials(cache->alloc, &materials, aws_byte_cursor_from_buf(&payload))) {
+        goto out;
+    }
+
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cache->local, entry, materials, cache_id);
+
+out:
+    aws_atomic_fetch_add_explicit(*entry ? &cache->remote_hits : &cache->remote_misses, 1, aws_memory_order_relaxed);
+    aws_cryptosdk_dec_materials_destroy(materials);
+    aws_byte_buf_clean_up_secure(&payload);
+    aws_byte_buf_clean_up(&sealed);
+    aws_reset_error();
+}
+
+/* Seals and stores decryption materials in the remote store, on a best-effort basis */
+static void store_remote(
+    struct remote_cache *cache,
+    const struct aws_cryptosdk_dec_materials *materials,
+    const struct aws_byte_buf *cache_id) {
+    uint8_t key_arr[MAX_KEY_LEN];
+    struct aws_byte_buf key     = aws_byte_buf_from_empty_array(key_arr, sizeof(key_arr));
+    struct aws_byte_buf payload = { 0 };
+    struct aws_byte_buf sealed  = { 0 };
+
+    if (cache_id->len > AWS_CRYPTOSDK_MD_MAX_SIZE ||
+        aws_byte_buf_init(&payload, aws_cryptosdk_secure_key_allocator(), MAX_PAYLOAD_LEN)) {
+        goto out;
+    }
+
+    store_key(&key, cache_id);
+    if (!aws_cryptosdk_priv_serialize_dec_materials(cache->alloc, &payload, materials) &&
+        !seal(cache, &sealed, &key, &payload)) {
+        cache->store.set(
+            cache->store.ctx, aws_byte_cursor_from_buf(&key), aws_byte_cursor_from_buf(&sealed), cache->ttl_secs);
+    }
+
+out:
+    aws_byte_buf_clean_up(&sealed);
+    aws_byte_buf_clean_up_secure(&payload);
+    aws_reset_error();
+}
+
+/********** Remote cache vtable methods; entry handles are those of the local cache **********/
+
+static int find_entry(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **entry,
+    bool *is_encrypt,
+    const struct aws_byte_buf *cache_id) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    if (aws_cryptosdk_materials_cache_find_entry(cache->local, entry, is_encrypt, cache_id)) {
+        return AWS_OP_ERR;
+    }
+
+    if (!*entry) {
+        fetch_remote(cache, entry, cache_id);
+        if (*entry && is_encrypt) *is_encrypt = false;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int update_usage_stats(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    struct aws_cryptosdk_cache_usage_stats *usage_stats) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_update_usage_stats(cache->local, entry, usage_stats);
+}
+
+static int return_usage_stats(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    const struct aws_cryptosdk_cache_usage_stats *usage_stats) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_return_usage_stats(cache->local, entry, usage_stats);
+}
+
+static int get_enc_materials(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_enc_materials **materials,
+    struct aws_hash_table *enc_ctx,
+    struct aws_cryptosdk_materials_cache_entry *entry) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_get_enc_materials(cache->local, allocator, materials, enc_ctx, entry);
+}
+
+static int get_dec_materials(
+    const struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials,
+    const struct aws_cryptosdk_materials_cache_entry *entry) {
+    const struct remote_cache *cache = (const struct remote_cache *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_get_dec_materials(cache->local, allocator, materials, entry);
+}
+
+/*
+ * Encryption materials are only cached locally: their usage limits are counted by the cache
+ * holding them, and hosts sharing a data key through the store would each count only their own use.
+ */
+static void put_entry_for_encrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **entry,
+    const struct aws_cryptosdk_enc_materials *materials,
+    struct aws_cryptosdk_cache_usage_stats initial_usage,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_buf *cache_id) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(
+        cache->local, entry, materials, initial_usage, enc_ctx, cache_id);
+}
+
+static void put_entry_for_decrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **entry,
+    const struct aws_cryptosdk_dec_materials *materials,
+    const struct aws_byte_buf *cache_id) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    store_remote(cache, materials, cache_id);
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cache->local, entry, materials, cache_id);
+}
+
+static void release_entry(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    bool invalidate) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    aws_cryptosdk_materials_cache_entry_release(cache->local, entry, invalidate);
+}
+
+static uint64_t get_creation_time(
+    const struct aws_cryptosdk_materials_cache *generic_cache,
+    const struct aws_cryptosdk_materials_cache_entry *entry) {
+    const struct remote_cache *cache = (const struct remote_cache *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_entry_get_creation_time(cache->local, entry);
+}
+
+static void set_expiration_hint(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    uint64_t expiry_time) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache->local, entry, expiry_time);
+}
+
+static void set_partition_hint(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *entry,
+    const struct aws_byte_buf *partition_id) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    aws_cryptosdk_materials_cache_entry_partition_hint(cache->local, entry, partition_id);
+}
+
+static size_t entry_count(const struct aws_cryptosdk_materials_cache *generic_cache) {
+    const struct remote_cache *cache = (const struct remote_cache *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_entry_count(cache->local);
+}
+
+static void clear_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    aws_cryptosdk_materials_cache_clear(cache->local);
+}
+
+static int invalidate_partition(
+    struct aws_cryptosdk_materials_cache *generic_cache, const struct aws_byte_buf *partition_id) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    return aws_cryptosdk_materials_cache_invalidate_partition(cache->local, partition_id);
+}
+
+static int get_stats(
+    const struct aws_cryptosdk_materials_cache *generic_cache, struct aws_cryptosdk_materials_cache_stats *stats) {
+    // Removing const to read the counters, as the atomics API takes no const pointers
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    // The remote counters are filled in even if the local cache keeps none of its own
+    int rv               = aws_cryptosdk_materials_cache_get_stats(cache->local, stats);
+    stats->remote_hits   = aws_atomic_load_int(&cache->remote_hits);
+    stats->remote_misses = aws_atomic_load_int(&cache->remote_misses);
+
+    return rv;
+}
+
+static void destroy_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
+    struct remote_cache *cache = (struct remote_cache *)generic_cache;
+
+    if (cache->store.destroy) {
+        cache->store.destroy(cache->store.ctx);
+    }
+    aws_cryptosdk_aes_gcm_key_destroy(cache->wrapping_key);
+    aws_cryptosdk_materials_cache_release(cache->local);
+    aws_mem_release(cache->alloc, cache);
+}
+
+static const struct aws_cryptosdk_materials_cache_vt remote_cache_vt = {
+    .vt_size                 = sizeof(remote_cache_vt),
+    .name                    = "Remote materials cache",
+    .find_entry              = find_entry,
+    .update_usage_stats      = update_usage_stats,
+    .get_enc_materials       = get_enc_materials,
+    .get_dec_materials       = get_dec_materials,
+    .put_entry_for_encrypt   = put_entry_for_encrypt,
+    .put_entry_for_decrypt   = put_entry_for_decrypt,
+    .destroy                 = destroy_cache,
+    .entry_count             = entry_count,
+    .entry_release           = release_entry,
+    .entry_get_creation_time = get_creation_time,
+    .entry_ttl_hint          = set_expiration_hint,
+    .clear                   = clear_cache,
+    .get_stats               = get_stats,
+    .return_usage_stats      = return_usage_stats,
+    .entry_partition_hint    = set_partition_hint,
+    .invalidate_partition    = invalidate_partition
+};
+
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_remote_new(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_materials_cache *local,
+    const struct aws_cryptosdk_remote_cache_store *store,
+    struct aws_byte_cursor wrapping_key,
+    uint64_t ttl_secs) {
+    if (!local || !store || !store->get || !store->set || !ttl_secs) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct remote_cache *cache = aws_mem_calloc(alloc, 1, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+
+    if (!(cache->wrapping_key = aws_cryptosdk_aes_gcm_key_new(alloc, wrapping_key))) {
+        aws_mem_release(alloc, cache);
+        return NULL;
+    }
+
+    aws_cryptosdk_materials_cache_base_init(&cache->base, &remote_cache_vt);
+    cache->alloc    = alloc;
+    cache->local    = aws_cryptosdk_materials_cache_retain(local);
+    cache->store    = *store;
+    cache->ttl_secs = ttl_secs;
+    aws_atomic_init_int(&cache->remote_hits, 0);
+    aws_atomic_init_int(&cache->remote_misses, 0);
+
+    return &cache->base;
+}
@@ -0,0 +1,372 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/edk.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/keyring_trace.h>
+#include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/enc_ctx.h>
+#include <aws/cryptosdk/private/framefmt.h>
+#include <aws/cryptosdk/private/header.h>
+#include <aws/cryptosdk/rewrap.h>
+
+#define REWRAP_INITIAL_HEADER_CAPACITY 1024
+
+enum rewrap_state { REWRAP_READ_HEADER, REWRAP_WRITE_HEADER, REWRAP_COPY_BODY, REWRAP_DONE, REWRAP_ERROR };
+
+struct aws_cryptosdk_rewrap {
+    struct aws_allocator *alloc;
+    struct aws_cryptosdk_cmm *cmm;
+    struct aws_cryptosdk_keyring *keyring;
+    enum rewrap_state state;
+    int error;
+
+    struct aws_cryptosdk_hdr header;
+    const struct aws_cryptosdk_alg_properties *alg_props;
+    /* The original header, as far as it has been read; keeps its allocation across messages */
+    struct aws_byte_buf header_in;
+    /* The rewritten header, and how much of it has been written out; keeps its allocation */
+    struct aws_byte_buf header_out;
+    size_t header_out_written;
+
+    uint32_t frame_seqno;
+    size_t input_size_estimate;
+    size_t output_size_estimate;
+};
+
+struct aws_cryptosdk_rewrap *aws_cryptosdk_rewrap_new(
+    struct aws_allocator *alloc, struct aws_cryptosdk_cmm *cmm, struct aws_cryptosdk_keyring *keyring) {
+    if (!cmm || !keyring) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct aws_cryptosdk_rewrap *rewrap = aws_mem_calloc(alloc, 1, sizeof(*rewrap));
+    if (!rewrap) return NULL;
+
+    if (aws_cryptosdk_hdr_init(&rewrap->header, alloc)) {
+        aws_mem_release(alloc, rewrap);
+        return NULL;
+    }
+    // Room for a typical header; larger ones grow the buffers
+    if (aws_byte_buf_init(&rewrap->header_in, alloc, REWRAP_INITIAL_HEADER_CAPACITY) ||
+        aws_byte_buf_init(&rewrap->header_out, alloc, REWRAP_INITIAL_HEADER_CAPACITY)) {
+        aws_byte_buf_clean_up(&rewrap->header_in);
+        aws_cryptosdk_hdr_clean_up(&rewrap->header);
+        aws_mem_release(alloc, rewrap);
+        return NULL;
+    }
+
+    rewrap->alloc   = alloc;
+    rewrap->cmm     = aws_cryptosdk_cmm_retain(cmm);
+    rewrap->keyring = aws_cryptosdk_keyring_retain(keyring);
+    aws_cryptosdk_rewrap_reset(rewrap);
+
+    return rewrap;
+}
+
+void aws_cryptosdk_rewrap_destroy(struct aws_cryptosdk_rewrap *rewrap) {
+    if (!rewrap) return;
+
+    aws_cryptosdk_hdr_clean_up(&rewrap->header);
+    aws_byte_buf_clean_up(&rewrap->header_in);
+    aws_byte_buf_clean_up(&rewrap->header_out);
+    aws_cryptosdk_cmm_release(rewrap->cmm);
+    aws_cryptosdk_keyring_release(rewrap->keyring);
+    aws_mem_release(rewrap->alloc, rewrap);
+}
+
+void aws_cryptosdk_rewrap_reset(struct aws_cryptosdk_rewrap *rewrap) {
+    aws_cryptosdk_hdr_clear(&rewrap->header);
+    rewrap->header_in.len        = 0;
+    rewrap->header_out.len       = 0;
+    rewrap->header_out_written   = 0;
+    rewrap->alg_props            = NULL;
+    rewrap->frame_seqno          = 1;
+    rewrap->input_size_estimate  = 1;
+    rewrap->output_size_estimate = 0;
+    rewrap->error                = AWS_ERROR_SUCCESS;
+    rewrap->state                = REWRAP_READ_HEADER;
+}
+
+/* Obtains the data key from the CMM, checks the original header with it and wraps it with the keyring */
+static int rewrap_data_key(struct aws_cryptosdk_rewrap *rewrap, struct content_key *content_key) {
+    struct aws_cryptosdk_hdr *hdr                 = &rewrap->header;
+    struct aws_cryptosdk_dec_materials *materials = NULL;
+    struct aws_array_list keyring_trace;
+    int rv = AWS_OP_ERR;
+
+    if (aws_cryptosdk_keyring_trace_init(rewrap->alloc, &keyring_trace)) return AWS_OP_ERR;
+
+    struct aws_cryptosdk_dec_request request = { .alloc               = rewrap->alloc,
+                                                 .enc_ctx             = &hdr->enc_ctx,
+                                                 .encrypted_data_keys = hdr->edk_list,
+                                                 .alg                 = hdr->alg_id,
+                                                 .message_id          = hdr->message_id,
+                                                 .skip_keyring_trace  = true,
+                                                 .skip_signature      = true };
+
+    // As with sessions, the request borrows the header's EDK list, and cannot grow it
+    request.encrypted_data_keys.alloc = NULL;
+
+    struct aws_byte_cursor serialized = aws_byte_cursor_from_array(
+        rewrap->header_in.buffer + hdr->parsed_enc_ctx_offset, hdr->parsed_enc_ctx_len);
+    if (serialized.len && aws_cryptosdk_enc_ctx_is_canonical(serialized)) request.serialized_enc_ctx = serialized;
+
+    if (aws_cryptosdk_cmm_decrypt_materials(rewrap->cmm, &materials, &request)) goto out;
+
+    if (materials->unencrypted_data_key.len != rewrap->alg_props->data_key_len) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        goto out;
+    }
+
+    // As in sessions, a content key the CMM already derived is used as is, and checked by the header tag
+    aws_secure_zero(content_key, sizeof(*content_key));
+    if (materials->content_key.len) {
+        if (materials->content_key.len != rewrap->alg_props->content_key_len) {
+            aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+            goto out;
+        }
+        memcpy(content_key->keybuf, materials->content_key.buffer, materials->content_key.len);
+    } else {
+        struct data_key data_key = { { 0 } };
+        memcpy(data_key.keybuf, materials->unencrypted_data_key.buffer, materials->unencrypted_data_key.len);
+        int derive_rv = aws_cryptosdk_derive_key(rewrap->alg_props, content_key, &data_key, hdr->message_id);
+        aws_secure_zero(&data_key, sizeof(data_key));
+        if (derive_rv) goto out;
+    }
+
+    size_t authtag_len           = rewrap->alg_props->iv_len + rewrap->alg_props->tag_len;
+    struct aws_byte_buf authtag  = aws_byte_buf_from_array(rewrap->header_in.buffer + hdr->auth_len, authtag_len);
+    struct aws_byte_buf to_check = aws_byte_buf_from_array(rewrap->header_in.buffer, hdr->auth_len);
+    if (aws_cryptosdk_verify_header(rewrap->alg_props, content_key, &authtag, &to_check)) goto out;
+
+    // The new EDKs take the place of the old ones, which the CMM has finished with
+    aws_cryptosdk_edk_list_clear(&hdr->edk_list);
+    if (aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx(
+            rewrap->keyring,
+            rewrap->alloc,
+            &materials->unencrypted_data_key,
+            &keyring_trace,
+            &hdr->edk_list,
+            &hdr->enc_ctx,
+            request.serialized_enc_ctx.len ? &request.serialized_enc_ctx : NULL,
+            hdr->alg_id)) {
+        goto out;
+    }
+
+    // A message without EDKs could never be decrypted again
+    if (!aws_array_list_length(&hdr->edk_list)) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+        goto out;
+    }
+
+    rv = AWS_OP_SUCCESS;
+out:
+    aws_cryptosdk_dec_materials_destroy(materials);
+    aws_array_list_clean_up(&request.encrypted_data_keys);
+    aws_cryptosdk_keyring_trace_clean_up(&keyring_trace);
+
+    return rv;
+}
+
+/* Replaces the EDKs of the parsed header and serializes it, with a new authentication tag, into header_out */
+static int rewrite_header(struct aws_cryptosdk_rewrap *rewrap) {
+    struct aws_cryptosdk_hdr *hdr = &rewrap->header;
+    struct content_key content_key = { { 0 } };
+    int rv                         = AWS_OP_ERR;
+
+    if (!(rewrap->alg_props = aws_cryptosdk_alg_props(hdr->alg_id))) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    }
+    if (rewrap->alg_props->signature_len) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    size_t authtag_len = rewrap->alg_props->iv_len + rewrap->alg_props->tag_len;
+    if (rewrap->header_in.len - hdr->auth_len != authtag_len) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    }
+
+    if (rewrap_data_key(rewrap, &content_key)) goto out;
+
+    // The encryption context keeps its original serialization, byte for byte
+    hdr->serialized_enc_ctx = aws_byte_cursor_from_array(
+        rewrap->header_in.buffer + hdr->parsed_enc_ctx_offset, hdr->parsed_enc_ctx_len);
+
+    size_t header_size = aws_cryptosdk_hdr_size(hdr);
+    size_t written;
+    if (!header_size) {
+        // EDK field lengths resulted in size_t overflow
+        aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        goto out;
+    }
+    if (aws_byte_buf_reserve(&rewrap->header_out, header_size)) goto out;
+    if (aws_cryptosdk_hdr_write(hdr, &written, rewrap->header_out.buffer, header_size)) goto out;
+    if (written != header_size) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        goto out;
+    }
+
+    // The IV and auth tag are written in place, which completes the serialized header
+    struct aws_byte_buf to_sign = aws_byte_buf_from_array(rewrap->header_out.buffer, header_size - authtag_len);
+    struct aws_byte_buf authtag =
+        aws_byte_buf_from_array(rewrap->header_out.buffer + header_size - authtag_len, authtag_len);
+    if (aws_cryptosdk_sign_header(rewrap->alg_props, &content_key, &authtag, &to_sign)) goto out;
+
+    rewrap->header_out.len       = header_size;
+    rewrap->output_size_estimate = header_size;
+    rewrap->input_size_estimate  = 0;
+    rewrap->state                = REWRAP_WRITE_HEADER;
+    rv                           = AWS_OP_SUCCESS;
+out:
+    aws_secure_zero(&content_key, sizeof(content_key));
+    AWS_ZERO_STRUCT(hdr->serialized_enc_ctx);
+
+    return rv;
+}
+
+/* Reads the original header, a piece at a time, never consuming input past its end */
+static int read_header(struct aws_cryptosdk_rewrap *rewrap, struct aws_byte_cursor *input) {
+    while (true) {
+        struct aws_byte_cursor cursor = aws_byte_cursor_from_buf(&rewrap->header_in);
+        size_t needed                 = 0;
+
+        int rv = aws_cryptosdk_hdr_try_parse_incremental(&rewrap->header, &cursor, &needed);
+        if (rv == AWS_OP_SUCCESS) break;
+        if (rv != AWS_CRYPTOSDK_NEED_MORE) return AWS_OP_ERR;
+
+        rewrap->input_size_estimate = needed - rewrap->header_in.len;
+        if (!input->len) return AWS_OP_SUCCESS;
+
+        size_t take = rewrap->input_size_estimate < input->len ? rewrap->input_size_estimate : input->len;
+        if (aws_byte_buf_reserve(&rewrap->header_in, needed)) return AWS_OP_ERR;
+        aws_byte_buf_write(&rewrap->header_in, input->ptr, take);
+        aws_byte_cursor_advance(input, take);
+    }
+
+    return rewrite_header(rewrap);
+}
+
+static void write_header(struct aws_cryptosdk_rewrap *rewrap, struct aws_byte_buf *output) {
+    size_t left = rewrap->header_out.len - rewrap->header_out_written;
+    size_t room = output->capacity - output->len;
+    size_t len  = left < room ? left : room;
+
+    aws_byte_buf_write(output, rewrap->header_out.buffer + rewrap->header_out_written, len);
+    rewrap->header_out_written += len;
+    rewrap->output_size_estimate = left - len;
+
+    if (rewrap->header_out_written == rewrap->header_out.len) {
+        rewrap->state = REWRAP_COPY_BODY;
+    }
+}
+
+/* Copies whole frames from input to output, for as long as both have room */
+static int copy_body(
+    struct aws_cryptosdk_rewrap *rewrap, struct aws_byte_buf *output, struct aws_byte_cursor *input) {
+    while (rewrap->state == REWRAP_COPY_BODY) {
+        struct aws_byte_cursor frame_start = *input;
+        struct aws_cryptosdk_frame frame;
+        size_t frame_len, plaintext_len;
+
+        int rv = aws_cryptosdk_try_deserialize_frame(
+            &frame, &frame_len, &plaintext_len, input, rewrap->alg_props, rewrap->header.frame_len);
+        if (rv == AWS_CRYPTOSDK_NEED_MORE) {
+            rewrap->input_size_estimate  = frame_len;
+            rewrap->output_size_estimate = frame_len;
+            return AWS_OP_SUCCESS;
+        }
+        if (rv) return AWS_OP_ERR;
+
+        // Frames are not authenticated here, but their order is checked as it costs nothing
+        if (frame.sequence_number != rewrap->frame_seqno) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        }
+
+        frame_len = input->ptr - frame_start.ptr;
+        if (output->capacity - output->len < frame_len) {
+            *input                       = frame_start;
+            rewrap->input_size_estimate  = frame_len;
+            rewrap->output_size_estimate = frame_len;
+            return AWS_OP_SUCCESS;
+        }
+
+        aws_byte_buf_write(output, frame_start.ptr, frame_len);
+        rewrap->frame_seqno++;
+
+        if (frame.type != FRAME_TYPE_FRAME) {
+            rewrap->input_size_estimate  = 0;
+            rewrap->output_size_estimate = 0;
+            rewrap->state                = REWRAP_DONE;
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_rewrap_message(
+    struct aws_cryptosdk_rewrap *rewrap,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen,
+    size_t *in_bytes_read) {
+    struct aws_byte_buf output   = aws_byte_buf_from_empty_array(outp, outlen);
+    struct aws_byte_cursor input = aws_byte_cursor_from_array(inp, inlen);
+    int rv                       = AWS_OP_SUCCESS;
+    enum rewrap_state prior_state;
+
+    *out_bytes_written = 0;
+    *in_bytes_read     = 0;
+
+    do {
+        prior_state = rewrap->state;
+
+        switch (rewrap->state) {
+            case REWRAP_READ_HEADER: rv = read_header(rewrap, &input); break;
+            case REWRAP_WRITE_HEADER: write_header(rewrap, &output); break;
+            case REWRAP_COPY_BODY: rv = copy_body(rewrap, &output, &input); break;
+            case REWRAP_DONE: break;
+            case REWRAP_ERROR: return aws_raise_error(rewrap->error);
+        }
+    } while (rv == AWS_OP_SUCCESS && rewrap->state != prior_state);
+
+    *in_bytes_read = input.ptr - inp;
+
+    if (rv) {
+        rewrap->error = aws_last_error();
+        rewrap->state = REWRAP_ERROR;
+        return AWS_OP_ERR;
+    }
+
+    *out_bytes_written = output.len;
+
+    return AWS_OP_SUCCESS;
+}
+
+bool aws_cryptosdk_rewrap_is_done(const struct aws_cryptosdk_rewrap *rewrap) {
+    return rewrap->state == REWRAP_DONE;
+}
+
+void aws_cryptosdk_rewrap_estimate_buf(
+    const struct aws_cryptosdk_rewrap *rewrap, size_t *outlen_needed, size_t *inlen_needed) {
+    *outlen_needed = rewrap->output_size_estimate;
+    *inlen_needed  = rewrap->input_size_estimate;
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/common/mutex.h>
+#include <aws/cryptosdk/private/secure_pool.h>
+#include <string.h>
+
+#ifndef _WIN32
+#    include <sys/mman.h>
+#    include <unistd.h>
+#endif
+
+/* Data keys (16, 24 or 32 bytes), content keys, and RSA blocks of up to 4096 bits */
+static const size_t slot_sizes[] = { 32, 64, AWS_CRYPTOSDK_SECURE_POOL_MAX_SLOT };
+#define NUM_SLOT_CLASSES (sizeof(slot_sizes) / sizeof(slot_sizes[0]))
+
+/* Pages of slots per slab, small enough to stay within a default RLIMIT_MEMLOCK */
+#define SLAB_PAGES 4
+
+/* Fallback allocations are prefixed with their size, so that they can be wiped on release */
+#define FALLBACK_HEADER_LEN 16
+
+struct slab {
+    struct slab *next;
+    uint8_t *slots;
+    size_t slots_len;
+    size_t slot_size;
+};
+
+static struct {
+    struct aws_mutex mutex;
+    /* Slabs are never unmapped, so this list only grows */
+    struct slab *slabs;
+    /* Free slots of each class, linked through their first bytes */
+    void *free_lists[NUM_SLOT_CLASSES];
+} pool = { AWS_MUTEX_INIT, NULL, { NULL } };
+
+static int slot_class(size_t size) {
+    for (size_t i = 0; i < NUM_SLOT_CLASSES; i++) {
+        if (size <= slot_sizes[i]) return (int)i;
+    }
+
+    return -1;
+}
+
+/* Maps a locked, guarded slab and puts its slots on the free list. Call with the mutex held. */
+static void add_slab(int cls) {
+#ifndef _WIN32
+    size_t page      = (size_t)sysconf(_SC_PAGESIZE);
+    size_t slots_len = SLAB_PAGES * page;
+
+    uint8_t *map = mmap(NULL, slots_len + 2 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return;
+
+    if (mprotect(map, page, PROT_NONE) || mprotect(map + page + slots_len, page, PROT_NONE)) goto err;
+
+    // Locking is best-effort, as unprivileged processes may have a small RLIMIT_MEMLOCK
+    (void)mlock(map + page, slots_len);
+#    ifdef MADV_DONTDUMP
+    (void)madvise(map + page, slots_len, MADV_DONTDUMP);
+#    endif
+
+    struct slab *slab = aws_mem_acquire(aws_default_allocator(), sizeof(*slab));
+    if (!slab) goto err;
+
+    slab->slots     = map + page;
+    slab->slots_len = slots_len;
+    slab->slot_size = slot_sizes[cls];
+    slab->next      = pool.slabs;
+    pool.slabs      = slab;
+
+    for (size_t offset = slots_len; offset >= slab->slot_size; offset -= slab->slot_size) {
+        void *slot = slab->slots + offset - slab->slot_size;
+        memcpy(slot, &pool.free_lists[cls], sizeof(void *));
+        pool.free_lists[cls] = slot;
+    }
+
+    return;
+
+err:
+    munmap(map, slots_len + 2 * page);
+#else
+    (void)cls;
+#endif
+}
+
+/* Call with the mutex held */
+static struct slab *find_slab(const void *ptr) {
+    for (struct slab *slab = pool.slabs; slab; slab = slab->next) {
+        if ((const uint8_t *)ptr >= slab->slots && (const uint8_t *)ptr < slab->slots + slab->slots_len) return slab;
+    }
+
+    return NULL;
+}
+
+static void *fallback_acquire(size_t size) {
+    if (size > SIZE_MAX - FALLBACK_HEADER_LEN) return NULL;
+
+    uint8_t *mem = aws_mem_acquire(aws_default_allocator(), size + FALLBACK_HEADER_LEN);
+    if (!mem) return NULL;
+
+    memcpy(mem, &size, sizeof(size));
+
+    return mem + FALLBACK_HEADER_LEN;
+}
+
+static size_t fallback_size(const void *ptr) {
+    size_t size;
+    memcpy(&size, (const uint8_t *)ptr - FALLBACK_HEADER_LEN, sizeof(size));
+
+    return size;
+}
+
+static void fallback_release(void *ptr) {
+    uint8_t *mem = (uint8_t *)ptr - FALLBACK_HEADER_LEN;
+
+    aws_secure_zero(mem, fallback_size(ptr) + FALLBACK_HEADER_LEN);
+    aws_mem_release(aws_default_allocator(), mem);
+}
+
+static void *pool_acquire(struct aws_allocator *allocator, size_t size) {
+    (void)allocator;
+    int cls    = slot_class(size);
+    void *slot = NULL;
+
+    if (cls < 0) return fallback_acquire(size);
+
+    aws_mutex_lock(&pool.mutex);
+    if (!pool.free_lists[cls]) add_slab(cls);
+    slot = pool.free_lists[cls];
+    if (slot) memcpy(&pool.free_lists[cls], slot, sizeof(void *));
+    aws_mutex_unlock(&pool.mutex);
+
+    // If no slab could be mapped, key material still goes somewhere that is wiped on release
+    if (!slot) return fallback_acquire(size);
+
+    aws_secure_zero(slot, sizeof(void *));
+
+    return slot;
+}
+
+static void pool_release(struct aws_allocator *allocator, void *ptr) {
+    (void)allocator;
+
+    aws_mutex_lock(&pool.mutex);
+    struct slab *slab = find_slab(ptr);
+    if (slab) {
+        int cls = slot_class(slab->slot_size);
+
+        aws_secure_zero(ptr, slab->slot_size);
+        memcpy(ptr, &pool.free_lists[cls], sizeof(void *));
+        pool.free_lists[cls] = ptr;
+    }
+    aws_mutex_unlock(&pool.mutex);
+
+    if (!slab) fallback_release(ptr);
+}
+
+static void *pool_realloc(struct aws_allocator *allocator, void *oldptr, size_t oldsize, size_t newsize) {
+    if (!oldptr) return pool_acquire(allocator, newsize);
+
+    aws_mutex_lock(&pool.mutex);
+    struct slab *slab = find_slab(oldptr);
+    aws_mutex_unlock(&pool.mutex);
+
+    size_t capacity = slab ? slab->slot_size : fallback_size(oldptr);
+    if (newsize <= capacity) return oldptr;
+
+    void *newptr = pool_acquire(allocator, newsize);
+    if (!newptr) return NULL;
+
+    memcpy(newptr, oldptr, oldsize);
+    pool_release(allocator, oldptr);
+
+    return newptr;
+}
+
+static void *pool_calloc(struct aws_allocator *allocator, size_t num, size_t size) {
+    if (size && num > SIZE_MAX / size) return NULL;
+
+    void *ptr = pool_acquire(allocator, num * size);
+    if (ptr) memset(ptr, 0, num * size);
+
+    return ptr;
+}
+
+static struct aws_allocator secure_key_allocator = {
+    .mem_acquire = pool_acquire,
+    .mem_release = pool_release,
+    .mem_realloc = pool_realloc,
+    .mem_calloc  = pool_calloc,
+    .impl        = NULL,
+};
+
+struct aws_allocator *aws_cryptosdk_secure_key_allocator(void) {
+    return &secure_key_allocator;
+}
+
+bool aws_cryptosdk_secure_pool_owns(const void *ptr) {
+    aws_mutex_lock(&pool.mutex);
+    struct slab *slab = find_slab(ptr);
+    aws_mutex_unlock(&pool.mutex);
+
+    return slab != NULL;
+}
@@ -15,18 +15,119 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <aws/common/byte_buf.h>
+#include <aws/common/clock.h>
+#include <aws/common/math.h>
 #include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/arena.h>
+#include <aws/cryptosdk/private/compress.h>
+#include <aws/cryptosdk/private/config.h>
+#include <aws/cryptosdk/private/frame_executor.h>
+#include <aws/cryptosdk/private/frame_pool.h>
+#include <aws/cryptosdk/private/frame_index.h>
 #include <aws/cryptosdk/private/framefmt.h>
 #include <aws/cryptosdk/private/header.h>
+#include <aws/cryptosdk/private/probes.h>
+#include <aws/cryptosdk/private/secure_pool.h>
 #include <aws/cryptosdk/private/session.h>
 #include <aws/cryptosdk/session.h>
 
+#ifdef AWS_CRYPTOSDK_P_HAVE_LIBNUMA
+#    include <numa.h>
+#    include <numaif.h>
+#endif
+
 /** Public APIs and common code **/
+static bool async_request_complete(void *arg) {
+    const struct aws_cryptosdk_session *session = arg;
+    return session->async_complete;
+}
+
+/* Waits out any outstanding asynchronous request, then discards its result */
+static void cancel_async_request(struct aws_cryptosdk_session *session) {
+    if (!session->async_requested) {
+        return;
+    }
+
+    // The CMM may still be using the request, so it can't be torn down until it completes
+    aws_mutex_lock(&session->async_mutex);
+    aws_condition_variable_wait_pred(&session->async_done, &session->async_mutex, async_request_complete, session);
+    aws_mutex_unlock(&session->async_mutex);
+
+    aws_cryptosdk_enc_materials_destroy(session->async_enc_materials);
+    aws_cryptosdk_dec_materials_destroy(session->async_dec_materials);
+    aws_array_list_clean_up(&session->dec_request.encrypted_data_keys);
+
+    session->async_enc_materials = NULL;
+    session->async_dec_materials = NULL;
+    session->async_complete      = false;
+    session->async_error         = AWS_ERROR_SUCCESS;
+    session->async_requested     = false;
+}
+
+static const char *state_name(enum session_state state) {
+    switch (state) {
+        case ST_CONFIG: return "config";
+        case ST_ERROR: return "error";
+        case ST_DONE: return "done";
+        case ST_READ_HEADER: return "read_header";
+        case ST_UNWRAP_KEY: return "unwrap_key";
+        case ST_DECRYPT_BODY: return "decrypt_body";
+        case ST_CHECK_TRAILER: return "check_trailer";
+        case ST_GEN_KEY: return "gen_key";
+        case ST_WRITE_HEADER: return "write_header";
+        case ST_ENCRYPT_BODY: return "encrypt_body";
+        case ST_WRITE_TRAILER: return "write_trailer";
+        default: return "unknown";
+    }
+}
+
+static uint64_t stats_now(void) {
+    uint64_t now = 0;
+
+    // Zero means "not timing", so a failed clock read just drops that interval
+    aws_high_res_clock_get_ticks(&now);
+
+    return now;
+}
+
+/* Reports the transition from the current state to new_state, if tracing is enabled */
+static void trace_transition(struct aws_cryptosdk_session *session, enum session_state new_state, uint64_t now) {
+    if (!session->on_trace || session->state == new_state) {
+        return;
+    }
+
+    struct aws_cryptosdk_session_trace_event event = {
+        .timestamp_ns = now,
+        .old_state    = state_name(session->state),
+        .new_state    = state_name(new_state),
+        // The header is sized once it has been built or parsed, message ID and all
+        .message_id = session->header_size ? session->header.message_id : NULL,
+    };
+
+    session->on_trace(session, &event, session->on_trace_user_data);
+}
+
+void aws_cryptosdk_session_set_trace_callback(
+    struct aws_cryptosdk_session *session, aws_cryptosdk_session_trace_fn *on_trace, void *user_data) {
+    session->on_trace           = on_trace;
+    session->on_trace_user_data = on_trace ? user_data : NULL;
+}
+
 int aws_cryptosdk_session_reset(struct aws_cryptosdk_session *session, enum aws_cryptosdk_mode mode) {
+    cancel_async_request(session);
+
+    // Reported before the message ID is cleared, so that the event closes the old message's timeline
+    if (session->on_trace) {
+        trace_transition(session, ST_CONFIG, stats_now());
+    }
+
     /* session->alloc is preserved */
     session->error = 0;
     session->mode  = mode;
@@ -37,27 +138,66 @@ int aws_cryptosdk_session_reset(struct aws_cryptosdk_session *session, enum aws_
     session->data_so_far        = 0;
     session->precise_size_known = false;
     session->cmm_success        = false;
+    session->compacted          = false;
 
+    /* header_copy keeps its allocation for the next message; the EDK list, encryption
+     * context and keyring trace are likewise cleared without giving up their storage */
     if (session->header_copy) {
-        aws_secure_zero(session->header_copy, session->header_size);
-        aws_mem_release(session->alloc, session->header_copy);
+        aws_secure_zero(session->header_copy, session->header_copy_capacity);
     }
 
-    session->header_copy = NULL;
-    session->header_size = 0;
+    session->header_size  = 0;
+    session->header_bytes = NULL;
     aws_cryptosdk_hdr_clear(&session->header);
+    aws_cryptosdk_materials_snapshot_release(session->edk_snapshot);
+    session->edk_snapshot = NULL;
     aws_cryptosdk_keyring_trace_clear(&session->keyring_trace);
-    /* session->frame_size is preserved */
+    /* session->frame_size, session->adaptive_frame_size and session->frame_block_size are preserved */
+    session->frozen_enc_ctx  = NULL;
+    session->frame_index_out = NULL;
+    AWS_ZERO_STRUCT(session->frame_index);
     session->input_size_estimate  = 1;
     session->output_size_estimate = 1;
     session->frame_seqno          = 0;
     session->alg_props            = NULL;
-    aws_secure_zero(&session->content_key, sizeof(session->content_key));
+    aws_secure_zero(session->content_key, sizeof(*session->content_key));
+    aws_cryptosdk_cipher_ctx_clean_up(&session->body_cipher);
+    /* session->worker_threads, session->frame_executor, session->gcm_provider,
+     * session->pipelined_signature, session->defer_signature and session->skip_keyring_trace
+     * are preserved */
+    for (size_t i = 0; session->worker_ciphers && i < session->worker_threads - 1; i++) {
+        aws_cryptosdk_cipher_ctx_clean_up(&session->worker_ciphers[i]);
+    }
 
     if (session->signctx) {
         aws_cryptosdk_sig_abort(session->signctx);
     }
     session->signctx = NULL;
+    aws_string_destroy(session->deferred_signature);
+    session->deferred_signature = NULL;
+
+    /* Everything allocated from the arena has been released above; session->arena is preserved */
+    if (session->arena) {
+        aws_cryptosdk_arena_reset(session->arena);
+    }
+
+    AWS_ZERO_STRUCT(session->stats);
+    session->state_since    = 0;
+    session->plaintext_sunk = 0;
+    /* session->on_trace, session->sink, session->plaintext_sink, session->source and their buffers
+     * are preserved; input pulled from the source for the old message is discarded */
+    aws_byte_buf_secure_zero(&session->source_buf);
+
+    /* session->compression and session->codec_buf are preserved */
+    aws_cryptosdk_priv_codec_destroy(session->codec);
+    session->codec                  = NULL;
+    session->codec_checked          = false;
+    session->codec_done             = false;
+    session->codec_plain_size       = 0;
+    session->codec_plain_size_known = false;
+    session->codec_plain_in         = 0;
+    session->codec_out              = 0;
+    aws_byte_buf_secure_zero(&session->codec_buf);
 
     if (mode != AWS_CRYPTOSDK_ENCRYPT && mode != AWS_CRYPTOSDK_DECRYPT) {
         // We do this only after clearing all internal state, to ensure that we don't
@@ -68,6 +208,39 @@ int aws_cryptosdk_session_reset(struct aws_cryptosdk_session *session, enum aws_
     return AWS_OP_SUCCESS;
 }
 
+int aws_cryptosdk_priv_reserve_header_copy(struct aws_cryptosdk_session *session) {
+    if (session->header_copy && session->header_copy_capacity >= session->header_size) {
+        return AWS_OP_SUCCESS;
+    }
+
+    if (session->header_copy) {
+        aws_secure_zero(session->header_copy, session->header_copy_capacity);
+        aws_mem_release(session->alloc, session->header_copy);
+        session->header_copy          = NULL;
+        session->header_copy_capacity = 0;
+    }
+
+    if (!(session->header_copy = aws_mem_acquire(session->alloc, session->header_size))) {
+        return aws_raise_error(AWS_ERROR_OOM);
+    }
+    session->header_copy_capacity = session->header_size;
+
+    return AWS_OP_SUCCESS;
+}
+
+size_t aws_cryptosdk_priv_frame_ciphertext_size(
+    const struct aws_cryptosdk_alg_properties *props, enum aws_cryptosdk_frame_type type, size_t plaintext_size) {
+    struct aws_cryptosdk_frame frame = { .type = type, .sequence_number = 1 };
+    uint8_t dummy;
+    struct aws_byte_buf empty = aws_byte_buf_from_empty_array(&dummy, 0);
+    size_t ciphertext_size    = 0;
+
+    // This always returns AWS_CRYPTOSDK_NEED_MORE, but reports the size needed
+    aws_cryptosdk_try_serialize_frame(&frame, &ciphertext_size, plaintext_size, &empty, props);
+
+    return ciphertext_size;
+}
+
 static struct aws_cryptosdk_session *aws_cryptosdk_session_new(
     struct aws_allocator *allocator, enum aws_cryptosdk_mode mode) {
     struct aws_cryptosdk_session *session = aws_mem_acquire(allocator, sizeof(struct aws_cryptosdk_session));
@@ -78,29 +251,53 @@ static struct aws_cryptosdk_session *aws_cryptosdk_session_new(
 
     aws_secure_zero(session, sizeof(*session));
 
-    session->alloc      = allocator;
-    session->frame_size = DEFAULT_FRAME_SIZE;
+    session->alloc                = allocator;
+    session->frame_size           = DEFAULT_FRAME_SIZE;
+    session->worker_threads       = 1;
+    session->sink_buf.allocator   = allocator;
+    session->source_buf.allocator = allocator;
+    session->codec_buf.allocator  = allocator;
 
-    if (aws_cryptosdk_hdr_init(&session->header, allocator)) {
+    if (aws_mutex_init(&session->async_mutex)) {
         aws_mem_release(allocator, session);
         return NULL;
     }
 
+    if (aws_condition_variable_init(&session->async_done)) {
+        goto err_mutex;
+    }
+
+    if (aws_cryptosdk_hdr_init(&session->header, allocator)) {
+        goto err_cond;
+    }
+
     if (aws_cryptosdk_keyring_trace_init(allocator, &session->keyring_trace)) {
-        aws_cryptosdk_hdr_clean_up(&session->header);
-        aws_mem_release(allocator, session);
-        return NULL;
+        goto err_hdr;
+    }
+
+    session->content_key = aws_mem_acquire(aws_cryptosdk_secure_key_allocator(), sizeof(*session->content_key));
+    if (!session->content_key) {
+        goto err_trace;
     }
 
     // This can fail due to invalid mode
     if (aws_cryptosdk_session_reset(session, mode)) {
-        aws_cryptosdk_hdr_clean_up(&session->header);
-        aws_cryptosdk_keyring_trace_clean_up(&session->keyring_trace);
-        aws_mem_release(allocator, session);
-        return NULL;
+        aws_mem_release(aws_cryptosdk_secure_key_allocator(), session->content_key);
+        goto err_trace;
     }
 
     return session;
+
+err_trace:
+    aws_cryptosdk_keyring_trace_clean_up(&session->keyring_trace);
+err_hdr:
+    aws_cryptosdk_hdr_clean_up(&session->header);
+err_cond:
+    aws_condition_variable_clean_up(&session->async_done);
+err_mutex:
+    aws_mutex_clean_up(&session->async_mutex);
+    aws_mem_release(allocator, session);
+    return NULL;
 }
 
 struct aws_cryptosdk_session *aws_cryptosdk_session_new_from_cmm(
@@ -115,187 +312,1990 @@ struct aws_cryptosdk_session *aws_cryptosdk_session_new_from_cmm(
     return session;
 }
 
+struct aws_cryptosdk_session *aws_cryptosdk_session_new_borrowing_cmm(
+    struct aws_allocator *allocator, enum aws_cryptosdk_mode mode, struct aws_cryptosdk_cmm *cmm) {
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new(allocator, mode);
+
+    if (session) {
+        session->cmm          = cmm;
+        session->cmm_borrowed = true;
+    }
+
+    return session;
+}
+
 struct aws_cryptosdk_session *aws_cryptosdk_session_new_from_keyring(
     struct aws_allocator *allocator, enum aws_cryptosdk_mode mode, struct aws_cryptosdk_keyring *keyring) {
     struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(allocator, keyring);
     if (!cmm) return NULL;
 
-    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new(allocator, mode);
-    if (!session) {
-        aws_cryptosdk_cmm_release(cmm);
-        return NULL;
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new(allocator, mode);
+    if (!session) {
+        aws_cryptosdk_cmm_release(cmm);
+        return NULL;
+    }
+
+    session->cmm = cmm;
+    // CMM reference count is now 1 and the session owns the reference, which will be released
+    // when session is destroyed.
+
+    return session;
+}
+
+void aws_cryptosdk_session_destroy(struct aws_cryptosdk_session *session) {
+    struct aws_allocator *alloc = session->alloc;
+
+    aws_cryptosdk_session_reset(
+        session, AWS_CRYPTOSDK_DECRYPT);  // frees dynamically allocated stuff (except for the header itself)
+
+    aws_cryptosdk_hdr_clean_up(&session->header);
+    aws_cryptosdk_keyring_trace_clean_up(&session->keyring_trace);
+    aws_cryptosdk_enc_materials_destroy(session->spare_enc_materials);
+    aws_cryptosdk_dec_materials_destroy(session->spare_dec_materials);
+    if (!session->cmm_borrowed) {
+        aws_cryptosdk_cmm_release(session->cmm);
+    }
+
+    if (session->header_copy) {
+        aws_mem_release(alloc, session->header_copy);
+    }
+
+    if (session->worker_ciphers) {
+        aws_mem_release(alloc, session->worker_ciphers);
+    }
+    aws_cryptosdk_frame_executor_destroy(session->worker_executor);
+
+    if (session->sink_buf.buffer) {
+        aws_byte_buf_clean_up_secure(&session->sink_buf);
+    }
+
+    if (session->source_buf.buffer) {
+        aws_byte_buf_clean_up_secure(&session->source_buf);
+    }
+
+    if (session->codec_buf.buffer) {
+        aws_byte_buf_clean_up_secure(&session->codec_buf);
+    }
+
+    aws_cryptosdk_arena_destroy(session->arena);
+    aws_mem_release(aws_cryptosdk_secure_key_allocator(), session->content_key);
+
+    aws_condition_variable_clean_up(&session->async_done);
+    aws_mutex_clean_up(&session->async_mutex);
+
+    aws_secure_zero(session, sizeof(*session));
+    aws_mem_release(alloc, session);
+}
+
+int aws_cryptosdk_session_set_frame_size(struct aws_cryptosdk_session *session, uint32_t frame_size) {
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->frame_size          = frame_size;
+    session->adaptive_frame_size = false;
+    session->frame_block_size    = 0;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_adaptive_frame_size(struct aws_cryptosdk_session *session, bool enable) {
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->frame_size          = DEFAULT_FRAME_SIZE;
+    session->adaptive_frame_size = enable;
+    session->frame_block_size    = 0;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_block_aligned_frames(struct aws_cryptosdk_session *session, uint32_t block_size) {
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (block_size && (block_size < MIN_FRAME_BLOCK_SIZE || (block_size & (block_size - 1)))) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    // The frame size itself depends on the algorithm suite, so it is set with the header
+    session->frame_size          = DEFAULT_FRAME_SIZE;
+    session->adaptive_frame_size = false;
+    session->frame_block_size    = block_size;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_worker_threads(struct aws_cryptosdk_session *session, size_t num_threads) {
+    if (session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (num_threads == 0 || num_threads > MAX_WORKER_THREADS) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    if (num_threads == session->worker_threads) {
+        return AWS_OP_SUCCESS;
+    }
+
+    struct aws_cryptosdk_cipher_ctx *worker_ciphers      = NULL;
+    struct aws_cryptosdk_frame_executor *worker_executor = NULL;
+    if (num_threads > 1) {
+        size_t size = sizeof(*worker_ciphers) * (num_threads - 1);
+        if (!(worker_ciphers = aws_mem_acquire(session->alloc, size))) {
+            return aws_raise_error(AWS_ERROR_OOM);
+        }
+        aws_secure_zero(worker_ciphers, size);
+
+        // The calling thread takes a share of each batch, so it needs one thread fewer
+        if (!(worker_executor = aws_cryptosdk_frame_executor_new(session->alloc, num_threads - 1))) {
+            aws_mem_release(session->alloc, worker_ciphers);
+            return AWS_OP_ERR;
+        }
+    }
+
+    // No message is in progress in ST_CONFIG, so the old contexts are already cleaned up
+    if (session->worker_ciphers) {
+        aws_mem_release(session->alloc, session->worker_ciphers);
+    }
+    aws_cryptosdk_frame_executor_destroy(session->worker_executor);
+
+    session->worker_ciphers  = worker_ciphers;
+    session->worker_executor = worker_executor;
+    session->worker_threads  = num_threads;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_pipelined_signature(struct aws_cryptosdk_session *session, bool enable) {
+    if (session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->pipelined_signature = enable;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_deferred_signature(struct aws_cryptosdk_session *session, bool enable) {
+    if (session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->defer_signature = enable;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_keyring_trace(struct aws_cryptosdk_session *session, bool enable) {
+    if (session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->skip_keyring_trace = !enable;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_header_only(struct aws_cryptosdk_session *session, bool enable) {
+    if (session->mode != AWS_CRYPTOSDK_DECRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->header_only = enable;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_verify_only(struct aws_cryptosdk_session *session, bool enable) {
+    if (session->mode != AWS_CRYPTOSDK_DECRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->verify_only = enable;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_max_encrypted_data_keys(struct aws_cryptosdk_session *session, size_t max_edks) {
+    if (session->mode != AWS_CRYPTOSDK_DECRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->header.max_edks = max_edks;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_max_enc_ctx_size(struct aws_cryptosdk_session *session, size_t max_size) {
+    if (session->mode != AWS_CRYPTOSDK_DECRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->header.max_enc_ctx_len = max_size;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_max_unwrap_attempts(struct aws_cryptosdk_session *session, size_t max_attempts) {
+    if (session->mode != AWS_CRYPTOSDK_DECRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->max_unwrap_attempts = max_attempts;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_compact(struct aws_cryptosdk_session *session, bool enable) {
+    if (session->mode != AWS_CRYPTOSDK_DECRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->compact = enable;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_output_sink(
+    struct aws_cryptosdk_session *session, aws_cryptosdk_session_sink_fn *sink, void *user_data) {
+    if (session->state != ST_CONFIG || (sink && session->plaintext_sink)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->sink           = sink;
+    session->sink_user_data = sink ? user_data : NULL;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_plaintext_sink(
+    struct aws_cryptosdk_session *session, aws_cryptosdk_session_plaintext_fn *sink, void *user_data) {
+    if (session->mode != AWS_CRYPTOSDK_DECRYPT || session->state != ST_CONFIG || (sink && session->sink)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->plaintext_sink           = sink;
+    session->plaintext_sink_user_data = sink ? user_data : NULL;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_input_source(
+    struct aws_cryptosdk_session *session, aws_cryptosdk_session_source_fn *source, void *user_data) {
+    if (session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->source           = source;
+    session->source_user_data = source ? user_data : NULL;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_async_callback(
+    struct aws_cryptosdk_session *session, aws_cryptosdk_session_ready_fn *on_ready, void *user_data) {
+    if (session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->on_ready           = on_ready;
+    session->on_ready_user_data = on_ready ? user_data : NULL;
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Records the outcome of an asynchronous request; called with async_mutex held */
+static void complete_async_request(struct aws_cryptosdk_session *session, int error_code) {
+    session->async_error    = error_code;
+    session->async_complete = true;
+
+    // Still under the lock, so that a reset or destroy can't free the session out from under us
+    session->on_ready(session, session->on_ready_user_data);
+    aws_condition_variable_notify_all(&session->async_done);
+}
+
+void aws_cryptosdk_priv_enc_materials_ready(
+    struct aws_cryptosdk_enc_materials *materials, int error_code, void *user_data) {
+    struct aws_cryptosdk_session *session = user_data;
+
+    AWS_CRYPTOSDK_PROBE2(cmm_generate_end, session, error_code);
+    aws_mutex_lock(&session->async_mutex);
+    session->async_enc_materials = materials;
+    complete_async_request(session, error_code);
+    aws_mutex_unlock(&session->async_mutex);
+}
+
+void aws_cryptosdk_priv_dec_materials_ready(
+    struct aws_cryptosdk_dec_materials *materials, int error_code, void *user_data) {
+    struct aws_cryptosdk_session *session = user_data;
+
+    AWS_CRYPTOSDK_PROBE2(cmm_decrypt_end, session, error_code);
+    aws_mutex_lock(&session->async_mutex);
+    session->async_dec_materials = materials;
+    complete_async_request(session, error_code);
+    aws_mutex_unlock(&session->async_mutex);
+}
+
+int aws_cryptosdk_priv_session_poll_async(struct aws_cryptosdk_session *session, bool *ready) {
+    int error_code;
+
+    aws_mutex_lock(&session->async_mutex);
+    *ready     = session->async_complete;
+    error_code = session->async_error;
+    if (*ready) {
+        session->async_complete = false;
+        session->async_error    = AWS_ERROR_SUCCESS;
+    }
+    aws_mutex_unlock(&session->async_mutex);
+
+    if (!*ready) {
+        return AWS_OP_SUCCESS;
+    }
+
+    session->async_requested = false;
+
+    return error_code ? aws_raise_error(error_code) : AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_gcm_provider(
+    struct aws_cryptosdk_session *session, const struct aws_cryptosdk_gcm_provider_vt *provider) {
+    if (session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (provider && !aws_cryptosdk_priv_gcm_provider_is_complete(provider)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    session->gcm_provider = provider;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_borrow_header(struct aws_cryptosdk_session *session, bool borrow) {
+    if (session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    session->borrow_header = borrow;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_message_arena(struct aws_cryptosdk_session *session, bool enable) {
+    if (session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (enable && !session->arena && !(session->arena = aws_cryptosdk_arena_new(session->alloc))) {
+        return aws_raise_error(AWS_ERROR_OOM);
+    }
+
+    if (!enable && session->arena) {
+        aws_cryptosdk_arena_destroy(session->arena);
+        session->arena = NULL;
+    }
+    // Header fields are parsed on the calling thread, so they can use the arena regardless
+    session->header.field_alloc =
+        session->arena ? aws_cryptosdk_arena_allocator(session->arena) : session->header.alloc;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_frame_buffer_pool(struct aws_cryptosdk_session *session, bool enable) {
+    if (session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    struct aws_allocator *alloc  = enable ? aws_cryptosdk_frame_buffer_allocator() : session->alloc;
+    struct aws_byte_buf *bufs[3] = { &session->sink_buf, &session->source_buf, &session->codec_buf };
+
+    // Between messages the buffers hold nothing but their capacity, which the new allocator replaces
+    for (size_t i = 0; i < sizeof(bufs) / sizeof(bufs[0]); i++) {
+        if (bufs[i]->allocator == alloc) continue;
+        if (bufs[i]->buffer) aws_byte_buf_clean_up_secure(bufs[i]);
+        bufs[i]->allocator = alloc;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+struct aws_allocator *aws_cryptosdk_priv_buffer_alloc(const struct aws_cryptosdk_session *session) {
+    return session->sink_buf.allocator;
+}
+
+struct aws_allocator *aws_cryptosdk_priv_message_alloc(const struct aws_cryptosdk_session *session) {
+    if (session->arena && !session->on_ready) {
+        return aws_cryptosdk_arena_allocator(session->arena);
+    }
+
+    return session->alloc;
+}
+
+int aws_cryptosdk_session_set_frame_index(struct aws_cryptosdk_session *session, struct aws_byte_buf *index) {
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (index && !index->allocator) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    session->frame_index_out = index;
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Sets the size of the message body, which is that of the plaintext unless it is compressed */
+static int set_body_size(struct aws_cryptosdk_session *session, uint64_t message_size) {
+    if (session->precise_size_known) {
+        // TODO AWS_BAD_STATE
+        return aws_cryptosdk_priv_fail_session(session, AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (session->size_bound < message_size) {
+        return aws_cryptosdk_priv_fail_session(session, AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    session->precise_size       = message_size;
+    session->precise_size_known = true;
+
+    if (session->state == ST_ENCRYPT_BODY) {
+        aws_cryptosdk_priv_encrypt_compute_body_estimate(session);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_message_size(struct aws_cryptosdk_session *session, uint64_t message_size) {
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (!session->compression) return set_body_size(session, message_size);
+
+    // The body size follows once the compressor has seen this much plaintext
+    if (session->codec_plain_size_known) {
+        return aws_cryptosdk_priv_fail_session(session, AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+    if (session->codec_plain_in > message_size) {
+        return aws_cryptosdk_priv_fail_session(session, AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    session->codec_plain_size       = message_size;
+    session->codec_plain_size_known = true;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_compression(
+    struct aws_cryptosdk_session *session, enum aws_cryptosdk_compression compression) {
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (!aws_cryptosdk_compression_available(compression)) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
+
+    session->compression = compression;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_set_message_bound(struct aws_cryptosdk_session *session, uint64_t max_message_size) {
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (session->precise_size_known && session->precise_size > max_message_size) {
+        return aws_cryptosdk_priv_fail_session(session, AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    if (session->size_bound > max_message_size) {
+        session->size_bound = max_message_size;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+struct frame_worker {
+    struct aws_cryptosdk_session *session;
+    struct aws_cryptosdk_cipher_ctx *cipher;
+    struct aws_cryptosdk_frame_job *jobs;
+    size_t num_jobs;
+    /* Signature context to digest the frames into, or NULL */
+    struct aws_cryptosdk_sig_ctx *signctx;
+    /* This worker handles jobs first to end - 1, whose input and output are each contiguous */
+    size_t first;
+    size_t end;
+};
+
+/*
+ * Without digesting to do, the worker's frames go to the cipher a few at a time, so that a provider
+ * with seal_many and open_many can interleave them.
+ */
+static void run_frame_worker_batched(struct frame_worker *worker) {
+    struct aws_cryptosdk_body_op ops[AWS_CRYPTOSDK_GCM_MAX_OPS];
+    struct aws_cryptosdk_frame_job *batch[AWS_CRYPTOSDK_GCM_MAX_OPS];
+
+    for (size_t i = worker->first; i < worker->end;) {
+        size_t n = 0;
+
+        for (; i < worker->end && n < AWS_CRYPTOSDK_GCM_MAX_OPS; i++, n++) {
+            struct aws_cryptosdk_frame_job *job = &worker->jobs[i];
+
+            batch[n]               = job;
+            ops[n].out             = &job->output;
+            ops[n].in              = &job->input;
+            ops[n].seqno           = job->frame.sequence_number;
+            ops[n].iv              = job->frame.iv.buffer;
+            ops[n].tag             = job->frame.authtag.buffer;
+            ops[n].body_frame_type = job->frame.type;
+        }
+
+        if (worker->cipher->enc) {
+            aws_cryptosdk_encrypt_bodies_with_ctx(worker->cipher, worker->session->header.message_id, ops, n);
+        } else {
+            aws_cryptosdk_decrypt_bodies_with_ctx(worker->cipher, worker->session->header.message_id, ops, n);
+        }
+
+        for (size_t j = 0; j < n; j++) {
+            batch[j]->error = ops[j].error;
+        }
+    }
+}
+
+static void run_frame_worker(void *arg) {
+    struct frame_worker *worker = arg;
+    bool verify_only            = worker->session->verify_only;
+
+    if (!worker->signctx && !verify_only && aws_cryptosdk_gcm_provider_has_many(worker->cipher->provider)) {
+        run_frame_worker_batched(worker);
+        return;
+    }
+
+    for (size_t i = worker->first; i < worker->end; i++) {
+        struct aws_cryptosdk_frame_job *job   = &worker->jobs[i];
+        struct aws_cryptosdk_sig_ctx *signctx = worker->signctx;
+        int rv;
+
+        if (verify_only) {
+            rv = aws_cryptosdk_verify_body_and_digest(
+                worker->cipher,
+                &job->input,
+                worker->session->header.message_id,
+                job->frame.sequence_number,
+                job->frame.iv.buffer,
+                job->frame.authtag.buffer,
+                job->frame.type,
+                signctx,
+                job->serialized);
+        } else if (worker->cipher->enc) {
+            rv = aws_cryptosdk_encrypt_body_and_digest(
+                worker->cipher,
+                &job->output,
+                &job->input,
+                worker->session->header.message_id,
+                job->frame.sequence_number,
+                job->frame.iv.buffer,
+                job->frame.authtag.buffer,
+                job->frame.type,
+                signctx,
+                job->serialized);
+        } else {
+            rv = aws_cryptosdk_decrypt_body_and_digest(
+                worker->cipher,
+                &job->output,
+                &job->input,
+                worker->session->header.message_id,
+                job->frame.sequence_number,
+                job->frame.iv.buffer,
+                job->frame.authtag.buffer,
+                job->frame.type,
+                signctx,
+                job->serialized);
+        }
+
+        // Error codes are thread-local, so capture them here for the calling thread to re-raise
+        job->error = rv ? aws_last_error() : AWS_ERROR_SUCCESS;
+    }
+}
+
+/*
+ * Runs a worker's frames as an executor task. An executor thread first moves onto the NUMA node
+ * holding the worker's input, if the host has more than one, so that its frames are not read
+ * across the interconnect, and afterwards moves back to the CPUs it was allowed before, since it
+ * lives on to run other tasks. Output is written to the caller's buffers, so it lands wherever the
+ * caller placed them. A task the calling thread runs itself leaves that thread where it is.
+ */
+static void run_frame_task(void *arg, bool on_executor_thread) {
+#ifdef AWS_CRYPTOSDK_P_HAVE_LIBNUMA
+    const struct frame_worker *worker = arg;
+    void *input                       = (void *)worker->jobs[worker->first].input.ptr;
+    struct bitmask *cpus              = NULL;
+    int node                          = -1;
+
+    if (on_executor_thread && input && numa_available() >= 0 && numa_max_node() >= 1 &&
+        !get_mempolicy(&node, NULL, 0, input, MPOL_F_NODE | MPOL_F_ADDR) && node >= 0) {
+        // Without the old affinity to go back to, the thread is not moved at all
+        cpus = numa_allocate_cpumask();
+        if (numa_sched_getaffinity(0, cpus) < 0 || numa_run_on_node(node)) {
+            numa_bitmask_free(cpus);
+            cpus = NULL;
+        }
+    }
+
+    run_frame_worker(arg);
+
+    if (cpus) {
+        numa_sched_setaffinity(0, cpus);
+        numa_bitmask_free(cpus);
+    }
+#else
+    (void)on_executor_thread;
+    run_frame_worker(arg);
+#endif
+}
+
+const struct aws_cryptosdk_gcm_provider_vt *aws_cryptosdk_priv_session_gcm_provider(
+    const struct aws_cryptosdk_session *session) {
+    if (session->gcm_provider || session->verify_only) return session->gcm_provider;
+
+    // A decrypt session's frame size is the message's, known once the header has been parsed
+    uint64_t frame_size = session->mode == AWS_CRYPTOSDK_DECRYPT ? session->header.frame_len : session->frame_size;
+    return aws_cryptosdk_gcm_kernel_for_frame_size(frame_size);
+}
+
+size_t aws_cryptosdk_priv_frame_batch_limit(const struct aws_cryptosdk_session *session) {
+    if (session->worker_threads > 1 ||
+        aws_cryptosdk_gcm_provider_has_many(aws_cryptosdk_priv_session_gcm_provider(session))) {
+        return MAX_FRAME_JOBS;
+    }
+
+    return 1;
+}
+
+int aws_cryptosdk_priv_run_frame_jobs(
+    struct aws_cryptosdk_session *session,
+    struct aws_cryptosdk_frame_job *jobs,
+    size_t num_jobs,
+    struct aws_cryptosdk_sig_ctx *signctx) {
+    struct frame_worker workers[MAX_WORKER_THREADS];
+    struct aws_cryptosdk_frame_task tasks[MAX_WORKER_THREADS];
+    struct aws_cryptosdk_frame_executor *executor =
+        session->frame_executor ? session->frame_executor : session->worker_executor;
+    size_t num_workers = session->worker_threads < num_jobs ? session->worker_threads : num_jobs;
+
+    // Frames must be digested in order
+    if (signctx && num_workers > 1) num_workers = 1;
+
+    if (num_workers == 0) {
+        return AWS_OP_SUCCESS;
+    }
+
+    for (size_t i = 0; i < num_workers; i++) {
+        workers[i].session  = session;
+        workers[i].cipher   = i ? &session->worker_ciphers[i - 1] : &session->body_cipher;
+        workers[i].jobs     = jobs;
+        workers[i].num_jobs = num_jobs;
+        workers[i].signctx  = signctx;
+        workers[i].first    = i * num_jobs / num_workers;
+        workers[i].end      = (i + 1) * num_jobs / num_workers;
+    }
+
+    // Worker 0 is the calling thread; the executor runs the rest
+    for (size_t i = 1; i < num_workers; i++) {
+        struct frame_worker *worker = &workers[i];
+
+        // Worker contexts are keyed on first use for each message
+        if (!worker->cipher->key_ctx) {
+            if (aws_cryptosdk_cipher_ctx_init(
+                    worker->cipher,
+                    aws_cryptosdk_priv_session_gcm_provider(session),
+                    session->alg_props,
+                    session->content_key,
+                    session->body_cipher.enc) ||
+                (session->verify_only &&
+                 aws_cryptosdk_cipher_ctx_enable_verify_only(worker->cipher, session->content_key))) {
+                aws_cryptosdk_cipher_ctx_clean_up(worker->cipher);
+                return AWS_OP_ERR;
+            }
+        }
+    }
+
+    if (num_workers == 1) {
+        run_frame_worker(&workers[0]);
+    } else {
+        for (size_t i = 0; i < num_workers; i++) {
+            tasks[i].fn  = run_frame_task;
+            tasks[i].arg = &workers[i];
+        }
+        aws_cryptosdk_priv_frame_executor_run(executor, tasks, num_workers);
+    }
+
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (jobs[i].error) {
+            return aws_raise_error(jobs[i].error);
+        }
+    }
+
+    // Destinations may overlap earlier frames' ciphertext, so this must happen in frame order
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (jobs[i].in_place_dest) {
+            memmove(jobs[i].in_place_dest, jobs[i].output.buffer, jobs[i].output.len);
+        }
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Returns the counter accumulating time spent in state, or NULL if that time isn't counted */
+static uint64_t *state_time_counter(struct aws_cryptosdk_session *session, enum session_state state) {
+    switch (state) {
+        case ST_GEN_KEY:
+        case ST_UNWRAP_KEY: return &session->stats.cmm_ns;
+        case ST_WRITE_HEADER:
+        case ST_READ_HEADER: return &session->stats.header_ns;
+        case ST_ENCRYPT_BODY:
+        case ST_DECRYPT_BODY: return &session->stats.gcm_ns;
+        case ST_WRITE_TRAILER:
+        case ST_CHECK_TRAILER: return &session->stats.signature_ns;
+        default: return NULL;
+    }
+}
+
+static void start_state_time(struct aws_cryptosdk_session *session) {
+    session->state_since = stats_now();
+}
+
+/* Charges the time from state_since until now to the current state */
+static void charge_state_time(struct aws_cryptosdk_session *session, uint64_t now) {
+    uint64_t *counter = state_time_counter(session, session->state);
+
+    if (counter && session->state_since && now > session->state_since) {
+        *counter += now - session->state_since;
+    }
+}
+
+static void stop_state_time(struct aws_cryptosdk_session *session) {
+    charge_state_time(session, stats_now());
+    session->state_since = 0;
+}
+
+static bool buffers_overlap(const uint8_t *outp, size_t outlen, const uint8_t *inp, size_t inlen) {
+    uintptr_t out_start = (uintptr_t)outp, in_start = (uintptr_t)inp;
+
+    return outlen && inlen && out_start < in_start + inlen && in_start < out_start + outlen;
+}
+
+static int process_buffer(
+    struct aws_cryptosdk_session *session,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen,
+    size_t *in_bytes_read) {
+    struct aws_byte_buf output   = { .buffer = outp, .capacity = outlen, .len = 0 };
+    struct aws_byte_cursor input = { .ptr = (uint8_t *)inp, .len = inlen };
+    int result;
+
+    enum session_state prior_state;
+    const uint8_t *old_inp;
+    bool made_progress;
+
+    *out_bytes_written = 0;
+    *in_bytes_read     = 0;
+
+    session->in_place = buffers_overlap(outp, outlen, inp, inlen);
+
+    if (session->in_place && (uintptr_t)outp > (uintptr_t)inp) {
+        // Output would run ahead of the input it has yet to consume
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    enum session_state entry_state = session->state;
+    session->output_capacity       = outlen;
+    start_state_time(session);
+
+    do {
+        prior_state = session->state;
+        old_inp     = input.ptr;
+
+        struct aws_byte_buf remaining_space =
+            aws_byte_buf_from_empty_array(output.buffer + output.len, output.capacity - output.len);
+
+        if (session->in_place && input.len &&
+            (session->state == ST_WRITE_HEADER || session->state == ST_WRITE_TRAILER)) {
+            // These states consume no input, so they may only write into the headroom
+            // ahead of it. Body states check for themselves frame by frame.
+            size_t headroom = (size_t)(input.ptr - remaining_space.buffer);
+            if (remaining_space.capacity > headroom) {
+                remaining_space.capacity = headroom;
+            }
+        }
+
+        switch (session->state) {
+            case ST_CONFIG:
+                if (!session->cmm) {
+                    // TODO - is this the right error?
+                    result = aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+                    break;
+                }
+
+                if (session->mode == AWS_CRYPTOSDK_ENCRYPT) {
+                    aws_cryptosdk_priv_session_change_state(session, ST_GEN_KEY);
+                } else {
+                    aws_cryptosdk_priv_session_change_state(session, ST_READ_HEADER);
+                }
+                result = AWS_OP_SUCCESS;
+                break;
+
+            case ST_READ_HEADER: result = aws_cryptosdk_priv_try_parse_header(session, &input); break;
+            case ST_UNWRAP_KEY: result = aws_cryptosdk_priv_unwrap_keys(session); break;
+            case ST_DECRYPT_BODY:
+                result = aws_cryptosdk_priv_try_decrypt_body(session, &remaining_space, &input);
+                break;
+            case ST_CHECK_TRAILER: result = aws_cryptosdk_priv_check_trailer(session, &input); break;
+
+            case ST_GEN_KEY: result = aws_cryptosdk_priv_try_gen_key(session); break;
+            case ST_WRITE_HEADER: result = aws_cryptosdk_priv_try_write_header(session, &remaining_space); break;
+            case ST_ENCRYPT_BODY:
+                result = aws_cryptosdk_priv_try_encrypt_body(session, &remaining_space, &input);
+                break;
+            case ST_WRITE_TRAILER: result = aws_cryptosdk_priv_write_trailer(session, &remaining_space); break;
+
+            case ST_DONE: result = AWS_OP_SUCCESS; break;
+            default: result = aws_raise_error(AWS_ERROR_UNKNOWN); break;
+            case ST_ERROR: result = aws_raise_error(session->error); break;
+        }
+
+        made_progress = (remaining_space.len) || (input.ptr != old_inp) || (prior_state != session->state);
+
+        output.len += remaining_space.len;
+    } while (result == AWS_OP_SUCCESS && made_progress);
+
+    *out_bytes_written       = output.len;
+    *in_bytes_read           = input.ptr - inp;
+    session->in_place        = false;
+    session->output_capacity = 0;
+
+    stop_state_time(session);
+    session->stats.bytes_in += *in_bytes_read;
+    if (result == AWS_OP_SUCCESS) {
+        session->stats.bytes_out += *out_bytes_written;
+
+        if (!output.len && input.ptr == inp && session->state == entry_state && session->state != ST_DONE &&
+            !session->async_requested) {
+            session->stats.stalled_calls++;
+        }
+    }
+
+    if (result != AWS_OP_SUCCESS) {
+        // Destroy any incomplete (and possibly corrupt) plaintext
+        aws_byte_buf_secure_zero(&output);
+        *out_bytes_written = 0;
+
+        if (session->state != ST_ERROR) {
+            session->error = aws_last_error();
+            aws_cryptosdk_priv_session_change_state(session, ST_ERROR);
+        }
+    }
+
+    if (session->state == ST_ERROR) {
+        // (Re-)raise any stored error
+        result = aws_raise_error(session->error);
+    }
+
+    return result;
+}
+
+/* Compressed plaintext is passed between the codec and the body in pieces of at least this size */
+#define CODEC_BUF_SIZE (64 * 1024)
+
+/*
+ * Finds the message's compression in its encryption context, without deserializing a deferred
+ * context: that one is known to be canonical, so its pairs can be walked in place.
+ */
+static bool find_compression_name(const struct aws_cryptosdk_session *session, struct aws_byte_cursor *name) {
+    const struct aws_string *key = aws_cryptosdk_priv_compression_key();
+
+    if (!session->header.enc_ctx_deferred) {
+        struct aws_hash_element *elem = NULL;
+        aws_hash_table_find(&session->header.enc_ctx, key, &elem);
+        if (!elem) return false;
+        *name = aws_byte_cursor_from_string(elem->value);
+        return true;
+    }
+
+    struct aws_byte_cursor aad = aws_byte_cursor_from_array(
+        session->header_bytes + session->header.parsed_enc_ctx_offset, session->header.parsed_enc_ctx_len);
+    uint16_t count = 0, len;
+    aws_byte_cursor_read_be16(&aad, &count);
+    while (count--) {
+        struct aws_byte_cursor k, v;
+        if (!aws_byte_cursor_read_be16(&aad, &len) || !(k = aws_byte_cursor_advance(&aad, len)).ptr) break;
+        if (!aws_byte_cursor_read_be16(&aad, &len) || !(v = aws_byte_cursor_advance(&aad, len)).ptr) break;
+        if (aws_string_eq_byte_cursor(key, &k)) {
+            *name = v;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool aws_cryptosdk_priv_is_compressed(const struct aws_cryptosdk_session *session) {
+    struct aws_byte_cursor name;
+    return find_compression_name(session, &name);
+}
+
+/* Records the compression in the encryption context before the materials are requested */
+static int add_compression_to_enc_ctx(struct aws_cryptosdk_session *session) {
+    struct aws_hash_element *elem = NULL;
+
+    aws_hash_table_find(&session->header.enc_ctx, aws_cryptosdk_priv_compression_key(), &elem);
+    if (elem) return aws_raise_error(AWS_CRYPTOSDK_ERR_RESERVED_NAME);
+
+    // Both strings are static, which the context's destructors leave alone
+    return aws_hash_table_put(
+        &session->header.enc_ctx,
+        aws_cryptosdk_priv_compression_key(),
+        (void *)aws_cryptosdk_priv_compression_name(session->compression),
+        NULL);
+}
+
+/*
+ * Compresses the caller's plaintext into codec_buf and encrypts from there. The compressed
+ * size becomes the message size once the compressor has written the end of its stream.
+ */
+static int compress_and_encrypt(
+    struct aws_cryptosdk_session *session,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen,
+    size_t *in_bytes_read) {
+    /* An empty input must still point somewhere, or the session sees no plaintext at all */
+    static const uint8_t empty_input = 0;
+    struct aws_byte_buf *buf     = &session->codec_buf;
+    struct aws_byte_cursor input = { .ptr = (uint8_t *)inp, .len = inlen };
+    size_t total_out             = 0;
+    int error;
+
+    if (session->state == ST_CONFIG) {
+        if (!session->frame_size && !session->adaptive_frame_size) {
+            return aws_cryptosdk_priv_fail_session(session, AWS_CRYPTOSDK_ERR_BAD_STATE);
+        }
+        if (add_compression_to_enc_ctx(session)) goto fail;
+        if (!(session->codec = aws_cryptosdk_priv_codec_new(session->alloc, session->compression, true))) goto fail;
+    }
+
+    for (;;) {
+        bool progress = false;
+
+        if (session->codec && !session->codec_done) {
+            size_t target = aws_max_size(session->input_size_estimate, CODEC_BUF_SIZE);
+            if (buf->capacity < target && aws_byte_buf_reserve(buf, target)) goto fail;
+
+            // Take no plaintext beyond the end of the message
+            struct aws_byte_cursor piece = input;
+            uint64_t left                = session->codec_plain_size - session->codec_plain_in;
+            if (session->codec_plain_size_known && piece.len > left) piece.len = (size_t)left;
+            bool finish = session->codec_plain_size_known && piece.len == left;
+
+            size_t old_len = buf->len, old_in = piece.len;
+            if (aws_cryptosdk_priv_codec_run(session->codec, &piece, buf, finish, &session->codec_done)) goto fail;
+            aws_byte_cursor_advance(&input, old_in - piece.len);
+            session->codec_plain_in += old_in - piece.len;
+            session->codec_out += buf->len - old_len;
+            progress = old_in != piece.len || buf->len != old_len;
+
+            if (session->codec_done && set_body_size(session, session->codec_out)) return AWS_OP_ERR;
+        }
+
+        size_t written, read;
+        const uint8_t *compressed = buf->buffer ? buf->buffer : &empty_input;
+        if (process_buffer(session, outp + total_out, outlen - total_out, &written, compressed, buf->len, &read)) {
+            return AWS_OP_ERR;
+        }
+        if (read) {
+            memmove(buf->buffer, buf->buffer + read, buf->len - read);
+            buf->len -= read;
+        }
+        total_out += written;
+
+        if (!progress && !written && !read) break;
+    }
+
+    *out_bytes_written = total_out;
+    *in_bytes_read     = input.ptr - inp;
+
+    return AWS_OP_SUCCESS;
+
+fail:
+    error = aws_last_error();
+    return aws_cryptosdk_priv_fail_session(session, error ? error : AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+}
+
+/*
+ * Decrypts into codec_buf and decompresses from there into the caller's buffer, once the
+ * encryption context shows that the message is compressed. Until then, the session is run
+ * without output space, so that no plaintext is written before we know what it is.
+ */
+static int decrypt_and_decompress(
+    struct aws_cryptosdk_session *session,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen,
+    size_t *in_bytes_read) {
+    struct aws_byte_buf *buf    = &session->codec_buf;
+    struct aws_byte_buf output  = aws_byte_buf_from_empty_array(outp, outlen);
+    size_t total_in             = 0;
+    size_t written, read;
+    int error;
+
+    *out_bytes_written = 0;
+    *in_bytes_read     = 0;
+
+    if (!session->codec_checked) {
+        if (process_buffer(session, outp, 0, &written, inp, inlen, &read)) return AWS_OP_ERR;
+        total_in += read;
+
+        if (session->state != ST_DECRYPT_BODY && session->state != ST_CHECK_TRAILER && session->state != ST_DONE) {
+            *in_bytes_read = total_in;
+            return AWS_OP_SUCCESS;
+        }
+
+        struct aws_byte_cursor name;
+        if (find_compression_name(session, &name)) {
+            struct aws_string *name_str = aws_string_new_from_array(session->alloc, name.ptr, name.len);
+            enum aws_cryptosdk_compression compression;
+            if (!name_str) goto fail;
+            int rv = aws_cryptosdk_priv_compression_from_name(name_str, &compression);
+            aws_string_destroy(name_str);
+            if (rv || !(session->codec = aws_cryptosdk_priv_codec_new(session->alloc, compression, false))) goto fail;
+        }
+        session->codec_checked = true;
+
+        // Leave the rest of the input untouched; process_plain rejects the next call
+        if (session->codec && buffers_overlap(outp, outlen, inp, inlen)) {
+            *in_bytes_read = total_in;
+            return AWS_OP_SUCCESS;
+        }
+    }
+
+    if (!session->codec) {
+        if (process_buffer(session, outp, outlen, &written, inp + total_in, inlen - total_in, &read)) {
+            return AWS_OP_ERR;
+        }
+        *out_bytes_written = written;
+        *in_bytes_read     = total_in + read;
+        return AWS_OP_SUCCESS;
+    }
+
+    for (;;) {
+        // Decompress what has been decrypted, or flush what the decompressor holds
+        struct aws_byte_cursor compressed = aws_byte_cursor_from_buf(buf);
+        size_t old_out = output.len, old_len = buf->len;
+        if (!session->codec_done) {
+            if (aws_cryptosdk_priv_codec_run(session->codec, &compressed, &output, false, &session->codec_done)) {
+                goto fail;
+            }
+            if (compressed.len) memmove(buf->buffer, compressed.ptr, compressed.len);
+            buf->len = compressed.len;
+        }
+        bool progress = output.len != old_out || buf->len != old_len;
+
+        // Nothing may follow the compressed stream, nor may it stop short of its end
+        if (session->codec_done && buf->len) goto bad_ciphertext;
+        if (session->state == ST_DONE && !session->codec_done && !progress && !buf->len && output.len < outlen) {
+            goto bad_ciphertext;
+        }
+
+        // Decrypt more once the decompressor has caught up
+        written = read = 0;
+        if (buf->len < CODEC_BUF_SIZE && session->state != ST_DONE) {
+            size_t frame = aws_max_size(session->output_size_estimate, CODEC_BUF_SIZE);
+            if (buf->capacity - buf->len < frame && aws_byte_buf_reserve(buf, buf->len + frame)) goto fail;
+            if (process_buffer(
+                    session,
+                    buf->buffer + buf->len,
+                    buf->capacity - buf->len,
+                    &written,
+                    inp + total_in,
+                    inlen - total_in,
+                    &read)) {
+                return AWS_OP_ERR;
+            }
+            buf->len += written;
+            total_in += read;
+        }
+
+        if (!progress && !written && !read) break;
+    }
+
+    *out_bytes_written = output.len;
+    *in_bytes_read     = total_in;
+
+    return AWS_OP_SUCCESS;
+
+bad_ciphertext:
+    aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+fail:
+    error = aws_last_error();
+    return aws_cryptosdk_priv_fail_session(session, error ? error : AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+}
+
+/* Processes plaintext on the caller's side of the codec, if the message is compressed */
+static int process_plain(
+    struct aws_cryptosdk_session *session,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen,
+    size_t *in_bytes_read) {
+    int rv;
+
+    /*
+     * Compressed data does not keep pace with the data it came from, so output written in place
+     * would overrun input not yet consumed: decompressed plaintext outgrows its ciphertext, and the
+     * ciphertext of plaintext which does not compress outgrows its plaintext. Overlapping buffers
+     * are refused before anything is done, leaving the session usable with separate ones.
+     */
+    bool compressed = (session->mode == AWS_CRYPTOSDK_ENCRYPT && session->compression) ||
+                      (session->mode == AWS_CRYPTOSDK_DECRYPT && session->codec);
+    if (compressed && buffers_overlap(outp, outlen, inp, inlen)) {
+        *out_bytes_written = 0;
+        *in_bytes_read     = 0;
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    if (session->mode == AWS_CRYPTOSDK_ENCRYPT && session->compression) {
+        rv = compress_and_encrypt(session, outp, outlen, out_bytes_written, inp, inlen, in_bytes_read);
+    } else if (
+        session->mode == AWS_CRYPTOSDK_DECRYPT && !session->header_only && !session->verify_only &&
+        (session->codec || !session->codec_checked)) {
+        rv = decrypt_and_decompress(session, outp, outlen, out_bytes_written, inp, inlen, in_bytes_read);
+    } else {
+        return process_buffer(session, outp, outlen, out_bytes_written, inp, inlen, in_bytes_read);
+    }
+
+    if (rv) {
+        // As with process_buffer, the whole output buffer is zeroed on failure
+        if (outlen) aws_secure_zero(outp, outlen);
+        *out_bytes_written = 0;
+    }
+
+    return rv;
+}
+
+/* True if the session's output goes to a sink of either kind instead of the caller's buffer */
+static bool has_sink(const struct aws_cryptosdk_session *session) {
+    return session->sink || (session->plaintext_sink && session->mode == AWS_CRYPTOSDK_DECRYPT);
+}
+
+/*
+ * Runs the session into its own output buffer, passing everything written to the sink. The
+ * buffer grows to what the session asks for, and in the body to a full batch of frames, so
+ * that batching and worker threads work as they do with a caller's buffer. A plaintext sink
+ * takes uncompressed frames straight from the body (see aws_cryptosdk_priv_try_decrypt_body),
+ * so only decompressed plaintext is written here for it.
+ */
+static int process_to_sink(
+    struct aws_cryptosdk_session *session,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen,
+    size_t *in_bytes_read) {
+    struct aws_byte_buf *buf = &session->sink_buf;
+    uint64_t sunk_before     = session->plaintext_sunk;
+    size_t total_out = 0, total_in = 0;
+
+    *out_bytes_written = 0;
+    *in_bytes_read     = 0;
+
+    for (;;) {
+        const uint8_t *next = inp ? inp + total_in : NULL;
+        size_t written, read;
+
+        if (process_plain(session, buf->buffer, buf->capacity, &written, next, inlen - total_in, &read)) {
+            return AWS_OP_ERR;
+        }
+        total_in += read;
+
+        if (written) {
+            struct aws_byte_cursor segment = aws_byte_cursor_from_array(buf->buffer, written);
+            int rv = session->sink ? session->sink(session, &segment, 1, session->sink_user_data)
+                                   : session->plaintext_sink(session, segment, 0, session->plaintext_sink_user_data);
+
+            // Plaintext does not linger in the session once it has been handed over
+            if (session->mode == AWS_CRYPTOSDK_DECRYPT) aws_secure_zero(buf->buffer, written);
+            if (rv) return aws_cryptosdk_priv_fail_session(session, aws_last_error());
+            total_out += written;
+        }
+
+        if (written || read) continue;
+
+        size_t out_needed, in_needed;
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+        if (out_needed <= buf->capacity) break;
+
+        if (session->state == ST_ENCRYPT_BODY || session->state == ST_DECRYPT_BODY) {
+            size_t batch = aws_cryptosdk_priv_frame_batch_limit(session);
+            if (out_needed <= SIZE_MAX / batch) out_needed *= batch;
+        }
+        if (aws_byte_buf_reserve(buf, out_needed)) return aws_cryptosdk_priv_fail_session(session, aws_last_error());
+    }
+
+    *out_bytes_written = total_out + (size_t)(session->plaintext_sunk - sunk_before);
+    *in_bytes_read     = total_in;
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Processes the given input, writing the output to the sink if there is one */
+static int process_input(
+    struct aws_cryptosdk_session *session,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen,
+    size_t *in_bytes_read) {
+    if (has_sink(session)) {
+        return process_to_sink(session, out_bytes_written, inp, inlen, in_bytes_read);
+    }
+
+    return process_plain(session, outp, outlen, out_bytes_written, inp, inlen, in_bytes_read);
+}
+
+/*
+ * Runs the session over input pulled from the source into the session's own buffer. Only as
+ * much is asked for as the session's estimate of the next step, so nothing beyond the end of
+ * the message is read. Input already pulled is kept until it is consumed.
+ */
+static int process_from_source(
+    struct aws_cryptosdk_session *session, uint8_t *outp, size_t outlen, size_t *out_bytes_written) {
+    /* An empty input must still point somewhere, or the session sees no plaintext at all */
+    static const uint8_t empty_input = 0;
+    struct aws_byte_buf *buf         = &session->source_buf;
+    size_t total_out                 = 0;
+
+    *out_bytes_written = 0;
+
+    for (;;) {
+        const uint8_t *inp = buf->buffer ? buf->buffer : &empty_input;
+        uint8_t *next      = outp ? outp + total_out : NULL;
+        size_t written, read;
+
+        if (process_input(session, next, outlen - total_out, &written, inp, buf->len, &read)) {
+            return AWS_OP_ERR;
+        }
+        total_out += written;
+
+        if (read) {
+            memmove(buf->buffer, buf->buffer + read, buf->len - read);
+            buf->len -= read;
+        }
+        if (written || read) continue;
+
+        // Stop when done, or when it is output space rather than input that is missing
+        size_t out_needed, in_needed;
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+        if (session->mode == AWS_CRYPTOSDK_DECRYPT) {
+            in_needed = aws_cryptosdk_priv_decrypt_input_needed(session, buf->len);
+        }
+        if (aws_cryptosdk_session_is_done(session) || in_needed <= buf->len) break;
+
+        if (aws_byte_buf_reserve(buf, in_needed)) return aws_cryptosdk_priv_fail_session(session, aws_last_error());
+
+        size_t pulled = 0;
+        uint8_t *dest = buf->buffer + buf->len;
+        if (session->source(session, dest, in_needed - buf->len, &pulled, session->source_user_data)) {
+            return aws_cryptosdk_priv_fail_session(session, aws_last_error());
+        }
+        if (!pulled) break;
+        buf->len += pulled;
+    }
+
+    *out_bytes_written = total_out;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_process(
+    struct aws_cryptosdk_session *session,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen,
+    size_t *in_bytes_read) {
+    *out_bytes_written = 0;
+    *in_bytes_read     = 0;
+
+    if ((has_sink(session) && outlen) || (session->source && inlen)) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    if (session->source) return process_from_source(session, outp, outlen, out_bytes_written);
+
+    return process_input(session, outp, outlen, out_bytes_written, inp, inlen, in_bytes_read);
+}
+
+/* Position within an array of scatter/gather segments */
+struct segment_pos {
+    size_t idx;
+    size_t off;
+};
+
+static void out_pos_normalize(const struct aws_byte_buf *outv, size_t outcnt, struct segment_pos *pos) {
+    while (pos->idx < outcnt && pos->off >= outv[pos->idx].capacity) {
+        if (++pos->idx < outcnt) {
+            pos->off = outv[pos->idx].len;
+        }
+    }
+}
+
+static void in_pos_normalize(const struct aws_byte_cursor *inv, size_t incnt, struct segment_pos *pos) {
+    while (pos->idx < incnt && pos->off >= inv[pos->idx].len) {
+        pos->idx++;
+        pos->off = 0;
+    }
+}
+
+/* Returns true if at least 'needed' bytes of output space remain from pos onward */
+static bool out_has_space(const struct aws_byte_buf *outv, size_t outcnt, struct segment_pos pos, size_t needed) {
+    size_t avail = 0;
+
+    for (size_t i = pos.idx; i < outcnt && avail < needed; i++) {
+        avail += outv[i].capacity - (i == pos.idx ? pos.off : outv[i].len);
+    }
+
+    return avail >= needed;
+}
+
+/* Returns true if at least 'needed' bytes of input remain from pos onward */
+static bool in_has_data(const struct aws_byte_cursor *inv, size_t incnt, struct segment_pos pos, size_t needed) {
+    size_t avail = 0;
+
+    for (size_t i = pos.idx; i < incnt && avail < needed; i++) {
+        avail += inv[i].len - (i == pos.idx ? pos.off : 0);
+    }
+
+    return avail >= needed;
+}
+
+/* Copies len bytes of input starting at pos into dest, without consuming them */
+static void in_gather(
+    uint8_t *dest, const struct aws_byte_cursor *inv, size_t incnt, struct segment_pos pos, size_t len) {
+    while (len) {
+        in_pos_normalize(inv, incnt, &pos);
+
+        size_t n = inv[pos.idx].len - pos.off;
+        if (n > len) n = len;
+
+        memcpy(dest, inv[pos.idx].ptr + pos.off, n);
+        dest += n;
+        len -= n;
+        pos.off += n;
+    }
+}
+
+static void in_advance(const struct aws_byte_cursor *inv, size_t incnt, struct segment_pos *pos, size_t len) {
+    while (len) {
+        in_pos_normalize(inv, incnt, pos);
+
+        size_t n = inv[pos->idx].len - pos->off;
+        if (n > len) n = len;
+
+        len -= n;
+        pos->off += n;
+    }
+}
+
+/* Copies len bytes from src into the output segments starting at pos, advancing pos */
+static void out_scatter(
+    struct aws_byte_buf *outv, size_t outcnt, struct segment_pos *pos, const uint8_t *src, size_t len) {
+    while (len) {
+        out_pos_normalize(outv, outcnt, pos);
+
+        size_t n = outv[pos->idx].capacity - pos->off;
+        if (n > len) n = len;
+
+        memcpy(outv[pos->idx].buffer + pos->off, src, n);
+        src += n;
+        len -= n;
+        pos->off += n;
+    }
+}
+
+int aws_cryptosdk_session_processv(
+    struct aws_cryptosdk_session *session,
+    struct aws_byte_buf *outv,
+    size_t outcnt,
+    size_t *out_bytes_written,
+    const struct aws_byte_cursor *inv,
+    size_t incnt,
+    size_t *in_bytes_read) {
+    // Stand-in for exhausted segment lists; the session treats NULL cursors as having no data
+    static uint8_t empty[1];
+
+    struct segment_pos out = { 0, outcnt ? outv[0].len : 0 };
+    struct segment_pos in  = { 0, 0 };
+    size_t total_out = 0, total_in = 0;
+    uint8_t *staging    = NULL;
+    size_t staging_size = 0;
+    int result          = AWS_OP_SUCCESS;
+
+    *out_bytes_written = 0;
+    *in_bytes_read     = 0;
+
+    while (!aws_cryptosdk_session_is_done(session)) {
+        out_pos_normalize(outv, outcnt, &out);
+        in_pos_normalize(inv, incnt, &in);
+
+        uint8_t *outp      = out.idx < outcnt ? outv[out.idx].buffer + out.off : empty;
+        size_t outlen      = out.idx < outcnt ? outv[out.idx].capacity - out.off : 0;
+        const uint8_t *inp = in.idx < incnt ? inv[in.idx].ptr + in.off : empty;
+        size_t inlen       = in.idx < incnt ? inv[in.idx].len - in.off : 0;
+        size_t written, read;
+
+        if ((result = aws_cryptosdk_session_process(session, outp, outlen, &written, inp, inlen, &read))) {
+            goto out;
+        }
+
+        if (written || read) {
+            out.off += written;
+            in.off += read;
+            total_out += written;
+            total_in += read;
+            continue;
+        }
+
+        // No progress. If that is because the next step straddles a segment boundary, stage it.
+        size_t out_needed, in_needed;
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+
+        bool stage_out = outlen < out_needed && out_has_space(outv, outcnt, out, out_needed);
+        bool stage_in  = inlen < in_needed && in_has_data(inv, incnt, in, in_needed);
+
+        if (!stage_out && !stage_in) {
+            break;
+        }
+
+        size_t needed = (stage_out ? out_needed : 0) + (stage_in ? in_needed : 0);
+        if (needed > staging_size) {
+            if (staging) {
+                aws_secure_zero(staging, staging_size);
+                aws_mem_release(session->alloc, staging);
+            }
+            staging_size = 0;
+            if (!(staging = aws_mem_acquire(session->alloc, needed))) {
+                result = aws_raise_error(AWS_ERROR_OOM);
+                goto out;
+            }
+            staging_size = needed;
+        }
+
+        if (stage_out) {
+            outp   = staging;
+            outlen = out_needed;
+        }
+        if (stage_in) {
+            uint8_t *stage_inp = staging + (stage_out ? out_needed : 0);
+            in_gather(stage_inp, inv, incnt, in, in_needed);
+            inp   = stage_inp;
+            inlen = in_needed;
+        }
+
+        session->input_staged = stage_in;
+        result                = aws_cryptosdk_session_process(session, outp, outlen, &written, inp, inlen, &read);
+        session->input_staged = false;
+        if (result) {
+            goto out;
+        }
+
+        if (stage_out) {
+            out_scatter(outv, outcnt, &out, staging, written);
+        } else {
+            out.off += written;
+        }
+        in_advance(inv, incnt, &in, read);
+        total_out += written;
+        total_in += read;
+
+        if (!written && !read) {
+            // Some steps (e.g. header parsing) only learn how much data they need incrementally;
+            // try again if the estimates grew, but stop once they are stable.
+            size_t new_out_needed, new_in_needed;
+            aws_cryptosdk_session_estimate_buf(session, &new_out_needed, &new_in_needed);
+
+            if (new_out_needed == out_needed && new_in_needed == in_needed) {
+                break;
+            }
+        }
+    }
+
+out:
+    if (staging) {
+        aws_secure_zero(staging, staging_size);
+        aws_mem_release(session->alloc, staging);
+    }
+
+    if (result != AWS_OP_SUCCESS) {
+        // Destroy any incomplete (and possibly corrupt) plaintext written by this call
+        for (size_t i = 0; i < outcnt && i <= out.idx; i++) {
+            size_t end = i == out.idx ? out.off : outv[i].capacity;
+            aws_secure_zero(outv[i].buffer + outv[i].len, end - outv[i].len);
+        }
+
+        return AWS_OP_ERR;
+    }
+
+    for (size_t i = 0; i < outcnt && i <= out.idx; i++) {
+        outv[i].len = i == out.idx ? out.off : outv[i].capacity;
+    }
+
+    *out_bytes_written = total_out;
+    *in_bytes_read     = total_in;
+
+    return AWS_OP_SUCCESS;
+}
+
+bool aws_cryptosdk_session_is_done(const struct aws_cryptosdk_session *session) {
+    // A decompressor may still hold plaintext once the body has been decrypted
+    return session->state == ST_DONE && (!session->codec || session->codec_done);
+}
+
+bool aws_cryptosdk_session_is_pending(const struct aws_cryptosdk_session *session) {
+    return session->async_requested;
+}
+
+int aws_cryptosdk_session_get_alg_id(const struct aws_cryptosdk_session *session, enum aws_cryptosdk_alg_id *alg_id) {
+    if (!session->alg_props) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    *alg_id = session->alg_props->alg_id;
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_get_total_output_size(struct aws_cryptosdk_session *session, uint64_t *size) {
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT || !session->precise_size_known) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (session->state == ST_ERROR) {
+        return aws_raise_error(session->error);
+    }
+
+    if (session->state == ST_CONFIG || session->state == ST_GEN_KEY) {
+        // The header size depends on the materials, so generate them now rather than on the first process call
+        if (!session->cmm) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+        }
+
+        start_state_time(session);
+        aws_cryptosdk_priv_session_change_state(session, ST_GEN_KEY);
+        int rv = aws_cryptosdk_priv_try_gen_key(session);
+        stop_state_time(session);
+
+        if (rv) {
+            session->error = aws_last_error();
+            aws_cryptosdk_priv_session_change_state(session, ST_ERROR);
+            return AWS_OP_ERR;
+        }
+    }
+
+    return aws_cryptosdk_priv_encrypt_output_size(session, size);
+}
+
+/* Checks that frames of the message being decrypted can be located and decrypted individually */
+/* Returns true once the header, and with it the frame size, has been parsed or generated */
+static bool header_done(const struct aws_cryptosdk_session *session) {
+    switch (session->state) {
+        case ST_DECRYPT_BODY:
+        case ST_CHECK_TRAILER:
+        case ST_WRITE_HEADER:
+        case ST_ENCRYPT_BODY:
+        case ST_WRITE_TRAILER:
+        case ST_DONE: return true;
+        default: return false;
+    }
+}
+
+static int check_random_access(const struct aws_cryptosdk_session *session, uint64_t seqno) {
+    if (session->state == ST_ERROR) {
+        return aws_raise_error(session->error);
+    }
+
+    if (session->mode != AWS_CRYPTOSDK_DECRYPT ||
+        (session->state != ST_DECRYPT_BODY && session->state != ST_CHECK_TRAILER && session->state != ST_DONE)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    // A compressed body can only be decompressed from its start
+    if (aws_cryptosdk_priv_is_compressed(session)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
+
+    /*
+     * Unframed bodies are a single frame, and signatures cover the entire message; a trusted
+     * frame index stands in for the signature by pinning each frame's tag
+     */
+    if (!session->frame_size || (session->alg_props->signature_len && !session->frame_index.ptr)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (seqno == 0 || seqno > MAX_FRAMES) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_session_use_frame_index(struct aws_cryptosdk_session *session, const uint8_t *index, size_t len) {
+    if (session->state == ST_ERROR) {
+        return aws_raise_error(session->error);
+    }
+
+    if (session->mode != AWS_CRYPTOSDK_DECRYPT ||
+        (session->state != ST_DECRYPT_BODY && session->state != ST_CHECK_TRAILER && session->state != ST_DONE)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_array(index, len);
+    if (aws_cryptosdk_priv_frame_index_check(cursor, &session->header, session->header_size)) {
+        return AWS_OP_ERR;
     }
 
-    session->cmm = cmm;
-    // CMM reference count is now 1 and the session owns the reference, which will be released
-    // when session is destroyed.
+    session->frame_index = cursor;
 
-    return session;
+    return AWS_OP_SUCCESS;
 }
 
-void aws_cryptosdk_session_destroy(struct aws_cryptosdk_session *session) {
-    struct aws_allocator *alloc = session->alloc;
+int aws_cryptosdk_session_get_frame_range(
+    const struct aws_cryptosdk_session *session, uint64_t seqno, uint64_t *offset, size_t *max_len) {
+    if (check_random_access(session, seqno)) {
+        return AWS_OP_ERR;
+    }
 
-    aws_cryptosdk_session_reset(
-        session, AWS_CRYPTOSDK_DECRYPT);  // frees dynamically allocated stuff (except for the header itself)
+    if (session->frame_index.ptr) {
+        return aws_cryptosdk_priv_frame_index_get_record(session->frame_index, seqno, offset, max_len, NULL);
+    }
 
-    aws_cryptosdk_hdr_clean_up(&session->header);
-    aws_cryptosdk_keyring_trace_clean_up(&session->keyring_trace);
-    aws_cryptosdk_cmm_release(session->cmm);
+    const struct aws_cryptosdk_alg_properties *props = session->alg_props;
+    size_t frame_len = aws_cryptosdk_priv_frame_ciphertext_size(props, FRAME_TYPE_FRAME, (size_t)session->frame_size);
 
-    aws_secure_zero(session, sizeof(*session));
-    aws_mem_release(alloc, session);
+    // All frames before seqno are regular frames, and the final frame is the longest there can be
+    if (aws_mul_u64_checked(seqno - 1, frame_len, offset) ||
+        aws_add_u64_checked(*offset, session->header_size, offset)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+    *max_len = aws_cryptosdk_priv_frame_ciphertext_size(props, FRAME_TYPE_FINAL, (size_t)session->frame_size);
+
+    return AWS_OP_SUCCESS;
 }
 
-int aws_cryptosdk_session_set_frame_size(struct aws_cryptosdk_session *session, uint32_t frame_size) {
-    if (session->mode != AWS_CRYPTOSDK_ENCRYPT || session->state != ST_CONFIG) {
+int aws_cryptosdk_session_get_frame_sizes(
+    const struct aws_cryptosdk_session *session,
+    size_t *frame_len,
+    size_t *final_frame_max_len,
+    size_t *frame_plaintext_len) {
+    if (session->state == ST_ERROR) {
+        return aws_raise_error(session->error);
+    }
+
+    if (!session->frame_size || !header_done(session)) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
     }
 
-    session->frame_size = frame_size;
+    const struct aws_cryptosdk_alg_properties *props = session->alg_props;
+    size_t frame_size                                = (size_t)session->frame_size;
+
+    *frame_len           = aws_cryptosdk_priv_frame_ciphertext_size(props, FRAME_TYPE_FRAME, frame_size);
+    *final_frame_max_len = aws_cryptosdk_priv_frame_ciphertext_size(props, FRAME_TYPE_FINAL, frame_size);
+    *frame_plaintext_len = frame_size;
 
     return AWS_OP_SUCCESS;
 }
 
-int aws_cryptosdk_session_set_message_size(struct aws_cryptosdk_session *session, uint64_t message_size) {
-    if (session->mode != AWS_CRYPTOSDK_ENCRYPT) {
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+/*
+ * Decrypts the frame at the start of *input, which must carry sequence number seqno, appending
+ * its plaintext to *output and advancing *input past it. Raises AWS_ERROR_SHORT_BUFFER, leaving
+ * both untouched, if the input does not hold the whole frame or the output cannot hold its
+ * plaintext.
+ */
+static int decrypt_frame_with_ctx(
+    const struct aws_cryptosdk_session *session,
+    struct aws_cryptosdk_cipher_ctx *cipher,
+    uint64_t seqno,
+    struct aws_byte_buf *output,
+    struct aws_byte_cursor *input,
+    bool *final_frame) {
+    struct aws_byte_cursor frame_input = *input;
+    struct aws_cryptosdk_frame frame;
+    size_t ciphertext_size, plaintext_size;
+
+    if (aws_cryptosdk_deserialize_frame(
+            &frame, &ciphertext_size, &plaintext_size, &frame_input, session->alg_props, session->frame_size)) {
+        return AWS_OP_ERR;
     }
 
-    if (session->precise_size_known) {
-        // TODO AWS_BAD_STATE
-        return aws_cryptosdk_priv_fail_session(session, AWS_CRYPTOSDK_ERR_BAD_STATE);
+    if (frame.sequence_number != seqno) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
     }
 
-    if (session->size_bound < message_size) {
-        return aws_cryptosdk_priv_fail_session(session, AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    if (session->frame_index.ptr) {
+        uint64_t index_offset;
+        size_t index_len;
+        const uint8_t *index_tag;
+
+        if (aws_cryptosdk_priv_frame_index_get_record(
+                session->frame_index, seqno, &index_offset, &index_len, &index_tag)) {
+            return AWS_OP_ERR;
+        }
+
+        // Any frame other than the one the encryptor produced is rejected, signed suite or not
+        if (index_len != ciphertext_size || frame.authtag.len != session->alg_props->tag_len ||
+            memcmp(index_tag, frame.authtag.buffer, frame.authtag.len)) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        }
     }
 
-    session->precise_size       = message_size;
-    session->precise_size_known = true;
+    if (plaintext_size > output->capacity - output->len) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+    }
 
-    if (session->state == ST_ENCRYPT_BODY) {
-        aws_cryptosdk_priv_encrypt_compute_body_estimate(session);
+    struct aws_byte_buf plaintext     = aws_byte_buf_from_empty_array(output->buffer + output->len, plaintext_size);
+    struct aws_byte_cursor ciphertext = aws_byte_cursor_from_array(frame.ciphertext.buffer, frame.ciphertext.len);
+
+    // The frame type and sequence number are authenticated, so one frame cannot pass for another
+    if (aws_cryptosdk_decrypt_body_with_ctx(
+            cipher,
+            &plaintext,
+            &ciphertext,
+            session->header.message_id,
+            frame.sequence_number,
+            frame.iv.buffer,
+            frame.authtag.buffer,
+            frame.type)) {
+        return AWS_OP_ERR;
     }
 
+    output->len += plaintext.len;
+    *input       = frame_input;
+    *final_frame = frame.type == FRAME_TYPE_FINAL;
+
     return AWS_OP_SUCCESS;
 }
 
-int aws_cryptosdk_session_set_message_bound(struct aws_cryptosdk_session *session, uint64_t max_message_size) {
-    if (session->mode != AWS_CRYPTOSDK_ENCRYPT) {
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
-    }
+int aws_cryptosdk_session_decrypt_frame_at(
+    struct aws_cryptosdk_session *session,
+    uint64_t seqno,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen) {
+    struct aws_byte_buf output   = aws_byte_buf_from_empty_array(outp, outlen);
+    struct aws_byte_cursor input = aws_byte_cursor_from_array(inp, inlen);
+    bool final_frame;
 
-    if (session->precise_size_known && session->precise_size > max_message_size) {
-        return aws_cryptosdk_priv_fail_session(session, AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    *out_bytes_written = 0;
+
+    if (check_random_access(session, seqno)) {
+        return AWS_OP_ERR;
     }
 
-    if (session->size_bound > max_message_size) {
-        session->size_bound = max_message_size;
+    if (decrypt_frame_with_ctx(session, &session->body_cipher, seqno, &output, &input, &final_frame)) {
+        if (aws_last_error() == AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT) aws_secure_zero(outp, outlen);
+        return AWS_OP_ERR;
     }
 
+    *out_bytes_written = output.len;
+
     return AWS_OP_SUCCESS;
 }
 
-int aws_cryptosdk_session_process(
-    struct aws_cryptosdk_session *session,
+int aws_cryptosdk_session_decrypt_frames_at(
+    const struct aws_cryptosdk_session *session,
+    uint64_t first_seqno,
     uint8_t *outp,
     size_t outlen,
     size_t *out_bytes_written,
     const uint8_t *inp,
     size_t inlen,
-    size_t *in_bytes_read) {
-    struct aws_byte_buf output   = { .buffer = outp, .capacity = outlen, .len = 0 };
-    struct aws_byte_cursor input = { .ptr = (uint8_t *)inp, .len = inlen };
-    int result;
-
-    enum session_state prior_state;
-    const uint8_t *old_inp;
-    bool made_progress;
+    size_t *in_bytes_read,
+    bool *final_frame) {
+    struct aws_byte_buf output   = aws_byte_buf_from_empty_array(outp, outlen);
+    struct aws_byte_cursor input = aws_byte_cursor_from_array(inp, inlen);
+    struct aws_cryptosdk_cipher_ctx cipher;
+    uint64_t seqno = first_seqno;
+    int rv         = AWS_OP_ERR;
 
     *out_bytes_written = 0;
+    *in_bytes_read     = 0;
+    *final_frame       = false;
 
-    do {
-        prior_state = session->state;
-        old_inp     = input.ptr;
+    if (check_random_access(session, first_seqno)) {
+        return AWS_OP_ERR;
+    }
 
-        struct aws_byte_buf remaining_space =
-            aws_byte_buf_from_empty_array(output.buffer + output.len, output.capacity - output.len);
+    // A context of our own, so that several ranges may be decrypted at once
+    if (aws_cryptosdk_cipher_ctx_init(
+            &cipher,
+            aws_cryptosdk_priv_session_gcm_provider(session),
+            session->alg_props,
+            session->content_key,
+            false)) {
+        return AWS_OP_ERR;
+    }
 
-        switch (session->state) {
-            case ST_CONFIG:
-                if (!session->cmm) {
-                    // TODO - is this the right error?
-                    result = aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
-                    break;
-                }
+    while (!*final_frame && input.len) {
+        if (seqno > MAX_FRAMES) {
+            aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+            goto out;
+        }
+        if (decrypt_frame_with_ctx(session, &cipher, seqno, &output, &input, final_frame)) {
+            // Stop at the first frame which does not fit, as long as there was one before it
+            if (aws_last_error() == AWS_ERROR_SHORT_BUFFER && seqno != first_seqno) break;
+            goto out;
+        }
+        seqno++;
+    }
 
-                if (session->mode == AWS_CRYPTOSDK_ENCRYPT) {
-                    aws_cryptosdk_priv_session_change_state(session, ST_GEN_KEY);
-                } else {
-                    aws_cryptosdk_priv_session_change_state(session, ST_READ_HEADER);
-                }
-                result = AWS_OP_SUCCESS;
-                break;
+    *out_bytes_written = output.len;
+    *in_bytes_read     = inlen - input.len;
+    rv                 = AWS_OP_SUCCESS;
 
-            case ST_READ_HEADER: result = aws_cryptosdk_priv_try_parse_header(session, &input); break;
-            case ST_UNWRAP_KEY: result = aws_cryptosdk_priv_unwrap_keys(session); break;
-            case ST_DECRYPT_BODY:
-                result = aws_cryptosdk_priv_try_decrypt_body(session, &remaining_space, &input);
-                break;
-            case ST_CHECK_TRAILER: result = aws_cryptosdk_priv_check_trailer(session, &input); break;
+out:
+    if (rv) {
+        *final_frame = false;
+        if (aws_last_error() == AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT) aws_secure_zero(outp, outlen);
+    }
+    aws_cryptosdk_cipher_ctx_clean_up(&cipher);
 
-            case ST_GEN_KEY: result = aws_cryptosdk_priv_try_gen_key(session); break;
-            case ST_WRITE_HEADER: result = aws_cryptosdk_priv_try_write_header(session, &remaining_space); break;
-            case ST_ENCRYPT_BODY:
-                result = aws_cryptosdk_priv_try_encrypt_body(session, &remaining_space, &input);
-                break;
-            case ST_WRITE_TRAILER: result = aws_cryptosdk_priv_write_trailer(session, &remaining_space); break;
+    return rv;
+}
 
-            case ST_DONE: result = AWS_OP_SUCCESS; break;
-            default: result = aws_raise_error(AWS_ERROR_UNKNOWN); break;
-            case ST_ERROR: result = aws_raise_error(session->error); break;
-        }
+int aws_cryptosdk_session_encrypt_frames_at(
+    const struct aws_cryptosdk_session *session,
+    uint64_t first_seqno,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen) {
+    const struct aws_cryptosdk_alg_properties *props = session->alg_props;
+    struct aws_cryptosdk_cipher_ctx cipher;
+    uint64_t offset;
+    int rv = AWS_OP_ERR;
 
-        made_progress = (remaining_space.len) || (input.ptr != old_inp) || (prior_state != session->state);
+    *out_bytes_written = 0;
 
-        output.len += remaining_space.len;
-    } while (result == AWS_OP_SUCCESS && made_progress);
+    if (session->state == ST_ERROR) {
+        return aws_raise_error(session->error);
+    }
 
-    *out_bytes_written = output.len;
-    *in_bytes_read     = input.ptr - inp;
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT ||
+        (session->state != ST_WRITE_HEADER && session->state != ST_ENCRYPT_BODY) || !session->frame_size ||
+        !session->precise_size_known || session->codec || session->frame_index_out) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
 
-    if (result != AWS_OP_SUCCESS) {
-        // Destroy any incomplete (and possibly corrupt) plaintext
-        aws_byte_buf_secure_zero(&output);
-        *out_bytes_written = 0;
+    // The signature would have to digest every frame in order
+    if (props->signature_len) {
+        return aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    }
 
-        if (session->state != ST_ERROR) {
-            session->error = aws_last_error();
-            aws_cryptosdk_priv_session_change_state(session, ST_ERROR);
-        }
+    // The range must start on a frame, and end on one or at the end of the message
+    if (first_seqno == 0 || first_seqno > MAX_FRAMES ||
+        aws_mul_u64_checked(first_seqno - 1, session->frame_size, &offset) || offset > session->precise_size ||
+        inlen > session->precise_size - offset ||
+        (inlen % session->frame_size && offset + inlen != session->precise_size)) {
+        return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
     }
 
-    if (session->state == ST_ERROR) {
-        // (Re-)raise any stored error
-        result = aws_raise_error(session->error);
+    // Size up the output first, so that nothing is written unless it all fits
+    size_t frame_size     = (size_t)session->frame_size;
+    bool final            = offset + inlen == session->precise_size;
+    uint64_t whole_frames = inlen / frame_size;
+    size_t frame_len      = aws_cryptosdk_priv_frame_ciphertext_size(props, FRAME_TYPE_FRAME, frame_size);
+    size_t final_len =
+        final ? aws_cryptosdk_priv_frame_ciphertext_size(props, FRAME_TYPE_FINAL, inlen % frame_size) : 0;
+    uint64_t needed;
+    if (first_seqno + whole_frames + final - 1 > MAX_FRAMES ||
+        aws_mul_u64_checked(whole_frames, frame_len, &needed) || aws_add_u64_checked(needed, final_len, &needed)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+    if (needed > outlen) {
+        return aws_raise_error(AWS_ERROR_SHORT_BUFFER);
     }
 
-    return result;
-}
+    // A context of our own, so that several ranges may be encrypted at once
+    if (aws_cryptosdk_cipher_ctx_init(
+            &cipher,
+            aws_cryptosdk_priv_session_gcm_provider(session),
+            props,
+            session->content_key,
+            true)) {
+        return AWS_OP_ERR;
+    }
 
-bool aws_cryptosdk_session_is_done(const struct aws_cryptosdk_session *session) {
-    return session->state == ST_DONE;
-}
+    struct aws_byte_buf output   = aws_byte_buf_from_empty_array(outp, (size_t)needed);
+    struct aws_byte_cursor input = aws_byte_cursor_from_array(inp, inlen);
+    uint64_t seqno               = first_seqno;
 
-int aws_cryptosdk_session_get_alg_id(const struct aws_cryptosdk_session *session, enum aws_cryptosdk_alg_id *alg_id) {
-    if (!session->alg_props) {
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    for (;;) {
+        struct aws_cryptosdk_frame frame;
+        size_t ciphertext_size;
+        bool last = input.len < session->frame_size;
+
+        if (last && !final) break;
+
+        frame.type            = last ? FRAME_TYPE_FINAL : FRAME_TYPE_FRAME;
+        frame.sequence_number = (uint32_t)seqno++;
+
+        size_t plaintext_size            = last ? input.len : (size_t)session->frame_size;
+        struct aws_byte_cursor plaintext = aws_byte_cursor_advance(&input, plaintext_size);
+        struct aws_byte_buf remaining =
+            aws_byte_buf_from_empty_array(output.buffer + output.len, output.capacity - output.len);
+
+        if (aws_cryptosdk_serialize_frame(&frame, &ciphertext_size, plaintext_size, &remaining, props) ||
+            aws_cryptosdk_encrypt_body_with_ctx(
+                &cipher,
+                &frame.ciphertext,
+                &plaintext,
+                session->header.message_id,
+                frame.sequence_number,
+                frame.iv.buffer,
+                frame.authtag.buffer,
+                frame.type)) {
+            aws_secure_zero(outp, outlen);
+            goto out;
+        }
+        output.len += remaining.len;
+
+        if (last) break;
     }
 
-    *alg_id = session->alg_props->alg_id;
+    *out_bytes_written = output.len;
+    rv                 = AWS_OP_SUCCESS;
 
-    return AWS_OP_SUCCESS;
+out:
+    aws_cryptosdk_cipher_ctx_clean_up(&cipher);
+
+    return rv;
 }
 
 void aws_cryptosdk_session_estimate_buf(
@@ -304,6 +2304,33 @@ void aws_cryptosdk_session_estimate_buf(
     size_t *AWS_RESTRICT inbuf_needed) {
     if (outbuf_needed) *outbuf_needed = session->output_size_estimate;
     if (inbuf_needed) *inbuf_needed = session->input_size_estimate;
+
+    // Plaintext held by a decompressor needs somewhere to go, whatever the body needs next
+    if (outbuf_needed && !*outbuf_needed && session->mode == AWS_CRYPTOSDK_DECRYPT && session->codec &&
+        !session->codec_done) {
+        *outbuf_needed = 1;
+    }
+}
+
+int aws_cryptosdk_priv_session_derive_key(struct aws_cryptosdk_session *session, const struct data_key *data_key) {
+    uint64_t start = stats_now();
+    int rv = aws_cryptosdk_derive_key(session->alg_props, session->content_key, data_key, session->header.message_id);
+    uint64_t end = stats_now();
+
+    if (start && end > start) {
+        session->stats.hkdf_ns += end - start;
+        // Skip over the derivation, so that it isn't also charged to the current state
+        if (session->state_since) session->state_since += end - start;
+    }
+
+    return rv;
+}
+
+void aws_cryptosdk_session_get_stats(
+    const struct aws_cryptosdk_session *session, struct aws_cryptosdk_session_stats *stats) {
+    *stats = session->stats;
+    // frame_seqno is that of the next frame once the body has started
+    stats->frames = session->frame_seqno ? session->frame_seqno - 1 : 0;
 }
 
 void aws_cryptosdk_priv_session_change_state(struct aws_cryptosdk_session *session, enum session_state new_state) {
@@ -351,7 +2378,7 @@ void aws_cryptosdk_priv_session_change_state(struct aws_cryptosdk_session *sessi
                 abort();
             }
             // check that a few of the more important state values are configured
-            if (!session->header_copy || !session->header_size) {
+            if (!session->header_bytes || !session->header_size) {
                 abort();
             }
             break;
@@ -444,6 +2471,7 @@ void aws_cryptosdk_priv_session_change_state(struct aws_cryptosdk_session *sessi
 
         case ST_DONE:
             switch (session->state) {
+                case ST_UNWRAP_KEY:     // ok if only the header is wanted, fall through
                 case ST_ENCRYPT_BODY:   // ok, fall through
                 case ST_DECRYPT_BODY:   // ok, fall through
                 case ST_CHECK_TRAILER:  // ok, fall through
@@ -455,6 +2483,17 @@ void aws_cryptosdk_priv_session_change_state(struct aws_cryptosdk_session *sessi
             break;
     }
 
+    if (session->state_since || session->on_trace) {
+        uint64_t now = stats_now();
+
+        trace_transition(session, new_state, now);
+        // The time so far belongs to the state being left; the new state's starts now
+        if (session->state_since) {
+            charge_state_time(session, now);
+            session->state_since = now;
+        }
+    }
+
     session->state = new_state;
 }
 
@@ -467,17 +2506,27 @@ int aws_cryptosdk_priv_fail_session(struct aws_cryptosdk_session *session, int e
     return aws_raise_error(error_code);
 }
 
+static bool enc_ctx_available(const struct aws_cryptosdk_session *session) {
+    /* In decrypt mode, we want to wait until after CMM call to
+     * return encryption context. This assures that it has already
+     * been validated, if the session is using a keyring that does
+     * validation of the encryption context.
+     */
+    return session->mode != AWS_CRYPTOSDK_DECRYPT || (session->cmm_success && !session->compacted);
+}
+
 const struct aws_hash_table *aws_cryptosdk_session_get_enc_ctx_ptr(const struct aws_cryptosdk_session *session) {
-    if (session->mode == AWS_CRYPTOSDK_DECRYPT && !session->cmm_success) {
-        /* In decrypt mode, we want to wait until after CMM call to
-         * return encryption context. This assures both that the
-         * encryption context has already been deserialized from the
-         * ciphertext and that it has already been validated, if the
-         * session is using a keyring that does validation of the
-         * encryption context.
-         */
+    if (!enc_ctx_available(session)) {
+        return NULL;
+    }
+
+    // A deferred context is deserialized on first access; the session otherwise stays as it was.
+    // This write is why the getter is documented as unsafe to call concurrently.
+    struct aws_cryptosdk_session *mut = (struct aws_cryptosdk_session *)session;
+    if (aws_cryptosdk_hdr_materialize_enc_ctx(&mut->header, session->header_bytes)) {
         return NULL;
     }
+
     return &session->header.enc_ctx;
 }
 
@@ -488,8 +2537,186 @@ struct aws_hash_table *aws_cryptosdk_session_get_enc_ctx_ptr_mut(struct aws_cryp
     return NULL;
 }
 
+int aws_cryptosdk_session_get_enc_ctx_flat(
+    const struct aws_cryptosdk_session *session,
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_flat_enc_ctx *flat) {
+    const uint8_t *header_bytes = NULL;
+
+    if (!enc_ctx_available(session)) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+
+    if (session->mode == AWS_CRYPTOSDK_ENCRYPT && session->header_size) {
+        header_bytes = session->header_copy;
+    } else if (session->mode == AWS_CRYPTOSDK_DECRYPT && session->header_bytes == session->header_copy) {
+        // A borrowed header lives in the caller's input, which may since have been reused
+        header_bytes = session->header_copy;
+    }
+
+    if (header_bytes) {
+        // The encryption context follows the version, type, algorithm ID, message ID and its own length
+        size_t aad_offset = 1 + 1 + 2 + MESSAGE_ID_LEN;
+        size_t aad_len    = (size_t)(header_bytes[aad_offset] << 8 | header_bytes[aad_offset + 1]);
+
+        return aws_cryptosdk_flat_enc_ctx_init_from_serialized(
+            alloc, flat, aws_byte_cursor_from_array(header_bytes + aad_offset + 2, aad_len));
+    }
+
+    const struct aws_hash_table *enc_ctx = aws_cryptosdk_session_get_enc_ctx_ptr(session);
+    if (!enc_ctx) return AWS_OP_ERR;
+
+    return aws_cryptosdk_flat_enc_ctx_init(alloc, flat, enc_ctx);
+}
+
+int aws_cryptosdk_session_set_frozen_enc_ctx(
+    struct aws_cryptosdk_session *session, const struct aws_cryptosdk_frozen_enc_ctx *frozen) {
+    if (session->mode != AWS_CRYPTOSDK_ENCRYPT || session->state != ST_CONFIG) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    aws_cryptosdk_enc_ctx_clear(&session->header.enc_ctx);
+    if (aws_cryptosdk_enc_ctx_clone(
+            aws_cryptosdk_priv_message_alloc(session),
+            &session->header.enc_ctx,
+            aws_cryptosdk_frozen_enc_ctx_table(frozen))) {
+        session->frozen_enc_ctx = NULL;
+        return AWS_OP_ERR;
+    }
+
+    session->frozen_enc_ctx = frozen;
+
+    return AWS_OP_SUCCESS;
+}
+
 const struct aws_array_list *aws_cryptosdk_session_get_keyring_trace_ptr(const struct aws_cryptosdk_session *session) {
-    if (session->cmm_success) return &session->keyring_trace;
+    if (session->cmm_success && !session->compacted) return &session->keyring_trace;
+
+    return NULL;
+}
+
+const struct aws_array_list *aws_cryptosdk_session_get_edks_ptr(const struct aws_cryptosdk_session *session) {
+    if (session->cmm_success && !session->compacted) return &session->header.edk_list;
 
     return NULL;
 }
+
+int aws_cryptosdk_encrypt_buffer(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    const struct aws_hash_table *enc_ctx,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen) {
+    struct aws_byte_buf output   = aws_byte_buf_from_empty_array(outp, outlen);
+    struct aws_byte_cursor input = aws_byte_cursor_from_array(inp, inlen);
+    uint64_t size;
+    int rv = AWS_OP_ERR;
+
+    *out_bytes_written = 0;
+
+    // The caller's reference on the CMM outlives the session, so the session need not take one
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_borrowing_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    if (!session) return AWS_OP_ERR;
+
+    if (enc_ctx && aws_cryptosdk_enc_ctx_clone(alloc, &session->header.enc_ctx, enc_ctx)) goto out;
+    if (aws_cryptosdk_session_set_message_size(session, inlen)) goto out;
+
+    // Generates the materials; after this, run each stage of the state machine exactly once
+    if (aws_cryptosdk_session_get_total_output_size(session, &size)) goto out;
+    if (size > outlen) {
+        *out_bytes_written = size > SIZE_MAX ? SIZE_MAX : (size_t)size;
+        aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+        goto out;
+    }
+
+    if (aws_cryptosdk_priv_try_write_header(session, &output)) goto out;
+    if (aws_cryptosdk_priv_try_encrypt_body(session, &output, &input)) goto out;
+    if (session->state == ST_WRITE_TRAILER && aws_cryptosdk_priv_write_trailer(session, &output)) goto out;
+
+    if (session->state != ST_DONE || input.len || output.len != size) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        goto out;
+    }
+
+    *out_bytes_written = output.len;
+    rv                 = AWS_OP_SUCCESS;
+
+out:
+    if (rv) {
+        aws_byte_buf_secure_zero(&output);
+    }
+    aws_cryptosdk_session_destroy(session);
+
+    return rv;
+}
+
+int aws_cryptosdk_decrypt_buffer(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_hash_table *enc_ctx_out,
+    uint8_t *outp,
+    size_t outlen,
+    size_t *out_bytes_written,
+    const uint8_t *inp,
+    size_t inlen) {
+    struct aws_byte_buf output   = aws_byte_buf_from_empty_array(outp, outlen);
+    struct aws_byte_cursor input = aws_byte_cursor_from_array(inp, inlen);
+    uint64_t size;
+    int rv = AWS_OP_ERR;
+
+    *out_bytes_written = 0;
+
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_borrowing_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, cmm);
+    if (!session) return AWS_OP_ERR;
+
+    // The input outlives the session, so there is no need to copy the header out of it
+    session->borrow_header                    = true;
+    session->borrowed_header_outlives_session = true;
+
+    // Parsing the header also unwraps the data key and verifies the header
+    aws_cryptosdk_priv_session_change_state(session, ST_READ_HEADER);
+    if (aws_cryptosdk_priv_try_parse_header(session, &input)) goto out;
+    if (session->state != ST_DECRYPT_BODY) {
+        // Not even a complete header
+        aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        goto out;
+    }
+
+    if (aws_cryptosdk_priv_decrypt_output_size(session, input, &size)) goto out;
+    if (size > outlen) {
+        *out_bytes_written = size > SIZE_MAX ? SIZE_MAX : (size_t)size;
+        aws_raise_error(AWS_ERROR_SHORT_BUFFER);
+        goto out;
+    }
+
+    if (aws_cryptosdk_priv_try_decrypt_body(session, &output, &input)) goto out;
+    // As in the process loop, verifying the signature and finishing take a pass each
+    while (session->state == ST_CHECK_TRAILER) {
+        size_t remaining = input.len;
+        if (aws_cryptosdk_priv_check_trailer(session, &input)) goto out;
+        if (session->signctx && input.len == remaining) break;  // truncated trailer
+    }
+
+    if (session->state != ST_DONE || input.len || output.len != size) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        goto out;
+    }
+
+    if (enc_ctx_out && (aws_cryptosdk_hdr_materialize_enc_ctx(&session->header, session->header_bytes) ||
+                        aws_cryptosdk_enc_ctx_clone(alloc, enc_ctx_out, &session->header.enc_ctx))) {
+        goto out;
+    }
+
+    *out_bytes_written = output.len;
+    rv                 = AWS_OP_SUCCESS;
+
+out:
+    if (rv) {
+        // Destroy any unauthenticated plaintext
+        aws_byte_buf_secure_zero(&output);
+    }
+    aws_cryptosdk_session_destroy(session);
+
+    return rv;
+}
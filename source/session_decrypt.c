@@ -19,51 +19,53 @@
 #include <stdlib.h>
 
 #include <aws/common/byte_buf.h>
+#include <aws/common/condition_variable.h>
+#include <aws/common/mutex.h>
 #include <aws/common/string.h>
 #include <aws/cryptosdk/edk.h>
 #include <aws/cryptosdk/error.h>
 #include <aws/cryptosdk/list_utils.h>
+#include <aws/cryptosdk/private/enc_ctx.h>
 #include <aws/cryptosdk/private/framefmt.h>
 #include <aws/cryptosdk/private/header.h>
+#include <aws/cryptosdk/private/probes.h>
 #include <aws/cryptosdk/private/session.h>
+#include <aws/cryptosdk/private/sig_pipeline.h>
 #include <aws/cryptosdk/session.h>
 
 /** Session decrypt path routines **/
 
 static int fill_request(struct aws_cryptosdk_dec_request *request, struct aws_cryptosdk_session *session) {
-    request->alloc = session->alloc;
-    request->alg   = session->alg_props->alg_id;
-
-    size_t n_keys = aws_array_list_length(&session->header.edk_list);
-
-    // TODO: Make encrypted_data_keys a pointer?
-    if (aws_cryptosdk_edk_list_init(session->alloc, &request->encrypted_data_keys)) {
-        return AWS_OP_ERR;
+    request->alloc              = aws_cryptosdk_priv_message_alloc(session);
+    request->alg                = session->alg_props->alg_id;
+    request->message_id         = session->header.message_id;
+    request->skip_keyring_trace = session->skip_keyring_trace;
+    request->skip_signature     = session->header_only;
+    request->spare_materials    = session->spare_dec_materials;
+
+    session->spare_dec_materials = NULL;
+
+    /*
+     * The session header owns the EDKs for the life of the message, so the request borrows its list
+     * storage directly. Without an allocator the view cannot grow, and cleaning it up frees nothing.
+     */
+    request->encrypted_data_keys       = session->header.edk_list;
+    request->encrypted_data_keys.alloc = NULL;
+    // Limiting the EDKs offered limits the unwraps keyrings can attempt; the rest are never seen
+    if (session->max_unwrap_attempts && request->encrypted_data_keys.length > session->max_unwrap_attempts) {
+        request->encrypted_data_keys.length = session->max_unwrap_attempts;
     }
 
-    request->enc_ctx = &session->header.enc_ctx;
+    request->enc_ctx          = &session->header.enc_ctx;
+    request->enc_ctx_deferred = session->header.enc_ctx_deferred;
 
-    for (size_t i = 0; i < n_keys; i++) {
-        struct aws_cryptosdk_edk edk;
-
-        if (aws_array_list_get_at(&session->header.edk_list, &edk, i)) {
-            goto UNEXPECTED_ERROR;
-        }
-        // Because the session header owns the EDKs, clear the allocators to avoid any unfortunate double frees
-        edk.provider_id.allocator   = NULL;
-        edk.provider_info.allocator = NULL;
-        edk.ciphertext.allocator    = NULL;
-
-        if (aws_array_list_push_back(&request->encrypted_data_keys, &edk)) {
-            goto UNEXPECTED_ERROR;
-        }
-    }
+    // Keyrings may authenticate the header's serialization in place of their own, if they match
+    struct aws_byte_cursor serialized = aws_byte_cursor_from_array(
+        session->header_bytes + session->header.parsed_enc_ctx_offset, session->header.parsed_enc_ctx_len);
+    AWS_ZERO_STRUCT(request->serialized_enc_ctx);
+    if (serialized.len && aws_cryptosdk_enc_ctx_is_canonical(serialized)) request->serialized_enc_ctx = serialized;
 
     return AWS_OP_SUCCESS;
-
-UNEXPECTED_ERROR:
-    aws_array_list_clean_up(&request->encrypted_data_keys);
-    return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
 }
 
 static int derive_data_key(struct aws_cryptosdk_session *session, struct aws_cryptosdk_dec_materials *materials) {
@@ -71,11 +73,22 @@ static int derive_data_key(struct aws_cryptosdk_session *session, struct aws_cry
         return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
     }
 
+    // The CMM may have already derived the content key (e.g. the caching CMM on a repeated message).
+    // If it's wrong, header validation will fail, so we don't need to double-check it here.
+    if (materials->content_key.len) {
+        if (materials->content_key.len != session->alg_props->content_key_len) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        }
+        aws_secure_zero(session->content_key->keybuf, sizeof(session->content_key->keybuf));
+        memcpy(session->content_key->keybuf, materials->content_key.buffer, materials->content_key.len);
+        return AWS_OP_SUCCESS;
+    }
+
     // TODO - eliminate the struct data_key type and use the unencrypted_data_key buffer directly
     struct data_key data_key = { { 0 } };
     memcpy(&data_key.keybuf, materials->unencrypted_data_key.buffer, materials->unencrypted_data_key.len);
 
-    return aws_cryptosdk_derive_key(session->alg_props, &session->content_key, &data_key, session->header.message_id);
+    return aws_cryptosdk_priv_session_derive_key(session, &data_key);
 }
 
 static int validate_header(struct aws_cryptosdk_session *session) {
@@ -93,14 +106,65 @@ static int validate_header(struct aws_cryptosdk_session *session) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
     }
 
-    struct aws_byte_buf authtag = { .buffer = session->header_copy + session->header.auth_len, .len = authtag_len };
-    struct aws_byte_buf headerbytebuf = { .buffer = session->header_copy, .len = session->header.auth_len };
+    const uint8_t *header_bytes       = session->header_bytes;
+    struct aws_byte_buf authtag       = aws_byte_buf_from_array(header_bytes + session->header.auth_len, authtag_len);
+    struct aws_byte_buf headerbytebuf = aws_byte_buf_from_array(header_bytes, session->header.auth_len);
+
+    // The body's cipher context is already keyed, so its key schedule serves the header too
+    return aws_cryptosdk_verify_header_with_ctx(&session->body_cipher, &authtag, &headerbytebuf);
+}
 
-    return aws_cryptosdk_verify_header(session->alg_props, &session->content_key, &authtag, &headerbytebuf);
+/* Takes back the spare materials lent to the CMM, if it did not use them */
+static void reclaim_spare_materials(struct aws_cryptosdk_session *session) {
+    session->spare_dec_materials         = session->dec_request.spare_materials;
+    session->dec_request.spare_materials = NULL;
+}
+
+/*
+ * Obtains decryption materials from the CMM. When the session is asynchronous, this sets
+ * *materials to NULL without raising an error while the request is outstanding.
+ */
+static int get_materials(struct aws_cryptosdk_session *session, struct aws_cryptosdk_dec_materials **materials) {
+    bool ready;
+
+    *materials = NULL;
+
+    if (!session->on_ready) {
+        if (fill_request(&session->dec_request, session)) return AWS_OP_ERR;
+        AWS_CRYPTOSDK_PROBE1(cmm_decrypt_start, session);
+        int rv = aws_cryptosdk_cmm_decrypt_materials(session->cmm, materials, &session->dec_request);
+        AWS_CRYPTOSDK_PROBE2(cmm_decrypt_end, session, rv ? aws_last_error() : 0);
+        reclaim_spare_materials(session);
+        return rv;
+    }
+
+    if (!session->async_requested) {
+        if (fill_request(&session->dec_request, session)) return AWS_OP_ERR;
+        session->async_requested = true;
+
+        // The matching end probe fires when the CMM calls back; see aws_cryptosdk_priv_dec_materials_ready
+        AWS_CRYPTOSDK_PROBE1(cmm_decrypt_start, session);
+        if (aws_cryptosdk_cmm_decrypt_materials_async(
+                session->cmm, &session->dec_request, aws_cryptosdk_priv_dec_materials_ready, session)) {
+            AWS_CRYPTOSDK_PROBE2(cmm_decrypt_end, session, aws_last_error());
+            reclaim_spare_materials(session);
+            session->async_requested = false;
+            return AWS_OP_ERR;
+        }
+        reclaim_spare_materials(session);
+    }
+
+    if (aws_cryptosdk_priv_session_poll_async(session, &ready)) return AWS_OP_ERR;
+
+    if (ready) {
+        *materials                   = session->async_dec_materials;
+        session->async_dec_materials = NULL;
+    }
+
+    return AWS_OP_SUCCESS;
 }
 
 int aws_cryptosdk_priv_unwrap_keys(struct aws_cryptosdk_session *AWS_RESTRICT session) {
-    struct aws_cryptosdk_dec_request request;
     struct aws_cryptosdk_dec_materials *materials = NULL;
 
     session->alg_props = aws_cryptosdk_alg_props(session->header.alg_id);
@@ -110,17 +174,54 @@ int aws_cryptosdk_priv_unwrap_keys(struct aws_cryptosdk_session *AWS_RESTRICT se
         return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
     }
 
-    if (fill_request(&request, session)) return AWS_OP_ERR;
+    // Messages for keys this CMM has no way to decrypt are turned away before any request is built
+    if (!session->async_requested && !aws_cryptosdk_cmm_may_decrypt(session->cmm, &session->header.edk_list)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT);
+    }
+
     int rv = AWS_OP_ERR;
 
-    if (aws_cryptosdk_cmm_decrypt_materials(session->cmm, &materials, &request)) goto out;
+    if (get_materials(session, &materials)) goto out;
+
+    if (!materials) {
+        // Still waiting on the CMM; we'll be called again once it's done
+        return AWS_OP_SUCCESS;
+    }
 
     aws_cryptosdk_transfer_list(&session->keyring_trace, &materials->keyring_trace);
     session->cmm_success = true;
 
+    // The CMM may have filled in the encryption context; if not, it is built when first asked for,
+    // unless the header bytes it comes from are the caller's and may be gone by then
+    session->header.enc_ctx_deferred = session->dec_request.enc_ctx_deferred;
+    if (session->header_bytes != session->header_copy && !session->borrowed_header_outlives_session &&
+        aws_cryptosdk_hdr_materialize_enc_ctx(&session->header, session->header_bytes)) {
+        goto out;
+    }
+
     if (derive_data_key(session, materials)) goto out;
+    if (aws_cryptosdk_cipher_ctx_init(
+            &session->body_cipher,
+            aws_cryptosdk_priv_session_gcm_provider(session),
+            session->alg_props,
+            session->content_key,
+            false)) {
+        goto out;
+    }
     if (validate_header(session)) goto out;
 
+    if (session->header_only) {
+        // The body is never read, so the body cipher keyed above serves only to check the header
+        aws_cryptosdk_priv_session_change_state(session, ST_DONE);
+        rv = AWS_OP_SUCCESS;
+        goto out;
+    }
+
+    if (session->verify_only &&
+        aws_cryptosdk_cipher_ctx_enable_verify_only(&session->body_cipher, session->content_key)) {
+        goto out;
+    }
+
     if (session->alg_props->signature_len) {
         if (!materials->signctx) {
             aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
@@ -133,7 +234,7 @@ int aws_cryptosdk_priv_unwrap_keys(struct aws_cryptosdk_session *AWS_RESTRICT se
 
         // Backfill the context with the header
         if (aws_cryptosdk_sig_update(
-                session->signctx, aws_byte_cursor_from_array(session->header_copy, session->header_size))) {
+                session->signctx, aws_byte_cursor_from_array(session->header_bytes, session->header_size))) {
             goto out;
         }
     }
@@ -144,8 +245,50 @@ int aws_cryptosdk_priv_unwrap_keys(struct aws_cryptosdk_session *AWS_RESTRICT se
 
     rv = AWS_OP_SUCCESS;
 out:
-    if (materials) aws_cryptosdk_dec_materials_destroy(materials);
-    aws_array_list_clean_up(&request.encrypted_data_keys);
+    if (materials && materials->alloc == session->alloc) {
+        aws_cryptosdk_dec_materials_recycle(&session->spare_dec_materials, materials);
+    } else {
+        aws_cryptosdk_dec_materials_destroy(materials);
+    }
+    aws_array_list_clean_up(&session->dec_request.encrypted_data_keys);
+
+    return rv;
+}
+
+int aws_cryptosdk_priv_recover_content_key(struct aws_cryptosdk_session *session) {
+    struct aws_cryptosdk_dec_materials *materials = NULL;
+    int rv                                        = AWS_OP_ERR;
+
+    if (fill_request(&session->dec_request, session)) return AWS_OP_ERR;
+    AWS_CRYPTOSDK_PROBE1(cmm_decrypt_start, session);
+    int cmm_rv = aws_cryptosdk_cmm_decrypt_materials(session->cmm, &materials, &session->dec_request);
+    AWS_CRYPTOSDK_PROBE2(cmm_decrypt_end, session, cmm_rv ? aws_last_error() : 0);
+    reclaim_spare_materials(session);
+    if (cmm_rv) goto out;
+
+    aws_cryptosdk_transfer_list(&session->keyring_trace, &materials->keyring_trace);
+    session->cmm_success = true;
+
+    if (derive_data_key(session, materials)) goto out;
+    // The session goes on to encrypt, so the context is keyed for that
+    if (aws_cryptosdk_cipher_ctx_init(
+            &session->body_cipher,
+            aws_cryptosdk_priv_session_gcm_provider(session),
+            session->alg_props,
+            session->content_key,
+            true)) {
+        goto out;
+    }
+    if (validate_header(session)) goto out;
+
+    rv = AWS_OP_SUCCESS;
+out:
+    if (materials && materials->alloc == session->alloc) {
+        aws_cryptosdk_dec_materials_recycle(&session->spare_dec_materials, materials);
+    } else {
+        aws_cryptosdk_dec_materials_destroy(materials);
+    }
+    aws_array_list_clean_up(&session->dec_request.encrypted_data_keys);
 
     return rv;
 }
@@ -153,20 +296,30 @@ out:
 int aws_cryptosdk_priv_try_parse_header(
     struct aws_cryptosdk_session *AWS_RESTRICT session, struct aws_byte_cursor *AWS_RESTRICT input) {
     const uint8_t *header_start = input->ptr;
-    int rv                      = aws_cryptosdk_hdr_parse(&session->header, input);
-
-    if (rv != AWS_OP_SUCCESS) {
-        if (aws_last_error() == AWS_ERROR_SHORT_BUFFER) {
-            if (input->len >= session->input_size_estimate) {
-                session->input_size_estimate = input->len + 128;
-                if (session->input_size_estimate < input->len) {
-                    // overflow
-                    session->input_size_estimate = (size_t)-1;
-                }
-            }
-            session->output_size_estimate = 0;
-            return AWS_OP_SUCCESS;  // suppress this error
+    size_t needed               = 0;
+    // processv's staging buffer does not outlive the call, so its contents are never borrowed
+    bool borrow = session->borrow_header && !session->input_staged;
+
+    // EDKs are borrowed only when the whole header is parsed from this one buffer
+    session->header.borrow_edks = borrow && !session->header.parse.offset;
+    // Many callers never look at the encryption context, so it is only deserialized when needed
+    session->header.defer_enc_ctx = true;
+
+    // Progress is kept in session->header, so bytes already parsed are not parsed again
+    int rv = aws_cryptosdk_hdr_try_parse_incremental(&session->header, input, &needed);
+
+    if (rv == AWS_CRYPTOSDK_NEED_MORE) {
+        if (session->header.borrow_edks) {
+            // The caller need not present this buffer again; start over on the next call,
+            // but keep what we learned about the header size
+            aws_cryptosdk_hdr_clear(&session->header);
+            session->header.parse.needed = needed;
         }
+        session->input_size_estimate  = needed;
+        session->output_size_estimate = 0;
+        return AWS_OP_SUCCESS;
+    }
+    if (rv != AWS_OP_SUCCESS) {
         return rv;
     }
 
@@ -180,94 +333,256 @@ int aws_cryptosdk_priv_try_parse_header(
         return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
     }
 
-    session->header_copy = aws_mem_acquire(session->alloc, session->header_size);
+    if (borrow) {
+        session->header_bytes = header_start;
+    } else {
+        if (aws_cryptosdk_priv_reserve_header_copy(session)) {
+            return AWS_OP_ERR;
+        }
 
-    if (!session->header_copy) {
-        return aws_raise_error(AWS_ERROR_OOM);
+        memcpy(session->header_copy, header_start, session->header_size);
+        session->header_bytes = session->header_copy;
     }
 
-    memcpy(session->header_copy, header_start, session->header_size);
-
     aws_cryptosdk_priv_session_change_state(session, ST_UNWRAP_KEY);
 
     return aws_cryptosdk_priv_unwrap_keys(session);
 }
 
-int aws_cryptosdk_priv_try_decrypt_body(
+/*
+ * Parses the next frame from *pinput and reserves space for its plaintext in *poutput,
+ * filling in *job so that the frame can be decrypted later. Sets *prepared to indicate
+ * whether a frame was set up; if there is not enough input or output space this returns
+ * success without consuming anything, leaving the session's size estimates updated.
+ * Verify-only sessions reserve no output space.
+ */
+static int prepare_frame(
     struct aws_cryptosdk_session *AWS_RESTRICT session,
     struct aws_byte_buf *AWS_RESTRICT poutput,
-    struct aws_byte_cursor *AWS_RESTRICT pinput) {
-    struct aws_cryptosdk_frame frame;
+    struct aws_byte_cursor *AWS_RESTRICT pinput,
+    struct aws_cryptosdk_frame_job *job,
+    bool *prepared) {
+    struct aws_cryptosdk_frame *frame = &job->frame;
     // We'll save the original cursor state; if we don't have enough plaintext buffer we'll
     // need to roll back and un-consume the ciphertext.
     struct aws_byte_cursor input_rollback = *pinput;
 
-    if (aws_cryptosdk_deserialize_frame(
-            &frame,
-            &session->input_size_estimate,
-            &session->output_size_estimate,
-            pinput,
-            session->alg_props,
-            session->frame_size)) {
-        if (aws_last_error() == AWS_ERROR_SHORT_BUFFER) {
-            // Not actually an error. We've updated the estimates, so move on.
-            return AWS_OP_SUCCESS;
-        } else {
-            // Frame format was malformed. Propagate the error up the chain.
-            return AWS_OP_ERR;
-        }
+    *prepared = false;
+
+    int rv = aws_cryptosdk_try_deserialize_frame(
+        frame,
+        &session->input_size_estimate,
+        &session->output_size_estimate,
+        pinput,
+        session->alg_props,
+        session->frame_size);
+
+    // Verify-only sessions never write plaintext, so they need no output space
+    if (session->verify_only) session->output_size_estimate = 0;
+
+    if (rv == AWS_CRYPTOSDK_NEED_MORE) {
+        // We've updated the estimates, so move on.
+        return AWS_OP_SUCCESS;
+    }
+    if (rv) {
+        // Frame format was malformed. Propagate the error up the chain.
+        return AWS_OP_ERR;
     }
 
     // The frame is structurally sound. Now we just need to do some validation of its
     // contents and decrypt.
 
-    if (session->frame_seqno != frame.sequence_number) {
+    if (session->frame_seqno != frame->sequence_number) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
     }
 
     // Before we go further, do we have enough room to place the plaintext?
     struct aws_byte_buf output = { .buffer = 0, .len = 0, .capacity = 0, .allocator = NULL };
-    if (!aws_byte_buf_advance(poutput, &output, session->output_size_estimate)) {
+    if (!session->verify_only && !aws_byte_buf_advance(poutput, &output, session->output_size_estimate)) {
         *pinput = input_rollback;
         // No progress due to not enough plaintext output space.
         return AWS_OP_SUCCESS;
     }
 
-    // We have everything we need, try to decrypt
-    struct aws_byte_cursor ciphertext_cursor =
-        aws_byte_cursor_from_array(frame.ciphertext.buffer, frame.ciphertext.len);
-    int rv = aws_cryptosdk_decrypt_body(
-        session->alg_props,
-        &output,
-        &ciphertext_cursor,
-        session->header.message_id,
-        frame.sequence_number,
-        frame.iv.buffer,
-        &session->content_key,
-        frame.authtag.buffer,
-        frame.type);
-
-    if (rv == AWS_ERROR_SUCCESS) {
-        session->frame_seqno++;
-
-        if (session->signctx) {
-            struct aws_byte_cursor frame = { .ptr = input_rollback.ptr, .len = pinput->ptr - input_rollback.ptr };
-            if (aws_cryptosdk_sig_update(session->signctx, frame)) {
-                return AWS_OP_ERR;
-            }
+    job->input         = aws_byte_cursor_from_array(frame->ciphertext.buffer, frame->ciphertext.len);
+    job->output        = output;
+    job->in_place_dest = NULL;
+    job->serialized    = aws_byte_cursor_from_array(input_rollback.ptr, pinput->ptr - input_rollback.ptr);
+    job->error         = AWS_ERROR_SUCCESS;
+
+    if (session->in_place && !session->verify_only) {
+        // Decrypt in the ciphertext slot; the plaintext is moved into place after authentication
+        job->output        = aws_byte_buf_from_empty_array(frame->ciphertext.buffer, frame->ciphertext.len);
+        job->in_place_dest = output.buffer;
+    }
+
+    session->frame_seqno++;
+    *prepared = true;
+
+    if (frame->type != FRAME_TYPE_FRAME) {
+        aws_cryptosdk_priv_session_change_state(session, ST_CHECK_TRAILER);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Frees what a compact session has no further use for once it has reached the body: the copy
+ * of the header, its EDKs and encryption context, the keyring trace and the spare materials.
+ * The content key, body cipher, signature context and counters are all that is left.
+ */
+static void compact_session(struct aws_cryptosdk_session *session) {
+    if (session->header_copy) {
+        aws_secure_zero(session->header_copy, session->header_copy_capacity);
+        aws_mem_release(session->alloc, session->header_copy);
+        session->header_copy          = NULL;
+        session->header_copy_capacity = 0;
+    }
+    session->header_bytes = NULL;
+    aws_cryptosdk_hdr_trim(&session->header);
+
+    aws_cryptosdk_keyring_trace_clear(&session->keyring_trace);
+    aws_array_list_shrink_to_fit(&session->keyring_trace);
+
+    aws_cryptosdk_dec_materials_destroy(session->spare_dec_materials);
+    session->spare_dec_materials = NULL;
+
+    session->compacted = true;
+}
+
+/*
+ * Passes the plaintext of a batch of authenticated frames, which lies in frame order in output
+ * from offset start, to the plaintext sink one frame at a time. The plaintext is then zeroed
+ * and taken back out of output, so that none of it also reaches the caller's buffer.
+ */
+static int sink_frames(
+    struct aws_cryptosdk_session *session,
+    const struct aws_cryptosdk_frame_job *jobs,
+    size_t num_jobs,
+    struct aws_byte_buf *output,
+    size_t start) {
+    uint8_t *plaintext = output->buffer + start;
+    int rv             = AWS_OP_SUCCESS;
+
+    for (size_t i = 0; i < num_jobs && !rv; i++) {
+        struct aws_byte_cursor frame = aws_byte_cursor_from_array(plaintext, jobs[i].output.len);
+
+        rv = session->plaintext_sink(session, frame, jobs[i].frame.sequence_number, session->plaintext_sink_user_data);
+        if (!rv) {
+            session->plaintext_sunk += frame.len;
+            session->stats.bytes_out += frame.len;
+        }
+        plaintext += frame.len;
+    }
+
+    aws_secure_zero(output->buffer + start, output->len - start);
+    output->len = start;
+
+    return rv;
+}
+
+int aws_cryptosdk_priv_try_decrypt_body(
+    struct aws_cryptosdk_session *AWS_RESTRICT session,
+    struct aws_byte_buf *AWS_RESTRICT poutput,
+    struct aws_byte_cursor *AWS_RESTRICT pinput) {
+    /*
+     * Parse as many complete frames as the input and output buffers allow, then decrypt them
+     * (concurrently, if worker threads are configured). The trailing signature is updated over
+     * each batch's ciphertext, in order, before it is decrypted (in-place decryption overwrites
+     * it). No plaintext is handed back to the caller unless every frame has authenticated; on
+     * failure the top level loop destroys it.
+     *
+     * With a plaintext sink, the frames of each batch are handed to it as soon as the batch has
+     * authenticated, rather than returned in output.
+     *
+     * With a pipelined signature, a helper thread hashes each batch while it is decrypted, or,
+     * when decrypting in place, while the next batch is parsed.
+     *
+     * Unlike encryption, which has no ciphertext to scan ahead, decryption batches frames even on
+     * a single thread: every complete frame at hand is parsed up front and the batch goes through
+     * the body cipher in one run, so a buffer of many small frames is not paid for frame by frame.
+     */
+    struct aws_cryptosdk_frame_job jobs[MAX_FRAME_JOBS];
+    size_t batch_limit           = MAX_FRAME_JOBS;
+    struct aws_byte_buf output   = *poutput;
+    struct aws_byte_cursor input = *pinput;
+    bool pipelined               = session->signctx && session->pipelined_signature;
+    bool sink                    = session->plaintext_sink && !session->codec && !session->verify_only;
+    struct aws_cryptosdk_sig_pipeline sig_pipeline;
+    int rv = AWS_OP_ERR;
+    size_t num_jobs;
+
+    // Callers may still read the header's contents until they first ask for plaintext. By then the
+    // message's compression has been looked up in the encryption context, except by verify-only
+    // sessions, which never decompress and produce no plaintext.
+    bool wants_plaintext = session->codec_checked && poutput->len < poutput->capacity;
+    if (session->compact && !session->compacted && (wants_plaintext || session->verify_only)) {
+        compact_session(session);
+    }
+
+    // Without parallel workers or a multi-op provider, each frame of the batch is digested as it
+    // is decrypted, in a single pass, on the calling thread
+    bool serial = aws_cryptosdk_priv_frame_batch_limit(session) == 1;
+    struct aws_cryptosdk_sig_ctx *stitch_signctx = serial && !pipelined ? session->signctx : NULL;
+
+    if (pipelined) aws_cryptosdk_priv_sig_pipeline_start(&sig_pipeline, session->alloc, session->signctx);
+
+    do {
+        bool prepared              = false;
+        const uint8_t *batch_start = input.ptr;
+        size_t batch_output        = output.len;
+
+        for (num_jobs = 0; num_jobs < batch_limit && session->state == ST_DECRYPT_BODY; num_jobs++) {
+            if (prepare_frame(session, &output, &input, &jobs[num_jobs], &prepared)) goto out;
+            if (!prepared) break;
         }
 
-        if (frame.type != FRAME_TYPE_FRAME) {
-            aws_cryptosdk_priv_session_change_state(session, ST_CHECK_TRAILER);
+        if (session->signctx && !stitch_signctx && input.ptr != batch_start) {
+            struct aws_byte_cursor frames = { .ptr = (uint8_t *)batch_start, .len = input.ptr - batch_start };
+
+            if (!pipelined) {
+                if (aws_cryptosdk_sig_update(session->signctx, frames)) goto out;
+            } else {
+                aws_cryptosdk_priv_sig_pipeline_push(&sig_pipeline, frames);
+                // Decrypting in place overwrites the ciphertext, so it must be hashed first
+                if (session->in_place && aws_cryptosdk_priv_sig_pipeline_wait(&sig_pipeline)) goto out;
+            }
         }
 
-        return rv;
+        // An error was encountered; the top level loop will transition to the error state
+        if (num_jobs && aws_cryptosdk_priv_run_frame_jobs(session, jobs, num_jobs, stitch_signctx)) goto out;
+
+        // Each frame goes to a plaintext sink as soon as its batch has authenticated
+        if (num_jobs && sink && sink_frames(session, jobs, num_jobs, &output, batch_output)) goto out;
+    } while (num_jobs == batch_limit && session->state == ST_DECRYPT_BODY);
+
+    *pinput  = input;
+    *poutput = output;
+    rv       = AWS_OP_SUCCESS;
+
+out:
+    if (pipelined) {
+        int error_code = rv ? aws_last_error() : AWS_ERROR_SUCCESS;
+
+        if (aws_cryptosdk_priv_sig_pipeline_finish(&sig_pipeline)) {
+            rv = AWS_OP_ERR;
+        } else if (rv) {
+            aws_raise_error(error_code);
+        }
     }
 
-    // An error was encountered; the top level loop will transition to the error state
     return rv;
 }
 
+size_t aws_cryptosdk_priv_decrypt_input_needed(const struct aws_cryptosdk_session *session, size_t buffered) {
+    // A frame starts with its sequence number, or the final frame marker in its place
+    if (session->state == ST_DECRYPT_BODY && session->frame_size && buffered < sizeof(uint32_t)) {
+        return sizeof(uint32_t);
+    }
+
+    return session->input_size_estimate;
+}
+
 int aws_cryptosdk_priv_check_trailer(
     struct aws_cryptosdk_session *AWS_RESTRICT session, struct aws_byte_cursor *AWS_RESTRICT input) {
     /* By the time we're here, we're not going to provide any more output.
@@ -299,6 +614,14 @@ int aws_cryptosdk_priv_check_trailer(
     if (!signature_str) {
         return AWS_OP_ERR;
     }
+
+    if (session->defer_signature) {
+        // signctx is kept until aws_cryptosdk_session_verify_deferred_signatures or a reset
+        session->deferred_signature = signature_str;
+        aws_cryptosdk_priv_session_change_state(session, ST_DONE);
+        return AWS_OP_SUCCESS;
+    }
+
     int rv = aws_cryptosdk_sig_verify_finish(session->signctx, signature_str);
 
     // signctx is unconditionally freed, so avoid double free by nulling it out
@@ -307,3 +630,138 @@ int aws_cryptosdk_priv_check_trailer(
 
     return rv;
 }
+
+/* State shared by the workers of one batch verification; next_session and pending are guarded by mutex */
+struct deferred_verify {
+    struct aws_mutex mutex;
+    struct aws_condition_variable cond;
+    size_t next_session;
+    size_t pending;
+    struct aws_cryptosdk_session **sessions;
+    int *results;
+    size_t num_sessions;
+};
+
+static int verify_deferred_signature(struct aws_cryptosdk_session *session) {
+    if (session->state != ST_DONE) {
+        return AWS_CRYPTOSDK_ERR_BAD_STATE;
+    }
+
+    if (!session->deferred_signature) {
+        return AWS_ERROR_SUCCESS;
+    }
+
+    int rv = aws_cryptosdk_sig_verify_finish(session->signctx, session->deferred_signature);
+
+    // signctx is unconditionally freed, so avoid double free by nulling it out
+    session->signctx = NULL;
+    aws_string_destroy(session->deferred_signature);
+    session->deferred_signature = NULL;
+
+    if (!rv) {
+        return AWS_ERROR_SUCCESS;
+    }
+
+    // Error codes are thread-local, so report this one through the results instead
+    int error_code = aws_last_error();
+    aws_cryptosdk_priv_fail_session(session, error_code);
+    aws_reset_error();
+
+    return error_code;
+}
+
+static void run_verify_worker(void *arg) {
+    struct deferred_verify *verify = arg;
+
+    while (true) {
+        aws_mutex_lock(&verify->mutex);
+        size_t idx = verify->next_session;
+        if (idx < verify->num_sessions) verify->next_session++;
+        aws_mutex_unlock(&verify->mutex);
+
+        if (idx >= verify->num_sessions) break;
+        verify->results[idx] = verify_deferred_signature(verify->sessions[idx]);
+    }
+
+    aws_mutex_lock(&verify->mutex);
+    verify->pending--;
+    aws_condition_variable_notify_all(&verify->cond);
+    aws_mutex_unlock(&verify->mutex);
+}
+
+static bool deferred_verify_done(void *arg) {
+    struct deferred_verify *verify = arg;
+
+    return !verify->pending;
+}
+
+int aws_cryptosdk_session_verify_deferred_signatures(
+    struct aws_cryptosdk_session **sessions,
+    int *results,
+    size_t num_sessions,
+    aws_cryptosdk_executor_fn *executor,
+    void *executor_data,
+    size_t num_workers) {
+    if (!executor || !num_workers || num_sessions < 2) {
+        for (size_t idx = 0; idx < num_sessions; idx++) results[idx] = verify_deferred_signature(sessions[idx]);
+        return AWS_OP_SUCCESS;
+    }
+
+    // The calling thread is one of the workers, and more workers than sessions would find nothing to do
+    size_t num_tasks = num_workers < num_sessions ? num_workers + 1 : num_sessions;
+
+    struct deferred_verify verify = { .mutex        = AWS_MUTEX_INIT,
+                                      .cond         = AWS_CONDITION_VARIABLE_INIT,
+                                      .next_session = 0,
+                                      .pending      = num_tasks,
+                                      .sessions     = sessions,
+                                      .results      = results,
+                                      .num_sessions = num_sessions };
+
+    for (size_t worker = 1; worker < num_tasks; worker++) {
+        if (executor(run_verify_worker, &verify, executor_data)) {
+            aws_reset_error();
+            run_verify_worker(&verify);
+        }
+    }
+    run_verify_worker(&verify);
+
+    aws_mutex_lock(&verify.mutex);
+    aws_condition_variable_wait_pred(&verify.cond, &verify.mutex, deferred_verify_done, &verify);
+    aws_mutex_unlock(&verify.mutex);
+
+    aws_condition_variable_clean_up(&verify.cond);
+    aws_mutex_clean_up(&verify.mutex);
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_priv_decrypt_output_size(
+    const struct aws_cryptosdk_session *session, struct aws_byte_cursor body, uint64_t *size) {
+    uint64_t total = 0;
+    struct aws_cryptosdk_frame frame;
+
+    if (session->state != ST_DECRYPT_BODY || session->frame_seqno != 1) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    // The frames hold compressed plaintext, whose decompressed size is not recorded anywhere
+    if (aws_cryptosdk_priv_is_compressed(session)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT);
+    }
+
+    do {
+        size_t ciphertext_size, plaintext_size;
+
+        if (aws_cryptosdk_deserialize_frame(
+                &frame, &ciphertext_size, &plaintext_size, &body, session->alg_props, session->frame_size)) {
+            // A short buffer here means the message is truncated
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+        }
+
+        total += plaintext_size;
+    } while (frame.type == FRAME_TYPE_FRAME);
+
+    *size = total;
+
+    return AWS_OP_SUCCESS;
+}
@@ -22,13 +22,17 @@
 #include <aws/common/string.h>
 #include <aws/cryptosdk/error.h>
 #include <aws/cryptosdk/list_utils.h>
+#include <aws/cryptosdk/private/frame_index.h>
 #include <aws/cryptosdk/private/framefmt.h>
 #include <aws/cryptosdk/private/header.h>
+#include <aws/cryptosdk/private/probes.h>
 #include <aws/cryptosdk/private/session.h>
+#include <aws/cryptosdk/private/sig_pipeline.h>
+#include <aws/cryptosdk/private/utils.h>
 #include <aws/cryptosdk/session.h>
 
 static int build_header(struct aws_cryptosdk_session *session, struct aws_cryptosdk_enc_materials *materials);
-static int sign_header(struct aws_cryptosdk_session *session);
+static int sign_header(struct aws_cryptosdk_session *session, const struct aws_byte_buf *header_template);
 
 /* Session encrypt path routines */
 void aws_cryptosdk_priv_encrypt_compute_body_estimate(struct aws_cryptosdk_session *session) {
@@ -47,22 +51,83 @@ void aws_cryptosdk_priv_encrypt_compute_body_estimate(struct aws_cryptosdk_sessi
     aws_cryptosdk_priv_try_encrypt_body(session, &empty_output, &empty_input);
 }
 
+static void fill_request(struct aws_cryptosdk_enc_request *request, struct aws_cryptosdk_session *session) {
+    request->alloc   = aws_cryptosdk_priv_message_alloc(session);
+    request->enc_ctx = &session->header.enc_ctx;
+    // The default CMM will fill this in.
+    request->requested_alg      = 0;
+    request->plaintext_size     = session->precise_size_known ? session->precise_size : session->size_bound;
+    request->frozen_enc_ctx     = session->frozen_enc_ctx;
+    request->skip_keyring_trace = session->skip_keyring_trace;
+    request->spare_materials    = session->spare_enc_materials;
+
+    session->spare_enc_materials = NULL;
+}
+
+/* Takes back the spare materials lent to the CMM, if it did not use them */
+static void reclaim_spare_materials(struct aws_cryptosdk_session *session) {
+    session->spare_enc_materials         = session->enc_request.spare_materials;
+    session->enc_request.spare_materials = NULL;
+}
+
+/*
+ * Obtains encryption materials from the CMM. When the session is asynchronous, this sets
+ * *materials to NULL without raising an error while the request is outstanding.
+ */
+static int get_materials(struct aws_cryptosdk_session *session, struct aws_cryptosdk_enc_materials **materials) {
+    bool ready;
+
+    *materials = NULL;
+
+    if (!session->on_ready) {
+        fill_request(&session->enc_request, session);
+        AWS_CRYPTOSDK_PROBE1(cmm_generate_start, session);
+        int rv = aws_cryptosdk_cmm_generate_enc_materials(session->cmm, materials, &session->enc_request);
+        AWS_CRYPTOSDK_PROBE2(cmm_generate_end, session, rv ? aws_last_error() : 0);
+        reclaim_spare_materials(session);
+        return rv;
+    }
+
+    if (!session->async_requested) {
+        fill_request(&session->enc_request, session);
+        session->async_requested = true;
+
+        // The matching end probe fires when the CMM calls back; see aws_cryptosdk_priv_enc_materials_ready
+        AWS_CRYPTOSDK_PROBE1(cmm_generate_start, session);
+        if (aws_cryptosdk_cmm_generate_enc_materials_async(
+                session->cmm, &session->enc_request, aws_cryptosdk_priv_enc_materials_ready, session)) {
+            AWS_CRYPTOSDK_PROBE2(cmm_generate_end, session, aws_last_error());
+            reclaim_spare_materials(session);
+            session->async_requested = false;
+            return AWS_OP_ERR;
+        }
+        reclaim_spare_materials(session);
+    }
+
+    if (aws_cryptosdk_priv_session_poll_async(session, &ready)) return AWS_OP_ERR;
+
+    if (ready) {
+        *materials                   = session->async_enc_materials;
+        session->async_enc_materials = NULL;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
 int aws_cryptosdk_priv_try_gen_key(struct aws_cryptosdk_session *session) {
-    struct aws_cryptosdk_enc_request request;
     struct aws_cryptosdk_enc_materials *materials = NULL;
     struct data_key data_key;
     int result = AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN;
 
-    request.alloc   = session->alloc;
-    request.enc_ctx = &session->header.enc_ctx;
-    // The default CMM will fill this in.
-    request.requested_alg  = 0;
-    request.plaintext_size = session->precise_size_known ? session->precise_size : session->size_bound;
-
-    if (aws_cryptosdk_cmm_generate_enc_materials(session->cmm, &materials, &request)) {
+    if (get_materials(session, &materials)) {
         goto rethrow;
     }
 
+    if (!materials) {
+        // Still waiting on the CMM; we'll be called again once it's done
+        return AWS_OP_SUCCESS;
+    }
+
     // Perform basic validation of the materials generated
     session->alg_props = aws_cryptosdk_alg_props(materials->alg);
 
@@ -87,7 +152,16 @@ int aws_cryptosdk_priv_try_gen_key(struct aws_cryptosdk_session *session) {
         goto out;
     }
 
-    if (aws_cryptosdk_derive_key(session->alg_props, &session->content_key, &data_key, session->header.message_id)) {
+    if (aws_cryptosdk_priv_session_derive_key(session, &data_key)) {
+        goto rethrow;
+    }
+
+    if (aws_cryptosdk_cipher_ctx_init(
+            &session->body_cipher,
+            aws_cryptosdk_priv_session_gcm_provider(session),
+            session->alg_props,
+            session->content_key,
+            true)) {
         goto rethrow;
     }
 
@@ -95,7 +169,7 @@ int aws_cryptosdk_priv_try_gen_key(struct aws_cryptosdk_session *session) {
         goto rethrow;
     }
 
-    if (sign_header(session)) {
+    if (sign_header(session, &materials->header_template)) {
         goto rethrow;
     }
 
@@ -108,8 +182,12 @@ rethrow:
     result = AWS_OP_ERR;
 cleanup:
     if (materials) {
-        aws_byte_buf_secure_zero(&materials->unencrypted_data_key);
-        aws_cryptosdk_enc_materials_destroy(materials);
+        if (materials->alloc == session->alloc) {
+            aws_cryptosdk_enc_materials_recycle(&session->spare_enc_materials, materials);
+        } else {
+            aws_byte_buf_secure_zero(&materials->unencrypted_data_key);
+            aws_cryptosdk_enc_materials_destroy(materials);
+        }
     }
 
     aws_secure_zero(&data_key, sizeof(data_key));
@@ -117,47 +195,110 @@ cleanup:
     return result;
 }
 
+/* Picks the frame size for adaptive frame sizing; see aws_cryptosdk_session_set_adaptive_frame_size */
+static uint64_t adaptive_frame_size(const struct aws_cryptosdk_session *session) {
+    const struct aws_cryptosdk_alg_properties *props = session->alg_props;
+    uint64_t size       = session->precise_size_known ? session->precise_size : session->size_bound;
+    uint64_t frame_size = MAX_ADAPTIVE_FRAME_SIZE;
+    size_t workers      = session->worker_threads;
+
+    // A tiny message is cheapest as a single block; compressed and indexed messages need frames
+    if (session->precise_size_known && session->precise_size <= MAX_ADAPTIVE_UNFRAMED_SIZE && !session->codec &&
+        !session->frame_index_out) {
+        return 0;
+    }
+
+    // A batch of one frame per worker should fit in the output buffer, if we know its size
+    size_t per_worker = session->output_capacity / workers;
+    while (frame_size > MIN_ADAPTIVE_FRAME_SIZE && per_worker &&
+           aws_cryptosdk_priv_frame_ciphertext_size(props, FRAME_TYPE_FRAME, (size_t)frame_size) > per_worker) {
+        frame_size /= 2;
+    }
+
+    // Give every worker a frame of the message
+    while (workers > 1 && frame_size > MIN_ADAPTIVE_FRAME_SIZE && size / frame_size < workers) {
+        frame_size /= 2;
+    }
+
+    // A message shorter than a frame goes in a single final frame, sized in whole pages
+    if (size < frame_size) {
+        frame_size = (size / MIN_ADAPTIVE_FRAME_SIZE + 1) * MIN_ADAPTIVE_FRAME_SIZE;
+    }
+
+    return frame_size;
+}
+
 static int build_header(struct aws_cryptosdk_session *session, struct aws_cryptosdk_enc_materials *materials) {
     session->header.alg_id = session->alg_props->alg_id;
+    if (session->adaptive_frame_size) {
+        session->frame_size = adaptive_frame_size(session);
+    } else if (session->frame_block_size) {
+        // Leave room in each block for the frame's sequence number, IV and tag
+        session->frame_size = session->frame_block_size -
+                              aws_cryptosdk_priv_frame_ciphertext_size(session->alg_props, FRAME_TYPE_FRAME, 0);
+    }
     if (session->frame_size > UINT32_MAX) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
     }
     session->header.frame_len = (uint32_t)session->frame_size;
 
-    // Swap the materials' EDK list for the header's. Note that these both use the session allocator
-    // (aws_array_list_swap_contents requires that both lists use the same allocator).
-    // When we clean up the materials structure we'll destroy the old EDK list.
-
-    aws_array_list_swap_contents(&session->header.edk_list, &materials->encrypted_data_keys);
+    // The header should have been cleared earlier, so it should have zero EDKs.
+    assert(aws_array_list_length(&session->header.edk_list) == 0);
 
-    // The header should have been cleared earlier, so the materials structure should have
-    // zero EDKs (otherwise we'd need to destroy the old EDKs as well).
-    assert(aws_array_list_length(&materials->encrypted_data_keys) == 0);
+    // Move the EDKs from the materials into the header's list, rather than swapping lists, so that
+    // the header's list storage is reused across session resets. We reserve space first so that
+    // the transfer itself cannot fail partway through and leave EDKs owned by both lists.
+    size_t num_edks = aws_array_list_length(&materials->encrypted_data_keys);
+    if (num_edks && aws_array_list_ensure_capacity(&session->header.edk_list, num_edks - 1)) {
+        return AWS_OP_ERR;
+    }
+    if (aws_cryptosdk_transfer_list(&session->header.edk_list, &materials->encrypted_data_keys)) {
+        return AWS_OP_ERR;
+    }
+    // Any EDKs borrowed from a snapshot now live in the header, so it must outlive the materials
+    session->edk_snapshot = materials->snapshot;
+    materials->snapshot   = NULL;
 
-    if (aws_byte_buf_init(&session->header.iv, session->alloc, session->alg_props->iv_len)) {
+    if (aws_cryptosdk_byte_buf_reinit(&session->header.iv, session->header.alloc, session->alg_props->iv_len)) {
         return AWS_OP_ERR;
     }
     aws_secure_zero(session->header.iv.buffer, session->alg_props->iv_len);
-    session->header.iv.len = session->header.iv.capacity;
+    session->header.iv.len = session->alg_props->iv_len;
 
-    if (aws_byte_buf_init(&session->header.auth_tag, session->alloc, session->alg_props->tag_len)) {
+    if (aws_cryptosdk_byte_buf_reinit(&session->header.auth_tag, session->header.alloc, session->alg_props->tag_len)) {
         return AWS_OP_ERR;
     }
-    session->header.auth_tag.len = session->header.auth_tag.capacity;
+    session->header.auth_tag.len = session->alg_props->tag_len;
 
     return AWS_OP_SUCCESS;
 }
 
-static int sign_header(struct aws_cryptosdk_session *session) {
-    session->header_size = aws_cryptosdk_hdr_size(&session->header);
+/*
+ * Serializes and signs the header. If the CMM supplied a header template, it is used in place of
+ * the encryption context and EDK sections, so that only the fixed fields need to be written.
+ */
+static int sign_header(struct aws_cryptosdk_session *session, const struct aws_byte_buf *header_template) {
+    bool use_template = header_template->len != 0;
+
+    // The frozen serialization only stands in for the context if no CMM has modified it
+    if (!use_template && session->frozen_enc_ctx &&
+        aws_cryptosdk_frozen_enc_ctx_matches(session->frozen_enc_ctx, &session->header.enc_ctx)) {
+        session->header.serialized_enc_ctx = aws_cryptosdk_frozen_enc_ctx_serialized(session->frozen_enc_ctx);
+    }
+
+    if (use_template) {
+        session->header_size = aws_cryptosdk_hdr_size_with_fields(&session->header, header_template->len);
+    } else {
+        session->header_size = aws_cryptosdk_hdr_size(&session->header);
+    }
 
     if (session->header_size == 0) {
         // EDK field lengths resulted in size_t overflow
         return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
     }
 
-    if (!(session->header_copy = aws_mem_acquire(session->alloc, session->header_size))) {
-        return aws_raise_error(AWS_ERROR_OOM);
+    if (aws_cryptosdk_priv_reserve_header_copy(session)) {
+        return AWS_OP_ERR;
     }
 
     // Debug memsets - if something goes wrong below this makes it easier to
@@ -168,7 +309,17 @@ static int sign_header(struct aws_cryptosdk_session *session) {
     memset(session->header.auth_tag.buffer, 0xDE, session->header.auth_tag.len);
 
     size_t actual_size;
-    int rv = aws_cryptosdk_hdr_write(&session->header, &actual_size, session->header_copy, session->header_size);
+    int rv;
+    if (use_template) {
+        rv = aws_cryptosdk_hdr_write_with_fields(
+            &session->header,
+            aws_byte_cursor_from_buf(header_template),
+            &actual_size,
+            session->header_copy,
+            session->header_size);
+    } else {
+        rv = aws_cryptosdk_hdr_write(&session->header, &actual_size, session->header_copy, session->header_size);
+    }
     if (rv) return AWS_OP_ERR;
     if (actual_size != session->header_size) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
@@ -179,19 +330,13 @@ static int sign_header(struct aws_cryptosdk_session *session) {
     struct aws_byte_buf authtag =
         aws_byte_buf_from_array(session->header_copy + session->header_size - authtag_len, authtag_len);
 
-    rv = aws_cryptosdk_sign_header(session->alg_props, &session->content_key, &authtag, &to_sign);
+    // The IV and auth tag are written in place, which completes the serialized header
+    rv = aws_cryptosdk_sign_header_with_ctx(&session->body_cipher, &authtag, &to_sign);
     if (rv) return AWS_OP_ERR;
 
     memcpy(session->header.iv.buffer, authtag.buffer, session->header.iv.len);
     memcpy(session->header.auth_tag.buffer, authtag.buffer + session->header.iv.len, session->header.auth_tag.len);
 
-    // Re-serialize the header now that we know the auth tag
-    rv = aws_cryptosdk_hdr_write(&session->header, &actual_size, session->header_copy, session->header_size);
-    if (rv) return AWS_OP_ERR;
-    if (actual_size != session->header_size) {
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
-    }
-
     if (session->signctx &&
         aws_cryptosdk_sig_update(
             session->signctx, aws_byte_cursor_from_array(session->header_copy, session->header_size))) {
@@ -214,6 +359,12 @@ int aws_cryptosdk_priv_try_write_header(struct aws_cryptosdk_session *session, s
 
     // TODO - should we try to write incrementally?
     if (aws_byte_buf_write(output, session->header_copy, session->header_size)) {
+        struct aws_byte_buf *index = session->frame_index_out;
+
+        if (index && aws_cryptosdk_priv_frame_index_write_prefix(index, &session->header, session->header_size)) {
+            return AWS_OP_ERR;
+        }
+
         aws_cryptosdk_priv_session_change_state(session, ST_ENCRYPT_BODY);
     }
 
@@ -222,14 +373,28 @@ int aws_cryptosdk_priv_try_write_header(struct aws_cryptosdk_session *session, s
     return AWS_OP_SUCCESS;
 }
 
-int aws_cryptosdk_priv_try_encrypt_body(
+/*
+ * Serializes the header of the next frame into *output and reserves its plaintext from *input,
+ * filling in *job so that the frame can be encrypted later. Sets *prepared to indicate whether
+ * a frame was set up; if there is not enough input or output space this returns success
+ * without touching either buffer, leaving the session's size estimates set for the frame we
+ * were trying to produce.
+ *
+ * The session's sequence number and data counters advance as soon as the frame is prepared;
+ * if its encryption later fails, the session enters the error state regardless.
+ */
+static int prepare_frame(
     struct aws_cryptosdk_session *AWS_RESTRICT session,
     struct aws_byte_buf *AWS_RESTRICT poutput,
-    struct aws_byte_cursor *AWS_RESTRICT pinput) {
+    struct aws_byte_cursor *AWS_RESTRICT pinput,
+    struct aws_cryptosdk_frame_job *job,
+    bool *prepared) {
     /* First, figure out how much plaintext we need. */
     size_t plaintext_size;
     enum aws_cryptosdk_frame_type frame_type;
 
+    *prepared = false;
+
     if (session->frame_size) {
         /* This is a framed message; is it the last frame? */
         if (session->precise_size_known && session->precise_size - session->data_so_far < session->frame_size) {
@@ -253,34 +418,53 @@ int aws_cryptosdk_priv_try_encrypt_body(
 
     /*
      * We'll use a shadow copy of the cursors; this lets us avoid modifying the
-     * output if the input is too small, and vice versa.
+     * output if the input is too small, and vice versa. The output shadow covers only
+     * the unused space, as serialize_frame clears the whole buffer it is given on failure
+     * and we must not wipe frames already written earlier in this batch.
      */
-    struct aws_byte_buf output   = *poutput;
+    struct aws_byte_buf output =
+        aws_byte_buf_from_empty_array(poutput->buffer + poutput->len, poutput->capacity - poutput->len);
     struct aws_byte_cursor input = *pinput;
 
-    struct aws_cryptosdk_frame frame;
+    struct aws_cryptosdk_frame *frame = &job->frame;
     size_t ciphertext_size;
 
-    frame.type = frame_type;
+    frame->type = frame_type;
     if (session->frame_seqno > UINT32_MAX) {
         return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
     }
-    frame.sequence_number = session->frame_seqno;
+    frame->sequence_number = session->frame_seqno;
+
+    if (session->in_place) {
+        /*
+         * The frame header and tag may only be written into the headroom between the output
+         * and the unconsumed plaintext, so check the frame's expansion fits before we write
+         * anything. A trial serialization into an empty buffer tells us the frame's size.
+         */
+        struct aws_byte_buf empty = aws_byte_buf_from_empty_array(output.buffer, 0);
+        aws_cryptosdk_try_serialize_frame(frame, &ciphertext_size, plaintext_size, &empty, session->alg_props);
+
+        size_t headroom = (size_t)(input.ptr - output.buffer);
+        if (headroom < ciphertext_size - plaintext_size) {
+            session->output_size_estimate = ciphertext_size;
+            session->input_size_estimate  = plaintext_size;
+            return AWS_OP_SUCCESS;
+        }
+    }
 
-    int rv = aws_cryptosdk_serialize_frame(&frame, &ciphertext_size, plaintext_size, &output, session->alg_props);
+    int rv = aws_cryptosdk_try_serialize_frame(frame, &ciphertext_size, plaintext_size, &output, session->alg_props);
 
     session->output_size_estimate = ciphertext_size;
     session->input_size_estimate  = plaintext_size;
 
+    if (rv == AWS_CRYPTOSDK_NEED_MORE) {
+        // The ciphertext buffer was too small. We've updated estimates;
+        // just return without doing any work.
+        return AWS_OP_SUCCESS;
+    }
     if (rv) {
-        if (aws_last_error() == AWS_ERROR_SHORT_BUFFER) {
-            // The ciphertext buffer was too small. We've updated estimates;
-            // just return without doing any work.
-            return AWS_OP_SUCCESS;
-        } else {
-            // Some kind of validation failed?
-            return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
-        }
+        // Some kind of validation failed?
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
     }
 
     struct aws_byte_cursor plaintext = aws_byte_cursor_advance(&input, plaintext_size);
@@ -290,28 +474,114 @@ int aws_cryptosdk_priv_try_encrypt_body(
         return AWS_OP_SUCCESS;
     }
 
-    if (aws_cryptosdk_encrypt_body(
-            session->alg_props,
-            &frame.ciphertext,
-            &plaintext,
-            session->header.message_id,
-            frame.sequence_number,
-            frame.iv.buffer,
-            &session->content_key,
-            frame.authtag.buffer,
-            frame.type)) {
-        // Something terrible happened. Clear the ciphertext buffer and error out.
-        aws_byte_buf_secure_zero(poutput);
-        return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+    if (session->in_place) {
+        // Slide the plaintext down into the ciphertext slot and encrypt it there
+        memmove(frame->ciphertext.buffer, plaintext.ptr, plaintext.len);
+        plaintext.ptr = frame->ciphertext.buffer;
+    }
+
+    job->input         = plaintext;
+    job->output        = frame->ciphertext;
+    job->in_place_dest = NULL;
+    job->serialized    = aws_byte_cursor_from_array(output.buffer, output.len);
+    job->error         = AWS_ERROR_SUCCESS;
+
+    // Success! Write back our input/output cursors now, and update our state.
+    *pinput = input;
+    poutput->len += output.len;
+    session->data_so_far += plaintext_size;
+    session->frame_seqno++;
+    *prepared = true;
+
+    if (frame->type != FRAME_TYPE_FRAME) {
+        // We've written a final frame, move on to the trailer
+        aws_cryptosdk_priv_session_change_state(session, ST_WRITE_TRAILER);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/*
+ * Appends the index records of the given (encrypted) frames to the session's frame index.
+ */
+static int index_frames(
+    struct aws_cryptosdk_session *session, const struct aws_cryptosdk_frame_job *jobs, size_t num_jobs) {
+    const struct aws_cryptosdk_alg_properties *props = session->alg_props;
+    uint64_t frame_len = aws_cryptosdk_priv_frame_ciphertext_size(props, FRAME_TYPE_FRAME, (size_t)session->frame_size);
+
+    for (size_t i = 0; i < num_jobs; i++) {
+        const struct aws_cryptosdk_frame *frame = &jobs[i].frame;
+
+        // Every frame before this one is a regular frame (and an unframed body follows the header)
+        uint64_t offset = session->header_size + (uint64_t)(frame->sequence_number - 1) * frame_len;
+        size_t len      = aws_cryptosdk_priv_frame_ciphertext_size(props, frame->type, jobs[i].input.len);
+
+        if (aws_cryptosdk_priv_frame_index_append(
+                session->frame_index_out, frame->sequence_number, offset, len, frame->authtag.buffer)) {
+            return AWS_OP_ERR;
+        }
     }
 
-    if (session->signctx) {
-        // Note that the 'output' buffer contains only our ciphertext; we need to keep track of the frame
-        // headers as well
+    return AWS_OP_SUCCESS;
+}
+
+int aws_cryptosdk_priv_try_encrypt_body(
+    struct aws_cryptosdk_session *AWS_RESTRICT session,
+    struct aws_byte_buf *AWS_RESTRICT poutput,
+    struct aws_byte_cursor *AWS_RESTRICT pinput) {
+    /*
+     * Encrypt as many frames as the input and output buffers allow in one pass, rather than
+     * returning to the session state machine after each frame. Frame headers are serialized
+     * up front in sequence order, after which the frame bodies can be encrypted independently
+     * (and, with worker threads configured, concurrently). The frames are laid out contiguously
+     * in the output buffer, so the trailing signature can be updated once over the whole span;
+     * or, with a pipelined signature, batch by batch on a helper thread.
+     */
+    struct aws_cryptosdk_frame_job jobs[MAX_FRAME_JOBS];
+    size_t batch_limit           = aws_cryptosdk_priv_frame_batch_limit(session);
+    struct aws_byte_buf output   = *poutput;
+    struct aws_byte_cursor input = *pinput;
+    bool pipelined               = session->signctx && session->pipelined_signature;
+    struct aws_cryptosdk_sig_pipeline sig_pipeline;
+    size_t num_jobs;
+
+    // Frames encrypted one at a time are digested as they are encrypted, in a single pass
+    struct aws_cryptosdk_sig_ctx *stitch_signctx = batch_limit == 1 && !pipelined ? session->signctx : NULL;
+
+    if (pipelined) aws_cryptosdk_priv_sig_pipeline_start(&sig_pipeline, session->alloc, session->signctx);
 
-        uint8_t *original_start = poutput->buffer + poutput->len;
-        uint8_t *current_end    = output.buffer + output.len;
+    do {
+        bool prepared        = false;
+        uint8_t *batch_start = output.buffer + output.len;
 
+        for (num_jobs = 0; num_jobs < batch_limit && session->state == ST_ENCRYPT_BODY; num_jobs++) {
+            if (prepare_frame(session, &output, &input, &jobs[num_jobs], &prepared)) goto error;
+            if (!prepared) break;
+        }
+
+        if (num_jobs && aws_cryptosdk_priv_run_frame_jobs(session, jobs, num_jobs, stitch_signctx)) {
+            aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+            goto error;
+        }
+
+        if (num_jobs && session->frame_index_out && index_frames(session, jobs, num_jobs)) goto error;
+
+        if (pipelined && output.buffer + output.len != batch_start) {
+            aws_cryptosdk_priv_sig_pipeline_push(
+                &sig_pipeline, aws_byte_cursor_from_array(batch_start, output.buffer + output.len - batch_start));
+        }
+    } while (num_jobs == batch_limit && session->state == ST_ENCRYPT_BODY);
+
+    // Note that the 'output' buffer contains frame headers as well as ciphertext; all of it must be signed
+    uint8_t *original_start = poutput->buffer + poutput->len;
+    uint8_t *current_end    = output.buffer + output.len;
+
+    if (pipelined) {
+        if (aws_cryptosdk_priv_sig_pipeline_finish(&sig_pipeline)) {
+            aws_secure_zero(original_start, current_end - original_start);
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+        }
+    } else if (session->signctx && !stitch_signctx && current_end != original_start) {
         struct aws_byte_cursor to_sign = aws_byte_cursor_from_array(original_start, current_end - original_start);
 
         if (aws_cryptosdk_sig_update(session->signctx, to_sign)) {
@@ -321,18 +591,23 @@ int aws_cryptosdk_priv_try_encrypt_body(
         }
     }
 
-    // Success! Write back our input/output cursors now, and update our state.
     *pinput  = input;
     *poutput = output;
-    session->data_so_far += plaintext_size;
-    session->frame_seqno++;
 
-    if (frame.type != FRAME_TYPE_FRAME) {
-        // We've written a final frame, move on to the trailer
-        aws_cryptosdk_priv_session_change_state(session, ST_WRITE_TRAILER);
+    return AWS_OP_SUCCESS;
+
+error:
+    // The helper thread may still be reading the output, so stop it first
+    if (pipelined) {
+        int error_code = aws_last_error();
+        aws_cryptosdk_priv_sig_pipeline_finish(&sig_pipeline);
+        aws_raise_error(error_code);
     }
 
-    return AWS_OP_SUCCESS;
+    // Something terrible happened. Clear the ciphertext buffer and error out.
+    aws_byte_buf_secure_zero(&output);
+    *poutput = output;
+    return AWS_OP_ERR;
 }
 
 int aws_cryptosdk_priv_write_trailer(
@@ -384,3 +659,47 @@ int aws_cryptosdk_priv_write_trailer(
 
     return rv;
 }
+
+int aws_cryptosdk_priv_encrypt_output_size(const struct aws_cryptosdk_session *session, uint64_t *size) {
+    const struct aws_cryptosdk_alg_properties *props = session->alg_props;
+    uint64_t total, body;
+
+    if (!props || !session->header_size || !session->precise_size_known) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    if (session->frame_size) {
+        uint64_t full_frames = session->precise_size / session->frame_size;
+        size_t final_size    = (size_t)(session->precise_size % session->frame_size);
+
+        if (full_frames >= MAX_FRAMES) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        }
+
+        size_t frame_len =
+            aws_cryptosdk_priv_frame_ciphertext_size(props, FRAME_TYPE_FRAME, (size_t)session->frame_size);
+        size_t final_len = aws_cryptosdk_priv_frame_ciphertext_size(props, FRAME_TYPE_FINAL, final_size);
+
+        if (aws_mul_u64_checked(full_frames, frame_len, &body) || aws_add_u64_checked(body, final_len, &body)) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        }
+    } else {
+        if (session->precise_size > MAX_UNFRAMED_PLAINTEXT_SIZE) {
+            return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        }
+        body = aws_cryptosdk_priv_frame_ciphertext_size(props, FRAME_TYPE_SINGLE, (size_t)session->precise_size);
+    }
+
+    if (aws_add_u64_checked(session->header_size, body, &total)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    }
+
+    if (props->signature_len) {
+        // 16-bit signature length, then the signature itself
+        total += 2 + props->signature_len;
+    }
+
+    *size = total;
+
+    return AWS_OP_SUCCESS;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/mutex.h>
+#include <aws/cryptosdk/materials.h>
+#include <aws/cryptosdk/private/utils.h>
+#include <aws/cryptosdk/session_pool.h>
+
+/* Number of freelists; threads are spread over them by a hash of their IDs */
+#define POOL_FREELISTS 16
+
+struct freelist {
+    struct aws_mutex mutex;
+    size_t count;
+    /* Idle sessions, max_idle_per_list of them at most */
+    struct aws_cryptosdk_session **sessions;
+};
+
+struct aws_cryptosdk_session_pool {
+    struct aws_allocator *alloc;
+    enum aws_cryptosdk_mode mode;
+    struct aws_cryptosdk_cmm *cmm;
+    size_t max_idle_per_list;
+    aws_cryptosdk_session_pool_configure_fn *configure;
+    void *configure_user_data;
+    struct freelist freelists[POOL_FREELISTS];
+    /* Backs the sessions arrays of all freelists */
+    struct aws_cryptosdk_session **storage;
+};
+
+struct aws_cryptosdk_session_pool *aws_cryptosdk_session_pool_new(
+    struct aws_allocator *alloc,
+    enum aws_cryptosdk_mode mode,
+    struct aws_cryptosdk_cmm *cmm,
+    size_t max_idle_per_list,
+    aws_cryptosdk_session_pool_configure_fn *configure,
+    void *configure_user_data) {
+    if ((mode != AWS_CRYPTOSDK_ENCRYPT && mode != AWS_CRYPTOSDK_DECRYPT) ||
+        max_idle_per_list > SIZE_MAX / POOL_FREELISTS) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct aws_cryptosdk_session_pool *pool = aws_mem_calloc(alloc, 1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+
+    if (max_idle_per_list) {
+        pool->storage = aws_mem_calloc(alloc, POOL_FREELISTS * max_idle_per_list, sizeof(*pool->storage));
+        if (!pool->storage) {
+            aws_mem_release(alloc, pool);
+            return NULL;
+        }
+    }
+
+    size_t initialized = 0;
+    for (; initialized < POOL_FREELISTS; initialized++) {
+        struct freelist *list = &pool->freelists[initialized];
+        if (aws_mutex_init(&list->mutex)) {
+            break;
+        }
+        list->sessions = pool->storage ? pool->storage + initialized * max_idle_per_list : NULL;
+    }
+    if (initialized < POOL_FREELISTS) {
+        while (initialized--) {
+            aws_mutex_clean_up(&pool->freelists[initialized].mutex);
+        }
+        if (pool->storage) {
+            aws_mem_release(alloc, pool->storage);
+        }
+        aws_mem_release(alloc, pool);
+        return NULL;
+    }
+
+    pool->alloc               = alloc;
+    pool->mode                = mode;
+    pool->cmm                 = aws_cryptosdk_cmm_retain(cmm);
+    pool->max_idle_per_list   = max_idle_per_list;
+    pool->configure           = configure;
+    pool->configure_user_data = configure_user_data;
+
+    return pool;
+}
+
+void aws_cryptosdk_session_pool_destroy(struct aws_cryptosdk_session_pool *pool) {
+    if (!pool) {
+        return;
+    }
+
+    for (size_t i = 0; i < POOL_FREELISTS; i++) {
+        struct freelist *list = &pool->freelists[i];
+        while (list->count) {
+            aws_cryptosdk_session_destroy(list->sessions[--list->count]);
+        }
+        aws_mutex_clean_up(&list->mutex);
+    }
+
+    aws_cryptosdk_cmm_release(pool->cmm);
+    if (pool->storage) {
+        aws_mem_release(pool->alloc, pool->storage);
+    }
+    aws_mem_release(pool->alloc, pool);
+}
+
+static struct freelist *freelist_for_current_thread(struct aws_cryptosdk_session_pool *pool) {
+    return &pool->freelists[aws_cryptosdk_current_thread_hash() % POOL_FREELISTS];
+}
+
+static struct aws_cryptosdk_session *pop_idle(struct freelist *list) {
+    struct aws_cryptosdk_session *session = NULL;
+
+    aws_mutex_lock(&list->mutex);
+    if (list->count) {
+        session = list->sessions[--list->count];
+    }
+    aws_mutex_unlock(&list->mutex);
+
+    return session;
+}
+
+struct aws_cryptosdk_session *aws_cryptosdk_session_pool_acquire(struct aws_cryptosdk_session_pool *pool) {
+    struct freelist *own                  = freelist_for_current_thread(pool);
+    struct aws_cryptosdk_session *session = pop_idle(own);
+
+    /* Before creating a session, look for one left idle by threads that hash elsewhere */
+    for (size_t i = 1; !session && i < POOL_FREELISTS; i++) {
+        session = pop_idle(&pool->freelists[(own - pool->freelists + i) % POOL_FREELISTS]);
+    }
+    if (session) {
+        return session;
+    }
+
+    /* The pool's own reference outlives its sessions */
+    session = aws_cryptosdk_session_new_borrowing_cmm(pool->alloc, pool->mode, pool->cmm);
+    if (session && pool->configure && pool->configure(session, pool->configure_user_data)) {
+        aws_cryptosdk_session_destroy(session);
+        return NULL;
+    }
+
+    return session;
+}
+
+void aws_cryptosdk_session_pool_release(
+    struct aws_cryptosdk_session_pool *pool, struct aws_cryptosdk_session *session) {
+    if (!session) {
+        return;
+    }
+
+    if (aws_cryptosdk_session_reset(session, pool->mode)) {
+        aws_reset_error();
+        aws_cryptosdk_session_destroy(session);
+        return;
+    }
+
+    struct freelist *list = freelist_for_current_thread(pool);
+    bool kept             = false;
+
+    aws_mutex_lock(&list->mutex);
+    if (list->count < pool->max_idle_per_list) {
+        list->sessions[list->count++] = session;
+        kept                          = true;
+    }
+    aws_mutex_unlock(&list->mutex);
+
+    if (!kept) {
+        aws_cryptosdk_session_destroy(session);
+    }
+}
@@ -0,0 +1,774 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/cache.h>
+
+#ifndef _WIN32
+
+#    include <aws/cryptosdk/cipher.h>
+#    include <aws/cryptosdk/private/cache_serialize.h>
+#    include <aws/cryptosdk/private/cipher.h>
+#    include <aws/cryptosdk/private/secure_pool.h>
+
+#    include <aws/common/byte_buf.h>
+#    include <aws/common/clock.h>
+#    include <aws/common/math.h>
+
+#    include <assert.h>
+#    include <errno.h>
+#    include <pthread.h>
+#    include <string.h>
+#    include <sys/mman.h>
+
+/*
+ * A cache ID is stored in the first free or least recently used of PROBE_SLOTS consecutive slots
+ * from its home slot, so a lookup only ever inspects that many slots.
+ */
+#    define PROBE_SLOTS 8
+#    define SLOT_ALIGN 64
+#    define MIN_SLOT_SIZE 512
+#    define MAX_CACHE_ID_LEN AWS_CRYPTOSDK_MD_MAX_SIZE
+#    define NO_EXPIRY UINT64_MAX
+
+enum slot_state {
+    SLOT_EMPTY = 0,
+    /* Set while a slot is rewritten, so that a slot left half written by a crashed process is discarded */
+    SLOT_WRITING,
+    SLOT_ENCRYPT,
+    SLOT_DECRYPT
+};
+
+/*
+ * A slot of the shared segment. Each is slot_size bytes long, the remainder after this header
+ * holding the serialized materials; see cache_serialize.c for the layout.
+ */
+struct shm_slot {
+    uint32_t state;
+    /* Changed whenever the slot is filled or emptied, so that stale entry handles can be detected */
+    uint64_t generation;
+    uint64_t last_used;
+    uint64_t creation_time, expiry_time;
+    uint64_t usage_messages, usage_bytes;
+    size_t cache_id_len;
+    uint8_t cache_id[MAX_CACHE_ID_LEN];
+    size_t payload_len;
+    uint8_t payload[];
+};
+
+/* The start of the shared segment, followed by the slots */
+struct shm_segment {
+    /* Process-shared (and on Linux, robust) mutex protecting the whole segment */
+    pthread_mutex_t mutex;
+    /* Advanced by every hit and insertion, to order slots by last use */
+    uint64_t use_counter;
+    /* Counters for aws_cryptosdk_materials_cache_get_stats; entries and bytes are computed on demand */
+    struct aws_cryptosdk_materials_cache_stats stats;
+};
+
+/*
+ * The process-local part of the cache. Each process which inherits the cache has its own copy of
+ * this structure and its own reference count, but they all map the same segment.
+ */
+struct shm_cache {
+    struct aws_cryptosdk_materials_cache base;
+    struct aws_allocator *alloc;
+
+    uint8_t *map;
+    size_t map_len;
+    struct shm_segment *segment;
+    uint8_t *slots;
+    size_t num_slots, slot_size;
+
+    int (*clock_get_ticks)(uint64_t *timestamp);
+};
+
+/*
+ * Entry handles hold a private copy of the slot's materials, so they remain usable however the
+ * slot changes; the slot index and generation are only used to update or invalidate the entry.
+ */
+struct shm_cache_entry {
+    size_t slot;
+    uint64_t generation;
+    uint64_t creation_time;
+    bool is_encrypt;
+    /* Taken from the secure key allocator, as it includes the data key */
+    struct aws_byte_buf payload;
+};
+
+static struct shm_slot *get_slot(const struct shm_cache *cache, size_t index) {
+    return (struct shm_slot *)(cache->slots + index * cache->slot_size);
+}
+
+static size_t payload_capacity(const struct shm_cache *cache) {
+    return cache->slot_size - sizeof(struct shm_slot);
+}
+
+static bool slot_occupied(const struct shm_slot *slot) {
+    return slot->state == SLOT_ENCRYPT || slot->state == SLOT_DECRYPT;
+}
+
+static bool slot_matches(const struct shm_slot *slot, const struct aws_byte_buf *cache_id) {
+    return slot_occupied(slot) && slot->cache_id_len == cache_id->len &&
+           !memcmp(slot->cache_id, cache_id->buffer, cache_id->len);
+}
+
+static size_t home_slot(const struct shm_cache *cache, const struct aws_byte_buf *cache_id) {
+    uint64_t mixed = 0;
+
+    /* As in the local cache, the leading bytes of cache IDs are already a hash; mix them anyway */
+    memcpy(&mixed, cache_id->buffer, cache_id->len < sizeof(mixed) ? cache_id->len : sizeof(mixed));
+    mixed ^= mixed >> 32;
+    mixed *= 0x9E3779B97F4A7C15ull;
+
+    return (size_t)((mixed >> 32) % cache->num_slots);
+}
+
+static size_t probe_window(const struct shm_cache *cache) {
+    return cache->num_slots < PROBE_SLOTS ? cache->num_slots : PROBE_SLOTS;
+}
+
+/********** Segment locking **********/
+
+/*
+ * Note: locked_* functions must be invoked while holding the segment mutex.
+ */
+
+static void locked_free_slot(struct shm_slot *slot) {
+    aws_secure_zero(slot->payload, slot->payload_len);
+    slot->state        = SLOT_EMPTY;
+    slot->payload_len  = 0;
+    slot->cache_id_len = 0;
+    slot->generation++;
+}
+
+/* Discards any slot which a process was part way through writing when it died */
+static void locked_recover(struct shm_cache *cache) {
+    for (size_t i = 0; i < cache->num_slots; i++) {
+        struct shm_slot *slot = get_slot(cache, i);
+
+        if (slot->state == SLOT_WRITING) {
+            slot->payload_len = payload_capacity(cache);
+            locked_free_slot(slot);
+        }
+    }
+}
+
+static int lock_segment(struct shm_cache *cache) {
+    int err = pthread_mutex_lock(&cache->segment->mutex);
+
+#    ifdef __linux__
+    if (err == EOWNERDEAD) {
+        locked_recover(cache);
+        err = pthread_mutex_consistent(&cache->segment->mutex);
+    }
+#    endif
+
+    return err ? aws_raise_error(AWS_ERROR_MUTEX_FAILED) : AWS_OP_SUCCESS;
+}
+
+static void unlock_segment(struct shm_cache *cache) {
+    if (pthread_mutex_unlock(&cache->segment->mutex)) {
+        /* Failed to release a lock - no recovery is possible */
+        abort();
+    }
+}
+
+/* Returns the index of the slot holding cache_id, or SIZE_MAX */
+static size_t locked_find_slot(const struct shm_cache *cache, const struct aws_byte_buf *cache_id) {
+    size_t home = home_slot(cache, cache_id);
+
+    for (size_t i = 0; i < probe_window(cache); i++) {
+        size_t index = (home + i) % cache->num_slots;
+
+        if (slot_matches(get_slot(cache, index), cache_id)) return index;
+    }
+
+    return SIZE_MAX;
+}
+
+/*
+ * Chooses the slot in which to store cache_id: the slot already holding it, or else the first
+ * free or expired slot of its window, or else the window's least recently used slot.
+ */
+static size_t locked_choose_slot(struct shm_cache *cache, const struct aws_byte_buf *cache_id, uint64_t now) {
+    struct aws_cryptosdk_materials_cache_stats *stats = &cache->segment->stats;
+    size_t existing                                   = locked_find_slot(cache, cache_id);
+    size_t home                                       = home_slot(cache, cache_id);
+    size_t victim                                     = home;
+    uint64_t oldest                                   = UINT64_MAX;
+
+    if (existing != SIZE_MAX) {
+        stats->replacements++;
+        return existing;
+    }
+
+    for (size_t i = 0; i < probe_window(cache); i++) {
+        size_t index          = (home + i) % cache->num_slots;
+        struct shm_slot *slot = get_slot(cache, index);
+
+        if (!slot_occupied(slot) || slot->expiry_time <= now) {
+            victim = index;
+            break;
+        }
+
+        if (slot->last_used < oldest) {
+            oldest = slot->last_used;
+            victim = index;
+        }
+    }
+
+    struct shm_slot *slot = get_slot(cache, victim);
+    if (slot_occupied(slot)) {
+        if (slot->expiry_time <= now) {
+            stats->ttl_evictions++;
+        } else {
+            stats->capacity_evictions++;
+        }
+    }
+
+    return victim;
+}
+
+/********** Shared-memory cache vtable methods **********/
+
+static void destroy_handle(struct shm_cache *cache, struct shm_cache_entry *entry) {
+    if (entry) {
+        aws_byte_buf_clean_up_secure(&entry->payload);
+        aws_mem_release(cache->alloc, entry);
+    }
+}
+
+/* Copies a slot's materials into a new entry handle */
+static struct shm_cache_entry *locked_new_handle(struct shm_cache *cache, size_t index) {
+    struct shm_slot *slot         = get_slot(cache, index);
+    struct shm_cache_entry *entry = aws_mem_acquire(cache->alloc, sizeof(*entry));
+
+    if (!entry) return NULL;
+
+    if (aws_byte_buf_init(&entry->payload, aws_cryptosdk_secure_key_allocator(), slot->payload_len)) {
+        aws_mem_release(cache->alloc, entry);
+        return NULL;
+    }
+
+    aws_byte_buf_write(&entry->payload, slot->payload, slot->payload_len);
+    entry->slot          = index;
+    entry->generation    = slot->generation;
+    entry->creation_time = slot->creation_time;
+    entry->is_encrypt    = slot->state == SLOT_ENCRYPT;
+
+    return entry;
+}
+
+static int find_entry(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **ret_entry,
+    bool *is_encrypt,
+    const struct aws_byte_buf *cache_id) {
+    struct shm_cache *cache                           = (struct shm_cache *)generic_cache;
+    struct aws_cryptosdk_materials_cache_stats *stats = &cache->segment->stats;
+    struct shm_cache_entry *entry                     = NULL;
+    uint64_t now;
+
+    *ret_entry = NULL;
+
+    /* If the clock is broken, entries just don't expire here */
+    if (cache->clock_get_ticks(&now)) {
+        now = 0;
+    }
+
+    if (lock_segment(cache)) {
+        return AWS_OP_ERR;
+    }
+
+    size_t index = cache_id->len <= MAX_CACHE_ID_LEN ? locked_find_slot(cache, cache_id) : SIZE_MAX;
+    if (index != SIZE_MAX && get_slot(cache, index)->expiry_time <= now) {
+        stats->ttl_evictions++;
+        locked_free_slot(get_slot(cache, index));
+        index = SIZE_MAX;
+    }
+
+    if (index == SIZE_MAX) {
+        stats->misses++;
+    } else if ((entry = locked_new_handle(cache, index))) {
+        get_slot(cache, index)->last_used = ++cache->segment->use_counter;
+
+        if (entry->is_encrypt) {
+            stats->encrypt_hits++;
+        } else {
+            stats->decrypt_hits++;
+        }
+    }
+
+    unlock_segment(cache);
+
+    if (index != SIZE_MAX && !entry) {
+        return AWS_OP_ERR;
+    }
+
+    *ret_entry = (struct aws_cryptosdk_materials_cache_entry *)entry;
+    if (entry && is_encrypt) {
+        *is_encrypt = entry->is_encrypt;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+/* Stores a serialized entry, and returns a handle to it which takes ownership of the payload */
+static struct aws_cryptosdk_materials_cache_entry *store_entry(
+    struct shm_cache *cache,
+    enum slot_state state,
+    const struct aws_byte_buf *cache_id,
+    struct aws_byte_buf *payload,
+    struct aws_cryptosdk_cache_usage_stats initial_usage) {
+    struct shm_cache_entry *entry = aws_mem_acquire(cache->alloc, sizeof(*entry));
+    uint64_t now;
+
+    if (!entry || cache->clock_get_ticks(&now) || lock_segment(cache)) {
+        if (entry) aws_mem_release(cache->alloc, entry);
+        return NULL;
+    }
+
+    size_t index          = locked_choose_slot(cache, cache_id, now);
+    struct shm_slot *slot = get_slot(cache, index);
+
+    if (slot_occupied(slot)) {
+        locked_free_slot(slot);
+    }
+
+    slot->state          = SLOT_WRITING;
+    slot->creation_time  = now;
+    slot->expiry_time    = NO_EXPIRY;
+    slot->usage_bytes    = initial_usage.bytes_encrypted;
+    slot->usage_messages = initial_usage.messages_encrypted;
+    slot->last_used      = ++cache->segment->use_counter;
+    slot->cache_id_len   = cache_id->len;
+    memcpy(slot->cache_id, cache_id->buffer, cache_id->len);
+    slot->payload_len = payload->len;
+    memcpy(slot->payload, payload->buffer, payload->len);
+    slot->generation++;
+    slot->state = state;
+
+    if (state == SLOT_ENCRYPT) {
+        cache->segment->stats.encrypt_puts++;
+    } else {
+        cache->segment->stats.decrypt_puts++;
+    }
+
+    entry->slot          = index;
+    entry->generation    = slot->generation;
+    entry->creation_time = now;
+    entry->is_encrypt    = state == SLOT_ENCRYPT;
+
+    unlock_segment(cache);
+
+    entry->payload = *payload;
+    memset(payload, 0, sizeof(*payload));
+
+    return (struct aws_cryptosdk_materials_cache_entry *)entry;
+}
+
+static void put_entry_for_encrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **ret_entry,
+    const struct aws_cryptosdk_enc_materials *materials,
+    struct aws_cryptosdk_cache_usage_stats initial_usage,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_buf *cache_id) {
+    struct shm_cache *cache     = (struct shm_cache *)generic_cache;
+    struct aws_byte_buf payload = { 0 };
+    *ret_entry                  = NULL;
+
+    if (cache_id->len > MAX_CACHE_ID_LEN) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        return;
+    }
+
+    if (aws_byte_buf_init(&payload, aws_cryptosdk_secure_key_allocator(), payload_capacity(cache))) {
+        return;
+    }
+
+    if (!aws_cryptosdk_priv_serialize_enc_materials(cache->alloc, &payload, materials, enc_ctx)) {
+        *ret_entry = store_entry(cache, SLOT_ENCRYPT, cache_id, &payload, initial_usage);
+    }
+
+    aws_byte_buf_clean_up_secure(&payload);
+}
+
+static void put_entry_for_decrypt(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry **ret_entry,
+    const struct aws_cryptosdk_dec_materials *materials,
+    const struct aws_byte_buf *cache_id) {
+    struct shm_cache *cache                     = (struct shm_cache *)generic_cache;
+    struct aws_byte_buf payload                 = { 0 };
+    struct aws_cryptosdk_cache_usage_stats zero = { 0, 0 };
+    *ret_entry                                  = NULL;
+
+    if (cache_id->len > MAX_CACHE_ID_LEN) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+        return;
+    }
+
+    if (aws_byte_buf_init(&payload, aws_cryptosdk_secure_key_allocator(), payload_capacity(cache))) {
+        return;
+    }
+
+    if (!aws_cryptosdk_priv_serialize_dec_materials(cache->alloc, &payload, materials)) {
+        *ret_entry = store_entry(cache, SLOT_DECRYPT, cache_id, &payload, zero);
+    }
+
+    aws_byte_buf_clean_up_secure(&payload);
+}
+
+static int get_enc_materials(
+    struct aws_cryptosdk_materials_cache *cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_enc_materials **materials_out,
+    struct aws_hash_table *enc_ctx,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry) {
+    (void)cache;
+    struct shm_cache_entry *entry = (struct shm_cache_entry *)generic_entry;
+    *materials_out                = NULL;
+
+    if (!entry->is_encrypt) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    return aws_cryptosdk_priv_deserialize_enc_materials(
+        allocator, materials_out, enc_ctx, aws_byte_cursor_from_buf(&entry->payload));
+}
+
+static int get_dec_materials(
+    const struct aws_cryptosdk_materials_cache *cache,
+    struct aws_allocator *allocator,
+    struct aws_cryptosdk_dec_materials **materials_out,
+    const struct aws_cryptosdk_materials_cache_entry *generic_entry) {
+    (void)cache;
+    const struct shm_cache_entry *entry = (const struct shm_cache_entry *)generic_entry;
+    *materials_out                      = NULL;
+
+    if (entry->is_encrypt) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    return aws_cryptosdk_priv_deserialize_dec_materials(
+        allocator, materials_out, aws_byte_cursor_from_buf(&entry->payload));
+}
+
+/* Returns the entry's slot if it still holds the entry, or NULL */
+static struct shm_slot *locked_entry_slot(const struct shm_cache *cache, const struct shm_cache_entry *entry) {
+    struct shm_slot *slot = get_slot(cache, entry->slot);
+
+    return slot_occupied(slot) && slot->generation == entry->generation ? slot : NULL;
+}
+
+static int update_usage_stats(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    struct aws_cryptosdk_cache_usage_stats *usage_stats) {
+    struct shm_cache *cache       = (struct shm_cache *)generic_cache;
+    struct shm_cache_entry *entry = (struct shm_cache_entry *)generic_entry;
+
+    if (!entry->is_encrypt || lock_segment(cache)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    struct shm_slot *slot = locked_entry_slot(cache, entry);
+    if (slot) {
+        // Saturate, so that a wrapped counter cannot reset the entry's budget for every process
+        slot->usage_bytes    = aws_add_u64_saturating(slot->usage_bytes, usage_stats->bytes_encrypted);
+        slot->usage_messages = aws_add_u64_saturating(slot->usage_messages, usage_stats->messages_encrypted);
+        usage_stats->bytes_encrypted    = slot->usage_bytes;
+        usage_stats->messages_encrypted = slot->usage_messages;
+    }
+
+    unlock_segment(cache);
+
+    return slot ? AWS_OP_SUCCESS : aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+}
+
+static int return_usage_stats(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    const struct aws_cryptosdk_cache_usage_stats *usage_stats) {
+    struct shm_cache *cache       = (struct shm_cache *)generic_cache;
+    struct shm_cache_entry *entry = (struct shm_cache_entry *)generic_entry;
+
+    if (!entry->is_encrypt || lock_segment(cache)) {
+        return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    }
+
+    struct shm_slot *slot = locked_entry_slot(cache, entry);
+    if (slot) {
+        // Never below zero, as a saturated counter may hold less than was added to it
+        slot->usage_bytes -= aws_min_u64(slot->usage_bytes, usage_stats->bytes_encrypted);
+        slot->usage_messages -= aws_min_u64(slot->usage_messages, usage_stats->messages_encrypted);
+    }
+
+    unlock_segment(cache);
+
+    return slot ? AWS_OP_SUCCESS : aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+}
+
+static void release_entry(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    bool invalidate) {
+    struct shm_cache *cache       = (struct shm_cache *)generic_cache;
+    struct shm_cache_entry *entry = (struct shm_cache_entry *)generic_entry;
+
+    if (!entry) {
+        return;
+    }
+
+    if (invalidate && !lock_segment(cache)) {
+        struct shm_slot *slot = locked_entry_slot(cache, entry);
+
+        if (slot) {
+            cache->segment->stats.invalidations++;
+            locked_free_slot(slot);
+        }
+
+        unlock_segment(cache);
+    }
+
+    destroy_handle(cache, entry);
+}
+
+static uint64_t get_creation_time(
+    const struct aws_cryptosdk_materials_cache *cache,
+    const struct aws_cryptosdk_materials_cache_entry *generic_entry) {
+    (void)cache;
+
+    return ((const struct shm_cache_entry *)generic_entry)->creation_time;
+}
+
+static void set_expiration_hint(
+    struct aws_cryptosdk_materials_cache *generic_cache,
+    struct aws_cryptosdk_materials_cache_entry *generic_entry,
+    uint64_t expiry_time) {
+    struct shm_cache *cache       = (struct shm_cache *)generic_cache;
+    struct shm_cache_entry *entry = (struct shm_cache_entry *)generic_entry;
+
+    if (lock_segment(cache)) {
+        return;
+    }
+
+    struct shm_slot *slot = locked_entry_slot(cache, entry);
+    if (slot && slot->expiry_time > expiry_time) {
+        slot->expiry_time = expiry_time;
+    }
+
+    unlock_segment(cache);
+}
+
+static size_t entry_count(const struct aws_cryptosdk_materials_cache *generic_cache) {
+    // Removing const so we can lock the segment
+    struct shm_cache *cache = (struct shm_cache *)generic_cache;
+    size_t count            = 0;
+
+    if (lock_segment(cache)) {
+        return SIZE_MAX;
+    }
+
+    for (size_t i = 0; i < cache->num_slots; i++) {
+        count += slot_occupied(get_slot(cache, i));
+    }
+
+    unlock_segment(cache);
+
+    return count;
+}
+
+static void clear_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
+    struct shm_cache *cache = (struct shm_cache *)generic_cache;
+
+    if (lock_segment(cache)) {
+        return;
+    }
+
+    for (size_t i = 0; i < cache->num_slots; i++) {
+        struct shm_slot *slot = get_slot(cache, i);
+
+        if (slot_occupied(slot)) {
+            cache->segment->stats.cleared++;
+            locked_free_slot(slot);
+        }
+    }
+
+    unlock_segment(cache);
+}
+
+static int get_stats(
+    const struct aws_cryptosdk_materials_cache *generic_cache, struct aws_cryptosdk_materials_cache_stats *stats) {
+    // Removing const so we can lock the segment
+    struct shm_cache *cache = (struct shm_cache *)generic_cache;
+
+    if (lock_segment(cache)) {
+        return AWS_OP_ERR;
+    }
+
+    *stats = cache->segment->stats;
+    for (size_t i = 0; i < cache->num_slots; i++) {
+        const struct shm_slot *slot = get_slot(cache, i);
+
+        if (slot_occupied(slot)) {
+            stats->entries++;
+            stats->bytes += sizeof(*slot) + slot->payload_len;
+        }
+    }
+
+    unlock_segment(cache);
+
+    return AWS_OP_SUCCESS;
+}
+
+static void destroy_cache(struct aws_cryptosdk_materials_cache *generic_cache) {
+    struct shm_cache *cache = (struct shm_cache *)generic_cache;
+
+    /*
+     * Other processes may still be using the segment, so its mutex is left alone; the memory
+     * itself goes once every process has unmapped it.
+     */
+    munmap(cache->map, cache->map_len);
+    aws_mem_release(cache->alloc, cache);
+}
+
+static const struct aws_cryptosdk_materials_cache_vt shm_cache_vt = {
+    .vt_size                 = sizeof(shm_cache_vt),
+    .name                    = "Shared-memory materials cache",
+    .find_entry              = find_entry,
+    .update_usage_stats      = update_usage_stats,
+    .get_enc_materials       = get_enc_materials,
+    .get_dec_materials       = get_dec_materials,
+    .put_entry_for_encrypt   = put_entry_for_encrypt,
+    .put_entry_for_decrypt   = put_entry_for_decrypt,
+    .destroy                 = destroy_cache,
+    .entry_count             = entry_count,
+    .entry_release           = release_entry,
+    .entry_get_creation_time = get_creation_time,
+    .entry_ttl_hint          = set_expiration_hint,
+    .clear                   = clear_cache,
+    .get_stats               = get_stats,
+    .return_usage_stats      = return_usage_stats
+};
+
+AWS_CRYPTOSDK_TEST_STATIC
+void aws_cryptosdk_shm_cache_set_clock(
+    struct aws_cryptosdk_materials_cache *generic_cache, int (*clock_get_ticks)(uint64_t *timestamp)) {
+    assert(generic_cache->vt == &shm_cache_vt);
+    struct shm_cache *cache = (struct shm_cache *)generic_cache;
+
+    cache->clock_get_ticks = clock_get_ticks;
+}
+
+static int init_mutex(pthread_mutex_t *mutex) {
+    pthread_mutexattr_t attr;
+
+    if (pthread_mutexattr_init(&attr)) {
+        return aws_raise_error(AWS_ERROR_MUTEX_FAILED);
+    }
+
+    int err = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#    ifdef __linux__
+    if (!err) err = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#    endif
+    if (!err) err = pthread_mutex_init(mutex, &attr);
+
+    pthread_mutexattr_destroy(&attr);
+
+    return err ? aws_raise_error(AWS_ERROR_MUTEX_FAILED) : AWS_OP_SUCCESS;
+}
+
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_shm_new(
+    struct aws_allocator *alloc, size_t capacity, size_t slot_size) {
+    /* Suppress unused static method warnings */
+    (void)aws_cryptosdk_shm_cache_set_clock;
+
+    size_t header_len = (sizeof(struct shm_segment) + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+    size_t slots_len, map_len;
+
+    if (!capacity) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    if (slot_size < MIN_SLOT_SIZE) {
+        slot_size = MIN_SLOT_SIZE;
+    }
+
+    if (slot_size > SIZE_MAX - SLOT_ALIGN) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    slot_size = (slot_size + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+    if (aws_mul_size_checked(capacity, slot_size, &slots_len) ||
+        aws_add_size_checked(header_len, slots_len, &map_len)) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct shm_cache *cache = aws_mem_acquire(alloc, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+
+    /* Anonymous shared mappings are zero-filled, so every slot starts out empty */
+    uint8_t *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        aws_mem_release(alloc, cache);
+        aws_raise_error(AWS_ERROR_OOM);
+        return NULL;
+    }
+
+    // As in the secure key pool, locking the data keys into memory is best-effort
+    (void)mlock(map, map_len);
+#    ifdef MADV_DONTDUMP
+    (void)madvise(map, map_len, MADV_DONTDUMP);
+#    endif
+
+    aws_cryptosdk_materials_cache_base_init(&cache->base, &shm_cache_vt);
+    cache->alloc           = alloc;
+    cache->map             = map;
+    cache->map_len         = map_len;
+    cache->segment         = (struct shm_segment *)map;
+    cache->slots           = map + header_len;
+    cache->num_slots       = capacity;
+    cache->slot_size       = slot_size;
+    cache->clock_get_ticks = aws_sys_clock_get_ticks;
+
+    if (init_mutex(&cache->segment->mutex)) {
+        munmap(map, map_len);
+        aws_mem_release(alloc, cache);
+        return NULL;
+    }
+
+    return &cache->base;
+}
+
+#else  // _WIN32
+
+struct aws_cryptosdk_materials_cache *aws_cryptosdk_materials_cache_shm_new(
+    struct aws_allocator *alloc, size_t capacity, size_t slot_size) {
+    (void)alloc;
+    (void)capacity;
+    (void)slot_size;
+
+    aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    return NULL;
+}
+
+#endif  // _WIN32
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <aws/cryptosdk/private/sig_pipeline.h>
+
+/*
+ * All atomics use sequentially consistent ordering. A side about to sleep sets its waiting flag
+ * and then re-checks the ring under the mutex, while the other side updates the ring and then
+ * checks the flag; so either the sleeper sees the update, or the other side sees the flag and
+ * wakes it.
+ */
+
+static bool has_work(void *arg) {
+    struct aws_cryptosdk_sig_pipeline *pipeline = arg;
+
+    return aws_atomic_load_int(&pipeline->head) != aws_atomic_load_int(&pipeline->tail) ||
+           aws_atomic_load_int(&pipeline->done);
+}
+
+static bool has_room(void *arg) {
+    struct aws_cryptosdk_sig_pipeline *pipeline = arg;
+
+    return aws_atomic_load_int(&pipeline->head) - aws_atomic_load_int(&pipeline->tail) <
+           AWS_CRYPTOSDK_SIG_PIPELINE_SLOTS;
+}
+
+static bool is_idle(void *arg) {
+    struct aws_cryptosdk_sig_pipeline *pipeline = arg;
+
+    return aws_atomic_load_int(&pipeline->head) == aws_atomic_load_int(&pipeline->tail);
+}
+
+static void wake_if_waiting(struct aws_cryptosdk_sig_pipeline *pipeline, struct aws_atomic_var *waiting) {
+    if (aws_atomic_load_int(waiting)) {
+        aws_mutex_lock(&pipeline->mutex);
+        aws_condition_variable_notify_all(&pipeline->cond);
+        aws_mutex_unlock(&pipeline->mutex);
+    }
+}
+
+static void sleep_until(
+    struct aws_cryptosdk_sig_pipeline *pipeline, struct aws_atomic_var *waiting, aws_condition_predicate_fn *pred) {
+    aws_mutex_lock(&pipeline->mutex);
+    aws_atomic_store_int(waiting, 1);
+    aws_condition_variable_wait_pred(&pipeline->cond, &pipeline->mutex, pred, pipeline);
+    aws_atomic_store_int(waiting, 0);
+    aws_mutex_unlock(&pipeline->mutex);
+}
+
+static void digest(struct aws_cryptosdk_sig_pipeline *pipeline, struct aws_byte_cursor span) {
+    if (aws_atomic_load_int(&pipeline->error) == AWS_ERROR_SUCCESS &&
+        aws_cryptosdk_sig_update(pipeline->signctx, span)) {
+        // Error codes are thread-local, so capture this one for the calling thread to re-raise
+        aws_atomic_store_int(&pipeline->error, (size_t)aws_last_error());
+    }
+}
+
+static void run_sig_pipeline(void *arg) {
+    struct aws_cryptosdk_sig_pipeline *pipeline = arg;
+
+    while (true) {
+        size_t tail = aws_atomic_load_int(&pipeline->tail);
+
+        if (tail == aws_atomic_load_int(&pipeline->head)) {
+            if (aws_atomic_load_int(&pipeline->done)) break;
+            sleep_until(pipeline, &pipeline->consumer_waiting, has_work);
+            continue;
+        }
+
+        digest(pipeline, pipeline->spans[tail % AWS_CRYPTOSDK_SIG_PIPELINE_SLOTS]);
+
+        aws_atomic_store_int(&pipeline->tail, tail + 1);
+        wake_if_waiting(pipeline, &pipeline->producer_waiting);
+    }
+}
+
+void aws_cryptosdk_priv_sig_pipeline_start(
+    struct aws_cryptosdk_sig_pipeline *pipeline, struct aws_allocator *alloc, struct aws_cryptosdk_sig_ctx *signctx) {
+    pipeline->signctx  = signctx;
+    pipeline->launched = false;
+    aws_atomic_init_int(&pipeline->head, 0);
+    aws_atomic_init_int(&pipeline->tail, 0);
+    aws_atomic_init_int(&pipeline->consumer_waiting, 0);
+    aws_atomic_init_int(&pipeline->producer_waiting, 0);
+    aws_atomic_init_int(&pipeline->error, AWS_ERROR_SUCCESS);
+    aws_atomic_init_int(&pipeline->done, 0);
+
+    if (aws_mutex_init(&pipeline->mutex)) goto err;
+    if (aws_condition_variable_init(&pipeline->cond)) goto err_mutex;
+    if (aws_thread_init(&pipeline->thread, alloc)) goto err_cond;
+    if (aws_thread_launch(&pipeline->thread, run_sig_pipeline, pipeline, aws_default_thread_options())) {
+        aws_thread_clean_up(&pipeline->thread);
+        goto err_cond;
+    }
+
+    pipeline->launched = true;
+    return;
+
+err_cond:
+    aws_condition_variable_clean_up(&pipeline->cond);
+err_mutex:
+    aws_mutex_clean_up(&pipeline->mutex);
+err:
+    // Without a helper thread, spans are digested as they are pushed
+    aws_reset_error();
+}
+
+void aws_cryptosdk_priv_sig_pipeline_push(struct aws_cryptosdk_sig_pipeline *pipeline, struct aws_byte_cursor span) {
+    if (!pipeline->launched) {
+        digest(pipeline, span);
+        return;
+    }
+
+    while (!has_room(pipeline)) {
+        sleep_until(pipeline, &pipeline->producer_waiting, has_room);
+    }
+
+    size_t head                                              = aws_atomic_load_int(&pipeline->head);
+    pipeline->spans[head % AWS_CRYPTOSDK_SIG_PIPELINE_SLOTS] = span;
+    aws_atomic_store_int(&pipeline->head, head + 1);
+    wake_if_waiting(pipeline, &pipeline->consumer_waiting);
+}
+
+int aws_cryptosdk_priv_sig_pipeline_wait(struct aws_cryptosdk_sig_pipeline *pipeline) {
+    if (pipeline->launched && !is_idle(pipeline)) {
+        sleep_until(pipeline, &pipeline->producer_waiting, is_idle);
+    }
+
+    int error = (int)aws_atomic_load_int(&pipeline->error);
+
+    return error == AWS_ERROR_SUCCESS ? AWS_OP_SUCCESS : aws_raise_error(error);
+}
+
+int aws_cryptosdk_priv_sig_pipeline_finish(struct aws_cryptosdk_sig_pipeline *pipeline) {
+    if (pipeline->launched) {
+        aws_mutex_lock(&pipeline->mutex);
+        aws_atomic_store_int(&pipeline->done, 1);
+        aws_condition_variable_notify_all(&pipeline->cond);
+        aws_mutex_unlock(&pipeline->mutex);
+
+        aws_thread_join(&pipeline->thread);
+        aws_thread_clean_up(&pipeline->thread);
+        aws_condition_variable_clean_up(&pipeline->cond);
+        aws_mutex_clean_up(&pipeline->mutex);
+        pipeline->launched = false;
+    }
+
+    int error = (int)aws_atomic_load_int(&pipeline->error);
+
+    return error == AWS_ERROR_SUCCESS ? AWS_OP_SUCCESS : aws_raise_error(error);
+}
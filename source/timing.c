@@ -0,0 +1,514 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/atomics.h>
+#include <aws/common/clock.h>
+#include <aws/cryptosdk/timing.h>
+
+struct timed_op_counters {
+    struct aws_atomic_var calls;
+    struct aws_atomic_var errors;
+    struct aws_atomic_var total_ns;
+    struct aws_atomic_var max_ns;
+    struct aws_atomic_var buckets[AWS_CRYPTOSDK_TIMING_BUCKETS];
+};
+
+struct aws_cryptosdk_timing_sink {
+    struct aws_allocator *alloc;
+    struct timed_op_counters ops[AWS_CRYPTOSDK_TIMED_OP_COUNT];
+};
+
+struct aws_cryptosdk_timing_sink *aws_cryptosdk_timing_sink_new(struct aws_allocator *alloc) {
+    struct aws_cryptosdk_timing_sink *sink = aws_mem_calloc(alloc, 1, sizeof(*sink));
+    if (!sink) return NULL;
+
+    sink->alloc = alloc;
+    for (int op = 0; op < AWS_CRYPTOSDK_TIMED_OP_COUNT; op++) {
+        struct timed_op_counters *counters = &sink->ops[op];
+        aws_atomic_init_int(&counters->calls, 0);
+        aws_atomic_init_int(&counters->errors, 0);
+        aws_atomic_init_int(&counters->total_ns, 0);
+        aws_atomic_init_int(&counters->max_ns, 0);
+        for (int bucket = 0; bucket < AWS_CRYPTOSDK_TIMING_BUCKETS; bucket++) {
+            aws_atomic_init_int(&counters->buckets[bucket], 0);
+        }
+    }
+
+    return sink;
+}
+
+void aws_cryptosdk_timing_sink_destroy(struct aws_cryptosdk_timing_sink *sink) {
+    if (sink) aws_mem_release(sink->alloc, sink);
+}
+
+static int bucket_of(uint64_t latency_ns) {
+    int bucket = 0;
+    while (latency_ns >>= 1) bucket++;
+
+    return bucket < AWS_CRYPTOSDK_TIMING_BUCKETS ? bucket : AWS_CRYPTOSDK_TIMING_BUCKETS - 1;
+}
+
+void aws_cryptosdk_timing_sink_record(
+    struct aws_cryptosdk_timing_sink *sink, enum aws_cryptosdk_timed_op op, uint64_t latency_ns, int error_code) {
+    if ((unsigned)op >= AWS_CRYPTOSDK_TIMED_OP_COUNT) return;
+    struct timed_op_counters *counters = &sink->ops[op];
+
+    aws_atomic_fetch_add_explicit(&counters->calls, 1, aws_memory_order_relaxed);
+    if (error_code) aws_atomic_fetch_add_explicit(&counters->errors, 1, aws_memory_order_relaxed);
+    aws_atomic_fetch_add_explicit(&counters->total_ns, (size_t)latency_ns, aws_memory_order_relaxed);
+    aws_atomic_fetch_add_explicit(&counters->buckets[bucket_of(latency_ns)], 1, aws_memory_order_relaxed);
+
+    size_t max_ns = aws_atomic_load_int_explicit(&counters->max_ns, aws_memory_order_relaxed);
+    while (max_ns < latency_ns && !aws_atomic_compare_exchange_int_explicit(
+                                      &counters->max_ns,
+                                      &max_ns,
+                                      (size_t)latency_ns,
+                                      aws_memory_order_relaxed,
+                                      aws_memory_order_relaxed)) {
+    }
+}
+
+int aws_cryptosdk_timing_sink_get(
+    const struct aws_cryptosdk_timing_sink *sink,
+    enum aws_cryptosdk_timed_op op,
+    struct aws_cryptosdk_timing_histogram *histogram) {
+    if ((unsigned)op >= AWS_CRYPTOSDK_TIMED_OP_COUNT) return aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+    // The atomics API takes non-const pointers, even to load
+    struct timed_op_counters *counters = (struct timed_op_counters *)&sink->ops[op];
+
+    histogram->calls    = aws_atomic_load_int_explicit(&counters->calls, aws_memory_order_relaxed);
+    histogram->errors   = aws_atomic_load_int_explicit(&counters->errors, aws_memory_order_relaxed);
+    histogram->total_ns = aws_atomic_load_int_explicit(&counters->total_ns, aws_memory_order_relaxed);
+    histogram->max_ns   = aws_atomic_load_int_explicit(&counters->max_ns, aws_memory_order_relaxed);
+    for (int bucket = 0; bucket < AWS_CRYPTOSDK_TIMING_BUCKETS; bucket++) {
+        histogram->buckets[bucket] = aws_atomic_load_int_explicit(&counters->buckets[bucket], aws_memory_order_relaxed);
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+uint64_t aws_cryptosdk_timing_histogram_percentile(
+    const struct aws_cryptosdk_timing_histogram *histogram, double percentile) {
+    uint64_t total = 0;
+    for (int bucket = 0; bucket < AWS_CRYPTOSDK_TIMING_BUCKETS; bucket++) total += histogram->buckets[bucket];
+    if (!total) return 0;
+
+    if (percentile < 0) percentile = 0;
+    if (percentile > 100) percentile = 100;
+    // The rank of the call wanted, counting from 1
+    uint64_t rank = (uint64_t)(percentile / 100 * (double)total + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < AWS_CRYPTOSDK_TIMING_BUCKETS - 1; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank) {
+            uint64_t top = ((uint64_t)2 << bucket) - 1;
+            return top < histogram->max_ns ? top : histogram->max_ns;
+        }
+    }
+
+    return histogram->max_ns;
+}
+
+static uint64_t now_ns(void) {
+    uint64_t now = 0;
+    aws_high_res_clock_get_ticks(&now);
+
+    return now;
+}
+
+/* Records a call which started at start_ns, and returned rv (for synchronous calls) */
+static int record_call(
+    struct aws_cryptosdk_timing_sink *sink, enum aws_cryptosdk_timed_op op, uint64_t start_ns, int rv) {
+    int error_code = AWS_ERROR_SUCCESS;
+    if (rv) error_code = aws_last_error() ? aws_last_error() : AWS_ERROR_UNKNOWN;
+
+    aws_cryptosdk_timing_sink_record(sink, op, now_ns() - start_ns, error_code);
+
+    return rv;
+}
+
+/* An asynchronous call in progress, carrying the caller's callback */
+struct timed_async_call {
+    struct aws_allocator *alloc;
+    struct aws_cryptosdk_timing_sink *sink;
+    enum aws_cryptosdk_timed_op op;
+    uint64_t start_ns;
+    union {
+        aws_cryptosdk_keyring_fn *keyring;
+        aws_cryptosdk_enc_materials_fn *enc_materials;
+        aws_cryptosdk_dec_materials_fn *dec_materials;
+    } callback;
+    void *user_data;
+};
+
+static struct timed_async_call *timed_async_call_new(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_timing_sink *sink,
+    enum aws_cryptosdk_timed_op op,
+    void *user_data) {
+    struct timed_async_call *call = aws_mem_calloc(alloc, 1, sizeof(*call));
+    if (!call) return NULL;
+
+    call->alloc     = alloc;
+    call->sink      = sink;
+    call->op        = op;
+    call->start_ns  = now_ns();
+    call->user_data = user_data;
+
+    return call;
+}
+
+struct timing_keyring {
+    struct aws_cryptosdk_keyring base;
+    struct aws_allocator *alloc;
+    struct aws_cryptosdk_keyring *inner;
+    struct aws_cryptosdk_timing_sink *sink;
+};
+
+static void timing_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
+    struct timing_keyring *self = (struct timing_keyring *)kr;
+
+    aws_cryptosdk_keyring_release(self->inner);
+    aws_mem_release(self->alloc, self);
+}
+
+static int timing_keyring_on_encrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct timing_keyring *self = (struct timing_keyring *)kr;
+    uint64_t start_ns           = now_ns();
+
+    int rv = aws_cryptosdk_keyring_on_encrypt(
+        self->inner, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+    return record_call(self->sink, AWS_CRYPTOSDK_TIMED_ON_ENCRYPT, start_ns, rv);
+}
+
+static int timing_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct timing_keyring *self = (struct timing_keyring *)kr;
+    uint64_t start_ns           = now_ns();
+
+    int rv = aws_cryptosdk_keyring_on_decrypt(
+        self->inner, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+    return record_call(self->sink, AWS_CRYPTOSDK_TIMED_ON_DECRYPT, start_ns, rv);
+}
+
+static int timing_keyring_on_encrypt_with_serialized_ctx(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct timing_keyring *self = (struct timing_keyring *)kr;
+    uint64_t start_ns           = now_ns();
+
+    int rv = aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx(
+        self->inner, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, serialized_enc_ctx, alg);
+    return record_call(self->sink, AWS_CRYPTOSDK_TIMED_ON_ENCRYPT, start_ns, rv);
+}
+
+static int timing_keyring_on_decrypt_with_serialized_ctx(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    const struct aws_byte_cursor *serialized_enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    struct timing_keyring *self = (struct timing_keyring *)kr;
+    uint64_t start_ns           = now_ns();
+
+    int rv = aws_cryptosdk_keyring_on_decrypt_with_serialized_ctx(
+        self->inner, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, serialized_enc_ctx, alg);
+    return record_call(self->sink, AWS_CRYPTOSDK_TIMED_ON_DECRYPT, start_ns, rv);
+}
+
+static void timing_keyring_async_done(int error_code, void *user_data) {
+    struct timed_async_call *call      = user_data;
+    aws_cryptosdk_keyring_fn *callback = call->callback.keyring;
+    void *callback_data                = call->user_data;
+
+    aws_cryptosdk_timing_sink_record(call->sink, call->op, now_ns() - call->start_ns, error_code);
+    aws_mem_release(call->alloc, call);
+    callback(error_code, callback_data);
+}
+
+static int timing_keyring_on_encrypt_async(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    struct timing_keyring *self = (struct timing_keyring *)kr;
+    struct timed_async_call *call =
+        timed_async_call_new(request_alloc, self->sink, AWS_CRYPTOSDK_TIMED_ON_ENCRYPT, user_data);
+    if (!call) return AWS_OP_ERR;
+    call->callback.keyring = callback;
+
+    if (aws_cryptosdk_keyring_on_encrypt_async(
+            self->inner,
+            request_alloc,
+            unencrypted_data_key,
+            keyring_trace,
+            edks,
+            enc_ctx,
+            alg,
+            timing_keyring_async_done,
+            call)) {
+        record_call(self->sink, AWS_CRYPTOSDK_TIMED_ON_ENCRYPT, call->start_ns, AWS_OP_ERR);
+        aws_mem_release(request_alloc, call);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int timing_keyring_on_decrypt_async(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    struct timing_keyring *self = (struct timing_keyring *)kr;
+    struct timed_async_call *call =
+        timed_async_call_new(request_alloc, self->sink, AWS_CRYPTOSDK_TIMED_ON_DECRYPT, user_data);
+    if (!call) return AWS_OP_ERR;
+    call->callback.keyring = callback;
+
+    if (aws_cryptosdk_keyring_on_decrypt_async(
+            self->inner,
+            request_alloc,
+            unencrypted_data_key,
+            keyring_trace,
+            edks,
+            enc_ctx,
+            alg,
+            timing_keyring_async_done,
+            call)) {
+        record_call(self->sink, AWS_CRYPTOSDK_TIMED_ON_DECRYPT, call->start_ns, AWS_OP_ERR);
+        aws_mem_release(request_alloc, call);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int timing_keyring_get_edk_filter(
+    const struct aws_cryptosdk_keyring *kr,
+    struct aws_byte_cursor *provider_id,
+    struct aws_byte_cursor *provider_info_prefix) {
+    const struct timing_keyring *self = (const struct timing_keyring *)kr;
+
+    return aws_cryptosdk_keyring_get_edk_filter(self->inner, provider_id, provider_info_prefix);
+}
+
+static bool timing_keyring_may_decrypt(const struct aws_cryptosdk_keyring *kr, const struct aws_array_list *edks) {
+    const struct timing_keyring *self = (const struct timing_keyring *)kr;
+
+    return aws_cryptosdk_keyring_may_decrypt(self->inner, edks);
+}
+
+static const struct aws_cryptosdk_keyring_vt timing_keyring_vt = {
+    .vt_size                        = sizeof(timing_keyring_vt),
+    .name                           = "timing keyring",
+    .destroy                        = timing_keyring_destroy,
+    .on_encrypt                     = timing_keyring_on_encrypt,
+    .on_decrypt                     = timing_keyring_on_decrypt,
+    .on_encrypt_async               = timing_keyring_on_encrypt_async,
+    .on_decrypt_async               = timing_keyring_on_decrypt_async,
+    .get_edk_filter                 = timing_keyring_get_edk_filter,
+    .on_encrypt_with_serialized_ctx = timing_keyring_on_encrypt_with_serialized_ctx,
+    .on_decrypt_with_serialized_ctx = timing_keyring_on_decrypt_with_serialized_ctx,
+    .may_decrypt                    = timing_keyring_may_decrypt
+};
+
+struct aws_cryptosdk_keyring *aws_cryptosdk_timing_keyring_new(
+    struct aws_allocator *alloc, struct aws_cryptosdk_keyring *inner, struct aws_cryptosdk_timing_sink *sink) {
+    if (!inner || !sink) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct timing_keyring *self = aws_mem_calloc(alloc, 1, sizeof(*self));
+    if (!self) return NULL;
+
+    aws_cryptosdk_keyring_base_init(&self->base, &timing_keyring_vt);
+    self->alloc = alloc;
+    self->inner = aws_cryptosdk_keyring_retain(inner);
+    self->sink  = sink;
+
+    return &self->base;
+}
+
+struct timing_cmm {
+    struct aws_cryptosdk_cmm base;
+    struct aws_allocator *alloc;
+    struct aws_cryptosdk_cmm *inner;
+    struct aws_cryptosdk_timing_sink *sink;
+};
+
+static void timing_cmm_destroy(struct aws_cryptosdk_cmm *cmm) {
+    struct timing_cmm *self = (struct timing_cmm *)cmm;
+
+    aws_cryptosdk_cmm_release(self->inner);
+    aws_mem_release(self->alloc, self);
+}
+
+static int timing_cmm_generate_enc_materials(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_enc_materials **output,
+    struct aws_cryptosdk_enc_request *request) {
+    struct timing_cmm *self = (struct timing_cmm *)cmm;
+    uint64_t start_ns       = now_ns();
+
+    int rv = aws_cryptosdk_cmm_generate_enc_materials(self->inner, output, request);
+    return record_call(self->sink, AWS_CRYPTOSDK_TIMED_GENERATE_ENC_MATERIALS, start_ns, rv);
+}
+
+static int timing_cmm_decrypt_materials(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request) {
+    struct timing_cmm *self = (struct timing_cmm *)cmm;
+    uint64_t start_ns       = now_ns();
+
+    // Materializes a deferred encryption context only if inner needs it
+    int rv = aws_cryptosdk_cmm_decrypt_materials(self->inner, output, request);
+    return record_call(self->sink, AWS_CRYPTOSDK_TIMED_DECRYPT_MATERIALS, start_ns, rv);
+}
+
+static void timing_cmm_enc_materials_done(
+    struct aws_cryptosdk_enc_materials *materials, int error_code, void *user_data) {
+    struct timed_async_call *call            = user_data;
+    aws_cryptosdk_enc_materials_fn *callback = call->callback.enc_materials;
+    void *callback_data                      = call->user_data;
+
+    aws_cryptosdk_timing_sink_record(call->sink, call->op, now_ns() - call->start_ns, error_code);
+    aws_mem_release(call->alloc, call);
+    callback(materials, error_code, callback_data);
+}
+
+static void timing_cmm_dec_materials_done(
+    struct aws_cryptosdk_dec_materials *materials, int error_code, void *user_data) {
+    struct timed_async_call *call            = user_data;
+    aws_cryptosdk_dec_materials_fn *callback = call->callback.dec_materials;
+    void *callback_data                      = call->user_data;
+
+    aws_cryptosdk_timing_sink_record(call->sink, call->op, now_ns() - call->start_ns, error_code);
+    aws_mem_release(call->alloc, call);
+    callback(materials, error_code, callback_data);
+}
+
+static int timing_cmm_generate_enc_materials_async(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_enc_request *request,
+    aws_cryptosdk_enc_materials_fn *callback,
+    void *user_data) {
+    struct timing_cmm *self = (struct timing_cmm *)cmm;
+    struct timed_async_call *call =
+        timed_async_call_new(request->alloc, self->sink, AWS_CRYPTOSDK_TIMED_GENERATE_ENC_MATERIALS, user_data);
+    if (!call) return AWS_OP_ERR;
+    call->callback.enc_materials = callback;
+
+    if (aws_cryptosdk_cmm_generate_enc_materials_async(self->inner, request, timing_cmm_enc_materials_done, call)) {
+        record_call(self->sink, AWS_CRYPTOSDK_TIMED_GENERATE_ENC_MATERIALS, call->start_ns, AWS_OP_ERR);
+        aws_mem_release(request->alloc, call);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static int timing_cmm_decrypt_materials_async(
+    struct aws_cryptosdk_cmm *cmm,
+    struct aws_cryptosdk_dec_request *request,
+    aws_cryptosdk_dec_materials_fn *callback,
+    void *user_data) {
+    struct timing_cmm *self = (struct timing_cmm *)cmm;
+    struct timed_async_call *call =
+        timed_async_call_new(request->alloc, self->sink, AWS_CRYPTOSDK_TIMED_DECRYPT_MATERIALS, user_data);
+    if (!call) return AWS_OP_ERR;
+    call->callback.dec_materials = callback;
+
+    if (aws_cryptosdk_cmm_decrypt_materials_async(self->inner, request, timing_cmm_dec_materials_done, call)) {
+        record_call(self->sink, AWS_CRYPTOSDK_TIMED_DECRYPT_MATERIALS, call->start_ns, AWS_OP_ERR);
+        aws_mem_release(request->alloc, call);
+        return AWS_OP_ERR;
+    }
+
+    return AWS_OP_SUCCESS;
+}
+
+static bool timing_cmm_may_decrypt(const struct aws_cryptosdk_cmm *cmm, const struct aws_array_list *edks) {
+    const struct timing_cmm *self = (const struct timing_cmm *)cmm;
+
+    return aws_cryptosdk_cmm_may_decrypt(self->inner, edks);
+}
+
+static const struct aws_cryptosdk_cmm_vt timing_cmm_vt = {
+    .vt_size                        = sizeof(timing_cmm_vt),
+    .name                           = "timing CMM",
+    .destroy                        = timing_cmm_destroy,
+    .generate_enc_materials         = timing_cmm_generate_enc_materials,
+    .decrypt_materials              = timing_cmm_decrypt_materials,
+    .generate_enc_materials_async   = timing_cmm_generate_enc_materials_async,
+    .decrypt_materials_async        = timing_cmm_decrypt_materials_async,
+    .decrypt_takes_deferred_enc_ctx = true,
+    .may_decrypt                    = timing_cmm_may_decrypt
+};
+
+struct aws_cryptosdk_cmm *aws_cryptosdk_timing_cmm_new(
+    struct aws_allocator *alloc, struct aws_cryptosdk_cmm *inner, struct aws_cryptosdk_timing_sink *sink) {
+    if (!inner || !sink) {
+        aws_raise_error(AWS_ERROR_INVALID_ARGUMENT);
+        return NULL;
+    }
+
+    struct timing_cmm *self = aws_mem_calloc(alloc, 1, sizeof(*self));
+    if (!self) return NULL;
+
+    aws_cryptosdk_cmm_base_init(&self->base, &timing_cmm_vt);
+    self->alloc = alloc;
+    self->inner = aws_cryptosdk_cmm_retain(inner);
+    self->sink  = sink;
+
+    return &self->base;
+}
@@ -13,7 +13,9 @@
  * limitations under the License.
  */
 #include <assert.h>
+#include <aws/common/atomics.h>
 #include <aws/common/string.h>
+#include <aws/common/thread.h>
 #include <aws/cryptosdk/private/utils.h>
 
 int aws_cryptosdk_compare_hash_elems_by_key_string(const void *elem_a, const void *elem_b) {
@@ -41,10 +43,101 @@ int aws_cryptosdk_hash_elems_array_init(
     return AWS_OP_SUCCESS;
 }
 
+/*
+ * An interned string is allocated right behind this header, with its allocator field pointing at
+ * interned_string_allocator; aws_string_destroy therefore lands in interned_string_release, which
+ * drops a reference and frees the block through the allocator it came from.
+ */
+struct interned_string_header {
+    struct aws_allocator *alloc;
+    struct aws_atomic_var refcount;
+};
+
+static void *interned_string_acquire(struct aws_allocator *allocator, size_t size) {
+    (void)allocator;
+    (void)size;
+    aws_raise_error(AWS_ERROR_UNSUPPORTED_OPERATION);
+    return NULL;
+}
+
+static void interned_string_release(struct aws_allocator *allocator, void *ptr) {
+    (void)allocator;
+    struct interned_string_header *header = (struct interned_string_header *)ptr - 1;
+
+    if (aws_atomic_fetch_sub_explicit(&header->refcount, 1, aws_memory_order_acq_rel) == 1) {
+        aws_mem_release(header->alloc, header);
+    }
+}
+
+static struct aws_allocator interned_string_allocator = { .mem_acquire = interned_string_acquire,
+                                                          .mem_release = interned_string_release };
+
+static struct aws_string *interned_string_retain(const struct aws_string *str) {
+    struct interned_string_header *header = (struct interned_string_header *)str - 1;
+
+    aws_atomic_fetch_add_explicit(&header->refcount, 1, aws_memory_order_relaxed);
+    return (struct aws_string *)str;
+}
+
+struct aws_string *aws_cryptosdk_string_intern(struct aws_allocator *alloc, const struct aws_string *str) {
+    aws_allocator_is_valid(alloc);
+    if (!str->allocator) {
+        return (struct aws_string *)str;
+    }
+    if (str->allocator == &interned_string_allocator) {
+        return interned_string_retain(str);
+    }
+
+    struct interned_string_header *header =
+        aws_mem_acquire(alloc, sizeof(*header) + offsetof(struct aws_string, bytes) + str->len + 1);
+    if (!header) {
+        return NULL;
+    }
+    header->alloc = alloc;
+    aws_atomic_init_int(&header->refcount, 1);
+
+    struct aws_string *interned                      = (struct aws_string *)(header + 1);
+    *(struct aws_allocator **)(&interned->allocator) = &interned_string_allocator;
+    *(size_t *)(&interned->len)                      = str->len;
+    memcpy((void *)interned->bytes, str->bytes, str->len);
+    *(uint8_t *)&interned->bytes[str->len] = '\0';
+
+    return interned;
+}
+
 struct aws_string *aws_cryptosdk_string_dup(struct aws_allocator *alloc, const struct aws_string *str) {
     aws_allocator_is_valid(alloc);
+    if (str->allocator == &interned_string_allocator) {
+        return interned_string_retain(str);
+    }
     if (str->allocator) {
         return aws_string_new_from_string(alloc, str);
     }
     return (struct aws_string *)str;
 }
+
+int aws_cryptosdk_byte_buf_reinit(struct aws_byte_buf *buf, struct aws_allocator *alloc, size_t capacity) {
+    if (buf->allocator == alloc && buf->buffer && buf->capacity >= capacity) {
+        aws_byte_buf_secure_zero(buf);
+        return AWS_OP_SUCCESS;
+    }
+
+    if (buf->allocator) {
+        aws_byte_buf_clean_up_secure(buf);
+    }
+
+    return aws_byte_buf_init(buf, alloc, capacity);
+}
+
+uint64_t aws_cryptosdk_current_thread_hash(void) {
+    aws_thread_id_t id   = aws_thread_current_thread_id();
+    const uint8_t *bytes = (const uint8_t *)&id;
+    uint64_t hash        = 14695981039346656037ull;
+
+    /* FNV-1a over the ID's bytes, as the type of a thread ID is platform-specific */
+    for (size_t i = 0; i < sizeof(id); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+
+    return hash;
+}
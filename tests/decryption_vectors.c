@@ -28,9 +28,13 @@
 #include <aws/cryptosdk/session.h>
 
 #include "testutil.h"
+#include "vector_perf.h"
 #include "zero_keyring.h"
 
 bool suite_failed = false;
+/* Set by --perf: vectors are timed rather than tested (see vector_perf.h) */
+static bool perf_mode;
+static struct vector_perf_options perf_options = { .min_time_ns = 100ull * 1000 * 1000, .tolerance = 0.25 };
 #define SENTINEL_VALUE ((size_t)0xABCD0123DEADBEEFllu)
 
 #define unexpected_error()                                                                                          \
@@ -409,21 +413,61 @@ error:
     }
 }
 
+static void decrypt_perf(const char *vector_name, struct aws_byte_buf pt, struct aws_byte_buf ct) {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = kr ? aws_cryptosdk_default_cmm_new(alloc, kr) : NULL;
+
+    if (!cmm || vector_perf_run(&perf_options, vector_name, cmm, ct.buffer, ct.len, pt.len)) suite_failed = true;
+
+    if (cmm) aws_cryptosdk_cmm_release(cmm);
+    if (kr) aws_cryptosdk_keyring_release(kr);
+}
+
 void decrypt_test_vector(
     enum aws_cryptosdk_alg_id alg_id, const char *vector_name, const char *plaintext_expected, const char *ciphertext) {
     struct aws_byte_buf pt = easy_b64_decode(plaintext_expected);
     struct aws_byte_buf ct = easy_b64_decode(ciphertext);
 
-    decrypt_test_oneshot(alg_id, vector_name, pt, ct);
-    decrypt_test_incremental(alg_id, vector_name, pt, ct);
-    decrypt_test_badciphertext(alg_id, vector_name, pt, ct);
+    if (perf_mode) {
+        decrypt_perf(vector_name, pt, ct);
+    } else {
+        decrypt_test_oneshot(alg_id, vector_name, pt, ct);
+        decrypt_test_incremental(alg_id, vector_name, pt, ct);
+        decrypt_test_badciphertext(alg_id, vector_name, pt, ct);
+    }
 
     aws_byte_buf_clean_up(&pt);
     aws_byte_buf_clean_up(&ct);
 }
 
-int main() {
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--perf [--baseline FILE] [--min-time-ms N] [--tolerance FRACTION]]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *baseline_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--perf")) {
+            perf_mode = true;
+        } else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (!strcmp(argv[i], "--min-time-ms") && i + 1 < argc) {
+            perf_options.min_time_ns = strtoull(argv[++i], NULL, 10) * 1000 * 1000;
+        } else if (!strcmp(argv[i], "--tolerance") && i + 1 < argc) {
+            perf_options.tolerance = strtod(argv[++i], NULL);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (baseline_path && !perf_mode) usage(argv[0]);
+
     aws_cryptosdk_load_error_strings();
+    if (baseline_path && !(perf_options.baseline = vector_perf_baseline_load(aws_default_allocator(), baseline_path))) {
+        return 1;
+    }
 
     // clang-format off
     decrypt_test_vector(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256, "ALG_AES_128_GCM_IV12_TAG16_HKDF_SHA256 hello empty final frame", "SGVsbG8sIHdvcmxkIQ==", "AYABFO37IzpEmc0FwZTvdUKZNmwAAAABAAh6ZXJvLWtleQANcHJvdmlkZXIgaW5mbwABAAIAAAAADAAAAA0AAAAAAAAAAAAAAACNU9yvQgmpDkhnXnIQNxa2AAAAAQAAAAAAAAAAAAAAASUlloU74HOz+Y1YlYf6Raw/tn/7oSD3tUsfzC8W/////wAAAAIAAAAAAAAAAAAAAAIAAAAAeSAQ6uk0/Gbj1GQb7AXKTw==");
@@ -481,5 +525,6 @@ int main() {
     decrypt_test_vector(ALG_AES256_GCM_IV12_TAG16_NO_KDF, "ALG_AES_256_GCM_IV12_TAG16_NO_KDF hello unframed", "SGVsbG8sIHdvcmxkIQ==", "AYAAeAr8nRUGvvNNJX+9eVc6MYsACAABAAF4AAF5AAEACHplcm8ta2V5AA1wcm92aWRlciBpbmZvAAEAAQAAAAAMAAAAAAAAAAAAAAAAAAAAAFtdCKkG58xv1CAV/uK2QDMAAAAAAAAAAAAAAAEAAAAAAAAADWGkSE6bWkerxnIxxbDDFuvB4V9ED6fQkGBrO1Y3");
     // clang-format on
 
+    vector_perf_baseline_destroy(perf_options.baseline);
     return suite_failed;
 }
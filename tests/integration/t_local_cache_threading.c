@@ -20,6 +20,10 @@
  *
  * As such it's not part of the main test suite run by ctest, but is instead a separate
  * target executed during CI.
+ *
+ * Run with --bench, it instead measures how many lookups per second all threads together manage
+ * on a single entry, which is bounded by how well the entry's layout keeps the fields every hit
+ * writes apart from those every hit reads.
  */
 
 // TODO: Make TTL expiry happen every once in a while
@@ -63,8 +67,12 @@
 // Total running time, in milliseconds
 #define RUN_TIME_MS 60000
 
+// Running time of the --bench measurement, in milliseconds
+#define BENCH_TIME_MS 5000
+
 static struct aws_cryptosdk_materials_cache *materials_cache;
 static struct aws_atomic_var stop_flag;
+static struct aws_atomic_var bench_ops;
 
 static struct aws_cryptosdk_enc_materials *expected_enc_mats[N_ENC_ENTRIES];
 static struct aws_cryptosdk_dec_materials *expected_dec_mats[N_DEC_ENTRIES];
@@ -262,6 +270,32 @@ static void thread_fn(void *ignored) {
     aws_cryptosdk_enc_ctx_clean_up(&empty_table);
 }
 
+static void bench_thread_fn(void *ignored) {
+    (void)ignored;
+
+    char buf[] = "BENCH ENTRY";
+    struct aws_byte_buf cache_id = aws_byte_buf_from_array((uint8_t *)buf, strlen(buf));
+    size_t ops                   = 0;
+
+    while (!aws_atomic_load_int_explicit(&stop_flag, aws_memory_order_relaxed)) {
+        struct aws_cryptosdk_materials_cache_entry *entry;
+        struct aws_cryptosdk_cache_usage_stats usage = { 1, 1 };
+        bool is_encrypt;
+
+        // What the caching CMM does on every hit, short of copying out the materials
+        if (aws_cryptosdk_materials_cache_find_entry(materials_cache, &entry, &is_encrypt, &cache_id) || !entry) {
+            abort();
+        }
+        if (aws_cryptosdk_materials_cache_update_usage_stats(materials_cache, entry, &usage)) {
+            abort();
+        }
+        aws_cryptosdk_materials_cache_entry_release(materials_cache, entry, false);
+        ops++;
+    }
+
+    aws_atomic_fetch_add(&bench_ops, ops);
+}
+
 static void setup() {
     materials_cache = aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), CACHE_SIZE);
 
@@ -300,20 +334,18 @@ static void teardown() {
     }
 }
 
-int main() {
-    libcrypto_init();
-
-    setup();
-
+static void run_threads(void (*fn)(void *), uint64_t run_time_ms) {
     struct aws_thread threads[THREAD_COUNT];
     struct aws_thread_options options = *aws_default_thread_options();
 
+    aws_atomic_store_int(&stop_flag, 0);
+
     for (int i = 0; i < THREAD_COUNT; i++) {
         aws_thread_init(&threads[i], aws_default_allocator());
-        aws_thread_launch(&threads[i], thread_fn, NULL, &options);
+        aws_thread_launch(&threads[i], fn, NULL, &options);
     }
 
-    aws_thread_current_sleep(RUN_TIME_MS * (1000LLU * 1000LLU));
+    aws_thread_current_sleep(run_time_ms * (1000LLU * 1000LLU));
 
     aws_atomic_store_int(&stop_flag, 1);
 
@@ -321,6 +353,48 @@ int main() {
         aws_thread_join(&threads[i]);
         aws_thread_clean_up(&threads[i]);
     }
+}
+
+static void run_benchmark() {
+    char buf[] = "BENCH ENTRY";
+    struct aws_byte_buf cache_id = aws_byte_buf_from_array((uint8_t *)buf, strlen(buf));
+    struct aws_cryptosdk_cache_usage_stats initial_usage = { 0 };
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    struct aws_hash_table empty_table;
+
+    // Under CLOCK, hits do not also contend on the shard's hit buffer, which would hide the entry's own costs
+    if (aws_cryptosdk_materials_cache_local_set_eviction(materials_cache, AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_CLOCK) ||
+        aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &empty_table)) {
+        abort();
+    }
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(
+        materials_cache, &entry, expected_enc_mats[0], initial_usage, &empty_table, &cache_id);
+    if (!entry) {
+        abort();
+    }
+    aws_cryptosdk_materials_cache_entry_release(materials_cache, entry, false);
+    aws_cryptosdk_enc_ctx_clean_up(&empty_table);
+
+    aws_atomic_init_int(&bench_ops, 0);
+    run_threads(bench_thread_fn, BENCH_TIME_MS);
+
+    printf(
+        "%d threads: %.0f lookups per second on one entry\n",
+        THREAD_COUNT,
+        (double)aws_atomic_load_int(&bench_ops) * 1000 / BENCH_TIME_MS);
+}
+
+int main(int argc, char **argv) {
+    libcrypto_init();
+
+    setup();
+
+    if (argc > 1 && !strcmp(argv[1], "--bench")) {
+        run_benchmark();
+    } else {
+        run_threads(thread_fn, RUN_TIME_MS);
+    }
 
     teardown();
 
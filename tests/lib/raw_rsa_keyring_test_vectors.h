@@ -19,6 +19,12 @@
 #include <aws/cryptosdk/materials.h>
 #include "testutil.h"
 
+/* The PEM-encoded key pair used by raw_rsa_keyring_tv_new */
+TESTLIB_API
+extern const char raw_rsa_keyring_tv_public_key[];
+TESTLIB_API
+extern const char raw_rsa_keyring_tv_private_key[];
+
 TESTLIB_API
 struct aws_cryptosdk_keyring *raw_rsa_keyring_tv_new(
     struct aws_allocator *alloc, enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode);
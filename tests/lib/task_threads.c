@@ -0,0 +1,42 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "task_threads.h"
+#include <aws/common/thread.h>
+
+static struct aws_thread task_threads[AWS_CRYPTOSDK_TEST_MAX_TASK_THREADS];
+static size_t num_task_threads;
+
+int aws_cryptosdk_test_thread_per_task_executor(aws_cryptosdk_task_fn *task, void *task_arg, void *executor_data) {
+    (void)executor_data;
+    if (num_task_threads == AWS_CRYPTOSDK_TEST_MAX_TASK_THREADS) return aws_raise_error(AWS_ERROR_INVALID_STATE);
+
+    struct aws_thread *thread = &task_threads[num_task_threads];
+    if (aws_thread_init(thread, aws_default_allocator())) return AWS_OP_ERR;
+    if (aws_thread_launch(thread, task, task_arg, aws_default_thread_options())) {
+        aws_thread_clean_up(thread);
+        return AWS_OP_ERR;
+    }
+    num_task_threads++;
+
+    return AWS_OP_SUCCESS;
+}
+
+void aws_cryptosdk_test_join_task_threads(void) {
+    for (size_t i = 0; i < num_task_threads; i++) {
+        aws_thread_join(&task_threads[i]);
+        aws_thread_clean_up(&task_threads[i]);
+    }
+    num_task_threads = 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_TESTS_LIB_TASK_THREADS_H
+#define AWS_CRYPTOSDK_TESTS_LIB_TASK_THREADS_H
+
+#include <aws/cryptosdk/executor.h>
+#include "testutil.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The most tasks aws_cryptosdk_test_thread_per_task_executor runs between joins */
+#define AWS_CRYPTOSDK_TEST_MAX_TASK_THREADS 16
+
+/**
+ * An aws_cryptosdk_executor_fn for tests, which runs each task on a thread of its own, until
+ * aws_cryptosdk_test_join_task_threads waits for them. Refuses tasks with
+ * AWS_ERROR_INVALID_STATE once AWS_CRYPTOSDK_TEST_MAX_TASK_THREADS are running, so that the
+ * caller runs them itself. executor_data is ignored. Not for use by several tests at once.
+ */
+TESTLIB_API
+int aws_cryptosdk_test_thread_per_task_executor(aws_cryptosdk_task_fn *task, void *task_arg, void *executor_data);
+
+/**
+ * Waits for every thread started by aws_cryptosdk_test_thread_per_task_executor since the last
+ * call, and releases them.
+ */
+TESTLIB_API
+void aws_cryptosdk_test_join_task_threads(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // AWS_CRYPTOSDK_TESTS_LIB_TASK_THREADS_H
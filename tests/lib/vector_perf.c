@@ -0,0 +1,249 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <aws/common/clock.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/session.h>
+
+#include "vector_perf.h"
+
+struct baseline_line {
+    char *name;
+    size_t allocs_per_decrypt;
+    /* Zero if the line has no decrypts_per_s field */
+    double decrypts_per_s;
+};
+
+struct vector_perf_baseline {
+    struct aws_allocator *alloc;
+    struct baseline_line *lines;
+    size_t count;
+};
+
+/* Returns the text just after "key": in line, or NULL if line has no such field */
+static const char *find_field(const char *line, const char *key) {
+    size_t key_len = strlen(key);
+
+    for (const char *p = strchr(line, '"'); p; p = strchr(p + 1, '"')) {
+        if (!strncmp(p + 1, key, key_len) && p[key_len + 1] == '"' && p[key_len + 2] == ':') return p + key_len + 3;
+    }
+    return NULL;
+}
+
+static int parse_line(struct aws_allocator *alloc, struct baseline_line *out, const char *line) {
+    const char *name   = find_field(line, "vector");
+    const char *allocs = find_field(line, "allocs_per_decrypt");
+    const char *rate   = find_field(line, "decrypts_per_s");
+
+    if (!name || *name != '"' || !allocs) return -1;
+    name++;
+    const char *name_end = strchr(name, '"');
+    if (!name_end) return -1;
+
+    if (!(out->name = aws_mem_acquire(alloc, name_end - name + 1))) return -1;
+    memcpy(out->name, name, name_end - name);
+    out->name[name_end - name] = 0;
+    out->allocs_per_decrypt    = strtoul(allocs, NULL, 10);
+    out->decrypts_per_s        = rate ? strtod(rate, NULL) : 0;
+
+    return 0;
+}
+
+struct vector_perf_baseline *vector_perf_baseline_load(struct aws_allocator *alloc, const char *path) {
+    uint8_t *data;
+    size_t size, lines = 0;
+
+    if (test_loadfile(path, &data, &size)) {
+        fprintf(stderr, "Failed to load baseline %s\n", path);
+        return NULL;
+    }
+
+    // Make the file a string, and count its lines for an upper bound on entries
+    char *text = realloc(data, size + 1);
+    if (!text) {
+        free(data);
+        return NULL;
+    }
+    text[size] = 0;
+    for (size_t i = 0; i < size; i++) lines += text[i] == '\n';
+
+    struct vector_perf_baseline *baseline = aws_mem_calloc(alloc, 1, sizeof(*baseline));
+    if (!baseline) goto out;
+    baseline->alloc = alloc;
+    if (!(baseline->lines = aws_mem_calloc(alloc, lines + 1, sizeof(*baseline->lines)))) goto err;
+
+    size_t lineno = 0;
+    for (char *line = text, *next; line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = 0;
+        lineno++;
+
+        // Blank lines are allowed, as anywhere in a file of JSON lines
+        if (!line[strspn(line, " \t\r")]) continue;
+        if (parse_line(alloc, &baseline->lines[baseline->count], line)) {
+            fprintf(stderr, "Bad baseline line %s:%zu\n", path, lineno);
+            goto err;
+        }
+        baseline->count++;
+    }
+
+    goto out;
+
+err:
+    vector_perf_baseline_destroy(baseline);
+    baseline = NULL;
+out:
+    free(text);
+    return baseline;
+}
+
+void vector_perf_baseline_destroy(struct vector_perf_baseline *baseline) {
+    if (!baseline) return;
+
+    for (size_t i = 0; i < baseline->count; i++) aws_mem_release(baseline->alloc, baseline->lines[i].name);
+    if (baseline->lines) aws_mem_release(baseline->alloc, baseline->lines);
+    aws_mem_release(baseline->alloc, baseline);
+}
+
+static const struct baseline_line *find_line(const struct vector_perf_baseline *baseline, const char *name) {
+    for (size_t i = 0; baseline && i < baseline->count; i++) {
+        if (!strcmp(baseline->lines[i].name, name)) return &baseline->lines[i];
+    }
+    return NULL;
+}
+
+/* Sessions under test allocate through this, so that the decrypt path's allocations can be counted */
+static size_t counted_allocs, counted_bytes;
+
+static void *counting_acquire(struct aws_allocator *alloc, size_t size) {
+    (void)alloc;
+    counted_allocs++;
+    counted_bytes += size;
+    return aws_mem_acquire(aws_default_allocator(), size);
+}
+
+static void counting_release(struct aws_allocator *alloc, void *ptr) {
+    (void)alloc;
+    aws_mem_release(aws_default_allocator(), ptr);
+}
+
+static void *counting_realloc(struct aws_allocator *alloc, void *ptr, size_t oldsize, size_t newsize) {
+    (void)alloc;
+    counted_allocs++;
+    if (newsize > oldsize) counted_bytes += newsize - oldsize;
+    if (aws_mem_realloc(aws_default_allocator(), &ptr, oldsize, newsize)) return NULL;
+    return ptr;
+}
+
+static struct aws_allocator counting_alloc = { .mem_acquire = counting_acquire,
+                                               .mem_release = counting_release,
+                                               .mem_realloc = counting_realloc };
+
+static uint64_t now_ns() {
+    uint64_t ticks = 0;
+    aws_high_res_clock_get_ticks(&ticks);
+    return ticks;
+}
+
+static int decrypt_once(
+    struct aws_cryptosdk_session *session, uint8_t *out, size_t pt_len, const uint8_t *ct, size_t ct_len) {
+    size_t out_produced, in_consumed;
+
+    if (aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT)) return -1;
+    if (aws_cryptosdk_session_process(session, out, pt_len, &out_produced, ct, ct_len, &in_consumed)) return -1;
+    if (!aws_cryptosdk_session_is_done(session) || in_consumed != ct_len || out_produced != pt_len) {
+        aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+        return -1;
+    }
+    return 0;
+}
+
+int vector_perf_run(
+    const struct vector_perf_options *options,
+    const char *name,
+    struct aws_cryptosdk_cmm *cmm,
+    const uint8_t *ct,
+    size_t ct_len,
+    size_t pt_len) {
+    int rv                                = -1;
+    uint64_t decrypts                     = 0, total_ns = 0;
+    size_t allocs                         = 0, bytes = 0;
+    struct aws_cryptosdk_session *session = NULL;
+    uint8_t *out                          = malloc(pt_len ? pt_len : 1);
+
+    if (!out) goto out;
+    if (!(session = aws_cryptosdk_session_new_from_cmm(&counting_alloc, AWS_CRYPTOSDK_DECRYPT, cmm))) goto out;
+
+    // The first decrypt grows the session's buffers; the next one shows what every later one costs
+    if (decrypt_once(session, out, pt_len, ct, ct_len)) goto out;
+    counted_allocs = counted_bytes = 0;
+    if (decrypt_once(session, out, pt_len, ct, ct_len)) goto out;
+    allocs = counted_allocs;
+    bytes  = counted_bytes;
+
+    while (total_ns < options->min_time_ns || decrypts < 3) {
+        uint64_t start = now_ns();
+        if (decrypt_once(session, out, pt_len, ct, ct_len)) goto out;
+        total_ns += now_ns() - start;
+        decrypts++;
+    }
+
+    rv = 0;
+
+out:
+    if (rv) fprintf(stderr, "[FAILED] Decrypt of vector %s: %s\n", name, aws_error_str(aws_last_error()));
+    if (session) aws_cryptosdk_session_destroy(session);
+    free(out);
+    if (rv) return rv;
+
+    double decrypts_per_s = (double)decrypts * 1e9 / (double)(total_ns ? total_ns : 1);
+    printf(
+        "{\"vector\":\"%s\",\"ct_len\":%zu,\"decrypts\":%llu,\"decrypts_per_s\":%.1f,\"allocs_per_decrypt\":%zu,"
+        "\"bytes_allocated_per_decrypt\":%zu}\n",
+        name,
+        ct_len,
+        (unsigned long long)decrypts,
+        decrypts_per_s,
+        allocs,
+        bytes);
+    fflush(stdout);
+
+    const struct baseline_line *line = find_line(options->baseline, name);
+    if (!line) return 0;
+
+    if (allocs > line->allocs_per_decrypt) {
+        fprintf(
+            stderr,
+            "[REGRESSED] Vector %s: %zu allocations per decrypt, baseline %zu\n",
+            name,
+            allocs,
+            line->allocs_per_decrypt);
+        rv = -1;
+    }
+    if (line->decrypts_per_s && decrypts_per_s < line->decrypts_per_s * (1 - options->tolerance)) {
+        fprintf(
+            stderr,
+            "[REGRESSED] Vector %s: %.1f decrypts per second, baseline %.1f\n",
+            name,
+            decrypts_per_s,
+            line->decrypts_per_s);
+        rv = -1;
+    }
+
+    return rv;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AWS_CRYPTOSDK_TESTS_LIB_VECTOR_PERF_H
+#define AWS_CRYPTOSDK_TESTS_LIB_VECTOR_PERF_H
+
+#include <aws/cryptosdk/materials.h>
+#include "testutil.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct vector_perf_baseline;
+
+/**
+ * Performance mode for the test vector runners: each vector is decrypted over and over, and its
+ * decrypt rate and allocation count are written to stdout as a JSON line, e.g.
+ *
+ *   {"vector":"<name>","ct_len":123,"decrypts":4567,"decrypts_per_s":8901.2,"allocs_per_decrypt":34,
+ *    "bytes_allocated_per_decrypt":5678}
+ *
+ * A baseline is a file of such lines from an earlier run, and each vector is checked against its
+ * line, if there is one: it regresses if it allocates more often per decrypt, or if its decrypt
+ * rate falls by more than the tolerance. Lines without a decrypts_per_s field only check
+ * allocations, which unlike throughput do not depend on the machine.
+ */
+struct vector_perf_options {
+    /* Minimum time spent decrypting each vector */
+    uint64_t min_time_ns;
+    /* Fraction by which the decrypt rate may fall below the baseline's */
+    double tolerance;
+    /* Lines of the baseline, or NULL to only report */
+    struct vector_perf_baseline *baseline;
+};
+
+/**
+ * Loads a baseline from path. Returns NULL, with a message on stderr, if it cannot be read.
+ */
+TESTLIB_API
+struct vector_perf_baseline *vector_perf_baseline_load(struct aws_allocator *alloc, const char *path);
+
+TESTLIB_API
+void vector_perf_baseline_destroy(struct vector_perf_baseline *baseline);
+
+/**
+ * Decrypts ct, a message of pt_len bytes, with sessions over cmm for options->min_time_ns, then
+ * reports the results and checks them against the baseline. Allocations are counted over a single
+ * decrypt on a reused session, after a warm-up, so they show the steady state of the decrypt path
+ * rather than the one-time cost of setting up the session.
+ *
+ * Returns 0, or -1 if decryption failed or the vector regressed; either is described on stderr.
+ */
+TESTLIB_API
+int vector_perf_run(
+    const struct vector_perf_options *options,
+    const char *name,
+    struct aws_cryptosdk_cmm *cmm,
+    const uint8_t *ct,
+    size_t ct_len,
+    size_t pt_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AWS_CRYPTOSDK_TESTS_LIB_VECTOR_PERF_H */
@@ -19,6 +19,10 @@
 #include <aws/cryptosdk/materials.h>
 #include "testutil.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * A degenerate Keyring (KR) which always returns an all zero data key, just
  * for testing the CMM and KR infrastructure.
@@ -38,4 +42,8 @@ struct aws_cryptosdk_keyring *aws_cryptosdk_zero_keyring_new(struct aws_allocato
 TESTLIB_API
 void aws_cryptosdk_literally_null_edk(struct aws_cryptosdk_edk *edk);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif  // AWS_CRYPTOSDK_TESTS_LIB_ZERO_KEYRING_H
@@ -520,9 +520,14 @@ static int mock_gen_enc_materials(
     return AWS_OP_SUCCESS;
 }
 
-/* From caching_cmm.c as a test static */
+/* From caching_cmm.c as test statics */
+int new_partition_md(
+    struct aws_allocator *alloc, struct aws_cryptosdk_md_context **partition_md, const struct aws_string *partition_id);
 int hash_dec_request(
-    const struct aws_string *partition_id, struct aws_byte_buf *out, const struct aws_cryptosdk_dec_request *req);
+    const struct aws_cryptosdk_md_context *partition_md,
+    struct aws_cryptosdk_md_context *md_context,
+    struct aws_byte_buf *out,
+    const struct aws_cryptosdk_dec_request *req);
 
 static int mock_decrypt_materials(
     struct aws_cryptosdk_cmm *generic_cmm,
@@ -552,9 +557,14 @@ static int mock_decrypt_materials(
      * We reuse hash_dec_request for convenience (we have tests that verify that it's input-dependent)
      */
     memset(materials->unencrypted_data_key.buffer, 0xAA, materials->unencrypted_data_key.capacity);
-    if (hash_dec_request(PARTITION_ID, &materials->unencrypted_data_key, request)) {
+    struct aws_cryptosdk_md_context *partition_md, *md_context;
+    if (new_partition_md(request->alloc, &partition_md, PARTITION_ID) ||
+        aws_cryptosdk_md_init(request->alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512) ||
+        hash_dec_request(partition_md, md_context, &materials->unencrypted_data_key, request)) {
         abort();
     }
+    aws_cryptosdk_md_abort(md_context);
+    aws_cryptosdk_md_abort(partition_md);
     materials->unencrypted_data_key.len = props->data_key_len;
 
     if (aws_cryptosdk_keyring_trace_add_record_c_str(
@@ -41,8 +41,18 @@ struct test_case *test_groups[] = { header_test_cases,
                                     raw_rsa_keyring_decrypt_test_cases,
                                     raw_rsa_keyring_encrypt_test_cases,
                                     local_cache_test_cases,
+                                    shm_cache_test_cases,
+                                    remote_cache_test_cases,
                                     caching_cmm_test_cases,
                                     keyring_trace_test_cases,
+                                    session_pool_test_cases,
+                                    pipeline_test_cases,
+                                    alloc_stats_test_cases,
+                                    timing_test_cases,
+                                    pkcs11_keyring_test_cases,
+                                    rewrap_test_cases,
+                                    kms_async_keyring_test_cases,
+                                    channel_handler_test_cases,
                                     NULL };
 
 struct test_case *test_cases;
@@ -0,0 +1,185 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/string.h>
+#include <aws/cryptosdk/alloc_stats.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/alloc_stats.h>
+#include <aws/cryptosdk/session.h>
+#include "testing.h"
+#include "zero_keyring.h"
+
+AWS_STATIC_STRING_FROM_LITERAL(enc_ctx_key, "purpose");
+AWS_STATIC_STRING_FROM_LITERAL(enc_ctx_value, "alloc stats test");
+
+static int counts_allocations_and_peak() {
+    struct aws_allocator *alloc = aws_cryptosdk_instrumented_allocator_new(aws_default_allocator());
+    struct aws_cryptosdk_alloc_stats stats;
+    TEST_ASSERT_ADDR_NOT_NULL(alloc);
+
+    void *a = aws_mem_acquire(alloc, 100);
+    void *b = aws_mem_acquire(alloc, 50);
+    TEST_ASSERT_ADDR_NOT_NULL(a);
+    TEST_ASSERT_ADDR_NOT_NULL(b);
+    aws_mem_release(alloc, a);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_get_stats(alloc, &stats));
+    TEST_ASSERT_INT_EQ(stats.total.allocs, 2);
+    TEST_ASSERT_INT_EQ(stats.total.bytes, 150);
+    TEST_ASSERT_INT_EQ(stats.total.live_bytes, 50);
+    TEST_ASSERT_INT_EQ(stats.total.peak_live_bytes, 150);
+    // Allocations made directly through the allocator are not attributed to any part of the SDK
+    TEST_ASSERT_INT_EQ(stats.by_tag[AWS_CRYPTOSDK_ALLOC_OTHER].allocs, 2);
+    TEST_ASSERT_INT_EQ(stats.by_tag[AWS_CRYPTOSDK_ALLOC_HEADER].allocs, 0);
+
+    // Resetting keeps what is still live, and the peak starts over from it
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_reset(alloc));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_get_stats(alloc, &stats));
+    TEST_ASSERT_INT_EQ(stats.total.allocs, 0);
+    TEST_ASSERT_INT_EQ(stats.total.bytes, 0);
+    TEST_ASSERT_INT_EQ(stats.total.live_bytes, 50);
+    TEST_ASSERT_INT_EQ(stats.total.peak_live_bytes, 50);
+
+    // A reallocation counts once, and only for the bytes it adds
+    TEST_ASSERT_SUCCESS(aws_mem_realloc(alloc, &b, 50, 80));
+    TEST_ASSERT_SUCCESS(aws_mem_realloc(alloc, &b, 80, 20));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_get_stats(alloc, &stats));
+    TEST_ASSERT_INT_EQ(stats.total.allocs, 2);
+    TEST_ASSERT_INT_EQ(stats.total.bytes, 30);
+    TEST_ASSERT_INT_EQ(stats.total.live_bytes, 20);
+    TEST_ASSERT_INT_EQ(stats.total.peak_live_bytes, 80);
+
+    aws_mem_release(alloc, b);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_get_stats(alloc, &stats));
+    TEST_ASSERT_INT_EQ(stats.total.live_bytes, 0);
+
+    aws_cryptosdk_instrumented_allocator_destroy(alloc);
+    return 0;
+}
+
+static int tagged_views_attribute_allocations() {
+    struct aws_allocator *alloc = aws_cryptosdk_instrumented_allocator_new(aws_default_allocator());
+    struct aws_cryptosdk_alloc_stats stats;
+    TEST_ASSERT_ADDR_NOT_NULL(alloc);
+
+    struct aws_allocator *cache = aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_CACHE);
+    TEST_ASSERT_ADDR_NE(cache, alloc);
+    // Retagging a view gives the view for the new tag, and views share the same counts
+    TEST_ASSERT_ADDR_EQ(aws_cryptosdk_priv_alloc_tagged(cache, AWS_CRYPTOSDK_ALLOC_OTHER), alloc);
+
+    void *p = aws_mem_calloc(cache, 4, 8);
+    TEST_ASSERT_ADDR_NOT_NULL(p);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(stats.by_tag[AWS_CRYPTOSDK_ALLOC_CACHE].allocs, 1);
+    TEST_ASSERT_INT_EQ(stats.by_tag[AWS_CRYPTOSDK_ALLOC_CACHE].live_bytes, 32);
+    TEST_ASSERT_INT_EQ(stats.total.allocs, 1);
+
+    // Memory may be released through any view; it comes off the tag it was allocated under
+    aws_mem_release(alloc, p);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_get_stats(alloc, &stats));
+    TEST_ASSERT_INT_EQ(stats.by_tag[AWS_CRYPTOSDK_ALLOC_CACHE].live_bytes, 0);
+    TEST_ASSERT_INT_EQ(stats.by_tag[AWS_CRYPTOSDK_ALLOC_OTHER].live_bytes, 0);
+
+    TEST_ASSERT(!strcmp(aws_cryptosdk_alloc_tag_name(AWS_CRYPTOSDK_ALLOC_CACHE), "cache"));
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_alloc_tag_name(AWS_CRYPTOSDK_ALLOC_TAG_COUNT));
+
+    aws_cryptosdk_instrumented_allocator_destroy(alloc);
+    return 0;
+}
+
+static int other_allocators_are_untouched() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_alloc_stats stats;
+
+    TEST_ASSERT_ADDR_EQ(aws_cryptosdk_priv_alloc_tagged(alloc, AWS_CRYPTOSDK_ALLOC_HEADER), alloc);
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_instrumented_allocator_get_stats(alloc, &stats));
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_instrumented_allocator_reset(alloc));
+
+    return 0;
+}
+
+static int run_session(
+    struct aws_allocator *alloc,
+    struct aws_cryptosdk_cmm *cmm,
+    enum aws_cryptosdk_mode mode,
+    uint8_t *out,
+    size_t out_cap,
+    size_t *out_len,
+    const uint8_t *in,
+    size_t in_len) {
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_from_cmm(alloc, mode, cmm);
+    size_t in_read;
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+
+    if (mode == AWS_CRYPTOSDK_ENCRYPT) {
+        struct aws_hash_table *enc_ctx = aws_cryptosdk_session_get_enc_ctx_ptr_mut(session);
+        TEST_ASSERT_SUCCESS(aws_hash_table_put(enc_ctx, enc_ctx_key, (void *)enc_ctx_value, NULL));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, in_len));
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, out, out_cap, out_len, in, in_len, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(in_read, in_len);
+
+    aws_cryptosdk_session_destroy(session);
+    return 0;
+}
+
+static int session_allocations_are_attributed() {
+    static const uint8_t pt[] = "Count every allocation of this message";
+    struct aws_allocator *alloc = aws_cryptosdk_instrumented_allocator_new(aws_default_allocator());
+    struct aws_cryptosdk_alloc_stats stats;
+    uint8_t ct[1024], decrypted[sizeof(pt)];
+    size_t ct_len, pt_len;
+    TEST_ASSERT_ADDR_NOT_NULL(alloc);
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    TEST_ASSERT_SUCCESS(run_session(alloc, cmm, AWS_CRYPTOSDK_ENCRYPT, ct, sizeof(ct), &ct_len, pt, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_reset(alloc));
+    TEST_ASSERT_SUCCESS(
+        run_session(alloc, cmm, AWS_CRYPTOSDK_DECRYPT, decrypted, sizeof(decrypted), &pt_len, ct, ct_len));
+    TEST_ASSERT_INT_EQ(pt_len, sizeof(pt));
+    TEST_ASSERT(!memcmp(decrypted, pt, sizeof(pt)));
+
+    // Parsing the header allocates its fields, and the encryption context's strings, separately
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_get_stats(alloc, &stats));
+    TEST_ASSERT(stats.by_tag[AWS_CRYPTOSDK_ALLOC_HEADER].allocs > 0);
+    TEST_ASSERT(stats.by_tag[AWS_CRYPTOSDK_ALLOC_ENC_CTX].allocs > 0);
+    TEST_ASSERT(stats.by_tag[AWS_CRYPTOSDK_ALLOC_KEYRING].allocs > 0);
+    uint64_t by_tag = 0;
+    for (int tag = 0; tag < AWS_CRYPTOSDK_ALLOC_TAG_COUNT; tag++) by_tag += stats.by_tag[tag].allocs;
+    TEST_ASSERT_INT_EQ(by_tag, stats.total.allocs);
+
+    // Nothing outlives the CMM
+    aws_cryptosdk_cmm_release(cmm);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_get_stats(alloc, &stats));
+    TEST_ASSERT_INT_EQ(stats.total.live_bytes, 0);
+
+    aws_cryptosdk_instrumented_allocator_destroy(alloc);
+    return 0;
+}
+
+#define TEST_CASE(name) \
+    { "alloc_stats", #name, name }
+struct test_case alloc_stats_test_cases[] = { TEST_CASE(counts_allocations_and_peak),
+                                              TEST_CASE(tagged_views_attribute_allocations),
+                                              TEST_CASE(other_allocators_are_untouched),
+                                              TEST_CASE(session_allocations_are_attributed),
+                                              { NULL } };
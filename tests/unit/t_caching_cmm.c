@@ -14,12 +14,16 @@
  */
 
 #include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/default_cmm.h>
 #include <aws/cryptosdk/edk.h>
 #include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/enc_ctx.h>
+#include <aws/cryptosdk/private/header.h>
 #include <aws/cryptosdk/session.h>
 
 #include <aws/common/encoding.h>
+#include <aws/common/thread.h>
 
 #include <stdarg.h>
 
@@ -78,7 +82,7 @@ static int enc_cache_miss() {
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &expect_context);
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 32768;
@@ -132,7 +136,7 @@ static int enc_cache_hit() {
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &expect_context);
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 32768;
@@ -213,7 +217,7 @@ static int enc_cache_unique_ids() {
         aws_hash_callback_string_destroy,
         NULL));
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 32768;
@@ -283,8 +287,13 @@ static int enc_cache_unique_ids() {
 }
 
 struct aws_string *hash_or_generate_partition_id(struct aws_allocator *alloc, const struct aws_byte_buf *partition_id);
+int new_partition_md(
+    struct aws_allocator *alloc, struct aws_cryptosdk_md_context **partition_md, const struct aws_string *partition_id);
 int hash_enc_request(
-    struct aws_string *partition_id, struct aws_byte_buf *out, const struct aws_cryptosdk_enc_request *req);
+    const struct aws_cryptosdk_md_context *partition_md,
+    struct aws_cryptosdk_md_context *md_context,
+    struct aws_byte_buf *out,
+    const struct aws_cryptosdk_enc_request *req);
 
 static int encrypt_id_vector(
     const char *expected_b64,
@@ -295,12 +304,16 @@ static int encrypt_id_vector(
     struct aws_string *partition_id = hash_or_generate_partition_id(aws_default_allocator(), &partition_name_buf);
     TEST_ASSERT_ADDR_NOT_NULL(partition_id);
 
+    struct aws_cryptosdk_md_context *partition_md, *md_context;
+    TEST_ASSERT_SUCCESS(new_partition_md(aws_default_allocator(), &partition_md, partition_id));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_init(aws_default_allocator(), &md_context, AWS_CRYPTOSDK_MD_SHA512));
+
     struct aws_byte_buf expected, actual;
 
     expected = easy_b64_decode(expected_b64);
     TEST_ASSERT_SUCCESS(aws_byte_buf_init(&actual, aws_default_allocator(), expected.len));
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     struct aws_hash_table encryption_context;
 
     TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &encryption_context));
@@ -325,10 +338,28 @@ static int encrypt_id_vector(
         TEST_ASSERT_SUCCESS(aws_hash_table_put(&encryption_context, sk, sv, NULL));
     }
 
-    TEST_ASSERT_SUCCESS(hash_enc_request(partition_id, &actual, &request));
+    TEST_ASSERT_SUCCESS(hash_enc_request(partition_md, md_context, &actual, &request));
+
+    TEST_ASSERT(aws_byte_buf_eq(&expected, &actual));
 
+    // The digest context is left ready for reuse, giving the same cache ID again
+    aws_byte_buf_reset(&actual, true);
+    TEST_ASSERT_SUCCESS(hash_enc_request(partition_md, md_context, &actual, &request));
     TEST_ASSERT(aws_byte_buf_eq(&expected, &actual));
 
+    // A frozen copy of the context gives the same cache ID from its stored digest
+    struct aws_cryptosdk_frozen_enc_ctx *frozen =
+        aws_cryptosdk_enc_ctx_freeze(aws_default_allocator(), &encryption_context);
+    TEST_ASSERT_ADDR_NOT_NULL(frozen);
+    request.frozen_enc_ctx = frozen;
+    aws_byte_buf_reset(&actual, true);
+    TEST_ASSERT_SUCCESS(hash_enc_request(partition_md, md_context, &actual, &request));
+    TEST_ASSERT(aws_byte_buf_eq(&expected, &actual));
+    aws_cryptosdk_frozen_enc_ctx_destroy(frozen);
+
+    aws_cryptosdk_md_abort(md_context);
+    aws_cryptosdk_md_abort(partition_md);
+
     aws_cryptosdk_enc_ctx_clean_up(&encryption_context);
     aws_byte_buf_clean_up(&expected);
     aws_byte_buf_clean_up(&actual);
@@ -428,7 +459,7 @@ static int byte_and_message_limits_test() {
     struct aws_hash_table req_context;
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 32768;
@@ -530,7 +561,7 @@ static int ttl_test() {
     struct aws_hash_table req_context;
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 1;
@@ -615,6 +646,72 @@ static int ttl_test() {
     return 0;
 }
 
+static int ttl_jitter() {
+    setup_mocks();
+
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        aws_default_allocator(), &mock_materials_cache->base, &mock_upstream_cmm->base, NULL, 1000, AWS_TIMESTAMP_SECS);
+
+    struct aws_hash_table req_context;
+    aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
+
+    struct aws_cryptosdk_enc_request request = { 0 };
+    request.alloc          = aws_default_allocator();
+    request.requested_alg  = 0;
+    request.plaintext_size = 1;
+
+    bool was_hit;
+    struct aws_cryptosdk_cache_usage_stats usage = { 1, 1 };
+
+    caching_cmm_set_clock(cmm, mock_clock_get_ticks);
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_caching_cmm_set_ttl_jitter(cmm, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_ttl_jitter(cmm, 20));
+
+    // Do an initial miss to create the response
+    mock_clock_time = 0;
+    ASSERT_HIT(false);
+
+    uint64_t first_ttl = 0;
+    bool varied        = false;
+    for (uint64_t creation_time = 1; creation_time <= 16; creation_time++) {
+        mock_materials_cache->entry_creation_time = creation_time;
+        mock_materials_cache->entry_ttl_hint      = 0;
+        mock_clock_time                           = creation_time;
+        ASSERT_HIT(true);
+
+        // Entries expire early by up to a fifth of the TTL, never late
+        uint64_t ttl = mock_materials_cache->entry_ttl_hint - creation_time;
+        TEST_ASSERT(ttl >= 800 * ONE_BILLION && ttl <= 1000 * ONE_BILLION);
+
+        // Each entry keeps its TTL until it expires
+        mock_clock_time = mock_materials_cache->entry_ttl_hint - 1;
+        ASSERT_HIT(true);
+        TEST_ASSERT_INT_EQ(creation_time + ttl, mock_materials_cache->entry_ttl_hint);
+
+        if (first_ttl && ttl != first_ttl) varied = true;
+        if (!first_ttl) first_ttl = ttl;
+    }
+    TEST_ASSERT(varied);
+
+    mock_materials_cache->entry_creation_time = 1;
+    mock_materials_cache->invalidated         = false;
+    mock_clock_time                           = first_ttl + 1;
+    ASSERT_HIT(false);
+    TEST_ASSERT(mock_materials_cache->invalidated);
+
+    // Without jitter, the TTL is exact again
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_ttl_jitter(cmm, 0));
+    mock_materials_cache->entry_creation_time = 1;
+    mock_clock_time                           = 2;
+    ASSERT_HIT(true);
+    TEST_ASSERT_INT_EQ(1000 * ONE_BILLION + 1, mock_materials_cache->entry_ttl_hint);
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_enc_ctx_clean_up(&req_context);
+    teardown();
+    return 0;
+}
+
 static int zero_byte_limit_zero_length_messages() {
     setup_mocks();
     struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
@@ -630,7 +727,7 @@ static int zero_byte_limit_zero_length_messages() {
     struct aws_hash_table req_context;
     aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &req_context);
 
-    struct aws_cryptosdk_enc_request request;
+    struct aws_cryptosdk_enc_request request = { 0 };
     request.alloc          = aws_default_allocator();
     request.requested_alg  = 0;
     request.plaintext_size = 0;
@@ -656,7 +753,10 @@ static int zero_byte_limit_zero_length_messages() {
 }
 
 int hash_dec_request(
-    const struct aws_string *partition_id, struct aws_byte_buf *out, const struct aws_cryptosdk_dec_request *req);
+    const struct aws_cryptosdk_md_context *partition_md,
+    struct aws_cryptosdk_md_context *md_context,
+    struct aws_byte_buf *out,
+    const struct aws_cryptosdk_dec_request *req);
 
 static int dec_test_vector(
     const char *partition_name,
@@ -668,22 +768,52 @@ static int dec_test_vector(
     struct aws_byte_buf partition_name_buf = aws_byte_buf_from_c_str(partition_name);
     struct aws_string *partition_id = hash_or_generate_partition_id(aws_default_allocator(), &partition_name_buf);
 
+    struct aws_cryptosdk_md_context *partition_md, *md_context;
+    TEST_ASSERT_SUCCESS(new_partition_md(aws_default_allocator(), &partition_md, partition_id));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_init(aws_default_allocator(), &md_context, AWS_CRYPTOSDK_MD_SHA512));
+
     struct aws_byte_buf expected, actual;
 
     expected = easy_b64_decode(expected_b64);
     TEST_ASSERT_SUCCESS(aws_byte_buf_init(&actual, aws_default_allocator(), expected.len));
 
-    struct aws_cryptosdk_dec_request request;
-    request.alloc   = aws_default_allocator();
-    request.alg     = alg;
-    request.enc_ctx = enc_ctx;
+    struct aws_cryptosdk_dec_request request = { 0 };
+    request.alloc                            = aws_default_allocator();
+    request.alg                              = alg;
+    request.enc_ctx                          = enc_ctx;
 
     aws_array_list_init_static(&request.encrypted_data_keys, (void *)edk_list, n_edks, sizeof(*edk_list));
     request.encrypted_data_keys.length = n_edks;
 
-    TEST_ASSERT_SUCCESS(hash_dec_request(partition_id, &actual, &request));
+    TEST_ASSERT_SUCCESS(hash_dec_request(partition_md, md_context, &actual, &request));
     TEST_ASSERT(aws_byte_buf_eq(&expected, &actual));
 
+    aws_byte_buf_reset(&actual, true);
+    TEST_ASSERT_SUCCESS(hash_dec_request(partition_md, md_context, &actual, &request));
+    TEST_ASSERT(aws_byte_buf_eq(&expected, &actual));
+
+    // A deferred context is hashed from its serialization alone, to the same cache ID
+    size_t serialized_len;
+    struct aws_byte_buf serialized;
+    struct aws_hash_table empty;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_size(&serialized_len, enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&serialized, aws_default_allocator(), serialized_len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_serialize(aws_default_allocator(), &serialized, enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &empty));
+    if (serialized.len) {
+        request.enc_ctx            = &empty;
+        request.serialized_enc_ctx = aws_byte_cursor_from_buf(&serialized);
+        request.enc_ctx_deferred   = true;
+
+        aws_byte_buf_reset(&actual, true);
+        TEST_ASSERT_SUCCESS(hash_dec_request(partition_md, md_context, &actual, &request));
+        TEST_ASSERT(aws_byte_buf_eq(&expected, &actual));
+    }
+    aws_cryptosdk_enc_ctx_clean_up(&empty);
+    aws_byte_buf_clean_up(&serialized);
+
+    aws_cryptosdk_md_abort(md_context);
+    aws_cryptosdk_md_abort(partition_md);
     aws_byte_buf_clean_up(&expected);
     aws_byte_buf_clean_up(&actual);
     aws_string_destroy(partition_id);
@@ -847,6 +977,78 @@ static int dec_materials() {
     return 0;
 }
 
+static int derived_content_key() {
+    setup_mocks();
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
+        aws_default_allocator(),
+        &mock_materials_cache->base,
+        &mock_upstream_cmm->base,
+        NULL,
+        UINT64_MAX,
+        AWS_TIMESTAMP_NANOS);
+    caching_cmm_set_clock(cmm, mock_clock_get_ticks);
+
+    struct aws_hash_table enc_ctx;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx));
+
+    struct aws_cryptosdk_edk edk;
+    edk.provider_id   = aws_byte_buf_from_c_str("provider_id");
+    edk.provider_info = aws_byte_buf_from_c_str("provider_info");
+    edk.ciphertext    = aws_byte_buf_from_c_str("enc_data_key");
+
+    uint8_t message_id[16] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+
+    struct aws_cryptosdk_dec_request dec_request = { 0 };
+    dec_request.alloc                            = aws_default_allocator();
+    dec_request.alg                              = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384;
+    dec_request.enc_ctx                          = &enc_ctx;
+    dec_request.message_id                       = message_id;
+    aws_array_list_init_static(&dec_request.encrypted_data_keys, &edk, 1, sizeof(edk));
+
+    const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(dec_request.alg);
+    struct aws_cryptosdk_dec_materials *miss_materials = NULL, *hit_materials = NULL, *other_materials = NULL;
+
+    mock_clock_time = 0;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_decrypt_materials(cmm, &miss_materials, &dec_request));
+    TEST_ASSERT_INT_EQ(miss_materials->content_key.len, props->content_key_len);
+
+    /* The attached key must match what the session would have derived itself */
+    struct data_key data_key = { { 0 } };
+    struct content_key expected;
+    memcpy(data_key.keybuf, miss_materials->unencrypted_data_key.buffer, miss_materials->unencrypted_data_key.len);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_derive_key(props, &expected, &data_key, message_id));
+    TEST_ASSERT(!memcmp(expected.keybuf, miss_materials->content_key.buffer, props->content_key_len));
+
+    /* A cache hit for the same message ID returns the same (memoized) key */
+    mock_materials_cache->should_hit = true;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_decrypt_materials(cmm, &hit_materials, &dec_request));
+    TEST_ASSERT(aws_byte_buf_eq(&miss_materials->content_key, &hit_materials->content_key));
+
+    /* A different message ID gets a different key, expanded from the data key's kept HKDF extract */
+    message_id[0] ^= 0xFF;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_decrypt_materials(cmm, &other_materials, &dec_request));
+    TEST_ASSERT_INT_EQ(other_materials->content_key.len, props->content_key_len);
+    TEST_ASSERT(!aws_byte_buf_eq(&miss_materials->content_key, &other_materials->content_key));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_derive_key(props, &expected, &data_key, message_id));
+    TEST_ASSERT(!memcmp(expected.keybuf, other_materials->content_key.buffer, props->content_key_len));
+    aws_cryptosdk_dec_materials_destroy(other_materials);
+
+    /* Without a message ID, no content key is attached */
+    dec_request.message_id = NULL;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_decrypt_materials(cmm, &other_materials, &dec_request));
+    TEST_ASSERT_INT_EQ(other_materials->content_key.len, 0);
+
+    aws_cryptosdk_dec_materials_destroy(other_materials);
+    aws_cryptosdk_dec_materials_destroy(miss_materials);
+    aws_cryptosdk_dec_materials_destroy(hit_materials);
+
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_cmm_release(cmm);
+    teardown();
+
+    return 0;
+}
+
 static int cache_miss_failed_put() {
     setup_mocks();
     struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_caching_cmm_new_from_cmm(
@@ -872,7 +1074,7 @@ static int cache_miss_failed_put() {
     dec_request.enc_ctx                          = &enc_ctx;
     aws_array_list_init_static(&dec_request.encrypted_data_keys, &edk, 1, sizeof(edk));
 
-    struct aws_cryptosdk_enc_request enc_request;
+    struct aws_cryptosdk_enc_request enc_request = { 0 };
     enc_request.alloc          = aws_default_allocator();
     enc_request.requested_alg  = 0;
     enc_request.plaintext_size = 32768;
@@ -918,7 +1120,7 @@ static bool partitions_match_on_enc(
         abort();
     }
 
-    struct aws_cryptosdk_enc_request enc_request;
+    struct aws_cryptosdk_enc_request enc_request = { 0 };
     enc_request.alloc          = aws_default_allocator();
     enc_request.requested_alg  = 0;
     enc_request.plaintext_size = 32768;
@@ -1206,6 +1408,980 @@ static int set_message_bound_with_caching_cmm() {
     return 0;
 }
 
+static int header_template_on_hit() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_cryptosdk_enc_materials *materials;
+    struct aws_hash_table enc_ctx;
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_keyring(alloc, cache, kr, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    struct aws_cryptosdk_enc_request request = { .alloc = alloc, .enc_ctx = &enc_ctx, .plaintext_size = 100 };
+
+    // A cache miss leaves the session to serialize the header itself
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(caching_cmm, &materials, &request));
+    TEST_ASSERT_INT_EQ(0, materials->header_template.len);
+    aws_cryptosdk_enc_materials_destroy(materials);
+
+    // A hit supplies exactly the sections the session would have serialized
+    aws_cryptosdk_enc_ctx_clear(&enc_ctx);
+    request.requested_alg = 0;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(caching_cmm, &materials, &request));
+    TEST_ASSERT_INT_NE(0, materials->header_template.len);
+
+    struct aws_byte_buf expected;
+    size_t expected_len = aws_cryptosdk_hdr_fields_size(&enc_ctx, &materials->encrypted_data_keys);
+    TEST_ASSERT_INT_EQ(expected_len, materials->header_template.len);
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&expected, alloc, expected_len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_write_fields(&expected, &enc_ctx, &materials->encrypted_data_keys));
+    TEST_ASSERT(aws_byte_buf_eq(&expected, &materials->header_template));
+    TEST_ASSERT(aws_cryptosdk_hdr_fields_match_edks(
+        aws_byte_cursor_from_buf(&materials->header_template), &materials->encrypted_data_keys));
+    aws_byte_buf_clean_up(&expected);
+    aws_cryptosdk_enc_materials_destroy(materials);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    // Messages whose headers were built from the template decrypt as usual
+    uint8_t plaintext[100], decrypted[100];
+    uint8_t *ciphertext;
+    size_t ciphertext_len, out_len, in_len;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(plaintext, sizeof(plaintext)));
+
+    struct aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, caching_cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 50));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_bound(session, sizeof(plaintext)));
+    TEST_ASSERT_SUCCESS(process_loop(alloc, &ciphertext, &ciphertext_len, session, plaintext, sizeof(plaintext)));
+    aws_cryptosdk_session_destroy(session);
+
+    session = aws_cryptosdk_session_new_from_keyring(alloc, AWS_CRYPTOSDK_DECRYPT, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+        session, decrypted, sizeof(decrypted), &out_len, ciphertext, ciphertext_len, &in_len));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(ciphertext_len, in_len);
+    TEST_ASSERT_INT_EQ(sizeof(plaintext), out_len);
+    TEST_ASSERT(!memcmp(plaintext, decrypted, sizeof(plaintext)));
+    aws_cryptosdk_session_destroy(session);
+
+    aws_mem_release(alloc, ciphertext);
+    aws_cryptosdk_keyring_release(kr);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_cmm_release(caching_cmm);
+
+    return 0;
+}
+
+/* Encrypts with caching_cmm, and checks which of the upstream CMM's data keys it used */
+static int refresh_generate(struct aws_cryptosdk_cmm *caching_cmm, struct aws_hash_table *enc_ctx, int expected_index) {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_enc_materials *materials;
+    struct aws_cryptosdk_enc_request request = { .alloc = alloc, .enc_ctx = enc_ctx, .plaintext_size = 10 };
+    struct aws_byte_buf expected_key;
+    char expected_key_str[16];
+
+    aws_cryptosdk_enc_ctx_clear(enc_ctx);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(caching_cmm, &materials, &request));
+
+    snprintf(expected_key_str, sizeof(expected_key_str), "UDK #%d", expected_index);
+    expected_key = aws_byte_buf_from_c_str(expected_key_str);
+    TEST_ASSERT(aws_byte_buf_eq(&expected_key, &materials->unencrypted_data_key));
+    aws_cryptosdk_enc_materials_destroy(materials);
+
+    return 0;
+}
+
+/* Waits for the refresh thread to put a replacement entry into the cache */
+static int wait_for_puts(struct aws_cryptosdk_materials_cache *cache, uint64_t expected_puts) {
+    struct aws_cryptosdk_materials_cache_stats stats;
+
+    for (int i = 0; i < 5000; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+        if (stats.encrypt_puts >= expected_puts) break;
+        aws_thread_current_sleep(1000 * 1000);
+    }
+
+    TEST_ASSERT_INT_EQ(expected_puts, stats.encrypt_puts);
+
+    return 0;
+}
+
+static int refresh_ahead() {
+    setup_mocks();
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_hash_table enc_ctx;
+
+    mock_upstream_cmm->materials_index = 1;
+    mock_upstream_cmm->n_edks          = 1;
+    mock_upstream_cmm->returned_alg    = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256;
+
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, cmm, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_messages(caching_cmm, 10));
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_caching_cmm_set_refresh_ahead(caching_cmm, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_refresh_ahead(caching_cmm, 50));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+
+    // The first four uses of the data key stay below half of the message limit
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_SUCCESS(refresh_generate(caching_cmm, &enc_ctx, 1));
+    }
+    TEST_ASSERT_SUCCESS(wait_for_puts(cache, 1));
+
+    // The fifth still uses the old data key, but queues its replacement
+    mock_upstream_cmm->materials_index = 2;
+    TEST_ASSERT_SUCCESS(refresh_generate(caching_cmm, &enc_ctx, 1));
+    TEST_ASSERT_SUCCESS(wait_for_puts(cache, 2));
+
+    // Later requests hit the replacement, well before the old key would have run out
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_SUCCESS(refresh_generate(caching_cmm, &enc_ctx, 2));
+    }
+    TEST_ASSERT_SUCCESS(wait_for_puts(cache, 2));
+
+    struct aws_cryptosdk_materials_cache_stats stats;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(8, stats.encrypt_hits);
+    TEST_ASSERT_INT_EQ(1, stats.misses);
+    TEST_ASSERT_INT_EQ(1, stats.replacements);
+
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_materials_cache_release(cache);
+    teardown();
+
+    return 0;
+}
+
+/* Delegates to another CMM after a delay, counting the calls made to it */
+struct slow_cmm {
+    struct aws_cryptosdk_cmm base;
+    struct aws_cryptosdk_cmm *delegate;
+    struct aws_atomic_var calls;
+};
+
+static void slow_cmm_destroy(struct aws_cryptosdk_cmm *generic_cmm) {
+    (void)generic_cmm;
+}
+
+static int slow_cmm_generate_enc_materials(
+    struct aws_cryptosdk_cmm *generic_cmm,
+    struct aws_cryptosdk_enc_materials **output,
+    struct aws_cryptosdk_enc_request *request) {
+    struct slow_cmm *slow = (struct slow_cmm *)generic_cmm;
+
+    aws_atomic_fetch_add(&slow->calls, 1);
+    aws_thread_current_sleep(50 * 1000 * 1000);
+
+    return aws_cryptosdk_cmm_generate_enc_materials(slow->delegate, output, request);
+}
+
+static int slow_cmm_decrypt_materials(
+    struct aws_cryptosdk_cmm *generic_cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request) {
+    struct slow_cmm *slow = (struct slow_cmm *)generic_cmm;
+
+    aws_atomic_fetch_add(&slow->calls, 1);
+    aws_thread_current_sleep(50 * 1000 * 1000);
+
+    return aws_cryptosdk_cmm_decrypt_materials(slow->delegate, output, request);
+}
+
+static const struct aws_cryptosdk_cmm_vt slow_cmm_vt = { .vt_size                = sizeof(slow_cmm_vt),
+                                                         .name                   = "Slow CMM",
+                                                         .destroy                = slow_cmm_destroy,
+                                                         .generate_enc_materials = slow_cmm_generate_enc_materials,
+                                                         .decrypt_materials      = slow_cmm_decrypt_materials };
+
+#define COALESCING_THREADS 4
+
+static void coalescing_worker(void *arg) {
+    struct aws_cryptosdk_cmm *caching_cmm = arg;
+    struct aws_allocator *alloc           = aws_default_allocator();
+    struct aws_cryptosdk_enc_materials *materials;
+    struct aws_hash_table enc_ctx;
+
+    if (aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx)) abort();
+    struct aws_cryptosdk_enc_request request = { .alloc = alloc, .enc_ctx = &enc_ctx, .plaintext_size = 10 };
+
+    if (aws_cryptosdk_cmm_generate_enc_materials(caching_cmm, &materials, &request)) abort();
+
+    aws_cryptosdk_enc_materials_destroy(materials);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+}
+
+static int concurrent_misses_coalesce() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_thread threads[COALESCING_THREADS];
+    struct aws_cryptosdk_materials_cache_stats stats;
+    struct slow_cmm slow;
+
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    aws_cryptosdk_cmm_base_init(&slow.base, &slow_cmm_vt);
+    aws_atomic_init_int(&slow.calls, 0);
+    slow.delegate = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(slow.delegate);
+
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, &slow.base, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+
+    // Every thread misses while the first is still waiting on the upstream CMM
+    for (int i = 0; i < COALESCING_THREADS; i++) {
+        TEST_ASSERT_SUCCESS(aws_thread_init(&threads[i], alloc));
+        TEST_ASSERT_SUCCESS(aws_thread_launch(&threads[i], coalescing_worker, caching_cmm, NULL));
+    }
+    for (int i = 0; i < COALESCING_THREADS; i++) {
+        aws_thread_join(&threads[i]);
+        aws_thread_clean_up(&threads[i]);
+    }
+
+    TEST_ASSERT_INT_EQ(1, aws_atomic_load_int(&slow.calls));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.encrypt_puts);
+    TEST_ASSERT_INT_EQ(COALESCING_THREADS - 1, stats.encrypt_hits);
+
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_cmm_release(slow.delegate);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+static int lease_generate(struct aws_cryptosdk_cmm *caching_cmm, const struct aws_string *value) {
+    AWS_STATIC_STRING_FROM_LITERAL(key, "lease");
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_enc_materials *materials;
+    struct aws_hash_table enc_ctx;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, key, (void *)value, NULL));
+    struct aws_cryptosdk_enc_request request = {
+        .alloc = alloc, .enc_ctx = &enc_ctx, .requested_alg = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, .plaintext_size = 1
+    };
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(caching_cmm, &materials, &request));
+
+    aws_cryptosdk_enc_materials_destroy(materials);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    return 0;
+}
+
+static int usage_lease() {
+    AWS_STATIC_STRING_FROM_LITERAL(value_a, "a");
+    AWS_STATIC_STRING_FROM_LITERAL(value_b, "b");
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    struct slow_cmm slow;
+
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    aws_cryptosdk_cmm_base_init(&slow.base, &slow_cmm_vt);
+    aws_atomic_init_int(&slow.calls, 0);
+    slow.delegate = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(slow.delegate);
+
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, &slow.base, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_messages(caching_cmm, 10));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_caching_cmm_set_usage_lease(caching_cmm, AWS_CRYPTOSDK_CACHE_MAX_LIMIT_MESSAGES + 1));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_usage_lease(caching_cmm, 8));
+
+    /*
+     * Alternating between two data keys moves the lease back and forth; the unused part of each
+     * lease is given back, so each key still serves exactly its ten messages
+     */
+    for (int i = 0; i < 20; i++) {
+        if (lease_generate(caching_cmm, i % 2 ? value_b : value_a)) return 1;
+    }
+    TEST_ASSERT_INT_EQ(2, aws_atomic_load_int(&slow.calls));
+
+    for (int i = 0; i < 2; i++) {
+        if (lease_generate(caching_cmm, i % 2 ? value_b : value_a)) return 1;
+    }
+    TEST_ASSERT_INT_EQ(4, aws_atomic_load_int(&slow.calls));
+
+    /* Sticking to one key, the lease is renewed as it runs out; the key from above has 9 uses left */
+    for (int i = 0; i < 19; i++) {
+        if (lease_generate(caching_cmm, value_a)) return 1;
+    }
+    TEST_ASSERT_INT_EQ(5, aws_atomic_load_int(&slow.calls));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(5, stats.encrypt_puts);
+    TEST_ASSERT_INT_EQ(36, stats.encrypt_hits);
+
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_cmm_release(slow.delegate);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+static int key_pool() {
+    AWS_STATIC_STRING_FROM_LITERAL(value_a, "a");
+    AWS_STATIC_STRING_FROM_LITERAL(value_b, "b");
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    struct slow_cmm slow;
+
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    aws_cryptosdk_cmm_base_init(&slow.base, &slow_cmm_vt);
+    aws_atomic_init_int(&slow.calls, 0);
+    slow.delegate = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(slow.delegate);
+
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, &slow.base, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_messages(caching_cmm, 8));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_caching_cmm_set_key_pool(caching_cmm, 0, AWS_CRYPTOSDK_KEY_POOL_ROUND_ROBIN));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_caching_cmm_set_key_pool(
+            caching_cmm, AWS_CRYPTOSDK_CACHE_MAX_KEY_POOL + 1, AWS_CRYPTOSDK_KEY_POOL_ROUND_ROBIN));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_key_pool(caching_cmm, 4, AWS_CRYPTOSDK_KEY_POOL_ROUND_ROBIN));
+
+    /* The first round creates the four keys of the pool, charged 0, 2, 4 and 6 messages up front */
+    for (int i = 0; i < 4; i++) {
+        if (lease_generate(caching_cmm, value_a)) return 1;
+    }
+    TEST_ASSERT_INT_EQ(4, aws_atomic_load_int(&slow.calls));
+
+    /* From then on, the keys run out one at a time: the last in the third round... */
+    for (int i = 0; i < 8; i++) {
+        if (lease_generate(caching_cmm, value_a)) return 1;
+    }
+    TEST_ASSERT_INT_EQ(5, aws_atomic_load_int(&slow.calls));
+
+    /* ...and the third in the fifth, while its replacement starts afresh */
+    for (int i = 0; i < 8; i++) {
+        if (lease_generate(caching_cmm, value_a)) return 1;
+    }
+    TEST_ASSERT_INT_EQ(6, aws_atomic_load_int(&slow.calls));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(6, stats.encrypt_puts);
+    TEST_ASSERT_INT_EQ(16, stats.encrypt_hits);
+
+    /* With thread affinity, this thread sticks to one key of the pool */
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_caching_cmm_set_key_pool(caching_cmm, 4, AWS_CRYPTOSDK_KEY_POOL_THREAD_AFFINITY));
+    for (int i = 0; i < 2; i++) {
+        if (lease_generate(caching_cmm, value_b)) return 1;
+    }
+    TEST_ASSERT_INT_EQ(7, aws_atomic_load_int(&slow.calls));
+
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_cmm_release(slow.delegate);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+static int invalidate_partition() {
+    AWS_STATIC_STRING_FROM_LITERAL(value, "value");
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_byte_buf name_a                  = aws_byte_buf_from_c_str("tenant a");
+    struct aws_byte_buf name_b                  = aws_byte_buf_from_c_str("tenant b");
+    struct slow_cmm slow;
+
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    aws_cryptosdk_cmm_base_init(&slow.base, &slow_cmm_vt);
+    aws_atomic_init_int(&slow.calls, 0);
+    slow.delegate = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(slow.delegate);
+
+    struct aws_cryptosdk_cmm *cmm_a =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, &slow.base, &name_a, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    struct aws_cryptosdk_cmm *cmm_b =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, &slow.base, &name_b, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm_a);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm_b);
+
+    if (lease_generate(cmm_a, value) || lease_generate(cmm_b, value)) return 1;
+    TEST_ASSERT_INT_EQ(2, aws_atomic_load_int(&slow.calls));
+
+    /* Only the invalidated tenant goes back to the upstream CMM */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_invalidate_partition(cmm_a));
+    if (lease_generate(cmm_a, value) || lease_generate(cmm_b, value)) return 1;
+    TEST_ASSERT_INT_EQ(3, aws_atomic_load_int(&slow.calls));
+
+    /* Other CMMs have no partition to invalidate */
+    TEST_ASSERT_ERROR(AWS_ERROR_UNSUPPORTED_OPERATION, aws_cryptosdk_caching_cmm_invalidate_partition(slow.delegate));
+
+    aws_cryptosdk_cmm_release(cmm_a);
+    aws_cryptosdk_cmm_release(cmm_b);
+    aws_cryptosdk_cmm_release(slow.delegate);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+/* Fails every decrypt request with the given error, counting the calls made to it */
+struct failing_cmm {
+    struct aws_cryptosdk_cmm base;
+    int error;
+    int calls;
+};
+
+static void failing_cmm_destroy(struct aws_cryptosdk_cmm *generic_cmm) {
+    (void)generic_cmm;
+}
+
+static int failing_cmm_decrypt_materials(
+    struct aws_cryptosdk_cmm *generic_cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request) {
+    struct failing_cmm *failing = (struct failing_cmm *)generic_cmm;
+    (void)output;
+    (void)request;
+
+    failing->calls++;
+
+    return aws_raise_error(failing->error);
+}
+
+static const struct aws_cryptosdk_cmm_vt failing_cmm_vt = { .vt_size           = sizeof(failing_cmm_vt),
+                                                            .name              = "Failing CMM",
+                                                            .destroy           = failing_cmm_destroy,
+                                                            .decrypt_materials = failing_cmm_decrypt_materials };
+
+static int negative_cache() {
+    struct aws_allocator *alloc                   = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache   = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_cryptosdk_dec_materials *materials = NULL;
+    struct failing_cmm failing;
+    struct aws_hash_table enc_ctx;
+
+    aws_cryptosdk_cmm_base_init(&failing.base, &failing_cmm_vt);
+    failing.error = AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT;
+    failing.calls = 0;
+
+    struct aws_cryptosdk_cmm *cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, &failing.base, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    caching_cmm_set_clock(cmm, mock_clock_get_ticks);
+    mock_clock_time = 0;
+
+    struct aws_cryptosdk_edk edk, edk_storage;
+    edk.provider_id   = aws_byte_buf_from_c_str("provider_id");
+    edk.provider_info = aws_byte_buf_from_c_str("provider_info");
+    edk.ciphertext    = aws_byte_buf_from_c_str("poison");
+
+    /* The request's list holds one EDK, which the test changes through edk_storage */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    struct aws_cryptosdk_dec_request request = { 0 };
+    request.alloc                            = alloc;
+    request.alg                              = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256;
+    request.enc_ctx                          = &enc_ctx;
+    aws_array_list_init_static(&request.encrypted_data_keys, &edk_storage, 1, sizeof(edk_storage));
+    TEST_ASSERT_SUCCESS(aws_array_list_push_back(&request.encrypted_data_keys, &edk));
+
+    /* Disabled by default */
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT, aws_cryptosdk_cmm_decrypt_materials(cmm, &materials, &request));
+    }
+    TEST_ASSERT_INT_EQ(2, failing.calls);
+
+    /* Once enabled, repeats fail without reaching the upstream CMM until the negative TTL passes */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_negative_ttl(cmm, 100, AWS_TIMESTAMP_NANOS));
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT, aws_cryptosdk_cmm_decrypt_materials(cmm, &materials, &request));
+    }
+    TEST_ASSERT_INT_EQ(3, failing.calls);
+
+    mock_clock_time = 100;
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT, aws_cryptosdk_cmm_decrypt_materials(cmm, &materials, &request));
+    TEST_ASSERT_INT_EQ(4, failing.calls);
+
+    /* A different message is not affected */
+    edk_storage.ciphertext = aws_byte_buf_from_c_str("other");
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT, aws_cryptosdk_cmm_decrypt_materials(cmm, &materials, &request));
+    TEST_ASSERT_INT_EQ(5, failing.calls);
+
+    /* Other failures are not cached */
+    failing.error          = AWS_ERROR_OOM;
+    edk_storage.ciphertext = aws_byte_buf_from_c_str("transient");
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_ERROR(AWS_ERROR_OOM, aws_cryptosdk_cmm_decrypt_materials(cmm, &materials, &request));
+    }
+    TEST_ASSERT_INT_EQ(7, failing.calls);
+
+    /* Disabling forgets remembered requests */
+    failing.error          = AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT;
+    edk_storage.ciphertext = aws_byte_buf_from_c_str("poison");
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_negative_ttl(cmm, 0, AWS_TIMESTAMP_NANOS));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT, aws_cryptosdk_cmm_decrypt_materials(cmm, &materials, &request));
+    TEST_ASSERT_INT_EQ(8, failing.calls);
+    TEST_ASSERT_ADDR_NULL(materials);
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    return 0;
+}
+
+static int session_keeps_borrowed_edks() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_cryptosdk_cmm *default_cmm       = aws_cryptosdk_default_cmm_new(alloc, kr);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    static const uint8_t plaintext[] = "borrowed EDKs";
+    uint8_t ct[2][1024], pt[sizeof(plaintext)];
+    size_t ct_len[2], pt_len, written, read;
+
+    TEST_ASSERT_ADDR_NOT_NULL(default_cmm);
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, default_cmm, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_buffer(
+        alloc, caching_cmm, NULL, ct[0], sizeof(ct[0]), &ct_len[0], plaintext, sizeof(plaintext)));
+
+    // The second message hits, and evicting its entry partway through must not disturb it
+    struct aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, caching_cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, sizeof(plaintext)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, ct[1], sizeof(ct[1]), &ct_len[1], NULL, 0, &read));
+    TEST_ASSERT(ct_len[1] > 0);
+    aws_cryptosdk_materials_cache_clear(cache);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+        session, ct[1] + ct_len[1], sizeof(ct[1]) - ct_len[1], &written, plaintext, sizeof(plaintext), &read));
+    ct_len[1] += written;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    aws_cryptosdk_session_destroy(session);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.encrypt_hits);
+
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_decrypt_buffer(alloc, default_cmm, NULL, pt, sizeof(pt), &pt_len, ct[i], ct_len[i]));
+        TEST_ASSERT_INT_EQ(sizeof(plaintext), pt_len);
+        TEST_ASSERT(!memcmp(plaintext, pt, pt_len));
+    }
+
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_cmm_release(default_cmm);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+static int write_through() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_cryptosdk_cmm *default_cmm       = aws_cryptosdk_default_cmm_new(alloc, kr);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    static const uint8_t plaintext[] = "read after write";
+    uint8_t ct[1024], pt[sizeof(plaintext)];
+    size_t ct_len, pt_len;
+
+    TEST_ASSERT_ADDR_NOT_NULL(default_cmm);
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, default_cmm, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+
+    // Off by default
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_encrypt_buffer(alloc, caching_cmm, NULL, ct, sizeof(ct), &ct_len, plaintext, sizeof(plaintext)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.encrypt_puts);
+    TEST_ASSERT_INT_EQ(0, stats.decrypt_puts);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_write_through(caching_cmm, true));
+    aws_cryptosdk_materials_cache_clear(cache);
+
+    // The miss caches both ways, so the first decryption of the (signed) message hits
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_encrypt_buffer(alloc, caching_cmm, NULL, ct, sizeof(ct), &ct_len, plaintext, sizeof(plaintext)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(2, stats.encrypt_puts);
+    TEST_ASSERT_INT_EQ(1, stats.decrypt_puts);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_buffer(alloc, caching_cmm, NULL, pt, sizeof(pt), &pt_len, ct, ct_len));
+    TEST_ASSERT_INT_EQ(sizeof(plaintext), pt_len);
+    TEST_ASSERT(!memcmp(plaintext, pt, pt_len));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.decrypt_hits);
+    TEST_ASSERT_INT_EQ(1, stats.decrypt_puts);
+
+    // The cached materials still check the signature
+    ct[ct_len - 1] ^= 1;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_decrypt_buffer(alloc, caching_cmm, NULL, pt, sizeof(pt), &pt_len, ct, ct_len));
+
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_cmm_release(default_cmm);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+struct recorded_requests {
+    struct aws_cryptosdk_caching_cmm_request_record records[4];
+    size_t count;
+};
+
+static void record_to_array(const struct aws_cryptosdk_caching_cmm_request_record *record, void *user_data) {
+    struct recorded_requests *recorded = user_data;
+    if (recorded->count < sizeof(recorded->records) / sizeof(recorded->records[0])) {
+        recorded->records[recorded->count] = *record;
+    }
+    recorded->count++;
+}
+
+static int request_recorder() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_cryptosdk_cmm *default_cmm       = aws_cryptosdk_default_cmm_new(alloc, kr);
+    struct recorded_requests recorded           = { .count = 0 };
+    static const uint8_t plaintext[]            = "recorded";
+    uint8_t ct[1024], pt[sizeof(plaintext)];
+    size_t ct_len, pt_len;
+
+    TEST_ASSERT_ADDR_NOT_NULL(default_cmm);
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_UNSUPPORTED_OPERATION,
+        aws_cryptosdk_caching_cmm_set_request_recorder(default_cmm, record_to_array, &recorded));
+
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, default_cmm, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_request_recorder(caching_cmm, record_to_array, &recorded));
+
+    // Two encryptions with the same context share a cache ID, and so a hash; the decryption has its own
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_buffer(
+            alloc, caching_cmm, NULL, ct, sizeof(ct), &ct_len, plaintext, sizeof(plaintext)));
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_buffer(alloc, caching_cmm, NULL, pt, sizeof(pt), &pt_len, ct, ct_len));
+
+    TEST_ASSERT_INT_EQ(3, recorded.count);
+    TEST_ASSERT(recorded.records[0].is_encrypt && recorded.records[1].is_encrypt && !recorded.records[2].is_encrypt);
+    TEST_ASSERT_INT_EQ(sizeof(plaintext), recorded.records[0].bytes);
+    TEST_ASSERT_INT_EQ(0, recorded.records[2].bytes);
+    TEST_ASSERT_INT_EQ(recorded.records[0].cache_id_hash, recorded.records[1].cache_id_hash);
+    TEST_ASSERT(recorded.records[0].cache_id_hash != recorded.records[2].cache_id_hash);
+    TEST_ASSERT(recorded.records[0].timestamp > 0 && recorded.records[0].timestamp <= recorded.records[2].timestamp);
+
+    // Once the recorder is removed, requests are no longer recorded
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_request_recorder(caching_cmm, NULL, NULL));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_encrypt_buffer(alloc, caching_cmm, NULL, ct, sizeof(ct), &ct_len, plaintext, sizeof(plaintext)));
+    TEST_ASSERT_INT_EQ(3, recorded.count);
+
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_cmm_release(default_cmm);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+static int prewarm_decrypt() {
+    enum { NUM_MESSAGES = 8 };
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_cmm *default_cmm       = aws_cryptosdk_default_cmm_new(alloc, kr);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    static const uint8_t plaintext[] = "prewarmed";
+    uint8_t ct[NUM_MESSAGES][1024], pt[sizeof(plaintext)];
+    size_t ct_len[NUM_MESSAGES], pt_len, warmed;
+    struct aws_byte_cursor headers[NUM_MESSAGES + 1];
+
+    TEST_ASSERT_ADDR_NOT_NULL(default_cmm);
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, default_cmm, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+
+    // Each message has its own data key; the whole message may stand in for its header
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_buffer(
+            alloc, default_cmm, NULL, ct[i], sizeof(ct[i]), &ct_len[i], plaintext, sizeof(plaintext)));
+        headers[i] = aws_byte_cursor_from_array(ct[i], ct_len[i]);
+    }
+    headers[NUM_MESSAGES] = aws_byte_cursor_from_c_str("not a header");
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_prewarm_decrypt(caching_cmm, headers, NUM_MESSAGES + 1, 4, &warmed));
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES, warmed);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES, stats.decrypt_puts);
+
+    // Warming up again only hits
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_prewarm_decrypt(caching_cmm, headers, NUM_MESSAGES, 1, &warmed));
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES, warmed);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES, stats.decrypt_puts);
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES, stats.decrypt_hits);
+
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_decrypt_buffer(alloc, caching_cmm, NULL, pt, sizeof(pt), &pt_len, ct[i], ct_len[i]));
+        TEST_ASSERT_INT_EQ(sizeof(plaintext), pt_len);
+        TEST_ASSERT(!memcmp(plaintext, pt, pt_len));
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES, stats.decrypt_puts);
+    TEST_ASSERT_INT_EQ(2 * NUM_MESSAGES, stats.decrypt_hits);
+
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_cmm_release(default_cmm);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+static int decrypt_materials_batch() {
+    enum { NUM_MESSAGES = 3, NUM_REQUESTS = 6 };
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_cmm *default_cmm       = aws_cryptosdk_default_cmm_new(alloc, kr);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    static const uint8_t plaintext[] = "batched";
+    uint8_t ct[NUM_MESSAGES][1024];
+    size_t ct_len;
+    struct aws_cryptosdk_hdr hdrs[NUM_MESSAGES];
+    struct aws_cryptosdk_dec_request requests[NUM_REQUESTS];
+    struct aws_cryptosdk_dec_materials *outputs[NUM_REQUESTS];
+    int errors[NUM_REQUESTS];
+
+    TEST_ASSERT_ADDR_NOT_NULL(default_cmm);
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, default_cmm, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_buffer(
+            alloc, default_cmm, NULL, ct[i], sizeof(ct[i]), &ct_len, plaintext, sizeof(plaintext)));
+        struct aws_byte_cursor cursor = aws_byte_cursor_from_array(ct[i], ct_len);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_init(&hdrs[i], alloc));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_parse(&hdrs[i], &cursor));
+    }
+
+    // Each message is requested twice, and the last request is for an algorithm that is never cached
+    for (int i = 0; i < NUM_REQUESTS; i++) {
+        struct aws_cryptosdk_hdr *hdr = &hdrs[i % NUM_MESSAGES];
+
+        requests[i] = (struct aws_cryptosdk_dec_request){ .alloc               = alloc,
+                                                          .enc_ctx             = &hdr->enc_ctx,
+                                                          .encrypted_data_keys = hdr->edk_list,
+                                                          .alg                 = hdr->alg_id };
+    }
+    requests[NUM_REQUESTS - 1].alg = ALG_AES128_GCM_IV12_TAG16_NO_KDF;
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_caching_cmm_decrypt_materials_batch(caching_cmm, outputs, requests, errors, NUM_REQUESTS));
+
+    // Repeated requests hit the entry cached by the first
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES, stats.decrypt_puts);
+    TEST_ASSERT_INT_EQ(NUM_REQUESTS - NUM_MESSAGES - 1, stats.decrypt_hits);
+
+    for (int i = 0; i < NUM_REQUESTS; i++) {
+        TEST_ASSERT_INT_EQ(0, errors[i]);
+        TEST_ASSERT_ADDR_NOT_NULL(outputs[i]);
+        TEST_ASSERT_INT_EQ(requests[i].alg, outputs[i]->alg);
+    }
+    TEST_ASSERT(aws_byte_buf_eq(&outputs[0]->unencrypted_data_key, &outputs[NUM_MESSAGES]->unencrypted_data_key));
+    for (int i = 0; i < NUM_REQUESTS; i++) {
+        aws_cryptosdk_dec_materials_destroy(outputs[i]);
+    }
+
+    // A second batch is served from one batched lookup, with the content key of each message attached
+    for (int i = 0; i < NUM_REQUESTS - 1; i++) {
+        requests[i].message_id = hdrs[i % NUM_MESSAGES].message_id;
+    }
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_caching_cmm_decrypt_materials_batch(caching_cmm, outputs, requests, NULL, NUM_REQUESTS - 1));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES, stats.decrypt_puts);
+    TEST_ASSERT_INT_EQ(2 * (NUM_REQUESTS - 1) - NUM_MESSAGES, stats.decrypt_hits);
+    for (int i = 0; i < NUM_REQUESTS - 1; i++) {
+        const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(requests[i].alg);
+        struct data_key data_key                         = { { 0 } };
+        struct content_key expected;
+
+        TEST_ASSERT_ADDR_NOT_NULL(outputs[i]);
+        TEST_ASSERT_INT_EQ(props->content_key_len, outputs[i]->content_key.len);
+        memcpy(data_key.keybuf, outputs[i]->unencrypted_data_key.buffer, outputs[i]->unencrypted_data_key.len);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_derive_key(props, &expected, &data_key, requests[i].message_id));
+        TEST_ASSERT(!memcmp(expected.keybuf, outputs[i]->content_key.buffer, props->content_key_len));
+        aws_cryptosdk_dec_materials_destroy(outputs[i]);
+        requests[i].message_id = NULL;
+    }
+
+    // Failures are reported per request
+    aws_cryptosdk_materials_cache_clear(cache);
+    struct aws_cryptosdk_edk no_edks[1];
+    aws_array_list_init_static(&requests[0].encrypted_data_keys, no_edks, 1, sizeof(no_edks[0]));
+    aws_array_list_clear(&requests[0].encrypted_data_keys);
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT,
+        aws_cryptosdk_caching_cmm_decrypt_materials_batch(caching_cmm, outputs, requests, errors, 2));
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT, errors[0]);
+    TEST_ASSERT_ADDR_NULL(outputs[0]);
+    TEST_ASSERT_INT_EQ(0, errors[1]);
+    TEST_ASSERT_ADDR_NOT_NULL(outputs[1]);
+    aws_cryptosdk_dec_materials_destroy(outputs[1]);
+
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        aws_cryptosdk_hdr_clean_up(&hdrs[i]);
+    }
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_cmm_release(default_cmm);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+static struct {
+    int calls;
+    size_t ops, max_ops;
+} digest_counts;
+
+static int counting_sha512_many(const struct aws_cryptosdk_digest_op *ops, size_t count) {
+    digest_counts.calls++;
+    digest_counts.ops += count;
+    if (count > digest_counts.max_ops) digest_counts.max_ops = count;
+    return aws_cryptosdk_digest_provider_openssl()->sha512_many(ops, count);
+}
+
+static const struct aws_cryptosdk_digest_provider_vt counting_digest_provider = {
+    .vt_size = sizeof(counting_digest_provider), .name = "counting", .sha512_many = counting_sha512_many
+};
+
+static int digest_provider() {
+    enum { NUM_MESSAGES = 12 };
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr            = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_cmm *default_cmm       = aws_cryptosdk_default_cmm_new(alloc, kr);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    static const uint8_t plaintext[] = "digested";
+    uint8_t ct[NUM_MESSAGES][1024], pt[sizeof(plaintext)];
+    size_t ct_len[NUM_MESSAGES], pt_len;
+    struct aws_cryptosdk_hdr hdrs[NUM_MESSAGES];
+    struct aws_cryptosdk_dec_request requests[NUM_MESSAGES];
+    struct aws_cryptosdk_dec_materials *outputs[NUM_MESSAGES];
+    static const struct aws_cryptosdk_digest_provider_vt truncated = { .vt_size = sizeof(size_t) };
+
+    TEST_ASSERT_ADDR_NOT_NULL(default_cmm);
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_UNSUPPORTED_OPERATION,
+        aws_cryptosdk_caching_cmm_set_digest_provider(default_cmm, aws_cryptosdk_digest_provider_openssl()));
+    struct aws_cryptosdk_cmm *caching_cmm =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, default_cmm, NULL, UINT64_MAX, AWS_TIMESTAMP_NANOS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching_cmm);
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_caching_cmm_set_digest_provider(caching_cmm, &truncated));
+
+    // Materials cached under the IDs hashed the usual way...
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_buffer(
+            alloc, default_cmm, NULL, ct[i], sizeof(ct[i]), &ct_len[i], plaintext, sizeof(plaintext)));
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_decrypt_buffer(alloc, caching_cmm, NULL, pt, sizeof(pt), &pt_len, ct[i], ct_len[i]));
+
+        struct aws_byte_cursor cursor = aws_byte_cursor_from_array(ct[i], ct_len[i]);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_init(&hdrs[i], alloc));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_parse(&hdrs[i], &cursor));
+        requests[i] = (struct aws_cryptosdk_dec_request){ .alloc               = alloc,
+                                                          .enc_ctx             = &hdrs[i].enc_ctx,
+                                                          .encrypted_data_keys = hdrs[i].edk_list,
+                                                          .alg                 = hdrs[i].alg_id };
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES, stats.decrypt_puts);
+
+    // ...are found again with the EDKs hashed by the provider, across requests, a chunk at a time
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_digest_provider(caching_cmm, &counting_digest_provider));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_caching_cmm_decrypt_materials_batch(caching_cmm, outputs, requests, NULL, NUM_MESSAGES));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES, stats.decrypt_puts);
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES, stats.decrypt_hits);
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        TEST_ASSERT_ADDR_NOT_NULL(outputs[i]);
+        aws_cryptosdk_dec_materials_destroy(outputs[i]);
+    }
+    TEST_ASSERT(digest_counts.ops >= NUM_MESSAGES);
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_DIGEST_MAX_OPS, digest_counts.max_ops);
+    TEST_ASSERT_INT_EQ((digest_counts.ops + AWS_CRYPTOSDK_DIGEST_MAX_OPS - 1) / AWS_CRYPTOSDK_DIGEST_MAX_OPS,
+                       digest_counts.calls);
+
+    // Single decryptions go through the provider too
+    digest_counts.calls = 0;
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_decrypt_buffer(alloc, caching_cmm, NULL, pt, sizeof(pt), &pt_len, ct[0], ct_len[0]));
+    TEST_ASSERT_INT_EQ(1, digest_counts.calls);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(NUM_MESSAGES + 1, stats.decrypt_hits);
+
+    // Without a provider, hashing goes back to the built-in digest
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_digest_provider(caching_cmm, NULL));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_decrypt_buffer(alloc, caching_cmm, NULL, pt, sizeof(pt), &pt_len, ct[0], ct_len[0]));
+    TEST_ASSERT_INT_EQ(1, digest_counts.calls);
+
+    for (int i = 0; i < NUM_MESSAGES; i++) {
+        aws_cryptosdk_hdr_clean_up(&hdrs[i]);
+    }
+    aws_cryptosdk_cmm_release(caching_cmm);
+    aws_cryptosdk_cmm_release(default_cmm);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
 static int message_bound_error_code() {
     setup_mocks();
     size_t message_bound_size = 128;
@@ -1276,6 +2452,13 @@ static int disallowed_limits() {
 
     TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_limit_bytes(cmm, INT64_MAX));
 
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_caching_cmm_set_clock_precision(cmm, 1, (enum aws_timestamp_unit)7));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_clock_precision(cmm, 0, AWS_TIMESTAMP_MILLIS));
+    // Releasing the CMM releases the coarse clock it holds
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_caching_cmm_set_clock_precision(cmm, 10, AWS_TIMESTAMP_MILLIS));
+
     aws_cryptosdk_cmm_release(cmm);
     teardown();
     return 0;
@@ -1332,15 +2515,30 @@ struct test_case caching_cmm_test_cases[] = { TEST_CASE(create_destroy),
                                               TEST_CASE(enc_cache_hit),
                                               TEST_CASE(byte_and_message_limits_test),
                                               TEST_CASE(ttl_test),
+                                              TEST_CASE(ttl_jitter),
                                               TEST_CASE(zero_byte_limit_zero_length_messages),
                                               TEST_CASE(dec_cache_id_test_vecs),
                                               TEST_CASE(dec_materials),
+                                              TEST_CASE(derived_content_key),
                                               TEST_CASE(cache_miss_failed_put),
                                               TEST_CASE(same_partition_id_cache_ids_match),
                                               TEST_CASE(static_and_null_partition_id_dont_match),
                                               TEST_CASE(two_null_partition_ids_dont_match),
                                               TEST_CASE(two_different_static_partition_ids_dont_match),
                                               TEST_CASE(set_message_bound_with_caching_cmm),
+                                              TEST_CASE(header_template_on_hit),
+                                              TEST_CASE(refresh_ahead),
+                                              TEST_CASE(concurrent_misses_coalesce),
+                                              TEST_CASE(session_keeps_borrowed_edks),
+                                              TEST_CASE(write_through),
+                                              TEST_CASE(request_recorder),
+                                              TEST_CASE(prewarm_decrypt),
+                                              TEST_CASE(decrypt_materials_batch),
+                                              TEST_CASE(digest_provider),
+                                              TEST_CASE(negative_cache),
+                                              TEST_CASE(usage_lease),
+                                              TEST_CASE(key_pool),
+                                              TEST_CASE(invalidate_partition),
                                               TEST_CASE(message_bound_error_code),
                                               TEST_CASE(disallowed_limits),
                                               TEST_CASE(time_conversions_work),
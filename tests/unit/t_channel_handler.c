@@ -0,0 +1,379 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/channel_handler.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/config.h>
+#include <aws/cryptosdk/raw_aes_keyring.h>
+#include <aws/cryptosdk/session.h>
+#include "testing.h"
+
+#include <string.h>
+
+#ifdef AWS_CRYPTOSDK_P_HAVE_AWS_C_IO
+#    include <aws/common/condition_variable.h>
+#    include <aws/common/mutex.h>
+#    include <aws/io/channel.h>
+#    include <aws/io/event_loop.h>
+#    include <aws/io/io.h>
+
+#    define PLAINTEXT_SIZE 10000
+
+AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "channel");
+AWS_STATIC_STRING_FROM_LITERAL(key_name, "test-key");
+
+static const uint8_t key_bytes[32] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                                       17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32 };
+
+static uint8_t plaintext[PLAINTEXT_SIZE];
+
+/* A handler at either end of the channel, which keeps whatever reaches it */
+struct end_handler {
+    struct aws_channel_handler handler;
+    struct aws_byte_buf received;
+};
+
+static int end_receive(
+    struct aws_channel_handler *handler, struct aws_channel_slot *slot, struct aws_io_message *message) {
+    struct end_handler *end     = handler->impl;
+    struct aws_byte_cursor data = aws_byte_cursor_from_buf(&message->message_data);
+    int rv                      = aws_byte_buf_append_dynamic(&end->received, &data);
+    (void)slot;
+
+    aws_mem_release(message->allocator, message);
+    return rv;
+}
+
+static int end_increment_read_window(
+    struct aws_channel_handler *handler, struct aws_channel_slot *slot, size_t size) {
+    (void)handler;
+    (void)slot;
+    (void)size;
+    return AWS_OP_SUCCESS;
+}
+
+static int end_shutdown(
+    struct aws_channel_handler *handler,
+    struct aws_channel_slot *slot,
+    enum aws_channel_direction dir,
+    int error_code,
+    bool free_scarce_resources_immediately) {
+    (void)handler;
+    return aws_channel_slot_on_handler_shutdown_complete(slot, dir, error_code, free_scarce_resources_immediately);
+}
+
+static size_t end_initial_window_size(struct aws_channel_handler *handler) {
+    (void)handler;
+    return SIZE_MAX;
+}
+
+static size_t end_message_overhead(struct aws_channel_handler *handler) {
+    (void)handler;
+    return 0;
+}
+
+static void end_destroy(struct aws_channel_handler *handler) {
+    (void)handler;
+}
+
+static struct aws_channel_handler_vtable end_vtable = { .process_read_message  = end_receive,
+                                                        .process_write_message = end_receive,
+                                                        .increment_read_window = end_increment_read_window,
+                                                        .shutdown              = end_shutdown,
+                                                        .initial_window_size   = end_initial_window_size,
+                                                        .message_overhead      = end_message_overhead,
+                                                        .destroy               = end_destroy };
+
+/*
+ * A channel of the socket's end, the handler under test and the application's end, which the
+ * tests drive by running tasks on the channel's thread.
+ */
+static struct harness {
+    struct aws_mutex mutex;
+    struct aws_condition_variable signal;
+    struct aws_event_loop_group *elg;
+    struct aws_channel *channel;
+    struct aws_channel_handler *handler;
+    struct aws_channel_slot *socket_slot, *app_slot;
+    struct end_handler socket_end, app_end;
+    bool set_up, task_done, shut_down, elg_released;
+    int shutdown_error;
+    /* Input the task sends, and in what direction */
+    struct aws_byte_cursor input;
+    size_t chunk_size;
+} h = { .mutex = AWS_MUTEX_INIT, .signal = AWS_CONDITION_VARIABLE_INIT };
+
+static bool is_set_up(void *arg) {
+    return ((struct harness *)arg)->set_up;
+}
+
+static bool is_task_done(void *arg) {
+    return ((struct harness *)arg)->task_done;
+}
+
+static bool is_shut_down(void *arg) {
+    return ((struct harness *)arg)->shut_down;
+}
+
+static bool is_elg_released(void *arg) {
+    return ((struct harness *)arg)->elg_released;
+}
+
+static void signal_flag(bool *flag) {
+    aws_mutex_lock(&h.mutex);
+    *flag = true;
+    aws_condition_variable_notify_all(&h.signal);
+    aws_mutex_unlock(&h.mutex);
+}
+
+static void on_setup(struct aws_channel *channel, int error_code, void *user_data) {
+    (void)user_data;
+    (void)error_code;
+
+    // Slots are set up on the channel's thread
+    h.socket_slot                 = aws_channel_slot_new(channel);
+    struct aws_channel_slot *slot = aws_channel_slot_new(channel);
+    h.app_slot                    = aws_channel_slot_new(channel);
+    aws_channel_slot_insert_end(channel, slot);
+    aws_channel_slot_insert_end(channel, h.app_slot);
+    aws_channel_slot_set_handler(h.socket_slot, &h.socket_end.handler);
+    aws_channel_slot_set_handler(slot, h.handler);
+    aws_channel_slot_set_handler(h.app_slot, &h.app_end.handler);
+    signal_flag(&h.set_up);
+}
+
+static void on_shutdown(struct aws_channel *channel, int error_code, void *user_data) {
+    (void)channel;
+    (void)user_data;
+    h.shutdown_error = error_code;
+    signal_flag(&h.shut_down);
+}
+
+static void on_elg_released(void *user_data) {
+    (void)user_data;
+    signal_flag(&h.elg_released);
+}
+
+static void wait_for(bool (*pred)(void *)) {
+    aws_mutex_lock(&h.mutex);
+    aws_condition_variable_wait_pred(&h.signal, &h.mutex, pred, &h);
+    aws_mutex_unlock(&h.mutex);
+}
+
+static int harness_start(struct aws_cryptosdk_session *read_session, struct aws_cryptosdk_session *write_session) {
+    struct aws_allocator *alloc                          = aws_default_allocator();
+    struct aws_cryptosdk_channel_handler_options options = { .read_session  = read_session,
+                                                             .write_session = write_session };
+    struct aws_shutdown_callback_options elg_shutdown    = { .shutdown_callback_fn = on_elg_released };
+
+    aws_io_library_init(alloc);
+    h.set_up = h.task_done = h.shut_down = h.elg_released = false;
+    for (size_t i = 0; i < 2; i++) {
+        struct end_handler *end = i ? &h.app_end : &h.socket_end;
+        end->handler.vtable     = &end_vtable;
+        end->handler.alloc      = alloc;
+        end->handler.impl       = end;
+        TEST_ASSERT_SUCCESS(aws_byte_buf_init(&end->received, alloc, 0));
+    }
+    TEST_ASSERT_ADDR_NOT_NULL(h.handler = aws_cryptosdk_channel_handler_new(alloc, &options));
+    TEST_ASSERT_ADDR_NOT_NULL(h.elg = aws_event_loop_group_new_default(alloc, 1, &elg_shutdown));
+
+    struct aws_event_loop *event_loop          = aws_event_loop_group_get_next_loop(h.elg);
+    struct aws_channel_options channel_options = { .event_loop                = event_loop,
+                                                   .on_setup_completed        = on_setup,
+                                                   .on_shutdown_completed     = on_shutdown,
+                                                   .enable_read_back_pressure = true };
+    TEST_ASSERT_ADDR_NOT_NULL(h.channel = aws_channel_new(alloc, &channel_options));
+    wait_for(is_set_up);
+    return 0;
+}
+
+/* Sends h.input in h.chunk_size pieces, from the socket's end if read, else from the application's */
+static void send_task(struct aws_channel_task *task, void *arg, enum aws_task_status status) {
+    bool read                    = arg != NULL;
+    struct aws_channel_slot *src = read ? h.socket_slot : h.app_slot;
+    (void)task;
+
+    while (status == AWS_TASK_STATUS_RUN_READY && h.input.len) {
+        size_t len = h.input.len < h.chunk_size ? h.input.len : h.chunk_size;
+        struct aws_io_message *message =
+            aws_channel_acquire_message_from_pool(h.channel, AWS_IO_MESSAGE_APPLICATION_DATA, len);
+        struct aws_byte_cursor chunk = aws_byte_cursor_advance(&h.input, len);
+
+        aws_byte_buf_write_from_whole_cursor(&message->message_data, chunk);
+        if (aws_channel_slot_send_message(src, message, read ? AWS_CHANNEL_DIR_READ : AWS_CHANNEL_DIR_WRITE)) {
+            aws_mem_release(message->allocator, message);
+            break;
+        }
+    }
+    signal_flag(&h.task_done);
+}
+
+static void harness_send(struct aws_byte_cursor input, size_t chunk_size, bool read) {
+    struct aws_channel_task task;
+
+    h.input      = input;
+    h.chunk_size = chunk_size;
+    h.task_done  = false;
+    aws_channel_task_init(&task, send_task, read ? &h : NULL, "test_send");
+    aws_channel_schedule_task_now(h.channel, &task);
+    wait_for(is_task_done);
+}
+
+static int harness_shutdown() {
+    aws_channel_shutdown(h.channel, AWS_OP_SUCCESS);
+    wait_for(is_shut_down);
+    return h.shutdown_error;
+}
+
+static void harness_clean_up() {
+    // Destroying the channel destroys the handlers in it
+    aws_channel_destroy(h.channel);
+    aws_event_loop_group_release(h.elg);
+    wait_for(is_elg_released);
+    aws_byte_buf_clean_up(&h.socket_end.received);
+    aws_byte_buf_clean_up(&h.app_end.received);
+    aws_io_library_clean_up();
+}
+
+static struct aws_cryptosdk_session *new_session(enum aws_cryptosdk_mode mode) {
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_raw_aes_keyring_new(
+        aws_default_allocator(), key_namespace, key_name, key_bytes, AWS_CRYPTOSDK_AES256);
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), mode, kr);
+
+    aws_cryptosdk_keyring_release(kr);
+    // Small frames, so that frames straddle the messages carrying them
+    if (session && mode == AWS_CRYPTOSDK_ENCRYPT) aws_cryptosdk_session_set_frame_size(session, 300);
+    return session;
+}
+
+/* Encrypts the plaintext into ct, whose capacity is large enough */
+static int encrypt_plaintext(struct aws_byte_buf *ct) {
+    struct aws_cryptosdk_session *session = new_session(AWS_CRYPTOSDK_ENCRYPT);
+    size_t read;
+
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(ct, aws_default_allocator(), PLAINTEXT_SIZE * 2));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, PLAINTEXT_SIZE));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, ct->buffer, ct->capacity, &ct->len, plaintext, PLAINTEXT_SIZE, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    aws_cryptosdk_session_destroy(session);
+    return 0;
+}
+
+static int encrypts_writes_until_shutdown() {
+    struct aws_cryptosdk_session *enc = new_session(AWS_CRYPTOSDK_ENCRYPT);
+    struct aws_cryptosdk_session *dec = new_session(AWS_CRYPTOSDK_DECRYPT);
+    uint8_t out[PLAINTEXT_SIZE];
+    size_t written, read;
+
+    for (size_t i = 0; i < PLAINTEXT_SIZE; i++) plaintext[i] = (uint8_t)(i * 7);
+    TEST_ASSERT_ADDR_NOT_NULL(enc);
+    TEST_ASSERT_ADDR_NOT_NULL(dec);
+    if (harness_start(NULL, enc)) return 1;
+
+    // The message size is unknown, so the last frame waits for the write side to shut down
+    harness_send(aws_byte_cursor_from_array(plaintext, PLAINTEXT_SIZE), 1000, false);
+    TEST_ASSERT(!aws_cryptosdk_session_is_done(enc));
+    TEST_ASSERT_INT_EQ(harness_shutdown(), AWS_OP_SUCCESS);
+    TEST_ASSERT(aws_cryptosdk_session_is_done(enc));
+
+    struct aws_byte_buf *ct = &h.socket_end.received;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(dec, out, sizeof(out), &written, ct->buffer, ct->len, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(dec));
+    TEST_ASSERT_INT_EQ(read, ct->len);
+    TEST_ASSERT_INT_EQ(written, PLAINTEXT_SIZE);
+    TEST_ASSERT(!memcmp(out, plaintext, PLAINTEXT_SIZE));
+
+    harness_clean_up();
+    aws_cryptosdk_session_destroy(enc);
+    aws_cryptosdk_session_destroy(dec);
+    return 0;
+}
+
+static int decrypts_reads_across_messages() {
+    struct aws_cryptosdk_session *dec = new_session(AWS_CRYPTOSDK_DECRYPT);
+    struct aws_byte_buf ct;
+
+    for (size_t i = 0; i < PLAINTEXT_SIZE; i++) plaintext[i] = (uint8_t)(i * 13);
+    if (encrypt_plaintext(&ct)) return 1;
+    TEST_ASSERT_ADDR_NOT_NULL(dec);
+    if (harness_start(dec, NULL)) return 1;
+
+    // Chunks of an odd size split the header and most frames between messages
+    harness_send(aws_byte_cursor_from_buf(&ct), 173, true);
+    TEST_ASSERT(aws_cryptosdk_session_is_done(dec));
+    TEST_ASSERT_INT_EQ(h.app_end.received.len, PLAINTEXT_SIZE);
+    TEST_ASSERT(!memcmp(h.app_end.received.buffer, plaintext, PLAINTEXT_SIZE));
+    TEST_ASSERT_INT_EQ(harness_shutdown(), AWS_OP_SUCCESS);
+
+    harness_clean_up();
+    aws_byte_buf_clean_up(&ct);
+    aws_cryptosdk_session_destroy(dec);
+    return 0;
+}
+
+static int truncated_message_fails_shutdown() {
+    struct aws_cryptosdk_session *dec = new_session(AWS_CRYPTOSDK_DECRYPT);
+    struct aws_byte_buf ct;
+
+    if (encrypt_plaintext(&ct)) return 1;
+    TEST_ASSERT_ADDR_NOT_NULL(dec);
+    if (harness_start(dec, NULL)) return 1;
+
+    harness_send(aws_byte_cursor_from_array(ct.buffer, ct.len - 10), 1000, true);
+    TEST_ASSERT(!aws_cryptosdk_session_is_done(dec));
+    TEST_ASSERT_INT_EQ(harness_shutdown(), AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+
+    harness_clean_up();
+    aws_byte_buf_clean_up(&ct);
+    aws_cryptosdk_session_destroy(dec);
+    return 0;
+}
+
+static int needs_a_session() {
+    struct aws_cryptosdk_channel_handler_options options = { 0 };
+
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_channel_handler_new(aws_default_allocator(), NULL));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_channel_handler_new(aws_default_allocator(), &options));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
+    return 0;
+}
+
+#    define TEST_CASE(name) \
+        { "channel_handler", #name, name }
+struct test_case channel_handler_test_cases[] = { TEST_CASE(encrypts_writes_until_shutdown),
+                                                  TEST_CASE(decrypts_reads_across_messages),
+                                                  TEST_CASE(truncated_message_fails_shutdown),
+                                                  TEST_CASE(needs_a_session),
+                                                  { NULL } };
+
+#else  // AWS_CRYPTOSDK_P_HAVE_AWS_C_IO
+
+static int unavailable_without_aws_c_io() {
+    struct aws_cryptosdk_channel_handler_options options = { 0 };
+
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_channel_handler_new(aws_default_allocator(), &options));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_UNSUPPORTED_OPERATION);
+    return 0;
+}
+
+#    define TEST_CASE(name) \
+        { "channel_handler", #name, name }
+struct test_case channel_handler_test_cases[] = { TEST_CASE(unavailable_without_aws_c_io), { NULL } };
+
+#endif  // AWS_CRYPTOSDK_P_HAVE_AWS_C_IO
@@ -13,11 +13,18 @@
  * limitations under the License.
  */
 
+#include <aws/common/atomics.h>
+#include <aws/common/thread.h>
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/header.h>
 #include <stdlib.h>
 #include "testing.h"
 
+#ifndef _WIN32
+#    include <sys/wait.h>
+#    include <unistd.h>
+#endif
+
 #ifdef _MSC_VER
 #    include <malloc.h>
 #    define alloca _alloca
@@ -640,6 +647,50 @@ static int test_random() {
     return 0;
 }
 
+static int test_random_buffered() {
+    uint8_t ids[64][16];
+    uint8_t big[100] = { 0 };
+
+    aws_cryptosdk_set_buffered_random(true);
+
+    /* enough requests to refill the per-thread block a few times, all distinct */
+    for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(ids[i], sizeof(ids[i])));
+        for (size_t j = 0; j < i; j++) {
+            TEST_ASSERT_INT_NE(0, memcmp(ids[i], ids[j], sizeof(ids[i])));
+        }
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(big, sizeof(big)));
+
+#ifndef _WIN32
+    /* a forked child must not hand out the bytes its parent has buffered */
+    int fds[2];
+    TEST_ASSERT_INT_EQ(0, pipe(fds));
+    pid_t pid = fork();
+    TEST_ASSERT(pid >= 0);
+    if (pid == 0) {
+        uint8_t child_id[16];
+        int ok = !aws_cryptosdk_genrandom(child_id, sizeof(child_id)) &&
+                 write(fds[1], child_id, sizeof(child_id)) == (ssize_t)sizeof(child_id);
+        _exit(ok ? 0 : 1);
+    }
+
+    uint8_t parent_id[16], child_id[16];
+    int status;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(parent_id, sizeof(parent_id)));
+    TEST_ASSERT_INT_EQ(sizeof(child_id), read(fds[0], child_id, sizeof(child_id)));
+    TEST_ASSERT_INT_EQ(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    TEST_ASSERT_INT_NE(0, memcmp(parent_id, child_id, sizeof(parent_id)));
+    close(fds[0]);
+    close(fds[1]);
+#endif
+
+    aws_cryptosdk_set_buffered_random(false);
+
+    return 0;
+}
+
 static const enum aws_cryptosdk_alg_id known_algorithms[] = {
     ALG_AES128_GCM_IV12_TAG16_NO_KDF,
     ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256,
@@ -747,6 +798,145 @@ static int test_encrypt_body() {
     return 0;
 }
 
+static int test_body_cipher_ctx_reuse() {
+    struct content_key key;
+    uint8_t pt[1025], ct[sizeof(pt)], ct_expected[sizeof(pt)], decrypted[sizeof(pt)];
+    uint8_t msg_id[MESSAGE_ID_LEN], other_msg_id[MESSAGE_ID_LEN];
+
+    aws_cryptosdk_genrandom(key.keybuf, sizeof(key.keybuf));
+    aws_cryptosdk_genrandom(msg_id, sizeof(msg_id));
+    aws_cryptosdk_genrandom(other_msg_id, sizeof(other_msg_id));
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+
+    for (size_t i = 0; i < sizeof(known_algorithms) / sizeof(known_algorithms[0]); i++) {
+        const struct aws_cryptosdk_alg_properties *alg = aws_cryptosdk_alg_props(known_algorithms[i]);
+        struct aws_cryptosdk_cipher_ctx enc_ctx, dec_ctx;
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_cipher_ctx_init(&enc_ctx, NULL, alg, &key, true));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_cipher_ctx_init(&dec_ctx, NULL, alg, &key, false));
+
+        /*
+         * Many frames of varying sizes through the same contexts must match the one-shot path,
+         * including when the message ID or frame type changes from one frame to the next
+         */
+        for (uint32_t seqno = 1; seqno <= 10; seqno++) {
+            size_t frame_len        = sizeof(pt) - seqno * 37;
+            const uint8_t *frame_id = seqno % 4 ? msg_id : other_msg_id;
+            int frame_type          = FRAME_TYPE_FRAME;
+            if (seqno == 6) frame_type = FRAME_TYPE_SINGLE;
+            if (seqno == 10) frame_type = FRAME_TYPE_FINAL;
+            uint8_t iv[12], iv_expected[12], tag[16], tag_expected[16];
+
+            struct aws_byte_cursor pt_cursor = aws_byte_cursor_from_array(pt, frame_len);
+            struct aws_byte_buf ct_buf       = aws_byte_buf_from_empty_array(ct, frame_len);
+            struct aws_byte_buf expected_buf = aws_byte_buf_from_empty_array(ct_expected, frame_len);
+
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_body_with_ctx(
+                &enc_ctx, &ct_buf, &pt_cursor, frame_id, seqno, iv, tag, frame_type));
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_body(
+                alg, &expected_buf, &pt_cursor, frame_id, seqno, iv_expected, &key, tag_expected, frame_type));
+
+            TEST_ASSERT_INT_EQ(ct_buf.len, frame_len);
+            TEST_ASSERT_INT_EQ(0, memcmp(ct, ct_expected, frame_len));
+            TEST_ASSERT_INT_EQ(0, memcmp(iv, iv_expected, sizeof(iv)));
+            TEST_ASSERT_INT_EQ(0, memcmp(tag, tag_expected, sizeof(tag)));
+
+            struct aws_byte_cursor ct_cursor = aws_byte_cursor_from_buf(&ct_buf);
+            struct aws_byte_buf pt_out       = aws_byte_buf_from_empty_array(decrypted, frame_len);
+
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_body_with_ctx(
+                &dec_ctx, &pt_out, &ct_cursor, frame_id, seqno, iv, tag, frame_type));
+            TEST_ASSERT_INT_EQ(0, memcmp(decrypted, pt, frame_len));
+
+            // A bad tag must be detected without poisoning the context for the next frame
+            tag[0] ^= 1;
+            pt_out = aws_byte_buf_from_empty_array(decrypted, frame_len);
+            TEST_ASSERT_ERROR(
+                AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+                aws_cryptosdk_decrypt_body_with_ctx(
+                    &dec_ctx, &pt_out, &ct_cursor, frame_id, seqno, iv, tag, frame_type));
+        }
+
+        // Contexts are direction-specific
+        struct aws_byte_cursor pt_cursor = aws_byte_cursor_from_array(pt, 1);
+        struct aws_byte_buf ct_buf       = aws_byte_buf_from_empty_array(ct, 1);
+        uint8_t iv[12], tag[16];
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_BAD_STATE,
+            aws_cryptosdk_encrypt_body_with_ctx(&dec_ctx, &ct_buf, &pt_cursor, msg_id, 1, iv, tag, FRAME_TYPE_FRAME));
+
+        aws_cryptosdk_cipher_ctx_clean_up(&enc_ctx);
+        aws_cryptosdk_cipher_ctx_clean_up(&dec_ctx);
+        // Idempotent
+        aws_cryptosdk_cipher_ctx_clean_up(&dec_ctx);
+    }
+
+    return 0;
+}
+
+static int test_aes_gcm_key_reuse() {
+    const size_t key_lens[] = { AWS_CRYPTOSDK_AES128, AWS_CRYPTOSDK_AES192, AWS_CRYPTOSDK_AES256 };
+    uint8_t raw_key[32], pt[48], ct[sizeof(pt)], ct_expected[sizeof(pt)], decrypted[sizeof(pt)];
+    uint8_t iv[12], aad[20], tag[16], tag_expected[16];
+
+    aws_cryptosdk_genrandom(raw_key, sizeof(raw_key));
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+    aws_cryptosdk_genrandom(aad, sizeof(aad));
+
+    TEST_ASSERT_ADDR_NULL(
+        aws_cryptosdk_aes_gcm_key_new(aws_default_allocator(), aws_byte_cursor_from_array(raw_key, 31)));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_BUFFER_SIZE);
+
+    for (size_t i = 0; i < sizeof(key_lens) / sizeof(key_lens[0]); i++) {
+        struct aws_string *key_str = aws_string_new_from_array(aws_default_allocator(), raw_key, key_lens[i]);
+        struct aws_cryptosdk_aes_gcm_key *key =
+            aws_cryptosdk_aes_gcm_key_new(aws_default_allocator(), aws_byte_cursor_from_string(key_str));
+        TEST_ASSERT_ADDR_NOT_NULL(key);
+
+        // Each call through the same key must match the one-shot path, with or without AAD
+        for (size_t call = 0; call < 4; call++) {
+            struct aws_byte_cursor aad_cursor = aws_byte_cursor_from_array(aad, call % 2 ? sizeof(aad) : 0);
+            struct aws_byte_cursor pt_cursor  = aws_byte_cursor_from_array(pt, sizeof(pt) - call);
+            struct aws_byte_buf ct_buf        = aws_byte_buf_from_empty_array(ct, sizeof(ct));
+            struct aws_byte_buf expected_buf  = aws_byte_buf_from_empty_array(ct_expected, sizeof(ct_expected));
+            struct aws_byte_buf tag_buf       = aws_byte_buf_from_empty_array(tag, sizeof(tag));
+            struct aws_byte_buf expected_tag  = aws_byte_buf_from_empty_array(tag_expected, sizeof(tag_expected));
+            aws_cryptosdk_genrandom(iv, sizeof(iv));
+            struct aws_byte_cursor iv_cursor = aws_byte_cursor_from_array(iv, sizeof(iv));
+
+            TEST_ASSERT_SUCCESS(
+                aws_cryptosdk_aes_gcm_key_encrypt(key, &ct_buf, &tag_buf, pt_cursor, iv_cursor, aad_cursor));
+            TEST_ASSERT_SUCCESS(
+                aws_cryptosdk_aes_gcm_encrypt(&expected_buf, &expected_tag, pt_cursor, iv_cursor, aad_cursor, key_str));
+            TEST_ASSERT_INT_EQ(ct_buf.len, pt_cursor.len);
+            TEST_ASSERT_INT_EQ(tag_buf.len, sizeof(tag));
+            TEST_ASSERT_INT_EQ(0, memcmp(ct, ct_expected, pt_cursor.len));
+            TEST_ASSERT_INT_EQ(0, memcmp(tag, tag_expected, sizeof(tag)));
+
+            struct aws_byte_cursor ct_cursor  = aws_byte_cursor_from_buf(&ct_buf);
+            struct aws_byte_cursor tag_cursor = aws_byte_cursor_from_buf(&tag_buf);
+            struct aws_byte_buf pt_out        = aws_byte_buf_from_empty_array(decrypted, sizeof(decrypted));
+            TEST_ASSERT_SUCCESS(
+                aws_cryptosdk_aes_gcm_key_decrypt(key, &pt_out, ct_cursor, tag_cursor, iv_cursor, aad_cursor));
+            TEST_ASSERT_INT_EQ(pt_out.len, pt_cursor.len);
+            TEST_ASSERT_INT_EQ(0, memcmp(decrypted, pt, pt_cursor.len));
+
+            // A bad tag must be detected without poisoning the pooled context for the next call
+            tag[0] ^= 1;
+            pt_out = aws_byte_buf_from_empty_array(decrypted, sizeof(decrypted));
+            TEST_ASSERT_ERROR(
+                AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+                aws_cryptosdk_aes_gcm_key_decrypt(key, &pt_out, ct_cursor, tag_cursor, iv_cursor, aad_cursor));
+            TEST_ASSERT_INT_EQ(pt_out.len, 0);
+        }
+
+        aws_cryptosdk_aes_gcm_key_destroy(key);
+        aws_string_destroy_secure(key_str);
+    }
+
+    return 0;
+}
+
 static int test_sign_header() {
     struct aws_allocator *alloc = aws_default_allocator();
     struct content_key key;
@@ -786,6 +976,106 @@ static int test_sign_header() {
     return 0;
 }
 
+static int test_header_with_ctx() {
+    struct content_key key;
+    uint8_t header[100];
+
+    aws_cryptosdk_genrandom(key.keybuf, sizeof(key.keybuf));
+    aws_cryptosdk_genrandom(header, sizeof(header));
+    struct aws_byte_buf header_buf = aws_byte_buf_from_array(header, sizeof(header));
+
+    for (size_t i = 0; i < sizeof(known_algorithms) / sizeof(known_algorithms[0]); i++) {
+        const struct aws_cryptosdk_alg_properties *alg = aws_cryptosdk_alg_props(known_algorithms[i]);
+        struct aws_cryptosdk_cipher_ctx enc_ctx, dec_ctx;
+        uint8_t auth_tag[256], ctx_auth_tag[256];
+        size_t auth_tag_size = alg->iv_len + alg->tag_len;
+
+        struct aws_byte_buf auth_buf     = aws_byte_buf_from_array(auth_tag, auth_tag_size);
+        struct aws_byte_buf ctx_auth_buf = aws_byte_buf_from_array(ctx_auth_tag, auth_tag_size);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_cipher_ctx_init(&enc_ctx, NULL, alg, &key, true));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_cipher_ctx_init(&dec_ctx, NULL, alg, &key, false));
+
+        /* A keyed context gives the same tag as a one-off */
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sign_header(alg, &key, &auth_buf, &header_buf));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sign_header_with_ctx(&enc_ctx, &ctx_auth_buf, &header_buf));
+        TEST_ASSERT(!memcmp(auth_tag, ctx_auth_tag, auth_tag_size));
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN, aws_cryptosdk_sign_header_with_ctx(&dec_ctx, &ctx_auth_buf, &header_buf));
+
+        /* Contexts keyed either way check the tag, and can go on to be reused after a bad one */
+        for (int pass = 0; pass < 2; pass++) {
+            struct aws_cryptosdk_cipher_ctx *ctx = pass ? &enc_ctx : &dec_ctx;
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_verify_header_with_ctx(ctx, &auth_buf, &header_buf));
+            auth_tag[auth_tag_size - 1] ^= 1;
+            TEST_ASSERT_ERROR(
+                AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_verify_header_with_ctx(ctx, &auth_buf, &header_buf));
+            auth_tag[auth_tag_size - 1] ^= 1;
+            header[0] ^= 1;
+            TEST_ASSERT_ERROR(
+                AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_verify_header_with_ctx(ctx, &auth_buf, &header_buf));
+            header[0] ^= 1;
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_verify_header_with_ctx(ctx, &auth_buf, &header_buf));
+        }
+
+        aws_cryptosdk_cipher_ctx_clean_up(&enc_ctx);
+        aws_cryptosdk_cipher_ctx_clean_up(&dec_ctx);
+    }
+
+    return 0;
+}
+
+static int test_fetched_algs() {
+    /* Each algorithm is looked up once, and the same handle is handed out every time */
+    const EVP_MD *sha256 = aws_cryptosdk_priv_evp_sha256();
+    TEST_ASSERT_ADDR_NOT_NULL(sha256);
+    TEST_ASSERT_ADDR_EQ(sha256, aws_cryptosdk_priv_evp_sha256());
+    TEST_ASSERT_INT_EQ(EVP_MD_size(sha256), 32);
+    TEST_ASSERT_INT_EQ(EVP_MD_size(aws_cryptosdk_priv_evp_sha384()), 48);
+    TEST_ASSERT_INT_EQ(EVP_MD_size(aws_cryptosdk_priv_evp_sha512()), 64);
+
+    const EVP_CIPHER *aes256 = aws_cryptosdk_priv_evp_aes_256_gcm();
+    TEST_ASSERT_ADDR_NOT_NULL(aes256);
+    TEST_ASSERT_ADDR_EQ(aes256, aws_cryptosdk_priv_evp_aes_256_gcm());
+    TEST_ASSERT_INT_EQ(EVP_CIPHER_key_length(aes256), 32);
+    TEST_ASSERT_INT_EQ(EVP_CIPHER_key_length(aws_cryptosdk_priv_evp_aes_128_gcm()), 16);
+    TEST_ASSERT_INT_EQ(EVP_CIPHER_key_length(aws_cryptosdk_priv_evp_aes_192_gcm()), 24);
+
+    const struct aws_cryptosdk_alg_properties *props =
+        aws_cryptosdk_alg_props(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384);
+    TEST_ASSERT_ADDR_EQ(props->impl->cipher_ctor(), aes256);
+    TEST_ASSERT_ADDR_EQ(props->impl->md_ctor(), aws_cryptosdk_priv_evp_sha384());
+
+    /* The library context can no longer change once anything has been fetched from it */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_set_openssl_lib_ctx(NULL));
+#else
+    TEST_ASSERT_ERROR(AWS_ERROR_UNSUPPORTED_OPERATION, aws_cryptosdk_set_openssl_lib_ctx(NULL));
+#endif
+
+    return 0;
+}
+
+static int test_prepare() {
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_prepare());
+    /* Everything is set up once, so a second call just finds it done */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_prepare());
+
+    TEST_ASSERT_ADDR_NOT_NULL(aws_cryptosdk_priv_evp_aes_256_gcm());
+    TEST_ASSERT_ADDR_NOT_NULL(aws_cryptosdk_priv_evp_sha384());
+    TEST_ASSERT(aws_cryptosdk_priv_prepare_ec_groups());
+
+    /* A signing suite works straight away once prepared */
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_sig_ctx *ctx;
+    struct aws_string *pub_key;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_start_keygen(
+        &ctx, alloc, &pub_key, aws_cryptosdk_alg_props(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384)));
+    aws_cryptosdk_sig_abort(ctx);
+    aws_string_destroy(pub_key);
+
+    return 0;
+}
+
 static int test_digest_sha512() {
     struct aws_allocator *allocator = aws_default_allocator();
     struct aws_cryptosdk_md_context *context;
@@ -808,6 +1098,24 @@ static int test_digest_sha512() {
     TEST_ASSERT_INT_EQ(md_len, sizeof(expected));
     TEST_ASSERT_INT_EQ(0, memcmp(expected, buf, md_len));
 
+    /* a context copied part way through, or reset after finishing, gives the same digest */
+    struct aws_cryptosdk_md_context *midstate;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_init(allocator, &midstate, AWS_CRYPTOSDK_MD_SHA512));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_update(midstate, "foo", 3));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_init(allocator, &context, AWS_CRYPTOSDK_MD_SHA512));
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_md_copy(context, midstate));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_md_update(context, "barbaz", 6));
+        memset(buf, 0, sizeof(buf));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_md_finish_reset(context, buf, &md_len));
+        TEST_ASSERT_INT_EQ(md_len, sizeof(expected));
+        TEST_ASSERT_INT_EQ(0, memcmp(expected, buf, md_len));
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_update(context, "foobarbaz", 9));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_finish(context, buf, &md_len));
+    TEST_ASSERT_INT_EQ(0, memcmp(expected, buf, md_len));
+    aws_cryptosdk_md_abort(midstate);
+
     /* test abort path as well */
     TEST_ASSERT_SUCCESS(aws_cryptosdk_md_init(allocator, &context, AWS_CRYPTOSDK_MD_SHA512));
     aws_cryptosdk_md_abort(context);
@@ -815,12 +1123,101 @@ static int test_digest_sha512() {
     return 0;
 }
 
+#define DIGEST_THREADS 4
+#define DIGEST_ROUNDS 200
+
+struct digest_worker_args {
+    const uint8_t *expected;
+    struct aws_atomic_var failures;
+};
+
+static int digest_foobarbaz(uint8_t *buf, size_t *md_len, bool abandon_first) {
+    struct aws_cryptosdk_md_context *context;
+
+    if (abandon_first) {
+        // Leaves a half-finished digest behind, which must not leak into the next context handed out
+        if (aws_cryptosdk_md_init(aws_default_allocator(), &context, AWS_CRYPTOSDK_MD_SHA512)) return AWS_OP_ERR;
+        if (aws_cryptosdk_md_update(context, "junk", 4)) return AWS_OP_ERR;
+        aws_cryptosdk_md_abort(context);
+    }
+
+    *md_len = AWS_CRYPTOSDK_MD_MAX_SIZE;
+    if (aws_cryptosdk_md_init(aws_default_allocator(), &context, AWS_CRYPTOSDK_MD_SHA512)) return AWS_OP_ERR;
+    if (aws_cryptosdk_md_update(context, "foobarbaz", 9)) {
+        aws_cryptosdk_md_abort(context);
+        return AWS_OP_ERR;
+    }
+
+    return aws_cryptosdk_md_finish(context, buf, md_len);
+}
+
+static void digest_worker(void *arg) {
+    struct digest_worker_args *args = arg;
+    uint8_t buf[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t md_len;
+
+    for (int i = 0; i < DIGEST_ROUNDS; i++) {
+        if (digest_foobarbaz(buf, &md_len, i % 2) || md_len != aws_cryptosdk_md_size(AWS_CRYPTOSDK_MD_SHA512) ||
+            memcmp(args->expected, buf, md_len)) {
+            aws_atomic_fetch_add(&args->failures, 1);
+        }
+    }
+}
+
+static int test_digest_context_reuse() {
+    struct aws_allocator *allocator = aws_default_allocator();
+    struct aws_cryptosdk_md_context *contexts[32];
+    uint8_t expected[AWS_CRYPTOSDK_MD_MAX_SIZE], buf[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t md_len;
+
+    TEST_ASSERT_SUCCESS(digest_foobarbaz(expected, &md_len, false));
+
+    /* hold more contexts at once than are pooled, then give them all back dirty */
+    for (size_t i = 0; i < sizeof(contexts) / sizeof(contexts[0]); i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_md_init(allocator, &contexts[i], AWS_CRYPTOSDK_MD_SHA512));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_md_update(contexts[i], "junk", 4));
+    }
+    for (size_t i = 0; i < sizeof(contexts) / sizeof(contexts[0]); i++) {
+        aws_cryptosdk_md_abort(contexts[i]);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        memset(buf, 0, sizeof(buf));
+        TEST_ASSERT_SUCCESS(digest_foobarbaz(buf, &md_len, i % 2));
+        TEST_ASSERT_INT_EQ(0, memcmp(expected, buf, md_len));
+    }
+
+    /* threads sharing the pool each get a context to themselves */
+    struct digest_worker_args args = { .expected = expected };
+    struct aws_thread threads[DIGEST_THREADS];
+    aws_atomic_init_int(&args.failures, 0);
+
+    for (int i = 0; i < DIGEST_THREADS; i++) {
+        TEST_ASSERT_SUCCESS(aws_thread_init(&threads[i], allocator));
+        TEST_ASSERT_SUCCESS(aws_thread_launch(&threads[i], digest_worker, &args, NULL));
+    }
+    for (int i = 0; i < DIGEST_THREADS; i++) {
+        aws_thread_join(&threads[i]);
+        aws_thread_clean_up(&threads[i]);
+    }
+    TEST_ASSERT_INT_EQ(0, aws_atomic_load_int(&args.failures));
+
+    return 0;
+}
+
 struct test_case cipher_test_cases[] = { { "cipher", "test_kdf", test_kdf },
                                          { "cipher", "test_decrypt_frame_aad", test_decrypt_frame_aad },
                                          { "cipher", "test_decrypt_frame_all_algos", test_decrypt_frame_all_algos },
                                          { "cipher", "test_verify_header", test_verify_header },
                                          { "cipher", "test_random", test_random },
+                                         { "cipher", "test_random_buffered", test_random_buffered },
                                          { "cipher", "test_encrypt_body", test_encrypt_body },
+                                         { "cipher", "test_body_cipher_ctx_reuse", test_body_cipher_ctx_reuse },
+                                         { "cipher", "test_aes_gcm_key_reuse", test_aes_gcm_key_reuse },
                                          { "cipher", "test_sign_header", test_sign_header },
+                                         { "cipher", "test_header_with_ctx", test_header_with_ctx },
+                                         { "cipher", "test_fetched_algs", test_fetched_algs },
+                                         { "cipher", "test_prepare", test_prepare },
                                          { "cipher", "test_digest_sha512", test_digest_sha512 },
+                                         { "cipher", "test_digest_context_reuse", test_digest_context_reuse },
                                          { NULL } };
@@ -12,9 +12,12 @@
  * implied. See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/enc_ctx.h>
 #include <aws/cryptosdk/private/utils.h>
+#include <aws/common/private/hash_table_impl.h>
 #include "testing.h"
 
 /*
@@ -403,6 +406,255 @@ int deserialize_error_when_duplicate_key_in_context() {
     return 0;
 }
 
+int enc_ctx_init_with_capacity_test() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    char buf[8];
+
+    for (size_t capacity = 1; capacity <= 300; capacity++) {
+        struct aws_hash_table enc_ctx;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init_with_capacity(alloc, &enc_ctx, capacity));
+        struct hash_table_state *state = enc_ctx.p_impl;
+
+        for (size_t idx = 0; idx < capacity; idx++) {
+            snprintf(buf, sizeof(buf), "%zu", idx);
+            TEST_ASSERT_SUCCESS(aws_hash_table_put(
+                &enc_ctx, checked_aws_str_dup(alloc, buf), checked_aws_str_dup(alloc, buf), NULL));
+        }
+        // Growing the table would have replaced its state
+        TEST_ASSERT_ADDR_EQ(state, enc_ctx.p_impl);
+
+        aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    }
+
+    return 0;
+}
+
+int deserialize_reserves_capacity_test() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_hash_table enc_ctx, parsed;
+    struct aws_byte_buf serialized;
+    char buf[8];
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    for (size_t idx = 0; idx < 200; idx++) {
+        snprintf(buf, sizeof(buf), "%zu", idx);
+        TEST_ASSERT_SUCCESS(
+            aws_hash_table_put(&enc_ctx, checked_aws_str_dup(alloc, buf), checked_aws_str_dup(alloc, buf), NULL));
+    }
+    TEST_ASSERT_SUCCESS(serialize_init(alloc, &serialized, &enc_ctx));
+
+    // A table too small for the pairs is replaced once, before they are added
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &parsed));
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_buf(&serialized);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_deserialize(alloc, &parsed, &cursor));
+    TEST_ASSERT_INT_EQ(200, aws_hash_table_get_entry_count(&parsed));
+    TEST_ASSERT(aws_hash_table_eq(&enc_ctx, &parsed, aws_hash_callback_string_eq));
+
+    // and one large enough is kept as it is
+    struct hash_table_state *state = parsed.p_impl;
+    cursor                         = aws_byte_cursor_from_buf(&serialized);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_deserialize(alloc, &parsed, &cursor));
+    TEST_ASSERT_ADDR_EQ(state, parsed.p_impl);
+    TEST_ASSERT_INT_EQ(200, aws_hash_table_get_entry_count(&parsed));
+
+    // A count the input cannot possibly hold fails without reserving anything
+    uint8_t forged[] = { 0xff, 0xff, 0x00, 0x00, 0x00, 0x00 };
+    cursor           = aws_byte_cursor_from_array(forged, sizeof(forged));
+    TEST_ASSERT_ERROR(AWS_ERROR_SHORT_BUFFER, aws_cryptosdk_enc_ctx_deserialize(alloc, &parsed, &cursor));
+    TEST_ASSERT_ADDR_EQ(state, parsed.p_impl);
+
+    aws_byte_buf_clean_up(&serialized);
+    aws_cryptosdk_enc_ctx_clean_up(&parsed);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    return 0;
+}
+
+int enc_ctx_is_canonical_test() {
+    const uint8_t sorted[] = "\x00\x02"
+                             "\x00\x05key_a\x00\x07value_a"
+                             "\x00\x05key_b\x00\x07value_b";
+    const uint8_t swapped[] = "\x00\x02"
+                              "\x00\x05key_b\x00\x07value_b"
+                              "\x00\x05key_a\x00\x07value_a";
+
+    TEST_ASSERT(aws_cryptosdk_enc_ctx_is_canonical(aws_byte_cursor_from_array(NULL, 0)));
+    TEST_ASSERT(aws_cryptosdk_enc_ctx_is_canonical(aws_byte_cursor_from_array(sorted, sizeof(sorted) - 1)));
+    TEST_ASSERT(!aws_cryptosdk_enc_ctx_is_canonical(aws_byte_cursor_from_array(swapped, sizeof(swapped) - 1)));
+    TEST_ASSERT(!aws_cryptosdk_enc_ctx_is_canonical(aws_byte_cursor_from_array(sorted, sizeof(sorted) - 2)));
+    TEST_ASSERT(!aws_cryptosdk_enc_ctx_is_canonical(aws_byte_cursor_from_array(sorted, sizeof(sorted))));
+
+    // A duplicated key is not strictly increasing
+    const uint8_t duplicate[] = "\x00\x02"
+                                "\x00\x05key_a\x00\x07value_a"
+                                "\x00\x05key_a\x00\x07value_b";
+    TEST_ASSERT(!aws_cryptosdk_enc_ctx_is_canonical(aws_byte_cursor_from_array(duplicate, sizeof(duplicate) - 1)));
+
+    return 0;
+}
+
+int frozen_enc_ctx_test() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf expected;
+    uint8_t digest[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t digest_len;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+
+    // An empty context freezes to an empty serialization
+    struct aws_cryptosdk_frozen_enc_ctx *frozen = aws_cryptosdk_enc_ctx_freeze(alloc, &enc_ctx);
+    TEST_ASSERT_ADDR_NOT_NULL(frozen);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_frozen_enc_ctx_serialized(frozen).len);
+    TEST_ASSERT(aws_cryptosdk_frozen_enc_ctx_matches(frozen, &enc_ctx));
+    aws_cryptosdk_frozen_enc_ctx_destroy(frozen);
+
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, foobar, (void *)bar, NULL));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, foo, (void *)bar_food, NULL));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, empty, (void *)foobaz, NULL));
+
+    frozen = aws_cryptosdk_enc_ctx_freeze(alloc, &enc_ctx);
+    TEST_ASSERT_ADDR_NOT_NULL(frozen);
+    TEST_ASSERT_INT_EQ(3, aws_hash_table_get_entry_count(aws_cryptosdk_frozen_enc_ctx_table(frozen)));
+
+    // The stored serialization and digest are those of the original context
+    TEST_ASSERT_SUCCESS(serialize_init(alloc, &expected, &enc_ctx));
+    struct aws_byte_cursor serialized = aws_cryptosdk_frozen_enc_ctx_serialized(frozen);
+    TEST_ASSERT(aws_byte_cursor_eq_byte_buf(&serialized, &expected));
+
+    struct aws_cryptosdk_md_context *md_context;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_init(alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_update(md_context, expected.buffer, expected.len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_finish(md_context, digest, &digest_len));
+    struct aws_byte_cursor expected_digest = aws_byte_cursor_from_array(digest, digest_len);
+    struct aws_byte_cursor frozen_digest   = aws_cryptosdk_frozen_enc_ctx_digest(frozen);
+    TEST_ASSERT(aws_byte_cursor_eq(&expected_digest, &frozen_digest));
+
+    // Hashing the context directly gives the digest of its serialization too
+    uint8_t streamed[AWS_CRYPTOSDK_MD_MAX_SIZE];
+    size_t streamed_len;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_init(alloc, &md_context, AWS_CRYPTOSDK_MD_SHA512));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_digest_update(alloc, md_context, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_md_finish(md_context, streamed, &streamed_len));
+    TEST_ASSERT_INT_EQ(digest_len, streamed_len);
+    TEST_ASSERT_INT_EQ(0, memcmp(digest, streamed, digest_len));
+    aws_byte_buf_clean_up(&expected);
+
+    // Changes to the original context are detected, and do not affect the frozen copy
+    TEST_ASSERT(aws_cryptosdk_frozen_enc_ctx_matches(frozen, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, foo, (void *)bar_null_food, NULL));
+    TEST_ASSERT(!aws_cryptosdk_frozen_enc_ctx_matches(frozen, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, foo, (void *)bar_food, NULL));
+    TEST_ASSERT(aws_cryptosdk_frozen_enc_ctx_matches(frozen, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, foobaz, (void *)bar, NULL));
+    TEST_ASSERT(!aws_cryptosdk_frozen_enc_ctx_matches(frozen, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_hash_table_remove(&enc_ctx, foobar, NULL, NULL));
+    TEST_ASSERT(!aws_cryptosdk_frozen_enc_ctx_matches(frozen, &enc_ctx));
+    TEST_ASSERT_INT_EQ(3, aws_hash_table_get_entry_count(aws_cryptosdk_frozen_enc_ctx_table(frozen)));
+
+    aws_cryptosdk_frozen_enc_ctx_destroy(frozen);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    return 0;
+}
+
+int flat_enc_ctx_test() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_hash_table enc_ctx, round_trip;
+    struct aws_cryptosdk_flat_enc_ctx flat, parsed;
+    struct aws_byte_buf expected;
+    struct aws_byte_cursor key, value;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &round_trip));
+
+    // An empty context needs no allocation
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_flat_enc_ctx_init(alloc, &flat, &enc_ctx));
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_flat_enc_ctx_count(&flat));
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_flat_enc_ctx_serialized(&flat).len);
+    TEST_ASSERT(!aws_cryptosdk_flat_enc_ctx_get(&flat, aws_byte_cursor_from_string(foo), &value));
+    aws_cryptosdk_flat_enc_ctx_clean_up(&flat);
+
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, foobar, (void *)bar, NULL));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, foo, (void *)bar_null_food, NULL));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, empty, (void *)foobaz, NULL));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_flat_enc_ctx_init(alloc, &flat, &enc_ctx));
+    TEST_ASSERT_INT_EQ(3, aws_cryptosdk_flat_enc_ctx_count(&flat));
+    TEST_ASSERT_SUCCESS(serialize_init(alloc, &expected, &enc_ctx));
+    struct aws_byte_cursor serialized = aws_cryptosdk_flat_enc_ctx_serialized(&flat);
+    TEST_ASSERT(aws_byte_cursor_eq_byte_buf(&serialized, &expected));
+
+    // Pairs are visited in key order
+    aws_cryptosdk_flat_enc_ctx_get_at(&flat, 0, &key, &value);
+    TEST_ASSERT_INT_EQ(0, key.len);
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&value, "foobaz"));
+    aws_cryptosdk_flat_enc_ctx_get_at(&flat, 1, &key, &value);
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&key, "foo"));
+    TEST_ASSERT_INT_EQ(bar_null_food->len, value.len);
+    aws_cryptosdk_flat_enc_ctx_get_at(&flat, 2, &key, &value);
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&key, "foobar"));
+
+    TEST_ASSERT(aws_cryptosdk_flat_enc_ctx_get(&flat, aws_byte_cursor_from_string(foobar), &value));
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&value, "bar"));
+    TEST_ASSERT(aws_cryptosdk_flat_enc_ctx_get(&flat, aws_byte_cursor_from_string(empty), &value));
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&value, "foobaz"));
+    TEST_ASSERT(!aws_cryptosdk_flat_enc_ctx_get(&flat, aws_byte_cursor_from_string(foobaz), &value));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_flat_enc_ctx_to_table(alloc, &round_trip, &flat));
+    TEST_ASSERT_INT_EQ(3, aws_hash_table_get_entry_count(&round_trip));
+    aws_cryptosdk_flat_enc_ctx_clean_up(&flat);
+    aws_cryptosdk_flat_enc_ctx_clean_up(&flat);
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_flat_enc_ctx_init_from_serialized(alloc, &parsed, aws_byte_cursor_from_buf(&expected)));
+    TEST_ASSERT_INT_EQ(3, aws_cryptosdk_flat_enc_ctx_count(&parsed));
+    TEST_ASSERT(aws_cryptosdk_flat_enc_ctx_get(&parsed, aws_byte_cursor_from_string(foo), &value));
+    TEST_ASSERT_INT_EQ(bar_null_food->len, value.len);
+    // Converting to a table replaces what was there
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, foobaz, (void *)bar, NULL));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_flat_enc_ctx_to_table(alloc, &enc_ctx, &parsed));
+    TEST_ASSERT_INT_EQ(3, aws_hash_table_get_entry_count(&enc_ctx));
+    aws_cryptosdk_flat_enc_ctx_clean_up(&parsed);
+
+    struct aws_byte_buf reserialized;
+    TEST_ASSERT_SUCCESS(serialize_init(alloc, &reserialized, &round_trip));
+    TEST_ASSERT(aws_byte_buf_eq(&expected, &reserialized));
+    aws_byte_buf_clean_up(&reserialized);
+    aws_byte_buf_clean_up(&expected);
+
+    // Unsorted input is indexed, and kept byte for byte
+    const uint8_t unsorted[] = { 0x00, 0x02, 0x00, 0x01, 'b', 0x00, 0x01, '2', 0x00, 0x01, 'a', 0x00, 0x01, '1' };
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_flat_enc_ctx_init_from_serialized(
+        alloc, &parsed, aws_byte_cursor_from_array(unsorted, sizeof(unsorted))));
+    serialized = aws_cryptosdk_flat_enc_ctx_serialized(&parsed);
+    TEST_ASSERT_INT_EQ(sizeof(unsorted), serialized.len);
+    TEST_ASSERT(!memcmp(unsorted, serialized.ptr, sizeof(unsorted)));
+    aws_cryptosdk_flat_enc_ctx_get_at(&parsed, 0, &key, &value);
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&key, "a"));
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&value, "1"));
+    TEST_ASSERT(aws_cryptosdk_flat_enc_ctx_get(&parsed, aws_byte_cursor_from_c_str("b"), &value));
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&value, "2"));
+    aws_cryptosdk_flat_enc_ctx_clean_up(&parsed);
+
+    // Duplicate keys, a zero count, and truncated or trailing bytes are all rejected
+    const uint8_t duplicate[]  = { 0x00, 0x02, 0x00, 0x01, 'a', 0x00, 0x01, '2', 0x00, 0x01, 'a', 0x00, 0x01, '1' };
+    const uint8_t zero_count[] = { 0x00, 0x00 };
+    const uint8_t trailing[]   = { 0x00, 0x01, 0x00, 0x01, 'a', 0x00, 0x01, '1', 0x00 };
+
+    const struct aws_byte_cursor bad[] = { aws_byte_cursor_from_array(duplicate, sizeof(duplicate)),
+                                           aws_byte_cursor_from_array(zero_count, sizeof(zero_count)),
+                                           aws_byte_cursor_from_array(trailing, sizeof(trailing)),
+                                           aws_byte_cursor_from_array(trailing, sizeof(trailing) - 2) };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_flat_enc_ctx_init_from_serialized(alloc, &parsed, bad[i]));
+        TEST_ASSERT_ADDR_NULL(parsed.buffer);
+    }
+
+    aws_cryptosdk_enc_ctx_clean_up(&round_trip);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    return 0;
+}
+
 struct test_case enc_ctx_test_cases[] = {
     { "enc_ctx", "get_sorted_elems_array_test", get_sorted_elems_array_test },
     { "enc_ctx", "serialize_empty_enc_ctx", serialize_empty_enc_ctx },
@@ -414,5 +666,10 @@ struct test_case enc_ctx_test_cases[] = {
     { "enc_ctx", "serialize_error_when_too_many_elements", serialize_error_when_too_many_elements },
     { "enc_ctx", "clone_test", enc_ctx_clone_test },
     { "enc_ctx", "deserialize_error_when_duplicate_key_in_context", deserialize_error_when_duplicate_key_in_context },
+    { "enc_ctx", "init_with_capacity_test", enc_ctx_init_with_capacity_test },
+    { "enc_ctx", "deserialize_reserves_capacity_test", deserialize_reserves_capacity_test },
+    { "enc_ctx", "is_canonical_test", enc_ctx_is_canonical_test },
+    { "enc_ctx", "frozen_enc_ctx_test", frozen_enc_ctx_test },
+    { "enc_ctx", "flat_enc_ctx_test", flat_enc_ctx_test },
     { NULL }
 };
@@ -13,11 +13,33 @@
  * limitations under the License.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#    define _GNU_SOURCE
+#endif
+
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/cache.h>
 #include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/frame_executor.h>
+#include <aws/cryptosdk/frame_index.h>
+#include <aws/cryptosdk/multi_keyring.h>
 #include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/header.h>
+#include <aws/cryptosdk/private/session.h>
+#include <aws/cryptosdk/raw_aes_keyring.h>
 #include <aws/cryptosdk/session.h>
+#include <stddef.h>
 #include <stdlib.h>
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <unistd.h>
+#endif
+#ifdef __linux__
+#    include <sched.h>
+#endif
 #include "counting_keyring.h"
+#include "task_threads.h"
 #include "testing.h"
 #include "testutil.h"
 #include "zero_keyring.h"
@@ -297,212 +319,4147 @@ int test_simple_roundtrip() {
     return 0;
 }
 
-int test_different_keyring_cant_decrypt() {
-    init_bufs(1 /*1024*/);
+int test_keyring_trace_disabled() {
+    init_bufs(1024);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
 
-    size_t ct_consumed, pt_consumed;
-    struct aws_cryptosdk_keyring *counting_kr = aws_cryptosdk_counting_keyring_new(aws_default_allocator());
-    TEST_ASSERT_ADDR_NOT_NULL(counting_kr);
-    create_session(AWS_CRYPTOSDK_ENCRYPT, counting_kr);
+    size_t ct_consumed, pt_consumed, out_written, in_read;
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_keyring_trace(session, false));
     aws_cryptosdk_session_set_message_size(session, pt_size);
     precise_size_set = true;
 
     if (pump_ciphertext(2048, &ct_consumed, pt_size, &pt_consumed)) return 1;
     TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_keyring_trace(session, true));
 
-    struct aws_cryptosdk_keyring *zero_kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
-    TEST_ASSERT_ADDR_NOT_NULL(zero_kr);
-    create_session(AWS_CRYPTOSDK_DECRYPT, zero_kr);
-    hexdump(stderr, ct_buf, ct_size);
+    /* The trace is still available, but nothing was recorded in it */
+    TEST_ASSERT_ADDR_NOT_NULL(aws_cryptosdk_session_get_keyring_trace_ptr(session));
+    TEST_ASSERT_INT_EQ(0, aws_array_list_length(aws_cryptosdk_session_get_keyring_trace_ptr(session)));
 
-    TEST_ASSERT_ERROR(
-        AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT,
-        aws_cryptosdk_session_process(session, pt_buf, pt_size, &pt_consumed, ct_buf, ct_size, &ct_consumed));
+    /* The setting carries over to decryption after a reset */
+    uint8_t *pt_check_buf = aws_mem_acquire(aws_default_allocator(), pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check_buf);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, pt_check_buf, pt_size, &out_written, ct_buf, ct_size, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(0, memcmp(pt_check_buf, pt_buf, pt_size));
+    TEST_ASSERT_INT_EQ(0, aws_array_list_length(aws_cryptosdk_session_get_keyring_trace_ptr(session)));
 
-    free_bufs();
+    /* Turning it back on records the trace again */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_keyring_trace(session, true));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, pt_check_buf, pt_size, &out_written, ct_buf, ct_size, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_SUCCESS(assert_keyring_trace_record(
+        aws_cryptosdk_session_get_keyring_trace_ptr(session),
+        0,
+        "null",
+        "null",
+        AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
 
+    aws_mem_release(aws_default_allocator(), pt_check_buf);
+    free_bufs();
     return 0;
 }
 
-int test_changed_keyring_can_decrypt() {
-    init_bufs(1 /*1024*/);
+int test_multi_frame_single_call() {
+    init_bufs(1000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
 
     size_t ct_consumed, pt_consumed;
-    struct aws_cryptosdk_keyring *counting_kr = aws_cryptosdk_counting_keyring_new(aws_default_allocator());
-    TEST_ASSERT_ADDR_NOT_NULL(counting_kr);
-    create_session(AWS_CRYPTOSDK_ENCRYPT, counting_kr);
-    aws_cryptosdk_session_set_message_size(session, pt_size);
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 64);
+
+    /* Without a known size, every complete frame that fits should be emitted in a single call. */
+    if (pump_ciphertext(4096, &ct_consumed, 500, &pt_consumed)) return 1;
+    TEST_ASSERT_INT_EQ(pt_consumed, 448);
+    TEST_ASSERT(!aws_cryptosdk_session_is_done(session));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
     precise_size_set = true;
 
-    if (pump_ciphertext(2048, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    /* The rest of the body, including the final frame and trailer, also goes out in one call. */
+    if (pump_ciphertext(4096, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT_INT_EQ(pt_offset, pt_size);
     TEST_ASSERT(aws_cryptosdk_session_is_done(session));
 
-    if (check_ciphertext_and_trace(false)) return 1;
+    if (check_ciphertext_and_trace(true)) return 1;
 
     free_bufs();
+    return 0;
+}
+
+int test_worker_threads() {
+    init_bufs(10000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    size_t ct_consumed, pt_consumed;
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 100);
+
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_session_set_worker_threads(session, 0));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(session, 2));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(session, 1));
+    TEST_ASSERT_ADDR_NULL(session->worker_executor);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(session, 4));
+    /* The threads are started here, once, rather than for each batch of frames */
+    struct aws_cryptosdk_frame_executor *worker_executor = session->worker_executor;
+    TEST_ASSERT_ADDR_NOT_NULL(worker_executor);
+
+    /* Feed a partial batch first, so that frames are split across several calls */
+    if (pump_ciphertext(4096, &ct_consumed, 1234, &pt_consumed)) return 1;
+    TEST_ASSERT_INT_EQ(pt_consumed, 1200);
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_worker_threads(session, 1));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    precise_size_set = true;
+
+    if (pump_ciphertext(65536, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    if (check_ciphertext_and_trace(true)) return 1;
+
+    /* ...and kept for the next message */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_ADDR_EQ(session->worker_executor, worker_executor);
 
+    free_bufs();
     return 0;
 }
 
-// This helper sub-test sets the CMM to use a particular algorithm ID, verifies
-// that we can encrypt and decrypt using that algorithm, and checks that that
-// algorithm was in fact used (as reported by both encrypt and decrypt sessions).
-static int test_algorithm_override_once(enum aws_cryptosdk_alg_id alg_id) {
-    init_bufs(1);
+/* Worker threads may move to the NUMA node holding their frames, but the calling thread never does */
+int test_worker_threads_keep_caller_placement() {
+#ifdef __linux__
+    cpu_set_t before, after;
+    TEST_ASSERT_SUCCESS(sched_getaffinity(0, sizeof(before), &before));
+
+    init_bufs(20000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
 
     size_t ct_consumed, pt_consumed;
-    enum aws_cryptosdk_alg_id reported_alg_id;
-    struct aws_cryptosdk_cmm *cmm =
-        create_session_with_cmm(AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_counting_keyring_new(aws_default_allocator()));
-    aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id);
-    aws_cryptosdk_session_set_message_size(session, pt_size);
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(session, 4));
     precise_size_set = true;
 
-    if (pump_ciphertext(2048, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    // Whole batches in each call, so that the calling thread also takes back frames it queued
+    if (pump_ciphertext(65536, &ct_consumed, pt_size, &pt_consumed)) return 1;
     TEST_ASSERT(aws_cryptosdk_session_is_done(session));
 
-    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_alg_id(session, &reported_alg_id));
-    TEST_ASSERT_INT_EQ(alg_id, reported_alg_id);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(session, 4));
+    uint8_t *pt_check_buf = aws_mem_acquire(aws_default_allocator(), pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check_buf);
 
-    if (check_ciphertext_and_trace(false)) return 1;
+    size_t out_written, in_read;
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, pt_check_buf, pt_size, &out_written, ct_buf, ct_size, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT(!memcmp(pt_check_buf, pt_buf, pt_size));
+    aws_mem_release(aws_default_allocator(), pt_check_buf);
 
-    // Session is now configured for decrypt and should report decryption-side ID
-    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_alg_id(session, &reported_alg_id));
-    TEST_ASSERT_INT_EQ(alg_id, reported_alg_id);
+    TEST_ASSERT_SUCCESS(sched_getaffinity(0, sizeof(after), &after));
+    TEST_ASSERT(CPU_EQUAL(&before, &after));
 
-    aws_cryptosdk_cmm_release(cmm);
     free_bufs();
-
+#endif
     return 0;
 }
 
-int test_algorithm_override() {
-    return test_algorithm_override_once(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256) ||
-           test_algorithm_override_once(ALG_AES192_GCM_IV12_TAG16_NO_KDF) ||
-           test_algorithm_override_once(ALG_AES256_GCM_IV12_TAG16_NO_KDF) ||
-           test_algorithm_override_once(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256_ECDSA_P256) ||
-           test_algorithm_override_once(ALG_AES192_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384) ||
-           test_algorithm_override_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384) ||
-           test_algorithm_override_once(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256) ||
-           test_algorithm_override_once(ALG_AES192_GCM_IV12_TAG16_HKDF_SHA256) ||
-           test_algorithm_override_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256);
-}
+static int corrupt_frame_once(size_t worker_threads) {
+    init_bufs(10000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
 
-int test_null_estimates() {
-    create_session(AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_counting_keyring_new(aws_default_allocator()));
+    size_t ct_consumed, pt_consumed;
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 100);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
 
-    aws_cryptosdk_session_estimate_buf(session, NULL, NULL);
+    if (pump_ciphertext(65536, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    /* Corrupt a frame in the middle of the message, so that it falls in the middle of a batch */
+    ct_buf[ct_size / 2] ^= 1;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(session, worker_threads));
+
+    uint8_t *pt_check_buf = aws_mem_acquire(aws_default_allocator(), pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check_buf);
+
+    size_t out_written, in_read;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_process(session, pt_check_buf, pt_size, &out_written, ct_buf, ct_size, &in_read));
+    /* No plaintext may be released from a batch containing an unauthenticated frame */
+    TEST_ASSERT_INT_EQ(out_written, 0);
+
+    aws_mem_release(aws_default_allocator(), pt_check_buf);
 
     free_bufs();
+    return 0;
+}
+
+int test_worker_threads_corrupt_frame() {
+    /* A single thread batches the frames it decrypts just as worker threads do */
+    if (corrupt_frame_once(1)) return 1;
+    if (corrupt_frame_once(4)) return 1;
 
     return 0;
 }
 
-/* Allocates a new output buffer and places its address at *output_buf */
-static int process_loop(
-    struct aws_allocator *alloc,
-    uint8_t **output_buf,
-    size_t *output_len,
-    const uint8_t *const input_buf,
-    const size_t input_len) {
-    size_t total_input_read = 0;
-    size_t input_window     = 1;
+struct executor_message {
+    struct aws_cryptosdk_frame_executor *executor;
+    enum aws_cryptosdk_alg_id alg_id;
+    size_t pt_len;
+    int result;
+};
 
-    /* how much memory is allocated to output buffer, not the same as length of output */
-    size_t output_size          = 1;
-    *output_buf                 = aws_mem_acquire(alloc, output_size);
-    size_t total_output_written = 0;
-    size_t output_needed        = 1;
+/* Encrypts and decrypts a message with sessions of four workers whose shares run on a shared executor */
+static int executor_roundtrip(const struct executor_message *msg) {
+    struct aws_allocator *alloc = aws_default_allocator();
+    size_t ct_cap               = msg->pt_len + 4096;
+    size_t ct_len, pt_len, in_read;
 
-    /* The entire input is already in the input buffer and we just expand the window into it as needed.
-     * The entire output will eventually be put into a single buffer. This is not a realistic streaming
-     * use case as we cannot handle more data than fits in memory, but it keeps things simple for testing.
-     */
-    while (1) {
-        size_t input_read, output_written;
-        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
-            session,
-            *output_buf + total_output_written,
-            output_size - total_output_written,
-            &output_written,
-            input_buf + total_input_read,
-            input_window,
-            &input_read));
+    uint8_t *pt  = aws_mem_acquire(alloc, msg->pt_len + 1);
+    uint8_t *ct  = aws_mem_acquire(alloc, ct_cap);
+    uint8_t *dec = aws_mem_acquire(alloc, msg->pt_len + 1);
+    TEST_ASSERT(pt && ct && dec);
+    for (size_t i = 0; i < msg->pt_len; i++) pt[i] = (uint8_t)(i * 7);
 
-        total_output_written += output_written;
-        total_input_read += input_read;
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, msg->alg_id));
 
-        if (aws_cryptosdk_session_is_done(session)) break;
+    struct aws_cryptosdk_session *enc = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    struct aws_cryptosdk_session *dec_session = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, cmm);
+    TEST_ASSERT(enc && dec_session);
+    aws_cryptosdk_cmm_release(cmm);
 
-        aws_cryptosdk_session_estimate_buf(session, &output_needed, &input_window);
-        if (input_window > input_len - total_input_read) {
-            /* There are some scenarios where our input estimates are larger than needed.
-             * If that happens, we shrink the input window to the rest of the buffer.
-             */
-            input_window = input_len - total_input_read;
-        }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(enc, 4));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_executor(enc, msg->executor));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(enc, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(enc, msg->pt_len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(enc, ct, ct_cap, &ct_len, pt, msg->pt_len, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(enc));
 
-        size_t output_size_needed = output_needed + total_output_written;
-        if (output_size < output_size_needed) {
-            TEST_ASSERT_SUCCESS(aws_mem_realloc(alloc, (void **)output_buf, output_size, output_size_needed));
-            output_size = output_size_needed;
-        }
-    }
-    *output_len = total_output_written;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(dec_session, 4));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_executor(dec_session, msg->executor));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(dec_session, dec, msg->pt_len + 1, &pt_len, ct, ct_len, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(dec_session));
+    TEST_ASSERT_INT_EQ(pt_len, msg->pt_len);
+    TEST_ASSERT(!memcmp(pt, dec, pt_len));
+
+    // The executor can only be changed before a message is started
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_frame_executor(dec_session, NULL));
+
+    aws_cryptosdk_session_destroy(enc);
+    aws_cryptosdk_session_destroy(dec_session);
+    aws_mem_release(alloc, pt);
+    aws_mem_release(alloc, ct);
+    aws_mem_release(alloc, dec);
     return 0;
 }
 
-/* We test that, with both input and output buffers set to a minimum size to start and always
- * following the buffer estimates provided, we will successfully do both encryption and decryption.
- * We do this for the default frame size, unframed data, and a variety of other frame sizes,
- * with messages that are a bit more, a bit less, and exactly at a 2 frame length.
- */
-int test_using_estimates() {
+static void run_executor_message(void *arg) {
+    struct executor_message *msg = arg;
+    msg->result                  = executor_roundtrip(msg);
+}
+
+int test_frame_executor() {
     struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_thread threads[4];
 
-    // first one we won't set frame size (uses default), last one for unframed data
-    uint32_t frame_sizes[] = { 0, 1536, 1537, 1538, 1539, 1540, 0 };
-    for (size_t frame_idx = 0; frame_idx < sizeof(frame_sizes) / sizeof(uint32_t); ++frame_idx) {
-        for (size_t plaintext_len = 2 * 1530; plaintext_len < 2 * 1545; plaintext_len++) {
-            struct aws_cryptosdk_keyring *keyring = aws_cryptosdk_counting_keyring_new(alloc);
-            create_session(AWS_CRYPTOSDK_ENCRYPT, keyring);
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_frame_executor_new(alloc, 0));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
 
-            if (frame_idx) {
-                TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, frame_sizes[frame_idx]));
-            }
+    struct aws_cryptosdk_frame_executor *executor = aws_cryptosdk_frame_executor_new(alloc, 2);
+    TEST_ASSERT_ADDR_NOT_NULL(executor);
 
-            uint8_t *plaintext_buf = aws_mem_acquire(alloc, plaintext_len);
-            TEST_ASSERT_ADDR_NOT_NULL(plaintext_buf);
-            TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(plaintext_buf, plaintext_len));
+    /* Large and small messages, with and without signatures, share the executor's two threads at once */
+    struct executor_message msgs[4] = {
+        { executor, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 50000, -1 },
+        { executor, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 250, -1 },
+        { executor, ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256, 80000, -1 },
+        { executor, ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256_ECDSA_P256, 0, -1 },
+    };
+    for (size_t i = 0; i < 4; i++) {
+        TEST_ASSERT_SUCCESS(aws_thread_init(&threads[i], alloc));
+        TEST_ASSERT_SUCCESS(aws_thread_launch(&threads[i], run_executor_message, &msgs[i], NULL));
+    }
+    for (size_t i = 0; i < 4; i++) {
+        aws_thread_join(&threads[i]);
+        aws_thread_clean_up(&threads[i]);
+        TEST_ASSERT_INT_EQ(msgs[i].result, 0);
+    }
 
-            TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, plaintext_len));
+    aws_cryptosdk_frame_executor_destroy(executor);
+    return 0;
+}
 
-            uint8_t *ciphertext_buf;
-            size_t ciphertext_len;
-            TEST_ASSERT_SUCCESS(process_loop(alloc, &ciphertext_buf, &ciphertext_len, plaintext_buf, plaintext_len));
+/* Splits buf into segments of cycling odd sizes, so that frames straddle segment boundaries */
+static size_t split_segments(struct aws_byte_cursor *segs, size_t max_segs, uint8_t *buf, size_t len) {
+    static const size_t sizes[] = { 1, 7, 300, 13, 4096, 2, 97 };
+    size_t n = 0;
 
-            TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    for (size_t off = 0; off < len && n < max_segs; n++) {
+        size_t seg_len = sizes[n % (sizeof(sizes) / sizeof(sizes[0]))];
+        if (seg_len > len - off || n == max_segs - 1) seg_len = len - off;
+        segs[n] = aws_byte_cursor_from_array(buf + off, seg_len);
+        off += seg_len;
+    }
 
-            uint8_t *decrypted_plaintext_buf;
-            size_t decrypted_plaintext_len;
-            TEST_ASSERT_SUCCESS(process_loop(
-                alloc, &decrypted_plaintext_buf, &decrypted_plaintext_len, ciphertext_buf, ciphertext_len));
+    return n;
+}
 
-            TEST_ASSERT_INT_EQ(plaintext_len, decrypted_plaintext_len);
-            TEST_ASSERT(!memcmp(plaintext_buf, decrypted_plaintext_buf, plaintext_len));
+static size_t split_output_segments(struct aws_byte_buf *segs, size_t max_segs, uint8_t *buf, size_t len) {
+    struct aws_byte_cursor cursors[64];
+    size_t n = split_segments(cursors, max_segs < 64 ? max_segs : 64, buf, len);
 
-            free_bufs();
-            aws_mem_release(alloc, plaintext_buf);
-            aws_mem_release(alloc, ciphertext_buf);
-            aws_mem_release(alloc, decrypted_plaintext_buf);
-        }
+    for (size_t i = 0; i < n; i++) {
+        segs[i] = aws_byte_buf_from_empty_array(cursors[i].ptr, cursors[i].len);
+    }
+
+    return n;
+}
+
+int test_processv_roundtrip() {
+    struct aws_byte_cursor inv[64];
+    struct aws_byte_buf outv[64];
+    size_t written, read;
+
+    init_bufs(5000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 200);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+
+    grow_buf(&ct_buf, &ct_buf_size, 8192);
+    size_t incnt  = split_segments(inv, 64, pt_buf, pt_size);
+    size_t outcnt = split_output_segments(outv, 64, ct_buf, ct_buf_size);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_processv(session, outv, outcnt, &written, inv, incnt, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(read, pt_size);
+    ct_size = written;
+
+    /* Output segments must have been filled in order, leaving no gaps */
+    size_t filled = 0;
+    for (size_t i = 0; i < outcnt; i++) {
+        filled += outv[i].len;
+        TEST_ASSERT(outv[i].len == outv[i].capacity || filled == written);
     }
+    TEST_ASSERT_INT_EQ(filled, written);
+
+    /* Decrypt scatter/gather as well */
+    uint8_t *pt_check_buf = aws_mem_acquire(aws_default_allocator(), 8192);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check_buf);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    incnt  = split_segments(inv, 64, ct_buf, ct_size);
+    outcnt = split_output_segments(outv, 64, pt_check_buf, 8192);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_processv(session, outv, outcnt, &written, inv, incnt, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(read, ct_size);
+    TEST_ASSERT_INT_EQ(written, pt_size);
+    TEST_ASSERT_INT_EQ(0, memcmp(pt_check_buf, pt_buf, pt_size));
+
+    aws_mem_release(aws_default_allocator(), pt_check_buf);
+
+    free_bufs();
+    return 0;
+}
+
+static int in_place_roundtrip(size_t worker_threads) {
+    size_t written, read;
+
+    init_bufs(5000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    /* Encrypt out of place first, to learn how much headroom the message needs */
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 256);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+    if (pump_ciphertext(8192, &written, pt_size, &read)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    size_t headroom = ct_size - pt_size;
+    uint8_t *buf    = aws_mem_acquire(aws_default_allocator(), ct_size);
+    TEST_ASSERT_ADDR_NOT_NULL(buf);
+    memcpy(buf + headroom, pt_buf, pt_size);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(session, worker_threads));
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+
+    /* Output may not start after the input it overlaps */
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_session_process(session, buf + 1, ct_size - 1, &written, buf, pt_size, &read));
+
+    /* Too little headroom stalls rather than clobbering plaintext */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+        session, buf + headroom / 2, ct_size - headroom / 2, &written, buf + headroom, pt_size, &read));
+    TEST_ASSERT(!aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT(read < pt_size);
+    TEST_ASSERT_INT_EQ(0, memcmp(buf + headroom + read, pt_buf + read, pt_size - read));
+
+    memcpy(buf + headroom, pt_buf, pt_size);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT));
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, buf, ct_size, &written, buf + headroom, pt_size, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(written, ct_size);
+    TEST_ASSERT_INT_EQ(read, pt_size);
+
+    /* Decrypt in place, over the ciphertext */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, buf, ct_size, &written, buf, ct_size, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(written, pt_size);
+    TEST_ASSERT_INT_EQ(read, ct_size);
+    TEST_ASSERT_INT_EQ(0, memcmp(buf, pt_buf, pt_size));
+
+    aws_mem_release(aws_default_allocator(), buf);
+
+    free_bufs();
+    return 0;
+}
+
+int test_in_place() {
+    if (in_place_roundtrip(1)) return 1;
+    if (in_place_roundtrip(4)) return 1;
+
+    return 0;
+}
+
+static int pipelined_signature_once(size_t worker_threads) {
+    size_t ct_consumed, pt_consumed, written, read;
+
+    init_bufs(10000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 100);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(session, worker_threads));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_pipelined_signature(session, true));
+
+    /* Feed a partial batch first, so that the digest spans several calls */
+    if (pump_ciphertext(4096, &ct_consumed, 1234, &pt_consumed)) return 1;
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_pipelined_signature(session, false));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    precise_size_set = true;
+
+    if (pump_ciphertext(65536, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    /* The setting is preserved, so this decrypts with a pipelined signature too */
+    if (check_ciphertext_and_trace(true)) return 1;
+
+    uint8_t *pt_check_buf = aws_mem_acquire(aws_default_allocator(), ct_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check_buf);
+
+    /* The signature is the same as an inline digest would produce */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_pipelined_signature(session, false));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, pt_check_buf, ct_size, &written, ct_buf, ct_size, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    /* Decrypting in place waits for each batch to be hashed before overwriting it */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_pipelined_signature(session, true));
+    memcpy(pt_check_buf, ct_buf, ct_size);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, pt_check_buf, ct_size, &written, pt_check_buf, ct_size, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(written, pt_size);
+    TEST_ASSERT_INT_EQ(0, memcmp(pt_check_buf, pt_buf, pt_size));
+
+    /* A bad signature is still caught */
+    ct_buf[ct_size - 1] ^= 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_process(session, pt_check_buf, ct_size, &written, ct_buf, ct_size, &read));
+
+    aws_mem_release(aws_default_allocator(), pt_check_buf);
+
+    free_bufs();
+    return 0;
+}
+
+int test_pipelined_signature() {
+    if (pipelined_signature_once(1)) return 1;
+    if (pipelined_signature_once(4)) return 1;
+
+    return 0;
+}
+
+#define NUM_DEFERRED_MESSAGES 8
+#define NUM_VERIFY_WORKERS 3
+
+static int deferred_signatures_once(bool use_executor) {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    struct aws_cryptosdk_session *sessions[NUM_DEFERRED_MESSAGES + 1];
+    uint8_t *cts[NUM_DEFERRED_MESSAGES];
+    size_t ct_lens[NUM_DEFERRED_MESSAGES];
+    int results[NUM_DEFERRED_MESSAGES + 1];
+    uint8_t pt[1000], pt_check[sizeof(pt)];
+    size_t written, read;
+
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+    for (int i = 0; i < NUM_DEFERRED_MESSAGES; i++) {
+        size_t needed;
+        TEST_ASSERT_ERROR(
+            AWS_ERROR_SHORT_BUFFER, aws_cryptosdk_encrypt_buffer(alloc, cmm, NULL, NULL, 0, &needed, pt, sizeof(pt)));
+        TEST_ASSERT_ADDR_NOT_NULL(cts[i] = aws_mem_acquire(alloc, needed));
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_encrypt_buffer(alloc, cmm, NULL, cts[i], needed, &ct_lens[i], pt, sizeof(pt)));
+    }
+
+    /* Message 5's signature is corrupted, which only the batch verification notices */
+    cts[5][ct_lens[5] - 1] ^= 1;
+    for (int i = 0; i < NUM_DEFERRED_MESSAGES; i++) {
+        TEST_ASSERT_ADDR_NOT_NULL(sessions[i] = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, cmm));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_deferred_signature(sessions[i], true));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+            sessions[i], pt_check, sizeof(pt_check), &written, cts[i], ct_lens[i], &read));
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_deferred_signature(sessions[i], false));
+        TEST_ASSERT(aws_cryptosdk_session_is_done(sessions[i]));
+        TEST_ASSERT_INT_EQ(read, ct_lens[i]);
+        TEST_ASSERT_INT_EQ(written, sizeof(pt));
+        TEST_ASSERT(!memcmp(pt_check, pt, sizeof(pt)));
+    }
+
+    /* A session which has not finished its message cannot be verified, and is left as it was */
+    TEST_ASSERT_ADDR_NOT_NULL(
+        sessions[NUM_DEFERRED_MESSAGES] = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, cmm));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_verify_deferred_signatures(
+        sessions,
+        results,
+        NUM_DEFERRED_MESSAGES + 1,
+        use_executor ? aws_cryptosdk_test_thread_per_task_executor : NULL,
+        NULL,
+        NUM_VERIFY_WORKERS));
+    aws_cryptosdk_test_join_task_threads();
+
+    for (int i = 0; i < NUM_DEFERRED_MESSAGES; i++) {
+        if (i == 5) {
+            TEST_ASSERT_INT_EQ(results[i], AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+            TEST_ASSERT(!aws_cryptosdk_session_is_done(sessions[i]));
+        } else {
+            TEST_ASSERT_INT_EQ(results[i], AWS_ERROR_SUCCESS);
+            TEST_ASSERT(aws_cryptosdk_session_is_done(sessions[i]));
+        }
+    }
+    TEST_ASSERT_INT_EQ(results[NUM_DEFERRED_MESSAGES], AWS_CRYPTOSDK_ERR_BAD_STATE);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_deferred_signature(sessions[NUM_DEFERRED_MESSAGES], true));
+
+    /* Verified signatures are not checked again */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_verify_deferred_signatures(sessions, results, 1, NULL, NULL, 0));
+    TEST_ASSERT_INT_EQ(results[0], AWS_ERROR_SUCCESS);
+
+    /* A reset discards a signature still awaiting verification, and keeps the setting */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(sessions[0], AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(sessions[0], pt_check, sizeof(pt_check), &written, cts[5], ct_lens[5], &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(sessions[0]));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(sessions[0], AWS_CRYPTOSDK_DECRYPT));
+
+    for (int i = 0; i < NUM_DEFERRED_MESSAGES; i++) {
+        aws_cryptosdk_session_destroy(sessions[i]);
+        aws_mem_release(alloc, cts[i]);
+    }
+    aws_cryptosdk_session_destroy(sessions[NUM_DEFERRED_MESSAGES]);
+    aws_cryptosdk_cmm_release(cmm);
+
+    return 0;
+}
+
+int test_deferred_signatures() {
+    if (deferred_signatures_once(false)) return 1;
+    if (deferred_signatures_once(true)) return 1;
+
+    return 0;
+}
+
+/* A GCM provider which forwards to the built-in one, counting the frames it handles */
+static int counting_gcm_seals, counting_gcm_opens;
+
+static void *counting_gcm_key_new(const uint8_t *key, size_t key_len, bool enc) {
+    return aws_cryptosdk_gcm_provider_openssl()->key_new(key, key_len, enc);
+}
+
+static void counting_gcm_key_destroy(void *key_ctx) {
+    aws_cryptosdk_gcm_provider_openssl()->key_destroy(key_ctx);
+}
+
+static int counting_gcm_seal(
+    void *key_ctx,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    uint8_t *tag) {
+    counting_gcm_seals++;
+    return aws_cryptosdk_gcm_provider_openssl()->seal(key_ctx, out, in, len, iv, aad, aad_len, tag);
+}
+
+static int counting_gcm_open(
+    void *key_ctx,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    const uint8_t *tag) {
+    counting_gcm_opens++;
+    return aws_cryptosdk_gcm_provider_openssl()->open(key_ctx, out, in, len, iv, aad, aad_len, tag);
+}
+
+static const struct aws_cryptosdk_gcm_provider_vt counting_gcm_provider = {
+    .vt_size     = sizeof(struct aws_cryptosdk_gcm_provider_vt),
+    .name        = "counting GCM provider",
+    .key_new     = counting_gcm_key_new,
+    .key_destroy = counting_gcm_key_destroy,
+    .seal        = counting_gcm_seal,
+    .open        = counting_gcm_open,
+};
+
+int test_gcm_provider() {
+    size_t ct_consumed, pt_consumed;
+
+    init_bufs(1000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 100);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+
+    struct aws_cryptosdk_gcm_provider_vt incomplete = counting_gcm_provider;
+    incomplete.open                                 = NULL;
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_session_set_gcm_provider(session, &incomplete));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_gcm_provider(session, &counting_gcm_provider));
+
+    counting_gcm_seals = counting_gcm_opens = 0;
+    if (pump_ciphertext(4096, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    /* The header tag, ten full frames and an empty final frame */
+    TEST_ASSERT_INT_EQ(counting_gcm_seals, 12);
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_gcm_provider(session, NULL));
+
+    /* The provider is kept across the reset to decrypt mode */
+    if (check_ciphertext_and_trace(true)) return 1;
+    TEST_ASSERT_INT_EQ(counting_gcm_opens, 12);
+
+    free_bufs();
+    return 0;
+}
+
+static int many_gcm_calls, many_gcm_max_ops;
+
+static void many_gcm_record(size_t count) {
+    many_gcm_calls++;
+    if ((int)count > many_gcm_max_ops) many_gcm_max_ops = (int)count;
+}
+
+static void many_gcm_seal_many(struct aws_cryptosdk_gcm_op *ops, size_t count) {
+    many_gcm_record(count);
+    for (size_t i = 0; i < count; i++) {
+        struct aws_cryptosdk_gcm_op *op = &ops[i];
+        int rv                          = aws_cryptosdk_gcm_provider_openssl()->seal(
+            op->key_ctx, op->out, op->in, op->len, op->iv, op->aad, op->aad_len, op->tag);
+        op->error = rv ? aws_last_error() : AWS_ERROR_SUCCESS;
+    }
+}
+
+static void many_gcm_open_many(struct aws_cryptosdk_gcm_op *ops, size_t count) {
+    many_gcm_record(count);
+    for (size_t i = 0; i < count; i++) {
+        struct aws_cryptosdk_gcm_op *op = &ops[i];
+        int rv                          = aws_cryptosdk_gcm_provider_openssl()->open(
+            op->key_ctx, op->out, op->in, op->len, op->iv, op->aad, op->aad_len, op->tag);
+        op->error = rv ? aws_last_error() : AWS_ERROR_SUCCESS;
+    }
+}
+
+static const struct aws_cryptosdk_gcm_provider_vt many_gcm_provider = {
+    .vt_size     = sizeof(struct aws_cryptosdk_gcm_provider_vt),
+    .name        = "multi-buffer test provider",
+    .key_new     = counting_gcm_key_new,
+    .key_destroy = counting_gcm_key_destroy,
+    .seal        = counting_gcm_seal,
+    .open        = counting_gcm_open,
+    .seal_many   = many_gcm_seal_many,
+    .open_many   = many_gcm_open_many,
+};
+
+int test_gcm_provider_many() {
+    size_t ct_consumed, pt_consumed, written, read;
+
+    init_bufs(1000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 100);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+
+    // A provider built against a definition without the many entry points is still accepted
+    struct aws_cryptosdk_gcm_provider_vt old = counting_gcm_provider;
+    old.vt_size                              = offsetof(struct aws_cryptosdk_gcm_provider_vt, seal_many);
+    TEST_ASSERT(!aws_cryptosdk_gcm_provider_has_many(&old));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_gcm_provider(session, &old));
+    TEST_ASSERT(aws_cryptosdk_gcm_provider_has_many(&many_gcm_provider));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_gcm_provider(session, &many_gcm_provider));
+
+    // Even on one thread, the frames are handed over several at a time
+    many_gcm_calls = many_gcm_max_ops = 0;
+    if (pump_ciphertext(4096, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT(many_gcm_calls > 0);
+    TEST_ASSERT(many_gcm_max_ops > 1);
+    TEST_ASSERT(many_gcm_max_ops <= AWS_CRYPTOSDK_GCM_MAX_OPS);
+
+    many_gcm_calls = many_gcm_max_ops = 0;
+    if (check_ciphertext_and_trace(true)) return 1;
+    TEST_ASSERT(many_gcm_max_ops > 1);
+
+    uint8_t *pt_check_buf = aws_mem_acquire(aws_default_allocator(), ct_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check_buf);
+
+    // A damaged frame among those batched together fails the message
+    ct_buf[ct_size / 2] ^= 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_process(session, pt_check_buf, ct_size, &written, ct_buf, ct_size, &read));
+
+    aws_mem_release(aws_default_allocator(), pt_check_buf);
+
+    free_bufs();
+    return 0;
+}
+
+/* A provider which gets every tag wrong, as a miscompiled kernel might */
+static int broken_gcm_seal(
+    void *key_ctx,
+    uint8_t *out,
+    const uint8_t *in,
+    size_t len,
+    const uint8_t *iv,
+    const uint8_t *aad,
+    size_t aad_len,
+    uint8_t *tag) {
+    if (aws_cryptosdk_gcm_provider_openssl()->seal(key_ctx, out, in, len, iv, aad, aad_len, tag)) return AWS_OP_ERR;
+    tag[0] ^= 1;
+    return AWS_OP_SUCCESS;
+}
+
+static const struct aws_cryptosdk_gcm_provider_vt broken_gcm_provider = {
+    .vt_size     = sizeof(struct aws_cryptosdk_gcm_provider_vt),
+    .name        = "broken GCM provider",
+    .key_new     = counting_gcm_key_new,
+    .key_destroy = counting_gcm_key_destroy,
+    .seal        = broken_gcm_seal,
+    .open        = counting_gcm_open,
+};
+
+int test_kernel_selection() {
+    const char *builtin = aws_cryptosdk_gcm_provider_openssl()->name;
+    struct aws_cryptosdk_active_kernels active;
+    size_t ct_consumed, pt_consumed;
+
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_FRAME_CLASS_SMALL, aws_cryptosdk_frame_class_of(1024));
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_FRAME_CLASS_MEDIUM, aws_cryptosdk_frame_class_of(4096));
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_FRAME_CLASS_LARGE, aws_cryptosdk_frame_class_of(64 * 1024 + 1));
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_FRAME_CLASS_LARGE, aws_cryptosdk_frame_class_of(0));
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_cpu_features(), aws_cryptosdk_cpu_features());
+
+    // Until a selection is made, the built-in providers are in use
+    aws_cryptosdk_get_active_kernels(&active);
+    TEST_ASSERT(!active.benchmarked);
+    TEST_ASSERT(!strcmp(builtin, active.gcm[AWS_CRYPTOSDK_FRAME_CLASS_MEDIUM]));
+    TEST_ASSERT_ADDR_EQ(aws_cryptosdk_gcm_provider_openssl(), aws_cryptosdk_gcm_kernel_for_frame_size(4096));
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_digest_kernel());
+
+    struct aws_cryptosdk_gcm_provider_vt incomplete = counting_gcm_provider;
+    incomplete.seal                                 = NULL;
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_register_gcm_kernel(&incomplete, 0));
+
+    // Kernels needing a feature no CPU has are never selected; otherwise the last registered wins
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_register_gcm_kernel(&many_gcm_provider, 0));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_register_gcm_kernel(&counting_gcm_provider, 1u << 30));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_register_digest_kernel(aws_cryptosdk_digest_provider_openssl(), 0));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_select_kernels(false));
+    aws_cryptosdk_get_active_kernels(&active);
+    for (int c = 0; c < AWS_CRYPTOSDK_FRAME_CLASS_COUNT; c++) {
+        TEST_ASSERT(!strcmp(many_gcm_provider.name, active.gcm[c]));
+        TEST_ASSERT_INT_EQ(0, active.gcm_bytes_per_sec[c]);
+    }
+    TEST_ASSERT_ADDR_EQ(aws_cryptosdk_digest_provider_openssl(), aws_cryptosdk_digest_kernel());
+
+    // Sessions without a provider of their own pick up the selected kernel
+    init_bufs(1000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 100);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+    many_gcm_calls = many_gcm_max_ops = 0;
+    if (pump_ciphertext(4096, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT(many_gcm_max_ops > 1);
+    if (check_ciphertext_and_trace(true)) return 1;
+    free_bufs();
+
+    // Benchmarking measures every candidate, and passes over one which gets the wrong answer
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_register_gcm_kernel(&broken_gcm_provider, 0));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_select_kernels(true));
+    aws_cryptosdk_get_active_kernels(&active);
+    TEST_ASSERT(active.benchmarked);
+    for (int c = 0; c < AWS_CRYPTOSDK_FRAME_CLASS_COUNT; c++) {
+        TEST_ASSERT(!strcmp(builtin, active.gcm[c]) || !strcmp(many_gcm_provider.name, active.gcm[c]));
+        TEST_ASSERT(active.gcm_bytes_per_sec[c] > 0);
+    }
+    TEST_ASSERT(active.digest_ops_per_sec > 0);
+
+    aws_cryptosdk_reset_kernels();
+    TEST_ASSERT_ADDR_EQ(aws_cryptosdk_gcm_provider_openssl(), aws_cryptosdk_gcm_kernel_for_frame_size(4096));
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_digest_kernel());
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_select_kernels(false));
+    aws_cryptosdk_get_active_kernels(&active);
+    TEST_ASSERT(!strcmp(builtin, active.gcm[AWS_CRYPTOSDK_FRAME_CLASS_SMALL]));
+    aws_cryptosdk_reset_kernels();
+
+    return 0;
+}
+
+/*
+ * Frames larger than the chunks in which the built-in provider interleaves GCM with the
+ * signature digest; the digest must match that of the two-pass path taken by other providers
+ * and by parallel workers.
+ */
+static int stitched_digest_once(const struct aws_cryptosdk_gcm_provider_vt *enc_provider, size_t decrypt_workers) {
+    size_t ct_consumed, pt_consumed, written, read;
+
+    init_bufs(100000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 40000);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_gcm_provider(session, enc_provider));
+
+    while (!aws_cryptosdk_session_is_done(session)) {
+        if (pump_ciphertext(65536, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    }
+
+    uint8_t *pt_check_buf = aws_mem_acquire(aws_default_allocator(), ct_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check_buf);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_gcm_provider(session, NULL));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(session, decrypt_workers));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, pt_check_buf, ct_size, &written, ct_buf, ct_size, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(written, pt_size);
+    TEST_ASSERT_INT_EQ(0, memcmp(pt_check_buf, pt_buf, pt_size));
+
+    /* A flipped bit in the middle of a chunk is caught by the tag */
+    ct_buf[ct_size / 2] ^= 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_process(session, pt_check_buf, ct_size, &written, ct_buf, ct_size, &read));
+
+    aws_mem_release(aws_default_allocator(), pt_check_buf);
+
+    free_bufs();
+    return 0;
+}
+
+int test_stitched_digest() {
+    if (stitched_digest_once(NULL, 1)) return 1;
+    if (stitched_digest_once(NULL, 4)) return 1;
+    if (stitched_digest_once(&counting_gcm_provider, 1)) return 1;
+
+    return 0;
+}
+
+static int check_stats(uint64_t bytes_in, uint64_t bytes_out, uint64_t frames) {
+    struct aws_cryptosdk_session_stats stats;
+
+    aws_cryptosdk_session_get_stats(session, &stats);
+    TEST_ASSERT_INT_EQ(stats.bytes_in, bytes_in);
+    TEST_ASSERT_INT_EQ(stats.bytes_out, bytes_out);
+    TEST_ASSERT_INT_EQ(stats.frames, frames);
+    TEST_ASSERT(stats.cmm_ns > 0);
+    TEST_ASSERT(stats.hkdf_ns > 0);
+    TEST_ASSERT(stats.header_ns > 0);
+    TEST_ASSERT(stats.gcm_ns > 0);
+    TEST_ASSERT(stats.signature_ns > 0);
+    TEST_ASSERT_INT_EQ(stats.stalled_calls, 1);
+
+    return 0;
+}
+
+int test_session_stats() {
+    size_t ct_consumed, pt_consumed, written, read;
+    struct aws_cryptosdk_session_stats stats;
+
+    init_bufs(1000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 100);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+
+    aws_cryptosdk_session_get_stats(session, &stats);
+    TEST_ASSERT_INT_EQ(stats.bytes_in + stats.bytes_out + stats.frames + stats.stalled_calls, 0);
+
+    /* Writes the header, then stalls on a buffer too small for a frame */
+    if (pump_ciphertext(4096, &ct_consumed, 0, &pt_consumed)) return 1;
+    if (pump_ciphertext(10, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT_INT_EQ(ct_consumed, 0);
+
+    while (!aws_cryptosdk_session_is_done(session)) {
+        if (pump_ciphertext(4096, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    }
+
+    /* Ten full frames plus an empty final frame */
+    if (check_stats(pt_size, ct_size, 11)) return 1;
+
+    uint8_t *pt_check_buf = aws_mem_acquire(aws_default_allocator(), pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check_buf);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    aws_cryptosdk_session_get_stats(session, &stats);
+    TEST_ASSERT_INT_EQ(stats.bytes_in + stats.bytes_out + stats.cmm_ns + stats.stalled_calls, 0);
+
+    /* Starts reading the header, stalls on the rest of it, then decrypts the whole message */
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, pt_check_buf, pt_size, &written, ct_buf, 1, &read));
+        TEST_ASSERT_INT_EQ(read, 0);
+    }
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, pt_check_buf, pt_size, &written, ct_buf, ct_size, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    if (check_stats(ct_size, pt_size, 11)) return 1;
+
+    aws_mem_release(aws_default_allocator(), pt_check_buf);
+
+    free_bufs();
+    return 0;
+}
+
+#define MAX_TRACE_EVENTS 16
+
+static struct {
+    size_t count;
+    struct aws_cryptosdk_session_trace_event events[MAX_TRACE_EVENTS];
+    uint8_t message_ids[MAX_TRACE_EVENTS][16];
+} trace_log;
+
+static void record_trace(
+    const struct aws_cryptosdk_session *s, const struct aws_cryptosdk_session_trace_event *event, void *user_data) {
+    (void)user_data;
+    if (s != session || trace_log.count == MAX_TRACE_EVENTS) return;
+
+    trace_log.events[trace_log.count] = *event;
+    if (event->message_id) memcpy(trace_log.message_ids[trace_log.count], event->message_id, 16);
+    trace_log.count++;
+}
+
+/* Checks the recorded events against a list of state names, starting from "config" */
+static int check_trace(const char **states, size_t num_states, const uint8_t *message_id) {
+    TEST_ASSERT_INT_EQ(trace_log.count, num_states - 1);
+
+    for (size_t i = 0; i < trace_log.count; i++) {
+        const struct aws_cryptosdk_session_trace_event *event = &trace_log.events[i];
+
+        TEST_ASSERT(!strcmp(event->old_state, states[i]));
+        TEST_ASSERT(!strcmp(event->new_state, states[i + 1]));
+        TEST_ASSERT(event->timestamp_ns > 0);
+        if (i) TEST_ASSERT(event->timestamp_ns >= trace_log.events[i - 1].timestamp_ns);
+
+        // The ID is unknown until the materials are generated or the header parsed
+        if (i == 0) {
+            TEST_ASSERT_ADDR_NULL(event->message_id);
+        } else {
+            TEST_ASSERT_ADDR_NOT_NULL(event->message_id);
+            TEST_ASSERT_INT_EQ(0, memcmp(trace_log.message_ids[i], message_id, 16));
+        }
+    }
+
+    trace_log.count = 0;
+    return 0;
+}
+
+int test_trace_callback() {
+    static const char *enc_states[] = { "config", "gen_key", "write_header", "encrypt_body", "write_trailer", "done" };
+    static const char *dec_states[] = {
+        "config", "read_header", "unwrap_key", "decrypt_body", "check_trailer", "done"
+    };
+    size_t ct_consumed, pt_consumed, written, read;
+
+    init_bufs(1000);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    aws_cryptosdk_session_set_frame_size(session, 100);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+
+    trace_log.count = 0;
+    aws_cryptosdk_session_set_trace_callback(session, record_trace, NULL);
+
+    while (!aws_cryptosdk_session_is_done(session)) {
+        if (pump_ciphertext(4096, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    }
+
+    /* The message ID follows the version, type and algorithm ID in the header */
+    uint8_t message_id[16];
+    memcpy(message_id, ct_buf + 4, sizeof(message_id));
+    if (check_trace(enc_states, sizeof(enc_states) / sizeof(enc_states[0]), message_id)) return 1;
+
+    uint8_t *pt_check_buf = aws_mem_acquire(aws_default_allocator(), pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check_buf);
+
+    /* Resetting is reported as the end of the encrypted message */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_INT_EQ(trace_log.count, 1);
+    TEST_ASSERT(!strcmp(trace_log.events[0].old_state, "done"));
+    TEST_ASSERT(!strcmp(trace_log.events[0].new_state, "config"));
+    TEST_ASSERT_INT_EQ(0, memcmp(trace_log.message_ids[0], message_id, 16));
+    trace_log.count = 0;
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, pt_check_buf, pt_size, &written, ct_buf, ct_size, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    if (check_trace(dec_states, sizeof(dec_states) / sizeof(dec_states[0]), message_id)) return 1;
+
+    /* Once the callback is removed, nothing more is reported */
+    aws_cryptosdk_session_set_trace_callback(session, NULL, NULL);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, pt_check_buf, pt_size, &written, ct_buf, ct_size, &read));
+    TEST_ASSERT_INT_EQ(trace_log.count, 0);
+
+    aws_mem_release(aws_default_allocator(), pt_check_buf);
+
+    free_bufs();
+    return 0;
+}
+
+/*
+ * Encrypts a message of pt_len bytes with adaptive frame sizing, offering ct_window bytes of
+ * output per call, and returns the frame size chosen (or UINT32_MAX on failure). If bound is
+ * nonzero, it is given as the message bound rather than setting the precise size up front.
+ */
+static uint32_t adaptive_frame_size_once(size_t pt_len, uint64_t bound, size_t worker_threads, size_t ct_window) {
+    size_t ct_consumed, pt_consumed;
+    struct aws_cryptosdk_hdr hdr;
+    uint32_t frame_len = UINT32_MAX;
+
+    init_bufs(pt_len);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    if (!kr) return UINT32_MAX;
+
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+    if (aws_cryptosdk_session_set_adaptive_frame_size(session, true) ||
+        aws_cryptosdk_session_set_worker_threads(session, worker_threads)) {
+        return UINT32_MAX;
+    }
+
+    if (bound) {
+        if (aws_cryptosdk_session_set_message_bound(session, bound)) return UINT32_MAX;
+    } else {
+        if (aws_cryptosdk_session_set_message_size(session, pt_size)) return UINT32_MAX;
+        precise_size_set = true;
+    }
+
+    for (int calls = 0; !aws_cryptosdk_session_is_done(session); calls++) {
+        if (calls > 10000 || pump_ciphertext(ct_window, &ct_consumed, pt_size, &pt_consumed)) return UINT32_MAX;
+        // The last partial frame waits for the end of the message to be marked
+        if (!precise_size_set && !ct_consumed && !pt_consumed) {
+            if (aws_cryptosdk_session_set_message_size(session, pt_size)) return UINT32_MAX;
+            precise_size_set = true;
+        }
+    }
+
+    aws_cryptosdk_hdr_init(&hdr, aws_default_allocator());
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_array(ct_buf, ct_size);
+    if (!aws_cryptosdk_hdr_parse(&hdr, &cursor)) frame_len = hdr.frame_len;
+    aws_cryptosdk_hdr_clean_up(&hdr);
+
+    // The message must still decrypt
+    if (check_ciphertext_and_trace(true)) frame_len = UINT32_MAX;
+
+    free_bufs();
+    return frame_len;
+}
+
+int test_adaptive_frame_size() {
+    /* A tiny message is unframed, unless only its bound is known */
+    TEST_ASSERT_INT_EQ(adaptive_frame_size_once(300, 0, 1, 65536), 0);
+    TEST_ASSERT_INT_EQ(adaptive_frame_size_once(300, 400, 1, 65536), 4096);
+    /* A small message is a single final frame */
+    TEST_ASSERT_INT_EQ(adaptive_frame_size_once(1000, 0, 1, 65536), 4096);
+    TEST_ASSERT_INT_EQ(adaptive_frame_size_once(5000, 0, 1, 65536), 8192);
+    /* Frames fit the output buffer */
+    TEST_ASSERT_INT_EQ(adaptive_frame_size_once(100000, UINT32_MAX, 1, 65536), 32768);
+    /* ...up to the maximum */
+    TEST_ASSERT_INT_EQ(adaptive_frame_size_once(100000, UINT32_MAX, 1, 4 * 1024 * 1024), 1024 * 1024);
+    /* Each worker thread gets a frame */
+    TEST_ASSERT_INT_EQ(adaptive_frame_size_once(100000, 0, 4, 4 * 1024 * 1024), 16384);
+    TEST_ASSERT_INT_EQ(adaptive_frame_size_once(100000, UINT32_MAX, 2, 65536), 16384);
+
+    /* Setting a frame size turns adaptive sizing off */
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    create_session(AWS_CRYPTOSDK_DECRYPT, kr);
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_adaptive_frame_size(session, true));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_adaptive_frame_size(session, true));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 100));
+
+    init_bufs(1000);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t ct_consumed, pt_consumed;
+        if (pump_ciphertext(4096, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    }
+    struct aws_cryptosdk_session_stats stats;
+    aws_cryptosdk_session_get_stats(session, &stats);
+    TEST_ASSERT_INT_EQ(stats.frames, 11);
+
+    free_bufs();
+    return 0;
+}
+
+int test_block_aligned_frames() {
+    struct aws_cryptosdk_hdr hdr;
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    create_session(AWS_CRYPTOSDK_ENCRYPT, kr);
+
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_session_set_block_aligned_frames(session, 256));
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_session_set_block_aligned_frames(session, 5000));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_block_aligned_frames(session, 4096));
+
+    init_bufs(20000);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t ct_consumed, pt_consumed;
+        if (pump_ciphertext(65536, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    }
+
+    /* Each whole frame (sequence number, IV, body, tag) is exactly one block */
+    aws_cryptosdk_hdr_init(&hdr, aws_default_allocator());
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_array(ct_buf, ct_size);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_parse(&hdr, &cursor));
+    TEST_ASSERT_INT_EQ(hdr.frame_len, 4096 - 4 - 12 - 16);
+    for (uint32_t seqno = 1; seqno <= 5; seqno++) {
+        uint32_t field;
+        struct aws_byte_cursor frame = aws_byte_cursor_from_array(cursor.ptr + (seqno - 1) * 4096, 4);
+        TEST_ASSERT(aws_byte_cursor_read_be32(&frame, &field));
+        /* 20000 bytes make four whole frames, then the final frame with its end marker */
+        TEST_ASSERT_INT_EQ(field, seqno < 5 ? seqno : UINT32_MAX);
+    }
+    aws_cryptosdk_hdr_clean_up(&hdr);
+
+    TEST_ASSERT_SUCCESS(check_ciphertext_and_trace(true));
+    free_bufs();
+
+    /* The setting survives a reset, and setting a frame size turns it off */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_block_aligned_frames(session, 4096));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_INT_EQ(session->frame_block_size, 4096);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 100));
+    TEST_ASSERT_INT_EQ(session->frame_block_size, 0);
+
+    return 0;
+}
+
+/* Encrypts and decrypts a message whose encryption context is set from frozen */
+static int frozen_enc_ctx_once(const struct aws_cryptosdk_frozen_enc_ctx *frozen, enum aws_cryptosdk_alg_id alg_id) {
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = create_session_with_cmm(AWS_CRYPTOSDK_ENCRYPT, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+    aws_cryptosdk_cmm_release(cmm);
+
+    init_bufs(1000);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frozen_enc_ctx(session, frozen));
+    TEST_ASSERT(aws_cryptosdk_frozen_enc_ctx_matches(frozen, aws_cryptosdk_session_get_enc_ctx_ptr(session)));
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t ct_consumed, pt_consumed;
+        if (pump_ciphertext(4096, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    }
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_frozen_enc_ctx(session, frozen));
+
+    // Without a signature, the header's AAD (after the 20 byte prefix and the AAD length) is the
+    // frozen serialization; the default CMM adds the public key to the context otherwise
+    size_t extra                      = aws_cryptosdk_alg_props(alg_id)->signature_len ? 1 : 0;
+    struct aws_byte_cursor serialized = aws_cryptosdk_frozen_enc_ctx_serialized(frozen);
+    TEST_ASSERT(ct_size > 22 + serialized.len);
+    TEST_ASSERT_INT_EQ(!extra, !memcmp(ct_buf + 22, serialized.ptr, serialized.len));
+
+    if (check_ciphertext_and_trace(true)) return 1;
+
+    const struct aws_hash_table *enc_ctx  = aws_cryptosdk_session_get_enc_ctx_ptr(session);
+    const struct aws_hash_table *expected = aws_cryptosdk_frozen_enc_ctx_table(frozen);
+    TEST_ASSERT_INT_EQ(aws_hash_table_get_entry_count(enc_ctx), aws_hash_table_get_entry_count(expected) + extra);
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_frozen_enc_ctx(session, frozen));
+
+    free_bufs();
+    return 0;
+}
+
+int test_frozen_enc_ctx() {
+    AWS_STATIC_STRING_FROM_LITERAL(key_a, "tenant");
+    AWS_STATIC_STRING_FROM_LITERAL(value_a, "example");
+    AWS_STATIC_STRING_FROM_LITERAL(key_b, "purpose");
+    AWS_STATIC_STRING_FROM_LITERAL(value_b, "frozen context test");
+    struct aws_hash_table enc_ctx;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, key_a, (void *)value_a, NULL));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, key_b, (void *)value_b, NULL));
+
+    struct aws_cryptosdk_frozen_enc_ctx *frozen = aws_cryptosdk_enc_ctx_freeze(aws_default_allocator(), &enc_ctx);
+    TEST_ASSERT_ADDR_NOT_NULL(frozen);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    if (frozen_enc_ctx_once(frozen, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256)) return 1;
+    if (frozen_enc_ctx_once(frozen, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384)) return 1;
+
+    aws_cryptosdk_frozen_enc_ctx_destroy(frozen);
+    return 0;
+}
+
+int test_enc_ctx_flat() {
+    AWS_STATIC_STRING_FROM_LITERAL(key, "tenant");
+    AWS_STATIC_STRING_FROM_LITERAL(value, "example");
+    AWS_STATIC_STRING_FROM_LITERAL(public_key, "aws-crypto-public-key");
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_flat_enc_ctx flat, decrypted;
+    struct aws_byte_cursor found;
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = create_session_with_cmm(AWS_CRYPTOSDK_ENCRYPT, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384));
+    aws_cryptosdk_cmm_release(cmm);
+
+    init_bufs(1000);
+    struct aws_hash_table *enc_ctx = aws_cryptosdk_session_get_enc_ctx_ptr_mut(session);
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(enc_ctx, key, (void *)value, NULL));
+
+    // Before the header is written, the flat context is built from the table
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_enc_ctx_flat(session, alloc, &flat));
+    TEST_ASSERT_INT_EQ(1, aws_cryptosdk_flat_enc_ctx_count(&flat));
+    aws_cryptosdk_flat_enc_ctx_clean_up(&flat);
+
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t ct_consumed, pt_consumed;
+        if (pump_ciphertext(4096, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    }
+
+    // Afterwards it is the header's AAD, including the public key the default CMM added
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_enc_ctx_flat(session, alloc, &flat));
+    TEST_ASSERT_INT_EQ(2, aws_cryptosdk_flat_enc_ctx_count(&flat));
+    TEST_ASSERT(aws_cryptosdk_flat_enc_ctx_get(&flat, aws_byte_cursor_from_string(public_key), &found));
+    TEST_ASSERT(aws_cryptosdk_flat_enc_ctx_get(&flat, aws_byte_cursor_from_string(key), &found));
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&found, "example"));
+    struct aws_byte_cursor serialized = aws_cryptosdk_flat_enc_ctx_serialized(&flat);
+    TEST_ASSERT_INT_EQ(0, memcmp(ct_buf + 22, serialized.ptr, serialized.len));
+
+    if (check_ciphertext_and_trace(true)) return 1;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_enc_ctx_flat(session, alloc, &decrypted));
+    struct aws_byte_cursor decrypted_serialized = aws_cryptosdk_flat_enc_ctx_serialized(&decrypted);
+    TEST_ASSERT(aws_byte_cursor_eq(&serialized, &decrypted_serialized));
+    aws_cryptosdk_flat_enc_ctx_clean_up(&decrypted);
+    aws_cryptosdk_flat_enc_ctx_clean_up(&flat);
+
+    // Decrypt sessions only have a context once the CMM has been called
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_get_enc_ctx_flat(session, alloc, &flat));
+
+    free_bufs();
+    return 0;
+}
+
+int test_deferred_enc_ctx() {
+    AWS_STATIC_STRING_FROM_LITERAL(key, "tenant");
+    AWS_STATIC_STRING_FROM_LITERAL(value, "example");
+    struct aws_allocator *alloc = aws_default_allocator();
+    size_t ct_consumed, pt_consumed, written, read;
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = create_session_with_cmm(AWS_CRYPTOSDK_ENCRYPT, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+
+    init_bufs(1000);
+    struct aws_hash_table *enc_ctx_mut = aws_cryptosdk_session_get_enc_ctx_ptr_mut(session);
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(enc_ctx_mut, key, (void *)value, NULL));
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+    if (pump_ciphertext(4096, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 4);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    struct aws_cryptosdk_cmm *caching =
+        aws_cryptosdk_caching_cmm_new_from_cmm(alloc, cache, cmm, NULL, 60, AWS_TIMESTAMP_SECS);
+    TEST_ASSERT_ADDR_NOT_NULL(caching);
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_cmm_release(cmm);
+
+    uint8_t *pt_check_buf = aws_mem_acquire(alloc, pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check_buf);
+
+    for (int i = 0; i < 2; i++) {
+        struct aws_cryptosdk_session *dec = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, caching);
+        TEST_ASSERT_ADDR_NOT_NULL(dec);
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_session_process(dec, pt_check_buf, pt_size, &written, ct_buf, ct_size, &read));
+        TEST_ASSERT(aws_cryptosdk_session_is_done(dec));
+        TEST_ASSERT_INT_EQ(0, memcmp(pt_check_buf, pt_buf, pt_size));
+
+        // On the cache miss the default CMM needs the context for its keyring; a hit never builds it
+        TEST_ASSERT_INT_EQ(dec->header.enc_ctx_deferred, i == 1);
+
+        const struct aws_hash_table *enc_ctx = aws_cryptosdk_session_get_enc_ctx_ptr(dec);
+        TEST_ASSERT_ADDR_NOT_NULL(enc_ctx);
+        TEST_ASSERT(!dec->header.enc_ctx_deferred);
+        TEST_ASSERT_INT_EQ(1, aws_hash_table_get_entry_count(enc_ctx));
+        struct aws_hash_element *elem;
+        TEST_ASSERT_SUCCESS(aws_hash_table_find(enc_ctx, key, &elem));
+        TEST_ASSERT_ADDR_NOT_NULL(elem);
+        TEST_ASSERT(aws_string_eq(elem->value, value));
+
+        aws_cryptosdk_session_destroy(dec);
+    }
+
+    aws_mem_release(alloc, pt_check_buf);
+    aws_cryptosdk_cmm_release(caching);
+    free_bufs();
+    return 0;
+}
+
+static size_t counting_alloc_count;
+
+static void *counting_alloc_acquire(struct aws_allocator *alloc, size_t size) {
+    (void)alloc;
+    counting_alloc_count++;
+    return aws_mem_acquire(aws_default_allocator(), size);
+}
+
+static void counting_alloc_release(struct aws_allocator *alloc, void *ptr) {
+    (void)alloc;
+    aws_mem_release(aws_default_allocator(), ptr);
+}
+
+static void *counting_alloc_realloc(struct aws_allocator *alloc, void *ptr, size_t oldsize, size_t newsize) {
+    (void)alloc;
+    counting_alloc_count++;
+    if (aws_mem_realloc(aws_default_allocator(), &ptr, oldsize, newsize)) return NULL;
+    return ptr;
+}
+
+static struct aws_allocator counting_alloc = { .mem_acquire = counting_alloc_acquire,
+                                               .mem_release = counting_alloc_release,
+                                               .mem_realloc = counting_alloc_realloc };
+
+/*
+ * Runs a message through a reused session and returns the number of allocations made.
+ */
+static size_t count_message_allocs(
+    struct aws_cryptosdk_session *s,
+    enum aws_cryptosdk_mode mode,
+    uint8_t *out,
+    size_t out_len,
+    size_t *out_written,
+    const uint8_t *in,
+    size_t in_len) {
+    size_t in_read;
+
+    counting_alloc_count = 0;
+    if (aws_cryptosdk_session_reset(s, mode)) return SIZE_MAX;
+    if (mode == AWS_CRYPTOSDK_ENCRYPT && aws_cryptosdk_session_set_message_size(s, in_len)) return SIZE_MAX;
+    if (aws_cryptosdk_session_process(s, out, out_len, out_written, in, in_len, &in_read)) return SIZE_MAX;
+    if (!aws_cryptosdk_session_is_done(s) || in_read != in_len) return SIZE_MAX;
+
+    return counting_alloc_count;
+}
+
+int test_reset_reuses_allocations() {
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(aws_default_allocator(), kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(&counting_alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+
+    uint8_t pt[100] = { 0 }, ct[1024], pt_out[100];
+    size_t ct_len, pt_len;
+    size_t enc_allocs[3], dec_allocs[3];
+
+    for (int i = 0; i < 3; i++) {
+        enc_allocs[i] = count_message_allocs(s, AWS_CRYPTOSDK_ENCRYPT, ct, sizeof(ct), &ct_len, pt, sizeof(pt));
+        TEST_ASSERT(enc_allocs[i] != SIZE_MAX);
+    }
+    for (int i = 0; i < 3; i++) {
+        dec_allocs[i] = count_message_allocs(s, AWS_CRYPTOSDK_DECRYPT, pt_out, sizeof(pt_out), &pt_len, ct, ct_len);
+        TEST_ASSERT(dec_allocs[i] != SIZE_MAX);
+        TEST_ASSERT_INT_EQ(pt_len, sizeof(pt));
+    }
+
+    /*
+     * Later messages reuse the header buffers and materials kept by the first, and settle into a
+     * steady state. Decryption reuses the buffers left by encryption, since the header is the same
+     * size, but needs its own materials once.
+     */
+    TEST_ASSERT(enc_allocs[1] < enc_allocs[0]);
+    TEST_ASSERT_INT_EQ(enc_allocs[1], enc_allocs[2]);
+    TEST_ASSERT(dec_allocs[1] < dec_allocs[0]);
+    TEST_ASSERT_INT_EQ(dec_allocs[1], dec_allocs[2]);
+
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+int test_borrow_header() {
+    AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "namespace");
+    AWS_STATIC_STRING_FROM_LITERAL(key_name, "borrowed");
+    static const uint8_t wrapping_key[32] = { 1 };
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_raw_aes_keyring_new(
+        aws_default_allocator(), key_namespace, key_name, wrapping_key, AWS_CRYPTOSDK_AES256);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(aws_default_allocator(), kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384));
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(&counting_alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+
+    uint8_t pt[100] = { 0 }, ct[2048], pt_out[100];
+    size_t ct_len, pt_len, ct_read;
+
+    TEST_ASSERT(count_message_allocs(s, AWS_CRYPTOSDK_ENCRYPT, ct, sizeof(ct), &ct_len, pt, sizeof(pt)) != SIZE_MAX);
+
+    // Warm up the buffers kept across resets, then compare steady-state decrypts
+    size_t copied_allocs = 0, borrowed_allocs = 0;
+    for (int i = 0; i < 2; i++) {
+        copied_allocs = count_message_allocs(s, AWS_CRYPTOSDK_DECRYPT, pt_out, sizeof(pt_out), &pt_len, ct, ct_len);
+        TEST_ASSERT(copied_allocs != SIZE_MAX);
+    }
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_borrow_header(s, true));
+    for (int i = 0; i < 2; i++) {
+        borrowed_allocs = count_message_allocs(s, AWS_CRYPTOSDK_DECRYPT, pt_out, sizeof(pt_out), &pt_len, ct, ct_len);
+        TEST_ASSERT(borrowed_allocs != SIZE_MAX);
+        TEST_ASSERT_INT_EQ(pt_len, sizeof(pt));
+        TEST_ASSERT(!memcmp(pt, pt_out, sizeof(pt)));
+    }
+
+    // The EDK's provider ID, provider info and ciphertext are no longer copied into their packed allocation
+    TEST_ASSERT(borrowed_allocs + 1 <= copied_allocs);
+
+    // A header split across calls is reparsed from the buffer which completes it
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, pt_out, sizeof(pt_out), &pt_len, ct, 50, &ct_read));
+    TEST_ASSERT_INT_EQ(ct_read, 0);
+    TEST_ASSERT(!aws_cryptosdk_session_is_done(s));
+
+    size_t out_needed, in_needed;
+    aws_cryptosdk_session_estimate_buf(s, &out_needed, &in_needed);
+    TEST_ASSERT(in_needed > 50);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, pt_out, sizeof(pt_out), &pt_len, ct, ct_len, &ct_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    TEST_ASSERT_INT_EQ(ct_read, ct_len);
+    TEST_ASSERT_INT_EQ(pt_len, sizeof(pt));
+    TEST_ASSERT(!memcmp(pt, pt_out, sizeof(pt)));
+
+    // The setting can only be changed before processing starts
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_borrow_header(s, false));
+
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+static struct aws_cryptosdk_keyring *peek_inner;
+static const struct aws_array_list *peeked_edks;
+static struct aws_array_list peeked_list;
+
+static void peek_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
+    (void)kr;
+}
+
+static int peek_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    (void)kr;
+    peeked_edks = edks;
+    peeked_list = *edks;
+    return aws_cryptosdk_keyring_on_decrypt(
+        peek_inner, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+}
+
+static const struct aws_cryptosdk_keyring_vt peek_keyring_vt = { .vt_size    = sizeof(struct aws_cryptosdk_keyring_vt),
+                                                                 .name       = "peek keyring",
+                                                                 .destroy    = peek_keyring_destroy,
+                                                                 .on_decrypt = peek_keyring_on_decrypt };
+
+int test_dec_request_borrows_header_edks() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_keyring peek_kr;
+
+    aws_cryptosdk_keyring_base_init(&peek_kr, &peek_keyring_vt);
+    peek_inner = aws_cryptosdk_zero_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(peek_inner);
+
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(alloc, peek_inner);
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    aws_cryptosdk_cmm_release(cmm);
+
+    uint8_t pt[100] = { 0 }, ct[1024], pt_out[100];
+    size_t ct_len, pt_len, in_read;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct, sizeof(ct), &ct_len, pt, sizeof(pt), &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    aws_cryptosdk_session_destroy(s);
+
+    cmm = aws_cryptosdk_default_cmm_new(alloc, &peek_kr);
+    s   = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    aws_cryptosdk_cmm_release(cmm);
+
+    peeked_edks = NULL;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, pt_out, sizeof(pt_out), &pt_len, ct, ct_len, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    TEST_ASSERT_INT_EQ(pt_len, sizeof(pt));
+
+    // The keyring saw a fixed-size view over the header's own EDK storage, rather than a copy
+    TEST_ASSERT_ADDR_EQ(peeked_edks, &s->dec_request.encrypted_data_keys);
+    TEST_ASSERT_ADDR_NULL(peeked_list.alloc);
+    TEST_ASSERT_ADDR_EQ(peeked_list.data, s->header.edk_list.data);
+    TEST_ASSERT_INT_EQ(peeked_list.length, aws_array_list_length(&s->header.edk_list));
+
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_keyring_release(peek_inner);
+
+    return 0;
+}
+
+int test_message_arena() {
+    AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "namespace");
+    AWS_STATIC_STRING_FROM_LITERAL(key_name, "arena");
+    static const uint8_t wrapping_key[32] = { 2 };
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_raw_aes_keyring_new(
+        aws_default_allocator(), key_namespace, key_name, wrapping_key, AWS_CRYPTOSDK_AES256);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(aws_default_allocator(), kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384));
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(&counting_alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+
+    uint8_t pt[100] = { 0 }, ct[2048], pt_out[100];
+    size_t ct_len, pt_len;
+    size_t enc_allocs[2], dec_allocs[2], enc_arena_allocs[3], dec_arena_allocs[3];
+
+    // Steady-state allocations for messages that do not use the arena
+    for (int i = 0; i < 2; i++) {
+        enc_allocs[i] = count_message_allocs(s, AWS_CRYPTOSDK_ENCRYPT, ct, sizeof(ct), &ct_len, pt, sizeof(pt));
+        TEST_ASSERT(enc_allocs[i] != SIZE_MAX);
+    }
+    for (int i = 0; i < 2; i++) {
+        dec_allocs[i] = count_message_allocs(s, AWS_CRYPTOSDK_DECRYPT, pt_out, sizeof(pt_out), &pt_len, ct, ct_len);
+        TEST_ASSERT(dec_allocs[i] != SIZE_MAX);
+    }
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_arena(s, true));
+    for (int i = 0; i < 3; i++) {
+        enc_arena_allocs[i] = count_message_allocs(s, AWS_CRYPTOSDK_ENCRYPT, ct, sizeof(ct), &ct_len, pt, sizeof(pt));
+        TEST_ASSERT(enc_arena_allocs[i] != SIZE_MAX);
+    }
+    for (int i = 0; i < 3; i++) {
+        dec_arena_allocs[i] =
+            count_message_allocs(s, AWS_CRYPTOSDK_DECRYPT, pt_out, sizeof(pt_out), &pt_len, ct, ct_len);
+        TEST_ASSERT(dec_arena_allocs[i] != SIZE_MAX);
+        TEST_ASSERT_INT_EQ(pt_len, sizeof(pt));
+        TEST_ASSERT(!memcmp(pt, pt_out, sizeof(pt)));
+    }
+
+    // Message-scoped objects stay usable until the session is reset
+    const struct aws_hash_table *enc_ctx = aws_cryptosdk_session_get_enc_ctx_ptr(s);
+    TEST_ASSERT_ADDR_NOT_NULL(enc_ctx);
+    TEST_ASSERT_INT_EQ(aws_hash_table_get_entry_count(enc_ctx), 1);
+    const struct aws_array_list *trace = aws_cryptosdk_session_get_keyring_trace_ptr(s);
+    TEST_ASSERT_ADDR_NOT_NULL(trace);
+    TEST_ASSERT_SUCCESS(assert_keyring_trace_record(
+        trace,
+        0,
+        "namespace",
+        "arena",
+        AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX));
+
+    /*
+     * Once the arena has grown to fit a message, the EDKs, encryption context entries, trace
+     * records and data keys no longer reach the session's allocator. Without the arena, the
+     * session already reuses the materials themselves.
+     */
+    TEST_ASSERT_INT_EQ(enc_arena_allocs[1], enc_arena_allocs[2]);
+    TEST_ASSERT_INT_EQ(dec_arena_allocs[1], dec_arena_allocs[2]);
+    TEST_ASSERT(enc_arena_allocs[2] + 5 <= enc_allocs[1]);
+    TEST_ASSERT(dec_arena_allocs[2] + 4 <= dec_allocs[1]);
+
+    // The setting can only be changed before processing starts
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_message_arena(s, false));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_arena(s, false));
+    TEST_ASSERT(
+        count_message_allocs(s, AWS_CRYPTOSDK_DECRYPT, pt_out, sizeof(pt_out), &pt_len, ct, ct_len) != SIZE_MAX);
+
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+static int random_access_once(enum aws_cryptosdk_alg_id alg_id) {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+
+    uint8_t pt[1050], ct[2048], out[1050];
+    size_t ct_len, out_len, in_read;
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(s, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct, sizeof(ct), &ct_len, pt, sizeof(pt), &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+
+    // Not available before the header has been processed
+    uint64_t offset;
+    size_t max_len;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_get_frame_range(s, 1, &offset, &max_len));
+
+    // With no output space, processing stops after the header
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, out, 0, &out_len, ct, ct_len, &in_read));
+    size_t header_len = in_read;
+
+    if (aws_cryptosdk_alg_props(alg_id)->signature_len) {
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_get_frame_range(s, 1, &offset, &max_len));
+        goto out;
+    }
+
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_session_get_frame_range(s, 0, &offset, &max_len));
+
+    // Ten full frames and a final frame holding the last 50 bytes, visited out of order
+    static const uint64_t seqnos[] = { 11, 1, 7, 2, 10 };
+    for (size_t i = 0; i < sizeof(seqnos) / sizeof(seqnos[0]); i++) {
+        uint64_t seqno = seqnos[i];
+        size_t pt_len  = seqno == 11 ? 50 : 100;
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_frame_range(s, seqno, &offset, &max_len));
+        TEST_ASSERT(offset >= header_len && offset < ct_len);
+        if (offset + max_len > ct_len) max_len = ct_len - (size_t)offset;
+
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_session_decrypt_frame_at(s, seqno, out, sizeof(out), &out_len, ct + offset, max_len));
+        TEST_ASSERT_INT_EQ(out_len, pt_len);
+        TEST_ASSERT(!memcmp(out, pt + (seqno - 1) * 100, pt_len));
+    }
+
+    // A frame presented as another, a truncated frame and a corrupt frame are all rejected
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_frame_range(s, 3, &offset, &max_len));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_decrypt_frame_at(s, 4, out, sizeof(out), &out_len, ct + offset, max_len));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_SHORT_BUFFER,
+        aws_cryptosdk_session_decrypt_frame_at(s, 3, out, sizeof(out), &out_len, ct + offset, 20));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_SHORT_BUFFER, aws_cryptosdk_session_decrypt_frame_at(s, 3, out, 99, &out_len, ct + offset, max_len));
+
+    ct[offset + 30] ^= 1;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_decrypt_frame_at(s, 3, out, sizeof(out), &out_len, ct + offset, max_len));
+    TEST_ASSERT_INT_EQ(out_len, 0);
+    ct[offset + 30] ^= 1;
+
+    // Sequential decryption carries on from where it was
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(s, out, sizeof(out), &out_len, ct + header_len, ct_len - header_len, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    TEST_ASSERT_INT_EQ(out_len, sizeof(pt));
+    TEST_ASSERT(!memcmp(out, pt, sizeof(pt)));
+
+out:
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+int test_random_access() {
+    if (random_access_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256)) return 1;
+    if (random_access_once(ALG_AES128_GCM_IV12_TAG16_NO_KDF)) return 1;
+    if (random_access_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384)) return 1;
+
+    return 0;
+}
+
+static int frame_sizes_once(enum aws_cryptosdk_alg_id alg_id) {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+
+    uint8_t pt[1050], ct[2048], out[1050];
+    size_t ct_len, out_len, in_read;
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(s, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct, sizeof(ct), &ct_len, pt, sizeof(pt), &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+
+    // Encrypt sessions report the layout they wrote; decrypt sessions need the header first
+    size_t frame_len, final_max_len, frame_pt_len, enc_frame_len;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_frame_sizes(s, &enc_frame_len, &final_max_len, &frame_pt_len));
+    TEST_ASSERT_INT_EQ(frame_pt_len, 100);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE,
+        aws_cryptosdk_session_get_frame_sizes(s, &frame_len, &final_max_len, &frame_pt_len));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, out, 0, &out_len, ct, ct_len, &in_read));
+    size_t pos = in_read;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_frame_sizes(s, &frame_len, &final_max_len, &frame_pt_len));
+    TEST_ASSERT_INT_EQ(frame_pt_len, 100);
+    TEST_ASSERT_INT_EQ(frame_len, enc_frame_len);
+    TEST_ASSERT(frame_len > frame_pt_len && final_max_len > frame_len);
+
+    // Reads of exactly one frame each are consumed whole, and fill exactly-sized output buffers
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_session_process(s, out + i * 100, frame_pt_len, &out_len, ct + pos, frame_len, &in_read));
+        TEST_ASSERT_INT_EQ(in_read, frame_len);
+        TEST_ASSERT_INT_EQ(out_len, frame_pt_len);
+        pos += in_read;
+    }
+
+    // The final frame fits in the bound reported for it, and is followed only by the trailer
+    if (!aws_cryptosdk_alg_props(alg_id)->signature_len) TEST_ASSERT(ct_len - pos <= final_max_len);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(s, out + 1000, frame_pt_len, &out_len, ct + pos, ct_len - pos, &in_read));
+    TEST_ASSERT_INT_EQ(out_len, 50);
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    TEST_ASSERT(!memcmp(out, pt, sizeof(pt)));
+
+    // Still available once the message is done
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_frame_sizes(s, &frame_len, &final_max_len, &frame_pt_len));
+
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+int test_frame_sizes() {
+    if (frame_sizes_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256)) return 1;
+    if (frame_sizes_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384)) return 1;
+
+    return 0;
+}
+
+static int frame_index_once(enum aws_cryptosdk_alg_id alg_id, size_t worker_threads) {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+
+    uint8_t pt[1050], ct[2048], out[1050];
+    size_t ct_len, out_len, in_read;
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+
+    struct aws_byte_buf index, other_index;
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&index, alloc, 1));
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&other_index, alloc, 1));
+
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+
+    // An index for some other message, to check that indexes are matched to their messages
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_index(s, &other_index));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(s, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct, sizeof(ct), &ct_len, pt, sizeof(pt), &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+
+    // The index applies to one message only
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_ENCRYPT));
+    size_t other_len = other_index.len;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(s, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct, sizeof(ct), &ct_len, pt, sizeof(pt), &in_read));
+    TEST_ASSERT_INT_EQ(other_index.len, other_len);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(s, worker_threads));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_index(s, &index));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(s, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct, sizeof(ct), &ct_len, pt, sizeof(pt), &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_frame_index(s, &index));
+
+    // Ten full frames and a final frame holding the last 50 bytes
+    struct aws_byte_cursor index_cur = aws_byte_cursor_from_buf(&index);
+    uint64_t num_frames, offset, next_offset = 0;
+    size_t len;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_frame_index_get_frame_count(index_cur, &num_frames));
+    TEST_ASSERT_INT_EQ(num_frames, 11);
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_frame_index_lookup(index_cur, 12, &offset, &len));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, out, 0, &out_len, ct, ct_len, &in_read));
+    size_t header_len = in_read;
+
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_use_frame_index(s, other_index.buffer, other_index.len));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_session_use_frame_index(s, index.buffer, index.len - 1));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_use_frame_index(s, index.buffer, index.len));
+
+    // The frames tile the body exactly, and each can be decrypted from just its own range
+    for (uint64_t seqno = 1; seqno <= num_frames; seqno++) {
+        size_t pt_len = seqno == 11 ? 50 : 100;
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_frame_range(s, seqno, &offset, &len));
+        TEST_ASSERT_INT_EQ(offset, seqno == 1 ? header_len : next_offset);
+        next_offset = offset + len;
+
+        uint64_t index_offset;
+        size_t index_len;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_frame_index_lookup(index_cur, seqno, &index_offset, &index_len));
+        TEST_ASSERT_INT_EQ(index_offset, offset);
+        TEST_ASSERT_INT_EQ(index_len, len);
+
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_session_decrypt_frame_at(s, seqno, out, sizeof(out), &out_len, ct + offset, len));
+        TEST_ASSERT_INT_EQ(out_len, pt_len);
+        TEST_ASSERT(!memcmp(out, pt + (seqno - 1) * 100, pt_len));
+    }
+    TEST_ASSERT(next_offset <= ct_len);
+
+    // A frame whose tag differs from the index is rejected, even if it would authenticate
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_frame_range(s, 5, &offset, &len));
+    index.buffer[AWS_CRYPTOSDK_FRAME_INDEX_PREFIX_LEN + 5 * AWS_CRYPTOSDK_FRAME_INDEX_RECORD_LEN - 1] ^= 1;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_decrypt_frame_at(s, 5, out, sizeof(out), &out_len, ct + offset, len));
+    index.buffer[AWS_CRYPTOSDK_FRAME_INDEX_PREFIX_LEN + 5 * AWS_CRYPTOSDK_FRAME_INDEX_RECORD_LEN - 1] ^= 1;
+
+    // Sequential decryption, signature and all, is unaffected
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(s, out, sizeof(out), &out_len, ct + header_len, ct_len - header_len, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    TEST_ASSERT_INT_EQ(out_len, sizeof(pt));
+    TEST_ASSERT(!memcmp(out, pt, sizeof(pt)));
+
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    aws_byte_buf_clean_up(&index);
+    aws_byte_buf_clean_up(&other_index);
+
+    return 0;
+}
+
+int test_frame_index() {
+    if (frame_index_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 1)) return 1;
+    if (frame_index_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 4)) return 1;
+
+    return 0;
+}
+
+static int encrypt_frames_at_once(enum aws_cryptosdk_alg_id alg_id) {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+
+    uint8_t pt[1050], ct[2048], out[1050];
+    size_t header_len, ct_len, out_len, in_read, written;
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(s, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+
+    // Not before the header has been generated
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE,
+        aws_cryptosdk_session_encrypt_frames_at(s, 1, ct, sizeof(ct), &written, pt, sizeof(pt)));
+
+    // Generate the header without room for it, then collect it
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct, 0, &ct_len, pt, 0, &in_read));
+    aws_cryptosdk_session_estimate_buf(s, &header_len, NULL);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct, header_len, &ct_len, pt, 0, &in_read));
+    TEST_ASSERT_INT_EQ(ct_len, header_len);
+
+    if (aws_cryptosdk_alg_props(alg_id)->signature_len) {
+        TEST_ASSERT_ERROR(
+            AWS_ERROR_UNSUPPORTED_OPERATION,
+            aws_cryptosdk_session_encrypt_frames_at(s, 1, ct, sizeof(ct), &written, pt, sizeof(pt)));
+        goto out;
+    }
+
+    size_t frame_len, final_max_len, frame_pt_len;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_frame_sizes(s, &frame_len, &final_max_len, &frame_pt_len));
+    TEST_ASSERT_INT_EQ(frame_pt_len, 100);
+
+    // Ranges must start on a frame, and end on one or at the end of the message
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_session_encrypt_frames_at(s, 0, ct + header_len, frame_len, &written, pt, 100));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_session_encrypt_frames_at(s, 1, ct + header_len, 2 * frame_len, &written, pt, 150));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_session_encrypt_frames_at(s, 11, ct + header_len, final_max_len, &written, pt + 1000, 100));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_SHORT_BUFFER,
+        aws_cryptosdk_session_encrypt_frames_at(s, 1, ct + header_len, 2 * frame_len - 1, &written, pt, 200));
+
+    // The tail of the message first, then the frames before it
+    uint8_t *body = ct + header_len;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_encrypt_frames_at(
+        s, 7, body + 6 * frame_len, sizeof(ct) - header_len - 6 * frame_len, &written, pt + 600, 450));
+    TEST_ASSERT(written > 4 * frame_len && written <= 4 * frame_len + final_max_len);
+    ct_len = header_len + 6 * frame_len + written;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_encrypt_frames_at(s, 1, body, 6 * frame_len, &written, pt, 600));
+    TEST_ASSERT_INT_EQ(written, 6 * frame_len);
+
+    // The session itself has not moved on
+    TEST_ASSERT(!aws_cryptosdk_session_is_done(s));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE,
+        aws_cryptosdk_session_encrypt_frames_at(s, 1, body, 6 * frame_len, &written, pt, 600));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, out, sizeof(out), &out_len, ct, ct_len, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    TEST_ASSERT_INT_EQ(in_read, ct_len);
+    TEST_ASSERT_INT_EQ(out_len, sizeof(pt));
+    TEST_ASSERT(!memcmp(out, pt, sizeof(pt)));
+
+out:
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+int test_encrypt_frames_at() {
+    if (encrypt_frames_at_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256)) return 1;
+    if (encrypt_frames_at_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384)) return 1;
+
+    return 0;
+}
+
+int test_decrypt_frames_at() {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+
+    uint8_t pt[1050], ct[2048], out[1050];
+    size_t ct_len, out_len, in_read;
+    bool final_frame;
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(s, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct, sizeof(ct), &ct_len, pt, sizeof(pt), &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE,
+        aws_cryptosdk_session_decrypt_frames_at(
+            s, 1, out, sizeof(out), &out_len, ct, ct_len, &in_read, &final_frame));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, out, 0, &out_len, ct, ct_len, &in_read));
+
+    uint64_t body;
+    size_t frame_len, final_max_len, frame_pt_len;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_frame_range(s, 1, &body, &final_max_len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_frame_sizes(s, &frame_len, &final_max_len, &frame_pt_len));
+
+    // The tail of the message first, up to and including the final frame
+    size_t tail = (size_t)body + 6 * frame_len;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_decrypt_frames_at(
+        s, 7, out + 600, sizeof(out) - 600, &out_len, ct + tail, ct_len - tail, &in_read, &final_frame));
+    TEST_ASSERT(final_frame);
+    TEST_ASSERT_INT_EQ(in_read, ct_len - tail);
+    TEST_ASSERT_INT_EQ(out_len, 450);
+
+    // Then the frames before it, which do not end the message
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_decrypt_frames_at(
+        s, 1, out, 600, &out_len, ct + body, 6 * frame_len, &in_read, &final_frame));
+    TEST_ASSERT(!final_frame);
+    TEST_ASSERT_INT_EQ(in_read, 6 * frame_len);
+    TEST_ASSERT_INT_EQ(out_len, 600);
+    TEST_ASSERT(!memcmp(out, pt, sizeof(pt)));
+
+    // Decryption stops at the first frame which is incomplete or does not fit
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_decrypt_frames_at(
+        s, 1, out, 600, &out_len, ct + body, 2 * frame_len - 1, &in_read, &final_frame));
+    TEST_ASSERT_INT_EQ(in_read, frame_len);
+    TEST_ASSERT_INT_EQ(out_len, 100);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_decrypt_frames_at(
+        s, 1, out, 250, &out_len, ct + body, 6 * frame_len, &in_read, &final_frame));
+    TEST_ASSERT_INT_EQ(in_read, 2 * frame_len);
+    TEST_ASSERT_INT_EQ(out_len, 200);
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_SHORT_BUFFER,
+        aws_cryptosdk_session_decrypt_frames_at(
+            s, 1, out, 99, &out_len, ct + body, 6 * frame_len, &in_read, &final_frame));
+
+    // Frames out of sequence, or tampered with, fail and zero the output
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_decrypt_frames_at(
+            s, 2, out, 600, &out_len, ct + body, 6 * frame_len, &in_read, &final_frame));
+    ct[body + 3 * frame_len - 1] ^= 1;
+    memcpy(out, pt, 600);
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_decrypt_frames_at(
+            s, 1, out, 600, &out_len, ct + body, 6 * frame_len, &in_read, &final_frame));
+    TEST_ASSERT(!final_frame);
+    for (size_t i = 0; i < 600; i++) TEST_ASSERT_INT_EQ(out[i], 0);
+
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
+int test_different_keyring_cant_decrypt() {
+    init_bufs(1 /*1024*/);
+
+    size_t ct_consumed, pt_consumed;
+    struct aws_cryptosdk_keyring *counting_kr = aws_cryptosdk_counting_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(counting_kr);
+    create_session(AWS_CRYPTOSDK_ENCRYPT, counting_kr);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+
+    if (pump_ciphertext(2048, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    struct aws_cryptosdk_keyring *zero_kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(zero_kr);
+    create_session(AWS_CRYPTOSDK_DECRYPT, zero_kr);
+    hexdump(stderr, ct_buf, ct_size);
+
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT,
+        aws_cryptosdk_session_process(session, pt_buf, pt_size, &pt_consumed, ct_buf, ct_size, &ct_consumed));
+
+    free_bufs();
+
+    return 0;
+}
+
+int test_changed_keyring_can_decrypt() {
+    init_bufs(1 /*1024*/);
+
+    size_t ct_consumed, pt_consumed;
+    struct aws_cryptosdk_keyring *counting_kr = aws_cryptosdk_counting_keyring_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(counting_kr);
+    create_session(AWS_CRYPTOSDK_ENCRYPT, counting_kr);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+
+    if (pump_ciphertext(2048, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    if (check_ciphertext_and_trace(false)) return 1;
+
+    free_bufs();
+
+    return 0;
+}
+
+// This helper sub-test sets the CMM to use a particular algorithm ID, verifies
+// that we can encrypt and decrypt using that algorithm, and checks that that
+// algorithm was in fact used (as reported by both encrypt and decrypt sessions).
+static int test_algorithm_override_once(enum aws_cryptosdk_alg_id alg_id) {
+    init_bufs(1);
+
+    size_t ct_consumed, pt_consumed;
+    enum aws_cryptosdk_alg_id reported_alg_id;
+    struct aws_cryptosdk_cmm *cmm =
+        create_session_with_cmm(AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_counting_keyring_new(aws_default_allocator()));
+    aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+
+    if (pump_ciphertext(2048, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_alg_id(session, &reported_alg_id));
+    TEST_ASSERT_INT_EQ(alg_id, reported_alg_id);
+
+    if (check_ciphertext_and_trace(false)) return 1;
+
+    // Session is now configured for decrypt and should report decryption-side ID
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_alg_id(session, &reported_alg_id));
+    TEST_ASSERT_INT_EQ(alg_id, reported_alg_id);
+
+    aws_cryptosdk_cmm_release(cmm);
+    free_bufs();
+
+    return 0;
+}
+
+int test_algorithm_override() {
+    return test_algorithm_override_once(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256) ||
+           test_algorithm_override_once(ALG_AES192_GCM_IV12_TAG16_NO_KDF) ||
+           test_algorithm_override_once(ALG_AES256_GCM_IV12_TAG16_NO_KDF) ||
+           test_algorithm_override_once(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256_ECDSA_P256) ||
+           test_algorithm_override_once(ALG_AES192_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384) ||
+           test_algorithm_override_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384) ||
+           test_algorithm_override_once(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256) ||
+           test_algorithm_override_once(ALG_AES192_GCM_IV12_TAG16_HKDF_SHA256) ||
+           test_algorithm_override_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256);
+}
+
+int test_null_estimates() {
+    create_session(AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_counting_keyring_new(aws_default_allocator()));
+
+    aws_cryptosdk_session_estimate_buf(session, NULL, NULL);
+
+    free_bufs();
+
+    return 0;
+}
+
+/* Allocates a new output buffer and places its address at *output_buf */
+static int process_loop(
+    struct aws_allocator *alloc,
+    uint8_t **output_buf,
+    size_t *output_len,
+    const uint8_t *const input_buf,
+    const size_t input_len) {
+    size_t total_input_read = 0;
+    size_t input_window     = 1;
+
+    /* how much memory is allocated to output buffer, not the same as length of output */
+    size_t output_size          = 1;
+    *output_buf                 = aws_mem_acquire(alloc, output_size);
+    size_t total_output_written = 0;
+    size_t output_needed        = 1;
+
+    /* The entire input is already in the input buffer and we just expand the window into it as needed.
+     * The entire output will eventually be put into a single buffer. This is not a realistic streaming
+     * use case as we cannot handle more data than fits in memory, but it keeps things simple for testing.
+     */
+    while (1) {
+        size_t input_read, output_written;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+            session,
+            *output_buf + total_output_written,
+            output_size - total_output_written,
+            &output_written,
+            input_buf + total_input_read,
+            input_window,
+            &input_read));
+
+        total_output_written += output_written;
+        total_input_read += input_read;
+
+        if (aws_cryptosdk_session_is_done(session)) break;
+
+        aws_cryptosdk_session_estimate_buf(session, &output_needed, &input_window);
+        if (input_window > input_len - total_input_read) {
+            /* There are some scenarios where our input estimates are larger than needed.
+             * If that happens, we shrink the input window to the rest of the buffer.
+             */
+            input_window = input_len - total_input_read;
+        }
+
+        size_t output_size_needed = output_needed + total_output_written;
+        if (output_size < output_size_needed) {
+            TEST_ASSERT_SUCCESS(aws_mem_realloc(alloc, (void **)output_buf, output_size, output_size_needed));
+            output_size = output_size_needed;
+        }
+    }
+    *output_len = total_output_written;
+    return 0;
+}
+
+/* We test that, with both input and output buffers set to a minimum size to start and always
+ * following the buffer estimates provided, we will successfully do both encryption and decryption.
+ * We do this for the default frame size, unframed data, and a variety of other frame sizes,
+ * with messages that are a bit more, a bit less, and exactly at a 2 frame length.
+ */
+int test_using_estimates() {
+    struct aws_allocator *alloc = aws_default_allocator();
+
+    // first one we won't set frame size (uses default), last one for unframed data
+    uint32_t frame_sizes[] = { 0, 1536, 1537, 1538, 1539, 1540, 0 };
+    for (size_t frame_idx = 0; frame_idx < sizeof(frame_sizes) / sizeof(uint32_t); ++frame_idx) {
+        for (size_t plaintext_len = 2 * 1530; plaintext_len < 2 * 1545; plaintext_len++) {
+            struct aws_cryptosdk_keyring *keyring = aws_cryptosdk_counting_keyring_new(alloc);
+            create_session(AWS_CRYPTOSDK_ENCRYPT, keyring);
+
+            if (frame_idx) {
+                TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, frame_sizes[frame_idx]));
+            }
+
+            uint8_t *plaintext_buf = aws_mem_acquire(alloc, plaintext_len);
+            TEST_ASSERT_ADDR_NOT_NULL(plaintext_buf);
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_genrandom(plaintext_buf, plaintext_len));
+
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, plaintext_len));
+
+            uint8_t *ciphertext_buf;
+            size_t ciphertext_len;
+            TEST_ASSERT_SUCCESS(process_loop(alloc, &ciphertext_buf, &ciphertext_len, plaintext_buf, plaintext_len));
+
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+
+            uint8_t *decrypted_plaintext_buf;
+            size_t decrypted_plaintext_len;
+            TEST_ASSERT_SUCCESS(process_loop(
+                alloc, &decrypted_plaintext_buf, &decrypted_plaintext_len, ciphertext_buf, ciphertext_len));
+
+            TEST_ASSERT_INT_EQ(plaintext_len, decrypted_plaintext_len);
+            TEST_ASSERT(!memcmp(plaintext_buf, decrypted_plaintext_buf, plaintext_len));
+
+            free_bufs();
+            aws_mem_release(alloc, plaintext_buf);
+            aws_mem_release(alloc, ciphertext_buf);
+            aws_mem_release(alloc, decrypted_plaintext_buf);
+        }
+    }
+    return 0;
+}
+
+static int one_shot_roundtrip_once(enum aws_cryptosdk_alg_id alg_id, size_t pt_len) {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+
+    struct aws_hash_table enc_ctx, enc_ctx_out;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx_out));
+    TEST_ASSERT_SUCCESS(test_enc_ctx_fill(&enc_ctx));
+
+    init_bufs(pt_len);
+    size_t needed = 0, written = 0, pt_written = 0, ct_consumed, pt_consumed;
+
+    /* Too small an output buffer reports the exact size required */
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_SHORT_BUFFER,
+        aws_cryptosdk_encrypt_buffer(alloc, cmm, &enc_ctx, ct_buf, 16, &needed, pt_buf, pt_size));
+    TEST_ASSERT(needed > pt_size);
+
+    grow_buf(&ct_buf, &ct_buf_size, needed);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_buffer(alloc, cmm, &enc_ctx, ct_buf, needed, &written, pt_buf, pt_size));
+    TEST_ASSERT_INT_EQ(written, needed);
+    ct_size = written;
+
+    /* The one-shot ciphertext decrypts with a streaming session */
+    uint8_t *pt_check = aws_mem_acquire(alloc, pt_size + 1);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check);
+    struct aws_cryptosdk_session *dec = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(dec);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(dec, pt_check, pt_size + 1, &pt_consumed, ct_buf, ct_size, &ct_consumed));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(dec));
+    TEST_ASSERT_INT_EQ(pt_consumed, pt_size);
+    TEST_ASSERT(!memcmp(pt_check, pt_buf, pt_size));
+    aws_cryptosdk_session_destroy(dec);
+
+    /* And with the one-shot API, after reporting the plaintext size */
+    memset(pt_check, 0, pt_size + 1);
+    if (pt_size) {
+        TEST_ASSERT_ERROR(
+            AWS_ERROR_SHORT_BUFFER,
+            aws_cryptosdk_decrypt_buffer(alloc, cmm, NULL, pt_check, pt_size - 1, &needed, ct_buf, ct_size));
+        TEST_ASSERT_INT_EQ(needed, pt_size);
+    }
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_decrypt_buffer(alloc, cmm, &enc_ctx_out, pt_check, pt_size + 1, &pt_written, ct_buf, ct_size));
+    TEST_ASSERT_INT_EQ(pt_written, pt_size);
+    TEST_ASSERT(!memcmp(pt_check, pt_buf, pt_size));
+    TEST_ASSERT_SUCCESS(assert_enc_ctx_fill(&enc_ctx_out));
+
+    /* Trailing data after the message is rejected */
+    grow_buf(&ct_buf, &ct_buf_size, ct_size + 1);
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_decrypt_buffer(alloc, cmm, NULL, pt_check, pt_size + 1, &pt_written, ct_buf, ct_size + 1));
+
+    /* A corrupted final byte fails, with the output zeroed */
+    ct_buf[ct_size - 1] ^= 1;
+    memset(pt_check, 0xAA, pt_size + 1);
+    TEST_ASSERT_INT_EQ(
+        AWS_OP_ERR,
+        aws_cryptosdk_decrypt_buffer(alloc, cmm, NULL, pt_check, pt_size + 1, &pt_written, ct_buf, ct_size));
+    TEST_ASSERT_INT_EQ(pt_written, 0);
+    for (size_t i = 0; i < pt_size + 1; i++) {
+        TEST_ASSERT_INT_EQ(pt_check[i], 0);
+    }
+
+    aws_mem_release(alloc, pt_check);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx_out);
+    aws_cryptosdk_cmm_release(cmm);
+    // No streaming session to destroy here, so don't use free_bufs
+    aws_mem_release(alloc, pt_buf);
+    aws_mem_release(alloc, ct_buf);
+    pt_buf = ct_buf = NULL;
+
+    return 0;
+}
+
+/* Streaming ciphertext, including a multi-frame message, decrypts with the one-shot API */
+static int one_shot_decrypt_streamed() {
+    init_bufs(10000);
+    size_t ct_consumed, pt_consumed, written;
+
+    struct aws_cryptosdk_cmm *cmm =
+        create_session_with_cmm(AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_zero_keyring_new(aws_default_allocator()));
+    aws_cryptosdk_session_set_frame_size(session, 1000);
+    aws_cryptosdk_session_set_message_size(session, pt_size);
+    precise_size_set = true;
+    if (pump_ciphertext(20000, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    uint8_t *pt_check = aws_mem_acquire(aws_default_allocator(), pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_buffer(
+        aws_default_allocator(), cmm, NULL, pt_check, pt_size, &written, ct_buf, ct_size));
+    TEST_ASSERT_INT_EQ(written, pt_size);
+    TEST_ASSERT(!memcmp(pt_check, pt_buf, pt_size));
+
+    /* A truncated message is rejected outright */
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_decrypt_buffer(
+            aws_default_allocator(), cmm, NULL, pt_check, pt_size, &written, ct_buf, ct_size - 200));
+
+    aws_mem_release(aws_default_allocator(), pt_check);
+    aws_cryptosdk_cmm_release(cmm);
+    free_bufs();
+
+    return 0;
+}
+
+int test_one_shot() {
+    return one_shot_roundtrip_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 1) ||
+           one_shot_roundtrip_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 100) ||
+           one_shot_roundtrip_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 100) ||
+           one_shot_roundtrip_once(ALG_AES128_GCM_IV12_TAG16_NO_KDF, 5000) || one_shot_decrypt_streamed();
+}
+
+/* Delegates to another CMM, counting the requests for encryption materials, or fails them */
+struct batch_test_cmm {
+    struct aws_cryptosdk_cmm base;
+    struct aws_cryptosdk_cmm *delegate;
+    struct aws_atomic_var calls;
+    bool fail;
+};
+
+static void batch_test_cmm_destroy(struct aws_cryptosdk_cmm *generic_cmm) {
+    (void)generic_cmm;
+}
+
+static int batch_test_cmm_generate_enc_materials(
+    struct aws_cryptosdk_cmm *generic_cmm,
+    struct aws_cryptosdk_enc_materials **output,
+    struct aws_cryptosdk_enc_request *request) {
+    struct batch_test_cmm *self = (struct batch_test_cmm *)generic_cmm;
+
+    aws_atomic_fetch_add(&self->calls, 1);
+    if (self->fail) return aws_raise_error(AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+
+    return aws_cryptosdk_cmm_generate_enc_materials(self->delegate, output, request);
+}
+
+static const struct aws_cryptosdk_cmm_vt batch_test_cmm_vt = {
+    .vt_size                = sizeof(batch_test_cmm_vt),
+    .name                   = "Batch test CMM",
+    .destroy                = batch_test_cmm_destroy,
+    .generate_enc_materials = batch_test_cmm_generate_enc_materials
+};
+
+#define BATCH_MESSAGES 200
+
+static int encrypt_batch_once(struct batch_test_cmm *cmm, size_t num_threads) {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_byte_buf outputs[BATCH_MESSAGES];
+    struct aws_byte_cursor inputs[BATCH_MESSAGES];
+    uint8_t pt[BATCH_MESSAGES], out[BATCH_MESSAGES];
+    struct aws_hash_table enc_ctx, enc_ctx_out;
+    size_t out_len;
+
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+    for (size_t i = 0; i < BATCH_MESSAGES; i++) {
+        // Record i is the first i bytes of pt, so that the first is empty
+        inputs[i] = aws_byte_cursor_from_array(pt, i);
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(test_enc_ctx_fill(&enc_ctx));
+
+    aws_atomic_store_int(&cmm->calls, 0);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_encrypt_batch(alloc, &cmm->base, &enc_ctx, outputs, inputs, BATCH_MESSAGES, num_threads));
+    TEST_ASSERT_INT_EQ(aws_atomic_load_int(&cmm->calls), 1);
+
+    for (size_t i = 0; i < BATCH_MESSAGES; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx_out));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_buffer(
+            alloc, cmm->delegate, &enc_ctx_out, out, sizeof(out), &out_len, outputs[i].buffer, outputs[i].len));
+        TEST_ASSERT_INT_EQ(out_len, i);
+        TEST_ASSERT(!memcmp(out, pt, i));
+        TEST_ASSERT_SUCCESS(assert_enc_ctx_fill(&enc_ctx_out));
+        aws_cryptosdk_enc_ctx_clean_up(&enc_ctx_out);
+    }
+    // Each message has its own message ID, so no two headers are alike
+    TEST_ASSERT(memcmp(outputs[1].buffer, outputs[2].buffer, 40));
+
+    for (size_t i = 0; i < BATCH_MESSAGES; i++) {
+        aws_byte_buf_clean_up(&outputs[i]);
+    }
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    return 0;
+}
+
+int test_encrypt_batch() {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct batch_test_cmm cmm;
+    struct aws_byte_buf outputs[2];
+    struct aws_byte_cursor inputs[2] = { aws_byte_cursor_from_c_str("a"), aws_byte_cursor_from_c_str("b") };
+
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    aws_cryptosdk_cmm_base_init(&cmm.base, &batch_test_cmm_vt);
+    aws_atomic_init_int(&cmm.calls, 0);
+    cmm.fail     = false;
+    cmm.delegate = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm.delegate);
+    aws_cryptosdk_keyring_release(kr);
+
+    // The default algorithm suite signs every message, each with the shared signing key
+    if (encrypt_batch_once(&cmm, 1) || encrypt_batch_once(&cmm, 4)) return 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm.delegate, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    if (encrypt_batch_once(&cmm, 0)) return 1;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_batch(alloc, &cmm.base, NULL, outputs, inputs, 0, 4));
+
+    // On failure, no output is left allocated
+    cmm.fail = true;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_KMS_FAILURE, aws_cryptosdk_encrypt_batch(alloc, &cmm.base, NULL, outputs, inputs, 2, 2));
+    TEST_ASSERT_ADDR_NULL(outputs[0].buffer);
+    TEST_ASSERT_ADDR_NULL(outputs[1].buffer);
+
+    aws_cryptosdk_cmm_release(cmm.delegate);
+
+    return 0;
+}
+
+/* Counts decrypt requests, passing them and the EDK pre-filter on to the delegate */
+struct filter_test_cmm {
+    struct aws_cryptosdk_cmm base;
+    struct aws_cryptosdk_cmm *delegate;
+    int calls;
+};
+
+static void filter_test_cmm_destroy(struct aws_cryptosdk_cmm *generic_cmm) {
+    (void)generic_cmm;
+}
+
+static int filter_test_cmm_decrypt_materials(
+    struct aws_cryptosdk_cmm *generic_cmm,
+    struct aws_cryptosdk_dec_materials **output,
+    struct aws_cryptosdk_dec_request *request) {
+    struct filter_test_cmm *self = (struct filter_test_cmm *)generic_cmm;
+
+    self->calls++;
+    return aws_cryptosdk_cmm_decrypt_materials(self->delegate, output, request);
+}
+
+static bool filter_test_cmm_may_decrypt(
+    const struct aws_cryptosdk_cmm *generic_cmm, const struct aws_array_list *edks) {
+    const struct filter_test_cmm *self = (const struct filter_test_cmm *)generic_cmm;
+    return aws_cryptosdk_cmm_may_decrypt(self->delegate, edks);
+}
+
+static const struct aws_cryptosdk_cmm_vt filter_test_cmm_vt = { .vt_size           = sizeof(filter_test_cmm_vt),
+                                                                .name              = "Filter test CMM",
+                                                                .destroy           = filter_test_cmm_destroy,
+                                                                .decrypt_materials = filter_test_cmm_decrypt_materials,
+                                                                .may_decrypt       = filter_test_cmm_may_decrypt };
+
+int test_edk_prefilter() {
+    AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "namespace");
+    AWS_STATIC_STRING_FROM_LITERAL(key_name, "filtered");
+    static const uint8_t wrapping_key[32] = { 1 };
+    struct aws_allocator *alloc           = aws_default_allocator();
+    uint8_t pt[10] = { 0 }, ct[1024], pt_out[10];
+    size_t ct_len, pt_len;
+    struct filter_test_cmm cmm;
+
+    struct aws_cryptosdk_keyring *zero_kr = aws_cryptosdk_zero_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(zero_kr);
+    struct aws_cryptosdk_keyring *aes_kr =
+        aws_cryptosdk_raw_aes_keyring_new(alloc, key_namespace, key_name, wrapping_key, AWS_CRYPTOSDK_AES256);
+    TEST_ASSERT_ADDR_NOT_NULL(aes_kr);
+    struct aws_cryptosdk_cmm *zero_cmm = aws_cryptosdk_default_cmm_new(alloc, zero_kr);
+    struct aws_cryptosdk_cmm *aes_cmm  = aws_cryptosdk_default_cmm_new(alloc, aes_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(zero_cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(aes_cmm);
+    aws_cryptosdk_keyring_release(zero_kr);
+    aws_cryptosdk_keyring_release(aes_kr);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_buffer(alloc, zero_cmm, NULL, ct, sizeof(ct), &ct_len, pt, sizeof(pt)));
+    aws_cryptosdk_cmm_base_init(&cmm.base, &filter_test_cmm_vt);
+    cmm.calls = 0;
+
+    // The raw AES keyring describes its EDKs, none of which is in the message, so no request is made
+    cmm.delegate = aes_cmm;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT,
+        aws_cryptosdk_decrypt_buffer(alloc, &cmm.base, NULL, pt_out, sizeof(pt_out), &pt_len, ct, ct_len));
+    TEST_ASSERT_INT_EQ(cmm.calls, 0);
+
+    // The zero keyring does not, so it is asked
+    cmm.delegate = zero_cmm;
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_decrypt_buffer(alloc, &cmm.base, NULL, pt_out, sizeof(pt_out), &pt_len, ct, ct_len));
+    TEST_ASSERT_INT_EQ(cmm.calls, 1);
+    TEST_ASSERT_INT_EQ(pt_len, sizeof(pt));
+
+    aws_cryptosdk_cmm_release(zero_cmm);
+    aws_cryptosdk_cmm_release(aes_cmm);
+    return 0;
+}
+
+static int write_test_file(const char *path, const uint8_t *buf, size_t len) {
+    FILE *fp = fopen(path, "wb");
+    TEST_ASSERT_ADDR_NOT_NULL(fp);
+    TEST_ASSERT_INT_EQ(fwrite(buf, 1, len, fp), len);
+    TEST_ASSERT_INT_EQ(fclose(fp), 0);
+
+    return 0;
+}
+
+static long test_file_size(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp || fseek(fp, 0, SEEK_END)) return -1;
+
+    long size = ftell(fp);
+    fclose(fp);
+
+    return size;
+}
+
+static int file_roundtrip_once(struct aws_cryptosdk_cmm *cmm, size_t pt_len) {
+    static const char *pt_path = "t_encrypt_file.pt", *ct_path = "t_encrypt_file.ct", *out_path = "t_encrypt_file.out";
+    struct aws_allocator *alloc = aws_default_allocator();
+    uint8_t *pt = aws_mem_acquire(alloc, pt_len + 1), *ct, *out;
+    size_t ct_len, out_len;
+    TEST_ASSERT_ADDR_NOT_NULL(pt);
+    aws_cryptosdk_genrandom(pt, pt_len);
+    if (write_test_file(pt_path, pt, pt_len)) return 1;
+
+    struct aws_hash_table enc_ctx, enc_ctx_out;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx_out));
+    TEST_ASSERT_SUCCESS(test_enc_ctx_fill(&enc_ctx));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_file(alloc, cmm, &enc_ctx, ct_path, pt_path));
+
+    /* The file holds exactly one message, which decrypts in memory */
+    TEST_ASSERT_INT_EQ(test_loadfile(ct_path, &ct, &ct_len), 0);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_buffer(alloc, cmm, NULL, pt, pt_len + 1, &out_len, ct, ct_len));
+    TEST_ASSERT_INT_EQ(out_len, pt_len);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_file(alloc, cmm, &enc_ctx_out, out_path, ct_path));
+    TEST_ASSERT_INT_EQ(test_file_size(out_path), pt_len);
+    if (pt_len) {
+        TEST_ASSERT_INT_EQ(test_loadfile(out_path, &out, &out_len), 0);
+        TEST_ASSERT(!memcmp(out, pt, pt_len));
+        free(out);
+    }
+    TEST_ASSERT_SUCCESS(assert_enc_ctx_fill(&enc_ctx_out));
+
+    /* A corrupt message leaves no plaintext behind, even once an earlier output is replaced */
+    ct[ct_len - 1] ^= 1;
+    if (write_test_file(ct_path, ct, ct_len)) return 1;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_decrypt_file(alloc, cmm, NULL, out_path, ct_path));
+    TEST_ASSERT_INT_EQ(test_file_size(out_path), 0);
+
+    /* As does trailing data after the message */
+    ct[ct_len - 1] ^= 1;
+    ct = realloc(ct, ct_len + 1);
+    TEST_ASSERT_ADDR_NOT_NULL(ct);
+    ct[ct_len] = 0;
+    if (write_test_file(ct_path, ct, ct_len + 1)) return 1;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_decrypt_file(alloc, cmm, NULL, out_path, ct_path));
+    TEST_ASSERT_INT_EQ(test_file_size(out_path), 0);
+    free(ct);
+
+    remove(pt_path);
+    remove(ct_path);
+    remove(out_path);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx_out);
+    aws_mem_release(alloc, pt);
+
+    return 0;
+}
+
+int test_file_roundtrip() {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    if (file_roundtrip_once(cmm, 0) || file_roundtrip_once(cmm, 100) || file_roundtrip_once(cmm, 300000)) return 1;
+
+    /* A missing input is an I/O error */
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_IO,
+        aws_cryptosdk_encrypt_file(alloc, cmm, NULL, "t_encrypt_file.out", "t_encrypt_file.missing"));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_IO,
+        aws_cryptosdk_decrypt_file(alloc, cmm, NULL, "t_encrypt_file.out", "t_encrypt_file.missing"));
+
+    aws_cryptosdk_cmm_release(cmm);
+
+    return 0;
+}
+
+#ifndef _WIN32
+static int file_direct_roundtrip_once(struct aws_cryptosdk_cmm *cmm, size_t pt_len, uint32_t block_size) {
+    static const char *pt_path = "t_encrypt_file.pt", *ct_path = "t_encrypt_file.ct", *out_path = "t_encrypt_file.out";
+    struct aws_allocator *alloc = aws_default_allocator();
+    uint8_t *pt = aws_mem_acquire(alloc, pt_len + 1), *ct, *out;
+    size_t ct_len, out_len;
+    TEST_ASSERT_ADDR_NOT_NULL(pt);
+    aws_cryptosdk_genrandom(pt, pt_len);
+    if (write_test_file(pt_path, pt, pt_len)) return 1;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_file_direct(alloc, cmm, NULL, ct_path, pt_path, block_size));
+
+    /* The padding of the last block is cut off, leaving exactly one message */
+    TEST_ASSERT_INT_EQ(test_loadfile(ct_path, &ct, &ct_len), 0);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_buffer(alloc, cmm, NULL, pt, pt_len + 1, &out_len, ct, ct_len));
+    TEST_ASSERT_INT_EQ(out_len, pt_len);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_file_direct(alloc, cmm, NULL, out_path, ct_path));
+    TEST_ASSERT_INT_EQ(test_file_size(out_path), pt_len);
+    if (pt_len) {
+        TEST_ASSERT_INT_EQ(test_loadfile(out_path, &out, &out_len), 0);
+        TEST_ASSERT(!memcmp(out, pt, pt_len));
+        free(out);
+    }
+
+    /* A corrupt message leaves no plaintext behind */
+    ct[ct_len - 1] ^= 1;
+    if (write_test_file(ct_path, ct, ct_len)) return 1;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_decrypt_file_direct(alloc, cmm, NULL, out_path, ct_path));
+    TEST_ASSERT_INT_EQ(test_file_size(out_path), 0);
+    free(ct);
+
+    remove(pt_path);
+    remove(ct_path);
+    remove(out_path);
+    aws_mem_release(alloc, pt);
+
+    return 0;
+}
+#endif
+
+int test_file_direct_roundtrip() {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+#ifdef _WIN32
+    TEST_ASSERT_ERROR(AWS_ERROR_UNIMPLEMENTED, aws_cryptosdk_encrypt_file_direct(alloc, cmm, NULL, "out", "in", 0));
+#else
+    if (file_direct_roundtrip_once(cmm, 0, 0) || file_direct_roundtrip_once(cmm, 5000, 0) ||
+        file_direct_roundtrip_once(cmm, 3000000, 4096) || file_direct_roundtrip_once(cmm, 3000000, 1024 * 1024)) {
+        return 1;
+    }
+
+    /* A missing input is an I/O error */
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_IO,
+        aws_cryptosdk_encrypt_file_direct(alloc, cmm, NULL, "t_encrypt_file.out", "t_encrypt_file.missing", 0));
+#endif
+
+    aws_cryptosdk_cmm_release(cmm);
+
+    return 0;
+}
+
+#ifndef _WIN32
+static int process_fd_once(enum aws_cryptosdk_alg_id alg_id, size_t pt_len, uint32_t frame_size, size_t read_ahead) {
+    static const char *pt_path = "t_encrypt_fd.pt", *ct_path = "t_encrypt_fd.ct", *out_path = "t_encrypt_fd.out";
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+    aws_cryptosdk_keyring_release(kr);
+
+    uint8_t *pt = aws_mem_acquire(alloc, pt_len + 1), *ct, *out;
+    size_t ct_len, out_len;
+    TEST_ASSERT_ADDR_NOT_NULL(pt);
+    aws_cryptosdk_genrandom(pt, pt_len);
+    if (write_test_file(pt_path, pt, pt_len)) return 1;
+
+    /* Encrypt without giving the message size up front */
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(s, frame_size));
+
+    int in_fd  = open(pt_path, O_RDONLY);
+    int out_fd = open(ct_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    TEST_ASSERT(in_fd >= 0 && out_fd >= 0);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process_fd(s, out_fd, in_fd, read_ahead));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    close(in_fd);
+    close(out_fd);
+
+    TEST_ASSERT_INT_EQ(test_loadfile(ct_path, &ct, &ct_len), 0);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_decrypt_buffer(alloc, cmm, NULL, pt, pt_len + 1, &out_len, ct, ct_len));
+    TEST_ASSERT_INT_EQ(out_len, pt_len);
+
+    /* And back again */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    in_fd  = open(ct_path, O_RDONLY);
+    out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    TEST_ASSERT(in_fd >= 0 && out_fd >= 0);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process_fd(s, out_fd, in_fd, read_ahead));
+    close(in_fd);
+    close(out_fd);
+
+    TEST_ASSERT_INT_EQ(test_file_size(out_path), pt_len);
+    if (pt_len) {
+        TEST_ASSERT_INT_EQ(test_loadfile(out_path, &out, &out_len), 0);
+        TEST_ASSERT(!memcmp(out, pt, pt_len));
+        free(out);
+    }
+
+    /* A truncated message is rejected */
+    if (write_test_file(ct_path, ct, ct_len - 1)) return 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    in_fd  = open(ct_path, O_RDONLY);
+    out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    TEST_ASSERT(in_fd >= 0 && out_fd >= 0);
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_session_process_fd(s, out_fd, in_fd, read_ahead));
+    close(in_fd);
+    close(out_fd);
+    free(ct);
+
+    remove(pt_path);
+    remove(ct_path);
+    remove(out_path);
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_mem_release(alloc, pt);
+
+    return 0;
+}
+
+/* Streams a short plaintext through a pipe, with a message size that does not match it */
+static int process_fd_pipe() {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    uint8_t pt[1000];
+    int fds[2];
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_keyring(alloc, AWS_CRYPTOSDK_ENCRYPT, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    aws_cryptosdk_keyring_release(kr);
+
+    int out_fd = open("/dev/null", O_WRONLY);
+    TEST_ASSERT(out_fd >= 0);
+
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_session_process_fd(s, out_fd, 0, 0));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt) - 1));
+    TEST_ASSERT_INT_EQ(pipe(fds), 0);
+    TEST_ASSERT_INT_EQ(write(fds[1], pt, sizeof(pt)), sizeof(pt));
+    close(fds[1]);
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED, aws_cryptosdk_session_process_fd(s, out_fd, fds[0], 2));
+    close(fds[0]);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt) + 1));
+    TEST_ASSERT_INT_EQ(pipe(fds), 0);
+    TEST_ASSERT_INT_EQ(write(fds[1], pt, sizeof(pt)), sizeof(pt));
+    close(fds[1]);
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_process_fd(s, out_fd, fds[0], 2));
+    close(fds[0]);
+
+    close(out_fd);
+    aws_cryptosdk_session_destroy(s);
+
+    return 0;
+}
+#endif
+
+int test_process_fd() {
+#ifdef _WIN32
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_keyring(
+        aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_zero_keyring_new(aws_default_allocator()));
+    TEST_ASSERT_ERROR(AWS_ERROR_UNIMPLEMENTED, aws_cryptosdk_session_process_fd(s, 1, 0, 1));
+    aws_cryptosdk_session_destroy(s);
+    return 0;
+#else
+    return process_fd_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 0, 4096, 1) ||
+           process_fd_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 3 * 1024 * 1024 + 7, 65536, 4) ||
+           process_fd_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 1500000, 4096, 2) ||
+           process_fd_once(ALG_AES128_GCM_IV12_TAG16_NO_KDF, 2 * 1024 * 1024 + 100, 0, 1) || process_fd_pipe();
+#endif
+}
+
+static int total_output_size_once(enum aws_cryptosdk_alg_id alg_id, uint32_t frame_size, size_t pt_len) {
+    init_bufs(pt_len);
+    size_t ct_consumed, pt_consumed;
+    uint64_t size, size_after;
+
+    struct aws_cryptosdk_cmm *cmm =
+        create_session_with_cmm(AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_zero_keyring_new(aws_default_allocator()));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, frame_size));
+
+    /* Not available until the message size is known */
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_get_total_output_size(session, &size));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    precise_size_set = true;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_total_output_size(session, &size));
+
+    /* The whole message fits in a buffer of exactly that size */
+    if (pump_ciphertext((size_t)size, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(ct_size, size);
+    TEST_ASSERT_INT_EQ(pt_consumed, pt_size);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_get_total_output_size(session, &size_after));
+    TEST_ASSERT_INT_EQ(size_after, size);
+
+    if (check_ciphertext_and_trace(true)) return 1;
+
+    /* Meaningless for decryption */
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_get_total_output_size(session, &size));
+
+    aws_cryptosdk_cmm_release(cmm);
+    free_bufs();
+
+    return 0;
+}
+
+int test_total_output_size() {
+    return total_output_size_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 1024, 1) ||
+           total_output_size_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 1024, 4096) ||
+           total_output_size_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 1000, 4096) ||
+           total_output_size_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 0, 4096) ||
+           total_output_size_once(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256_ECDSA_P256, 100, 1000) ||
+           total_output_size_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 4096, 10000);
+}
+
+/*
+ * A keyring whose asynchronous calls are left outstanding until the test completes them,
+ * forwarding to a zero keyring at that point.
+ */
+static struct deferred_keyring_call {
+    bool pending;
+    bool encrypt;
+    struct aws_allocator *request_alloc;
+    struct aws_byte_buf *unencrypted_data_key;
+    struct aws_array_list *keyring_trace;
+    struct aws_array_list *edks;
+    const struct aws_hash_table *enc_ctx;
+    enum aws_cryptosdk_alg_id alg;
+    aws_cryptosdk_keyring_fn *callback;
+    void *user_data;
+} deferred_call;
+
+static struct aws_cryptosdk_keyring *deferred_inner;
+
+static void deferred_keyring_destroy(struct aws_cryptosdk_keyring *kr) {
+    (void)kr;
+}
+
+static int deferred_keyring_on_encrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    (void)kr;
+    return aws_cryptosdk_keyring_on_encrypt(
+        deferred_inner, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+}
+
+static int deferred_keyring_on_decrypt(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg) {
+    (void)kr;
+    return aws_cryptosdk_keyring_on_decrypt(
+        deferred_inner, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg);
+}
+
+static int defer_call(
+    bool encrypt,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    deferred_call.pending              = true;
+    deferred_call.encrypt              = encrypt;
+    deferred_call.request_alloc        = request_alloc;
+    deferred_call.unencrypted_data_key = unencrypted_data_key;
+    deferred_call.keyring_trace        = keyring_trace;
+    // Decrypt calls only read the EDK list
+    deferred_call.edks      = (struct aws_array_list *)edks;
+    deferred_call.enc_ctx   = enc_ctx;
+    deferred_call.alg       = alg;
+    deferred_call.callback  = callback;
+    deferred_call.user_data = user_data;
+
+    return AWS_OP_SUCCESS;
+}
+
+static int deferred_keyring_on_encrypt_async(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    (void)kr;
+    return defer_call(
+        true, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg, callback, user_data);
+}
+
+static int deferred_keyring_on_decrypt_async(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_byte_buf *unencrypted_data_key,
+    struct aws_array_list *keyring_trace,
+    const struct aws_array_list *edks,
+    const struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    aws_cryptosdk_keyring_fn *callback,
+    void *user_data) {
+    (void)kr;
+    return defer_call(
+        false, request_alloc, unencrypted_data_key, keyring_trace, edks, enc_ctx, alg, callback, user_data);
+}
+
+static const struct aws_cryptosdk_keyring_vt deferred_keyring_vt = {
+    .vt_size          = sizeof(struct aws_cryptosdk_keyring_vt),
+    .name             = "deferred keyring",
+    .destroy          = deferred_keyring_destroy,
+    .on_encrypt       = deferred_keyring_on_encrypt,
+    .on_decrypt       = deferred_keyring_on_decrypt,
+    .on_encrypt_async = deferred_keyring_on_encrypt_async,
+    .on_decrypt_async = deferred_keyring_on_decrypt_async
+};
+
+/* Completes the outstanding call, failing it with error_code if that is nonzero */
+static void deferred_keyring_complete(int error_code) {
+    struct deferred_keyring_call call = deferred_call;
+
+    deferred_call.pending = false;
+    if (!error_code) {
+        int rv = call.encrypt ? aws_cryptosdk_keyring_on_encrypt(
+                                    deferred_inner,
+                                    call.request_alloc,
+                                    call.unencrypted_data_key,
+                                    call.keyring_trace,
+                                    call.edks,
+                                    call.enc_ctx,
+                                    call.alg)
+                              : aws_cryptosdk_keyring_on_decrypt(
+                                    deferred_inner,
+                                    call.request_alloc,
+                                    call.unencrypted_data_key,
+                                    call.keyring_trace,
+                                    call.edks,
+                                    call.enc_ctx,
+                                    call.alg);
+        if (rv) error_code = aws_last_error();
+    }
+
+    call.callback(error_code, call.user_data);
+}
+
+static int ready_count;
+
+static void count_ready(struct aws_cryptosdk_session *ready_session, void *user_data) {
+    (void)ready_session;
+    (void)user_data;
+    ready_count++;
+}
+
+static void complete_after_delay(void *arg) {
+    (void)arg;
+    aws_thread_current_sleep(10 * 1000 * 1000);
+    deferred_keyring_complete(AWS_ERROR_SUCCESS);
+}
+
+int test_async_materials() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_keyring deferred_kr;
+    size_t ct_consumed, pt_consumed, out_written, in_read;
+
+    aws_cryptosdk_keyring_base_init(&deferred_kr, &deferred_keyring_vt);
+    deferred_inner = aws_cryptosdk_zero_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(deferred_inner);
+
+    init_bufs(1000);
+    ready_count = 0;
+    grow_buf(&ct_buf, &ct_buf_size, 4096);
+
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(alloc, &deferred_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    session = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_async_callback(session, count_ready, NULL));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+
+    /* The first call leaves the keyring call outstanding, without blocking or making progress */
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, ct_buf, ct_buf_size, &ct_consumed, pt_buf, pt_size, &pt_consumed));
+    TEST_ASSERT_INT_EQ(ct_consumed, 0);
+    TEST_ASSERT_INT_EQ(pt_consumed, 0);
+    TEST_ASSERT(aws_cryptosdk_session_is_pending(session));
+    TEST_ASSERT(deferred_call.pending);
+    TEST_ASSERT_INT_EQ(ready_count, 0);
+
+    /* Calling again while the request is outstanding is harmless */
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, ct_buf, ct_buf_size, &ct_consumed, pt_buf, pt_size, &pt_consumed));
+    TEST_ASSERT_INT_EQ(ct_consumed, 0);
+
+    deferred_keyring_complete(AWS_ERROR_SUCCESS);
+    TEST_ASSERT_INT_EQ(ready_count, 1);
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, ct_buf, ct_buf_size, &ct_consumed, pt_buf, pt_size, &pt_consumed));
+    TEST_ASSERT(!aws_cryptosdk_session_is_pending(session));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(pt_consumed, pt_size);
+    ct_size = ct_consumed;
+
+    /* Decrypt parses the header, then waits on the keyring */
+    uint8_t *pt_check = aws_mem_acquire(alloc, pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_check);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, pt_check, pt_size, &out_written, ct_buf, ct_size, &in_read));
+    TEST_ASSERT_INT_EQ(out_written, 0);
+    TEST_ASSERT(aws_cryptosdk_session_is_pending(session));
+    TEST_ASSERT(!deferred_call.encrypt);
+
+    deferred_keyring_complete(AWS_ERROR_SUCCESS);
+    TEST_ASSERT_INT_EQ(ready_count, 2);
+
+    size_t header_read = in_read;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(
+        session, pt_check, pt_size, &out_written, ct_buf + header_read, ct_size - header_read, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(out_written, pt_size);
+    TEST_ASSERT_INT_EQ(header_read + in_read, ct_size);
+    TEST_ASSERT(!memcmp(pt_check, pt_buf, pt_size));
+
+    /* A failed keyring call fails the session */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, pt_check, pt_size, &out_written, ct_buf, ct_size, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_pending(session));
+    deferred_keyring_complete(AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT);
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT,
+        aws_cryptosdk_session_process(session, pt_check, pt_size, &out_written, ct_buf, ct_size, &in_read));
+    TEST_ASSERT(!aws_cryptosdk_session_is_pending(session));
+
+    /* Resetting a pending session waits for the outstanding request */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, ct_buf, ct_buf_size, &ct_consumed, pt_buf, pt_size, &pt_consumed));
+    TEST_ASSERT(aws_cryptosdk_session_is_pending(session));
+
+    struct aws_thread completer;
+    TEST_ASSERT_SUCCESS(aws_thread_init(&completer, alloc));
+    TEST_ASSERT_SUCCESS(aws_thread_launch(&completer, complete_after_delay, NULL, NULL));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT(!aws_cryptosdk_session_is_pending(session));
+    TEST_ASSERT(!deferred_call.pending);
+    aws_thread_join(&completer);
+    aws_thread_clean_up(&completer);
+
+    /* Without the callback, the session uses the synchronous keyring call */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_async_callback(session, NULL, NULL));
+    ct_size = 0;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    precise_size_set = true;
+    if (pump_ciphertext(4096, &ct_consumed, pt_size, &pt_consumed)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(ready_count, 4);
+
+    aws_mem_release(alloc, pt_check);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(deferred_inner);
+    free_bufs();
+
+    return 0;
+}
+
+struct sink_state {
+    struct aws_byte_buf received;
+    int calls;
+    /* Error to raise on the next call, or zero */
+    int fail_with;
+};
+
+static int collect_output(
+    struct aws_cryptosdk_session *s, const struct aws_byte_cursor *segments, size_t count, void *user_data) {
+    struct sink_state *state = user_data;
+    (void)s;
+
+    state->calls++;
+    if (state->fail_with) return aws_raise_error(state->fail_with);
+    for (size_t i = 0; i < count; i++) {
+        if (aws_byte_buf_append_dynamic(&state->received, &segments[i])) return AWS_OP_ERR;
+    }
+    return AWS_OP_SUCCESS;
+}
+
+/* Feeds input to a session with a sink, chunk more bytes of it each call, until it is done */
+static int feed_sink_session(struct sink_state *state, const uint8_t *in, size_t in_len, size_t chunk) {
+    size_t offset = 0, end = 0, total_written = 0, written, read, out_needed, in_needed;
+
+    while (!aws_cryptosdk_session_is_done(session)) {
+        end = in_len - end < chunk ? in_len : end + chunk;
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_session_process(session, NULL, 0, &written, in + offset, end - offset, &read));
+        offset += read;
+        total_written += written;
+        TEST_ASSERT_INT_EQ(total_written, state->received.len);
+
+        // Everything produced so far has been handed over, and only missing input holds the session back
+        aws_cryptosdk_session_estimate_buf(session, &out_needed, &in_needed);
+        TEST_ASSERT(aws_cryptosdk_session_is_done(session) || in_needed > end - offset);
+    }
+    TEST_ASSERT_INT_EQ(offset, in_len);
+
+    return 0;
+}
+
+int test_output_sink() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct sink_state state     = { 0 };
+    size_t written, read;
+
+    init_bufs(10000);
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&state.received, alloc, 0));
+    create_session(AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_zero_keyring_new(alloc));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 1000));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_output_sink(session, collect_output, &state));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+
+    // The caller's buffer is not used at all
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_session_process(session, ct_buf, 1, &written, pt_buf, 0, &read));
+    if (feed_sink_session(&state, pt_buf, pt_size, 777)) return 1;
+    TEST_ASSERT(state.calls > 1);
+
+    // Sinks work the same way for decryption, and across resets
+    struct aws_byte_buf ct = state.received;
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&state.received, alloc, 0));
+    state.calls = 0;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    if (feed_sink_session(&state, ct.buffer, ct.len, 333)) return 1;
+    TEST_ASSERT_INT_EQ(state.received.len, pt_size);
+    TEST_ASSERT(!memcmp(state.received.buffer, pt_buf, pt_size));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_output_sink(session, NULL, NULL));
+
+    // An error raised by the sink fails the session
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    state.fail_with = AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED,
+        aws_cryptosdk_session_process(session, NULL, 0, &written, ct.buffer, ct.len, &read));
+    TEST_ASSERT_INT_EQ(written, 0);
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED,
+        aws_cryptosdk_session_process(session, NULL, 0, &written, ct.buffer, ct.len, &read));
+
+    aws_byte_buf_clean_up(&ct);
+    aws_byte_buf_clean_up(&state.received);
+    free_bufs();
+    return 0;
+}
+
+struct frame_sink_state {
+    struct aws_byte_buf received;
+    uint32_t next_seqno;
+    size_t largest_frame;
+};
+
+static int collect_frame(
+    struct aws_cryptosdk_session *s, struct aws_byte_cursor plaintext, uint32_t sequence_number, void *user_data) {
+    struct frame_sink_state *state = user_data;
+    (void)s;
+
+    if (sequence_number != state->next_seqno++) return aws_raise_error(AWS_ERROR_INVALID_STATE);
+    if (plaintext.len > state->largest_frame) state->largest_frame = plaintext.len;
+    return aws_byte_buf_append_dynamic(&state->received, &plaintext);
+}
+
+int test_plaintext_sink() {
+    struct aws_allocator *alloc   = aws_default_allocator();
+    struct sink_state ct_state    = { 0 };
+    struct frame_sink_state state = { .next_seqno = 1 };
+    size_t written, read;
+
+    init_bufs(10000);
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&ct_state.received, alloc, 0));
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&state.received, alloc, 0));
+    create_session(AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_zero_keyring_new(alloc));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_plaintext_sink(session, collect_frame, &state));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 1000));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_output_sink(session, collect_output, &ct_state));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    if (feed_sink_session(&ct_state, pt_buf, pt_size, pt_size)) return 1;
+    struct aws_byte_buf ct = ct_state.received;
+
+    // The two kinds of sink are exclusive
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_plaintext_sink(session, collect_frame, &state));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_output_sink(session, NULL, NULL));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_plaintext_sink(session, collect_frame, &state));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_output_sink(session, collect_output, &ct_state));
+
+    // Given the whole message at once, the session still hands it over frame by frame, in order
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_session_process(session, pt_buf, 1, &written, ct.buffer, 0, &read));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, NULL, 0, &written, ct.buffer, ct.len, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(ct.len, read);
+    TEST_ASSERT_INT_EQ(pt_size, written);
+    TEST_ASSERT_INT_EQ(pt_size, state.received.len);
+    TEST_ASSERT(!memcmp(state.received.buffer, pt_buf, pt_size));
+    TEST_ASSERT_INT_EQ(1000, state.largest_frame);
+    TEST_ASSERT(state.next_seqno > pt_size / 1000);
+
+    struct aws_cryptosdk_session_stats stats;
+    aws_cryptosdk_session_get_stats(session, &stats);
+    TEST_ASSERT_INT_EQ(pt_size, stats.bytes_out);
+
+    // Fed in pieces, and across resets, likewise
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    aws_byte_buf_reset(&state.received, false);
+    state.next_seqno = 1;
+    size_t offset    = 0;
+    while (!aws_cryptosdk_session_is_done(session)) {
+        size_t chunk = aws_min_size(ct.len - offset, 333);
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_session_process(session, NULL, 0, &written, ct.buffer + offset, chunk, &read));
+        offset += read;
+    }
+    TEST_ASSERT_INT_EQ(pt_size, state.received.len);
+    TEST_ASSERT(!memcmp(state.received.buffer, pt_buf, pt_size));
+
+    // An error raised by the sink fails the session
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    state.next_seqno = 2;
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_STATE, aws_cryptosdk_session_process(session, NULL, 0, &written, ct.buffer, ct.len, &read));
+    TEST_ASSERT_INT_EQ(written, 0);
+
+    aws_byte_buf_clean_up(&ct);
+    aws_byte_buf_clean_up(&state.received);
+    free_bufs();
+    return 0;
+}
+
+struct source_state {
+    struct aws_byte_cursor remaining;
+    size_t pulled, largest_request;
+    /* Every other call reports no input, as a non-blocking reader would */
+    bool starve;
+    bool starved_last;
+};
+
+static int supply_input(
+    struct aws_cryptosdk_session *s, uint8_t *buf, size_t len, size_t *out_bytes_read, void *user_data) {
+    struct source_state *state = user_data;
+    (void)s;
+
+    *out_bytes_read = 0;
+    if (len > state->largest_request) state->largest_request = len;
+    if (state->starve && (state->starved_last = !state->starved_last)) return AWS_OP_SUCCESS;
+
+    struct aws_byte_cursor piece = aws_byte_cursor_advance(&state->remaining, len);
+    if (!piece.ptr) piece = aws_byte_cursor_advance(&state->remaining, state->remaining.len);
+    if (piece.len) memcpy(buf, piece.ptr, piece.len);
+    *out_bytes_read = piece.len;
+    state->pulled += piece.len;
+    return AWS_OP_SUCCESS;
+}
+
+int test_input_source() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct sink_state sink      = { 0 };
+    struct source_state source  = { 0 };
+    size_t written, read, total = 0;
+
+    init_bufs(10000);
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&sink.received, alloc, 0));
+    create_session(AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_zero_keyring_new(alloc));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 1000));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+
+    // With a sink as well, a single call runs the whole message
+    source.remaining = aws_byte_cursor_from_array(pt_buf, pt_size);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_input_source(session, supply_input, &source));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_output_sink(session, collect_output, &sink));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_session_process(session, NULL, 0, &written, pt_buf, 1, &read));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, NULL, 0, &written, NULL, 0, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(read, 0);
+    TEST_ASSERT_INT_EQ(written, sink.received.len);
+    TEST_ASSERT_INT_EQ(source.pulled, pt_size);
+    TEST_ASSERT_INT_EQ(source.largest_request, 1000);
+
+    // Decrypting into the caller's buffer, the session reads no further than the end of the message
+    struct aws_byte_buf ct = sink.received;
+    TEST_ASSERT_SUCCESS(aws_byte_buf_reserve(&ct, ct.len + 100));
+    memset(ct.buffer + ct.len, 0xff, 100);
+    uint8_t *pt_out = aws_mem_acquire(alloc, pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_out);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_output_sink(session, NULL, NULL));
+    source = (struct source_state){ .remaining = aws_byte_cursor_from_array(ct.buffer, ct.len + 100), .starve = true };
+    for (int calls = 0; !aws_cryptosdk_session_is_done(session); calls++) {
+        TEST_ASSERT(calls < 100);
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_session_process(session, pt_out + total, pt_size - total, &written, NULL, 0, &read));
+        total += written;
+    }
+    TEST_ASSERT_INT_EQ(total, pt_size);
+    TEST_ASSERT(!memcmp(pt_out, pt_buf, pt_size));
+    TEST_ASSERT_INT_EQ(source.pulled, ct.len);
+    TEST_ASSERT(source.largest_request < 1100);
+
+    aws_mem_release(alloc, pt_out);
+    aws_byte_buf_clean_up(&ct);
+    free_bufs();
+    return 0;
+}
+
+int test_compression() {
+    AWS_STATIC_STRING_FROM_LITERAL(compression_key, "aws-crypto-compression");
+    AWS_STATIC_STRING_FROM_LITERAL(zlib_name, "zlib");
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct sink_state sink      = { 0 };
+    size_t ct_len, pt_len, written, read;
+    uint8_t *ct, *pt_out;
+
+    TEST_ASSERT(!aws_cryptosdk_compression_available((enum aws_cryptosdk_compression)7));
+    if (!aws_cryptosdk_compression_available(AWS_CRYPTOSDK_COMPRESSION_ZLIB)) return 0;
+
+    // Text compresses well; random bytes would not
+    init_bufs(50000);
+    for (size_t i = 0; i < pt_size; i++) pt_buf[i] = "the quick brown fox "[i % 20] + (i % 77 == 0);
+
+    create_session(AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_zero_keyring_new(alloc));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_compression(session, AWS_CRYPTOSDK_COMPRESSION_ZLIB));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 1000));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    if (process_loop(alloc, &ct, &ct_len, pt_buf, pt_size)) return 1;
+    TEST_ASSERT(ct_len < pt_size / 4);
+
+    struct aws_string *value = NULL;
+    struct aws_hash_element *elem;
+    TEST_ASSERT_SUCCESS(
+        aws_hash_table_find(aws_cryptosdk_session_get_enc_ctx_ptr(session), (void *)compression_key, &elem));
+    TEST_ASSERT_ADDR_NOT_NULL(elem);
+    value = elem->value;
+    TEST_ASSERT(aws_string_eq(value, zlib_name));
+
+    // Decryption follows the encryption context, a little output at a time
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    if (process_loop(alloc, &pt_out, &pt_len, ct, ct_len)) return 1;
+    TEST_ASSERT_INT_EQ(pt_len, pt_size);
+    TEST_ASSERT(!memcmp(pt_out, pt_buf, pt_size));
+    aws_mem_release(alloc, pt_out);
+
+    // And into a sink, all at once
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_output_sink(session, collect_output, &sink));
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&sink.received, alloc, 0));
+    if (feed_sink_session(&sink, ct, ct_len, ct_len)) return 1;
+    TEST_ASSERT_INT_EQ(sink.received.len, pt_size);
+    TEST_ASSERT(!memcmp(sink.received.buffer, pt_buf, pt_size));
+    aws_byte_buf_clean_up(&sink.received);
+
+    // Compression is for encryption only, and must be chosen before the message starts
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_compression(session, AWS_CRYPTOSDK_COMPRESSION_ZLIB));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_output_sink(session, NULL, NULL));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, ct, ct_len, &written, pt_buf, 10, &read));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_compression(session, AWS_CRYPTOSDK_COMPRESSION_NONE));
+
+    // Unframed messages cannot be compressed
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 0));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_process(session, ct, ct_len, &written, pt_buf, 10, &read));
+
+    // The caller may not claim the reserved key for itself
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 1000));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(
+        aws_cryptosdk_session_get_enc_ctx_ptr_mut(session), (void *)compression_key, (void *)zlib_name, NULL));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_RESERVED_NAME,
+        aws_cryptosdk_session_process(session, ct, ct_len, &written, pt_buf, 10, &read));
+
+    aws_mem_release(alloc, ct);
+    free_bufs();
+    return 0;
+}
+
+int test_compression_in_place() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    size_t ct_len, pt_len, written, read;
+    uint8_t *ct, *pt_out;
+
+    if (!aws_cryptosdk_compression_available(AWS_CRYPTOSDK_COMPRESSION_ZLIB)) return 0;
+
+    init_bufs(50000);
+    for (size_t i = 0; i < pt_size; i++) pt_buf[i] = "the quick brown fox "[i % 20] + (i % 77 == 0);
+
+    create_session(AWS_CRYPTOSDK_ENCRYPT, aws_cryptosdk_zero_keyring_new(alloc));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_compression(session, AWS_CRYPTOSDK_COMPRESSION_ZLIB));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 1000));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+
+    /* Encryption refuses overlapping buffers up front, whatever the headroom... */
+    size_t headroom = 4096;
+    uint8_t *buf    = aws_mem_acquire(alloc, headroom + pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(buf);
+    memcpy(buf + headroom, pt_buf, pt_size);
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_session_process(session, buf, headroom + pt_size, &written, buf + headroom, pt_size, &read));
+    TEST_ASSERT_INT_EQ(0, memcmp(buf + headroom, pt_buf, pt_size));
+
+    /* ...and the session carries on with separate ones */
+    if (process_loop(alloc, &ct, &ct_len, pt_buf, pt_size)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    /* Decryption reads the header, then stops short of the body without touching it */
+    memcpy(buf, ct, ct_len);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, buf, ct_len, &written, buf, ct_len, &read));
+    TEST_ASSERT_INT_EQ(written, 0);
+    TEST_ASSERT(read > 0 && read < ct_len);
+    TEST_ASSERT_INT_EQ(0, memcmp(buf + read, ct + read, ct_len - read));
+    size_t header_len = read;
+
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_session_process(
+            session, buf + header_len, ct_len - header_len, &written, buf + header_len, ct_len - header_len, &read));
+    TEST_ASSERT_INT_EQ(0, memcmp(buf + header_len, ct + header_len, ct_len - header_len));
+
+    if (process_loop(alloc, &pt_out, &pt_len, ct + header_len, ct_len - header_len)) return 1;
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(pt_len, pt_size);
+    TEST_ASSERT(!memcmp(pt_out, pt_buf, pt_size));
+
+    aws_mem_release(alloc, pt_out);
+    aws_mem_release(alloc, buf);
+    aws_mem_release(alloc, ct);
+    free_bufs();
+    return 0;
+}
+
+int test_compression_unsized_paths() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    size_t ct_len, pt_len, written, max_len;
+    uint64_t offset;
+    uint8_t *ct, *pt_out;
+
+    if (!aws_cryptosdk_compression_available(AWS_CRYPTOSDK_COMPRESSION_ZLIB)) return 0;
+
+    init_bufs(50000);
+    for (size_t i = 0; i < pt_size; i++) pt_buf[i] = "the quick brown fox "[i % 20] + (i % 77 == 0);
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = create_session_with_cmm(AWS_CRYPTOSDK_ENCRYPT, kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_compression(session, AWS_CRYPTOSDK_COMPRESSION_ZLIB));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, 1000));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_size));
+    if (process_loop(alloc, &ct, &ct_len, pt_buf, pt_size)) return 1;
+
+    /* The one-shot decrypt sizes its output from the frames, which hold compressed plaintext */
+    pt_out = aws_mem_acquire(alloc, pt_size);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_out);
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT,
+        aws_cryptosdk_decrypt_buffer(alloc, cmm, NULL, pt_out, pt_size, &written, ct, ct_len));
+    TEST_ASSERT_INT_EQ(written, 0);
+    aws_mem_release(alloc, pt_out);
+
+#ifndef _WIN32
+    /* As does the file decrypt, which maps an output of that size */
+    static const char *ct_path = "t_compression.ct", *out_path = "t_compression.out";
+    if (write_test_file(ct_path, ct, ct_len)) return 1;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT, aws_cryptosdk_decrypt_file(alloc, cmm, NULL, out_path, ct_path));
+    TEST_ASSERT(test_file_size(out_path) <= 0);
+    remove(ct_path);
+    remove(out_path);
+#endif
+
+    /* Only the streaming decrypt decompresses, and random access cannot start it mid-stream */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(session, AWS_CRYPTOSDK_DECRYPT));
+    if (process_loop(alloc, &pt_out, &pt_len, ct, ct_len)) return 1;
+    TEST_ASSERT_INT_EQ(pt_len, pt_size);
+    TEST_ASSERT(!memcmp(pt_out, pt_buf, pt_size));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT, aws_cryptosdk_session_get_frame_range(session, 1, &offset, &max_len));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT,
+        aws_cryptosdk_session_decrypt_frame_at(session, 1, pt_out, pt_len, &written, ct, ct_len));
+    TEST_ASSERT_INT_EQ(written, 0);
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    aws_mem_release(alloc, pt_out);
+    aws_mem_release(alloc, ct);
+    aws_cryptosdk_cmm_release(cmm);
+    free_bufs();
+    return 0;
+}
+
+/* Encrypts pt_len bytes of pt with s, up to the end of the message, appending the output to ct */
+static int encrypt_rest(struct aws_cryptosdk_session *s, struct aws_byte_buf *ct, const uint8_t *pt, size_t pt_len) {
+    size_t written, read;
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(s, ct->buffer + ct->len, ct->capacity - ct->len, &written, pt, pt_len, &read));
+    ct->len += written;
+    TEST_ASSERT_INT_EQ(read, pt_len);
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+
+    return 0;
+}
+
+static int checkpoint_resume_once(struct aws_cryptosdk_cmm *cmm, bool size_known) {
+    struct aws_allocator *alloc = aws_default_allocator();
+    uint8_t pt[5500];
+    size_t written, read, resumed_from;
+    struct aws_byte_buf ct, resumed_ct, checkpoint;
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&ct, alloc, 8192));
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&resumed_ct, alloc, 8192));
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&checkpoint, alloc, 1));
+
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(s, 1000));
+    if (size_known) TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_export_checkpoint(s, &checkpoint));
+
+    // Only whole frames are taken, so the checkpoint falls after the second
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct.buffer, ct.capacity, &written, pt, 2500, &read));
+    TEST_ASSERT_INT_EQ(read, 2000);
+    ct.len = resumed_from = written;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_export_checkpoint(s, &checkpoint));
+
+    if (!size_known) TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+    if (encrypt_rest(s, &ct, pt + 2000, sizeof(pt) - 2000)) return 1;
+
+    // The same message ID and content key give the same ciphertext from the checkpoint on
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_resume_from_checkpoint(s, checkpoint.buffer, checkpoint.len));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE,
+        aws_cryptosdk_session_resume_from_checkpoint(s, checkpoint.buffer, checkpoint.len));
+    if (!size_known) TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+    if (encrypt_rest(s, &resumed_ct, pt + 2000, sizeof(pt) - 2000)) return 1;
+    TEST_ASSERT_INT_EQ(resumed_ct.len, ct.len - resumed_from);
+    TEST_ASSERT(!memcmp(resumed_ct.buffer, ct.buffer + resumed_from, resumed_ct.len));
+
+    // The whole message decrypts as usual
+    uint8_t out[sizeof(pt)];
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, out, sizeof(out), &written, ct.buffer, ct.len, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    TEST_ASSERT_INT_EQ(written, sizeof(pt));
+    TEST_ASSERT(!memcmp(out, pt, sizeof(pt)));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE,
+        aws_cryptosdk_session_resume_from_checkpoint(s, checkpoint.buffer, checkpoint.len));
+
+    // Any change to the checkpoint is caught
+    for (size_t i = 0; i < checkpoint.len; i += 7) {
+        checkpoint.buffer[i] ^= 0x10;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_ENCRYPT));
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+            aws_cryptosdk_session_resume_from_checkpoint(s, checkpoint.buffer, checkpoint.len));
+        checkpoint.buffer[i] ^= 0x10;
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_resume_from_checkpoint(s, checkpoint.buffer, checkpoint.len - 1));
+
+    aws_cryptosdk_session_destroy(s);
+    aws_byte_buf_clean_up(&ct);
+    aws_byte_buf_clean_up(&resumed_ct);
+    aws_byte_buf_clean_up(&checkpoint);
+    return 0;
+}
+
+int test_checkpoint_resume() {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    if (checkpoint_resume_once(cmm, true) || checkpoint_resume_once(cmm, false)) return 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES128_GCM_IV12_TAG16_NO_KDF));
+    if (checkpoint_resume_once(cmm, true)) return 1;
+
+    // The trailing signature cannot be carried over
+    uint8_t pt[100], ct[1024];
+    size_t written, read;
+    struct aws_byte_buf checkpoint;
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&checkpoint, alloc, 1));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384));
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(s, 10));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct, sizeof(ct), &written, pt, sizeof(pt), &read));
+    TEST_ASSERT_ERROR(AWS_ERROR_UNSUPPORTED_OPERATION, aws_cryptosdk_session_export_checkpoint(s, &checkpoint));
+    TEST_ASSERT_INT_EQ(checkpoint.len, 0);
+
+    aws_cryptosdk_session_destroy(s);
+    aws_byte_buf_clean_up(&checkpoint);
+    aws_cryptosdk_cmm_release(cmm);
+    return 0;
+}
+
+static int header_only_once(enum aws_cryptosdk_alg_id alg_id) {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+
+    struct aws_hash_table enc_ctx;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(test_enc_ctx_fill(&enc_ctx));
+
+    uint8_t pt[3000], ct[4096], out[3000];
+    size_t ct_len, written, read;
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_buffer(alloc, cmm, &enc_ctx, ct, sizeof(ct), &ct_len, pt, sizeof(pt)));
+
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_header_only(s, true));
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_session_get_edks_ptr(s));
+
+    // The body is left alone, and nothing is set up for it
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, out, sizeof(out), &written, ct, ct_len, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    TEST_ASSERT_INT_EQ(written, 0);
+    TEST_ASSERT_INT_EQ(read, s->header_size);
+    TEST_ASSERT_ADDR_NULL(s->signctx);
+    TEST_ASSERT_SUCCESS(assert_enc_ctx_fill(aws_cryptosdk_session_get_enc_ctx_ptr(s)));
+    const struct aws_array_list *edks = aws_cryptosdk_session_get_edks_ptr(s);
+    TEST_ASSERT_ADDR_NOT_NULL(edks);
+    TEST_ASSERT_INT_EQ(aws_array_list_length(edks), 1);
+
+    // Only the header bytes have to be supplied, and only they are checked
+    size_t header_len = read;
+    ct[ct_len - 1] ^= 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, out, sizeof(out), &written, ct, header_len, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    ct[header_len - 1] ^= 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_session_process(s, out, sizeof(out), &written, ct, ct_len, &read));
+    ct[header_len - 1] ^= 1;
+    ct[ct_len - 1] ^= 1;
+
+    // With the setting cleared, the same session decrypts the whole message
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_header_only(s, false));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, out, sizeof(out), &written, ct, ct_len, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    TEST_ASSERT_INT_EQ(written, sizeof(pt));
+    TEST_ASSERT(!memcmp(out, pt, sizeof(pt)));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_header_only(s, true));
+
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_cmm_release(cmm);
+    return 0;
+}
+
+int test_header_only() {
+    return header_only_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384) ||
+           header_only_once(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256);
+}
+
+static int verify_only_once(enum aws_cryptosdk_alg_id alg_id, size_t frame_size, size_t worker_threads) {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+
+    uint8_t pt[3000], ct[4096];
+    size_t ct_len, written, read;
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_verify_only(s, true));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(s, frame_size));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(s, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, ct, sizeof(ct), &ct_len, pt, sizeof(pt), &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+
+    // The whole message is checked with no output buffer at all
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_worker_threads(s, worker_threads));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_verify_only(s, true));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, NULL, 0, &written, ct, ct_len, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    TEST_ASSERT_INT_EQ(written, 0);
+    TEST_ASSERT_INT_EQ(read, ct_len);
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_verify_only(s, false));
+
+    // Input may arrive in pieces, as when decrypting; the setting is kept across resets
+    size_t pos = 0, window = 333;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    while (!aws_cryptosdk_session_is_done(s)) {
+        size_t piece = ct_len - pos < window ? ct_len - pos : window;
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, NULL, 0, &written, ct + pos, piece, &read));
+        TEST_ASSERT_INT_EQ(written, 0);
+        if (!read) {
+            // Too little for the next frame; the whole rest of the message is always enough
+            TEST_ASSERT(piece < ct_len - pos);
+            window *= 2;
+        }
+        pos += read;
+    }
+    TEST_ASSERT_INT_EQ(pos, ct_len);
+
+    // A flipped bit anywhere in the body or trailer is caught
+    size_t offsets[] = { ct_len / 2, ct_len - 1 };
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        ct[offsets[i]] ^= 1;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_session_process(s, NULL, 0, &written, ct, ct_len, &read));
+        ct[offsets[i]] ^= 1;
+    }
+
+    // Other GCM providers can only decrypt
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_gcm_provider(s, &counting_gcm_provider));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_UNSUPPORTED_OPERATION, aws_cryptosdk_session_process(s, NULL, 0, &written, ct, ct_len, &read));
+
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_cmm_release(cmm);
+    return 0;
+}
+
+int test_verify_only() {
+    // Unframed, framed with an empty final frame, and framed over worker threads
+    return verify_only_once(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256, 0, 1) ||
+           verify_only_once(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 100, 1) ||
+           verify_only_once(ALG_AES192_GCM_IV12_TAG16_HKDF_SHA256, 100, 4);
+}
+
+/* Decrypts ct in a new session with the given limits, returning the error raised, or zero on success */
+static int decrypt_limited(
+    struct aws_cryptosdk_cmm *cmm,
+    const uint8_t *ct,
+    size_t ct_len,
+    size_t max_edks,
+    size_t max_enc_ctx_size,
+    size_t max_unwrap_attempts) {
+    struct aws_cryptosdk_session *s =
+        aws_cryptosdk_session_new_from_cmm(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, cmm);
+    uint8_t out[100];
+    size_t written, read;
+    int error = AWS_ERROR_UNKNOWN;
+
+    if (!s) return error;
+    if (aws_cryptosdk_session_set_max_encrypted_data_keys(s, max_edks) ||
+        aws_cryptosdk_session_set_max_enc_ctx_size(s, max_enc_ctx_size) ||
+        aws_cryptosdk_session_set_max_unwrap_attempts(s, max_unwrap_attempts)) {
+        goto out;
+    }
+
+    if (aws_cryptosdk_session_process(s, out, sizeof(out), &written, ct, ct_len, &read)) {
+        error = aws_last_error();
+    } else if (aws_cryptosdk_session_is_done(s)) {
+        error = AWS_ERROR_SUCCESS;
+    }
+
+out:
+    aws_cryptosdk_session_destroy(s);
+    return error;
+}
+
+int test_decrypt_limits() {
+    AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "namespace");
+    AWS_STATIC_STRING_FROM_LITERAL(key_name_a, "a");
+    AWS_STATIC_STRING_FROM_LITERAL(key_name_b, "b");
+    AWS_STATIC_STRING_FROM_LITERAL(key_name_c, "c");
+    static const uint8_t wrapping_key_a[32] = { 1 };
+    static const uint8_t wrapping_key_b[32] = { 2 };
+    static const uint8_t wrapping_key_c[32] = { 3 };
+    struct aws_allocator *alloc             = aws_default_allocator();
+
+    // The message gets an EDK under each of a, b and c, in that order
+    struct aws_cryptosdk_keyring *kr_a =
+        aws_cryptosdk_raw_aes_keyring_new(alloc, key_namespace, key_name_a, wrapping_key_a, AWS_CRYPTOSDK_AES256);
+    struct aws_cryptosdk_keyring *kr_b =
+        aws_cryptosdk_raw_aes_keyring_new(alloc, key_namespace, key_name_b, wrapping_key_b, AWS_CRYPTOSDK_AES256);
+    struct aws_cryptosdk_keyring *kr_c =
+        aws_cryptosdk_raw_aes_keyring_new(alloc, key_namespace, key_name_c, wrapping_key_c, AWS_CRYPTOSDK_AES256);
+    TEST_ASSERT_ADDR_NOT_NULL(kr_a);
+    TEST_ASSERT_ADDR_NOT_NULL(kr_b);
+    TEST_ASSERT_ADDR_NOT_NULL(kr_c);
+    struct aws_cryptosdk_keyring *multi = aws_cryptosdk_multi_keyring_new(alloc, kr_a);
+    TEST_ASSERT_ADDR_NOT_NULL(multi);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_add_child(multi, kr_b));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_multi_keyring_add_child(multi, kr_c));
+    struct aws_cryptosdk_cmm *enc_cmm = aws_cryptosdk_default_cmm_new(alloc, multi);
+    struct aws_cryptosdk_cmm *dec_cmm = aws_cryptosdk_default_cmm_new(alloc, kr_c);
+    TEST_ASSERT_ADDR_NOT_NULL(enc_cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_cmm);
+
+    struct aws_hash_table enc_ctx;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(test_enc_ctx_fill(&enc_ctx));
+
+    uint8_t pt[100] = { 0 }, ct[2048];
+    size_t ct_len;
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_encrypt_buffer(alloc, enc_cmm, &enc_ctx, ct, sizeof(ct), &ct_len, pt, sizeof(pt)));
+
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, dec_cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    uint8_t out[100];
+    size_t written, read;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, out, sizeof(out), &written, ct, ct_len, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+    size_t enc_ctx_size = s->header.parsed_enc_ctx_len;
+    TEST_ASSERT(enc_ctx_size > 0);
+
+    // The limits apply to decryption only
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_max_encrypted_data_keys(s, 1));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_max_enc_ctx_size(s, 1));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_max_unwrap_attempts(s, 1));
+    aws_cryptosdk_session_destroy(s);
+
+    TEST_ASSERT_INT_EQ(decrypt_limited(dec_cmm, ct, ct_len, 2, 0, 0), AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    TEST_ASSERT_INT_EQ(decrypt_limited(dec_cmm, ct, ct_len, 3, 0, 0), AWS_ERROR_SUCCESS);
+
+    TEST_ASSERT_INT_EQ(decrypt_limited(dec_cmm, ct, ct_len, 0, enc_ctx_size - 1, 0), AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED);
+    TEST_ASSERT_INT_EQ(decrypt_limited(dec_cmm, ct, ct_len, 0, enc_ctx_size, 0), AWS_ERROR_SUCCESS);
+
+    // Only the first EDKs are offered to the keyring, so one under c is out of reach of two attempts
+    TEST_ASSERT_INT_EQ(decrypt_limited(dec_cmm, ct, ct_len, 0, 0, 2), AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT);
+    TEST_ASSERT_INT_EQ(decrypt_limited(dec_cmm, ct, ct_len, 0, 0, 3), AWS_ERROR_SUCCESS);
+    TEST_ASSERT_INT_EQ(decrypt_limited(enc_cmm, ct, ct_len, 0, 0, 1), AWS_ERROR_SUCCESS);
+
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_cmm_release(enc_cmm);
+    aws_cryptosdk_cmm_release(dec_cmm);
+    aws_cryptosdk_keyring_release(multi);
+    aws_cryptosdk_keyring_release(kr_a);
+    aws_cryptosdk_keyring_release(kr_b);
+    aws_cryptosdk_keyring_release(kr_c);
+    return 0;
+}
+
+int test_compact_session() {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    struct aws_hash_table enc_ctx;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(test_enc_ctx_fill(&enc_ctx));
+
+    uint8_t pt[1000], ct[4096], out[1000];
+    size_t ct_len, written, read;
+    aws_cryptosdk_genrandom(pt, sizeof(pt));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_encrypt_buffer(alloc, cmm, &enc_ctx, ct, sizeof(ct), &ct_len, pt, sizeof(pt)));
+
+    struct aws_cryptosdk_session *s = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_DECRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(s);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_compact(s, true));
+
+    for (int message = 0; message < 2; message++) {
+        // Until plaintext is asked for, everything from the header is still there
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(s, out, 0, &written, ct, ct_len, &read));
+        TEST_ASSERT_INT_EQ(written, 0);
+        TEST_ASSERT_ADDR_NOT_NULL(s->header_copy);
+        TEST_ASSERT_SUCCESS(assert_enc_ctx_fill(aws_cryptosdk_session_get_enc_ctx_ptr(s)));
+        TEST_ASSERT_ADDR_NOT_NULL(aws_cryptosdk_session_get_edks_ptr(s));
+        TEST_ASSERT_ADDR_NOT_NULL(aws_cryptosdk_session_get_keyring_trace_ptr(s));
+
+        size_t consumed = read;
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_session_process(s, out, sizeof(out), &written, ct + consumed, ct_len - consumed, &read));
+        TEST_ASSERT(aws_cryptosdk_session_is_done(s));
+        TEST_ASSERT_INT_EQ(written, sizeof(pt));
+        TEST_ASSERT(!memcmp(out, pt, sizeof(pt)));
+
+        // Then only what the body needs is kept
+        TEST_ASSERT_ADDR_NULL(s->header_copy);
+        TEST_ASSERT_ADDR_NULL(s->spare_dec_materials);
+        TEST_ASSERT_INT_EQ(aws_array_list_length(&s->header.edk_list), 0);
+        TEST_ASSERT_INT_EQ(aws_hash_table_get_entry_count(&s->header.enc_ctx), 0);
+        TEST_ASSERT_ADDR_NULL(aws_cryptosdk_session_get_enc_ctx_ptr(s));
+        TEST_ASSERT_ADDR_NULL(aws_cryptosdk_session_get_edks_ptr(s));
+        TEST_ASSERT_ADDR_NULL(aws_cryptosdk_session_get_keyring_trace_ptr(s));
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_DECRYPT));
+    }
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_reset(s, AWS_CRYPTOSDK_ENCRYPT));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_session_set_compact(s, true));
+
+    aws_cryptosdk_session_destroy(s);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_cmm_release(cmm);
     return 0;
 }
 
 struct test_case encrypt_test_cases[] = {
     { "encrypt", "test_simple_roundtrip", test_simple_roundtrip },
+    { "encrypt", "test_keyring_trace_disabled", test_keyring_trace_disabled },
     { "encrypt", "test_small_buffers", test_small_buffers },
+    { "encrypt", "test_multi_frame_single_call", test_multi_frame_single_call },
+    { "encrypt", "test_worker_threads", test_worker_threads },
+    { "encrypt", "test_worker_threads_keep_caller_placement", test_worker_threads_keep_caller_placement },
+    { "encrypt", "test_worker_threads_corrupt_frame", test_worker_threads_corrupt_frame },
+    { "encrypt", "test_frame_executor", test_frame_executor },
+    { "encrypt", "test_processv_roundtrip", test_processv_roundtrip },
+    { "encrypt", "test_in_place", test_in_place },
+    { "encrypt", "test_pipelined_signature", test_pipelined_signature },
+    { "encrypt", "test_deferred_signatures", test_deferred_signatures },
+    { "encrypt", "test_gcm_provider", test_gcm_provider },
+    { "encrypt", "test_gcm_provider_many", test_gcm_provider_many },
+    { "encrypt", "test_kernel_selection", test_kernel_selection },
+    { "encrypt", "test_stitched_digest", test_stitched_digest },
+    { "encrypt", "test_session_stats", test_session_stats },
+    { "encrypt", "test_trace_callback", test_trace_callback },
+    { "encrypt", "test_adaptive_frame_size", test_adaptive_frame_size },
+    { "encrypt", "test_block_aligned_frames", test_block_aligned_frames },
+    { "encrypt", "test_frozen_enc_ctx", test_frozen_enc_ctx },
+    { "encrypt", "test_enc_ctx_flat", test_enc_ctx_flat },
+    { "encrypt", "test_deferred_enc_ctx", test_deferred_enc_ctx },
+    { "encrypt", "test_reset_reuses_allocations", test_reset_reuses_allocations },
+    { "encrypt", "test_borrow_header", test_borrow_header },
+    { "encrypt", "test_dec_request_borrows_header_edks", test_dec_request_borrows_header_edks },
+    { "encrypt", "test_message_arena", test_message_arena },
+    { "encrypt", "test_random_access", test_random_access },
+    { "encrypt", "test_frame_sizes", test_frame_sizes },
+    { "encrypt", "test_frame_index", test_frame_index },
+    { "encrypt", "test_encrypt_frames_at", test_encrypt_frames_at },
+    { "encrypt", "test_decrypt_frames_at", test_decrypt_frames_at },
+    { "encrypt", "test_one_shot", test_one_shot },
+    { "encrypt", "test_encrypt_batch", test_encrypt_batch },
+    { "encrypt", "test_edk_prefilter", test_edk_prefilter },
+    { "encrypt", "test_file_roundtrip", test_file_roundtrip },
+    { "encrypt", "test_file_direct_roundtrip", test_file_direct_roundtrip },
+    { "encrypt", "test_process_fd", test_process_fd },
+    { "encrypt", "test_total_output_size", test_total_output_size },
+    { "encrypt", "test_async_materials", test_async_materials },
+    { "encrypt", "test_output_sink", test_output_sink },
+    { "encrypt", "test_plaintext_sink", test_plaintext_sink },
+    { "encrypt", "test_input_source", test_input_source },
+    { "encrypt", "test_compression", test_compression },
+    { "encrypt", "test_compression_in_place", test_compression_in_place },
+    { "encrypt", "test_compression_unsized_paths", test_compression_unsized_paths },
+    { "encrypt", "test_checkpoint_resume", test_checkpoint_resume },
+    { "encrypt", "test_header_only", test_header_only },
+    { "encrypt", "test_verify_only", test_verify_only },
+    { "encrypt", "test_decrypt_limits", test_decrypt_limits },
+    { "encrypt", "test_compact_session", test_compact_session },
     { "encrypt", "test_different_keyring_cant_decrypt", &test_different_keyring_cant_decrypt },
     { "encrypt", "test_changed_keyring_can_decrypt", &test_changed_keyring_can_decrypt },
     { "encrypt", "test_algorithm_override", &test_algorithm_override },
@@ -14,6 +14,8 @@
  */
 
 #include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/frame_scan.h>
 #include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/private/framefmt.h>
 #include <aws/cryptosdk/session.h>
@@ -59,6 +61,184 @@ int test_serialize_return_ciphertext_size() {
     return 0;
 }
 
+int test_short_buffer_needs_more() {
+    const struct aws_cryptosdk_alg_properties *alg_props =
+        aws_cryptosdk_alg_props(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256);
+    struct aws_cryptosdk_frame frame = { .type = FRAME_TYPE_FRAME, .sequence_number = 1 };
+    uint8_t buf[256];
+    size_t plaintext_size = 100, ciphertext_size = 0, full_size = 0;
+
+    // A short output buffer is reported without raising an error, along with the exact size needed
+    struct aws_byte_buf short_buf = aws_byte_buf_from_empty_array(buf, 10);
+    aws_reset_error();
+    TEST_ASSERT_INT_EQ(
+        AWS_CRYPTOSDK_NEED_MORE,
+        aws_cryptosdk_try_serialize_frame(&frame, &ciphertext_size, plaintext_size, &short_buf, alg_props));
+    TEST_ASSERT_INT_EQ(0, aws_last_error());
+    TEST_ASSERT_INT_EQ(0, short_buf.len);
+
+    struct aws_byte_buf out = aws_byte_buf_from_empty_array(buf, sizeof(buf));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_try_serialize_frame(&frame, &full_size, plaintext_size, &out, alg_props));
+    TEST_ASSERT_INT_EQ(ciphertext_size, full_size);
+    TEST_ASSERT_INT_EQ(full_size, out.len);
+
+    // The raising variant still reports it as an error
+    short_buf = aws_byte_buf_from_empty_array(buf + sizeof(buf) - 10, 10);
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_SHORT_BUFFER,
+        aws_cryptosdk_serialize_frame(&frame, &ciphertext_size, plaintext_size, &short_buf, alg_props));
+
+    // Likewise for a frame cut short, once its size fields have been seen
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_array(buf, full_size - 1);
+    size_t parsed_ciphertext_size = 0, parsed_plaintext_size = 0;
+    aws_reset_error();
+    TEST_ASSERT_INT_EQ(
+        AWS_CRYPTOSDK_NEED_MORE,
+        aws_cryptosdk_try_deserialize_frame(
+            &frame, &parsed_ciphertext_size, &parsed_plaintext_size, &cursor, alg_props, plaintext_size));
+    TEST_ASSERT_INT_EQ(0, aws_last_error());
+    TEST_ASSERT_ADDR_EQ(buf, cursor.ptr);
+    TEST_ASSERT_INT_EQ(full_size, parsed_ciphertext_size);
+    TEST_ASSERT_INT_EQ(plaintext_size, parsed_plaintext_size);
+
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_SHORT_BUFFER,
+        aws_cryptosdk_deserialize_frame(
+            &frame, &parsed_ciphertext_size, &parsed_plaintext_size, &cursor, alg_props, plaintext_size));
+
+    cursor = aws_byte_cursor_from_array(buf, full_size);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_try_deserialize_frame(
+        &frame, &parsed_ciphertext_size, &parsed_plaintext_size, &cursor, alg_props, plaintext_size));
+    TEST_ASSERT_INT_EQ(0, cursor.len);
+
+    return 0;
+}
+
+static uint8_t scan_ct[4096];
+static size_t scan_ct_len;
+
+static int encrypt_for_scan(enum aws_cryptosdk_alg_id alg_id, uint32_t frame_size, size_t pt_len) {
+    struct aws_allocator *alloc = aws_default_allocator();
+    uint8_t pt[1000] = { 0 };
+    size_t in_read;
+
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    aws_cryptosdk_cmm_release(cmm);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, frame_size));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, pt_len));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_session_process(session, scan_ct, sizeof(scan_ct), &scan_ct_len, pt, pt_len, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    aws_cryptosdk_session_destroy(session);
+    return 0;
+}
+
+/*
+ * Scans the body of scan_ct in chunks of at most chunk bytes, with room for at most max_spans
+ * spans per call, and checks each span against what aws_cryptosdk_deserialize_frame finds there.
+ */
+static int scan_once(size_t chunk, size_t max_spans, size_t *num_frames) {
+    struct aws_cryptosdk_frame_span spans[4];
+    struct aws_cryptosdk_frame_scanner scanner;
+    struct aws_cryptosdk_hdr_view view;
+    uint32_t next_seqno = 1;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_view_init(&view, aws_byte_cursor_from_array(scan_ct, scan_ct_len)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_frame_scanner_init(&scanner, &view));
+    const struct aws_cryptosdk_alg_properties *props = aws_cryptosdk_alg_props(view.alg_id);
+    size_t pos                                       = view.header.len;
+
+    while (!aws_cryptosdk_frame_scanner_is_done(&scanner)) {
+        size_t len = scan_ct_len - pos < chunk ? scan_ct_len - pos : chunk;
+        struct aws_byte_cursor input = aws_byte_cursor_from_array(scan_ct + pos, len);
+        size_t found;
+
+        TEST_ASSERT(len);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_frame_scanner_scan(&scanner, &input, spans, max_spans, &found));
+        pos = input.ptr - scan_ct;
+        TEST_ASSERT_INT_EQ(aws_cryptosdk_frame_scanner_offset(&scanner), pos);
+
+        for (size_t i = 0; i < found; i++, next_seqno++) {
+            struct aws_byte_cursor frame_cur = aws_byte_cursor_from_array(
+                scan_ct + spans[i].offset, scan_ct_len - spans[i].offset);
+            struct aws_cryptosdk_frame frame;
+            size_t ct_size, pt_size;
+
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_deserialize_frame(
+                &frame, &ct_size, &pt_size, &frame_cur, props, view.frame_len));
+            TEST_ASSERT_INT_EQ(spans[i].seqno, next_seqno);
+            TEST_ASSERT_INT_EQ(frame.sequence_number, next_seqno);
+            TEST_ASSERT_INT_EQ(spans[i].len, ct_size);
+            TEST_ASSERT_INT_EQ(spans[i].plaintext_len, pt_size);
+            TEST_ASSERT(spans[i].final == (frame.type != FRAME_TYPE_FRAME));
+        }
+    }
+
+    *num_frames = next_seqno - 1;
+    return 0;
+}
+
+static int scan_message(enum aws_cryptosdk_alg_id alg_id, uint32_t frame_size, size_t pt_len) {
+    static const size_t chunks[] = { 1, 3, 17, 100, 4096 };
+    size_t num_frames;
+
+    TEST_ASSERT_SUCCESS(encrypt_for_scan(alg_id, frame_size, pt_len));
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        for (size_t max_spans = 1; max_spans <= 4; max_spans += 3) {
+            TEST_ASSERT_SUCCESS(scan_once(chunks[i], max_spans, &num_frames));
+            TEST_ASSERT_INT_EQ(num_frames, frame_size ? pt_len / frame_size + 1 : 1);
+        }
+    }
+
+    return 0;
+}
+
+int test_frame_scanner() {
+    struct aws_cryptosdk_frame_span spans[16];
+    struct aws_cryptosdk_frame_scanner scanner;
+    struct aws_cryptosdk_hdr_view view;
+    size_t found;
+
+    if (scan_message(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 100, 1000)) return 1;
+    if (scan_message(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 128, 1000)) return 1;
+    if (scan_message(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 0, 1000)) return 1;
+    if (scan_message(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256_ECDSA_P256, 100, 0)) return 1;
+
+    // Once the final frame is found, the trailer is left unread
+    TEST_ASSERT_SUCCESS(encrypt_for_scan(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 100, 250));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_view_init(&view, aws_byte_cursor_from_array(scan_ct, scan_ct_len)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_frame_scanner_init(&scanner, &view));
+    struct aws_byte_cursor body = aws_byte_cursor_from_array(scan_ct + view.header.len, scan_ct_len - view.header.len);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_frame_scanner_scan(&scanner, &body, spans, 16, &found));
+    TEST_ASSERT_INT_EQ(found, 3);
+    TEST_ASSERT(aws_cryptosdk_frame_scanner_is_done(&scanner));
+    TEST_ASSERT(body.len > 0);
+    TEST_ASSERT_INT_EQ(spans[2].offset + spans[2].len, scan_ct_len - body.len);
+
+    // A frame out of sequence is caught, after the spans of the frames before it
+    scan_ct[spans[1].offset + 3] ^= 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_frame_scanner_init(&scanner, &view));
+    body = aws_byte_cursor_from_array(scan_ct + view.header.len, scan_ct_len - view.header.len);
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_frame_scanner_scan(&scanner, &body, spans, 16, &found));
+    TEST_ASSERT_INT_EQ(found, 1);
+
+    return 0;
+}
+
 struct test_case framefmt_test_cases[] = {
-    { "framefmt", "test_serialize_return_ciphertext_size", test_serialize_return_ciphertext_size }, { NULL }
+    { "framefmt", "test_serialize_return_ciphertext_size", test_serialize_return_ciphertext_size },
+    { "framefmt", "test_short_buffer_needs_more", test_short_buffer_needs_more },
+    { "framefmt", "test_frame_scanner", test_frame_scanner },
+    { NULL }
 };
@@ -403,6 +403,31 @@ int simple_header_parse() {
     return 0;
 }
 
+/* Buffers left over from a longer IV or tag are reused, but only as much of them as the suite needs is read */
+int reparse_into_larger_buffers() {
+    struct aws_cryptosdk_hdr hdr;
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_array(test_header_1, sizeof(test_header_1) - 1);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_init(&hdr, aws_default_allocator()));
+    aws_byte_buf_clean_up(&hdr.iv);
+    aws_byte_buf_clean_up(&hdr.auth_tag);
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&hdr.iv, hdr.alloc, 32));
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&hdr.auth_tag, hdr.alloc, 32));
+    uint8_t *iv_buffer = hdr.iv.buffer, *tag_buffer = hdr.auth_tag.buffer;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_parse(&hdr, &cursor));
+    TEST_ASSERT_INT_EQ(cursor.len, 0);
+    TEST_ASSERT_ADDR_EQ(hdr.iv.buffer, iv_buffer);
+    TEST_ASSERT_ADDR_EQ(hdr.auth_tag.buffer, tag_buffer);
+    TEST_ASSERT_BUF_EQ(hdr.iv, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b);
+    TEST_ASSERT_BUF_EQ(
+        hdr.auth_tag, 0xde, 0xad, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xbe, 0xef);
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_hdr_size(&hdr), sizeof(test_header_1) - 1);
+
+    aws_cryptosdk_hdr_clean_up(&hdr);
+    return 0;
+}
+
 int simple_header_parse2() {
     struct aws_cryptosdk_hdr hdr;
     struct aws_byte_cursor cursor = aws_byte_cursor_from_array(test_header_2, sizeof(test_header_2));
@@ -466,6 +491,15 @@ int failed_parse() {
 
     TEST_ASSERT_INT_EQ(0, hdr.alg_id);
 
+    // The non-raising variant reports the exact size needed without setting an error
+    size_t needed = 0;
+    aws_reset_error();
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_NEED_MORE, aws_cryptosdk_hdr_try_parse_incremental(&hdr, &cursor, &needed));
+    TEST_ASSERT_INT_EQ(0, aws_last_error());
+    TEST_ASSERT_INT_EQ(sizeof(test_header_1), needed);
+    TEST_ASSERT_ADDR_EQ(cursor.ptr, test_header_1);
+    aws_cryptosdk_hdr_clear(&hdr);
+
     // faulty header
     size_t num_bad_hdrs = sizeof(bad_headers) / sizeof(uint8_t *);
 
@@ -483,6 +517,136 @@ int failed_parse() {
     return 0;
 }
 
+int header_view() {
+    struct aws_cryptosdk_hdr_view view;
+    struct aws_byte_cursor input = aws_byte_cursor_from_array(test_header_1, sizeof(test_header_1));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_view_init(&view, input));
+
+    // The trailing junk byte is not part of the header
+    TEST_ASSERT_ADDR_EQ(view.header.ptr, test_header_1);
+    TEST_ASSERT_INT_EQ(view.header.len, sizeof(test_header_1) - 1);
+    TEST_ASSERT_INT_EQ(view.alg_id, ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256_ECDSA_P256);
+    TEST_ASSERT_ADDR_EQ(view.message_id.ptr, test_header_1 + 4);
+    TEST_ASSERT_INT_EQ(view.message_id.len, MESSAGE_ID_LEN);
+    TEST_ASSERT_INT_EQ(view.frame_len, 0x1000);
+    TEST_ASSERT_CUR_EQ(view.iv, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b);
+    TEST_ASSERT_CUR_EQ(
+        view.auth_tag, 0xde, 0xad, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xbe, 0xef);
+
+    struct aws_cryptosdk_hdr_edk_iter edk_iter;
+    struct aws_byte_cursor provider_id, provider_info, ciphertext;
+    size_t num_edks = 0;
+
+    aws_cryptosdk_hdr_view_edk_iter_init(&view, &edk_iter);
+    while (aws_cryptosdk_hdr_edk_iter_next(&edk_iter, &provider_id, &provider_info, &ciphertext)) {
+        const struct aws_cryptosdk_edk *expected = &test_header_1_edk_tbl[num_edks++];
+
+        TEST_ASSERT(aws_byte_cursor_eq_byte_buf(&provider_id, &expected->provider_id));
+        TEST_ASSERT(aws_byte_cursor_eq_byte_buf(&provider_info, &expected->provider_info));
+        TEST_ASSERT(aws_byte_cursor_eq_byte_buf(&ciphertext, &expected->ciphertext));
+    }
+    TEST_ASSERT_INT_EQ(num_edks, 3);
+    TEST_ASSERT(!aws_cryptosdk_hdr_edk_iter_next(&edk_iter, NULL, NULL, NULL));
+
+    struct aws_cryptosdk_hdr_enc_ctx_iter ctx_iter;
+    struct aws_byte_cursor key, value;
+
+    aws_cryptosdk_hdr_view_enc_ctx_iter_init(&view, &ctx_iter);
+    TEST_ASSERT(aws_cryptosdk_hdr_enc_ctx_iter_next(&ctx_iter, &key, &value));
+    TEST_ASSERT_INT_EQ(key.len + value.len, 0);
+    TEST_ASSERT(aws_cryptosdk_hdr_enc_ctx_iter_next(&ctx_iter, &key, &value));
+    TEST_ASSERT_CUR_EQ(key, 0x01, 0x02, 0x03, 0x04);
+    TEST_ASSERT_CUR_EQ(value, 0x01, 0x00, 0x01, 0x00, 0x01);
+    TEST_ASSERT(!aws_cryptosdk_hdr_enc_ctx_iter_next(&ctx_iter, &key, &value));
+
+    // No encryption context
+    input = aws_byte_cursor_from_array(test_header_2, sizeof(test_header_2));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_view_init(&view, input));
+    TEST_ASSERT_INT_EQ(view.enc_ctx_count, 0);
+    aws_cryptosdk_hdr_view_enc_ctx_iter_init(&view, &ctx_iter);
+    TEST_ASSERT(!aws_cryptosdk_hdr_enc_ctx_iter_next(&ctx_iter, NULL, NULL));
+    TEST_ASSERT_INT_EQ(view.edk_count, 3);
+
+    // Every truncation of a header is reported as incomplete
+    for (size_t len = 0; len < sizeof(test_header_1) - 1; len++) {
+        input = aws_byte_cursor_from_array(test_header_1, len);
+        TEST_ASSERT_ERROR(AWS_ERROR_SHORT_BUFFER, aws_cryptosdk_hdr_view_init(&view, input));
+        TEST_ASSERT_ADDR_NULL(view.header.ptr);
+    }
+
+    for (size_t i = 0; i < sizeof(bad_headers) / sizeof(bad_headers[0]); i++) {
+        input = aws_byte_cursor_from_array(bad_headers[i], bad_headers_sz[i]);
+        TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_hdr_view_init(&view, input));
+    }
+
+    return 0;
+}
+
+int incremental_parse() {
+    struct aws_cryptosdk_hdr hdr;
+    struct aws_byte_cursor cursor;
+    size_t hdr_len     = sizeof(test_header_1) - 1;  // not including junk byte
+    size_t needed      = 0;
+    size_t prev_needed = 0;
+    size_t exact_at    = hdr_len;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_init(&hdr, aws_default_allocator()));
+
+    // Present the header one byte at a time
+    for (size_t len = 0; len < hdr_len; len++) {
+        cursor = aws_byte_cursor_from_array(test_header_1, len);
+        TEST_ASSERT_ERROR(AWS_ERROR_SHORT_BUFFER, aws_cryptosdk_hdr_parse_incremental(&hdr, &cursor, &needed));
+        TEST_ASSERT_ADDR_EQ(cursor.ptr, test_header_1);
+        TEST_ASSERT_INT_EQ(cursor.len, len);
+
+        TEST_ASSERT(needed > len);
+        TEST_ASSERT(needed >= prev_needed);
+        TEST_ASSERT(needed <= hdr_len);
+        if (needed == hdr_len && exact_at == hdr_len) exact_at = len;
+        prev_needed = needed;
+    }
+
+    cursor = aws_byte_cursor_from_array(test_header_1, sizeof(test_header_1));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_hdr_parse_incremental(&hdr, &cursor, &needed));
+    TEST_ASSERT_ADDR_EQ(cursor.ptr, test_header_1 + hdr_len);
+    TEST_ASSERT_INT_EQ(cursor.len, 1);
+
+    // The exact size is known as soon as the last EDK has been parsed, before the IV and tag
+    TEST_ASSERT(exact_at <= hdr.auth_len);
+
+    TEST_ASSERT_INT_EQ(hdr.alg_id, ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256_ECDSA_P256);
+    TEST_ASSERT_INT_EQ(2, aws_hash_table_get_entry_count(&hdr.enc_ctx));
+    TEST_ASSERT_INT_EQ(3, aws_array_list_length(&hdr.edk_list));
+    TEST_ASSERT_INT_EQ(0x1000, hdr.frame_len);
+    TEST_ASSERT_INT_EQ(hdr.auth_len, hdr_len - 28);
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_hdr_size(&hdr), hdr_len);
+
+    // Presenting exactly the reported number of bytes each time takes at most one call per
+    // fixed-size block, four per EDK (one per length field, plus one for the last field's
+    // data), and the final successful call
+    aws_cryptosdk_hdr_clear(&hdr);
+    size_t calls = 0;
+    needed       = 0;
+    do {
+        TEST_ASSERT(++calls <= 3 + 3 * 4 + 1);
+        cursor = aws_byte_cursor_from_array(test_header_1, needed);
+    } while (aws_cryptosdk_hdr_parse_incremental(&hdr, &cursor, &needed) == AWS_OP_ERR &&
+             aws_last_error() == AWS_ERROR_SHORT_BUFFER);
+    TEST_ASSERT_INT_EQ(cursor.len, 0);
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_hdr_size(&hdr), hdr_len);
+
+    // Faulty headers are still rejected
+    aws_cryptosdk_hdr_clear(&hdr);
+    cursor = aws_byte_cursor_from_array(hdr_with_zero_edk_count, sizeof(hdr_with_zero_edk_count));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_hdr_parse_incremental(&hdr, &cursor, &needed));
+
+    aws_cryptosdk_hdr_clean_up(&hdr);
+
+    return 0;
+}
+
 #ifdef _POSIX_VERSION
 // Returns the amount of padding needed to align len to a multiple of
 // the system page size.
@@ -691,8 +855,11 @@ int overwrite() {
 #endif
 
 struct test_case header_test_cases[] = { { "header", "parse", simple_header_parse },
+                                         { "header", "reparse_into_larger_buffers", reparse_into_larger_buffers },
                                          { "header", "parse2", simple_header_parse2 },
                                          { "header", "failed_parse", failed_parse },
+                                         { "header", "incremental_parse", incremental_parse },
+                                         { "header", "view", header_view },
                                          { "header", "overread", overread },
                                          { "header", "size", header_size },
                                          { "header", "write", simple_header_write },
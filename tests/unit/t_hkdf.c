@@ -668,4 +668,100 @@ int test_hkdf() {
     return AWS_OP_SUCCESS;
 }
 
-struct test_case hkdf_test_cases[] = { { "hkdf", "test_hkdf", test_hkdf }, { NULL } };
+/* One extract serves any number of expands, from the same key or from copies of it */
+int test_hkdf_key_reuse() {
+    for (int i = 0; i < sizeof(tv) / sizeof(struct hkdf_test_vector); i++) {
+        struct aws_allocator *allocator  = aws_default_allocator();
+        const struct aws_byte_buf mysalt = aws_byte_buf_from_array(tv[i].salt, tv[i].salt_len);
+        const struct aws_byte_buf myikm  = aws_byte_buf_from_array(tv[i].ikm, tv[i].ikm_len);
+        const struct aws_byte_buf myinfo = aws_byte_buf_from_array(tv[i].info, tv[i].info_len);
+        struct aws_cryptosdk_hkdf_key hkdf_key, hkdf_key_copy;
+        struct aws_byte_buf myokm;
+
+        if (i == 6) {
+            TEST_ASSERT_ERROR(
+                AWS_CRYPTOSDK_ERR_UNSUPPORTED_FORMAT,
+                aws_cryptosdk_hkdf_key_init(&hkdf_key, tv[i].which_sha, &mysalt, &myikm));
+            continue;
+        }
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf_key_init(&hkdf_key, tv[i].which_sha, &mysalt, &myikm));
+        hkdf_key_copy = hkdf_key;
+        TEST_ASSERT_SUCCESS(aws_byte_buf_init(&myokm, allocator, tv[i].okm_len));
+        myokm.len = tv[i].okm_len;
+
+        for (int round = 0; round < 2; round++) {
+            memset(myokm.buffer, 0, myokm.len);
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf_key_expand(&hkdf_key, &myokm, &myinfo));
+            TEST_ASSERT(!memcmp(tv[i].okm_desired, myokm.buffer, myokm.len));
+        }
+
+        memset(myokm.buffer, 0, myokm.len);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf_key_expand(&hkdf_key_copy, &myokm, &myinfo));
+        TEST_ASSERT(!memcmp(tv[i].okm_desired, myokm.buffer, myokm.len));
+
+        /* An empty output is rejected */
+        myokm.len = 0;
+        TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN, aws_cryptosdk_hkdf_key_expand(&hkdf_key, &myokm, &myinfo));
+        myokm.len = tv[i].okm_len;
+
+        aws_byte_buf_clean_up(&myokm);
+        aws_cryptosdk_hkdf_key_clean_up(&hkdf_key);
+        aws_cryptosdk_hkdf_key_clean_up(&hkdf_key_copy);
+    }
+    return AWS_OP_SUCCESS;
+}
+
+/* A batched expand gives each output what a single expand would, whatever its length */
+int test_hkdf_key_expand_many() {
+    enum { NUM_OUTPUTS = 19 };
+    struct aws_allocator *allocator = aws_default_allocator();
+
+    for (int i = 0; i < sizeof(tv) / sizeof(struct hkdf_test_vector); i++) {
+        const struct aws_byte_buf mysalt = aws_byte_buf_from_array(tv[i].salt, tv[i].salt_len);
+        const struct aws_byte_buf myikm  = aws_byte_buf_from_array(tv[i].ikm, tv[i].ikm_len);
+        struct aws_byte_buf okms[NUM_OUTPUTS], infos[NUM_OUTPUTS], expected;
+        uint8_t info[NUM_OUTPUTS][18];
+        struct aws_cryptosdk_hkdf_key hkdf_key;
+
+        if (i == 6) continue;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf_key_init(&hkdf_key, tv[i].which_sha, &mysalt, &myikm));
+
+        // Mostly key-sized outputs, enough to fill more than one set of lanes, with a few long ones
+        for (int j = 0; j < NUM_OUTPUTS; j++) {
+            size_t len = j % 7 == 3 ? tv[i].okm_len : (size_t)(16 + j % 17);
+
+            memset(info[j], j, sizeof(info[j]));
+            infos[j] = aws_byte_buf_from_array(info[j], j % 5 ? sizeof(info[j]) : 0);
+            TEST_ASSERT_SUCCESS(aws_byte_buf_init(&okms[j], allocator, len));
+            okms[j].len = len;
+        }
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf_key_expand_many(&hkdf_key, okms, infos, NUM_OUTPUTS));
+
+        for (int j = 0; j < NUM_OUTPUTS; j++) {
+            TEST_ASSERT_SUCCESS(aws_byte_buf_init(&expected, allocator, okms[j].len));
+            expected.len = okms[j].len;
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_hkdf_key_expand(&hkdf_key, &expected, &infos[j]));
+            TEST_ASSERT(aws_byte_buf_eq(&expected, &okms[j]));
+            aws_byte_buf_clean_up(&expected);
+        }
+
+        /* One bad length fails the whole batch, leaving every output zeroed */
+        okms[NUM_OUTPUTS - 1].len = 0;
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN,
+            aws_cryptosdk_hkdf_key_expand_many(&hkdf_key, okms, infos, NUM_OUTPUTS));
+        for (int j = 0; j < NUM_OUTPUTS - 1; j++) {
+            for (size_t k = 0; k < okms[j].capacity; k++) TEST_ASSERT_INT_EQ(0, okms[j].buffer[k]);
+        }
+
+        for (int j = 0; j < NUM_OUTPUTS; j++) aws_byte_buf_clean_up(&okms[j]);
+        aws_cryptosdk_hkdf_key_clean_up(&hkdf_key);
+    }
+    return AWS_OP_SUCCESS;
+}
+
+struct test_case hkdf_test_cases[] = { { "hkdf", "test_hkdf", test_hkdf },
+                                       { "hkdf", "test_hkdf_key_reuse", test_hkdf_key_reuse },
+                                       { "hkdf", "test_hkdf_key_expand_many", test_hkdf_key_expand_many },
+                                       { NULL } };
@@ -14,6 +14,7 @@
  */
 #include <aws/cryptosdk/list_utils.h>
 #include <aws/cryptosdk/private/keyring_trace.h>
+#include <aws/cryptosdk/private/utils.h>
 #include "testing.h"
 #include "testutil.h"
 
@@ -100,8 +101,85 @@ int keyring_trace_copy_all_works() {
     return 0;
 }
 
+int keyring_trace_interned_strings_are_shared() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_array_list traces[2];
+    struct aws_string *name = aws_string_new_from_c_str(alloc, "key_name");
+    TEST_ASSERT_ADDR_NOT_NULL(name);
+
+    // a static string is already shared, and the interned copy of a heap string outlives it
+    TEST_ASSERT_ADDR_EQ(kms_name_space, aws_cryptosdk_string_intern(alloc, kms_name_space));
+    struct aws_string *interned = aws_cryptosdk_string_intern(alloc, name);
+    TEST_ASSERT_ADDR_NOT_NULL(interned);
+    TEST_ASSERT_ADDR_NE(name, interned);
+    TEST_ASSERT(aws_string_eq(name, interned));
+    aws_string_destroy(name);
+
+    for (int i = 0; i < 2; ++i) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_init(alloc, &traces[i]));
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_add_record(
+        alloc, &traces[0], kms_name_space, interned, AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_copy_all(alloc, &traces[1], &traces[0]));
+
+    // records and their copies all point at the interned string
+    for (int i = 0; i < 2; ++i) {
+        struct aws_cryptosdk_keyring_trace_record *rec;
+        TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&traces[i], (void **)&rec, 0));
+        TEST_ASSERT_ADDR_EQ(interned, rec->wrapping_key_name);
+    }
+
+    // the string stays valid until the last reference is dropped
+    aws_string_destroy(interned);
+    aws_cryptosdk_keyring_trace_clean_up(&traces[0]);
+    TEST_ASSERT_SUCCESS(assert_keyring_trace_record(
+        &traces[1], 0, "aws-kms", "key_name", AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+    aws_cryptosdk_keyring_trace_clean_up(&traces[1]);
+
+    return 0;
+}
+
+int keyring_trace_disabled_records_nothing() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_array_list disabled, child, enabled;
+
+    aws_cryptosdk_keyring_trace_init_disabled(&disabled);
+    TEST_ASSERT(aws_cryptosdk_keyring_trace_is_disabled(&disabled));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_add_record(
+        alloc, &disabled, kms_name_space, kms_key, AWS_CRYPTOSDK_WRAPPING_KEY_GENERATED_DATA_KEY));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_add_record_c_str(
+        alloc, &disabled, "foo", "bar", AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY));
+    TEST_ASSERT_INT_EQ(0, aws_array_list_length(&disabled));
+
+    // scratch traces of a disabled trace are disabled too
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_init_like(alloc, &child, &disabled));
+    TEST_ASSERT(aws_cryptosdk_keyring_trace_is_disabled(&child));
+    aws_cryptosdk_keyring_trace_clean_up(&child);
+
+    // nothing is transferred or copied into a disabled trace, and the source keeps its records
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_init(alloc, &enabled));
+    TEST_ASSERT(!aws_cryptosdk_keyring_trace_is_disabled(&enabled));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_add_record_c_str(
+        alloc, &enabled, "foo", "bar", AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_copy_all(alloc, &disabled, &enabled));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_transfer_list(&disabled, &enabled));
+    TEST_ASSERT_INT_EQ(0, aws_array_list_length(&disabled));
+    TEST_ASSERT_INT_EQ(1, aws_array_list_length(&enabled));
+
+    // disabling an initialized trace frees its records
+    aws_cryptosdk_keyring_trace_disable(&enabled);
+    TEST_ASSERT(aws_cryptosdk_keyring_trace_is_disabled(&enabled));
+    TEST_ASSERT_INT_EQ(0, aws_array_list_length(&enabled));
+
+    aws_cryptosdk_keyring_trace_clean_up(&enabled);
+    aws_cryptosdk_keyring_trace_clean_up(&disabled);
+    return 0;
+}
+
 struct test_case keyring_trace_test_cases[] = {
     { "keyring_trace", "keyring_trace_add_record_works", keyring_trace_add_record_works },
     { "keyring_trace", "keyring_trace_copy_all_works", keyring_trace_copy_all_works },
+    { "keyring_trace", "keyring_trace_interned_strings_are_shared", keyring_trace_interned_strings_are_shared },
+    { "keyring_trace", "keyring_trace_disabled_records_nothing", keyring_trace_disabled_records_nothing },
     { NULL }
 };
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/config.h>
+#include <aws/cryptosdk/private/kms_async_keyring.h>
+#include "testing.h"
+
+#include <string.h>
+
+AWS_STATIC_STRING_FROM_LITERAL(key_arn, "arn:aws:kms:us-west-2:111122223333:key/0123-abcd");
+AWS_STATIC_STRING_FROM_LITERAL(key_alias, "alias/tenant");
+AWS_STATIC_STRING_FROM_LITERAL(grant_token_1, "grant-1");
+AWS_STATIC_STRING_FROM_LITERAL(grant_token_2, "grant-2");
+AWS_STATIC_STRING_FROM_LITERAL(enc_ctx_key, "tenant\"id");
+AWS_STATIC_STRING_FROM_LITERAL(enc_ctx_value, "a\\b\n");
+
+static const uint8_t blob[] = { 1, 2, 3 };
+
+#define TEST_ASSERT_JSON_EQ(buf, expected)                                \
+    do {                                                                  \
+        TEST_ASSERT_INT_EQ((buf).len, strlen(expected));                  \
+        TEST_ASSERT(!memcmp((buf).buffer, (expected), strlen(expected))); \
+    } while (0)
+
+static int request_bodies() {
+    struct aws_allocator *alloc             = aws_default_allocator();
+    const struct aws_string *grant_tokens[] = { grant_token_1, grant_token_2 };
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf body;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(&enc_ctx, enc_ctx_key, (void *)enc_ctx_value, NULL));
+
+    struct aws_cryptosdk_kms_request generate = { .op              = AWS_CRYPTOSDK_KMS_GENERATE_DATA_KEY,
+                                                  .key_id          = aws_byte_cursor_from_string(key_alias),
+                                                  .number_of_bytes = 32 };
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&body, alloc, 16));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_kms_request_body(&body, &generate));
+    TEST_ASSERT_JSON_EQ(body, "{\"KeyId\":\"alias/tenant\",\"NumberOfBytes\":32}");
+    aws_byte_buf_clean_up_secure(&body);
+
+    // The plaintext comes last, after the context and grant tokens, and strings are escaped
+    struct aws_cryptosdk_kms_request encrypt = { .op               = AWS_CRYPTOSDK_KMS_ENCRYPT,
+                                                 .key_id           = aws_byte_cursor_from_string(key_arn),
+                                                 .blob             = aws_byte_cursor_from_array(blob, sizeof(blob)),
+                                                 .enc_ctx          = &enc_ctx,
+                                                 .grant_tokens     = grant_tokens,
+                                                 .num_grant_tokens = 2 };
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&body, alloc, 16));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_kms_request_body(&body, &encrypt));
+    TEST_ASSERT_JSON_EQ(
+        body,
+        "{\"KeyId\":\"arn:aws:kms:us-west-2:111122223333:key/0123-abcd\","
+        "\"EncryptionContext\":{\"tenant\\\"id\":\"a\\\\b\\u000a\"},"
+        "\"GrantTokens\":[\"grant-1\",\"grant-2\"],\"Plaintext\":\"AQID\"}");
+    aws_byte_buf_clean_up_secure(&body);
+
+    // Decrypt leaves out an empty key ID, and an empty context
+    struct aws_hash_table empty_ctx;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &empty_ctx));
+    struct aws_cryptosdk_kms_request decrypt = { .op      = AWS_CRYPTOSDK_KMS_DECRYPT,
+                                                 .blob    = aws_byte_cursor_from_array(blob, sizeof(blob)),
+                                                 .enc_ctx = &empty_ctx };
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&body, alloc, 16));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_kms_request_body(&body, &decrypt));
+    TEST_ASSERT_JSON_EQ(body, "{\"CiphertextBlob\":\"AQID\"}");
+    aws_byte_buf_clean_up_secure(&body);
+
+    aws_cryptosdk_enc_ctx_clean_up(&empty_ctx);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    return 0;
+}
+
+static int response_parsing() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_kms_response response;
+
+    // Unknown fields of any shape are skipped, and escaped slashes are unescaped
+    const char *generated =
+        "{ \"Extra\": {\"a\": [1, \"}\", true]}, \"CiphertextBlob\" : \"AQID\",\n"
+        "  \"KeyId\": \"arn:aws:kms:us-west-2:111122223333:key\\/0123-abcd\", \"Plaintext\": \"BAUG\" }";
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_kms_response_parse(
+        &response, alloc, AWS_CRYPTOSDK_KMS_GENERATE_DATA_KEY, aws_byte_cursor_from_c_str(generated)));
+    TEST_ASSERT(aws_string_eq_byte_buf(key_arn, &response.key_id));
+    TEST_ASSERT_BUF_EQ(response.ciphertext, 1, 2, 3);
+    TEST_ASSERT_BUF_EQ(response.plaintext, 4, 5, 6);
+    aws_cryptosdk_kms_response_clean_up(&response);
+
+    const char *decrypted = "{\"KeyId\":\"alias/tenant\",\"Plaintext\":\"BAUG\"}";
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_kms_response_parse(
+        &response, alloc, AWS_CRYPTOSDK_KMS_DECRYPT, aws_byte_cursor_from_c_str(decrypted)));
+    TEST_ASSERT(aws_string_eq_byte_buf(key_alias, &response.key_id));
+    TEST_ASSERT_INT_EQ(response.ciphertext.len, 0);
+    TEST_ASSERT_BUF_EQ(response.plaintext, 4, 5, 6);
+    aws_cryptosdk_kms_response_clean_up(&response);
+
+    // Encrypt needs a CiphertextBlob, which a Decrypt response does not have
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_KMS_FAILURE,
+        aws_cryptosdk_kms_response_parse(
+            &response, alloc, AWS_CRYPTOSDK_KMS_ENCRYPT, aws_byte_cursor_from_c_str(decrypted)));
+    TEST_ASSERT_ADDR_NULL(response.key_id.buffer);
+
+    const char *malformed[] = { "",
+                                "[]",
+                                "{\"KeyId\":\"alias/tenant\",\"Plaintext\":\"!!!!\"}",
+                                "{\"KeyId\":\"alias/tenant\",\"Plaintext\":\"BAUG}",
+                                "{\"KeyId\":\"\\u00e9\",\"Plaintext\":\"BAUG\"}",
+                                "{\"Nested\":{\"KeyId\":\"alias/tenant\"},\"Plaintext\":\"BAUG\"}" };
+    for (size_t i = 0; i < sizeof(malformed) / sizeof(*malformed); i++) {
+        TEST_ASSERT_ERROR(
+            AWS_CRYPTOSDK_ERR_KMS_FAILURE,
+            aws_cryptosdk_kms_response_parse(
+                &response, alloc, AWS_CRYPTOSDK_KMS_DECRYPT, aws_byte_cursor_from_c_str(malformed[i])));
+    }
+    return 0;
+}
+
+static int regions_of_arns() {
+    struct aws_byte_cursor region = aws_byte_cursor_from_c_str("unchanged");
+
+    TEST_ASSERT(aws_cryptosdk_kms_region_of_arn(&region, aws_byte_cursor_from_string(key_arn)));
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&region, "us-west-2"));
+    TEST_ASSERT(aws_cryptosdk_kms_region_of_arn(
+        &region, aws_byte_cursor_from_c_str("arn:aws-cn:kms:cn-north-1:111122223333:alias/tenant")));
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&region, "cn-north-1"));
+
+    const char *not_kms_arns[] = { "alias/tenant",
+                                   "0123-abcd",
+                                   "arn:aws:s3:::bucket:key",
+                                   "arn:aws:kms::111122223333:key/0123-abcd",
+                                   "arn:aws:kms:us-west-2:111122223333" };
+    for (size_t i = 0; i < sizeof(not_kms_arns) / sizeof(*not_kms_arns); i++) {
+        TEST_ASSERT(!aws_cryptosdk_kms_region_of_arn(&region, aws_byte_cursor_from_c_str(not_kms_arns[i])));
+    }
+    TEST_ASSERT(aws_byte_cursor_eq_c_str(&region, "cn-north-1"));
+    return 0;
+}
+
+static int retryable_errors() {
+    bool throttled;
+
+    TEST_ASSERT(aws_cryptosdk_kms_error_is_retryable(503, aws_byte_cursor_from_c_str(""), &throttled));
+    TEST_ASSERT(!throttled);
+    TEST_ASSERT(aws_cryptosdk_kms_error_is_retryable(429, aws_byte_cursor_from_c_str(""), &throttled));
+    TEST_ASSERT(throttled);
+    TEST_ASSERT(aws_cryptosdk_kms_error_is_retryable(
+        400, aws_byte_cursor_from_c_str("{\"__type\":\"com.amazonaws.kms#ThrottlingException\"}"), &throttled));
+    TEST_ASSERT(throttled);
+    TEST_ASSERT(aws_cryptosdk_kms_error_is_retryable(
+        400, aws_byte_cursor_from_c_str("{\"__type\":\"KMSInternalException\",\"message\":\"x\"}"), &throttled));
+    TEST_ASSERT(!throttled);
+
+    TEST_ASSERT(!aws_cryptosdk_kms_error_is_retryable(
+        400, aws_byte_cursor_from_c_str("{\"__type\":\"NotFoundException\"}"), &throttled));
+    TEST_ASSERT(!aws_cryptosdk_kms_error_is_retryable(
+        400, aws_byte_cursor_from_c_str("{\"__type\":\"InvalidCiphertextException\"}"), &throttled));
+    TEST_ASSERT(!aws_cryptosdk_kms_error_is_retryable(403, aws_byte_cursor_from_c_str("not json"), &throttled));
+    TEST_ASSERT(!throttled);
+    return 0;
+}
+
+#ifdef AWS_CRYPTOSDK_P_HAVE_AWS_C_HTTP
+
+static int construction_failures() {
+    struct aws_allocator *alloc                            = aws_default_allocator();
+    const struct aws_string *key_ids[]                     = { key_arn, key_alias };
+    struct aws_cryptosdk_kms_async_keyring_options options = { 0 };
+    int placeholder;
+
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_kms_async_keyring_new(alloc, NULL, key_ids, 1, NULL, 0));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_kms_async_keyring_new(alloc, &options, key_ids, 1, NULL, 0));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
+
+    // An alias has no region of its own; the options are checked before anything is set up
+    options.bootstrap            = (struct aws_client_bootstrap *)&placeholder;
+    options.credentials_provider = (struct aws_credentials_provider *)&placeholder;
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_kms_async_keyring_new(alloc, &options, key_ids, 2, NULL, 0));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
+    return 0;
+}
+
+#else  // AWS_CRYPTOSDK_P_HAVE_AWS_C_HTTP
+
+static int construction_failures() {
+    const struct aws_string *key_ids[]                     = { key_arn };
+    struct aws_cryptosdk_kms_async_keyring_options options = { 0 };
+
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_kms_async_keyring_new(aws_default_allocator(), &options, key_ids, 1, NULL, 0));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_UNSUPPORTED_OPERATION);
+    return 0;
+}
+
+#endif  // AWS_CRYPTOSDK_P_HAVE_AWS_C_HTTP
+
+#define TEST_CASE(name) \
+    { "kms_async_keyring", #name, name }
+struct test_case kms_async_keyring_test_cases[] = { TEST_CASE(request_bodies),
+                                                    TEST_CASE(response_parsing),
+                                                    TEST_CASE(regions_of_arns),
+                                                    TEST_CASE(retryable_errors),
+                                                    TEST_CASE(construction_failures),
+                                                    { NULL } };
@@ -14,6 +14,8 @@
  */
 
 #include <aws/common/byte_buf.h>
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/alloc_stats.h>
 #include <aws/cryptosdk/cache.h>
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/enc_ctx.h>
@@ -560,6 +562,901 @@ static int test_materials_cache_entry_count() {
     return 0;
 }
 
+static int test_sharded() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new_sharded(alloc, 64, 4);
+
+    /* Far below any shard's capacity, nothing is evicted */
+    for (int i = 0; i < 8; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_INT_EQ(8, aws_cryptosdk_materials_cache_entry_count(cache));
+    for (int i = 0; i < 8; i++) {
+        if (check_enc_entry(cache, i, true, i == 3, NULL)) return 1;
+    }
+    TEST_ASSERT_INT_EQ(7, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    /* Each shard evicts within its own share of the capacity */
+    for (int i = 0; i < 256; i++) {
+        insert_enc_entry(cache, i, NULL);
+        TEST_ASSERT(aws_cryptosdk_materials_cache_entry_count(cache) <= 64);
+    }
+    TEST_ASSERT(aws_cryptosdk_materials_cache_entry_count(cache) > 4);
+    if (check_enc_entry(cache, 255, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 0, false, false, NULL)) return 1;
+
+    aws_cryptosdk_materials_cache_clear(cache);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+    if (check_enc_entry(cache, 255, false, false, NULL)) return 1;
+    aws_cryptosdk_materials_cache_release(cache);
+
+    /* Shards are limited to leave each a capacity of two, so this holds entries 0 to 3 */
+    cache = aws_cryptosdk_materials_cache_local_new_sharded(alloc, 4, 16);
+    for (int i = 0; i < 4; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT(aws_cryptosdk_materials_cache_entry_count(cache) >= 3);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+#define SHARDED_THREADS 8
+#define SHARDED_THREAD_ITERATIONS 200
+
+struct sharded_worker_args {
+    struct aws_cryptosdk_materials_cache *cache;
+    int seed;
+};
+
+static void sharded_worker(void *arg) {
+    const struct sharded_worker_args *args      = arg;
+    struct aws_cryptosdk_materials_cache *cache = args->cache;
+
+    for (int i = 0; i < SHARDED_THREAD_ITERATIONS; i++) {
+        struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+        struct aws_cryptosdk_enc_materials *enc_mat       = NULL;
+        struct aws_hash_table enc_ctx;
+        struct aws_byte_buf cache_id;
+        int index = (args->seed * 7 + i) % 48;
+
+        if (i % 3 == 0) {
+            insert_enc_entry(cache, index, NULL);
+            continue;
+        }
+
+        byte_buf_printf(&cache_id, aws_default_allocator(), "ID %d", index);
+        if (aws_cryptosdk_materials_cache_find_entry(cache, &entry, NULL, &cache_id)) abort();
+        if (entry) {
+            if (aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx) ||
+                aws_cryptosdk_materials_cache_get_enc_materials(
+                    cache, aws_default_allocator(), &enc_mat, &enc_ctx, entry)) {
+                abort();
+            }
+            aws_cryptosdk_enc_materials_destroy(enc_mat);
+            aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+            aws_cryptosdk_materials_cache_entry_release(cache, entry, i % 5 == 0);
+        }
+        aws_byte_buf_clean_up(&cache_id);
+    }
+}
+
+static int test_sharded_threads() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_thread threads[SHARDED_THREADS];
+    struct sharded_worker_args args[SHARDED_THREADS];
+
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new_sharded(alloc, 32, 4);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+
+    for (int i = 0; i < SHARDED_THREADS; i++) {
+        args[i].cache = cache;
+        args[i].seed  = i;
+        TEST_ASSERT_SUCCESS(aws_thread_init(&threads[i], alloc));
+        TEST_ASSERT_SUCCESS(aws_thread_launch(&threads[i], sharded_worker, &args[i], NULL));
+    }
+
+    for (int i = 0; i < SHARDED_THREADS; i++) {
+        aws_thread_join(&threads[i]);
+        aws_thread_clean_up(&threads[i]);
+    }
+
+    TEST_ASSERT(aws_cryptosdk_materials_cache_entry_count(cache) <= 32);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_hit_buffer() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 2);
+
+    insert_enc_entry(cache, 0, NULL);
+    insert_enc_entry(cache, 1, NULL);
+
+    /* Many more hits than the buffer holds still leave entry 0 the most recently used */
+    for (int i = 0; i < 500; i++) {
+        if (check_enc_entry(cache, 0, true, false, NULL)) return 1;
+    }
+
+    insert_enc_entry(cache, 2, NULL);
+    if (check_enc_entry(cache, 1, false, false, NULL)) return 1;
+    if (check_enc_entry(cache, 0, true, false, NULL)) return 1;
+
+    /* Buffered hits on an entry invalidated before they are applied are simply dropped */
+    if (check_enc_entry(cache, 2, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 2, true, true, NULL)) return 1;
+    insert_enc_entry(cache, 3, NULL);
+    TEST_ASSERT_INT_EQ(2, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    /* Expired entries are misses, even before a writer removes them */
+    now = 10000;
+    aws_cryptosdk_local_cache_set_clock(cache, test_clock);
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    insert_enc_entry(cache, 4, &entry);
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, 10005);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    if (check_enc_entry(cache, 4, true, false, NULL)) return 1;
+    now = 10005;
+    if (check_enc_entry(cache, 4, false, false, NULL)) return 1;
+    TEST_ASSERT_INT_EQ(2, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int clock_eviction_once(enum aws_cryptosdk_local_cache_eviction eviction, int expected_victim) {
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), 4);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_eviction(cache, eviction));
+
+    for (int i = 0; i < 4; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    if (check_enc_entry(cache, 2, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 1, true, false, NULL)) return 1;
+
+    /* Both policies evict 0 and then 3; they differ on whether 2 or 4 goes next */
+    for (int i = 4; i < 7; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+
+    for (int i = 0; i < 7; i++) {
+        bool present = i != 0 && i != 3 && i != expected_victim;
+        if (check_enc_entry(cache, i, present, false, NULL)) return 1;
+    }
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_clock_eviction() {
+    if (clock_eviction_once(AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_LRU, 2)) return 1;
+    if (clock_eviction_once(AWS_CRYPTOSDK_LOCAL_CACHE_EVICT_CLOCK, 4)) return 1;
+
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), 4);
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_materials_cache_local_set_eviction(cache, (enum aws_cryptosdk_local_cache_eviction)42));
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_ttl_wheel() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 64);
+    const uint64_t second                       = 1000000000ull;
+    const uint64_t start                        = 1000 * second;
+
+    now = start;
+    aws_cryptosdk_local_cache_set_clock(cache, test_clock);
+
+    /* Expiry times spread over several turns of the wheel, with two on the same instant */
+    for (int i = 0; i < 10; i++) {
+        struct aws_cryptosdk_materials_cache_entry *entry;
+        insert_enc_entry(cache, i, &entry);
+        aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, start + (i ? i : 1) * 10 * second);
+        aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    }
+
+    /* Each insertion (of an entry without a TTL) reaps whatever has come due */
+    for (int step = 1; step <= 20; step++) {
+        now = start + step * 5 * second;
+        insert_enc_entry(cache, 100 + step, NULL);
+
+        int expired = step / 2 < 1 ? 0 : (step / 2 >= 9 ? 10 : step / 2 + 1);
+        TEST_ASSERT_INT_EQ(10 - expired + step, aws_cryptosdk_materials_cache_entry_count(cache));
+    }
+
+    /* A jump of many turns at once finds everything due */
+    for (int i = 0; i < 5; i++) {
+        struct aws_cryptosdk_materials_cache_entry *entry;
+        insert_enc_entry(cache, 200 + i, &entry);
+        aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, now + (i + 1) * 60 * second);
+        aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    }
+    TEST_ASSERT_INT_EQ(25, aws_cryptosdk_materials_cache_entry_count(cache));
+    now += 3600 * second;
+    insert_enc_entry(cache, 300, NULL);
+    TEST_ASSERT_INT_EQ(21, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    /* Hints already in the past are reaped on the next insertion */
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    insert_enc_entry(cache, 301, &entry);
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, now - 3000 * second);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    if (check_enc_entry(cache, 301, false, false, NULL)) return 1;
+    insert_enc_entry(cache, 302, NULL);
+    TEST_ASSERT_INT_EQ(22, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_maintenance() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_materials_cache_entry *entry;
+
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_materials_cache_local_start_maintenance(cache, 0));
+
+    /* With a long interval, insertions leave expired entries for the maintenance thread */
+    now = 10000;
+    aws_cryptosdk_local_cache_set_clock(cache, test_clock);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_start_maintenance(cache, 3600 * 1000000000ull));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_materials_cache_local_start_maintenance(cache, 1));
+
+    insert_enc_entry(cache, 0, &entry);
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, 10005);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    now = 10005;
+    insert_enc_entry(cache, 1, NULL);
+    TEST_ASSERT_INT_EQ(2, aws_cryptosdk_materials_cache_entry_count(cache));
+    if (check_enc_entry(cache, 0, false, false, NULL)) return 1;
+
+    /* Destroying the cache wakes and stops the thread */
+    aws_cryptosdk_materials_cache_release(cache);
+
+    /* With a short interval, the thread removes expired entries by itself */
+    cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    now   = 10000;
+    aws_cryptosdk_local_cache_set_clock(cache, test_clock);
+    for (int i = 0; i < 4; i++) {
+        insert_enc_entry(cache, i, &entry);
+        aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, i < 3 ? 10005 : 20000);
+        aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    }
+    now = 10005;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_start_maintenance(cache, 1000000));
+
+    for (int i = 0; i < 2000 && aws_cryptosdk_materials_cache_entry_count(cache) != 1; i++) {
+        aws_thread_current_sleep(1000000);
+    }
+    TEST_ASSERT_INT_EQ(1, aws_cryptosdk_materials_cache_entry_count(cache));
+    if (check_enc_entry(cache, 3, true, false, NULL)) return 1;
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_stats() {
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(aws_default_allocator(), 4);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    struct aws_cryptosdk_materials_cache_entry *entry;
+
+    now = 10000;
+    aws_cryptosdk_local_cache_set_clock(cache, test_clock);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(0, stats.entries);
+    TEST_ASSERT_INT_EQ(0, stats.bytes);
+
+    for (int i = 0; i < 4; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    if (check_enc_entry(cache, 0, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 9, false, false, NULL)) return 1;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(4, stats.encrypt_puts);
+    TEST_ASSERT_INT_EQ(1, stats.encrypt_hits);
+    TEST_ASSERT_INT_EQ(0, stats.decrypt_hits);
+    TEST_ASSERT_INT_EQ(1, stats.misses);
+    TEST_ASSERT_INT_EQ(4, stats.entries);
+    TEST_ASSERT(stats.bytes > 0);
+
+    /* Evictions are counted by cause */
+    insert_enc_entry(cache, 4, NULL);
+    insert_enc_entry(cache, 4, NULL);
+    insert_enc_entry(cache, 5, &entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, true);
+    insert_enc_entry(cache, 6, &entry);
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, now + 100);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    now += 200;
+    if (check_enc_entry(cache, 6, false, false, NULL)) return 1;
+    insert_enc_entry(cache, 7, NULL);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(9, stats.encrypt_puts);
+    TEST_ASSERT_INT_EQ(2, stats.misses);
+    TEST_ASSERT_INT_EQ(2, stats.capacity_evictions);
+    TEST_ASSERT_INT_EQ(1, stats.replacements);
+    TEST_ASSERT_INT_EQ(1, stats.invalidations);
+    TEST_ASSERT_INT_EQ(1, stats.ttl_evictions);
+    TEST_ASSERT_INT_EQ(4, stats.entries);
+    TEST_ASSERT_INT_EQ(0, stats.zombies);
+    TEST_ASSERT(stats.bytes > 0);
+
+    /* An entry still held when the cache is cleared stays a zombie until released */
+    insert_enc_entry(cache, 8, &entry);
+    aws_cryptosdk_materials_cache_clear(cache);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(4, stats.cleared);
+    TEST_ASSERT_INT_EQ(0, stats.entries);
+    TEST_ASSERT_INT_EQ(1, stats.zombies);
+    TEST_ASSERT_INT_EQ(0, stats.bytes);
+
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(0, stats.zombies);
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_byte_limit() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_materials_cache_stats stats;
+
+    for (int i = 0; i < 4; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    size_t entry_bytes = stats.bytes / 4;
+
+    /* Lowering the limit evicts the least recently used entries straight away */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_byte_limit(cache, entry_bytes * 5 / 2));
+    TEST_ASSERT_INT_EQ(2, aws_cryptosdk_materials_cache_entry_count(cache));
+    if (check_enc_entry(cache, 0, false, false, NULL)) return 1;
+    if (check_enc_entry(cache, 1, false, false, NULL)) return 1;
+    if (check_enc_entry(cache, 2, true, false, NULL)) return 1;
+
+    /* Insertions then evict by size; entry 3 is now the least recently used */
+    insert_enc_entry(cache, 4, NULL);
+    TEST_ASSERT_INT_EQ(2, aws_cryptosdk_materials_cache_entry_count(cache));
+    if (check_enc_entry(cache, 3, false, false, NULL)) return 1;
+    if (check_enc_entry(cache, 2, true, false, NULL)) return 1;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT(stats.bytes <= entry_bytes * 5 / 2);
+    TEST_ASSERT_INT_EQ(3, stats.capacity_evictions);
+
+    /* Entries too large for the whole limit are not cached */
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    struct aws_cryptosdk_cache_usage_stats usage = { 0, 0 };
+    struct aws_hash_table enc_ctx;
+    struct aws_byte_buf cache_id;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_byte_limit(cache, entry_bytes / 2));
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+    TEST_ASSERT_SUCCESS(setup_enc_params(5, &enc_mat, &enc_ctx, &cache_id));
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat, usage, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NULL(entry);
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED, aws_last_error());
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_byte_buf_clean_up(&cache_id);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    /* A zero limit removes it again */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_byte_limit(cache, 0));
+    for (int i = 0; i < 4; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_INT_EQ(4, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_table_churn() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 32);
+
+    /* Many insertions and evictions leave long probe runs with holes punched in them */
+    for (int i = 0; i < 200; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_INT_EQ(32, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    for (int i = 168; i < 200; i++) {
+        if (check_enc_entry(cache, i, true, i % 3 == 0, NULL)) return 1;
+    }
+
+    /* Every entry which was not invalidated must still be found past the holes left behind */
+    for (int i = 0; i < 200; i++) {
+        if (check_enc_entry(cache, i, i >= 168 && i % 3 != 0, false, NULL)) return 1;
+    }
+
+    for (int i = 168; i < 200; i += 3) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_INT_EQ(32, aws_cryptosdk_materials_cache_entry_count(cache));
+    for (int i = 168; i < 200; i++) {
+        if (check_enc_entry(cache, i, true, false, NULL)) return 1;
+    }
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static void insert_partitioned_entry(struct aws_cryptosdk_materials_cache *cache, int index, const char *partition) {
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    struct aws_byte_buf partition_id = aws_byte_buf_from_c_str(partition);
+
+    insert_enc_entry(cache, index, &entry);
+    aws_cryptosdk_materials_cache_entry_partition_hint(cache, entry, &partition_id);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+}
+
+static int test_partition_quota() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_materials_cache_stats stats;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_partition_quota(cache, 2));
+
+    /* A partition over its quota only evicts its own entries, however much room the cache has */
+    insert_partitioned_entry(cache, 0, "tenant a");
+    insert_partitioned_entry(cache, 1, "tenant a");
+    insert_partitioned_entry(cache, 10, "tenant b");
+    insert_partitioned_entry(cache, 11, "tenant b");
+    insert_enc_entry(cache, 20, NULL);
+    insert_partitioned_entry(cache, 2, "tenant a");
+
+    if (check_enc_entry(cache, 0, false, false, NULL)) return 1;
+    if (check_enc_entry(cache, 1, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 2, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 10, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 11, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 20, true, false, NULL)) return 1;
+
+    /* Each partition keeps its own LRU order, so the entry just used survives the next eviction */
+    if (check_enc_entry(cache, 1, true, false, NULL)) return 1;
+    insert_partitioned_entry(cache, 3, "tenant a");
+    if (check_enc_entry(cache, 2, false, false, NULL)) return 1;
+    if (check_enc_entry(cache, 1, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 3, true, false, NULL)) return 1;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(2, stats.quota_evictions);
+    TEST_ASSERT_INT_EQ(0, stats.capacity_evictions);
+
+    /* Lowering the quota trims every partition straight away, but leaves unpartitioned entries alone */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_partition_quota(cache, 1));
+    TEST_ASSERT_INT_EQ(3, aws_cryptosdk_materials_cache_entry_count(cache));
+    if (check_enc_entry(cache, 3, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 11, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 20, true, false, NULL)) return 1;
+
+    /* A zero quota removes it again */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_partition_quota(cache, 0));
+    insert_partitioned_entry(cache, 4, "tenant a");
+    insert_partitioned_entry(cache, 5, "tenant a");
+    TEST_ASSERT_INT_EQ(5, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(4, stats.quota_evictions);
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_invalidate_partition() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new_sharded(alloc, 16, 4);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    struct aws_byte_buf tenant_a = aws_byte_buf_from_c_str("tenant a");
+    struct aws_byte_buf tenant_c = aws_byte_buf_from_c_str("tenant c");
+
+    for (int i = 0; i < 4; i++) {
+        insert_partitioned_entry(cache, i, "tenant a");
+    }
+    insert_partitioned_entry(cache, 10, "tenant b");
+    insert_enc_entry(cache, 20, NULL);
+
+    /* Only the partition's own entries go, from whichever shards hold them */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_invalidate_partition(cache, &tenant_a));
+    for (int i = 0; i < 4; i++) {
+        if (check_enc_entry(cache, i, false, false, NULL)) return 1;
+    }
+    if (check_enc_entry(cache, 10, true, false, NULL)) return 1;
+    if (check_enc_entry(cache, 20, true, false, NULL)) return 1;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(4, stats.cleared);
+    TEST_ASSERT_INT_EQ(2, stats.entries);
+
+    /* Unknown partitions have nothing to invalidate, and a cleared partition can be refilled */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_invalidate_partition(cache, &tenant_c));
+    insert_partitioned_entry(cache, 0, "tenant a");
+    if (check_enc_entry(cache, 0, true, false, NULL)) return 1;
+    TEST_ASSERT_INT_EQ(3, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static bool enc_entry_present(struct aws_cryptosdk_materials_cache *cache, int index) {
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_byte_buf cache_id;
+
+    byte_buf_printf(&cache_id, aws_default_allocator(), "ID %d", index);
+    if (aws_cryptosdk_materials_cache_find_entry(cache, &entry, NULL, &cache_id)) abort();
+    aws_byte_buf_clean_up(&cache_id);
+    if (entry) aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    return entry != NULL;
+}
+
+static int test_clock_precision() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    uint64_t start;
+
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_materials_cache_local_set_clock_precision(cache, 1, (enum aws_timestamp_unit)7));
+
+    /* With an hour between ticks, the cache keeps seeing the time at which the clock started */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_clock_precision(cache, 3600, AWS_TIMESTAMP_SECS));
+    TEST_ASSERT_SUCCESS(aws_sys_clock_get_ticks(&start));
+    insert_enc_entry(cache, 0, &entry);
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, start + 1000000);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    aws_thread_current_sleep(10000000);
+    TEST_ASSERT(enc_entry_present(cache, 0));
+
+    /* A finer precision takes effect at once, and the entry expires on a later tick */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_clock_precision(cache, 1, AWS_TIMESTAMP_MILLIS));
+    for (int i = 0; i < 2000 && enc_entry_present(cache, 0); i++) {
+        aws_thread_current_sleep(1000000);
+    }
+    TEST_ASSERT(!enc_entry_present(cache, 0));
+
+    /* Back on the exact clock, an entry expires as soon as its time has passed */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_clock_precision(cache, 0, AWS_TIMESTAMP_SECS));
+    TEST_ASSERT_SUCCESS(aws_sys_clock_get_ticks(&start));
+    insert_enc_entry(cache, 1, &entry);
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, start + 1000000);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    aws_thread_current_sleep(10000000);
+    TEST_ASSERT(!enc_entry_present(cache, 1));
+
+    /* Destroying a cache which holds the coarse clock stops its ticker */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_clock_precision(cache, 3600, AWS_TIMESTAMP_SECS));
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_shared_edks() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 16);
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    struct aws_cryptosdk_enc_materials *enc_mat, *hit_1 = NULL, *hit_2 = NULL;
+    struct aws_cryptosdk_cache_usage_stats stats = { 0, 0 };
+    struct aws_hash_table enc_ctx, hit_ctx;
+    struct aws_byte_buf cache_id;
+
+    TEST_ASSERT_SUCCESS(setup_enc_params(3, &enc_mat, &enc_ctx, &cache_id));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &hit_ctx));
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat, stats, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_enc_materials(cache, alloc, &hit_1, &hit_ctx, entry));
+    aws_cryptosdk_enc_ctx_clear(&hit_ctx);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_enc_materials(cache, alloc, &hit_2, &hit_ctx, entry));
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, true);
+
+    /* Both hits borrow the same EDK bytes rather than owning copies */
+    TEST_ASSERT_ADDR_NOT_NULL(hit_1->snapshot);
+    TEST_ASSERT_ADDR_EQ(hit_1->snapshot, hit_2->snapshot);
+    for (size_t i = 0; i < aws_array_list_length(&hit_1->encrypted_data_keys); i++) {
+        struct aws_cryptosdk_edk *edk_1, *edk_2;
+        TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&hit_1->encrypted_data_keys, (void **)&edk_1, i));
+        TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&hit_2->encrypted_data_keys, (void **)&edk_2, i));
+        TEST_ASSERT_ADDR_NULL(edk_1->ciphertext.allocator);
+        TEST_ASSERT_ADDR_EQ(edk_1->ciphertext.buffer, edk_2->ciphertext.buffer);
+    }
+
+    /* The borrowed EDKs stay valid after the entry and the cache are gone */
+    aws_cryptosdk_materials_cache_release(cache);
+    aws_cryptosdk_enc_materials_destroy(hit_1);
+    TEST_ASSERT(materials_eq(enc_mat, hit_2));
+
+    aws_cryptosdk_enc_materials_destroy(hit_2);
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_byte_buf_clean_up(&cache_id);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_enc_ctx_clean_up(&hit_ctx);
+
+    return 0;
+}
+
+static int test_set_capacity() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new_sharded(alloc, 8, 2);
+
+    for (int i = 0; i < 8; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+
+    /* Raising the capacity regrows the tables, keeping the entries already held */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_capacity(cache, 64));
+    TEST_ASSERT_INT_EQ(64, aws_cryptosdk_materials_cache_local_get_capacity(cache));
+    for (int i = 8; i < 40; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_INT_EQ(40, aws_cryptosdk_materials_cache_entry_count(cache));
+    for (int i = 0; i < 40; i++) {
+        if (check_enc_entry(cache, i, true, false, NULL)) return 1;
+    }
+
+    /* Lowering it evicts straight away, down to the minimum of two entries per shard */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_capacity(cache, 0));
+    TEST_ASSERT_INT_EQ(4, aws_cryptosdk_materials_cache_local_get_capacity(cache));
+    TEST_ASSERT(aws_cryptosdk_materials_cache_entry_count(cache) <= 4);
+
+    for (int i = 0; i < 100; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT(aws_cryptosdk_materials_cache_entry_count(cache) <= 4);
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+/* Looks up each of the first count entries in turn, rounds times over, inserting those missing */
+static void cycle_entries(struct aws_cryptosdk_materials_cache *cache, int count, int rounds) {
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < count; i++) {
+            if (!enc_entry_present(cache, i)) insert_enc_entry(cache, i, NULL);
+        }
+    }
+}
+
+static int test_auto_capacity() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 8);
+    struct aws_cryptosdk_materials_cache_stats stats;
+
+    /* Tuning does nothing until it is turned on */
+    cycle_entries(cache, 12, 8);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_tune_capacity(cache));
+    TEST_ASSERT_INT_EQ(8, aws_cryptosdk_materials_cache_local_get_capacity(cache));
+
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_materials_cache_local_set_auto_capacity(cache, 8, 4, 0));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_auto_capacity(cache, 4, 64, 0));
+
+    /* A loop over more entries than fit misses on entries just evicted, so the cache grows to hold it */
+    for (int pass = 0; pass < 8; pass++) {
+        cycle_entries(cache, 12, 8);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_tune_capacity(cache));
+    }
+    size_t capacity = aws_cryptosdk_materials_cache_local_get_capacity(cache);
+    TEST_ASSERT(capacity >= 12 && capacity < 64);
+    for (int i = 0; i < 12; i++) {
+        TEST_ASSERT(enc_entry_present(cache, i));
+    }
+
+    /* Passes with too few lookups to judge by change nothing */
+    aws_cryptosdk_materials_cache_clear(cache);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_tune_capacity(cache));
+    TEST_ASSERT_INT_EQ(capacity, aws_cryptosdk_materials_cache_local_get_capacity(cache));
+
+    /* A mostly empty cache without ghost hits shrinks, but not below the minimum */
+    for (int pass = 0; pass < 8; pass++) {
+        cycle_entries(cache, 1, 64);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_tune_capacity(cache));
+    }
+    TEST_ASSERT_INT_EQ(4, aws_cryptosdk_materials_cache_local_get_capacity(cache));
+
+    /* The byte ceiling holds growth back */
+    for (int i = 0; i < 4; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(4, stats.entries);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_materials_cache_local_set_auto_capacity(cache, 2, 64, (size_t)(stats.bytes / 4 * 6)));
+    for (int pass = 0; pass < 8; pass++) {
+        cycle_entries(cache, 12, 8);
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_tune_capacity(cache));
+    }
+    TEST_ASSERT(aws_cryptosdk_materials_cache_local_get_capacity(cache) <= 8);
+
+    /* Turning tuning off leaves the capacity where it is */
+    capacity = aws_cryptosdk_materials_cache_local_get_capacity(cache);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_auto_capacity(cache, 0, 0, 0));
+    cycle_entries(cache, 12, 8);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_tune_capacity(cache));
+    TEST_ASSERT_INT_EQ(capacity, aws_cryptosdk_materials_cache_local_get_capacity(cache));
+
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+struct removal_log {
+    struct aws_cryptosdk_materials_cache *cache;
+    int count;
+    enum aws_cryptosdk_local_cache_removal_reason reasons[16];
+    int indices[16];
+    bool partitioned[16];
+    size_t entries_seen;
+};
+
+static void log_removal(const struct aws_cryptosdk_local_cache_removal *removal, void *user_data) {
+    struct removal_log *log = user_data;
+    char cache_id[32]       = { 0 };
+
+    if (log->count == 16 || removal->cache_id.len >= sizeof(cache_id)) abort();
+    memcpy(cache_id, removal->cache_id.ptr, removal->cache_id.len);
+    if (sscanf(cache_id, "ID %d", &log->indices[log->count]) != 1) abort();
+
+    log->reasons[log->count]     = removal->reason;
+    log->partitioned[log->count] = aws_byte_cursor_eq_c_str(&removal->partition_id, "tenant a");
+    if (!removal->is_encrypt) abort();
+    log->count++;
+
+    /* None of the cache's locks are held, so the callback may use it */
+    log->entries_seen = aws_cryptosdk_materials_cache_entry_count(log->cache);
+}
+
+static int test_removal_callback() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 4);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    struct removal_log log = { 0 };
+
+    log.cache = cache;
+
+    /* Without a callback, nothing is queued */
+    for (int i = 0; i < 5; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_removal_callback(cache, log_removal, &log));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_deliver_removals(cache));
+    TEST_ASSERT_INT_EQ(0, log.count);
+
+    /* Removals wait for delivery */
+    insert_enc_entry(cache, 5, NULL);
+    TEST_ASSERT_INT_EQ(0, log.count);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_deliver_removals(cache));
+    TEST_ASSERT_INT_EQ(1, log.count);
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_CAPACITY, log.reasons[0]);
+    TEST_ASSERT_INT_EQ(1, log.indices[0]);
+    TEST_ASSERT(!log.partitioned[0]);
+    TEST_ASSERT_INT_EQ(4, log.entries_seen);
+
+    insert_enc_entry(cache, 5, NULL);
+    if (check_enc_entry(cache, 2, true, true, NULL)) return 1;
+    insert_partitioned_entry(cache, 6, "tenant a");
+    aws_cryptosdk_materials_cache_clear(cache);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_deliver_removals(cache));
+
+    TEST_ASSERT_INT_EQ(7, log.count);
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_REPLACED, log.reasons[1]);
+    TEST_ASSERT_INT_EQ(5, log.indices[1]);
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_INVALIDATED, log.reasons[2]);
+    TEST_ASSERT_INT_EQ(2, log.indices[2]);
+    for (int i = 3; i < 7; i++) {
+        TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_LOCAL_CACHE_REMOVED_CLEARED, log.reasons[i]);
+        TEST_ASSERT(log.partitioned[i] == (log.indices[i] == 6));
+    }
+    TEST_ASSERT_INT_EQ(0, log.entries_seen);
+
+    /* Removing the callback stops the queueing again */
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_removal_callback(cache, NULL, NULL));
+    for (int i = 0; i < 8; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_set_removal_callback(cache, log_removal, &log));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_local_deliver_removals(cache));
+    TEST_ASSERT_INT_EQ(7, log.count);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(0, stats.removals_dropped);
+
+    /* Removals still queued are freed along with the cache */
+    aws_cryptosdk_materials_cache_clear(cache);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_entry_arenas() {
+    struct aws_allocator *alloc = aws_cryptosdk_instrumented_allocator_new(aws_default_allocator());
+    TEST_ASSERT_ADDR_NOT_NULL(alloc);
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_local_new(alloc, 4);
+    struct aws_cryptosdk_alloc_stats stats;
+
+    /*
+     * Once the slots are carved out, an entry's copies take no allocations of their own; only its
+     * EDK snapshot and signing key do
+     */
+    for (int i = 0; i < 8; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_reset(alloc));
+    for (int i = 8; i < 108; i++) {
+        insert_enc_entry(cache, i, NULL);
+    }
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_get_stats(alloc, &stats));
+    TEST_ASSERT(stats.by_tag[AWS_CRYPTOSDK_ALLOC_CACHE].allocs <= 100 * 2);
+    for (int i = 104; i < 108; i++) {
+        if (check_enc_entry(cache, i, true, false, NULL)) return 1;
+    }
+
+    /* An encryption context too large for the slot spills over into further chunks */
+    AWS_STATIC_STRING_FROM_LITERAL(big_key, "big");
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    struct aws_cryptosdk_enc_materials *enc_mat, *cached_materials = NULL;
+    struct aws_cryptosdk_cache_usage_stats usage = { 0, 0 };
+    struct aws_hash_table enc_ctx, cached_context;
+    struct aws_byte_buf cache_id;
+    char big_value[4096];
+
+    memset(big_value, 'x', sizeof(big_value) - 1);
+    big_value[sizeof(big_value) - 1] = 0;
+    TEST_ASSERT_SUCCESS(setup_enc_params(200, &enc_mat, &enc_ctx, &cache_id));
+    TEST_ASSERT_SUCCESS(
+        aws_hash_table_put(&enc_ctx, big_key, aws_string_new_from_c_str(aws_default_allocator(), big_value), NULL));
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat, usage, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &cached_context));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, NULL, &cache_id));
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_enc_materials(
+        cache, aws_default_allocator(), &cached_materials, &cached_context, entry));
+    TEST_ASSERT(materials_eq(enc_mat, cached_materials));
+    TEST_ASSERT(aws_hash_table_eq(&enc_ctx, &cached_context, aws_hash_callback_string_eq));
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_cryptosdk_enc_materials_destroy(cached_materials);
+    aws_byte_buf_clean_up(&cache_id);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_enc_ctx_clean_up(&cached_context);
+
+    /* Slots, arenas and all go with the cache */
+    aws_cryptosdk_materials_cache_release(cache);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_instrumented_allocator_get_stats(alloc, &stats));
+    TEST_ASSERT_INT_EQ(0, stats.total.live_bytes);
+    aws_cryptosdk_instrumented_allocator_destroy(alloc);
+
+    return 0;
+}
+
 #define TEST_CASE(name) \
     { "local_cache", #name, name }
 struct test_case local_cache_test_cases[] = { TEST_CASE(create_destroy),
@@ -572,4 +1469,21 @@ struct test_case local_cache_test_cases[] = { TEST_CASE(create_destroy),
                                               TEST_CASE(hash_truncation),
                                               TEST_CASE(test_decrypt_entries),
                                               TEST_CASE(test_materials_cache_entry_count),
+                                              TEST_CASE(test_sharded),
+                                              TEST_CASE(test_sharded_threads),
+                                              TEST_CASE(test_hit_buffer),
+                                              TEST_CASE(test_clock_eviction),
+                                              TEST_CASE(test_ttl_wheel),
+                                              TEST_CASE(test_maintenance),
+                                              TEST_CASE(test_stats),
+                                              TEST_CASE(test_byte_limit),
+                                              TEST_CASE(test_table_churn),
+                                              TEST_CASE(test_partition_quota),
+                                              TEST_CASE(test_invalidate_partition),
+                                              TEST_CASE(test_clock_precision),
+                                              TEST_CASE(test_shared_edks),
+                                              TEST_CASE(test_set_capacity),
+                                              TEST_CASE(test_auto_capacity),
+                                              TEST_CASE(test_removal_callback),
+                                              TEST_CASE(test_entry_arenas),
                                               { NULL } };
@@ -33,10 +33,10 @@ int default_cmm_zero_keyring_enc_mat() {
 
     aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx);
 
-    struct aws_cryptosdk_enc_request req;
-    req.enc_ctx       = &enc_ctx;
-    req.requested_alg = 0;
-    req.alloc         = aws_default_allocator();
+    struct aws_cryptosdk_enc_request req = { 0 };
+    req.enc_ctx                          = &enc_ctx;
+    req.requested_alg                    = 0;
+    req.alloc                            = aws_default_allocator();
 
     aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_IV12_TAG16_NO_KDF);
 
@@ -74,8 +74,8 @@ int default_cmm_zero_keyring_dec_mat() {
     struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
     struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
 
-    struct aws_cryptosdk_dec_request req;
-    req.alg   = ALG_AES192_GCM_IV12_TAG16_NO_KDF;
+    struct aws_cryptosdk_dec_request req = { 0 };
+    req.alg                              = ALG_AES192_GCM_IV12_TAG16_NO_KDF;
     req.alloc = aws_default_allocator();
 
     TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_list_init(alloc, &req.encrypted_data_keys));
@@ -100,6 +100,63 @@ int default_cmm_zero_keyring_dec_mat() {
     return 0;
 }
 
+int default_cmm_reuses_spare_materials() {
+    struct aws_hash_table enc_ctx;
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm    = aws_cryptosdk_default_cmm_new(alloc, kr);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_IV12_TAG16_NO_KDF));
+    aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx);
+
+    struct aws_cryptosdk_enc_request req = { 0 };
+    req.enc_ctx                          = &enc_ctx;
+    req.alloc                            = alloc;
+
+    struct aws_cryptosdk_enc_materials *enc_mat, *spare = NULL;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(cmm, &enc_mat, &req));
+    void *edk_storage = enc_mat->encrypted_data_keys.data;
+
+    // Recycling empties the materials but keeps their list storage
+    aws_cryptosdk_enc_materials_recycle(&spare, enc_mat);
+    TEST_ASSERT_ADDR_EQ(spare, enc_mat);
+    TEST_ASSERT_ADDR_NULL(spare->unencrypted_data_key.buffer);
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&spare->encrypted_data_keys), 0);
+    TEST_ASSERT_ADDR_EQ(spare->encrypted_data_keys.data, edk_storage);
+
+    // The default CMM takes the spare from the request in place of allocating
+    req.requested_alg   = 0;
+    req.spare_materials = spare;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(cmm, &enc_mat, &req));
+    TEST_ASSERT_ADDR_EQ(enc_mat, spare);
+    TEST_ASSERT_ADDR_NULL(req.spare_materials);
+    TEST_ASSERT_INT_EQ(enc_mat->unencrypted_data_key.len, 32);
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&enc_mat->encrypted_data_keys), 1);
+
+    // A spare from another allocator is left for the caller
+    spare = NULL;
+    aws_cryptosdk_enc_materials_recycle(&spare, enc_mat);
+    struct aws_cryptosdk_dec_materials *dec_spare = NULL;
+    struct aws_cryptosdk_dec_materials *dec_mat   = aws_cryptosdk_dec_materials_new(alloc, req.requested_alg);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_mat);
+    aws_cryptosdk_dec_materials_recycle(&dec_spare, dec_mat);
+
+    struct aws_allocator other = *alloc;
+    TEST_ASSERT_ADDR_NOT_NULL(enc_mat = aws_cryptosdk_enc_materials_new_from_spare(&spare, &other, req.requested_alg));
+    TEST_ASSERT(enc_mat != spare);
+    TEST_ASSERT_ADDR_EQ(dec_mat, aws_cryptosdk_dec_materials_new_from_spare(&dec_spare, alloc, req.requested_alg));
+    TEST_ASSERT_ADDR_NULL(dec_spare);
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_cryptosdk_enc_materials_destroy(spare);
+    aws_cryptosdk_dec_materials_destroy(dec_mat);
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    return 0;
+}
+
 int default_cmm_alg_mismatch() {
     struct aws_hash_table enc_ctx;
     struct aws_allocator *alloc      = aws_default_allocator();
@@ -108,10 +165,10 @@ int default_cmm_alg_mismatch() {
 
     aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx);
 
-    struct aws_cryptosdk_enc_request req;
-    req.enc_ctx       = &enc_ctx;
-    req.requested_alg = ALG_AES192_GCM_IV12_TAG16_NO_KDF;
-    req.alloc         = aws_default_allocator();
+    struct aws_cryptosdk_enc_request req = { 0 };
+    req.enc_ctx                          = &enc_ctx;
+    req.requested_alg                    = ALG_AES192_GCM_IV12_TAG16_NO_KDF;
+    req.alloc                            = aws_default_allocator();
 
     aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES128_GCM_IV12_TAG16_NO_KDF);
 
@@ -138,10 +195,10 @@ int default_cmm_alg_match() {
 
     aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx);
 
-    struct aws_cryptosdk_enc_request req;
-    req.enc_ctx       = &enc_ctx;
-    req.requested_alg = ALG_AES192_GCM_IV12_TAG16_NO_KDF;
-    req.alloc         = aws_default_allocator();
+    struct aws_cryptosdk_enc_request req = { 0 };
+    req.enc_ctx                          = &enc_ctx;
+    req.requested_alg                    = ALG_AES192_GCM_IV12_TAG16_NO_KDF;
+    req.alloc                            = aws_default_allocator();
 
     aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES192_GCM_IV12_TAG16_NO_KDF);
 
@@ -184,10 +241,10 @@ int default_cmm_context_presence() {
 
         aws_cryptosdk_enc_ctx_clear(&enc_ctx);
 
-        struct aws_cryptosdk_enc_request req;
-        req.enc_ctx       = &enc_ctx;
-        req.requested_alg = 0;
-        req.alloc         = aws_default_allocator();
+        struct aws_cryptosdk_enc_request req = { 0 };
+        req.enc_ctx                          = &enc_ctx;
+        req.requested_alg                    = 0;
+        req.alloc                            = aws_default_allocator();
 
         aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id);
 
@@ -218,7 +275,7 @@ int default_cmm_context_presence() {
 
 int default_cmm_signer_key_in_enc_ctx() {
     struct aws_hash_table enc_ctx;
-    struct aws_cryptosdk_enc_request req;
+    struct aws_cryptosdk_enc_request req = { 0 };
     struct aws_cryptosdk_enc_materials *enc_mat;
     struct aws_allocator *alloc      = aws_default_allocator();
     struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
@@ -242,6 +299,44 @@ int default_cmm_signer_key_in_enc_ctx() {
     return 0;
 }
 
+int default_cmm_sig_key_pool() {
+    struct aws_hash_table enc_ctx;
+    struct aws_cryptosdk_enc_request req = { 0 };
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    struct aws_hash_element *pElement = NULL;
+    struct aws_allocator *alloc       = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr  = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_cryptosdk_cmm *cmm     = aws_cryptosdk_default_cmm_new(alloc, kr);
+    AWS_STATIC_STRING_FROM_LITERAL(EC_PUBLIC_KEY_FIELD, "aws-crypto-public-key");
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_sig_key_pool_depth(cmm, 4));
+
+    for (int i = 0; i < 8; i++) {
+        aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx);
+        req.enc_ctx       = &enc_ctx;
+        req.requested_alg = 0;
+        req.alloc         = alloc;
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_cmm_generate_enc_materials(cmm, &enc_mat, &req));
+        TEST_ASSERT_ADDR_NOT_NULL(enc_mat->signctx);
+        TEST_ASSERT_SUCCESS(aws_hash_table_find(&enc_ctx, EC_PUBLIC_KEY_FIELD, &pElement));
+        TEST_ASSERT_ADDR_NOT_NULL(pElement);
+
+        aws_cryptosdk_enc_materials_destroy(enc_mat);
+        aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    }
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_sig_key_pool_depth(cmm, 0));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT_ERROR(AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_default_cmm_set_sig_key_pool_depth(cmm, 4));
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(kr);
+
+    return 0;
+}
+
 int zero_size_cmm_does_not_run_vfs() {
     struct aws_cryptosdk_cmm cmm = aws_cryptosdk_zero_size_cmm();
     TEST_ASSERT_ERROR(AWS_ERROR_UNIMPLEMENTED, aws_cryptosdk_cmm_generate_enc_materials(&cmm, NULL, NULL));
@@ -470,13 +565,115 @@ int on_decrypt_postcondition_violation() {
     return 0;
 }
 
+int edk_clone_is_packed() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_edk src, packed, clone;
+
+    AWS_ZERO_STRUCT(src);
+    src.provider_id = aws_byte_buf_from_c_str("provider");
+    src.ciphertext  = aws_byte_buf_from_c_str("ciphertext");
+
+    // Empty fields take no space, and only the first non-empty field owns the allocation
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_init_packed(alloc, &packed, 0, 4, 16));
+    TEST_ASSERT_ADDR_NULL(packed.provider_id.buffer);
+    TEST_ASSERT_ADDR_EQ(alloc, packed.provider_info.allocator);
+    TEST_ASSERT_ADDR_NULL(packed.ciphertext.allocator);
+    TEST_ASSERT_ADDR_EQ(packed.provider_info.buffer + 4, packed.ciphertext.buffer);
+    TEST_ASSERT_INT_EQ(16, packed.ciphertext.capacity);
+    TEST_ASSERT_INT_EQ(0, packed.ciphertext.len);
+    aws_cryptosdk_edk_clean_up(&packed);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_init_packed(alloc, &packed, 0, 0, 0));
+    TEST_ASSERT(aws_cryptosdk_edk_is_valid(&packed));
+    aws_cryptosdk_edk_clean_up(&packed);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_init_clone(alloc, &clone, &src));
+    TEST_ASSERT(aws_cryptosdk_edk_eq(&src, &clone));
+    TEST_ASSERT_ADDR_EQ(alloc, clone.provider_id.allocator);
+    TEST_ASSERT_ADDR_NULL(clone.ciphertext.allocator);
+    TEST_ASSERT_ADDR_EQ(clone.provider_id.buffer + src.provider_id.len, clone.ciphertext.buffer);
+    aws_cryptosdk_edk_clean_up(&clone);
+
+    return 0;
+}
+
+int edk_record() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_edk src, record, view, clone;
+    uint8_t out_bytes[64];
+    struct aws_byte_buf out = aws_byte_buf_from_empty_array(out_bytes, sizeof(out_bytes));
+    static const uint8_t expected[] = { 0, 8, 'p', 'r', 'o', 'v', 'i', 'd', 'e', 'r', 0, 0, 0, 4, 'c', 'i', 'p', 'h' };
+
+    AWS_ZERO_STRUCT(src);
+    src.provider_id = aws_byte_buf_from_c_str("provider");
+    src.ciphertext  = aws_byte_buf_from_c_str("ciph");
+    TEST_ASSERT(!aws_cryptosdk_edk_has_record(&src));
+    TEST_ASSERT_INT_EQ(sizeof(expected), aws_cryptosdk_edk_record_size(&src));
+
+    // The lengths are written up front, and the fields are empty views into the record
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_init_record(alloc, &record, 8, 0, 4));
+    TEST_ASSERT_ADDR_EQ(alloc, record.record.allocator);
+    TEST_ASSERT_ADDR_NULL(record.provider_id.allocator);
+    TEST_ASSERT_ADDR_NULL(record.provider_info.buffer);
+    TEST_ASSERT_ADDR_EQ(record.record.buffer + 2, record.provider_id.buffer);
+    TEST_ASSERT_ADDR_EQ(record.record.buffer + 14, record.ciphertext.buffer);
+    TEST_ASSERT(!aws_cryptosdk_edk_has_record(&record));
+
+    TEST_ASSERT(aws_byte_buf_write_from_whole_buffer(&record.provider_id, src.provider_id));
+    TEST_ASSERT(aws_byte_buf_write_from_whole_buffer(&record.ciphertext, src.ciphertext));
+    TEST_ASSERT(aws_cryptosdk_edk_has_record(&record));
+    TEST_ASSERT(aws_cryptosdk_edk_eq(&src, &record));
+    TEST_ASSERT_INT_EQ(sizeof(expected), record.record.len);
+    TEST_ASSERT(!memcmp(expected, record.record.buffer, sizeof(expected)));
+
+    // Both forms serialize the same way
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_write_record(&out, &src));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_write_record(&out, &record));
+    TEST_ASSERT_INT_EQ(2 * sizeof(expected), out.len);
+    TEST_ASSERT(!memcmp(expected, out.buffer, sizeof(expected)));
+    TEST_ASSERT(!memcmp(expected, out.buffer + sizeof(expected), sizeof(expected)));
+
+    out.len = sizeof(out_bytes) - sizeof(expected) + 1;
+    TEST_ASSERT_ERROR(AWS_ERROR_SHORT_BUFFER, aws_cryptosdk_edk_write_record(&out, &record));
+    TEST_ASSERT_INT_EQ(sizeof(out_bytes) - sizeof(expected) + 1, out.len);
+
+    // A view of serialized bytes is a record, and so is its clone
+    struct aws_byte_cursor cursor = aws_byte_cursor_from_array(out_bytes, sizeof(expected) + 1);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_init_view(&view, &cursor));
+    TEST_ASSERT_INT_EQ(1, cursor.len);
+    TEST_ASSERT(aws_cryptosdk_edk_has_record(&view));
+    TEST_ASSERT(aws_cryptosdk_edk_eq(&src, &view));
+    TEST_ASSERT_ERROR(AWS_ERROR_SHORT_BUFFER, aws_cryptosdk_edk_init_view(&view, &cursor));
+    TEST_ASSERT_INT_EQ(1, cursor.len);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_init_clone(alloc, &clone, &record));
+    TEST_ASSERT(aws_cryptosdk_edk_has_record(&clone));
+    TEST_ASSERT(aws_cryptosdk_edk_eq(&src, &clone));
+    TEST_ASSERT_ADDR_NE(record.record.buffer, clone.record.buffer);
+    aws_cryptosdk_edk_clean_up(&clone);
+
+    // Once a field no longer lies in the record, the record is no longer used
+    record.ciphertext = aws_byte_buf_from_c_str("text");
+    TEST_ASSERT(!aws_cryptosdk_edk_has_record(&record));
+    out.len = 0;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_write_record(&out, &record));
+    TEST_ASSERT(!memcmp("text", out.buffer + 14, 4));
+    aws_cryptosdk_edk_clean_up(&record);
+
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED, aws_cryptosdk_edk_init_record(alloc, &record, 0, 0, 65536));
+
+    return 0;
+}
+
 struct test_case materials_test_cases[] = {
     { "materials", "default_cmm_zero_keyring_enc_mat", default_cmm_zero_keyring_enc_mat },
     { "materials", "default_cmm_zero_keyring_dec_mat", default_cmm_zero_keyring_dec_mat },
+    { "materials", "default_cmm_reuses_spare_materials", default_cmm_reuses_spare_materials },
     { "materials", "default_cmm_alg_mismatch", default_cmm_alg_mismatch },
     { "materials", "default_cmm_alg_match", default_cmm_alg_match },
     { "materials", "default_cmm_context_presence", default_cmm_context_presence },
     { "materials", "default_cmm_signer_key_in_enc_ctx", default_cmm_signer_key_in_enc_ctx },
+    { "materials", "default_cmm_sig_key_pool", default_cmm_sig_key_pool },
     { "materials", "zero_size_cmm_does_not_run_vfs", zero_size_cmm_does_not_run_vfs },
     { "materials", "null_cmm_fails_vf_calls_cleanly", null_cmm_fails_vf_calls_cleanly },
     { "materials", "null_materials_release_is_noop", null_materials_release_is_noop },
@@ -487,5 +684,7 @@ struct test_case materials_test_cases[] = {
     { "materials", "on_encrypt_postcondition_violation", on_encrypt_postcondition_violation },
     { "materials", "on_decrypt_precondition_violation", on_decrypt_precondition_violation },
     { "materials", "on_decrypt_postcondition_violation", on_decrypt_postcondition_violation },
+    { "materials", "edk_clone_is_packed", edk_clone_is_packed },
+    { "materials", "edk_record", edk_record },
     { NULL }
 };
@@ -13,6 +13,7 @@
  * limitations under the License.
  */
 #include <aws/cryptosdk/multi_keyring.h>
+#include "task_threads.h"
 #include "test_keyring.h"
 #include "testing.h"
 #include "testutil.h"
@@ -20,7 +21,8 @@
 static struct aws_allocator *alloc;
 
 // test_keyring[0] used as generator, rest used as children
-static struct test_keyring test_keyrings[5];
+#define NUM_TEST_KEYRINGS 5
+static struct test_keyring test_keyrings[NUM_TEST_KEYRINGS];
 static const size_t num_test_keyrings = sizeof(test_keyrings) / sizeof(struct test_keyring);
 static struct aws_cryptosdk_keyring *multi;
 static struct aws_array_list edks;
@@ -192,6 +194,111 @@ int on_encrypt_fails_when_generator_does_not_generate() {
     return 0;
 }
 
+int parallel_children_merged_in_order() {
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    aws_cryptosdk_multi_keyring_set_executor(multi, aws_cryptosdk_test_thread_per_task_executor, NULL);
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_encrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    aws_cryptosdk_test_join_task_threads();
+
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&edks), num_test_keyrings);
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_encrypt_called);
+        uint32_t flags = AWS_CRYPTOSDK_WRAPPING_KEY_ENCRYPTED_DATA_KEY;
+        if (!kr_idx) flags |= AWS_CRYPTOSDK_WRAPPING_KEY_GENERATED_DATA_KEY;
+        TEST_ASSERT_SUCCESS(assert_keyring_trace_record(&keyring_trace, kr_idx, NULL, NULL, flags));
+    }
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+int parallel_children_fail_after_all_called() {
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    aws_cryptosdk_multi_keyring_set_executor(multi, aws_cryptosdk_test_thread_per_task_executor, NULL);
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+
+    test_keyrings[2].ret = AWS_OP_ERR;
+
+    TEST_ASSERT_INT_EQ(
+        AWS_OP_ERR,
+        aws_cryptosdk_keyring_on_encrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    aws_cryptosdk_test_join_task_threads();
+
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_encrypt_called);
+    }
+    TEST_ASSERT(!aws_array_list_length(&edks));
+    TEST_ASSERT(!aws_array_list_length(&keyring_trace));
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+static bool is_wiped(const char *key, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (key[i]) return false;
+    }
+    return true;
+}
+
+int parallel_decrypt_takes_first_key_and_wipes_others() {
+    char key_a[] = "keyAkeyAkeyAkeyAkeyAkeyAkeyAkeyA";
+    char key_b[] = "keyBkeyBkeyBkeyBkeyBkeyBkeyBkeyB";
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    aws_cryptosdk_multi_keyring_set_executor(multi, aws_cryptosdk_test_thread_per_task_executor, NULL);
+    aws_cryptosdk_multi_keyring_set_parallel_decrypt(multi, true);
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+
+    test_keyrings[1].decrypted_data_key_to_return = aws_byte_buf_from_c_str(key_a);
+    test_keyrings[2].ret                          = AWS_OP_ERR;
+    test_keyrings[3].decrypted_data_key_to_return = aws_byte_buf_from_c_str(key_b);
+
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    aws_cryptosdk_test_join_task_threads();
+
+    TEST_ASSERT(unencrypted_data_key.buffer == (uint8_t *)key_a || unencrypted_data_key.buffer == (uint8_t *)key_b);
+    size_t loser    = unencrypted_data_key.buffer == (uint8_t *)key_a ? 3 : 1;
+    char *loser_key = loser == 3 ? key_b : key_a;
+    // The other key is wiped if its keyring was called before the race was decided
+    if (test_keyrings[loser].on_decrypt_called) TEST_ASSERT(is_wiped(loser_key, sizeof(key_a) - 1));
+    TEST_ASSERT(!is_wiped((const char *)unencrypted_data_key.buffer, unencrypted_data_key.len));
+
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&keyring_trace), 1);
+    TEST_ASSERT_SUCCESS(
+        assert_keyring_trace_record(&keyring_trace, 0, NULL, NULL, AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+int parallel_decrypt_fails_after_all_called() {
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    aws_cryptosdk_multi_keyring_set_executor(multi, aws_cryptosdk_test_thread_per_task_executor, NULL);
+    aws_cryptosdk_multi_keyring_set_parallel_decrypt(multi, true);
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+
+    test_keyrings[2].ret = AWS_OP_ERR;
+
+    TEST_ASSERT_INT_EQ(
+        AWS_OP_ERR,
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    aws_cryptosdk_test_join_task_threads();
+
+    TEST_ASSERT_ADDR_NULL(unencrypted_data_key.buffer);
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_decrypt_called);
+    }
+    TEST_ASSERT(!aws_array_list_length(&keyring_trace));
+
+    tear_down_all_the_things();
+    return 0;
+}
+
 int fail_on_failed_encrypt_and_stop() {
     TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
     struct aws_byte_buf unencrypted_data_key = { 0 };
@@ -315,6 +422,168 @@ int delegates_decrypt_calls() {
     return 0;
 }
 
+/* Test keyrings using this describe their EDKs as having provider ID "provider N", for index N */
+static int numbered_get_edk_filter(
+    const struct aws_cryptosdk_keyring *kr,
+    struct aws_byte_cursor *provider_id,
+    struct aws_byte_cursor *provider_info_prefix) {
+    static const char *provider_ids[] = { "provider 0", "provider 1", "provider 2", "provider 3", "provider 4" };
+    size_t kr_idx                     = (const struct test_keyring *)kr - test_keyrings;
+
+    *provider_id          = aws_byte_cursor_from_c_str(provider_ids[kr_idx]);
+    *provider_info_prefix = aws_byte_cursor_from_c_str("key");
+    return AWS_OP_SUCCESS;
+}
+
+int decrypt_routes_edks_by_provider() {
+    static struct aws_cryptosdk_keyring_vt numbered_vt;
+    numbered_vt                = test_keyring_vt;
+    numbered_vt.get_edk_filter = numbered_get_edk_filter;
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(false));
+    // Rebuild the multi-keyring, with children 1 and 2 describing their EDKs
+    aws_cryptosdk_keyring_release(multi);
+    multi = aws_cryptosdk_multi_keyring_new(alloc, NULL);
+    TEST_ASSERT_ADDR_NOT_NULL(multi);
+    test_keyrings[1].base.vtable = &numbered_vt;
+    test_keyrings[2].base.vtable = &numbered_vt;
+    for (size_t kr_idx = 1; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT_SUCCESS(
+            aws_cryptosdk_multi_keyring_add_child(multi, (struct aws_cryptosdk_keyring *)(test_keyrings + kr_idx)));
+    }
+    test_keyrings[2].decrypted_data_key_to_return = aws_byte_buf_from_c_str(test_data_key);
+
+    struct aws_cryptosdk_edk edk = { .provider_id   = aws_byte_buf_from_c_str("provider 2"),
+                                     .provider_info = aws_byte_buf_from_c_str("key 2"),
+                                     .ciphertext    = aws_byte_buf_from_c_str("ciphertext") };
+    TEST_ASSERT_SUCCESS(aws_array_list_push_back(&edks, &edk));
+
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+
+    // Child 1 has no EDKs in the message, so only child 2 is tried
+    TEST_ASSERT(!test_keyrings[1].on_decrypt_called);
+    TEST_ASSERT(test_keyrings[2].on_decrypt_called);
+    TEST_ASSERT(!test_keyrings[3].on_decrypt_called);
+
+    // Without an EDK for either, both are skipped, while the others are still tried
+    test_keyrings[2].on_decrypt_called = false;
+    edk.provider_info                  = aws_byte_buf_from_c_str("other 2");
+    TEST_ASSERT_SUCCESS(aws_array_list_set_at(&edks, &edk, 0));
+    unencrypted_data_key = (struct aws_byte_buf){ 0 };
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_NULL(unencrypted_data_key.buffer);
+    TEST_ASSERT(!test_keyrings[1].on_decrypt_called);
+    TEST_ASSERT(!test_keyrings[2].on_decrypt_called);
+    TEST_ASSERT(test_keyrings[3].on_decrypt_called);
+    TEST_ASSERT(test_keyrings[4].on_decrypt_called);
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+int may_decrypt_consults_index_and_children() {
+    static struct aws_cryptosdk_keyring_vt numbered_vt;
+    numbered_vt                = test_keyring_vt;
+    numbered_vt.get_edk_filter = numbered_get_edk_filter;
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(false));
+    aws_cryptosdk_keyring_release(multi);
+    multi = aws_cryptosdk_multi_keyring_new(alloc, NULL);
+    TEST_ASSERT_ADDR_NOT_NULL(multi);
+    test_keyrings[1].base.vtable = &numbered_vt;
+    test_keyrings[2].base.vtable = &numbered_vt;
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_multi_keyring_add_child(multi, (struct aws_cryptosdk_keyring *)&test_keyrings[1]));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_multi_keyring_add_child(multi, (struct aws_cryptosdk_keyring *)&test_keyrings[2]));
+
+    struct aws_cryptosdk_edk edk = { .provider_id   = aws_byte_buf_from_c_str("provider 2"),
+                                     .provider_info = aws_byte_buf_from_c_str("key 2"),
+                                     .ciphertext    = aws_byte_buf_from_c_str("ciphertext") };
+    TEST_ASSERT(!aws_cryptosdk_keyring_may_decrypt(multi, &edks));
+    TEST_ASSERT_SUCCESS(aws_array_list_push_back(&edks, &edk));
+    TEST_ASSERT(aws_cryptosdk_keyring_may_decrypt(multi, &edks));
+    TEST_ASSERT(aws_cryptosdk_keyring_may_decrypt((struct aws_cryptosdk_keyring *)&test_keyrings[2], &edks));
+    TEST_ASSERT(!aws_cryptosdk_keyring_may_decrypt((struct aws_cryptosdk_keyring *)&test_keyrings[1], &edks));
+
+    // Neither indexed child has an EDK with this provider info
+    edk.provider_info = aws_byte_buf_from_c_str("other 2");
+    TEST_ASSERT_SUCCESS(aws_array_list_set_at(&edks, &edk, 0));
+    TEST_ASSERT(!aws_cryptosdk_keyring_may_decrypt(multi, &edks));
+
+    // A child which does not describe its EDKs may decrypt anything
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_multi_keyring_add_child(multi, (struct aws_cryptosdk_keyring *)&test_keyrings[3]));
+    TEST_ASSERT(aws_cryptosdk_keyring_may_decrypt(multi, &edks));
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+static void reset_decrypt_flags() {
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        test_keyrings[kr_idx].on_decrypt_called = false;
+    }
+}
+
+int adaptive_decrypt_tries_successful_child_first() {
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_multi_keyring_set_decrypt_order(multi, (enum aws_cryptosdk_multi_keyring_decrypt_order)42));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_multi_keyring_set_decrypt_order(multi, AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_ADAPTIVE));
+
+    const size_t successful_keyring = num_test_keyrings - 1;
+
+    test_keyrings[successful_keyring].decrypted_data_key_to_return = aws_byte_buf_from_c_str(test_data_key);
+    struct aws_cryptosdk_edk edk = { .provider_id   = aws_byte_buf_from_c_str("provider"),
+                                     .provider_info = aws_byte_buf_from_c_str("key"),
+                                     .ciphertext    = aws_byte_buf_from_c_str("ciphertext") };
+    TEST_ASSERT_SUCCESS(aws_array_list_push_back(&edks, &edk));
+
+    // With no history, every keyring is tried in order
+    struct aws_byte_buf unencrypted_data_key = { 0 };
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT(test_keyrings[kr_idx].on_decrypt_called);
+    }
+
+    // Then the generator, followed by the child which succeeded
+    reset_decrypt_flags();
+    unencrypted_data_key = (struct aws_byte_buf){ 0 };
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+    TEST_ASSERT(test_keyrings[0].on_decrypt_called);
+    for (size_t kr_idx = 1; kr_idx < successful_keyring; ++kr_idx) {
+        TEST_ASSERT(!test_keyrings[kr_idx].on_decrypt_called);
+    }
+    TEST_ASSERT(test_keyrings[successful_keyring].on_decrypt_called);
+
+    // Ranking the generator too, only the child which succeeded is tried
+    reset_decrypt_flags();
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_multi_keyring_set_decrypt_order(multi, AWS_CRYPTOSDK_MULTI_KEYRING_DECRYPT_ADAPTIVE_ALL));
+    unencrypted_data_key = (struct aws_byte_buf){ 0 };
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_keyring_on_decrypt(multi, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, alg));
+    TEST_ASSERT_ADDR_EQ(unencrypted_data_key.buffer, test_data_key);
+    for (size_t kr_idx = 0; kr_idx < successful_keyring; ++kr_idx) {
+        TEST_ASSERT(!test_keyrings[kr_idx].on_decrypt_called);
+    }
+    TEST_ASSERT(test_keyrings[successful_keyring].on_decrypt_called);
+
+    tear_down_all_the_things();
+    return 0;
+}
+
 int succeed_when_no_error_and_no_decrypt() {
     TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
     struct aws_byte_buf unencrypted_data_key = { 0 };
@@ -354,6 +623,161 @@ int fail_when_error_and_no_decrypt() {
     return 0;
 }
 
+/* Batch calls made to each test keyring switched to batch_test_keyring_vt, by index */
+static size_t batch_calls[NUM_TEST_KEYRINGS];
+static struct aws_cryptosdk_keyring_vt batch_test_keyring_vt;
+
+static int batch_test_keyring_on_encrypt_batch(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_cryptosdk_keyring_encrypt_item *items,
+    size_t num_items) {
+    batch_calls[(struct test_keyring *)kr - test_keyrings]++;
+    for (size_t i = 0; i < num_items; i++) {
+        if (test_keyring_vt.on_encrypt(
+                kr,
+                request_alloc,
+                items[i].unencrypted_data_key,
+                items[i].keyring_trace,
+                items[i].edks,
+                items[i].enc_ctx,
+                items[i].alg)) {
+            items[i].error_code = AWS_ERROR_UNKNOWN;
+        }
+    }
+    return AWS_OP_SUCCESS;
+}
+
+static int batch_test_keyring_on_decrypt_batch(
+    struct aws_cryptosdk_keyring *kr,
+    struct aws_allocator *request_alloc,
+    struct aws_cryptosdk_keyring_decrypt_item *items,
+    size_t num_items) {
+    batch_calls[(struct test_keyring *)kr - test_keyrings]++;
+    for (size_t i = 0; i < num_items; i++) {
+        if (test_keyring_vt.on_decrypt(
+                kr,
+                request_alloc,
+                items[i].unencrypted_data_key,
+                items[i].keyring_trace,
+                items[i].edks,
+                items[i].enc_ctx,
+                items[i].alg)) {
+            items[i].error_code = AWS_ERROR_UNKNOWN;
+        }
+    }
+    return AWS_OP_SUCCESS;
+}
+
+/* Switches all the test keyrings, generator included, to batch_test_keyring_vt */
+static void use_batch_test_keyrings() {
+    batch_test_keyring_vt                  = test_keyring_vt;
+    batch_test_keyring_vt.on_encrypt_batch = batch_test_keyring_on_encrypt_batch;
+    batch_test_keyring_vt.on_decrypt_batch = batch_test_keyring_on_decrypt_batch;
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        test_keyrings[kr_idx].base.vtable = &batch_test_keyring_vt;
+        batch_calls[kr_idx]               = 0;
+    }
+}
+
+#define NUM_BATCH_ITEMS 3
+
+int batched_encrypt_calls_each_keyring_once() {
+    struct aws_byte_buf data_keys[NUM_BATCH_ITEMS] = { { 0 } };
+    struct aws_array_list item_edks[NUM_BATCH_ITEMS];
+    struct aws_array_list item_traces[NUM_BATCH_ITEMS];
+    struct aws_cryptosdk_keyring_encrypt_item items[NUM_BATCH_ITEMS];
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    use_batch_test_keyrings();
+    for (size_t i = 0; i < NUM_BATCH_ITEMS; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_list_init(alloc, &item_edks[i]));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_init(alloc, &item_traces[i]));
+        items[i] = (struct aws_cryptosdk_keyring_encrypt_item){ .unencrypted_data_key = &data_keys[i],
+                                                                .keyring_trace        = &item_traces[i],
+                                                                .edks                 = &item_edks[i],
+                                                                .alg                  = alg,
+                                                                .error_code           = AWS_ERROR_UNKNOWN };
+    }
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt_batch(multi, alloc, items, NUM_BATCH_ITEMS));
+
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT_INT_EQ(batch_calls[kr_idx], 1);
+    }
+    for (size_t i = 0; i < NUM_BATCH_ITEMS; i++) {
+        TEST_ASSERT_INT_EQ(items[i].error_code, AWS_ERROR_SUCCESS);
+        TEST_ASSERT_ADDR_EQ(data_keys[i].buffer, test_data_key);
+        TEST_ASSERT_INT_EQ(aws_array_list_length(&item_edks[i]), num_test_keyrings);
+        TEST_ASSERT_INT_EQ(aws_array_list_length(&item_traces[i]), num_test_keyrings);
+        aws_cryptosdk_edk_list_clean_up(&item_edks[i]);
+        aws_cryptosdk_keyring_trace_clean_up(&item_traces[i]);
+    }
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+int batched_encrypt_fails_items_of_failed_child() {
+    struct aws_byte_buf data_key = { 0 };
+
+    struct aws_cryptosdk_keyring_encrypt_item item = {
+        .unencrypted_data_key = &data_key, .keyring_trace = &keyring_trace, .edks = &edks, .alg = alg
+    };
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    use_batch_test_keyrings();
+    test_keyrings[2].ret = AWS_OP_ERR;
+
+    TEST_ASSERT_INT_EQ(AWS_OP_ERR, aws_cryptosdk_keyring_on_encrypt_batch(multi, alloc, &item, 1));
+    TEST_ASSERT_INT_EQ(item.error_code, AWS_ERROR_UNKNOWN);
+    TEST_ASSERT_INT_EQ(batch_calls[3], 0);
+    TEST_ASSERT(!aws_array_list_length(&edks));
+    TEST_ASSERT(!aws_array_list_length(&keyring_trace));
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+int batched_decrypt_stops_at_decrypting_keyring() {
+    struct aws_byte_buf data_keys[NUM_BATCH_ITEMS] = { { 0 } };
+    struct aws_cryptosdk_keyring_decrypt_item items[NUM_BATCH_ITEMS];
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(true));
+    use_batch_test_keyrings();
+    test_keyrings[1].ret                          = AWS_OP_ERR;
+    test_keyrings[2].decrypted_data_key_to_return = aws_byte_buf_from_c_str(test_data_key);
+    for (size_t i = 0; i < NUM_BATCH_ITEMS; i++) {
+        items[i] = (struct aws_cryptosdk_keyring_decrypt_item){
+            .unencrypted_data_key = &data_keys[i], .keyring_trace = &keyring_trace, .edks = &edks, .alg = alg
+        };
+    }
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt_batch(multi, alloc, items, NUM_BATCH_ITEMS));
+
+    for (size_t kr_idx = 0; kr_idx < num_test_keyrings; ++kr_idx) {
+        TEST_ASSERT_INT_EQ(batch_calls[kr_idx], kr_idx <= 2);
+    }
+    for (size_t i = 0; i < NUM_BATCH_ITEMS; i++) {
+        TEST_ASSERT_INT_EQ(items[i].error_code, AWS_ERROR_SUCCESS);
+        TEST_ASSERT_ADDR_EQ(data_keys[i].buffer, test_data_key);
+    }
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&keyring_trace), NUM_BATCH_ITEMS);
+
+    // With no keyring decrypting, the failure of keyring 1 fails every item
+    test_keyrings[2].decrypted_data_key_to_return = (struct aws_byte_buf){ 0 };
+    for (size_t i = 0; i < NUM_BATCH_ITEMS; i++) data_keys[i] = (struct aws_byte_buf){ 0 };
+
+    TEST_ASSERT_INT_EQ(AWS_OP_ERR, aws_cryptosdk_keyring_on_decrypt_batch(multi, alloc, items, NUM_BATCH_ITEMS));
+    for (size_t i = 0; i < NUM_BATCH_ITEMS; i++) {
+        TEST_ASSERT_INT_EQ(items[i].error_code, AWS_ERROR_UNKNOWN);
+        TEST_ASSERT_ADDR_NULL(data_keys[i].buffer);
+    }
+
+    tear_down_all_the_things();
+    return 0;
+}
+
 struct test_case multi_keyring_test_cases[] = {
     { "multi_keyring", "delegates_on_encrypt_calls", delegates_on_encrypt_calls },
     { "multi_keyring",
@@ -366,11 +790,23 @@ struct test_case multi_keyring_test_cases[] = {
       "on_encrypt_fails_when_generator_does_not_generate",
       on_encrypt_fails_when_generator_does_not_generate },
     { "multi_keyring", "delegates_decrypt_calls", delegates_decrypt_calls },
+    { "multi_keyring", "decrypt_routes_edks_by_provider", decrypt_routes_edks_by_provider },
+    { "multi_keyring", "may_decrypt_consults_index_and_children", may_decrypt_consults_index_and_children },
+    { "multi_keyring", "adaptive_decrypt_tries_successful_child_first", adaptive_decrypt_tries_successful_child_first },
     { "multi_keyring", "fail_on_failed_encrypt_and_stop", fail_on_failed_encrypt_and_stop },
+    { "multi_keyring", "parallel_children_merged_in_order", parallel_children_merged_in_order },
+    { "multi_keyring", "parallel_children_fail_after_all_called", parallel_children_fail_after_all_called },
+    { "multi_keyring",
+      "parallel_decrypt_takes_first_key_and_wipes_others",
+      parallel_decrypt_takes_first_key_and_wipes_others },
+    { "multi_keyring", "parallel_decrypt_fails_after_all_called", parallel_decrypt_fails_after_all_called },
     { "multi_keyring", "failed_encrypt_keeps_edk_list_intact", failed_encrypt_keeps_edk_list_intact },
     { "multi_keyring", "fail_on_failed_generate_and_stop", fail_on_failed_generate_and_stop },
     { "multi_keyring", "succeed_when_no_error_and_no_decrypt", succeed_when_no_error_and_no_decrypt },
     { "multi_keyring", "fail_when_error_and_no_decrypt", fail_when_error_and_no_decrypt },
+    { "multi_keyring", "batched_encrypt_calls_each_keyring_once", batched_encrypt_calls_each_keyring_once },
+    { "multi_keyring", "batched_encrypt_fails_items_of_failed_child", batched_encrypt_fails_items_of_failed_child },
+    { "multi_keyring", "batched_decrypt_stops_at_decrypting_keyring", batched_decrypt_stops_at_decrypting_keyring },
     { "multi_keyring", "adds_and_removes_refs", adds_and_removes_refs },
     { "multi_keyring", "adds_and_removes_refs_for_generator", adds_and_removes_refs_for_generator },
     { NULL }
@@ -0,0 +1,233 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/pipeline.h>
+#include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/frame_pool.h>
+#include "testing.h"
+#include "testutil.h"
+#include "zero_keyring.h"
+
+#define PIPELINE_PT_SIZE 100000
+
+/* Frame size and buffer pool setting for the sessions created by stream() */
+static uint32_t stream_frame_size = 1024;
+static bool stream_frame_pool     = false;
+
+struct consumer {
+    struct aws_cryptosdk_pipeline *pipeline;
+    uint8_t *buf;
+    size_t capacity, len;
+    /* Bytes asked for per read */
+    size_t chunk;
+    int error;
+};
+
+static void run_consumer(void *arg) {
+    struct consumer *consumer = arg;
+
+    for (;;) {
+        size_t room = consumer->capacity - consumer->len;
+        size_t read;
+
+        if (!room) {
+            consumer->error = AWS_ERROR_SHORT_BUFFER;
+            return;
+        }
+        if (aws_cryptosdk_pipeline_read(
+                consumer->pipeline,
+                consumer->buf + consumer->len,
+                room < consumer->chunk ? room : consumer->chunk,
+                &read)) {
+            consumer->error = aws_last_error();
+            return;
+        }
+        if (!read) return;
+        consumer->len += read;
+    }
+}
+
+/*
+ * Streams in through a pipeline over a new session in the given mode, len_in bytes at a time,
+ * with another thread reading the output into out. Returns the error of the producer, or of
+ * the consumer if the producer succeeded, or zero.
+ */
+static int stream(
+    enum aws_cryptosdk_mode mode,
+    size_t depth,
+    const uint8_t *in,
+    size_t in_len,
+    size_t chunk,
+    uint8_t *out,
+    size_t out_capacity,
+    size_t *out_len) {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    struct aws_thread thread;
+    int error = 0;
+
+    if (!kr) return aws_last_error();
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_from_keyring(alloc, mode, kr);
+    aws_cryptosdk_keyring_release(kr);
+    if (!session) return aws_last_error();
+    if (mode == AWS_CRYPTOSDK_ENCRYPT && aws_cryptosdk_session_set_frame_size(session, stream_frame_size)) {
+        return aws_last_error();
+    }
+    if (aws_cryptosdk_session_set_frame_buffer_pool(session, stream_frame_pool)) return aws_last_error();
+
+    struct aws_cryptosdk_pipeline *pipeline = aws_cryptosdk_pipeline_new(alloc, session, depth);
+    if (!pipeline) return aws_last_error();
+
+    struct consumer consumer = { .pipeline = pipeline, .buf = out, .capacity = out_capacity, .chunk = 700 };
+    if (aws_thread_init(&thread, alloc) ||
+        aws_thread_launch(&thread, run_consumer, &consumer, aws_default_thread_options())) {
+        return aws_last_error();
+    }
+
+    for (size_t offset = 0; offset < in_len && !error; offset += chunk) {
+        size_t n = in_len - offset < chunk ? in_len - offset : chunk;
+        if (aws_cryptosdk_pipeline_write(pipeline, in + offset, n)) error = aws_last_error();
+    }
+    if (!error && aws_cryptosdk_pipeline_finish(pipeline)) error = aws_last_error();
+
+    aws_thread_join(&thread);
+    aws_thread_clean_up(&thread);
+    if (!error) error = consumer.error;
+    *out_len = consumer.len;
+
+    aws_cryptosdk_pipeline_destroy(pipeline);
+    aws_cryptosdk_session_destroy(session);
+    return error;
+}
+
+static int streams_roundtrip() {
+    // The reader needs room for one more byte to see the end of the message
+    uint8_t *pt     = aws_mem_acquire(aws_default_allocator(), PIPELINE_PT_SIZE);
+    uint8_t *ct     = aws_mem_acquire(aws_default_allocator(), 2 * PIPELINE_PT_SIZE);
+    uint8_t *pt_out = aws_mem_acquire(aws_default_allocator(), PIPELINE_PT_SIZE + 1);
+    size_t ct_len, pt_len;
+
+    TEST_ASSERT_ADDR_NOT_NULL(pt);
+    TEST_ASSERT_ADDR_NOT_NULL(ct);
+    TEST_ASSERT_ADDR_NOT_NULL(pt_out);
+    aws_cryptosdk_genrandom(pt, PIPELINE_PT_SIZE);
+
+    // A ring of one buffer holds the writer to the reader's pace at every frame
+    for (size_t depth = 1; depth <= 4; depth += 3) {
+        TEST_ASSERT_INT_EQ(
+            0, stream(AWS_CRYPTOSDK_ENCRYPT, depth, pt, PIPELINE_PT_SIZE, 777, ct, 2 * PIPELINE_PT_SIZE, &ct_len));
+        TEST_ASSERT(ct_len > PIPELINE_PT_SIZE);
+
+        TEST_ASSERT_INT_EQ(
+            0, stream(AWS_CRYPTOSDK_DECRYPT, depth, ct, ct_len, 333, pt_out, PIPELINE_PT_SIZE + 1, &pt_len));
+        TEST_ASSERT_INT_EQ(pt_len, PIPELINE_PT_SIZE);
+        TEST_ASSERT(!memcmp(pt, pt_out, PIPELINE_PT_SIZE));
+    }
+
+    // The ciphertext must be exactly one message
+    TEST_ASSERT_INT_EQ(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        stream(AWS_CRYPTOSDK_DECRYPT, 2, ct, ct_len - 10, 4096, pt_out, PIPELINE_PT_SIZE + 1, &pt_len));
+    ct[ct_len] = 0;
+    TEST_ASSERT_INT_EQ(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        stream(AWS_CRYPTOSDK_DECRYPT, 2, ct, ct_len + 1, 4096, pt_out, PIPELINE_PT_SIZE + 1, &pt_len));
+
+    // An empty message has a header and a final frame all the same
+    TEST_ASSERT_INT_EQ(0, stream(AWS_CRYPTOSDK_ENCRYPT, 1, pt, 0, 1, ct, 2 * PIPELINE_PT_SIZE, &ct_len));
+    TEST_ASSERT_INT_EQ(0, stream(AWS_CRYPTOSDK_DECRYPT, 1, ct, ct_len, 1, pt_out, PIPELINE_PT_SIZE + 1, &pt_len));
+    TEST_ASSERT_INT_EQ(pt_len, 0);
+
+    aws_mem_release(aws_default_allocator(), pt);
+    aws_mem_release(aws_default_allocator(), ct);
+    aws_mem_release(aws_default_allocator(), pt_out);
+    return 0;
+}
+
+static int failure_reaches_reader() {
+    struct aws_allocator *alloc      = aws_default_allocator();
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_from_keyring(alloc, AWS_CRYPTOSDK_DECRYPT, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    aws_cryptosdk_keyring_release(kr);
+
+    struct aws_cryptosdk_pipeline *pipeline = aws_cryptosdk_pipeline_new(alloc, session, 2);
+    TEST_ASSERT_ADDR_NOT_NULL(pipeline);
+
+    // Not a message header; once the write fails, so does everything after it
+    static const uint8_t garbage[100] = { 0xff };
+    uint8_t out[16];
+    size_t read;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_pipeline_write(pipeline, garbage, sizeof(garbage)));
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_pipeline_read(pipeline, out, sizeof(out), &read));
+    TEST_ASSERT_INT_EQ(read, 0);
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, aws_cryptosdk_pipeline_finish(pipeline));
+
+    aws_cryptosdk_pipeline_destroy(pipeline);
+    aws_cryptosdk_session_destroy(session);
+
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_pipeline_new(alloc, NULL, 2));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
+    return 0;
+}
+
+static int frame_buffer_pool() {
+    struct aws_allocator *pool = aws_cryptosdk_frame_buffer_allocator();
+
+    // A frame-sized buffer comes from a slab, and is recycled for the next request of its class
+    void *buf = aws_mem_acquire(pool, 256 * 1024 + 40);
+    TEST_ASSERT_ADDR_NOT_NULL(buf);
+    memset(buf, 0x42, 256 * 1024 + 40);
+    aws_mem_release(pool, buf);
+    void *again = aws_mem_acquire(pool, 200 * 1024);
+    TEST_ASSERT_ADDR_NOT_NULL(again);
+#ifndef _WIN32
+    TEST_ASSERT(aws_cryptosdk_frame_pool_owns(again));
+    TEST_ASSERT_ADDR_EQ(again, buf);
+#endif
+
+    // Growing past the class moves the contents to a larger one
+    memset(again, 0x17, 100);
+    TEST_ASSERT_SUCCESS(aws_mem_realloc(pool, &again, 200 * 1024, 600 * 1024));
+    TEST_ASSERT_INT_EQ(((uint8_t *)again)[99], 0x17);
+    aws_mem_release(pool, again);
+
+    // Small buffers are not worth a slab
+    uint8_t *small = aws_mem_acquire(pool, 100);
+    TEST_ASSERT_ADDR_NOT_NULL(small);
+    TEST_ASSERT(!aws_cryptosdk_frame_pool_owns(small));
+    aws_mem_release(pool, small);
+
+    // Sessions and their pipelines work the same with pooled buffers
+    stream_frame_size = 64 * 1024;
+    stream_frame_pool = true;
+    int rv            = streams_roundtrip();
+    stream_frame_size = 1024;
+    stream_frame_pool = false;
+
+    return rv;
+}
+
+#define TEST_CASE(name) \
+    { "pipeline", #name, name }
+struct test_case pipeline_test_cases[] = { TEST_CASE(streams_roundtrip),
+                                           TEST_CASE(failure_reaches_reader),
+                                           TEST_CASE(frame_buffer_pool),
+                                           { NULL } };
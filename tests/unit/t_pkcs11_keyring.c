@@ -0,0 +1,389 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/atomics.h>
+#include <aws/common/mutex.h>
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/private/cipher.h>
+#include <aws/cryptosdk/private/config.h>
+#include <aws/cryptosdk/private/pkcs11_keyring.h>
+#include <aws/cryptosdk/raw_aes_keyring.h>
+#include <aws/cryptosdk/session.h>
+#include "testing.h"
+
+#include <string.h>
+
+AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "hsm");
+AWS_STATIC_STRING_FROM_LITERAL(key_name, "tenant-key");
+AWS_STATIC_STRING_FROM_LITERAL(missing_key_name, "no-such-key");
+
+#ifdef AWS_CRYPTOSDK_P_HAVE_PKCS11
+#    include <p11-kit/pkcs11.h>
+
+#    define MOCK_SESSIONS 16
+#    define MOCK_KEY 42
+#    define MOCK_PIN "1234"
+
+static const uint8_t key_bytes[32] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                                       17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32 };
+
+/* A token holding one AES key, which keeps count of how the keyring uses it */
+static struct mock_token {
+    struct aws_mutex mutex;
+    struct aws_cryptosdk_aes_gcm_key *key;
+    bool open[MOCK_SESSIONS];
+    bool logged_in;
+    bool found_key;
+    /* The parameters of each session's pending encrypt or decrypt */
+    CK_GCM_PARAMS params[MOCK_SESSIONS];
+    int opens, closes, logins, open_now, max_open_now;
+    /* Returned once by the next C_Encrypt, if set */
+    CK_RV fail_next;
+} token = { .mutex = AWS_MUTEX_INIT };
+
+static bool valid_session(CK_SESSION_HANDLE session) {
+    return session < MOCK_SESSIONS && token.open[session];
+}
+
+static CK_RV mock_open_session(
+    CK_SLOT_ID slot, CK_FLAGS flags, void *application, CK_NOTIFY notify, CK_SESSION_HANDLE_PTR session) {
+    CK_RV rv = CKR_SESSION_COUNT;
+    (void)flags;
+    (void)application;
+    (void)notify;
+    if (slot != 7) return CKR_SLOT_ID_INVALID;
+
+    aws_mutex_lock(&token.mutex);
+    for (CK_SESSION_HANDLE i = 1; i < MOCK_SESSIONS; i++) {
+        if (!token.open[i]) {
+            token.open[i] = true;
+            *session      = i;
+            token.opens++;
+            if (++token.open_now > token.max_open_now) token.max_open_now = token.open_now;
+            rv = CKR_OK;
+            break;
+        }
+    }
+    aws_mutex_unlock(&token.mutex);
+    return rv;
+}
+
+static CK_RV mock_close_session(CK_SESSION_HANDLE session) {
+    CK_RV rv = CKR_SESSION_HANDLE_INVALID;
+
+    aws_mutex_lock(&token.mutex);
+    if (valid_session(session)) {
+        token.open[session] = false;
+        token.closes++;
+        // Logins lapse with the last session
+        if (!--token.open_now) token.logged_in = false;
+        rv = CKR_OK;
+    }
+    aws_mutex_unlock(&token.mutex);
+    return rv;
+}
+
+static CK_RV mock_login(CK_SESSION_HANDLE session, CK_USER_TYPE user, CK_UTF8CHAR_PTR pin, CK_ULONG pin_len) {
+    CK_RV rv = CKR_OK;
+
+    aws_mutex_lock(&token.mutex);
+    if (!valid_session(session) || user != CKU_USER) {
+        rv = CKR_ARGUMENTS_BAD;
+    } else if (pin_len != strlen(MOCK_PIN) || memcmp(pin, MOCK_PIN, pin_len)) {
+        rv = CKR_PIN_INCORRECT;
+    } else if (token.logged_in) {
+        rv = CKR_USER_ALREADY_LOGGED_IN;
+    } else {
+        token.logged_in = true;
+        token.logins++;
+    }
+    aws_mutex_unlock(&token.mutex);
+    return rv;
+}
+
+static CK_RV mock_find_objects_init(CK_SESSION_HANDLE session, CK_ATTRIBUTE_PTR templ, CK_ULONG count) {
+    if (!valid_session(session)) return CKR_SESSION_HANDLE_INVALID;
+
+    token.found_key = false;
+    for (CK_ULONG i = 0; i < count; i++) {
+        if (templ[i].type == CKA_LABEL) {
+            token.found_key = templ[i].ulValueLen == key_name->len &&
+                              !memcmp(templ[i].pValue, aws_string_bytes(key_name), key_name->len);
+        }
+    }
+    return CKR_OK;
+}
+
+static CK_RV mock_find_objects(
+    CK_SESSION_HANDLE session, CK_OBJECT_HANDLE_PTR objects, CK_ULONG max_count, CK_ULONG_PTR count) {
+    if (!valid_session(session)) return CKR_SESSION_HANDLE_INVALID;
+
+    *count = 0;
+    if (token.found_key && max_count) {
+        objects[(*count)++] = MOCK_KEY;
+    }
+    return CKR_OK;
+}
+
+static CK_RV mock_find_objects_final(CK_SESSION_HANDLE session) {
+    return valid_session(session) ? CKR_OK : CKR_SESSION_HANDLE_INVALID;
+}
+
+static CK_RV mock_crypt_init(CK_SESSION_HANDLE session, CK_MECHANISM_PTR mechanism, CK_OBJECT_HANDLE key) {
+    if (!valid_session(session)) return CKR_SESSION_HANDLE_INVALID;
+    if (!token.logged_in) return CKR_USER_NOT_LOGGED_IN;
+    if (key != MOCK_KEY) return CKR_KEY_HANDLE_INVALID;
+    if (mechanism->mechanism != CKM_AES_GCM || mechanism->ulParameterLen != sizeof(CK_GCM_PARAMS)) {
+        return CKR_MECHANISM_INVALID;
+    }
+
+    token.params[session] = *(CK_GCM_PARAMS *)mechanism->pParameter;
+    if (token.params[session].ulTagBits != 128) return CKR_MECHANISM_PARAM_INVALID;
+    return CKR_OK;
+}
+
+static CK_RV mock_encrypt(
+    CK_SESSION_HANDLE session, CK_BYTE_PTR data, CK_ULONG data_len, CK_BYTE_PTR out, CK_ULONG_PTR out_len) {
+    const CK_GCM_PARAMS *params = &token.params[session];
+
+    if (token.fail_next) {
+        CK_RV rv         = token.fail_next;
+        token.fail_next = CKR_OK;
+        return rv;
+    }
+    if (*out_len < data_len + 16) return CKR_BUFFER_TOO_SMALL;
+
+    struct aws_byte_buf ciphertext = aws_byte_buf_from_empty_array(out, data_len);
+    struct aws_byte_buf tag        = aws_byte_buf_from_empty_array(out + data_len, 16);
+    if (aws_cryptosdk_aes_gcm_key_encrypt(
+            token.key,
+            &ciphertext,
+            &tag,
+            aws_byte_cursor_from_array(data, data_len),
+            aws_byte_cursor_from_array(params->pIv, params->ulIvLen),
+            aws_byte_cursor_from_array(params->pAAD, params->ulAADLen))) {
+        return CKR_FUNCTION_FAILED;
+    }
+    *out_len = data_len + 16;
+    return CKR_OK;
+}
+
+static CK_RV mock_decrypt(
+    CK_SESSION_HANDLE session, CK_BYTE_PTR in, CK_ULONG in_len, CK_BYTE_PTR data, CK_ULONG_PTR data_len) {
+    const CK_GCM_PARAMS *params = &token.params[session];
+
+    if (in_len < 16) return CKR_ENCRYPTED_DATA_LEN_RANGE;
+    if (*data_len < in_len - 16) return CKR_BUFFER_TOO_SMALL;
+
+    struct aws_byte_buf plaintext = aws_byte_buf_from_empty_array(data, in_len - 16);
+    if (aws_cryptosdk_aes_gcm_key_decrypt(
+            token.key,
+            &plaintext,
+            aws_byte_cursor_from_array(in, in_len - 16),
+            aws_byte_cursor_from_array(in + in_len - 16, 16),
+            aws_byte_cursor_from_array(params->pIv, params->ulIvLen),
+            aws_byte_cursor_from_array(params->pAAD, params->ulAADLen))) {
+        aws_reset_error();
+        return CKR_ENCRYPTED_DATA_INVALID;
+    }
+    *data_len = in_len - 16;
+    return CKR_OK;
+}
+
+static CK_FUNCTION_LIST mock_functions = { .version            = { 2, 40 },
+                                           .C_OpenSession      = mock_open_session,
+                                           .C_CloseSession     = mock_close_session,
+                                           .C_Login            = mock_login,
+                                           .C_FindObjectsInit  = mock_find_objects_init,
+                                           .C_FindObjects      = mock_find_objects,
+                                           .C_FindObjectsFinal = mock_find_objects_final,
+                                           .C_EncryptInit      = mock_crypt_init,
+                                           .C_Encrypt          = mock_encrypt,
+                                           .C_DecryptInit      = mock_crypt_init,
+                                           .C_Decrypt          = mock_decrypt };
+
+static int mock_token_reset(void) {
+    aws_cryptosdk_aes_gcm_key_destroy(token.key);
+    memset(token.open, 0, sizeof(token.open));
+    token.logged_in = false;
+    token.opens = token.closes = token.logins = token.open_now = token.max_open_now = 0;
+    token.fail_next                                                                = CKR_OK;
+
+    token.key = aws_cryptosdk_aes_gcm_key_new(
+        aws_default_allocator(), aws_byte_cursor_from_array(key_bytes, sizeof(key_bytes)));
+    return token.key ? 0 : 1;
+}
+
+static struct aws_cryptosdk_keyring *mock_keyring_new(const char *pin, const struct aws_string *name, size_t max) {
+    return aws_cryptosdk_pkcs11_keyring_new_from_functions(
+        aws_default_allocator(), &mock_functions, 7, aws_byte_cursor_from_c_str(pin), key_namespace, name, max);
+}
+
+/* Encrypts a message with one keyring, and decrypts it with another */
+static int roundtrip(struct aws_cryptosdk_keyring *enc_kr, struct aws_cryptosdk_keyring *dec_kr) {
+    static const uint8_t pt[] = "Wrapped inside the token";
+    uint8_t ct[1024], out[sizeof(pt)];
+    size_t ct_len, out_len, read;
+
+    struct aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, enc_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, ct, sizeof(ct), &ct_len, pt, sizeof(pt), &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    aws_cryptosdk_session_destroy(session);
+
+    session = aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, dec_kr);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, out, sizeof(out), &out_len, ct, ct_len, &read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+    TEST_ASSERT_INT_EQ(out_len, sizeof(pt));
+    TEST_ASSERT(!memcmp(out, pt, sizeof(pt)));
+    aws_cryptosdk_session_destroy(session);
+
+    return 0;
+}
+
+static int roundtrip_interoperates_with_raw_aes() {
+    TEST_ASSERT_SUCCESS(mock_token_reset());
+    struct aws_cryptosdk_keyring *kr = mock_keyring_new(MOCK_PIN, key_name, 4);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_keyring *raw = aws_cryptosdk_raw_aes_keyring_new(
+        aws_default_allocator(), key_namespace, key_name, key_bytes, AWS_CRYPTOSDK_AES256);
+    TEST_ASSERT_ADDR_NOT_NULL(raw);
+
+    TEST_ASSERT_SUCCESS(roundtrip(kr, kr));
+    TEST_ASSERT_SUCCESS(roundtrip(kr, raw));
+    TEST_ASSERT_SUCCESS(roundtrip(raw, kr));
+
+    // Messages one after another reuse the session the keyring opened and logged in to
+    TEST_ASSERT_INT_EQ(token.opens, 1);
+    TEST_ASSERT_INT_EQ(token.logins, 1);
+
+    aws_cryptosdk_keyring_release(raw);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_INT_EQ(token.closes, 1);
+    TEST_ASSERT_INT_EQ(token.open_now, 0);
+    return 0;
+}
+
+static int construction_failures() {
+    TEST_ASSERT_SUCCESS(mock_token_reset());
+
+    TEST_ASSERT_ADDR_NULL(mock_keyring_new("4321", key_name, 4));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_CRYPTOSDK_ERR_PKCS11_FAILURE);
+    TEST_ASSERT_ADDR_NULL(mock_keyring_new(MOCK_PIN, missing_key_name, 4));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
+    TEST_ASSERT_ADDR_NULL(mock_keyring_new(MOCK_PIN, key_name, 0));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
+
+    // Failed constructions leave no sessions open
+    TEST_ASSERT_INT_EQ(token.open_now, 0);
+    return 0;
+}
+
+static int broken_sessions_are_replaced() {
+    TEST_ASSERT_SUCCESS(mock_token_reset());
+    struct aws_cryptosdk_keyring *kr = mock_keyring_new(MOCK_PIN, key_name, 4);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    // The token loses the keyring's only session, and with it the login
+    token.fail_next = CKR_SESSION_HANDLE_INVALID;
+    struct aws_cryptosdk_session *session =
+        aws_cryptosdk_session_new_from_keyring(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    uint8_t ct[1024];
+    size_t ct_len, read;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, 0));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_PKCS11_FAILURE,
+        aws_cryptosdk_session_process(session, ct, sizeof(ct), &ct_len, NULL, 0, &read));
+    aws_cryptosdk_session_destroy(session);
+    TEST_ASSERT_INT_EQ(token.closes, 1);
+
+    // The next message opens a new session and logs in again
+    TEST_ASSERT_SUCCESS(roundtrip(kr, kr));
+    TEST_ASSERT_INT_EQ(token.opens, 2);
+    TEST_ASSERT_INT_EQ(token.logins, 2);
+
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_INT_EQ(token.open_now, 0);
+    return 0;
+}
+
+#    define POOL_THREADS 8
+#    define MESSAGES_PER_THREAD 20
+
+static struct aws_atomic_var failures;
+
+static void pool_worker(void *kr) {
+    for (int i = 0; i < MESSAGES_PER_THREAD; i++) {
+        if (roundtrip(kr, kr)) aws_atomic_fetch_add(&failures, 1);
+    }
+}
+
+static int sessions_are_shared_between_threads() {
+    struct aws_thread threads[POOL_THREADS];
+
+    TEST_ASSERT_SUCCESS(mock_token_reset());
+    struct aws_cryptosdk_keyring *kr = mock_keyring_new(MOCK_PIN, key_name, 2);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+
+    aws_atomic_init_int(&failures, 0);
+    for (int i = 0; i < POOL_THREADS; i++) {
+        TEST_ASSERT_SUCCESS(aws_thread_init(&threads[i], aws_default_allocator()));
+        TEST_ASSERT_SUCCESS(aws_thread_launch(&threads[i], pool_worker, kr, NULL));
+    }
+    for (int i = 0; i < POOL_THREADS; i++) {
+        TEST_ASSERT_SUCCESS(aws_thread_join(&threads[i]));
+        aws_thread_clean_up(&threads[i]);
+    }
+    TEST_ASSERT_INT_EQ(aws_atomic_load_int(&failures), 0);
+
+    // However many threads there are, the token never sees more sessions than the pool allows
+    TEST_ASSERT(token.opens <= 2);
+    TEST_ASSERT(token.max_open_now <= 2);
+    TEST_ASSERT_INT_EQ(token.logins, 1);
+
+    aws_cryptosdk_keyring_release(kr);
+    aws_cryptosdk_aes_gcm_key_destroy(token.key);
+    token.key = NULL;
+    return 0;
+}
+
+#    define TEST_CASE(name) \
+        { "pkcs11_keyring", #name, name }
+struct test_case pkcs11_keyring_test_cases[] = { TEST_CASE(roundtrip_interoperates_with_raw_aes),
+                                                 TEST_CASE(construction_failures),
+                                                 TEST_CASE(broken_sessions_are_replaced),
+                                                 TEST_CASE(sessions_are_shared_between_threads),
+                                                 { NULL } };
+
+#else  // AWS_CRYPTOSDK_P_HAVE_PKCS11
+
+static int unavailable_without_pkcs11() {
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_pkcs11_keyring_new(
+        aws_default_allocator(), "libsofthsm2.so", 0, aws_byte_cursor_from_c_str(""), key_namespace, key_name, 1));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_UNSUPPORTED_OPERATION);
+    (void)missing_key_name;
+    return 0;
+}
+
+#    define TEST_CASE(name) \
+        { "pkcs11_keyring", #name, name }
+struct test_case pkcs11_keyring_test_cases[] = { TEST_CASE(unavailable_without_pkcs11), { NULL } };
+
+#endif  // AWS_CRYPTOSDK_P_HAVE_PKCS11
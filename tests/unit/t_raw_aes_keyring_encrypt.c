@@ -14,7 +14,9 @@
  */
 #include <aws/cryptosdk/enc_ctx.h>
 #include <aws/cryptosdk/materials.h>
+#include <aws/cryptosdk/private/enc_ctx.h>
 #include <aws/cryptosdk/private/raw_aes_keyring.h>
+#include <aws/cryptosdk/private/secure_pool.h>
 #include "raw_aes_keyring_test_vectors.h"
 #include "testing.h"
 
@@ -172,6 +174,221 @@ static int encrypt_data_key_test_vectors() {
     return 0;
 }
 
+/**
+ * Data keys generated and decrypted by the keyring live in the secure key pool, and their slots
+ * are wiped and recycled once released.
+ */
+static int data_keys_in_secure_pool() {
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(AWS_CRYPTOSDK_AES256, true));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+        kr, alloc, &unencrypted_data_key, &keyring_trace, &edks, &enc_ctx, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        kr, alloc, &decrypted_data_key, &keyring_trace, &edks, &enc_ctx, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT(aws_byte_buf_eq(&unencrypted_data_key, &decrypted_data_key));
+
+#ifndef _WIN32
+    TEST_ASSERT(aws_cryptosdk_secure_pool_owns(unencrypted_data_key.buffer));
+    TEST_ASSERT(aws_cryptosdk_secure_pool_owns(decrypted_data_key.buffer));
+#endif
+
+    uint8_t *slot = decrypted_data_key.buffer;
+    aws_byte_buf_clean_up(&decrypted_data_key);
+
+    // The most recently released slot of a size class is the next one handed out
+    uint8_t *reused = aws_mem_acquire(aws_cryptosdk_secure_key_allocator(), 32);
+    TEST_ASSERT_ADDR_NOT_NULL(reused);
+    if (aws_cryptosdk_secure_pool_owns(reused)) {
+        TEST_ASSERT_ADDR_EQ(reused, slot);
+        for (size_t i = 0; i < 32; i++) TEST_ASSERT_INT_EQ(reused[i], 0);
+    }
+    aws_mem_release(aws_cryptosdk_secure_key_allocator(), reused);
+
+    // Requests too large for any slot still work, through the fallback
+    uint8_t *big = aws_mem_acquire(aws_cryptosdk_secure_key_allocator(), AWS_CRYPTOSDK_SECURE_POOL_MAX_SLOT + 1);
+    TEST_ASSERT_ADDR_NOT_NULL(big);
+    TEST_ASSERT(!aws_cryptosdk_secure_pool_owns(big));
+    memset(big, 0x5a, AWS_CRYPTOSDK_SECURE_POOL_MAX_SLOT + 1);
+    aws_mem_release(aws_cryptosdk_secure_key_allocator(), big);
+
+    tear_down_all_the_things();
+    return 0;
+}
+
+/**
+ * A caller-supplied serialization of the encryption context is used as the AAD in place of
+ * serializing the context again, on both encrypt and decrypt.
+ */
+static int encrypt_decrypt_with_serialized_enc_ctx() {
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(AWS_CRYPTOSDK_AES256, true));
+
+    struct aws_byte_buf serialized;
+    size_t serialized_len;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_size(&serialized_len, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_byte_buf_init(&serialized, alloc, serialized_len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_serialize(alloc, &serialized, &enc_ctx));
+    struct aws_byte_cursor serialized_cur = aws_byte_cursor_from_buf(&serialized);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt_with_serialized_ctx(
+        kr,
+        alloc,
+        &unencrypted_data_key,
+        &keyring_trace,
+        &edks,
+        &enc_ctx,
+        &serialized_cur,
+        ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT_INT_EQ(aws_array_list_length(&edks), 1);
+
+    // The EDK is interchangeable with one wrapped under a freshly serialized context
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        kr, alloc, &decrypted_data_key, &keyring_trace, &edks, &enc_ctx, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT(aws_byte_buf_eq(&unencrypted_data_key, &decrypted_data_key));
+    aws_byte_buf_clean_up(&decrypted_data_key);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt_with_serialized_ctx(
+        kr,
+        alloc,
+        &decrypted_data_key,
+        &keyring_trace,
+        &edks,
+        &enc_ctx,
+        &serialized_cur,
+        ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT(aws_byte_buf_eq(&unencrypted_data_key, &decrypted_data_key));
+    aws_byte_buf_clean_up(&decrypted_data_key);
+
+    // The supplied bytes are what is authenticated, so different ones fail to unwrap the key
+    struct aws_byte_cursor truncated = aws_byte_cursor_from_array(serialized.buffer, serialized.len - 1);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt_with_serialized_ctx(
+        kr,
+        alloc,
+        &decrypted_data_key,
+        &keyring_trace,
+        &edks,
+        &enc_ctx,
+        &truncated,
+        ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT_ADDR_NULL(decrypted_data_key.buffer);
+
+    aws_byte_buf_clean_up(&serialized);
+    tear_down_all_the_things();
+    return 0;
+}
+
+#define NUM_TENANTS 200
+
+/**
+ * The key store keyring interoperates with raw AES keyrings made from any one of its keys, in
+ * both directions.
+ */
+static int key_store_keyring_matches_raw_aes_keyrings() {
+    AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "tenants");
+    struct aws_string *key_names[NUM_TENANTS];
+    uint8_t key_bytes[NUM_TENANTS][32];
+
+    alloc = aws_default_allocator();
+    struct aws_cryptosdk_keyring *store = aws_cryptosdk_raw_aes_key_store_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(store);
+
+    for (int i = 0; i < NUM_TENANTS; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "tenant %d", i);
+        key_names[i] = aws_string_new_from_c_str(alloc, name);
+        TEST_ASSERT_ADDR_NOT_NULL(key_names[i]);
+        memset(key_bytes[i], i, sizeof(key_bytes[i]));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_raw_aes_key_store_keyring_add_key(
+            store, key_namespace, key_names[i], key_bytes[i], AWS_CRYPTOSDK_AES256));
+    }
+
+    struct aws_cryptosdk_keyring *tenant =
+        aws_cryptosdk_raw_aes_keyring_new(alloc, key_namespace, key_names[42], key_bytes[42], AWS_CRYPTOSDK_AES256);
+    TEST_ASSERT_ADDR_NOT_NULL(tenant);
+
+    kr = store;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_init(alloc, &keyring_trace));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_list_init(alloc, &edks));
+    TEST_ASSERT_SUCCESS(put_stuff_in_encryption_context());
+
+    // Encrypt under the store's chosen key, decrypt with that tenant's own keyring
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_raw_aes_key_store_keyring_set_encrypt_key(store, key_namespace, key_names[42]));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+        store, alloc, &unencrypted_data_key, &keyring_trace, &edks, &enc_ctx, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        tenant, alloc, &decrypted_data_key, &keyring_trace, &edks, &enc_ctx, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT(aws_byte_buf_eq(&unencrypted_data_key, &decrypted_data_key));
+    aws_byte_buf_clean_up(&decrypted_data_key);
+    aws_byte_buf_clean_up(&unencrypted_data_key);
+    aws_cryptosdk_edk_list_clear(&edks);
+    aws_cryptosdk_keyring_trace_clear(&keyring_trace);
+
+    // Encrypt with the tenant's keyring, decrypt with the store
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_encrypt(
+        tenant, alloc, &unencrypted_data_key, &keyring_trace, &edks, &enc_ctx, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    aws_cryptosdk_keyring_trace_clear(&keyring_trace);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        store, alloc, &decrypted_data_key, &keyring_trace, &edks, &enc_ctx, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT(aws_byte_buf_eq(&unencrypted_data_key, &decrypted_data_key));
+    TEST_ASSERT_SUCCESS(assert_keyring_trace_record(
+        &keyring_trace,
+        0,
+        "tenants",
+        "tenant 42",
+        AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY | AWS_CRYPTOSDK_WRAPPING_KEY_VERIFIED_ENC_CTX));
+    aws_byte_buf_clean_up(&decrypted_data_key);
+
+    // Shortening the key name to "tenant 4" selects that tenant's key, which does not unwrap the EDK
+    struct aws_cryptosdk_edk *edk;
+    TEST_ASSERT_SUCCESS(aws_array_list_get_at_ptr(&edks, (void **)&edk, 0));
+    memmove(edk->provider_info.buffer + 8, edk->provider_info.buffer + 9, edk->provider_info.len - 9);
+    edk->provider_info.len--;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_on_decrypt(
+        store, alloc, &decrypted_data_key, &keyring_trace, &edks, &enc_ctx, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    TEST_ASSERT_ADDR_NULL(decrypted_data_key.buffer);
+
+    aws_cryptosdk_keyring_release(tenant);
+    for (int i = 0; i < NUM_TENANTS; i++) aws_string_destroy(key_names[i]);
+    tear_down_all_the_things();
+    return 0;
+}
+
+static int key_store_keyring_errors() {
+    AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "tenants");
+    AWS_STATIC_STRING_FROM_LITERAL(key_name, "tenant");
+    AWS_STATIC_STRING_FROM_LITERAL(other_key_name, "other tenant");
+    AWS_STATIC_STRING_FROM_LITERAL(reserved_namespace, "aws-kms");
+    const uint8_t key_bytes[16] = { 0 };
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(AWS_CRYPTOSDK_AES256, false));
+    struct aws_cryptosdk_keyring *store = aws_cryptosdk_raw_aes_key_store_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(store);
+
+    // Until an encryption key is chosen, there is nothing to encrypt under
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE,
+        aws_cryptosdk_keyring_on_encrypt(
+            store, alloc, &unencrypted_data_key, &keyring_trace, &edks, &enc_ctx, ALG_AES128_GCM_IV12_TAG16_NO_KDF));
+
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_RESERVED_NAME,
+        aws_cryptosdk_raw_aes_key_store_keyring_add_key(
+            store, reserved_namespace, key_name, key_bytes, AWS_CRYPTOSDK_AES128));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_raw_aes_key_store_keyring_add_key(
+        store, key_namespace, key_name, key_bytes, AWS_CRYPTOSDK_AES128));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_raw_aes_key_store_keyring_add_key(
+            store, key_namespace, key_name, key_bytes, AWS_CRYPTOSDK_AES128));
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT,
+        aws_cryptosdk_raw_aes_key_store_keyring_set_encrypt_key(store, key_namespace, other_key_name));
+
+    aws_cryptosdk_keyring_release(store);
+    tear_down_all_the_things();
+    return 0;
+}
+
 static int fail_on_disallowed_namespace() {
     AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "aws-kms");
     TEST_ASSERT_ADDR_NULL(aws_cryptosdk_raw_aes_keyring_new(NULL, key_namespace, NULL, NULL, 0));
@@ -183,6 +400,10 @@ struct test_case raw_aes_keyring_encrypt_test_cases[] = {
     { "raw_aes_keyring", "encrypt_decrypt_data_key", encrypt_decrypt_data_key },
     { "raw_aes_keyring", "generate_decrypt_data_key", generate_decrypt_data_key },
     { "raw_aes_keyring", "encrypt_data_key_test_vectors", encrypt_data_key_test_vectors },
+    { "raw_aes_keyring", "data_keys_in_secure_pool", data_keys_in_secure_pool },
+    { "raw_aes_keyring", "encrypt_decrypt_with_serialized_enc_ctx", encrypt_decrypt_with_serialized_enc_ctx },
+    { "raw_aes_keyring", "key_store_keyring_matches_raw_aes_keyrings", key_store_keyring_matches_raw_aes_keyrings },
+    { "raw_aes_keyring", "key_store_keyring_errors", key_store_keyring_errors },
     { "raw_aes_keyring", "fail_on_disallowed_namespace", fail_on_disallowed_namespace },
     { NULL }
 };
@@ -15,6 +15,7 @@
 #include <aws/cryptosdk/materials.h>
 #include <aws/cryptosdk/raw_rsa_keyring.h>
 #include "raw_rsa_keyring_test_vectors.h"
+#include "task_threads.h"
 #include "testing.h"
 
 static struct aws_cryptosdk_edk good_edk() {
@@ -181,21 +182,14 @@ int decrypt_data_key_from_bad_edk() {
 }
 
 /**
- * Test to check for decryption failure of an encrypted data key with an incorrect rsa private key.
+ * Test to check that an incorrect rsa private key is rejected when the keyring is created, as keys are
+ * parsed up front rather than on each decrypt.
  */
 int decrypt_data_key_from_bad_rsa_private_key() {
     struct raw_rsa_keyring_test_vector tv = raw_rsa_keyring_test_vectors[0];
-    TEST_ASSERT_SUCCESS(set_up_all_the_things(tv.rsa_padding_mode, false));
-
-    struct aws_cryptosdk_edk edk = edk_init_test_vector(&tv);
-    aws_array_list_push_back(&edks, (void *)&edk);
-
-    TEST_ASSERT_INT_EQ(
-        AWS_OP_SUCCESS,
-        aws_cryptosdk_keyring_on_decrypt(kr, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, tv.alg));
-    TEST_ASSERT_ADDR_NULL(unencrypted_data_key.buffer);
-    TEST_ASSERT(!aws_array_list_length(&keyring_trace));
-    tear_down_all_the_things();
+    aws_reset_error();
+    TEST_ASSERT_ADDR_NULL(raw_rsa_keyring_tv_new_with_wrong_key(aws_default_allocator(), tv.rsa_padding_mode));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
     return 0;
 }
 
@@ -221,11 +215,82 @@ int decrypt_data_key_from_bad_rsa_padding_mode() {
     return 0;
 }
 
+#define NUM_BATCH_ITEMS 24
+#define NUM_BATCH_WORKERS 3
+
+/**
+ * A batch unwraps every item as On Decrypt would, both on the calling thread alone and spread
+ * over workers, with failures confined to their own items.
+ */
+int decrypt_batch_matches_on_decrypt() {
+    const enum aws_cryptosdk_alg_id alg = ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384;
+    static struct aws_array_list item_edks[NUM_BATCH_ITEMS], item_traces[NUM_BATCH_ITEMS];
+    static struct aws_byte_buf data_keys[NUM_BATCH_ITEMS];
+    struct aws_cryptosdk_raw_rsa_batch_item items[NUM_BATCH_ITEMS];
+
+    TEST_ASSERT_SUCCESS(set_up_all_the_things(AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1, true));
+    for (int i = 0; i < NUM_BATCH_ITEMS; i++) {
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_list_init(alloc, &item_edks[i]));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_init(alloc, &item_traces[i]));
+        data_keys[i] = (struct aws_byte_buf){ 0 };
+        // The last item has no EDKs, so no data key
+        if (i != NUM_BATCH_ITEMS - 1) {
+            TEST_ASSERT_SUCCESS(
+                aws_cryptosdk_keyring_on_encrypt(kr, alloc, &data_keys[i], &keyring_trace, &item_edks[i], NULL, alg));
+        }
+    }
+
+    for (int use_executor = 0; use_executor < 2; use_executor++) {
+        for (int i = 0; i < NUM_BATCH_ITEMS; i++) {
+            items[i] = (struct aws_cryptosdk_raw_rsa_batch_item){
+                .edks = &item_edks[i], .alg = alg, .keyring_trace = &item_traces[i], .error = -1
+            };
+        }
+        // An item whose output is already allocated fails on its own
+        TEST_ASSERT_SUCCESS(aws_byte_buf_init(&items[3].unencrypted_data_key, alloc, 1));
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_raw_rsa_keyring_decrypt_batch(
+            kr,
+            alloc,
+            items,
+            NUM_BATCH_ITEMS,
+            use_executor ? aws_cryptosdk_test_thread_per_task_executor : NULL,
+            NULL,
+            NUM_BATCH_WORKERS));
+        aws_cryptosdk_test_join_task_threads();
+
+        for (int i = 0; i < NUM_BATCH_ITEMS; i++) {
+            if (i == 3) {
+                TEST_ASSERT_INT_EQ(items[i].error, AWS_CRYPTOSDK_ERR_BAD_STATE);
+            } else if (i == NUM_BATCH_ITEMS - 1) {
+                TEST_ASSERT_INT_EQ(items[i].error, AWS_ERROR_SUCCESS);
+                TEST_ASSERT_ADDR_NULL(items[i].unencrypted_data_key.buffer);
+            } else {
+                TEST_ASSERT_INT_EQ(items[i].error, AWS_ERROR_SUCCESS);
+                TEST_ASSERT(aws_byte_buf_eq(&items[i].unencrypted_data_key, &data_keys[i]));
+                TEST_ASSERT_SUCCESS(raw_rsa_keyring_tv_trace_updated_properly(
+                    &item_traces[i], AWS_CRYPTOSDK_WRAPPING_KEY_DECRYPTED_DATA_KEY));
+            }
+            aws_byte_buf_clean_up(&items[i].unencrypted_data_key);
+            aws_cryptosdk_keyring_trace_clear(&item_traces[i]);
+        }
+    }
+
+    for (int i = 0; i < NUM_BATCH_ITEMS; i++) {
+        aws_cryptosdk_edk_list_clean_up(&item_edks[i]);
+        aws_cryptosdk_keyring_trace_clean_up(&item_traces[i]);
+        aws_byte_buf_clean_up(&data_keys[i]);
+    }
+    tear_down_all_the_things();
+    return 0;
+}
+
 struct test_case raw_rsa_keyring_decrypt_test_cases[] = {
     { "raw_rsa_keyring", "decrypt_data_key_from_test_vectors", decrypt_data_key_from_test_vectors },
     { "raw_rsa_keyring", "decrypt_data_key_from_multiple_edks", decrypt_data_key_from_multiple_edks },
     { "raw_rsa_keyring", "decrypt_data_key_from_bad_edk", decrypt_data_key_from_bad_edk },
     { "raw_rsa_keyring", "decrypt_data_key_from_bad_rsa_private_key", decrypt_data_key_from_bad_rsa_private_key },
     { "raw_rsa_keyring", "decrypt_data_key_from_bad_rsa_padding_mode", decrypt_data_key_from_bad_rsa_padding_mode },
+    { "raw_rsa_keyring", "decrypt_batch_matches_on_decrypt", decrypt_batch_matches_on_decrypt },
     { NULL }
 };
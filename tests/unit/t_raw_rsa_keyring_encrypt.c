@@ -13,13 +13,12 @@
  * limitations under the License.
  */
 #include <aws/cryptosdk/materials.h>
+#include <aws/cryptosdk/private/cipher.h>
 #include <aws/cryptosdk/raw_rsa_keyring.h>
 #include "raw_rsa_keyring_test_vectors.h"
 #include "testing.h"
 
 static struct aws_allocator *alloc;
-// FIXME: refactor to use one keyring pointer and one setup/teardown function pair
-static struct aws_cryptosdk_keyring *kr1;
 static struct aws_cryptosdk_keyring *kr2;
 static struct aws_array_list keyring_trace;
 static struct aws_array_list edks;
@@ -35,24 +34,6 @@ static enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode[] = { AWS_CRYPTOSDK_
                                                                   AWS_CRYPTOSDK_RSA_OAEP_SHA1_MGF1,
                                                                   AWS_CRYPTOSDK_RSA_OAEP_SHA256_MGF1 };
 
-static int set_up_encrypt_with_wrong_key(enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
-    alloc = aws_default_allocator();
-    kr1   = raw_rsa_keyring_tv_new_with_wrong_key(alloc, rsa_padding_mode);
-    TEST_ASSERT_ADDR_NOT_NULL(kr1);
-
-    TEST_ASSERT_SUCCESS(aws_cryptosdk_keyring_trace_init(alloc, &keyring_trace));
-    TEST_ASSERT_SUCCESS(aws_cryptosdk_edk_list_init(alloc, &edks));
-
-    return 0;
-}
-
-static void tear_down_encrypt() {
-    aws_cryptosdk_keyring_release(kr1);
-    aws_cryptosdk_edk_list_clean_up(&edks);
-    aws_cryptosdk_keyring_trace_clean_up(&keyring_trace);
-    aws_byte_buf_clean_up(&unencrypted_data_key);
-}
-
 static int set_up_encrypt_decrypt(enum aws_cryptosdk_rsa_padding_mode rsa_padding_mode) {
     alloc = aws_default_allocator();
     kr2   = raw_rsa_keyring_tv_new(alloc, rsa_padding_mode);
@@ -131,20 +112,23 @@ static int encrypt_decrypt_data_key_from_test_vectors() {
 }
 
 /**
- * Test to check for encryption failure of an unencrypted data key with an incorrect rsa public key.
+ * Test to check that an incorrect rsa public key is rejected when the keyring is created, as keys are
+ * parsed up front rather than on each encrypt.
  */
 static int encrypt_data_key_from_bad_rsa_public_key() {
-    uint8_t data_key_dup[32];
     struct raw_rsa_keyring_test_vector tv = raw_rsa_keyring_test_vectors[0];
-    TEST_ASSERT_SUCCESS(set_up_encrypt_with_wrong_key(tv.rsa_padding_mode));
-    memcpy(data_key_dup, tv.data_key, tv.data_key_len);
-    unencrypted_data_key = aws_byte_buf_from_array(data_key_dup, tv.data_key_len);
-    TEST_ASSERT_ERROR(
-        AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN,
-        aws_cryptosdk_keyring_on_encrypt(kr1, alloc, &unencrypted_data_key, &keyring_trace, &edks, NULL, tv.alg));
-    TEST_ASSERT_INT_EQ(aws_array_list_length(&edks), 0);
-    TEST_ASSERT(!aws_array_list_length(&keyring_trace));
-    tear_down_encrypt();
+    AWS_STATIC_STRING_FROM_LITERAL(master_key_id, "master key ID");
+    AWS_STATIC_STRING_FROM_LITERAL(provider_id, "provider ID");
+    const char public_key[] = "Test not-PEM public key";
+
+    aws_reset_error();
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_raw_rsa_keyring_new(
+        aws_default_allocator(), provider_id, master_key_id, NULL, public_key, tv.rsa_padding_mode));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
+
+    aws_reset_error();
+    TEST_ASSERT_ADDR_NULL(raw_rsa_keyring_tv_new_with_wrong_key(aws_default_allocator(), tv.rsa_padding_mode));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_CRYPTOSDK_ERR_CRYPTO_UNKNOWN);
 
     return 0;
 }
@@ -156,8 +140,6 @@ static int test_for_null_pem_files_while_setting_up_rsa_kr() {
     alloc                            = aws_default_allocator();
     AWS_STATIC_STRING_FROM_LITERAL(master_key_id, "master key ID");
     AWS_STATIC_STRING_FROM_LITERAL(provider_id, "provider ID");
-    const char public_key[]  = "Test not-NULL public key";
-    const char private_key[] = "Test not-NULL private key";
 
     aws_reset_error();
     kr = aws_cryptosdk_raw_rsa_keyring_new(alloc, provider_id, master_key_id, NULL, NULL, AWS_CRYPTOSDK_RSA_PKCS1);
@@ -165,18 +147,65 @@ static int test_for_null_pem_files_while_setting_up_rsa_kr() {
     TEST_ASSERT_ADDR_NULL(kr);
 
     kr = aws_cryptosdk_raw_rsa_keyring_new(
-        alloc, provider_id, master_key_id, private_key, NULL, AWS_CRYPTOSDK_RSA_PKCS1);
+        alloc, provider_id, master_key_id, raw_rsa_keyring_tv_private_key, NULL, AWS_CRYPTOSDK_RSA_PKCS1);
     TEST_ASSERT_ADDR_NOT_NULL(kr);
     aws_cryptosdk_keyring_release(kr);
 
-    kr =
-        aws_cryptosdk_raw_rsa_keyring_new(alloc, provider_id, master_key_id, NULL, public_key, AWS_CRYPTOSDK_RSA_PKCS1);
+    kr = aws_cryptosdk_raw_rsa_keyring_new(
+        alloc, provider_id, master_key_id, NULL, raw_rsa_keyring_tv_public_key, AWS_CRYPTOSDK_RSA_PKCS1);
     TEST_ASSERT_ADDR_NOT_NULL(kr);
     aws_cryptosdk_keyring_release(kr);
 
     return 0;
 }
 
+/**
+ * A key parsed once can be used repeatedly, and interoperates with the PEM-based functions.
+ */
+static int parsed_rsa_key_matches_pem_functions() {
+    alloc                          = aws_default_allocator();
+    struct aws_string *public_pem  = aws_string_new_from_c_str(alloc, raw_rsa_keyring_tv_public_key);
+    struct aws_string *private_pem = aws_string_new_from_c_str(alloc, raw_rsa_keyring_tv_private_key);
+    TEST_ASSERT_ADDR_NOT_NULL(public_pem);
+    TEST_ASSERT_ADDR_NOT_NULL(private_pem);
+
+    struct aws_cryptosdk_rsa_key *public_key =
+        aws_cryptosdk_rsa_public_key_new(alloc, aws_byte_cursor_from_string(public_pem));
+    struct aws_cryptosdk_rsa_key *private_key =
+        aws_cryptosdk_rsa_private_key_new(alloc, aws_byte_cursor_from_string(private_pem));
+    TEST_ASSERT_ADDR_NOT_NULL(public_key);
+    TEST_ASSERT_ADDR_NOT_NULL(private_key);
+
+    const uint8_t data_key[16]   = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    struct aws_byte_cursor plain = aws_byte_cursor_from_array(data_key, sizeof(data_key));
+    struct aws_byte_buf expected = aws_byte_buf_from_array(data_key, sizeof(data_key));
+
+    for (int i = 0; i < sizeof(rsa_padding_mode) / sizeof(*rsa_padding_mode); i++) {
+        struct aws_byte_buf cipher = { 0 };
+        struct aws_byte_buf result = { 0 };
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_rsa_key_encrypt(&cipher, alloc, plain, public_key, rsa_padding_mode[i]));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_rsa_decrypt(
+            &result, alloc, aws_byte_cursor_from_buf(&cipher), private_pem, rsa_padding_mode[i]));
+        TEST_ASSERT(aws_byte_buf_eq(&result, &expected));
+        aws_byte_buf_clean_up(&cipher);
+        aws_byte_buf_clean_up(&result);
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_rsa_encrypt(&cipher, alloc, plain, public_pem, rsa_padding_mode[i]));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_rsa_key_decrypt(
+            &result, alloc, aws_byte_cursor_from_buf(&cipher), private_key, rsa_padding_mode[i]));
+        TEST_ASSERT(aws_byte_buf_eq(&result, &expected));
+        aws_byte_buf_clean_up(&cipher);
+        aws_byte_buf_clean_up(&result);
+    }
+
+    aws_cryptosdk_rsa_key_destroy(public_key);
+    aws_cryptosdk_rsa_key_destroy(private_key);
+    aws_string_destroy(public_pem);
+    aws_string_destroy_secure(private_pem);
+    return 0;
+}
+
 static int fail_on_disallowed_namespace() {
     AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "aws-kms");
     TEST_ASSERT_ADDR_NULL(aws_cryptosdk_raw_rsa_keyring_new(NULL, key_namespace, NULL, NULL, NULL, 0));
@@ -191,6 +220,7 @@ struct test_case raw_rsa_keyring_encrypt_test_cases[] = {
     { "raw_rsa_keyring",
       "test_for_null_pem_files_while_setting_up_rsa_kr",
       test_for_null_pem_files_while_setting_up_rsa_kr },
+    { "raw_rsa_keyring", "parsed_rsa_key_matches_pem_functions", parsed_rsa_key_matches_pem_functions },
     { "raw_rsa_keyring", "fail_on_disallowed_namespace", fail_on_disallowed_namespace },
     { NULL }
 };
@@ -0,0 +1,293 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/byte_buf.h>
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/materials.h>
+#include <string.h>
+#include "cache_test_lib.h"
+#include "testing.h"
+#include "testutil.h"
+
+#define STORE_SLOTS 8
+
+/* An in-memory stand-in for a Redis or memcached server, shared by every "host" in a test */
+struct test_store {
+    struct aws_allocator *alloc;
+    size_t num_values, gets, sets;
+    uint64_t last_ttl;
+    struct aws_byte_buf keys[STORE_SLOTS], values[STORE_SLOTS];
+};
+
+static struct aws_byte_buf *store_lookup(struct test_store *store, struct aws_byte_cursor key) {
+    for (size_t i = 0; i < store->num_values; i++) {
+        if (aws_byte_buf_eq_buf(&store->keys[i], key.ptr, key.len)) return &store->values[i];
+    }
+    return NULL;
+}
+
+static int store_get(void *ctx, struct aws_allocator *alloc, struct aws_byte_cursor key, struct aws_byte_buf *value) {
+    struct test_store *store   = ctx;
+    struct aws_byte_buf *found = store_lookup(store, key);
+
+    store->gets++;
+    if (!found) return AWS_OP_SUCCESS;
+
+    return aws_byte_buf_init_copy(value, alloc, found);
+}
+
+static int store_set(void *ctx, struct aws_byte_cursor key, struct aws_byte_cursor value, uint64_t ttl_secs) {
+    struct test_store *store   = ctx;
+    struct aws_byte_buf *found = store_lookup(store, key);
+
+    store->sets++;
+    store->last_ttl = ttl_secs;
+    if (found) {
+        aws_byte_buf_clean_up(found);
+    } else {
+        if (store->num_values == STORE_SLOTS) return aws_raise_error(AWS_ERROR_OOM);
+        if (aws_byte_buf_init_copy_from_cursor(&store->keys[store->num_values], store->alloc, key)) {
+            return AWS_OP_ERR;
+        }
+        found = &store->values[store->num_values++];
+    }
+
+    return aws_byte_buf_init_copy_from_cursor(found, store->alloc, value);
+}
+
+static void store_clean_up(struct test_store *store) {
+    for (size_t i = 0; i < store->num_values; i++) {
+        aws_byte_buf_clean_up(&store->keys[i]);
+        aws_byte_buf_clean_up(&store->values[i]);
+    }
+}
+
+static bool contains(const struct aws_byte_buf *haystack, const struct aws_byte_buf *needle) {
+    for (size_t i = 0; i + needle->len <= haystack->len; i++) {
+        if (!memcmp(haystack->buffer + i, needle->buffer, needle->len)) return true;
+    }
+    return false;
+}
+
+static const uint8_t wrapping_key_bytes[32] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                                                17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32 };
+
+static struct aws_cryptosdk_materials_cache *new_host_cache(struct test_store *store, const uint8_t *key_bytes) {
+    struct aws_cryptosdk_remote_cache_store callbacks = { .ctx = store, .get = store_get, .set = store_set };
+    struct aws_cryptosdk_materials_cache *local = aws_cryptosdk_materials_cache_local_new(store->alloc, 16);
+
+    if (!local) return NULL;
+
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_remote_new(
+        store->alloc, local, &callbacks, aws_byte_cursor_from_array(key_bytes, sizeof(wrapping_key_bytes)), 300);
+
+    // The remote cache keeps its own reference to the local cache
+    aws_cryptosdk_materials_cache_release(local);
+    return cache;
+}
+
+static struct aws_cryptosdk_dec_materials *new_dec_materials(void) {
+    struct aws_byte_buf data_key = aws_byte_buf_from_c_str("THE MAGIC WORDS ARE SQUEAMISH OSSIFRAGE");
+    struct aws_cryptosdk_dec_materials *materials =
+        aws_cryptosdk_dec_materials_new(aws_default_allocator(), ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384);
+    AWS_STATIC_STRING_FROM_LITERAL(pubkey, "AoZ0mPKrKqcCyWlF47FYUrk4as696N4WUmv+54kp58hBiGJ22Fm+g4esiICWcOrgfQ==");
+
+    if (!materials || aws_byte_buf_init_copy(&materials->unencrypted_data_key, aws_default_allocator(), &data_key) ||
+        aws_cryptosdk_sig_verify_start(
+            &materials->signctx, aws_default_allocator(), pubkey, aws_cryptosdk_alg_props(materials->alg))) {
+        aws_cryptosdk_dec_materials_destroy(materials);
+        return NULL;
+    }
+
+    return materials;
+}
+
+static int shared_between_hosts() {
+    struct test_store store      = { .alloc = aws_default_allocator() };
+    struct aws_byte_buf cache_id = aws_byte_buf_from_c_str("Hello, world!");
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_materials_cache_stats stats;
+    struct aws_cryptosdk_dec_materials *dec_mat_in = new_dec_materials();
+    struct aws_cryptosdk_dec_materials *dec_mat_out = NULL;
+    bool is_encrypt                                 = true;
+
+    struct aws_cryptosdk_materials_cache *host_a = new_host_cache(&store, wrapping_key_bytes);
+    struct aws_cryptosdk_materials_cache *host_b = new_host_cache(&store, wrapping_key_bytes);
+    TEST_ASSERT_ADDR_NOT_NULL(host_a);
+    TEST_ASSERT_ADDR_NOT_NULL(host_b);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_mat_in);
+
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(host_a, &entry, dec_mat_in, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(host_a, entry, false);
+
+    // The store only ever sees the sealed materials
+    TEST_ASSERT_INT_EQ(1, store.num_values);
+    TEST_ASSERT_INT_EQ(300, store.last_ttl);
+    TEST_ASSERT(!contains(&store.values[0], &dec_mat_in->unencrypted_data_key));
+
+    // The other host misses locally, and finds the materials in the store
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(host_b, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT(!is_encrypt);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_materials_cache_get_dec_materials(host_b, aws_default_allocator(), &dec_mat_out, entry));
+    aws_cryptosdk_materials_cache_entry_release(host_b, entry, false);
+    TEST_ASSERT(dec_materials_eq(dec_mat_in, dec_mat_out));
+    aws_cryptosdk_dec_materials_destroy(dec_mat_out);
+
+    // ... and then holds them locally
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(host_b, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(host_b, entry, false);
+    TEST_ASSERT_INT_EQ(1, store.gets);
+    TEST_ASSERT_INT_EQ(1, store.sets);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(host_b, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.remote_hits);
+    TEST_ASSERT_INT_EQ(0, stats.remote_misses);
+    TEST_ASSERT_INT_EQ(1, stats.decrypt_hits);
+
+    aws_cryptosdk_dec_materials_destroy(dec_mat_in);
+    aws_cryptosdk_materials_cache_release(host_a);
+    aws_cryptosdk_materials_cache_release(host_b);
+    store_clean_up(&store);
+
+    return 0;
+}
+
+static int unreadable_values_miss() {
+    struct test_store store      = { .alloc = aws_default_allocator() };
+    struct aws_byte_buf cache_id = aws_byte_buf_from_c_str("Hello, world!");
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_materials_cache_stats stats;
+    struct aws_cryptosdk_dec_materials *dec_mat_in = new_dec_materials();
+    uint8_t other_key_bytes[sizeof(wrapping_key_bytes)];
+
+    memcpy(other_key_bytes, wrapping_key_bytes, sizeof(other_key_bytes));
+    other_key_bytes[0] ^= 1;
+
+    struct aws_cryptosdk_materials_cache *host_a     = new_host_cache(&store, wrapping_key_bytes);
+    struct aws_cryptosdk_materials_cache *other_host = new_host_cache(&store, other_key_bytes);
+    TEST_ASSERT_ADDR_NOT_NULL(host_a);
+    TEST_ASSERT_ADDR_NOT_NULL(other_host);
+    TEST_ASSERT_ADDR_NOT_NULL(dec_mat_in);
+
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(host_a, &entry, dec_mat_in, &cache_id);
+    aws_cryptosdk_materials_cache_entry_release(host_a, entry, false);
+
+    // A host with another wrapping key cannot open the value
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(other_host, &entry, NULL, &cache_id));
+    TEST_ASSERT_ADDR_NULL(entry);
+
+    // Nor can a host with the right key once the value is tampered with
+    aws_cryptosdk_materials_cache_clear(host_a);
+    store.values[0].buffer[store.values[0].len - 1] ^= 1;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(host_a, &entry, NULL, &cache_id));
+    TEST_ASSERT_ADDR_NULL(entry);
+
+    // A value stored under one key is not accepted under another
+    struct aws_byte_buf other_id = aws_byte_buf_from_c_str("Goodbye, world!");
+    store.values[0].buffer[store.values[0].len - 1] ^= 1;
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(host_a, &entry, dec_mat_in, &other_id);
+    aws_cryptosdk_materials_cache_entry_release(host_a, entry, false);
+    aws_cryptosdk_materials_cache_clear(host_a);
+    TEST_ASSERT_INT_EQ(2, store.num_values);
+
+    struct aws_byte_buf swap = store.values[0];
+    store.values[0]          = store.values[1];
+    store.values[1]          = swap;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(host_a, &entry, NULL, &other_id));
+    TEST_ASSERT_ADDR_NULL(entry);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(host_a, &stats));
+    TEST_ASSERT_INT_EQ(0, stats.remote_hits);
+    TEST_ASSERT_INT_EQ(2, stats.remote_misses);
+
+    aws_cryptosdk_dec_materials_destroy(dec_mat_in);
+    aws_cryptosdk_materials_cache_release(host_a);
+    aws_cryptosdk_materials_cache_release(other_host);
+    store_clean_up(&store);
+
+    return 0;
+}
+
+static int encrypt_entries_stay_local() {
+    struct test_store store      = { .alloc = aws_default_allocator() };
+    struct aws_byte_buf cache_id = aws_byte_buf_from_c_str("encrypt");
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_cache_usage_stats usage      = { 100, 1 };
+    struct aws_cryptosdk_enc_materials *enc_mat       = NULL;
+    struct aws_hash_table enc_ctx;
+    bool is_encrypt = false;
+
+    struct aws_cryptosdk_materials_cache *cache = new_host_cache(&store, wrapping_key_bytes);
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx));
+    gen_enc_materials(aws_default_allocator(), &enc_mat, 1, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384, 2);
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat, usage, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    TEST_ASSERT_INT_EQ(0, store.sets);
+
+    // Usage is still counted by the local cache
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT(is_encrypt);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_update_usage_stats(cache, entry, &usage));
+    TEST_ASSERT_INT_EQ(200, usage.bytes_encrypted);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    TEST_ASSERT_INT_EQ(0, store.gets);
+
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_cryptosdk_materials_cache_release(cache);
+    store_clean_up(&store);
+
+    return 0;
+}
+
+static int bad_arguments() {
+    struct test_store store                           = { .alloc = aws_default_allocator() };
+    struct aws_cryptosdk_remote_cache_store callbacks = { .ctx = &store, .get = store_get, .set = store_set };
+    struct aws_cryptosdk_materials_cache *local = aws_cryptosdk_materials_cache_local_new(store.alloc, 16);
+    struct aws_byte_cursor key                  = aws_byte_cursor_from_array(wrapping_key_bytes, 32);
+
+    TEST_ASSERT_ADDR_NOT_NULL(local);
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_materials_cache_remote_new(store.alloc, local, &callbacks, key, 0));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_INVALID_ARGUMENT, aws_last_error());
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_materials_cache_remote_new(
+        store.alloc, local, &callbacks, aws_byte_cursor_from_array(wrapping_key_bytes, 20), 300));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_INVALID_BUFFER_SIZE, aws_last_error());
+
+    callbacks.set = NULL;
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_materials_cache_remote_new(store.alloc, local, &callbacks, key, 300));
+    TEST_ASSERT_INT_EQ(AWS_ERROR_INVALID_ARGUMENT, aws_last_error());
+
+    aws_cryptosdk_materials_cache_release(local);
+
+    return 0;
+}
+
+#define TEST_CASE(name) \
+    { "remote_cache", #name, name }
+struct test_case remote_cache_test_cases[] = { TEST_CASE(shared_between_hosts),
+                                               TEST_CASE(unreadable_values_miss),
+                                               TEST_CASE(encrypt_entries_stay_local),
+                                               TEST_CASE(bad_arguments),
+                                               { NULL } };
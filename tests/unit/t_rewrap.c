@@ -0,0 +1,234 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/raw_aes_keyring.h>
+#include <aws/cryptosdk/rewrap.h>
+#include <aws/cryptosdk/session.h>
+#include "testing.h"
+
+#include <string.h>
+
+AWS_STATIC_STRING_FROM_LITERAL(key_namespace, "rewrap-test");
+AWS_STATIC_STRING_FROM_LITERAL(old_key_name, "old key");
+AWS_STATIC_STRING_FROM_LITERAL(new_key_name, "new key");
+static const uint8_t old_key[32] = { 1 };
+static const uint8_t new_key[32] = { 2 };
+
+#define PT_SIZE 1000
+#define FRAME_SIZE 128
+#define CT_CAP 4096
+
+static uint8_t pt[PT_SIZE], ct[CT_CAP], rewrapped[CT_CAP];
+static size_t ct_len, rewrapped_len;
+
+static struct aws_cryptosdk_keyring *new_keyring(const struct aws_string *name, const uint8_t *key) {
+    return aws_cryptosdk_raw_aes_keyring_new(aws_default_allocator(), key_namespace, name, key, AWS_CRYPTOSDK_AES256);
+}
+
+static int encrypt_message(enum aws_cryptosdk_alg_id alg_id) {
+    AWS_STATIC_STRING_FROM_LITERAL(ctx_key, "purpose");
+    AWS_STATIC_STRING_FROM_LITERAL(ctx_value, "rotation");
+    struct aws_allocator *alloc = aws_default_allocator();
+    size_t in_read;
+
+    for (size_t i = 0; i < sizeof(pt); i++) pt[i] = (uint8_t)i;
+
+    struct aws_cryptosdk_keyring *kr = new_keyring(old_key_name, old_key);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_keyring_release(kr);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_default_cmm_set_alg_id(cmm, alg_id));
+
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_from_cmm(alloc, AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    aws_cryptosdk_cmm_release(cmm);
+    TEST_ASSERT_SUCCESS(
+        aws_hash_table_put(aws_cryptosdk_session_get_enc_ctx_ptr_mut(session), ctx_key, (void *)ctx_value, NULL));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_frame_size(session, FRAME_SIZE));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, ct, sizeof(ct), &ct_len, pt, sizeof(pt), &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    aws_cryptosdk_session_destroy(session);
+    return 0;
+}
+
+/* Decrypts the message with a keyring holding only the given key, and checks the plaintext if it succeeds */
+static int decrypt_with(const struct aws_string *name, const uint8_t *key, const uint8_t *msg, size_t msg_len) {
+    struct aws_allocator *alloc = aws_default_allocator();
+    uint8_t decrypted[PT_SIZE];
+    size_t out_len, in_read;
+
+    struct aws_cryptosdk_keyring *kr = new_keyring(name, key);
+    if (!kr) return -1;
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_from_keyring(alloc, AWS_CRYPTOSDK_DECRYPT, kr);
+    aws_cryptosdk_keyring_release(kr);
+    if (!session) return -1;
+
+    int rv = aws_cryptosdk_session_process(session, decrypted, sizeof(decrypted), &out_len, msg, msg_len, &in_read);
+    if (!rv && (!aws_cryptosdk_session_is_done(session) || out_len != sizeof(pt) || memcmp(decrypted, pt, out_len))) {
+        rv = aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT);
+    }
+
+    aws_cryptosdk_session_destroy(session);
+    return rv;
+}
+
+static struct aws_cryptosdk_rewrap *new_rewrap() {
+    struct aws_allocator *alloc = aws_default_allocator();
+
+    struct aws_cryptosdk_keyring *old_kr = new_keyring(old_key_name, old_key);
+    struct aws_cryptosdk_keyring *new_kr = new_keyring(new_key_name, new_key);
+    struct aws_cryptosdk_cmm *cmm        = old_kr ? aws_cryptosdk_default_cmm_new(alloc, old_kr) : NULL;
+    struct aws_cryptosdk_rewrap *rewrap  = cmm && new_kr ? aws_cryptosdk_rewrap_new(alloc, cmm, new_kr) : NULL;
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_keyring_release(old_kr);
+    aws_cryptosdk_keyring_release(new_kr);
+    return rewrap;
+}
+
+/*
+ * Feeds the message through the rewrapper with at most in_chunk bytes of input and out_chunk
+ * bytes of output per call, widening either window when the rewrapper says it needs more.
+ */
+static int pump_rewrap(struct aws_cryptosdk_rewrap *rewrap, size_t in_chunk, size_t out_chunk) {
+    size_t in_pos = 0;
+    rewrapped_len = 0;
+
+    while (!aws_cryptosdk_rewrap_is_done(rewrap)) {
+        size_t in_len  = ct_len - in_pos < in_chunk ? ct_len - in_pos : in_chunk;
+        size_t out_len = sizeof(rewrapped) - rewrapped_len < out_chunk ? sizeof(rewrapped) - rewrapped_len : out_chunk;
+        size_t written, read, out_needed, in_needed;
+
+        if (aws_cryptosdk_rewrap_message(
+                rewrap, rewrapped + rewrapped_len, out_len, &written, ct + in_pos, in_len, &read)) {
+            return AWS_OP_ERR;
+        }
+        rewrapped_len += written;
+        in_pos += read;
+
+        if (!written && !read) {
+            aws_cryptosdk_rewrap_estimate_buf(rewrap, &out_needed, &in_needed);
+            TEST_ASSERT(out_needed > out_len || in_needed > in_len);
+            if (out_needed > out_chunk) out_chunk = out_needed;
+            if (in_needed > in_chunk) in_chunk = in_needed;
+        }
+    }
+    TEST_ASSERT_INT_EQ(in_pos, ct_len);
+
+    return 0;
+}
+
+static int rewrapped_message_decrypts_with_new_key_only() {
+    TEST_ASSERT_SUCCESS(encrypt_message(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    struct aws_cryptosdk_rewrap *rewrap = new_rewrap();
+    TEST_ASSERT_ADDR_NOT_NULL(rewrap);
+
+    TEST_ASSERT_SUCCESS(pump_rewrap(rewrap, SIZE_MAX, SIZE_MAX));
+    TEST_ASSERT_SUCCESS(decrypt_with(new_key_name, new_key, rewrapped, rewrapped_len));
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_CANNOT_DECRYPT, decrypt_with(old_key_name, old_key, rewrapped, rewrapped_len));
+
+    // Both key names are the same length, so the header keeps its size and the body is untouched
+    TEST_ASSERT_INT_EQ(rewrapped_len, ct_len);
+    size_t body_offset = ct_len - (sizeof(pt) / FRAME_SIZE + 1) * (4 + 12 + 16) - sizeof(pt) - 8;
+    TEST_ASSERT(!memcmp(rewrapped + body_offset, ct + body_offset, ct_len - body_offset));
+    TEST_ASSERT(memcmp(rewrapped, ct, body_offset));
+
+    // A reset rewrapper starts on a new message
+    aws_cryptosdk_rewrap_reset(rewrap);
+    TEST_ASSERT(!aws_cryptosdk_rewrap_is_done(rewrap));
+    TEST_ASSERT_SUCCESS(pump_rewrap(rewrap, SIZE_MAX, SIZE_MAX));
+    TEST_ASSERT_SUCCESS(decrypt_with(new_key_name, new_key, rewrapped, rewrapped_len));
+
+    aws_cryptosdk_rewrap_destroy(rewrap);
+    return 0;
+}
+
+static int small_chunks() {
+    static const size_t chunks[] = { 1, 7, 64, 200 };
+
+    TEST_ASSERT_SUCCESS(encrypt_message(ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256));
+    struct aws_cryptosdk_rewrap *rewrap = new_rewrap();
+    TEST_ASSERT_ADDR_NOT_NULL(rewrap);
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        for (size_t j = 0; j < sizeof(chunks) / sizeof(chunks[0]); j++) {
+            aws_cryptosdk_rewrap_reset(rewrap);
+            TEST_ASSERT_SUCCESS(pump_rewrap(rewrap, chunks[i], chunks[j]));
+            TEST_ASSERT_SUCCESS(decrypt_with(new_key_name, new_key, rewrapped, rewrapped_len));
+        }
+    }
+
+    aws_cryptosdk_rewrap_destroy(rewrap);
+    return 0;
+}
+
+static int signed_suites_are_refused() {
+    TEST_ASSERT_SUCCESS(encrypt_message(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384));
+    struct aws_cryptosdk_rewrap *rewrap = new_rewrap();
+    TEST_ASSERT_ADDR_NOT_NULL(rewrap);
+
+    TEST_ASSERT_ERROR(AWS_ERROR_UNSUPPORTED_OPERATION, pump_rewrap(rewrap, SIZE_MAX, SIZE_MAX));
+
+    aws_cryptosdk_rewrap_destroy(rewrap);
+    return 0;
+}
+
+static int bad_messages_are_refused() {
+    uint8_t out[CT_CAP];
+    size_t written, read;
+
+    TEST_ASSERT_SUCCESS(encrypt_message(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256));
+    struct aws_cryptosdk_rewrap *rewrap = new_rewrap();
+    TEST_ASSERT_ADDR_NOT_NULL(rewrap);
+
+    // The message ID is covered by the header tag, so the header no longer authenticates
+    ct[5] ^= 1;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_rewrap_message(rewrap, out, sizeof(out), &written, ct, ct_len, &read));
+    TEST_ASSERT_INT_EQ(written, 0);
+
+    // The error sticks until the rewrapper is reset
+    ct[5] ^= 1;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT,
+        aws_cryptosdk_rewrap_message(rewrap, out, sizeof(out), &written, ct, ct_len, &read));
+    aws_cryptosdk_rewrap_reset(rewrap);
+    TEST_ASSERT_SUCCESS(pump_rewrap(rewrap, SIZE_MAX, SIZE_MAX));
+
+    // Frames out of order are caught while copying, though their tags are not checked
+    uint8_t *seqno = ct + ct_len - (sizeof(pt) / FRAME_SIZE + 1) * (4 + 12 + 16) - sizeof(pt) - 8 + 3;
+    *seqno ^= 3;
+    aws_cryptosdk_rewrap_reset(rewrap);
+    TEST_ASSERT_ERROR(AWS_CRYPTOSDK_ERR_BAD_CIPHERTEXT, pump_rewrap(rewrap, SIZE_MAX, SIZE_MAX));
+    *seqno ^= 3;
+
+    aws_cryptosdk_rewrap_destroy(rewrap);
+    return 0;
+}
+
+#define TEST_CASE(name) \
+    { "rewrap", #name, name }
+struct test_case rewrap_test_cases[] = { TEST_CASE(rewrapped_message_decrypts_with_new_key_only),
+                                         TEST_CASE(small_chunks),
+                                         TEST_CASE(signed_suites_are_refused),
+                                         TEST_CASE(bad_messages_are_refused),
+                                         { NULL } };
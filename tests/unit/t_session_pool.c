@@ -0,0 +1,256 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/atomics.h>
+#include <aws/common/thread.h>
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/session_pool.h>
+#include "testing.h"
+#include "zero_keyring.h"
+
+static struct aws_cryptosdk_cmm *new_cmm(void) {
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_zero_keyring_new(aws_default_allocator());
+    if (!kr) return NULL;
+
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_default_cmm_new(aws_default_allocator(), kr);
+    aws_cryptosdk_keyring_release(kr);
+    return cmm;
+}
+
+/* Encrypts a short message into ct, which must have room for all of it */
+static int encrypt_message(struct aws_cryptosdk_session *session, uint8_t *ct, size_t ct_capacity, size_t *ct_len) {
+    static const uint8_t pt[] = "Hello, pool";
+    size_t read;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, ct, ct_capacity, ct_len, pt, sizeof(pt), &read));
+    TEST_ASSERT_INT_EQ(read, sizeof(pt));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    return 0;
+}
+
+static int released_session_is_reused() {
+    struct aws_cryptosdk_cmm *cmm = new_cmm();
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    struct aws_cryptosdk_session_pool *pool =
+        aws_cryptosdk_session_pool_new(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, cmm, 2, NULL, NULL);
+    TEST_ASSERT_ADDR_NOT_NULL(pool);
+    // The pool holds its own reference
+    aws_cryptosdk_cmm_release(cmm);
+
+    uint8_t ct[1024];
+    size_t ct_len;
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_pool_acquire(pool);
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+    TEST_ASSERT_SUCCESS(encrypt_message(session, ct, sizeof(ct), &ct_len));
+    aws_cryptosdk_session_pool_release(pool, session);
+
+    // The same thread gets the same session back, reset for the next message
+    struct aws_cryptosdk_session *again = aws_cryptosdk_session_pool_acquire(pool);
+    TEST_ASSERT_ADDR_EQ(again, session);
+    TEST_ASSERT(!aws_cryptosdk_session_is_done(again));
+    TEST_ASSERT_SUCCESS(encrypt_message(again, ct, sizeof(ct), &ct_len));
+
+    // A session abandoned part-way through a message is reset as well
+    struct aws_cryptosdk_session *other = aws_cryptosdk_session_pool_acquire(pool);
+    TEST_ASSERT_ADDR_NOT_NULL(other);
+    TEST_ASSERT_ADDR_NE(other, again);
+    size_t written, read;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(other, 100));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(other, ct, sizeof(ct), &written, ct, 10, &read));
+    aws_cryptosdk_session_pool_release(pool, other);
+    aws_cryptosdk_session_pool_release(pool, again);
+
+    session = aws_cryptosdk_session_pool_acquire(pool);
+    TEST_ASSERT_SUCCESS(encrypt_message(session, ct, sizeof(ct), &ct_len));
+    aws_cryptosdk_session_pool_release(pool, session);
+    session = aws_cryptosdk_session_pool_acquire(pool);
+    TEST_ASSERT_SUCCESS(encrypt_message(session, ct, sizeof(ct), &ct_len));
+    aws_cryptosdk_session_pool_release(pool, session);
+
+    aws_cryptosdk_session_pool_release(pool, NULL);
+    aws_cryptosdk_session_pool_destroy(pool);
+    return 0;
+}
+
+static int full_freelist_destroys_sessions() {
+    struct aws_cryptosdk_cmm *cmm = new_cmm();
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    struct aws_cryptosdk_session_pool *pool =
+        aws_cryptosdk_session_pool_new(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, cmm, 1, NULL, NULL);
+    TEST_ASSERT_ADDR_NOT_NULL(pool);
+    aws_cryptosdk_cmm_release(cmm);
+
+    struct aws_cryptosdk_session *a = aws_cryptosdk_session_pool_acquire(pool);
+    struct aws_cryptosdk_session *b = aws_cryptosdk_session_pool_acquire(pool);
+    TEST_ASSERT_ADDR_NOT_NULL(a);
+    TEST_ASSERT_ADDR_NOT_NULL(b);
+
+    // Only one fits on this thread's freelist; the other is destroyed (which leak checking verifies)
+    aws_cryptosdk_session_pool_release(pool, a);
+    aws_cryptosdk_session_pool_release(pool, b);
+    TEST_ASSERT_ADDR_EQ(aws_cryptosdk_session_pool_acquire(pool), a);
+    aws_cryptosdk_session_pool_release(pool, a);
+    aws_cryptosdk_session_pool_destroy(pool);
+
+    // A pool which keeps nothing idle still hands out sessions
+    cmm = new_cmm();
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    pool = aws_cryptosdk_session_pool_new(aws_default_allocator(), AWS_CRYPTOSDK_DECRYPT, cmm, 0, NULL, NULL);
+    TEST_ASSERT_ADDR_NOT_NULL(pool);
+    aws_cryptosdk_cmm_release(cmm);
+    a = aws_cryptosdk_session_pool_acquire(pool);
+    TEST_ASSERT_ADDR_NOT_NULL(a);
+    aws_cryptosdk_session_pool_release(pool, a);
+    aws_cryptosdk_session_pool_destroy(pool);
+
+    return 0;
+}
+
+static int sessions_borrow_pool_cmm() {
+    struct aws_cryptosdk_cmm *cmm = new_cmm();
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    struct aws_cryptosdk_session_pool *pool =
+        aws_cryptosdk_session_pool_new(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, cmm, 2, NULL, NULL);
+    TEST_ASSERT_ADDR_NOT_NULL(pool);
+    aws_cryptosdk_cmm_release(cmm);
+    TEST_ASSERT_INT_EQ(aws_atomic_load_int(&cmm->refcount), 1);
+
+    // Neither pooled sessions nor the messages they process touch the CMM's reference count
+    uint8_t ct[1024];
+    size_t ct_len;
+    struct aws_cryptosdk_session *a = aws_cryptosdk_session_pool_acquire(pool);
+    struct aws_cryptosdk_session *b = aws_cryptosdk_session_pool_acquire(pool);
+    TEST_ASSERT_ADDR_NOT_NULL(a);
+    TEST_ASSERT_ADDR_NOT_NULL(b);
+    TEST_ASSERT_SUCCESS(encrypt_message(a, ct, sizeof(ct), &ct_len));
+    TEST_ASSERT_INT_EQ(aws_atomic_load_int(&cmm->refcount), 1);
+    aws_cryptosdk_session_pool_release(pool, a);
+    aws_cryptosdk_session_destroy(b);
+    TEST_ASSERT_INT_EQ(aws_atomic_load_int(&cmm->refcount), 1);
+
+    // Sessions created outside a pool can borrow a CMM the caller keeps alive
+    struct aws_cryptosdk_session *borrowing =
+        aws_cryptosdk_session_new_borrowing_cmm(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, cmm);
+    TEST_ASSERT_ADDR_NOT_NULL(borrowing);
+    TEST_ASSERT_SUCCESS(encrypt_message(borrowing, ct, sizeof(ct), &ct_len));
+    aws_cryptosdk_session_destroy(borrowing);
+    TEST_ASSERT_INT_EQ(aws_atomic_load_int(&cmm->refcount), 1);
+
+    // The pool's reference is the last one, which leak checking verifies is released
+    aws_cryptosdk_session_pool_destroy(pool);
+    return 0;
+}
+
+struct configure_state {
+    int calls;
+    bool fail;
+};
+
+static int configure_session(struct aws_cryptosdk_session *session, void *user_data) {
+    struct configure_state *state = user_data;
+
+    state->calls++;
+    if (state->fail) return aws_raise_error(AWS_CRYPTOSDK_ERR_BAD_STATE);
+    return aws_cryptosdk_session_set_frame_size(session, 1024);
+}
+
+static int configure_runs_once_per_session() {
+    struct configure_state state  = { 0 };
+    struct aws_cryptosdk_cmm *cmm = new_cmm();
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    struct aws_cryptosdk_session_pool *pool = aws_cryptosdk_session_pool_new(
+        aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, cmm, 4, configure_session, &state);
+    TEST_ASSERT_ADDR_NOT_NULL(pool);
+    aws_cryptosdk_cmm_release(cmm);
+
+    for (int i = 0; i < 3; i++) {
+        struct aws_cryptosdk_session *session = aws_cryptosdk_session_pool_acquire(pool);
+        TEST_ASSERT_ADDR_NOT_NULL(session);
+        aws_cryptosdk_session_pool_release(pool, session);
+    }
+    TEST_ASSERT_INT_EQ(state.calls, 1);
+
+    // A session that cannot be configured is never handed out
+    struct aws_cryptosdk_session *held = aws_cryptosdk_session_pool_acquire(pool);
+    TEST_ASSERT_ADDR_NOT_NULL(held);
+    state.fail = true;
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_session_pool_acquire(pool));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_CRYPTOSDK_ERR_BAD_STATE);
+    TEST_ASSERT_INT_EQ(state.calls, 2);
+    aws_cryptosdk_session_pool_release(pool, held);
+
+    aws_cryptosdk_session_pool_destroy(pool);
+
+    TEST_ASSERT_ADDR_NULL(
+        aws_cryptosdk_session_pool_new(aws_default_allocator(), (enum aws_cryptosdk_mode)7, NULL, 4, NULL, NULL));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
+
+    return 0;
+}
+
+#define POOL_THREADS 8
+#define POOL_MESSAGES_PER_THREAD 50
+
+static struct aws_atomic_var pool_failures;
+
+static void pool_worker(void *arg) {
+    struct aws_cryptosdk_session_pool *pool = arg;
+    uint8_t ct[1024];
+    size_t ct_len;
+
+    for (int i = 0; i < POOL_MESSAGES_PER_THREAD; i++) {
+        struct aws_cryptosdk_session *session = aws_cryptosdk_session_pool_acquire(pool);
+        if (!session || encrypt_message(session, ct, sizeof(ct), &ct_len)) {
+            aws_atomic_fetch_add(&pool_failures, 1);
+        }
+        aws_cryptosdk_session_pool_release(pool, session);
+    }
+}
+
+static int concurrent_acquire_release() {
+    struct aws_thread threads[POOL_THREADS];
+    struct aws_cryptosdk_cmm *cmm = new_cmm();
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    struct aws_cryptosdk_session_pool *pool =
+        aws_cryptosdk_session_pool_new(aws_default_allocator(), AWS_CRYPTOSDK_ENCRYPT, cmm, 2, NULL, NULL);
+    TEST_ASSERT_ADDR_NOT_NULL(pool);
+    aws_cryptosdk_cmm_release(cmm);
+
+    aws_atomic_init_int(&pool_failures, 0);
+    for (int i = 0; i < POOL_THREADS; i++) {
+        TEST_ASSERT_SUCCESS(aws_thread_init(&threads[i], aws_default_allocator()));
+        TEST_ASSERT_SUCCESS(aws_thread_launch(&threads[i], pool_worker, pool, NULL));
+    }
+    for (int i = 0; i < POOL_THREADS; i++) {
+        TEST_ASSERT_SUCCESS(aws_thread_join(&threads[i]));
+        aws_thread_clean_up(&threads[i]);
+    }
+    TEST_ASSERT_INT_EQ(aws_atomic_load_int(&pool_failures), 0);
+
+    aws_cryptosdk_session_pool_destroy(pool);
+    return 0;
+}
+
+#define TEST_CASE(name) \
+    { "session_pool", #name, name }
+struct test_case session_pool_test_cases[] = { TEST_CASE(released_session_is_reused),
+                                               TEST_CASE(full_freelist_destroys_sessions),
+                                               TEST_CASE(sessions_borrow_pool_cmm),
+                                               TEST_CASE(configure_runs_once_per_session),
+                                               TEST_CASE(concurrent_acquire_release),
+                                               { NULL } };
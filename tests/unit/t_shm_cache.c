@@ -0,0 +1,331 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/common/byte_buf.h>
+#include <aws/cryptosdk/cache.h>
+#include <aws/cryptosdk/cipher.h>
+#include <aws/cryptosdk/enc_ctx.h>
+#include <aws/cryptosdk/materials.h>
+#include "cache_test_lib.h"
+#include "testing.h"
+#include "testutil.h"
+
+#ifndef _WIN32
+
+#    include <sys/wait.h>
+#    include <unistd.h>
+
+#    define SIGNING_ALG ALG_AES128_GCM_IV12_TAG16_HKDF_SHA256_ECDSA_P256
+
+static uint64_t now = 10000;
+
+/* Exposed for unit tests only */
+void aws_cryptosdk_shm_cache_set_clock(
+    struct aws_cryptosdk_materials_cache *generic_cache, int (*clock_get_ticks)(uint64_t *timestamp));
+
+static int test_clock(uint64_t *timestamp) {
+    *timestamp = now;
+    return AWS_OP_SUCCESS;
+}
+
+static int put_enc_entry(
+    struct aws_cryptosdk_materials_cache *cache,
+    struct aws_cryptosdk_enc_materials **p_materials,
+    struct aws_hash_table *enc_ctx,
+    enum aws_cryptosdk_alg_id alg,
+    const char *cache_id_str) {
+    struct aws_allocator *alloc                       = aws_default_allocator();
+    struct aws_byte_buf cache_id                      = aws_byte_buf_from_c_str(cache_id_str);
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_cache_usage_stats stats      = { 100, 1 };
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(
+        enc_ctx, aws_string_new_from_c_str(alloc, "foo"), aws_string_new_from_c_str(alloc, cache_id_str), NULL));
+    gen_enc_materials(alloc, p_materials, 1, alg, 3);
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, *p_materials, stats, enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    return 0;
+}
+
+/* Checks that the entry for cache_id_str matches the given materials, if present; returns 0 if present */
+static int check_enc_entry(
+    struct aws_cryptosdk_materials_cache *cache,
+    const struct aws_cryptosdk_enc_materials *expected_materials,
+    const struct aws_hash_table *expected_enc_ctx,
+    const char *cache_id_str) {
+    struct aws_allocator *alloc                       = aws_default_allocator();
+    struct aws_byte_buf cache_id                      = aws_byte_buf_from_c_str(cache_id_str);
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    struct aws_cryptosdk_enc_materials *materials     = NULL;
+    struct aws_hash_table enc_ctx;
+    bool is_encrypt = false;
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+    if (!entry) return 1;
+    TEST_ASSERT(is_encrypt);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_enc_materials(cache, alloc, &materials, &enc_ctx, entry));
+    TEST_ASSERT(materials_eq(expected_materials, materials));
+    TEST_ASSERT(aws_hash_table_eq(expected_enc_ctx, &enc_ctx, aws_hash_callback_string_eq));
+
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+    aws_cryptosdk_enc_materials_destroy(materials);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+
+    return 0;
+}
+
+static int single_put() {
+    struct aws_allocator *alloc                 = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache = aws_cryptosdk_materials_cache_shm_new(alloc, 16, 2048);
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    struct aws_cryptosdk_cache_usage_stats stats = { 1000, 10 };
+    struct aws_byte_buf cache_id                 = aws_byte_buf_from_c_str("Cache ID 1");
+    struct aws_hash_table enc_ctx;
+    bool is_encrypt;
+
+    TEST_ASSERT_ADDR_NOT_NULL(cache);
+    TEST_ASSERT_SUCCESS(put_enc_entry(cache, &enc_mat, &enc_ctx, SIGNING_ALG, "Cache ID 1"));
+    TEST_ASSERT_INT_EQ(1, aws_cryptosdk_materials_cache_entry_count(cache));
+    TEST_ASSERT_SUCCESS(check_enc_entry(cache, enc_mat, &enc_ctx, "Cache ID 1"));
+    TEST_ASSERT_INT_EQ(1, check_enc_entry(cache, enc_mat, &enc_ctx, "Cache ID 2"));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_update_usage_stats(cache, entry, &stats));
+    TEST_ASSERT_INT_EQ(1100, stats.bytes_encrypted);
+    TEST_ASSERT_INT_EQ(11, stats.messages_encrypted);
+
+    struct aws_cryptosdk_dec_materials *dec_mat = (struct aws_cryptosdk_dec_materials *)0xAA;
+    TEST_ASSERT_ERROR(
+        AWS_CRYPTOSDK_ERR_BAD_STATE, aws_cryptosdk_materials_cache_get_dec_materials(cache, alloc, &dec_mat, entry));
+    TEST_ASSERT_ADDR_NULL(dec_mat);
+
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, true);
+    TEST_ASSERT_INT_EQ(1, check_enc_entry(cache, enc_mat, &enc_ctx, "Cache ID 1"));
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_decrypt_entries() {
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_shm_new(aws_default_allocator(), 16, 0);
+    struct aws_byte_buf cache_id     = aws_byte_buf_from_c_str("Hello, world!");
+    struct aws_byte_buf expected_key = aws_byte_buf_from_c_str("THE MAGIC WORDS ARE SQUEAMISH OSSIFRAGE");
+    struct aws_cryptosdk_dec_materials *dec_mat_in =
+        aws_cryptosdk_dec_materials_new(aws_default_allocator(), ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384);
+    AWS_STATIC_STRING_FROM_LITERAL(pubkey, "AoZ0mPKrKqcCyWlF47FYUrk4as696N4WUmv+54kp58hBiGJ22Fm+g4esiICWcOrgfQ==");
+
+    TEST_ASSERT_SUCCESS(
+        aws_byte_buf_init_copy(&dec_mat_in->unencrypted_data_key, aws_default_allocator(), &expected_key));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_verify_start(
+        &dec_mat_in->signctx, aws_default_allocator(), pubkey, aws_cryptosdk_alg_props(dec_mat_in->alg)));
+
+    struct aws_cryptosdk_materials_cache_entry *entry = NULL;
+    aws_cryptosdk_materials_cache_put_entry_for_decrypt(cache, &entry, dec_mat_in, &cache_id);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    struct aws_cryptosdk_dec_materials *dec_mat_out = NULL;
+    bool is_encrypt                                 = true;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT(!is_encrypt);
+    TEST_ASSERT_ADDR_NOT_NULL(entry);
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_materials_cache_get_dec_materials(cache, aws_default_allocator(), &dec_mat_out, entry));
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    TEST_ASSERT(dec_materials_eq(dec_mat_in, dec_mat_out));
+
+    struct aws_string *pubkey_out;
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_get_pubkey(dec_mat_out->signctx, aws_default_allocator(), &pubkey_out));
+    TEST_ASSERT(aws_string_eq(pubkey_out, pubkey));
+
+    aws_string_destroy(pubkey_out);
+    aws_cryptosdk_dec_materials_destroy(dec_mat_out);
+    aws_cryptosdk_dec_materials_destroy(dec_mat_in);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_ttl() {
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_shm_new(aws_default_allocator(), 4, 1024);
+    struct aws_cryptosdk_materials_cache_entry *entry;
+    struct aws_cryptosdk_materials_cache_stats stats;
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    struct aws_byte_buf cache_id = aws_byte_buf_from_c_str("ttl");
+    struct aws_hash_table enc_ctx;
+    bool is_encrypt;
+
+    aws_cryptosdk_shm_cache_set_clock(cache, test_clock);
+    now = 10000;
+
+    TEST_ASSERT_SUCCESS(put_enc_entry(cache, &enc_mat, &enc_ctx, SIGNING_ALG, "ttl"));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_find_entry(cache, &entry, &is_encrypt, &cache_id));
+    TEST_ASSERT_INT_EQ(10000, aws_cryptosdk_materials_cache_entry_get_creation_time(cache, entry));
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, 20000);
+    aws_cryptosdk_materials_cache_entry_ttl_hint(cache, entry, 30000);
+    aws_cryptosdk_materials_cache_entry_release(cache, entry, false);
+
+    now = 19999;
+    TEST_ASSERT_SUCCESS(check_enc_entry(cache, enc_mat, &enc_ctx, "ttl"));
+    now = 20000;
+    TEST_ASSERT_INT_EQ(1, check_enc_entry(cache, enc_mat, &enc_ctx, "ttl"));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.ttl_evictions);
+    TEST_ASSERT_INT_EQ(2, stats.encrypt_hits);
+    TEST_ASSERT_INT_EQ(1, stats.misses);
+    TEST_ASSERT_INT_EQ(0, stats.entries);
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_eviction() {
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_shm_new(aws_default_allocator(), 4, 1024);
+    struct aws_cryptosdk_enc_materials *enc_mat[6];
+    struct aws_hash_table enc_ctx[6];
+    struct aws_cryptosdk_materials_cache_stats stats;
+    char cache_ids[6][8];
+
+    for (int i = 0; i < 6; i++) {
+        snprintf(cache_ids[i], sizeof(cache_ids[i]), "ID %d", i);
+        TEST_ASSERT_SUCCESS(put_enc_entry(cache, &enc_mat[i], &enc_ctx[i], SIGNING_ALG, cache_ids[i]));
+
+        // Keep the first entry recently used, so that it is never the one evicted
+        TEST_ASSERT_SUCCESS(check_enc_entry(cache, enc_mat[0], &enc_ctx[0], cache_ids[0]));
+    }
+
+    TEST_ASSERT_INT_EQ(4, aws_cryptosdk_materials_cache_entry_count(cache));
+    TEST_ASSERT_INT_EQ(1, check_enc_entry(cache, enc_mat[1], &enc_ctx[1], cache_ids[1]));
+    TEST_ASSERT_INT_EQ(1, check_enc_entry(cache, enc_mat[2], &enc_ctx[2], cache_ids[2]));
+    for (int i = 3; i < 6; i++) {
+        TEST_ASSERT_SUCCESS(check_enc_entry(cache, enc_mat[i], &enc_ctx[i], cache_ids[i]));
+    }
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(6, stats.encrypt_puts);
+    TEST_ASSERT_INT_EQ(2, stats.capacity_evictions);
+    TEST_ASSERT_INT_EQ(4, stats.entries);
+
+    aws_cryptosdk_materials_cache_clear(cache);
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(4, stats.cleared);
+
+    for (int i = 0; i < 6; i++) {
+        aws_cryptosdk_enc_materials_destroy(enc_mat[i]);
+        aws_cryptosdk_enc_ctx_clean_up(&enc_ctx[i]);
+    }
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_oversize() {
+    struct aws_allocator *alloc                       = aws_default_allocator();
+    struct aws_cryptosdk_materials_cache *cache       = aws_cryptosdk_materials_cache_shm_new(alloc, 4, 0);
+    struct aws_cryptosdk_materials_cache_entry *entry = (struct aws_cryptosdk_materials_cache_entry *)0xAA;
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    struct aws_cryptosdk_cache_usage_stats stats = { 0, 0 };
+    struct aws_byte_buf cache_id                 = aws_byte_buf_from_c_str("big");
+    struct aws_hash_table enc_ctx;
+
+    // Twenty EDKs of a few dozen bytes each do not fit in a minimum size slot
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(alloc, &enc_ctx));
+    gen_enc_materials(alloc, &enc_mat, 1, SIGNING_ALG, 20);
+
+    aws_cryptosdk_materials_cache_put_entry_for_encrypt(cache, &entry, enc_mat, stats, &enc_ctx, &cache_id);
+    TEST_ASSERT_ADDR_NULL(entry);
+    TEST_ASSERT_INT_EQ(AWS_CRYPTOSDK_ERR_LIMIT_EXCEEDED, aws_last_error());
+    TEST_ASSERT_INT_EQ(0, aws_cryptosdk_materials_cache_entry_count(cache));
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+static int test_fork() {
+    struct aws_cryptosdk_materials_cache *cache =
+        aws_cryptosdk_materials_cache_shm_new(aws_default_allocator(), 16, 2048);
+    struct aws_cryptosdk_materials_cache_stats stats;
+    struct aws_cryptosdk_enc_materials *enc_mat;
+    struct aws_hash_table enc_ctx;
+    int status;
+
+    pid_t child = fork();
+    TEST_ASSERT(child >= 0);
+
+    if (!child) {
+        // Without a signing key the materials are deterministic, so the parent can generate the same ones
+        if (put_enc_entry(cache, &enc_mat, &enc_ctx, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, "From child")) _exit(1);
+        _exit(0);
+    }
+
+    TEST_ASSERT_INT_EQ(child, waitpid(child, &status, 0));
+    TEST_ASSERT(WIFEXITED(status) && !WEXITSTATUS(status));
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_enc_ctx_init(aws_default_allocator(), &enc_ctx));
+    TEST_ASSERT_SUCCESS(aws_hash_table_put(
+        &enc_ctx,
+        aws_string_new_from_c_str(aws_default_allocator(), "foo"),
+        aws_string_new_from_c_str(aws_default_allocator(), "From child"),
+        NULL));
+    gen_enc_materials(aws_default_allocator(), &enc_mat, 1, ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256, 3);
+
+    TEST_ASSERT_SUCCESS(check_enc_entry(cache, enc_mat, &enc_ctx, "From child"));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_materials_cache_get_stats(cache, &stats));
+    TEST_ASSERT_INT_EQ(1, stats.encrypt_puts);
+    TEST_ASSERT_INT_EQ(1, stats.encrypt_hits);
+
+    aws_cryptosdk_enc_materials_destroy(enc_mat);
+    aws_cryptosdk_enc_ctx_clean_up(&enc_ctx);
+    aws_cryptosdk_materials_cache_release(cache);
+
+    return 0;
+}
+
+#    define TEST_CASE(name) \
+        { "shm_cache", #name, name }
+struct test_case shm_cache_test_cases[] = { TEST_CASE(single_put),   TEST_CASE(test_decrypt_entries),
+                                            TEST_CASE(test_ttl),     TEST_CASE(test_eviction),
+                                            TEST_CASE(test_oversize), TEST_CASE(test_fork),
+                                            { NULL } };
+
+#else  // _WIN32
+
+struct test_case shm_cache_test_cases[] = { { NULL } };
+
+#endif  // _WIN32
@@ -20,6 +20,7 @@
 #include "testutil.h"
 
 #include <aws/common/encoding.h>
+#include <aws/common/thread.h>
 
 #include <aws/cryptosdk/cipher.h>
 #include <aws/cryptosdk/error.h>
@@ -326,6 +327,48 @@ static int t_serialize_privkey() {
     return 0;
 }
 
+static int t_start_from_key() {
+    FOREACH_ALGORITHM(props) {
+        struct aws_string *pub_key, *pub_key_2, *sig;
+        struct aws_cryptosdk_sig_ctx *ctx;
+        struct aws_cryptosdk_sig_key *priv_key, *verify_key;
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_start_keygen(&ctx, aws_default_allocator(), &pub_key, props));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_get_key(ctx, aws_default_allocator(), &priv_key));
+        aws_cryptosdk_sig_abort(ctx);
+
+        // Each context started from the key is independent of the others, and of the key
+        for (int i = 0; i < 2; i++) {
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_start_from_key(&ctx, aws_default_allocator(), priv_key));
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_get_pubkey(ctx, aws_default_allocator(), &pub_key_2));
+            TEST_ASSERT(aws_string_compare(pub_key, pub_key_2) == 0);
+            aws_string_destroy(pub_key_2);
+
+            if (i) aws_cryptosdk_sig_key_destroy(priv_key);
+
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_update(ctx, test_cursor));
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_finish(ctx, aws_default_allocator(), &sig));
+            TEST_ASSERT_SUCCESS(check_signature(props, true, pub_key, sig, &test_cursor));
+
+            // A key taken from a verification context starts verification contexts
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_verify_start(&ctx, aws_default_allocator(), pub_key, props));
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_get_key(ctx, aws_default_allocator(), &verify_key));
+            aws_cryptosdk_sig_abort(ctx);
+
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_start_from_key(&ctx, aws_default_allocator(), verify_key));
+            aws_cryptosdk_sig_key_destroy(verify_key);
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_update(ctx, test_cursor));
+            TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_verify_finish(ctx, sig));
+
+            aws_string_destroy(sig);
+        }
+
+        aws_string_destroy(pub_key);
+    }
+
+    return 0;
+}
+
 static int t_empty_signature() {
     FOREACH_ALGORITHM(props) {
         struct aws_string *pub_key, *sig;
@@ -492,6 +535,158 @@ static int t_trailing_garbage_with_o2i_ECPublicKey() {
     return 0;
 }
 
+/* More keys than the verification key cache holds, so that later keys evict earlier ones */
+#define NUM_CACHED_KEYS 40
+
+static int t_pubkey_cache() {
+    const struct aws_cryptosdk_alg_properties *p256        = aws_cryptosdk_alg_props(SIG_ALGORITHMS[0]);
+    const struct aws_cryptosdk_alg_properties *p384        = aws_cryptosdk_alg_props(SIG_ALGORITHMS[1]);
+    const struct aws_cryptosdk_alg_properties *p384_aes256 = aws_cryptosdk_alg_props(SIG_ALGORITHMS[2]);
+    struct aws_string *pub_keys[NUM_CACHED_KEYS], *sigs[NUM_CACHED_KEYS];
+
+    for (int i = 0; i < NUM_CACHED_KEYS; i++) {
+        TEST_ASSERT_SUCCESS(sign_message(p384, &pub_keys[i], &sigs[i], &test_cursor));
+    }
+
+    // The second pass finds some keys still cached and reloads the evicted ones
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < NUM_CACHED_KEYS; i++) {
+            const struct aws_string *other_sig = sigs[(i + 1) % NUM_CACHED_KEYS];
+
+            TEST_ASSERT_SUCCESS(check_signature(p384, true, pub_keys[i], sigs[i], &test_cursor));
+            TEST_ASSERT_SUCCESS(check_signature(p384, false, pub_keys[i], other_sig, &test_cursor));
+        }
+    }
+
+    // A key cached for one algorithm serves every algorithm on the same curve, but no other curve
+    TEST_ASSERT_SUCCESS(check_signature(p384_aes256, true, pub_keys[0], sigs[0], &test_cursor));
+    TEST_ASSERT_SUCCESS(check_signature(p256, false, pub_keys[0], sigs[0], &test_cursor));
+
+    for (int i = 0; i < NUM_CACHED_KEYS; i++) {
+        aws_string_destroy(pub_keys[i]);
+        aws_string_destroy(sigs[i]);
+    }
+
+    return 0;
+}
+
+#define NUM_SIGNING_THREADS 4
+
+struct signing_thread {
+    struct aws_thread thread;
+    int result;
+};
+
+static void run_signing_thread(void *arg) {
+    struct signing_thread *st = arg;
+
+    st->result = t_basic_signature_sign_verify();
+}
+
+static int t_shared_group_concurrent() {
+    struct signing_thread threads[NUM_SIGNING_THREADS];
+
+    // Every thread signs and verifies with the same cached curve groups
+    for (int i = 0; i < NUM_SIGNING_THREADS; i++) {
+        threads[i].result = -1;
+        TEST_ASSERT_SUCCESS(aws_thread_init(&threads[i].thread, aws_default_allocator()));
+        TEST_ASSERT_SUCCESS(
+            aws_thread_launch(&threads[i].thread, run_signing_thread, &threads[i], aws_default_thread_options()));
+    }
+
+    for (int i = 0; i < NUM_SIGNING_THREADS; i++) {
+        aws_thread_join(&threads[i].thread);
+        aws_thread_clean_up(&threads[i].thread);
+        TEST_ASSERT_INT_EQ(threads[i].result, 0);
+    }
+
+    return 0;
+}
+
+static int wait_for_pool(struct aws_cryptosdk_sig_key_pool *pool, size_t count) {
+    // Allow up to ten seconds for the refill thread to catch up
+    for (int i = 0; i < 10000 && aws_cryptosdk_sig_key_pool_available(pool) < count; i++) {
+        aws_thread_current_sleep(1000 * 1000);
+    }
+
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_sig_key_pool_available(pool), count);
+
+    return 0;
+}
+
+static int t_key_pool() {
+    struct aws_allocator *alloc = aws_default_allocator();
+
+    TEST_ASSERT_ADDR_NULL(
+        aws_cryptosdk_sig_key_pool_new(alloc, aws_cryptosdk_alg_props(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA256), 1));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
+    TEST_ASSERT_ADDR_NULL(aws_cryptosdk_sig_key_pool_new(
+        alloc, aws_cryptosdk_alg_props(ALG_AES256_GCM_IV12_TAG16_HKDF_SHA384_ECDSA_P384), 0));
+    TEST_ASSERT_INT_EQ(aws_last_error(), AWS_ERROR_INVALID_ARGUMENT);
+
+    FOREACH_ALGORITHM(props) {
+        struct aws_cryptosdk_sig_key_pool *pool = aws_cryptosdk_sig_key_pool_new(alloc, props, 2);
+        TEST_ASSERT_ADDR_NOT_NULL(pool);
+        TEST_ASSERT_SUCCESS(wait_for_pool(pool, 2));
+
+        struct aws_cryptosdk_sig_ctx *ctx;
+        struct aws_string *pub_key, *sig;
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_start_pooled(&ctx, alloc, &pub_key, props, pool));
+        TEST_ASSERT_ADDR_NOT_NULL(ctx);
+
+        // The public key serialized in advance is the one the context signs with
+        struct aws_string *ctx_pub_key;
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_get_pubkey(ctx, alloc, &ctx_pub_key));
+        TEST_ASSERT(aws_string_eq(pub_key, ctx_pub_key));
+        aws_string_destroy(ctx_pub_key);
+
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_update(ctx, test_cursor));
+        TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_finish(ctx, alloc, &sig));
+        TEST_ASSERT_SUCCESS(check_signature(props, true, pub_key, sig, &test_cursor));
+        aws_string_destroy(pub_key);
+        aws_string_destroy(sig);
+
+        // The refill thread replaces the key we took
+        TEST_ASSERT_SUCCESS(wait_for_pool(pool, 2));
+
+        aws_cryptosdk_sig_key_pool_destroy(pool);
+    }
+
+    return 0;
+}
+
+static int t_key_pool_fallback() {
+    struct aws_allocator *alloc                     = aws_default_allocator();
+    const struct aws_cryptosdk_alg_properties *p256 = aws_cryptosdk_alg_props(SIG_ALGORITHMS[0]);
+    const struct aws_cryptosdk_alg_properties *p384 = aws_cryptosdk_alg_props(SIG_ALGORITHMS[2]);
+    struct aws_cryptosdk_sig_key_pool *pool         = aws_cryptosdk_sig_key_pool_new(alloc, p256, 1);
+    struct aws_cryptosdk_sig_ctx *ctx;
+    struct aws_string *pub_key, *sig;
+
+    TEST_ASSERT_ADDR_NOT_NULL(pool);
+    TEST_ASSERT_SUCCESS(wait_for_pool(pool, 1));
+
+    // A different curve must not come from the pool
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_start_pooled(&ctx, alloc, &pub_key, p384, pool));
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_sig_key_pool_available(pool), 1);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_update(ctx, test_cursor));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_finish(ctx, alloc, &sig));
+    TEST_ASSERT_SUCCESS(check_signature(p384, true, pub_key, sig, &test_cursor));
+    aws_string_destroy(pub_key);
+    aws_string_destroy(sig);
+
+    // Nor does a NULL pool prevent signing
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_sig_sign_start_pooled(&ctx, alloc, NULL, p256, NULL));
+    TEST_ASSERT_ADDR_NOT_NULL(ctx);
+    aws_cryptosdk_sig_abort(ctx);
+
+    // Destroying a full pool releases its keys
+    aws_cryptosdk_sig_key_pool_destroy(pool);
+
+    return 0;
+}
+
 struct test_case signature_test_cases[] = {
     { "signature", "t_basic_signature_sign_verify", t_basic_signature_sign_verify },
     { "signature", "t_signature_length", t_signature_length },
@@ -501,10 +696,15 @@ struct test_case signature_test_cases[] = {
     { "signature", "t_wrong_data", t_wrong_data },
     { "signature", "t_partial_update", t_partial_update },
     { "signature", "t_serialize_privkey", t_serialize_privkey },
+    { "signature", "t_start_from_key", t_start_from_key },
     { "signature", "t_empty_signature", t_empty_signature },
     { "signature", "t_test_vectors", t_test_vectors },
     { "signature", "t_trailing_garbage", t_trailing_garbage },
     { "signature", "t_get_pubkey", t_get_pubkey },
     { "signature", "t_trailing_garbage_with_o2i_ECPublicKey", t_trailing_garbage_with_o2i_ECPublicKey },
+    { "signature", "t_pubkey_cache", t_pubkey_cache },
+    { "signature", "t_shared_group_concurrent", t_shared_group_concurrent },
+    { "signature", "t_key_pool", t_key_pool },
+    { "signature", "t_key_pool_fallback", t_key_pool_fallback },
     { NULL }
 };
@@ -0,0 +1,179 @@
+/*
+ * Copyright 2018 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"). You may not use
+ * this file except in compliance with the License. A copy of the License is
+ * located at
+ *
+ *     http://aws.amazon.com/apache2.0/
+ *
+ * or in the "license" file accompanying this file. This file is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <aws/cryptosdk/default_cmm.h>
+#include <aws/cryptosdk/error.h>
+#include <aws/cryptosdk/session.h>
+#include <aws/cryptosdk/timing.h>
+#include "bad_cmm.h"
+#include "testing.h"
+#include "zero_keyring.h"
+
+#include <string.h>
+
+static int histogram_buckets_and_percentiles() {
+    struct aws_cryptosdk_timing_sink *sink = aws_cryptosdk_timing_sink_new(aws_default_allocator());
+    struct aws_cryptosdk_timing_histogram hist;
+    TEST_ASSERT_ADDR_NOT_NULL(sink);
+
+    // 90 fast calls in [64, 128) ns, and 10 slow ones in [4096, 8192) ns, one of which failed
+    for (int i = 0; i < 90; i++) aws_cryptosdk_timing_sink_record(sink, AWS_CRYPTOSDK_TIMED_ON_ENCRYPT, 100, 0);
+    for (int i = 0; i < 10; i++) {
+        aws_cryptosdk_timing_sink_record(
+            sink, AWS_CRYPTOSDK_TIMED_ON_ENCRYPT, 5000, i ? AWS_ERROR_SUCCESS : AWS_CRYPTOSDK_ERR_KMS_FAILURE);
+    }
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_timing_sink_get(sink, AWS_CRYPTOSDK_TIMED_ON_ENCRYPT, &hist));
+    TEST_ASSERT_INT_EQ(hist.calls, 100);
+    TEST_ASSERT_INT_EQ(hist.errors, 1);
+    TEST_ASSERT_INT_EQ(hist.total_ns, 90 * 100 + 10 * 5000);
+    TEST_ASSERT_INT_EQ(hist.max_ns, 5000);
+    TEST_ASSERT_INT_EQ(hist.buckets[6], 90);
+    TEST_ASSERT_INT_EQ(hist.buckets[12], 10);
+
+    // Percentiles report the top of their bucket, but never more than the slowest call
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_timing_histogram_percentile(&hist, 50), 127);
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_timing_histogram_percentile(&hist, 90), 127);
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_timing_histogram_percentile(&hist, 91), 5000);
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_timing_histogram_percentile(&hist, 100), 5000);
+
+    // Other operations are kept apart, and calls too slow for the histogram land in the last bucket
+    aws_cryptosdk_timing_sink_record(sink, AWS_CRYPTOSDK_TIMED_DECRYPT_MATERIALS, UINT64_MAX, 0);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_timing_sink_get(sink, AWS_CRYPTOSDK_TIMED_DECRYPT_MATERIALS, &hist));
+    TEST_ASSERT_INT_EQ(hist.calls, 1);
+    TEST_ASSERT_INT_EQ(hist.buckets[AWS_CRYPTOSDK_TIMING_BUCKETS - 1], 1);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_timing_sink_get(sink, AWS_CRYPTOSDK_TIMED_ON_DECRYPT, &hist));
+    TEST_ASSERT_INT_EQ(hist.calls, 0);
+    TEST_ASSERT_INT_EQ(aws_cryptosdk_timing_histogram_percentile(&hist, 99), 0);
+
+    TEST_ASSERT_ERROR(
+        AWS_ERROR_INVALID_ARGUMENT, aws_cryptosdk_timing_sink_get(sink, AWS_CRYPTOSDK_TIMED_OP_COUNT, &hist));
+
+    aws_cryptosdk_timing_sink_destroy(sink);
+    return 0;
+}
+
+static int run_session(
+    struct aws_cryptosdk_cmm *cmm,
+    enum aws_cryptosdk_mode mode,
+    uint8_t *out,
+    size_t out_cap,
+    size_t *out_len,
+    const uint8_t *in,
+    size_t in_len) {
+    struct aws_cryptosdk_session *session = aws_cryptosdk_session_new_from_cmm(aws_default_allocator(), mode, cmm);
+    size_t in_read;
+    TEST_ASSERT_ADDR_NOT_NULL(session);
+
+    if (mode == AWS_CRYPTOSDK_ENCRYPT) TEST_ASSERT_SUCCESS(aws_cryptosdk_session_set_message_size(session, in_len));
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_session_process(session, out, out_cap, out_len, in, in_len, &in_read));
+    TEST_ASSERT(aws_cryptosdk_session_is_done(session));
+
+    aws_cryptosdk_session_destroy(session);
+    return 0;
+}
+
+static int decorators_time_each_layer() {
+    static const uint8_t pt[] = "Time every layer of this message";
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_timing_histogram hist;
+    uint8_t ct[1024], decrypted[sizeof(pt)];
+    size_t ct_len, pt_len;
+
+    struct aws_cryptosdk_timing_sink *kr_sink  = aws_cryptosdk_timing_sink_new(alloc);
+    struct aws_cryptosdk_timing_sink *cmm_sink = aws_cryptosdk_timing_sink_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(kr_sink);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm_sink);
+
+    struct aws_cryptosdk_keyring *zero_kr = aws_cryptosdk_zero_keyring_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(zero_kr);
+    struct aws_cryptosdk_keyring *kr = aws_cryptosdk_timing_keyring_new(alloc, zero_kr, kr_sink);
+    TEST_ASSERT_ADDR_NOT_NULL(kr);
+    aws_cryptosdk_keyring_release(zero_kr);
+    struct aws_cryptosdk_cmm *default_cmm = aws_cryptosdk_default_cmm_new(alloc, kr);
+    TEST_ASSERT_ADDR_NOT_NULL(default_cmm);
+    aws_cryptosdk_keyring_release(kr);
+    struct aws_cryptosdk_cmm *cmm = aws_cryptosdk_timing_cmm_new(alloc, default_cmm, cmm_sink);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+    aws_cryptosdk_cmm_release(default_cmm);
+
+    TEST_ASSERT_SUCCESS(run_session(cmm, AWS_CRYPTOSDK_ENCRYPT, ct, sizeof(ct), &ct_len, pt, sizeof(pt)));
+    TEST_ASSERT_SUCCESS(
+        run_session(cmm, AWS_CRYPTOSDK_DECRYPT, decrypted, sizeof(decrypted), &pt_len, ct, ct_len));
+    TEST_ASSERT_INT_EQ(pt_len, sizeof(pt));
+    TEST_ASSERT(!memcmp(decrypted, pt, sizeof(pt)));
+
+    // Each sink sees only the calls made to its own layer
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_timing_sink_get(kr_sink, AWS_CRYPTOSDK_TIMED_ON_ENCRYPT, &hist));
+    TEST_ASSERT_INT_EQ(hist.calls, 1);
+    TEST_ASSERT_INT_EQ(hist.errors, 0);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_timing_sink_get(kr_sink, AWS_CRYPTOSDK_TIMED_ON_DECRYPT, &hist));
+    TEST_ASSERT_INT_EQ(hist.calls, 1);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_timing_sink_get(kr_sink, AWS_CRYPTOSDK_TIMED_GENERATE_ENC_MATERIALS, &hist));
+    TEST_ASSERT_INT_EQ(hist.calls, 0);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_timing_sink_get(cmm_sink, AWS_CRYPTOSDK_TIMED_GENERATE_ENC_MATERIALS, &hist));
+    TEST_ASSERT_INT_EQ(hist.calls, 1);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_timing_sink_get(cmm_sink, AWS_CRYPTOSDK_TIMED_DECRYPT_MATERIALS, &hist));
+    TEST_ASSERT_INT_EQ(hist.calls, 1);
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_timing_sink_get(cmm_sink, AWS_CRYPTOSDK_TIMED_ON_ENCRYPT, &hist));
+    TEST_ASSERT_INT_EQ(hist.calls, 0);
+
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_timing_sink_destroy(kr_sink);
+    aws_cryptosdk_timing_sink_destroy(cmm_sink);
+    return 0;
+}
+
+static void record_async_error(struct aws_cryptosdk_enc_materials *materials, int error_code, void *user_data) {
+    (void)materials;
+    *(int *)user_data = error_code;
+}
+
+static int failures_are_counted() {
+    struct aws_allocator *alloc = aws_default_allocator();
+    struct aws_cryptosdk_timing_histogram hist;
+    struct aws_cryptosdk_enc_materials *materials = NULL;
+    struct aws_cryptosdk_enc_request request      = { .alloc = alloc };
+    int async_error                               = AWS_ERROR_SUCCESS;
+
+    struct aws_cryptosdk_timing_sink *sink = aws_cryptosdk_timing_sink_new(alloc);
+    TEST_ASSERT_ADDR_NOT_NULL(sink);
+    struct aws_cryptosdk_cmm null_cmm = aws_cryptosdk_null_cmm();
+    struct aws_cryptosdk_cmm *cmm     = aws_cryptosdk_timing_cmm_new(alloc, &null_cmm, sink);
+    TEST_ASSERT_ADDR_NOT_NULL(cmm);
+
+    // The inner CMM's error comes through, and is counted, whether called directly or asynchronously
+    TEST_ASSERT_ERROR(AWS_ERROR_UNIMPLEMENTED, aws_cryptosdk_cmm_generate_enc_materials(cmm, &materials, &request));
+    TEST_ASSERT_SUCCESS(
+        aws_cryptosdk_cmm_generate_enc_materials_async(cmm, &request, record_async_error, &async_error));
+    TEST_ASSERT_INT_EQ(async_error, AWS_ERROR_UNIMPLEMENTED);
+
+    TEST_ASSERT_SUCCESS(aws_cryptosdk_timing_sink_get(sink, AWS_CRYPTOSDK_TIMED_GENERATE_ENC_MATERIALS, &hist));
+    TEST_ASSERT_INT_EQ(hist.calls, 2);
+    TEST_ASSERT_INT_EQ(hist.errors, 2);
+
+    // The inner CMM keeps the reference it was created with, so its broken destroy is never called
+    aws_cryptosdk_cmm_release(cmm);
+    aws_cryptosdk_timing_sink_destroy(sink);
+    return 0;
+}
+
+#define TEST_CASE(name) \
+    { "timing", #name, name }
+struct test_case timing_test_cases[] = { TEST_CASE(histogram_buckets_and_percentiles),
+                                         TEST_CASE(decorators_time_each_layer),
+                                         TEST_CASE(failures_are_counted),
+                                         { NULL } };
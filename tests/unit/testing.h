@@ -37,8 +37,18 @@ extern struct test_case trailing_sig_test_cases[];
 extern struct test_case raw_rsa_keyring_decrypt_test_cases[];
 extern struct test_case raw_rsa_keyring_encrypt_test_cases[];
 extern struct test_case local_cache_test_cases[];
+extern struct test_case shm_cache_test_cases[];
+extern struct test_case remote_cache_test_cases[];
 extern struct test_case caching_cmm_test_cases[];
 extern struct test_case keyring_trace_test_cases[];
+extern struct test_case session_pool_test_cases[];
+extern struct test_case pipeline_test_cases[];
+extern struct test_case alloc_stats_test_cases[];
+extern struct test_case timing_test_cases[];
+extern struct test_case pkcs11_keyring_test_cases[];
+extern struct test_case rewrap_test_cases[];
+extern struct test_case kms_async_keyring_test_cases[];
+extern struct test_case channel_handler_test_cases[];
 extern struct test_case version_test_cases[];
 
 #define TEST_ASSERT(cond)                                                                        \